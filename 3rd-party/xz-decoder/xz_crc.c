@@ -0,0 +1,286 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * The CRC32 and CRC64 of xz-embedded, built in place of its xz_crc32.c and xz_crc64.c. Their tables still serve
+ * short buffers and CPUs without the instructions used here: long buffers are folded 64 bytes at a time by
+ * carry-less multiplication on x86-64 (PCLMULQDQ), or go through the CRC32 instructions of ARMv8. Which way they
+ * go is settled by xz_crc32_init() and xz_crc64_init(), from what the CPU has.
+ */
+
+#include <xz.h>
+
+#include <string.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define XZ_CRC_CLMUL 1
+#include <cpuid.h>
+#include <immintrin.h>
+#elif defined(__aarch64__) && (defined(__GNUC__) || defined(__clang__))
+#define XZ_CRC_ARMV8 1
+#if defined(__linux__)
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
+#endif
+
+static uint32_t crc32_table[256];
+static uint64_t crc64_table[256];
+
+/* Both take and return the CRC register as it is, without the inversions xz applies around it */
+static uint32_t crc32_bytes(const uint8_t *buf, size_t size, uint32_t crc)
+{
+	while (size--)
+		crc = crc32_table[*buf++ ^ (crc & 0xFF)] ^ (crc >> 8);
+
+	return crc;
+}
+
+static uint64_t crc64_bytes(const uint8_t *buf, size_t size, uint64_t crc)
+{
+	while (size--)
+		crc = crc64_table[*buf++ ^ (crc & 0xFF)] ^ (crc >> 8);
+
+	return crc;
+}
+
+#ifdef XZ_CRC_CLMUL
+/*
+ * A 16-byte block, loaded little-endian, holds the coefficients of x^127 down to x^0 from its lowest bit up, as
+ * the CRC is bit-reflected. Each block is folded into one further on by multiplying its halves by x^(d+63) and
+ * x^(d-1) modulo the polynomial, for a distance of d bits; the one lost in either power makes up for the product of
+ * two reflected 64-bit values coming out a bit short. Whatever block is left has the CRC of everything folded in.
+ */
+struct fold_constants {
+	__m128i by_64_bytes;
+	__m128i by_48_bytes;
+	__m128i by_32_bytes;
+	__m128i by_16_bytes;
+};
+
+static struct fold_constants crc32_constants;
+static struct fold_constants crc64_constants;
+static int crc32_folding;
+static int crc64_folding;
+
+/* x^power modulo the polynomial of the given width, in its normal, unreflected form */
+static uint64_t power_of_x(unsigned int power, uint64_t polynomial, unsigned int width)
+{
+	const uint64_t top = (uint64_t)1 << (width - 1);
+	const uint64_t mask = width == 64 ? ~(uint64_t)0 : ((uint64_t)1 << width) - 1;
+	uint64_t remainder = 1;
+
+	while (power--) {
+		const int carry = (remainder & top) != 0;
+		remainder = (remainder << 1) & mask;
+		if (carry)
+			remainder ^= polynomial;
+	}
+
+	return remainder;
+}
+
+static uint64_t reflect(uint64_t value)
+{
+	uint64_t reflected = 0;
+	int i;
+
+	for (i = 0; i < 64; ++i, value >>= 1)
+		reflected = (reflected << 1) | (value & 1);
+
+	return reflected;
+}
+
+static __m128i fold_by(unsigned int bits, uint64_t polynomial, unsigned int width)
+{
+	return _mm_set_epi64x((long long)reflect(power_of_x(bits - 1, polynomial, width)),
+			      (long long)reflect(power_of_x(bits + 63, polynomial, width)));
+}
+
+static struct fold_constants make_fold_constants(uint64_t polynomial, unsigned int width)
+{
+	struct fold_constants constants;
+
+	constants.by_64_bytes = fold_by(512, polynomial, width);
+	constants.by_48_bytes = fold_by(384, polynomial, width);
+	constants.by_32_bytes = fold_by(256, polynomial, width);
+	constants.by_16_bytes = fold_by(128, polynomial, width);
+	return constants;
+}
+
+static int has_clmul(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_PCLMUL);
+}
+
+__attribute__((target("pclmul,sse2")))
+static __m128i fold(__m128i block, __m128i constants, __m128i onto)
+{
+	const __m128i low = _mm_clmulepi64_si128(block, constants, 0x00);
+	const __m128i high = _mm_clmulepi64_si128(block, constants, 0x11);
+
+	return _mm_xor_si128(_mm_xor_si128(low, high), onto);
+}
+
+/*
+ * Folds the whole 16-byte blocks of buf, at least four of them, into the one written to folded, which has the same
+ * CRC once the CRC register is taken as zero. Returns how many bytes were folded.
+ */
+__attribute__((target("pclmul,sse2")))
+static size_t fold_blocks(const uint8_t *buf, size_t size, uint64_t crc, const struct fold_constants *constants,
+			  uint8_t folded[16])
+{
+	const uint8_t *const end = buf + (size & ~(size_t)15);
+	__m128i lanes[4];
+	__m128i block;
+	int i;
+
+	for (i = 0; i < 4; ++i)
+		lanes[i] = _mm_loadu_si128((const __m128i *)(buf + 16 * i));
+	lanes[0] = _mm_xor_si128(lanes[0], _mm_cvtsi64_si128((long long)crc));
+	buf += 64;
+
+	for (; end - buf >= 64; buf += 64)
+		for (i = 0; i < 4; ++i)
+			lanes[i] = fold(lanes[i], constants->by_64_bytes,
+					_mm_loadu_si128((const __m128i *)(buf + 16 * i)));
+
+	block = fold(lanes[0], constants->by_48_bytes, lanes[3]);
+	block = fold(lanes[1], constants->by_32_bytes, block);
+	block = fold(lanes[2], constants->by_16_bytes, block);
+
+	for (; buf < end; buf += 16)
+		block = fold(block, constants->by_16_bytes, _mm_loadu_si128((const __m128i *)buf));
+
+	_mm_storeu_si128((__m128i *)folded, block);
+	return size & ~(size_t)15;
+}
+#endif
+
+#ifdef XZ_CRC_ARMV8
+static int crc32_instructions;
+
+static int has_crc32_instructions(void)
+{
+#if defined(__linux__)
+	return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#elif defined(__APPLE__)
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+static uint32_t crc32_armv8(const uint8_t *buf, size_t size, uint32_t crc)
+{
+	uint64_t word;
+
+	for (; size >= 8; buf += 8, size -= 8) {
+		memcpy(&word, buf, sizeof(word));
+		__asm__(".arch_extension crc\n\tcrc32x %w0, %w0, %x1" : "+r"(crc) : "r"(word));
+	}
+
+	for (; size; ++buf, --size)
+		__asm__(".arch_extension crc\n\tcrc32b %w0, %w0, %w1" : "+r"(crc) : "r"((uint32_t)*buf));
+
+	return crc;
+}
+#endif
+
+XZ_EXTERN void xz_crc32_init(void)
+{
+	const uint32_t poly = 0xEDB88320;
+	uint32_t i, j, r;
+
+	for (i = 0; i < 256; ++i) {
+		r = i;
+		for (j = 0; j < 8; ++j)
+			r = (r >> 1) ^ (poly & ~((r & 1) - 1));
+
+		crc32_table[i] = r;
+	}
+
+#ifdef XZ_CRC_CLMUL
+	crc32_constants = make_fold_constants(0x04C11DB7, 32);
+	crc32_folding = has_clmul();
+#endif
+#ifdef XZ_CRC_ARMV8
+	crc32_instructions = has_crc32_instructions();
+#endif
+}
+
+XZ_EXTERN uint32_t xz_crc32(const uint8_t *buf, size_t size, uint32_t crc)
+{
+	crc = ~crc;
+
+#ifdef XZ_CRC_CLMUL
+	if (crc32_folding && size >= 64) {
+		uint8_t folded[16];
+		const size_t done = fold_blocks(buf, size, crc, &crc32_constants, folded);
+
+		crc = crc32_bytes(folded, sizeof(folded), 0);
+		buf += done;
+		size -= done;
+	}
+#endif
+#ifdef XZ_CRC_ARMV8
+	if (crc32_instructions)
+		return ~crc32_armv8(buf, size, crc);
+#endif
+
+	return ~crc32_bytes(buf, size, crc);
+}
+
+XZ_EXTERN void xz_crc64_init(void)
+{
+	const uint64_t poly = 0xC96C5795D7870F42ULL;
+	uint32_t i, j;
+	uint64_t r;
+
+	for (i = 0; i < 256; ++i) {
+		r = i;
+		for (j = 0; j < 8; ++j)
+			r = (r >> 1) ^ (poly & ~((r & 1) - 1));
+
+		crc64_table[i] = r;
+	}
+
+#ifdef XZ_CRC_CLMUL
+	crc64_constants = make_fold_constants(0x42F0E1EBA9EA3693ULL, 64);
+	crc64_folding = has_clmul();
+#endif
+}
+
+XZ_EXTERN uint64_t xz_crc64(const uint8_t *buf, size_t size, uint64_t crc)
+{
+	crc = ~crc;
+
+#ifdef XZ_CRC_CLMUL
+	if (crc64_folding && size >= 64) {
+		uint8_t folded[16];
+		const size_t done = fold_blocks(buf, size, crc, &crc64_constants, folded);
+
+		crc = crc64_bytes(folded, sizeof(folded), 0);
+		buf += done;
+		size -= done;
+	}
+#endif
+
+	return ~crc64_bytes(buf, size, crc);
+}
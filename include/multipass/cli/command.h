@@ -23,6 +23,7 @@
 #include <multipass/format.h>
 #include <multipass/rpc/multipass.grpc.pb.h>
 #include <multipass/terminal.h>
+#include <multipass/tracing.h>
 #include <multipass/utils.h>
 
 #include <QLocalSocket>
@@ -75,7 +76,15 @@ protected:
 
         auto rpc_method = std::bind(rpc_func, stub, std::placeholders::_1, std::placeholders::_2);
 
+        // The daemon's spans for this call join the client's trace
+        auto span = Tracer::instance().span("client " + name());
         grpc::ClientContext context;
+        if (span.context().valid())
+        {
+            context.AddMetadata(Tracer::trace_id_metadata_key, span.context().trace_id);
+            context.AddMetadata(Tracer::span_id_metadata_key, span.context().span_id);
+        }
+
         std::unique_ptr<grpc::ClientReader<ReplyType>> reader = rpc_method(&context, request);
 
         while (reader->Read(&reply))
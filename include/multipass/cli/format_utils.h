@@ -25,7 +25,9 @@
 #include <fmt/format.h>
 
 #include <algorithm>
+#include <ostream>
 #include <string>
+#include <vector>
 
 namespace multipass
 {
@@ -40,7 +42,15 @@ Formatter* formatter_for(const std::string& format);
 template <typename Instances>
 Instances sorted(const Instances& instances);
 
+// The same order as sorted, without copying the entries
+template <typename Instances>
+std::vector<const typename Instances::value_type*> sorted_view(const Instances& instances);
+
 void filter_aliases(google::protobuf::RepeatedPtrField<multipass::FindReply_AliasInfo>& aliases);
+
+// How much output streaming formatters gather before handing it over, so that long outputs never sit whole in memory
+constexpr std::size_t output_chunk_size = 64 * 1024;
+void flush_to(std::ostream& out, fmt::memory_buffer& buf, std::size_t threshold = 0);
 } // namespace format
 }
 
@@ -64,6 +74,30 @@ Instances multipass::format::sorted(const Instances& instances)
     return ret;
 }
 
+template <typename Instances>
+std::vector<const typename Instances::value_type*> multipass::format::sorted_view(const Instances& instances)
+{
+    std::vector<const typename Instances::value_type*> ret;
+    ret.reserve(instances.size());
+    for (const auto& instance : instances)
+        ret.push_back(&instance);
+
+    if (ret.empty())
+        return ret;
+
+    const auto petenv_name = Settings::instance().get(petenv_key).toStdString();
+    std::sort(std::begin(ret), std::end(ret), [&petenv_name](const auto* a, const auto* b) {
+        if (a->name() == petenv_name)
+            return true;
+        else if (b->name() == petenv_name)
+            return false;
+        else
+            return a->name() < b->name();
+    });
+
+    return ret;
+}
+
 namespace fmt
 {
 template <>
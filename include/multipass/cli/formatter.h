@@ -22,6 +22,7 @@
 
 #include <multipass/cli/client_platform.h>
 
+#include <ostream>
 #include <string>
 
 namespace multipass
@@ -36,6 +37,20 @@ public:
     virtual std::string format(const ListReply& reply) const = 0;
     virtual std::string format(const FindReply& reply) const = 0;
 
+    // Formatters that can write their output as they go override these, to spare building it whole first
+    virtual void format_to(std::ostream& out, const InfoReply& reply) const
+    {
+        out << format(reply);
+    }
+    virtual void format_to(std::ostream& out, const ListReply& reply) const
+    {
+        out << format(reply);
+    }
+    virtual void format_to(std::ostream& out, const FindReply& reply) const
+    {
+        out << format(reply);
+    }
+
 protected:
     Formatter() = default;
     Formatter(const Formatter&) = delete;
@@ -28,6 +28,10 @@ public:
     std::string format(const InfoReply& info) const override;
     std::string format(const ListReply& list) const override;
     std::string format(const FindReply& list) const override;
+
+    void format_to(std::ostream& out, const InfoReply& info) const override;
+    void format_to(std::ostream& out, const ListReply& list) const override;
+    void format_to(std::ostream& out, const FindReply& list) const override;
 };
 }
 #endif // MULTIPASS_TABLE_FORMATTER
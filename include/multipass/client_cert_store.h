@@ -19,8 +19,11 @@
 #define MULTIPASS_CLIENT_CERT_STORE_H
 
 #include <multipass/cert_store.h>
+#include <multipass/optional.h>
 #include <multipass/path.h>
 
+#include <mutex>
+
 namespace multipass
 {
 class ClientCertStore : public CertStore
@@ -32,6 +35,8 @@ public:
 
 private:
     Path cert_dir;
+    mutable std::mutex chain_mutex;
+    mutable optional<std::string> chain; // as last read from disk, until a certificate is added
 };
 } // namespace multipass
 #endif // MULTIPASS_CLIENT_CERT_STORE_H
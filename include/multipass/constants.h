@@ -28,11 +28,62 @@ constexpr auto min_cpu_cores = "1";
 constexpr auto default_memory_size = "1G";
 constexpr auto default_disk_size = "5G";
 constexpr auto default_cpu_cores = min_cpu_cores;
+constexpr auto default_disk_profile = "default"; // host page cache; "native" and "io_uring" bypass it on an iothread
+constexpr auto native_disk_profile = "native";
+constexpr auto io_uring_disk_profile = "io_uring";
+constexpr auto default_mount_profile = "default"; // sshfs's own caching; "dev" caches briefly, "strict" not at all
+constexpr auto strict_mount_profile = "strict";
+constexpr auto dev_mount_profile = "dev";
+constexpr auto read_only_mount_profile = "read-only-aggressive"; // the host's files are not expected to change
+constexpr auto write_back_mount_profile = "write-back"; // writes land in the background, for scratch output
+constexpr auto default_resource_class = "default"; // CPU and I/O shared evenly; "latency" gets more, "batch" less
+constexpr auto latency_resource_class = "latency";
+constexpr auto batch_resource_class = "batch";
+constexpr auto firmware_boot_profile = "firmware"; // through firmware and GRUB; the others boot the kernel directly
+constexpr auto kernel_boot_profile = "kernel";
+constexpr auto q35_boot_profile = "q35";         // on q35, with only the devices instances use
+constexpr auto microvm_boot_profile = "microvm"; // on microvm, idem
 constexpr auto home_automount_dir = "Home";
 constexpr auto driver_env_var = "MULTIPASS_VM_DRIVER";
+constexpr auto trace_file_env_var = "MULTIPASS_TRACE_FILE";     // where spans go, in Chrome's trace-event format
+constexpr auto trace_parent_env_var = "MULTIPASS_TRACE_PARENT"; // the span a helper process was started under
 constexpr auto petenv_key = "client.primary-name";     // This will eventually be moved to some dynamic settings schema
 constexpr auto driver_key = "local.driver";            // idem
 constexpr auto autostart_key = "client.gui.autostart"; // idem
+
+constexpr auto image_overlays_key = "local.image-overlays"; // instances get qcow2 overlays on cached images, not copies
+constexpr auto image_compression_key = "local.image-compression"; // images converted to qcow2 are zstd-compressed
+constexpr auto warm_pool_key = "local.warm-pool";           // pre-booted instances per image, e.g. "default=2,focal=1"
+constexpr auto prefetch_images_key = "local.prefetch-images"; // images kept cached ahead of launches, e.g. "lts,devel"
+constexpr auto memory_templates_key = "local.memory-templates"; // images launched from a booted memory (qemu)
+constexpr auto parallel_operations_key = "local.parallel-operations"; // instances stopped, suspended, etc. at once
+constexpr auto image_peers_key = "local.image-peers"; // daemons asked for images first, e.g. "http://10.0.0.2:50052"
+constexpr auto image_sharing_port_key = "local.image-sharing-port"; // where cached images are served to peers, 0 = not
+constexpr auto image_sharing_address_key = "local.image-sharing-address"; // the interface they are served on
+// Another daemon's cache directory, only ever read from, whose images back instances rather than being downloaded
+// again. Its images must outlive the instances they back
+constexpr auto shared_image_cache_key = "local.shared-image-cache";
+constexpr auto image_cache_size_key = "local.image-cache-size"; // least recently used images go past it; 0 = by age
+constexpr auto streaming_launch_key = "local.streaming-launch"; // uncached images boot while they download (qemu)
+constexpr auto density_mode_key = "local.density-mode"; // instances' identical pages are merged (qemu)
+constexpr auto network_shards_key = "local.network-shards"; // bridges, each with a /24 and a dnsmasq (qemu)
+constexpr auto keep_running_key = "local.keep-running"; // instances run on through daemon restarts (qemu)
+constexpr auto boot_profile_key = "local.boot-profile"; // how instances boot, e.g. "kernel" to skip firmware (qemu)
+constexpr auto cpu_overcommit_key = "local.cpu-overcommit"; // vCPUs running per host CPU, "0" for no limit
+constexpr auto memory_overcommit_key = "local.memory-overcommit"; // idem, for memory
+constexpr auto disk_overcommit_key = "local.disk-overcommit"; // image sizes per byte of the instances' filesystem
+constexpr auto idle_suspend_key = "local.idle-suspend"; // minutes idle before an instance is suspended, "0" for never
+constexpr auto download_bandwidth_key = "local.download-bandwidth"; // bytes a second downloads share, e.g. "20M"
+constexpr auto scrub_bandwidth_key = "local.scrub-bandwidth"; // bytes a second scrubs read, "0" for never scrubbing
+constexpr auto download_connections_key = "local.download-connections"; // most connections to one image host
+constexpr auto ssh_crypto_key = "local.ssh-crypto"; // "auto", "aes-gcm" or "chacha20" for host/guest ssh traffic
+constexpr auto rpc_threads_key = "local.rpc-threads"; // most gRPC server threads, each busy for a whole call
+constexpr auto rpc_streams_key = "local.rpc-streams"; // most calls open at once on one client connection
+constexpr auto rpc_limits_key = "local.rpc-limits";   // most concurrent calls per method, e.g. "launch=4,mount=2"
+constexpr auto fast_exec_key = "client.fast-exec"; // exec remembers how to reach instances instead of asking each time
+constexpr auto log_overflow_key = "local.log-overflow"; // "drop" or "block" when the daemon's log cannot keep up
+constexpr auto mount_serving_key = "local.mount-serving"; // "process" for an sshfs_server per mount, or "daemon"
+constexpr auto package_cache_port_key = "local.package-cache-port"; // where guests' apt downloads are cached, 0 = not
 } // namespace multipass
 
 #endif // MULTIPASS_CONSTANTS_H
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_DOWNLOAD_SCHEDULER_H
+#define MULTIPASS_DOWNLOAD_SCHEDULER_H
+
+#include <QString>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+
+namespace multipass
+{
+enum class DownloadPriority
+{
+    interactive, // someone is waiting on it, e.g. a launch
+    background   // image refreshes and prefetches
+};
+
+// Shares the link among downloads: each host gets so many connections and all of them together so many bytes a
+// second. Interactive downloads come first for connections, and background ones slow to a trickle while any
+// interactive one runs. The connections of background downloads running meanwhile are not counted against the
+// interactive ones, so that a launch preempts a refresh already under way instead of queueing behind it
+class DownloadScheduler
+{
+public:
+    // Held for the life of a download
+    class Ticket
+    {
+    public:
+        ~Ticket();
+
+        int connections() const;
+
+        // Takes the bytes just received out of the allowance, waiting until they fit. Returns whether it waited
+        bool account(qint64 bytes);
+
+    private:
+        friend class DownloadScheduler;
+        Ticket(DownloadScheduler& scheduler, const QString& host, DownloadPriority priority, int connections);
+
+        DownloadScheduler& scheduler;
+        const QString host;
+        const DownloadPriority priority;
+        const int granted;
+    };
+
+    // Zero stands for no limit
+    void set_limits(qint64 bytes_per_second, int connections_per_host);
+
+    // Waits for a first connection to the host, then takes as many of those wanted as are free. Gives up, returning
+    // null, once abort is set
+    std::unique_ptr<Ticket> admit(const QString& host, DownloadPriority priority, int connections_wanted,
+                                  const std::atomic_bool& abort);
+
+private:
+    struct Host
+    {
+        int connections{0};
+        int interactive_connections{0};
+        int interactive_waiting{0};
+    };
+
+    void release(const QString& host, DownloadPriority priority, int connections);
+    bool throttle(DownloadPriority priority, qint64 bytes);
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    qint64 bytes_per_second{0};
+    int connections_per_host{0};
+    std::map<QString, Host> hosts;
+    int interactive_downloads{0};
+
+    // Where each kind of traffic has booked the link up to, as on a timeline shared by its downloads
+    std::chrono::steady_clock::time_point link_booked_until;
+    std::chrono::steady_clock::time_point trickle_booked_until;
+};
+} // namespace multipass
+#endif // MULTIPASS_DOWNLOAD_SCHEDULER_H
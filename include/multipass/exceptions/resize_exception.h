@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_RESIZE_EXCEPTION_H
+#define MULTIPASS_RESIZE_EXCEPTION_H
+
+#include <multipass/memory_size.h>
+
+#include <stdexcept>
+#include <string>
+
+namespace multipass
+{
+// A resize that fell short, along with what the instance took on before it did
+class ResizeException : public std::runtime_error
+{
+public:
+    ResizeException(const std::string& what, int num_cores, const MemorySize& mem_size, const MemorySize& disk_space)
+        : runtime_error(what), cores(num_cores), memory(mem_size), disk(disk_space)
+    {
+    }
+
+    int num_cores() const
+    {
+        return cores;
+    }
+
+    MemorySize mem_size() const
+    {
+        return memory;
+    }
+
+    MemorySize disk_space() const
+    {
+        return disk;
+    }
+
+private:
+    const int cores;
+    const MemorySize memory;
+    const MemorySize disk;
+};
+} // namespace multipass
+#endif // MULTIPASS_RESIZE_EXCEPTION_H
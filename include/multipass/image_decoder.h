@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_IMAGE_DECODER_H
+#define MULTIPASS_IMAGE_DECODER_H
+
+#include <multipass/path.h>
+#include <multipass/progress_monitor.h>
+
+#include <multipass/auto_join_thread.h>
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+#include <QByteArray>
+
+namespace multipass
+{
+// Decodes a compressed image file into a sparse one
+class ImageDecoder
+{
+public:
+    using UPtr = std::unique_ptr<ImageDecoder>;
+    virtual ~ImageDecoder() = default;
+
+    virtual void decode_to(const Path& decoded_file_path, const ProgressMonitor& monitor) = 0;
+};
+
+// Decodes a compressed stream that is fed to it piecewise, e.g. while it is being downloaded, on a worker thread
+class PipelinedImageDecoder
+{
+public:
+    using UPtr = std::unique_ptr<PipelinedImageDecoder>;
+    virtual ~PipelinedImageDecoder() = default;
+
+    // Queues a chunk of compressed data, blocking while the worker is too far behind. Never throws; a decoding
+    // error is reported by finish().
+    virtual void feed(const QByteArray& chunk) = 0;
+    // Waits until everything fed so far is decoded and throws if decoding failed or the stream is incomplete
+    virtual void finish() = 0;
+};
+
+// The queue and worker thread behind the pipelined decoders. The worker runs the decoder given, which takes its
+// input from next_chunk: that blocks until there is a chunk, and returns false once the input is done
+class DecodePipeline
+{
+public:
+    using ChunkSource = std::function<bool(QByteArray& chunk)>;
+    using Decoder = std::function<void(const ChunkSource& next_chunk)>;
+
+    explicit DecodePipeline(Decoder decoder);
+    ~DecodePipeline(); // drops what is still queued
+
+    void feed(const QByteArray& chunk);
+    void finish(); // waits for the decoder to return, and rethrows what it threw
+
+private:
+    void work();
+    bool next_chunk(QByteArray& chunk);
+
+    const Decoder decoder;
+    std::mutex queue_mutex;
+    std::condition_variable queue_cv;
+    std::deque<QByteArray> queue;
+    bool input_done{false};
+    bool worker_done{false};
+    std::exception_ptr decode_error;
+    AutoJoinThread worker;
+};
+
+// Decodes count independent parts of an image, e.g. its blocks or frames, on as many threads as there are cores, or
+// max_threads when that is fewer and not 0. Progress is reported from the calling thread only, as the monitor is not
+// meant to be called concurrently
+void decode_in_parallel(std::size_t count, const std::function<void(std::size_t part)>& decode_part,
+                        const ProgressMonitor& monitor, std::size_t max_threads = 0);
+
+// What the parts decoded at once may hold in memory between them, which caps the threads decoding them
+constexpr unsigned long long parallel_decode_budget = 512 * 1024 * 1024;
+// The max_threads for parts that each hold up to part_footprint bytes while decoded; never fewer than one
+std::size_t threads_within_decode_budget(unsigned long long part_footprint);
+
+// Compressed images are told by their suffix, which the decoded ones go without
+bool is_compressed_image(const QString& image_path);
+QString decoded_image_path(const QString& compressed_image_path);
+
+// Both throw for a file that is not a compressed image
+ImageDecoder::UPtr make_image_decoder(const Path& compressed_file_path);
+PipelinedImageDecoder::UPtr make_pipelined_image_decoder(const Path& compressed_file_path,
+                                                         const Path& decoded_file_path);
+} // namespace multipass
+#endif // MULTIPASS_IMAGE_DECODER_H
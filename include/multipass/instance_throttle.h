@@ -0,0 +1,31 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MULTIPASS_INSTANCE_THROTTLE_H
+#define MULTIPASS_INSTANCE_THROTTLE_H
+
+namespace multipass
+{
+// Hard caps on an instance's disk and network, 0 being none. The network cap holds each way
+struct InstanceThrottle
+{
+    long long disk_iops{0};
+    long long disk_bytes_per_second{0};
+    long long network_bytes_per_second{0};
+};
+} // namespace multipass
+
+#endif // MULTIPASS_INSTANCE_THROTTLE_H
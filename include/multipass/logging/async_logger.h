@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_ASYNC_LOGGER_H
+#define MULTIPASS_ASYNC_LOGGER_H
+
+#include "logger.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace multipass
+{
+namespace logging
+{
+// Hands messages to a thread of its own, which passes them on to a slow sink (e.g. journald), so that logging costs
+// callers no more than taking a slot in a ring buffer
+class AsyncLogger : public Logger
+{
+public:
+    enum class OverflowPolicy
+    {
+        drop,  // messages that find the buffer full are counted and left out
+        block, // callers wait for the sink to catch up
+    };
+
+    AsyncLogger(UPtr sink, OverflowPolicy overflow_policy, std::size_t capacity = 4096);
+    ~AsyncLogger(); // passes on whatever is still buffered
+
+    void log(Level level, CString category, CString message) const override;
+    bool enabled(Level level) const override;
+
+private:
+    struct Record
+    {
+        Level level;
+        std::string category;
+        std::string message;
+    };
+
+    struct Slot
+    {
+        std::atomic<std::size_t> sequence; // says whose turn it is, a producer's or the drainer's
+        Record record;
+    };
+
+    bool try_push(Record& record) const;
+    bool try_pop(Record& record);
+    bool has_records() const;
+    void wake_drainer() const;
+    void drain();
+
+    const UPtr sink;
+    const OverflowPolicy overflow_policy;
+    const std::size_t mask;
+    const std::unique_ptr<Slot[]> slots;
+    mutable std::atomic<std::size_t> enqueue_pos{0};
+    std::size_t dequeue_pos{0}; // only the drainer touches it
+    mutable std::atomic<std::size_t> dropped{0};
+    std::atomic<bool> running{true};
+    std::atomic<bool> drainer_idle{false};
+    mutable std::mutex wakeup_mutex;
+    mutable std::condition_variable wakeup;
+    std::thread drainer;
+};
+} // namespace logging
+} // namespace multipass
+
+#endif // MULTIPASS_ASYNC_LOGGER_H
@@ -25,15 +25,29 @@
 
 #include <fmt/format.h>
 
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+#include <string>
+
 namespace multipass
 {
 namespace logging
 {
-template <typename T>
+// Forwards log lines to a client in batches, so that verbose operations don't pay for a stream write per line. A batch
+// is written once it grows past max_batch_size, or with the first line logged after it has waited flush_interval. Until
+// then it can ride on one of the operation's own replies (see merge_into).
+//
+// Whatever is still pending when the logger goes is written then, so callers that release the writer before that (by
+// fulfilling the status promise) must flush() first.
+template <typename T, typename Writer = grpc::ServerWriter<T>>
 class ClientLogger : public Logger
 {
 public:
-    ClientLogger(Level level, MultiplexingLogger& mpx, grpc::ServerWriter<T>* server)
+    static constexpr std::size_t max_batch_size = 16 * 1024; // bytes
+    static constexpr std::chrono::milliseconds flush_interval{100};
+
+    ClientLogger(Level level, MultiplexingLogger& mpx, Writer* server)
         : logging_level{level}, server{server}, mpx_logger{mpx}
     {
         mpx_logger.add_logger(this);
@@ -42,23 +56,68 @@ public:
     ~ClientLogger()
     {
         mpx_logger.remove_logger(this);
+        flush();
     }
 
     void log(Level level, CString category, CString message) const override
     {
-        if (level <= logging_level && server != nullptr)
+        if (!enabled(level))
+            return;
+
+        auto line = fmt::format("[{}] [{}] [{}] {}\n", multipass::utils::timestamp(), as_string(level).c_str(),
+                                category.c_str(), message.c_str());
+        auto now = std::chrono::steady_clock::now();
+
+        bool due;
         {
-            T reply;
-            reply.set_log_line(fmt::format("[{}] [{}] [{}] {}\n", multipass::utils::timestamp(),
-                                           as_string(level).c_str(), category.c_str(), message.c_str()));
-            server->Write(reply);
+            std::lock_guard<std::mutex> lock{pending_mutex};
+            if (pending.empty())
+                oldest_pending = now;
+
+            pending.append(line);
+            due = pending.size() >= max_batch_size || now - oldest_pending >= flush_interval;
+        }
+
+        if (due)
+            flush();
+    }
+
+    bool enabled(Level level) const override
+    {
+        return level <= logging_level && server != nullptr;
+    }
+
+    // Moves the pending lines ahead of whatever the reply already carries, sparing them a write of their own; the
+    // caller then writes the reply
+    void merge_into(T& reply) const
+    {
+        std::lock_guard<std::mutex> lock{pending_mutex};
+        if (!pending.empty())
+        {
+            reply.set_log_line(pending + reply.log_line());
+            pending.clear();
         }
     }
 
+    void flush() const
+    {
+        // Taking the batch under write_mutex keeps batches in order, without holding up loggers during the write
+        std::lock_guard<std::mutex> lock{write_mutex};
+
+        T reply;
+        merge_into(reply);
+        if (!reply.log_line().empty())
+            server->Write(reply);
+    }
+
 private:
     Level logging_level;
-    grpc::ServerWriter<T>* server;
+    Writer* server;
     MultiplexingLogger& mpx_logger;
+    mutable std::mutex write_mutex;
+    mutable std::mutex pending_mutex;
+    mutable std::string pending;
+    mutable std::chrono::steady_clock::time_point oldest_pending;
 };
 } // namespace logging
 } // namespace multipass
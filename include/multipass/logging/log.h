@@ -22,11 +22,24 @@
 #include <multipass/logging/level.h>
 #include <multipass/logging/logger.h>
 
+#include <fmt/format.h>
+
+#include <utility>
+
 namespace multipass
 {
 namespace logging
 {
 void log(Level level, CString category, CString message);
+bool enabled(Level level);
+
+// Formats the message only when some logger takes messages at this level
+template <typename Arg, typename... Args>
+void log(Level level, CString category, const char* format_string, Arg&& arg, Args&&... args)
+{
+    if (enabled(level))
+        log(level, category, fmt::format(format_string, std::forward<Arg>(arg), std::forward<Args>(args)...));
+}
 void set_logger(std::shared_ptr<Logger> logger);
 } // namespace logging
 } // namespace multipass
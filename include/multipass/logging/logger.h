@@ -35,6 +35,11 @@ public:
     using UPtr = std::unique_ptr<Logger>;
     virtual ~Logger() = default;
     virtual void log(Level level, CString category, CString message) const = 0;
+    // Whether messages at this level would be logged at all, so that callers can skip formatting them
+    virtual bool enabled(Level level) const
+    {
+        return true;
+    }
 
 protected:
     Logger() = default;
@@ -20,6 +20,7 @@
 
 #include "logger.h"
 
+#include <atomic>
 #include <memory>
 #include <shared_mutex>
 #include <vector>
@@ -33,13 +34,17 @@ class MultiplexingLogger : public Logger
 public:
     explicit MultiplexingLogger(UPtr system_logger);
     void log(Level level, CString category, CString message) const override;
+    bool enabled(Level level) const override;
     void add_logger(const Logger* logger);
     void remove_logger(const Logger* logger);
 
 private:
+    void update_max_level();
+
     UPtr system_logger;
     mutable std::shared_timed_mutex mutex;
     std::vector<const Logger*> loggers;
+    std::atomic<int> max_level; // the most verbose level any logger takes, so filtering needs no lock
 };
 } // namespace logging
 } // namespace multipass
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_RECENT_LOGGER_H
+#define MULTIPASS_RECENT_LOGGER_H
+
+#include "logger.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace multipass
+{
+namespace logging
+{
+// Keeps the latest messages of each category (instances log under their own name) in memory, so that they can be
+// looked at without going through the system's journal. No category crowds the others out
+class RecentLogger : public Logger
+{
+public:
+    struct Record
+    {
+        std::chrono::system_clock::time_point time;
+        Level level;
+        std::string category;
+        std::string message;
+    };
+
+    explicit RecentLogger(Level level, std::size_t records_per_category = 512, std::size_t max_categories = 256);
+    void log(Level level, CString category, CString message) const override;
+    bool enabled(Level level) const override;
+
+    // Oldest first, those at least as severe as level and, unless no category is given, of that category only
+    std::vector<Record> recent(Level level, const std::string& category = {}) const;
+
+private:
+    struct Entry
+    {
+        std::uint64_t sequence; // orders records across categories
+        Record record;
+    };
+
+    const Level logging_level;
+    const std::size_t records_per_category;
+    const std::size_t max_categories;
+    mutable std::mutex mutex;
+    mutable std::unordered_map<std::string, std::deque<Entry>> entries; // by category; guarded by mutex
+    mutable std::uint64_t next_sequence{0};                              // idem
+};
+} // namespace logging
+} // namespace multipass
+
+#endif // MULTIPASS_RECENT_LOGGER_H
@@ -46,10 +46,19 @@ VirtualMachineFactory::UPtr vm_backend(const Path& data_dir);
 logging::Logger::UPtr make_logger(logging::Level level);
 UpdatePrompt::UPtr make_update_prompt();
 std::unique_ptr<Process> make_sshfs_server_process(const SSHFSServerConfig& config);
+void create_image_overlay(const Path& backing_image_path, const Path& overlay_path); // throws on failure
+void flatten_image(const Path& image_path, const Path& flat_path, bool compress);   // throws on failure
+// Points the overlay at another backing image with the same contents, without reading either; throws on failure, as
+// when the overlay is in use
+void rebase_image_overlay(const Path& backing_image_path, const Path& overlay_path);
 int chown(const char* path, unsigned int uid, unsigned int gid);
 bool symlink(const char* target, const char* link, bool is_dir);
 bool link(const char* target, const char* link);
+bool clone_file(const char* source, const char* destination); // reflink or in-kernel copy, false if unsupported
 int utime(const char* path, int atime, int mtime);
+bool sync_file(int fd); // waits until what was written to fd has reached stable storage
+long long allocated_size(const char* path); // what the file takes on disk, holes left out; -1 if unknown
+bool on_rotational_disk(const char* path);  // whether the file is on a spinning disk, false if unknown
 int symlink_attr_from(const char* path, sftp_attributes_struct* attr);
 bool is_alias_supported(const std::string& alias, const std::string& remote);
 bool is_remote_supported(const std::string& remote);
@@ -20,6 +20,8 @@
 
 #include <QProcessEnvironment>
 #include <QStringList>
+#include <functional>
+#include <future>
 #include <memory>
 #include <multipass/optional.h>
 
@@ -92,6 +94,7 @@ public:
     virtual bool wait_for_finished(int msecs = 30000) = 0;
 
     virtual bool running() const = 0;
+    virtual qint64 process_id() const = 0; // 0 unless running
     virtual ProcessState process_state() const = 0;
 
     virtual QByteArray read_all_standard_output() = 0;
@@ -102,6 +105,13 @@ public:
 
     virtual ProcessState execute(const int timeout = 30000) = 0;
 
+    // Starts the process and returns straight away, hearing of the outcome through finished() rather than waiting on
+    // it, so the thread the process lives in must run an event loop; the process is killed if it runs over the timeout
+    // (negative for none) and must outlive the call. The callback is run on context's thread, unless context is gone
+    // by then, in which case it is not run at all
+    std::future<ProcessState> run_async(const int timeout = 30000);
+    void run_async(const int timeout, QObject* context, std::function<void(const ProcessState&)> on_completion);
+
 signals:
     void started();
     void finished(multipass::ProcessState process_state);
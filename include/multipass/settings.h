@@ -21,6 +21,7 @@
 #include "exceptions/settings_exceptions.h"
 #include "singleton.h"
 
+#include <QDateTime>
 #include <QString>
 #include <QVariant>
 
@@ -51,8 +52,16 @@ protected:
 private:
     void set_aux(const QString& key, QString val);
 
+    struct CachedFile
+    {
+        QDateTime modified;
+        qint64 size;
+        std::map<QString, QString> values; // by key, as last read from the file
+    };
+
     std::map<QString, QString> defaults;
     mutable std::mutex mutex;
+    mutable std::map<QString, CachedFile> cache; // by file name; guarded by mutex
 };
 } // namespace multipass
 
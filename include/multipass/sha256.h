@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_SHA256_H
+#define MULTIPASS_SHA256_H
+
+#include <QByteArray>
+#include <QString>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace multipass
+{
+// SHA-256 of data that comes in pieces, as it is downloaded or read. The blocks go through the SHA instructions of
+// x86 or the crypto extensions of ARMv8 when the CPU has them
+class Sha256
+{
+public:
+    Sha256();
+
+    void add_data(const char* data, std::size_t size);
+    void add_data(const QByteArray& data);
+
+    // The raw 32 bytes, like QCryptographicHash::result(); no more data can be added after it
+    QByteArray result();
+
+private:
+    std::array<uint32_t, 8> state;
+    std::array<unsigned char, 64> block;
+    std::size_t block_size{0};
+    uint64_t total_size{0};
+};
+
+// The hex digest of the file at path, e.g. of a prepared image the vault keeps a record of; throws
+// std::runtime_error when it cannot be read
+QByteArray sha256_of_file(const QString& path);
+
+// The hex digests of the files, in their order, each hashed on a thread of its own, e.g. the sshfs packages cached
+// for instances to install
+std::vector<QByteArray> sha256_of_files(const std::vector<QString>& paths);
+} // namespace multipass
+
+#endif // MULTIPASS_SHA256_H
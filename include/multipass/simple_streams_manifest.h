@@ -23,7 +23,7 @@
 #include <multipass/vm_image_info.h>
 
 #include <QByteArray>
-#include <QMap>
+#include <QHash>
 #include <QString>
 
 #include <memory>
@@ -38,9 +38,19 @@ struct SimpleStreamsManifest
     SimpleStreamsManifest& operator=(const SimpleStreamsManifest&) = delete;
     static std::unique_ptr<SimpleStreamsManifest> fromJson(const QByteArray& json);
 
+    // The products whose id starts with the given prefix, in id order
+    std::vector<const VMImageInfo*> products_with_id_prefix(const QString& prefix) const;
+
+    // The products in manifest order, leaving out the unsupported ones unless asked not to
+    std::vector<const VMImageInfo*> supported_products(bool allow_unsupported) const;
+
     const QString updated_at;
     const std::vector<VMImageInfo> products;
-    const QMap<QString, const VMImageInfo*> image_records;
+    const QHash<QString, const VMImageInfo*> image_records;
+    // Sorted by id, so that ids sharing a prefix sit next to each other
+    const std::vector<const VMImageInfo*> products_by_id;
+    // Whether each product is supported, packed in products' order so that filtering on it touches no product
+    const std::vector<bool> supported;
 };
 }
 #endif // MULTIPASS_SIMPLE_STREAMS_MANIFEST_H
@@ -43,6 +43,8 @@ public:
 private:
     QDir ssh_key_dir;
     KeyUPtr priv_key;
+    std::string priv_key_base64; // read and exported once, since they are asked for on every ssh_info and mount
+    std::string pub_key_base64;
 };
 }
 #endif // MULTIPASS_OPENSSH_KEY_PROVIDER_H
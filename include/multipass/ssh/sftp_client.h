@@ -22,14 +22,19 @@
 
 #include <libssh/sftp.h>
 
+#include <cstddef>
+#include <cstdint>
 #include <iostream>
 #include <memory>
 #include <string>
+#include <utility>
+#include <vector>
 
 namespace multipass
 {
 using SSHSessionUPtr = std::unique_ptr<SSHSession>;
 using SFTPSessionUPtr = std::unique_ptr<sftp_session_struct, void (*)(sftp_session)>;
+using FileTransfers = std::vector<std::pair<std::string, std::string>>; // source and destination paths
 
 class SFTPClient
 {
@@ -38,13 +43,50 @@ public:
     SFTPClient(SSHSessionUPtr ssh_session);
 
     void push_file(const std::string& source_path, const std::string& destination_path);
+    // Like push_file, but leaves alone a destination of the same size and modification time, and otherwise only
+    // sends the blocks that differ from what it holds
+    void sync_file(const std::string& source_path, const std::string& destination_path);
     void pull_file(const std::string& source_path, const std::string& destination_path);
     void stream_file(const std::string& destination_path, std::istream& cin);
     void stream_file(const std::string& source_path, std::ostream& cout);
 
+    // Recreate a directory tree at the destination, returning the files that are left to transfer
+    FileTransfers push_dir_tree(const std::string& source_dir, const std::string& destination_dir);
+    FileTransfers pull_dir_tree(const std::string& source_dir, const std::string& destination_dir);
+    bool is_remote_dir(const std::string& path);
+
+    // For moving one large file in ranges over several clients at once, each on a cipher stream of its own.
+    // begin_split_* creates the destination, then every range goes to the same offset at the other end, by any client
+    // and in any order. end_split_* gives the destination the source's permissions once all the ranges are there
+    struct SplitTransfer
+    {
+        std::string source_path;
+        std::string destination_path; // resolved against the destination directory, if it was one
+        uint64_t size;
+        int mode;
+    };
+    SplitTransfer begin_split_push(const std::string& source_path, const std::string& destination_path);
+    SplitTransfer begin_split_pull(const std::string& source_path, const std::string& destination_path);
+    void push_range(const SplitTransfer& transfer, uint64_t offset, uint64_t length);
+    void pull_range(const SplitTransfer& transfer, uint64_t offset, uint64_t length);
+    void end_split_push(const SplitTransfer& transfer);
+    void end_split_pull(const SplitTransfer& transfer);
+
+    // How many reads are kept in flight at once when pulling
+    void set_transfer_window(std::size_t requests);
+
+    static constexpr std::size_t default_transfer_window = 32;
+
 private:
+    void push_changed_blocks(const std::string& source_path, const std::string& destination_path,
+                             const std::vector<std::string>& destination_digests);
+    void make_remote_dir(const std::string& path, int mode);
+    void list_remote_dir(const std::string& root, const std::string& relative_dir, FileTransfers& files,
+                         const std::string& destination_root);
+
     SSHSessionUPtr ssh_session;
     SFTPSessionUPtr sftp;
+    std::size_t transfer_window{default_transfer_window};
 };
 } // namespace multipass
 #endif // MULTIPASS_SFTP_CLIENT_H
@@ -32,6 +32,9 @@ namespace multipass
 {
 using SSHSessionUPtr = std::unique_ptr<SSHSession>;
 
+SSHSessionUPtr make_ssh_session(const std::string& host, int port, const std::string& username,
+                                const std::string& priv_key_blob);
+
 class SSHClient
 {
 public:
@@ -41,6 +44,8 @@ public:
     SSHClient(const std::string& host, int port, const std::string& username, const std::string& priv_key_blob,
               ConsoleCreator console_creator);
     SSHClient(SSHSessionUPtr ssh_session, ConsoleCreator console_creator);
+    // Opens a channel on a session that is kept by the caller, e.g. to run several commands over one connection
+    SSHClient(SSHSession& ssh_session, ConsoleCreator console_creator);
 
     int exec(const std::vector<std::string>& args);
     void connect();
@@ -48,7 +53,8 @@ public:
 private:
     void handle_ssh_events();
 
-    SSHSessionUPtr ssh_session;
+    SSHSessionUPtr owned_session;
+    SSHSession* ssh_session;
     ChannelUPtr channel;
     Console::UPtr console;
 };
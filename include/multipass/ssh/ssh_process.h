@@ -23,6 +23,7 @@
 #include <libssh/libssh.h>
 
 #include <chrono>
+#include <functional>
 #include <memory>
 #include <string>
 
@@ -32,6 +33,7 @@ class SSHProcess
 {
 public:
     using ChannelUPtr = std::unique_ptr<ssh_channel_struct, void (*)(ssh_channel)>;
+    using OutputHandler = std::function<void(const std::string& output, bool is_std_err)>;
 
     SSHProcess(ssh_session ssh_session, const std::string& cmd);
 
@@ -39,6 +41,9 @@ public:
     std::string read_std_output();
     std::string read_std_error();
 
+    // Hands over output as it arrives, rather than all at once at the end, and returns the exit status
+    int stream_output(const OutputHandler& on_output);
+
 private:
     enum class StreamType
     {
@@ -40,6 +40,16 @@ public:
 
     void force_shutdown();
     operator ssh_session() const;
+    // The SHA256 of the key the server presented, as raw bytes; empty when it cannot be had
+    std::string host_key_hash() const;
+
+    // Picks the ciphers of every session opened afterwards in this process: "auto" prefers AES-GCM where the host
+    // has AES instructions and chacha20 elsewhere, while "aes-gcm" and "chacha20" force either
+    static void set_crypto_profile(const std::string& profile);
+    static std::string crypto_profile();
+    // Whether sessions opened afterwards ask for zlib compression; off by default, guests are usually local
+    static void set_compression(bool enabled);
+    static bool compression();
 
 private:
     SSHSession(const std::string& host, int port, const std::string& ssh_username, const SSHKeyProvider* key_provider);
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2020 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_SSH_SESSION_POOL_H
+#define MULTIPASS_SSH_SESSION_POOL_H
+
+#include <multipass/optional.h>
+#include <multipass/ssh/ssh_session.h>
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace multipass
+{
+class SSHKeyProvider;
+
+// Keeps one authenticated session per instance alive, so that commands open a channel instead of connecting anew.
+// libssh sessions are not thread safe, so each is leased to one user at a time.
+class SSHSessionPool
+{
+    struct Entry
+    {
+        std::mutex mutex;
+        std::string host;
+        int port{0};
+        std::string username;
+        optional<SSHSession> session;
+    };
+
+public:
+    class Lease
+    {
+    public:
+        Lease(Lease&&) = default;
+        ~Lease();
+
+        SSHSession& operator*();
+        SSHSession* operator->();
+
+    private:
+        friend class SSHSessionPool;
+        explicit Lease(std::shared_ptr<Entry> entry);
+
+        std::shared_ptr<Entry> entry; // before the lock, so that the lock is released first
+        std::unique_lock<std::mutex> lock;
+        int uncaught_exceptions;
+    };
+
+    explicit SSHSessionPool(const SSHKeyProvider& key_provider);
+
+    // Blocks while another user holds the instance's session; reconnects if the pooled one is no longer usable
+    Lease acquire(const std::string& instance_name, const std::string& host, int port, const std::string& username);
+    void drop(const std::string& instance_name);
+    void clear();
+    std::size_t size() const; // instances with a session pooled
+
+private:
+    const SSHKeyProvider& key_provider;
+    mutable std::mutex entries_mutex;
+    std::unordered_map<std::string, std::shared_ptr<Entry>> entries;
+};
+} // namespace multipass
+#endif // MULTIPASS_SSH_SESSION_POOL_H
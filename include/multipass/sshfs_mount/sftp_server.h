@@ -18,18 +18,25 @@
 #ifndef MULTIPASS_SFTP_SERVER_H
 #define MULTIPASS_SFTP_SERVER_H
 
+#include <multipass/constants.h>
 #include <multipass/ssh/ssh_session.h>
 
 #include <libssh/sftp.h>
 
+#include <chrono>
+#include <map>
 #include <memory>
+#include <set>
+#include <string>
 #include <unordered_map>
+#include <vector>
 
 #include <QFile>
 #include <QFileInfo>
 
 namespace multipass
 {
+class ReadRing;
 class SSHSession;
 class SSHProcess;
 
@@ -38,22 +45,64 @@ class SftpServer
 public:
     SftpServer(SSHSession&& ssh_session, const std::string& source, const std::string& target,
                const std::unordered_map<int, int>& gid_map, const std::unordered_map<int, int>& uid_map,
-               int default_uid, int default_gid);
+               int default_uid, int default_gid, const std::string& profile = default_mount_profile);
+    // Shares the session with other servers, each serving its own channel
+    SftpServer(std::shared_ptr<SSHSession> ssh_session, const std::string& source, const std::string& target,
+               const std::unordered_map<int, int>& gid_map, const std::unordered_map<int, int>& uid_map,
+               int default_uid, int default_gid, const std::string& profile = default_mount_profile);
     SftpServer(SftpServer&& other);
     ~SftpServer();
 
     void run();
+    bool serve_next_message(); // blocks for a message; false once the server should stop
     void stop();
+    ssh_channel channel() const;
+    bool has_pending_replies() const;
+    void enable_pipelining(int worker_count); // stat requests are served by workers, replied as they complete
+    void enable_change_forwarding();          // host changes to what the instance looked at reach its watchers
+    // Writes land on a thread of their own, failures reported on the next write, close or fsync of the file. Anything
+    // else waits for them to land, so that nothing sees the file without them
+    void enable_write_back();
+    // Reads go to the kernel through an io_uring, many in flight at once, replied as they complete. Kept off where
+    // io_uring is not to be had
+    void enable_read_ring(unsigned entries);
+    void forward_changes();                   // those seen since the last call
+    // Tells the usage reported apart from that of other instances' mounts served in the same process
+    void label_usage(const std::string& instance);
 
     using SSHSessionUptr = std::unique_ptr<ssh_session_struct, decltype(ssh_free)*>;
     using SftpSessionUptr = std::unique_ptr<sftp_session_struct, decltype(sftp_free)*>;
     using SSHFSProcUptr = std::unique_ptr<SSHProcess>;
+    using SftpMessageUptr = std::unique_ptr<sftp_client_message_struct, decltype(sftp_client_message_free)*>;
 
 private:
+    struct StatResult
+    {
+        uint32_t status;
+        sftp_attributes_struct attr;
+    };
+    class StatWorkers;
+    class WriteBack;
+    class DirStream;
+    class AttrCache;
+    struct OpenFile;
+    class HandleTable;
+
     void process_message(sftp_client_message msg);
-    sftp_attributes_struct attr_from(const QFileInfo& file_info);
+    StatResult stat_for(const char* filename, bool follow);
+    void reply_completed_stats(bool wait_for_all);
+    bool submit_ring_read(SftpMessageUptr& client_msg); // takes the message when it does
+    void reply_completed_reads(bool wait_for_all);
     int mapped_uid_for(const int uid);
     int mapped_gid_for(const int gid);
+    bool flush_pending_write(); // hands it to write_back instead, with that enabled
+    void land_writes();         // all of them, write_back's included
+    void note_write_back_failures();
+    void restart_sshfs(); // in place of one that died, over the same session
+    void note_guest_change(sftp_client_message msg, uint8_t type);
+    void queue_changes(const std::set<std::string>& changes); // for the agent, but those the instance made itself
+    void record_op(const char* op, std::chrono::steady_clock::time_point start);
+    void report_usage(bool force);
 
     int handle_close(sftp_client_message msg);
     int handle_fstat(sftp_client_message msg);
@@ -73,18 +122,51 @@ private:
     int handle_write(sftp_client_message msg);
     int handle_extended(sftp_client_message msg);
 
-    SSHSession ssh_session;
+    std::shared_ptr<SSHSession> ssh_session;
     SSHFSProcUptr sshfs_process;
     SftpSessionUptr sftp_server_session;
     const std::string source_path;
     const std::string target_path;
-    std::unordered_map<void*, std::unique_ptr<QFileInfoList>> open_dir_handles;
-    std::unordered_map<void*, std::unique_ptr<QFile>> open_file_handles;
+    const std::string mount_profile;
+    std::string instance_label;
+    std::unique_ptr<HandleTable> handles;
+    std::vector<char> read_buffer;
+    struct PendingWrite
+    {
+        OpenFile* file{nullptr};
+        uint64_t offset{0};
+        std::vector<char> data;
+    } pending_write;
     const std::unordered_map<int, int> gid_map;
     const std::unordered_map<int, int> uid_map;
     const int default_uid;
     const int default_gid;
+    std::unique_ptr<AttrCache> attr_cache;
     bool stop_invoked{false};
+    int lost_messages{0}; // failed reads in a row
+    std::unique_ptr<StatWorkers> stat_workers;
+    std::unique_ptr<WriteBack> write_back;
+    struct RingRead
+    {
+        SftpMessageUptr msg;
+        std::vector<char> buffer;
+        std::chrono::steady_clock::time_point submitted;
+    };
+    std::unordered_map<uint64_t, RingRead> ring_reads; // in flight, by tag
+    std::vector<std::vector<char>> spare_read_buffers;
+    uint64_t next_ring_tag{0};
+    std::unique_ptr<ReadRing> read_ring; // last, so that it waits for its reads before their buffers go
+    SSHFSProcUptr change_agent;
+    std::string unsent_changes; // lines the agent's channel had no room for yet
+    // Paths the instance changed itself, by when; the host's events about them are not forwarded back
+    std::unordered_map<std::string, std::chrono::steady_clock::time_point> guest_changes;
+    struct Usage // since the last report to Telemetry
+    {
+        std::map<std::string, std::vector<std::chrono::steady_clock::duration>> op_latencies;
+        unsigned long long bytes_read{0};
+        unsigned long long bytes_written{0};
+        std::chrono::steady_clock::time_point reported{std::chrono::steady_clock::now()};
+    } usage;
 };
 } // namespace multipass
 #endif // MULTIPASS_SFTP_SERVER_H
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_SFTP_SERVICE_H
+#define MULTIPASS_SFTP_SERVICE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace multipass
+{
+class SftpServer;
+
+// Serves mounts of any number of instances from the process that owns it, rather than from an sshfs_server each.
+// One thread waits on the channels of all the sessions at once, and hands whichever has something to say to a few
+// serving threads. A mount is only ever served by one thread at a time, and one that takes long, e.g. restarting
+// sshfs in its instance, holds up none of the others. A server that stops or throws, e.g. because its instance went
+// away, is dropped without the others noticing
+class SftpService
+{
+public:
+    SftpService();
+    ~SftpService(); // stops serving everything
+
+    SftpService(const SftpService&) = delete;
+    SftpService& operator=(const SftpService&) = delete;
+
+    // The servers must be ready to serve; from here on, only the service's threads touch them, or their sessions
+    void serve(const std::string& instance, std::vector<std::pair<std::string, std::unique_ptr<SftpServer>>> servers);
+
+    bool stop(const std::string& instance, const std::string& target); // false when not served
+    void stop_all(const std::string& instance);
+    bool serves(const std::string& instance, const std::string& target) const;
+    std::size_t size() const; // mounts served, of all instances
+
+private:
+    using Key = std::pair<std::string, std::string>; // instance and target
+
+    struct Mount
+    {
+        Key key;
+        std::uint64_t id; // tells a target's server from the one serving it after it was stopped and mounted again
+        std::unique_ptr<SftpServer> server;
+        bool serving{false}; // while a serving thread has it, which alone touches the server then
+        bool stopped{false}; // by its server, or by it throwing
+    };
+
+    void run();
+    void serve_mounts();
+    void serve(Mount& mount);
+
+    mutable std::mutex mutex;
+    std::condition_variable work_arrived;
+    std::condition_variable mount_ready; // for the serving threads
+    std::map<Key, std::uint64_t> served; // whatever is handed over and not stopped yet, by id
+    std::vector<std::shared_ptr<Mount>> incoming; // waiting for the waiting thread to take them up
+    std::set<std::uint64_t> stopping;             // idem, to drop
+    std::deque<std::shared_ptr<Mount>> ready;     // with something to say, for a serving thread to take up
+    std::uint64_t next_id{0};
+    bool finishing{false};
+    std::vector<std::shared_ptr<Mount>> mounts; // only ever touched by the waiting thread
+    std::vector<std::thread> serving_threads;
+    std::thread waiting_thread;
+};
+} // namespace multipass
+#endif // MULTIPASS_SFTP_SERVICE_H
@@ -18,28 +18,55 @@
 #ifndef MULTIPASS_SSHFS_MOUNT
 #define MULTIPASS_SSHFS_MOUNT
 
+#include <multipass/sshfs_server_config.h>
+
+#include <atomic>
 #include <memory>
+#include <mutex>
+#include <string>
 #include <thread>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 namespace multipass
 {
 class SSHSession;
 class SftpServer;
+
+// Readies the target in the instance, creating it if needed, and a server for it over the session. Serving it is
+// left to the caller. Throws SSHFSMissingError when the instance has no sshfs
+std::unique_ptr<SftpServer> make_sftp_server(std::shared_ptr<SSHSession> session, const SSHFSMountConfig& mount);
+
 class SshfsMount
 {
 public:
     SshfsMount(SSHSession&& session, const std::string& source, const std::string& target,
-               const std::unordered_map<int, int>& gid_map, const std::unordered_map<int, int>& uid_map);
+               const std::unordered_map<int, int>& gid_map, const std::unordered_map<int, int>& uid_map,
+               const std::string& profile = default_mount_profile);
+    // Serves all the mounts from one thread, each over its own channel of the same session
+    SshfsMount(SSHSession&& session, const std::vector<SSHFSMountConfig>& mounts);
     SshfsMount(SshfsMount&& other);
     ~SshfsMount();
 
     void stop();
+    void stop(const std::string& target);
+
+    // The targets still served, none once serving stopped, whether asked to or because the session went away
+    std::vector<std::string> serving();
 
 private:
+    void serve_all();
+
     // sftp_server Doesn't need to be a pointer, but done for now to avoid bringing sftp.h
     // which has an error with -pedantic.
-    std::unique_ptr<SftpServer> sftp_server;
+    std::vector<std::unique_ptr<SftpServer>> sftp_servers;
+    std::vector<std::string> targets;
+    bool multiplexed{false};
+    std::atomic<bool> stop_invoked{false};
+    std::atomic<bool> stopped{false};
+    std::mutex servers_mutex;
+    std::unordered_set<std::string> targets_to_stop;
     std::thread sftp_thread;
 };
 } // namespace multipass
@@ -19,11 +19,16 @@
 #define MULTIPASS_SSHFSMOUNTS_H
 
 #include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
+#include <multipass/constants.h>
 #include <multipass/process.h>
 #include <multipass/ssh/ssh_key_provider.h>
+#include <multipass/sshfs_mount/sftp_service.h>
+#include <multipass/sshfs_server_config.h>
 #include <multipass/qt_delete_later_unique_ptr.h>
 
 namespace multipass
@@ -34,20 +39,43 @@ class SSHFSMounts : public QObject
 {
     Q_OBJECT
 public:
-    explicit SSHFSMounts(const SSHKeyProvider& ssh_key_provider);
+    // With a control directory, sshfs_servers started while keep_running_key is set outlive the daemon, each with a
+    // socket there that the next daemon finds it again by. Those still running are taken up here
+    explicit SSHFSMounts(const SSHKeyProvider& ssh_key_provider, const QString& control_directory = QString());
 
     void start_mount(VirtualMachine* vm, const std::string& source_path, const std::string& target_path,
-                     const std::unordered_map<int, int>& gid_map, const std::unordered_map<int, int>& uid_map);
+                     const std::unordered_map<int, int>& gid_map, const std::unordered_map<int, int>& uid_map,
+                     const std::string& profile = default_mount_profile);
+    // Serves all the mounts from a single sshfs_server, multiplexed over one SSH session
+    void start_mounts(VirtualMachine* vm, const std::vector<SSHFSMountConfig>& mounts);
 
     bool stop_mount(const std::string& instance, const std::string& path);
     void stop_all_mounts_for_instance(const std::string& instance);
 
     bool has_instance_already_mounted(const std::string& instance, const std::string& path) const;
+    std::size_t mount_count() const; // of all instances, wherever they are served from
 
 private:
+    // With mount_serving_key set to "daemon", mounts are served from this process instead of an sshfs_server,
+    // sparing them a process each at the cost of sharing the daemon's fate
+    void serve_in_daemon(VirtualMachine* vm, const std::vector<SSHFSMountConfig>& mounts);
+
+    // Logs the process's troubles and forgets its mounts once it finishes, whether it got to serve them or not
+    void watch_mount_process(const std::string& instance, const std::vector<std::string>& target_paths,
+                             const std::shared_ptr<Process>& process);
+    // Records the process as serving the mounts, taking in its counters
+    void keep_mount_process(const std::string& instance, const std::vector<std::string>& target_paths,
+                            const std::shared_ptr<Process>& process);
+    void adopt_detached_servers();
+    QString control_socket_path(const std::string& instance, const std::string& target_path) const;
+
+    const SSHKeyProvider& key_provider;
     const std::string key;
-    std::unordered_map<std::string, std::unordered_map<std::string, qt_delete_later_unique_ptr<Process>>>
-        mount_processes;
+    const QString control_directory;
+    // Mounts started together share their process. Mounts may be started concurrently, hence the mutex
+    mutable std::mutex mount_processes_mutex;
+    std::unordered_map<std::string, std::unordered_map<std::string, std::shared_ptr<Process>>> mount_processes;
+    std::unique_ptr<SftpService> sftp_service; // started with the first mount served in the daemon, idem
 };
 
 } // namespace multipass
@@ -18,12 +18,24 @@
 #ifndef MULTIPASS_SSHFS_SERVER_CONFIG_H
 #define MULTIPASS_SSHFS_SERVER_CONFIG_H
 
+#include <multipass/constants.h>
+
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 namespace multipass
 {
 
+struct SSHFSMountConfig
+{
+    std::string source_path;
+    std::string target_path;
+    std::unordered_map<int, int> gid_map;
+    std::unordered_map<int, int> uid_map;
+    std::string profile{default_mount_profile};
+};
+
 struct SSHFSServerConfig
 {
     std::string host;
@@ -31,10 +43,14 @@ struct SSHFSServerConfig
     std::string username;
     std::string instance;
     std::string private_key;
+    std::string crypto_profile;
     std::string source_path;
     std::string target_path;
     std::unordered_map<int, int> gid_map;
     std::unordered_map<int, int> uid_map;
+    std::vector<SSHFSMountConfig> additional_mounts; // served by the same process, over the same session
+    std::string profile{default_mount_profile};
+    std::string control_socket; // when set, the server outlives the daemon, which finds it again through this
 };
 
 } // namespace multipass
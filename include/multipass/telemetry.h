@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_TELEMETRY_H
+#define MULTIPASS_TELEMETRY_H
+
+#include "singleton.h"
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace multipass
+{
+// Counters and histograms about what this process has been doing, read back in Prometheus' text format. Unlike
+// MetricsProvider, nothing here leaves the machine
+class Telemetry : public Singleton<Telemetry>
+{
+public:
+    using Labels = std::map<std::string, std::string>;
+
+    // One series as it reads in the exposition, for passing on what a helper process counted. Histograms come as
+    // their _bucket, _sum and _count series, which are taken back in under the histogram they belong to
+    struct Sample
+    {
+        std::string name;
+        std::string labels; // e.g. mount="/home/ubuntu/src"
+        double value;
+        std::string histogram{}; // the series' histogram, empty for counters
+    };
+
+    class Timer
+    {
+    public:
+        Timer(Telemetry& telemetry, std::string name, Labels labels);
+        ~Timer();
+
+    private:
+        Telemetry& telemetry;
+        const std::string name;
+        const Labels labels;
+        const std::chrono::steady_clock::time_point start;
+    };
+
+    Telemetry(const Singleton<Telemetry>::PrivatePass&);
+
+    void count(const std::string& name, const Labels& labels = {}, double amount = 1);
+    void set(const std::string& name, const Labels& labels, double total); // for totals kept somewhere else
+    void observe(const std::string& name, const Labels& labels, std::chrono::steady_clock::duration duration);
+    Timer time(std::string name, Labels labels = {}); // observes its lifetime
+
+    std::string exposition() const;
+    std::vector<Sample> samples() const;
+    void set(const Sample& sample);
+
+private:
+    struct Histogram
+    {
+        std::vector<unsigned long long> buckets; // not cumulative, one per bound plus one for +Inf
+        double sum{0};
+        unsigned long long count{0};
+    };
+
+    void append_histogram_samples(const std::string& name, std::vector<Sample>& samples) const; // with mutex held
+
+    mutable std::mutex mutex;
+    std::map<std::string, std::map<std::string, double>> counters;      // name -> rendered labels -> value
+    std::map<std::string, std::map<std::string, Histogram>> histograms; // idem
+    std::map<std::string, std::map<std::pair<std::string, std::string>, double>>
+        forwarded_histograms; // histogram -> series name and rendered labels -> value
+};
+} // namespace multipass
+
+#endif // MULTIPASS_TELEMETRY_H
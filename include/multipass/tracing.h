@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_TRACING_H
+#define MULTIPASS_TRACING_H
+
+#include "singleton.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+
+namespace multipass
+{
+// Spans of work, appended to the file MULTIPASS_TRACE_FILE names in Chrome's trace-event format (chrome://tracing,
+// Perfetto). The client, the daemon and its helpers can all be pointed at the same file, and each span says which
+// trace it belongs to, so a slow command opens as one flame view. Without the variable, spans cost next to nothing
+class Tracer : public Singleton<Tracer>
+{
+public:
+    using Args = std::map<std::string, std::string>;
+
+    // What a span passes on to the work it causes, in another thread or, through gRPC metadata or the environment,
+    // in another process
+    struct Context
+    {
+        std::string trace_id; // 32 hex digits, as in W3C trace context
+        std::string span_id;  // 16 hex digits
+
+        bool valid() const;
+        std::string serialised() const; // "<trace_id>-<span_id>"
+        static Context deserialised(const std::string& serialised);
+    };
+
+    static constexpr auto trace_id_metadata_key = "multipass-trace-id";
+    static constexpr auto span_id_metadata_key = "multipass-span-id";
+
+    class Span
+    {
+    public:
+        Span(Tracer& tracer, std::string name, const Context& parent, Args args);
+        ~Span();
+
+        Span(const Span&) = delete;
+        Span& operator=(const Span&) = delete;
+
+        const Context& context() const;
+        void hand_over(const void* key); // lets other threads' spans under key join this one's trace, while it lasts
+        void annotate(const std::string& key, const std::string& value);
+
+    private:
+        Tracer& tracer;
+        const bool recording;
+        std::string name;
+        Args args;
+        Context own;
+        Context parent;
+        const Span* enclosing; // the calling thread's current span, until this one ends
+        const void* handed_over_key{nullptr};
+        const std::chrono::system_clock::time_point start;
+    };
+
+    Tracer(const Singleton<Tracer>::PrivatePass&);
+    ~Tracer();
+
+    bool enabled() const;
+    void trace_to(const std::string& path); // an empty path stops tracing
+
+    Span span(std::string name, Args args = {});                        // within the calling thread's current span
+    Span span(const Context& parent, std::string name, Args args = {}); // within a span from elsewhere
+    Context current() const;                                            // of the calling thread
+    Context handed_over(const void* key) const; // or the calling thread's current context, when nothing was
+
+    // Wraps work for another thread (e.g. QtConcurrent::run), so that it runs in a span of the caller's trace
+    template <typename Callable>
+    auto carry(std::string name, Callable&& callable);
+
+private:
+    void write(const std::string& event);
+
+    std::atomic<bool> tracing{false};
+    mutable std::mutex mutex;
+    std::FILE* file{nullptr};
+    Context process_parent; // what a helper process was started under, for spans with nothing else to join
+    std::map<const void*, Context> handed_over_contexts;
+};
+} // namespace multipass
+
+template <typename Callable>
+auto multipass::Tracer::carry(std::string name, Callable&& callable)
+{
+    return [this, name = std::move(name), parent = current(),
+            callable = std::forward<Callable>(callable)]() mutable {
+        auto span = this->span(parent, name);
+        return callable();
+    };
+}
+
+#endif // MULTIPASS_TRACING_H
@@ -18,6 +18,7 @@
 #ifndef MULTIPASS_URL_DOWNLOADER_H
 #define MULTIPASS_URL_DOWNLOADER_H
 
+#include <multipass/download_scheduler.h>
 #include <multipass/path.h>
 #include <multipass/progress_monitor.h>
 
@@ -26,19 +27,28 @@
 
 #include <atomic>
 #include <chrono>
+#include <functional>
 
 class QUrl;
 class QString;
 namespace multipass
 {
+// Sidecar file kept next to a partially downloaded file so that a later download_to() can resume it
+constexpr auto download_journal_suffix = ".journal";
+
 class URLDownloader
 {
 public:
+    // Receives the downloaded bytes in file order, as they become available
+    using DataSink = std::function<void(const QByteArray&)>;
+
     URLDownloader(std::chrono::milliseconds timeout);
     URLDownloader(const Path& cache_dir, std::chrono::milliseconds timeout);
     virtual ~URLDownloader() = default;
-    virtual void download_to(const QUrl& url, const QString& file_name, int64_t size, const int download_type,
-                             const ProgressMonitor& monitor);
+    // Returns the hex encoded SHA-256 digest of the downloaded file
+    virtual QByteArray download_to(const QUrl& url, const QString& file_name, int64_t size, const int download_type,
+                                   const ProgressMonitor& monitor, const DataSink& sink = {},
+                                   DownloadPriority priority = DownloadPriority::interactive);
     virtual QByteArray download(const QUrl& url);
     virtual QDateTime last_modified(const QUrl& url);
     virtual void abort_all_downloads();
@@ -52,6 +62,7 @@ private:
 
     const Path cache_dir_path;
     std::chrono::milliseconds timeout;
+    DownloadScheduler scheduler;
 };
 }
 #endif // MULTIPASS_URL_DOWNLOADER_H
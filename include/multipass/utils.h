@@ -21,13 +21,16 @@
 #include <multipass/path.h>
 #include <multipass/virtual_machine.h>
 
+#include <algorithm>
 #include <chrono>
 #include <functional>
+#include <map>
 #include <string>
 #include <thread>
 #include <vector>
 
 #include <QDir>
+#include <QFile>
 #include <QString>
 #include <QStringList>
 #include <QVariant>
@@ -52,6 +55,16 @@ enum class TimeoutAction
     done
 };
 
+// Attempts are spaced from initial_delay, growing by backoff_factor up to max_delay. If set, wait replaces sleeping
+// between attempts: it is given the delay and may return early, e.g. when an event the caller awaits fires.
+struct RetryPolicy
+{
+    std::chrono::milliseconds initial_delay{std::chrono::milliseconds(50)};
+    std::chrono::milliseconds max_delay{std::chrono::seconds(1)};
+    double backoff_factor{2.0};
+    std::function<void(std::chrono::milliseconds)> wait;
+};
+
 QDir base_dir(const QString& path);
 multipass::Path make_dir(const QDir& a_dir, const QString& name);
 bool is_dir(const std::string& path);
@@ -62,6 +75,8 @@ QString make_uuid();
 std::string contents_of(const multipass::Path& file_path);
 bool has_only_digits(const std::string& value);
 void validate_server_address(const std::string& value);
+std::string plain_socket_address(const std::string& server_address);
+bool is_remote_server_address(const std::string& server_address);
 bool valid_hostname(const std::string& name_string);
 bool invalid_target_path(const QString& target_path);
 std::string to_cmd(const std::vector<std::string>& args, QuoteType type);
@@ -79,10 +94,20 @@ void wait_for_cloud_init(VirtualMachine* virtual_machine, std::chrono::milliseco
                          const SSHKeyProvider& key_provider);
 void link_autostart_file(const QDir& link_dir, const QString& autostart_subdir, const QString& autostart_filename);
 void check_and_create_config_file(const QString& config_file_path);
-
-template <typename OnTimeoutCallable, typename TryAction, typename... Args>
+// Writes data at the current position, seeking over all-zero blocks instead of writing them so the file stays sparse.
+// Since a file may end in such a hole, finish with finish_sparse_write() to set its final size.
+qint64 write_sparse(QFile& file, const char* data, qint64 size);
+bool finish_sparse_write(QFile& file);
+bool is_qcow2_image(const QString& image_path);
+QString qcow2_backing_file(const QString& image_path); // empty if there is none
+quint64 qcow2_virtual_size(const QString& image_path); // 0 if not a qcow2 image
+bool is_zstd_compressed_qcow2(const QString& image_path);
+std::map<std::string, int> parse_counts(const QString& spec);    // "<name>=<count>[,...]", throws if malformed
+std::map<std::string, int> parse_warm_pool(const QString& spec); // "<image>=<count>[,...]", idem
+
+template <typename OnTimeoutCallable, typename TryAction>
 void try_action_for(OnTimeoutCallable&& on_timeout, std::chrono::milliseconds timeout, TryAction&& try_action,
-                    Args&&... args);
+                    const RetryPolicy& policy = RetryPolicy{});
 template <typename RegisteredQtEnum>
 QString qenum_to_qstring(RegisteredQtEnum val);
 template <typename RegisteredQtEnum>
@@ -91,26 +116,33 @@ std::string qenum_to_string(RegisteredQtEnum val);
 } // namespace utils
 } // namespace multipass
 
-template <typename OnTimeoutCallable, typename TryAction, typename... Args>
+template <typename OnTimeoutCallable, typename TryAction>
 void multipass::utils::try_action_for(OnTimeoutCallable&& on_timeout, std::chrono::milliseconds timeout,
-                                      TryAction&& try_action, Args&&... args)
+                                      TryAction&& try_action, const RetryPolicy& policy)
 {
-
-    static_assert(std::is_same<decltype(try_action(std::forward<Args>(args)...)), TimeoutAction>::value, "");
-    using namespace std::literals::chrono_literals;
+    static_assert(std::is_same<decltype(try_action()), TimeoutAction>::value, "");
 
     auto deadline = std::chrono::steady_clock::now() + timeout;
-    while (std::chrono::steady_clock::now() < deadline)
+    auto delay = policy.initial_delay;
+    while (try_action() != TimeoutAction::done)
     {
-        if (try_action(std::forward<Args>(args)...) == TimeoutAction::done)
+        auto remaining =
+            std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        if (remaining <= std::chrono::milliseconds::zero())
+        {
+            on_timeout();
             return;
+        }
 
-        if ((std::chrono::steady_clock::now() + 1s) >= deadline)
-            break;
+        auto pause = std::min(delay, remaining);
+        if (policy.wait)
+            policy.wait(pause);
+        else
+            std::this_thread::sleep_for(pause);
 
-        std::this_thread::sleep_for(1s);
+        delay = std::min(policy.max_delay,
+                         std::chrono::duration_cast<std::chrono::milliseconds>(delay * policy.backoff_factor));
     }
-    on_timeout();
 }
 
 template <typename RegisteredQtEnum>
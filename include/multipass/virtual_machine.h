@@ -18,11 +18,17 @@
 #ifndef MULTIPASS_VIRTUAL_MACHINE_H
 #define MULTIPASS_VIRTUAL_MACHINE_H
 
+#include <multipass/instance_throttle.h>
+#include <multipass/memory_size.h>
+
 #include <chrono>
 #include <condition_variable>
+#include <cstdint>
 #include <memory>
 #include <mutex>
+#include <stdexcept>
 #include <string>
+#include <unordered_map>
 
 namespace multipass
 {
@@ -62,6 +68,94 @@ public:
     virtual void ensure_vm_is_running() = 0;
     virtual void update_state() = 0;
 
+    // Backends that hear from the guest directly wait here, up to timeout, for it to report it finished booting,
+    // and throw if it does not. Others return false straight away, leaving the caller to find out over SSH
+    virtual bool wait_for_guest_ready(std::chrono::milliseconds /*timeout*/)
+    {
+        return false;
+    }
+
+    // Backends that can export host directories to the guest themselves, rather than over SSHFS, record them here.
+    // Exports are attached the next time the instance starts, and only then does native_mount_tag return the tag
+    // the guest mounts them by
+    virtual void add_native_mount(const std::string& /*source_path*/, const std::string& /*target_path*/)
+    {
+        throw std::runtime_error("native mounts are not supported by this backend");
+    }
+
+    virtual void remove_native_mount(const std::string& /*target_path*/)
+    {
+    }
+
+    virtual std::string native_mount_tag(const std::string& /*target_path*/)
+    {
+        return {};
+    }
+
+    // Counters the hypervisor keeps for the instance, such as bytes read from disk, gathered without the guest.
+    // They may lag behind by a query; backends that keep none return nothing
+    virtual std::unordered_map<std::string, std::string> hypervisor_stats()
+    {
+        return {};
+    }
+
+    // What the guest's own agent tells of it, under the keys the daemon gathers over SSH otherwise: load, memory,
+    // disk, release and sessions. Empty when the backend has no agent to ask or the guest does not run one, in which
+    // case SSH it is
+    virtual std::unordered_map<std::string, std::string> guest_stats()
+    {
+        return {};
+    }
+
+    // Moves the instance to another share of the host's CPU and I/O, which a running one takes on straight away.
+    // Backends that cannot tell instances apart from the daemon leave them all in its share
+    virtual void set_resource_class(const std::string& /*resource_class*/)
+    {
+    }
+
+    // Caps the instance's disk and network, straight away when it is running. Backends without a hypervisor to
+    // enforce them ignore this
+    virtual void set_throttle(const InstanceThrottle& /*throttle*/)
+    {
+    }
+
+    // Grows the instance to these resources, returning once it has them. A running instance takes them on without
+    // a restart, leaving the guest to bring them online; a stopped one has them the next time it starts
+    virtual void resize(int /*num_cores*/, const MemorySize& /*mem_size*/, const MemorySize& /*disk_space*/)
+    {
+        throw std::runtime_error("resizing instances is not supported by this backend");
+    }
+
+    // What is wrong with the instance's disk, or nothing when it checks out. Only asked of stopped instances, and reads
+    // the disk at no more than bytes_per_second. Backends that cannot check their disks find nothing wrong
+    virtual std::string check_disk(int64_t /*bytes_per_second*/)
+    {
+        return {};
+    }
+
+    // Starts saving a running instance on the daemon's way out and returns before that is done, so that several can be
+    // saved at once. The instance is no longer suspending once saved, and keeps the state it was recorded in, so that
+    // it is resumed when the daemon is back. Backends that return false save the instance when it is destroyed
+    virtual bool start_saving_for_exit()
+    {
+        return false;
+    }
+
+    // Saves a running instance described as a memory template, for instances described as starting from it, and stops
+    // it for good. Blocks until then, and returns whether the template was saved. Backends that cannot start one
+    // instance from another's memory save nothing
+    virtual bool save_memory_template()
+    {
+        return false;
+    }
+
+    // Whether shutdown() and suspend() may be called from threads other than the one the instance was created on,
+    // letting bulk operations drive several instances at once. Backends tied to the daemon thread leave this false
+    virtual bool lifecycle_is_thread_safe() const
+    {
+        return false;
+    }
+
     VirtualMachine::State state;
     const std::string vm_name;
     std::condition_variable state_wait;
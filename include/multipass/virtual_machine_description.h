@@ -18,6 +18,8 @@
 #ifndef MULTIPASS_VIRTUAL_MACHINE_DESCRIPTION_H
 #define MULTIPASS_VIRTUAL_MACHINE_DESCRIPTION_H
 
+#include <multipass/constants.h>
+#include <multipass/instance_throttle.h>
 #include <multipass/memory_size.h>
 #include <multipass/vm_image.h>
 #include <string>
@@ -40,6 +42,12 @@ public:
     std::string ssh_username;
     VMImage image;
     Path cloud_init_iso;
+    std::string disk_profile{default_disk_profile};
+    bool hugepages{false}; // guest memory preallocated on the host's huge pages
+    std::string resource_class{default_resource_class}; // its share of the host's CPU and I/O
+    InstanceThrottle throttle;                          // hard caps on top of that share
+    bool memory_template{false}; // booted for its memory to be saved, for identical instances to start from
+    Path memory_template_dir{};  // the directory of the template this instance starts from, on its first start only
 };
 } // namespace multipass
 
@@ -22,6 +22,10 @@
 #include <multipass/virtual_machine.h>
 #include <multipass/vm_image.h>
 
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 namespace YAML
 {
 class Node;
@@ -36,6 +40,14 @@ class VirtualMachineFactory
 {
 public:
     using UPtr = std::unique_ptr<VirtualMachineFactory>;
+
+    struct InstanceState
+    {
+        VirtualMachine::State state;
+        std::string ipv4; // only looked up for running instances
+    };
+    using InstanceStates = std::unordered_map<std::string, InstanceState>;
+
     virtual ~VirtualMachineFactory() = default;
     virtual VirtualMachine::UPtr create_virtual_machine(const VirtualMachineDescription& desc,
                                                         VMStatusMonitor& monitor) = 0;
@@ -54,6 +66,34 @@ public:
     virtual QString get_backend_directory_name() = 0;
     virtual QString get_backend_version_string() = 0;
 
+    /** Gathers the state, and the address of those running, of several instances created by this factory.
+     *
+     * Backends that can answer for all of them with one query override this; by default each instance is asked.
+     *
+     * @param vms The instances to query, keyed by name in the result
+     */
+    virtual InstanceStates query_instances(const std::vector<VirtualMachine::ShPtr>& vms)
+    {
+        InstanceStates states;
+        for (const auto& vm : vms)
+        {
+            auto state = vm->current_state();
+            auto running = state == VirtualMachine::State::running || state == VirtualMachine::State::delayed_shutdown;
+            states.emplace(vm->vm_name, InstanceState{state, running ? vm->ipv4() : ""});
+        }
+
+        return states;
+    }
+
+    /** Gives the host's addresses on the networks instances are put on, where the daemon can offer them services.
+     *
+     * Backends that do not manage those networks themselves give none.
+     */
+    virtual std::vector<std::string> host_addresses()
+    {
+        return {};
+    }
+
 protected:
     VirtualMachineFactory() = default;
     VirtualMachineFactory(const VirtualMachineFactory&) = delete;
@@ -41,6 +41,8 @@ public:
     virtual std::vector<VMImageInfo> all_images_for(const std::string& remote_name, const bool allow_unsupported) = 0;
     virtual void for_each_entry_do(const Action& action) = 0;
     virtual std::vector<std::string> supported_remotes() = 0;
+    // Changes whenever a refresh changes the images on offer, so that views of them can be kept until then
+    virtual int manifest_generation() = 0;
 
 protected:
     VMImageHost() = default;
@@ -21,13 +21,23 @@
 #include <multipass/fetch_type.h>
 #include <multipass/progress_monitor.h>
 
+#include <chrono>
+#include <cstdint>
 #include <functional>
+#include <string>
+#include <vector>
 
 namespace multipass
 {
 
 class Query;
 class VMImage;
+struct ImageSnapshot
+{
+    std::string name;
+    std::chrono::system_clock::time_point created;
+};
+
 class VMImageVault
 {
 public:
@@ -40,6 +50,27 @@ public:
     virtual void prune_expired_images() = 0;
     virtual void update_images(const FetchType& fetch_type, const PrepareAction& prepare,
                                const ProgressMonitor& monitor) = 0;
+    // Downloads and prepares what the query resolves to, unless that is cached already
+    virtual void prefetch_image(const FetchType& fetch_type, const Query& query, const PrepareAction& prepare,
+                                const ProgressMonitor& monitor) = 0;
+    // Reads the cached images through again, at no more than bytes_per_second, and fetches anew those whose contents
+    // changed since they were cached. Stops early when the monitor returns false
+    virtual void scrub_images(const FetchType& fetch_type, const PrepareAction& prepare, const ProgressMonitor& monitor,
+                              int64_t bytes_per_second) = 0;
+    // Gives a new instance an image that starts out as the named instance's is now, which must not be in use
+    virtual VMImage clone_instance_image(const std::string& source_name, const std::string& clone_name) = 0;
+    // Idem, for a source that is never started again, such as a memory template, whose clones all share one layer
+    virtual VMImage clone_template_image(const std::string& template_name, const std::string& clone_name) = 0;
+    // Keeps what the named instance's image holds now, to go back to later; the image must not be in use
+    virtual void snapshot_instance_image(const std::string& instance_name, const std::string& snapshot_name) = 0;
+    virtual void restore_instance_image(const std::string& instance_name, const std::string& snapshot_name) = 0;
+    virtual std::vector<ImageSnapshot> instance_image_snapshots(const std::string& instance_name) = 0; // oldest first
+    // Keeps a standalone copy of what the named instance's image holds now, which later launches can ask for by
+    // image_name; the image must not be in use
+    virtual void bake_instance_image(const std::string& instance_name, const std::string& image_name,
+                                     bool compress) = 0;
+    virtual void remove_baked_image(const std::string& image_name) = 0; // refused while instances read through it
+    virtual bool is_baked_image(const Query& query) = 0; // whether the query launches from a baked image
 
 protected:
     VMImageVault() = default;
@@ -18,23 +18,23 @@
 #ifndef MULTIPASS_XZ_IMAGE_DECODER_H
 #define MULTIPASS_XZ_IMAGE_DECODER_H
 
-#include <multipass/path.h>
-#include <multipass/progress_monitor.h>
+#include <multipass/image_decoder.h>
 
 #include <memory>
 
+#include <QByteArray>
 #include <QFile>
 
 #include <xz.h>
 
 namespace multipass
 {
-class XzImageDecoder
+class XzImageDecoder final : public ImageDecoder
 {
 public:
     XzImageDecoder(const Path& xz_file_path);
 
-    void decode_to(const Path& decoded_file_path, const ProgressMonitor& monitor);
+    void decode_to(const Path& decoded_file_path, const ProgressMonitor& monitor) override;
 
     using XzDecoderUPtr = std::unique_ptr<xz_dec, decltype(xz_dec_end)*>;
 
@@ -42,5 +42,23 @@ private:
     QFile xz_file;
     XzDecoderUPtr xz_decoder;
 };
+
+class PipelinedXzDecoder final : public PipelinedImageDecoder
+{
+public:
+    PipelinedXzDecoder(const Path& decoded_file_path);
+
+    void feed(const QByteArray& chunk) override;
+    void finish() override;
+
+private:
+    void run_decoder(const DecodePipeline::ChunkSource& next_chunk);
+    bool decode(const QByteArray& chunk);
+
+    QFile decoded_file;
+    XzImageDecoder::XzDecoderUPtr xz_decoder;
+    bool stream_end{false};
+    DecodePipeline pipeline; // last, so that its worker is done before the rest goes
+};
 } // namespace multipass
 #endif // MULTIPASS_XZ_IMAGE_DECODER_H
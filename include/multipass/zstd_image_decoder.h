@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_ZSTD_IMAGE_DECODER_H
+#define MULTIPASS_ZSTD_IMAGE_DECODER_H
+
+#include <multipass/image_decoder.h>
+
+#include <memory>
+
+#include <QByteArray>
+#include <QFile>
+
+#include <zstd.h>
+
+namespace multipass
+{
+class ZstdImageDecoder final : public ImageDecoder
+{
+public:
+    ZstdImageDecoder(const Path& zstd_file_path);
+
+    void decode_to(const Path& decoded_file_path, const ProgressMonitor& monitor) override;
+
+    using ZstdDecoderUPtr = std::unique_ptr<ZSTD_DCtx, decltype(ZSTD_freeDCtx)*>;
+
+private:
+    QFile zstd_file;
+};
+
+class PipelinedZstdDecoder final : public PipelinedImageDecoder
+{
+public:
+    PipelinedZstdDecoder(const Path& decoded_file_path);
+
+    void feed(const QByteArray& chunk) override;
+    void finish() override;
+
+private:
+    void run_decoder(const DecodePipeline::ChunkSource& next_chunk);
+    void decode(const QByteArray& chunk);
+
+    QFile decoded_file;
+    ZstdImageDecoder::ZstdDecoderUPtr zstd_decoder;
+    bool frame_end{false};
+    DecodePipeline pipeline; // last, so that its worker is done before the rest goes
+};
+} // namespace multipass
+#endif // MULTIPASS_ZSTD_IMAGE_DECODER_H
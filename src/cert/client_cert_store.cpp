@@ -52,6 +52,10 @@ mp::ClientCertStore::ClientCertStore(const multipass::Path& cert_dir) : cert_dir
 void mp::ClientCertStore::add_cert(const std::string& pem_cert)
 {
     validate_certificate(pem_cert);
+
+    std::lock_guard<decltype(chain_mutex)> lock{chain_mutex};
+    chain = nullopt; // whatever makes it to the file, it is read again
+
     QDir dir{cert_dir};
     QFile file{dir.filePath(chain_name)};
     auto opened = file.open(QIODevice::WriteOnly | QIODevice::Append);
@@ -65,9 +69,13 @@ void mp::ClientCertStore::add_cert(const std::string& pem_cert)
 
 std::string mp::ClientCertStore::PEM_cert_chain() const
 {
-    QDir dir{cert_dir};
-    auto path = dir.filePath(chain_name);
-    if (QFile::exists(path))
-        return mp::utils::contents_of(path);
-    return {};
+    std::lock_guard<decltype(chain_mutex)> lock{chain_mutex};
+    if (!chain)
+    {
+        QDir dir{cert_dir};
+        auto path = dir.filePath(chain_name);
+        chain = QFile::exists(path) ? mp::utils::contents_of(path) : std::string{};
+    }
+
+    return *chain;
 }
@@ -0,0 +1,307 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "load_driver.h"
+
+#include <multipass/ssh/sftp_client.h>
+#include <multipass/ssh/ssh_client.h>
+#include <multipass/ssh/ssh_session.h>
+
+#include <multipass/format.h>
+
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTemporaryFile>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <sstream>
+#include <thread>
+
+namespace mp = multipass;
+namespace mpb = multipass::bench;
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+template <typename Request, typename Reply, typename OnReply>
+grpc::Status call(mp::Rpc::Stub& stub,
+                  std::unique_ptr<grpc::ClientReader<Reply>> (mp::Rpc::Stub::*rpc)(grpc::ClientContext*,
+                                                                                    const Request&),
+                  const Request& request, OnReply&& on_reply)
+{
+    grpc::ClientContext context;
+    auto reader = (stub.*rpc)(&context, request);
+
+    Reply reply;
+    while (reader->Read(&reply))
+        on_reply(reply);
+
+    return reader->Finish();
+}
+
+template <typename Request, typename Reply>
+grpc::Status call(mp::Rpc::Stub& stub,
+                  std::unique_ptr<grpc::ClientReader<Reply>> (mp::Rpc::Stub::*rpc)(grpc::ClientContext*,
+                                                                                    const Request&),
+                  const Request& request)
+{
+    return call(stub, rpc, request, [](const Reply&) {});
+}
+
+template <typename Request>
+Request for_instance(const std::string& instance)
+{
+    Request request;
+    request.mutable_instance_names()->add_instance_name(instance);
+    return request;
+}
+
+mp::SSHInfo ssh_info_for(mp::Rpc::Stub& stub, const std::string& instance)
+{
+    mp::SSHInfoRequest request;
+    request.add_instance_name(instance);
+
+    mp::SSHInfo info;
+    auto status = call(stub, &mp::Rpc::Stub::ssh_info, request, [&info, &instance](const mp::SSHInfoReply& reply) {
+        auto it = reply.ssh_info().find(instance);
+        if (it != reply.ssh_info().end())
+            info = it->second;
+    });
+
+    if (!status.ok())
+        throw std::runtime_error(status.error_message());
+    if (info.host().empty())
+        throw std::runtime_error("no SSH details");
+
+    mp::SSHSession::set_crypto_profile(info.crypto_profile());
+    return info;
+}
+
+void throw_on_failure(const grpc::Status& status)
+{
+    if (!status.ok())
+        throw std::runtime_error(status.error_message());
+}
+} // namespace
+
+mpb::LoadDriver::LoadDriver(Rpc::Stub& stub, const LoadConfig& config) : stub{stub}, config{config}
+{
+    for (auto i = 0; i < config.instances; ++i)
+        instances.push_back(fmt::format("{}-{}", config.name_prefix, i));
+}
+
+const std::vector<std::string>& mpb::LoadDriver::known_phases()
+{
+    static const std::vector<std::string> phases{"exec", "transfer", "stop", "start", "suspend", "resume", "restart"};
+    return phases;
+}
+
+template <typename Operation>
+void mpb::LoadDriver::run_on_all(const std::string& phase, Operation&& operation)
+{
+    std::atomic<std::size_t> next{0};
+    auto worker = [this, &phase, &operation, &next] {
+        for (auto i = next++; i < instances.size(); i = next++)
+        {
+            auto start = Clock::now();
+            try
+            {
+                operation(instances[i]);
+                record(phase, Clock::now() - start);
+            }
+            catch (const std::exception& e)
+            {
+                record_failure(phase, fmt::format("{}: {}", instances[i], e.what()));
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (auto i = 0; i < std::max(1, std::min<int>(config.concurrency, instances.size())); ++i)
+        workers.emplace_back(worker);
+
+    for (auto& thread : workers)
+        thread.join();
+}
+
+mpb::LoadResults mpb::LoadDriver::run()
+{
+    QTemporaryFile source;
+    if (!source.open())
+        throw std::runtime_error("cannot create the file to transfer");
+
+    const QByteArray chunk(1 << 20, 'x');
+    for (auto left = config.transfer_size; left > 0; left -= chunk.size())
+        source.write(chunk.constData(), std::min<long long>(left, chunk.size()));
+    source.flush();
+    transfer_source = source.fileName().toStdString();
+
+    run_on_all("launch", [this](const std::string& instance) { launch(instance); });
+
+    for (auto round = 0; round < config.rounds; ++round)
+    {
+        for (const auto& phase : config.phases)
+        {
+            if (phase == "exec")
+                run_on_all(phase, [this](const std::string& instance) { exec(instance); });
+            else if (phase == "transfer")
+                run_on_all(phase, [this](const std::string& instance) { transfer(instance); });
+            else if (phase == "stop")
+                run_on_all(phase, [this](const std::string& instance) {
+                    throw_on_failure(call(stub, &Rpc::Stub::stop, for_instance<StopRequest>(instance)));
+                });
+            else if (phase == "start" || phase == "resume")
+                run_on_all(phase, [this](const std::string& instance) {
+                    throw_on_failure(call(stub, &Rpc::Stub::start, for_instance<StartRequest>(instance)));
+                });
+            else if (phase == "suspend")
+                run_on_all(phase, [this](const std::string& instance) {
+                    throw_on_failure(call(stub, &Rpc::Stub::suspend, for_instance<SuspendRequest>(instance)));
+                });
+            else if (phase == "restart")
+                run_on_all(phase, [this](const std::string& instance) {
+                    throw_on_failure(call(stub, &Rpc::Stub::restart, for_instance<RestartRequest>(instance)));
+                });
+        }
+    }
+
+    if (!config.keep_instances)
+        remove_instances();
+
+    return results;
+}
+
+void mpb::LoadDriver::record(const std::string& phase, Clock::duration elapsed)
+{
+    std::lock_guard<decltype(results_mutex)> lock{results_mutex};
+    results[phase].durations_ms.push_back(std::chrono::duration<double, std::milli>(elapsed).count());
+}
+
+void mpb::LoadDriver::record_failure(const std::string& phase, const std::string& error)
+{
+    std::lock_guard<decltype(results_mutex)> lock{results_mutex};
+    auto& stats = results[phase];
+    ++stats.failures;
+    stats.last_error = error;
+}
+
+void mpb::LoadDriver::launch(const std::string& instance)
+{
+    LaunchRequest request;
+    request.set_instance_name(instance);
+    request.set_image(config.image);
+    request.set_timings(true);
+    request.mutable_opt_in_reply()->set_opt_in_status(OptInStatus::LATER);
+
+    std::vector<std::pair<std::string, double>> daemon_phases;
+    auto status = call(stub, &Rpc::Stub::launch, request, [&daemon_phases](const LaunchReply& reply) {
+        for (const auto& timing : reply.timings())
+            daemon_phases.emplace_back(timing.phase(), timing.duration_ms());
+    });
+    throw_on_failure(status);
+
+    std::lock_guard<decltype(results_mutex)> lock{results_mutex};
+    for (const auto& phase : daemon_phases)
+        results["launch:" + phase.first].durations_ms.push_back(phase.second);
+}
+
+void mpb::LoadDriver::exec(const std::string& instance)
+{
+    auto info = ssh_info_for(stub, instance);
+    auto session = make_ssh_session(info.host(), info.port(), info.username(), info.priv_key_base64());
+
+    auto process = session->exec(config.exec_command);
+    auto exit_code = process.exit_code(std::chrono::minutes(5));
+    if (exit_code != 0)
+        throw std::runtime_error(fmt::format("\"{}\" exited with {}", config.exec_command, exit_code));
+}
+
+void mpb::LoadDriver::transfer(const std::string& instance)
+{
+    auto info = ssh_info_for(stub, instance);
+    SFTPClient sftp_client{info.host(), info.port(), info.username(), info.priv_key_base64()};
+    sftp_client.push_file(transfer_source, "multipass-bench-transfer");
+}
+
+void mpb::LoadDriver::remove_instances()
+{
+    run_on_all("delete", [this](const std::string& instance) {
+        auto request = for_instance<DeleteRequest>(instance);
+        request.set_purge(true);
+        throw_on_failure(call(stub, &Rpc::Stub::delet, request));
+    });
+}
+
+double mpb::percentile(const std::vector<double>& sorted_durations, double p)
+{
+    if (sorted_durations.empty())
+        return 0.;
+
+    auto rank = static_cast<std::size_t>(std::ceil(p / 100. * sorted_durations.size()));
+    return sorted_durations[std::max<std::size_t>(rank, 1) - 1];
+}
+
+std::string mpb::format_table(const LoadResults& results)
+{
+    std::ostringstream out;
+    out << fmt::format("{:<28}{:>7}{:>8}{:>11}{:>11}{:>11}{:>11}\n", "Phase", "Count", "Failed", "p50 ms", "p95 ms",
+                       "p99 ms", "Max ms");
+
+    for (const auto& result : results)
+    {
+        auto durations = result.second.durations_ms;
+        std::sort(durations.begin(), durations.end());
+
+        out << fmt::format("{:<28}{:>7}{:>8}{:>11.1f}{:>11.1f}{:>11.1f}{:>11.1f}\n", result.first, durations.size(),
+                           result.second.failures, percentile(durations, 50), percentile(durations, 95),
+                           percentile(durations, 99), durations.empty() ? 0. : durations.back());
+    }
+
+    for (const auto& result : results)
+        if (result.second.failures)
+            out << fmt::format("{} last failed with: {}\n", result.first, result.second.last_error);
+
+    return out.str();
+}
+
+std::string mpb::format_json(const LoadResults& results)
+{
+    QJsonObject phases;
+    for (const auto& result : results)
+    {
+        auto durations = result.second.durations_ms;
+        std::sort(durations.begin(), durations.end());
+
+        QJsonObject phase;
+        phase.insert("count", static_cast<int>(durations.size()));
+        phase.insert("failures", result.second.failures);
+        phase.insert("p50_ms", percentile(durations, 50));
+        phase.insert("p95_ms", percentile(durations, 95));
+        phase.insert("p99_ms", percentile(durations, 99));
+        phase.insert("max_ms", durations.empty() ? 0. : durations.back());
+        if (result.second.failures)
+            phase.insert("last_error", QString::fromStdString(result.second.last_error));
+
+        phases.insert(QString::fromStdString(result.first), phase);
+    }
+
+    return QJsonDocument{phases}.toJson().toStdString();
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_LOAD_DRIVER_H
+#define MULTIPASS_LOAD_DRIVER_H
+
+#include <multipass/rpc/multipass.grpc.pb.h>
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace multipass
+{
+namespace bench
+{
+struct LoadConfig
+{
+    int instances{4};
+    int concurrency{4};
+    int rounds{1};
+    std::string image;
+    std::string name_prefix{"bench"};
+    // Run on every instance after it is launched, in this order, once per round
+    std::vector<std::string> phases{"exec", "transfer", "stop", "start", "suspend", "resume"};
+    std::string exec_command{"true"};
+    long long transfer_size{16 << 20};
+    bool keep_instances{false};
+};
+
+struct PhaseStats
+{
+    std::vector<double> durations_ms;
+    int failures{0};
+    std::string last_error;
+};
+
+// Keyed by operation, plus "launch:<phase>" for the daemon's own breakdown of each launch
+using LoadResults = std::map<std::string, PhaseStats>;
+
+// Puts a real daemon through the instance lifecycle, running each operation on all instances with a bounded
+// number of calls in flight, and times every call from the client's side
+class LoadDriver
+{
+public:
+    LoadDriver(Rpc::Stub& stub, const LoadConfig& config);
+
+    LoadResults run();
+
+    static const std::vector<std::string>& known_phases();
+
+private:
+    template <typename Operation>
+    void run_on_all(const std::string& phase, Operation&& operation);
+    void record(const std::string& phase, std::chrono::steady_clock::duration elapsed);
+    void record_failure(const std::string& phase, const std::string& error);
+
+    void launch(const std::string& instance);
+    void exec(const std::string& instance);
+    void transfer(const std::string& instance);
+    void remove_instances();
+
+    Rpc::Stub& stub;
+    const LoadConfig config;
+    std::vector<std::string> instances;
+    std::string transfer_source;
+
+    std::mutex results_mutex;
+    LoadResults results;
+};
+
+// Nearest-rank percentile of durations that are already sorted
+double percentile(const std::vector<double>& sorted_durations, double p);
+
+std::string format_table(const LoadResults& results);
+std::string format_json(const LoadResults& results);
+} // namespace bench
+} // namespace multipass
+#endif // MULTIPASS_LOAD_DRIVER_H
@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "load_driver.h"
+
+#include <multipass/cli/client_common.h>
+#include <multipass/top_catch_all.h>
+
+#include <multipass/format.h>
+
+#include <QCommandLineOption>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QFile>
+
+#include <algorithm>
+#include <iostream>
+
+namespace mp = multipass;
+namespace mpb = multipass::bench;
+
+namespace
+{
+int positive_value(const QCommandLineParser& parser, const QCommandLineOption& option)
+{
+    bool ok{false};
+    auto value = parser.value(option).toInt(&ok);
+    if (!ok || value < 1)
+        throw std::runtime_error(
+            fmt::format("--{} needs a positive number, got \"{}\"", option.names().last(), parser.value(option)));
+
+    return value;
+}
+
+mpb::LoadConfig parse(const QCoreApplication& app, QString& json_path)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Times instance operations against a running multipass daemon");
+    parser.addHelpOption();
+
+    QCommandLineOption instances_option{{"n", "instances"}, "Number of instances to launch", "count", "4"};
+    QCommandLineOption concurrency_option{
+        {"c", "concurrency"}, "Operations in flight at once (default: one per instance)", "count"};
+    QCommandLineOption rounds_option{"rounds", "Times to go through the phases after launching", "count", "1"};
+    QCommandLineOption image_option{"image", "Image to launch (default: the daemon's default)", "image"};
+    QCommandLineOption prefix_option{"prefix", "Prefix of the instance names", "prefix", "bench"};
+    const auto phases_description = fmt::format("Comma-separated phases to run after launching, out of: {}",
+                                                fmt::join(mpb::LoadDriver::known_phases(), ","));
+    QCommandLineOption phases_option{"phases", QString::fromStdString(phases_description), "phases",
+                                     "exec,transfer,stop,start,suspend,resume"};
+    QCommandLineOption exec_option{"exec-command", "Command the exec phase runs", "command", "true"};
+    QCommandLineOption transfer_size_option{"transfer-size", "MiB the transfer phase pushes", "MiB", "16"};
+    QCommandLineOption keep_option{"keep", "Keep the instances instead of deleting and purging them"};
+    QCommandLineOption json_option{"json", "Also write the results as JSON to <file>", "file"};
+
+    parser.addOptions({instances_option, concurrency_option, rounds_option, image_option, prefix_option, phases_option,
+                       exec_option, transfer_size_option, keep_option, json_option});
+    parser.process(app);
+
+    mpb::LoadConfig config;
+    config.instances = positive_value(parser, instances_option);
+    config.concurrency = parser.isSet(concurrency_option) ? positive_value(parser, concurrency_option)
+                                                          : config.instances;
+    config.rounds = positive_value(parser, rounds_option);
+    config.image = parser.value(image_option).toStdString();
+    config.name_prefix = parser.value(prefix_option).toStdString();
+    config.exec_command = parser.value(exec_option).toStdString();
+    config.transfer_size = static_cast<long long>(positive_value(parser, transfer_size_option)) << 20;
+    config.keep_instances = parser.isSet(keep_option);
+    json_path = parser.value(json_option);
+
+    const auto& known = mpb::LoadDriver::known_phases();
+    config.phases.clear();
+    for (const auto& phase : parser.value(phases_option).split(',', QString::SkipEmptyParts))
+    {
+        if (std::find(known.begin(), known.end(), phase.toStdString()) == known.end())
+            throw std::runtime_error(fmt::format("unknown phase \"{}\"", phase));
+        config.phases.push_back(phase.toStdString());
+    }
+
+    return config;
+}
+
+int main_impl(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("multipass_load_bench");
+
+    QString json_path;
+    auto config = parse(app, json_path);
+
+    auto cert_provider = mp::client::get_cert_provider();
+    auto channel = mp::client::make_channel(mp::client::get_server_address(), mp::RpcConnectionType::ssl,
+                                            *cert_provider);
+    auto stub = mp::Rpc::NewStub(channel);
+
+    auto results = mpb::LoadDriver{*stub, config}.run();
+    std::cout << mpb::format_table(results);
+
+    if (!json_path.isEmpty())
+    {
+        QFile json_file{json_path};
+        if (!json_file.open(QIODevice::WriteOnly))
+            throw std::runtime_error(fmt::format("cannot write {}", json_path));
+        json_file.write(QByteArray::fromStdString(mpb::format_json(results)));
+    }
+
+    for (const auto& result : results)
+        if (result.second.failures)
+            return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    return mp::top_catch_all("load-bench", main_impl, argc, argv);
+}
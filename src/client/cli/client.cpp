@@ -16,25 +16,39 @@
  */
 
 #include "client.h"
+#include "cmd/bake.h"
+#include "cmd/batch.h"
+#include "cmd/clone.h"
 #include "cmd/delete.h"
 #include "cmd/exec.h"
 #include "cmd/find.h"
+#include "cmd/fleet.h"
+#include "cmd/forward.h"
 #include "cmd/get.h"
 #include "cmd/help.h"
 #include "cmd/info.h"
 #include "cmd/launch.h"
 #include "cmd/list.h"
+#include "cmd/logs.h"
+#include "cmd/metrics.h"
 #include "cmd/mount.h"
 #include "cmd/purge.h"
+#include "cmd/qos.h"
 #include "cmd/recover.h"
+#include "cmd/resize.h"
 #include "cmd/restart.h"
+#include "cmd/restore.h"
 #include "cmd/set.h"
 #include "cmd/shell.h"
+#include "cmd/snapshot.h"
+#include "cmd/snapshots.h"
 #include "cmd/start.h"
 #include "cmd/stop.h"
 #include "cmd/suspend.h"
+#include "cmd/throttle.h"
 #include "cmd/transfer.h"
 #include "cmd/umount.h"
+#include "cmd/utilization.h"
 #include "cmd/version.h"
 
 #include <grpcpp/grpcpp.h>
@@ -50,32 +64,59 @@ namespace mp = multipass;
 namespace mpl = multipass::logging;
 
 mp::Client::Client(ClientConfig& config)
-    : cert_provider{std::move(config.cert_provider)},
+    : conn_type{config.conn_type},
+      cert_provider{std::move(config.cert_provider)},
       rpc_channel{mp::client::make_channel(config.server_address, config.conn_type, *cert_provider)},
       stub{mp::Rpc::NewStub(rpc_channel)},
       term{config.term}
 {
     add_command<cmd::Launch>();
     add_command<cmd::Purge>();
+    add_command<cmd::Qos>();
+    add_command<cmd::Bake>();
+    add_command<cmd::Clone>();
     add_command<cmd::Exec>();
     add_command<cmd::Find>();
+    add_command<cmd::Forward>();
     add_command<cmd::Get>();
     add_command<cmd::Help>();
     add_command<cmd::Info>();
     add_command<cmd::List>();
+    add_command<cmd::Logs>();
+    add_command<cmd::Metrics>();
     add_command<cmd::Mount>();
     add_command<cmd::Recover>();
     add_command<cmd::Set>();
     add_command<cmd::Shell>();
+    add_command<cmd::Snapshot>();
+    add_command<cmd::Snapshots>();
+    add_command<cmd::Resize>();
+    add_command<cmd::Restore>();
     add_command<cmd::Start>();
     add_command<cmd::Stop>();
     add_command<cmd::Suspend>();
+    add_command<cmd::Throttle>();
     add_command<cmd::Transfer>();
     add_command<cmd::Restart>();
     add_command<cmd::Delete>();
     add_command<cmd::Umount>();
+    add_command<cmd::Utilization>();
     add_command<cmd::Version>();
 
+    command_makers.push_back([this](grpc::Channel& channel, Rpc::Stub& stub) {
+        return std::make_unique<cmd::Batch>(channel, stub, term,
+                                            [this, &channel, &stub] { return make_commands(channel, stub); });
+    });
+    commands.push_back(command_makers.back()(*rpc_channel, *stub));
+
+    command_makers.push_back([this](grpc::Channel& channel, Rpc::Stub& stub) {
+        return std::make_unique<cmd::Fleet>(channel, stub, term, conn_type, *cert_provider,
+                                            [this](grpc::Channel& host_channel, Rpc::Stub& host_stub) {
+                                                return make_commands(host_channel, host_stub);
+                                            });
+    });
+    commands.push_back(command_makers.back()(*rpc_channel, *stub));
+
     sort_commands();
 }
 
@@ -85,6 +126,18 @@ void mp::Client::sort_commands()
     std::sort(commands.begin(), commands.end(), name_sort);
 }
 
+std::vector<mp::cmd::Command::UPtr> mp::Client::make_commands(grpc::Channel& channel, Rpc::Stub& stub) const
+{
+    std::vector<cmd::Command::UPtr> fresh_commands;
+    for (const auto& make_command : command_makers)
+        fresh_commands.push_back(make_command(channel, stub));
+
+    auto name_sort = [](cmd::Command::UPtr& a, cmd::Command::UPtr& b) { return a->name() < b->name(); };
+    std::sort(fresh_commands.begin(), fresh_commands.end(), name_sort);
+
+    return fresh_commands;
+}
+
 int mp::Client::run(const QStringList& arguments)
 {
     QString description("Create, control and connect to Ubuntu instances.\n\n"
@@ -24,6 +24,7 @@
 #include <multipass/rpc/multipass.grpc.pb.h>
 #include <multipass/rpc_connection_type.h>
 
+#include <functional>
 #include <map>
 #include <memory>
 #include <unordered_map>
@@ -51,11 +52,16 @@ protected:
     void sort_commands();
 
 private:
+    // Fresh commands over the given connection, the client's own unless they are to talk to another daemon
+    std::vector<cmd::Command::UPtr> make_commands(grpc::Channel& channel, Rpc::Stub& stub) const;
+
+    const RpcConnectionType conn_type;
     const std::unique_ptr<CertProvider> cert_provider;
     std::shared_ptr<grpc::Channel> rpc_channel;
     std::unique_ptr<multipass::Rpc::Stub> stub;
 
     std::vector<cmd::Command::UPtr> commands;
+    std::vector<std::function<cmd::Command::UPtr(grpc::Channel&, Rpc::Stub&)>> command_makers;
 
     Terminal* term;
 };
@@ -64,8 +70,9 @@ private:
 template <typename T>
 void multipass::Client::add_command()
 {
-    auto cmd = std::make_unique<T>(*rpc_channel, *stub, term);
-    commands.push_back(std::move(cmd));
+    command_makers.push_back(
+        [this](grpc::Channel& channel, Rpc::Stub& stub) { return std::make_unique<T>(channel, stub, term); });
+    commands.push_back(command_makers.back()(*rpc_channel, *stub));
 }
 
 #endif // MULTIPASS_CLIENT_H
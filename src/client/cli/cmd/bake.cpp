@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "bake.h"
+#include "common_cli.h"
+
+#include <multipass/cli/argparser.h>
+
+namespace mp = multipass;
+namespace cmd = multipass::cmd;
+using RpcMethod = mp::Rpc::Stub;
+
+mp::ReturnCode cmd::Bake::run(mp::ArgParser* parser)
+{
+    auto ret = parse_args(parser);
+    if (ret != ParseCode::Ok)
+    {
+        return parser->returnCodeFrom(ret);
+    }
+
+    auto on_success = [this](mp::BakeReply& reply) {
+        cout << (request.remove() ? "Deleted: " : "Baked: ") << request.image_name() << "\n";
+        return ReturnCode::Ok;
+    };
+
+    auto on_failure = [this](grpc::Status& status) { return standard_failure_handler_for(name(), cerr, status); };
+
+    request.set_verbosity_level(parser->verbosityLevel());
+    return dispatch(&RpcMethod::bake, request, on_success, on_failure);
+}
+
+std::string cmd::Bake::name() const
+{
+    return "bake";
+}
+
+QString cmd::Bake::short_help() const
+{
+    return QStringLiteral("Make an image out of an instance");
+}
+
+QString cmd::Bake::description() const
+{
+    return QStringLiteral("Write the disk of a stopped instance out as an image of its own, which\n"
+                          "'multipass launch <image>' then starts new instances from, with what\n"
+                          "was set up in it already there. Baked images go before those of the\n"
+                          "image servers by the same name, and 'baked:<image>' asks for one only.\n"
+                          "With --delete, the baked image is deleted instead.");
+}
+
+mp::ParseCode cmd::Bake::parse_args(mp::ArgParser* parser)
+{
+    parser->addPositionalArgument("instance", "Name of the instance to bake", "<instance>");
+    parser->addPositionalArgument("image", "Name to launch the image by", "<image>");
+
+    QCommandLineOption compress_option("compress", "Compress the image, which makes it smaller but slower to read");
+    QCommandLineOption delete_option("delete", "Delete the baked image given, instead of baking one");
+    parser->addOptions({compress_option, delete_option});
+
+    auto status = parser->commandParse(this);
+    if (status != ParseCode::Ok)
+        return status;
+
+    const auto removing = parser->isSet(delete_option);
+    if (parser->positionalArguments().count() != (removing ? 1 : 2))
+    {
+        cerr << "Wrong number of arguments\n";
+        return ParseCode::CommandLineError;
+    }
+
+    if (removing && parser->isSet(compress_option))
+    {
+        cerr << "--compress only goes with baking an image\n";
+        return ParseCode::CommandLineError;
+    }
+
+    request.set_remove(removing);
+    request.set_compress(parser->isSet(compress_option));
+    request.set_image_name(parser->positionalArguments().last().toStdString());
+    if (!removing)
+        request.set_instance_name(parser->positionalArguments().first().toStdString());
+
+    return status;
+}
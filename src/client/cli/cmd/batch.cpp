@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "batch.h"
+
+#include <multipass/cli/argparser.h>
+
+#include <fmt/ostream.h>
+
+#include <cctype>
+#include <string>
+
+namespace mp = multipass;
+namespace cmd = multipass::cmd;
+
+namespace
+{
+// Splits a line into words the way a shell would, minus expansions: quotes group words and a backslash escapes
+// the next character, outside single quotes
+QStringList split_words(const std::string& line)
+{
+    QStringList words;
+    std::string word;
+    bool in_word{false};
+    char quote{'\0'};
+
+    for (std::size_t i = 0; i < line.size(); ++i)
+    {
+        auto c = line[i];
+        if (quote)
+        {
+            if (c == quote)
+                quote = '\0';
+            else if (c == '\\' && quote == '"' && i + 1 < line.size())
+                word += line[++i];
+            else
+                word += c;
+        }
+        else if (c == '\'' || c == '"')
+        {
+            quote = c;
+            in_word = true;
+        }
+        else if (c == '\\' && i + 1 < line.size())
+        {
+            word += line[++i];
+            in_word = true;
+        }
+        else if (std::isspace(static_cast<unsigned char>(c)))
+        {
+            if (in_word)
+                words.append(QString::fromStdString(word));
+            word.clear();
+            in_word = false;
+        }
+        else
+        {
+            word += c;
+            in_word = true;
+        }
+    }
+
+    if (quote)
+        throw std::runtime_error("unterminated quote");
+
+    if (in_word)
+        words.append(QString::fromStdString(word));
+
+    return words;
+}
+} // namespace
+
+cmd::Batch::Batch(grpc::Channel& channel, Rpc::Stub& stub, Terminal* term, CommandMaker make_commands)
+    : Command{channel, stub, term}, make_commands{std::move(make_commands)}
+{
+}
+
+mp::ReturnCode cmd::Batch::run(mp::ArgParser* parser)
+{
+    auto ret = parse_args(parser);
+    if (ret != ParseCode::Ok)
+        return parser->returnCodeFrom(ret);
+
+    auto return_code = ReturnCode::Ok;
+    std::string line;
+    for (int line_number = 1; std::getline(term->cin(), line); ++line_number)
+    {
+        QStringList words;
+        try
+        {
+            words = split_words(line);
+        }
+        catch (const std::runtime_error& e)
+        {
+            fmt::print(cerr, "line {}: {}\n", line_number, e.what());
+            return_code = ReturnCode::CommandLineError;
+            if (stop_on_error)
+                break;
+            continue;
+        }
+
+        if (words.isEmpty() || words.first().startsWith('#'))
+            continue;
+
+        if (words.first() == "multipass")
+            words.removeFirst();
+
+        if (!words.isEmpty() && words.first() == QString::fromStdString(name()))
+        {
+            fmt::print(cerr, "line {}: batches cannot be nested\n", line_number);
+            return_code = ReturnCode::CommandLineError;
+            if (stop_on_error)
+                break;
+            continue;
+        }
+
+        auto commands = make_commands();
+        ArgParser line_parser{QStringList{"multipass"} + words, commands, cout, cerr};
+        auto parse_code = line_parser.parse();
+        auto line_code = parse_code == ParseCode::Ok ? line_parser.chosenCommand()->run(&line_parser)
+                                                     : line_parser.returnCodeFrom(parse_code);
+
+        if (line_code != ReturnCode::Ok)
+        {
+            return_code = line_code;
+            if (stop_on_error)
+                break;
+        }
+    }
+
+    return return_code;
+}
+
+std::string cmd::Batch::name() const
+{
+    return "batch";
+}
+
+QString cmd::Batch::short_help() const
+{
+    return QStringLiteral("Run commands read from stdin");
+}
+
+QString cmd::Batch::description() const
+{
+    return QStringLiteral("Run the multipass commands read from stdin, one per line, over a\n"
+                          "single connection to the daemon. Blank lines and lines starting\n"
+                          "with '#' are skipped. Exits with the return code of the last\n"
+                          "command that failed, or 0 if all of them succeeded.");
+}
+
+mp::ParseCode cmd::Batch::parse_args(mp::ArgParser* parser)
+{
+    QCommandLineOption stop_option("stop-on-error", "Stop at the first command that fails");
+    parser->addOption(stop_option);
+
+    auto status = parser->commandParse(this);
+    if (status != ParseCode::Ok)
+        return status;
+
+    if (!parser->positionalArguments().isEmpty())
+    {
+        cerr << "This command takes no arguments\n";
+        return ParseCode::CommandLineError;
+    }
+
+    stop_on_error = parser->isSet(stop_option);
+
+    return ParseCode::Ok;
+}
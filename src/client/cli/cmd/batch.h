@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_BATCH_H
+#define MULTIPASS_BATCH_H
+
+#include <multipass/cli/command.h>
+
+#include <functional>
+#include <vector>
+
+namespace multipass
+{
+namespace cmd
+{
+// Runs the commands read from stdin, one per line, over the client's one connection to the daemon
+class Batch final : public Command
+{
+public:
+    // Commands keep what they parsed, so each line gets fresh ones
+    using CommandMaker = std::function<std::vector<Command::UPtr>()>;
+
+    Batch(grpc::Channel& channel, Rpc::Stub& stub, Terminal* term, CommandMaker make_commands);
+    ReturnCode run(ArgParser* parser) override;
+
+    std::string name() const override;
+    QString short_help() const override;
+    QString description() const override;
+
+private:
+    ParseCode parse_args(ArgParser* parser) override;
+
+    CommandMaker make_commands;
+    bool stop_on_error{false};
+};
+} // namespace cmd
+} // namespace multipass
+#endif // MULTIPASS_BATCH_H
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "clone.h"
+#include "common_cli.h"
+
+#include <multipass/cli/argparser.h>
+
+namespace mp = multipass;
+namespace cmd = multipass::cmd;
+using RpcMethod = mp::Rpc::Stub;
+
+mp::ReturnCode cmd::Clone::run(mp::ArgParser* parser)
+{
+    auto ret = parse_args(parser);
+    if (ret != ParseCode::Ok)
+    {
+        return parser->returnCodeFrom(ret);
+    }
+
+    auto on_success = [this](mp::CloneReply& reply) {
+        cout << "Cloned: " << reply.instance_name() << "\n";
+        return ReturnCode::Ok;
+    };
+
+    auto on_failure = [this](grpc::Status& status) { return standard_failure_handler_for(name(), cerr, status); };
+
+    request.set_verbosity_level(parser->verbosityLevel());
+    return dispatch(&RpcMethod::clone, request, on_success, on_failure);
+}
+
+std::string cmd::Clone::name() const
+{
+    return "clone";
+}
+
+QString cmd::Clone::short_help() const
+{
+    return QStringLiteral("Make a copy of an instance");
+}
+
+QString cmd::Clone::description() const
+{
+    return QStringLiteral("Make a new instance that starts out with the disk of a stopped one,\n"
+                          "and with a hostname and network address of its own. The copy takes\n"
+                          "seconds, since both instances share what the disk held up to then.");
+}
+
+mp::ParseCode cmd::Clone::parse_args(mp::ArgParser* parser)
+{
+    parser->addPositionalArgument("source", "Name of the instance to clone", "<source>");
+
+    QCommandLineOption name_option({"n", "name"}, "Name for the new instance", "name");
+    parser->addOption(name_option);
+
+    auto status = parser->commandParse(this);
+    if (status != ParseCode::Ok)
+        return status;
+
+    if (parser->positionalArguments().count() != 1)
+    {
+        cerr << "Wrong number of arguments\n";
+        return ParseCode::CommandLineError;
+    }
+
+    request.set_source_name(parser->positionalArguments().first().toStdString());
+    if (parser->isSet(name_option))
+        request.set_destination_name(parser->value(name_option).toStdString());
+
+    return status;
+}
@@ -22,6 +22,10 @@
 #include <multipass/cli/format_utils.h>
 #include <multipass/exceptions/settings_exceptions.h>
 #include <multipass/settings.h>
+#include <multipass/ssh/ssh_session.h>
+#include <multipass/utils.h>
+
+#include <QRegExp>
 
 #include <fmt/ostream.h>
 #include <sstream>
@@ -104,6 +108,53 @@ mp::ParseCode cmd::handle_format_option(const mp::ArgParser* parser, mp::Formatt
     return ParseCode::Ok;
 }
 
+void cmd::add_selection_options(mp::ArgParser* parser, const QString& valid_fields)
+{
+    QCommandLineOption fields_option(fields_option_name,
+                                     QString("Only report these comma-separated fields.\nValid fields are: %1")
+                                         .arg(valid_fields),
+                                     "fields");
+    QCommandLineOption state_option(
+        state_option_name, "Only report instances in one of these comma-separated states, e.g. running,stopped",
+        "states");
+    QCommandLineOption match_option(match_option_name, "Only report instances whose name matches this glob pattern",
+                                    "pattern");
+    QCommandLineOption image_option(image_option_name,
+                                    "Only report instances launched from this image release, alias or hash prefix",
+                                    "image");
+    parser->addOptions({fields_option, state_option, match_option, image_option});
+}
+
+mp::ParseCode cmd::handle_selection_options(const mp::ArgParser* parser, mp::InstanceFilter* filter,
+                                            google::protobuf::RepeatedPtrField<std::string>* fields,
+                                            std::ostream& cerr)
+{
+    if (parser->isSet(fields_option_name))
+        for (const auto& field : parser->value(fields_option_name).split(',', QString::SkipEmptyParts))
+            fields->Add(field.trimmed().toStdString());
+
+    if (parser->isSet(state_option_name))
+    {
+        for (const auto& state : parser->value(state_option_name).split(',', QString::SkipEmptyParts))
+        {
+            mp::InstanceStatus::Status status;
+            auto enum_name = state.trimmed().toUpper().replace(QRegExp("[ -]"), "_").toStdString();
+            if (!mp::InstanceStatus::Status_Parse(enum_name, &status))
+            {
+                fmt::print(cerr, "Invalid state given: {}\n", state.trimmed());
+                return ParseCode::CommandLineError;
+            }
+
+            filter->add_states(status);
+        }
+    }
+
+    filter->set_name_glob(parser->value(match_option_name).toStdString());
+    filter->set_image(parser->value(image_option_name).toStdString());
+
+    return ParseCode::Ok;
+}
+
 std::string cmd::instance_action_message_for(const mp::InstanceNames& instance_names, const std::string& action_name)
 {
     std::string message{action_name};
@@ -160,3 +211,8 @@ QString multipass::cmd::describe_settings_keys()
     return std::accumulate(cbegin(keys), cend(keys), QStringLiteral("Keys:"),
                            [](const auto& a, const auto& b) { return a + "\n  " + b; });
 }
+
+void cmd::set_ssh_compression(bool requested)
+{
+    mp::SSHSession::set_compression(requested || mp::utils::is_remote_server_address(mp::client::get_server_address()));
+}
@@ -37,16 +37,34 @@ namespace cmd
 {
 const QString all_option_name{"all"};
 const QString format_option_name{"format"};
+const QString fields_option_name{"fields"};
+const QString state_option_name{"state"};
+const QString match_option_name{"match"};
+const QString image_option_name{"image"};
 
 ParseCode check_for_name_and_all_option_conflict(const ArgParser* parser, std::ostream& cerr, bool allow_empty = false);
 InstanceNames add_instance_names(const ArgParser* parser);
 InstanceNames add_instance_names(const ArgParser* parser, const std::string& default_name);
 ParseCode handle_format_option(const ArgParser* parser, Formatter** chosen_formatter, std::ostream& cerr);
+void add_selection_options(ArgParser* parser, const QString& valid_fields);
+ParseCode handle_selection_options(const ArgParser* parser, InstanceFilter* filter,
+                                   google::protobuf::RepeatedPtrField<std::string>* fields, std::ostream& cerr);
 std::string instance_action_message_for(const InstanceNames& instance_names, const std::string& action_name);
 ReturnCode run_cmd(const QStringList& args, const ArgParser* parser, std::ostream& cout, std::ostream& cerr);
 ReturnCode run_cmd_and_retry(const QStringList& args, const ArgParser* parser, std::ostream& cout, std::ostream& cerr);
 ReturnCode return_code_from(const SettingsException& e);
 QString describe_settings_keys();
+// SSH to instances is compressed when asked for, or when the daemon, and so the instances, are across a network
+void set_ssh_compression(bool requested);
+
+// Moves the entries of one message of a reply the daemon spread over several into those gathered so far
+template <typename Entries>
+void gather_entries(Entries& gathered, Entries* entries)
+{
+    for (auto& entry : *entries)
+        gathered.Add()->Swap(&entry);
+    entries->Clear();
+}
 
 // helpers for update handling
 bool update_available(const multipass::UpdateInfo& update_info);
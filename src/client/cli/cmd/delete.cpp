@@ -17,6 +17,7 @@
 
 #include "delete.h"
 #include "common_cli.h"
+#include "ssh_info_cache.h"
 
 #include <multipass/cli/argparser.h>
 
@@ -37,6 +38,7 @@ mp::ReturnCode cmd::Delete::run(mp::ArgParser* parser)
     auto on_failure = [this](grpc::Status& status) { return standard_failure_handler_for(name(), cerr, status); };
 
     request.set_verbosity_level(parser->verbosityLevel());
+    forget_ssh_info(request.instance_names());
     return dispatch(&RpcMethod::delet, request, on_success, on_failure);
 }
 
@@ -17,14 +17,150 @@
 
 #include "exec.h"
 #include "common_cli.h"
+#include "ssh_info_cache.h"
 
 #include <multipass/cli/argparser.h>
+#include <multipass/constants.h>
+#include <multipass/settings.h>
 #include <multipass/ssh/ssh_client.h>
+#include <multipass/utils.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
 
 namespace mp = multipass;
 namespace cmd = multipass::cmd;
 using RpcMethod = mp::Rpc::Stub;
 
+namespace
+{
+// Empty when the instance cannot be reached with the given details, so that the caller can ask the daemon afresh.
+// Cached details are also refused when the instance no longer presents the host key it did when they were fresh
+mp::optional<mp::ReturnCode> exec_over_shared_session(const std::string& instance_name, const mp::SSHInfo& ssh_info,
+                                                      bool cached, const std::vector<std::string>& args,
+                                                      mp::Terminal* term)
+{
+    std::unique_ptr<mp::SSHClient> ssh_client;
+    mp::SSHSession::set_crypto_profile(ssh_info.crypto_profile());
+    try
+    {
+        auto& session = cmd::shared_ssh_session(instance_name, ssh_info);
+        const auto host_key_hash = session.host_key_hash();
+        if (cached && (host_key_hash.empty() || cmd::cached_host_key(instance_name) != host_key_hash))
+            throw std::runtime_error("host key changed");
+        if (!cached && !host_key_hash.empty())
+            cmd::cache_host_key(instance_name, host_key_hash);
+
+        auto console_creator = [&term](auto channel) { return mp::Console::make_console(channel, term); };
+        ssh_client = std::make_unique<mp::SSHClient>(session, console_creator);
+    }
+    catch (const std::exception&)
+    {
+        cmd::drop_shared_ssh_session(instance_name);
+        return mp::nullopt;
+    }
+
+    try
+    {
+        return static_cast<mp::ReturnCode>(ssh_client->exec(args));
+    }
+    catch (const std::exception& e)
+    {
+        term->cerr() << "exec failed: " << e.what() << "\n";
+        return mp::ReturnCode::CommandFail;
+    }
+}
+
+// Each instance's output goes out a line at a time, led by the instance's name, so that lines from different instances
+// never run into each other
+mp::ReturnCode exec_on_each(const mp::SSHInfoReply& reply, const std::vector<std::string>& args, int parallel,
+                            mp::Terminal* term)
+{
+    std::vector<std::pair<std::string, mp::SSHInfo>> targets{reply.ssh_info().begin(), reply.ssh_info().end()};
+    if (targets.empty())
+    {
+        term->cerr() << "No running instances to execute the command on\n";
+        return mp::ReturnCode::Ok;
+    }
+    std::sort(targets.begin(), targets.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    mp::SSHSession::set_crypto_profile(targets.front().second.crypto_profile());
+    const auto command = mp::utils::to_cmd(args, mp::utils::QuoteType::quote_every_arg);
+    std::vector<int> exit_codes(targets.size(), -1);
+    std::vector<std::string> failures(targets.size());
+    std::mutex output_mutex;
+    std::atomic<size_t> next{0};
+
+    auto write_lines = [term, &output_mutex](const std::string& name, std::string& pending, bool is_std_err) {
+        std::lock_guard<std::mutex> lock{output_mutex};
+        auto& out = is_std_err ? term->cerr() : term->cout();
+        for (auto end = pending.find('\n'); end != std::string::npos; end = pending.find('\n'))
+        {
+            out << name << ": " << pending.substr(0, end + 1);
+            pending.erase(0, end + 1);
+        }
+        out.flush();
+    };
+
+    auto exec_next = [&] {
+        for (auto i = next++; i < targets.size(); i = next++)
+        {
+            const auto& name = targets[i].first;
+            const auto& ssh_info = targets[i].second;
+            std::string pending_out, pending_err;
+            try
+            {
+                auto session = mp::make_ssh_session(ssh_info.host(), ssh_info.port(), ssh_info.username(),
+                                                    ssh_info.priv_key_base64());
+                auto process = session->exec(command);
+                exit_codes[i] = process.stream_output([&](const std::string& output, bool is_std_err) {
+                    auto& pending = is_std_err ? pending_err : pending_out;
+                    pending += output;
+                    write_lines(name, pending, is_std_err);
+                });
+            }
+            catch (const std::exception& e)
+            {
+                failures[i] = e.what();
+            }
+
+            // A last line the command left unterminated
+            for (auto is_std_err : {false, true})
+            {
+                auto& pending = is_std_err ? pending_err : pending_out;
+                if (!pending.empty())
+                {
+                    pending += '\n';
+                    write_lines(name, pending, is_std_err);
+                }
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (auto i = 0u; i < std::min<size_t>(parallel, targets.size()); ++i)
+        workers.emplace_back(exec_next);
+    for (auto& worker : workers)
+        worker.join();
+
+    auto ret = mp::ReturnCode::Ok;
+    for (auto i = 0u; i < targets.size(); ++i)
+    {
+        if (!failures[i].empty())
+            term->cerr() << targets[i].first << ": exec failed: " << failures[i] << "\n";
+        else
+            term->cerr() << targets[i].first << ": exited with code " << exit_codes[i] << "\n";
+
+        if (!failures[i].empty() || exit_codes[i] != 0)
+            ret = mp::ReturnCode::CommandFail;
+    }
+
+    return ret;
+}
+} // namespace
+
 mp::ReturnCode cmd::Exec::run(mp::ArgParser* parser)
 {
     auto ret = parse_args(parser);
@@ -34,10 +170,47 @@ mp::ReturnCode cmd::Exec::run(mp::ArgParser* parser)
     }
 
     std::vector<std::string> args;
-    for (int i = 1; i < parser->positionalArguments().size(); ++i)
+    for (int i = parser->isSet(all_option_name) ? 0 : 1; i < parser->positionalArguments().size(); ++i)
         args.push_back(parser->positionalArguments().at(i).toStdString());
 
-    auto on_success = [this, &args](mp::SSHInfoReply& reply) { return exec_success(reply, args, term); };
+    set_ssh_compression(compress);
+    if (fan_out)
+    {
+        auto on_success = [this, &args](mp::SSHInfoReply& reply) { return exec_on_each(reply, args, parallel, term); };
+        auto on_failure = [this](grpc::Status& status) { return standard_failure_handler_for(name(), cerr, status); };
+
+        request.set_verbosity_level(parser->verbosityLevel());
+        return dispatch(&RpcMethod::ssh_info, request, on_success, on_failure);
+    }
+
+    const auto fast_exec = Settings::instance().get(fast_exec_key) == "true";
+    if (fast_exec)
+    {
+        const auto& instance_name = request.instance_name(0);
+        if (auto ssh_info = cached_ssh_info(instance_name))
+        {
+            if (auto ret = exec_over_shared_session(instance_name, *ssh_info, true, args, term))
+                return *ret;
+
+            InstanceNames stale;
+            stale.add_instance_name(instance_name);
+            forget_ssh_info(stale);
+        }
+    }
+
+    auto on_success = [this, &args, fast_exec](mp::SSHInfoReply& reply) {
+        if (!fast_exec || reply.ssh_info().empty())
+            return exec_success(reply, args, term);
+
+        const auto& instance_name = reply.ssh_info().begin()->first;
+        const auto& ssh_info = reply.ssh_info().begin()->second;
+        cache_ssh_info(instance_name, ssh_info);
+
+        if (auto ret = exec_over_shared_session(instance_name, ssh_info, false, args, term))
+            return *ret;
+
+        return exec_success(reply, args, term); // connecting anew reports why the instance cannot be reached
+    };
 
     auto on_failure = [this](grpc::Status& status) { return standard_failure_handler_for(name(), cerr, status); };
 
@@ -72,6 +245,7 @@ mp::ReturnCode cmd::Exec::exec_success(const mp::SSHInfoReply& reply, const std:
     const auto& port = ssh_info.port();
     const auto& username = ssh_info.username();
     const auto& priv_key_blob = ssh_info.priv_key_base64();
+    mp::SSHSession::set_crypto_profile(ssh_info.crypto_profile());
 
     try
     {
@@ -88,9 +262,22 @@ mp::ReturnCode cmd::Exec::exec_success(const mp::SSHInfoReply& reply, const std:
 
 mp::ParseCode cmd::Exec::parse_args(mp::ArgParser* parser)
 {
-    parser->addPositionalArgument("name", "Name of instance to execute the command on", "<name>");
+    parser->addPositionalArgument("name",
+                                  "Name of instance to execute the command on. Wildcards run it on every running "
+                                  "instance they match, a few at a time, with each line of output led by the "
+                                  "instance it came from",
+                                  "<name>");
     parser->addPositionalArgument("command", "Command to execute on the instance", "[--] <command>");
 
+    QCommandLineOption compress_option("compress", "Compress the command's input and output, for instances behind "
+                                                   "slow links");
+    QCommandLineOption all_option(all_option_name, "Execute the command on all running instances, in place of <name>");
+    QCommandLineOption parallel_option("parallel",
+                                       "How many instances to execute the command on at a time, when on more than "
+                                       "one (default: 8)",
+                                       "count", "8");
+    parser->addOptions({compress_option, all_option, parallel_option});
+
     auto status = parser->commandParse(this);
 
     if (status != ParseCode::Ok)
@@ -98,16 +285,26 @@ mp::ParseCode cmd::Exec::parse_args(mp::ArgParser* parser)
         return status;
     }
 
-    if (parser->positionalArguments().count() < 2)
+    compress = parser->isSet(compress_option);
+
+    const auto all = parser->isSet(all_option);
+    if (parser->positionalArguments().count() < (all ? 1 : 2))
     {
         cerr << "Wrong number of arguments\n";
-        status = ParseCode::CommandLineError;
+        return ParseCode::CommandLineError;
     }
-    else
+
+    auto ok = false;
+    parallel = parser->value(parallel_option).toInt(&ok);
+    if (!ok || parallel < 1)
     {
-        auto entry = request.add_instance_name();
-        entry->append(parser->positionalArguments().first().toStdString());
+        cerr << "--parallel must be a positive number of instances\n";
+        return ParseCode::CommandLineError;
     }
 
+    const auto instance_name = all ? std::string{"*"} : parser->positionalArguments().first().toStdString();
+    fan_out = instance_name.find_first_of("*?[") != std::string::npos;
+    request.add_instance_name(instance_name);
+
     return status;
 }
@@ -40,6 +40,9 @@ public:
 
 private:
     SSHInfoRequest request;
+    bool compress{false};
+    bool fan_out{false}; // on every instance matched, rather than on the one named
+    int parallel{0};
 
     ParseCode parse_args(ArgParser* parser) override;
 };
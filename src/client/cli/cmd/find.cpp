@@ -33,16 +33,23 @@ mp::ReturnCode cmd::Find::run(mp::ArgParser* parser)
         return parser->returnCodeFrom(ret);
     }
 
-    auto on_success = [this](FindReply& reply) {
-        cout << chosen_formatter->format(reply);
+    google::protobuf::RepeatedPtrField<FindReply::ImageInfo> images_info;
+    auto on_success = [this, &images_info](FindReply& reply) {
+        reply.mutable_images_info()->Swap(&images_info);
+        chosen_formatter->format_to(cout, reply);
 
         return ReturnCode::Ok;
     };
 
     auto on_failure = [this](grpc::Status& status) { return standard_failure_handler_for(name(), cerr, status); };
 
+    auto streaming_callback = [&images_info](FindReply& reply) {
+        gather_entries(images_info, reply.mutable_images_info());
+    };
+
     request.set_verbosity_level(parser->verbosityLevel());
-    return dispatch(&RpcMethod::find, request, on_success, on_failure);
+    request.set_chunked_reply(true);
+    return dispatch(&RpcMethod::find, request, on_success, on_failure, streaming_callback);
 }
 
 std::string cmd::Find::name() const
@@ -0,0 +1,347 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "fleet.h"
+#include "common_cli.h"
+
+#include <multipass/cli/argparser.h>
+#include <multipass/cli/client_common.h>
+#include <multipass/cli/format_utils.h>
+#include <multipass/cli/formatter.h>
+
+#include <fmt/ostream.h>
+
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <set>
+#include <tuple>
+
+namespace mp = multipass;
+namespace cmd = multipass::cmd;
+
+namespace
+{
+constexpr auto fleet_env_var = "MULTIPASS_FLEET";
+constexpr auto host_timeout = std::chrono::seconds(30); // so that a host that is down holds the others up no longer
+
+template <typename Reply>
+struct Answer
+{
+    grpc::Status status;
+    std::vector<Reply> replies;
+};
+
+// Makes the call on every host at once, so that it takes as long as the slowest of them
+template <typename Reply, typename Request, typename RpcFunc>
+std::vector<Answer<Reply>> ask_all(std::vector<cmd::Fleet::Host>& hosts, RpcFunc rpc_func, const Request& request)
+{
+    std::vector<std::future<Answer<Reply>>> calls;
+    for (auto& host : hosts)
+    {
+        calls.push_back(std::async(std::launch::async, [&host, rpc_func, &request] {
+            grpc::ClientContext context;
+            context.set_deadline(std::chrono::system_clock::now() + host_timeout);
+
+            Answer<Reply> answer;
+            auto reader = ((*host.stub).*rpc_func)(&context, request);
+            Reply reply;
+            while (reader->Read(&reply))
+                answer.replies.push_back(reply);
+            answer.status = reader->Finish();
+
+            return answer;
+        }));
+    }
+
+    std::vector<Answer<Reply>> answers;
+    for (auto& call : calls)
+        answers.push_back(call.get());
+
+    return answers;
+}
+
+// The largest share of any resource that is limited, or nothing when none is
+double load_of(const mp::HostCommitment& commitment)
+{
+    auto share = [](double committed, double limit) { return limit > 0 ? committed / limit : 0.0; };
+    return std::max({share(commitment.cpus(), commitment.cpus_limit()),
+                     share(commitment.memory_bytes(), commitment.memory_limit_bytes()),
+                     share(commitment.disk_bytes(), commitment.disk_limit_bytes())});
+}
+} // namespace
+
+cmd::Fleet::Fleet(grpc::Channel& channel, Rpc::Stub& stub, Terminal* term, RpcConnectionType conn_type,
+                  CertProvider& cert_provider, CommandMaker make_commands)
+    : Command{channel, stub, term},
+      conn_type{conn_type},
+      cert_provider{cert_provider},
+      make_commands{std::move(make_commands)}
+{
+}
+
+mp::ReturnCode cmd::Fleet::run(mp::ArgParser* parser)
+{
+    auto ret = parse_args(parser);
+    if (ret != ParseCode::Ok)
+        return parser->returnCodeFrom(ret);
+
+    if (subcommand == "list" || subcommand == "ls")
+        return list(parser->verbosityLevel());
+    if (subcommand == "find")
+        return find(parser->verbosityLevel());
+
+    return launch(parser->verbosityLevel());
+}
+
+std::string cmd::Fleet::name() const
+{
+    return "fleet";
+}
+
+QString cmd::Fleet::short_help() const
+{
+    return QStringLiteral("List, find and launch across several daemons");
+}
+
+QString cmd::Fleet::description() const
+{
+    return QStringLiteral("Run a command against several multipass daemons at once. \"list\"\n"
+                          "and \"find\" ask every daemon side by side and merge what they\n"
+                          "answer; \"launch\" goes to the daemon with the most room left,\n"
+                          "going by what its instances take against how far it may be\n"
+                          "committed. The daemons are those given with --hosts, or else\n"
+                          "in the MULTIPASS_FLEET environment variable, as comma-separated\n"
+                          "addresses like MULTIPASS_SERVER_ADDRESS takes.");
+}
+
+mp::ParseCode cmd::Fleet::parse_args(mp::ArgParser* parser)
+{
+    parser->addPositionalArgument("command", "The command to run: list, find or launch", "<command>");
+    parser->addPositionalArgument("arguments", "The command's arguments; launch's options follow a --",
+                                  "[--] [<arguments>]");
+
+    QCommandLineOption hosts_option("hosts", "Comma-separated addresses of the daemons to run against", "hosts");
+    QCommandLineOption format_option(
+        "format", "Output find in the requested format.\nValid formats are: table (default), json, csv and yaml",
+        "format", "table");
+    parser->addOptions({hosts_option, format_option});
+
+    auto status = parser->commandParse(this);
+    if (status != ParseCode::Ok)
+        return status;
+
+    auto arguments = parser->positionalArguments();
+    if (arguments.isEmpty())
+    {
+        cerr << "Which command to run across the fleet is missing\n";
+        return ParseCode::CommandLineError;
+    }
+
+    subcommand = arguments.takeFirst();
+    subcommand_args = arguments;
+    if (subcommand != "list" && subcommand != "ls" && subcommand != "find" && subcommand != "launch")
+    {
+        fmt::print(cerr, "Unknown fleet command \"{}\", try list, find or launch\n", subcommand);
+        return ParseCode::CommandLineError;
+    }
+
+    if ((subcommand == "list" || subcommand == "ls") && !subcommand_args.isEmpty())
+    {
+        cerr << "Listing across the fleet takes no arguments\n";
+        return ParseCode::CommandLineError;
+    }
+
+    if (subcommand == "find" && subcommand_args.size() > 1)
+    {
+        cerr << "Wrong number of arguments\n";
+        return ParseCode::CommandLineError;
+    }
+
+    const auto addresses = parser->isSet(hosts_option) ? parser->value(hosts_option)
+                                                       : QString::fromLocal8Bit(qgetenv(fleet_env_var));
+    for (const auto& address : addresses.split(',', QString::SkipEmptyParts))
+    {
+        const auto trimmed = address.trimmed().toStdString();
+        try
+        {
+            mp::utils::validate_server_address(trimmed);
+        }
+        catch (const std::runtime_error& e)
+        {
+            fmt::print(cerr, "Invalid fleet host: {}\n", e.what());
+            return ParseCode::CommandLineError;
+        }
+
+        auto channel = mp::client::make_channel(trimmed, conn_type, cert_provider);
+        auto host_stub = Rpc::NewStub(channel);
+        hosts.push_back({trimmed, std::move(channel), std::move(host_stub)});
+    }
+
+    if (hosts.empty())
+    {
+        fmt::print(cerr, "No daemons to run against, give them with --hosts or in {}\n", fleet_env_var);
+        return ParseCode::CommandLineError;
+    }
+
+    return handle_format_option(parser, &chosen_formatter, cerr);
+}
+
+mp::ReturnCode cmd::Fleet::list(int verbosity_level)
+{
+    ListRequest request;
+    request.set_verbosity_level(verbosity_level);
+    request.set_chunked_reply(true);
+    const auto answers = ask_all<ListReply>(hosts, &Rpc::Stub::list, request);
+
+    auto return_code = ReturnCode::Ok;
+    std::vector<std::pair<std::string, const ListVMInstance*>> rows;
+    for (std::size_t i = 0; i < answers.size(); ++i)
+    {
+        if (!answers[i].status.ok())
+        {
+            fmt::print(cerr, "{}: {}\n", hosts[i].address, answers[i].status.error_message());
+            return_code = ReturnCode::CommandFail;
+            continue;
+        }
+
+        for (const auto& reply : answers[i].replies)
+            for (const auto& instance : reply.instances())
+                rows.emplace_back(hosts[i].address, &instance);
+    }
+
+    if (rows.empty())
+    {
+        cout << "No instances found.\n";
+        return return_code;
+    }
+
+    std::sort(rows.begin(), rows.end(), [](const auto& a, const auto& b) {
+        return std::tie(a.first, a.second->name()) < std::tie(b.first, b.second->name());
+    });
+
+    auto widest = [&rows](auto length_of) {
+        std::string::size_type width = 0;
+        for (const auto& row : rows)
+            width = std::max(width, length_of(row));
+        return width + 1;
+    };
+    const auto host_width = std::max<std::string::size_type>(widest([](const auto& row) { return row.first.size(); }),
+                                                             16);
+    const auto name_width = std::max<std::string::size_type>(
+        widest([](const auto& row) { return row.second->name().size(); }), 24);
+
+    const auto row_format = "{:<{}}{:<{}}{:<18}{:<17}{:<}\n";
+    fmt::print(cout, row_format, "Host", host_width, "Name", name_width, "State", "IPv4", "Image");
+    for (const auto& row : rows)
+    {
+        const auto& instance = *row.second;
+        fmt::print(cout, row_format, row.first, host_width, instance.name(), name_width,
+                   mp::format::status_string_for(instance.instance_status()),
+                   instance.ipv4().empty() ? "--" : instance.ipv4(),
+                   instance.current_release().empty() ? "Not Available"
+                                                      : fmt::format("Ubuntu {}", instance.current_release()));
+    }
+
+    return return_code;
+}
+
+mp::ReturnCode cmd::Fleet::find(int verbosity_level)
+{
+    FindRequest request;
+    request.set_verbosity_level(verbosity_level);
+    request.set_chunked_reply(true);
+    if (!subcommand_args.isEmpty())
+    {
+        const auto& search_string = subcommand_args.first();
+        if (search_string.count(':') > 1)
+        {
+            cerr << "Invalid remote and search string supplied\n";
+            return ReturnCode::CommandLineError;
+        }
+
+        request.set_remote_name(search_string.count(':') ? search_string.section(':', 0, 0).toStdString() : "");
+        request.set_search_string(search_string.section(':', -1).toStdString());
+    }
+    const auto answers = ask_all<FindReply>(hosts, &Rpc::Stub::find, request);
+
+    // Daemons that follow the same remotes mostly find the same images, which are listed once
+    auto return_code = ReturnCode::Ok;
+    FindReply merged;
+    std::set<std::string> seen;
+    for (std::size_t i = 0; i < answers.size(); ++i)
+    {
+        if (!answers[i].status.ok())
+        {
+            fmt::print(cerr, "{}: {}\n", hosts[i].address, answers[i].status.error_message());
+            return_code = ReturnCode::CommandFail;
+            continue;
+        }
+
+        for (const auto& reply : answers[i].replies)
+            for (const auto& image : reply.images_info())
+                if (seen.insert(image.SerializeAsString()).second)
+                    *merged.add_images_info() = image;
+    }
+
+    chosen_formatter->format_to(cout, merged);
+
+    return return_code;
+}
+
+mp::ReturnCode cmd::Fleet::launch(int verbosity_level)
+{
+    VersionRequest request;
+    request.set_verbosity_level(verbosity_level);
+    const auto answers = ask_all<VersionReply>(hosts, &Rpc::Stub::version, request);
+
+    // Ties go to the host with the least memory committed, for fleets that set no limits
+    Host* chosen{nullptr};
+    std::pair<double, int64_t> least_load;
+    for (std::size_t i = 0; i < answers.size(); ++i)
+    {
+        if (!answers[i].status.ok() || answers[i].replies.empty())
+        {
+            fmt::print(cerr, "{}: {}\n", hosts[i].address,
+                       answers[i].status.ok() ? "no answer" : answers[i].status.error_message());
+            continue;
+        }
+
+        const auto& commitment = answers[i].replies.back().host_commitment();
+        const std::pair<double, int64_t> load{load_of(commitment), commitment.memory_bytes()};
+        if (!chosen || load < least_load)
+        {
+            chosen = &hosts[i];
+            least_load = load;
+        }
+    }
+
+    if (!chosen)
+    {
+        cerr << "launch failed: none of the fleet's daemons answered\n";
+        return ReturnCode::DaemonFail;
+    }
+
+    fmt::print(cerr, "Launching on {}\n", chosen->address);
+
+    auto commands = make_commands(*chosen->channel, *chosen->stub);
+    ArgParser launch_parser{QStringList{"multipass", "launch"} + subcommand_args, commands, cout, cerr};
+    auto parse_code = launch_parser.parse();
+
+    return parse_code == ParseCode::Ok ? launch_parser.chosenCommand()->run(&launch_parser)
+                                       : launch_parser.returnCodeFrom(parse_code);
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_FLEET_H
+#define MULTIPASS_FLEET_H
+
+#include <multipass/cert_provider.h>
+#include <multipass/cli/command.h>
+#include <multipass/rpc_connection_type.h>
+
+#include <QStringList>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace multipass
+{
+class Formatter;
+
+namespace cmd
+{
+// Drives several daemons at once: listings and image searches ask all of them side by side and merge what they
+// answer, while launches go to the one with the most room left
+class Fleet final : public Command
+{
+public:
+    // Fresh commands talking to the given daemon, for running one there
+    using CommandMaker = std::function<std::vector<Command::UPtr>(grpc::Channel&, Rpc::Stub&)>;
+
+    Fleet(grpc::Channel& channel, Rpc::Stub& stub, Terminal* term, RpcConnectionType conn_type,
+          CertProvider& cert_provider, CommandMaker make_commands);
+    ReturnCode run(ArgParser* parser) override;
+
+    std::string name() const override;
+    QString short_help() const override;
+    QString description() const override;
+
+    struct Host
+    {
+        std::string address;
+        std::shared_ptr<grpc::Channel> channel;
+        std::unique_ptr<Rpc::Stub> stub;
+    };
+
+private:
+    ParseCode parse_args(ArgParser* parser) override;
+
+    ReturnCode list(int verbosity_level);
+    ReturnCode find(int verbosity_level);
+    ReturnCode launch(int verbosity_level);
+
+    RpcConnectionType conn_type;
+    CertProvider& cert_provider;
+    CommandMaker make_commands;
+    std::vector<Host> hosts;
+    QString subcommand;
+    QStringList subcommand_args;
+    Formatter* chosen_formatter;
+};
+} // namespace cmd
+} // namespace multipass
+#endif // MULTIPASS_FLEET_H
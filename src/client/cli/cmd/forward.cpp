@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "forward.h"
+#include "common_cli.h"
+
+#include <multipass/cli/argparser.h>
+#include <multipass/format.h>
+
+namespace mp = multipass;
+namespace cmd = multipass::cmd;
+using RpcMethod = mp::Rpc::Stub;
+
+namespace
+{
+bool parse_port(const QString& value, int& port)
+{
+    bool ok;
+    port = value.toInt(&ok);
+    return ok && port > 0 && port <= 65535;
+}
+} // namespace
+
+mp::ReturnCode cmd::Forward::run(mp::ArgParser* parser)
+{
+    auto ret = parse_args(parser);
+    if (ret != ParseCode::Ok)
+    {
+        return parser->returnCodeFrom(ret);
+    }
+
+    auto on_success = [this](mp::ForwardReply& reply) {
+        if (reply.port_forwards().empty())
+        {
+            cout << "No ports forwarded.\n";
+            return ReturnCode::Ok;
+        }
+
+        fmt::memory_buffer buf;
+        fmt::format_to(buf, "{:<24}{}\n", "Host", "Instance port");
+        for (const auto& forward : reply.port_forwards())
+            fmt::format_to(buf, "{:<24}{}\n", fmt::format("{}:{}", forward.address(), forward.host_port()),
+                           forward.instance_port());
+
+        cout << fmt::to_string(buf);
+        return ReturnCode::Ok;
+    };
+
+    auto on_failure = [this](grpc::Status& status) { return standard_failure_handler_for(name(), cerr, status); };
+
+    request.set_verbosity_level(parser->verbosityLevel());
+    return dispatch(&RpcMethod::forward, request, on_success, on_failure);
+}
+
+std::string cmd::Forward::name() const
+{
+    return "forward";
+}
+
+QString cmd::Forward::short_help() const
+{
+    return QStringLiteral("Forward host ports to an instance");
+}
+
+QString cmd::Forward::description() const
+{
+    return QStringLiteral("Relay connections to ports of the host to ports of an instance, on its\n"
+                          "address on the bridge, for as long as it runs. Forwards are kept with the\n"
+                          "instance and come back whenever it starts. Without ports to add or\n"
+                          "remove, the instance's forwards are listed.");
+}
+
+mp::ParseCode cmd::Forward::parse_args(mp::ArgParser* parser)
+{
+    parser->addPositionalArgument("instance", "Name of the instance to forward ports to", "<instance>");
+    parser->addPositionalArgument("ports", "Host ports and the instance ports they go to, e.g. 8080:80",
+                                  "[<host port>:<instance port> ...]");
+
+    QCommandLineOption address_option("address",
+                                      "Host address to listen on for the ports added, 127.0.0.1 if omitted. "
+                                      "0.0.0.0 takes connections from other hosts too.",
+                                      "address");
+    QCommandLineOption remove_option("remove", "Stop forwarding this host port; may be given more than once",
+                                     "host port");
+    parser->addOptions({address_option, remove_option});
+
+    auto status = parser->commandParse(this);
+    if (status != ParseCode::Ok)
+        return status;
+
+    const auto arguments = parser->positionalArguments();
+    if (arguments.isEmpty())
+    {
+        cerr << "Name of instance is required\n";
+        return ParseCode::CommandLineError;
+    }
+
+    request.set_instance_name(arguments.first().toStdString());
+
+    for (const auto& argument : arguments.mid(1))
+    {
+        const auto ports = argument.split(':');
+        int host_port, instance_port;
+        if (ports.size() != 2 || !parse_port(ports[0], host_port) || !parse_port(ports[1], instance_port))
+        {
+            cerr << fmt::format("Invalid port forward \"{}\", expected e.g. 8080:80\n", argument);
+            return ParseCode::CommandLineError;
+        }
+
+        auto forward = request.add_add();
+        forward->set_address(parser->value(address_option).toStdString());
+        forward->set_host_port(host_port);
+        forward->set_instance_port(instance_port);
+    }
+
+    for (const auto& value : parser->values(remove_option))
+    {
+        int host_port;
+        if (!parse_port(value, host_port))
+        {
+            cerr << fmt::format("Invalid --remove value \"{}\"\n", value);
+            return ParseCode::CommandLineError;
+        }
+
+        request.add_remove(host_port);
+    }
+
+    return status;
+}
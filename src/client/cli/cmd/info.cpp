@@ -33,16 +33,21 @@ mp::ReturnCode cmd::Info::run(mp::ArgParser* parser)
         return parser->returnCodeFrom(ret);
     }
 
-    auto on_success = [this](mp::InfoReply& reply) {
-        cout << chosen_formatter->format(reply);
+    google::protobuf::RepeatedPtrField<mp::InfoReply::Info> info;
+    auto on_success = [this, &info](mp::InfoReply& reply) {
+        reply.mutable_info()->Swap(&info);
+        chosen_formatter->format_to(cout, reply);
 
         return ReturnCode::Ok;
     };
 
     auto on_failure = [this](grpc::Status& status) { return standard_failure_handler_for(name(), cerr, status); };
 
+    auto streaming_callback = [&info](mp::InfoReply& reply) { gather_entries(info, reply.mutable_info()); };
+
     request.set_verbosity_level(parser->verbosityLevel());
-    return dispatch(&RpcMethod::info, request, on_success, on_failure);
+    request.set_chunked_reply(true);
+    return dispatch(&RpcMethod::info, request, on_success, on_failure, streaming_callback);
 }
 
 std::string cmd::Info::name() const { return "info"; }
@@ -69,6 +74,12 @@ mp::ParseCode cmd::Info::parse_args(mp::ArgParser* parser)
         "format", "table");
     parser->addOption(formatOption);
 
+    QCommandLineOption refreshOption("refresh", "Query the instances now, instead of reporting recently gathered stats");
+    parser->addOption(refreshOption);
+
+    add_selection_options(parser, "name, state, image_release, image_hash, current_release, load, memory, disk, "
+                                  "ipv4, mounts and hypervisor_stats");
+
     auto status = parser->commandParse(this);
 
     if (status != ParseCode::Ok)
@@ -81,6 +92,11 @@ mp::ParseCode cmd::Info::parse_args(mp::ArgParser* parser)
         return parse_code;
 
     request.mutable_instance_names()->CopyFrom(add_instance_names(parser));
+    request.set_refresh(parser->isSet(refreshOption));
+
+    status = handle_selection_options(parser, request.mutable_filter(), request.mutable_fields(), cerr);
+    if (status != ParseCode::Ok)
+        return status;
 
     status = handle_format_option(parser, &chosen_formatter, cerr);
 
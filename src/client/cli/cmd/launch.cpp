@@ -123,7 +123,31 @@ mp::ParseCode cmd::Launch::parse_args(mp::ArgParser* parser)
         "name");
     QCommandLineOption cloudInitOption("cloud-init", "Path to a user-data cloud-init configuration, or '-' for stdin",
                                        "file");
-    parser->addOptions({cpusOption, diskOption, memOption, nameOption, cloudInitOption});
+    QCommandLineOption diskProfileOption(
+        "disk-profile",
+        QString::fromStdString(fmt::format("How the disk is driven: '{}' goes through the host page cache, while '{}' "
+                                           "and '{}' do direct I/O on a dedicated thread, for disk-heavy workloads.\n"
+                                           "Default: {}.",
+                                           default_disk_profile, native_disk_profile, io_uring_disk_profile,
+                                           default_disk_profile)),
+        "profile", QString::fromUtf8(default_disk_profile));
+    QCommandLineOption hugepagesOption("hugepages", "Back the instance's memory with the host's huge pages, which "
+                                                    "have to be reserved beforehand");
+    QCommandLineOption resourceClassOption(
+        "resource-class",
+        QString::fromStdString(fmt::format("Share of the host's CPU and disk the instance gets when they are "
+                                           "contended: '{}' gets more than '{}', and '{}' less, within caps.\n"
+                                           "Default: {}.",
+                                           latency_resource_class, default_resource_class, batch_resource_class,
+                                           default_resource_class)),
+        "class", QString::fromUtf8(default_resource_class));
+    QCommandLineOption timingsOption("timings", "Report how long each phase of the launch took");
+    QCommandLineOption countOption("count",
+                                   "Number of alike instances to launch together, sharing the image preparation. "
+                                   "Given a name, they are called <name>-1 to <name>-<count>",
+                                   "count", "1");
+    parser->addOptions({cpusOption, diskOption, memOption, nameOption, cloudInitOption, diskProfileOption,
+                        hugepagesOption, resourceClassOption, timingsOption, countOption});
 
     auto status = parser->commandParse(this);
 
@@ -188,6 +212,18 @@ mp::ParseCode cmd::Launch::parse_args(mp::ArgParser* parser)
         request.set_disk_space(parser->value(diskOption).toStdString());
     }
 
+    if (parser->isSet(diskProfileOption))
+    {
+        request.set_disk_profile(parser->value(diskProfileOption).toStdString());
+    }
+
+    request.set_hugepages(parser->isSet(hugepagesOption));
+
+    if (parser->isSet(resourceClassOption))
+    {
+        request.set_resource_class(parser->value(resourceClassOption).toStdString());
+    }
+
     if (parser->isSet(cloudInitOption))
     {
         try
@@ -211,6 +247,26 @@ mp::ParseCode cmd::Launch::parse_args(mp::ArgParser* parser)
         }
     }
 
+    if (parser->isSet(countOption))
+    {
+        bool ok;
+        auto count = parser->value(countOption).toInt(&ok);
+        if (!ok || count < 1)
+        {
+            cerr << "Invalid count supplied: " << parser->value(countOption).toStdString() << "\n";
+            return ParseCode::CommandLineError;
+        }
+
+        if (count > 1 && request.instance_name() == petenv_name.toStdString())
+        {
+            cerr << "The primary instance cannot be launched more than once\n";
+            return ParseCode::CommandLineError;
+        }
+
+        request.set_count(count);
+    }
+
+    request.set_timings(parser->isSet(timingsOption));
     request.set_verbosity_level(parser->verbosityLevel());
 
     return status;
@@ -272,7 +328,13 @@ mp::ReturnCode cmd::Launch::request_launch()
             return request_launch();
         }
 
-        cout << "Launched: " << reply.vm_instance_name() << "\n";
+        if (request.count() <= 1) // a bulk launch has reported each instance as it came up
+        {
+            cout << "Launched: " << reply.vm_instance_name() << "\n";
+
+            for (const auto& timing : reply.timings())
+                cout << fmt::format("  {:<16}{:>8}ms\n", timing.phase(), timing.duration_ms());
+        }
 
         if (term->is_live() && update_available(reply.update_info()))
         {
@@ -305,6 +367,14 @@ mp::ReturnCode cmd::Launch::request_launch()
             {
                 error_details = fmt::format("Invalid instance name supplied: {}", request.instance_name());
             }
+            else if (error == LaunchError::INVALID_DISK_PROFILE)
+            {
+                error_details = fmt::format("Invalid disk profile supplied: {}.", request.disk_profile());
+            }
+            else if (error == LaunchError::INVALID_RESOURCE_CLASS)
+            {
+                error_details = fmt::format("Invalid resource class supplied: {}.", request.resource_class());
+            }
         }
 
         return standard_failure_handler_for(name(), cerr, status, error_details);
@@ -344,6 +414,14 @@ mp::ReturnCode cmd::Launch::request_launch()
             spinner.stop();
             spinner.start(reply.reply_message());
         }
+        else if (request.count() > 1 && !reply.vm_instance_name().empty())
+        {
+            spinner.stop();
+            cout << "Launched: " << reply.vm_instance_name() << "\n";
+
+            for (const auto& timing : reply.timings())
+                cout << fmt::format("  {:<16}{:>8}ms\n", timing.phase(), timing.duration_ms());
+        }
     };
 
     return dispatch(&RpcMethod::launch, request, on_success, on_failure, streaming_callback);
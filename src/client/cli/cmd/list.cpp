@@ -33,8 +33,10 @@ mp::ReturnCode cmd::List::run(mp::ArgParser* parser)
         return parser->returnCodeFrom(ret);
     }
 
-    auto on_success = [this](ListReply& reply) {
-        cout << chosen_formatter->format(reply);
+    google::protobuf::RepeatedPtrField<ListVMInstance> instances;
+    auto on_success = [this, &instances](ListReply& reply) {
+        reply.mutable_instances()->Swap(&instances);
+        chosen_formatter->format_to(cout, reply);
 
         if (term->is_live() && update_available(reply.update_info()))
             cout << update_notice(reply.update_info());
@@ -44,9 +46,11 @@ mp::ReturnCode cmd::List::run(mp::ArgParser* parser)
 
     auto on_failure = [this](grpc::Status& status) { return standard_failure_handler_for(name(), cerr, status); };
 
-    ListRequest request;
+    auto streaming_callback = [&instances](ListReply& reply) { gather_entries(instances, reply.mutable_instances()); };
+
     request.set_verbosity_level(parser->verbosityLevel());
-    return dispatch(&RpcMethod::list, request, on_success, on_failure);
+    request.set_chunked_reply(true);
+    return dispatch(&RpcMethod::list, request, on_success, on_failure, streaming_callback);
 }
 
 std::string cmd::List::name() const
@@ -77,6 +81,11 @@ mp::ParseCode cmd::List::parse_args(mp::ArgParser* parser)
 
     parser->addOption(formatOption);
 
+    QCommandLineOption refreshOption("refresh", "Query the instances now, instead of reporting recently gathered stats");
+    parser->addOption(refreshOption);
+
+    add_selection_options(parser, "name, state, ipv4 and release");
+
     auto status = parser->commandParse(this);
 
     if (status != ParseCode::Ok)
@@ -90,6 +99,12 @@ mp::ParseCode cmd::List::parse_args(mp::ArgParser* parser)
         return ParseCode::CommandLineError;
     }
 
+    status = handle_selection_options(parser, request.mutable_filter(), request.mutable_fields(), cerr);
+    if (status != ParseCode::Ok)
+        return status;
+
+    request.set_refresh(parser->isSet(refreshOption));
+
     status = handle_format_option(parser, &chosen_formatter, cerr);
 
     return status;
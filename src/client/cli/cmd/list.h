@@ -42,6 +42,7 @@ public:
 private:
     ParseCode parse_args(ArgParser *parser) override;
 
+    ListRequest request;
     Formatter* chosen_formatter;
 };
 }
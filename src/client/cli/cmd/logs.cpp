@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "logs.h"
+#include "common_cli.h"
+
+#include <multipass/cli/argparser.h>
+#include <multipass/format.h>
+
+namespace mp = multipass;
+namespace cmd = multipass::cmd;
+using RpcMethod = mp::Rpc::Stub;
+
+mp::ReturnCode cmd::Logs::run(mp::ArgParser* parser)
+{
+    auto ret = parse_args(parser);
+    if (ret != ParseCode::Ok)
+    {
+        return parser->returnCodeFrom(ret);
+    }
+
+    // Records come in batches, each printed as soon as it arrives
+    auto on_success = [](mp::LogsReply&) { return ReturnCode::Ok; };
+    auto streaming_callback = [this](mp::LogsReply& reply) {
+        for (const auto& record : reply.records())
+            cout << fmt::format("{} {:<7} [{}] {}\n", record.timestamp(), record.level(), record.category(),
+                                record.message());
+    };
+
+    auto on_failure = [this](grpc::Status& status) { return standard_failure_handler_for(name(), cerr, status); };
+
+    request.set_verbosity_level(parser->verbosityLevel());
+    return dispatch(&RpcMethod::logs, request, on_success, on_failure, streaming_callback);
+}
+
+std::string cmd::Logs::name() const
+{
+    return "logs";
+}
+
+QString cmd::Logs::short_help() const
+{
+    return QStringLiteral("Show what the daemon logged lately");
+}
+
+QString cmd::Logs::description() const
+{
+    return QStringLiteral("Show the latest messages the daemon logged, oldest first, as kept in\n"
+                          "its memory. Each category, such as an instance, keeps its own share.");
+}
+
+mp::ParseCode cmd::Logs::parse_args(mp::ArgParser* parser)
+{
+    parser->addPositionalArgument("instance", "Only show what this instance logged", "[<instance>]");
+
+    QCommandLineOption level_option({"l", "level"},
+                                    "Least severe messages to show: error, warning, info, debug or trace", "level",
+                                    "trace");
+    parser->addOption(level_option);
+
+    auto status = parser->commandParse(this);
+    if (status != ParseCode::Ok)
+        return status;
+
+    if (parser->positionalArguments().count() > 1)
+    {
+        cerr << "Too many arguments\n";
+        return ParseCode::CommandLineError;
+    }
+
+    if (parser->positionalArguments().count() == 1)
+        request.set_instance_name(parser->positionalArguments().first().toStdString());
+    request.set_level(parser->value(level_option).toStdString());
+
+    return status;
+}
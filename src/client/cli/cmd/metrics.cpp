@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "metrics.h"
+#include "common_cli.h"
+
+#include <multipass/cli/argparser.h>
+
+namespace mp = multipass;
+namespace cmd = multipass::cmd;
+using RpcMethod = mp::Rpc::Stub;
+
+mp::ReturnCode cmd::Metrics::run(mp::ArgParser* parser)
+{
+    auto ret = parse_args(parser);
+    if (ret != ParseCode::Ok)
+    {
+        return parser->returnCodeFrom(ret);
+    }
+
+    auto on_success = [this](mp::MetricsReply& reply) {
+        cout << reply.exposition();
+        return ReturnCode::Ok;
+    };
+
+    auto on_failure = [this](grpc::Status& status) { return standard_failure_handler_for(name(), cerr, status); };
+
+    mp::MetricsRequest request;
+    request.set_verbosity_level(parser->verbosityLevel());
+    return dispatch(&RpcMethod::metrics, request, on_success, on_failure);
+}
+
+std::string cmd::Metrics::name() const
+{
+    return "metrics";
+}
+
+QString cmd::Metrics::short_help() const
+{
+    return QStringLiteral("Show daemon metrics");
+}
+
+QString cmd::Metrics::description() const
+{
+    return QStringLiteral("Display what the daemon counted and timed since it started, such as\n"
+                          "RPC latencies, launch phases, image cache use and mount traffic,\n"
+                          "in the Prometheus text format.");
+}
+
+mp::ParseCode cmd::Metrics::parse_args(mp::ArgParser* parser)
+{
+    return parser->commandParse(this);
+}
@@ -21,6 +21,7 @@
 #include "animated_spinner.h"
 #include <multipass/cli/argparser.h>
 #include <multipass/cli/client_platform.h>
+#include <multipass/constants.h>
 #include <multipass/logging/log.h>
 #include <multipass/sshfs_mount/sftp_server.h>
 
@@ -114,7 +115,25 @@ mp::ParseCode cmd::Mount::parse_args(mp::ArgParser* parser)
                                                  "File and folder ownership will be mapped from "
                                                  "<host> to <instance> inside the instance. Can be "
                                                  "used multiple times.", "host>:<instance");
-    parser->addOptions({gid_map, uid_map});
+    QCommandLineOption mount_type({"t", "type"}, "Specify the type of mount to use.\n"
+                                                  "Classic mounts use SSHFS and work with every backend.\n"
+                                                  "Native mounts are exported by the hypervisor, are faster and "
+                                                  "need the instance to be stopped. They are available with the "
+                                                  "QEMU backend, where ownership is passed through unmapped.\n"
+                                                  "Valid types are: classic (default) and native",
+                                  "type", "classic");
+    QCommandLineOption mount_profile(
+        "profile",
+        QString("How long a classic mount's instance side caches what it learns about the host's files.\n"
+                "%1 caches nothing, so changes made on the host show at once; %2 caches for a couple of seconds "
+                "and reads in larger chunks; %3 makes the mount read-only and caches for an hour, for sources "
+                "that do not change; %4 writes in larger chunks and acknowledges them before they reach the disk, "
+                "for scratch output, reporting failures only on the next write, close or sync.\n"
+                "Valid profiles are: %5 (default), %1, %2, %3 and %4")
+            .arg(mp::strict_mount_profile, mp::dev_mount_profile, mp::read_only_mount_profile,
+                 mp::write_back_mount_profile, mp::default_mount_profile),
+        "profile", mp::default_mount_profile);
+    parser->addOptions({gid_map, uid_map, mount_type, mount_profile});
 
     auto status = parser->commandParse(this);
     if (status != ParseCode::Ok)
@@ -148,6 +167,33 @@ mp::ParseCode cmd::Mount::parse_args(mp::ArgParser* parser)
         return ParseCode::CommandLineError;
     }
 
+    const auto type = parser->value(mount_type);
+    if (type == "native")
+    {
+        request.set_mount_type(mp::MountRequest::NATIVE);
+    }
+    else if (type != "classic")
+    {
+        cerr << "Bad mount type '" << type.toStdString() << "' specified, please use 'classic' or 'native'.\n";
+        return ParseCode::CommandLineError;
+    }
+
+    const auto profile = parser->value(mount_profile);
+    if (profile != mp::default_mount_profile && profile != mp::strict_mount_profile &&
+        profile != mp::dev_mount_profile && profile != mp::read_only_mount_profile &&
+        profile != mp::write_back_mount_profile)
+    {
+        cerr << "Bad mount profile '" << profile.toStdString() << "' specified.\n";
+        return ParseCode::CommandLineError;
+    }
+
+    if (type == "native" && profile != mp::default_mount_profile)
+    {
+        cerr << "Mount profiles only apply to classic mounts.\n";
+        return ParseCode::CommandLineError;
+    }
+    request.set_mount_profile(profile.toStdString());
+
     source_path = QDir(source_path).absolutePath();
     request.set_source_path(source_path.toStdString());
 
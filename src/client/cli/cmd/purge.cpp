@@ -17,6 +17,7 @@
 
 #include "purge.h"
 #include "common_cli.h"
+#include "ssh_info_cache.h"
 
 #include <multipass/cli/argparser.h>
 
@@ -38,6 +39,7 @@ mp::ReturnCode cmd::Purge::run(mp::ArgParser* parser)
 
     mp::PurgeRequest request;
     request.set_verbosity_level(parser->verbosityLevel());
+    forget_ssh_info(InstanceNames{});
     return dispatch(&RpcMethod::purge, request, on_success, on_failure);
 }
 
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include "qos.h"
+#include "common_cli.h"
+
+#include <multipass/cli/argparser.h>
+#include <multipass/constants.h>
+#include <multipass/format.h>
+#include <multipass/settings.h>
+
+namespace mp = multipass;
+namespace cmd = multipass::cmd;
+using RpcMethod = mp::Rpc::Stub;
+
+mp::ReturnCode cmd::Qos::run(mp::ArgParser* parser)
+{
+    auto ret = parse_args(parser);
+    if (ret != ParseCode::Ok)
+    {
+        return parser->returnCodeFrom(ret);
+    }
+
+    auto on_success = [](mp::QosReply& reply) { return ReturnCode::Ok; };
+
+    auto on_failure = [this](grpc::Status& status) { return standard_failure_handler_for(name(), cerr, status); };
+
+    request.set_verbosity_level(parser->verbosityLevel());
+    return dispatch(&RpcMethod::qos, request, on_success, on_failure);
+}
+
+std::string cmd::Qos::name() const
+{
+    return "qos";
+}
+
+QString cmd::Qos::short_help() const
+{
+    return QStringLiteral("Change the resource class of instances");
+}
+
+QString cmd::Qos::description() const
+{
+    return QString::fromStdString(
+        fmt::format("Move the named instances to another resource class, which decides the share\n"
+                    "of the host's CPU and disk they get when it is contended. '{}' instances\n"
+                    "get more than '{}' ones, and '{}' ones less, within caps. Running\n"
+                    "instances take on the new class straight away.",
+                    latency_resource_class, default_resource_class, batch_resource_class));
+}
+
+mp::ParseCode cmd::Qos::parse_args(mp::ArgParser* parser)
+{
+    const auto petenv_name = Settings::instance().get(petenv_key);
+    parser->addPositionalArgument(
+        "name",
+        QString{"Names of instances to move. If omitted, and without the --all option, '%1' will be assumed."}.arg(
+            petenv_name),
+        "[<name> ...]");
+
+    QCommandLineOption all_option("all", "Move all instances");
+    QCommandLineOption class_option(
+        {"c", "class"},
+        QString::fromStdString(fmt::format("Resource class: {}, {} or {}", default_resource_class,
+                                           latency_resource_class, batch_resource_class)),
+        "class");
+    parser->addOptions({all_option, class_option});
+
+    auto status = parser->commandParse(this);
+    if (status != ParseCode::Ok)
+        return status;
+
+    if (!parser->isSet(class_option))
+    {
+        cerr << "The resource class is required\n";
+        return ParseCode::CommandLineError;
+    }
+
+    auto parse_code = check_for_name_and_all_option_conflict(parser, cerr, /*allow_empty=*/true);
+    if (parse_code != ParseCode::Ok)
+        return parse_code;
+
+    request.mutable_instance_names()->CopyFrom(add_instance_names(parser, /*default_name=*/petenv_name.toStdString()));
+    request.set_resource_class(parser->value(class_option).toStdString());
+
+    return status;
+}
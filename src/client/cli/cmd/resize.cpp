@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "resize.h"
+#include "common_cli.h"
+
+#include <multipass/cli/argparser.h>
+#include <multipass/exceptions/invalid_memory_size_exception.h>
+#include <multipass/memory_size.h>
+
+namespace mp = multipass;
+namespace cmd = multipass::cmd;
+using RpcMethod = mp::Rpc::Stub;
+
+mp::ReturnCode cmd::Resize::run(mp::ArgParser* parser)
+{
+    auto ret = parse_args(parser);
+    if (ret != ParseCode::Ok)
+    {
+        return parser->returnCodeFrom(ret);
+    }
+
+    auto on_success = [](mp::ResizeReply& reply) { return ReturnCode::Ok; };
+
+    auto on_failure = [this](grpc::Status& status) { return standard_failure_handler_for(name(), cerr, status); };
+
+    request.set_verbosity_level(parser->verbosityLevel());
+    return dispatch(&RpcMethod::resize, request, on_success, on_failure);
+}
+
+std::string cmd::Resize::name() const
+{
+    return "resize";
+}
+
+QString cmd::Resize::short_help() const
+{
+    return QStringLiteral("Give an instance more CPUs, memory or disk");
+}
+
+QString cmd::Resize::description() const
+{
+    return QStringLiteral("Grow the resources of an instance, without starting it anew. A running\n"
+                          "instance takes on the new CPUs and memory straight away, and its root\n"
+                          "filesystem grows into the new disk space. Resources can only grow, and\n"
+                          "those left out stay as they were.");
+}
+
+mp::ParseCode cmd::Resize::parse_args(mp::ArgParser* parser)
+{
+    parser->addPositionalArgument("instance", "Name of the instance to resize", "<instance>");
+
+    QCommandLineOption cpus_option({"c", "cpus"}, "Number of CPUs to grow to", "cpus");
+    QCommandLineOption mem_option({"m", "mem"},
+                                  "Amount of memory to grow to. Positive integers, in bytes, or with K, M, G suffix.",
+                                  "mem");
+    QCommandLineOption disk_option({"d", "disk"},
+                                   "Disk space to grow to. Positive integers, in bytes, or with K, M, G suffix.",
+                                   "disk");
+    parser->addOptions({cpus_option, mem_option, disk_option});
+
+    auto status = parser->commandParse(this);
+    if (status != ParseCode::Ok)
+        return status;
+
+    if (parser->positionalArguments().count() != 1)
+    {
+        cerr << "Wrong number of arguments\n";
+        return ParseCode::CommandLineError;
+    }
+
+    if (!parser->isSet(cpus_option) && !parser->isSet(mem_option) && !parser->isSet(disk_option))
+    {
+        cerr << "At least one of --cpus, --mem or --disk is required\n";
+        return ParseCode::CommandLineError;
+    }
+
+    if (parser->isSet(cpus_option))
+    {
+        bool ok;
+        const auto num_cores = parser->value(cpus_option).toInt(&ok);
+        if (!ok || num_cores < 1)
+        {
+            cerr << "Invalid --cpus value\n";
+            return ParseCode::CommandLineError;
+        }
+        request.set_num_cores(num_cores);
+    }
+
+    // Sizes are checked here, so that typos are caught before the daemon is asked
+    auto size_from = [parser, this](const QCommandLineOption& option, std::string& size) {
+        if (!parser->isSet(option))
+            return true;
+
+        try
+        {
+            size = parser->value(option).toStdString();
+            mp::MemorySize{size};
+            return true;
+        }
+        catch (const mp::InvalidMemorySizeException&)
+        {
+            cerr << "Invalid --" << option.names().back().toStdString() << " value\n";
+            return false;
+        }
+    };
+
+    std::string mem_size, disk_space;
+    if (!size_from(mem_option, mem_size) || !size_from(disk_option, disk_space))
+        return ParseCode::CommandLineError;
+
+    request.set_mem_size(mem_size);
+    request.set_disk_space(disk_space);
+    request.set_instance_name(parser->positionalArguments().first().toStdString());
+
+    return status;
+}
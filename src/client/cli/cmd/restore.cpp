@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "restore.h"
+#include "common_cli.h"
+
+#include <multipass/cli/argparser.h>
+
+namespace mp = multipass;
+namespace cmd = multipass::cmd;
+using RpcMethod = mp::Rpc::Stub;
+
+mp::ReturnCode cmd::Restore::run(mp::ArgParser* parser)
+{
+    auto ret = parse_args(parser);
+    if (ret != ParseCode::Ok)
+    {
+        return parser->returnCodeFrom(ret);
+    }
+
+    auto on_success = [this](mp::RestoreReply& /*reply*/) {
+        cout << "Restored " << request.instance_name() << " to " << request.snapshot_name() << "\n";
+        return ReturnCode::Ok;
+    };
+
+    auto on_failure = [this](grpc::Status& status) { return standard_failure_handler_for(name(), cerr, status); };
+
+    request.set_verbosity_level(parser->verbosityLevel());
+    return dispatch(&RpcMethod::restore, request, on_success, on_failure);
+}
+
+std::string cmd::Restore::name() const
+{
+    return "restore";
+}
+
+QString cmd::Restore::short_help() const
+{
+    return QStringLiteral("Restore an instance to a snapshot");
+}
+
+QString cmd::Restore::description() const
+{
+    return QStringLiteral("Put the disk of a stopped instance back the way it was when the\n"
+                          "snapshot was taken. Whatever was written since is lost, while the\n"
+                          "instance's snapshots are all kept.");
+}
+
+mp::ParseCode cmd::Restore::parse_args(mp::ArgParser* parser)
+{
+    parser->addPositionalArgument("instance", "Name of the instance to restore", "<instance>");
+    parser->addPositionalArgument("snapshot", "Name of the snapshot to restore it to", "<snapshot>");
+
+    auto status = parser->commandParse(this);
+    if (status != ParseCode::Ok)
+        return status;
+
+    if (parser->positionalArguments().count() != 2)
+    {
+        cerr << "Wrong number of arguments\n";
+        return ParseCode::CommandLineError;
+    }
+
+    request.set_instance_name(parser->positionalArguments().at(0).toStdString());
+    request.set_snapshot_name(parser->positionalArguments().at(1).toStdString());
+
+    return status;
+}
@@ -53,6 +53,8 @@ mp::ReturnCode cmd::Shell::run(mp::ArgParser* parser)
         const auto& port = ssh_info.port();
         const auto& username = ssh_info.username();
         const auto& priv_key_blob = ssh_info.priv_key_base64();
+        mp::SSHSession::set_crypto_profile(ssh_info.crypto_profile());
+        set_ssh_compression(false);
 
         try
         {
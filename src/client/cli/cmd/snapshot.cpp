@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "snapshot.h"
+#include "common_cli.h"
+
+#include <multipass/cli/argparser.h>
+
+namespace mp = multipass;
+namespace cmd = multipass::cmd;
+using RpcMethod = mp::Rpc::Stub;
+
+mp::ReturnCode cmd::Snapshot::run(mp::ArgParser* parser)
+{
+    auto ret = parse_args(parser);
+    if (ret != ParseCode::Ok)
+    {
+        return parser->returnCodeFrom(ret);
+    }
+
+    auto on_success = [this](mp::SnapshotReply& reply) {
+        cout << "Snapshot taken: " << reply.snapshot_name() << "\n";
+        return ReturnCode::Ok;
+    };
+
+    auto on_failure = [this](grpc::Status& status) { return standard_failure_handler_for(name(), cerr, status); };
+
+    request.set_verbosity_level(parser->verbosityLevel());
+    return dispatch(&RpcMethod::snapshot, request, on_success, on_failure);
+}
+
+std::string cmd::Snapshot::name() const
+{
+    return "snapshot";
+}
+
+QString cmd::Snapshot::short_help() const
+{
+    return QStringLiteral("Take a snapshot of an instance's disk");
+}
+
+QString cmd::Snapshot::description() const
+{
+    return QStringLiteral("Keep what the disk of a stopped instance holds now, so that the\n"
+                          "instance can be restored to it later. Taking a snapshot copies\n"
+                          "nothing, however large the disk.");
+}
+
+mp::ParseCode cmd::Snapshot::parse_args(mp::ArgParser* parser)
+{
+    parser->addPositionalArgument("instance", "Name of the instance to take a snapshot of", "<instance>");
+
+    QCommandLineOption name_option({"n", "name"}, "Name for the snapshot", "name");
+    parser->addOption(name_option);
+
+    auto status = parser->commandParse(this);
+    if (status != ParseCode::Ok)
+        return status;
+
+    if (parser->positionalArguments().count() != 1)
+    {
+        cerr << "Wrong number of arguments\n";
+        return ParseCode::CommandLineError;
+    }
+
+    request.set_instance_name(parser->positionalArguments().first().toStdString());
+    if (parser->isSet(name_option))
+        request.set_snapshot_name(parser->value(name_option).toStdString());
+
+    return status;
+}
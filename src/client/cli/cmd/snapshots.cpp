@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "snapshots.h"
+#include "common_cli.h"
+
+#include <multipass/cli/argparser.h>
+#include <multipass/format.h>
+
+namespace mp = multipass;
+namespace cmd = multipass::cmd;
+using RpcMethod = mp::Rpc::Stub;
+
+mp::ReturnCode cmd::Snapshots::run(mp::ArgParser* parser)
+{
+    auto ret = parse_args(parser);
+    if (ret != ParseCode::Ok)
+    {
+        return parser->returnCodeFrom(ret);
+    }
+
+    auto on_success = [this](mp::SnapshotsReply& reply) {
+        if (reply.snapshots().empty())
+        {
+            cout << "No snapshots found.\n";
+            return ReturnCode::Ok;
+        }
+
+        fmt::memory_buffer buf;
+        fmt::format_to(buf, "{:<24}{}\n", "Name", "Created");
+        for (const auto& snapshot : reply.snapshots())
+            fmt::format_to(buf, "{:<24}{}\n", snapshot.name(), snapshot.created());
+
+        cout << fmt::to_string(buf);
+        return ReturnCode::Ok;
+    };
+
+    auto on_failure = [this](grpc::Status& status) { return standard_failure_handler_for(name(), cerr, status); };
+
+    request.set_verbosity_level(parser->verbosityLevel());
+    return dispatch(&RpcMethod::snapshots, request, on_success, on_failure);
+}
+
+std::string cmd::Snapshots::name() const
+{
+    return "snapshots";
+}
+
+QString cmd::Snapshots::short_help() const
+{
+    return QStringLiteral("List the snapshots of an instance");
+}
+
+QString cmd::Snapshots::description() const
+{
+    return QStringLiteral("List the snapshots taken of an instance, oldest first.");
+}
+
+mp::ParseCode cmd::Snapshots::parse_args(mp::ArgParser* parser)
+{
+    parser->addPositionalArgument("instance", "Name of the instance to list the snapshots of", "<instance>");
+
+    auto status = parser->commandParse(this);
+    if (status != ParseCode::Ok)
+        return status;
+
+    if (parser->positionalArguments().count() != 1)
+    {
+        cerr << "Wrong number of arguments\n";
+        return ParseCode::CommandLineError;
+    }
+
+    request.set_instance_name(parser->positionalArguments().first().toStdString());
+
+    return status;
+}
@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "ssh_info_cache.h"
+
+#include <multipass/constants.h>
+#include <multipass/ssh/ssh_client.h>
+
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#include <memory>
+#include <unordered_map>
+
+namespace mp = multipass;
+namespace cmd = multipass::cmd;
+
+namespace
+{
+struct SharedSession
+{
+    mp::SSHInfo ssh_info;
+    mp::SSHSessionUPtr session;
+};
+
+std::unordered_map<std::string, SharedSession> shared_sessions;
+
+QDir cache_dir()
+{
+    QDir dir{QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation)};
+    return QDir{dir.filePath(QString("%1/ssh_info").arg(mp::client_name))};
+}
+
+QString cache_file_for(const std::string& instance_name)
+{
+    return cache_dir().filePath(QString::fromStdString(instance_name));
+}
+
+QString host_key_file_for(const std::string& instance_name)
+{
+    return cache_file_for(instance_name) + ".host_key";
+}
+
+// Failing to write the cache is no reason to fail the command, it only saves a round trip
+void write_cache_file(const QString& path, const std::string& data)
+{
+    auto dir = cache_dir();
+    if (!dir.mkpath(".") || !QFile::setPermissions(dir.path(), QFile::ReadOwner | QFile::WriteOwner | QFile::ExeOwner))
+        return;
+
+    QSaveFile file{path};
+    if (!file.open(QIODevice::WriteOnly) || !file.setPermissions(QFile::ReadOwner | QFile::WriteOwner))
+        return;
+
+    if (file.write(data.data(), data.size()) == static_cast<qint64>(data.size()))
+        file.commit();
+}
+
+bool same_endpoint(const mp::SSHInfo& a, const mp::SSHInfo& b)
+{
+    return a.host() == b.host() && a.port() == b.port() && a.username() == b.username() &&
+           a.priv_key_base64() == b.priv_key_base64();
+}
+} // namespace
+
+mp::optional<mp::SSHInfo> cmd::cached_ssh_info(const std::string& instance_name)
+{
+    QFile file{cache_file_for(instance_name)};
+    if (!file.open(QIODevice::ReadOnly))
+        return nullopt;
+
+    mp::SSHInfo ssh_info;
+    if (!ssh_info.ParseFromString(file.readAll().toStdString()) || ssh_info.host().empty())
+        return nullopt;
+
+    return ssh_info;
+}
+
+void cmd::cache_ssh_info(const std::string& instance_name, const SSHInfo& ssh_info)
+{
+    // Whatever key was seen with earlier details is no proof for these
+    QFile::remove(host_key_file_for(instance_name));
+    write_cache_file(cache_file_for(instance_name), ssh_info.SerializeAsString());
+}
+
+mp::optional<std::string> cmd::cached_host_key(const std::string& instance_name)
+{
+    QFile file{host_key_file_for(instance_name)};
+    if (!file.open(QIODevice::ReadOnly))
+        return nullopt;
+
+    const auto host_key_hash = file.readAll().toStdString();
+    if (host_key_hash.empty())
+        return nullopt;
+
+    return host_key_hash;
+}
+
+void cmd::cache_host_key(const std::string& instance_name, const std::string& host_key_hash)
+{
+    write_cache_file(host_key_file_for(instance_name), host_key_hash);
+}
+
+void cmd::forget_ssh_info(const InstanceNames& instance_names)
+{
+    if (instance_names.instance_name().empty())
+    {
+        cache_dir().removeRecursively();
+        shared_sessions.clear();
+        return;
+    }
+
+    for (const auto& instance_name : instance_names.instance_name())
+    {
+        QFile::remove(cache_file_for(instance_name));
+        QFile::remove(host_key_file_for(instance_name));
+        shared_sessions.erase(instance_name);
+    }
+}
+
+mp::SSHSession& cmd::shared_ssh_session(const std::string& instance_name, const SSHInfo& ssh_info)
+{
+    auto it = shared_sessions.find(instance_name);
+    if (it == shared_sessions.end() || !same_endpoint(it->second.ssh_info, ssh_info))
+    {
+        auto session = make_ssh_session(ssh_info.host(), ssh_info.port(), ssh_info.username(),
+                                        ssh_info.priv_key_base64());
+        it = shared_sessions.insert_or_assign(instance_name, SharedSession{ssh_info, std::move(session)}).first;
+    }
+
+    return *it->second.session;
+}
+
+void cmd::drop_shared_ssh_session(const std::string& instance_name)
+{
+    shared_sessions.erase(instance_name);
+}
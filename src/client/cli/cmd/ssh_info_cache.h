@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_SSH_INFO_CACHE_H
+#define MULTIPASS_SSH_INFO_CACHE_H
+
+#include <multipass/optional.h>
+#include <multipass/rpc/multipass.grpc.pb.h>
+#include <multipass/ssh/ssh_session.h>
+
+#include <string>
+
+namespace multipass
+{
+namespace cmd
+{
+// Remembers, across invocations, how to reach instances over SSH, so that exec need not ask the daemon every time.
+// Entries only live in the user's cache directory, readable by the user alone
+optional<SSHInfo> cached_ssh_info(const std::string& instance_name);
+void cache_ssh_info(const std::string& instance_name, const SSHInfo& ssh_info);
+
+// The host key the instance presented when it was last reached with details from the daemon. Cached details are only
+// to be used with an instance that still presents it, as the same address may now belong to another machine
+optional<std::string> cached_host_key(const std::string& instance_name);
+void cache_host_key(const std::string& instance_name, const std::string& host_key_hash);
+
+// Forgets the given instances, or every instance when none are given; used whenever they may change state
+void forget_ssh_info(const InstanceNames& instance_names);
+
+// A connection to the instance that every exec within this process shares; throws if it cannot be established
+SSHSession& shared_ssh_session(const std::string& instance_name, const SSHInfo& ssh_info);
+void drop_shared_ssh_session(const std::string& instance_name);
+} // namespace cmd
+} // namespace multipass
+#endif // MULTIPASS_SSH_INFO_CACHE_H
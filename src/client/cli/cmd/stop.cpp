@@ -17,6 +17,7 @@
 
 #include "stop.h"
 #include "common_cli.h"
+#include "ssh_info_cache.h"
 
 #include "animated_spinner.h"
 
@@ -47,9 +48,19 @@ mp::ReturnCode cmd::Stop::run(mp::ArgParser* parser)
         return standard_failure_handler_for(name(), cerr, status);
     };
 
+    // Instances are reported on as each one is done with
+    auto streaming_callback = [&spinner](mp::StopReply& reply) {
+        if (reply.reply_message().empty())
+            return;
+
+        spinner.stop();
+        spinner.start(reply.reply_message());
+    };
+
     spinner.start(instance_action_message_for(request.instance_names(), "Stopping "));
     request.set_verbosity_level(parser->verbosityLevel());
-    return dispatch(&RpcMethod::stop, request, on_success, on_failure);
+    forget_ssh_info(request.instance_names());
+    return dispatch(&RpcMethod::stop, request, on_success, on_failure, streaming_callback);
 }
 
 std::string cmd::Stop::name() const { return "stop"; }
@@ -17,6 +17,7 @@
 
 #include "suspend.h"
 #include "common_cli.h"
+#include "ssh_info_cache.h"
 
 #include "animated_spinner.h"
 
@@ -44,9 +45,18 @@ mp::ReturnCode cmd::Suspend::run(mp::ArgParser* parser)
         return standard_failure_handler_for(name(), cerr, status);
     };
 
+    auto streaming_callback = [&spinner](mp::SuspendReply& reply) {
+        if (reply.reply_message().empty())
+            return;
+
+        spinner.stop();
+        spinner.start(reply.reply_message());
+    };
+
     spinner.start(instance_action_message_for(request.instance_names(), "Suspending "));
     request.set_verbosity_level(parser->verbosityLevel());
-    return dispatch(&RpcMethod::suspend, request, on_success, on_failure);
+    forget_ssh_info(request.instance_names());
+    return dispatch(&RpcMethod::suspend, request, on_success, on_failure, streaming_callback);
 }
 
 std::string cmd::Suspend::name() const
@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "throttle.h"
+#include "common_cli.h"
+
+#include <multipass/cli/argparser.h>
+#include <multipass/constants.h>
+#include <multipass/exceptions/invalid_memory_size_exception.h>
+#include <multipass/memory_size.h>
+#include <multipass/settings.h>
+
+namespace mp = multipass;
+namespace cmd = multipass::cmd;
+using RpcMethod = mp::Rpc::Stub;
+
+namespace
+{
+// "none" and "0" lift the cap, and anything else is a count or a size per second, e.g. "50M"
+bool parse_cap(const QString& value, bool size, long long& cap)
+{
+    if (value == "none")
+    {
+        cap = 0;
+        return true;
+    }
+
+    if (size)
+    {
+        try
+        {
+            cap = mp::MemorySize{value.toStdString()}.in_bytes();
+            return true;
+        }
+        catch (const mp::InvalidMemorySizeException&)
+        {
+            return false;
+        }
+    }
+
+    bool ok;
+    cap = value.toLongLong(&ok);
+    return ok && cap >= 0;
+}
+} // namespace
+
+mp::ReturnCode cmd::Throttle::run(mp::ArgParser* parser)
+{
+    auto ret = parse_args(parser);
+    if (ret != ParseCode::Ok)
+    {
+        return parser->returnCodeFrom(ret);
+    }
+
+    auto on_success = [](mp::ThrottleReply& reply) { return ReturnCode::Ok; };
+
+    auto on_failure = [this](grpc::Status& status) { return standard_failure_handler_for(name(), cerr, status); };
+
+    request.set_verbosity_level(parser->verbosityLevel());
+    return dispatch(&RpcMethod::throttle, request, on_success, on_failure);
+}
+
+std::string cmd::Throttle::name() const
+{
+    return "throttle";
+}
+
+QString cmd::Throttle::short_help() const
+{
+    return QStringLiteral("Cap the disk and network of instances");
+}
+
+QString cmd::Throttle::description() const
+{
+    return QStringLiteral("Put hard caps on the disk operations and bandwidth, and on the network\n"
+                          "bandwidth, of the named instances, whatever their resource class. The\n"
+                          "network cap holds each way. Caps left out stay as they were, and \"none\"\n"
+                          "lifts one. Running instances are capped straight away.");
+}
+
+mp::ParseCode cmd::Throttle::parse_args(mp::ArgParser* parser)
+{
+    const auto petenv_name = Settings::instance().get(petenv_key);
+    parser->addPositionalArgument(
+        "name",
+        QString{"Names of instances to cap. If omitted, and without the --all option, '%1' will be assumed."}.arg(
+            petenv_name),
+        "[<name> ...]");
+
+    QCommandLineOption all_option("all", "Cap all instances");
+    QCommandLineOption disk_iops_option("disk-iops", "Disk operations per second", "count");
+    QCommandLineOption disk_bandwidth_option("disk-bandwidth",
+                                             "Disk bytes per second. Positive integers, in bytes, or with "
+                                             "K, M, G suffix.",
+                                             "size");
+    QCommandLineOption network_bandwidth_option("network-bandwidth",
+                                                "Network bytes per second, each way. Positive integers, in bytes, "
+                                                "or with K, M, G suffix.",
+                                                "size");
+    parser->addOptions({all_option, disk_iops_option, disk_bandwidth_option, network_bandwidth_option});
+
+    auto status = parser->commandParse(this);
+    if (status != ParseCode::Ok)
+        return status;
+
+    if (!parser->isSet(disk_iops_option) && !parser->isSet(disk_bandwidth_option) &&
+        !parser->isSet(network_bandwidth_option))
+    {
+        cerr << "At least one cap is required\n";
+        return ParseCode::CommandLineError;
+    }
+
+    auto parse_code = check_for_name_and_all_option_conflict(parser, cerr, /*allow_empty=*/true);
+    if (parse_code != ParseCode::Ok)
+        return parse_code;
+
+    // Caps left out are sent as -1, for the daemon to leave alone
+    auto cap_from = [parser, this](const QCommandLineOption& option, bool size, long long& cap) {
+        cap = -1;
+        if (!parser->isSet(option) || parse_cap(parser->value(option), size, cap))
+            return true;
+
+        cerr << "Invalid --" << option.names().front().toStdString() << " value\n";
+        return false;
+    };
+
+    long long disk_iops, disk_bytes_per_second, network_bytes_per_second;
+    if (!cap_from(disk_iops_option, false, disk_iops) ||
+        !cap_from(disk_bandwidth_option, true, disk_bytes_per_second) ||
+        !cap_from(network_bandwidth_option, true, network_bytes_per_second))
+        return ParseCode::CommandLineError;
+
+    request.set_disk_iops(disk_iops);
+    request.set_disk_bytes_per_second(disk_bytes_per_second);
+    request.set_network_bytes_per_second(network_bytes_per_second);
+    request.mutable_instance_names()->CopyFrom(add_instance_names(parser, /*default_name=*/petenv_name.toStdString()));
+
+    return status;
+}
@@ -21,10 +21,19 @@
 #include <multipass/cli/argparser.h>
 #include <multipass/cli/client_platform.h>
 #include <multipass/ssh/sftp_client.h>
+#include <multipass/ssh/ssh_session.h>
 
 #include <QDir>
 #include <QFileInfo>
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <thread>
+
 namespace mp = multipass;
 namespace cmd = multipass::cmd;
 namespace mcp = multipass::cli::platform;
@@ -33,11 +42,24 @@ using RpcMethod = mp::Rpc::Stub;
 namespace
 {
 const char streaming_symbol{'-'};
+constexpr auto default_parallel_transfers = 4;
+constexpr uint64_t split_range_size = 64ull * 1024 * 1024; // for files split across sessions
+
+auto make_sftp_client(const mp::SSHInfo& ssh_info)
+{
+    mp::SSHSession::set_crypto_profile(ssh_info.crypto_profile());
+    return std::make_unique<mp::SFTPClient>(ssh_info.host(), ssh_info.port(), ssh_info.username(),
+                                            ssh_info.priv_key_base64());
+}
 } // namespace
 
 mp::ReturnCode cmd::Transfer::run(mp::ArgParser* parser)
 {
     streaming_enabled = false;
+    recursive = false;
+    sync_enabled = false;
+    compress = false;
+    parallel_transfers = default_parallel_transfers;
     auto ret = parse_args(parser);
     if (ret != ParseCode::Ok)
     {
@@ -49,41 +71,37 @@ mp::ReturnCode cmd::Transfer::run(mp::ArgParser* parser)
         if (reply.ssh_info().empty())
             return ReturnCode::Ok;
 
-        for (const auto& source : sources)
+        set_ssh_compression(compress);
+        if (streaming_enabled)
         {
-            mp::SSHInfo ssh_info;
-            if (!source.first.empty())
+            const auto& source = sources.front();
+            const auto& instance = source.first.empty() ? destination.first : source.first;
+            try
             {
-                ssh_info = reply.ssh_info().find(source.first)->second;
+                auto sftp_client = make_sftp_client(reply.ssh_info().find(instance)->second);
+                if (destination.first.empty())
+                    sftp_client->stream_file(source.second, term->cout());
+                else
+                    sftp_client->stream_file(destination.second, term->cin());
             }
-            else if (!destination.first.empty())
+            catch (const std::exception& e)
             {
-                ssh_info = reply.ssh_info().find(destination.first)->second;
+                cerr << "transfer failed: " << e.what() << "\n";
+                return ReturnCode::CommandFail;
             }
+            return ReturnCode::Ok;
+        }
 
-            auto host = ssh_info.host();
-            auto port = ssh_info.port();
-            auto username = ssh_info.username();
-            auto priv_key_blob = ssh_info.priv_key_base64();
+        // Sources are grouped by instance, so that each group can be spread over several sessions
+        std::map<std::string, std::vector<std::string>> sources_by_instance;
+        for (const auto& source : sources)
+            sources_by_instance[source.first.empty() ? destination.first : source.first].push_back(source.second);
 
+        for (const auto& instance_sources : sources_by_instance)
+        {
             try
             {
-                mp::SFTPClient sftp_client{host, port, username, priv_key_blob};
-
-                if (streaming_enabled)
-                {
-                    if (destination.first.empty())
-                        sftp_client.stream_file(source.second, term->cout());
-                    else
-                        sftp_client.stream_file(destination.second, term->cin());
-                }
-                else
-                {
-                    if (!destination.first.empty())
-                        sftp_client.push_file(source.second, destination.second);
-                    else
-                        sftp_client.pull_file(source.second, destination.second);
-                }
+                transfer_files(reply.ssh_info().find(instance_sources.first)->second, instance_sources.second);
             }
             catch (const std::exception& e)
             {
@@ -100,6 +118,145 @@ mp::ReturnCode cmd::Transfer::run(mp::ArgParser* parser)
     return dispatch(&RpcMethod::ssh_info, request, on_success, on_failure);
 }
 
+void cmd::Transfer::transfer_files(const mp::SSHInfo& ssh_info, const std::vector<std::string>& source_paths)
+{
+    const auto pushing = !destination.first.empty();
+    auto sftp_client = make_sftp_client(ssh_info);
+
+    mp::FileTransfers transfers;
+    for (const auto& source_path : source_paths)
+    {
+        const auto is_dir =
+            pushing ? QFileInfo(QString::fromStdString(source_path)).isDir() : sftp_client->is_remote_dir(source_path);
+        if (!is_dir)
+        {
+            transfers.emplace_back(source_path, destination.second);
+            continue;
+        }
+
+        if (!recursive)
+            throw std::runtime_error(fmt::format("\"{}\" is a directory, use --recursive to transfer it", source_path));
+
+        auto dir_transfers = pushing ? sftp_client->push_dir_tree(source_path, destination.second)
+                                     : sftp_client->pull_dir_tree(source_path, destination.second);
+        std::move(dir_transfers.begin(), dir_transfers.end(), std::back_inserter(transfers));
+    }
+
+    // With fewer files than sessions, one session's cipher stream would bound each file, so files are split into
+    // ranges that all the sessions take a share of, each at the same offset on both ends
+    struct Work
+    {
+        std::size_t transfer;
+        uint64_t offset;
+        uint64_t length;
+    };
+
+    const auto splitting = !sync_enabled && transfers.size() < static_cast<std::size_t>(parallel_transfers);
+    std::vector<mp::SFTPClient::SplitTransfer> splits;
+    std::vector<std::size_t> ranges_left; // of each split file, guarded by ranges_mutex
+    std::mutex ranges_mutex;
+    std::vector<Work> work;
+    for (std::size_t i = 0; i < transfers.size(); ++i)
+    {
+        if (!splitting)
+        {
+            work.push_back({i, 0, 0});
+            continue;
+        }
+
+        const auto& transfer = transfers[i];
+        splits.push_back(pushing ? sftp_client->begin_split_push(transfer.first, transfer.second)
+                                 : sftp_client->begin_split_pull(transfer.first, transfer.second));
+
+        // Empty files still get a range, for their permissions to be set once it is done
+        const auto size = splits.back().size;
+        const auto ranges = std::max<uint64_t>(1, (size + split_range_size - 1) / split_range_size);
+        ranges_left.push_back(ranges);
+        for (uint64_t range = 0; range < ranges; ++range)
+        {
+            const auto offset = range * split_range_size;
+            work.push_back({i, offset, std::min(split_range_size, size - offset)});
+        }
+    }
+
+    // Each worker holds its own session and takes the next file, or range, from the shared queue, so that small
+    // files are not serialised on each other's open and close round-trips
+    std::atomic<std::size_t> next_work{0};
+    std::atomic<bool> failed{false};
+    std::mutex error_mutex;
+    std::string error;
+
+    auto record_error = [&failed, &error_mutex, &error](const std::string& message) {
+        std::lock_guard<std::mutex> lock{error_mutex};
+        if (!failed.exchange(true))
+            error = message;
+    };
+
+    auto transfer_range = [&](mp::SFTPClient& client, const Work& item) {
+        const auto& split = splits[item.transfer];
+        if (pushing)
+            client.push_range(split, item.offset, item.length);
+        else
+            client.pull_range(split, item.offset, item.length);
+
+        std::unique_lock<std::mutex> lock{ranges_mutex};
+        if (--ranges_left[item.transfer] > 0)
+            return;
+        lock.unlock();
+
+        if (pushing)
+            client.end_split_push(split);
+        else
+            client.end_split_pull(split);
+    };
+
+    auto transfer_queued_files = [&](mp::SFTPClient& client) {
+        try
+        {
+            for (auto i = next_work++; i < work.size() && !failed; i = next_work++)
+            {
+                const auto& transfer = transfers[work[i].transfer];
+                if (splitting)
+                    transfer_range(client, work[i]);
+                else if (pushing && sync_enabled)
+                    client.sync_file(transfer.first, transfer.second);
+                else if (pushing)
+                    client.push_file(transfer.first, transfer.second);
+                else
+                    client.pull_file(transfer.first, transfer.second);
+            }
+        }
+        catch (const std::exception& e)
+        {
+            record_error(e.what());
+        }
+    };
+
+    const auto worker_count = std::min<std::size_t>(parallel_transfers, work.size());
+    std::vector<std::thread> workers;
+    for (std::size_t i = 1; i < worker_count; ++i)
+    {
+        workers.emplace_back([&ssh_info, &record_error, &transfer_queued_files] {
+            try
+            {
+                auto client = make_sftp_client(ssh_info);
+                transfer_queued_files(*client);
+            }
+            catch (const std::exception& e)
+            {
+                record_error(e.what());
+            }
+        });
+    }
+
+    transfer_queued_files(*sftp_client);
+    for (auto& worker : workers)
+        worker.join();
+
+    if (failed)
+        throw std::runtime_error(error);
+}
+
 std::string cmd::Transfer::name() const
 {
     return "transfer";
@@ -117,9 +274,7 @@ QString cmd::Transfer::short_help() const
 
 QString cmd::Transfer::description() const
 {
-    // TODO: Don't mention directories until we support that
-    // return QStringLiteral("Copy files and directories between the host and instances.");
-    return QStringLiteral("Copy files between the host and instances.");
+    return QStringLiteral("Copy files and directories between the host and instances.");
 }
 
 mp::ParseCode cmd::Transfer::parse_args(mp::ArgParser* parser)
@@ -133,10 +288,36 @@ mp::ParseCode cmd::Transfer::parse_args(mp::ArgParser* parser)
                                   "a path inside the instance, or '-' for stdout",
                                   "<destination>");
 
+    QCommandLineOption recursive_option({"r", "recursive"}, "Transfer directories and their contents");
+    QCommandLineOption parallel_option(
+        {"p", "parallel"},
+        QString::fromStdString(
+            fmt::format("Number of sessions to transfer over at once, splitting files across them when there are "
+                        "fewer (default: {})",
+                        default_parallel_transfers)),
+        "count", QString::number(default_parallel_transfers));
+    QCommandLineOption sync_option(
+        "sync", "Only send what changed: skip files whose size and modification time match those in the instance, "
+                "and send only the parts of the others that differ");
+    QCommandLineOption compress_option("compress", "Compress the data on its way, for instances behind slow links");
+    parser->addOptions({recursive_option, parallel_option, sync_option, compress_option});
+
     auto status = parser->commandParse(this);
     if (status != ParseCode::Ok)
         return status;
 
+    recursive = parser->isSet(recursive_option);
+    sync_enabled = parser->isSet(sync_option);
+    compress = parser->isSet(compress_option);
+
+    bool ok;
+    parallel_transfers = parser->value(parallel_option).toInt(&ok);
+    if (!ok || parallel_transfers < 1)
+    {
+        cerr << "Invalid number of parallel transfers\n";
+        return ParseCode::CommandLineError;
+    }
+
     if (parser->positionalArguments().count() < 2)
     {
         cerr << "Not enough arguments given\n";
@@ -173,6 +354,12 @@ mp::ParseCode cmd::Transfer::parse_args(mp::ArgParser* parser)
         return ParseCode::CommandLineError;
     }
 
+    if (sync_enabled && (streaming_enabled || destination.first.empty()))
+    {
+        cerr << "--sync only applies to copying files into an instance\n";
+        return ParseCode::CommandLineError;
+    }
+
     return ParseCode::Ok;
 }
 
@@ -207,9 +394,9 @@ mp::ParseCode cmd::Transfer::parse_sources(mp::ArgParser* parser)
                 return ParseCode::CommandLineError;
             }
 
-            if (!source.isFile())
+            if (!source.isFile() && !(recursive && source.isDir()))
             {
-                cerr << "Source path must be a file\n";
+                cerr << "Source path must be a file, or a directory with --recursive\n";
                 return ParseCode::CommandLineError;
             }
 
@@ -43,10 +43,15 @@ private:
     std::vector<std::pair<std::string, std::string>> sources;
     std::pair<std::string, std::string> destination;
     bool streaming_enabled;
+    bool recursive;
+    bool sync_enabled;
+    bool compress;
+    int parallel_transfers;
 
     ParseCode parse_args(ArgParser* parser) override;
     ParseCode parse_sources(ArgParser* parser);
     ParseCode parse_destination(ArgParser* parser);
+    void transfer_files(const SSHInfo& ssh_info, const std::vector<std::string>& source_paths);
 };
 }
 }
@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "utilization.h"
+#include "common_cli.h"
+
+#include <multipass/cli/argparser.h>
+#include <multipass/format.h>
+
+#include <QRegularExpression>
+
+#include <utility>
+
+namespace mp = multipass;
+namespace cmd = multipass::cmd;
+using RpcMethod = mp::Rpc::Stub;
+
+namespace
+{
+// Windows are given, and shown, in whole seconds, minutes, hours or days, e.g. 90m or 7d
+constexpr std::pair<char, long long> units[] = {{'d', 86400}, {'h', 3600}, {'m', 60}, {'s', 1}};
+
+std::string window_string(long long seconds)
+{
+    for (const auto& unit : units)
+    {
+        if (seconds % unit.second == 0)
+            return fmt::format("{}{}", seconds / unit.second, unit.first);
+    }
+
+    return fmt::format("{}s", seconds);
+}
+
+std::string value_string(const std::string& metric, double value)
+{
+    if (metric == "load")
+        return fmt::format("{:.2f}", value);
+
+    if (value < 1048576)
+        return fmt::format("{:.1f}K", value / 1024);
+    if (value < 1073741824)
+        return fmt::format("{:.1f}M", value / 1048576);
+
+    return fmt::format("{:.1f}G", value / 1073741824);
+}
+} // namespace
+
+mp::ReturnCode cmd::Utilization::run(mp::ArgParser* parser)
+{
+    auto ret = parse_args(parser);
+    if (ret != ParseCode::Ok)
+    {
+        return parser->returnCodeFrom(ret);
+    }
+
+    auto on_success = [this](mp::UtilizationReply& reply) {
+        if (reply.summaries().empty())
+        {
+            cout << "No utilization recorded yet\n";
+            return ReturnCode::Ok;
+        }
+
+        cout << fmt::format("{:<24}{:<14}{:>8}{:>10}{:>10}{:>10}{:>10}\n", "Name", "Metric", "Window", "Min", "Avg",
+                            "P95", "Max");
+        for (const auto& summary : reply.summaries())
+            cout << fmt::format("{:<24}{:<14}{:>8}{:>10}{:>10}{:>10}{:>10}\n", summary.instance_name(),
+                                summary.metric(), window_string(summary.window_seconds()),
+                                value_string(summary.metric(), summary.min()),
+                                value_string(summary.metric(), summary.average()),
+                                value_string(summary.metric(), summary.p95()),
+                                value_string(summary.metric(), summary.max()));
+        return ReturnCode::Ok;
+    };
+
+    auto on_failure = [this](grpc::Status& status) { return standard_failure_handler_for(name(), cerr, status); };
+
+    request.set_verbosity_level(parser->verbosityLevel());
+    return dispatch(&RpcMethod::utilization, request, on_success, on_failure);
+}
+
+std::string cmd::Utilization::name() const
+{
+    return "utilization";
+}
+
+QString cmd::Utilization::short_help() const
+{
+    return QStringLiteral("Show how much instances used over time");
+}
+
+QString cmd::Utilization::description() const
+{
+    return QStringLiteral("Show the least, average, 95th percentile and most load, memory and disk\n"
+                          "instances used over the last hour, day and thirty days, as the daemon\n"
+                          "saw them while it ran. Longer windows are summarized from coarser\n"
+                          "averages, of up to an hour each.");
+}
+
+mp::ParseCode cmd::Utilization::parse_args(mp::ArgParser* parser)
+{
+    parser->addPositionalArgument("name", "Names of instances to show", "[<name> ...]");
+
+    QCommandLineOption window_option({"w", "window"},
+                                     "Window to summarize, e.g. 30m, 12h or 7d, instead of the default ones. "
+                                     "Can be repeated",
+                                     "window");
+    parser->addOption(window_option);
+
+    auto status = parser->commandParse(this);
+    if (status != ParseCode::Ok)
+        return status;
+
+    const QRegularExpression window_format{"^([1-9][0-9]*)([smhd])$"};
+    for (const auto& window : parser->values(window_option))
+    {
+        auto match = window_format.match(window);
+        if (!match.hasMatch())
+        {
+            cerr << fmt::format("Invalid window \"{}\": give a number of seconds, minutes, hours or days, e.g. 7d\n",
+                                window.toStdString());
+            return ParseCode::CommandLineError;
+        }
+
+        const auto unit = match.captured(2).at(0).toLatin1();
+        auto seconds = match.captured(1).toLongLong();
+        for (const auto& candidate : units)
+        {
+            if (candidate.first == unit)
+                seconds *= candidate.second;
+        }
+        request.add_window_seconds(seconds);
+    }
+
+    request.mutable_instance_names()->CopyFrom(add_instance_names(parser));
+
+    return status;
+}
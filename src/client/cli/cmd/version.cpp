@@ -18,12 +18,25 @@
 #include "version.h"
 #include "common_cli.h"
 #include <multipass/cli/argparser.h>
+#include <multipass/format.h>
 #include <multipass/version.h>
 
 namespace mp = multipass;
 namespace cmd = multipass::cmd;
 using RpcMethod = mp::Rpc::Stub;
 
+namespace
+{
+std::string commitment(long long committed, long long limit, bool sizes)
+{
+    auto format = [sizes](long long amount) {
+        return sizes ? fmt::format("{:.1f}GiB", amount / 1073741824.) : std::to_string(amount);
+    };
+
+    return limit > 0 ? fmt::format("{} of {}", format(committed), format(limit)) : format(committed);
+}
+} // namespace
+
 mp::ReturnCode cmd::Version::run(mp::ArgParser* parser)
 {
     auto ret = parse_args(parser);
@@ -36,6 +49,14 @@ mp::ReturnCode cmd::Version::run(mp::ArgParser* parser)
 
     auto on_success = [this](mp::VersionReply& reply) {
         cout << "multipassd " << reply.version() << "\n";
+        if (reply.has_host_commitment())
+        {
+            const auto& host = reply.host_commitment();
+            cout << fmt::format("committed  {} vCPUs, {} memory, {} disk\n",
+                                commitment(host.cpus(), host.cpus_limit(), false),
+                                commitment(host.memory_bytes(), host.memory_limit_bytes(), true),
+                                commitment(host.disk_bytes(), host.disk_limit_bytes(), true));
+        }
         if (term->is_live() && update_available(reply.update_info()))
             cout << update_notice(reply.update_info());
         return ReturnCode::Ok;
@@ -21,50 +21,76 @@
 
 #include <multipass/format.h>
 
+#include <sstream>
+
 namespace mp = multipass;
 
 std::string mp::CSVFormatter::format(const InfoReply& reply) const
+{
+    std::ostringstream out;
+    format_to(out, reply);
+    return out.str();
+}
+
+std::string mp::CSVFormatter::format(const ListReply& reply) const
+{
+    std::ostringstream out;
+    format_to(out, reply);
+    return out.str();
+}
+
+std::string mp::CSVFormatter::format(const FindReply& reply) const
+{
+    std::ostringstream out;
+    format_to(out, reply);
+    return out.str();
+}
+
+void mp::CSVFormatter::format_to(std::ostream& out, const InfoReply& reply) const
 {
     fmt::memory_buffer buf;
     fmt::format_to(
         buf, "Name,State,Ipv4,Ipv6,Release,Image hash,Image release,Load,Disk usage,Disk total,Memory usage,Memory "
              "total,Mounts\n");
 
-    for (const auto& info : format::sorted(reply.info()))
+    for (const auto* entry : format::sorted_view(reply.info()))
     {
+        const auto& info = *entry;
         fmt::format_to(buf, "{},{},{},{},{},{},{},{},{},{},{},{},", info.name(),
                        mp::format::status_string_for(info.instance_status()), info.ipv4(), info.ipv6(),
                        info.current_release(), info.id(), info.image_release(), info.load(), info.disk_usage(),
                        info.disk_total(), info.memory_usage(), info.memory_total());
 
-        auto mount_paths = info.mount_info().mount_paths();
-        for (auto mount = mount_paths.cbegin(); mount != mount_paths.cend(); ++mount)
+        for (const auto& mount : info.mount_info().mount_paths())
         {
-            fmt::format_to(buf, "{} => {};", mount->source_path(), mount->target_path());
+            fmt::format_to(buf, "{} => {};", mount.source_path(), mount.target_path());
         }
 
         fmt::format_to(buf, "\n");
+        format::flush_to(out, buf, format::output_chunk_size);
     }
-    return fmt::to_string(buf);
+
+    format::flush_to(out, buf);
 }
 
-std::string mp::CSVFormatter::format(const ListReply& reply) const
+void mp::CSVFormatter::format_to(std::ostream& out, const ListReply& reply) const
 {
     fmt::memory_buffer buf;
 
     fmt::format_to(buf, "Name,State,IPv4,IPv6,Release\n");
 
-    for (const auto& instance : format::sorted(reply.instances()))
+    for (const auto* instance : format::sorted_view(reply.instances()))
     {
-        fmt::format_to(buf, "{},{},{},{},{}\n", instance.name(),
-                       mp::format::status_string_for(instance.instance_status()), instance.ipv4(), instance.ipv6(),
-                       instance.current_release());
+        fmt::format_to(buf, "{},{},{},{},{}\n", instance->name(),
+                       mp::format::status_string_for(instance->instance_status()), instance->ipv4(), instance->ipv6(),
+                       instance->current_release());
+        format::flush_to(out, buf, format::output_chunk_size);
     }
 
-    return fmt::to_string(buf);
+    format::flush_to(out, buf);
 }
 
-std::string mp::CSVFormatter::format(const FindReply& reply) const
+void mp::CSVFormatter::format_to(std::ostream& out, const FindReply& reply) const
 {
     fmt::memory_buffer buf;
 
@@ -80,7 +106,8 @@ std::string mp::CSVFormatter::format(const FindReply& reply) const
         fmt::format_to(buf, "{},{},{},{},{},{}\n", image_id, aliases[0].remote_name(),
                        fmt::join(aliases.cbegin() + 1, aliases.cend(), ";"), image.os(), image.release(),
                        image.version());
+        format::flush_to(out, buf, format::output_chunk_size);
     }
 
-    return fmt::to_string(buf);
+    format::flush_to(out, buf);
 }
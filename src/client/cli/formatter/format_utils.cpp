@@ -110,3 +110,12 @@ void mp::format::filter_aliases(google::protobuf::RepeatedPtrField<multipass::Fi
             aliases.DeleteSubrange(i, 1);
     }
 }
+
+void mp::format::flush_to(std::ostream& out, fmt::memory_buffer& buf, std::size_t threshold)
+{
+    if (buf.size() <= threshold)
+        return;
+
+    out.write(buf.data(), static_cast<std::streamsize>(buf.size()));
+    buf.clear();
+}
@@ -73,6 +73,17 @@ std::string mp::JsonFormatter::format(const InfoReply& reply) const
             ipv4_addrs.append(QString::fromStdString(info.ipv4()));
         instance_info.insert("ipv4", ipv4_addrs);
 
+        if (!info.telemetry_timestamp().empty())
+            instance_info.insert("telemetry_timestamp", QString::fromStdString(info.telemetry_timestamp()));
+
+        if (!info.hypervisor_stats().empty())
+        {
+            QJsonObject hypervisor_stats;
+            for (const auto& stat : info.hypervisor_stats())
+                hypervisor_stats.insert(QString::fromStdString(stat.first), QString::fromStdString(stat.second));
+            instance_info.insert("hypervisor_stats", hypervisor_stats);
+        }
+
         QJsonObject mounts;
         for (const auto& mount : info.mount_info().mount_paths())
         {
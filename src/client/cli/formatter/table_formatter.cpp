@@ -21,6 +21,8 @@
 
 #include <multipass/format.h>
 
+#include <sstream>
+
 namespace mp = multipass;
 
 namespace
@@ -52,10 +54,43 @@ std::string to_usage(const std::string& usage, const std::string& total)
 } // namespace
 std::string mp::TableFormatter::format(const InfoReply& reply) const
 {
+    std::ostringstream out;
+    format_to(out, reply);
+    return out.str();
+}
+
+std::string mp::TableFormatter::format(const ListReply& reply) const
+{
+    std::ostringstream out;
+    format_to(out, reply);
+    return out.str();
+}
+
+std::string mp::TableFormatter::format(const FindReply& reply) const
+{
+    std::ostringstream out;
+    format_to(out, reply);
+    return out.str();
+}
+
+void mp::TableFormatter::format_to(std::ostream& out, const InfoReply& reply) const
+{
+    if (reply.info().empty())
+    {
+        out << "\n";
+        return;
+    }
+
     fmt::memory_buffer buf;
+    auto first_entry = true;
 
-    for (const auto& info : format::sorted(reply.info()))
+    for (const auto* entry : format::sorted_view(reply.info()))
     {
+        const auto& info = *entry;
+        if (!first_entry)
+            fmt::format_to(buf, "\n");
+        first_entry = false;
+
         fmt::format_to(buf, "{:<16}{}\n", "Name:", info.name());
         fmt::format_to(buf, "{:<16}{}\n", "State:", mp::format::status_string_for(info.instance_status()));
         fmt::format_to(buf, "{:<16}{}\n", "IPv4:", info.ipv4().empty() ? "--" : info.ipv4());
@@ -76,7 +111,20 @@ std::string mp::TableFormatter::format(const InfoReply& reply) const
         fmt::format_to(buf, "{:<16}{}\n", "Disk usage:", to_usage(info.disk_usage(), info.disk_total()));
         fmt::format_to(buf, "{:<16}{}\n", "Memory usage:", to_usage(info.memory_usage(), info.memory_total()));
 
-        auto mount_paths = info.mount_info().mount_paths();
+        const auto& stats = info.hypervisor_stats();
+        auto has_stats = [&stats](const char* first, const char* second) {
+            return stats.find(first) != stats.end() && stats.find(second) != stats.end();
+        };
+        if (has_stats("disk_read_bytes", "disk_written_bytes"))
+            fmt::format_to(buf, "{:<16}{} read, {} written\n", "Disk I/O:",
+                           human_readable_size(stats.at("disk_read_bytes")),
+                           human_readable_size(stats.at("disk_written_bytes")));
+        if (has_stats("network_received_bytes", "network_sent_bytes"))
+            fmt::format_to(buf, "{:<16}{} received, {} sent\n", "Network I/O:",
+                           human_readable_size(stats.at("network_received_bytes")),
+                           human_readable_size(stats.at("network_sent_bytes")));
+
+        const auto& mount_paths = info.mount_info().mount_paths();
         for (auto mount = mount_paths.cbegin(); mount != mount_paths.cend(); ++mount)
         {
             fmt::format_to(buf, "{:<16}{:{}} => {}\n", (mount == mount_paths.cbegin()) ? "Mounts:" : " ",
@@ -104,26 +152,23 @@ std::string mp::TableFormatter::format(const InfoReply& reply) const
             }
         }
 
-        fmt::format_to(buf, "\n");
+        format::flush_to(out, buf, format::output_chunk_size);
     }
 
-    auto output = fmt::to_string(buf);
-    if (!reply.info().empty())
-        output.pop_back();
-    else
-        output = "\n";
-
-    return output;
+    format::flush_to(out, buf);
 }
 
-std::string mp::TableFormatter::format(const ListReply& reply) const
+void mp::TableFormatter::format_to(std::ostream& out, const ListReply& reply) const
 {
-    fmt::memory_buffer buf;
-
-    auto instances = reply.instances();
+    const auto& instances = reply.instances();
 
     if (instances.empty())
-        return "No instances found.\n";
+    {
+        out << "No instances found.\n";
+        return;
+    }
+
+    fmt::memory_buffer buf;
 
     const std::string::size_type minimal_name_column_width = 24;
     const std::string::size_type state_column_width = 18;
@@ -141,25 +186,28 @@ std::string mp::TableFormatter::format(const ListReply& reply) const
     fmt::format_to(buf, row_format, "Name", name_column_width, "State", state_column_width, "IPv4", ip_column_width,
                    "Image");
 
-    for (const auto& instance : format::sorted(reply.instances()))
+    for (const auto* instance : format::sorted_view(instances))
     {
-        fmt::format_to(buf, row_format, instance.name(), name_column_width,
-                       mp::format::status_string_for(instance.instance_status()), state_column_width,
-                       instance.ipv4().empty() ? "--" : instance.ipv4(), ip_column_width,
-                       instance.current_release().empty() ? "Not Available"
-                                                          : fmt::format("Ubuntu {}", instance.current_release()));
+        fmt::format_to(buf, row_format, instance->name(), name_column_width,
+                       mp::format::status_string_for(instance->instance_status()), state_column_width,
+                       instance->ipv4().empty() ? "--" : instance->ipv4(), ip_column_width,
+                       instance->current_release().empty() ? "Not Available"
+                                                           : fmt::format("Ubuntu {}", instance->current_release()));
+        format::flush_to(out, buf, format::output_chunk_size);
     }
 
-    return fmt::to_string(buf);
+    format::flush_to(out, buf);
 }
 
-std::string mp::TableFormatter::format(const FindReply& reply) const
+void mp::TableFormatter::format_to(std::ostream& out, const FindReply& reply) const
 {
-    fmt::memory_buffer buf;
-
     if (reply.images_info().empty())
-        return "No images found.\n";
+    {
+        out << "No images found.\n";
+        return;
+    }
 
+    fmt::memory_buffer buf;
     fmt::format_to(buf, "{:<24}{:<18}{:<17}{:<}\n", "Image", "Aliases", "Version", "Description");
 
     for (const auto& image : reply.images_info())
@@ -171,7 +219,8 @@ std::string mp::TableFormatter::format(const FindReply& reply) const
         fmt::format_to(buf, "{:<24}{:<18}{:<17}{:<}\n", mp::format::image_string_for(aliases[0]),
                        fmt::format("{}", fmt::join(aliases.cbegin() + 1, aliases.cend(), ",")), image.version(),
                        fmt::format("{}{}", image.os().empty() ? ""  : image.os() + " ", image.release()));
+        format::flush_to(out, buf, format::output_chunk_size);
     }
 
-    return fmt::to_string(buf);
+    format::flush_to(out, buf);
 }
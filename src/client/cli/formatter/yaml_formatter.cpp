@@ -24,6 +24,7 @@
 #include <yaml-cpp/yaml.h>
 
 #include <locale>
+#include <map>
 
 namespace mp = multipass;
 
@@ -47,8 +48,9 @@ std::string mp::YamlFormatter::format(const InfoReply& reply) const
 
     info_node["errors"].push_back(YAML::Null);
 
-    for (const auto& info : format::sorted(reply.info()))
+    for (const auto* entry : format::sorted_view(reply.info()))
     {
+        const auto& info = *entry;
         YAML::Node instance_node;
 
         instance_node["state"] = mp::format::status_string_for(info.instance_status());
@@ -96,6 +98,15 @@ std::string mp::YamlFormatter::format(const InfoReply& reply) const
         if (!info.ipv4().empty())
             instance_node["ipv4"].push_back(info.ipv4());
 
+        if (!info.telemetry_timestamp().empty())
+            instance_node["telemetry_timestamp"] = info.telemetry_timestamp();
+
+        std::map<std::string, std::string> hypervisor_stats; // sorted, for the output to be stable
+        for (const auto& stat : info.hypervisor_stats())
+            hypervisor_stats[stat.first] = stat.second;
+        for (const auto& stat : hypervisor_stats)
+            instance_node["hypervisor_stats"][stat.first] = stat.second;
+
         YAML::Node mounts;
         for (const auto& mount : info.mount_info().mount_paths())
         {
@@ -128,8 +139,9 @@ std::string mp::YamlFormatter::format(const ListReply& reply) const
 {
     YAML::Node list;
 
-    for (const auto& instance : format::sorted(reply.instances()))
+    for (const auto* entry : format::sorted_view(reply.instances()))
     {
+        const auto& instance = *entry;
         YAML::Node instance_node;
         instance_node["state"] = mp::format::status_string_for(instance.instance_status());
 
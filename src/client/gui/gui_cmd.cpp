@@ -32,6 +32,8 @@
 #include <QStyle>
 #include <QtConcurrent/QtConcurrent>
 
+#include <utility>
+
 namespace mp = multipass;
 namespace cmd = multipass::cmd;
 using RpcMethod = mp::Rpc::Stub;
@@ -139,6 +141,7 @@ void cmd::GuiCmd::create_actions()
     config_watcher.addPath(client_config_path);
     QObject::connect(&config_watcher, &QFileSystemWatcher::fileChanged, this, [this](const QString& path) {
         autostart_option.setChecked(Settings::instance().get_as<bool>(autostart_key));
+        handle_petenv_change();
         // Needed since the original watched file may be removed and opened as a new file
         if (!config_watcher.files().contains(path) && QFile::exists(path))
         {
@@ -163,74 +166,38 @@ void cmd::GuiCmd::create_actions()
     });
 }
 
-void cmd::GuiCmd::update_menu()
+void cmd::GuiCmd::update_instance_entry(const std::string& instance_name, const mp::InstanceStatus& state)
 {
-    std::vector<std::string> instances_to_remove;
-
-    auto reply = list_future.result();
-
-    handle_petenv_instance(reply.instances());
-
-    for (auto it = instances_entries.cbegin(); it != instances_entries.cend(); ++it)
-    {
-        auto instance = std::find_if(reply.instances().cbegin(), reply.instances().cend(),
-                                     [it](const ListVMInstance& instance) { return it->first == instance.name(); });
-
-        if (instance == reply.instances().cend())
-        {
-            instances_to_remove.push_back(it->first);
-        }
-    }
+    if (state.status() == InstanceStatus::DELETED)
+        instance_states.erase(instance_name);
+    else
+        instance_states[instance_name] = state;
 
-    for (const auto instance : instances_to_remove)
+    if (instance_name == current_petenv_name)
     {
-        instances_entries.erase(instance);
+        update_petenv_actions();
+        return;
     }
 
-    for (const auto& instance : reply.instances())
+    auto it = instances_entries.find(instance_name);
+    if (state.status() == InstanceStatus::DELETED)
     {
-        auto name = instance.name();
-        auto state = instance.instance_status();
-
-        auto it = instances_entries.find(name);
-
         if (it != instances_entries.end())
-        {
-            auto instance_state = it->second.state;
-            if (name == current_petenv_name || state.status() == InstanceStatus::DELETED)
-            {
-                instances_entries.erase(name);
-            }
-            else if (instance_state.status() != state.status())
-            {
-                auto& instance_menu = instances_entries.at(name).menu;
-
-                instance_menu->setTitle(set_title_string_for(name, state));
-                set_input_state_for(instance_menu->actions(), state);
-                instances_entries[name].state = state;
-            }
-
-            continue;
-        }
-
-        if (name == current_petenv_name)
-            continue;
-
-        if (state.status() != InstanceStatus::DELETED)
-        {
-            create_menu_actions_for(name, state);
-            instances_entries[name].state = state;
-        }
+            instances_entries.erase(it);
     }
-
-    if (instances_entries.empty())
+    else if (it == instances_entries.end())
     {
-        about_separator->setVisible(false);
+        create_menu_actions_for(instance_name, state);
+        instances_entries[instance_name].state = state;
     }
-    else
+    else if (it->second.state.status() != state.status())
     {
-        about_separator->setVisible(true);
+        it->second.menu->setTitle(set_title_string_for(instance_name, state));
+        set_input_state_for(it->second.menu->actions(), state);
+        it->second.state = state;
     }
+
+    about_separator->setVisible(!instances_entries.empty());
 }
 
 void cmd::GuiCmd::update_about_menu()
@@ -266,12 +233,27 @@ void cmd::GuiCmd::create_menu()
 
     tray_icon.setIcon(QIcon{":images/multipass-icon.png"});
 
-    QObject::connect(&list_watcher, &QFutureWatcher<ListReply>::finished, this, &GuiCmd::update_menu);
+    // Queued, since both are emitted from the watching thread
+    QObject::connect(this, &GuiCmd::instance_state_changed, this,
+                     [this](const QString& instance_name, int status) {
+                         InstanceStatus state;
+                         state.set_status(static_cast<InstanceStatus::Status>(status));
+                         update_instance_entry(instance_name.toStdString(), state);
+                     },
+                     Qt::QueuedConnection);
+    QObject::connect(this, &GuiCmd::watch_ended, this, &GuiCmd::handle_watch_end, Qt::QueuedConnection);
 
-    QObject::connect(&menu_update_timer, &QTimer::timeout, this, [this] { initiate_menu_layout(); });
+    watch_retry_timer.setSingleShot(true);
+    QObject::connect(&watch_retry_timer, &QTimer::timeout, this, [this] { start_watching(); });
 
     // Use a singleShot here to make sure the event loop is running before the quit() runs
     QObject::connect(quit_action, &QAction::triggered, [this] {
+        {
+            std::lock_guard<decltype(watch_mutex)> lock{watch_mutex};
+            quitting = true;
+            if (watch_context)
+                watch_context->TryCancel();
+        }
         future_synchronizer.waitForFinished();
         QTimer::singleShot(0, [] { QCoreApplication::quit(); });
     });
@@ -297,26 +279,18 @@ void cmd::GuiCmd::create_menu()
 
     tray_icon_menu.insertMenu(quit_action, &about_menu);
 
-    initiate_menu_layout();
+    handle_petenv_change();
+    start_watching();
     initiate_about_menu_layout();
 
-    menu_update_timer.start(1s);
     about_update_timer.start(24h);
 }
 
-void cmd::GuiCmd::initiate_menu_layout()
+void cmd::GuiCmd::start_watching()
 {
-    if (failure_action.isVisible())
-    {
-        tray_icon_menu.removeAction(&failure_action);
-    }
+    tray_icon_menu.removeAction(&failure_action);
 
-    if (!list_future.isRunning())
-    {
-        list_future = QtConcurrent::run(this, &GuiCmd::retrieve_all_instances);
-        future_synchronizer.addFuture(list_future);
-        list_watcher.setFuture(list_future);
-    }
+    future_synchronizer.addFuture(QtConcurrent::run(this, &GuiCmd::watch_instances));
 }
 
 void cmd::GuiCmd::initiate_about_menu_layout()
@@ -329,25 +303,45 @@ void cmd::GuiCmd::initiate_about_menu_layout()
     }
 }
 
-mp::ListReply cmd::GuiCmd::retrieve_all_instances()
+// The daemon first describes every instance, then follows up with each change until the stream is cut
+void cmd::GuiCmd::watch_instances()
 {
-    ListReply list_reply;
-    auto on_success = [&list_reply](ListReply& reply) {
-        list_reply = reply;
-
-        return ReturnCode::Ok;
-    };
+    grpc::ClientContext context;
+    {
+        std::lock_guard<decltype(watch_mutex)> lock{watch_mutex};
+        if (quitting)
+            return;
+        watch_context = &context;
+    }
 
-    auto on_failure = [this](grpc::Status& status) {
-        tray_icon_menu.insertAction(about_separator, &failure_action);
+    auto reader = stub->watch(&context, WatchRequest{});
+    WatchReply reply;
+    while (reader->Read(&reply))
+        emit instance_state_changed(QString::fromStdString(reply.instance_name()), reply.instance_status().status());
 
-        return standard_failure_handler_for(name(), cerr, status);
-    };
+    auto status = reader->Finish();
+    {
+        std::lock_guard<decltype(watch_mutex)> lock{watch_mutex};
+        watch_context = nullptr;
+        if (quitting)
+            return;
+    }
 
-    ListRequest request;
-    dispatch(&RpcMethod::list, request, on_success, on_failure);
+    if (!status.ok())
+        standard_failure_handler_for(name(), cerr, status);
+    emit watch_ended();
+}
 
-    return list_reply;
+void cmd::GuiCmd::handle_watch_end()
+{
+    // What was heard so far can no longer be trusted, the next snapshot rebuilds it all
+    instances_entries.clear();
+    instance_states.clear();
+    about_separator->setVisible(false);
+    update_petenv_actions();
+
+    tray_icon_menu.insertAction(about_separator, &failure_action);
+    watch_retry_timer.start(5s);
 }
 
 void cmd::GuiCmd::create_menu_actions_for(const std::string& instance_name, const mp::InstanceStatus& state)
@@ -375,39 +369,41 @@ void cmd::GuiCmd::create_menu_actions_for(const std::string& instance_name, cons
     tray_icon_menu.insertMenu(about_separator, instance_menu.get());
 }
 
-void cmd::GuiCmd::handle_petenv_instance(const google::protobuf::RepeatedPtrField<mp::ListVMInstance>& instances)
+void cmd::GuiCmd::handle_petenv_change()
 {
     auto petenv_name = Settings::instance().get(petenv_key).toStdString();
-    auto petenv_instance =
-        std::find_if(instances.cbegin(), instances.cend(),
-                     [&petenv_name](const ListVMInstance& instance) { return petenv_name == instance.name(); });
+    if (petenv_name == current_petenv_name)
+        return;
 
-    // petenv doesn't exist yet
-    if (petenv_instance == instances.cend())
-    {
-        if (current_petenv_name != petenv_name)
-        {
-            petenv_start_action.setText("Start");
-            petenv_start_action.setEnabled(false);
-            petenv_shell_action.setEnabled(true);
-            petenv_stop_action.setEnabled(false);
+    auto previous_petenv_name = std::exchange(current_petenv_name, petenv_name);
 
-            current_petenv_name = petenv_name;
-        }
+    // The new primary instance moves out of the list of others, and the old one back into it
+    instances_entries.erase(petenv_name);
+    auto previous = instance_states.find(previous_petenv_name);
+    if (previous != instance_states.end())
+        update_instance_entry(previous_petenv_name, InstanceStatus{previous->second});
 
-        return;
-    }
+    about_separator->setVisible(!instances_entries.empty());
+    update_petenv_actions();
+}
 
-    auto state = petenv_instance->instance_status();
+void cmd::GuiCmd::update_petenv_actions()
+{
+    auto petenv = instance_states.find(current_petenv_name);
 
-    if (petenv_state.status() != state.status() || petenv_name != current_petenv_name)
+    // petenv doesn't exist yet
+    if (petenv == instance_states.end())
     {
-        petenv_start_action.setText(set_title_string_for(fmt::format("Start \"{}\"", petenv_name), state));
-
-        set_input_state_for({&petenv_start_action, &petenv_shell_action, &petenv_stop_action}, state);
-        petenv_state = state;
-        current_petenv_name = petenv_name;
+        petenv_start_action.setText("Start");
+        petenv_start_action.setEnabled(false);
+        petenv_shell_action.setEnabled(true);
+        petenv_stop_action.setEnabled(false);
+        return;
     }
+
+    const auto& state = petenv->second;
+    petenv_start_action.setText(set_title_string_for(fmt::format("Start \"{}\"", current_petenv_name), state));
+    set_input_state_for({&petenv_start_action, &petenv_shell_action, &petenv_stop_action}, state);
 }
 
 void cmd::GuiCmd::start_instance_for(const std::string& instance_name)
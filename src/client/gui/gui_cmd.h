@@ -29,6 +29,7 @@
 #include <QTimer>
 
 #include <memory>
+#include <mutex>
 #include <unordered_map>
 #include <vector>
 
@@ -60,6 +61,11 @@ public:
         return "";
     };
 
+signals:
+    // Emitted from the thread following the daemon, for the menus to be updated on the GUI thread
+    void instance_state_changed(const QString& instance_name, int status);
+    void watch_ended();
+
 private:
     ParseCode parse_args(ArgParser* parser) override
     {
@@ -68,13 +74,15 @@ private:
 
     void create_actions();
     void create_menu();
-    void update_menu();
     void update_about_menu();
-    void initiate_menu_layout();
+    void start_watching();
     void initiate_about_menu_layout();
-    ListReply retrieve_all_instances();
+    void watch_instances();
+    void update_instance_entry(const std::string& instance_name, const InstanceStatus& state);
+    void handle_watch_end();
     void create_menu_actions_for(const std::string& instance_name, const InstanceStatus& state);
-    void handle_petenv_instance(const google::protobuf::RepeatedPtrField<ListVMInstance>&);
+    void handle_petenv_change();
+    void update_petenv_actions();
     void start_instance_for(const std::string& instance_name);
     void stop_instance_for(const std::string& instance_name);
     void suspend_instance_for(const std::string& instance_name);
@@ -86,7 +94,6 @@ private:
     QAction petenv_start_action;
     QAction petenv_shell_action{"Open Shell"};
     QAction petenv_stop_action{"Stop"};
-    InstanceStatus petenv_state;
     std::string current_petenv_name;
 
     QAction* petenv_actions_separator;
@@ -107,9 +114,11 @@ private:
         std::unique_ptr<QMenu> menu;
     };
     std::unordered_map<std::string, InstanceEntry> instances_entries;
+    std::unordered_map<std::string, InstanceStatus> instance_states; // as last heard, the primary instance included
 
-    QFuture<ListReply> list_future;
-    QFutureWatcher<ListReply> list_watcher;
+    std::mutex watch_mutex;
+    grpc::ClientContext* watch_context{nullptr};
+    bool quitting{false};
 
     QFuture<VersionReply> version_future;
     QFutureWatcher<VersionReply> version_watcher;
@@ -118,7 +127,7 @@ private:
 
     QFileSystemWatcher config_watcher;
 
-    QTimer menu_update_timer;
+    QTimer watch_retry_timer;
     QTimer about_update_timer;
 };
 } // namespace cmd
@@ -17,8 +17,11 @@
 
 #include "cli.h"
 
+#include <multipass/constants.h>
+#include <multipass/logging/async_logger.h>
 #include <multipass/logging/standard_logger.h>
 #include <multipass/platform.h>
+#include <multipass/settings.h>
 #include <multipass/utils.h>
 
 #include <multipass/format.h>
@@ -74,15 +77,22 @@ mp::DaemonConfigBuilder mp::cli::parse(const QCoreApplication& app)
     if (parser.isSet(verbosity_option))
         builder.verbosity_level = to_logging_level(parser.value(verbosity_option));
 
-    if (parser.isSet(logger_option))
+    auto logger_name = parser.isSet(logger_option) ? parser.value(logger_option) : QStringLiteral("platform");
+    mpl::Logger::UPtr logger;
+    if (logger_name == "platform")
+        logger = platform::make_logger(builder.verbosity_level);
+    else if (logger_name == "stderr")
+        logger = std::make_unique<mpl::StandardLogger>(builder.verbosity_level);
+    else
+        throw std::runtime_error(fmt::format("invalid logger option '{}'", logger_name));
+
+    // Writing to journald can block, so none of the daemon's threads does it itself
+    if (logger)
     {
-        auto logger = parser.value(logger_option);
-        if (logger == "platform")
-            builder.logger = platform::make_logger(builder.verbosity_level);
-        else if (logger == "stderr")
-            builder.logger = std::make_unique<mpl::StandardLogger>(builder.verbosity_level);
-        else
-            throw std::runtime_error(fmt::format("invalid logger option '{}'", logger));
+        auto overflow_policy = mp::Settings::instance().get(mp::log_overflow_key) == "block"
+                                   ? mpl::AsyncLogger::OverflowPolicy::block
+                                   : mpl::AsyncLogger::OverflowPolicy::drop;
+        builder.logger = std::make_unique<mpl::AsyncLogger>(std::move(logger), overflow_policy);
     }
 
     if (parser.isSet(address_option))
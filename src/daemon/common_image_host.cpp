@@ -17,10 +17,17 @@
 
 #include "common_image_host.h"
 
+#include <multipass/exceptions/download_exception.h>
 #include <multipass/logging/log.h>
 
 #include <multipass/format.h>
 
+#include <QCryptographicHash>
+#include <QFutureSynchronizer>
+#include <QtConcurrent/QtConcurrent>
+
+#include <exception>
+
 namespace mp = multipass;
 namespace mpl = multipass::logging;
 
@@ -63,22 +70,148 @@ auto mp::CommonVMImageHost::info_for_full_hash(const std::string& full_hash) ->
     return info_for_full_hash_impl(full_hash);
 }
 
+int mp::CommonVMImageHost::manifest_generation()
+{
+    update_manifests();
+
+    return generation;
+}
+
+void mp::CommonVMImageHost::wait_for_manifest_refresh()
+{
+    QFuture<void> pending;
+    {
+        std::lock_guard<std::mutex> lock{state_mutex};
+        pending = refresh;
+    }
+
+    pending.waitForFinished();
+}
+
 void mp::CommonVMImageHost::update_manifests()
 {
-    const auto now = std::chrono::steady_clock::now();
-    if ((now - last_update) > manifest_time_to_live || need_extra_update)
+    std::unique_lock<std::mutex> lock{state_mutex};
+    if (!manifests_due())
+        return;
+
+    if (manifests_loaded)
     {
-        need_extra_update = false;
+        if (!refreshing)
+        {
+            refreshing = true;
+            need_extra_update = false;
+            last_update = std::chrono::steady_clock::now();
+
+            refresh = QtConcurrent::run([this] {
+                std::lock_guard<std::mutex> fetch_lock{fetch_mutex};
+                try
+                {
+                    refresh_manifests();
+                }
+                catch (const std::exception& e)
+                {
+                    mpl::log(mpl::Level::error, category, e.what());
+                    std::lock_guard<std::mutex> retry_lock{state_mutex};
+                    need_extra_update = true;
+                }
+
+                std::lock_guard<std::mutex> done_lock{state_mutex};
+                refreshing = false;
+            });
+        }
 
-        clear();
-        fetch_manifests();
+        return;
+    }
+
+    // Nothing to serve yet, so this waits for the network, after whoever else got here first
+    lock.unlock();
+    std::lock_guard<std::mutex> fetch_lock{fetch_mutex};
+    lock.lock();
+    if (manifests_loaded || !manifests_due())
+        return;
+
+    need_extra_update = false;
+    last_update = std::chrono::steady_clock::now();
+    lock.unlock();
 
-        last_update = now;
+    try
+    {
+        refresh_manifests();
+    }
+    catch (...)
+    {
+        std::lock_guard<std::mutex> retry_lock{state_mutex};
+        need_extra_update = true;
+        throw;
     }
 }
 
+bool mp::CommonVMImageHost::manifests_due() const
+{
+    return (std::chrono::steady_clock::now() - last_update) > manifest_time_to_live || need_extra_update;
+}
+
+void mp::CommonVMImageHost::refresh_manifests()
+{
+    fetch_manifests();
+
+    QCryptographicHash digest{QCryptographicHash::Md5};
+    for_each_entry_do_impl([&digest](const std::string& remote, const VMImageInfo& info) {
+        digest.addData(remote.c_str());
+        digest.addData(info.id.toUtf8());
+        digest.addData(info.aliases.join(',').toUtf8());
+        digest.addData(info.supported ? "1" : "0");
+    });
+
+    if (digest.result() != manifests_digest)
+    {
+        manifests_digest = digest.result();
+        ++generation;
+    }
+
+    std::lock_guard<std::mutex> lock{state_mutex};
+    manifests_loaded = manifests_loaded || !need_extra_update; // every remote came through at least once
+}
+
+void mp::CommonVMImageHost::fetch_concurrently(const std::vector<std::function<void()>>& fetches)
+{
+    std::vector<std::string> download_failures(fetches.size());
+    std::vector<std::exception_ptr> errors(fetches.size());
+    {
+        QFutureSynchronizer<void> synchronizer;
+        for (std::size_t i = 0; i < fetches.size(); ++i)
+        {
+            synchronizer.addFuture(QtConcurrent::run([&fetches, &download_failures, &errors, i] {
+                try
+                {
+                    fetches[i]();
+                }
+                catch (const mp::DownloadException& e)
+                {
+                    download_failures[i] = e.what();
+                }
+                catch (...)
+                {
+                    errors[i] = std::current_exception();
+                }
+            }));
+        }
+    }
+
+    for (const auto& failure : download_failures)
+        if (!failure.empty())
+            on_manifest_update_failure(failure);
+
+    for (const auto& error : errors)
+        if (error)
+            std::rethrow_exception(error);
+}
+
 void mp::CommonVMImageHost::on_manifest_update_failure(const std::string& details)
 {
-    need_extra_update = true;
+    {
+        std::lock_guard<std::mutex> lock{state_mutex};
+        need_extra_update = true;
+    }
     mpl::log(mpl::Level::warning, category, fmt::format("Could not update manifest: {}", details));
 }
@@ -20,9 +20,15 @@
 
 #include "multipass/vm_image_host.h"
 
+#include <QByteArray>
+#include <QFuture>
 #include <QTimer>
 
+#include <atomic>
 #include <chrono>
+#include <functional>
+#include <mutex>
+#include <vector>
 
 namespace multipass
 {
@@ -33,20 +39,39 @@ public:
     CommonVMImageHost(std::chrono::seconds manifest_time_to_live);
     void for_each_entry_do(const Action& action) final;
     VMImageInfo info_for_full_hash(const std::string& full_hash) final;
+    int manifest_generation() final;
+
+    // Waits for a refresh going on in the background, if any. Hosts call this on destruction, before their manifests go
+    void wait_for_manifest_refresh();
 
 protected:
+    // Once there are manifests, stale ones keep being served while they are refreshed in the background; only the
+    // first fetch, or one retrying remotes that never came through, is waited for
     void update_manifests();
     void on_manifest_update_failure(const std::string& details);
+    // Runs the fetches side by side and waits for all of them, so a slow mirror only holds up its own remote. Each
+    // download failure is reported, and any other exception is rethrown once every fetch is done
+    void fetch_concurrently(const std::vector<std::function<void()>>& fetches);
 
     virtual void for_each_entry_do_impl(const Action& action) = 0;
     virtual VMImageInfo info_for_full_hash_impl(const std::string& full_hash) = 0;
-    virtual void clear() = 0;
+    // Fetches fresh manifests and swaps them in all at once, keeping the last good one of any remote that failed
     virtual void fetch_manifests() = 0;
 
 private:
+    bool manifests_due() const;
+    void refresh_manifests(); // with fetch_mutex held
+
     std::chrono::seconds manifest_time_to_live;
+    std::mutex state_mutex; // guards the fields up to the refresh future
     std::chrono::steady_clock::time_point last_update;
     bool need_extra_update = true;
+    bool manifests_loaded = false;
+    bool refreshing = false;
+    QFuture<void> refresh;
+    std::mutex fetch_mutex; // one refresh at a time; taken before state_mutex when both are needed
+    QByteArray manifests_digest;
+    std::atomic<int> generation{0};
     QTimer manifest_single_shot;
 };
 
@@ -176,11 +176,16 @@ mp::CustomVMImageHost::CustomVMImageHost(URLDownloader* downloader, std::chrono:
     : CommonVMImageHost{manifest_time_to_live},
       url_downloader{downloader},
       path_prefix{path_prefix},
-      custom_image_info{},
+      custom_image_info{std::make_shared<const CustomManifests>()},
       remotes{no_remote, snapcraft_remote}
 {
 }
 
+mp::CustomVMImageHost::~CustomVMImageHost()
+{
+    wait_for_manifest_refresh();
+}
+
 mp::optional<mp::VMImageInfo> mp::CustomVMImageHost::info_for(const Query& query)
 {
     auto custom_manifest = manifest_from(query.remote_name);
@@ -225,7 +230,8 @@ std::vector<mp::VMImageInfo> mp::CustomVMImageHost::all_images_for(const std::st
 
 void mp::CustomVMImageHost::for_each_entry_do_impl(const Action& action)
 {
-    for (const auto& manifest : custom_image_info)
+    const auto current = std::atomic_load(&custom_image_info);
+    for (const auto& manifest : *current)
     {
         for (const auto& info : manifest.second->products)
         {
@@ -241,32 +247,39 @@ std::vector<std::string> mp::CustomVMImageHost::supported_remotes()
 
 void mp::CustomVMImageHost::fetch_manifests()
 {
-    for (const auto& spec :
-         {std::make_pair(no_remote, multipass_image_info), std::make_pair(snapcraft_remote, snapcraft_image_info)})
+    const std::vector<std::pair<std::string, QMap<QString, CustomImageInfo>>> specs{
+        {no_remote, multipass_image_info}, {snapcraft_remote, snapcraft_image_info}};
+
+    std::vector<std::unique_ptr<CustomManifest>> fetched(specs.size());
+    std::vector<std::function<void()>> fetches;
+    for (std::size_t i = 0; i < specs.size(); ++i)
+        fetches.push_back([this, &specs, &fetched, i] {
+            fetched[i] = full_image_info_for(specs[i].second, url_downloader, path_prefix);
+        });
+
+    fetch_concurrently(fetches);
+
+    const auto current = std::atomic_load(&custom_image_info);
+    auto refreshed = std::make_shared<CustomManifests>();
+    for (std::size_t i = 0; i < specs.size(); ++i)
     {
-        try
-        {
-            custom_image_info.emplace(spec.first, full_image_info_for(spec.second, url_downloader, path_prefix));
-        }
-        catch (mp::DownloadException& e)
-        {
-            on_manifest_update_failure(e.what());
-        }
+        if (fetched[i])
+            refreshed->emplace(specs[i].first, std::move(fetched[i]));
+        else if (current->count(specs[i].first))
+            refreshed->emplace(specs[i].first, current->at(specs[i].first)); // the last good one
     }
-}
 
-void mp::CustomVMImageHost::clear()
-{
-    custom_image_info.clear();
+    std::atomic_store(&custom_image_info, std::shared_ptr<const CustomManifests>{std::move(refreshed)});
 }
 
-mp::CustomManifest* mp::CustomVMImageHost::manifest_from(const std::string& remote_name)
+std::shared_ptr<const mp::CustomManifest> mp::CustomVMImageHost::manifest_from(const std::string& remote_name)
 {
     update_manifests();
 
-    auto it = custom_image_info.find(remote_name);
-    if (it == custom_image_info.end())
+    const auto current = std::atomic_load(&custom_image_info);
+    auto it = current->find(remote_name);
+    if (it == current->end())
         throw std::runtime_error(fmt::format("Remote \"{}\" is unknown or unreachable.", remote_name));
 
-    return it->second.get();
+    return it->second;
 }
@@ -43,6 +43,7 @@ public:
     CustomVMImageHost(URLDownloader* downloader, std::chrono::seconds manifest_time_to_live);
     // For testing
     CustomVMImageHost(URLDownloader* downloader, std::chrono::seconds manifest_time_to_live, const QString& path_prefix);
+    ~CustomVMImageHost();
 
     optional<VMImageInfo> info_for(const Query& query) override;
     std::vector<VMImageInfo> all_info_for(const Query& query) override;
@@ -53,14 +54,15 @@ protected:
     void for_each_entry_do_impl(const Action& action) override;
     VMImageInfo info_for_full_hash_impl(const std::string& full_hash) override;
     void fetch_manifests() override;
-    void clear() override;
 
 private:
-    CustomManifest* manifest_from(const std::string& remote_name);
+    using CustomManifests = std::unordered_map<std::string, std::shared_ptr<const CustomManifest>>;
+
+    std::shared_ptr<const CustomManifest> manifest_from(const std::string& remote_name);
 
     URLDownloader* const url_downloader;
     const QString path_prefix;
-    std::unordered_map<std::string, std::unique_ptr<CustomManifest>> custom_image_info;
+    std::shared_ptr<const CustomManifests> custom_image_info; // swapped whole by each refresh
     std::vector<std::string> remotes;
 };
 } // namespace multipass
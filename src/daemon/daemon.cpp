@@ -18,12 +18,16 @@
 #include "daemon.h"
 #include "base_cloud_init_config.h"
 #include "json_writer.h"
+#include "memory_footprint.h"
+#include "progress_coalescer.h"
+#include "task_graph.h"
 
 #include <multipass/cloud_init_iso.h>
 #include <multipass/constants.h>
 #include <multipass/exceptions/create_image_exception.h>
 #include <multipass/exceptions/exitless_sshprocess_exception.h>
 #include <multipass/exceptions/invalid_memory_size_exception.h>
+#include <multipass/exceptions/resize_exception.h>
 #include <multipass/exceptions/sshfs_missing_error.h>
 #include <multipass/exceptions/start_exception.h>
 #include <multipass/logging/client_logger.h>
@@ -31,7 +35,13 @@
 #include <multipass/name_generator.h>
 #include <multipass/platform.h>
 #include <multipass/query.h>
+#include <multipass/settings.h>
+#include <multipass/sha256.h>
+#include <multipass/ssh/sftp_client.h>
 #include <multipass/ssh/ssh_session.h>
+#include <multipass/ssh/ssh_session_pool.h>
+#include <multipass/telemetry.h>
+#include <multipass/tracing.h>
 #include <multipass/utils.h>
 #include <multipass/version.h>
 #include <multipass/virtual_machine.h>
@@ -44,19 +54,29 @@
 #include <multipass/format.h>
 #include <yaml-cpp/yaml.h>
 
+#include <google/protobuf/arena.h>
+
 #include <QDir>
-#include <QEventLoop>
+#include <QFile>
 #include <QFutureSynchronizer>
 #include <QJsonArray>
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QJsonParseError>
+#include <QRegExp>
 #include <QSysInfo>
+#include <QTimeZone>
 #include <QtConcurrent/QtConcurrent>
 
+#include <algorithm>
 #include <cassert>
+#include <exception>
 #include <functional>
+#include <sstream>
 #include <stdexcept>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 
 namespace mp = multipass;
@@ -70,14 +90,45 @@ using namespace std::chrono_literals;
 using error_string = std::string;
 
 constexpr auto category = "daemon";
+constexpr mpl::Level log_levels[] = {mpl::Level::error, mpl::Level::warning, mpl::Level::info, mpl::Level::debug,
+                                     mpl::Level::trace};
 constexpr auto instance_db_name = "multipassd-vm-instances.json";
+constexpr auto instance_journal_name = "multipassd-vm-instances.journal";
+constexpr auto warm_pool_db_name = "multipassd-warm-pool.json";
+constexpr auto memory_templates_db_name = "multipassd-memory-templates.json";
 constexpr auto uuid_file_name = "multipass-unique-id";
 constexpr auto metrics_opt_in_file = "multipassd-send-metrics.yaml";
 constexpr auto reboot_cmd = "sudo reboot";
 constexpr auto up_timeout = 2min; // This may be tweaked as appropriate and used in places that wait for ssh to be up
 constexpr auto cloud_init_timeout = 5min;
+constexpr auto exit_save_timeout = 5min; // beyond it, instances still being saved are left to lose their memory
+constexpr auto max_entries_per_reply = 100; // for clients that take long replies in several messages
+constexpr auto reply_arena_block_size = 256 * 1024; // each worker's first arena block, kept between replies
 constexpr auto stop_ssh_cmd = "sudo systemctl stop ssh";
 constexpr auto max_install_sshfs_retries = 3;
+constexpr auto guest_sshfs_packages_dir_template = "/tmp/multipass-sshfs.XXXXXXXX";
+constexpr auto guest_sshfs_installed_list = "installed"; // what the instance had before apt brought sshfs in
+constexpr auto sshfs_packages_sums = "SHA256SUMS"; // in sha256sum's format, alongside the cached packages
+constexpr auto telemetry_refresh_interval = 30s;
+constexpr auto disk_trim_interval = 24h;
+constexpr auto disk_trim_cmd = "sudo fstrim --all";
+// Brings the hot-added vCPUs and memory online, then grows the root partition and filesystem into the disk
+constexpr auto guest_resize_cmd =
+    "for f in /sys/devices/system/cpu/cpu*/online /sys/devices/system/memory/memory*/online; do "
+    "grep -qx 0 $f && echo 1 | sudo tee $f > /dev/null; done; "
+    "root=$(findmnt -no SOURCE /); sudo growpart /dev/$(lsblk -no PKNAME $root) ${root##*[!0-9]}; "
+    "sudo resize2fs $root";
+constexpr qint64 package_cache_size = 4LL * 1024 * 1024 * 1024; // least recently used packages go past it
+// Tells apt to go through the package cache on the instance's gateway while that answers, and straight out otherwise
+constexpr auto package_cache_detect_script = "#!/bin/sh\n"
+                                             "# written by Multipass\n"
+                                             "gateway=$(ip -4 route show default | awk '{{ print $3; exit }}')\n"
+                                             "if [ -n \"$gateway\" ] && timeout 1 bash -c "
+                                             "\"exec 3<>/dev/tcp/$gateway/{0}\" 2>/dev/null; then\n"
+                                             "    echo \"http://$gateway:{0}\"\n"
+                                             "else\n"
+                                             "    echo DIRECT\n"
+                                             "fi\n";
 const std::string sshfs_error_template = "Error enabling mount support in '{}'"
                                          "\n\nPlease install 'sshfs' manually inside the instance.";
 
@@ -99,8 +150,138 @@ mp::Query query_from(const mp::LaunchRequest* request, const std::string& name)
     return {name, image, false, request->remote_name(), query_type, true};
 }
 
+// Where the packages installing sshfs took are kept for instances of the same release and architecture, e.g.
+// <cache>/sshfs/focal-amd64. Empty if the instance cannot tell
+QString sshfs_packages_dir_for(mp::SSHSession& session, const mp::Path& cache_directory)
+{
+    auto proc = session.exec("echo \"$(lsb_release -cs)-$(dpkg --print-architecture)\"");
+    if (proc.exit_code() != 0)
+        return {};
+
+    auto key = proc.read_std_output();
+    mp::utils::trim_end(key);
+    if (key.empty() || key.front() == '-' || key.back() == '-')
+        return {};
+
+    return QDir{cache_directory}.filePath(QString::fromStdString("sshfs/" + key));
+}
+
+// A directory of its own in the instance for the packages to go through, which other users there cannot swap them in
+std::string make_guest_sshfs_packages_dir(mp::SSHSession& session)
+{
+    auto proc = session.exec(fmt::format("mktemp -d {}", guest_sshfs_packages_dir_template));
+    if (proc.exit_code() != 0)
+        throw std::runtime_error(proc.read_std_error());
+
+    auto dir = proc.read_std_output();
+    mp::utils::trim_end(dir);
+    if (dir.empty())
+        throw std::runtime_error("mktemp gave no directory");
+
+    return dir;
+}
+
+// Whether the cached packages are all the ones whose digests were recorded when caching them, unchanged since
+bool cached_sshfs_packages_intact(const QDir& dir, const QStringList& packages)
+{
+    QFile sums_file{dir.filePath(sshfs_packages_sums)};
+    if (!sums_file.open(QIODevice::ReadOnly | QIODevice::Text))
+        return false;
+
+    std::unordered_map<std::string, QByteArray> sums;
+    for (const auto& line : sums_file.readAll().split('\n'))
+    {
+        const auto separator = line.indexOf("  ");
+        if (separator > 0)
+            sums.emplace(line.mid(separator + 2).toStdString(), line.left(separator));
+    }
+
+    if (sums.size() != static_cast<std::size_t>(packages.size()))
+        return false;
+
+    std::vector<QString> paths;
+    for (const auto& package : packages)
+        paths.push_back(dir.filePath(package));
+
+    const auto digests = mp::sha256_of_files(paths);
+    for (auto i = 0; i < packages.size(); ++i)
+    {
+        const auto sum = sums.find(packages[i].toStdString());
+        if (sum == sums.end() || sum->second != digests[i])
+            return false;
+    }
+
+    return true;
+}
+
+// Pushes the cached packages and installs them, without going through the instance's package mirrors. The digests
+// are checked on both ends before dpkg sees the packages, and whatever a failed install leaves behind is purged
+bool install_cached_sshfs(mp::SSHSession& session, mp::SFTPClient& sftp, const std::string& guest_dir,
+                          const QString& packages_dir)
+{
+    const QDir dir{packages_dir};
+    const auto packages = dir.entryList({"*.deb"}, QDir::Files);
+    if (packages.isEmpty() || !cached_sshfs_packages_intact(dir, packages))
+        return false;
+
+    for (const auto& package : packages)
+        sftp.push_file(dir.filePath(package).toStdString(), fmt::format("{}/{}", guest_dir, package.toStdString()));
+    sftp.push_file(dir.filePath(sshfs_packages_sums).toStdString(),
+                   fmt::format("{}/{}", guest_dir, sshfs_packages_sums));
+
+    auto proc = session.exec(fmt::format(
+        "cd {0} || exit 1; "
+        "if ! sha256sum -c --quiet {1}; then status=1; "
+        "else before=$(dpkg-query -W -f='${{Package}}\\n'); "
+        "if sudo dpkg -i ./*.deb; then status=0; "
+        "else status=1; "
+        "added=$(for deb in ./*.deb; do dpkg-deb -f $deb Package; done | grep -vxF \"$before\"); "
+        "[ -z \"$added\" ] || sudo dpkg --purge $added; "
+        "sudo dpkg --configure -a; fi; fi; "
+        "rm -f ./*.deb {1}; exit $status",
+        guest_dir, sshfs_packages_sums));
+    return proc.exit_code(std::chrono::minutes(1)) == 0;
+}
+
+// Fetches the packages apt just added to the instance, i.e. those missing from the installed list taken before, and
+// records their digests last, so that a cache cut short is never trusted
+void cache_sshfs_packages(mp::SSHSession& session, mp::SFTPClient& sftp, const std::string& guest_dir,
+                          const QString& packages_dir)
+{
+    auto proc = session.exec(
+        fmt::format("cd {0} && dpkg-query -W -f='${{Package}}\\n' | sort | comm -13 {1} - | "
+                    "xargs -r apt-get download -q >/dev/null && {{ ls | grep '\\.deb$' || true; }}",
+                    guest_dir, guest_sshfs_installed_list));
+    if (proc.exit_code(std::chrono::minutes(2)) != 0)
+        throw std::runtime_error(proc.read_std_error());
+
+    const auto packages = QString::fromStdString(proc.read_std_output()).split('\n', QString::SkipEmptyParts);
+    const QDir dir{packages_dir};
+    if (packages.isEmpty() || !QDir{}.mkpath(packages_dir))
+        return;
+
+    std::vector<QString> paths;
+    for (const auto& package : packages)
+    {
+        paths.push_back(dir.filePath(package));
+        sftp.pull_file(fmt::format("{}/{}", guest_dir, package.toStdString()), paths.back().toStdString());
+    }
+
+    const auto digests = mp::sha256_of_files(paths);
+    QFile sums_file{dir.filePath(sshfs_packages_sums)};
+    if (!sums_file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+        throw std::runtime_error(fmt::format("cannot write {}", sums_file.fileName()));
+
+    for (auto i = 0; i < packages.size(); ++i)
+        sums_file.write(digests[i] + "  " + packages[i].toUtf8() + '\n');
+
+    if (!sums_file.flush())
+        throw std::runtime_error(fmt::format("cannot write {}", sums_file.fileName()));
+}
+
 auto make_cloud_init_vendor_config(const mp::SSHKeyProvider& key_provider, const std::string& time_zone,
-                                   const std::string& username, const std::string& backend_version_string)
+                                   const std::string& username, const std::string& backend_version_string,
+                                   quint16 package_cache_port)
 {
     auto ssh_key_line = fmt::format("ssh-rsa {} {}@localhost", key_provider.public_key_as_base64(), username);
 
@@ -121,9 +302,34 @@ auto make_cloud_init_vendor_config(const mp::SSHKeyProvider& key_provider, const
 
     config["write_files"].push_back(pollinate_user_agent_node);
 
+    // Looked up whenever apt fetches, so instances only use the cache while the daemon serves it
+    if (package_cache_port)
+    {
+        YAML::Node detect_script_node;
+        detect_script_node["path"] = "/usr/local/sbin/multipass-package-cache";
+        detect_script_node["permissions"] = "0755";
+        detect_script_node["content"] = fmt::format(package_cache_detect_script, package_cache_port);
+
+        YAML::Node apt_config_node;
+        apt_config_node["path"] = "/etc/apt/apt.conf.d/90multipass-package-cache";
+        apt_config_node["content"] =
+            "Acquire::http::Proxy-Auto-Detect \"/usr/local/sbin/multipass-package-cache\"; // written by Multipass\n";
+
+        config["write_files"].push_back(detect_script_node);
+        config["write_files"].push_back(apt_config_node);
+    }
+
     return config;
 }
 
+// Baked images carry the machine-id of the instance they were baked from, which every instance launched from one
+// replaces once, early in its first boot
+void reset_machine_id(YAML::Node& vendor_config)
+{
+    vendor_config["bootcmd"].push_back(
+        "cloud-init-per instance multipass-machine-id sh -c 'rm -f /etc/machine-id && systemd-machine-id-setup'");
+}
+
 auto make_cloud_init_meta_config(const std::string& name)
 {
     YAML::Node meta_data;
@@ -146,17 +352,23 @@ auto emit_yaml(YAML::Node& node, const std::string& node_name)
     return fmt::format("#cloud-config\n{}\n", emitter.c_str());
 }
 
-auto make_cloud_init_image(const std::string& name, const QDir& instance_dir, YAML::Node& meta_data_config,
-                           YAML::Node& user_data_config, YAML::Node& vendor_data_config)
+mp::CloudInitIso make_cloud_init_iso(YAML::Node& meta_data_config, YAML::Node& user_data_config,
+                                     YAML::Node& vendor_data_config)
 {
-    const auto cloud_init_iso = instance_dir.filePath("cloud-init-config.iso");
-    if (QFile::exists(cloud_init_iso))
-        return cloud_init_iso;
-
     mp::CloudInitIso iso;
     iso.add_file("meta-data", emit_yaml(meta_data_config, "meta data"));
     iso.add_file("vendor-data", emit_yaml(vendor_data_config, "vendor data"));
     iso.add_file("user-data", emit_yaml(user_data_config, "user data"));
+
+    return iso;
+}
+
+auto make_cloud_init_image(const QDir& instance_dir, mp::CloudInitIso& iso)
+{
+    const auto cloud_init_iso = instance_dir.filePath("cloud-init-config.iso");
+    if (QFile::exists(cloud_init_iso))
+        return cloud_init_iso;
+
     iso.write_to(cloud_init_iso);
 
     return cloud_init_iso;
@@ -171,21 +383,34 @@ void prepare_user_data(YAML::Node& user_data_config, YAML::Node& vendor_config)
     auto keys = user_data_config["ssh_authorized_keys"];
     if (keys.IsSequence())
         keys.push_back(vendor_config["ssh_authorized_keys"][0]);
+
+    // User files replace vendor ones rather than merge with them, so carry ours along
+    auto files = user_data_config["write_files"];
+    if (files.IsSequence())
+        for (const auto& file : vendor_config["write_files"])
+            files.push_back(file);
+
+    auto commands = user_data_config["bootcmd"];
+    if (commands.IsSequence())
+        for (const auto& command : vendor_config["bootcmd"])
+            commands.push_back(command);
 }
 
 mp::VirtualMachineDescription to_machine_desc(const mp::LaunchRequest* request, const std::string& name,
                                               const mp::MemorySize& mem_size, const mp::MemorySize& disk_space,
                                               const std::string& mac_addr, const std::string& ssh_username,
-                                              const mp::VMImage& image, YAML::Node& meta_data_config,
-                                              YAML::Node& user_data_config, YAML::Node& vendor_data_config)
+                                              const mp::VMImage& image, mp::CloudInitIso& iso)
 {
     const auto num_cores = request->num_cores() < std::stoi(mp::min_cpu_cores)
                                ? std::stoi(mp::default_cpu_cores)
                                : request->num_cores();
     const auto instance_dir = mp::utils::base_dir(image.image_path);
-    const auto cloud_init_iso =
-        make_cloud_init_image(name, instance_dir, meta_data_config, user_data_config, vendor_data_config);
-    return {num_cores, mem_size, disk_space, name, mac_addr, ssh_username, image, cloud_init_iso};
+    const auto cloud_init_iso = make_cloud_init_image(instance_dir, iso);
+    const auto disk_profile = request->disk_profile().empty() ? mp::default_disk_profile : request->disk_profile();
+    const auto resource_class =
+        request->resource_class().empty() ? mp::default_resource_class : request->resource_class();
+    return {num_cores,      mem_size,     disk_space,          name,          mac_addr, ssh_username, image,
+            cloud_init_iso, disk_profile, request->hugepages(), resource_class};
 }
 
 template <typename T>
@@ -206,30 +431,28 @@ auto name_from(const std::string& requested_name, mp::NameGenerator& name_gen, c
     return requested_name;
 }
 
-std::unordered_map<std::string, mp::VMSpecs> load_db(const mp::Path& data_path, const mp::Path& cache_path)
+QString instance_db_path(const mp::DaemonConfig& config, const char* file_name)
 {
-    QDir data_dir{data_path};
-    QDir cache_dir{cache_path};
-    QFile db_file{data_dir.filePath(instance_db_name)};
-    auto opened = db_file.open(QIODevice::ReadOnly);
-    if (!opened)
+    QDir data_dir{
+        mp::utils::backend_directory_path(config.data_directory, config.factory->get_backend_directory_name())};
+    return data_dir.filePath(file_name);
+}
+
+std::unordered_map<std::string, mp::VMSpecs> load_db(mp::JournaledJsonStore& db, const mp::Path& cache_path)
+{
+    auto records = db.load();
+    if (records.isEmpty())
     {
         // Try to open the old location
         QDir cache_dir{cache_path};
-        db_file.setFileName(cache_dir.filePath(instance_db_name));
-        auto opened = db_file.open(QIODevice::ReadOnly);
-        if (!opened)
+        QFile db_file{cache_dir.filePath(instance_db_name)};
+        if (!db_file.open(QIODevice::ReadOnly))
             return {};
-    }
-
-    QJsonParseError parse_error;
-    auto doc = QJsonDocument::fromJson(db_file.readAll(), &parse_error);
-    if (doc.isNull())
-        return {};
 
-    auto records = doc.object();
-    if (records.isEmpty())
-        return {};
+        records = QJsonDocument::fromJson(db_file.readAll()).object();
+        if (records.isEmpty())
+            return {};
+    }
 
     std::unordered_map<std::string, mp::VMSpecs> reconstructed_records;
     for (auto it = records.constBegin(); it != records.constEnd(); ++it)
@@ -247,6 +470,12 @@ std::unordered_map<std::string, mp::VMSpecs> load_db(const mp::Path& data_path,
         auto state = record["state"].toInt();
         auto deleted = record["deleted"].toBool();
         auto metadata = record["metadata"].toObject();
+        auto disk_profile = record["disk_profile"].toString().toStdString();
+        auto hugepages = record["hugepages"].toBool();
+        auto resource_class = record["resource_class"].toString().toStdString();
+        auto throttle_entry = record["throttle"].toObject();
+        auto purged = record["purged"].toBool();
+        auto idle_suspended = record["idle_suspended"].toBool();
 
         if (ssh_username.empty())
             ssh_username = "ubuntu";
@@ -270,10 +499,32 @@ std::unordered_map<std::string, mp::VMSpecs> load_db(const mp::Path& data_path,
                 gid_map[gid_entry.toObject()["host_gid"].toInt()] = gid_entry.toObject()["instance_gid"].toInt();
             }
 
-            mp::VMMount mount{source_path, gid_map, uid_map};
+            auto type = entry.toObject()["mount_type"].toString() == "native" ? mp::VMMount::Type::native
+                                                                                : mp::VMMount::Type::classic;
+
+            auto profile = entry.toObject()["mount_profile"].toString().toStdString();
+
+            mp::VMMount mount{source_path, gid_map, uid_map, type,
+                              profile.empty() ? mp::default_mount_profile : profile};
             mounts[target_path] = mount;
         }
 
+        std::vector<mp::PortForward> port_forwards;
+        for (const auto& entry : record["port_forwards"].toArray())
+        {
+            const auto forward = entry.toObject();
+            const auto address = forward["address"].toString().toStdString();
+            if (!mp::PortForwarder::is_ipv4_address(address))
+            {
+                mpl::log(mpl::Level::warning, category,
+                         fmt::format("Dropping the forward of port {} of \"{}\": \"{}\" is not an IPv4 address",
+                                     forward["host_port"].toInt(), key, address));
+                continue;
+            }
+
+            port_forwards.push_back({address, forward["host_port"].toInt(), forward["instance_port"].toInt()});
+        }
+
         reconstructed_records[key] = {num_cores,
                                       mp::MemorySize{mem_size.empty() ? mp::default_memory_size : mem_size},
                                       mp::MemorySize{disk_space.empty() ? mp::default_disk_size : disk_space},
@@ -282,11 +533,144 @@ std::unordered_map<std::string, mp::VMSpecs> load_db(const mp::Path& data_path,
                                       static_cast<mp::VirtualMachine::State>(state),
                                       mounts,
                                       deleted,
-                                      metadata};
+                                      metadata,
+                                      disk_profile.empty() ? mp::default_disk_profile : disk_profile,
+                                      hugepages,
+                                      resource_class.empty() ? mp::default_resource_class : resource_class,
+                                      {throttle_entry["disk_iops"].toVariant().toLongLong(),
+                                       throttle_entry["disk_bytes_per_second"].toVariant().toLongLong(),
+                                       throttle_entry["network_bytes_per_second"].toVariant().toLongLong()},
+                                      port_forwards,
+                                      purged,
+                                      idle_suspended};
     }
     return reconstructed_records;
 }
 
+QJsonObject vm_spec_to_json(const mp::VMSpecs& specs)
+{
+    QJsonObject json;
+    json.insert("num_cores", specs.num_cores);
+    json.insert("mem_size", QString::number(specs.mem_size.in_bytes()));
+    json.insert("disk_space", QString::number(specs.disk_space.in_bytes()));
+    json.insert("mac_addr", QString::fromStdString(specs.mac_addr));
+    json.insert("ssh_username", QString::fromStdString(specs.ssh_username));
+    json.insert("state", static_cast<int>(specs.state));
+    json.insert("deleted", specs.deleted);
+    json.insert("metadata", specs.metadata);
+    json.insert("disk_profile", QString::fromStdString(specs.disk_profile));
+    json.insert("hugepages", specs.hugepages);
+    json.insert("resource_class", QString::fromStdString(specs.resource_class));
+    json.insert("throttle", QJsonObject{{"disk_iops", specs.throttle.disk_iops},
+                                        {"disk_bytes_per_second", specs.throttle.disk_bytes_per_second},
+                                        {"network_bytes_per_second", specs.throttle.network_bytes_per_second}});
+    json.insert("purged", specs.purged);
+    json.insert("idle_suspended", specs.idle_suspended);
+
+    QJsonArray port_forwards;
+    for (const auto& forward : specs.port_forwards)
+        port_forwards.append(QJsonObject{{"address", QString::fromStdString(forward.address)},
+                                         {"host_port", forward.host_port},
+                                         {"instance_port", forward.instance_port}});
+    json.insert("port_forwards", port_forwards);
+
+    QJsonArray mounts;
+    for (const auto& mount : specs.mounts)
+    {
+        QJsonObject entry;
+        entry.insert("source_path", QString::fromStdString(mount.second.source_path));
+        entry.insert("target_path", QString::fromStdString(mount.first));
+        entry.insert("mount_type", mount.second.type == mp::VMMount::Type::native ? "native" : "classic");
+        entry.insert("mount_profile", QString::fromStdString(mount.second.profile));
+
+        QJsonArray uid_map;
+        for (const auto& map : mount.second.uid_map)
+        {
+            QJsonObject map_entry;
+            map_entry.insert("host_uid", map.first);
+            map_entry.insert("instance_uid", map.second);
+
+            uid_map.append(map_entry);
+        }
+
+        entry.insert("uid_mappings", uid_map);
+
+        QJsonArray gid_map;
+        for (const auto& map : mount.second.gid_map)
+        {
+            QJsonObject map_entry;
+            map_entry.insert("host_gid", map.first);
+            map_entry.insert("instance_gid", map.second);
+
+            gid_map.append(map_entry);
+        }
+
+        entry.insert("gid_mappings", gid_map);
+        mounts.append(entry);
+    }
+
+    json.insert("mounts", mounts);
+    return json;
+}
+
+std::unordered_map<std::string, std::string> load_warm_pool(const mp::Path& data_path)
+{
+    QFile db_file{QDir{data_path}.filePath(warm_pool_db_name)};
+    if (!db_file.open(QIODevice::ReadOnly))
+        return {};
+
+    std::unordered_map<std::string, std::string> warm_pool;
+    const auto records = QJsonDocument::fromJson(db_file.readAll()).object();
+    for (auto it = records.constBegin(); it != records.constEnd(); ++it)
+        warm_pool[it.key().toStdString()] = it.value().toString().toStdString();
+
+    return warm_pool;
+}
+
+// Memory templates by name, with their image and whether their memory was saved
+std::unordered_map<std::string, std::pair<std::string, bool>> load_memory_templates(const mp::Path& data_path)
+{
+    QFile db_file{QDir{data_path}.filePath(memory_templates_db_name)};
+    if (!db_file.open(QIODevice::ReadOnly))
+        return {};
+
+    std::unordered_map<std::string, std::pair<std::string, bool>> memory_templates;
+    const auto records = QJsonDocument::fromJson(db_file.readAll()).object();
+    for (auto it = records.constBegin(); it != records.constEnd(); ++it)
+    {
+        const auto record = it.value().toObject();
+        memory_templates[it.key().toStdString()] = {record["image"].toString().toStdString(),
+                                                     record["saved"].toBool()};
+    }
+
+    return memory_templates;
+}
+
+// Warm instances and memory templates are booted with the defaults, so only launches that ask for nothing else can
+// start from them
+bool asks_for_defaults(const mp::LaunchRequest* request)
+{
+    const auto num_cores = request->num_cores() < std::stoi(mp::min_cpu_cores) ? std::stoi(mp::default_cpu_cores)
+                                                                                : request->num_cores();
+    auto default_size = [](const std::string& size, const char* default_size) {
+        return size.empty() || size == default_size;
+    };
+
+    return request->cloud_init_user_data().empty() && request->remote_name().empty() &&
+           num_cores == std::stoi(mp::default_cpu_cores) &&
+           default_size(request->mem_size(), mp::default_memory_size) &&
+           default_size(request->disk_space(), mp::default_disk_size) &&
+           default_size(request->disk_profile(), mp::default_disk_profile) && !request->hugepages() &&
+           default_size(request->resource_class(), mp::default_resource_class) &&
+           request->time_zone() == QTimeZone::systemTimeZoneId().toStdString();
+}
+
+// A warm instance has a name already
+bool can_use_warm_instance(const mp::LaunchRequest* request)
+{
+    return request->instance_name().empty() && asks_for_defaults(request);
+}
+
 auto fetch_image_for(const std::string& name, const mp::FetchType& fetch_type, mp::VMImageVault& vault)
 {
     auto stub_prepare = [](const mp::VMImage&) -> mp::VMImage { return {}; };
@@ -310,6 +694,33 @@ auto try_mem_size(const std::string& val) -> mp::optional<mp::MemorySize>
     }
 }
 
+bool takes_host_resources(mp::VirtualMachine::State state)
+{
+    return state != mp::VirtualMachine::State::off && state != mp::VirtualMachine::State::stopped &&
+           state != mp::VirtualMachine::State::suspended && state != mp::VirtualMachine::State::unknown;
+}
+
+// Saving and resuming instances is mostly writing and reading their memory, which a spinning disk would only spend
+// seeking between more than a couple of instances
+int disk_bound_operations(const mp::Path& data_directory)
+{
+    const auto parallel_operations = std::max(1, mp::Settings::instance().get(mp::parallel_operations_key).toInt());
+    return mp::platform::on_rotational_disk(QFile::encodeName(data_directory).constData())
+               ? std::min(2, parallel_operations)
+               : parallel_operations;
+}
+
+double overcommit_ratio(const char* key)
+{
+    return mp::Settings::instance().get(key).toDouble(); // 0, i.e. no limit, should the setting be unreadable
+}
+
+bool valid_resource_class(const std::string& resource_class)
+{
+    return resource_class == mp::default_resource_class || resource_class == mp::latency_resource_class ||
+           resource_class == mp::batch_resource_class;
+}
+
 auto validate_create_arguments(const mp::LaunchRequest* request)
 {
     static const auto min_mem = try_mem_size(mp::min_memory_size);
@@ -338,6 +749,14 @@ auto validate_create_arguments(const mp::LaunchRequest* request)
     if (!request->instance_name().empty() && !mp::utils::valid_hostname(request->instance_name()))
         option_errors.add_error_codes(mp::LaunchError::INVALID_HOSTNAME);
 
+    const auto& disk_profile = request->disk_profile();
+    if (!disk_profile.empty() && disk_profile != mp::default_disk_profile && disk_profile != mp::native_disk_profile &&
+        disk_profile != mp::io_uring_disk_profile)
+        option_errors.add_error_codes(mp::LaunchError::INVALID_DISK_PROFILE);
+
+    if (!request->resource_class().empty() && !valid_resource_class(request->resource_class()))
+        option_errors.add_error_codes(mp::LaunchError::INVALID_RESOURCE_CLASS);
+
     struct CheckedArguments
     {
         mp::MemorySize mem_size;
@@ -432,24 +851,67 @@ auto get_metrics_opt_in(const mp::Path& data_path)
     return opt_in_data;
 }
 
+// Runs a handler in a span of the trace its RPC belongs to
+template <typename Request, typename Reply>
+auto traced(mp::Daemon& daemon,
+            void (mp::Daemon::*handler)(const Request*, grpc::ServerWriter<Reply>*, std::promise<grpc::Status>*),
+            const char* name)
+{
+    return [&daemon, handler, name](const Request* request, grpc::ServerWriter<Reply>* server,
+                                    std::promise<grpc::Status>* status_promise) {
+        auto& tracer = mp::Tracer::instance();
+        auto span = tracer.span(tracer.handed_over(request), name);
+        (daemon.*handler)(request, server, status_promise);
+    };
+}
+
 auto connect_rpc(mp::DaemonRpc& rpc, mp::Daemon& daemon)
 {
-    QObject::connect(&rpc, &mp::DaemonRpc::on_create, &daemon, &mp::Daemon::create);
-    QObject::connect(&rpc, &mp::DaemonRpc::on_launch, &daemon, &mp::Daemon::launch);
-    QObject::connect(&rpc, &mp::DaemonRpc::on_purge, &daemon, &mp::Daemon::purge);
-    QObject::connect(&rpc, &mp::DaemonRpc::on_find, &daemon, &mp::Daemon::find);
-    QObject::connect(&rpc, &mp::DaemonRpc::on_info, &daemon, &mp::Daemon::info);
-    QObject::connect(&rpc, &mp::DaemonRpc::on_list, &daemon, &mp::Daemon::list);
-    QObject::connect(&rpc, &mp::DaemonRpc::on_mount, &daemon, &mp::Daemon::mount);
-    QObject::connect(&rpc, &mp::DaemonRpc::on_recover, &daemon, &mp::Daemon::recover);
-    QObject::connect(&rpc, &mp::DaemonRpc::on_ssh_info, &daemon, &mp::Daemon::ssh_info);
-    QObject::connect(&rpc, &mp::DaemonRpc::on_start, &daemon, &mp::Daemon::start);
-    QObject::connect(&rpc, &mp::DaemonRpc::on_stop, &daemon, &mp::Daemon::stop);
-    QObject::connect(&rpc, &mp::DaemonRpc::on_suspend, &daemon, &mp::Daemon::suspend);
-    QObject::connect(&rpc, &mp::DaemonRpc::on_restart, &daemon, &mp::Daemon::restart);
-    QObject::connect(&rpc, &mp::DaemonRpc::on_delete, &daemon, &mp::Daemon::delet);
-    QObject::connect(&rpc, &mp::DaemonRpc::on_umount, &daemon, &mp::Daemon::umount);
-    QObject::connect(&rpc, &mp::DaemonRpc::on_version, &daemon, &mp::Daemon::version);
+    QObject::connect(&rpc, &mp::DaemonRpc::on_create, &daemon, traced(daemon, &mp::Daemon::create, "daemon create"));
+    QObject::connect(&rpc, &mp::DaemonRpc::on_launch, &daemon, traced(daemon, &mp::Daemon::launch, "daemon launch"));
+    QObject::connect(&rpc, &mp::DaemonRpc::on_purge, &daemon, traced(daemon, &mp::Daemon::purge, "daemon purge"));
+    QObject::connect(&rpc, &mp::DaemonRpc::on_find, &daemon, traced(daemon, &mp::Daemon::find, "daemon find"));
+    QObject::connect(&rpc, &mp::DaemonRpc::on_info, &daemon, traced(daemon, &mp::Daemon::info, "daemon info"));
+    QObject::connect(&rpc, &mp::DaemonRpc::on_list, &daemon, traced(daemon, &mp::Daemon::list, "daemon list"));
+    QObject::connect(&rpc, &mp::DaemonRpc::on_mount, &daemon, traced(daemon, &mp::Daemon::mount, "daemon mount"));
+    QObject::connect(&rpc, &mp::DaemonRpc::on_recover, &daemon, traced(daemon, &mp::Daemon::recover, "daemon recover"));
+    QObject::connect(&rpc, &mp::DaemonRpc::on_ssh_info, &daemon,
+                     traced(daemon, &mp::Daemon::ssh_info, "daemon ssh_info"));
+    QObject::connect(&rpc, &mp::DaemonRpc::on_start, &daemon, traced(daemon, &mp::Daemon::start, "daemon start"));
+    QObject::connect(&rpc, &mp::DaemonRpc::on_stop, &daemon, traced(daemon, &mp::Daemon::stop, "daemon stop"));
+    QObject::connect(&rpc, &mp::DaemonRpc::on_suspend, &daemon, traced(daemon, &mp::Daemon::suspend, "daemon suspend"));
+    QObject::connect(&rpc, &mp::DaemonRpc::on_restart, &daemon, traced(daemon, &mp::Daemon::restart, "daemon restart"));
+    QObject::connect(&rpc, &mp::DaemonRpc::on_delete, &daemon, traced(daemon, &mp::Daemon::delet, "daemon delete"));
+    QObject::connect(&rpc, &mp::DaemonRpc::on_umount, &daemon, traced(daemon, &mp::Daemon::umount, "daemon umount"));
+    QObject::connect(&rpc, &mp::DaemonRpc::on_version, &daemon, traced(daemon, &mp::Daemon::version, "daemon version"));
+    QObject::connect(&rpc, &mp::DaemonRpc::on_watch, &daemon, traced(daemon, &mp::Daemon::watch, "daemon watch"));
+    QObject::connect(&rpc, &mp::DaemonRpc::on_unwatch, &daemon, &mp::Daemon::unwatch);
+    QObject::connect(&rpc, &mp::DaemonRpc::on_metrics, &daemon, traced(daemon, &mp::Daemon::metrics, "daemon metrics"));
+    QObject::connect(&rpc, &mp::DaemonRpc::on_clone, &daemon, traced(daemon, &mp::Daemon::clone, "daemon clone"));
+    QObject::connect(&rpc, &mp::DaemonRpc::on_snapshot, &daemon,
+                     traced(daemon, &mp::Daemon::snapshot, "daemon snapshot"));
+    QObject::connect(&rpc, &mp::DaemonRpc::on_restore, &daemon, traced(daemon, &mp::Daemon::restore, "daemon restore"));
+    QObject::connect(&rpc, &mp::DaemonRpc::on_snapshots, &daemon,
+                     traced(daemon, &mp::Daemon::snapshots, "daemon snapshots"));
+    QObject::connect(&rpc, &mp::DaemonRpc::on_logs, &daemon, traced(daemon, &mp::Daemon::logs, "daemon logs"));
+    QObject::connect(&rpc, &mp::DaemonRpc::on_qos, &daemon, traced(daemon, &mp::Daemon::qos, "daemon qos"));
+    QObject::connect(&rpc, &mp::DaemonRpc::on_throttle, &daemon,
+                     traced(daemon, &mp::Daemon::throttle, "daemon throttle"));
+    QObject::connect(&rpc, &mp::DaemonRpc::on_resize, &daemon, traced(daemon, &mp::Daemon::resize, "daemon resize"));
+    QObject::connect(&rpc, &mp::DaemonRpc::on_bake, &daemon, traced(daemon, &mp::Daemon::bake, "daemon bake"));
+    QObject::connect(&rpc, &mp::DaemonRpc::on_utilization, &daemon,
+                     traced(daemon, &mp::Daemon::utilization, "daemon utilization"));
+    QObject::connect(&rpc, &mp::DaemonRpc::on_forward, &daemon, traced(daemon, &mp::Daemon::forward, "daemon forward"));
+}
+
+// Records as much as the system logger does, so that keeping them never has anyone format more messages
+mpl::Level most_verbose_level(const mpl::Logger& logger)
+{
+    auto level = mpl::Level::trace;
+    while (level > mpl::Level::error && !logger.enabled(level))
+        level = mpl::level_from(mpl::enum_type(level) - 1);
+
+    return level;
 }
 
 template <typename Instances, typename InstanceMap, typename InstanceCheck>
@@ -463,6 +925,22 @@ grpc::Status validate_requested_instances(const Instances& instances, const Inst
     return grpc_status_for(errors);
 }
 
+// Cloning and snapshots swap the instance's image for an overlay, which a running instance would not notice
+template <typename InstanceMap>
+grpc::Status check_instance_is_stopped(const InstanceMap& vms, const std::string& name, const std::string& action)
+{
+    auto vm = vms.find(name);
+    if (vm == vms.end())
+        return grpc::Status(grpc::StatusCode::NOT_FOUND, fmt::format("instance \"{}\" does not exist", name), "");
+
+    const auto state = vm->second->current_state();
+    if (state != mp::VirtualMachine::State::off && state != mp::VirtualMachine::State::stopped)
+        return grpc::Status(grpc::StatusCode::FAILED_PRECONDITION,
+                            fmt::format("instance \"{}\" has to be stopped to {}", name, action), "");
+
+    return grpc::Status::OK;
+}
+
 template <typename Instances, typename InstanceMap, typename InstanceCheck>
 auto find_requested_instances(const Instances& instances, const InstanceMap& vms, InstanceCheck check_instance)
     -> std::pair<std::vector<typename Instances::value_type>, grpc::Status>
@@ -542,11 +1020,8 @@ grpc::Status stop_accepting_ssh_connections(mp::SSHSession& session)
                                      proc.read_std_error()};
 }
 
-grpc::Status ssh_reboot(const std::string& hostname, int port, const std::string& username,
-                        const mp::SSHKeyProvider& key_provider)
+grpc::Status ssh_reboot(mp::SSHSession& session)
 {
-    mp::SSHSession session{hostname, port, username, key_provider};
-
     // This allows us to later detect when the machine has finished restarting by waiting for SSH to be back up.
     // Otherwise, there would be a race condition, and we would be unable to distinguish whether it had ever been down.
     stop_accepting_ssh_connections(session);
@@ -606,114 +1081,635 @@ mp::InstanceStatus::Status grpc_instance_status_for(const mp::VirtualMachine::St
         return mp::InstanceStatus::UNKNOWN;
     }
 }
-} // namespace
 
-mp::Daemon::Daemon(std::unique_ptr<const DaemonConfig> the_config)
-    : config{std::move(the_config)},
-      vm_instance_specs{load_db(
-          mp::utils::backend_directory_path(config->data_directory, config->factory->get_backend_directory_name()),
-          mp::utils::backend_directory_path(config->cache_directory, config->factory->get_backend_directory_name()))},
-      daemon_rpc{config->server_address, config->connection_type, *config->cert_provider, *config->client_cert_store},
-      metrics_provider{"https://api.jujucharms.com/omnibus/v4/multipass/metrics", get_unique_id(config->data_directory),
-                       config->data_directory},
-      metrics_opt_in{get_metrics_opt_in(config->data_directory)},
-      instance_mounts{*config->ssh_key_provider}
+// Gathers all of an instance's stats in one round trip, one "key=value" per line
+constexpr auto instance_stats_cmd =
+    "echo load=\"$(cut -d ' ' -f1-3 /proc/loadavg)\"; "
+    "free -b | awk 'NR == 2 { print \"memory_usage=\" $3; print \"memory_total=\" $2 }'; "
+    "df --output=used,size -B1 `awk '$2 == \"/\" { print $1 }' /proc/mounts` | "
+    "awk 'NR == 2 { print \"disk_usage=\" $1; print \"disk_total=\" $2 }'; "
+    "echo current_release=\"$(lsb_release -ds)\"; "
+    "echo sessions=\"$(who | wc -l)\"";
+constexpr auto idle_load = 0.2; // one-minute load average below which a guest counts as doing nothing
+// What the command above reports, which the guest agent has to come up with all of for SSH to be spared
+const std::vector<std::string> instance_stats_keys{"load",       "memory_usage",    "memory_total", "disk_usage",
+                                                   "disk_total", "current_release", "sessions"};
+
+std::unordered_map<std::string, std::string> parse_instance_stats(const std::string& output)
 {
-    connect_rpc(daemon_rpc, *this);
-    std::vector<std::string> invalid_specs;
-    bool mac_addr_missing{false};
-    for (auto& entry : vm_instance_specs)
+    std::unordered_map<std::string, std::string> stats;
+    std::istringstream lines{output};
+    std::string line;
+    while (std::getline(lines, line))
     {
-        const auto& name = entry.first;
-        auto& spec = entry.second;
+        const auto separator = line.find('=');
+        if (separator != std::string::npos)
+            stats[line.substr(0, separator)] = mp::utils::trim_end(line.substr(separator + 1));
+    }
 
-        if (!config->vault->has_record_for(name))
-        {
-            invalid_specs.push_back(name);
-            continue;
-        }
+    return stats;
+}
 
-        auto mac_addr = spec.mac_addr;
-        if (mac_addr.empty())
-        {
-            mac_addr = mp::utils::generate_mac_address();
-            vm_instance_specs[name].mac_addr = mac_addr;
-            mac_addr_missing = true;
-        }
-        allocated_mac_addrs.insert(mac_addr);
+// What preparing one of a bulk launch's instances came to: its description, or why there is none
+struct PreparedInstance
+{
+    std::string name;
+    mp::VirtualMachineDescription desc;
+    std::string error;
+};
 
-        auto vm_image = fetch_image_for(name, config->factory->fetch_type(), *config->vault);
-        const auto instance_dir = mp::utils::base_dir(vm_image.image_path);
-        const auto cloud_init_iso = instance_dir.filePath("cloud-init-config.iso");
-        mp::VirtualMachineDescription vm_desc{spec.num_cores, spec.mem_size,     spec.disk_space, name,
-                                              mac_addr,       spec.ssh_username, vm_image,        cloud_init_iso};
+// What read-only requests need of an instance, copied on the daemon thread so that they can be answered elsewhere
+struct InstanceSnapshot
+{
+    std::string name;
+    mp::VirtualMachine::ShPtr vm;
+    bool deleted;
+    mp::VMSpecs specs;
+    mp::VMImage image;
+};
+
+using Fields = google::protobuf::RepeatedPtrField<std::string>;
+
+const std::vector<std::string> info_fields{"name", "state",  "image_release", "image_hash", "current_release", "load",
+                                           "memory", "disk", "ipv4",          "mounts",     "hypervisor_stats"};
+// Only the guest itself can tell these, so they are the ones that cost an SSH round trip
+const std::vector<std::string> guest_info_fields{"current_release", "load", "memory", "disk"};
+const std::vector<std::string> list_fields{"name", "state", "ipv4", "release"};
+
+// Asking for no field in particular means asking for all of them
+bool wants_field(const Fields& fields, const std::string& field)
+{
+    return fields.empty() || std::find(fields.begin(), fields.end(), field) != fields.end();
+}
+
+grpc::Status validate_fields(const Fields& fields, const std::vector<std::string>& known_fields)
+{
+    fmt::memory_buffer errors;
+    for (const auto& field : fields)
+        if (std::find(known_fields.cbegin(), known_fields.cend(), field) == known_fields.cend())
+            fmt::format_to(errors, "unknown field \"{}\", valid fields are: {}\n", field,
+                           fmt::join(known_fields, ", "));
+
+    return grpc_status_for(errors);
+}
+
+bool matches_filter(const mp::InstanceFilter& filter, const std::string& name, mp::InstanceStatus::Status status,
+                    const mp::VMImage& image)
+{
+    const auto& states = filter.states();
+    if (!states.empty() && std::find(states.begin(), states.end(), status) == states.end())
+        return false;
+
+    if (!filter.name_glob().empty() &&
+        !QRegExp(QString::fromStdString(filter.name_glob()), Qt::CaseSensitive, QRegExp::Wildcard)
+             .exactMatch(QString::fromStdString(name)))
+        return false;
 
+    const auto& wanted_image = filter.image();
+    if (!wanted_image.empty() && image.original_release != wanted_image && image.id.rfind(wanted_image, 0) != 0 &&
+        std::find(image.aliases.cbegin(), image.aliases.cend(), wanted_image) == image.aliases.cend())
+        return false;
+
+    return true;
+}
+
+std::string original_release_for(const mp::VMImage& vm_image, mp::VMImageHost& image_host)
+{
+    auto original_release = vm_image.original_release;
+
+    if (!vm_image.id.empty() && original_release.empty())
+    {
         try
         {
-            auto& instance_record = spec.deleted ? deleted_instances : vm_instances;
-            instance_record[name] = config->factory->create_virtual_machine(vm_desc, *this);
+            auto vm_image_info = image_host.info_for_full_hash(vm_image.id);
+            original_release = vm_image_info.release_title.toStdString();
         }
         catch (const std::exception& e)
         {
-            mpl::log(mpl::Level::error, category, fmt::format("Removing instance {}: {}", name, e.what()));
-            invalid_specs.push_back(name);
-            config->vault->remove(name);
+            mpl::log(mpl::Level::warning, category, fmt::format("Cannot fetch image information: {}", e.what()));
         }
+    }
 
-        // FIXME: somehow we're writing contradictory state to disk.
-        if (spec.deleted && spec.state != VirtualMachine::State::stopped)
+    return original_release;
+}
+
+mp::InstanceTelemetry gather_instance_telemetry(const std::string& name, mp::VirtualMachine& vm,
+                                               const std::string& username, mp::SSHSessionPool& ssh_sessions)
+{
+    mp::InstanceTelemetry telemetry;
+
+    // The guest agent answers without a session, a shell or sshd in the way, so SSH is only for guests without one
+    telemetry.stats = vm.guest_stats();
+    const auto from_guest_agent = std::all_of(instance_stats_keys.cbegin(), instance_stats_keys.cend(),
+                                              [&telemetry](const auto& key) { return telemetry.stats.count(key); });
+    if (!from_guest_agent)
+    {
+        auto session = ssh_sessions.acquire(name, vm.ssh_hostname(), vm.ssh_port(), username);
+        auto proc = session->exec(instance_stats_cmd);
+        if (proc.exit_code() != 0)
         {
+            auto error_msg = proc.read_std_error();
             mpl::log(mpl::Level::warning, category,
-                     fmt::format("{} is deleted but has incompatible state {}, reseting state to 0 (stopped)", name,
-                                 static_cast<int>(spec.state)));
-            spec.state = VirtualMachine::State::stopped;
+                     fmt::format("failed to gather stats for {}, error message: '{}'", name,
+                                 mp::utils::trim_end(error_msg)));
         }
-
-        if (spec.state == VirtualMachine::State::running && vm_instances[name]->state != VirtualMachine::State::running)
+        else
         {
-            assert(!spec.deleted);
-            mpl::log(mpl::Level::info, category, fmt::format("{} needs starting. Starting now...", name));
-
-            QTimer::singleShot(0, [this, &name] {
-                vm_instances[name]->start();
-                on_restart(name);
-            });
+            telemetry.stats = parse_instance_stats(proc.read_std_output());
         }
     }
 
-    for (const auto& bad_spec : invalid_specs)
+    telemetry.ipv4 = vm.ipv4();
+    telemetry.timestamp = QDateTime::currentDateTimeUtc();
+
+    return telemetry;
+}
+
+// Guests running anything, or with anyone logged in, are busy. So are those whose stats did not come through
+bool guest_is_busy(const mp::InstanceTelemetry& telemetry)
+{
+    const auto load = telemetry.stats.find("load");
+    const auto sessions = telemetry.stats.find("sessions");
+    if (load == telemetry.stats.end() || sessions == telemetry.stats.end())
+        return true;
+
+    bool ok{false};
+    const auto one_minute_load = QString::fromStdString(load->second).section(' ', 0, 0).toDouble(&ok);
+    return !ok || one_minute_load >= idle_load || sessions->second != "0";
+}
+
+// Only what tells whether an instance is sized right: its one-minute load and the memory and disk it uses
+void record_utilization(mp::UtilizationHistory& history, const std::string& name,
+                        const mp::InstanceTelemetry& telemetry)
+{
+    const auto when = mp::UtilizationHistory::Clock::time_point{
+        std::chrono::milliseconds{telemetry.timestamp.toMSecsSinceEpoch()}};
+
+    for (const auto& metric : {"load", "memory_usage", "disk_usage"})
     {
-        vm_instance_specs.erase(bad_spec);
+        auto it = telemetry.stats.find(metric);
+        if (it == telemetry.stats.end())
+            continue;
+
+        bool ok{false};
+        const auto value = QString::fromStdString(it->second).section(' ', 0, 0).toDouble(&ok);
+        if (ok)
+            history.record(name, metric, value, when);
     }
+}
 
-    if (!invalid_specs.empty() || mac_addr_missing)
-        persist_instances();
+mp::SSHInfo ssh_info_for(mp::VirtualMachine& vm, const mp::SSHKeyProvider& key_provider)
+{
+    mp::SSHInfo ssh_info;
+    ssh_info.set_host(vm.ssh_hostname());
+    ssh_info.set_port(vm.ssh_port());
+    ssh_info.set_priv_key_base64(key_provider.private_key_as_base64());
+    ssh_info.set_username(vm.ssh_username());
+    ssh_info.set_crypto_profile(mp::SSHSession::crypto_profile());
+    return ssh_info;
+}
 
-    for (const auto& image_host : config->image_hosts)
+// The guest discards the blocks its filesystems no longer use, which QEMU passes on by punching holes in the image.
+// Returns how many bytes the image gave back to the host
+long long trim_instance_disk(const std::string& name, mp::VirtualMachine& vm, const std::string& username,
+                             const mp::Path& image_path, mp::SSHSessionPool& ssh_sessions)
+{
+    const auto image_file = QFile::encodeName(image_path);
+    const auto allocated_before = mp::platform::allocated_size(image_file.constData());
     {
-        for (const auto& remote : image_host->supported_remotes())
-        {
-            remote_image_host_map[remote] = image_host.get();
-        }
+        auto session = ssh_sessions.acquire(name, vm.ssh_hostname(), vm.ssh_port(), username);
+        auto proc = session->exec(disk_trim_cmd);
+        if (proc.exit_code() != 0)
+            throw std::runtime_error(mp::utils::trim_end(proc.read_std_error()));
     }
+    const auto allocated_after = mp::platform::allocated_size(image_file.constData());
 
-    config->vault->prune_expired_images();
+    if (allocated_before < 0 || allocated_after < 0)
+        return 0;
 
-    // Fire timer every six hours to perform maintenance on source images such as
-    // pruning expired images and updating to newly released images.
-    connect(&source_images_maintenance_task, &QTimer::timeout, [this]() {
-        if (image_update_future.isRunning())
-        {
-            mpl::log(mpl::Level::info, category, "Image updater already running. Skipping…");
-        }
-        else
-        {
-            image_update_future = QtConcurrent::run([this] {
-                config->vault->prune_expired_images();
+    return std::max(0LL, allocated_before - allocated_after);
+}
 
-                auto prepare_action = [this](const VMImage& source_image) -> VMImage {
-                    return config->factory->prepare_source_image(source_image);
-                };
+void populate_instance_info(const InstanceSnapshot& instance, mp::VMImageHost& image_host,
+                            const mp::optional<mp::InstanceTelemetry>& telemetry, const Fields& fields,
+                            mp::InfoReply::Info& info)
+{
+    const auto& vm = instance.vm;
+    auto present_state = vm->current_state();
+    info.set_name(instance.name);
+    if (wants_field(fields, "state"))
+        info.mutable_instance_status()->set_status(instance.deleted ? mp::InstanceStatus::DELETED
+                                                                    : grpc_instance_status_for(present_state));
+
+    std::string original_release;
+    if (wants_field(fields, "image_release") || wants_field(fields, "current_release"))
+        original_release = original_release_for(instance.image, image_host);
+    if (wants_field(fields, "image_release"))
+        info.set_image_release(original_release);
+    if (wants_field(fields, "image_hash"))
+        info.set_id(instance.image.id);
+
+    const auto& vm_specs = instance.specs;
+
+    auto mount_info = info.mutable_mount_info();
+
+    mount_info->set_longest_path_len(0);
+
+    if (wants_field(fields, "mounts"))
+    {
+        for (const auto& mount : vm_specs.mounts)
+        {
+            if (mount.second.source_path.size() > mount_info->longest_path_len())
+            {
+                mount_info->set_longest_path_len(mount.second.source_path.size());
+            }
+
+            auto entry = mount_info->add_mount_paths();
+            entry->set_source_path(mount.second.source_path);
+            entry->set_target_path(mount.first);
+
+            for (const auto uid_map : mount.second.uid_map)
+            {
+                (*entry->mutable_mount_maps()->mutable_uid_map())[uid_map.first] = uid_map.second;
+            }
+            for (const auto gid_map : mount.second.gid_map)
+            {
+                (*entry->mutable_mount_maps()->mutable_gid_map())[gid_map.first] = gid_map.second;
+            }
+        }
+    }
+
+    if (mp::utils::is_running(present_state) && wants_field(fields, "hypervisor_stats"))
+    {
+        // Counted by the hypervisor, so these need neither the guest nor SSH
+        for (const auto& stat : vm->hypervisor_stats())
+            (*info.mutable_hypervisor_stats())[stat.first] = stat.second;
+    }
+
+    if (mp::utils::is_running(present_state) && !telemetry && wants_field(fields, "ipv4"))
+        info.set_ipv4(vm->ipv4());
+
+    if (mp::utils::is_running(present_state) && telemetry)
+    {
+        const auto& stats = telemetry->stats;
+        auto stat = [&stats, &instance](const std::string& key) {
+            auto it = stats.find(key);
+            if (it == stats.end() || it->second.empty())
+            {
+                mpl::log(mpl::Level::warning, category, fmt::format("no {} reported by {}", key, instance.name));
+                return std::string{};
+            }
+
+            return it->second;
+        };
+
+        if (wants_field(fields, "load"))
+            info.set_load(stat("load"));
+        if (wants_field(fields, "memory"))
+        {
+            info.set_memory_usage(stat("memory_usage"));
+            info.set_memory_total(stat("memory_total"));
+        }
+        if (wants_field(fields, "disk"))
+        {
+            info.set_disk_usage(stat("disk_usage"));
+            info.set_disk_total(stat("disk_total"));
+        }
+        if (wants_field(fields, "ipv4"))
+            info.set_ipv4(telemetry->ipv4);
+        info.set_telemetry_timestamp(telemetry->timestamp.toString(Qt::ISODateWithMs).toStdString());
+
+        if (wants_field(fields, "current_release"))
+        {
+            auto current_release = stat("current_release");
+            info.set_current_release(!current_release.empty() ? current_release : original_release);
+        }
+    }
+}
+
+// Builds large replies in an arena, so that their thousands of fields come out of a few blocks rather than one heap
+// allocation each, and go in one go. The thread's first block is kept for its next reply
+class ReplyArena
+{
+public:
+    ReplyArena() : owns_thread_block{!thread_block_in_use}, arena{options(owns_thread_block)}
+    {
+        thread_block_in_use = true;
+    }
+
+    ~ReplyArena()
+    {
+        if (owns_thread_block)
+            thread_block_in_use = false;
+    }
+
+    template <typename Reply>
+    Reply& make()
+    {
+        return *google::protobuf::Arena::CreateMessage<Reply>(&arena);
+    }
+
+private:
+    static google::protobuf::ArenaOptions options(bool with_thread_block)
+    {
+        thread_local std::vector<char> thread_block(reply_arena_block_size);
+
+        google::protobuf::ArenaOptions options;
+        if (with_thread_block) // a nested arena must not scribble over the outer one's
+        {
+            options.initial_block = thread_block.data();
+            options.initial_block_size = thread_block.size();
+        }
+
+        return options;
+    }
+
+    static thread_local bool thread_block_in_use;
+    const bool owns_thread_block;
+    google::protobuf::Arena arena;
+};
+
+thread_local bool ReplyArena::thread_block_in_use{false};
+
+// Leading messages carry nothing but entries, the last one has the rest of the reply, so that clients put the
+// entries back together from the same stream they take log lines from. The reply must come from a ReplyArena, within
+// which entries change messages by pointer
+template <typename Reply, typename EntriesOf>
+void write_in_chunks(grpc::ServerWriter<Reply>* server, Reply& reply, bool chunked, EntriesOf&& entries_of)
+{
+    auto entries = entries_of(reply);
+    if (!chunked || entries->size() <= max_entries_per_reply)
+    {
+        server->Write(reply);
+        return;
+    }
+
+    const auto count = entries->size();
+    std::vector<typename std::remove_reference<decltype(*entries)>::type::value_type*> all(count);
+    entries->UnsafeArenaExtractSubrange(0, count, all.data());
+
+    int next = 0;
+    while (count - next > max_entries_per_reply)
+    {
+        auto chunk = google::protobuf::Arena::CreateMessage<Reply>(reply.GetArena());
+        for (const auto end = next + max_entries_per_reply; next < end; ++next)
+            entries_of(*chunk)->UnsafeArenaAddAllocated(all[next]);
+        server->Write(*chunk);
+    }
+
+    for (; next < count; ++next)
+        entries->UnsafeArenaAddAllocated(all[next]);
+    server->Write(reply);
+}
+
+// Its share of the daemon's memory, going by what it holds
+std::size_t footprint_of(const mp::VMSpecs& specs)
+{
+    namespace mf = mp::memory_footprint;
+
+    auto bytes = sizeof(specs) + mf::of(specs.mac_addr) + mf::of(specs.ssh_username) + mf::of(specs.metadata) +
+                 mf::of(specs.disk_profile) + mf::of(specs.resource_class);
+    for (const auto& mount : specs.mounts)
+    {
+        const auto id_entries = mount.second.gid_map.size() + mount.second.uid_map.size();
+        bytes += mf::entry_overhead + sizeof(mount) + mf::of(mount.first) + mf::of(mount.second.source_path) +
+                 mf::of(mount.second.profile) + id_entries * (mf::entry_overhead + sizeof(std::pair<const int, int>));
+    }
+
+    return bytes;
+}
+} // namespace
+
+mp::Daemon::Daemon(std::unique_ptr<const DaemonConfig> the_config)
+    : config{std::move(the_config)},
+      recent_logs{most_verbose_level(*config->logger)},
+      instance_db{instance_db_path(*config, instance_db_name), instance_db_path(*config, instance_journal_name)},
+      vm_instance_specs{load_db(
+          instance_db,
+          mp::utils::backend_directory_path(config->cache_directory, config->factory->get_backend_directory_name()))},
+      daemon_rpc{config->server_address, config->connection_type, *config->cert_provider, *config->client_cert_store},
+      metrics_provider{"https://api.jujucharms.com/omnibus/v4/multipass/metrics", get_unique_id(config->data_directory),
+                       config->data_directory},
+      metrics_opt_in{get_metrics_opt_in(config->data_directory)},
+      instance_mounts{*config->ssh_key_provider, QDir{config->data_directory}.filePath("mounts")},
+      ssh_sessions{*config->ssh_key_provider},
+      host_resources{HostCapacity::of_host(config->data_directory)}
+{
+    heap_at_start = memory_footprint::heap_in_use(); // before the instances are set up
+    config->logger->add_logger(&recent_logs);
+    connect_rpc(daemon_rpc, *this);
+    mp::SSHSession::set_crypto_profile(mp::Settings::instance().get(mp::ssh_crypto_key).toStdString());
+    warm_pool_images = load_warm_pool(
+        mp::utils::backend_directory_path(config->data_directory, config->factory->get_backend_directory_name()));
+    for (const auto& memory_template : load_memory_templates(
+             mp::utils::backend_directory_path(config->data_directory, config->factory->get_backend_directory_name())))
+    {
+        template_images[memory_template.first] = memory_template.second.first;
+        if (memory_template.second.second)
+            saved_templates.insert(memory_template.first);
+    }
+
+    std::vector<std::string> invalid_specs;
+    std::deque<std::string> warm_autostarts;
+    bool mac_addr_missing{false};
+    std::vector<mp::VirtualMachineDescription> descriptions;
+    for (auto& entry : vm_instance_specs)
+    {
+        const auto& name = entry.first;
+        auto& spec = entry.second;
+
+        if (!config->vault->has_record_for(name))
+        {
+            invalid_specs.push_back(name);
+            continue;
+        }
+
+        auto mac_addr = spec.mac_addr;
+        if (mac_addr.empty())
+        {
+            mac_addr = mp::utils::generate_mac_address();
+            vm_instance_specs[name].mac_addr = mac_addr;
+            mac_addr_missing = true;
+        }
+        allocated_mac_addrs.insert(mac_addr);
+
+        auto vm_image = fetch_image_for(name, config->factory->fetch_type(), *config->vault);
+        const auto instance_dir = mp::utils::base_dir(vm_image.image_path);
+        const auto cloud_init_iso = instance_dir.filePath("cloud-init-config.iso");
+        descriptions.push_back({spec.num_cores, spec.mem_size, spec.disk_space, name, mac_addr, spec.ssh_username,
+                                vm_image, cloud_init_iso, spec.disk_profile, spec.hugepages, spec.resource_class,
+                                spec.throttle});
+    }
+
+    // Instances are created concurrently, since backends spend most of it waiting on external commands, so that
+    // restarting the daemon takes as long as the slowest instance rather than all of them in turn
+    std::vector<VirtualMachine::UPtr> machines(descriptions.size());
+    std::vector<std::string> failures(descriptions.size());
+    {
+        QFutureSynchronizer<void> creation_synchronizer;
+        for (std::size_t i = 0; i < descriptions.size(); ++i)
+        {
+            creation_synchronizer.addFuture(QtConcurrent::run([this, &descriptions, &machines, &failures, i] {
+                try
+                {
+                    machines[i] = config->factory->create_virtual_machine(descriptions[i], *this);
+
+                    // Queued signals are delivered in the thread an object lives in, not the pool thread creating it
+                    if (auto object = dynamic_cast<QObject*>(machines[i].get()))
+                        object->moveToThread(thread());
+                }
+                catch (const std::exception& e)
+                {
+                    failures[i] = e.what();
+                }
+            }));
+        }
+    }
+
+    for (std::size_t i = 0; i < descriptions.size(); ++i)
+    {
+        const auto& name = descriptions[i].vm_name;
+        auto& spec = vm_instance_specs[name];
+
+        const auto warm = warm_pool_images.find(name) != warm_pool_images.end();
+        const auto memory_template = template_images.find(name) != template_images.end();
+        auto& instance_record = spec.purged      ? purged_instances
+                                : spec.deleted    ? deleted_instances
+                                : warm            ? warm_instances
+                                : memory_template ? template_instances
+                                                  : vm_instances;
+        try
+        {
+            if (!machines[i])
+                throw std::runtime_error(failures[i]);
+
+            instance_record[name] = std::move(machines[i]);
+
+            for (const auto& mount : spec.mounts)
+                if (mount.second.type == VMMount::Type::native)
+                    instance_record[name]->add_native_mount(mount.second.source_path, mount.first);
+        }
+        catch (const std::exception& e)
+        {
+            mpl::log(mpl::Level::error, category, fmt::format("Removing instance {}: {}", name, e.what()));
+            invalid_specs.push_back(name);
+            config->vault->remove(name);
+        }
+
+        // FIXME: somehow we're writing contradictory state to disk.
+        if (spec.deleted && spec.state != VirtualMachine::State::stopped)
+        {
+            mpl::log(mpl::Level::warning, category,
+                     fmt::format("{} is deleted but has incompatible state {}, reseting state to 0 (stopped)", name,
+                                 static_cast<int>(spec.state)));
+            spec.state = VirtualMachine::State::stopped;
+        }
+
+        // Templates are not started again once their memory is saved, and are booted over when it was not
+        if (!memory_template && spec.state == VirtualMachine::State::running &&
+            instance_record[name]->state != VirtualMachine::State::running)
+        {
+            assert(!spec.deleted);
+            mpl::log(mpl::Level::info, category, fmt::format("{} needs starting. Queuing it for autostart", name));
+
+            (warm ? warm_autostarts : autostart_queue).push_back(name);
+        }
+    }
+
+    // Users' instances come back before the warm pool, which nobody is waiting on yet
+    std::sort(autostart_queue.begin(), autostart_queue.end());
+    std::sort(warm_autostarts.begin(), warm_autostarts.end());
+    autostart_queue.insert(autostart_queue.end(), warm_autostarts.begin(), warm_autostarts.end());
+    QTimer::singleShot(0, [this] { autostart_next(); });
+
+    for (const auto& bad_spec : invalid_specs)
+    {
+        vm_instance_specs.erase(bad_spec);
+        warm_instances.erase(bad_spec);
+        template_instances.erase(bad_spec);
+    }
+
+    // Whatever the reaper had not got round to before the daemon went away
+    QTimer::singleShot(0, [this] { reap_purged_instances(); });
+
+    // Forget warm pool members whose instance did not survive
+    for (auto it = warm_pool_images.begin(); it != warm_pool_images.end();)
+        it = warm_instances.find(it->first) == warm_instances.end() ? warm_pool_images.erase(it) : std::next(it);
+
+    // And templates whose memory was not saved before the daemon went away, which are booted over
+    auto unsaved_templates = false;
+    for (auto it = template_images.begin(); it != template_images.end();)
+    {
+        const auto name = it->first;
+        auto instance = template_instances.find(name);
+        if (instance != template_instances.end() && saved_templates.count(name))
+        {
+            ++it;
+            continue;
+        }
+
+        if (instance != template_instances.end())
+        {
+            instance->second->shutdown();
+            release_resources(name);
+            template_instances.erase(instance);
+            unsaved_templates = true;
+        }
+        saved_templates.erase(name);
+        it = template_images.erase(it);
+    }
+
+    if (!invalid_specs.empty() || mac_addr_missing || unsaved_templates)
+        persist_instances();
+
+    for (const auto& image_host : config->image_hosts)
+    {
+        for (const auto& remote : image_host->supported_remotes())
+        {
+            remote_image_host_map[remote] = image_host.get();
+        }
+    }
+
+    const auto package_cache_port = mp::Settings::instance().get(mp::package_cache_port_key).toInt();
+    const auto host_addresses = config->factory->host_addresses();
+    if (package_cache_port > 0 && !host_addresses.empty())
+    {
+        try
+        {
+            package_cache = std::make_unique<PackageCache>(
+                host_addresses, package_cache_port, QDir{config->cache_directory}.filePath("packages"),
+                package_cache_size);
+        }
+        catch (const std::exception& e)
+        {
+            mpl::log(mpl::Level::warning, category, fmt::format("Not caching instances' packages: {}", e.what()));
+        }
+    }
+
+    config->vault->prune_expired_images();
+
+    QTimer::singleShot(0, [this] { replenish_warm_pool(); });
+    QTimer::singleShot(0, [this] { replenish_memory_templates(); });
+
+    // Fire timer every six hours to perform maintenance on source images such as
+    // pruning expired images and updating to newly released images.
+    connect(&source_images_maintenance_task, &QTimer::timeout, [this]() {
+        replenish_warm_pool();
+        replenish_memory_templates();
+        scrub();
+
+        if (image_update_future.isRunning())
+        {
+            mpl::log(mpl::Level::info, category, "Image updater already running. Skipping…");
+        }
+        else
+        {
+            image_update_future = QtConcurrent::run([this] {
+                config->vault->prune_expired_images();
+
+                auto prepare_action = [this](const VMImage& source_image) -> VMImage {
+                    return config->factory->prepare_source_image(source_image);
+                };
 
                 auto download_monitor = [](int download_type, int percentage) {
                     static int last_percentage_logged = -1;
@@ -737,10 +1733,58 @@ mp::Daemon::Daemon(std::unique_ptr<const DaemonConfig> the_config)
                 {
                     mpl::log(mpl::Level::error, category, fmt::format("Error updating images: {}", e.what()));
                 }
+
+                // One at a time, so that keeping images hot never takes more than a single download's bandwidth
+                const auto prefetch_images = Settings::instance().get(prefetch_images_key);
+                for (const auto& image : prefetch_images.split(',', QString::SkipEmptyParts))
+                {
+                    const auto remote_and_alias = image.trimmed().split(':');
+                    const auto remote = remote_and_alias.size() > 1 ? remote_and_alias.first() : QString{};
+                    Query query{"", remote_and_alias.last().toStdString(), false, remote.toStdString(),
+                                Query::Type::Alias};
+                    try
+                    {
+                        config->vault->prefetch_image(config->factory->fetch_type(), query, prepare_action,
+                                                      download_monitor);
+                    }
+                    catch (const std::exception& e)
+                    {
+                        mpl::log(mpl::Level::warning, category,
+                                 fmt::format("Cannot prefetch {}: {}", image.toStdString(), e.what()));
+                    }
+                }
             });
         }
     });
     source_images_maintenance_task.start(config->image_refresh_timer);
+
+    connect(&telemetry_refresh_task, &QTimer::timeout, [this] {
+        refresh_telemetry();
+        suspend_idle_instances();
+    });
+    telemetry_refresh_task.start(telemetry_refresh_interval);
+
+    connect(&disk_trim_task, &QTimer::timeout, [this] { trim_instance_disks(); });
+    disk_trim_task.start(disk_trim_interval);
+
+    connect(&reaper, &QFutureWatcher<void>::finished, [this] {
+        finish_reaping();
+        reap_purged_instances(); // those purged in the meantime
+    });
+}
+
+mp::Daemon::~Daemon()
+{
+    config->logger->remove_logger(&recent_logs);
+    disk_trim_future.waitForFinished();
+    scrub_stopped = true;
+    scrub_future.waitForFinished();
+    reaper.waitForFinished();
+    finish_reaping();
+
+    // Watching calls only end when told to, and the RPC server waits for all calls before it goes
+    std::lock_guard<std::mutex> lock{watchers_mutex};
+    watchers.clear();
 }
 
 void mp::Daemon::create(const CreateRequest* request, grpc::ServerWriter<CreateReply>* server,
@@ -769,6 +1813,7 @@ try // clang-format on
 
             LaunchReply reply;
             reply.set_metrics_pending(true);
+            logger.merge_into(reply);
             server->Write(reply);
 
             return status_promise->set_value(grpc::Status::OK);
@@ -791,6 +1836,13 @@ try // clang-format on
     if (metrics_opt_in.opt_in_status == OptInStatus::ACCEPTED)
         metrics_provider.send_metrics();
 
+    if (request->count() > 1)
+        return launch_many(request, server, status_promise);
+
+    if (claim_warm_instance(request, server, status_promise) ||
+        claim_template_clone(request, server, status_promise))
+        return;
+
     return create_vm(request, server, status_promise, /*start=*/true);
 }
 catch (const mp::StartException& e)
@@ -813,10 +1865,11 @@ void mp::Daemon::purge(const PurgeRequest* request, grpc::ServerWriter<PurgeRepl
 try // clang-format on
 {
     for (const auto& del : deleted_instances)
-        release_resources(del.first);
+        purge_instance(del.first, del.second);
 
     deleted_instances.clear();
     persist_instances();
+    reap_purged_instances();
 
     status_promise->set_value(grpc::Status::OK);
 }
@@ -826,11 +1879,20 @@ catch (const std::exception& e)
 }
 
 void mp::Daemon::find(const FindRequest* request, grpc::ServerWriter<FindReply>* server,
-                      std::promise<grpc::Status>* status_promise) // clang-format off
+                      std::promise<grpc::Status>* status_promise)
+{
+    // Only the image hosts are consulted, so the (possibly slow) lookup need not hold up the daemon thread
+    QtConcurrent::run(&read_only_workers,
+                      [this, request, server, status_promise] { find_images(request, server, status_promise); });
+}
+
+void mp::Daemon::find_images(const FindRequest* request, grpc::ServerWriter<FindReply>* server,
+                             std::promise<grpc::Status>* status_promise) // clang-format off
 try // clang-format on
 {
     mpl::ClientLogger<FindReply> logger{mpl::level_from(request->verbosity_level()), *config->logger, server};
-    FindReply response;
+    ReplyArena arena;
+    auto& response = arena.make<FindReply>();
 
     if (!request->search_string().empty())
     {
@@ -912,75 +1974,93 @@ try // clang-format on
             throw std::runtime_error(fmt::format(
                 "{} is not a supported remote. Please use `multipass find` for list of supported images.", remote));
 
-        auto vm_images_info = it->second->all_images_for(remote, request->allow_unsupported());
-        for (const auto& info : vm_images_info)
+        const auto key = std::make_pair(remote, request->allow_unsupported());
+        const std::vector<int> generations{it->second->manifest_generation()};
+        if (!cached_find_reply(key, generations, response))
         {
-            if (!info.aliases.empty())
+            auto vm_images_info = it->second->all_images_for(remote, request->allow_unsupported());
+            for (const auto& info : vm_images_info)
             {
-                auto entry = response.add_images_info();
-                for (const auto& alias : info.aliases)
+                if (!info.aliases.empty())
                 {
-                    if (!mp::platform::is_alias_supported(alias.toStdString(), remote))
-                        continue;
+                    auto entry = response.add_images_info();
+                    for (const auto& alias : info.aliases)
+                    {
+                        if (!mp::platform::is_alias_supported(alias.toStdString(), remote))
+                            continue;
 
-                    auto alias_entry = entry->add_aliases_info();
-                    alias_entry->set_remote_name(request->remote_name());
-                    alias_entry->set_alias(alias.toStdString());
-                }
+                        auto alias_entry = entry->add_aliases_info();
+                        alias_entry->set_remote_name(request->remote_name());
+                        alias_entry->set_alias(alias.toStdString());
+                    }
 
-                // If no aliases are found, then it's an invalid entry
-                if (entry->aliases_info().empty())
-                {
-                    response.mutable_images_info()->RemoveLast();
-                    continue;
-                }
+                    // If no aliases are found, then it's an invalid entry
+                    if (entry->aliases_info().empty())
+                    {
+                        response.mutable_images_info()->RemoveLast();
+                        continue;
+                    }
 
-                entry->set_os(info.os.toStdString());
-                entry->set_release(info.release_title.toStdString());
-                entry->set_version(info.version.toStdString());
+                    entry->set_os(info.os.toStdString());
+                    entry->set_release(info.release_title.toStdString());
+                    entry->set_version(info.version.toStdString());
+                }
             }
+
+            cache_find_reply(key, generations, response);
         }
     }
     else
     {
+        const auto key = std::make_pair(std::string{}, request->allow_unsupported());
+        std::vector<int> generations;
         for (const auto& image_host : config->image_hosts)
-        {
-            std::unordered_set<std::string> image_found;
-            const auto default_remote{"release"};
-            auto action = [&response, &image_found, default_remote, request](const std::string& remote,
-                                                                             const mp::VMImageInfo& info) {
-                if (!mp::platform::is_remote_supported(remote))
-                    return;
+            generations.push_back(image_host->manifest_generation());
 
-                if (info.supported || request->allow_unsupported())
-                {
-                    if (image_found.find(info.release_title.toStdString()) == image_found.end())
+        if (!cached_find_reply(key, generations, response))
+        {
+            for (const auto& image_host : config->image_hosts)
+            {
+                std::unordered_set<std::string> image_found;
+                const auto default_remote{"release"};
+                auto action = [&response, &image_found, default_remote, request](const std::string& remote,
+                                                                                 const mp::VMImageInfo& info) {
+                    if (!mp::platform::is_remote_supported(remote))
+                        return;
+
+                    if (info.supported || request->allow_unsupported())
                     {
-                        const auto supported_aliases = filter_unsupported_aliases(info.aliases, remote);
-                        if (!supported_aliases.empty())
+                        if (image_found.find(info.release_title.toStdString()) == image_found.end())
                         {
-                            auto entry = response.add_images_info();
-                            for (const auto& alias : supported_aliases)
+                            const auto supported_aliases = filter_unsupported_aliases(info.aliases, remote);
+                            if (!supported_aliases.empty())
                             {
-                                auto alias_entry = entry->add_aliases_info();
-                                if (remote != default_remote)
-                                    alias_entry->set_remote_name(remote);
-                                alias_entry->set_alias(alias.toStdString());
+                                auto entry = response.add_images_info();
+                                for (const auto& alias : supported_aliases)
+                                {
+                                    auto alias_entry = entry->add_aliases_info();
+                                    if (remote != default_remote)
+                                        alias_entry->set_remote_name(remote);
+                                    alias_entry->set_alias(alias.toStdString());
+                                }
+
+                                image_found.insert(info.release_title.toStdString());
+                                entry->set_os(info.os.toStdString());
+                                entry->set_release(info.release_title.toStdString());
+                                entry->set_version(info.version.toStdString());
                             }
-
-                            image_found.insert(info.release_title.toStdString());
-                            entry->set_os(info.os.toStdString());
-                            entry->set_release(info.release_title.toStdString());
-                            entry->set_version(info.version.toStdString());
                         }
                     }
-                }
-            };
+                };
+
+                image_host->for_each_entry_do(action);
+            }
 
-            image_host->for_each_entry_do(action);
+            cache_find_reply(key, generations, response);
         }
     }
-    server->Write(response);
+    logger.merge_into(response);
+    write_in_chunks(server, response, request->chunked_reply(), [](FindReply& r) { return r.mutable_images_info(); });
     status_promise->set_value(grpc::Status::OK);
 }
 catch (const std::exception& e)
@@ -988,12 +2068,33 @@ catch (const std::exception& e)
     status_promise->set_value(grpc::Status(grpc::StatusCode::FAILED_PRECONDITION, e.what(), ""));
 }
 
+bool mp::Daemon::cached_find_reply(const std::pair<std::string, bool>& key,
+                                   const std::vector<int>& manifest_generations, FindReply& reply)
+{
+    std::lock_guard<decltype(find_cache_mutex)> lock{find_cache_mutex};
+
+    auto it = find_cache.find(key);
+    if (it == find_cache.end() || it->second.first != manifest_generations)
+        return false;
+
+    reply = it->second.second;
+    return true;
+}
+
+void mp::Daemon::cache_find_reply(const std::pair<std::string, bool>& key,
+                                  const std::vector<int>& manifest_generations, const FindReply& reply)
+{
+    std::lock_guard<decltype(find_cache_mutex)> lock{find_cache_mutex};
+    find_cache[key] = std::make_pair(manifest_generations, reply);
+}
+
 void mp::Daemon::info(const InfoRequest* request, grpc::ServerWriter<InfoReply>* server,
                       std::promise<grpc::Status>* status_promise) // clang-format off
 try // clang-format on
 {
-    mpl::ClientLogger<InfoReply> logger{mpl::level_from(request->verbosity_level()), *config->logger, server};
-    InfoReply response;
+    auto fields_status = validate_fields(request->fields(), info_fields);
+    if (!fields_status.ok())
+        return status_promise->set_value(fields_status);
 
     fmt::memory_buffer errors;
     std::vector<decltype(vm_instances)::key_type> instances_for_info;
@@ -1002,6 +2103,11 @@ try // clang-format on
     {
         for (auto& pair : vm_instances)
             instances_for_info.push_back(pair.first);
+
+        const auto& states = request->filter().states();
+        if (std::find(states.begin(), states.end(), mp::InstanceStatus::DELETED) != states.end())
+            for (auto& pair : deleted_instances)
+                instances_for_info.push_back(pair.first);
     }
     else
     {
@@ -1009,6 +2115,7 @@ try // clang-format on
             instances_for_info.push_back(name);
     }
 
+    std::vector<InstanceSnapshot> instances;
     for (const auto& name : instances_for_info)
     {
         auto it = vm_instances.find(name);
@@ -1024,110 +2131,81 @@ try // clang-format on
             deleted = true;
         }
 
-        auto info = response.add_info();
-        auto& vm = it->second;
-        auto present_state = vm->current_state();
-        info->set_name(name);
-        if (deleted)
-        {
-            info->mutable_instance_status()->set_status(mp::InstanceStatus::DELETED);
-        }
-        else
-        {
-            info->mutable_instance_status()->set_status(grpc_instance_status_for(present_state));
-        }
-
-        auto vm_image = fetch_image_for(name, config->factory->fetch_type(), *config->vault);
-        auto original_release = vm_image.original_release;
+        auto image = fetch_image_for(name, config->factory->fetch_type(), *config->vault);
+        auto status = deleted ? mp::InstanceStatus::DELETED : grpc_instance_status_for(it->second->current_state());
+        if (matches_filter(request->filter(), name, status, image))
+            instances.push_back({name, it->second, deleted, vm_instance_specs[name], std::move(image)});
+    }
 
-        if (!vm_image.id.empty() && original_release.empty())
+    // Querying image hosts and instances is slow, so it happens on a snapshot, away from the daemon thread
+    QtConcurrent::run(&read_only_workers, [this, request, server, status_promise, instances,
+                                           instance_errors = fmt::to_string(errors)] {
+        grpc::Status status;
         {
+            mpl::ClientLogger<InfoReply> logger{mpl::level_from(request->verbosity_level()), *config->logger, server};
             try
             {
-                auto vm_image_info = config->image_hosts.back()->info_for_full_hash(vm_image.id);
-                original_release = vm_image_info.release_title.toStdString();
-            }
-            catch (const std::exception& e)
-            {
-                mpl::log(mpl::Level::warning, category, fmt::format("Cannot fetch image information: {}", e.what()));
-            }
-        }
-
-        info->set_image_release(original_release);
-        info->set_id(vm_image.id);
-
-        auto vm_specs = vm_instance_specs[name];
-
-        auto mount_info = info->mutable_mount_info();
-
-        mount_info->set_longest_path_len(0);
+                // Instances are queried concurrently, so that the reply waits on the slowest, not on all in turn.
+                // Each fills its own entry, allocating from the arena as it goes
+                ReplyArena arena;
+                auto& response = arena.make<InfoReply>();
+                for (std::size_t i = 0; i < instances.size(); ++i)
+                    response.add_info();
+
+                std::vector<std::string> failures(instances.size());
+                QFutureSynchronizer<void> info_synchronizer;
+                for (std::size_t i = 0; i < instances.size(); ++i)
+                {
+                    auto info = response.mutable_info(static_cast<int>(i));
+                    info_synchronizer.addFuture(QtConcurrent::run([this, request, &instances, info, &failures, i] {
+                        try
+                        {
+                            const auto& instance = instances[i];
+                            const auto& fields = request->fields();
+                            auto wants_guest_fields = std::any_of(
+                                guest_info_fields.cbegin(), guest_info_fields.cend(),
+                                [&fields](const std::string& field) { return wants_field(fields, field); });
+
+                            mp::optional<InstanceTelemetry> telemetry;
+                            if (wants_guest_fields && mp::utils::is_running(instance.vm->current_state()))
+                                telemetry = telemetry_for(instance.name, *instance.vm, instance.specs.ssh_username,
+                                                          request->refresh());
+
+                            populate_instance_info(instance, *config->image_hosts.back(), telemetry, fields,
+                                                   *info);
+                        }
+                        catch (const std::exception& e)
+                        {
+                            failures[i] = e.what();
+                        }
+                    }));
+                }
+                info_synchronizer.waitForFinished();
 
-        for (const auto& mount : vm_specs.mounts)
-        {
-            if (mount.second.source_path.size() > mount_info->longest_path_len())
-            {
-                mount_info->set_longest_path_len(mount.second.source_path.size());
-            }
+                auto failure = std::find_if(failures.cbegin(), failures.cend(),
+                                            [](const std::string& message) { return !message.empty(); });
+                if (failure != failures.cend())
+                    throw std::runtime_error(*failure);
 
-            auto entry = mount_info->add_mount_paths();
-            entry->set_source_path(mount.second.source_path);
-            entry->set_target_path(mount.first);
+                fmt::memory_buffer errors;
+                fmt::format_to(errors, "{}", instance_errors);
 
-            for (const auto uid_map : mount.second.uid_map)
-            {
-                (*entry->mutable_mount_maps()->mutable_uid_map())[uid_map.first] = uid_map.second;
+                status = grpc_status_for(errors);
+                if (status.ok())
+                {
+                    logger.merge_into(response);
+                    write_in_chunks(server, response, request->chunked_reply(),
+                                    [](InfoReply& r) { return r.mutable_info(); });
+                }
             }
-            for (const auto gid_map : mount.second.gid_map)
+            catch (const std::exception& e)
             {
-                (*entry->mutable_mount_maps()->mutable_gid_map())[gid_map.first] = gid_map.second;
+                status = grpc::Status(grpc::StatusCode::FAILED_PRECONDITION, e.what(), "");
             }
-        }
-
-        if (mp::utils::is_running(present_state))
-        {
-            mp::SSHSession session{vm->ssh_hostname(), vm->ssh_port(), vm_specs.ssh_username,
-                                   *config->ssh_key_provider};
-
-            auto run_in_vm = [&session](const std::string& cmd) {
-                auto proc = session.exec(cmd);
-                if (proc.exit_code() != 0)
-                {
-                    auto error_msg = proc.read_std_error();
-                    mpl::log(
-                        mpl::Level::warning, category,
-                        fmt::format("failed to run '{}', error message: '{}'", cmd, mp::utils::trim_end(error_msg)));
-                    return std::string{};
-                }
-
-                auto output = proc.read_std_output();
-                if (output.empty())
-                {
-                    mpl::log(mpl::Level::warning, category, fmt::format("no output after running '{}'", cmd));
-                    return std::string{};
-                }
-
-                return mp::utils::trim_end(output);
-            };
-
-            info->set_load(run_in_vm("cat /proc/loadavg | cut -d ' ' -f1-3"));
-            info->set_memory_usage(run_in_vm("free -b | sed '1d;3d' | awk '{printf $3}'"));
-            info->set_memory_total(run_in_vm("free -b | sed '1d;3d' | awk '{printf $2}'"));
-            info->set_disk_usage(
-                run_in_vm("df --output=used `awk '$2 == \"/\" { print $1 }' /proc/mounts` -B1 | sed 1d"));
-            info->set_disk_total(
-                run_in_vm("df --output=size `awk '$2 == \"/\" { print $1 }' /proc/mounts` -B1 | sed 1d"));
-            info->set_ipv4(vm->ipv4());
-
-            auto current_release = run_in_vm("lsb_release -ds");
-            info->set_current_release(!current_release.empty() ? current_release : original_release);
-        }
-    }
-
-    auto status = grpc_status_for(errors);
-    if (status.ok())
-        server->Write(response);
+        } // stop logging to the client before it is released
 
-    status_promise->set_value(status);
+        status_promise->set_value(status);
+    });
 }
 catch (const std::exception& e)
 {
@@ -1138,52 +2216,111 @@ void mp::Daemon::list(const ListRequest* request, grpc::ServerWriter<ListReply>*
                       std::promise<grpc::Status>* status_promise) // clang-format off
 try // clang-format on
 {
-    mpl::ClientLogger<ListReply> logger{mpl::level_from(request->verbosity_level()), *config->logger, server};
-    ListReply response;
-    config->update_prompt->populate_if_time_to_show(response.mutable_update_info());
+    auto fields_status = validate_fields(request->fields(), list_fields);
+    if (!fields_status.ok())
+        return status_promise->set_value(fields_status);
 
+    std::vector<InstanceSnapshot> instances;
     for (const auto& instance : vm_instances)
     {
         const auto& name = instance.first;
-        const auto& vm = instance.second;
-        auto present_state = vm->current_state();
-        auto entry = response.add_instances();
-        entry->set_name(name);
-        entry->mutable_instance_status()->set_status(grpc_instance_status_for(present_state));
+        instances.push_back({name, instance.second, false, vm_instance_specs[name],
+                             fetch_image_for(name, config->factory->fetch_type(), *config->vault)});
+    }
 
-        // FIXME: Set the release to the cached current version when supported
-        auto vm_image = fetch_image_for(name, config->factory->fetch_type(), *config->vault);
-        auto current_release = vm_image.original_release;
+    std::vector<std::string> deleted;
+    for (const auto& instance : deleted_instances)
+    {
+        const auto& name = instance.first;
+        if (matches_filter(request->filter(), name, mp::InstanceStatus::DELETED,
+                           fetch_image_for(name, config->factory->fetch_type(), *config->vault)))
+            deleted.push_back(name);
+    }
+
+    ListReply response;
+    config->update_prompt->populate_if_time_to_show(response.mutable_update_info());
 
-        if (!vm_image.id.empty() && current_release.empty())
+    // Release lookups and addresses may take a while, so they are gathered away from the daemon thread
+    QtConcurrent::run(&read_only_workers, [this, request, server, status_promise, instances, deleted, response] {
+        grpc::Status status;
         {
+            mpl::ClientLogger<ListReply> logger{mpl::level_from(request->verbosity_level()), *config->logger, server};
             try
             {
-                auto vm_image_info = config->image_hosts.back()->info_for_full_hash(vm_image.id);
-                current_release = vm_image_info.release_title.toStdString();
+                ReplyArena arena;
+                auto& reply = arena.make<ListReply>();
+                reply.CopyFrom(response);
+
+                // One backend query answers for every instance listed
+                std::vector<mp::VirtualMachine::ShPtr> vms;
+                for (const auto& instance : instances)
+                    vms.push_back(instance.vm);
+                auto queried_states = config->factory->query_instances(vms);
+
+                const auto& fields = request->fields();
+                auto wants_release = wants_field(fields, "release");
+                for (const auto& instance : instances)
+                {
+                    auto queried = queried_states.find(instance.name);
+                    auto present_state =
+                        queried != queried_states.end() ? queried->second.state : instance.vm->current_state();
+                    if (!matches_filter(request->filter(), instance.name, grpc_instance_status_for(present_state),
+                                        instance.image))
+                        continue;
+
+                    auto entry = reply.add_instances();
+                    entry->set_name(instance.name);
+                    if (wants_field(fields, "state"))
+                        entry->mutable_instance_status()->set_status(grpc_instance_status_for(present_state));
+                    if (wants_release)
+                        entry->set_current_release(original_release_for(instance.image, *config->image_hosts.back()));
+
+                    if (mp::utils::is_running(present_state) && (wants_release || wants_field(fields, "ipv4")))
+                    {
+                        // Listing does not wait on guests that have not been queried yet, unless asked to, and
+                        // addresses alone never need asking the guest
+                        auto telemetry = request->refresh() && wants_release
+                                             ? mp::make_optional(telemetry_for(instance.name, *instance.vm,
+                                                                               instance.specs.ssh_username, true))
+                                             : cached_telemetry_for(instance.name);
+                        if (telemetry)
+                        {
+                            auto release = telemetry->stats.find("current_release");
+                            if (wants_release && release != telemetry->stats.end() && !release->second.empty())
+                                entry->set_current_release(release->second);
+
+                            if (wants_field(fields, "ipv4"))
+                                entry->set_ipv4(telemetry->ipv4);
+                            entry->set_telemetry_timestamp(
+                                telemetry->timestamp.toString(Qt::ISODateWithMs).toStdString());
+                        }
+                        else if (wants_field(fields, "ipv4"))
+                        {
+                            entry->set_ipv4(queried != queried_states.end() ? queried->second.ipv4
+                                                                            : instance.vm->ipv4());
+                        }
+                    }
+                }
+
+                for (const auto& name : deleted)
+                {
+                    auto entry = reply.add_instances();
+                    entry->set_name(name);
+                    entry->mutable_instance_status()->set_status(mp::InstanceStatus::DELETED);
+                }
+
+                logger.merge_into(reply);
+                write_in_chunks(server, reply, request->chunked_reply(),
+                                [](ListReply& r) { return r.mutable_instances(); });
             }
             catch (const std::exception& e)
             {
-                mpl::log(mpl::Level::warning, category, fmt::format("Cannot fetch image information: {}", e.what()));
+                status = grpc::Status(grpc::StatusCode::FAILED_PRECONDITION, e.what(), "");
             }
-        }
-
-        entry->set_current_release(current_release);
-
-        if (mp::utils::is_running(present_state))
-            entry->set_ipv4(vm->ipv4());
-    }
-
-    for (const auto& instance : deleted_instances)
-    {
-        const auto& name = instance.first;
-        auto entry = response.add_instances();
-        entry->set_name(name);
-        entry->mutable_instance_status()->set_status(mp::InstanceStatus::DELETED);
-    }
+        } // stop logging to the client before it is released
 
-    server->Write(response);
-    status_promise->set_value(grpc::Status::OK);
+        status_promise->set_value(status);
+    });
 }
 catch (const std::exception& e)
 {
@@ -1199,6 +2336,7 @@ try // clang-format on
     QFileInfo source_dir(QString::fromStdString(request->source_path()));
     if (!source_dir.exists())
     {
+        logger.flush();
         return status_promise->set_value(
             grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
                          fmt::format("source \"{}\" does not exist", request->source_path()), ""));
@@ -1206,6 +2344,7 @@ try // clang-format on
 
     if (!source_dir.isDir())
     {
+        logger.flush();
         return status_promise->set_value(
             grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
                          fmt::format("source \"{}\" is not a directory", request->source_path()), ""));
@@ -1213,6 +2352,7 @@ try // clang-format on
 
     if (!source_dir.isReadable())
     {
+        logger.flush();
         return status_promise->set_value(
             grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
                          fmt::format("source \"{}\" is not readable", request->source_path()), ""));
@@ -1223,6 +2363,16 @@ try // clang-format on
     std::unordered_map<int, int> gid_map{request->mount_maps().gid_map().begin(),
                                          request->mount_maps().gid_map().end()};
 
+    const auto profile = request->mount_profile().empty() ? mp::default_mount_profile : request->mount_profile();
+    if (profile != mp::default_mount_profile && profile != mp::strict_mount_profile &&
+        profile != mp::dev_mount_profile && profile != mp::read_only_mount_profile &&
+        profile != mp::write_back_mount_profile)
+    {
+        logger.flush();
+        return status_promise->set_value(grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
+                                                      fmt::format("unknown mount profile \"{}\"", profile), ""));
+    }
+
     fmt::memory_buffer errors;
     for (const auto& path_entry : request->target_paths())
     {
@@ -1248,12 +2398,51 @@ try // clang-format on
         }
 
         auto& vm = it->second;
+        auto& vm_specs = vm_instance_specs[name];
+        const auto native = request->mount_type() == MountRequest::NATIVE;
+
+        if (native)
+        {
+            if (profile != mp::default_mount_profile)
+            {
+                fmt::format_to(errors, "mount profiles only apply to classic mounts\n");
+                continue;
+            }
+
+            // Exports are part of the hypervisor's configuration, which can only change while the instance is off
+            if (vm_specs.mounts.find(target_path) != vm_specs.mounts.end())
+            {
+                fmt::format_to(errors, "There is already a mount defined for \"{}:{}\"\n", name, target_path);
+                continue;
+            }
+
+            const auto state = vm->current_state();
+            if (state != mp::VirtualMachine::State::stopped && state != mp::VirtualMachine::State::off)
+            {
+                fmt::format_to(errors, "instance \"{}\" must be stopped to mount natively\n", name);
+                continue;
+            }
+
+            try
+            {
+                vm->add_native_mount(request->source_path(), target_path);
+            }
+            catch (const std::exception& e)
+            {
+                fmt::format_to(errors, "error mounting \"{}\": {}\n", target_path, e.what());
+                continue;
+            }
+
+            vm_specs.mounts[target_path] = VMMount{request->source_path(), gid_map, uid_map, VMMount::Type::native};
+            continue;
+        }
 
         if (vm->current_state() == mp::VirtualMachine::State::running)
         {
             try
             {
-                instance_mounts.start_mount(vm.get(), request->source_path(), target_path, gid_map, uid_map);
+                instance_mounts.start_mount(vm.get(), request->source_path(), target_path, gid_map, uid_map,
+                                            profile);
             }
             catch (const mp::SSHFSMissingError&)
             {
@@ -1267,10 +2456,12 @@ try // clang-format on
                     mount_reply.set_mount_message("Enabling support for mounting");
                     server->Write(mount_reply);
                     install_sshfs(vm.get(), name);
-                    instance_mounts.start_mount(vm.get(), request->source_path(), target_path, gid_map, uid_map);
+                    instance_mounts.start_mount(vm.get(), request->source_path(), target_path, gid_map, uid_map,
+                                                profile);
                 }
                 catch (const mp::SSHFSMissingError&)
                 {
+                    logger.flush();
                     return status_promise->set_value(grpc_status_for_mount_error(name));
                 }
             }
@@ -1281,19 +2472,19 @@ try // clang-format on
             }
         }
 
-        auto& vm_specs = vm_instance_specs[name];
         if (vm_specs.mounts.find(target_path) != vm_specs.mounts.end())
         {
             fmt::format_to(errors, "There is already a mount defined for \"{}:{}\"\n", name, target_path);
             continue;
         }
 
-        VMMount mount{request->source_path(), gid_map, uid_map};
+        VMMount mount{request->source_path(), gid_map, uid_map, VMMount::Type::classic, profile};
         vm_specs.mounts[target_path] = mount;
     }
 
     persist_instances();
 
+    logger.flush();
     status_promise->set_value(grpc_status_for(errors));
 }
 catch (const std::exception& e)
@@ -1322,6 +2513,7 @@ try // clang-format on
                 vm_instance_specs[name].deleted = false;
                 vm_instances[name] = std::move(it->second);
                 deleted_instances.erase(it);
+                notify_watchers(name, grpc_instance_status_for(vm_instances[name]->current_state()));
             }
             else
             {
@@ -1333,6 +2525,7 @@ try // clang-format on
         persist_instances();
     }
 
+    logger.flush();
     status_promise->set_value(status);
 }
 catch (const std::exception& e)
@@ -1346,26 +2539,60 @@ try // clang-format on
 {
     mpl::ClientLogger<SSHInfoReply> logger{mpl::level_from(request->verbosity_level()), *config->logger, server};
     SSHInfoReply response;
+    std::vector<std::string> to_resume; // suspended for being idle, which whoever comes back to them should not notice
 
+    // Wildcards, which instance names never hold, stand for every instance they match that can be reached
+    std::vector<std::string> names;
     for (const auto& name : request->instance_name())
+    {
+        if (name.find_first_of("*?[") == std::string::npos)
+        {
+            names.push_back(name);
+            continue;
+        }
+
+        const QRegExp matcher{QString::fromStdString(name), Qt::CaseSensitive, QRegExp::Wildcard};
+        for (const auto& vm_item : vm_instances)
+        {
+            const auto state = vm_item.second->current_state();
+            if (matcher.exactMatch(QString::fromStdString(vm_item.first)) &&
+                (mp::utils::is_running(state) || vm_instance_specs[vm_item.first].idle_suspended))
+                names.push_back(vm_item.first);
+        }
+    }
+
+    for (const auto& name : names)
     {
         auto it = vm_instances.find(name);
         if (it == vm_instances.end())
         {
             if (deleted_instances.find(name) == deleted_instances.end())
+            {
+                logger.flush();
                 return status_promise->set_value(
                     grpc::Status{grpc::StatusCode::NOT_FOUND, fmt::format("instance \"{}\" does not exist", name)});
+            }
             else
+            {
+                logger.flush();
                 return status_promise->set_value(
                     grpc::Status{grpc::StatusCode::INVALID_ARGUMENT, fmt::format("instance \"{}\" is deleted", name)});
+            }
         }
 
         auto& vm = it->second;
         if (vm->current_state() == VirtualMachine::State::unknown)
             throw std::runtime_error("Cannot retrieve credentials in unknown state");
 
+        if (vm->current_state() == VirtualMachine::State::suspended && vm_instance_specs[name].idle_suspended)
+        {
+            to_resume.push_back(name);
+            continue;
+        }
+
         if (!mp::utils::is_running(vm->current_state()))
         {
+            logger.flush();
             return status_promise->set_value(
                 grpc::Status(grpc::StatusCode::ABORTED, fmt::format("instance \"{}\" is not running", name)));
         }
@@ -1374,6 +2601,7 @@ try // clang-format on
         {
             if (delayed_shutdown_instances[name]->get_time_remaining() <= std::chrono::minutes(1))
             {
+                logger.flush();
                 return status_promise->set_value(
                     grpc::Status(grpc::StatusCode::FAILED_PRECONDITION,
                                  fmt::format("\"{}\" is scheduled to shut down in less than a minute, use "
@@ -1383,16 +2611,44 @@ try // clang-format on
             }
         }
 
-        mp::SSHInfo ssh_info;
-        ssh_info.set_host(vm->ssh_hostname());
-        ssh_info.set_port(vm->ssh_port());
-        ssh_info.set_priv_key_base64(config->ssh_key_provider->private_key_as_base64());
-        ssh_info.set_username(vm->ssh_username());
-        (*response.mutable_ssh_info())[name] = ssh_info;
+        note_activity(name);
+        (*response.mutable_ssh_info())[name] = ssh_info_for(*vm, *config->ssh_key_provider);
     }
 
-    server->Write(response);
-    status_promise->set_value(grpc::Status::OK);
+    logger.merge_into(response);
+    if (to_resume.empty())
+    {
+        server->Write(response);
+        return status_promise->set_value(grpc::Status::OK);
+    }
+
+    // The workers must not look instances up, the daemon thread may change vm_instances under them
+    std::vector<std::pair<std::string, VirtualMachine::ShPtr>> resumed;
+    for (const auto& name : to_resume)
+    {
+        mpl::log(mpl::Level::info, category, fmt::format("Resuming idle instance \"{}\"", name));
+        vm_instance_specs[name].idle_suspended = false;
+        persist_instance(name);
+        note_activity(name);
+
+        auto vm = vm_instances.at(name);
+        vm->start();
+        resumed.emplace_back(name, std::move(vm));
+    }
+
+    auto future_watcher = create_future_watcher();
+    future_watcher->setFuture(QtConcurrent::run([this, server, status_promise, to_resume, resumed, response]() mutable {
+        auto ready = async_wait_for_ready_all<StartReply>(nullptr, to_resume, nullptr);
+        if (ready.status.ok())
+        {
+            for (const auto& instance : resumed)
+                (*response.mutable_ssh_info())[instance.first] =
+                    ssh_info_for(*instance.second, *config->ssh_key_provider);
+            server->Write(response);
+        }
+
+        return AsyncOperationStatus{ready.status, status_promise};
+    }));
 }
 catch (const std::exception& e)
 {
@@ -1426,8 +2682,11 @@ try // clang-format on
     }
 
     if (start_error.instance_errors_size())
+    {
+        logger.flush();
         return status_promise->set_value(
             grpc::Status(grpc::StatusCode::ABORTED, "instance(s) missing", start_error.SerializeAsString()));
+    }
 
     if (request->instance_names().instance_name().empty())
     {
@@ -1439,10 +2698,31 @@ try // clang-format on
         }
     }
 
+    HostCapacity::Resources requested{0, 0, 0}; // their disks are committed already
+    for (const auto& name : vms)
+    {
+        if (takes_host_resources(vm_instances[name]->current_state()))
+            continue;
+        requested.cpus += vm_instance_specs[name].num_cores;
+        requested.memory_bytes += vm_instance_specs[name].mem_size.in_bytes();
+    }
+
+    const auto shortfall = host_capacity().shortfall(committed_resources(), requested);
+    if (!shortfall.empty())
+    {
+        logger.flush();
+        return status_promise->set_value(grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED, shortfall, ""));
+    }
+
     for (const auto& name : vms)
     {
         auto it = vm_instances.find(name);
         auto state = it->second->current_state();
+        if (vm_instance_specs[name].idle_suspended)
+        {
+            vm_instance_specs[name].idle_suspended = false;
+            persist_instance(name);
+        }
         if (state != VirtualMachine::State::starting && state != VirtualMachine::State::restarting)
             it->second->start();
     }
@@ -1468,16 +2748,30 @@ try // clang-format on
 
     if (status.ok())
     {
-        std::function<grpc::Status(VirtualMachine&)> operation;
-        if (request->cancel_shutdown())
-            operation = std::bind(&Daemon::cancel_vm_shutdown, this, std::placeholders::_1);
+        if (request->cancel_shutdown() || request->time_minutes() > 0)
+        {
+            // Only timers to set up or cancel, which belong to the daemon thread
+            for (const auto& name : instances)
+            {
+                auto& vm = *vm_instances.at(name);
+                status = request->cancel_shutdown()
+                             ? cancel_vm_shutdown(vm)
+                             : shutdown_vm(vm, std::chrono::minutes(request->time_minutes()));
+                if (!status.ok())
+                    break;
+            }
+        }
         else
-            operation = std::bind(&Daemon::shutdown_vm, this, std::placeholders::_1,
-                                  std::chrono::minutes(request->time_minutes()));
+        {
+            for (const auto& name : instances)
+                delayed_shutdown_instances.erase(name); // superseded by stopping now
 
-        status = cmd_vms(instances, operation);
+            status = cmd_vms(instances, std::bind(&Daemon::shutdown_vm_now, this, std::placeholders::_1), server,
+                             "Stopped", /*drives_backend=*/true);
+        }
     }
 
+    logger.flush();
     status_promise->set_value(status);
 }
 catch (const std::exception& e)
@@ -1517,13 +2811,17 @@ try // clang-format on
                 instances_to_suspend.push_back(pair.first);
         }
 
-        status = cmd_vms(instances_to_suspend, [this](auto& vm) {
-            instance_mounts.stop_all_mounts_for_instance(vm.vm_name);
-            vm.suspend();
-            return grpc::Status::OK;
-        });
+        status = cmd_vms(
+            instances_to_suspend,
+            [this](auto& vm) {
+                instance_mounts.stop_all_mounts_for_instance(vm.vm_name);
+                vm.suspend();
+                return grpc::Status::OK;
+            },
+            server, "Suspended", /*drives_backend=*/true);
     }
 
+    logger.flush();
     status_promise->set_value(status);
 }
 catch (const std::exception& e)
@@ -1543,14 +2841,20 @@ try // clang-format on
 
     if (!status.ok())
     {
+        logger.flush();
         return status_promise->set_value(status);
     }
 
-    status = cmd_vms(instances,
-                     std::bind(&Daemon::reboot_vm, this, std::placeholders::_1)); // 1st pass to reboot all targets
+    for (const auto& name : instances)
+        delayed_shutdown_instances.erase(name);
+
+    // 1st pass to reboot all targets, which only takes SSH
+    status = cmd_vms(instances, std::bind(&Daemon::reboot_vm, this, std::placeholders::_1), server, "Rebooted",
+                     /*drives_backend=*/false);
 
     if (!status.ok())
     {
+        logger.flush();
         return status_promise->set_value(status);
     }
 
@@ -1586,17 +2890,19 @@ try // clang-format on
                 delayed_shutdown_instances.erase(name);
 
             instance_mounts.stop_all_mounts_for_instance(name);
-            instance->shutdown();
 
             if (purge)
-                release_resources(name);
+                purge_instance(name, instance);
             else
             {
+                instance->shutdown();
                 deleted_instances[name] = std::move(instance);
                 vm_instance_specs[name].deleted = true;
             }
 
             vm_instances.erase(name);
+            forget_telemetry_for(name);
+            notify_watchers(name, mp::InstanceStatus::DELETED);
         }
 
         if (purge)
@@ -1604,14 +2910,17 @@ try // clang-format on
             for (const auto& name : trashed_instances_to_delete)
             {
                 assert(vm_instance_specs[name].deleted);
-                release_resources(name);
+                purge_instance(name, deleted_instances[name]);
                 deleted_instances.erase(name);
             }
         }
 
         persist_instances();
+        if (purge)
+            reap_purged_instances();
     }
 
+    logger.flush();
     status_promise->set_value(status);
 }
 catch (const std::exception& e)
@@ -1640,15 +2949,36 @@ try // clang-format on
         auto& mounts = vm_instance_specs[name].mounts;
         auto& vm = it->second;
 
+        auto stop_native = [this, &vm, &name, &errors](const std::string& target_path) {
+            try
+            {
+                if (vm->current_state() == mp::VirtualMachine::State::running)
+                    stop_native_mount(vm.get(), name, target_path);
+            }
+            catch (const std::exception& e)
+            {
+                fmt::format_to(errors, "error unmounting \"{}\": {}\n", target_path, e.what());
+            }
+            vm->remove_native_mount(target_path);
+        };
+
         // Empty target path indicates removing all mounts for the VM instance
         if (target_path.empty())
         {
             instance_mounts.stop_all_mounts_for_instance(name);
+            for (const auto& mount : mounts)
+                if (mount.second.type == VMMount::Type::native)
+                    stop_native(mount.first);
             mounts.clear();
         }
         else
         {
-            if (vm->current_state() == mp::VirtualMachine::State::running)
+            auto mount = mounts.find(target_path);
+            if (mount != mounts.end() && mount->second.type == VMMount::Type::native)
+            {
+                stop_native(target_path);
+            }
+            else if (vm->current_state() == mp::VirtualMachine::State::running)
             {
                 if (!instance_mounts.stop_mount(name, target_path))
                 {
@@ -1666,6 +2996,7 @@ try // clang-format on
 
     persist_instances();
 
+    logger.flush();
     status_promise->set_value(grpc_status_for(errors));
 }
 catch (const std::exception& e)
@@ -1681,412 +3012,2739 @@ void mp::Daemon::version(const VersionRequest* request, grpc::ServerWriter<Versi
     VersionReply reply;
     reply.set_version(multipass::version_string);
     config->update_prompt->populate(reply.mutable_update_info());
+
+    const auto committed = committed_resources();
+    const auto limits = host_capacity().limits();
+    auto commitment = reply.mutable_host_commitment();
+    commitment->set_cpus(committed.cpus);
+    commitment->set_cpus_limit(limits.cpus);
+    commitment->set_memory_bytes(committed.memory_bytes);
+    commitment->set_memory_limit_bytes(limits.memory_bytes);
+    commitment->set_disk_bytes(committed.disk_bytes);
+    commitment->set_disk_limit_bytes(limits.disk_bytes);
+    logger.merge_into(reply);
     server->Write(reply);
     status_promise->set_value(grpc::Status::OK);
 }
 
-void mp::Daemon::on_shutdown()
+void mp::Daemon::metrics(const MetricsRequest* request, grpc::ServerWriter<MetricsReply>* server,
+                         std::promise<grpc::Status>* status_promise)
 {
-}
+    mpl::ClientLogger<MetricsReply> logger{mpl::level_from(request->verbosity_level()), *config->logger, server};
 
-void mp::Daemon::on_resume()
-{
-}
+    publish_memory_footprint();
 
-void mp::Daemon::on_stop()
-{
+    MetricsReply reply;
+    reply.set_exposition(Telemetry::instance().exposition());
+    logger.merge_into(reply);
+    server->Write(reply);
+    status_promise->set_value(grpc::Status::OK);
 }
 
-void mp::Daemon::on_suspend()
+void mp::Daemon::clone(const CloneRequest* request, grpc::ServerWriter<CloneReply>* server,
+                       std::promise<grpc::Status>* status_promise) // clang-format off
+try // clang-format on
 {
-}
+    mpl::ClientLogger<CloneReply> logger{mpl::level_from(request->verbosity_level()), *config->logger, server};
 
-void mp::Daemon::on_restart(const std::string& name)
+    const auto& source_name = request->source_name();
+    auto status = check_instance_is_stopped(vm_instances, source_name, "be cloned");
+    if (!status.ok())
+    {
+        logger.flush();
+        return status_promise->set_value(status);
+    }
+
+    const auto name = name_from(request->destination_name(), *config->name_generator, vm_instances);
+    if (vm_instances.find(name) != vm_instances.end() || deleted_instances.find(name) != deleted_instances.end() ||
+        purged_instances.find(name) != purged_instances.end() ||
+        warm_pool_images.find(name) != warm_pool_images.end() ||
+        template_images.find(name) != template_images.end() ||
+        preparing_instances.find(name) != preparing_instances.end())
+    {
+        logger.flush();
+        return status_promise->set_value(grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
+                                                      fmt::format("instance \"{}\" already exists", name), ""));
+    }
+
+    const auto& source_specs = vm_instance_specs[source_name];
+    auto vm_image = config->vault->clone_instance_image(source_name, name);
+    const auto mac_addr = allocate_mac_addr();
+    try
+    {
+        // A new instance-id makes cloud-init give the clone an identity of its own on first boot: its hostname, host
+        // keys and network configuration for the new MAC address
+        auto vendor_data_cloud_init_config =
+            make_cloud_init_vendor_config(*config->ssh_key_provider, QTimeZone::systemTimeZoneId().toStdString(),
+                                          source_specs.ssh_username,
+                                          config->factory->get_backend_version_string().toStdString(),
+                                          package_cache ? package_cache->port() : 0);
+        auto meta_data_cloud_init_config = make_cloud_init_meta_config(name);
+        auto user_data_cloud_init_config = YAML::Load("");
+        config->factory->configure(name, meta_data_cloud_init_config, vendor_data_cloud_init_config);
+        auto cloud_init_iso = make_cloud_init_iso(meta_data_cloud_init_config, user_data_cloud_init_config,
+                                                  vendor_data_cloud_init_config);
+
+        const VirtualMachineDescription vm_desc{
+            source_specs.num_cores,
+            source_specs.mem_size,
+            source_specs.disk_space,
+            name,
+            mac_addr,
+            source_specs.ssh_username,
+            vm_image,
+            make_cloud_init_image(mp::utils::base_dir(vm_image.image_path), cloud_init_iso),
+            source_specs.disk_profile,
+            source_specs.hugepages,
+            source_specs.resource_class,
+            source_specs.throttle};
+
+        add_instance(name, vm_desc);
+        persist_instances();
+    }
+    catch (...)
+    {
+        {
+            std::lock_guard<std::mutex> mac_addr_lock{mac_addr_mutex};
+            allocated_mac_addrs.erase(mac_addr);
+        }
+        release_resources(name);
+        vm_instances.erase(name);
+        throw;
+    }
+
+    CloneReply reply;
+    reply.set_instance_name(name);
+    logger.merge_into(reply);
+    server->Write(reply);
+    status_promise->set_value(grpc::Status::OK);
+}
+catch (const std::exception& e)
 {
-    auto future_watcher = create_future_watcher();
-    future_watcher->setFuture(QtConcurrent::run(this, &Daemon::async_wait_for_ready_all<StartReply>, nullptr,
-                                                std::vector<std::string>{name}, nullptr));
+    status_promise->set_value(grpc::Status(grpc::StatusCode::FAILED_PRECONDITION, e.what(), ""));
 }
 
-void mp::Daemon::persist_state_for(const std::string& name, const VirtualMachine::State& state)
+void mp::Daemon::snapshot(const SnapshotRequest* request, grpc::ServerWriter<SnapshotReply>* server,
+                          std::promise<grpc::Status>* status_promise) // clang-format off
+try // clang-format on
 {
-    vm_instance_specs[name].state = state;
-    persist_instances();
+    mpl::ClientLogger<SnapshotReply> logger{mpl::level_from(request->verbosity_level()), *config->logger, server};
+
+    const auto& name = request->instance_name();
+    auto status = check_instance_is_stopped(vm_instances, name, "take a snapshot");
+    if (!status.ok())
+    {
+        logger.flush();
+        return status_promise->set_value(status);
+    }
+
+    auto snapshot_name = request->snapshot_name();
+    if (snapshot_name.empty())
+    {
+        const auto snapshots = config->vault->instance_image_snapshots(name);
+        for (auto i = snapshots.size() + 1; snapshot_name.empty(); ++i)
+        {
+            auto candidate = fmt::format("snapshot{}", i);
+            if (std::none_of(snapshots.cbegin(), snapshots.cend(),
+                             [&candidate](const ImageSnapshot& snapshot) { return snapshot.name == candidate; }))
+                snapshot_name = candidate;
+        }
+    }
+
+    config->vault->snapshot_instance_image(name, snapshot_name);
+    mpl::log(mpl::Level::info, category, fmt::format("Took snapshot \"{}\" of {}", snapshot_name, name));
+
+    SnapshotReply reply;
+    reply.set_snapshot_name(snapshot_name);
+    logger.merge_into(reply);
+    server->Write(reply);
+    status_promise->set_value(grpc::Status::OK);
+}
+catch (const std::exception& e)
+{
+    status_promise->set_value(grpc::Status(grpc::StatusCode::FAILED_PRECONDITION, e.what(), ""));
 }
 
-void mp::Daemon::update_metadata_for(const std::string& name, const QJsonObject& metadata)
+void mp::Daemon::restore(const RestoreRequest* request, grpc::ServerWriter<RestoreReply>* server,
+                         std::promise<grpc::Status>* status_promise) // clang-format off
+try // clang-format on
 {
-    vm_instance_specs[name].metadata = metadata;
+    mpl::ClientLogger<RestoreReply> logger{mpl::level_from(request->verbosity_level()), *config->logger, server};
 
-    persist_instances();
+    const auto& name = request->instance_name();
+    auto status = check_instance_is_stopped(vm_instances, name, "be restored");
+    if (!status.ok())
+    {
+        logger.flush();
+        return status_promise->set_value(status);
+    }
+
+    config->vault->restore_instance_image(name, request->snapshot_name());
+    mpl::log(mpl::Level::info, category, fmt::format("Restored {} to snapshot \"{}\"", name, request->snapshot_name()));
+
+    logger.flush();
+    status_promise->set_value(grpc::Status::OK);
+}
+catch (const std::exception& e)
+{
+    status_promise->set_value(grpc::Status(grpc::StatusCode::FAILED_PRECONDITION, e.what(), ""));
 }
 
-QJsonObject mp::Daemon::retrieve_metadata_for(const std::string& name)
+void mp::Daemon::snapshots(const SnapshotsRequest* request, grpc::ServerWriter<SnapshotsReply>* server,
+                           std::promise<grpc::Status>* status_promise) // clang-format off
+try // clang-format on
 {
-    return vm_instance_specs[name].metadata;
+    mpl::ClientLogger<SnapshotsReply> logger{mpl::level_from(request->verbosity_level()), *config->logger, server};
+
+    const auto& name = request->instance_name();
+    if (vm_instances.find(name) == vm_instances.end())
+    {
+        logger.flush();
+        return status_promise->set_value(
+            grpc::Status(grpc::StatusCode::NOT_FOUND, fmt::format("instance \"{}\" does not exist", name), ""));
+    }
+
+    SnapshotsReply reply;
+    for (const auto& snapshot : config->vault->instance_image_snapshots(name))
+    {
+        auto entry = reply.add_snapshots();
+        entry->set_name(snapshot.name);
+        auto created_ms =
+            std::chrono::duration_cast<std::chrono::milliseconds>(snapshot.created.time_since_epoch()).count();
+        entry->set_created(QDateTime::fromMSecsSinceEpoch(created_ms, Qt::UTC).toString(Qt::ISODate).toStdString());
+    }
+
+    logger.merge_into(reply);
+    server->Write(reply);
+    status_promise->set_value(grpc::Status::OK);
+}
+catch (const std::exception& e)
+{
+    status_promise->set_value(grpc::Status(grpc::StatusCode::FAILED_PRECONDITION, e.what(), ""));
 }
 
-void mp::Daemon::persist_instances()
+void mp::Daemon::logs(const LogsRequest* request, grpc::ServerWriter<LogsReply>* server,
+                      std::promise<grpc::Status>* status_promise)
 {
-    auto vm_spec_to_json = [](const mp::VMSpecs& specs) -> QJsonObject {
-        QJsonObject json;
-        json.insert("num_cores", specs.num_cores);
-        json.insert("mem_size", QString::number(specs.mem_size.in_bytes()));
-        json.insert("disk_space", QString::number(specs.disk_space.in_bytes()));
-        json.insert("mac_addr", QString::fromStdString(specs.mac_addr));
-        json.insert("ssh_username", QString::fromStdString(specs.ssh_username));
-        json.insert("state", static_cast<int>(specs.state));
-        json.insert("deleted", specs.deleted);
-        json.insert("metadata", specs.metadata);
+    // The records are copied out under their own lock, so the daemon thread has no part in this
+    QtConcurrent::run(&read_only_workers, [this, request, server, status_promise] {
+        constexpr auto records_per_reply = 500;
 
-        QJsonArray mounts;
-        for (const auto& mount : specs.mounts)
+        auto level = mpl::Level::trace;
+        if (!request->level().empty())
         {
-            QJsonObject entry;
-            entry.insert("source_path", QString::fromStdString(mount.second.source_path));
-            entry.insert("target_path", QString::fromStdString(mount.first));
+            auto it = std::find_if(std::begin(log_levels), std::end(log_levels), [request](mpl::Level candidate) {
+                return request->level() == mpl::as_string(candidate).c_str();
+            });
+            if (it == std::end(log_levels))
+                return status_promise->set_value(grpc::Status(
+                    grpc::StatusCode::INVALID_ARGUMENT, fmt::format("unknown log level \"{}\"", request->level()), ""));
+            level = *it;
+        }
 
-            QJsonArray uid_map;
-            for (const auto& map : mount.second.uid_map)
+        LogsReply reply;
+        for (const auto& record : recent_logs.recent(level, request->instance_name()))
+        {
+            auto entry = reply.add_records();
+            auto time_ms =
+                std::chrono::duration_cast<std::chrono::milliseconds>(record.time.time_since_epoch()).count();
+            entry->set_timestamp(
+                QDateTime::fromMSecsSinceEpoch(time_ms, Qt::UTC).toString(Qt::ISODateWithMs).toStdString());
+            entry->set_level(mpl::as_string(record.level).c_str());
+            entry->set_category(record.category);
+            entry->set_message(record.message);
+
+            if (reply.records_size() == records_per_reply)
             {
-                QJsonObject map_entry;
-                map_entry.insert("host_uid", map.first);
-                map_entry.insert("instance_uid", map.second);
-
-                uid_map.append(map_entry);
+                server->Write(reply);
+                reply.clear_records();
             }
+        }
 
-            entry.insert("uid_mappings", uid_map);
+        if (reply.records_size() > 0)
+            server->Write(reply);
+        status_promise->set_value(grpc::Status::OK);
+    });
+}
 
-            QJsonArray gid_map;
-            for (const auto& map : mount.second.gid_map)
-            {
-                QJsonObject map_entry;
-                map_entry.insert("host_gid", map.first);
-                map_entry.insert("instance_gid", map.second);
+void mp::Daemon::qos(const QosRequest* request, grpc::ServerWriter<QosReply>* server,
+                     std::promise<grpc::Status>* status_promise) // clang-format off
+try // clang-format on
+{
+    mpl::ClientLogger<QosReply> logger{mpl::level_from(request->verbosity_level()), *config->logger, server};
 
-                gid_map.append(map_entry);
-            }
+    if (!valid_resource_class(request->resource_class()))
+    {
+        logger.flush();
+        return status_promise->set_value(
+            grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
+                         fmt::format("unknown resource class \"{}\"", request->resource_class()), ""));
+    }
 
-            entry.insert("gid_mappings", gid_map);
-            mounts.append(entry);
+    fmt::memory_buffer errors;
+    std::vector<decltype(vm_instances)::key_type> instances_to_move;
+    for (const auto& name : request->instance_names().instance_name())
+    {
+        auto it = vm_instances.find(name);
+        if (it == vm_instances.end())
+        {
+            it = deleted_instances.find(name);
+            if (it == deleted_instances.end())
+                fmt::format_to(errors, "instance \"{}\" does not exist\n", name);
+            else
+                fmt::format_to(errors, "instance \"{}\" is deleted\n", name);
+            continue;
         }
+        instances_to_move.push_back(name);
+    }
 
-        json.insert("mounts", mounts);
-        return json;
-    };
-    QJsonObject instance_records_json;
-    for (const auto& record : vm_instance_specs)
+    auto status = grpc_status_for(errors);
+    if (status.ok())
     {
-        auto key = QString::fromStdString(record.first);
-        instance_records_json.insert(key, vm_spec_to_json(record.second));
+        if (instances_to_move.empty())
+        {
+            for (auto& pair : vm_instances)
+                instances_to_move.push_back(pair.first);
+        }
+
+        for (const auto& name : instances_to_move)
+        {
+            vm_instances[name]->set_resource_class(request->resource_class());
+            vm_instance_specs[name].resource_class = request->resource_class();
+        }
+        persist_instances();
     }
-    QDir data_dir{
-        mp::utils::backend_directory_path(config->data_directory, config->factory->get_backend_directory_name())};
-    mp::write_json(instance_records_json, data_dir.filePath(instance_db_name));
-}
 
-void mp::Daemon::release_resources(const std::string& instance)
+    logger.flush();
+    status_promise->set_value(status);
+}
+catch (const std::exception& e)
 {
-    config->factory->remove_resources_for(instance);
-    config->vault->remove(instance);
-    vm_instance_specs.erase(instance);
+    status_promise->set_value(grpc::Status(grpc::StatusCode::FAILED_PRECONDITION, e.what(), ""));
 }
 
-std::string mp::Daemon::check_instance_operational(const std::string& instance_name) const
+void mp::Daemon::throttle(const ThrottleRequest* request, grpc::ServerWriter<ThrottleReply>* server,
+                          std::promise<grpc::Status>* status_promise) // clang-format off
+try // clang-format on
 {
-    if (vm_instances.find(instance_name) == std::cend(vm_instances))
+    mpl::ClientLogger<ThrottleReply> logger{mpl::level_from(request->verbosity_level()), *config->logger, server};
+
+    if (request->disk_iops() < -1 || request->disk_bytes_per_second() < -1 || request->network_bytes_per_second() < -1)
     {
-        if (deleted_instances.find(instance_name) == std::cend(deleted_instances))
-            return fmt::format("instance \"{}\" does not exist\n", instance_name);
-        else
-            return fmt::format("instance \"{}\" is deleted\n", instance_name);
+        logger.flush();
+        return status_promise->set_value(
+            grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "caps have to be positive, or 0 for none", ""));
     }
 
-    return {};
-}
+    fmt::memory_buffer errors;
+    std::vector<decltype(vm_instances)::key_type> instances_to_throttle;
+    for (const auto& name : request->instance_names().instance_name())
+    {
+        if (vm_instances.find(name) == vm_instances.end())
+        {
+            if (deleted_instances.find(name) == deleted_instances.end())
+                fmt::format_to(errors, "instance \"{}\" does not exist\n", name);
+            else
+                fmt::format_to(errors, "instance \"{}\" is deleted\n", name);
+            continue;
+        }
+        instances_to_throttle.push_back(name);
+    }
 
-std::string mp::Daemon::check_instance_exists(const std::string& instance_name) const
-{
-    if (vm_instances.find(instance_name) == std::cend(vm_instances) &&
-        deleted_instances.find(instance_name) == std::cend(deleted_instances))
-        return fmt::format("instance \"{}\" does not exist\n", instance_name);
+    auto status = grpc_status_for(errors);
+    if (status.ok())
+    {
+        if (instances_to_throttle.empty())
+        {
+            for (auto& pair : vm_instances)
+                instances_to_throttle.push_back(pair.first);
+        }
 
-    return {};
+        auto update = [](long long requested, long long& cap) {
+            if (requested >= 0)
+                cap = requested;
+        };
+
+        for (const auto& name : instances_to_throttle)
+        {
+            auto& throttle = vm_instance_specs[name].throttle;
+            update(request->disk_iops(), throttle.disk_iops);
+            update(request->disk_bytes_per_second(), throttle.disk_bytes_per_second);
+            update(request->network_bytes_per_second(), throttle.network_bytes_per_second);
+            vm_instances[name]->set_throttle(throttle);
+        }
+        persist_instances();
+    }
+
+    logger.flush();
+    status_promise->set_value(status);
+}
+catch (const std::exception& e)
+{
+    status_promise->set_value(grpc::Status(grpc::StatusCode::FAILED_PRECONDITION, e.what(), ""));
 }
 
-void mp::Daemon::create_vm(const CreateRequest* request, grpc::ServerWriter<CreateReply>* server,
-                           std::promise<grpc::Status>* status_promise, bool start)
+void mp::Daemon::resize(const ResizeRequest* request, grpc::ServerWriter<ResizeReply>* server,
+                        std::promise<grpc::Status>* status_promise) // clang-format off
+try // clang-format on
 {
-    auto checked_args = validate_create_arguments(request);
+    mpl::ClientLogger<ResizeReply> logger{mpl::level_from(request->verbosity_level()), *config->logger, server};
 
-    if (!checked_args.option_errors.error_codes().empty())
+    const auto& name = request->instance_name();
+    auto it = vm_instances.find(name);
+    if (it == vm_instances.end())
     {
-        return status_promise->set_value(grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "Invalid arguments supplied",
-                                                      checked_args.option_errors.SerializeAsString()));
+        logger.flush();
+        const auto error = deleted_instances.find(name) == deleted_instances.end() ? "instance \"{}\" does not exist"
+                                                                                    : "instance \"{}\" is deleted";
+        return status_promise->set_value(grpc::Status(grpc::StatusCode::NOT_FOUND, fmt::format(error, name), ""));
     }
 
-    auto name = name_from(checked_args.instance_name, *config->name_generator, vm_instances);
-
-    if (vm_instances.find(name) != vm_instances.end() || deleted_instances.find(name) != deleted_instances.end())
+    const auto& specs = vm_instance_specs[name];
+    const auto num_cores = request->num_cores() > 0 ? request->num_cores() : specs.num_cores;
+    const auto mem_size = request->mem_size().empty() ? specs.mem_size : MemorySize{request->mem_size()};
+    const auto disk_space = request->disk_space().empty() ? specs.disk_space : MemorySize{request->disk_space()};
+    if (num_cores < specs.num_cores || mem_size < specs.mem_size || disk_space < specs.disk_space)
     {
-        CreateError create_error;
-        create_error.add_error_codes(CreateError::INSTANCE_EXISTS);
+        logger.flush();
+        return status_promise->set_value(
+            grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "instances can only grow, not shrink", ""));
+    }
 
-        return status_promise->set_value(grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
-                                                      fmt::format("instance \"{}\" already exists", name),
-                                                      create_error.SerializeAsString()));
+    // Only a running instance takes up the CPUs and memory it grows into
+    auto* vm = it->second.get();
+    const auto running = vm->current_state() == VirtualMachine::State::running;
+    const auto takes_host = takes_host_resources(vm->current_state());
+    const HostCapacity::Resources requested{takes_host ? num_cores - specs.num_cores : 0,
+                                            takes_host ? mem_size.in_bytes() - specs.mem_size.in_bytes() : 0,
+                                            disk_space.in_bytes() - specs.disk_space.in_bytes()};
+    const auto shortfall = host_capacity().shortfall(committed_resources(), requested);
+    if (!shortfall.empty())
+    {
+        logger.flush();
+        return status_promise->set_value(grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED, shortfall, ""));
     }
 
-    if (preparing_instances.find(name) != preparing_instances.end())
+    // The specs follow what the instance took on, all of it or the part that went through, and not before
+    struct Resized
     {
-        CreateError create_error;
-        create_error.add_error_codes(CreateError::INSTANCE_EXISTS);
+        int num_cores;
+        MemorySize mem_size;
+        MemorySize disk_space;
+    };
+    auto resized = std::make_shared<mp::optional<Resized>>();
+    auto future_watcher = create_future_watcher([this, name, resized] {
+        if (!*resized || vm_instance_specs.find(name) == vm_instance_specs.end())
+            return;
+
+        auto& specs = vm_instance_specs[name];
+        specs.num_cores = std::max(specs.num_cores, (*resized)->num_cores);
+        specs.mem_size = std::max(specs.mem_size, (*resized)->mem_size);
+        specs.disk_space = std::max(specs.disk_space, (*resized)->disk_space);
+        persist_instance(name);
+    });
+    future_watcher->setFuture(QtConcurrent::run(
+        [this, vm, name, num_cores, mem_size, disk_space, running, resized, status_promise] {
+            try
+            {
+                vm->resize(num_cores, mem_size, disk_space);
+                *resized = Resized{num_cores, mem_size, disk_space};
+            }
+            catch (const mp::ResizeException& e)
+            {
+                *resized = Resized{e.num_cores(), e.mem_size(), e.disk_space()};
+                return AsyncOperationStatus{grpc::Status(grpc::StatusCode::FAILED_PRECONDITION, e.what(), ""),
+                                            status_promise};
+            }
+            catch (const std::exception& e)
+            {
+                return AsyncOperationStatus{grpc::Status(grpc::StatusCode::FAILED_PRECONDITION, e.what(), ""),
+                                            status_promise};
+            }
+
+            if (running)
+            {
+                try
+                {
+                    auto session = ssh_sessions.acquire(name, vm->ssh_hostname(), vm->ssh_port(), vm->ssh_username());
+                    auto proc = session->exec(guest_resize_cmd);
+                    if (proc.exit_code() != 0)
+                        throw std::runtime_error(mp::utils::trim_end(proc.read_std_error()));
+                }
+                catch (const std::exception& e)
+                {
+                    // The guest has the new resources all the same, so this does not fail the request
+                    mpl::log(mpl::Level::warning, name, fmt::format("Cannot grow the root filesystem: {}", e.what()));
+                }
+            }
+
+            mpl::log(mpl::Level::info, category,
+                     fmt::format("Resized {} to {} CPUs, {}MiB of memory and {}MiB of disk", name, num_cores,
+                                 mem_size.in_megabytes(), disk_space.in_megabytes()));
+            return AsyncOperationStatus{grpc::Status::OK, status_promise};
+        }));
+}
+catch (const std::exception& e)
+{
+    status_promise->set_value(grpc::Status(grpc::StatusCode::FAILED_PRECONDITION, e.what(), ""));
+}
 
+void mp::Daemon::bake(const BakeRequest* request, grpc::ServerWriter<BakeReply>* server,
+                      std::promise<grpc::Status>* status_promise) // clang-format off
+try // clang-format on
+{
+    mpl::ClientLogger<BakeReply> logger{mpl::level_from(request->verbosity_level()), *config->logger, server};
+
+    // Images are launched by these names, and kept in directories by them, so none may read as a remote, a URL, a
+    // file to fetch the image from or a path
+    const auto& image_name = request->image_name();
+    const auto qimage_name = QString::fromStdString(image_name);
+    if (!QRegExp{"[A-Za-z0-9-]+"}.exactMatch(qimage_name) || qimage_name.startsWith("file") ||
+        qimage_name.startsWith("http"))
+    {
+        logger.flush();
         return status_promise->set_value(grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
-                                                      fmt::format("instance \"{}\" is being prepared", name),
-                                                      create_error.SerializeAsString()));
+                                                      fmt::format("\"{}\" cannot name an image", image_name), ""));
     }
 
-    if (!instances_running(vm_instances))
-        config->factory->hypervisor_health_check();
-
-    preparing_instances.insert(name);
+    if (request->remove())
+    {
+        config->vault->remove_baked_image(image_name);
+        mpl::log(mpl::Level::info, category, fmt::format("Removed baked image \"{}\"", image_name));
+        logger.flush();
+        return status_promise->set_value(grpc::Status::OK);
+    }
 
-    auto prepare_future_watcher = new QFutureWatcher<VirtualMachineDescription>();
+    const auto& name = request->instance_name();
+    auto status = check_instance_is_stopped(vm_instances, name, "be baked");
+    if (!status.ok())
+    {
+        logger.flush();
+        return status_promise->set_value(status);
+    }
 
-    QObject::connect(
-        prepare_future_watcher, &QFutureWatcher<VirtualMachineDescription>::finished,
-        [this, server, status_promise, name, start, prepare_future_watcher] {
+    // Writing out the whole disk takes a while, so it is done off the daemon's thread; QEMU cannot take the disk
+    // meanwhile, as the flattening holds a lock on it
+    auto future_watcher = create_future_watcher();
+    future_watcher->setFuture(
+        QtConcurrent::run([this, name, image_name, compress = request->compress(), status_promise] {
             try
             {
-                auto vm_desc = prepare_future_watcher->future().result();
-
-                vm_instances[name] = config->factory->create_virtual_machine(vm_desc, *this);
-                vm_instance_specs[name] = {vm_desc.num_cores,
-                                           vm_desc.mem_size,
-                                           vm_desc.disk_space,
-                                           vm_desc.mac_addr,
-                                           config->ssh_username,
-                                           VirtualMachine::State::off,
-                                           {},
-                                           false,
-                                           QJsonObject()};
-                preparing_instances.erase(name);
+                config->vault->bake_instance_image(name, image_name, compress);
+            }
+            catch (const std::exception& e)
+            {
+                return AsyncOperationStatus{grpc::Status(grpc::StatusCode::FAILED_PRECONDITION, e.what(), ""),
+                                            status_promise};
+            }
 
-                persist_instances();
+            mpl::log(mpl::Level::info, category, fmt::format("Baked {} into image \"{}\"", name, image_name));
+            return AsyncOperationStatus{grpc::Status::OK, status_promise};
+        }));
+}
+catch (const std::exception& e)
+{
+    status_promise->set_value(grpc::Status(grpc::StatusCode::FAILED_PRECONDITION, e.what(), ""));
+}
 
-                if (start)
-                {
-                    LaunchReply reply;
-                    reply.set_create_message("Starting " + name);
-                    server->Write(reply);
+void mp::Daemon::utilization(const UtilizationRequest* request, grpc::ServerWriter<UtilizationReply>* server,
+                             std::promise<grpc::Status>* status_promise) // clang-format off
+try // clang-format on
+{
+    fmt::memory_buffer errors;
+    std::vector<std::string> names;
+    for (const auto& name : request->instance_names().instance_name())
+    {
+        if (vm_instances.find(name) == vm_instances.end())
+            fmt::format_to(errors, "instance \"{}\" does not exist\n", name);
+        else
+            names.push_back(name);
+    }
 
-                    auto& vm = vm_instances[name];
-                    vm->start();
+    std::vector<std::chrono::seconds> windows;
+    for (const auto window : request->window_seconds())
+    {
+        if (window <= 0)
+            fmt::format_to(errors, "windows have to be positive\n");
+        windows.emplace_back(window);
+    }
 
-                    auto future_watcher = create_future_watcher([this, server, name] {
-                        LaunchReply reply;
-                        reply.set_vm_instance_name(name);
-                        config->update_prompt->populate_if_time_to_show(reply.mutable_update_info());
-                        server->Write(reply);
-                    });
-                    future_watcher->setFuture(QtConcurrent::run(this, &Daemon::async_wait_for_ready_all<LaunchReply>,
-                                                                server, std::vector<std::string>{name},
-                                                                status_promise));
+    auto status = grpc_status_for(errors);
+    if (!status.ok())
+        return status_promise->set_value(status);
+
+    if (names.empty())
+    {
+        for (const auto& instance : vm_instances)
+            names.push_back(instance.first);
+        std::sort(names.begin(), names.end());
+    }
+
+    if (windows.empty())
+        windows = {1h, 24h, 30 * 24h};
+
+    // The history has a lock of its own, so only the names are taken from the daemon thread
+    QtConcurrent::run(&read_only_workers, [this, names, windows, server, status_promise] {
+        const auto now = UtilizationHistory::Clock::now();
+
+        UtilizationReply reply;
+        for (const auto& name : names)
+        {
+            for (const auto& metric : utilization_history.metrics(name))
+            {
+                for (const auto& window : windows)
+                {
+                    auto summary = utilization_history.summarize(name, metric, window, now);
+                    if (!summary)
+                        continue;
+
+                    auto entry = reply.add_summaries();
+                    entry->set_instance_name(name);
+                    entry->set_metric(metric);
+                    entry->set_window_seconds(window.count());
+                    entry->set_min(summary->min);
+                    entry->set_average(summary->average);
+                    entry->set_max(summary->max);
+                    entry->set_p95(summary->p95);
+                    entry->set_resolution_seconds(summary->resolution.count());
+                    entry->set_samples(summary->samples);
                 }
-                else
+            }
+        }
+
+        server->Write(reply);
+        status_promise->set_value(grpc::Status::OK);
+    });
+}
+catch (const std::exception& e)
+{
+    status_promise->set_value(grpc::Status(grpc::StatusCode::FAILED_PRECONDITION, e.what(), ""));
+}
+
+void mp::Daemon::forward(const ForwardRequest* request, grpc::ServerWriter<ForwardReply>* server,
+                         std::promise<grpc::Status>* status_promise) // clang-format off
+try // clang-format on
+{
+    mpl::ClientLogger<ForwardReply> logger{mpl::level_from(request->verbosity_level()), *config->logger, server};
+
+    const auto& name = request->instance_name();
+    fmt::memory_buffer errors;
+    fmt::format_to(errors, "{}", check_instance_operational(name));
+
+    std::unordered_set<int> requested_ports;
+    for (const auto& forward : request->add())
+    {
+        if (forward.host_port() < 1 || forward.host_port() > 65535 || forward.instance_port() < 1 ||
+            forward.instance_port() > 65535)
+            fmt::format_to(errors, "ports have to be between 1 and 65535\n");
+
+        if (!forward.address().empty() && !PortForwarder::is_ipv4_address(forward.address()))
+            fmt::format_to(errors, "\"{}\" is not an IPv4 address\n", forward.address());
+
+        if (!requested_ports.insert(forward.host_port()).second)
+            fmt::format_to(errors, "port {} is asked to be forwarded more than once\n", forward.host_port());
+
+        // A host port can only be listened on once, whichever instance it goes to, unless the request frees it
+        const auto& freed = request->remove();
+        const auto is_freed = std::find(freed.begin(), freed.end(), forward.host_port()) != freed.end();
+        for (const auto& specs : vm_instance_specs)
+        {
+            if (is_freed && specs.first == name)
+                continue;
+
+            const auto& forwards = specs.second.port_forwards;
+            if (std::any_of(forwards.cbegin(), forwards.cend(),
+                            [&forward](const auto& other) { return other.host_port == forward.host_port(); }))
+                fmt::format_to(errors, "port {} is forwarded to \"{}\" already\n", forward.host_port(), specs.first);
+        }
+    }
+
+    auto status = grpc_status_for(errors);
+    if (!status.ok())
+    {
+        logger.flush();
+        return status_promise->set_value(status);
+    }
+
+    auto& forwards = vm_instance_specs[name].port_forwards;
+    for (const auto host_port : request->remove())
+    {
+        port_forwarder.stop(name, host_port);
+        forwards.erase(std::remove_if(forwards.begin(), forwards.end(),
+                                      [host_port](const auto& forward) { return forward.host_port == host_port; }),
+                       forwards.end());
+    }
+
+    // A running instance has its new forwards straight away, unless it has no address yet; a stopped one, or one
+    // still without an address, the next time it starts
+    auto& vm = vm_instances[name];
+    const auto running = mp::utils::is_running(vm->current_state());
+    const auto instance_ip = running ? vm->ipv4() : std::string{};
+    const auto reachable = PortForwarder::is_ipv4_address(instance_ip);
+    if (running && !reachable)
+        mpl::log(mpl::Level::warning, category,
+                 fmt::format("\"{}\" has no address yet, its new forwards are set up the next time it starts", name));
+
+    for (const auto& entry : request->add())
+    {
+        PortForward forward{entry.address().empty() ? "127.0.0.1" : entry.address(), entry.host_port(),
+                            entry.instance_port()};
+        try
+        {
+            if (running && reachable)
+                port_forwarder.start(name, forward, instance_ip);
+            forwards.push_back(forward);
+        }
+        catch (const std::exception& e)
+        {
+            fmt::format_to(errors, "cannot forward port {}: {}\n", forward.host_port, e.what());
+        }
+    }
+    persist_instance(name);
+
+    ForwardReply reply;
+    for (const auto& forward : forwards)
+    {
+        auto entry = reply.add_port_forwards();
+        entry->set_address(forward.address);
+        entry->set_host_port(forward.host_port);
+        entry->set_instance_port(forward.instance_port);
+    }
+    server->Write(reply);
+
+    logger.flush();
+    status_promise->set_value(grpc_status_for(errors));
+}
+catch (const std::exception& e)
+{
+    status_promise->set_value(grpc::Status(grpc::StatusCode::FAILED_PRECONDITION, e.what(), ""));
+}
+
+void mp::Daemon::watch(const WatchRequest* request, grpc::ServerWriter<WatchReply>* server,
+                       std::promise<grpc::Status>* status_promise)
+{
+    std::lock_guard<std::mutex> lock{watchers_mutex};
+
+    auto write = [server](const WatchReply& reply) { return server->Write(reply); };
+    auto stream = std::make_unique<WatchStream>(write, status_promise);
+
+    WatchReply reply;
+    for (const auto& instance : vm_instances)
+    {
+        reply.set_instance_name(instance.first);
+        reply.mutable_instance_status()->set_status(grpc_instance_status_for(instance.second->current_state()));
+        if (!stream->push(reply))
+            return;
+    }
+
+    for (const auto& instance : deleted_instances)
+    {
+        reply.set_instance_name(instance.first);
+        reply.mutable_instance_status()->set_status(mp::InstanceStatus::DELETED);
+        if (!stream->push(reply))
+            return;
+    }
+
+    watchers.emplace(server, std::move(stream));
+}
+
+void mp::Daemon::unwatch(grpc::ServerWriter<WatchReply>* server)
+{
+    std::lock_guard<std::mutex> lock{watchers_mutex};
+    watchers.erase(server); // if not already finished by a failed write
+}
+
+void mp::Daemon::on_shutdown()
+{
+}
+
+void mp::Daemon::on_resume()
+{
+}
+
+void mp::Daemon::on_stop()
+{
+}
+
+void mp::Daemon::on_suspend()
+{
+}
+
+void mp::Daemon::on_restart(const std::string& name)
+{
+    auto future_watcher = create_future_watcher();
+    future_watcher->setFuture(QtConcurrent::run(this, &Daemon::async_wait_for_ready_all<StartReply>, nullptr,
+                                                std::vector<std::string>{name}, nullptr));
+}
+
+void mp::Daemon::autostart_next()
+{
+    // Each boot keeps a couple of cores and the disk busy, so only let a few of them compete at a time
+    const auto max_concurrent_autostarts =
+        std::max(1, std::min(QThread::idealThreadCount() / 2, disk_bound_operations(config->data_directory)));
+
+    while (!autostart_queue.empty() && autostarts_in_progress < max_concurrent_autostarts)
+    {
+        auto name = autostart_queue.front();
+        autostart_queue.pop_front();
+
+        // Instances may have been deleted, claimed or started by a client while they were waiting their turn
+        auto vm_it = vm_instances.find(name);
+        auto warm_it = warm_instances.find(name);
+        auto vm = vm_it != vm_instances.end() ? vm_it->second
+                                               : warm_it != warm_instances.end() ? warm_it->second : nullptr;
+        if (!vm || vm->current_state() == VirtualMachine::State::starting ||
+            vm->current_state() == VirtualMachine::State::restarting || mp::utils::is_running(vm->current_state()))
+            continue;
+
+        try
+        {
+            vm->start();
+        }
+        catch (const std::exception& e)
+        {
+            mpl::log(mpl::Level::error, category, fmt::format("Could not autostart {}: {}", name, e.what()));
+            continue;
+        }
+
+        // The next instance is admitted once this one is reachable, or has given up
+        ++autostarts_in_progress;
+        auto future_watcher = create_future_watcher([this] {
+            --autostarts_in_progress;
+            autostart_next();
+        });
+
+        if (vm_it != vm_instances.end())
+            future_watcher->setFuture(QtConcurrent::run(this, &Daemon::async_wait_for_ready_all<StartReply>, nullptr,
+                                                        std::vector<std::string>{name}, nullptr));
+        else
+            future_watcher->setFuture(QtConcurrent::run([vm] {
+                try
                 {
-                    status_promise->set_value(grpc::Status::OK);
+                    vm->wait_until_ssh_up(up_timeout);
+                }
+                catch (const std::exception&)
+                {
+                    // The warm pool notices broken members when claiming them
                 }
+                return AsyncOperationStatus{grpc::Status::OK, nullptr};
+            }));
+    }
+}
+
+// Rather than one after the other as they are destroyed, running instances are saved a few at a time. The event loop
+// carries each one's save along, so this only starts it: a timer checks on the saves until they are all through or
+// the deadline passes, then says it is done
+void mp::Daemon::save_instances_then(std::function<void()> done)
+{
+    if (exit_save)
+        return; // already on its way out
+
+    exit_save = std::make_unique<ExitSave>();
+    exit_save->done = std::move(done);
+    exit_save->at_once = static_cast<std::size_t>(disk_bound_operations(config->data_directory));
+    exit_save->deadline = std::chrono::steady_clock::now() + exit_save_timeout;
+    for (const auto& item : vm_instances)
+        exit_save->to_save.push_back(item.second);
+    for (const auto& item : warm_instances)
+        exit_save->to_save.push_back(item.second);
+
+    connect(&exit_save->timer, &QTimer::timeout, this, [this] { save_more_instances_for_exit(); });
+    exit_save->timer.start(100);
+    save_more_instances_for_exit();
+}
+
+void mp::Daemon::save_more_instances_for_exit()
+{
+    auto& saving = exit_save->saving;
+    auto& to_save = exit_save->to_save;
+
+    auto finished = std::remove_if(saving.begin(), saving.end(), [](const VirtualMachine::ShPtr& vm) {
+        return vm->current_state() != VirtualMachine::State::suspending;
+    });
+    exit_save->saved += std::distance(finished, saving.end());
+    saving.erase(finished, saving.end());
+
+    const auto past_deadline = std::chrono::steady_clock::now() >= exit_save->deadline;
+    while (!past_deadline && !to_save.empty() && saving.size() < exit_save->at_once)
+    {
+        auto vm = to_save.front();
+        to_save.pop_front();
+        try
+        {
+            if (vm->start_saving_for_exit())
+                saving.push_back(vm);
+        }
+        catch (const std::exception& e)
+        {
+            mpl::log(mpl::Level::warning, category, fmt::format("Cannot save {}: {}", vm->vm_name, e.what()));
+        }
+    }
+
+    if (!past_deadline && (!to_save.empty() || !saving.empty()))
+        return;
+
+    exit_save->timer.stop();
+    if (exit_save->saved > 0)
+        mpl::log(mpl::Level::info, category,
+                 fmt::format("Saved {} instances, {} at a time", exit_save->saved, exit_save->at_once));
+    for (const auto& vm : saving)
+        mpl::log(mpl::Level::warning, category, fmt::format("Gave up waiting for {} to be saved", vm->vm_name));
+
+    exit_save->done();
+}
+
+void mp::Daemon::publish_memory_footprint()
+{
+    auto& telemetry = Telemetry::instance();
+    const auto heap = memory_footprint::heap_in_use();
+    telemetry.set("multipass_daemon_heap_bytes", {}, heap);
+    telemetry.set("multipass_daemon_resident_bytes", {}, memory_footprint::resident());
+
+    std::size_t manifests{0};
+    for (const auto& image_host : config->image_hosts)
+    {
+        image_host->for_each_entry_do([&manifests](const std::string&, const VMImageInfo& info) {
+            manifests += memory_footprint::of(info);
+        });
+    }
+
+    std::size_t specs{0}, mounts{0};
+    for (const auto& entry : vm_instance_specs)
+    {
+        specs += memory_footprint::entry_overhead + memory_footprint::of(entry.first) + footprint_of(entry.second);
+        mounts += entry.second.mounts.size();
+    }
+
+    std::size_t telemetry_cache{0};
+    {
+        std::lock_guard<std::mutex> lock{telemetry_mutex};
+        for (const auto& entry : instance_telemetry)
+            telemetry_cache += memory_footprint::entry_overhead + memory_footprint::of(entry.first) +
+                               sizeof(entry.second) + memory_footprint::of(entry.second.stats) +
+                               memory_footprint::of(entry.second.ipv4);
+    }
+
+    std::size_t find_replies{0};
+    {
+        std::lock_guard<std::mutex> lock{find_cache_mutex};
+        for (const auto& entry : find_cache)
+            find_replies += memory_footprint::entry_overhead + entry.second.second.ByteSizeLong();
+    }
+
+    for (const auto& subsystem : {std::make_pair("manifests", manifests), std::make_pair("instance_specs", specs),
+                                  std::make_pair("telemetry_cache", telemetry_cache),
+                                  std::make_pair("find_cache", find_replies)})
+        telemetry.set("multipass_daemon_memory_bytes", {{"subsystem", subsystem.first}}, subsystem.second);
+
+    telemetry.set("multipass_daemon_mounts", {{"kind", "recorded"}}, mounts);
+    telemetry.set("multipass_daemon_mounts", {{"kind", "active"}}, instance_mounts.mount_count());
+    telemetry.set("multipass_daemon_ssh_sessions", {}, ssh_sessions.size());
+
+    // Whatever the heap grew by since the daemon came up, shared among the instances it has now. Manifest refreshes
+    // and caches count too, so small daemons overstate it; it settles as instances are added
+    const auto instances = vm_instances.size() + warm_instances.size();
+    const auto grown = heap > heap_at_start ? heap - heap_at_start : 0;
+    telemetry.set("multipass_daemon_memory_per_instance_bytes", {}, instances ? grown / instances : 0);
+}
+
+mp::HostCapacity mp::Daemon::host_capacity() const
+{
+    return {host_resources, overcommit_ratio(mp::cpu_overcommit_key), overcommit_ratio(mp::memory_overcommit_key),
+            overcommit_ratio(mp::disk_overcommit_key)};
+}
+
+// Every instance takes up its disk until it is purged, but only those that run take CPUs and memory
+mp::HostCapacity::Resources mp::Daemon::committed_resources()
+{
+    HostCapacity::Resources committed{0, 0, 0};
+    {
+        std::lock_guard<std::mutex> lock{persist_mutex};
+        for (const auto& item : vm_instance_specs)
+        {
+            const auto& specs = item.second;
+            if (specs.purged)
+                continue;
+
+            committed.disk_bytes += specs.disk_space.in_bytes();
+            if (takes_host_resources(specs.state))
+            {
+                committed.cpus += specs.num_cores;
+                committed.memory_bytes += specs.mem_size.in_bytes();
+            }
+        }
+    }
+
+    for (const auto& item : preparing_instances)
+    {
+        committed.cpus += item.second.cpus;
+        committed.memory_bytes += item.second.memory_bytes;
+        committed.disk_bytes += item.second.disk_bytes;
+    }
+
+    return committed;
+}
+
+void mp::Daemon::persist_state_for(const std::string& name, const VirtualMachine::State& state)
+{
+    forget_telemetry_for(name); // right away, so that guests still being queried do not store the previous state's
+
+    // Bulk operations report from their workers; the specs, sessions and forwards belong to the daemon thread
+    if (QThread::currentThread() != thread())
+    {
+        QMetaObject::invokeMethod(this, [this, name, state] { persist_state_for(name, state); }, Qt::QueuedConnection);
+        return;
+    }
+
+    if (!mp::utils::is_running(state))
+    {
+        ssh_sessions.drop(name);
+        port_forwarder.stop_all_for(name);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock{persist_mutex};
+        vm_instance_specs[name].state = state;
+        persist_instance(name);
+    }
+
+    // Nobody knows about these yet
+    if (warm_instances.find(name) == warm_instances.end() && template_instances.find(name) == template_instances.end())
+        notify_watchers(name, grpc_instance_status_for(state));
+}
+
+void mp::Daemon::notify_watchers(const std::string& name, InstanceStatus::Status status)
+{
+    WatchReply reply;
+    reply.set_instance_name(name);
+    reply.mutable_instance_status()->set_status(status);
+
+    // Only queued, each watcher writes on a thread of its own
+    std::lock_guard<std::mutex> lock{watchers_mutex};
+    for (auto it = watchers.begin(); it != watchers.end();)
+    {
+        if (it->second->push(reply))
+            ++it;
+        else
+            it = watchers.erase(it); // the client went away or fell too far behind
+    }
+}
+
+void mp::Daemon::update_metadata_for(const std::string& name, const QJsonObject& metadata)
+{
+    vm_instance_specs[name].metadata = metadata;
+
+    persist_instance(name);
+}
+
+QJsonObject mp::Daemon::retrieve_metadata_for(const std::string& name)
+{
+    return vm_instance_specs[name].metadata;
+}
+
+void mp::Daemon::persist_instances()
+{
+    // Only records that actually changed reach the disk
+    for (const auto& record : vm_instance_specs)
+        instance_db.put(QString::fromStdString(record.first), vm_spec_to_json(record.second));
+
+    for (const auto& key : instance_db.keys())
+        if (vm_instance_specs.find(key.toStdString()) == vm_instance_specs.end())
+            instance_db.remove(key);
+}
+
+void mp::Daemon::persist_instance(const std::string& name)
+{
+    auto it = vm_instance_specs.find(name);
+    if (it != vm_instance_specs.end())
+        instance_db.put(QString::fromStdString(name), vm_spec_to_json(it->second));
+}
+
+void mp::Daemon::release_resources(const std::string& instance)
+{
+    port_forwarder.stop_all_for(instance);
+    config->factory->remove_resources_for(instance);
+    config->vault->remove(instance);
+    vm_instance_specs.erase(instance);
+}
+
+std::string mp::Daemon::check_instance_operational(const std::string& instance_name) const
+{
+    if (vm_instances.find(instance_name) == std::cend(vm_instances))
+    {
+        if (deleted_instances.find(instance_name) == std::cend(deleted_instances))
+            return fmt::format("instance \"{}\" does not exist\n", instance_name);
+        else
+            return fmt::format("instance \"{}\" is deleted\n", instance_name);
+    }
+
+    return {};
+}
+
+std::string mp::Daemon::check_instance_exists(const std::string& instance_name) const
+{
+    if (vm_instances.find(instance_name) == std::cend(vm_instances) &&
+        deleted_instances.find(instance_name) == std::cend(deleted_instances))
+        return fmt::format("instance \"{}\" does not exist\n", instance_name);
+
+    return {};
+}
+
+void mp::Daemon::create_vm(const CreateRequest* request, grpc::ServerWriter<CreateReply>* server,
+                           std::promise<grpc::Status>* status_promise, bool start)
+{
+    auto checked_args = validate_create_arguments(request);
+
+    if (!checked_args.option_errors.error_codes().empty())
+    {
+        return status_promise->set_value(grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "Invalid arguments supplied",
+                                                      checked_args.option_errors.SerializeAsString()));
+    }
+
+    auto name = name_from(checked_args.instance_name, *config->name_generator, vm_instances);
+
+    if (vm_instances.find(name) != vm_instances.end() || deleted_instances.find(name) != deleted_instances.end() ||
+        purged_instances.find(name) != purged_instances.end() ||
+        warm_pool_images.find(name) != warm_pool_images.end() || template_images.find(name) != template_images.end())
+    {
+        CreateError create_error;
+        create_error.add_error_codes(CreateError::INSTANCE_EXISTS);
+
+        return status_promise->set_value(grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
+                                                      fmt::format("instance \"{}\" already exists", name),
+                                                      create_error.SerializeAsString()));
+    }
+
+    if (preparing_instances.find(name) != preparing_instances.end())
+    {
+        CreateError create_error;
+        create_error.add_error_codes(CreateError::INSTANCE_EXISTS);
+
+        return status_promise->set_value(grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
+                                                      fmt::format("instance \"{}\" is being prepared", name),
+                                                      create_error.SerializeAsString()));
+    }
+
+    // Instances that are only created take up their disk, and the rest once they are started
+    const auto num_cores = std::max(request->num_cores(), std::stoi(mp::min_cpu_cores));
+    const auto requested =
+        start ? HostCapacity::Resources{num_cores, checked_args.mem_size.in_bytes(), checked_args.disk_space.in_bytes()}
+              : HostCapacity::Resources{0, 0, checked_args.disk_space.in_bytes()};
+    const auto shortfall = host_capacity().shortfall(committed_resources(), requested);
+    if (!shortfall.empty())
+        return status_promise->set_value(grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED, shortfall, ""));
+
+    if (!instances_running(vm_instances))
+        config->factory->hypervisor_health_check();
+
+    preparing_instances.emplace(name, requested);
+
+    auto timings = std::make_shared<LaunchTimings>();
+    auto prepare_future_watcher = new QFutureWatcher<VirtualMachineDescription>();
+    // Progress is written from a thread of its own, alongside the messages of the preparation, and ahead of those
+    // that follow here; the stream takes one write at a time
+    auto write_mutex = std::make_shared<std::mutex>();
+
+    QObject::connect(
+        prepare_future_watcher, &QFutureWatcher<VirtualMachineDescription>::finished,
+        [this, server, status_promise, name, start, prepare_future_watcher, timings, write_mutex,
+         report_timings = request->timings()] {
+            try
+            {
+                auto vm_desc = prepare_future_watcher->future().result();
+
+                add_instance(name, vm_desc);
+                persist_instances();
+
+                if (start)
+                {
+                    LaunchReply reply;
+                    reply.set_create_message("Starting " + name);
+                    {
+                        std::lock_guard<std::mutex> lock{*write_mutex};
+                        server->Write(reply);
+                    }
+
+                    auto& vm = vm_instances[name];
+                    {
+                        auto phase = timings->time("start");
+                        vm->start();
+                    }
+
+                    {
+                        std::lock_guard<decltype(start_mutex)> lock{start_mutex};
+                        launch_timings[name] = timings;
+                    }
+
+                    auto future_watcher = create_future_watcher([this, server, name, report_timings, write_mutex] {
+                        LaunchReply reply;
+                        reply.set_vm_instance_name(name);
+                        config->update_prompt->populate_if_time_to_show(reply.mutable_update_info());
+                        report_launch_timings(name, report_timings, reply);
+                        std::lock_guard<std::mutex> lock{*write_mutex};
+                        server->Write(reply);
+                    });
+                    future_watcher->setFuture(QtConcurrent::run(this, &Daemon::async_wait_for_ready_all<LaunchReply>,
+                                                                server, std::vector<std::string>{name},
+                                                                status_promise));
+                }
+                else
+                {
+                    status_promise->set_value(grpc::Status::OK);
+                }
+            }
+            catch (const std::exception& e)
+            {
+                preparing_instances.erase(name);
+                release_resources(name);
+                vm_instances.erase(name);
+                persist_instances();
+                status_promise->set_value(grpc::Status(grpc::StatusCode::FAILED_PRECONDITION, e.what(), ""));
+            }
+
+            delete prepare_future_watcher;
+        });
+
+    prepare_future_watcher->setFuture(QtConcurrent::run(mp::Tracer::instance().carry(
+        "prepare instance",
+        [this, server, request, name, checked_args, timings, write_mutex]() -> VirtualMachineDescription {
+            ProgressCoalescer progress{[server, write_mutex](int progress_type, int percentage) {
+                CreateReply create_reply;
+                create_reply.mutable_launch_progress()->set_percent_complete(std::to_string(percentage));
+                create_reply.mutable_launch_progress()->set_type((CreateProgress::ProgressTypes)progress_type);
+                std::lock_guard<std::mutex> lock{*write_mutex};
+                return server->Write(create_reply);
+            }};
+
+            auto report = [server, write_mutex, &progress](const std::string& message) {
+                // Messages follow whatever progress led up to them
+                progress.flush();
+
+                CreateReply reply;
+                reply.set_create_message(message);
+                std::lock_guard<std::mutex> lock{*write_mutex};
+                server->Write(reply);
+            };
+
+            return prepare_instance(request, name, checked_args.mem_size, checked_args.disk_space, report,
+                                    progress.monitor(), *timings);
+        })));
+}
+
+void mp::Daemon::launch_many(const LaunchRequest* request, grpc::ServerWriter<LaunchReply>* server,
+                             std::promise<grpc::Status>* status_promise)
+{
+    auto checked_args = validate_create_arguments(request);
+
+    if (!checked_args.option_errors.error_codes().empty())
+    {
+        return status_promise->set_value(grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "Invalid arguments supplied",
+                                                      checked_args.option_errors.SerializeAsString()));
+    }
+
+    std::vector<std::string> names;
+    auto name_taken = [this, &names](const std::string& name) {
+        return vm_instances.count(name) || deleted_instances.count(name) || purged_instances.count(name) ||
+               warm_pool_images.count(name) || template_images.count(name) || preparing_instances.count(name) ||
+               std::find(names.cbegin(), names.cend(), name) != names.cend();
+    };
+
+    for (int i = 1; i <= request->count(); ++i)
+    {
+        if (!checked_args.instance_name.empty())
+        {
+            auto name = fmt::format("{}-{}", checked_args.instance_name, i);
+            if (name_taken(name))
+            {
+                CreateError create_error;
+                create_error.add_error_codes(CreateError::INSTANCE_EXISTS);
+
+                return status_promise->set_value(grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
+                                                              fmt::format("instance \"{}\" already exists", name),
+                                                              create_error.SerializeAsString()));
+            }
+            names.push_back(name);
+            continue;
+        }
+
+        constexpr int num_retries = 100;
+        auto name = config->name_generator->make_name();
+        for (int retry = 0; name_taken(name); ++retry)
+        {
+            if (retry == num_retries)
+                throw std::runtime_error("unable to generate a unique name");
+            name = config->name_generator->make_name();
+        }
+        names.push_back(name);
+    }
+
+    const auto num_cores = std::max(request->num_cores(), std::stoi(mp::min_cpu_cores));
+    const HostCapacity::Resources requested{num_cores, checked_args.mem_size.in_bytes(),
+                                            checked_args.disk_space.in_bytes()};
+    const auto count = static_cast<long long>(names.size());
+    const auto shortfall = host_capacity().shortfall(
+        committed_resources(), {static_cast<int>(num_cores * count), requested.memory_bytes * count,
+                                requested.disk_bytes * count});
+    if (!shortfall.empty())
+        return status_promise->set_value(grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED, shortfall, ""));
+
+    if (!instances_running(vm_instances))
+        config->factory->hypervisor_health_check();
+
+    for (const auto& name : names)
+        preparing_instances.emplace(name, requested);
+    {
+        std::lock_guard<decltype(start_mutex)> lock{start_mutex};
+        for (const auto& name : names)
+            launch_timings[name] = std::make_shared<LaunchTimings>();
+    }
+
+    // Instances are prepared and waited on together, so their replies have to take turns
+    auto write_mutex = std::make_shared<std::mutex>();
+    auto prepare_future_watcher = new QFutureWatcher<std::vector<PreparedInstance>>();
+
+    QObject::connect(
+        prepare_future_watcher, &QFutureWatcher<std::vector<PreparedInstance>>::finished,
+        [this, server, status_promise, prepare_future_watcher, write_mutex, report_timings = request->timings()] {
+            auto prepared = prepare_future_watcher->future().result();
+            delete prepare_future_watcher;
+
+            fmt::memory_buffer errors;
+            std::vector<std::string> started;
+            for (auto& instance : prepared)
+            {
+                const auto& name = instance.name;
+                preparing_instances.erase(name);
+
+                if (instance.error.empty())
+                {
+                    try
+                    {
+                        add_instance(name, instance.desc);
+
+                        std::shared_ptr<LaunchTimings> timings;
+                        {
+                            std::lock_guard<decltype(start_mutex)> lock{start_mutex};
+                            timings = launch_timings[name];
+                        }
+
+                        auto phase = timings->time("start");
+                        vm_instances[name]->start();
+                        started.push_back(name);
+                        continue;
+                    }
+                    catch (const std::exception& e)
+                    {
+                        instance.error = e.what();
+                    }
+                }
+
+                release_resources(name);
+                vm_instances.erase(name);
+                {
+                    std::lock_guard<decltype(start_mutex)> lock{start_mutex};
+                    launch_timings.erase(name);
+                }
+                fmt::format_to(errors, "{}: {}\n", name, instance.error);
+            }
+
+            persist_instances();
+
+            auto future_watcher = create_future_watcher();
+            future_watcher->setFuture(QtConcurrent::run([this, server, status_promise, write_mutex, report_timings,
+                                                         started, instance_errors = fmt::to_string(errors)] {
+                // Each instance is reported as soon as it is up, so the launch takes as long as the slowest one
+                std::vector<std::string> failures(started.size());
+                QFutureSynchronizer<void> ready_synchronizer;
+                for (std::size_t i = 0; i < started.size(); ++i)
+                {
+                    ready_synchronizer.addFuture(QtConcurrent::run([this, server, write_mutex, report_timings,
+                                                                    &started, &failures, i] {
+                        const auto& name = started[i];
+                        auto ready = async_wait_for_ready_all<LaunchReply>(nullptr, {name}, nullptr);
+
+                        LaunchReply reply;
+                        report_launch_timings(name, report_timings && ready.status.ok(), reply);
+                        if (!ready.status.ok())
+                        {
+                            failures[i] = fmt::format("{}: {}\n", name, ready.status.error_message());
+                            return;
+                        }
+
+                        reply.set_vm_instance_name(name);
+                        std::lock_guard<std::mutex> lock{*write_mutex};
+                        server->Write(reply);
+                    }));
+                }
+                ready_synchronizer.waitForFinished();
+
+                fmt::memory_buffer errors;
+                fmt::format_to(errors, "{}", instance_errors);
+                for (const auto& failure : failures)
+                    fmt::format_to(errors, "{}", failure);
+
+                auto error_string = fmt::to_string(errors);
+                if (!error_string.empty() && error_string.back() == '\n')
+                    error_string.pop_back();
+
+                return AsyncOperationStatus{error_string.empty()
+                                                ? grpc::Status::OK
+                                                : grpc::Status(grpc::StatusCode::FAILED_PRECONDITION, error_string, ""),
+                                            status_promise};
+            }));
+        });
+
+    prepare_future_watcher->setFuture(QtConcurrent::run([this, server, request, names, checked_args, write_mutex] {
+        ProgressCoalescer progress{[server, write_mutex](int progress_type, int percentage) {
+            CreateReply create_reply;
+            create_reply.mutable_launch_progress()->set_percent_complete(std::to_string(percentage));
+            create_reply.mutable_launch_progress()->set_type((CreateProgress::ProgressTypes)progress_type);
+            std::lock_guard<std::mutex> lock{*write_mutex};
+            return server->Write(create_reply);
+        }};
+        auto progress_monitor = progress.monitor();
+
+        auto report = [server, write_mutex, &progress](const std::string& message) {
+            progress.flush();
+
+            CreateReply reply;
+            reply.set_create_message(message);
+            std::lock_guard<std::mutex> lock{*write_mutex};
+            server->Write(reply);
+        };
+
+        std::vector<PreparedInstance> prepared(names.size());
+        auto prepare = [&](std::size_t i) {
+            auto& instance = prepared[i];
+            instance.name = names[i];
+
+            std::shared_ptr<LaunchTimings> timings;
+            {
+                std::lock_guard<decltype(start_mutex)> lock{start_mutex};
+                timings = launch_timings[instance.name];
+            }
+
+            try
+            {
+                instance.desc = prepare_instance(request, instance.name, checked_args.mem_size,
+                                                 checked_args.disk_space, report, progress_monitor, *timings);
+            }
+            catch (const std::exception& e)
+            {
+                instance.error = e.what();
+            }
+        };
+
+        // The first instance fetches the image into the cache, where the others find it ready
+        prepare(0);
+        if (!prepared[0].error.empty())
+        {
+            for (std::size_t i = 1; i < prepared.size(); ++i)
+                prepared[i] = {names[i], {}, prepared[0].error};
+            return prepared;
+        }
+
+        QThreadPool workers;
+        workers.setMaxThreadCount(std::max(1, Settings::instance().get(parallel_operations_key).toInt()));
+        QFutureSynchronizer<void> prepare_synchronizer;
+        for (std::size_t i = 1; i < names.size(); ++i)
+            prepare_synchronizer.addFuture(QtConcurrent::run(&workers, [&prepare, i] { prepare(i); }));
+        prepare_synchronizer.waitForFinished();
+
+        return prepared;
+    }));
+}
+
+void mp::Daemon::add_instance(const std::string& name, const VirtualMachineDescription& vm_desc)
+{
+    vm_instances[name] = config->factory->create_virtual_machine(vm_desc, *this);
+    vm_instance_specs[name] = {vm_desc.num_cores,
+                               vm_desc.mem_size,
+                               vm_desc.disk_space,
+                               vm_desc.mac_addr,
+                               config->ssh_username,
+                               VirtualMachine::State::off,
+                               {},
+                               false,
+                               QJsonObject(),
+                               vm_desc.disk_profile,
+                               vm_desc.hugepages,
+                               vm_desc.resource_class,
+                               vm_desc.throttle};
+    preparing_instances.erase(name);
+}
+
+mp::VirtualMachineDescription mp::Daemon::prepare_instance(const CreateRequest* request, const std::string& name,
+                                                           const MemorySize& mem_size, const MemorySize& disk_space,
+                                                           const std::function<void(const std::string&)>& report,
+                                                           const ProgressMonitor& monitor,
+                                                           LaunchTimings& timings) // clang-format off
+try // clang-format on
+{
+    auto query = query_from(request, name);
+
+    auto prepare_action = [this, &report, &name](const VMImage& source_image) -> VMImage {
+        report("Preparing image for " + name);
+        return config->factory->prepare_source_image(source_image);
+    };
+
+    auto fetch_type = config->factory->fetch_type();
+
+    report("Creating " + name);
+
+    // Nothing depends on the image until the description is put together, so the cloud-init ISO is written meanwhile
+    VMImage vm_image;
+    std::string mac_addr;
+    CloudInitIso cloud_init_iso;
+    VirtualMachineDescription vm_desc;
+    TaskGraph launch;
+
+    auto fetch = launch.add("fetch_image", TaskGraph::Work::blocking, [&] {
+        auto phase = timings.time("fetch_image");
+        vm_image = config->vault->fetch_image(fetch_type, query, prepare_action, monitor);
+    });
+
+    auto configure = launch.add("cloud_init", TaskGraph::Work::compute, [&] {
+        auto vendor_data_cloud_init_config =
+            make_cloud_init_vendor_config(*config->ssh_key_provider, request->time_zone(), config->ssh_username,
+                                          config->factory->get_backend_version_string().toStdString(),
+                                          package_cache ? package_cache->port() : 0);
+        auto meta_data_cloud_init_config = make_cloud_init_meta_config(name);
+        if (config->vault->is_baked_image(query))
+            reset_machine_id(vendor_data_cloud_init_config);
+        auto user_data_cloud_init_config = YAML::Load(request->cloud_init_user_data());
+        config->factory->configure(name, meta_data_cloud_init_config, vendor_data_cloud_init_config);
+        prepare_user_data(user_data_cloud_init_config, vendor_data_cloud_init_config);
+        cloud_init_iso = make_cloud_init_iso(meta_data_cloud_init_config, user_data_cloud_init_config,
+                                             vendor_data_cloud_init_config);
+
+        mac_addr = allocate_mac_addr();
+    });
+
+    auto describe = launch.add(
+        "describe", TaskGraph::Work::compute,
+        [&] {
+            report("Configuring " + name);
+            auto phase = timings.time("cloud_init_iso");
+            vm_desc = to_machine_desc(request, name, mem_size, disk_space, mac_addr, config->ssh_username, vm_image,
+                                      cloud_init_iso);
+        },
+        {fetch, configure});
+
+    launch.add(
+        "instance_image", TaskGraph::Work::blocking,
+        [&] {
+            auto phase = timings.time("instance_image");
+            config->factory->prepare_instance_image(vm_image, vm_desc);
+        },
+        {describe});
+
+    try
+    {
+        launch.run();
+    }
+    catch (...)
+    {
+        if (!mac_addr.empty())
+        {
+            std::lock_guard<std::mutex> mac_addr_lock{mac_addr_mutex};
+            allocated_mac_addrs.erase(mac_addr);
+        }
+        throw;
+    }
+
+    return vm_desc;
+}
+catch (const std::exception& e)
+{
+    throw CreateImageException(e.what());
+}
+
+std::string mp::Daemon::allocate_mac_addr()
+{
+    std::lock_guard<std::mutex> mac_addr_lock{mac_addr_mutex}; // instances of a bulk launch are prepared together
+    while (true)
+    {
+        auto mac_addr = mp::utils::generate_mac_address();
+
+        auto it = allocated_mac_addrs.find(mac_addr);
+        if (it == allocated_mac_addrs.end())
+        {
+            allocated_mac_addrs.insert(mac_addr);
+            return mac_addr;
+        }
+    }
+}
+
+bool mp::Daemon::claim_warm_instance(const LaunchRequest* request, grpc::ServerWriter<LaunchReply>* server,
+                                     std::promise<grpc::Status>* status_promise)
+{
+    if (!can_use_warm_instance(request))
+        return false;
+
+    const auto image = request->image().empty() ? std::string{"default"} : request->image();
+    auto it = std::find_if(warm_instances.begin(), warm_instances.end(),
+                           [this, &image](const std::pair<const std::string, VirtualMachine::ShPtr>& warm_instance) {
+                               return warm_pool_images[warm_instance.first] == image;
+                           });
+    if (it == warm_instances.end())
+        return false;
+
+    const auto name = it->first;
+    vm_instances[name] = std::move(it->second);
+    warm_instances.erase(it);
+    warm_pool_images.erase(name);
+    persist_warm_pool();
+
+    mpl::log(mpl::Level::debug, category, fmt::format("Launching {} from the warm pool", name));
+
+    LaunchReply reply;
+    reply.set_create_message("Starting " + name);
+    server->Write(reply);
+
+    auto timings = std::make_shared<LaunchTimings>();
+    auto& vm = vm_instances[name];
+    if (vm->current_state() != VirtualMachine::State::running && vm->current_state() != VirtualMachine::State::starting)
+    {
+        auto phase = timings->time("start");
+        vm->start();
+    }
+
+    {
+        std::lock_guard<decltype(start_mutex)> lock{start_mutex};
+        launch_timings[name] = timings;
+    }
+
+    auto future_watcher = create_future_watcher([this, server, name, report_timings = request->timings()] {
+        LaunchReply reply;
+        reply.set_vm_instance_name(name);
+        config->update_prompt->populate_if_time_to_show(reply.mutable_update_info());
+        report_launch_timings(name, report_timings, reply);
+        server->Write(reply);
+    });
+    future_watcher->setFuture(QtConcurrent::run(this, &Daemon::async_wait_for_ready_all<LaunchReply>, server,
+                                                std::vector<std::string>{name}, status_promise));
+
+    replenish_warm_pool();
+
+    return true;
+}
+
+void mp::Daemon::create_warm_instance(const std::string& image)
+{
+    std::string name;
+    do
+    {
+        name = config->name_generator->make_name();
+    } while (vm_instances.find(name) != vm_instances.end() || deleted_instances.find(name) != deleted_instances.end() ||
+             purged_instances.find(name) != purged_instances.end() ||
+             warm_pool_images.find(name) != warm_pool_images.end() ||
+             template_images.find(name) != template_images.end() ||
+             preparing_instances.find(name) != preparing_instances.end());
+
+    auto request = std::make_shared<LaunchRequest>();
+    if (image != "default")
+        request->set_image(image);
+    request->set_time_zone(QTimeZone::systemTimeZoneId().toStdString());
+
+    // Spare instances are no reason to turn launches away later
+    const HostCapacity::Resources requested{std::stoi(mp::default_cpu_cores),
+                                            MemorySize{mp::default_memory_size}.in_bytes(),
+                                            MemorySize{mp::default_disk_size}.in_bytes()};
+    const auto shortfall = host_capacity().shortfall(committed_resources(), requested);
+    if (!shortfall.empty())
+    {
+        mpl::log(mpl::Level::info, category, fmt::format("Not adding to the warm pool: {}", shortfall));
+        return;
+    }
+
+    preparing_instances.emplace(name, requested);
+    warm_pool_images[name] = image;
+
+    auto prepare_future_watcher = new QFutureWatcher<VirtualMachineDescription>();
+
+    QObject::connect(
+        prepare_future_watcher, &QFutureWatcher<VirtualMachineDescription>::finished,
+        [this, name, prepare_future_watcher] {
+            try
+            {
+                auto vm_desc = prepare_future_watcher->future().result();
+
+                warm_instances[name] = config->factory->create_virtual_machine(vm_desc, *this);
+                vm_instance_specs[name] = {vm_desc.num_cores,
+                                           vm_desc.mem_size,
+                                           vm_desc.disk_space,
+                                           vm_desc.mac_addr,
+                                           config->ssh_username,
+                                           VirtualMachine::State::off,
+                                           {},
+                                           false,
+                                           QJsonObject(),
+                                           vm_desc.disk_profile,
+                                           vm_desc.hugepages,
+                                           vm_desc.resource_class};
+                preparing_instances.erase(name);
+
+                persist_instances();
+                persist_warm_pool();
+
+                mpl::log(mpl::Level::info, category, fmt::format("Starting {} for the warm pool", name));
+                warm_instances[name]->start();
+            }
+            catch (const std::exception& e)
+            {
+                mpl::log(mpl::Level::warning, category,
+                         fmt::format("Cannot add {} to the warm pool: {}", name, e.what()));
+                preparing_instances.erase(name);
+                warm_pool_images.erase(name);
+                release_resources(name);
+                warm_instances.erase(name);
+                persist_instances();
+                persist_warm_pool();
+            }
+
+            delete prepare_future_watcher;
+        });
+
+    prepare_future_watcher->setFuture(QtConcurrent::run([this, request, name]() -> VirtualMachineDescription {
+        auto report = [](const std::string& message) {
+            mpl::log(mpl::Level::debug, category, fmt::format("Warm pool: {}", message));
+        };
+        auto progress_monitor = [](int /*progress_type*/, int /*percentage*/) { return true; };
+        LaunchTimings timings; // nobody waits on this launch
+
+        return prepare_instance(request.get(), name, MemorySize{default_memory_size}, MemorySize{default_disk_size},
+                                report, progress_monitor, timings);
+    }));
+}
+
+void mp::Daemon::replenish_warm_pool()
+{
+    std::map<std::string, int> pool;
+    try
+    {
+        pool = mp::utils::parse_warm_pool(Settings::instance().get(warm_pool_key));
+    }
+    catch (const std::exception& e)
+    {
+        mpl::log(mpl::Level::warning, category, fmt::format("Ignoring warm pool setting: {}", e.what()));
+        return;
+    }
+
+    std::map<std::string, int> pool_members;
+    for (const auto& member : warm_pool_images)
+        ++pool_members[member.second];
+
+    // Retire ready warm instances the pool no longer asks for
+    auto retired = false;
+    for (auto it = warm_instances.begin(); it != warm_instances.end();)
+    {
+        const auto name = it->first;
+        auto& count = pool_members[warm_pool_images[name]];
+        if (count > pool[warm_pool_images[name]])
+        {
+            --count;
+            mpl::log(mpl::Level::info, category, fmt::format("Removing {} from the warm pool", name));
+            it->second->shutdown();
+            release_resources(name);
+            warm_pool_images.erase(name);
+            it = warm_instances.erase(it);
+            retired = true;
+        }
+        else
+            ++it;
+    }
+
+    if (retired)
+    {
+        persist_instances();
+        persist_warm_pool();
+    }
+
+    for (const auto& entry : pool)
+        for (auto count = pool_members[entry.first]; count < entry.second; ++count)
+            create_warm_instance(entry.first);
+}
+
+void mp::Daemon::persist_warm_pool()
+{
+    QJsonObject warm_pool_json;
+    for (const auto& member : warm_pool_images)
+    {
+        if (warm_instances.find(member.first) != warm_instances.end()) // still preparing ones are not resumable
+            warm_pool_json.insert(QString::fromStdString(member.first), QString::fromStdString(member.second));
+    }
+
+    QDir data_dir{
+        mp::utils::backend_directory_path(config->data_directory, config->factory->get_backend_directory_name())};
+    mp::write_json(warm_pool_json, data_dir.filePath(warm_pool_db_name));
+}
+
+bool mp::Daemon::claim_template_clone(const LaunchRequest* request, grpc::ServerWriter<LaunchReply>* server,
+                                      std::promise<grpc::Status>* status_promise)
+{
+    if (!asks_for_defaults(request))
+        return false;
+
+    const auto image = request->image().empty() ? std::string{"default"} : request->image();
+    auto it = std::find_if(saved_templates.begin(), saved_templates.end(),
+                           [this, &image](const std::string& name) { return template_images[name] == image; });
+    if (it == saved_templates.end())
+        return false;
+
+    // Names taken and shortfalls are for the usual launch to report
+    const auto template_name = *it;
+    const auto name = name_from(request->instance_name(), *config->name_generator, vm_instances);
+    if (vm_instances.find(name) != vm_instances.end() || deleted_instances.find(name) != deleted_instances.end() ||
+        purged_instances.find(name) != purged_instances.end() ||
+        warm_pool_images.find(name) != warm_pool_images.end() ||
+        template_images.find(name) != template_images.end() ||
+        preparing_instances.find(name) != preparing_instances.end())
+        return false;
+
+    const auto& template_specs = vm_instance_specs[template_name];
+    const HostCapacity::Resources requested{template_specs.num_cores, template_specs.mem_size.in_bytes(),
+                                            template_specs.disk_space.in_bytes()};
+    if (!host_capacity().shortfall(committed_resources(), requested).empty())
+        return false;
+
+    mpl::log(mpl::Level::debug, category, fmt::format("Launching {} from memory template {}", name, template_name));
+
+    auto timings = std::make_shared<LaunchTimings>();
+    const auto mac_addr = allocate_mac_addr();
+    try
+    {
+        {
+            auto phase = timings->time("clone");
+            auto vm_image = config->vault->clone_template_image(template_name, name);
+
+            // The instance takes its identity over from the template's once it is up; the new instance-id is for
+            // cloud-init to do the same when it next boots from its own disk
+            auto vendor_data_cloud_init_config =
+                make_cloud_init_vendor_config(*config->ssh_key_provider, QTimeZone::systemTimeZoneId().toStdString(),
+                                              template_specs.ssh_username,
+                                              config->factory->get_backend_version_string().toStdString(),
+                                              package_cache ? package_cache->port() : 0);
+            auto meta_data_cloud_init_config = make_cloud_init_meta_config(name);
+            auto user_data_cloud_init_config = YAML::Load("");
+            config->factory->configure(name, meta_data_cloud_init_config, vendor_data_cloud_init_config);
+            auto cloud_init_iso = make_cloud_init_iso(meta_data_cloud_init_config, user_data_cloud_init_config,
+                                                      vendor_data_cloud_init_config);
+
+            VirtualMachineDescription vm_desc{template_specs.num_cores,
+                                              template_specs.mem_size,
+                                              template_specs.disk_space,
+                                              name,
+                                              mac_addr,
+                                              template_specs.ssh_username,
+                                              vm_image,
+                                              make_cloud_init_image(mp::utils::base_dir(vm_image.image_path),
+                                                                    cloud_init_iso),
+                                              template_specs.disk_profile,
+                                              template_specs.hugepages,
+                                              template_specs.resource_class,
+                                              template_specs.throttle};
+            vm_desc.memory_template_dir =
+                mp::utils::base_dir(fetch_image_for(template_name, config->factory->fetch_type(), *config->vault)
+                                        .image_path)
+                    .path();
+
+            add_instance(name, vm_desc);
+            persist_instances();
+        }
+
+        LaunchReply reply;
+        reply.set_create_message("Starting " + name);
+        server->Write(reply);
+
+        auto phase = timings->time("start");
+        vm_instances[name]->start();
+    }
+    catch (const std::exception& e)
+    {
+        // Nothing of the clone is left behind, on disk or in the database, for the usual launch to start over
+        mpl::log(mpl::Level::warning, category,
+                 fmt::format("Cannot launch {} from memory template {}: {}", name, template_name, e.what()));
+        {
+            std::lock_guard<std::mutex> mac_addr_lock{mac_addr_mutex};
+            allocated_mac_addrs.erase(mac_addr);
+        }
+        vm_instances.erase(name);
+        release_resources(name);
+        persist_instances();
+        return false;
+    }
+
+    {
+        std::lock_guard<decltype(start_mutex)> lock{start_mutex};
+        launch_timings[name] = timings;
+    }
+
+    auto future_watcher = create_future_watcher([this, server, name, report_timings = request->timings()] {
+        LaunchReply reply;
+        reply.set_vm_instance_name(name);
+        config->update_prompt->populate_if_time_to_show(reply.mutable_update_info());
+        report_launch_timings(name, report_timings, reply);
+        server->Write(reply);
+    });
+    future_watcher->setFuture(QtConcurrent::run(this, &Daemon::async_wait_for_ready_all<LaunchReply>, server,
+                                                std::vector<std::string>{name}, status_promise));
+
+    return true;
+}
+
+void mp::Daemon::create_memory_template(const std::string& image)
+{
+    std::string name;
+    do
+    {
+        name = config->name_generator->make_name();
+    } while (vm_instances.find(name) != vm_instances.end() || deleted_instances.find(name) != deleted_instances.end() ||
+             purged_instances.find(name) != purged_instances.end() ||
+             warm_pool_images.find(name) != warm_pool_images.end() ||
+             template_images.find(name) != template_images.end() ||
+             preparing_instances.find(name) != preparing_instances.end());
+
+    // The agent is what clones are taken over from the template through
+    auto request = std::make_shared<LaunchRequest>();
+    if (image != "default")
+        request->set_image(image);
+    request->set_time_zone(QTimeZone::systemTimeZoneId().toStdString());
+    request->set_cloud_init_user_data("packages: [qemu-guest-agent]\n"
+                                      "runcmd: [[systemctl, start, qemu-guest-agent]]\n");
+
+    const HostCapacity::Resources requested{std::stoi(mp::default_cpu_cores),
+                                            MemorySize{mp::default_memory_size}.in_bytes(),
+                                            MemorySize{mp::default_disk_size}.in_bytes()};
+    const auto shortfall = host_capacity().shortfall(committed_resources(), requested);
+    if (!shortfall.empty())
+    {
+        mpl::log(mpl::Level::info, category, fmt::format("Not booting a memory template: {}", shortfall));
+        return;
+    }
+
+    preparing_instances.emplace(name, requested);
+    template_images[name] = image;
+
+    auto forget_template = [this](const std::string& name) {
+        preparing_instances.erase(name);
+        template_images.erase(name);
+        saved_templates.erase(name);
+        release_resources(name);
+        template_instances.erase(name);
+        persist_instances();
+        persist_memory_templates();
+    };
+
+    auto prepare_future_watcher = new QFutureWatcher<VirtualMachineDescription>();
+
+    QObject::connect(
+        prepare_future_watcher, &QFutureWatcher<VirtualMachineDescription>::finished,
+        [this, name, prepare_future_watcher, forget_template] {
+            try
+            {
+                auto vm_desc = prepare_future_watcher->future().result();
+                vm_desc.memory_template = true;
+
+                template_instances[name] = config->factory->create_virtual_machine(vm_desc, *this);
+                vm_instance_specs[name] = {vm_desc.num_cores,
+                                           vm_desc.mem_size,
+                                           vm_desc.disk_space,
+                                           vm_desc.mac_addr,
+                                           config->ssh_username,
+                                           VirtualMachine::State::off,
+                                           {},
+                                           false,
+                                           QJsonObject(),
+                                           vm_desc.disk_profile,
+                                           vm_desc.hugepages,
+                                           vm_desc.resource_class};
+                preparing_instances.erase(name);
+
+                persist_instances();
+                persist_memory_templates();
+
+                mpl::log(mpl::Level::info, category, fmt::format("Booting {} for a memory template", name));
+                auto vm = template_instances[name];
+                vm->start();
+
+                // Its memory is only saved once cloud-init is done with the guest, for clones to find it so too
+                auto boot_future_watcher = new QFutureWatcher<std::string>();
+                QObject::connect(boot_future_watcher, &QFutureWatcher<std::string>::finished,
+                                 [this, name, vm, boot_future_watcher, forget_template] {
+                                     const auto error = boot_future_watcher->future().result();
+                                     delete boot_future_watcher;
+
+                                     auto it = template_instances.find(name);
+                                     if (it == template_instances.end() || it->second != vm)
+                                         return; // retired while it booted
+
+                                     if (error.empty() && vm->save_memory_template())
+                                     {
+                                         mpl::log(mpl::Level::info, category,
+                                                  fmt::format("Saved memory template {}", name));
+                                         saved_templates.insert(name);
+                                         persist_memory_templates();
+                                         return;
+                                     }
+
+                                     mpl::log(mpl::Level::warning, category,
+                                              fmt::format("Cannot save memory template {}{}", name,
+                                                          error.empty() ? "" : ": " + error));
+                                     vm->shutdown();
+                                     forget_template(name);
+                                 });
+                boot_future_watcher->setFuture(QtConcurrent::run([this, vm]() -> std::string {
+                    try
+                    {
+                        vm->ssh_hostname();
+                        vm->wait_until_ssh_up(up_timeout);
+                        mp::utils::wait_for_cloud_init(vm.get(), cloud_init_timeout, *config->ssh_key_provider);
+                        return {};
+                    }
+                    catch (const std::exception& e)
+                    {
+                        return e.what();
+                    }
+                }));
+            }
+            catch (const std::exception& e)
+            {
+                mpl::log(mpl::Level::warning, category,
+                         fmt::format("Cannot boot {} for a memory template: {}", name, e.what()));
+                forget_template(name);
+            }
+
+            delete prepare_future_watcher;
+        });
+
+    prepare_future_watcher->setFuture(QtConcurrent::run([this, request, name]() -> VirtualMachineDescription {
+        auto report = [](const std::string& message) {
+            mpl::log(mpl::Level::debug, category, fmt::format("Memory template: {}", message));
+        };
+        auto progress_monitor = [](int /*progress_type*/, int /*percentage*/) { return true; };
+        LaunchTimings timings; // nobody waits on this launch
+
+        return prepare_instance(request.get(), name, MemorySize{default_memory_size}, MemorySize{default_disk_size},
+                                report, progress_monitor, timings);
+    }));
+}
+
+void mp::Daemon::replenish_memory_templates()
+{
+    std::unordered_set<std::string> images;
+    for (const auto& image : Settings::instance().get(memory_templates_key).split(',', QString::SkipEmptyParts))
+        images.insert(image.trimmed().toStdString());
+
+    // Retire the templates of images no longer asked for; their clones go on from their own disks
+    auto retired = false;
+    for (auto it = template_instances.begin(); it != template_instances.end();)
+    {
+        const auto name = it->first;
+        if (images.count(template_images[name]))
+        {
+            ++it;
+            continue;
+        }
+
+        mpl::log(mpl::Level::info, category, fmt::format("Removing memory template {}", name));
+        it->second->shutdown();
+        release_resources(name);
+        template_images.erase(name);
+        saved_templates.erase(name);
+        it = template_instances.erase(it);
+        retired = true;
+    }
+
+    if (retired)
+    {
+        persist_instances();
+        persist_memory_templates();
+    }
+
+    std::unordered_set<std::string> templated;
+    for (const auto& memory_template : template_images)
+        templated.insert(memory_template.second);
+
+    for (const auto& image : images)
+        if (!templated.count(image))
+            create_memory_template(image);
+}
+
+void mp::Daemon::persist_memory_templates()
+{
+    QJsonObject memory_templates_json;
+    for (const auto& memory_template : template_images)
+    {
+        const auto& name = memory_template.first;
+        if (template_instances.find(name) != template_instances.end()) // still preparing ones are not resumable
+            memory_templates_json.insert(
+                QString::fromStdString(name),
+                QJsonObject{{"image", QString::fromStdString(memory_template.second)},
+                            {"saved", saved_templates.find(name) != saved_templates.end()}});
+    }
+
+    QDir data_dir{
+        mp::utils::backend_directory_path(config->data_directory, config->factory->get_backend_directory_name())};
+    mp::write_json(memory_templates_json, data_dir.filePath(memory_templates_db_name));
+}
+
+grpc::Status mp::Daemon::reboot_vm(VirtualMachine& vm)
+{
+    if (!mp::utils::is_running(vm.current_state()))
+        return grpc::Status{grpc::StatusCode::INVALID_ARGUMENT,
+                            fmt::format("instance \"{}\" is not running", vm.vm_name), ""};
+
+    mpl::log(mpl::Level::debug, category, fmt::format("Rebooting {}", vm.vm_name));
+    auto status = [this, &vm] {
+        auto session = ssh_sessions.acquire(vm.vm_name, vm.ssh_hostname(), vm.ssh_port(), vm.ssh_username());
+        return ssh_reboot(*session);
+    }();
+
+    ssh_sessions.drop(vm.vm_name); // the pooled session does not survive the reboot
+    return status;
+}
+
+grpc::Status mp::Daemon::shutdown_vm(VirtualMachine& vm, const std::chrono::milliseconds delay)
+{
+    const auto& name = vm.vm_name;
+    const auto& state = vm.current_state();
+
+    using St = VirtualMachine::State;
+    const auto skip_states = {St::off, St::stopped, St::suspended};
+
+    if (std::none_of(cbegin(skip_states), cend(skip_states), [&state](const auto& st) { return state == st; }))
+    {
+        delayed_shutdown_instances.erase(name);
+
+        mp::optional<mp::SSHSession> session;
+        try
+        {
+            session = mp::SSHSession{vm.ssh_hostname(), vm.ssh_port(), vm.ssh_username(), *config->ssh_key_provider};
+        }
+        catch (const std::exception& e)
+        {
+            mpl::log(mpl::Level::info, category,
+                     fmt::format("Cannot open ssh session on \"{}\" shutdown: {}", name, e.what()));
+        }
+
+        auto& shutdown_timer = delayed_shutdown_instances[name] = std::make_unique<DelayedShutdownTimer>(
+            &vm, std::move(session),
+            std::bind(&SSHFSMounts::stop_all_mounts_for_instance, &instance_mounts, std::placeholders::_1));
+
+        QObject::connect(shutdown_timer.get(), &DelayedShutdownTimer::finished,
+                         [this, name]() { delayed_shutdown_instances.erase(name); });
+
+        shutdown_timer->start(delay);
+    }
+    else
+        mpl::log(mpl::Level::debug, category, fmt::format("instance \"{}\" does not need stopping", name));
+
+    return grpc::Status::OK;
+}
+
+grpc::Status mp::Daemon::shutdown_vm_now(VirtualMachine& vm)
+{
+    const auto& name = vm.vm_name;
+    const auto& state = vm.current_state();
+    if (state == VirtualMachine::State::off || state == VirtualMachine::State::stopped ||
+        state == VirtualMachine::State::suspended)
+    {
+        mpl::log(mpl::Level::debug, category, fmt::format("instance \"{}\" does not need stopping", name));
+        return grpc::Status::OK;
+    }
+
+    mp::optional<mp::SSHSession> session;
+    try
+    {
+        session = mp::SSHSession{vm.ssh_hostname(), vm.ssh_port(), vm.ssh_username(), *config->ssh_key_provider};
+    }
+    catch (const std::exception& e)
+    {
+        mpl::log(mpl::Level::info, category,
+                 fmt::format("Cannot open ssh session on \"{}\" shutdown: {}", name, e.what()));
+    }
+
+    // Not kept around, as nothing is left to cancel once it has started
+    DelayedShutdownTimer shutdown_timer{
+        &vm, std::move(session),
+        std::bind(&SSHFSMounts::stop_all_mounts_for_instance, &instance_mounts, std::placeholders::_1)};
+    shutdown_timer.start(std::chrono::milliseconds::zero());
+
+    return grpc::Status::OK;
+}
+
+grpc::Status mp::Daemon::cancel_vm_shutdown(const VirtualMachine& vm)
+{
+    auto it = delayed_shutdown_instances.find(vm.vm_name);
+    if (it != delayed_shutdown_instances.end())
+        delayed_shutdown_instances.erase(it);
+    else
+        mpl::log(mpl::Level::debug, category,
+                 fmt::format("no delayed shutdown to cancel on instance \"{}\"", vm.vm_name));
+
+    return grpc::Status::OK;
+}
+
+template <typename Reply>
+grpc::Status mp::Daemon::cmd_vms(const std::vector<std::string>& tgts, std::function<grpc::Status(VirtualMachine&)> cmd,
+                                 grpc::ServerWriter<Reply>* server, const std::string& done_message,
+                                 bool drives_backend)
+{
+    // Up to the configured number of targets go at once, so that the lot takes about as long as the slowest one.
+    // Backends that must be driven from the daemon thread are worked through here meanwhile
+    QThreadPool workers;
+    workers.setMaxThreadCount(std::max(1, Settings::instance().get(parallel_operations_key).toInt()));
+
+    std::mutex reply_mutex;
+    std::size_t done{0};
+    auto run_cmd = [this, &cmd, &tgts, server, &done_message, &reply_mutex, &done](VirtualMachine& vm) {
+        grpc::Status status;
+        try
+        {
+            status = cmd(vm);
+        }
+        catch (const std::exception& e)
+        {
+            status = grpc::Status(grpc::StatusCode::FAILED_PRECONDITION, e.what(), "");
+        }
+
+        std::lock_guard<std::mutex> lock{reply_mutex};
+        ++done;
+        if (server && status.ok())
+        {
+            Reply reply;
+            reply.set_reply_message(fmt::format("{} {} ({}/{})", done_message, vm.vm_name, done, tgts.size()));
+            server->Write(reply);
+        }
+
+        return status;
+    };
+
+    std::vector<QFuture<grpc::Status>> futures;
+    std::vector<VirtualMachine::ShPtr> on_daemon_thread;
+    for (const auto& tgt : tgts)
+    {
+        auto vm = vm_instances.at(tgt);
+        if (drives_backend && !vm->lifecycle_is_thread_safe())
+            on_daemon_thread.push_back(vm);
+        else
+            futures.push_back(QtConcurrent::run(&workers, [&run_cmd, vm] { return run_cmd(*vm); }));
+    }
+
+    std::vector<grpc::Status> statuses;
+    for (const auto& vm : on_daemon_thread)
+        statuses.push_back(run_cmd(*vm));
+
+    for (auto& future : futures)
+        statuses.push_back(future.result());
+
+    auto failure = std::find_if(statuses.cbegin(), statuses.cend(), [](const auto& status) { return !status.ok(); });
+    return failure != statuses.cend() ? *failure : grpc::Status::OK;
+}
+
+void mp::Daemon::install_sshfs(VirtualMachine* vm, const std::string& name)
+{
+    auto session = ssh_sessions.acquire(name, vm->ssh_hostname(), vm->ssh_port(), vm->ssh_username());
+
+    mpl::log(mpl::Level::info, category, fmt::format("Installing sshfs in \'{}\'", name));
+
+    const auto packages_dir = sshfs_packages_dir_for(*session, config->cache_directory);
+    std::unique_ptr<mp::SFTPClient> sftp;
+    std::string guest_dir;
+    auto remove_guest_dir = [&session, &guest_dir] {
+        if (!guest_dir.empty())
+            session->exec(fmt::format("rm -rf {}", guest_dir)).exit_code();
+    };
+
+    if (!packages_dir.isEmpty())
+    {
+        try
+        {
+            sftp = std::make_unique<mp::SFTPClient>(vm->ssh_hostname(), vm->ssh_port(), vm->ssh_username(),
+                                                    config->ssh_key_provider->private_key_as_base64());
+            guest_dir = make_guest_sshfs_packages_dir(*session);
+            if (install_cached_sshfs(*session, *sftp, guest_dir, packages_dir))
+            {
+                remove_guest_dir();
+                return;
+            }
+        }
+        catch (const std::exception& e)
+        {
+            mpl::log(mpl::Level::debug, category,
+                     fmt::format("Cannot install the cached sshfs packages: {}", e.what()));
+        }
+
+        // Whatever is cached no longer fits the instance's release or was tampered with, apt brings in what does
+        QDir{packages_dir}.removeRecursively();
+        if (!guest_dir.empty())
+            session->exec(fmt::format("rm -f {0}/*.deb {0}/{1}", guest_dir, sshfs_packages_sums)).exit_code();
+    }
+
+    const auto record_installed =
+        guest_dir.empty() ? std::string{}
+                          : fmt::format("dpkg-query -W -f='${{Package}}\\n' | sort > {}/{}; ", guest_dir,
+                                        guest_sshfs_installed_list);
+    int retries{0};
+    while (++retries <= max_install_sshfs_retries)
+    {
+        try
+        {
+            auto proc = session->exec(record_installed + "sudo apt update && sudo apt install -y sshfs");
+            if (proc.exit_code(std::chrono::minutes(5)) != 0)
+            {
+                auto error_msg = proc.read_std_error();
+                mpl::log(mpl::Level::warning, category,
+                         fmt::format("Failed to install 'sshfs', error message: '{}'", mp::utils::trim_end(error_msg)));
+            }
+            else
+            {
+                break;
+            }
+        }
+        catch (const mp::ExitlessSSHProcessException&)
+        {
+            mpl::log(mpl::Level::info, category, fmt::format("Timeout while installing 'sshfs' in '{}'", name));
+        }
+    }
+
+    if (retries > max_install_sshfs_retries)
+    {
+        remove_guest_dir();
+        throw mp::SSHFSMissingError();
+    }
+
+    if (!sftp || guest_dir.empty())
+        return;
+
+    try
+    {
+        cache_sshfs_packages(*session, *sftp, guest_dir, packages_dir);
+    }
+    catch (const std::exception& e)
+    {
+        QDir{packages_dir}.removeRecursively();
+        mpl::log(mpl::Level::debug, category, fmt::format("Cannot cache the sshfs packages: {}", e.what()));
+    }
+    remove_guest_dir();
+}
+
+void mp::Daemon::start_native_mount(VirtualMachine* vm, const std::string& name, const std::string& target_path)
+{
+    const auto tag = vm->native_mount_tag(target_path);
+    if (tag.empty())
+        throw std::runtime_error("the instance needs restarting to make the mount available");
+
+    auto session = ssh_sessions.acquire(name, vm->ssh_hostname(), vm->ssh_port(), vm->ssh_username());
+    const auto target = mp::utils::escape_char(target_path, '"');
+    auto proc = session->exec(fmt::format("sudo mkdir -p \"{0}\" && {{ mountpoint -q \"{0}\" || sudo mount -t 9p -o "
+                                          "trans=virtio,version=9p2000.L,msize=262144 {1} \"{0}\"; }}",
+                                          target, tag));
+    if (proc.exit_code() != 0)
+    {
+        auto error_msg = proc.read_std_error();
+        throw std::runtime_error(mp::utils::trim_end(error_msg));
+    }
+}
+
+void mp::Daemon::stop_native_mount(VirtualMachine* vm, const std::string& name, const std::string& target_path)
+{
+    auto session = ssh_sessions.acquire(name, vm->ssh_hostname(), vm->ssh_port(), vm->ssh_username());
+    auto proc = session->exec(fmt::format("sudo umount \"{}\"", mp::utils::escape_char(target_path, '"')));
+    if (proc.exit_code() != 0)
+    {
+        auto error_msg = proc.read_std_error();
+        throw std::runtime_error(mp::utils::trim_end(error_msg));
+    }
+}
+
+// Relays the instance's forwards to where it is now on the bridge, which may not be where it was on its last boot
+std::string mp::Daemon::start_port_forwards(const std::string& name, VirtualMachine& vm)
+{
+    const auto forwards = vm_instance_specs[name].port_forwards;
+    if (forwards.empty())
+        return {};
+
+    port_forwarder.stop_all_for(name);
+    const auto ip = vm.ipv4();
+    if (!PortForwarder::is_ipv4_address(ip))
+        return fmt::format("cannot forward ports to \"{}\": it has no address\n", name);
+
+    fmt::memory_buffer errors;
+    for (const auto& forward : forwards)
+    {
+        try
+        {
+            port_forwarder.start(name, forward, ip);
+        }
+        catch (const std::exception& e)
+        {
+            fmt::format_to(errors, "cannot forward port {} to \"{}\": {}\n", forward.host_port, name, e.what());
+        }
+    }
+
+    return fmt::to_string(errors);
+}
+
+mp::optional<mp::InstanceTelemetry> mp::Daemon::cached_telemetry_for(const std::string& name)
+{
+    std::lock_guard<std::mutex> lock{telemetry_mutex};
+    auto it = instance_telemetry.find(name);
+    if (it == instance_telemetry.end())
+        return mp::nullopt;
+
+    return it->second;
+}
+
+mp::InstanceTelemetry mp::Daemon::telemetry_for(const std::string& name, VirtualMachine& vm,
+                                                const std::string& username, bool refresh)
+{
+    if (!refresh)
+    {
+        if (auto cached = cached_telemetry_for(name))
+            return *cached;
+    }
+
+    int generation;
+    {
+        std::lock_guard<std::mutex> lock{telemetry_mutex};
+        generation = telemetry_generations[name];
+    }
+
+    auto telemetry = gather_instance_telemetry(name, vm, username, ssh_sessions);
+
+    std::lock_guard<std::mutex> lock{telemetry_mutex};
+    if (telemetry_generations[name] != generation)
+        return telemetry; // the instance changed state or went away meanwhile, what it told is not kept
+
+    record_utilization(utilization_history, name, telemetry);
+    return instance_telemetry[name] = std::move(telemetry);
+}
+
+void mp::Daemon::forget_telemetry_for(const std::string& name)
+{
+    std::lock_guard<std::mutex> lock{telemetry_mutex};
+    instance_telemetry.erase(name);
+    ++telemetry_generations[name];
+}
+
+// Runs on the daemon thread; guests are queried on the workers, so that info and list find their stats ready
+void mp::Daemon::refresh_telemetry()
+{
+    for (const auto& instance : vm_instances)
+    {
+        const auto& name = instance.first;
+        const auto& vm = instance.second;
+        if (!mp::utils::is_running(vm->current_state()))
+            continue;
+
+        {
+            std::lock_guard<std::mutex> lock{telemetry_mutex};
+            if (!telemetry_in_flight.insert(name).second)
+                continue; // a guest slower to answer than the interval is not asked again until it has
+        }
+
+        QtConcurrent::run(&read_only_workers, [this, name, vm, username = vm_instance_specs[name].ssh_username] {
+            try
+            {
+                if (guest_is_busy(telemetry_for(name, *vm, username, /*refresh=*/true)))
+                    note_activity(name);
             }
             catch (const std::exception& e)
             {
-                preparing_instances.erase(name);
-                release_resources(name);
-                vm_instances.erase(name);
-                persist_instances();
-                status_promise->set_value(grpc::Status(grpc::StatusCode::FAILED_PRECONDITION, e.what(), ""));
+                mpl::log(mpl::Level::debug, category,
+                         fmt::format("Cannot refresh telemetry for \"{}\": {}", name, e.what()));
             }
 
-            delete prepare_future_watcher;
+            std::lock_guard<std::mutex> lock{telemetry_mutex};
+            telemetry_in_flight.erase(name);
         });
+    }
+}
 
-    prepare_future_watcher->setFuture(
-        QtConcurrent::run([this, server, request, name, checked_args]() -> VirtualMachineDescription {
-            try
+void mp::Daemon::note_activity(const std::string& name)
+{
+    std::lock_guard<std::mutex> lock{telemetry_mutex};
+    instance_activity[name] = QDateTime::currentDateTimeUtc();
+}
+
+// Instances are suspended rather than stopped, so that coming back to one resumes it where it was. Those with mounts
+// are left alone, as their mounts would not survive
+void mp::Daemon::suspend_idle_instances()
+{
+    const auto idle_minutes = Settings::instance().get(idle_suspend_key).toInt();
+    if (idle_minutes <= 0)
+        return;
+
+    const auto now = QDateTime::currentDateTimeUtc();
+    std::vector<std::string> idle;
+    {
+        std::lock_guard<std::mutex> lock{telemetry_mutex};
+        for (const auto& instance : vm_instances)
+        {
+            const auto& name = instance.first;
+            if (instance.second->current_state() != VirtualMachine::State::running ||
+                !vm_instance_specs[name].mounts.empty())
             {
-                auto query = query_from(request, name);
+                instance_activity.erase(name); // the clock starts over once it is up again
+                continue;
+            }
 
-                auto progress_monitor = [server](int progress_type, int percentage) {
-                    CreateReply create_reply;
-                    create_reply.mutable_launch_progress()->set_percent_complete(std::to_string(percentage));
-                    create_reply.mutable_launch_progress()->set_type((CreateProgress::ProgressTypes)progress_type);
-                    return server->Write(create_reply);
-                };
+            auto& last_active = instance_activity[name];
+            if (!last_active.isValid())
+                last_active = now;
+            else if (last_active.secsTo(now) >= idle_minutes * 60)
+                idle.push_back(name);
+        }
+    }
 
-                auto prepare_action = [this, server, &name](const VMImage& source_image) -> VMImage {
-                    CreateReply reply;
-                    reply.set_create_message("Preparing image for " + name);
-                    server->Write(reply);
+    if (idle.empty())
+        return;
 
-                    return config->factory->prepare_source_image(source_image);
-                };
+    for (const auto& name : idle)
+        mpl::log(mpl::Level::info, category,
+                 fmt::format("Suspending \"{}\" after {} minutes of inactivity", name, idle_minutes));
 
-                auto fetch_type = config->factory->fetch_type();
+    cmd_vms<SuspendReply>(
+        idle,
+        [](auto& vm) {
+            vm.suspend();
+            return grpc::Status::OK;
+        },
+        nullptr, "Suspended", /*drives_backend=*/true);
 
-                CreateReply reply;
-                reply.set_create_message("Creating " + name);
-                server->Write(reply);
-                auto vm_image = config->vault->fetch_image(fetch_type, query, prepare_action, progress_monitor);
+    for (const auto& name : idle)
+        if (vm_instances[name]->current_state() == VirtualMachine::State::suspended)
+        {
+            vm_instance_specs[name].idle_suspended = true;
+            persist_instance(name);
+        }
+}
 
-                reply.set_create_message("Configuring " + name);
-                server->Write(reply);
-                auto vendor_data_cloud_init_config =
-                    make_cloud_init_vendor_config(*config->ssh_key_provider, request->time_zone(), config->ssh_username,
-                                                  config->factory->get_backend_version_string().toStdString());
-                auto meta_data_cloud_init_config = make_cloud_init_meta_config(name);
-                auto user_data_cloud_init_config = YAML::Load(request->cloud_init_user_data());
-                prepare_user_data(user_data_cloud_init_config, vendor_data_cloud_init_config);
-                config->factory->configure(name, meta_data_cloud_init_config, vendor_data_cloud_init_config);
-
-                std::string mac_addr;
-                while (true)
-                {
-                    mac_addr = mp::utils::generate_mac_address();
+void mp::Daemon::trim_instance_disks()
+{
+    if (disk_trim_future.isRunning())
+    {
+        mpl::log(mpl::Level::info, category, "Instance disks are still being trimmed. Skipping…");
+        return;
+    }
 
-                    auto it = allocated_mac_addrs.find(mac_addr);
-                    if (it == allocated_mac_addrs.end())
-                    {
-                        allocated_mac_addrs.insert(mac_addr);
-                        break;
-                    }
-                }
-                auto vm_desc = to_machine_desc(request, name, checked_args.mem_size, checked_args.disk_space, mac_addr,
-                                               config->ssh_username, vm_image, meta_data_cloud_init_config,
-                                               user_data_cloud_init_config, vendor_data_cloud_init_config);
+    struct Trim
+    {
+        std::string name;
+        VirtualMachine::ShPtr vm;
+        std::string username;
+        Path image_path;
+    };
+    std::vector<Trim> trims;
+    for (const auto& instance : vm_instances)
+    {
+        const auto& name = instance.first;
+        if (!mp::utils::is_running(instance.second->current_state()) || !config->vault->has_record_for(name))
+            continue;
 
-                config->factory->prepare_instance_image(vm_image, vm_desc);
+        trims.push_back({name, instance.second, vm_instance_specs[name].ssh_username,
+                         fetch_image_for(name, config->factory->fetch_type(), *config->vault).image_path});
+    }
 
-                return vm_desc;
+    // One instance after the other, so that the host disk is never busy with more than one trim
+    disk_trim_future = QtConcurrent::run([this, trims] {
+        for (const auto& trim : trims)
+        {
+            try
+            {
+                const auto reclaimed = trim_instance_disk(trim.name, *trim.vm, trim.username, trim.image_path,
+                                                          ssh_sessions);
+                mpl::log(mpl::Level::info, category,
+                         fmt::format("Trimming \"{}\" reclaimed {} bytes", trim.name, reclaimed));
+                mp::Telemetry::instance().count("multipass_disk_reclaimed_bytes_total", {{"instance", trim.name}},
+                                                reclaimed);
             }
             catch (const std::exception& e)
             {
-                throw CreateImageException(e.what());
+                mpl::log(mpl::Level::warning, category,
+                         fmt::format("Cannot trim the disk of \"{}\": {}", trim.name, e.what()));
             }
-        }));
+        }
+    });
 }
 
-grpc::Status mp::Daemon::reboot_vm(VirtualMachine& vm)
+void mp::Daemon::scrub()
 {
-    if (vm.state == VirtualMachine::State::delayed_shutdown)
-        delayed_shutdown_instances.erase(vm.vm_name);
+    if (scrub_future.isRunning())
+    {
+        mpl::log(mpl::Level::info, category, "Scrub still running. Skipping…");
+        return;
+    }
 
-    if (!mp::utils::is_running(vm.current_state()))
-        return grpc::Status{grpc::StatusCode::INVALID_ARGUMENT,
-                            fmt::format("instance \"{}\" is not running", vm.vm_name), ""};
+    const auto bytes_per_second = MemorySize{Settings::instance().get(scrub_bandwidth_key).toStdString()}.in_bytes();
+    if (bytes_per_second <= 0)
+        return;
 
-    mpl::log(mpl::Level::debug, category, fmt::format("Rebooting {}", vm.vm_name));
-    return ssh_reboot(vm.ssh_hostname(), vm.ssh_port(), vm.ssh_username(), *config->ssh_key_provider);
+    // Only disks that nothing writes to can be told apart from disks being written to
+    std::vector<std::pair<std::string, VirtualMachine::ShPtr>> idle_instances;
+    for (const auto& instance : vm_instances)
+    {
+        const auto state = instance.second->current_state();
+        if (state == VirtualMachine::State::stopped || state == VirtualMachine::State::off)
+            idle_instances.emplace_back(instance.first, instance.second);
+    }
+
+    scrub_future = QtConcurrent::run([this, bytes_per_second, idle_instances] {
+        auto prepare_action = [this](const VMImage& source_image) -> VMImage {
+            return config->factory->prepare_source_image(source_image);
+        };
+        auto monitor = [this](int, int) { return !scrub_stopped; };
+
+        try
+        {
+            config->vault->scrub_images(config->factory->fetch_type(), prepare_action, monitor, bytes_per_second);
+        }
+        catch (const std::exception& e)
+        {
+            mpl::log(mpl::Level::error, category, fmt::format("Error scrubbing images: {}", e.what()));
+        }
+
+        // One disk after the other, like trims, and none that started in the meantime
+        for (const auto& instance : idle_instances)
+        {
+            const auto& name = instance.first;
+            const auto state = instance.second->current_state();
+            if (scrub_stopped)
+                return;
+            if (state != VirtualMachine::State::stopped && state != VirtualMachine::State::off)
+                continue;
+
+            try
+            {
+                const auto problems = instance.second->check_disk(bytes_per_second);
+                if (!problems.empty() && instance.second->current_state() == state)
+                {
+                    mpl::log(mpl::Level::warning, category,
+                             fmt::format("The disk of \"{}\" is corrupt:\n{}", name, problems));
+                    mp::Telemetry::instance().count("multipass_scrub_failures_total", {{"kind", "disk"}});
+                }
+            }
+            catch (const std::exception& e)
+            {
+                mpl::log(mpl::Level::warning, category,
+                         fmt::format("Cannot check the disk of \"{}\": {}", name, e.what()));
+            }
+        }
+    });
 }
 
-grpc::Status mp::Daemon::shutdown_vm(VirtualMachine& vm, const std::chrono::milliseconds delay)
+// Only takes the instance out of sight, so that purging replies at once and leaves the slow part to the reaper
+void mp::Daemon::purge_instance(const std::string& name, VirtualMachine::ShPtr instance)
 {
-    const auto& name = vm.vm_name;
-    const auto& state = vm.current_state();
+    auto& spec = vm_instance_specs[name];
+    spec.deleted = true;
+    spec.purged = true;
 
-    using St = VirtualMachine::State;
-    const auto skip_states = {St::off, St::stopped, St::suspended};
+    purged_instances[name] = std::move(instance);
+    forget_telemetry_for(name);
+    utilization_history.forget(name);
+}
 
-    if (std::none_of(cbegin(skip_states), cend(skip_states), [&state](const auto& st) { return state == st; }))
-    {
-        delayed_shutdown_instances.erase(name);
+void mp::Daemon::reap_purged_instances()
+{
+    if (!reaped_instances.empty() || purged_instances.empty())
+        return;
 
-        mp::optional<mp::SSHSession> session;
+    auto shut_down = [](const std::pair<std::string, VirtualMachine::ShPtr>& instance) {
         try
         {
-            session = mp::SSHSession{vm.ssh_hostname(), vm.ssh_port(), vm.ssh_username(), *config->ssh_key_provider};
+            instance.second->shutdown();
         }
         catch (const std::exception& e)
         {
-            mpl::log(mpl::Level::info, category,
-                     fmt::format("Cannot open ssh session on \"{}\" shutdown: {}", name, e.what()));
+            mpl::log(mpl::Level::warning, category,
+                     fmt::format("Cannot shut \"{}\" down before reclaiming it: {}", instance.first, e.what()));
         }
+    };
 
-        auto& shutdown_timer = delayed_shutdown_instances[name] = std::make_unique<DelayedShutdownTimer>(
-            &vm, std::move(session),
-            std::bind(&SSHFSMounts::stop_all_mounts_for_instance, &instance_mounts, std::placeholders::_1));
-
-        QObject::connect(shutdown_timer.get(), &DelayedShutdownTimer::finished,
-                         [this, name]() { delayed_shutdown_instances.erase(name); });
+    // Instances tied to the daemon thread are shut down here; the workers only get instances that may be driven from
+    // anywhere, and names for the vault, which has locks of its own, to reclaim the disks of. The factory's resources
+    // go once the batch is done, back on this thread
+    reaped_instances.assign(purged_instances.cbegin(), purged_instances.cend());
+    for (const auto& instance : reaped_instances)
+        if (!instance.second->lifecycle_is_thread_safe())
+            shut_down(instance);
 
-        shutdown_timer->start(delay);
-    }
-    else
-        mpl::log(mpl::Level::debug, category, fmt::format("instance \"{}\" does not need stopping", name));
+    reaper.setFuture(QtConcurrent::map(
+        reaped_instances, [this, shut_down](const std::pair<std::string, VirtualMachine::ShPtr>& instance) {
+            if (instance.second->lifecycle_is_thread_safe())
+                shut_down(instance);
 
-    return grpc::Status::OK;
+            try
+            {
+                config->vault->remove(instance.first);
+            }
+            catch (const std::exception& e)
+            {
+                mpl::log(mpl::Level::warning, category,
+                         fmt::format("Cannot reclaim the disk of \"{}\": {}", instance.first, e.what()));
+            }
+        }));
 }
 
-grpc::Status mp::Daemon::cancel_vm_shutdown(const VirtualMachine& vm)
+void mp::Daemon::finish_reaping()
 {
-    auto it = delayed_shutdown_instances.find(vm.vm_name);
-    if (it != delayed_shutdown_instances.end())
-        delayed_shutdown_instances.erase(it);
-    else
-        mpl::log(mpl::Level::debug, category,
-                 fmt::format("no delayed shutdown to cancel on instance \"{}\"", vm.vm_name));
+    if (reaped_instances.empty())
+        return;
 
-    return grpc::Status::OK;
-}
-
-grpc::Status mp::Daemon::cmd_vms(const std::vector<std::string>& tgts, std::function<grpc::Status(VirtualMachine&)> cmd)
-{ /* TODO: use this in commands, rather than repeating the same logic.
-  std::function involves some overhead, but it should be negligible here and
-  it gives clear error messages on type mismatch (!= templated callable). */
-    for (const auto& tgt : tgts)
+    for (const auto& instance : reaped_instances)
     {
-        const auto st = cmd(*vm_instances.at(tgt));
-        if (!st.ok())
-            return st; // Fail early
-    }
+        const auto& name = instance.first;
+        try
+        {
+            config->factory->remove_resources_for(name);
+        }
+        catch (const std::exception& e)
+        {
+            mpl::log(mpl::Level::warning, category,
+                     fmt::format("Cannot reclaim everything \"{}\" used: {}", name, e.what()));
+        }
 
-    return grpc::Status::OK;
+        purged_instances.erase(name);
+        vm_instance_specs.erase(name);
+    }
+    reaped_instances.clear();
+    persist_instances();
 }
 
-void mp::Daemon::install_sshfs(VirtualMachine* vm, const std::string& name)
+void mp::Daemon::report_launch_timings(const std::string& name, bool to_client, LaunchReply& reply)
 {
-    auto& key_provider = *config->ssh_key_provider;
+    std::shared_ptr<LaunchTimings> timings;
+    {
+        std::lock_guard<decltype(start_mutex)> lock{start_mutex};
+        auto it = launch_timings.find(name);
+        if (it == launch_timings.end())
+            return;
 
-    SSHSession session{vm->ssh_hostname(), vm->ssh_port(), vm->ssh_username(), key_provider};
+        timings = it->second;
+        launch_timings.erase(it);
+    }
 
-    mpl::log(mpl::Level::info, category, fmt::format("Installing sshfs in \'{}\'", name));
+    auto phases = timings->recorded();
+    phases.emplace_back("total", std::chrono::duration_cast<std::chrono::milliseconds>(timings->elapsed()));
 
-    int retries{0};
-    while (++retries <= max_install_sshfs_retries)
+    fmt::memory_buffer record;
+    for (const auto& phase : phases)
     {
-        try
-        {
-            auto proc = session.exec("sudo apt update && sudo apt install -y sshfs");
-            if (proc.exit_code(std::chrono::minutes(5)) != 0)
-            {
-                auto error_msg = proc.read_std_error();
-                mpl::log(mpl::Level::warning, category,
-                         fmt::format("Failed to install 'sshfs', error message: '{}'", mp::utils::trim_end(error_msg)));
-            }
-            else
-            {
-                break;
-            }
-        }
-        catch (const mp::ExitlessSSHProcessException&)
+        fmt::format_to(record, " {}={}", phase.first, phase.second.count());
+
+        if (to_client)
         {
-            mpl::log(mpl::Level::info, category, fmt::format("Timeout while installing 'sshfs' in '{}'", name));
+            auto entry = reply.add_timings();
+            entry->set_phase(phase.first);
+            entry->set_duration_ms(phase.second.count());
         }
     }
 
-    if (retries > max_install_sshfs_retries)
-        throw mp::SSHFSMissingError();
+    mpl::log(mpl::Level::info, category,
+             fmt::format("launch timings (ms): instance={}{}", name, fmt::to_string(record)));
 }
 
 QFutureWatcher<mp::Daemon::AsyncOperationStatus>*
@@ -2111,62 +5769,200 @@ error_string mp::Daemon::async_wait_for_ssh_and_start_mounts_for(const std::stri
     fmt::memory_buffer errors;
     try
     {
+        std::shared_ptr<LaunchTimings> timings;
+        {
+            std::lock_guard<decltype(start_mutex)> lock{start_mutex};
+            auto timings_it = launch_timings.find(name);
+            timings = timings_it != launch_timings.end() ? timings_it->second : std::make_shared<LaunchTimings>();
+        }
+
         auto it = vm_instances.find(name);
         auto vm = it->second;
-        vm->wait_until_ssh_up(up_timeout);
 
+        // Mounts only need SSH, so they are set up while cloud-init finishes; sshfs is only installed after it
+        TaskGraph start;
+        auto ip = start.add("ip", TaskGraph::Work::blocking, [&] {
+            auto phase = timings->time("ip");
+            vm->ssh_hostname();
+        });
+
+        auto ssh = start.add(
+            "ssh", TaskGraph::Work::blocking,
+            [&] {
+                auto phase = timings->time("ssh");
+                vm->wait_until_ssh_up(up_timeout);
+            },
+            {ip});
+
+        // Forwards only need the instance's address, and report apart from the mounts they run alongside
+        std::string forward_errors;
+        start.add(
+            "port_forwards", TaskGraph::Work::blocking, [&] { forward_errors = start_port_forwards(name, *vm); },
+            {ip});
+
+        std::vector<TaskGraph::Step> initialized{ssh};
         if (std::is_same<Reply, LaunchReply>::value)
         {
-            if (server)
-            {
-                Reply reply;
-                reply.set_reply_message("Waiting for initialization to complete");
-                server->Write(reply);
-            }
+            initialized = {start.add(
+                "cloud_init", TaskGraph::Work::blocking,
+                [&] {
+                    if (server)
+                    {
+                        Reply reply;
+                        reply.set_reply_message("Waiting for initialization to complete");
+                        server->Write(reply);
+                    }
 
-            mp::utils::wait_for_cloud_init(vm.get(), cloud_init_timeout, *config->ssh_key_provider);
+                    auto phase = timings->time("cloud_init");
+                    mp::utils::wait_for_cloud_init(vm.get(), cloud_init_timeout, *config->ssh_key_provider);
+                },
+                {ssh})};
         }
 
         std::vector<std::string> invalid_mounts;
         auto& mounts = vm_instance_specs[name].mounts;
-        for (const auto& mount_entry : mounts)
-        {
-            auto& target_path = mount_entry.first;
-            auto& source_path = mount_entry.second.source_path;
-            auto& uid_map = mount_entry.second.uid_map;
-            auto& gid_map = mount_entry.second.gid_map;
 
-            try
+        // Each sshfs_server is waited on until it connects, so start them together and wait on the slowest
+        auto start_mounts_concurrently = [this, &vm, &mounts](const std::vector<std::string>& targets) {
+            std::vector<std::exception_ptr> failures(targets.size());
+            QFutureSynchronizer<void> mount_synchronizer;
+            for (std::size_t i = 0; i < targets.size(); ++i)
             {
-                instance_mounts.start_mount(vm.get(), source_path, target_path, gid_map, uid_map);
+                mount_synchronizer.addFuture(QtConcurrent::run([this, &vm, &mounts, &targets, &failures, i] {
+                    try
+                    {
+                        const auto& mount = mounts.at(targets[i]);
+                        instance_mounts.start_mount(vm.get(), mount.source_path, targets[i], mount.gid_map,
+                                                    mount.uid_map, mount.profile);
+                    }
+                    catch (...)
+                    {
+                        failures[i] = std::current_exception();
+                    }
+                }));
             }
-            catch (const mp::SSHFSMissingError&)
+            mount_synchronizer.waitForFinished();
+
+            return failures;
+        };
+
+        // Reports the failed mounts, returning those that need sshfs installed to be retried
+        auto report_failures = [&errors, &invalid_mounts](const std::vector<std::string>& targets,
+                                                          const std::vector<std::exception_ptr>& failures) {
+            std::vector<std::string> missing_sshfs;
+            for (std::size_t i = 0; i < targets.size(); ++i)
             {
+                if (!failures[i])
+                    continue;
+
                 try
                 {
-                    if (server)
+                    std::rethrow_exception(failures[i]);
+                }
+                catch (const mp::SSHFSMissingError&)
+                {
+                    missing_sshfs.push_back(targets[i]);
+                }
+                catch (const std::exception& e)
+                {
+                    fmt::format_to(errors, "Removing \"{}\": {}\n", targets[i], e.what());
+                    invalid_mounts.push_back(targets[i]);
+                }
+            }
+
+            return missing_sshfs;
+        };
+
+        std::vector<std::string> pending_mounts;
+        std::vector<std::string> missing_sshfs;
+        initialized.push_back(start.add(
+            "mounts", TaskGraph::Work::blocking,
+            [&] {
+                auto phase = timings->time("mounts");
+
+                // Serve all the classic mounts from one sshfs_server over a single SSH session when we can
+                std::vector<SSHFSMountConfig> classic_mounts;
+                for (const auto& mount_entry : mounts)
+                {
+                    const auto& target_path = mount_entry.first;
+                    const auto& mount = mount_entry.second;
+                    if (mount.type == VMMount::Type::classic &&
+                        !instance_mounts.has_instance_already_mounted(name, target_path))
+                        classic_mounts.push_back(
+                            {mount.source_path, target_path, mount.gid_map, mount.uid_map, mount.profile});
+                }
+
+                if (classic_mounts.size() > 1)
+                {
+                    try
                     {
-                        Reply reply;
-                        reply.set_reply_message("Enabling support for mounting");
-                        server->Write(reply);
+                        instance_mounts.start_mounts(vm.get(), classic_mounts);
+                    }
+                    catch (const std::exception& e)
+                    {
+                        mpl::log(mpl::Level::debug, category,
+                                 fmt::format("Could not share one sshfs_server between the mounts of \"{}\", "
+                                             "starting one per mount: {}",
+                                             name, e.what()));
                     }
+                }
 
-                    install_sshfs(vm.get(), name);
-                    instance_mounts.start_mount(vm.get(), source_path, target_path, gid_map, uid_map);
+                for (const auto& mount_entry : mounts)
+                {
+                    auto& target_path = mount_entry.first;
+
+                    if (mount_entry.second.type == VMMount::Type::native)
+                    {
+                        try
+                        {
+                            start_native_mount(vm.get(), name, target_path);
+                        }
+                        catch (const std::exception& e)
+                        {
+                            fmt::format_to(errors, "error mounting \"{}\": {}\n", target_path, e.what());
+                        }
+                        continue;
+                    }
+
+                    if (!instance_mounts.has_instance_already_mounted(name, target_path))
+                        pending_mounts.push_back(target_path);
                 }
-                catch (const mp::SSHFSMissingError&)
+
+                missing_sshfs = report_failures(pending_mounts, start_mounts_concurrently(pending_mounts));
+            },
+            {ssh}));
+
+        start.add(
+            "sshfs", TaskGraph::Work::blocking,
+            [&] {
+                if (!missing_sshfs.empty())
                 {
-                    fmt::format_to(errors, sshfs_error_template + "\n", name);
-                    break;
+                    try
+                    {
+                        if (server)
+                        {
+                            Reply reply;
+                            reply.set_reply_message("Enabling support for mounting");
+                            server->Write(reply);
+                        }
+
+                        install_sshfs(vm.get(), name);
+                        if (!report_failures(missing_sshfs, start_mounts_concurrently(missing_sshfs)).empty())
+                            throw mp::SSHFSMissingError();
+                    }
+                    catch (const mp::SSHFSMissingError&)
+                    {
+                        fmt::format_to(errors, sshfs_error_template + "\n", name);
+                    }
                 }
-            }
-            catch (const std::exception& e)
-            {
-                fmt::format_to(errors, "Removing \"{}\": {}\n", target_path, e.what());
-                invalid_mounts.push_back(target_path);
-            }
-            persist_instances();
-        }
+
+                if (!pending_mounts.empty())
+                    persist_instances();
+            },
+            initialized);
+
+        start.run();
+        fmt::format_to(errors, "{}", forward_errors);
     }
     catch (const std::exception& e)
     {
@@ -20,30 +20,57 @@
 
 #include "daemon_config.h"
 #include "daemon_rpc.h"
+#include "host_capacity.h"
+#include "journaled_json_store.h"
+#include "launch_timings.h"
+#include "package_cache.h"
+#include "port_forwarder.h"
+#include "utilization_history.h"
+#include "watch_stream.h"
 
 #include <multipass/delayed_shutdown_timer.h>
+#include <multipass/logging/recent_logger.h>
 #include <multipass/memory_size.h>
 #include <multipass/metrics_provider.h>
+#include <multipass/optional.h>
+#include <multipass/progress_monitor.h>
+#include <multipass/ssh/ssh_session_pool.h>
 #include <multipass/sshfs_mount/sshfs_mounts.h>
 #include <multipass/virtual_machine.h>
+#include <multipass/virtual_machine_description.h>
 #include <multipass/vm_status_monitor.h>
 
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
 #include <future>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
+#include <QDateTime>
 #include <QFutureWatcher>
+#include <QThreadPool>
 
 namespace multipass
 {
 struct VMMount
 {
+    enum class Type
+    {
+        classic, // SSHFS
+        native   // exported by the hypervisor
+    };
+
     std::string source_path;
     std::unordered_map<int, int> gid_map;
     std::unordered_map<int, int> uid_map;
+    Type type{Type::classic};
+    std::string profile{default_mount_profile}; // how long a classic mount's instance side caches
 };
 
 struct VMSpecs
@@ -57,6 +84,20 @@ struct VMSpecs
     std::unordered_map<std::string, VMMount> mounts;
     bool deleted;
     QJsonObject metadata;
+    std::string disk_profile{default_disk_profile};
+    bool hugepages{false};
+    std::string resource_class{default_resource_class};
+    InstanceThrottle throttle;
+    std::vector<PortForward> port_forwards; // relayed while the instance runs
+    bool purged{false}; // deleted for good, though what it used may still have to be reclaimed
+    bool idle_suspended{false}; // suspended for being idle, resumed by the next shell or exec
+};
+
+struct InstanceTelemetry
+{
+    std::unordered_map<std::string, std::string> stats;
+    std::string ipv4;
+    QDateTime timestamp;
 };
 
 struct MetricsOptInData
@@ -73,6 +114,11 @@ public:
     explicit Daemon(std::unique_ptr<const DaemonConfig> config);
     Daemon(const Daemon&) = delete;
     Daemon& operator=(const Daemon&) = delete;
+    ~Daemon();
+
+    // Saves the running instances, a few at a time, while the event loop goes on; calls done once they all are or
+    // the time to save them is up. For the way out, as nothing is started again afterwards
+    void save_instances_then(std::function<void()> done);
 
 protected:
     void on_resume() override;
@@ -133,18 +179,109 @@ public slots:
     virtual void version(const VersionRequest* request, grpc::ServerWriter<VersionReply>* response,
                          std::promise<grpc::Status>* status_promise);
 
+    virtual void watch(const WatchRequest* request, grpc::ServerWriter<WatchReply>* response,
+                       std::promise<grpc::Status>* status_promise);
+
+    virtual void unwatch(grpc::ServerWriter<WatchReply>* response);
+
+    virtual void metrics(const MetricsRequest* request, grpc::ServerWriter<MetricsReply>* response,
+                         std::promise<grpc::Status>* status_promise);
+
+    virtual void clone(const CloneRequest* request, grpc::ServerWriter<CloneReply>* response,
+                       std::promise<grpc::Status>* status_promise);
+
+    virtual void snapshot(const SnapshotRequest* request, grpc::ServerWriter<SnapshotReply>* response,
+                          std::promise<grpc::Status>* status_promise);
+
+    virtual void restore(const RestoreRequest* request, grpc::ServerWriter<RestoreReply>* response,
+                         std::promise<grpc::Status>* status_promise);
+
+    virtual void snapshots(const SnapshotsRequest* request, grpc::ServerWriter<SnapshotsReply>* response,
+                           std::promise<grpc::Status>* status_promise);
+
+    virtual void logs(const LogsRequest* request, grpc::ServerWriter<LogsReply>* response,
+                      std::promise<grpc::Status>* status_promise);
+
+    virtual void qos(const QosRequest* request, grpc::ServerWriter<QosReply>* response,
+                     std::promise<grpc::Status>* status_promise);
+
+    virtual void throttle(const ThrottleRequest* request, grpc::ServerWriter<ThrottleReply>* response,
+                          std::promise<grpc::Status>* status_promise);
+
+    virtual void resize(const ResizeRequest* request, grpc::ServerWriter<ResizeReply>* response,
+                        std::promise<grpc::Status>* status_promise);
+
+    virtual void bake(const BakeRequest* request, grpc::ServerWriter<BakeReply>* response,
+                      std::promise<grpc::Status>* status_promise);
+
+    virtual void utilization(const UtilizationRequest* request, grpc::ServerWriter<UtilizationReply>* response,
+                             std::promise<grpc::Status>* status_promise);
+
+    virtual void forward(const ForwardRequest* request, grpc::ServerWriter<ForwardReply>* response,
+                         std::promise<grpc::Status>* status_promise);
+
 private:
+    void find_images(const FindRequest* request, grpc::ServerWriter<FindReply>* server,
+                     std::promise<grpc::Status>* status_promise);
+    bool cached_find_reply(const std::pair<std::string, bool>& key, const std::vector<int>& manifest_generations,
+                           FindReply& reply);
+    void cache_find_reply(const std::pair<std::string, bool>& key, const std::vector<int>& manifest_generations,
+                          const FindReply& reply);
     void persist_instances();
+    void persist_instance(const std::string& name);
     void release_resources(const std::string& instance);
     std::string check_instance_operational(const std::string& instance_name) const;
     std::string check_instance_exists(const std::string& instance_name) const;
     void create_vm(const CreateRequest* request, grpc::ServerWriter<CreateReply>* server,
                    std::promise<grpc::Status>* status_promise, bool start);
+    VirtualMachineDescription prepare_instance(const CreateRequest* request, const std::string& name,
+                                               const MemorySize& mem_size, const MemorySize& disk_space,
+                                               const std::function<void(const std::string&)>& report,
+                                               const ProgressMonitor& monitor, LaunchTimings& timings);
+    void launch_many(const LaunchRequest* request, grpc::ServerWriter<LaunchReply>* server,
+                     std::promise<grpc::Status>* status_promise);
+    void add_instance(const std::string& name, const VirtualMachineDescription& vm_desc);
+    bool claim_warm_instance(const LaunchRequest* request, grpc::ServerWriter<LaunchReply>* server,
+                             std::promise<grpc::Status>* status_promise);
+    void create_warm_instance(const std::string& image);
+    void replenish_warm_pool();
+    void persist_warm_pool();
+    bool claim_template_clone(const LaunchRequest* request, grpc::ServerWriter<LaunchReply>* server,
+                              std::promise<grpc::Status>* status_promise);
+    void create_memory_template(const std::string& image);
+    void replenish_memory_templates();
+    void persist_memory_templates();
+    void report_launch_timings(const std::string& name, bool to_client, LaunchReply& reply);
     grpc::Status reboot_vm(VirtualMachine& vm);
     grpc::Status shutdown_vm(VirtualMachine& vm, const std::chrono::milliseconds delay);
+    grpc::Status shutdown_vm_now(VirtualMachine& vm);
     grpc::Status cancel_vm_shutdown(const VirtualMachine& vm);
-    grpc::Status cmd_vms(const std::vector<std::string>& tgts, std::function<grpc::Status(VirtualMachine&)> cmd);
+    template <typename Reply>
+    grpc::Status cmd_vms(const std::vector<std::string>& tgts, std::function<grpc::Status(VirtualMachine&)> cmd,
+                         grpc::ServerWriter<Reply>* server, const std::string& done_message, bool drives_backend);
     void install_sshfs(VirtualMachine* vm, const std::string& name);
+    void start_native_mount(VirtualMachine* vm, const std::string& name, const std::string& target_path);
+    std::string start_port_forwards(const std::string& name, VirtualMachine& vm); // the errors, if any
+    void stop_native_mount(VirtualMachine* vm, const std::string& name, const std::string& target_path);
+    optional<InstanceTelemetry> cached_telemetry_for(const std::string& name);
+    InstanceTelemetry telemetry_for(const std::string& name, VirtualMachine& vm, const std::string& username,
+                                    bool refresh);
+    void forget_telemetry_for(const std::string& name);
+    void refresh_telemetry();
+    void note_activity(const std::string& name);
+    void suspend_idle_instances();
+    void trim_instance_disks();
+    void scrub(); // the cached images and stopped instances' disks, for corruption
+    void purge_instance(const std::string& name, VirtualMachine::ShPtr instance);
+    void reap_purged_instances();
+    void finish_reaping(); // on the daemon thread, once the reaper is done with its batch
+    std::string allocate_mac_addr();
+    void autostart_next();
+    void save_more_instances_for_exit(); // on the exit save's timer
+    void publish_memory_footprint(); // to the telemetry, before it is read back
+    HostCapacity host_capacity() const;
+    HostCapacity::Resources committed_resources();
+    void notify_watchers(const std::string& name, InstanceStatus::Status status);
 
     struct AsyncOperationStatus
     {
@@ -162,9 +299,19 @@ private:
     QFutureWatcher<AsyncOperationStatus>* create_future_watcher(std::function<void()> const& finished_op = []() {});
 
     std::unique_ptr<const DaemonConfig> config;
+    logging::RecentLogger recent_logs; // what the logs RPC answers with
+    JournaledJsonStore instance_db;
     std::unordered_map<std::string, VMSpecs> vm_instance_specs;
     std::unordered_map<std::string, VirtualMachine::ShPtr> vm_instances;
     std::unordered_map<std::string, VirtualMachine::ShPtr> deleted_instances;
+    std::unordered_map<std::string, VirtualMachine::ShPtr> warm_instances; // booted ahead of time, hidden until claimed
+    std::unordered_map<std::string, VirtualMachine::ShPtr> purged_instances; // waiting for the reaper
+    std::vector<std::pair<std::string, VirtualMachine::ShPtr>> reaped_instances; // the reaper's current batch
+    QFutureWatcher<void> reaper;
+    std::unordered_map<std::string, std::string> warm_pool_images; // warm (or preparing warm) instance -> pool image
+    std::unordered_map<std::string, VirtualMachine::ShPtr> template_instances; // booted for their memory, never shown
+    std::unordered_map<std::string, std::string> template_images; // memory template (or preparing one) -> its image
+    std::unordered_set<std::string> saved_templates;              // the templates clones can start from
     std::unordered_map<std::string, std::unique_ptr<DelayedShutdownTimer>> delayed_shutdown_instances;
     std::unordered_set<std::string> allocated_mac_addrs;
     std::unordered_map<std::string, VMImageHost*> remote_image_host_map;
@@ -173,11 +320,52 @@ private:
     MetricsProvider metrics_provider;
     MetricsOptInData metrics_opt_in;
     SSHFSMounts instance_mounts;
+    SSHSessionPool ssh_sessions;
+    PortForwarder port_forwarder;
+    std::unique_ptr<PackageCache> package_cache; // when instances' apt downloads are cached
     std::vector<std::unique_ptr<QFutureWatcher<AsyncOperationStatus>>> async_future_watchers;
     std::unordered_map<std::string, QFuture<std::string>> async_running_futures;
     std::mutex start_mutex;
-    std::unordered_set<std::string> preparing_instances;
+    std::unordered_map<std::string, std::shared_ptr<LaunchTimings>> launch_timings; // guarded by start_mutex
+    std::unordered_map<std::string, HostCapacity::Resources> preparing_instances; // with what they will take
+    const HostCapacity::Resources host_resources;
+    std::deque<std::string> autostart_queue; // previously running instances still waiting for their turn to boot
+    int autostarts_in_progress{0};
     QFuture<void> image_update_future;
+    QTimer telemetry_refresh_task;
+    QTimer disk_trim_task;
+    // Instances being saved on the way out
+    struct ExitSave
+    {
+        std::function<void()> done;
+        std::size_t at_once{1};
+        std::chrono::steady_clock::time_point deadline;
+        std::deque<VirtualMachine::ShPtr> to_save;
+        std::vector<VirtualMachine::ShPtr> saving;
+        int saved{0};
+        QTimer timer;
+    };
+    std::unique_ptr<ExitSave> exit_save;
+    QFuture<void> disk_trim_future;
+    QFuture<void> scrub_future;
+    std::atomic<bool> scrub_stopped{false}; // for the daemon's way out, as a scrub may take hours
+    std::mutex telemetry_mutex;
+    std::unordered_map<std::string, InstanceTelemetry> instance_telemetry; // guarded by telemetry_mutex
+    std::unordered_map<std::string, QDateTime> instance_activity;          // when each was last busy, idem
+    std::unordered_map<std::string, int> telemetry_generations;            // bumped on each state change, never erased
+    std::unordered_set<std::string> telemetry_in_flight;                   // being refreshed on the workers, idem
+    // What the telemetry showed over time, for the utilization RPC; guarded by its own lock
+    UtilizationHistory utilization_history;
+    std::mutex find_cache_mutex;
+    std::mutex persist_mutex;
+    std::mutex mac_addr_mutex; // guards allocated_mac_addrs while instances are prepared
+    // Image listings by (remote, allow_unsupported), along with the manifest generations they were built from
+    std::map<std::pair<std::string, bool>, std::pair<std::vector<int>, FindReply>> find_cache;
+    std::mutex watchers_mutex;
+    // Streams hearing about state changes, each queueing for its own writer thread; guarded by watchers_mutex
+    std::unordered_map<grpc::ServerWriter<WatchReply>*, std::unique_ptr<WatchStream>> watchers;
+    std::size_t heap_at_start{0}; // what the daemon took before its instances, for the per-instance figure
+    QThreadPool read_only_workers; // answers find, info and list; declared last so it is drained first
 };
 } // namespace multipass
 #endif // MULTIPASS_DAEMON_H
@@ -40,7 +40,9 @@
 
 #include <csignal>
 #include <cstring>
+#include <functional>
 #include <grp.h>
+#include <mutex>
 #include <sys/stat.h>
 #include <vector>
 
@@ -92,17 +94,36 @@ public:
         pthread_kill(signal_handling_thread.thread.native_handle(), SIGUSR1);
     }
 
+    // What the first SIGTERM or SIGINT does on the main thread, quitting unless told otherwise; a second one quits
+    // right away
+    void on_first_signal(std::function<void()> action)
+    {
+        std::lock_guard<std::mutex> lock{action_mutex};
+        first_signal_action = std::move(action);
+    }
+
     void monitor_signals(sigset_t sigset)
     {
-        int sig = -1;
-        sigwait(&sigset, &sig);
-        if (sig != SIGUSR1)
+        for (auto signals = 0;; ++signals)
+        {
+            int sig = -1;
+            sigwait(&sigset, &sig);
+            if (sig == SIGUSR1)
+                return QCoreApplication::quit();
+
             mpl::log(mpl::Level::info, "daemon", fmt::format("Received signal {} ({})", sig, strsignal(sig)));
-        QCoreApplication::quit();
+            if (signals > 0)
+                return QCoreApplication::quit();
+
+            std::lock_guard<std::mutex> lock{action_mutex};
+            QMetaObject::invokeMethod(QCoreApplication::instance(), first_signal_action, Qt::QueuedConnection);
+        }
     }
 
 private:
-    mp::AutoJoinThread signal_handling_thread;
+    std::mutex action_mutex;
+    std::function<void()> first_signal_action{[] { QCoreApplication::quit(); }};
+    mp::AutoJoinThread signal_handling_thread; // last, for the above to be there before it runs
 };
 
 int main_impl(int argc, char* argv[])
@@ -116,11 +137,17 @@ int main_impl(int argc, char* argv[])
     auto builder = mp::cli::parse(app);
     auto config = builder.build();
     auto server_address = config->server_address;
+    auto plain_address = config->connection_type == mp::RpcConnectionType::ssl
+                             ? mp::utils::plain_socket_address(server_address)
+                             : std::string{};
 
     mp::monitor_and_quit_on_settings_change(); // temporary
     mp::Daemon daemon(std::move(config));
+    handler.on_first_signal([&daemon] { daemon.save_instances_then([] { QCoreApplication::quit(); }); });
 
     set_server_permissions(server_address);
+    if (!plain_address.empty())
+        set_server_permissions(plain_address);
 
     auto ret = QCoreApplication::exec();
 
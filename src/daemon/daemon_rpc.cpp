@@ -18,7 +18,12 @@
 #include "daemon_rpc.h"
 #include "daemon_config.h"
 
+#include <multipass/constants.h>
 #include <multipass/logging/log.h>
+#include <multipass/settings.h>
+#include <multipass/telemetry.h>
+#include <multipass/tracing.h>
+#include <multipass/utils.h>
 #include <multipass/virtual_machine_factory.h>
 #include <multipass/vm_image_host.h>
 
@@ -33,6 +38,8 @@ namespace mpl = multipass::logging;
 namespace
 {
 constexpr auto category = "rpc";
+// How often a watching call checks whether its client is still there
+constexpr auto watch_cancellation_poll = std::chrono::milliseconds(500);
 
 void throw_if_server_exists(const std::string& address)
 {
@@ -51,6 +58,44 @@ void throw_if_server_exists(const std::string& address)
         throw std::runtime_error(fmt::format("a multipass daemon already exists at {}", address));
 }
 
+// Listings can be large; over a loopback or the local socket compressing them only costs CPU
+void compress_for_remote_peer(grpc::ServerContext* context)
+{
+    const auto peer = context->peer();
+    const auto is_local = peer.compare(0, 5, "unix:") == 0 || peer.compare(0, 9, "ipv4:127.") == 0 ||
+                          peer.compare(0, 11, "ipv6:[::1]:") == 0;
+    if (!is_local)
+        context->set_compression_algorithm(GRPC_COMPRESS_GZIP);
+}
+
+// Settings that are missing or malformed leave gRPC's own defaults in place
+void apply_resource_settings(grpc::ServerBuilder& builder)
+{
+    if (auto threads = mp::Settings::instance().get(mp::rpc_threads_key).toInt(); threads > 0)
+    {
+        grpc::ResourceQuota quota{"multipassd"};
+        quota.SetMaxThreads(threads);
+        builder.SetResourceQuota(quota);
+        builder.SetSyncServerOption(grpc::ServerBuilder::SyncServerOption::MAX_POLLERS, threads);
+    }
+
+    if (auto streams = mp::Settings::instance().get(mp::rpc_streams_key).toInt(); streams > 0)
+        builder.AddChannelArgument(GRPC_ARG_MAX_CONCURRENT_STREAMS, streams);
+}
+
+std::map<std::string, int> read_call_limits()
+{
+    try
+    {
+        return mp::utils::parse_counts(mp::Settings::instance().get(mp::rpc_limits_key));
+    }
+    catch (const std::exception& e)
+    {
+        mpl::log(mpl::Level::warning, category, fmt::format("Ignoring call limits: {}", e.what()));
+        return {};
+    }
+}
+
 auto make_server(const std::string& server_address, mp::RpcConnectionType conn_type,
                  const mp::CertProvider& cert_provider, const mp::CertStore& client_cert_store,
                  mp::Rpc::Service* service)
@@ -64,6 +109,8 @@ auto make_server(const std::string& server_address, mp::RpcConnectionType conn_t
         grpc::SslServerCredentialsOptions opts(GRPC_SSL_REQUEST_CLIENT_CERTIFICATE_BUT_DONT_VERIFY);
         opts.pem_key_cert_pairs.push_back({cert_provider.PEM_signing_key(), cert_provider.PEM_certificate()});
         opts.pem_root_certs = client_cert_store.PEM_cert_chain();
+        // The credentials' TLS context, kept for as long as the server, issues the session tickets that clients
+        // resume their sessions with, so that they can connect again without a full handshake
         creds = grpc::SslServerCredentials(opts);
     }
     else if (conn_type == mp::RpcConnectionType::insecure)
@@ -76,6 +123,17 @@ auto make_server(const std::string& server_address, mp::RpcConnectionType conn_t
     }
 
     builder.AddListeningPort(server_address, creds);
+
+    // Only local users that the socket permissions already let in can reach a unix socket, so on top of the TLS
+    // one there is a plain one that spares local clients the handshake
+    const auto plain_address = mp::utils::plain_socket_address(server_address);
+    if (conn_type == mp::RpcConnectionType::ssl && !plain_address.empty())
+    {
+        throw_if_server_exists(plain_address);
+        builder.AddListeningPort(plain_address, grpc::InsecureServerCredentials());
+    }
+
+    apply_resource_settings(builder);
     builder.RegisterService(service);
 
     std::unique_ptr<grpc::Server> server{builder.BuildAndStart()};
@@ -85,6 +143,18 @@ auto make_server(const std::string& server_address, mp::RpcConnectionType conn_t
     return server;
 }
 
+mp::Tracer::Context client_trace_context(const grpc::ServerContext& context)
+{
+    const auto& metadata = context.client_metadata();
+    auto trace_id = metadata.find(mp::Tracer::trace_id_metadata_key);
+    auto span_id = metadata.find(mp::Tracer::span_id_metadata_key);
+    if (trace_id == metadata.end() || span_id == metadata.end())
+        return {};
+
+    return {std::string(trace_id->second.data(), trace_id->second.size()),
+            std::string(span_id->second.data(), span_id->second.size())};
+}
+
 template <typename OperationSignal>
 grpc::Status emit_signal_and_wait_for_result(OperationSignal operation_signal)
 {
@@ -98,122 +168,324 @@ grpc::Status emit_signal_and_wait_for_result(OperationSignal operation_signal)
 
 mp::DaemonRpc::DaemonRpc(const std::string& server_address, mp::RpcConnectionType type,
                          const CertProvider& cert_provider, const CertStore& client_cert_store)
-    : server_address{server_address}, server{make_server(server_address, type, cert_provider, client_cert_store, this)}
+    : server_address{server_address},
+      call_limits{read_call_limits()},
+      server{make_server(server_address, type, cert_provider, client_cert_store, this)}
 {
     std::string ssl_enabled = type == mp::RpcConnectionType::ssl ? "on" : "off";
     mpl::log(mpl::Level::info, category, fmt::format("gRPC listening on {}, SSL:{}", server_address, ssl_enabled));
 }
 
+template <typename Call>
+grpc::Status mp::DaemonRpc::limited(const std::string& method, grpc::ServerContext* context, const void* request,
+                                    Call&& call)
+{
+    auto timer = Telemetry::instance().time("multipass_rpc_duration_seconds", {{"method", method}});
+    auto span = Tracer::instance().span(client_trace_context(*context), "rpc " + method);
+    span.hand_over(request); // to the daemon's handler, which runs on its own thread
+
+    auto limit = call_limits.find(method);
+    if (limit == call_limits.end())
+        return call();
+
+    {
+        std::lock_guard<decltype(calls_mutex)> lock{calls_mutex};
+        if (calls_in_flight[method] >= limit->second)
+        {
+            Telemetry::instance().count("multipass_rpc_rejected_total", {{"method", method}});
+            return grpc::Status{grpc::StatusCode::RESOURCE_EXHAUSTED,
+                                fmt::format("too many {} requests in progress, try again later", method)};
+        }
+        ++calls_in_flight[method];
+    }
+
+    auto status = call();
+
+    std::lock_guard<decltype(calls_mutex)> lock{calls_mutex};
+    --calls_in_flight[method];
+
+    return status;
+}
+
 grpc::Status mp::DaemonRpc::create(grpc::ServerContext* context, const CreateRequest* request,
                                    grpc::ServerWriter<CreateReply>* reply)
 {
-    return emit_signal_and_wait_for_result(
-        std::bind(&DaemonRpc::on_create, this, request, reply, std::placeholders::_1));
+    return limited("create", context, request, [&] {
+        return emit_signal_and_wait_for_result(
+            std::bind(&DaemonRpc::on_create, this, request, reply, std::placeholders::_1));
+    });
 }
 
 grpc::Status mp::DaemonRpc::launch(grpc::ServerContext* context, const LaunchRequest* request,
                                    grpc::ServerWriter<LaunchReply>* reply)
 {
-    return emit_signal_and_wait_for_result(
-        std::bind(&DaemonRpc::on_launch, this, request, reply, std::placeholders::_1));
+    return limited("launch", context, request, [&] {
+        return emit_signal_and_wait_for_result(
+            std::bind(&DaemonRpc::on_launch, this, request, reply, std::placeholders::_1));
+    });
 }
 
 grpc::Status mp::DaemonRpc::purge(grpc::ServerContext* context, const PurgeRequest* request,
                                   grpc::ServerWriter<PurgeReply>* response)
 {
-    return emit_signal_and_wait_for_result(
-        std::bind(&DaemonRpc::on_purge, this, request, response, std::placeholders::_1));
+    return limited("purge", context, request, [&] {
+        return emit_signal_and_wait_for_result(
+            std::bind(&DaemonRpc::on_purge, this, request, response, std::placeholders::_1));
+    });
 }
 
 grpc::Status mp::DaemonRpc::find(grpc::ServerContext* context, const FindRequest* request,
                                  grpc::ServerWriter<FindReply>* response)
 {
-    return emit_signal_and_wait_for_result(
-        std::bind(&DaemonRpc::on_find, this, request, response, std::placeholders::_1));
+    compress_for_remote_peer(context);
+    return limited("find", context, request, [&] {
+        return emit_signal_and_wait_for_result(
+            std::bind(&DaemonRpc::on_find, this, request, response, std::placeholders::_1));
+    });
 }
 
 grpc::Status mp::DaemonRpc::info(grpc::ServerContext* context, const InfoRequest* request,
                                  grpc::ServerWriter<InfoReply>* response)
 {
-    return emit_signal_and_wait_for_result(
-        std::bind(&DaemonRpc::on_info, this, request, response, std::placeholders::_1));
+    compress_for_remote_peer(context);
+    return limited("info", context, request, [&] {
+        return emit_signal_and_wait_for_result(
+            std::bind(&DaemonRpc::on_info, this, request, response, std::placeholders::_1));
+    });
 }
 
 grpc::Status mp::DaemonRpc::list(grpc::ServerContext* context, const ListRequest* request,
                                  grpc::ServerWriter<ListReply>* response)
 {
-    return emit_signal_and_wait_for_result(
-        std::bind(&DaemonRpc::on_list, this, request, response, std::placeholders::_1));
+    compress_for_remote_peer(context);
+    return limited("list", context, request, [&] {
+        return emit_signal_and_wait_for_result(
+            std::bind(&DaemonRpc::on_list, this, request, response, std::placeholders::_1));
+    });
 }
 
 grpc::Status mp::DaemonRpc::mount(grpc::ServerContext* context, const MountRequest* request,
                                   grpc::ServerWriter<MountReply>* response)
 {
-    return emit_signal_and_wait_for_result(
-        std::bind(&DaemonRpc::on_mount, this, request, response, std::placeholders::_1));
+    return limited("mount", context, request, [&] {
+        return emit_signal_and_wait_for_result(
+            std::bind(&DaemonRpc::on_mount, this, request, response, std::placeholders::_1));
+    });
 }
 
 grpc::Status mp::DaemonRpc::recover(grpc::ServerContext* context, const RecoverRequest* request,
                                     grpc::ServerWriter<RecoverReply>* response)
 {
-    return emit_signal_and_wait_for_result(
-        std::bind(&DaemonRpc::on_recover, this, request, response, std::placeholders::_1));
+    return limited("recover", context, request, [&] {
+        return emit_signal_and_wait_for_result(
+            std::bind(&DaemonRpc::on_recover, this, request, response, std::placeholders::_1));
+    });
 }
 
 grpc::Status mp::DaemonRpc::ssh_info(grpc::ServerContext* context, const SSHInfoRequest* request,
                                      grpc::ServerWriter<SSHInfoReply>* response)
 {
-    return emit_signal_and_wait_for_result(
-        std::bind(&DaemonRpc::on_ssh_info, this, request, response, std::placeholders::_1));
+    return limited("ssh_info", context, request, [&] {
+        return emit_signal_and_wait_for_result(
+            std::bind(&DaemonRpc::on_ssh_info, this, request, response, std::placeholders::_1));
+    });
 }
 
 grpc::Status mp::DaemonRpc::start(grpc::ServerContext* context, const StartRequest* request,
                                   grpc::ServerWriter<StartReply>* response)
 {
-    return emit_signal_and_wait_for_result(
-        std::bind(&DaemonRpc::on_start, this, request, response, std::placeholders::_1));
+    return limited("start", context, request, [&] {
+        return emit_signal_and_wait_for_result(
+            std::bind(&DaemonRpc::on_start, this, request, response, std::placeholders::_1));
+    });
 }
 
 grpc::Status mp::DaemonRpc::stop(grpc::ServerContext* context, const StopRequest* request,
                                  grpc::ServerWriter<StopReply>* response)
 {
-    return emit_signal_and_wait_for_result(
-        std::bind(&DaemonRpc::on_stop, this, request, response, std::placeholders::_1));
+    return limited("stop", context, request, [&] {
+        return emit_signal_and_wait_for_result(
+            std::bind(&DaemonRpc::on_stop, this, request, response, std::placeholders::_1));
+    });
 }
 
 grpc::Status mp::DaemonRpc::suspend(grpc::ServerContext* context, const SuspendRequest* request,
                                     grpc::ServerWriter<SuspendReply>* response)
 {
-    return emit_signal_and_wait_for_result(
-        std::bind(&DaemonRpc::on_suspend, this, request, response, std::placeholders::_1));
+    return limited("suspend", context, request, [&] {
+        return emit_signal_and_wait_for_result(
+            std::bind(&DaemonRpc::on_suspend, this, request, response, std::placeholders::_1));
+    });
 }
 
 grpc::Status mp::DaemonRpc::restart(grpc::ServerContext* context, const RestartRequest* request,
                                     grpc::ServerWriter<RestartReply>* response)
 {
-    return emit_signal_and_wait_for_result(
-        std::bind(&DaemonRpc::on_restart, this, request, response, std::placeholders::_1));
+    return limited("restart", context, request, [&] {
+        return emit_signal_and_wait_for_result(
+            std::bind(&DaemonRpc::on_restart, this, request, response, std::placeholders::_1));
+    });
 }
 
 grpc::Status mp::DaemonRpc::delet(grpc::ServerContext* context, const DeleteRequest* request,
                                   grpc::ServerWriter<DeleteReply>* response)
 {
-    return emit_signal_and_wait_for_result(
-        std::bind(&DaemonRpc::on_delete, this, request, response, std::placeholders::_1));
+    return limited("delete", context, request, [&] {
+        return emit_signal_and_wait_for_result(
+            std::bind(&DaemonRpc::on_delete, this, request, response, std::placeholders::_1));
+    });
 }
 
 grpc::Status mp::DaemonRpc::umount(grpc::ServerContext* context, const UmountRequest* request,
                                    grpc::ServerWriter<UmountReply>* response)
 {
-    return emit_signal_and_wait_for_result(
-        std::bind(&DaemonRpc::on_umount, this, request, response, std::placeholders::_1));
+    return limited("umount", context, request, [&] {
+        return emit_signal_and_wait_for_result(
+            std::bind(&DaemonRpc::on_umount, this, request, response, std::placeholders::_1));
+    });
 }
 
 grpc::Status mp::DaemonRpc::version(grpc::ServerContext* context, const VersionRequest* request,
                                     grpc::ServerWriter<VersionReply>* response)
 {
-    return emit_signal_and_wait_for_result(
-        std::bind(&DaemonRpc::on_version, this, request, response, std::placeholders::_1));
+    return limited("version", context, request, [&] {
+        return emit_signal_and_wait_for_result(
+            std::bind(&DaemonRpc::on_version, this, request, response, std::placeholders::_1));
+    });
+}
+
+grpc::Status mp::DaemonRpc::watch(grpc::ServerContext* context, const WatchRequest* request,
+                                  grpc::ServerWriter<WatchReply>* response)
+{
+    return limited("watch", context, request, [&] { return watch_until_cancelled(context, request, response); });
+}
+
+grpc::Status mp::DaemonRpc::watch_until_cancelled(grpc::ServerContext* context, const WatchRequest* request,
+                                                  grpc::ServerWriter<WatchReply>* response)
+{
+    std::promise<grpc::Status> status_promise;
+    auto status_future = status_promise.get_future();
+    emit on_watch(request, response, &status_promise);
+
+    // The daemon keeps writing to the stream until it goes away, or until told the client did
+    while (status_future.wait_for(watch_cancellation_poll) != std::future_status::ready)
+    {
+        if (context->IsCancelled())
+        {
+            emit on_unwatch(response);
+            break;
+        }
+    }
+
+    return status_future.get();
+}
+
+grpc::Status mp::DaemonRpc::metrics(grpc::ServerContext* context, const MetricsRequest* request,
+                                    grpc::ServerWriter<MetricsReply>* response)
+{
+    return limited("metrics", context, request, [&] {
+        return emit_signal_and_wait_for_result(
+            std::bind(&DaemonRpc::on_metrics, this, request, response, std::placeholders::_1));
+    });
+}
+
+grpc::Status mp::DaemonRpc::clone(grpc::ServerContext* context, const CloneRequest* request,
+                                  grpc::ServerWriter<CloneReply>* response)
+{
+    return limited("clone", context, request, [&] {
+        return emit_signal_and_wait_for_result(
+            std::bind(&DaemonRpc::on_clone, this, request, response, std::placeholders::_1));
+    });
+}
+
+grpc::Status mp::DaemonRpc::snapshot(grpc::ServerContext* context, const SnapshotRequest* request,
+                                     grpc::ServerWriter<SnapshotReply>* response)
+{
+    return limited("snapshot", context, request, [&] {
+        return emit_signal_and_wait_for_result(
+            std::bind(&DaemonRpc::on_snapshot, this, request, response, std::placeholders::_1));
+    });
+}
+
+grpc::Status mp::DaemonRpc::restore(grpc::ServerContext* context, const RestoreRequest* request,
+                                    grpc::ServerWriter<RestoreReply>* response)
+{
+    return limited("restore", context, request, [&] {
+        return emit_signal_and_wait_for_result(
+            std::bind(&DaemonRpc::on_restore, this, request, response, std::placeholders::_1));
+    });
+}
+
+grpc::Status mp::DaemonRpc::snapshots(grpc::ServerContext* context, const SnapshotsRequest* request,
+                                      grpc::ServerWriter<SnapshotsReply>* response)
+{
+    return limited("snapshots", context, request, [&] {
+        return emit_signal_and_wait_for_result(
+            std::bind(&DaemonRpc::on_snapshots, this, request, response, std::placeholders::_1));
+    });
+}
+
+grpc::Status mp::DaemonRpc::logs(grpc::ServerContext* context, const LogsRequest* request,
+                                 grpc::ServerWriter<LogsReply>* response)
+{
+    return limited("logs", context, request, [&] {
+        return emit_signal_and_wait_for_result(
+            std::bind(&DaemonRpc::on_logs, this, request, response, std::placeholders::_1));
+    });
+}
+
+grpc::Status mp::DaemonRpc::qos(grpc::ServerContext* context, const QosRequest* request,
+                                grpc::ServerWriter<QosReply>* response)
+{
+    return limited("qos", context, request, [&] {
+        return emit_signal_and_wait_for_result(
+            std::bind(&DaemonRpc::on_qos, this, request, response, std::placeholders::_1));
+    });
+}
+
+grpc::Status mp::DaemonRpc::throttle(grpc::ServerContext* context, const ThrottleRequest* request,
+                                     grpc::ServerWriter<ThrottleReply>* response)
+{
+    return limited("throttle", context, request, [&] {
+        return emit_signal_and_wait_for_result(
+            std::bind(&DaemonRpc::on_throttle, this, request, response, std::placeholders::_1));
+    });
+}
+
+grpc::Status mp::DaemonRpc::resize(grpc::ServerContext* context, const ResizeRequest* request,
+                                   grpc::ServerWriter<ResizeReply>* response)
+{
+    return limited("resize", context, request, [&] {
+        return emit_signal_and_wait_for_result(
+            std::bind(&DaemonRpc::on_resize, this, request, response, std::placeholders::_1));
+    });
+}
+
+grpc::Status mp::DaemonRpc::bake(grpc::ServerContext* context, const BakeRequest* request,
+                                 grpc::ServerWriter<BakeReply>* response)
+{
+    return limited("bake", context, request, [&] {
+        return emit_signal_and_wait_for_result(
+            std::bind(&DaemonRpc::on_bake, this, request, response, std::placeholders::_1));
+    });
+}
+
+grpc::Status mp::DaemonRpc::utilization(grpc::ServerContext* context, const UtilizationRequest* request,
+                                        grpc::ServerWriter<UtilizationReply>* response)
+{
+    return limited("utilization", context, request, [&] {
+        return emit_signal_and_wait_for_result(
+            std::bind(&DaemonRpc::on_utilization, this, request, response, std::placeholders::_1));
+    });
+}
+
+grpc::Status mp::DaemonRpc::forward(grpc::ServerContext* context, const ForwardRequest* request,
+                                    grpc::ServerWriter<ForwardReply>* response)
+{
+    return limited("forward", context, request, [&] {
+        return emit_signal_and_wait_for_result(
+            std::bind(&DaemonRpc::on_forward, this, request, response, std::placeholders::_1));
+    });
 }
 
 grpc::Status mp::DaemonRpc::ping(grpc::ServerContext* context, const PingRequest* request, PingReply* response)
@@ -29,7 +29,10 @@
 #include <QObject>
 
 #include <future>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <string>
 
 namespace multipass
 {
@@ -81,9 +84,46 @@ signals:
                    std::promise<grpc::Status>* status_promise);
     void on_version(const VersionRequest* request, grpc::ServerWriter<VersionReply>* response,
                     std::promise<grpc::Status>* status_promise);
+    void on_watch(const WatchRequest* request, grpc::ServerWriter<WatchReply>* response,
+                  std::promise<grpc::Status>* status_promise);
+    void on_unwatch(grpc::ServerWriter<WatchReply>* response);
+    void on_metrics(const MetricsRequest* request, grpc::ServerWriter<MetricsReply>* response,
+                    std::promise<grpc::Status>* status_promise);
+    void on_clone(const CloneRequest* request, grpc::ServerWriter<CloneReply>* response,
+                  std::promise<grpc::Status>* status_promise);
+    void on_snapshot(const SnapshotRequest* request, grpc::ServerWriter<SnapshotReply>* response,
+                     std::promise<grpc::Status>* status_promise);
+    void on_restore(const RestoreRequest* request, grpc::ServerWriter<RestoreReply>* response,
+                    std::promise<grpc::Status>* status_promise);
+    void on_snapshots(const SnapshotsRequest* request, grpc::ServerWriter<SnapshotsReply>* response,
+                      std::promise<grpc::Status>* status_promise);
+    void on_logs(const LogsRequest* request, grpc::ServerWriter<LogsReply>* response,
+                 std::promise<grpc::Status>* status_promise);
+    void on_qos(const QosRequest* request, grpc::ServerWriter<QosReply>* response,
+                std::promise<grpc::Status>* status_promise);
+    void on_throttle(const ThrottleRequest* request, grpc::ServerWriter<ThrottleReply>* response,
+                     std::promise<grpc::Status>* status_promise);
+    void on_resize(const ResizeRequest* request, grpc::ServerWriter<ResizeReply>* response,
+                   std::promise<grpc::Status>* status_promise);
+    void on_bake(const BakeRequest* request, grpc::ServerWriter<BakeReply>* response,
+                 std::promise<grpc::Status>* status_promise);
+    void on_utilization(const UtilizationRequest* request, grpc::ServerWriter<UtilizationReply>* response,
+                        std::promise<grpc::Status>* status_promise);
+    void on_forward(const ForwardRequest* request, grpc::ServerWriter<ForwardReply>* response,
+                    std::promise<grpc::Status>* status_promise);
 
 private:
+    // Calls beyond their method's limit are turned away at once, rather than holding one more server thread. Each
+    // call is traced, within the client's span when it passed one on
+    template <typename Call>
+    grpc::Status limited(const std::string& method, grpc::ServerContext* context, const void* request, Call&& call);
+    grpc::Status watch_until_cancelled(grpc::ServerContext* context, const WatchRequest* request,
+                                       grpc::ServerWriter<WatchReply>* response);
+
     const std::string server_address;
+    const std::map<std::string, int> call_limits;
+    std::mutex calls_mutex;
+    std::map<std::string, int> calls_in_flight;
     const std::unique_ptr<grpc::Server> server;
 
 protected:
@@ -119,6 +159,32 @@ protected:
                         grpc::ServerWriter<UmountReply>* response) override;
     grpc::Status version(grpc::ServerContext* context, const VersionRequest* request,
                          grpc::ServerWriter<VersionReply>* response) override;
+    grpc::Status watch(grpc::ServerContext* context, const WatchRequest* request,
+                       grpc::ServerWriter<WatchReply>* response) override;
+    grpc::Status metrics(grpc::ServerContext* context, const MetricsRequest* request,
+                         grpc::ServerWriter<MetricsReply>* response) override;
+    grpc::Status clone(grpc::ServerContext* context, const CloneRequest* request,
+                       grpc::ServerWriter<CloneReply>* response) override;
+    grpc::Status snapshot(grpc::ServerContext* context, const SnapshotRequest* request,
+                          grpc::ServerWriter<SnapshotReply>* response) override;
+    grpc::Status restore(grpc::ServerContext* context, const RestoreRequest* request,
+                         grpc::ServerWriter<RestoreReply>* response) override;
+    grpc::Status snapshots(grpc::ServerContext* context, const SnapshotsRequest* request,
+                           grpc::ServerWriter<SnapshotsReply>* response) override;
+    grpc::Status logs(grpc::ServerContext* context, const LogsRequest* request,
+                      grpc::ServerWriter<LogsReply>* response) override;
+    grpc::Status qos(grpc::ServerContext* context, const QosRequest* request,
+                     grpc::ServerWriter<QosReply>* response) override;
+    grpc::Status throttle(grpc::ServerContext* context, const ThrottleRequest* request,
+                          grpc::ServerWriter<ThrottleReply>* response) override;
+    grpc::Status resize(grpc::ServerContext* context, const ResizeRequest* request,
+                        grpc::ServerWriter<ResizeReply>* response) override;
+    grpc::Status bake(grpc::ServerContext* context, const BakeRequest* request,
+                      grpc::ServerWriter<BakeReply>* response) override;
+    grpc::Status utilization(grpc::ServerContext* context, const UtilizationRequest* request,
+                             grpc::ServerWriter<UtilizationReply>* response) override;
+    grpc::Status forward(grpc::ServerContext* context, const ForwardRequest* request,
+                         grpc::ServerWriter<ForwardReply>* response) override;
     grpc::Status ping(grpc::ServerContext* context, const PingRequest* request, PingReply* response) override;
 };
 } // namespace multipass
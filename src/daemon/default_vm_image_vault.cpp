@@ -17,29 +17,45 @@
 
 #include "default_vm_image_vault.h"
 #include "json_writer.h"
+#include "peer_image_server.h"
 
+#include <multipass/constants.h>
 #include <multipass/exceptions/aborted_download_exception.h>
 #include <multipass/exceptions/create_image_exception.h>
 #include <multipass/exceptions/unsupported_image_exception.h>
+#include <multipass/image_decoder.h>
 #include <multipass/logging/log.h>
+#include <multipass/memory_size.h>
 #include <multipass/platform.h>
 #include <multipass/query.h>
 #include <multipass/rpc/multipass.grpc.pb.h>
+#include <multipass/settings.h>
+#include <multipass/sha256.h>
+#include <multipass/telemetry.h>
+#include <multipass/tracing.h>
 #include <multipass/url_downloader.h>
 #include <multipass/utils.h>
 #include <multipass/vm_image.h>
-#include <multipass/xz_image_decoder.h>
 
 #include <multipass/format.h>
 
 #include <QCryptographicHash>
+#include <QDateTime>
+#include <QFutureSynchronizer>
+#include <QHostAddress>
 #include <QJsonArray>
 #include <QJsonDocument>
 #include <QJsonObject>
+#include <QRegExp>
+#include <QSet>
 #include <QUrl>
+#include <QUuid>
 #include <QtConcurrent/QtConcurrent>
 
+#include <algorithm>
 #include <exception>
+#include <thread>
+#include <utility>
 
 namespace mp = multipass;
 namespace mpl = multipass::logging;
@@ -49,6 +65,24 @@ namespace
 constexpr auto category = "image vault";
 constexpr auto instance_db_name = "multipassd-instance-image-records.json";
 constexpr auto image_db_name = "multipassd-image-records.json";
+constexpr auto baked_db_name = "multipassd-baked-image-records.json";
+constexpr auto baked_remote = "baked"; // for asking for a baked image even where an image host has one by that name
+constexpr auto records_write_delay = std::chrono::milliseconds(250); // lets a burst of changes settle into one write
+// Next to a cached image that is still the download its id was verified against, holding that id; only those can be
+// served to peers, as they check what they get against the same id
+constexpr auto shared_digest_suffix = ".sha256";
+
+std::string alias_key(const std::string& remote_name, const std::string& alias)
+{
+    return fmt::format("{}:{}", remote_name, alias);
+}
+
+// Baked images get a directory by their name, so nothing that could step out of it is one
+void check_baked_image_name(const std::string& image_name)
+{
+    if (!QRegExp{"[A-Za-z0-9-]+"}.exactMatch(QString::fromStdString(image_name)))
+        throw std::runtime_error(fmt::format("\"{}\" cannot name a baked image", image_name));
+}
 
 auto filename_for(const QString& path)
 {
@@ -95,6 +129,24 @@ auto record_to_json(const mp::VaultRecord& record)
     json.insert("image", image_to_json(record.image));
     json.insert("query", query_to_json(record.query));
     json.insert("last_accessed", static_cast<qint64>(record.last_accessed.time_since_epoch().count()));
+
+    if (!record.snapshots.empty())
+    {
+        QJsonArray snapshots;
+        for (const auto& snapshot : record.snapshots)
+        {
+            QJsonObject snapshot_entry;
+            snapshot_entry.insert("name", QString::fromStdString(snapshot.name));
+            snapshot_entry.insert("layer", snapshot.layer);
+            snapshot_entry.insert("created", static_cast<qint64>(snapshot.created.time_since_epoch().count()));
+            snapshots.append(snapshot_entry);
+        }
+        json.insert("snapshots", snapshots);
+    }
+
+    if (!record.digest.empty())
+        json.insert("digest", QString::fromStdString(record.digest));
+
     return json;
 }
 
@@ -167,10 +219,21 @@ std::unordered_map<std::string, mp::VaultRecord> load_db(const QString& db_name)
             last_accessed = std::chrono::system_clock::time_point(duration);
         }
 
+        std::vector<mp::VaultSnapshot> snapshots;
+        for (const auto& entry : record["snapshots"].toArray())
+        {
+            auto snapshot = entry.toObject();
+            auto created = std::chrono::system_clock::duration(static_cast<qint64>(snapshot["created"].toDouble()));
+            snapshots.push_back({snapshot["name"].toString().toStdString(), snapshot["layer"].toString(),
+                                 std::chrono::system_clock::time_point(created)});
+        }
+
         reconstructed_records[key] = {
             {image_path, kernel_path, initrd_path, image_id, original_release, current_release, release_date, aliases},
             {"", release.toStdString(), persistent.toBool(), remote_name.toStdString(), query_type},
-            last_accessed};
+            last_accessed,
+            snapshots,
+            record["digest"].toString().toStdString()};
     }
     return reconstructed_records;
 }
@@ -186,10 +249,43 @@ QString copy(const QString& file_name, const QDir& output_dir)
     QFileInfo info{file_name};
     const auto source_name = info.fileName();
     auto new_path = output_dir.filePath(source_name);
-    QFile::copy(file_name, new_path);
+    if (!mp::platform::clone_file(QFile::encodeName(file_name).constData(), QFile::encodeName(new_path).constData()))
+        QFile::copy(file_name, new_path);
+    return new_path;
+}
+
+QString overlay(const QString& backing_file_name, const QDir& output_dir)
+{
+    if (!QFileInfo::exists(backing_file_name))
+        throw std::runtime_error(fmt::format("{} missing", backing_file_name));
+
+    auto new_path = output_dir.filePath(filename_for(backing_file_name));
+    mp::platform::create_image_overlay(QFileInfo{backing_file_name}.absoluteFilePath(), new_path);
     return new_path;
 }
 
+// The images an image reads through, nearest first. Streamed images end in one on the image host, which is left out
+QStringList backing_chain(const QString& image_path)
+{
+    constexpr auto max_chain_length = 64; // well beyond what cloning and snapshots make, but never loops forever
+
+    QStringList chain;
+    auto backing_file = mp::utils::qcow2_backing_file(image_path);
+    while (!backing_file.isEmpty() && !backing_file.startsWith("http") && chain.size() < max_chain_length)
+    {
+        chain << QFileInfo{backing_file}.absoluteFilePath();
+        backing_file = mp::utils::qcow2_backing_file(backing_file);
+    }
+
+    return chain;
+}
+
+auto find_snapshot(const std::vector<mp::VaultSnapshot>& snapshots, const std::string& name)
+{
+    return std::find_if(snapshots.cbegin(), snapshots.cend(),
+                        [&name](const mp::VaultSnapshot& snapshot) { return snapshot.name == name; });
+}
+
 void delete_file(const QString& path)
 {
     QFile file{path};
@@ -207,24 +303,24 @@ void remove_source_images(const mp::VMImage& source_image, const mp::VMImage& pr
         delete_file(source_image.initrd_path);
 }
 
-void verify_image_download(const mp::Path& image_path, const std::string& image_hash)
+void verify_image_download(const QByteArray& image_digest, const std::string& image_hash)
 {
-    QFile image_file(image_path);
-    if (!image_file.open(QFile::ReadOnly))
+    if (image_digest.toStdString() != image_hash)
     {
-        throw std::runtime_error("Cannot open image file for computing hash");
+        throw std::runtime_error("Downloaded image hash does not match");
     }
+}
 
-    QCryptographicHash hash(QCryptographicHash::Sha256);
-    if (!hash.addData(&image_file))
-    {
-        throw std::runtime_error("Cannot read image file to compute hash");
-    }
+// Downloads left off for as long as images are kept are not coming back to be resumed
+bool has_resumable_download(const mp::Path& image_dir, mp::days days_to_expire)
+{
+    const auto left_off_before = QDateTime::currentDateTime().addDays(-days_to_expire.count());
+    const auto journals =
+        QDir(image_dir).entryInfoList({QString("*%1").arg(mp::download_journal_suffix)}, QDir::Files);
 
-    if (hash.result().toHex().toStdString() != image_hash)
-    {
-        throw std::runtime_error("Downloaded image hash does not match");
-    }
+    return std::any_of(journals.cbegin(), journals.cend(), [&left_off_before](const QFileInfo& journal) {
+        return journal.lastModified() > left_off_before;
+    });
 }
 
 void delete_image_dir(const mp::Path& image_path)
@@ -257,6 +353,131 @@ private:
     QFile file;
     const int initial_exc_count = std::uncaught_exceptions();
 };
+// Runs the downloads side by side and, once all of them are over, rethrows the first failure
+void download_concurrently(const std::vector<std::function<void()>>& downloads)
+{
+    std::vector<std::exception_ptr> errors(downloads.size());
+    {
+        QFutureSynchronizer<void> synchronizer;
+        for (std::size_t i = 0; i < downloads.size(); ++i)
+        {
+            synchronizer.addFuture(QtConcurrent::run([&downloads, &errors, i] {
+                try
+                {
+                    downloads[i]();
+                }
+                catch (...)
+                {
+                    errors[i] = std::current_exception();
+                }
+            }));
+        }
+    }
+
+    for (const auto& error : errors)
+        if (error)
+            std::rethrow_exception(error);
+}
+
+// Takes the image from the first peer whose copy hashes to the manifest's sha256
+bool download_from_peers(mp::URLDownloader* url_downloader, const mp::VMImageInfo& info, const mp::Path& image_path,
+                         const mp::ProgressMonitor& monitor, mp::DownloadPriority priority)
+{
+    const auto peers = mp::Settings::instance().get(mp::image_peers_key).split(',', QString::SkipEmptyParts);
+    for (const auto& peer : peers)
+    {
+        const QUrl image_url{QString("%1/images/%2").arg(peer.trimmed()).arg(info.id)};
+        try
+        {
+            const auto digest = url_downloader->download_to(image_url, image_path, info.size,
+                                                            mp::LaunchProgress::IMAGE, monitor, {}, priority);
+            if (digest == info.id.toLatin1())
+            {
+                mpl::log(mpl::Level::info, category, fmt::format("Got {} from {}", info.id, peer));
+                return true;
+            }
+
+            mpl::log(mpl::Level::warning, category, fmt::format("The copy of {} on {} does not match", info.id, peer));
+        }
+        catch (const mp::AbortedDownloadException&)
+        {
+            throw;
+        }
+        catch (const std::exception& e)
+        {
+            mpl::log(mpl::Level::debug, category, fmt::format("Cannot get {} from {}: {}", info.id, peer, e.what()));
+        }
+
+        QFile::remove(image_path);
+        QFile::remove(image_path + mp::download_journal_suffix);
+    }
+
+    return false;
+}
+
+// A qcow2 image served over https can back an instance straight from its host, while a compressed one has to be
+// decoded first. Only images with a hash to check are streamed, the instance being moved onto the cached copy once
+// that is verified, and only for QEMU, which alone streams the rest of the image in rather than reading it remotely
+// for good
+bool launches_streamed(const mp::FetchType& fetch_type, const mp::VMImageInfo& info)
+{
+    return fetch_type == mp::FetchType::ImageOnly && QUrl{info.image_location}.scheme() == "https" && info.verify &&
+           !mp::is_compressed_image(info.image_location) &&
+           mp::Settings::instance().get(mp::driver_key) == QStringLiteral("qemu") &&
+           mp::Settings::instance().get_as<bool>(mp::streaming_launch_key);
+}
+
+// Whether a fetch found its image cached, waited on someone else's download, downloaded it, or streamed it
+void count_image_lookup(const char* result)
+{
+    mp::Telemetry::instance().count("multipass_image_cache_lookups_total", {{"result", result}});
+}
+
+// Reads the file through no faster than bytes_per_second, so that scrubbing does not starve instances of their disks.
+// Nothing when the monitor asks to stop first
+mp::optional<std::string> throttled_sha256_of_file(const mp::Path& path, int64_t bytes_per_second,
+                                                   const mp::ProgressMonitor& monitor)
+{
+    QFile file{path};
+    if (!file.open(QIODevice::ReadOnly))
+        throw std::runtime_error(fmt::format("cannot open {} to hash it: {}", path, file.errorString()));
+
+    constexpr auto chunk_size = 1024 * 1024;
+    const auto start = std::chrono::steady_clock::now();
+    const auto size = std::max<qint64>(file.size(), 1);
+    mp::Sha256 hash;
+    QByteArray chunk(chunk_size, '\0');
+    int64_t total = 0;
+    qint64 read;
+    while ((read = file.read(chunk.data(), chunk.size())) > 0)
+    {
+        hash.add_data(chunk.constData(), read);
+        total += read;
+
+        if (!monitor(mp::LaunchProgress::VERIFY, static_cast<int>(total * 100 / size)))
+            return mp::nullopt;
+
+        std::this_thread::sleep_until(start + std::chrono::microseconds(total * 1000000 / bytes_per_second));
+    }
+
+    if (read < 0)
+        throw std::runtime_error(fmt::format("cannot read {} to hash it: {}", path, file.errorString()));
+
+    return hash.result().toHex().toStdString();
+}
+
+// Custom images are known by the file, its size and when it last changed, so that launching the same file again reuses
+// what was prepared from it without reading it all through
+std::string custom_image_id(const mp::Path& image_path, const mp::FetchType& fetch_type)
+{
+    const QFileInfo file_info{image_path};
+    const auto fingerprint = QString("%1:%2:%3:%4")
+                                 .arg(file_info.canonicalFilePath())
+                                 .arg(file_info.size())
+                                 .arg(file_info.lastModified().toMSecsSinceEpoch())
+                                 .arg(fetch_type == mp::FetchType::ImageKernelAndInitrd ? "kernel" : "image");
+    return QCryptographicHash::hash(fingerprint.toUtf8(), QCryptographicHash::Sha256).toHex().toStdString();
+}
 } // namespace
 
 mp::DefaultVMImageVault::DefaultVMImageVault(std::vector<VMImageHost*> image_hosts, URLDownloader* downloader,
@@ -267,9 +488,12 @@ mp::DefaultVMImageVault::DefaultVMImageVault(std::vector<VMImageHost*> image_hos
       data_dir{QDir(data_dir_path).filePath("vault")},
       instances_dir(data_dir.filePath("instances")),
       images_dir(cache_dir.filePath("images")),
+      layers_dir(data_dir.filePath("layers")),
+      baked_dir(data_dir.filePath("baked")),
       days_to_expire{days_to_expire},
       prepared_image_records{load_db(cache_dir.filePath(image_db_name))},
-      instance_image_records{load_db(data_dir.filePath(instance_db_name))}
+      instance_image_records{load_db(data_dir.filePath(instance_db_name))},
+      baked_image_records{load_db(data_dir.filePath(baked_db_name))}
 {
     for (const auto& image_host : image_hosts)
     {
@@ -278,18 +502,73 @@ mp::DefaultVMImageVault::DefaultVMImageVault(std::vector<VMImageHost*> image_hos
             remote_image_host_map[remote] = image_host;
         }
     }
+
+    index_aliases();
+    records_writer = std::thread{&DefaultVMImageVault::write_records_behind, this};
+
+    const auto sharing_port = Settings::instance().get(image_sharing_port_key).toInt();
+    if (sharing_port > 0)
+    {
+        try
+        {
+            const QHostAddress sharing_address{Settings::instance().get(image_sharing_address_key)};
+            if (sharing_address.isNull())
+                throw std::runtime_error("no address to share them on");
+
+            auto lookup = [this](const std::string& sha256) -> Path {
+                Path image_path;
+                {
+                    std::shared_lock<decltype(fetch_mutex)> lock{fetch_mutex};
+                    auto record = prepared_image_records.find(sha256);
+                    if (record != prepared_image_records.end())
+                        image_path = record->second.image.image_path;
+                }
+
+                QFile digest_file{image_path + shared_digest_suffix};
+                if (image_path.isEmpty() || !digest_file.open(QIODevice::ReadOnly) ||
+                    digest_file.readAll() != QByteArray::fromStdString(sha256))
+                    return {};
+                return image_path;
+            };
+            peer_server = std::make_unique<PeerImageServer>(sharing_address, sharing_port, lookup);
+        }
+        catch (const std::exception& e)
+        {
+            mpl::log(mpl::Level::warning, category, fmt::format("Not sharing images with peers: {}", e.what()));
+        }
+    }
 }
 
 mp::DefaultVMImageVault::~DefaultVMImageVault()
 {
     url_downloader->abort_all_downloads();
+    for (auto& fetch : streamed_image_caching)
+        fetch.waitForFinished();
+
+    // Whatever is still pending gets written before the writer exits
+    {
+        std::lock_guard<decltype(persistence_mutex)> lock{persistence_mutex};
+        stop_persisting = true;
+    }
+    persistence_cv.notify_all();
+    records_writer.join();
 }
 
 mp::VMImage mp::DefaultVMImageVault::fetch_image(const FetchType& fetch_type, const Query& query,
                                                  const PrepareAction& prepare, const ProgressMonitor& monitor)
 {
+    return fetch_image(fetch_type, query, prepare, monitor, DownloadPriority::interactive);
+}
+
+mp::VMImage mp::DefaultVMImageVault::fetch_image(const FetchType& fetch_type, const Query& query,
+                                                 const PrepareAction& prepare, const ProgressMonitor& monitor,
+                                                 DownloadPriority priority)
+{
+    auto span = Tracer::instance().span("vault fetch", {{"instance", query.name}, {"release", query.release}});
+
     {
-        std::lock_guard<decltype(fetch_mutex)> lock{fetch_mutex};
+        // Instances that already have their image only read, so they never wait on each other
+        std::shared_lock<decltype(fetch_mutex)> lock{fetch_mutex};
         auto name_entry = instance_image_records.find(query.name);
         if (name_entry != instance_image_records.end())
         {
@@ -302,249 +581,424 @@ mp::VMImage mp::DefaultVMImageVault::fetch_image(const FetchType& fetch_type, co
     if (query.query_type != Query::Type::Alias && !mp::platform::is_image_url_supported())
         throw std::runtime_error(fmt::format("http and file based images are not supported"));
 
+    std::string id;
+    optional<VMImage> source_image{nullopt};
+    QFuture<VMImage> future;
+
     if (query.query_type == Query::Type::LocalFile)
     {
-        QUrl image_url(QString::fromStdString(query.release));
-        VMImage source_image, vm_image;
+        const auto image_path = QUrl(QString::fromStdString(query.release)).path();
+        if (!QFile::exists(image_path))
+            throw std::runtime_error(fmt::format("Custom image `{}` does not exist.", image_path));
 
-        if (!QFile::exists(image_url.path()))
-            throw std::runtime_error(fmt::format("Custom image `{}` does not exist.", image_url.path()));
+        id = custom_image_id(image_path, fetch_type);
 
-        source_image.image_path = image_url.path();
+        std::unique_lock<decltype(fetch_mutex)> lock{fetch_mutex};
+        auto entry = prepared_image_records.find(id);
+        if (entry != prepared_image_records.end())
+        {
+            const auto prepared_image = entry->second.image;
+            lock.unlock();
+            count_image_lookup("hit");
+            return finalize_image_records(query, prepared_image, id);
+        }
 
-        if (source_image.image_path.endsWith(".xz"))
+        auto running_future = get_image_future(id);
+        if (running_future)
         {
-            source_image = extract_image_from(query.name, source_image, monitor);
+            count_image_lookup("joined");
+            monitor(LaunchProgress::WAITING, -1);
+            future = *running_future;
         }
         else
         {
-            source_image = image_instance_from(query.name, source_image);
+            count_image_lookup("miss");
+            const auto image_dir =
+                mp::utils::make_dir(images_dir, QString("custom-%1").arg(QString::fromStdString(id).left(12)));
+            future = QtConcurrent::run(Tracer::instance().carry(
+                "image fetch", std::bind(&DefaultVMImageVault::prepare_custom_image, this, image_path, id, image_dir,
+                                         fetch_type, prepare, monitor, priority)));
+
+            in_progress_image_fetches[id] = future;
         }
+    }
+    else if (query.query_type == Query::Type::HttpDownload)
+    {
+        QUrl image_url(QString::fromStdString(query.release));
 
-        if (fetch_type == FetchType::ImageKernelAndInitrd)
+        // Generate a sha256 hash based on the URL and use that for the id
+        id = QCryptographicHash::hash(query.release.c_str(), QCryptographicHash::Sha256).toHex().toStdString();
+        auto last_modified = url_downloader->last_modified(image_url);
+
+        std::unique_lock<decltype(fetch_mutex)> lock{fetch_mutex};
+        auto entry = prepared_image_records.find(id);
+        if (entry != prepared_image_records.end())
         {
-            auto info = get_kernel_query_info(query.name);
+            const auto prepared_image = entry->second.image;
 
-            source_image =
-                fetch_kernel_and_initrd(info, source_image, QFileInfo(source_image.image_path).absoluteDir(), monitor);
+            if (last_modified.isValid() && (last_modified.toString().toStdString() == prepared_image.release_date))
+            {
+                lock.unlock();
+                count_image_lookup("hit");
+                return finalize_image_records(query, prepared_image, id);
+            }
         }
 
-        vm_image = prepare(source_image);
-        remove_source_images(source_image, vm_image);
-
+        auto running_future = get_image_future(id);
+        if (running_future)
         {
-            std::lock_guard<decltype(fetch_mutex)> lock{fetch_mutex};
-            instance_image_records[query.name] = {vm_image, query, std::chrono::system_clock::now()};
-            persist_instance_records();
+            count_image_lookup("joined");
+            monitor(LaunchProgress::WAITING, -1);
+            future = *running_future;
+        }
+        else
+        {
+            count_image_lookup("miss");
+            auto kernel_info = get_kernel_query_info(query.name);
+            const VMImageInfo info{{},
+                                   {},
+                                   {},
+                                   {},
+                                   true,
+                                   image_url.url(),
+                                   kernel_info.kernel_location,
+                                   kernel_info.initrd_location,
+                                   QString::fromStdString(id),
+                                   last_modified.toString(),
+                                   0,
+                                   false};
+            const auto image_filename = filename_for(image_url.path());
+            // Attempt to make a sane directory name based on the filename of the image
+
+            const auto image_dir_name =
+                QString("%1-%2")
+                    .arg(image_filename.section(".", 0, mp::is_compressed_image(image_filename) ? -3 : -2))
+                    .arg(last_modified.toString("yyyyMMdd"));
+            const auto image_dir = mp::utils::make_dir(images_dir, image_dir_name);
+
+            // Had to use std::bind here to workaround the 5 allowable function arguments constraint of
+            // QtConcurrent::run()
+            future = QtConcurrent::run(Tracer::instance().carry(
+                "image fetch", std::bind(&DefaultVMImageVault::download_and_prepare_source_image, this, info,
+                                         source_image, image_dir, fetch_type, prepare, monitor, priority)));
+
+            in_progress_image_fetches[id] = future;
         }
-
-        return vm_image;
     }
     else
     {
-        std::string id;
-        optional<VMImage> source_image{nullopt};
-        QFuture<VMImage> future;
-
-        if (query.query_type == Query::Type::HttpDownload)
+        // Baked images go before what the image hosts offer, as they were made on purpose under that name
+        if (auto baked_image = baked_image_for(query))
         {
-            QUrl image_url(QString::fromStdString(query.release));
+            count_image_lookup("baked");
+            return query.name.empty() ? *baked_image : instance_image_over(query, *baked_image);
+        }
 
-            // Generate a sha256 hash based on the URL and use that for the id
-            id = QCryptographicHash::hash(query.release.c_str(), QCryptographicHash::Sha256).toHex().toStdString();
-            auto last_modified = url_downloader->last_modified(image_url);
+        const auto info = info_for(query);
 
-            std::lock_guard<decltype(fetch_mutex)> lock{fetch_mutex};
-            auto entry = prepared_image_records.find(id);
-            if (entry != prepared_image_records.end())
-            {
-                auto& record = entry->second;
+        if (!mp::platform::is_remote_supported(query.remote_name))
+            throw std::runtime_error(
+                fmt::format("{} is not a supported remote. Please use `multipass find` for supported images.",
+                            query.remote_name));
 
-                if (last_modified.isValid() && (last_modified.toString().toStdString() == record.image.release_date))
-                {
-                    return finalize_image_records(query, record.image, id);
-                }
+        if (!mp::platform::is_alias_supported(query.release, query.remote_name))
+            throw std::runtime_error(
+                fmt::format("{} is not a supported alias. Please use `multipass find` for supported image aliases.",
+                            query.release));
+
+        id = info.id.toStdString();
+
+        std::unique_lock<decltype(fetch_mutex)> lock{fetch_mutex};
+        if (!query.name.empty())
+        {
+            // Images are keyed by their sha256, so the same bytes are shared whichever remote or alias they
+            // were asked for by. Failing that, a cached image the alias resolved to earlier will do
+            auto record = prepared_image_records.find(id);
+            if (record == prepared_image_records.end())
+            {
+                auto indexed_id = alias_index.find(alias_key(query.remote_name, query.release));
+                if (indexed_id != alias_index.end())
+                    record = prepared_image_records.find(indexed_id->second);
             }
 
-            auto running_future = get_image_future(id);
-            if (running_future)
+            if (record != prepared_image_records.end())
             {
-                monitor(LaunchProgress::WAITING, -1);
-                future = *running_future;
+                const auto prepared_image = record->second.image;
+                const auto prepared_id = record->first;
+                lock.unlock();
+                try
+                {
+                    auto vm_image = finalize_image_records(query, prepared_image, prepared_id);
+                    count_image_lookup("hit");
+                    return vm_image;
+                }
+                catch (const std::exception& e)
+                {
+                    mpl::log(mpl::Level::warning, category,
+                             fmt::format("Cannot create instance image: {}", e.what()));
+                }
+                lock.lock();
             }
             else
             {
-                auto kernel_info = get_kernel_query_info(query.name);
-                const VMImageInfo info{{},
-                                       {},
-                                       {},
-                                       {},
-                                       true,
-                                       image_url.url(),
-                                       kernel_info.kernel_location,
-                                       kernel_info.initrd_location,
-                                       QString::fromStdString(id),
-                                       last_modified.toString(),
-                                       0,
-                                       false};
-                const auto image_filename = filename_for(image_url.path());
-                // Attempt to make a sane directory name based on the filename of the image
-
-                const auto image_dir_name =
-                    QString("%1-%2")
-                        .arg(image_filename.section(".", 0, image_filename.endsWith(".xz") ? -3 : -2))
-                        .arg(last_modified.toString("yyyyMMdd"));
-                const auto image_dir = mp::utils::make_dir(images_dir, image_dir_name);
-
-                // Had to use std::bind here to workaround the 5 allowable function arguments constraint of
-                // QtConcurrent::run()
-                future = QtConcurrent::run(std::bind(&DefaultVMImageVault::download_and_prepare_source_image, this,
-                                                     info, source_image, image_dir, fetch_type, prepare, monitor));
-
-                in_progress_image_fetches[id] = future;
+                lock.unlock();
+                if (auto shared_image = shared_image_for(id))
+                {
+                    try
+                    {
+                        auto vm_image = instance_image_over(query, *shared_image);
+                        count_image_lookup("shared");
+                        return vm_image;
+                    }
+                    catch (const std::exception& e)
+                    {
+                        mpl::log(mpl::Level::warning, category,
+                                 fmt::format("Cannot create instance image from the shared cache: {}", e.what()));
+                    }
+                }
+                lock.lock();
             }
         }
+
+        auto running_future = get_image_future(id);
+        if (running_future)
+        {
+            count_image_lookup("joined");
+            monitor(LaunchProgress::WAITING, -1);
+            future = *running_future;
+        }
         else
         {
-            const auto info = info_for(query);
-
-            if (!mp::platform::is_remote_supported(query.remote_name))
-                throw std::runtime_error(
-                    fmt::format("{} is not a supported remote. Please use `multipass find` for supported images.",
-                                query.remote_name));
-
-            if (!mp::platform::is_alias_supported(query.release, query.remote_name))
-                throw std::runtime_error(
-                    fmt::format("{} is not a supported alias. Please use `multipass find` for supported image aliases.",
-                                query.release));
+            const auto streamed = !query.name.empty() && launches_streamed(fetch_type, info);
+            count_image_lookup(streamed ? "streamed" : "miss");
+            const auto image_dir =
+                mp::utils::make_dir(images_dir, QString("%1-%2").arg(info.release).arg(info.version));
 
-            id = info.id.toStdString();
-
-            std::lock_guard<decltype(fetch_mutex)> lock{fetch_mutex};
-            if (!query.name.empty())
+            if (streamed)
             {
-                for (auto& record : prepared_image_records)
+                // The instance reads from the image host while the cache gets its own copy, for the next launch
+                future = QtConcurrent::run(std::bind(&DefaultVMImageVault::cache_streamed_image, this, info,
+                                                     image_dir, fetch_type, prepare, query));
+                in_progress_image_fetches[id] = future;
+                streamed_image_caching.erase(std::remove_if(streamed_image_caching.begin(),
+                                                            streamed_image_caching.end(),
+                                                            [](const auto& fetch) { return fetch.isFinished(); }),
+                                             streamed_image_caching.end());
+                streamed_image_caching.push_back(future);
+                lock.unlock();
+
+                try
                 {
-                    if (record.second.query.remote_name != query.remote_name)
-                        continue;
-
-                    const auto aliases = record.second.image.aliases;
-                    if (id == record.first ||
-                        std::find(aliases.cbegin(), aliases.cend(), query.release) != aliases.cend())
-                    {
-                        const auto prepared_image = record.second.image;
-                        try
-                        {
-                            return finalize_image_records(query, prepared_image, record.first);
-                        }
-                        catch (const std::exception& e)
-                        {
-                            mpl::log(mpl::Level::warning, category,
-                                     fmt::format("Cannot create instance image: {}", e.what()));
-
-                            break;
-                        }
-                    }
+                    return streamed_instance_image(query, info);
+                }
+                catch (const std::exception& e)
+                {
+                    mpl::log(mpl::Level::warning, category,
+                             fmt::format("Cannot stream {}, waiting for its download instead: {}", query.release,
+                                         e.what()));
                 }
-            }
-
-            auto running_future = get_image_future(id);
-            if (running_future)
-            {
-                monitor(LaunchProgress::WAITING, -1);
-                future = *running_future;
             }
             else
             {
-                const auto image_dir =
-                    mp::utils::make_dir(images_dir, QString("%1-%2").arg(info.release).arg(info.version));
-
                 // Had to use std::bind here to workaround the 5 allowable function arguments constraint of
                 // QtConcurrent::run()
-                future = QtConcurrent::run(std::bind(&DefaultVMImageVault::download_and_prepare_source_image, this,
-                                                     info, source_image, image_dir, fetch_type, prepare, monitor));
+                future = QtConcurrent::run(Tracer::instance().carry(
+                    "image fetch", std::bind(&DefaultVMImageVault::download_and_prepare_source_image, this, info,
+                                             source_image, image_dir, fetch_type, prepare, monitor, priority)));
 
                 in_progress_image_fetches[id] = future;
             }
         }
+    }
 
-        try
-        {
-            auto prepared_image = future.result();
-            std::lock_guard<decltype(fetch_mutex)> lock{fetch_mutex};
-            in_progress_image_fetches.erase(id);
-            return finalize_image_records(query, prepared_image, id);
-        }
-        catch (const AbortedDownloadException&)
-        {
-            throw;
-        }
-        catch (const std::exception& e)
+    try
+    {
+        auto prepared_image = future.result();
         {
             std::lock_guard<decltype(fetch_mutex)> lock{fetch_mutex};
             in_progress_image_fetches.erase(id);
-            throw;
         }
+        auto vm_image = finalize_image_records(query, prepared_image, id);
+        request_eviction();
+
+        return vm_image;
+    }
+    catch (const AbortedDownloadException&)
+    {
+        throw;
+    }
+    catch (const std::exception& e)
+    {
+        std::lock_guard<decltype(fetch_mutex)> lock{fetch_mutex};
+        in_progress_image_fetches.erase(id);
+        throw;
     }
 }
 
 void mp::DefaultVMImageVault::remove(const std::string& name)
 {
-    const auto& name_entry = instance_image_records.find(name);
-    if (name_entry == instance_image_records.end())
-        return;
+    {
+        std::lock_guard<decltype(fetch_mutex)> lock{fetch_mutex};
+        if (!instance_image_records.erase(name))
+            return;
+
+        persist_instance_records();
+    }
 
     QDir instance_dir{instances_dir};
     if (instance_dir.cd(QString::fromStdString(name)))
         instance_dir.removeRecursively();
 
-    instance_image_records.erase(name);
-    persist_instance_records();
+    remove_unused_layers();
 }
 
 bool mp::DefaultVMImageVault::has_record_for(const std::string& name)
 {
+    std::shared_lock<decltype(fetch_mutex)> lock{fetch_mutex};
     return instance_image_records.find(name) != instance_image_records.end();
 }
 
 void mp::DefaultVMImageVault::prune_expired_images()
 {
     std::vector<decltype(prepared_image_records)::key_type> expired_keys;
-    std::lock_guard<decltype(fetch_mutex)> lock{fetch_mutex};
+    std::vector<mp::Path> doomed_image_paths; // deleted once the lock is released
+    // With a budget, images leave the cache when it runs out of room rather than when they get old
+    const auto budgeted = cache_budget() > 0;
+    std::unique_lock<decltype(fetch_mutex)> lock{fetch_mutex};
 
     for (const auto& record : prepared_image_records)
     {
-        // Expire source images if they aren't persistent and haven't been accessed in 14 days
-        if (record.second.query.query_type == Query::Type::Alias && !record.second.query.persistent &&
+        // Expire source images if they aren't persistent and haven't been accessed in 14 days. Custom files are
+        // rebuilt often, so what was prepared from them goes the same way
+        const auto expires = record.second.query.query_type != Query::Type::HttpDownload;
+        if (!budgeted && expires && !record.second.query.persistent &&
             record.second.last_accessed + days_to_expire <= std::chrono::system_clock::now())
         {
+            if (is_backing_image_in_use(record.second.image))
+            {
+                mpl::log(mpl::Level::debug, category,
+                         fmt::format("Source image {} is expired but still backs instances. Keeping it.",
+                                     record.second.query.release));
+                continue;
+            }
+
             mpl::log(
                 mpl::Level::info, category,
                 fmt::format("Source image {} is expired. Removing it from the cache.", record.second.query.release));
             expired_keys.push_back(record.first);
-            delete_image_dir(record.second.image.image_path);
+            doomed_image_paths.push_back(record.second.image.image_path);
         }
     }
 
-    // Remove any image directories that have no corresponding database entry
+    // Remove any image directories that have no corresponding database entry and no resumable download
+    QSet<QString> recorded_paths;
+    for (const auto& record : prepared_image_records)
+    {
+        const QFileInfo image_file{record.second.image.image_path};
+        recorded_paths.insert(image_file.absoluteFilePath());
+        recorded_paths.insert(image_file.absolutePath());
+    }
+
     for (const auto& entry : images_dir.entryInfoList(QDir::AllEntries | QDir::NoDotAndDotDot))
     {
-        if (std::find_if(prepared_image_records.cbegin(), prepared_image_records.cend(),
-                         [&entry](const std::pair<std::string, VaultRecord>& record) {
-                             return record.second.image.image_path.contains(entry.absoluteFilePath());
-                         }) == prepared_image_records.cend())
+        // Whatever this process is still fetching may be writing to its journal right now
+        if (entry.isDir() && (!in_progress_image_fetches.empty() ||
+                              has_resumable_download(entry.absoluteFilePath(), days_to_expire)))
+            continue;
+
+        if (!recorded_paths.contains(entry.absoluteFilePath()))
         {
             mpl::log(mpl::Level::info, category,
                      fmt::format("Source image {} is no longer valid. Removing it from the cache.",
                                  entry.absoluteFilePath()));
-            delete_image_dir(entry.absoluteFilePath());
+            doomed_image_paths.push_back(entry.absoluteFilePath());
         }
     }
 
     for (const auto& key : expired_keys)
         prepared_image_records.erase(key);
 
+    index_aliases();
     persist_image_records();
+    lock.unlock();
+
+    for (const auto& image_path : doomed_image_paths)
+        delete_image_dir(image_path);
+
+    if (budgeted)
+        evict_to_budget();
+}
+
+qint64 mp::DefaultVMImageVault::cache_budget() const
+{
+    return MemorySize{Settings::instance().get(image_cache_size_key).toStdString()}.in_bytes();
+}
+
+void mp::DefaultVMImageVault::evict_to_budget()
+{
+    const auto budget = cache_budget();
+    if (budget <= 0)
+        return;
+
+    struct Candidate
+    {
+        std::string id;
+        std::chrono::system_clock::time_point last_accessed;
+        qint64 size;
+        bool evictable;
+    };
+
+    // Sizes are taken without the lock, since the cache may have many images on a slow disk
+    std::vector<std::pair<std::string, VaultRecord>> records;
+    {
+        std::shared_lock<decltype(fetch_mutex)> lock{fetch_mutex};
+        records.assign(prepared_image_records.cbegin(), prepared_image_records.cend());
+    }
+
+    qint64 usage{0};
+    std::vector<Candidate> candidates;
+    for (const auto& record : records)
+    {
+        const auto& image = record.second.image;
+        qint64 size{0};
+        for (const auto& path : {image.image_path, image.kernel_path, image.initrd_path})
+            if (!path.isEmpty())
+                size += QFileInfo{path}.size();
+
+        usage += size;
+        candidates.push_back({record.first, record.second.last_accessed, size, !record.second.query.persistent});
+    }
+
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+        return a.last_accessed < b.last_accessed;
+    });
+
+    // One image at a time, so that launches never wait on more than a single eviction
+    for (const auto& candidate : candidates)
+    {
+        if (usage <= budget)
+            break;
+        if (!candidate.evictable)
+            continue;
+
+        std::unique_lock<decltype(fetch_mutex)> lock{fetch_mutex};
+        auto record = prepared_image_records.find(candidate.id);
+        if (record == prepared_image_records.end() || is_backing_image_in_use(record->second.image) ||
+            record->second.last_accessed != candidate.last_accessed)
+            continue;
+
+        mpl::log(mpl::Level::info, category,
+                 fmt::format("Removing least recently used source image {} to keep the cache within {} bytes",
+                             record->second.query.release, budget));
+        const auto image_path = record->second.image.image_path;
+        prepared_image_records.erase(record);
+        index_aliases();
+        persist_image_records();
+        lock.unlock();
+
+        delete_image_dir(image_path);
+        usage -= candidate.size;
+    }
 }
 
 void mp::DefaultVMImageVault::update_images(const FetchType& fetch_type, const PrepareAction& prepare,
@@ -561,7 +1015,11 @@ void mp::DefaultVMImageVault::update_images(const FetchType& fetch_type, const P
             try
             {
                 auto info = info_for(record.second.query);
-                if (info.id.toStdString() != record.first)
+                const auto latest_id = info.id.toStdString();
+                // An outdated image kept around for the instances it backs needs no further update
+                if (latest_id != record.first &&
+                    (prepared_image_records.find(latest_id) == prepared_image_records.end() ||
+                     !is_backing_image_in_use(record.second.image)))
                 {
                     keys_to_update.push_back(record.first);
                 }
@@ -575,17 +1033,33 @@ void mp::DefaultVMImageVault::update_images(const FetchType& fetch_type, const P
 
     for (const auto& key : keys_to_update)
     {
-        const auto& record = prepared_image_records[key];
+        auto& record = prepared_image_records[key];
         mpl::log(mpl::Level::info, category, fmt::format("Updating {} source image to latest", record.query.release));
         try
         {
-            fetch_image(fetch_type, record.query, prepare, monitor);
+            fetch_image(fetch_type, record.query, prepare, monitor, DownloadPriority::background);
 
-            // Remove old image
-            std::lock_guard<decltype(fetch_mutex)> lock{fetch_mutex};
-            delete_image_dir(record.image.image_path);
-            prepared_image_records.erase(key);
-            persist_image_records();
+            // Remove old image, unless instances are still backed by it. Then it is kept, non-persistent, until
+            // the last of them is deleted and it expires.
+            std::unique_lock<decltype(fetch_mutex)> lock{fetch_mutex};
+            if (is_backing_image_in_use(record.image))
+            {
+                mpl::log(mpl::Level::info, category,
+                         fmt::format("Keeping previous {} source image for the instances it backs",
+                                     record.query.release));
+                record.query.persistent = false;
+                persist_image_records();
+            }
+            else
+            {
+                const auto old_image_path = record.image.image_path;
+                prepared_image_records.erase(key);
+                index_aliases();
+                persist_image_records();
+                lock.unlock();
+
+                delete_image_dir(old_image_path);
+            }
         }
         catch (const CreateImageException& e)
         {
@@ -595,23 +1069,119 @@ void mp::DefaultVMImageVault::update_images(const FetchType& fetch_type, const P
     }
 }
 
-mp::VMImage mp::DefaultVMImageVault::download_and_prepare_source_image(
-    const VMImageInfo& info, mp::optional<VMImage>& existing_source_image, const QDir& image_dir,
-    const FetchType& fetch_type, const PrepareAction& prepare, const ProgressMonitor& monitor)
+void mp::DefaultVMImageVault::prefetch_image(const FetchType& fetch_type, const Query& query,
+                                             const PrepareAction& prepare, const ProgressMonitor& monitor)
 {
-    VMImage source_image;
-    auto id = info.id.toStdString();
-
-    if (existing_source_image)
+    const auto id = info_for(query).id.toStdString();
     {
-        source_image = *existing_source_image;
+        std::shared_lock<decltype(fetch_mutex)> lock{fetch_mutex};
+        if (prepared_image_records.find(id) != prepared_image_records.end())
+            return;
     }
-    else
-    {
-        source_image.id = id;
-        source_image.image_path = image_dir.filePath(filename_for(info.image_location));
-        source_image.original_release = info.release_title.toStdString();
-        source_image.release_date = info.version.toStdString();
+
+    mpl::log(mpl::Level::info, category, fmt::format("Prefetching {} source image", query.release));
+
+    // Without an instance name, fetching only prepares the source image
+    Query prefetch_query{query};
+    prefetch_query.name = "";
+    fetch_image(fetch_type, prefetch_query, prepare, monitor, DownloadPriority::background);
+}
+
+void mp::DefaultVMImageVault::scrub_images(const FetchType& fetch_type, const PrepareAction& prepare,
+                                           const ProgressMonitor& monitor, int64_t bytes_per_second)
+{
+    struct Cached
+    {
+        std::string id;
+        Path image_path;
+        std::string digest;
+    };
+
+    std::vector<Cached> cached;
+    {
+        std::shared_lock<decltype(fetch_mutex)> lock{fetch_mutex};
+        for (const auto& record : prepared_image_records)
+            cached.push_back({record.first, record.second.image.image_path, record.second.digest});
+    }
+
+    mpl::log(mpl::Level::debug, category, fmt::format("Scrubbing {} cached images…", cached.size()));
+
+    for (const auto& image : cached)
+    {
+        // Images cached before their digests were recorded have nothing to be held to
+        if (image.digest.empty())
+            continue;
+
+        mp::optional<std::string> digest;
+        try
+        {
+            digest = throttled_sha256_of_file(image.image_path, bytes_per_second, monitor);
+        }
+        catch (const std::exception& e)
+        {
+            mpl::log(mpl::Level::warning, category, fmt::format("Cannot scrub {}: {}", image.image_path, e.what()));
+            continue;
+        }
+
+        if (!digest)
+            return;
+
+        // Preparing most images changes them from what the manifest hashes, so they are held to what they hashed to
+        // once prepared
+        std::unique_lock<decltype(fetch_mutex)> lock{fetch_mutex};
+        auto it = prepared_image_records.find(image.id);
+        if (it == prepared_image_records.end() || it->second.image.image_path != image.image_path ||
+            *digest == it->second.digest)
+            continue;
+
+        Telemetry::instance().count("multipass_scrub_failures_total", {{"kind", "image"}});
+        if (is_backing_image_in_use(it->second.image))
+        {
+            mpl::log(mpl::Level::error, category,
+                     fmt::format("Cached image {} is corrupt, but instances are backed by it", image.image_path));
+            continue;
+        }
+
+        mpl::log(mpl::Level::warning, category,
+                 fmt::format("Cached image {} is corrupt, fetching it again", image.image_path));
+        auto query = it->second.query;
+        query.name = "";
+        prepared_image_records.erase(it);
+        index_aliases();
+        persist_image_records();
+        lock.unlock();
+
+        delete_image_dir(image.image_path);
+        try
+        {
+            fetch_image(fetch_type, query, prepare, monitor, DownloadPriority::background);
+        }
+        catch (const std::exception& e)
+        {
+            mpl::log(mpl::Level::warning, category,
+                     fmt::format("Cannot fetch {} source image again: {}", query.release, e.what()));
+        }
+    }
+}
+
+mp::VMImage mp::DefaultVMImageVault::download_and_prepare_source_image(
+    const VMImageInfo& info, mp::optional<VMImage>& existing_source_image, const QDir& image_dir,
+    const FetchType& fetch_type, const PrepareAction& prepare, const ProgressMonitor& monitor,
+    DownloadPriority priority)
+{
+    VMImage source_image;
+    auto id = info.id.toStdString();
+
+    if (existing_source_image)
+    {
+        source_image = *existing_source_image;
+    }
+    else
+    {
+        source_image.id = id;
+        source_image.image_path = image_dir.filePath(filename_for(info.image_location));
+        source_image.original_release = info.release_title.toStdString();
+        source_image.release_date = info.version.toStdString();
 
         for (const auto& alias : info.aliases)
         {
@@ -619,32 +1189,99 @@ mp::VMImage mp::DefaultVMImageVault::download_and_prepare_source_image(
         }
     }
 
-    DeleteOnException image_file{source_image.image_path};
-
     try
     {
-        url_downloader->download_to(info.image_location, source_image.image_path, info.size, LaunchProgress::IMAGE,
-                                    monitor);
+        // Compressed images are decoded on a worker thread while they download
+        PipelinedImageDecoder::UPtr image_decoder;
+        URLDownloader::DataSink sink;
+        const auto decoded_image_path = mp::decoded_image_path(source_image.image_path);
+        if (mp::is_compressed_image(source_image.image_path))
+        {
+            image_decoder = mp::make_pipelined_image_decoder(source_image.image_path, decoded_image_path);
+            sink = [&image_decoder](const QByteArray& chunk) { image_decoder->feed(chunk); };
+        }
+        DeleteOnException decoded_image_file{image_decoder ? decoded_image_path : QString()};
+
+        // The kernel and initrd come down alongside the image, so the fetch takes as long as its largest file
+        const auto with_kernel_and_initrd = fetch_type == FetchType::ImageKernelAndInitrd;
+        DeleteOnException kernel_file{with_kernel_and_initrd ? image_dir.filePath(filename_for(info.kernel_location))
+                                                             : QString()};
+        DeleteOnException initrd_file{with_kernel_and_initrd ? image_dir.filePath(filename_for(info.initrd_location))
+                                                             : QString()};
+
+        QByteArray image_digest;
+        VMImage kernel_and_initrd;
+        std::vector<std::function<void()>> downloads{[&] {
+            // Peers serve images as they are cached, so a compressed one or one that cannot be verified is never
+            // asked for, nor one whose partial download is waiting to be resumed
+            if (!image_decoder && info.verify &&
+                !QFile::exists(source_image.image_path + download_journal_suffix) &&
+                download_from_peers(url_downloader, info, source_image.image_path, monitor, priority))
+            {
+                image_digest = info.id.toLatin1();
+                return;
+            }
+
+            // A failed download leaves its partial file behind so the next attempt can resume it
+            image_digest = url_downloader->download_to(info.image_location, source_image.image_path, info.size,
+                                                       LaunchProgress::IMAGE, monitor, sink, priority);
+        }};
+        if (with_kernel_and_initrd)
+            downloads.emplace_back(
+                [&] { kernel_and_initrd = fetch_kernel_and_initrd(info, source_image, image_dir, monitor, priority); });
+
+        try
+        {
+            auto phase = Tracer::instance().span("image download", {{"image", id}});
+            download_concurrently(downloads);
+        }
+        catch (...)
+        {
+            // Unlike a partial image, which a later attempt resumes, a complete one is no use without the others
+            if (!image_digest.isEmpty())
+                delete_file(source_image.image_path);
+            throw;
+        }
+
+        DeleteOnException image_file{source_image.image_path};
 
         if (info.verify)
         {
             monitor(LaunchProgress::VERIFY, -1);
-            verify_image_download(source_image.image_path, id);
+            auto phase = Tracer::instance().span("image verify");
+            verify_image_download(image_digest, id);
         }
 
-        if (fetch_type == FetchType::ImageKernelAndInitrd)
+        if (with_kernel_and_initrd)
         {
-            source_image = fetch_kernel_and_initrd(info, source_image, image_dir, monitor);
+            source_image.kernel_path = kernel_and_initrd.kernel_path;
+            source_image.initrd_path = kernel_and_initrd.initrd_path;
         }
 
-        if (source_image.image_path.endsWith(".xz"))
+        if (image_decoder)
         {
-            source_image = extract_downloaded_image(source_image, monitor);
+            monitor(LaunchProgress::EXTRACT, -1);
+            auto phase = Tracer::instance().span("image extract");
+            image_decoder->finish();
+            delete_file(source_image.image_path);
+            source_image.image_path = decoded_image_path;
         }
 
-        auto prepared_image = prepare(source_image);
+        auto prepared_image = [&] {
+            auto phase = Tracer::instance().span("image prepare");
+            return prepare(source_image);
+        }();
         remove_source_images(source_image, prepared_image);
 
+        // Preparing may have converted the image, and decoding surely changed it, so only an image still as verified
+        // is known to hash to its id
+        if (info.verify && !image_decoder && prepared_image.image_path == source_image.image_path)
+        {
+            QFile digest_file{prepared_image.image_path + shared_digest_suffix};
+            if (digest_file.open(QIODevice::WriteOnly))
+                digest_file.write(info.id.toLatin1());
+        }
+
         return prepared_image;
     }
     catch (const AbortedDownloadException&)
@@ -657,35 +1294,57 @@ mp::VMImage mp::DefaultVMImageVault::download_and_prepare_source_image(
     }
 }
 
-mp::VMImage mp::DefaultVMImageVault::extract_image_from(const std::string& instance_name, const VMImage& source_image,
-                                                        const ProgressMonitor& monitor)
+mp::VMImage mp::DefaultVMImageVault::prepare_custom_image(const mp::Path& image_path, const std::string& id,
+                                                          const QDir& image_dir, const FetchType& fetch_type,
+                                                          const PrepareAction& prepare, const ProgressMonitor& monitor,
+                                                          DownloadPriority priority)
 {
-    const auto name = QString::fromStdString(instance_name);
-    const QDir output_dir{mp::utils::make_dir(instances_dir, name)};
-    QFileInfo file_info{source_image.image_path};
-    const auto image_name = file_info.fileName().remove(".xz");
-    const auto image_path = output_dir.filePath(image_name);
+    try
+    {
+        // The vault keeps a copy of its own to prepare, as the file given may change or go away
+        VMImage source_image;
+        source_image.id = id;
+        source_image.image_path = image_path;
+        if (mp::is_compressed_image(image_path))
+            source_image = extract_image_from(image_dir, source_image, monitor);
+        else
+            source_image.image_path = copy(image_path, image_dir);
 
-    VMImage image{source_image};
-    image.image_path = image_path;
+        if (fetch_type == FetchType::ImageKernelAndInitrd)
+            source_image = fetch_kernel_and_initrd(get_kernel_query_info(""), source_image, image_dir, monitor,
+                                                   priority);
 
-    XzImageDecoder xz_decoder(source_image.image_path);
-    xz_decoder.decode_to(image_path, monitor);
+        auto prepared_image = [&] {
+            auto phase = Tracer::instance().span("image prepare");
+            return prepare(source_image);
+        }();
+        remove_source_images(source_image, prepared_image);
 
-    return image;
+        return prepared_image;
+    }
+    catch (const AbortedDownloadException&)
+    {
+        QDir{image_dir}.removeRecursively();
+        throw;
+    }
+    catch (const std::exception& e)
+    {
+        QDir{image_dir}.removeRecursively();
+        throw CreateImageException(e.what());
+    }
 }
 
-mp::VMImage mp::DefaultVMImageVault::extract_downloaded_image(const VMImage& source_image,
-                                                              const ProgressMonitor& monitor)
+mp::VMImage mp::DefaultVMImageVault::extract_image_from(const QDir& output_dir, const VMImage& source_image,
+                                                        const ProgressMonitor& monitor)
 {
-    VMImage image{source_image};
-    XzImageDecoder xz_decoder(image.image_path);
-    auto image_path = image.image_path.remove(".xz");
+    QFileInfo file_info{source_image.image_path};
+    const auto image_path = output_dir.filePath(mp::decoded_image_path(file_info.fileName()));
 
-    xz_decoder.decode_to(image_path, monitor);
-    delete_file(source_image.image_path);
+    VMImage image{source_image};
     image.image_path = image_path;
 
+    mp::make_image_decoder(source_image.image_path)->decode_to(image_path, monitor);
+
     return image;
 }
 
@@ -705,8 +1364,289 @@ mp::VMImage mp::DefaultVMImageVault::image_instance_from(const std::string& inst
             {}};
 }
 
+mp::VMImage mp::DefaultVMImageVault::image_overlay_from(const std::string& instance_name,
+                                                        const VMImage& prepared_image)
+{
+    if (!Settings::instance().get_as<bool>(image_overlays_key) || !mp::utils::is_qcow2_image(prepared_image.image_path))
+        return image_instance_from(instance_name, prepared_image);
+
+    auto name = QString::fromStdString(instance_name);
+    auto output_dir = mp::utils::make_dir(instances_dir, name);
+
+    QString image_path;
+    try
+    {
+        image_path = overlay(prepared_image.image_path, output_dir);
+    }
+    catch (const std::exception& e)
+    {
+        mpl::log(mpl::Level::warning, category,
+                 fmt::format("Cannot create image overlay for {}, copying the image instead: {}", instance_name,
+                             e.what()));
+        delete_file(output_dir.filePath(filename_for(prepared_image.image_path)));
+        image_path = copy(prepared_image.image_path, output_dir);
+    }
+
+    return {image_path,
+            copy(prepared_image.kernel_path, output_dir),
+            copy(prepared_image.initrd_path, output_dir),
+            prepared_image.id,
+            prepared_image.original_release,
+            prepared_image.current_release,
+            prepared_image.release_date,
+            {}};
+}
+
+bool mp::DefaultVMImageVault::is_backing_image_in_use(const VMImage& prepared_image) const
+{
+    // Cloned instances read the cached image through the layers they share
+    const auto image_path = QFileInfo{prepared_image.image_path}.absoluteFilePath();
+    return std::any_of(instance_image_records.cbegin(), instance_image_records.cend(),
+                       [&image_path](const std::pair<const std::string, VaultRecord>& record) {
+                           return backing_chain(record.second.image.image_path).contains(image_path);
+                       });
+}
+
+QString mp::DefaultVMImageVault::freeze_instance_image(const VMImage& instance_image)
+{
+    if (!mp::utils::is_qcow2_image(instance_image.image_path))
+        throw std::runtime_error(fmt::format("{} is not a qcow2 image", instance_image.image_path));
+
+    QDir{}.mkpath(layers_dir.path());
+    const auto layer = layers_dir.filePath(QString("%1.qcow2").arg(QUuid::createUuid().toString().mid(1, 36)));
+    if (!QFile::rename(instance_image.image_path, layer))
+        throw std::runtime_error(fmt::format("Cannot move {} to {}", instance_image.image_path, layer));
+
+    try
+    {
+        mp::platform::create_image_overlay(layer, instance_image.image_path);
+    }
+    catch (...)
+    {
+        QFile::rename(layer, instance_image.image_path);
+        throw;
+    }
+
+    return layer;
+}
+
+void mp::DefaultVMImageVault::remove_unused_layers()
+{
+    QSet<QString> used_layers;
+    {
+        std::shared_lock<decltype(fetch_mutex)> lock{fetch_mutex};
+        for (const auto& record : instance_image_records)
+        {
+            for (const auto& backing_file : backing_chain(record.second.image.image_path))
+                used_layers.insert(backing_file);
+
+            for (const auto& snapshot : record.second.snapshots)
+            {
+                used_layers.insert(QFileInfo{snapshot.layer}.absoluteFilePath());
+                for (const auto& backing_file : backing_chain(snapshot.layer))
+                    used_layers.insert(backing_file);
+            }
+        }
+    }
+
+    for (const auto& layer : layers_dir.entryInfoList(QDir::Files))
+        if (!used_layers.contains(layer.absoluteFilePath()))
+            QFile::remove(layer.absoluteFilePath());
+}
+
+mp::VaultRecord mp::DefaultVMImageVault::instance_record_for(const std::string& name)
+{
+    std::shared_lock<decltype(fetch_mutex)> lock{fetch_mutex};
+    auto record = instance_image_records.find(name);
+    if (record == instance_image_records.end())
+        throw std::runtime_error(fmt::format("There is no image for \"{}\"", name));
+
+    return record->second;
+}
+
+mp::VMImage mp::DefaultVMImageVault::clone_instance_image(const std::string& source_name,
+                                                          const std::string& clone_name)
+{
+    auto source_record = instance_record_for(source_name);
+    if (has_record_for(clone_name))
+        throw std::runtime_error(fmt::format("There is an image for \"{}\" already", clone_name));
+
+    // Both instances go on from what the source's image is now, each writing to an overlay of its own
+    return clone_onto_layer(source_record, freeze_instance_image(source_record.image), clone_name);
+}
+
+mp::VMImage mp::DefaultVMImageVault::clone_template_image(const std::string& template_name,
+                                                          const std::string& clone_name)
+{
+    auto template_record = instance_record_for(template_name);
+    if (has_record_for(clone_name))
+        throw std::runtime_error(fmt::format("There is an image for \"{}\" already", clone_name));
+
+    // The first clone freezes the template's image, and the template, which writes nothing after that, is left with
+    // an empty overlay on the layer that every later clone shares too
+    auto layer = mp::utils::qcow2_backing_file(template_record.image.image_path);
+    if (QFileInfo{layer}.absolutePath() != layers_dir.absolutePath())
+        layer = freeze_instance_image(template_record.image);
+
+    return clone_onto_layer(template_record, layer, clone_name);
+}
+
+mp::VMImage mp::DefaultVMImageVault::clone_onto_layer(const VaultRecord& source_record, const QString& layer,
+                                                      const std::string& clone_name)
+{
+    auto output_dir = mp::utils::make_dir(instances_dir, QString::fromStdString(clone_name));
+    auto vm_image = source_record.image;
+    vm_image.image_path = output_dir.filePath(filename_for(source_record.image.image_path));
+    {
+        DeleteOnException image_file{vm_image.image_path};
+        mp::platform::create_image_overlay(layer, vm_image.image_path);
+    }
+    vm_image.kernel_path = copy(source_record.image.kernel_path, output_dir);
+    vm_image.initrd_path = copy(source_record.image.initrd_path, output_dir);
+
+    auto query = source_record.query;
+    query.name = clone_name;
+
+    std::lock_guard<decltype(fetch_mutex)> lock{fetch_mutex};
+    instance_image_records[clone_name] = {vm_image, query, std::chrono::system_clock::now()};
+    persist_instance_records();
+
+    return vm_image;
+}
+
+void mp::DefaultVMImageVault::snapshot_instance_image(const std::string& instance_name,
+                                                      const std::string& snapshot_name)
+{
+    auto record = instance_record_for(instance_name);
+    if (find_snapshot(record.snapshots, snapshot_name) != record.snapshots.cend())
+        throw std::runtime_error(
+            fmt::format("\"{}\" has a snapshot named \"{}\" already", instance_name, snapshot_name));
+
+    // The instance goes on in a fresh overlay, so taking the snapshot copies nothing
+    const auto layer = freeze_instance_image(record.image);
+
+    std::lock_guard<decltype(fetch_mutex)> lock{fetch_mutex};
+    auto it = instance_image_records.find(instance_name);
+    if (it == instance_image_records.end())
+        throw std::runtime_error(fmt::format("\"{}\" was removed while taking its snapshot", instance_name));
+
+    it->second.snapshots.push_back({snapshot_name, layer, std::chrono::system_clock::now()});
+    persist_instance_records();
+}
+
+void mp::DefaultVMImageVault::restore_instance_image(const std::string& instance_name,
+                                                     const std::string& snapshot_name)
+{
+    auto record = instance_record_for(instance_name);
+    auto snapshot = find_snapshot(record.snapshots, snapshot_name);
+    if (snapshot == record.snapshots.cend())
+        throw std::runtime_error(fmt::format("\"{}\" has no snapshot named \"{}\"", instance_name, snapshot_name));
+
+    // Everything written since the snapshot is in the instance's own overlay, which a new one replaces
+    const auto& image_path = record.image.image_path;
+    const auto restored_path = image_path + ".restored";
+    {
+        DeleteOnException restored_file{restored_path};
+        mp::platform::create_image_overlay(snapshot->layer, restored_path);
+    }
+
+    QFile::remove(image_path);
+    if (!QFile::rename(restored_path, image_path))
+        throw std::runtime_error(fmt::format("Cannot move {} to {}", restored_path, image_path));
+}
+
+std::vector<mp::ImageSnapshot> mp::DefaultVMImageVault::instance_image_snapshots(const std::string& instance_name)
+{
+    std::vector<ImageSnapshot> snapshots;
+    for (const auto& snapshot : instance_record_for(instance_name).snapshots)
+        snapshots.push_back({snapshot.name, snapshot.created});
+
+    return snapshots;
+}
+
+void mp::DefaultVMImageVault::bake_instance_image(const std::string& instance_name, const std::string& image_name,
+                                                  bool compress)
+{
+    check_baked_image_name(image_name);
+    const auto record = instance_record_for(instance_name);
+    {
+        // The name is taken along with the check, so that two bakes by the same name cannot both write to it
+        std::lock_guard<decltype(fetch_mutex)> lock{fetch_mutex};
+        if (baked_image_records.find(image_name) != baked_image_records.end() ||
+            !baking_images.insert(image_name).second)
+            throw std::runtime_error(fmt::format("There is a baked image called \"{}\" already", image_name));
+    }
+
+    // Flattened, the baked image stands on its own, whatever happens to the instance and the layers under it
+    auto baked_image = record.image;
+    try
+    {
+        QDir{}.mkpath(baked_dir.path());
+        auto output_dir = mp::utils::make_dir(baked_dir, QString::fromStdString(image_name));
+        baked_image.image_path = output_dir.filePath(filename_for(record.image.image_path));
+        try
+        {
+            mp::platform::flatten_image(record.image.image_path, baked_image.image_path, compress);
+            baked_image.kernel_path = copy(record.image.kernel_path, output_dir);
+            baked_image.initrd_path = copy(record.image.initrd_path, output_dir);
+        }
+        catch (...)
+        {
+            output_dir.removeRecursively();
+            throw;
+        }
+    }
+    catch (...)
+    {
+        std::lock_guard<decltype(fetch_mutex)> lock{fetch_mutex};
+        baking_images.erase(image_name);
+        throw;
+    }
+    baked_image.aliases = {image_name};
+
+    std::lock_guard<decltype(fetch_mutex)> lock{fetch_mutex};
+    baking_images.erase(image_name);
+    baked_image_records[image_name] = {baked_image, Query{"", image_name, false, baked_remote, Query::Type::Alias},
+                                       std::chrono::system_clock::now()};
+    persist_baked_records();
+}
+
+void mp::DefaultVMImageVault::remove_baked_image(const std::string& image_name)
+{
+    check_baked_image_name(image_name);
+    VMImage baked_image;
+    {
+        std::lock_guard<decltype(fetch_mutex)> lock{fetch_mutex};
+        auto record = baked_image_records.find(image_name);
+        if (record == baked_image_records.end())
+            throw std::runtime_error(fmt::format("There is no baked image called \"{}\"", image_name));
+        if (is_backing_image_in_use(record->second.image))
+            throw std::runtime_error(
+                fmt::format("Instances launched from \"{}\" still read through it; delete them first", image_name));
+
+        baked_image = record->second.image;
+        baked_image_records.erase(record);
+        persist_baked_records();
+    }
+
+    // Only ever a directory of the baked images', whatever the record says
+    const QFileInfo image_dir{QFileInfo{baked_image.image_path}.absolutePath()};
+    if (image_dir.absoluteDir() == QDir{baked_dir.absolutePath()})
+        QDir{image_dir.absoluteFilePath()}.removeRecursively();
+}
+
+bool mp::DefaultVMImageVault::is_baked_image(const Query& query)
+{
+    if (!query.remote_name.empty() && query.remote_name != baked_remote)
+        return false;
+
+    std::shared_lock<decltype(fetch_mutex)> lock{fetch_mutex};
+    return baked_image_records.find(query.release) != baked_image_records.end();
+}
+
 mp::VMImage mp::DefaultVMImageVault::fetch_kernel_and_initrd(const VMImageInfo& info, const VMImage& source_image,
-                                                             const QDir& image_dir, const ProgressMonitor& monitor)
+                                                             const QDir& image_dir, const ProgressMonitor& monitor,
+                                                             DownloadPriority priority)
 {
     auto image{source_image};
 
@@ -714,8 +1654,14 @@ mp::VMImage mp::DefaultVMImageVault::fetch_kernel_and_initrd(const VMImageInfo&
     image.initrd_path = image_dir.filePath(filename_for(info.initrd_location));
     DeleteOnException kernel_file{image.kernel_path};
     DeleteOnException initrd_file{image.initrd_path};
-    url_downloader->download_to(info.kernel_location, image.kernel_path, -1, LaunchProgress::KERNEL, monitor);
-    url_downloader->download_to(info.initrd_location, image.initrd_path, -1, LaunchProgress::INITRD, monitor);
+    download_concurrently({[&] {
+                               url_downloader->download_to(info.kernel_location, image.kernel_path, -1,
+                                                           LaunchProgress::KERNEL, monitor, {}, priority);
+                           },
+                           [&] {
+                               url_downloader->download_to(info.initrd_location, image.initrd_path, -1,
+                                                           LaunchProgress::INITRD, monitor, {}, priority);
+                           }});
 
     return image;
 }
@@ -731,21 +1677,53 @@ mp::optional<QFuture<mp::VMImage>> mp::DefaultVMImageVault::get_image_future(con
     return mp::nullopt;
 }
 
+void mp::DefaultVMImageVault::index_aliases()
+{
+    alias_index.clear();
+    for (const auto& record : prepared_image_records)
+        for (const auto& alias : record.second.image.aliases)
+            alias_index[alias_key(record.second.query.remote_name, alias)] = record.first;
+}
+
 mp::VMImage mp::DefaultVMImageVault::finalize_image_records(const Query& query, const VMImage& prepared_image,
                                                             const std::string& id)
 {
     VMImage vm_image;
 
+    // Copying or overlaying the image is by far the slowest part, and only concerns this instance
     if (!query.name.empty())
+        vm_image = image_overlay_from(query.name, prepared_image);
+
+    // Freshly prepared images are hashed as they are now, for scrubs to tell when they stop being so
+    std::string digest;
     {
-        vm_image = image_instance_from(query.name, prepared_image);
-        instance_image_records[query.name] = {vm_image, query, std::chrono::system_clock::now()};
+        std::lock_guard<decltype(fetch_mutex)> lock{fetch_mutex};
+        auto record = prepared_image_records.find(id);
+        if (record != prepared_image_records.end() && record->second.image.image_path == prepared_image.image_path)
+            digest = record->second.digest;
+    }
+    if (digest.empty())
+    {
+        try
+        {
+            digest = sha256_of_file(prepared_image.image_path).toStdString();
+        }
+        catch (const std::exception& e)
+        {
+            mpl::log(mpl::Level::warning, category,
+                     fmt::format("Cannot hash {}, it will not be scrubbed: {}", prepared_image.image_path, e.what()));
+        }
     }
 
+    std::lock_guard<decltype(fetch_mutex)> lock{fetch_mutex};
+    if (!query.name.empty())
+        instance_image_records[query.name] = {vm_image, query, std::chrono::system_clock::now()};
+
     // Do not save the instance name for prepared images
     Query prepared_query{query};
     prepared_query.name = "";
-    prepared_image_records[id] = {prepared_image, prepared_query, std::chrono::system_clock::now()};
+    prepared_image_records[id] = {prepared_image, prepared_query, std::chrono::system_clock::now(), {}, digest};
+    index_aliases();
 
     persist_instance_records();
     persist_image_records();
@@ -753,6 +1731,138 @@ mp::VMImage mp::DefaultVMImageVault::finalize_image_records(const Query& query,
     return vm_image;
 }
 
+mp::optional<mp::VMImage> mp::DefaultVMImageVault::shared_image_for(const std::string& id)
+{
+    const auto shared_cache = Settings::instance().get(shared_image_cache_key);
+    if (shared_cache.isEmpty())
+        return nullopt;
+
+    // Read afresh each time, since the daemon that owns the cache keeps adding to it
+    const auto records = load_db(QDir{shared_cache}.filePath(QString("vault/%1").arg(image_db_name)));
+    const auto record = records.find(id);
+    if (record == records.end())
+        return nullopt;
+
+    const auto& image = record->second.image;
+    if (!QFile::exists(image.image_path) || (!image.kernel_path.isEmpty() && !QFile::exists(image.kernel_path)) ||
+        (!image.initrd_path.isEmpty() && !QFile::exists(image.initrd_path)))
+        return nullopt;
+
+    return image;
+}
+
+mp::optional<mp::VMImage> mp::DefaultVMImageVault::baked_image_for(const Query& query)
+{
+    if (!query.remote_name.empty() && query.remote_name != baked_remote)
+        return nullopt;
+
+    std::shared_lock<decltype(fetch_mutex)> lock{fetch_mutex};
+    auto record = baked_image_records.find(query.release);
+    if (record != baked_image_records.end())
+        return record->second.image;
+
+    if (query.remote_name == baked_remote)
+        throw std::runtime_error(fmt::format("There is no baked image called \"{}\"", query.release));
+
+    return nullopt;
+}
+
+mp::VMImage mp::DefaultVMImageVault::instance_image_over(const Query& query, const VMImage& foreign_image)
+{
+    // Shared and baked images are not among the prepared ones, so nothing here ever updates, expires or deletes them
+    auto vm_image = image_overlay_from(query.name, foreign_image);
+
+    std::lock_guard<decltype(fetch_mutex)> lock{fetch_mutex};
+    instance_image_records[query.name] = {vm_image, query, std::chrono::system_clock::now()};
+    persist_instance_records();
+
+    return vm_image;
+}
+
+mp::VMImage mp::DefaultVMImageVault::streamed_instance_image(const Query& query, const VMImageInfo& info)
+{
+    auto output_dir = mp::utils::make_dir(instances_dir, QString::fromStdString(query.name));
+    const auto image_path = output_dir.filePath(filename_for(info.image_location));
+
+    {
+        DeleteOnException image_file{image_path};
+        mp::platform::create_image_overlay(info.image_location, image_path);
+    }
+
+    VMImage vm_image{image_path, "", "", info.id.toStdString(), info.release_title.toStdString(), "",
+                     info.version.toStdString(), {}};
+
+    std::lock_guard<decltype(fetch_mutex)> lock{fetch_mutex};
+    instance_image_records[query.name] = {vm_image, query, std::chrono::system_clock::now()};
+    persist_instance_records();
+
+    return vm_image;
+}
+
+mp::VMImage mp::DefaultVMImageVault::cache_streamed_image(const VMImageInfo& info, const QDir& image_dir,
+                                                          const FetchType& fetch_type, const PrepareAction& prepare,
+                                                          const Query& query)
+{
+    const auto id = info.id.toStdString();
+    optional<VMImage> no_source_image;
+    Query prepared_query{query};
+    prepared_query.name = "";
+
+    try
+    {
+        auto prepared_image = download_and_prepare_source_image(info, no_source_image, image_dir, fetch_type, prepare,
+                                                                [](auto...) { return true; },
+                                                                DownloadPriority::background);
+        {
+            std::lock_guard<decltype(fetch_mutex)> lock{fetch_mutex};
+            in_progress_image_fetches.erase(id);
+        }
+
+        // Without an instance name, this only records the prepared image
+        finalize_image_records(prepared_query, prepared_image, id);
+        request_eviction();
+        rebase_streamed_instances(info, prepared_image);
+
+        return prepared_image;
+    }
+    catch (const std::exception& e)
+    {
+        mpl::log(mpl::Level::warning, category,
+                 fmt::format("Cannot cache {} behind its streamed launch: {}", info.release, e.what()));
+
+        std::lock_guard<decltype(fetch_mutex)> lock{fetch_mutex};
+        in_progress_image_fetches.erase(id);
+        throw;
+    }
+}
+
+// The image the instances were launched on has been downloaded from the same place and checked against its hash, so
+// whatever they have yet to read comes from the verified copy instead. Those running already have their stream job
+// to finish what they started, qemu-img being unable to take an image in use
+void mp::DefaultVMImageVault::rebase_streamed_instances(const VMImageInfo& info, const VMImage& verified_image)
+{
+    std::vector<mp::Path> streamed_images;
+    {
+        std::shared_lock<decltype(fetch_mutex)> lock{fetch_mutex};
+        for (const auto& record : instance_image_records)
+            if (mp::utils::qcow2_backing_file(record.second.image.image_path) == info.image_location)
+                streamed_images.push_back(record.second.image.image_path);
+    }
+
+    for (const auto& image_path : streamed_images)
+    {
+        try
+        {
+            mp::platform::rebase_image_overlay(verified_image.image_path, image_path);
+        }
+        catch (const std::exception& e)
+        {
+            mpl::log(mpl::Level::debug, category,
+                     fmt::format("Leaving {} to stream in the rest of its image: {}", image_path, e.what()));
+        }
+    }
+}
+
 mp::VMImageInfo mp::DefaultVMImageVault::info_for(const mp::Query& query)
 {
     if (!query.remote_name.empty())
@@ -791,7 +1901,7 @@ mp::VMImageInfo mp::DefaultVMImageVault::get_kernel_query_info(const std::string
 namespace
 {
 template <typename T>
-void persist_records(const T& records, const QString& path)
+QJsonObject records_to_json(const T& records)
 {
     QJsonObject json_records;
     for (const auto& record : records)
@@ -799,16 +1909,90 @@ void persist_records(const T& records, const QString& path)
         auto key = QString::fromStdString(record.first);
         json_records.insert(key, record_to_json(record.second));
     }
-    mp::write_json(json_records, path);
+    return json_records;
 }
 } // namespace
 
+// These only mark the records for the writer, so callers holding fetch_mutex never wait on the disk
 void mp::DefaultVMImageVault::persist_instance_records()
 {
-    persist_records(instance_image_records, data_dir.filePath(instance_db_name));
+    {
+        std::lock_guard<decltype(persistence_mutex)> lock{persistence_mutex};
+        instance_records_dirty = true;
+    }
+    persistence_cv.notify_one();
+}
+
+void mp::DefaultVMImageVault::persist_baked_records()
+{
+    {
+        std::lock_guard<decltype(persistence_mutex)> lock{persistence_mutex};
+        baked_records_dirty = true;
+    }
+    persistence_cv.notify_one();
 }
 
 void mp::DefaultVMImageVault::persist_image_records()
 {
-    persist_records(prepared_image_records, cache_dir.filePath(image_db_name));
+    {
+        std::lock_guard<decltype(persistence_mutex)> lock{persistence_mutex};
+        image_records_dirty = true;
+    }
+    persistence_cv.notify_one();
+}
+
+void mp::DefaultVMImageVault::request_eviction()
+{
+    {
+        std::lock_guard<decltype(persistence_mutex)> lock{persistence_mutex};
+        eviction_due = true;
+    }
+    persistence_cv.notify_one();
+}
+
+void mp::DefaultVMImageVault::write_records_behind()
+{
+    std::unique_lock<decltype(persistence_mutex)> lock{persistence_mutex};
+    while (true)
+    {
+        persistence_cv.wait(lock, [this] {
+            return stop_persisting || image_records_dirty || instance_records_dirty || baked_records_dirty ||
+                   eviction_due;
+        });
+        persistence_cv.wait_for(lock, records_write_delay, [this] { return stop_persisting; });
+
+        const auto write_images = std::exchange(image_records_dirty, false);
+        const auto write_instances = std::exchange(instance_records_dirty, false);
+        const auto write_baked = std::exchange(baked_records_dirty, false);
+        const auto evict = std::exchange(eviction_due, false);
+        const auto stopping = stop_persisting;
+        lock.unlock();
+
+        QJsonObject image_records, instance_records, baked_records;
+        {
+            std::shared_lock<decltype(fetch_mutex)> fetch_lock{fetch_mutex};
+            if (write_images)
+                image_records = records_to_json(prepared_image_records);
+            if (write_instances)
+                instance_records = records_to_json(instance_image_records);
+            if (write_baked)
+                baked_records = records_to_json(baked_image_records);
+        }
+
+        if (write_images)
+            mp::write_json(image_records, cache_dir.filePath(image_db_name));
+        if (write_instances)
+            mp::write_json(instance_records, data_dir.filePath(instance_db_name));
+        if (write_baked)
+            mp::write_json(baked_records, data_dir.filePath(baked_db_name));
+
+        if (stopping)
+            return;
+
+        // A newly cached image may have taken the cache over its budget
+        if (evict)
+            evict_to_budget();
+
+        lock.lock();
+    }
 }
@@ -19,6 +19,7 @@
 #define MULTIPASS_DEFAULT_VM_IMAGE_VAULT_H
 
 #include <multipass/days.h>
+#include <multipass/download_scheduler.h>
 #include <multipass/optional.h>
 #include <multipass/path.h>
 #include <multipass/query.h>
@@ -29,20 +30,36 @@
 #include <QDir>
 #include <QFuture>
 
+#include <condition_variable>
 #include <memory>
 #include <mutex>
+#include <shared_mutex>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 namespace multipass
 {
+class PeerImageServer;
 class URLDownloader;
 class VMImageHost;
+class VaultSnapshot
+{
+public:
+    std::string name;
+    QString layer;
+    std::chrono::system_clock::time_point created;
+};
+
 class VaultRecord
 {
 public:
     multipass::VMImage image;
     multipass::Query query;
     std::chrono::system_clock::time_point last_accessed;
+    std::vector<VaultSnapshot> snapshots; // of instance images, made oldest first
+    std::string digest; // what a prepared image hashed to once prepared
 };
 class DefaultVMImageVault final : public VMImageVault
 {
@@ -58,23 +75,58 @@ public:
     void prune_expired_images() override;
     void update_images(const FetchType& fetch_type, const PrepareAction& prepare,
                        const ProgressMonitor& monitor) override;
+    void prefetch_image(const FetchType& fetch_type, const Query& query, const PrepareAction& prepare,
+                        const ProgressMonitor& monitor) override;
+    void scrub_images(const FetchType& fetch_type, const PrepareAction& prepare, const ProgressMonitor& monitor,
+                      int64_t bytes_per_second) override;
+    VMImage clone_instance_image(const std::string& source_name, const std::string& clone_name) override;
+    VMImage clone_template_image(const std::string& template_name, const std::string& clone_name) override;
+    void snapshot_instance_image(const std::string& instance_name, const std::string& snapshot_name) override;
+    void restore_instance_image(const std::string& instance_name, const std::string& snapshot_name) override;
+    std::vector<ImageSnapshot> instance_image_snapshots(const std::string& instance_name) override;
+    void bake_instance_image(const std::string& instance_name, const std::string& image_name, bool compress) override;
+    void remove_baked_image(const std::string& image_name) override;
+    bool is_baked_image(const Query& query) override;
 
 private:
+    VMImage fetch_image(const FetchType& fetch_type, const Query& query, const PrepareAction& prepare,
+                        const ProgressMonitor& monitor, DownloadPriority priority);
+    VaultRecord instance_record_for(const std::string& name);
     VMImage image_instance_from(const std::string& name, const VMImage& prepared_image);
+    VMImage image_overlay_from(const std::string& name, const VMImage& prepared_image);
+    bool is_backing_image_in_use(const VMImage& prepared_image) const;
+    QString freeze_instance_image(const VMImage& instance_image);
+    VMImage clone_onto_layer(const VaultRecord& source_record, const QString& layer, const std::string& clone_name);
+    void remove_unused_layers();
     VMImage download_and_prepare_source_image(const VMImageInfo& info, optional<VMImage>& existing_source_image,
                                               const QDir& image_dir, const FetchType& fetch_type,
-                                              const PrepareAction& prepare, const ProgressMonitor& monitor);
-    VMImage extract_image_from(const std::string& instance_name, const VMImage& source_image,
-                               const ProgressMonitor& monitor);
-    VMImage extract_downloaded_image(const VMImage& source_image, const ProgressMonitor& monitor);
+                                              const PrepareAction& prepare, const ProgressMonitor& monitor,
+                                              DownloadPriority priority);
+    VMImage prepare_custom_image(const Path& image_path, const std::string& id, const QDir& image_dir,
+                                 const FetchType& fetch_type, const PrepareAction& prepare,
+                                 const ProgressMonitor& monitor, DownloadPriority priority);
+    VMImage extract_image_from(const QDir& output_dir, const VMImage& source_image, const ProgressMonitor& monitor);
     VMImage fetch_kernel_and_initrd(const VMImageInfo& info, const VMImage& source_image, const QDir& image_dir,
-                                    const ProgressMonitor& monitor);
+                                    const ProgressMonitor& monitor, DownloadPriority priority);
     optional<QFuture<VMImage>> get_image_future(const std::string& id);
+    void index_aliases();
     VMImage finalize_image_records(const Query& query, const VMImage& prepared_image, const std::string& id);
+    optional<VMImage> shared_image_for(const std::string& id);
+    qint64 cache_budget() const;
+    void evict_to_budget();
+    optional<VMImage> baked_image_for(const Query& query);
+    VMImage instance_image_over(const Query& query, const VMImage& foreign_image);
+    VMImage streamed_instance_image(const Query& query, const VMImageInfo& info);
+    void rebase_streamed_instances(const VMImageInfo& info, const VMImage& verified_image);
+    VMImage cache_streamed_image(const VMImageInfo& info, const QDir& image_dir, const FetchType& fetch_type,
+                                 const PrepareAction& prepare, const Query& query);
     VMImageInfo info_for(const Query& query);
     VMImageInfo get_kernel_query_info(const std::string& name);
     void persist_image_records();
     void persist_instance_records();
+    void persist_baked_records();
+    void request_eviction();
+    void write_records_behind();
 
     std::vector<VMImageHost*> image_hosts;
     URLDownloader* const url_downloader;
@@ -82,13 +134,30 @@ private:
     const QDir data_dir;
     const QDir instances_dir;
     const QDir images_dir;
+    const QDir layers_dir; // frozen instance images, shared by the overlays of clones and kept by snapshots
+    const QDir baked_dir;
     const days days_to_expire;
-    std::mutex fetch_mutex;
+    std::shared_timed_mutex fetch_mutex; // guards the records and fetches, not held while copying or deleting images
 
-    std::unordered_map<std::string, VaultRecord> prepared_image_records;
+    std::unordered_map<std::string, VaultRecord> prepared_image_records; // keyed by the image's sha256
+    std::unordered_map<std::string, std::string> alias_index; // "remote:alias" -> prepared image it resolved to
     std::unordered_map<std::string, VaultRecord> instance_image_records;
+    std::unordered_map<std::string, VaultRecord> baked_image_records; // keyed by the name they launch by
+    std::unordered_set<std::string> baking_images;                    // names taken by bakes still writing
     std::unordered_map<std::string, VMImageHost*> remote_image_host_map;
     std::unordered_map<std::string, QFuture<VMImage>> in_progress_image_fetches;
+    std::vector<QFuture<VMImage>> streamed_image_caching; // nobody waits on these but the destructor
+
+    std::mutex persistence_mutex; // never held while waiting for fetch_mutex
+    std::condition_variable persistence_cv;
+    bool image_records_dirty{false};
+    bool instance_records_dirty{false};
+    bool baked_records_dirty{false};
+    bool stop_persisting{false};
+    bool eviction_due{false}; // evictions run on the records writer, behind the fetch that filled the cache
+    std::thread records_writer;
+
+    std::unique_ptr<PeerImageServer> peer_server;
 };
 }
 #endif // MULTIPASS_DEFAULT_VM_IMAGE_VAULT_H
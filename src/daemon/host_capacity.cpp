@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "host_capacity.h"
+
+#include <multipass/format.h>
+
+#include <QStorageInfo>
+#include <QThread>
+
+#include <unistd.h>
+
+namespace mp = multipass;
+
+namespace
+{
+template <typename T>
+T scaled(T amount, double ratio)
+{
+    return static_cast<T>(amount * ratio);
+}
+
+std::string format_size(long long bytes)
+{
+    return fmt::format("{:.1f}GiB", bytes / 1073741824.);
+}
+} // namespace
+
+mp::HostCapacity::Resources mp::HostCapacity::of_host(const QString& data_directory)
+{
+    const auto memory_bytes = static_cast<long long>(sysconf(_SC_PHYS_PAGES)) * sysconf(_SC_PAGE_SIZE);
+    return {QThread::idealThreadCount(), memory_bytes, QStorageInfo{data_directory}.bytesTotal()};
+}
+
+mp::HostCapacity::HostCapacity(const Resources& host, double cpu_ratio, double memory_ratio, double disk_ratio)
+    : limit{scaled(host.cpus, cpu_ratio), scaled(host.memory_bytes, memory_ratio), scaled(host.disk_bytes, disk_ratio)}
+{
+}
+
+mp::HostCapacity::Resources mp::HostCapacity::limits() const
+{
+    return limit;
+}
+
+std::string mp::HostCapacity::shortfall(const Resources& committed, const Resources& requested) const
+{
+    fmt::memory_buffer shortfalls;
+    auto check = [&shortfalls](long long committed, long long requested, long long limit, const char* what,
+                               auto format) {
+        if (requested <= 0 || limit <= 0 || committed + requested <= limit)
+            return;
+
+        fmt::format_to(shortfalls, "{}{} more {} ({} of {} committed)", shortfalls.size() ? ", " : "",
+                       format(requested), what, format(committed), format(limit));
+    };
+
+    auto count = [](long long cpus) { return std::to_string(cpus); };
+    check(committed.cpus, requested.cpus, limit.cpus, "vCPUs", count);
+    check(committed.memory_bytes, requested.memory_bytes, limit.memory_bytes, "memory", format_size);
+    check(committed.disk_bytes, requested.disk_bytes, limit.disk_bytes, "disk", format_size);
+
+    return shortfalls.size() ? fmt::format("the host cannot take {}", fmt::to_string(shortfalls)) : std::string{};
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_HOST_CAPACITY_H
+#define MULTIPASS_HOST_CAPACITY_H
+
+#include <QString>
+
+#include <string>
+
+namespace multipass
+{
+// Weighs what instances take of the host against what it has, times how far each resource may be overcommitted.
+// A ratio of 0 leaves that resource unlimited
+class HostCapacity
+{
+public:
+    struct Resources
+    {
+        int cpus;
+        long long memory_bytes;
+        long long disk_bytes;
+    };
+
+    // The host's CPUs and memory, along with the size of the filesystem holding the instances
+    static Resources of_host(const QString& data_directory);
+
+    HostCapacity(const Resources& host, double cpu_ratio, double memory_ratio, double disk_ratio);
+
+    Resources limits() const; // 0 where unlimited
+
+    // Why the request does not fit next to what is committed already, or empty when it does. Resources the request
+    // does not add to, e.g. the disk of an instance being restarted, are left at 0
+    std::string shortfall(const Resources& committed, const Resources& requested) const;
+
+private:
+    Resources limit;
+};
+} // namespace multipass
+
+#endif // MULTIPASS_HOST_CAPACITY_H
@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "journaled_json_store.h"
+
+#include <multipass/format.h>
+#include <multipass/logging/log.h>
+#include <multipass/platform.h>
+#include <multipass/telemetry.h>
+
+#include <QJsonDocument>
+#include <QSaveFile>
+#include <QtConcurrent/QtConcurrent>
+
+#include <algorithm>
+
+namespace mp = multipass;
+namespace mpl = multipass::logging;
+
+namespace
+{
+constexpr auto category = "journaled-store";
+constexpr auto min_entries_before_compaction = 64;
+
+bool write_snapshot(const QString& path, const QJsonObject& records)
+{
+    auto timer = mp::Telemetry::instance().time("multipass_persistence_write_seconds", {{"kind", "snapshot"}});
+
+    // QSaveFile only replaces the old snapshot once the new one is completely on disk
+    QSaveFile snapshot{path};
+    if (!snapshot.open(QIODevice::WriteOnly) || snapshot.write(QJsonDocument{records}.toJson()) < 0 ||
+        !snapshot.commit())
+    {
+        mpl::log(mpl::Level::error, category,
+                 fmt::format("Cannot write {}: {}", path.toStdString(), snapshot.errorString().toStdString()));
+        return false;
+    }
+
+    return true;
+}
+} // namespace
+
+mp::JournaledJsonStore::JournaledJsonStore(const QString& snapshot_path, const QString& journal_path)
+    : snapshot_path{snapshot_path}, journal_path{journal_path}, rotated_journal_path{journal_path + ".old"}
+{
+}
+
+mp::JournaledJsonStore::~JournaledJsonStore()
+{
+    compaction.waitForFinished();
+}
+
+QJsonObject mp::JournaledJsonStore::load()
+{
+    compaction.waitForFinished();
+    journal.close();
+
+    QFile snapshot{snapshot_path};
+    records = snapshot.open(QIODevice::ReadOnly) ? QJsonDocument::fromJson(snapshot.readAll()).object() : QJsonObject{};
+
+    journal_entries = 0;
+    replay(rotated_journal_path);
+    replay(journal_path);
+
+    // Start over from a clean journal, rather than appending after a line that might have been torn
+    if (journal_entries > 0)
+        compact();
+
+    return records;
+}
+
+QStringList mp::JournaledJsonStore::keys() const
+{
+    return records.keys();
+}
+
+void mp::JournaledJsonStore::put(const QString& key, const QJsonObject& record)
+{
+    auto it = records.constFind(key);
+    if (it != records.constEnd() && it.value().toObject() == record)
+        return;
+
+    records.insert(key, record);
+    append(QJsonObject{{"key", key}, {"record", record}});
+}
+
+void mp::JournaledJsonStore::remove(const QString& key)
+{
+    if (!records.contains(key))
+        return;
+
+    records.remove(key);
+    append(QJsonObject{{"key", key}, {"removed", true}});
+}
+
+void mp::JournaledJsonStore::compact()
+{
+    compaction.waitForFinished();
+    journal.close();
+
+    // A journal left behind by an interrupted compaction can only go once a snapshot covers it
+    if (QFile::exists(rotated_journal_path) && write_snapshot(snapshot_path, records))
+        QFile::remove(rotated_journal_path);
+
+    if (!QFile::exists(rotated_journal_path))
+        QFile::rename(journal_path, rotated_journal_path);
+
+    journal_entries = 0;
+    open_journal();
+
+    compaction = QtConcurrent::run([snapshot_path = snapshot_path, rotated_journal_path = rotated_journal_path,
+                                    records = records] {
+        if (write_snapshot(snapshot_path, records))
+            QFile::remove(rotated_journal_path);
+    });
+}
+
+void mp::JournaledJsonStore::replay(const QString& path)
+{
+    QFile file{path};
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+
+    while (!file.atEnd())
+    {
+        auto entry = QJsonDocument::fromJson(file.readLine()).object();
+        auto key = entry["key"].toString();
+        if (key.isEmpty())
+            continue;
+
+        if (entry["removed"].toBool())
+            records.remove(key);
+        else
+            records.insert(key, entry["record"].toObject());
+
+        ++journal_entries;
+    }
+}
+
+void mp::JournaledJsonStore::open_journal()
+{
+    journal.setFileName(journal_path);
+    if (!journal.open(QIODevice::WriteOnly | QIODevice::Append))
+        mpl::log(mpl::Level::error, category,
+                 fmt::format("Cannot open {}: {}", journal_path.toStdString(), journal.errorString().toStdString()));
+}
+
+void mp::JournaledJsonStore::append(const QJsonObject& entry)
+{
+    if (!journal.isOpen())
+        open_journal();
+
+    {
+        auto timer = Telemetry::instance().time("multipass_persistence_write_seconds", {{"kind", "journal"}});
+        if (journal.write(QJsonDocument{entry}.toJson(QJsonDocument::Compact) + '\n') < 0 || !journal.flush() ||
+            !mp::platform::sync_file(journal.handle()))
+            mpl::log(mpl::Level::error, category, fmt::format("Cannot write {}: {}", journal_path.toStdString(),
+                                                              journal.errorString().toStdString()));
+    }
+
+    // Folding the journal in costs as much as writing every record once, so wait until it has as many entries
+    if (++journal_entries > std::max(min_entries_before_compaction, records.size()))
+        compact();
+}
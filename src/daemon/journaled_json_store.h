@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_JOURNALED_JSON_STORE_H
+#define MULTIPASS_JOURNALED_JSON_STORE_H
+
+#include <QFile>
+#include <QFuture>
+#include <QJsonObject>
+#include <QString>
+#include <QStringList>
+
+namespace multipass
+{
+// A JSON object of records kept as a snapshot plus a journal of the records changed since. Each change costs one
+// appended line, and the journal is folded back into the snapshot in the background once it has grown large
+class JournaledJsonStore
+{
+public:
+    JournaledJsonStore(const QString& snapshot_path, const QString& journal_path);
+    ~JournaledJsonStore();
+    JournaledJsonStore(const JournaledJsonStore&) = delete;
+    JournaledJsonStore& operator=(const JournaledJsonStore&) = delete;
+
+    // The snapshot with the journal replayed on top of it; an entry cut short by a crash is dropped
+    QJsonObject load();
+    QStringList keys() const;
+
+    // Both are synced to disk before returning; putting an unchanged record writes nothing
+    void put(const QString& key, const QJsonObject& record);
+    void remove(const QString& key);
+
+    void compact();
+
+private:
+    void replay(const QString& path);
+    void open_journal();
+    void append(const QJsonObject& entry);
+
+    const QString snapshot_path;
+    const QString journal_path;
+    const QString rotated_journal_path; // being folded into the snapshot
+    QJsonObject records;
+    QFile journal;
+    int journal_entries{0};
+    QFuture<void> compaction;
+};
+} // namespace multipass
+#endif // MULTIPASS_JOURNALED_JSON_STORE_H
@@ -19,8 +19,8 @@
 
 #include "json_writer.h"
 
-#include <QFile>
 #include <QJsonDocument>
+#include <QSaveFile>
 
 namespace mp = multipass;
 
@@ -28,7 +28,9 @@ void mp::write_json(const QJsonObject& root, QString file_name)
 {
     QJsonDocument doc{root};
     auto raw_json = doc.toJson();
-    QFile db_file{file_name};
-    db_file.open(QIODevice::ReadWrite | QIODevice::Truncate);
+    // Readers see either the old file or the new one, never a partial write
+    QSaveFile db_file{file_name};
+    db_file.open(QIODevice::WriteOnly);
     db_file.write(raw_json);
+    db_file.commit();
 }
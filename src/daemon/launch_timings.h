@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2020 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_LAUNCH_TIMINGS_H
+#define MULTIPASS_LAUNCH_TIMINGS_H
+
+#include <multipass/telemetry.h>
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace multipass
+{
+// Monotonic durations of the phases of one launch, in the order they finished. Phases may be timed from any thread
+class LaunchTimings
+{
+public:
+    using Phases = std::vector<std::pair<std::string, std::chrono::milliseconds>>;
+
+    // Recorded once, by whichever holds it last; one moved from records nothing
+    class Phase
+    {
+    public:
+        Phase(LaunchTimings& timings, std::string name)
+            : timings{&timings}, name{std::move(name)}, start{std::chrono::steady_clock::now()}
+        {
+        }
+
+        Phase(const Phase&) = delete;
+        Phase& operator=(const Phase&) = delete;
+        Phase& operator=(Phase&&) = delete;
+
+        Phase(Phase&& other) noexcept
+            : timings{std::exchange(other.timings, nullptr)}, name{std::move(other.name)}, start{other.start}
+        {
+        }
+
+        ~Phase()
+        {
+            if (timings)
+                timings->record(name, std::chrono::steady_clock::now() - start);
+        }
+
+    private:
+        LaunchTimings* timings;
+        std::string name;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    Phase time(std::string phase)
+    {
+        return {*this, std::move(phase)};
+    }
+
+    void record(const std::string& phase, std::chrono::steady_clock::duration duration)
+    {
+        Telemetry::instance().observe("multipass_launch_phase_duration_seconds", {{"phase", phase}}, duration);
+
+        std::lock_guard<std::mutex> lock{mutex};
+        phases.emplace_back(phase, std::chrono::duration_cast<std::chrono::milliseconds>(duration));
+    }
+
+    std::chrono::steady_clock::duration elapsed() const
+    {
+        return std::chrono::steady_clock::now() - created;
+    }
+
+    Phases recorded() const
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        return phases;
+    }
+
+private:
+    const std::chrono::steady_clock::time_point created{std::chrono::steady_clock::now()};
+    mutable std::mutex mutex;
+    Phases phases;
+};
+} // namespace multipass
+#endif // MULTIPASS_LAUNCH_TIMINGS_H
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "memory_footprint.h"
+
+#include <multipass/vm_image_info.h>
+
+#include <QJsonDocument>
+
+#include <fstream>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+#include <unistd.h>
+
+namespace mp = multipass;
+
+namespace
+{
+// What a std::string holds outside of itself, nothing while it fits in its small buffer
+std::size_t heap_part(const std::string& string)
+{
+    return string.capacity() > std::string{}.capacity() ? string.capacity() + 1 : 0;
+}
+} // namespace
+
+std::size_t mp::memory_footprint::heap_in_use()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    const auto info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+#elif defined(__GLIBC__)
+    const auto info = mallinfo(); // wraps past 2GiB, which the daemon is not expected to reach
+    return static_cast<unsigned int>(info.uordblks) + static_cast<unsigned int>(info.hblkhd);
+#else
+    return 0;
+#endif
+}
+
+std::size_t mp::memory_footprint::resident()
+{
+    std::ifstream statm{"/proc/self/statm"};
+    std::size_t size_pages{0}, resident_pages{0};
+    if (!(statm >> size_pages >> resident_pages))
+        return 0;
+
+    return resident_pages * static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+}
+
+std::size_t mp::memory_footprint::of(const std::string& string)
+{
+    return heap_part(string);
+}
+
+std::size_t mp::memory_footprint::of(const QString& string)
+{
+    return string.isNull() ? 0 : entry_overhead + (static_cast<std::size_t>(string.capacity()) + 1) * sizeof(QChar);
+}
+
+std::size_t mp::memory_footprint::of(const QStringList& list)
+{
+    auto bytes = entry_overhead + static_cast<std::size_t>(list.size()) * sizeof(void*);
+    for (const auto& string : list)
+        bytes += of(string);
+
+    return bytes;
+}
+
+std::size_t mp::memory_footprint::of(const QJsonObject& object)
+{
+    // Qt keeps objects in a binary form of about the size of their compact text, which is what is counted
+    return object.isEmpty() ? 0 : entry_overhead + QJsonDocument{object}.toJson(QJsonDocument::Compact).size();
+}
+
+std::size_t mp::memory_footprint::of(const VMImageInfo& info)
+{
+    return sizeof(info) + of(info.aliases) + of(info.os) + of(info.release) + of(info.release_title) +
+           of(info.image_location) + of(info.kernel_location) + of(info.initrd_location) + of(info.id) +
+           of(info.version);
+}
+
+std::size_t mp::memory_footprint::of(const std::unordered_map<std::string, std::string>& map)
+{
+    auto bytes = map.bucket_count() * sizeof(void*);
+    for (const auto& entry : map)
+        bytes += entry_overhead + sizeof(entry) + of(entry.first) + of(entry.second);
+
+    return bytes;
+}
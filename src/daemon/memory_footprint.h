@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_MEMORY_FOOTPRINT_H
+#define MULTIPASS_MEMORY_FOOTPRINT_H
+
+#include <QJsonObject>
+#include <QString>
+#include <QStringList>
+
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+
+namespace multipass
+{
+class VMImageInfo;
+
+// What the daemon's memory goes to. The allocator and the kernel give the totals; the shares of the daemon's parts
+// are estimated from what those parts hold, counting the characters of their strings and an allowance for every
+// container entry. Shared strings are counted as if they were not, so estimates err on the high side
+namespace memory_footprint
+{
+constexpr std::size_t entry_overhead = 4 * sizeof(void*); // a hash node's links, hash and allocation header
+
+std::size_t heap_in_use(); // handed out by malloc and not given back yet, mapped blocks included; 0 if unknown
+std::size_t resident();    // the process's resident set; 0 if unknown
+
+std::size_t of(const std::string& string);
+std::size_t of(const QString& string);
+std::size_t of(const QStringList& list);
+std::size_t of(const QJsonObject& object);
+std::size_t of(const VMImageInfo& info);
+std::size_t of(const std::unordered_map<std::string, std::string>& map);
+} // namespace memory_footprint
+} // namespace multipass
+#endif // MULTIPASS_MEMORY_FOOTPRINT_H
@@ -0,0 +1,491 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "package_cache.h"
+
+#include <multipass/logging/log.h>
+#include <multipass/telemetry.h>
+
+#include <multipass/format.h>
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QHostInfo>
+#include <QNetworkReply>
+#include <QRegularExpression>
+#include <QTcpSocket>
+
+#include <exception>
+#include <stdexcept>
+
+namespace mp = multipass;
+namespace mpl = multipass::logging;
+
+namespace
+{
+constexpr auto category = "package cache";
+constexpr auto requests_metric = "multipass_package_cache_requests_total";
+constexpr auto max_request_size = 16 * 1024;
+constexpr qint64 chunk_size = 64 * 1024;
+constexpr qint64 max_queued_bytes = 4 * chunk_size;
+constexpr auto partial_suffix = ".part";
+
+// The proxy's own connections are its business, so these are neither passed on upstream nor back to the instance
+const QList<QByteArray> hop_by_hop_headers{"connection", "proxy-connection",   "keep-alive", "proxy-authorization",
+                                           "te",         "proxy-authenticate", "trailer",    "transfer-encoding",
+                                           "upgrade",    "host"};
+
+bool is_hop_by_hop(const QByteArray& name)
+{
+    return hop_by_hop_headers.contains(name.trimmed().toLower());
+}
+
+// Packages go in the archive's pool under names carrying their version, and are never changed once there
+bool is_package(const QUrl& url)
+{
+    const auto path = url.path();
+    return path.endsWith(".deb") || path.endsWith(".udeb") || path.endsWith(".ddeb");
+}
+
+std::string cache_key(const QUrl& url)
+{
+    return QCryptographicHash::hash(url.toEncoded(QUrl::RemoveFragment), QCryptographicHash::Sha256)
+        .toHex()
+        .toStdString();
+}
+
+void count_request(const char* result)
+{
+    mp::Telemetry::instance().count(requests_metric, {{"result", result}});
+}
+
+void reply_and_close(QTcpSocket* socket, const QByteArray& status, const QByteArray& headers = {})
+{
+    socket->write("HTTP/1.1 " + status + "\r\n" + headers + "Content-Length: 0\r\nConnection: close\r\n\r\n");
+    socket->disconnectFromHost();
+}
+
+// Redirects go back to apt, which follows them through the proxy again, so that their targets are checked too
+QByteArray location_of(QNetworkReply* reply)
+{
+    const auto location = reply->rawHeader("Location");
+    return location.isEmpty() ? QByteArray{} : "Location: " + location + "\r\n";
+}
+
+// What upstream answered, or a gateway error when it did not get that far
+QByteArray status_of(QNetworkReply* reply)
+{
+    const auto code = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (!code)
+        return "502 Bad Gateway";
+
+    return QByteArray::number(code) + ' ' + reply->attribute(QNetworkRequest::HttpReasonPhraseAttribute).toByteArray();
+}
+
+// Keeps only a few chunks queued on the socket, so the package is read as fast as the instance takes it and no faster
+void send_more(QTcpSocket* socket, QFile* package)
+{
+    while (socket->bytesToWrite() < max_queued_bytes && !package->atEnd())
+    {
+        const auto data = package->read(chunk_size);
+        if (data.isEmpty())
+        {
+            mpl::log(mpl::Level::warning, category,
+                     fmt::format("Cannot read {}: {}", package->fileName(), package->errorString()));
+            socket->abort();
+            return;
+        }
+
+        socket->write(data);
+    }
+
+    if (package->atEnd())
+        socket->disconnectFromHost();
+}
+
+void send_package(QTcpSocket* socket, const QString& path)
+{
+    auto package = new QFile{path, socket};
+    if (!package->open(QIODevice::ReadOnly))
+    {
+        mpl::log(mpl::Level::warning, category, fmt::format("Cannot open {}: {}", path, package->errorString()));
+        return reply_and_close(socket, "500 Internal Server Error");
+    }
+
+    // Touched on every use, for trimming the least recently used first
+    package->setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime);
+
+    socket->write(fmt::format("HTTP/1.1 200 OK\r\nContent-Type: application/vnd.debian.binary-package\r\n"
+                              "Content-Length: {}\r\nConnection: close\r\n\r\n",
+                              package->size())
+                      .c_str());
+
+    QObject::connect(socket, &QTcpSocket::bytesWritten, package, [socket, package] { send_more(socket, package); });
+    send_more(socket, package);
+}
+} // namespace
+
+mp::PackageCache::PackageCache(const std::vector<std::string>& addresses, quint16 port, const Path& cache_dir,
+                               qint64 max_size, AddressFilter upstream_allowed)
+    : cache_dir{cache_dir}, max_size{max_size}, upstream_allowed{std::move(upstream_allowed)}
+{
+    QDir dir{cache_dir};
+    if (!dir.mkpath("."))
+        throw std::runtime_error(fmt::format("cannot create {}", cache_dir));
+
+    // Whatever was still being fetched when the daemon went away
+    for (const auto& stale : dir.entryInfoList({QString("*") + partial_suffix}, QDir::Files))
+        QFile::remove(stale.filePath());
+
+    // Everything the proxy drives is made in its thread, for it to be driven from there alone
+    thread.setObjectName("package cache");
+    thread.start();
+    context = std::make_unique<QObject>();
+    context->moveToThread(&thread);
+
+    std::exception_ptr error;
+    QMetaObject::invokeMethod(
+        context.get(),
+        [this, &addresses, port, &error] {
+            try
+            {
+                listen(addresses, port);
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+            }
+        },
+        Qt::BlockingQueuedConnection);
+
+    if (error)
+    {
+        stop();
+        std::rethrow_exception(error);
+    }
+}
+
+mp::PackageCache::~PackageCache()
+{
+    stop();
+}
+
+void mp::PackageCache::stop()
+{
+    if (!thread.isRunning())
+        return;
+
+    // Whatever is still in flight goes with the servers and the network manager, in the thread they belong to
+    QMetaObject::invokeMethod(
+        context.get(),
+        [this] {
+            fetches.clear();
+            servers.clear();
+            network_manager.reset();
+            context.reset();
+        },
+        Qt::BlockingQueuedConnection);
+    thread.quit();
+    thread.wait();
+}
+
+void mp::PackageCache::listen(const std::vector<std::string>& addresses, quint16 port)
+{
+    network_manager = std::make_unique<QNetworkAccessManager>();
+
+    for (const auto& address : addresses)
+    {
+        auto server = std::make_unique<QTcpServer>();
+        QObject::connect(server.get(), &QTcpServer::newConnection, [this, server = server.get()] {
+            while (auto socket = server->nextPendingConnection())
+                serve(socket);
+        });
+
+        if (!server->listen(QHostAddress{QString::fromStdString(address)}, port))
+            throw std::runtime_error(
+                fmt::format("cannot cache packages on {}:{}: {}", address, port, server->errorString()));
+
+        port = server->serverPort(); // the same on every address, even once picked for the first
+        servers.push_back(std::move(server));
+    }
+
+    listening_port = servers.empty() ? 0 : port;
+    mpl::log(mpl::Level::info, category, fmt::format("Caching instances' packages on port {}", port));
+}
+
+quint16 mp::PackageCache::port() const
+{
+    return listening_port;
+}
+
+bool mp::PackageCache::is_public_address(const QHostAddress& address)
+{
+    bool is_ipv4{false};
+    const auto ipv4 = address.toIPv4Address(&is_ipv4); // IPv4-mapped IPv6 addresses are checked as what they map to
+    if (is_ipv4)
+    {
+        static const std::vector<QPair<QHostAddress, int>> non_public_ipv4{
+            QHostAddress::parseSubnet("0.0.0.0/8"),     QHostAddress::parseSubnet("10.0.0.0/8"),
+            QHostAddress::parseSubnet("100.64.0.0/10"), QHostAddress::parseSubnet("127.0.0.0/8"),
+            QHostAddress::parseSubnet("169.254.0.0/16"), QHostAddress::parseSubnet("172.16.0.0/12"),
+            QHostAddress::parseSubnet("192.0.0.0/24"),  QHostAddress::parseSubnet("192.168.0.0/16"),
+            QHostAddress::parseSubnet("198.18.0.0/15"), QHostAddress::parseSubnet("224.0.0.0/3")};
+        const QHostAddress checked{ipv4};
+        return std::none_of(non_public_ipv4.cbegin(), non_public_ipv4.cend(),
+                            [&checked](const QPair<QHostAddress, int>& subnet) { return checked.isInSubnet(subnet); });
+    }
+
+    static const std::vector<QPair<QHostAddress, int>> non_public_ipv6{
+        QHostAddress::parseSubnet("::/127"), QHostAddress::parseSubnet("64:ff9b::/96"),
+        QHostAddress::parseSubnet("fc00::/7"), QHostAddress::parseSubnet("fe80::/10"),
+        QHostAddress::parseSubnet("fec0::/10"), QHostAddress::parseSubnet("ff00::/8")};
+    return address.protocol() == QAbstractSocket::IPv6Protocol &&
+           std::none_of(non_public_ipv6.cbegin(), non_public_ipv6.cend(),
+                        [&address](const QPair<QHostAddress, int>& subnet) { return address.isInSubnet(subnet); });
+}
+
+void mp::PackageCache::resolve(const QUrl& url, QObject* owner, std::function<void(const QNetworkRequest&)> on_allowed,
+                               std::function<void()> on_refused)
+{
+    // Forgotten along with the owner, should that go before the name is resolved
+    QHostInfo::lookupHost(url.host(), owner, [this, url, on_allowed, on_refused](const QHostInfo& info) {
+        const auto addresses = info.addresses();
+        if (addresses.isEmpty() || !std::all_of(addresses.cbegin(), addresses.cend(), upstream_allowed))
+        {
+            mpl::log(mpl::Level::debug, category, fmt::format("Refusing to fetch {}", url.toString()));
+            count_request("refused");
+            return on_refused();
+        }
+
+        // Pinned to the address checked, so that the name cannot resolve elsewhere by the time it is connected to
+        auto pinned = url;
+        pinned.setHost(addresses.first().toString());
+        QNetworkRequest request{pinned};
+        request.setRawHeader("Host", url.port() < 0 ? url.host(QUrl::FullyEncoded).toLatin1()
+                                                    : url.authority(QUrl::FullyEncoded).section('@', -1).toLatin1());
+        on_allowed(request);
+    });
+}
+
+void mp::PackageCache::serve(QTcpSocket* socket)
+{
+    struct Exchange
+    {
+        QByteArray request;
+        bool answered{false};
+    };
+    auto exchange = std::make_shared<Exchange>();
+
+    QObject::connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+    QObject::connect(socket, &QTcpSocket::readyRead, socket, [this, socket, exchange] {
+        if (exchange->answered)
+        {
+            socket->readAll();
+            return;
+        }
+
+        exchange->request.append(socket->readAll());
+        const auto end_of_head = exchange->request.indexOf("\r\n\r\n");
+        if (end_of_head < 0)
+        {
+            if (exchange->request.size() > max_request_size)
+            {
+                exchange->answered = true;
+                reply_and_close(socket, "400 Bad Request");
+            }
+            return;
+        }
+        exchange->answered = true;
+
+        auto lines = exchange->request.left(end_of_head).split('\n');
+
+        static const QRegularExpression request_line{"^(\\S+) (\\S+) HTTP/1\\.[01]$"};
+        const auto match = request_line.match(QString::fromLatin1(lines.takeFirst().trimmed()));
+        if (!match.hasMatch())
+            return reply_and_close(socket, "400 Bad Request");
+
+        const auto method = match.captured(1).toLatin1();
+        const QUrl url{match.captured(2)};
+        if ((method != "GET" && method != "HEAD") || url.scheme() != "http" || url.host().isEmpty())
+            return reply_and_close(socket, "501 Not Implemented");
+
+        if (method == "GET" && is_package(url))
+            serve_cached(socket, url);
+        else
+            pass_through(socket, method, url, lines);
+    });
+}
+
+void mp::PackageCache::serve_cached(QTcpSocket* socket, const QUrl& url)
+{
+    const auto key = cache_key(url);
+    const auto path = QDir{cache_dir}.filePath(QString::fromStdString(key));
+    if (QFile::exists(path))
+    {
+        count_request("hit");
+        return send_package(socket, path);
+    }
+
+    // Instances launched together ask for the same packages at the same time, so they all wait on one fetch
+    count_request("miss");
+    auto& waiters = fetches[key];
+    waiters.emplace_back(socket);
+    if (waiters.size() == 1)
+        fetch(key, url);
+}
+
+void mp::PackageCache::fetch(const std::string& key, const QUrl& url)
+{
+    resolve(
+        url, context.get(), [this, key, url](const QNetworkRequest& request) { fetch_from(key, url, request); },
+        [this, key] {
+            auto waiters = std::move(fetches[key]);
+            fetches.erase(key);
+            for (const auto& waiter : waiters)
+                if (waiter)
+                    reply_and_close(waiter, "403 Forbidden");
+        });
+}
+
+void mp::PackageCache::fetch_from(const std::string& key, const QUrl& url, QNetworkRequest request)
+{
+    const auto path = QDir{cache_dir}.filePath(QString::fromStdString(key));
+
+    request.setRawHeader("Accept-Encoding", "identity");
+
+    auto reply = network_manager->get(request);
+    auto partial = new QFile{path + partial_suffix, reply};
+    if (!partial->open(QIODevice::WriteOnly | QIODevice::Truncate))
+        mpl::log(mpl::Level::warning, category,
+                 fmt::format("Cannot write {}: {}", partial->fileName(), partial->errorString()));
+
+    QObject::connect(reply, &QNetworkReply::readyRead, reply,
+                     [reply, partial] { partial->write(reply->readAll()); });
+    QObject::connect(reply, &QNetworkReply::finished, reply, [this, key, url, path, reply, partial] {
+        reply->deleteLater();
+        partial->write(reply->readAll());
+        partial->close();
+
+        auto waiters = std::move(fetches[key]);
+        fetches.erase(key);
+
+        const auto fetched = reply->error() == QNetworkReply::NoError &&
+                             reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == 200;
+        if (!fetched || partial->error() != QFileDevice::NoError || !partial->rename(path))
+        {
+            mpl::log(mpl::Level::debug, category,
+                     fmt::format("Not caching {}: {}", url.toString(), reply->errorString()));
+            partial->remove();
+
+            const auto status = fetched ? QByteArray{"500 Internal Server Error"} : status_of(reply);
+            for (const auto& waiter : waiters)
+                if (waiter)
+                    reply_and_close(waiter, status, location_of(reply));
+            return;
+        }
+
+        trim();
+        for (const auto& waiter : waiters)
+            if (waiter)
+                send_package(waiter, path);
+    });
+}
+
+void mp::PackageCache::pass_through(QTcpSocket* socket, const QByteArray& method, const QUrl& url,
+                                    const QList<QByteArray>& headers)
+{
+    resolve(
+        url, socket,
+        [this, socket, method, headers](QNetworkRequest request) {
+            // The instance's own conditions come along, so that unchanged indices are not downloaded again
+            for (const auto& header : headers)
+            {
+                const auto colon = header.indexOf(':');
+                if (colon > 0 && !is_hop_by_hop(header.left(colon)))
+                    request.setRawHeader(header.left(colon).trimmed(), header.mid(colon + 1).trimmed());
+            }
+            pass_through_to(socket, method, request);
+        },
+        [socket] { reply_and_close(socket, "403 Forbidden"); });
+}
+
+void mp::PackageCache::pass_through_to(QTcpSocket* socket, const QByteArray& method, QNetworkRequest request)
+{
+    count_request("pass");
+
+    if (!request.hasRawHeader("Accept-Encoding"))
+        request.setRawHeader("Accept-Encoding", "identity"); // or Qt inflates it, behind the Content-Length
+
+    auto reply = method == "HEAD" ? network_manager->head(request) : network_manager->get(request);
+    reply->setReadBufferSize(max_queued_bytes);
+
+    QPointer<QTcpSocket> client{socket};
+    auto responded = std::make_shared<bool>(false);
+    const auto respond = [reply, client, responded] {
+        if (*responded || !client)
+            return;
+        *responded = true;
+
+        auto head = "HTTP/1.1 " + status_of(reply) + "\r\n";
+        for (const auto& header : reply->rawHeaderPairs())
+            if (!is_hop_by_hop(header.first))
+                head += header.first + ": " + header.second + "\r\n";
+        client->write(head + "Connection: close\r\n\r\n");
+    };
+    const auto forward_more = [reply, client] {
+        while (client && client->bytesToWrite() < max_queued_bytes && reply->bytesAvailable())
+            client->write(reply->read(chunk_size));
+    };
+
+    QObject::connect(reply, &QNetworkReply::metaDataChanged, reply, respond);
+    QObject::connect(reply, &QNetworkReply::readyRead, reply, [respond, forward_more] {
+        respond();
+        forward_more();
+    });
+    QObject::connect(socket, &QTcpSocket::bytesWritten, reply, forward_more);
+    QObject::connect(socket, &QTcpSocket::disconnected, reply, [reply] { reply->abort(); });
+    QObject::connect(reply, &QNetworkReply::finished, reply, [reply, client, respond] {
+        reply->deleteLater();
+        if (!client)
+            return;
+
+        respond();
+        client->write(reply->readAll());
+        client->disconnectFromHost();
+    });
+}
+
+void mp::PackageCache::trim()
+{
+    // Newest first, sparing the package just fetched, however big it is
+    const auto packages = QDir{cache_dir}.entryInfoList(QDir::Files, QDir::Time);
+
+    qint64 total = 0;
+    bool newest = true;
+    for (const auto& package : packages)
+    {
+        if (package.fileName().endsWith(partial_suffix))
+            continue;
+
+        total += package.size();
+        if (!newest && total > max_size)
+            QFile::remove(package.filePath());
+        newest = false;
+    }
+}
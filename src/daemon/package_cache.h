@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_PACKAGE_CACHE_H
+#define MULTIPASS_PACKAGE_CACHE_H
+
+#include <multipass/path.h>
+
+#include <QHostAddress>
+#include <QNetworkAccessManager>
+#include <QPointer>
+#include <QTcpServer>
+#include <QThread>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class QTcpSocket;
+
+namespace multipass
+{
+// A caching HTTP proxy for instances' apt traffic, listening on the host's addresses on their networks. Packages,
+// which the archive never changes under the same URL, are kept in the cache directory and fetched upstream once,
+// however many instances ask for them at the same time; the least recently used go once the cache outgrows max_size.
+// Anything else, such as the archive's indices, is passed through as it is. Upstream is only ever a host whose
+// addresses all pass upstream_allowed, public ones by default, so that instances reach nothing through the proxy they
+// could not reach anyway. It runs on a thread of its own, file and network I/O alike
+class PackageCache
+{
+public:
+    using AddressFilter = std::function<bool(const QHostAddress&)>;
+
+    PackageCache(const std::vector<std::string>& addresses, quint16 port, const Path& cache_dir, qint64 max_size,
+                 AddressFilter upstream_allowed = is_public_address);
+    ~PackageCache();
+
+    quint16 port() const;
+
+    // Neither loopback, link-local, private (RFC 1918 and unique local), shared, multicast nor reserved
+    static bool is_public_address(const QHostAddress& address);
+
+private:
+    // Sockets waiting on a package being fetched upstream
+    using Waiters = std::vector<QPointer<QTcpSocket>>;
+
+    void listen(const std::vector<std::string>& addresses, quint16 port);
+    void stop();
+    void serve(QTcpSocket* socket);
+    void serve_cached(QTcpSocket* socket, const QUrl& url);
+    void fetch(const std::string& key, const QUrl& url);
+    void fetch_from(const std::string& key, const QUrl& url, QNetworkRequest request);
+    void pass_through(QTcpSocket* socket, const QByteArray& method, const QUrl& url, const QList<QByteArray>& headers);
+    void pass_through_to(QTcpSocket* socket, const QByteArray& method, QNetworkRequest request);
+    void resolve(const QUrl& url, QObject* owner, std::function<void(const QNetworkRequest&)> on_allowed,
+                 std::function<void()> on_refused);
+    void trim();
+
+    const Path cache_dir;
+    const qint64 max_size;
+    const AddressFilter upstream_allowed;
+    quint16 listening_port{0};
+    QThread thread;
+    std::unique_ptr<QObject> context; // in the proxy's thread, for work to be queued to
+    // Only ever touched in the proxy's thread
+    std::unique_ptr<QNetworkAccessManager> network_manager;
+    std::vector<std::unique_ptr<QTcpServer>> servers;
+    std::unordered_map<std::string, Waiters> fetches; // by cache key, for packages being fetched
+};
+} // namespace multipass
+#endif // MULTIPASS_PACKAGE_CACHE_H
@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "peer_image_server.h"
+
+#include <multipass/logging/log.h>
+
+#include <multipass/format.h>
+
+#include <QFile>
+#include <QRegularExpression>
+#include <QTcpSocket>
+
+#include <memory>
+#include <stdexcept>
+
+namespace mp = multipass;
+namespace mpl = multipass::logging;
+
+namespace
+{
+constexpr auto category = "peer image server";
+constexpr auto max_request_size = 8 * 1024;
+constexpr qint64 chunk_size = 64 * 1024;
+constexpr qint64 max_queued_bytes = 4 * chunk_size;
+
+void reply_and_close(QTcpSocket* socket, const char* status)
+{
+    socket->write(fmt::format("HTTP/1.1 {}\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", status).c_str());
+    socket->disconnectFromHost();
+}
+
+// Keeps only a few chunks queued on the socket, so the image is read as fast as the peer takes it and no faster
+void send_more(QTcpSocket* socket, QFile* image)
+{
+    while (socket->bytesToWrite() < max_queued_bytes && !image->atEnd())
+    {
+        const auto data = image->read(chunk_size);
+        if (data.isEmpty())
+        {
+            mpl::log(mpl::Level::warning, category,
+                     fmt::format("Cannot read {}: {}", image->fileName(), image->errorString()));
+            socket->abort();
+            return;
+        }
+
+        socket->write(data);
+    }
+
+    if (image->atEnd())
+        socket->disconnectFromHost();
+}
+} // namespace
+
+mp::PeerImageServer::PeerImageServer(const QHostAddress& address, quint16 port, ImageLookup lookup)
+    : lookup{std::move(lookup)}
+{
+    QObject::connect(&server, &QTcpServer::newConnection, [this] {
+        while (auto socket = server.nextPendingConnection())
+            serve(socket);
+    });
+
+    if (!server.listen(address, port))
+        throw std::runtime_error(
+            fmt::format("cannot share images on {}:{}: {}", address.toString(), port, server.errorString()));
+
+    mpl::log(mpl::Level::info, category,
+             fmt::format("Sharing cached images on {}:{}", address.toString(), server.serverPort()));
+}
+
+quint16 mp::PeerImageServer::port() const
+{
+    return server.serverPort();
+}
+
+void mp::PeerImageServer::serve(QTcpSocket* socket)
+{
+    struct Exchange
+    {
+        QByteArray request;
+        bool answered{false};
+    };
+    auto exchange = std::make_shared<Exchange>();
+
+    QObject::connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+    QObject::connect(socket, &QTcpSocket::readyRead, socket, [this, socket, exchange] {
+        if (exchange->answered)
+        {
+            socket->readAll();
+            return;
+        }
+
+        exchange->request.append(socket->readAll());
+        if (exchange->request.indexOf("\r\n\r\n") < 0)
+        {
+            if (exchange->request.size() > max_request_size)
+            {
+                exchange->answered = true;
+                reply_and_close(socket, "400 Bad Request");
+            }
+            return;
+        }
+        exchange->answered = true;
+
+        static const QRegularExpression image_request{"^(GET|HEAD) /images/([0-9a-f]{64}) HTTP/1\\.[01]$"};
+        const auto match =
+            image_request.match(QString::fromLatin1(exchange->request.left(exchange->request.indexOf("\r\n"))));
+        if (!match.hasMatch())
+            return reply_and_close(socket, "400 Bad Request");
+
+        const auto image_path = lookup(match.captured(2).toStdString());
+        auto image = new QFile{image_path, socket};
+        if (image_path.isEmpty() || !image->open(QIODevice::ReadOnly))
+            return reply_and_close(socket, "404 Not Found");
+
+        socket->write(fmt::format("HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\n"
+                                  "Content-Length: {}\r\nConnection: close\r\n\r\n",
+                                  image->size())
+                          .c_str());
+        if (match.captured(1) == "HEAD")
+            return socket->disconnectFromHost();
+
+        QObject::connect(socket, &QTcpSocket::bytesWritten, image, [socket, image] { send_more(socket, image); });
+        send_more(socket, image);
+    });
+}
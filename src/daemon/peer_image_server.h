@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_PEER_IMAGE_SERVER_H
+#define MULTIPASS_PEER_IMAGE_SERVER_H
+
+#include <multipass/path.h>
+
+#include <QHostAddress>
+#include <QTcpServer>
+
+#include <functional>
+#include <string>
+
+class QTcpSocket;
+
+namespace multipass
+{
+// Lets daemons on the same network take cached images from each other: answers GET and HEAD for /images/<sha256>
+// with the cached image whose contents hash to it, over plain HTTP and for reading only
+class PeerImageServer
+{
+public:
+    // Gives the path of the cached image whose sha256 that is, or an empty one when there is none
+    using ImageLookup = std::function<Path(const std::string& sha256)>;
+
+    PeerImageServer(const QHostAddress& address, quint16 port, ImageLookup lookup);
+
+    quint16 port() const;
+
+private:
+    void serve(QTcpSocket* socket);
+
+    ImageLookup lookup;
+    QTcpServer server;
+};
+} // namespace multipass
+#endif // MULTIPASS_PEER_IMAGE_SERVER_H
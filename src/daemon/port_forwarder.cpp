@@ -0,0 +1,486 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "port_forwarder.h"
+
+#include <multipass/format.h>
+#include <multipass/logging/log.h>
+#include <multipass/telemetry.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <future>
+#include <stdexcept>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace mp = multipass;
+namespace mpl = multipass::logging;
+
+namespace
+{
+constexpr auto category = "port forwarding";
+constexpr auto forwarded_bytes_metric = "multipass_port_forward_bytes_total";
+constexpr auto listen_backlog = 128;
+constexpr std::size_t flow_capacity = 1 << 20;
+
+void set_non_blocking(int fd)
+{
+    ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+    ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+sockaddr_in address_of(const std::string& ip, int port)
+{
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(static_cast<uint16_t>(port));
+    if (::inet_pton(AF_INET, ip.c_str(), &address.sin_addr) != 1)
+        throw std::runtime_error(fmt::format("\"{}\" is not an IPv4 address", ip));
+
+    return address;
+}
+
+int listen_on(const mp::PortForward& forward)
+{
+    const auto address = address_of(forward.address, forward.host_port);
+    const auto fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        throw std::runtime_error(fmt::format("cannot make a socket: {}", std::strerror(errno)));
+
+    const int on = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (::bind(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0 ||
+        ::listen(fd, listen_backlog) < 0)
+    {
+        const auto error = errno;
+        ::close(fd);
+        throw std::runtime_error(
+            fmt::format("cannot listen on {}:{}: {}", forward.address, forward.host_port, std::strerror(error)));
+    }
+
+    set_non_blocking(fd);
+    return fd;
+}
+
+// One direction of a connection: what was read from one socket waits here until the other takes it
+class Flow
+{
+public:
+    Flow()
+    {
+#ifdef __linux__
+        if (::pipe2(pipe_fds, O_NONBLOCK | O_CLOEXEC) < 0)
+            throw std::runtime_error(fmt::format("cannot make a pipe: {}", std::strerror(errno)));
+        ::fcntl(pipe_fds[1], F_SETPIPE_SZ, static_cast<int>(flow_capacity)); // best effort, 64KiB otherwise
+        const auto pipe_size = ::fcntl(pipe_fds[1], F_GETPIPE_SZ);
+        if (pipe_size > 0)
+            capacity = std::min<std::size_t>(pipe_size, flow_capacity);
+#endif
+    }
+
+    ~Flow()
+    {
+#ifdef __linux__
+        ::close(pipe_fds[0]);
+        ::close(pipe_fds[1]);
+#endif
+    }
+
+    Flow(const Flow&) = delete;
+    Flow& operator=(const Flow&) = delete;
+
+    bool has_room() const
+    {
+        return !eof && queued < capacity;
+    }
+
+    bool has_data() const
+    {
+        return queued > 0;
+    }
+
+    // False when the connection is done for; reaching the end of what comes in is not an error
+    bool fill_from(int fd)
+    {
+#ifdef __linux__
+        const auto read = ::splice(fd, nullptr, pipe_fds[1], nullptr, capacity - queued,
+                                   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+#else
+        buffer.resize(capacity);
+        const auto read = ::recv(fd, buffer.data() + queued, capacity - queued, 0);
+#endif
+        if (read > 0)
+            queued += read;
+        else if (read == 0)
+            eof = true;
+
+        return read >= 0 || errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    }
+
+    bool drain_to(int fd, std::size_t& moved)
+    {
+#ifdef __linux__
+        const auto written = ::splice(pipe_fds[0], nullptr, fd, nullptr, queued, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+#else
+        const auto written = ::send(fd, buffer.data(), queued, 0);
+        if (written > 0)
+            buffer.erase(buffer.begin(), buffer.begin() + written);
+#endif
+        if (written > 0)
+        {
+            queued -= written;
+            moved += written;
+        }
+
+        return written >= 0 || errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    }
+
+    bool eof{false};
+    bool shut{false}; // the end was passed on
+
+private:
+#ifdef __linux__
+    int pipe_fds[2]; // spliced through, so that nothing is copied to userspace
+#else
+    std::vector<char> buffer;
+#endif
+    std::size_t capacity{flow_capacity};
+    std::size_t queued{0};
+};
+
+struct Listener
+{
+    std::string instance;
+    int host_port;
+    int fd;
+    sockaddr_in target;
+};
+
+struct Connection
+{
+    Connection(const Listener& listener, int client) : instance{listener.instance}, host_port{listener.host_port},
+                                                        client{client}
+    {
+        set_non_blocking(client);
+        server = ::socket(AF_INET, SOCK_STREAM, 0);
+        if (server < 0)
+        {
+            done = true;
+            return;
+        }
+
+        set_non_blocking(server);
+        const int on = 1;
+        ::setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        ::setsockopt(server, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        if (::connect(server, reinterpret_cast<const sockaddr*>(&listener.target), sizeof(listener.target)) < 0 &&
+            errno != EINPROGRESS)
+            done = true;
+    }
+
+    ~Connection()
+    {
+        ::close(client);
+        if (server >= 0)
+            ::close(server);
+    }
+
+    Connection(const Connection&) = delete;
+    Connection& operator=(const Connection&) = delete;
+
+    const std::string instance;
+    const int host_port;
+    const int client;
+    int server{-1};
+    bool connecting{true};
+    bool done{false};
+    Flow up;   // client to instance
+    Flow down; // instance to client
+    std::size_t moved{0};
+};
+} // namespace
+
+struct mp::PortForwarder::Relays
+{
+    std::vector<Listener> listeners;
+    std::vector<std::unique_ptr<Connection>> connections;
+};
+
+mp::PortForwarder::PortForwarder() : relays{std::make_unique<Relays>()}
+{
+    if (::pipe(wake_fds) < 0)
+        throw std::runtime_error(fmt::format("cannot make a pipe: {}", std::strerror(errno)));
+    set_non_blocking(wake_fds[0]);
+    set_non_blocking(wake_fds[1]);
+
+    relay_thread = std::thread{&PortForwarder::run, this};
+}
+
+mp::PortForwarder::~PortForwarder()
+{
+    {
+        std::lock_guard<std::mutex> lock{changes_mutex};
+        stopping = true;
+    }
+    ::write(wake_fds[1], "x", 1);
+    relay_thread.join();
+
+    for (const auto& listener : relays->listeners)
+        ::close(listener.fd);
+    ::close(wake_fds[0]);
+    ::close(wake_fds[1]);
+}
+
+void mp::PortForwarder::start(const std::string& instance, const PortForward& forward, const std::string& instance_ip)
+{
+    Listener listener{instance, forward.host_port, -1, address_of(instance_ip, forward.instance_port)};
+    listener.fd = listen_on(forward);
+
+    mpl::log(mpl::Level::debug, category,
+             fmt::format("Forwarding {}:{} to {}:{}", forward.address, forward.host_port, instance_ip,
+                         forward.instance_port));
+    apply([listener](Relays& relays) { relays.listeners.push_back(listener); });
+}
+
+void mp::PortForwarder::stop(const std::string& instance, int host_port)
+{
+    apply([instance, host_port](Relays& relays) {
+        auto matches = [&instance, host_port](const auto& relay) {
+            return relay.instance == instance && relay.host_port == host_port;
+        };
+
+        for (const auto& listener : relays.listeners)
+            if (matches(listener))
+                ::close(listener.fd);
+        relays.listeners.erase(std::remove_if(relays.listeners.begin(), relays.listeners.end(), matches),
+                               relays.listeners.end());
+
+        for (auto& connection : relays.connections)
+            if (matches(*connection))
+                connection->done = true;
+    });
+}
+
+void mp::PortForwarder::stop_all_for(const std::string& instance)
+{
+    apply([instance](Relays& relays) {
+        auto matches = [&instance](const Listener& listener) { return listener.instance == instance; };
+
+        for (const auto& listener : relays.listeners)
+            if (matches(listener))
+                ::close(listener.fd);
+        relays.listeners.erase(std::remove_if(relays.listeners.begin(), relays.listeners.end(), matches),
+                               relays.listeners.end());
+
+        for (auto& connection : relays.connections)
+            if (connection->instance == instance)
+                connection->done = true;
+    });
+}
+
+std::size_t mp::PortForwarder::connection_count() const
+{
+    return connections;
+}
+
+bool mp::PortForwarder::is_ipv4_address(const std::string& address)
+{
+    in_addr parsed;
+    return ::inet_pton(AF_INET, address.c_str(), &parsed) == 1;
+}
+
+void mp::PortForwarder::apply(std::function<void(Relays&)> change)
+{
+    std::promise<void> applied;
+    auto done = applied.get_future();
+    {
+        std::lock_guard<std::mutex> lock{changes_mutex};
+        changes.push_back([&change, &applied](Relays& relays) {
+            change(relays);
+            applied.set_value();
+        });
+    }
+    ::write(wake_fds[1], "x", 1);
+
+    done.wait();
+}
+
+void mp::PortForwarder::run()
+{
+    // A peer gone away shows as EPIPE on the write that finds out, rather than as a signal taking the daemon down
+    sigset_t pipe_signal;
+    sigemptyset(&pipe_signal);
+    sigaddset(&pipe_signal, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_signal, nullptr);
+
+    auto& listeners = relays->listeners;
+    auto& open_connections = relays->connections;
+    std::vector<pollfd> polled;
+    while (true)
+    {
+        {
+            std::lock_guard<std::mutex> lock{changes_mutex};
+            for (auto& change : changes)
+                change(*relays);
+            changes.clear();
+
+            if (stopping)
+                break;
+        }
+
+        // Counted a pipeful at a time, rather than on every splice
+        for (auto& connection : open_connections)
+        {
+            if (connection->moved && (connection->done || connection->moved >= flow_capacity))
+            {
+                mp::Telemetry::instance().count(forwarded_bytes_metric, {{"instance", connection->instance}},
+                                                connection->moved);
+                connection->moved = 0;
+            }
+        }
+        open_connections.erase(std::remove_if(open_connections.begin(), open_connections.end(),
+                                              [](const auto& connection) { return connection->done; }),
+                               open_connections.end());
+        connections = open_connections.size();
+
+        // The wake pipe comes first, then each listener, then the two sockets of each connection
+        polled.clear();
+        polled.push_back({wake_fds[0], POLLIN, 0});
+        for (const auto& listener : listeners)
+            polled.push_back({listener.fd, POLLIN, 0});
+        for (const auto& connection : open_connections)
+        {
+            const auto& c = *connection;
+            short client_events = 0, server_events = 0;
+            if (c.connecting)
+                server_events = POLLOUT;
+            else
+            {
+                client_events = (c.up.has_room() ? POLLIN : 0) | (c.down.has_data() ? POLLOUT : 0);
+                server_events = (c.down.has_room() ? POLLIN : 0) | (c.up.has_data() ? POLLOUT : 0);
+            }
+            // A socket with nothing to wait for is left out, or its hangup or error would wake us for nothing until
+            // the other side makes room
+            polled.push_back({client_events ? c.client : -1, client_events, 0});
+            polled.push_back({server_events ? c.server : -1, server_events, 0});
+        }
+
+        if (::poll(polled.data(), polled.size(), -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            // Changes still have to be made, for whoever waits on them
+            mpl::log(mpl::Level::error, category,
+                     fmt::format("Cannot wait on forwarded ports: {}", std::strerror(errno)));
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            continue;
+        }
+
+        if (polled[0].revents)
+        {
+            char drained[64];
+            while (::read(wake_fds[0], drained, sizeof(drained)) > 0)
+                ;
+        }
+
+        const auto existing = open_connections.size();
+        for (std::size_t i = 0; i < listeners.size(); ++i)
+        {
+            if (!polled[1 + i].revents)
+                continue;
+
+            int client;
+            while ((client = ::accept(listeners[i].fd, nullptr, nullptr)) >= 0)
+            {
+                // Each connection takes four pipe descriptors besides its two sockets, which can run out under load
+                try
+                {
+                    open_connections.push_back(std::make_unique<Connection>(listeners[i], client));
+                }
+                catch (const std::exception& e)
+                {
+                    ::close(client);
+                    mpl::log(mpl::Level::warning, category,
+                             fmt::format("Cannot relay a connection to port {} of \"{}\": {}", listeners[i].host_port,
+                                         listeners[i].instance, e.what()));
+                }
+            }
+        }
+
+        for (std::size_t i = 0; i < existing; ++i)
+        {
+            auto& c = *open_connections[i];
+            const auto client_events = polled[1 + listeners.size() + 2 * i].revents;
+            const auto server_events = polled[2 + listeners.size() + 2 * i].revents;
+
+            if (c.connecting)
+            {
+                if (!server_events)
+                    continue;
+
+                int error = 0;
+                socklen_t length = sizeof(error);
+                ::getsockopt(c.server, SOL_SOCKET, SO_ERROR, &error, &length);
+                if (error)
+                {
+                    mpl::log(mpl::Level::debug, category,
+                             fmt::format("Cannot reach port {} of \"{}\": {}", c.host_port, c.instance,
+                                         std::strerror(error)));
+                    c.done = true;
+                }
+                c.connecting = false;
+                continue;
+            }
+
+            auto ok = !((client_events | server_events) & (POLLERR | POLLNVAL)); // reset, or otherwise broken
+            const auto readable = POLLIN | POLLHUP;
+            if ((client_events & readable) && c.up.has_room())
+                ok = c.up.fill_from(c.client) && ok;
+            if ((server_events & readable) && c.down.has_room())
+                ok = c.down.fill_from(c.server) && ok;
+            if (c.up.has_data())
+                ok = c.up.drain_to(c.server, c.moved) && ok;
+            if (c.down.has_data())
+                ok = c.down.drain_to(c.client, c.moved) && ok;
+
+            // Each side's end is passed on once everything before it was, leaving the other way open
+            for (auto flow : {std::make_pair(&c.up, c.server), std::make_pair(&c.down, c.client)})
+            {
+                if (flow.first->eof && !flow.first->has_data() && !flow.first->shut)
+                {
+                    ::shutdown(flow.second, SHUT_WR);
+                    flow.first->shut = true;
+                }
+            }
+
+            if (!ok || (c.up.shut && c.down.shut))
+                c.done = true;
+        }
+    }
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_PORT_FORWARDER_H
+#define MULTIPASS_PORT_FORWARDER_H
+
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace multipass
+{
+// A host port whose connections are relayed to a port of the instance, on its address on the bridge
+struct PortForward
+{
+    std::string address; // that the host listens on, e.g. 127.0.0.1 or 0.0.0.0
+    int host_port;
+    int instance_port;
+};
+
+// Relays forwarded connections between host and instance from a thread of its own, without them going through SSH.
+// On Linux the bytes go from one socket to the other through a pipe, with splice, and so never reach userspace
+class PortForwarder
+{
+public:
+    PortForwarder();
+    ~PortForwarder();
+
+    // Listens on the forward's host address and port from now on, relaying to instance_ip. Throws std::runtime_error
+    // when the port cannot be listened on, e.g. because something else has it
+    void start(const std::string& instance, const PortForward& forward, const std::string& instance_ip);
+
+    // Stops listening, and drops the connections that came in through the port. The port is free once these return
+    void stop(const std::string& instance, int host_port);
+    void stop_all_for(const std::string& instance);
+
+    std::size_t connection_count() const;
+
+    static bool is_ipv4_address(const std::string& address);
+
+private:
+    struct Relays; // what the relay thread alone touches
+
+    void run();
+    void apply(std::function<void(Relays&)> change); // on the relay thread, returning once it is made
+
+    std::unique_ptr<Relays> relays;
+    int wake_fds[2];
+    std::mutex changes_mutex;
+    std::deque<std::function<void(Relays&)>> changes; // made by the relay thread before it next polls
+    bool stopping{false};
+    std::atomic<std::size_t> connections{0};
+    std::thread relay_thread;
+};
+} // namespace multipass
+
+#endif // MULTIPASS_PORT_FORWARDER_H
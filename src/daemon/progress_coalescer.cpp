@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "progress_coalescer.h"
+
+#include <algorithm>
+
+namespace mp = multipass;
+
+namespace
+{
+constexpr auto nothing_pending = UINT64_MAX;
+
+std::uint64_t pack(int progress_type, int percentage)
+{
+    return (static_cast<std::uint64_t>(static_cast<std::uint32_t>(progress_type)) << 32) |
+           static_cast<std::uint32_t>(percentage);
+}
+} // namespace
+
+mp::ProgressCoalescer::ProgressCoalescer(Writer writer, int max_updates_per_second)
+    : writer{std::move(writer)},
+      interval{1000 / std::max(max_updates_per_second, 1)},
+      mailbox{nothing_pending},
+      last_written{nothing_pending},
+      writer_thread{[this] {
+          std::unique_lock<std::mutex> lock{stop_mutex};
+          while (!stop_requested.wait_for(lock, interval, [this] { return stopping; }))
+              write_pending();
+      }}
+{
+}
+
+mp::ProgressCoalescer::~ProgressCoalescer()
+{
+    {
+        std::lock_guard<std::mutex> lock{stop_mutex};
+        stopping = true;
+    }
+    stop_requested.notify_one();
+    writer_thread.join();
+
+    // The final percentage is never left behind
+    write_pending();
+}
+
+bool mp::ProgressCoalescer::operator()(int progress_type, int percentage)
+{
+    mailbox.store(pack(progress_type, percentage), std::memory_order_release);
+    return !writes_failed.load(std::memory_order_acquire);
+}
+
+mp::ProgressMonitor mp::ProgressCoalescer::monitor()
+{
+    return [this](int progress_type, int percentage) { return (*this)(progress_type, percentage); };
+}
+
+void mp::ProgressCoalescer::flush()
+{
+    write_pending();
+}
+
+void mp::ProgressCoalescer::write_pending()
+{
+    std::lock_guard<std::mutex> lock{write_mutex};
+
+    auto pending = mailbox.exchange(nothing_pending, std::memory_order_acq_rel);
+    if (pending == nothing_pending || pending == last_written || writes_failed)
+        return;
+
+    last_written = pending;
+    if (!writer(static_cast<int>(pending >> 32), static_cast<int>(static_cast<std::uint32_t>(pending))))
+        writes_failed = true;
+}
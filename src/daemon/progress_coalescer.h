@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_PROGRESS_COALESCER_H
+#define MULTIPASS_PROGRESS_COALESCER_H
+
+#include <multipass/progress_monitor.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace multipass
+{
+// Stands between the download and decode loops and a client stream: reporting progress only stores it, while a
+// thread of its own writes at most a few updates a second and only when the type or percentage changed
+class ProgressCoalescer
+{
+public:
+    // Returns false once the client is gone, which is handed back to the data path to abort it
+    using Writer = std::function<bool(int progress_type, int percentage)>;
+
+    explicit ProgressCoalescer(Writer writer, int max_updates_per_second = 4);
+    ~ProgressCoalescer();
+
+    ProgressCoalescer(const ProgressCoalescer&) = delete;
+    ProgressCoalescer& operator=(const ProgressCoalescer&) = delete;
+
+    bool operator()(int progress_type, int percentage);
+    ProgressMonitor monitor();
+
+    // Writes what is waiting right away, e.g. before a message that must not overtake it
+    void flush();
+
+private:
+    void write_pending();
+
+    Writer writer;
+    const std::chrono::milliseconds interval;
+
+    std::atomic<std::uint64_t> mailbox;
+    std::atomic_bool writes_failed{false};
+    std::uint64_t last_written;
+
+    std::mutex write_mutex;
+    std::mutex stop_mutex;
+    std::condition_variable stop_requested;
+    bool stopping{false};
+    std::thread writer_thread;
+};
+} // namespace multipass
+#endif // MULTIPASS_PROGRESS_COALESCER_H
@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "task_graph.h"
+
+#include <multipass/format.h>
+
+#include <QThread>
+#include <QThreadPool>
+#include <QtConcurrent/QtConcurrent>
+
+#include <stdexcept>
+
+namespace mp = multipass;
+
+namespace
+{
+// Blocking steps spend their time waiting, so there are a good few of them for every core
+constexpr auto blocking_threads_per_core = 8;
+
+QThreadPool* make_pool(int threads)
+{
+    auto pool = new QThreadPool; // left for the OS to clean up, so that no step is waited for on the way out
+    pool->setMaxThreadCount(threads);
+    return pool;
+}
+} // namespace
+
+auto mp::TaskGraph::add(std::string name, Work work, std::function<void()> run, const std::vector<Step>& after)
+    -> Step
+{
+    const auto step = nodes.size();
+    for (const auto& before : after)
+    {
+        if (before >= step)
+            throw std::invalid_argument(fmt::format("step \"{}\" cannot wait on one added after it", name));
+    }
+
+    nodes.push_back({std::move(name), work, std::move(run), {}, after.size(), false});
+    for (const auto& before : after)
+        nodes[before].dependents.push_back(step);
+
+    return step;
+}
+
+void mp::TaskGraph::run()
+{
+    std::unique_lock<std::mutex> lock{mutex};
+    if (started)
+        throw std::logic_error("a task graph only runs once");
+
+    started = true;
+    outstanding = nodes.size();
+    for (Step step = 0; step < nodes.size(); ++step)
+    {
+        if (nodes[step].waiting_on == 0)
+            start(step);
+    }
+
+    all_done.wait(lock, [this] { return outstanding == 0; });
+
+    if (failure)
+        std::rethrow_exception(failure);
+}
+
+void mp::TaskGraph::cancel()
+{
+    std::lock_guard<std::mutex> lock{mutex};
+    stopped = true;
+}
+
+bool mp::TaskGraph::cancelled() const
+{
+    std::lock_guard<std::mutex> lock{mutex};
+    return stopped;
+}
+
+std::vector<std::string> mp::TaskGraph::skipped() const
+{
+    std::lock_guard<std::mutex> lock{mutex};
+    std::vector<std::string> names;
+    for (const auto& node : nodes)
+    {
+        if (node.skipped)
+            names.push_back(node.name);
+    }
+
+    return names;
+}
+
+QThreadPool& mp::TaskGraph::pool(Work work)
+{
+    static auto blocking = make_pool(blocking_threads_per_core * QThread::idealThreadCount());
+    static auto compute = make_pool(QThread::idealThreadCount());
+
+    return work == Work::blocking ? *blocking : *compute;
+}
+
+void mp::TaskGraph::start(Step step)
+{
+    if (stopped)
+    {
+        nodes[step].skipped = true;
+        return finish(step);
+    }
+
+    QtConcurrent::run(&pool(nodes[step].work), [this, step] { execute(step); });
+}
+
+void mp::TaskGraph::execute(Step step)
+{
+    std::exception_ptr exception;
+    try
+    {
+        nodes[step].run();
+    }
+    catch (...)
+    {
+        exception = std::current_exception();
+    }
+
+    std::lock_guard<std::mutex> lock{mutex};
+    if (exception && !failure)
+        failure = exception;
+    if (exception)
+        stopped = true;
+
+    finish(step);
+}
+
+void mp::TaskGraph::finish(Step step)
+{
+    for (const auto& dependent : nodes[step].dependents)
+    {
+        if (--nodes[dependent].waiting_on == 0)
+            start(dependent);
+    }
+
+    if (--outstanding == 0)
+        all_done.notify_all();
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_TASK_GRAPH_H
+#define MULTIPASS_TASK_GRAPH_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class QThreadPool;
+
+namespace multipass
+{
+// The steps of one operation and which others each waits on. A step starts as soon as all of those are done, so that
+// steps that do not depend on one another overlap without being told to. Steps that block, on the network or on an
+// instance, go to a pool of their own, so that they neither starve nor are starved by the ones computing. Once a step
+// throws or the graph is cancelled, the steps yet to start are skipped; run() still waits for those under way.
+// Steps are not to run graphs of their own, which could leave a bounded pool waiting on itself
+class TaskGraph
+{
+public:
+    enum class Work
+    {
+        blocking,
+        compute
+    };
+
+    using Step = std::size_t;
+
+    // Steps can only wait on those added before them, which keeps the graph free of cycles
+    Step add(std::string name, Work work, std::function<void()> run, const std::vector<Step>& after = {});
+
+    // Returns once every step is done or skipped, rethrowing what the first failing one threw. Runs a graph once
+    void run();
+
+    void cancel(); // from any thread, steps included
+    bool cancelled() const;
+
+    std::vector<std::string> skipped() const; // by name, once run
+
+    static QThreadPool& pool(Work work);
+
+private:
+    struct Node
+    {
+        std::string name;
+        Work work;
+        std::function<void()> run;
+        std::vector<Step> dependents;
+        std::size_t waiting_on;
+        bool skipped;
+    };
+
+    void start(Step step);
+    void execute(Step step);
+    void finish(Step step); // holding the lock
+
+    std::vector<Node> nodes;
+    mutable std::mutex mutex;
+    std::condition_variable all_done;
+    std::size_t outstanding{0};
+    bool stopped{false};
+    bool started{false};
+    std::exception_ptr failure;
+};
+} // namespace multipass
+#endif // MULTIPASS_TASK_GRAPH_H
@@ -26,6 +26,7 @@
 
 #include <multipass/format.h>
 
+#include <QCryptographicHash>
 #include <QUrl>
 
 #include <algorithm>
@@ -42,8 +43,7 @@ auto download_manifest(const QString& host_url, mp::URLDownloader* url_downloade
     auto json_index = url_downloader->download({host_url + index_path});
     auto index = mp::SimpleStreamsIndex::fromJson(json_index);
 
-    auto json_manifest = url_downloader->download({host_url + index.manifest_path});
-    return mp::SimpleStreamsManifest::fromJson(json_manifest);
+    return url_downloader->download({host_url + index.manifest_path});
 }
 
 mp::VMImageInfo with_location_fully_resolved(const QString& host_url, const mp::VMImageInfo& info)
@@ -73,37 +73,36 @@ auto key_from(const std::string& search_string)
 
 mp::UbuntuVMImageHost::UbuntuVMImageHost(std::vector<std::pair<std::string, std::string>> remotes,
                                          URLDownloader* downloader, std::chrono::seconds manifest_time_to_live)
-    : CommonVMImageHost{manifest_time_to_live}, url_downloader{downloader}, remotes{std::move(remotes)}
+    : CommonVMImageHost{manifest_time_to_live},
+      manifests{std::make_shared<const Manifests>()},
+      url_downloader{downloader},
+      remotes{std::move(remotes)}
 {
 }
 
+mp::UbuntuVMImageHost::~UbuntuVMImageHost()
+{
+    wait_for_manifest_refresh();
+}
+
 mp::optional<mp::VMImageInfo> mp::UbuntuVMImageHost::info_for(const Query& query)
 {
     auto key = key_from(query.release);
-    mp::SimpleStreamsManifest* manifest;
     const VMImageInfo* info{nullptr};
 
     auto remote_name = query.remote_name.empty() ? release_remote : query.remote_name;
 
-    manifest = manifest_from(remote_name);
+    const auto manifest = manifest_from(remote_name);
     match_alias(key, &info, *manifest);
 
     if (!info)
     {
-        int num_matches = 0;
-
-        auto predicate = [&](const VMImageInfo& entry) {
-            auto partial_match = false;
-            if (entry.id.startsWith(key))
-            {
-                info = &entry;
-                partial_match = true;
-            }
-            return partial_match;
-        };
-        num_matches += std::count_if(manifest->products.begin(), manifest->products.end(), predicate);
-        if (num_matches > 1)
+        const auto matches = manifest->products_with_id_prefix(key);
+        if (matches.size() > 1)
             throw std::runtime_error(fmt::format("Too many images matching \"{}\"", query.release));
+
+        if (!matches.empty())
+            info = matches.front();
     }
 
     if (info)
@@ -122,12 +121,11 @@ std::vector<mp::VMImageInfo> mp::UbuntuVMImageHost::all_info_for(const Query& qu
     std::vector<mp::VMImageInfo> images;
 
     auto key = key_from(query.release);
-    mp::SimpleStreamsManifest* manifest;
     const VMImageInfo* info{nullptr};
 
     auto remote_name = query.remote_name.empty() ? release_remote : query.remote_name;
 
-    manifest = manifest_from(remote_name);
+    const auto manifest = manifest_from(remote_name);
     match_alias(key, &info, *manifest);
 
     if (info)
@@ -141,14 +139,14 @@ std::vector<mp::VMImageInfo> mp::UbuntuVMImageHost::all_info_for(const Query& qu
     {
         std::unordered_set<std::string> found_hashes;
 
-        for (const auto& entry : manifest->products)
+        for (const auto entry : manifest->products_with_id_prefix(key))
         {
-            if (entry.id.startsWith(key) && (entry.supported || query.allow_unsupported) &&
-                found_hashes.find(entry.id.toStdString()) == found_hashes.end())
+            if ((entry->supported || query.allow_unsupported) &&
+                found_hashes.find(entry->id.toStdString()) == found_hashes.end())
             {
                 images.push_back(
-                    with_location_fully_resolved(QString::fromStdString(remote_url_from(remote_name)), entry));
-                found_hashes.insert(entry.id.toStdString());
+                    with_location_fully_resolved(QString::fromStdString(remote_url_from(remote_name)), *entry));
+                found_hashes.insert(entry->id.toStdString());
             }
         }
     }
@@ -161,13 +159,15 @@ std::vector<mp::VMImageInfo> mp::UbuntuVMImageHost::all_info_for(const Query& qu
 
 mp::VMImageInfo mp::UbuntuVMImageHost::info_for_full_hash_impl(const std::string& full_hash)
 {
-    for (const auto& manifest : manifests)
+    const auto id = QString::fromStdString(full_hash);
+    const auto current = std::atomic_load(&manifests);
+    for (const auto& manifest : *current)
     {
-        for (const auto& product : manifest.second->products)
+        for (const auto product : manifest.second->products_with_id_prefix(id))
         {
-            if (product.id.toStdString() == full_hash)
+            if (product->id == id)
             {
-                return with_location_fully_resolved(QString::fromStdString(remote_url_from(manifest.first)), product);
+                return with_location_fully_resolved(QString::fromStdString(remote_url_from(manifest.first)), *product);
             }
         }
     }
@@ -181,13 +181,9 @@ std::vector<mp::VMImageInfo> mp::UbuntuVMImageHost::all_images_for(const std::st
     std::vector<mp::VMImageInfo> images;
     auto manifest = manifest_from(remote_name);
 
-    for (const auto& entry : manifest->products)
-    {
-        if (entry.supported || allow_unsupported)
-        {
-            images.push_back(with_location_fully_resolved(QString::fromStdString(remote_url_from(remote_name)), entry));
-        }
-    }
+    const auto remote_url = QString::fromStdString(remote_url_from(remote_name));
+    for (const auto entry : manifest->supported_products(allow_unsupported))
+        images.push_back(with_location_fully_resolved(remote_url, *entry));
 
     if (images.empty())
         throw std::runtime_error(fmt::format("Unable to find images for remote \"{}\"", remote_name));
@@ -197,7 +193,8 @@ std::vector<mp::VMImageInfo> mp::UbuntuVMImageHost::all_images_for(const std::st
 
 void mp::UbuntuVMImageHost::for_each_entry_do_impl(const Action& action)
 {
-    for (const auto& manifest : manifests)
+    const auto current = std::atomic_load(&manifests);
+    for (const auto& manifest : *current)
     {
         for (const auto& product : manifest.second->products)
         {
@@ -221,38 +218,65 @@ std::vector<std::string> mp::UbuntuVMImageHost::supported_remotes()
 
 void mp::UbuntuVMImageHost::fetch_manifests()
 {
-    for (const auto& remote : remotes)
+    const auto current = std::atomic_load(&manifests);
+    auto current_manifest = [&current](const std::string& remote_name) {
+        auto it = std::find_if(current->begin(), current->end(), [&remote_name](const Manifests::value_type& entry) {
+            return entry.first == remote_name;
+        });
+        return it != current->end() ? it->second : nullptr;
+    };
+
+    std::vector<std::shared_ptr<const SimpleStreamsManifest>> fetched(remotes.size());
+    std::vector<QByteArray> digests(remotes.size());
+    std::vector<std::function<void()>> fetches;
+    for (std::size_t i = 0; i < remotes.size(); ++i)
+        fetches.push_back([this, &fetched, &digests, &current_manifest, i] {
+            const auto& remote_name = remotes[i].first;
+            const auto json = download_manifest(QString::fromStdString(remotes[i].second), url_downloader);
+            digests[i] = QCryptographicHash::hash(json, QCryptographicHash::Md5);
+
+            // Daily manifests run to megabytes, and mostly come back unchanged from one refresh to the next
+            auto previous = current_manifest(remote_name);
+            auto digest = manifest_digests.find(remote_name);
+            if (previous && digest != manifest_digests.end() && digest->second == digests[i])
+                fetched[i] = std::move(previous);
+            else
+                fetched[i] = SimpleStreamsManifest::fromJson(json);
+        });
+
+    fetch_concurrently(fetches);
+
+    // Merged in the order the remotes were given, whichever answered first
+    auto refreshed = std::make_shared<Manifests>();
+    for (std::size_t i = 0; i < remotes.size(); ++i)
     {
-        try
+        const auto& remote_name = remotes[i].first;
+        if (fetched[i])
         {
-            manifests.emplace_back(
-                std::make_pair(remote.first, download_manifest(QString::fromStdString(remote.second), url_downloader)));
+            manifest_digests[remote_name] = digests[i];
+            refreshed->emplace_back(remote_name, std::move(fetched[i]));
         }
-        catch (mp::DownloadException& e)
+        else if (auto previous = current_manifest(remote_name))
         {
-            on_manifest_update_failure(e.what());
+            refreshed->emplace_back(remote_name, std::move(previous));
         }
     }
-}
 
-void mp::UbuntuVMImageHost::clear()
-{
-    manifests.clear();
+    std::atomic_store(&manifests, std::shared_ptr<const Manifests>{std::move(refreshed)});
 }
 
-mp::SimpleStreamsManifest* mp::UbuntuVMImageHost::manifest_from(const std::string& remote)
+std::shared_ptr<const mp::SimpleStreamsManifest> mp::UbuntuVMImageHost::manifest_from(const std::string& remote)
 {
     update_manifests();
 
-    auto it = std::find_if(manifests.begin(), manifests.end(),
-                           [&remote](const std::pair<std::string, std::unique_ptr<SimpleStreamsManifest>>& element) {
-                               return element.first == remote;
-                           });
+    const auto current = std::atomic_load(&manifests);
+    auto it = std::find_if(current->begin(), current->end(),
+                           [&remote](const Manifests::value_type& element) { return element.first == remote; });
 
-    if (it == manifests.cend())
+    if (it == current->cend())
         throw std::runtime_error(fmt::format("Remote \"{}\" is unknown or unreachable.", remote));
 
-    return it->second.get();
+    return it->second;
 }
 
 void mp::UbuntuVMImageHost::match_alias(const QString& key, const VMImageInfo** info,
@@ -21,9 +21,12 @@
 #include "common_image_host.h"
 #include "multipass/simple_streams_manifest.h"
 
+#include <QByteArray>
 #include <QString>
 
+#include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace multipass
@@ -37,6 +40,7 @@ class UbuntuVMImageHost final : public CommonVMImageHost
 public:
     UbuntuVMImageHost(std::vector<std::pair<std::string, std::string>> remotes, URLDownloader* downloader,
                       std::chrono::seconds manifest_time_to_live);
+    ~UbuntuVMImageHost();
 
     optional<VMImageInfo> info_for(const Query& query) override;
     std::vector<VMImageInfo> all_info_for(const Query& query) override;
@@ -47,12 +51,15 @@ protected:
     void for_each_entry_do_impl(const Action& action) override;
     VMImageInfo info_for_full_hash_impl(const std::string& full_hash) override;
     void fetch_manifests() override;
-    void clear() override;
 
 private:
-    SimpleStreamsManifest* manifest_from(const std::string& remote);
+    using Manifests = std::vector<std::pair<std::string, std::shared_ptr<const SimpleStreamsManifest>>>;
+
+    std::shared_ptr<const SimpleStreamsManifest> manifest_from(const std::string& remote);
     void match_alias(const QString& key, const VMImageInfo** info, const SimpleStreamsManifest& manifest);
-    std::vector<std::pair<std::string, std::unique_ptr<SimpleStreamsManifest>>> manifests;
+    // Swapped whole by each refresh, so readers holding on to one are never cut short
+    std::shared_ptr<const Manifests> manifests;
+    std::unordered_map<std::string, QByteArray> manifest_digests;
     URLDownloader* const url_downloader;
     std::vector<std::pair<std::string, std::string>> remotes;
     std::string remote_url_from(const std::string& remote_name);
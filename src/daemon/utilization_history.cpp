@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "utilization_history.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+
+namespace mp = multipass;
+
+using namespace std::chrono_literals;
+
+namespace
+{
+struct Width
+{
+    std::chrono::seconds width;
+    std::size_t capacity;
+};
+
+// About 55 kB per series once full, though the rings only grow as samples come in
+constexpr Width widths[] = {{60s, 120}, {300s, 576}, {3600s, 720}};
+
+mp::UtilizationHistory::Clock::time_point bucket_start(mp::UtilizationHistory::Clock::time_point when,
+                                                       std::chrono::seconds width)
+{
+    auto since_epoch = std::chrono::duration_cast<std::chrono::seconds>(when.time_since_epoch());
+    return mp::UtilizationHistory::Clock::time_point{since_epoch - since_epoch % width};
+}
+} // namespace
+
+void mp::UtilizationHistory::record(const std::string& instance, const std::string& metric, double value,
+                                    Clock::time_point when)
+{
+    std::lock_guard<std::mutex> lock{mutex};
+    auto& rings = series[instance][metric];
+    rings.resize(std::size(widths));
+
+    for (std::size_t i = 0; i < rings.size(); ++i)
+    {
+        auto& ring = rings[i];
+        const auto start = bucket_start(when, widths[i].width);
+
+        if (!ring.buckets.empty())
+        {
+            auto& newest = ring.buckets[ring.newest];
+            if (newest.start == start)
+            {
+                newest.min = std::min(newest.min, value);
+                newest.max = std::max(newest.max, value);
+                newest.sum += value;
+                ++newest.count;
+                continue;
+            }
+
+            if (start < newest.start)
+                continue; // the clock went back; what is there already stands for this time
+        }
+
+        Bucket bucket{start, value, value, value, 1};
+        if (ring.buckets.size() < widths[i].capacity)
+        {
+            ring.buckets.push_back(bucket);
+            ring.newest = ring.buckets.size() - 1;
+        }
+        else
+        {
+            ring.newest = (ring.newest + 1) % ring.buckets.size();
+            ring.buckets[ring.newest] = bucket;
+        }
+    }
+}
+
+void mp::UtilizationHistory::forget(const std::string& instance)
+{
+    std::lock_guard<std::mutex> lock{mutex};
+    series.erase(instance);
+}
+
+auto mp::UtilizationHistory::summarize(const std::string& instance, const std::string& metric,
+                                       std::chrono::seconds window, Clock::time_point now) const -> optional<Summary>
+{
+    std::lock_guard<std::mutex> lock{mutex};
+    auto instance_it = series.find(instance);
+    if (instance_it == series.end())
+        return nullopt;
+
+    auto metric_it = instance_it->second.find(metric);
+    if (metric_it == instance_it->second.end())
+        return nullopt;
+
+    // The coarsest ring covers what the others do not, as far back as it goes
+    std::size_t chosen = 0;
+    while (chosen + 1 < std::size(widths) && widths[chosen].width * widths[chosen].capacity < window)
+        ++chosen;
+
+    const auto& ring = metric_it->second[chosen];
+    const auto width = widths[chosen].width;
+    const auto since = bucket_start(now - window, width);
+
+    Summary summary{0, 0, 0, 0, width, 0};
+    std::vector<double> averages;
+    double sum = 0;
+    for (const auto& bucket : ring.buckets)
+    {
+        if (bucket.start < since || bucket.start > now)
+            continue;
+
+        summary.min = averages.empty() ? bucket.min : std::min(summary.min, bucket.min);
+        summary.max = averages.empty() ? bucket.max : std::max(summary.max, bucket.max);
+        sum += bucket.sum;
+        summary.samples += bucket.count;
+        averages.push_back(bucket.sum / bucket.count);
+    }
+
+    if (averages.empty())
+        return nullopt;
+
+    // Nearest rank, so that the figure is one that was actually seen
+    const auto rank = static_cast<std::size_t>(std::ceil(0.95 * averages.size()));
+    std::nth_element(averages.begin(), averages.begin() + (rank - 1), averages.end());
+    summary.p95 = averages[rank - 1];
+    summary.average = sum / summary.samples;
+
+    return summary;
+}
+
+std::vector<std::string> mp::UtilizationHistory::metrics(const std::string& instance) const
+{
+    std::lock_guard<std::mutex> lock{mutex};
+    std::vector<std::string> names;
+    auto it = series.find(instance);
+    if (it != series.end())
+    {
+        for (const auto& metric : it->second)
+            names.push_back(metric.first);
+    }
+
+    return names;
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_UTILIZATION_HISTORY_H
+#define MULTIPASS_UTILIZATION_HISTORY_H
+
+#include <multipass/optional.h>
+
+#include <chrono>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace multipass
+{
+// What instances' guests reported over time, one series per instance and metric. Every sample goes into a few rings
+// of fixed size, each adding it to buckets of its own width: a minute wide over the last two hours, five minutes
+// over the last two days and an hour over the last thirty. Summaries come from the finest ring that covers their
+// window, so the further back they look, the coarser they get. Nothing is kept across daemon restarts
+class UtilizationHistory
+{
+public:
+    using Clock = std::chrono::system_clock;
+
+    struct Summary
+    {
+        double min;
+        double average;
+        double max;
+        double p95;                      // of the buckets' averages, so of single samples only at the finest width
+        std::chrono::seconds resolution; // of the buckets it came from
+        std::size_t samples;
+    };
+
+    void record(const std::string& instance, const std::string& metric, double value, Clock::time_point when);
+    void forget(const std::string& instance);
+
+    // Over the window leading up to now; nothing when no sample fell within it
+    optional<Summary> summarize(const std::string& instance, const std::string& metric, std::chrono::seconds window,
+                                Clock::time_point now) const;
+    std::vector<std::string> metrics(const std::string& instance) const; // with anything recorded, sorted
+
+private:
+    struct Bucket
+    {
+        Clock::time_point start;
+        double min;
+        double max;
+        double sum;
+        std::size_t count;
+    };
+
+    struct Ring
+    {
+        std::vector<Bucket> buckets; // grows up to the ring's capacity, then wraps around
+        std::size_t newest{0};
+    };
+
+    using Series = std::vector<Ring>; // one per width in use, finest first
+
+    mutable std::mutex mutex;
+    std::unordered_map<std::string, std::map<std::string, Series>> series; // instance -> metric -> rings
+};
+} // namespace multipass
+#endif // MULTIPASS_UTILIZATION_HISTORY_H
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "watch_stream.h"
+
+namespace mp = multipass;
+
+mp::WatchStream::WatchStream(Writer writer, std::promise<grpc::Status>* status_promise, std::size_t max_pending)
+    : writer{std::move(writer)},
+      status_promise{status_promise},
+      max_pending{max_pending},
+      writer_thread{[this] { write_pending(); }}
+{
+}
+
+mp::WatchStream::~WatchStream()
+{
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        stopping = true;
+        pending.clear();
+    }
+    woken.notify_one();
+    writer_thread.join();
+
+    // Only now is the call's writer no longer in use, so only now may the call end
+    status_promise->set_value(status);
+}
+
+bool mp::WatchStream::push(const WatchReply& reply)
+{
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        if (failed)
+            return false;
+
+        if (pending.size() >= max_pending)
+        {
+            failed = true;
+            pending.clear();
+            status = grpc::Status{grpc::StatusCode::RESOURCE_EXHAUSTED, "too many state changes went unread"};
+            woken.notify_one();
+            return false;
+        }
+
+        pending.push_back(reply);
+    }
+    woken.notify_one();
+
+    return true;
+}
+
+void mp::WatchStream::write_pending()
+{
+    std::unique_lock<std::mutex> lock{mutex};
+    while (true)
+    {
+        woken.wait(lock, [this] { return stopping || failed || !pending.empty(); });
+        if (stopping || failed)
+            return;
+
+        auto reply = std::move(pending.front());
+        pending.pop_front();
+
+        lock.unlock();
+        auto written = writer(reply);
+        lock.lock();
+
+        if (!written)
+        {
+            failed = true; // the client went away, which ends the call normally
+            pending.clear();
+            return;
+        }
+    }
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_WATCH_STREAM_H
+#define MULTIPASS_WATCH_STREAM_H
+
+#include <multipass/rpc/multipass.grpc.pb.h>
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+
+namespace multipass
+{
+// Stands between the daemon and a client watching state changes: pushing a reply only queues it, while a thread of
+// its own writes the queue in order, so that a client reading slowly holds up neither the daemon nor other watchers
+class WatchStream
+{
+public:
+    // Returns false once the client is gone
+    using Writer = std::function<bool(const WatchReply&)>;
+
+    WatchStream(Writer writer, std::promise<grpc::Status>* status_promise, std::size_t max_pending = 4096);
+    // Drops what is still queued and finishes the call once the reply being written, if any, is out
+    ~WatchStream();
+
+    WatchStream(const WatchStream&) = delete;
+    WatchStream& operator=(const WatchStream&) = delete;
+
+    // Returns false once the client is gone or has fallen max_pending replies behind, after which the stream is done
+    bool push(const WatchReply& reply);
+
+private:
+    void write_pending();
+
+    Writer writer;
+    std::promise<grpc::Status>* status_promise;
+    const std::size_t max_pending;
+
+    std::mutex mutex;
+    std::condition_variable woken;
+    std::deque<WatchReply> pending;
+    bool stopping{false};
+    bool failed{false};
+    grpc::Status status;
+    std::thread writer_thread;
+};
+} // namespace multipass
+#endif // MULTIPASS_WATCH_STREAM_H
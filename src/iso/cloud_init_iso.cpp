@@ -21,6 +21,7 @@
 
 #include <QFile>
 
+#include <algorithm>
 #include <array>
 #include <cctype>
 
@@ -96,12 +97,6 @@ void set_at(T& t, SizeType offset, const V& value)
     std::copy(std::begin(value), std::end(value), t.begin() + offset);
 }
 
-template <typename T>
-void write(const T& t, QFile& f)
-{
-    f.write(reinterpret_cast<const char*>(t.data.data()), t.data.size());
-}
-
 template <size_t size>
 struct PaddedString
 {
@@ -365,19 +360,47 @@ Size num_blocks(Size num_bytes)
     return ((num_bytes + logical_block_size - 1) / logical_block_size);
 }
 
-void seek_to_next_block(QFile& f)
+// The image is laid out in memory and then handed to the file in one write, rather than in as many small writes
+// and seeks as there are records
+struct ImageBuffer
 {
-    const auto next_block_pos = num_blocks(f.pos()) * logical_block_size;
-    f.seek(next_block_pos);
-}
+    explicit ImageBuffer(uint32_t num_blocks) : data(num_blocks * logical_block_size, '\0')
+    {
+    }
 
-void pad_to_end(QFile& f)
-{
-    seek_to_next_block(f);
-    f.seek(f.pos() - 1);
-    char end = 0;
-    f.write(&end, 1);
-}
+    template <typename T>
+    void write(const T& t)
+    {
+        write(reinterpret_cast<const char*>(t.data.data()), t.data.size());
+    }
+
+    void write(const char* bytes, size_t size)
+    {
+        if (pos + size > data.size())
+            data.resize(pos + size, '\0');
+
+        std::copy_n(bytes, size, data.begin() + pos);
+        pos += size;
+    }
+
+    void seek(size_t new_pos)
+    {
+        pos = new_pos;
+    }
+
+    void seek_to_next_block()
+    {
+        pos = num_blocks(pos) * logical_block_size;
+    }
+
+    void pad_to_end()
+    {
+        data.resize(num_blocks(data.size()) * logical_block_size, '\0');
+    }
+
+    std::string data;
+    size_t pos{0};
+};
 } // namespace
 
 void mp::CloudInitIso::add_file(const std::string& name, const std::string& data)
@@ -387,13 +410,8 @@ void mp::CloudInitIso::add_file(const std::string& name, const std::string& data
 
 void mp::CloudInitIso::write_to(const Path& path)
 {
-    QFile f{path};
-    if (!f.open(QIODevice::WriteOnly))
-        throw std::runtime_error{"failed to open file for writing during cloud-init generation"};
-
     const uint32_t num_reserved_bytes = 32768u;
     const uint32_t num_reserved_blocks = num_blocks(num_reserved_bytes);
-    f.seek(num_reserved_bytes);
 
     PrimaryVolumeDescriptor prim_desc;
     JolietVolumeDescriptor joliet_desc;
@@ -443,35 +461,45 @@ void mp::CloudInitIso::write_to(const Path& path)
         current_block_index += num_blocks(entry.data.size());
     }
 
-    write(prim_desc, f);
-    write(joliet_desc, f);
-    write(VolumeDescriptorSetTerminator(), f);
+    ImageBuffer image{volume_size};
+    image.seek(num_reserved_bytes);
 
-    write(root_path, f);
-    seek_to_next_block(f);
-    write(joliet_root_path, f);
-    seek_to_next_block(f);
+    image.write(prim_desc);
+    image.write(joliet_desc);
+    image.write(VolumeDescriptorSetTerminator());
 
-    write(root_record, f);
-    write(root_parent_record, f);
+    image.write(root_path);
+    image.seek_to_next_block();
+    image.write(joliet_root_path);
+    image.seek_to_next_block();
+
+    image.write(root_record);
+    image.write(root_parent_record);
     for (const auto& iso_record : iso_file_records)
     {
-        write(iso_record, f);
+        image.write(iso_record);
     }
-    seek_to_next_block(f);
+    image.seek_to_next_block();
 
-    write(joliet_root_record, f);
-    write(joliet_root_parent_record, f);
+    image.write(joliet_root_record);
+    image.write(joliet_root_parent_record);
     for (const auto& joliet_record : joliet_file_records)
     {
-        write(joliet_record, f);
+        image.write(joliet_record);
     }
-    seek_to_next_block(f);
+    image.seek_to_next_block();
 
     for (const auto& entry : files)
     {
-        f.write(entry.data.data(), entry.data.size());
-        seek_to_next_block(f);
+        image.write(entry.data.data(), entry.data.size());
+        image.seek_to_next_block();
     }
-    pad_to_end(f);
+    image.pad_to_end();
+
+    QFile f{path};
+    if (!f.open(QIODevice::WriteOnly))
+        throw std::runtime_error{"failed to open file for writing during cloud-init generation"};
+
+    if (f.write(image.data.data(), image.data.size()) != static_cast<qint64>(image.data.size()))
+        throw std::runtime_error{"failed to write the cloud-init image"};
 }
@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <multipass/logging/async_logger.h>
+
+#include <multipass/format.h>
+
+#include <chrono>
+
+namespace mpl = multipass::logging;
+
+namespace
+{
+// Bounds how long a message can wait should the drainer miss a wakeup
+constexpr auto idle_wakeup = std::chrono::milliseconds(100);
+
+std::size_t ring_size_for(std::size_t capacity)
+{
+    std::size_t size = 2;
+    while (size < capacity)
+        size <<= 1;
+    return size;
+}
+} // namespace
+
+mpl::AsyncLogger::AsyncLogger(UPtr sink, OverflowPolicy overflow_policy, std::size_t capacity)
+    : sink{std::move(sink)},
+      overflow_policy{overflow_policy},
+      mask{ring_size_for(capacity) - 1},
+      slots{std::make_unique<Slot[]>(mask + 1)}
+{
+    for (std::size_t i = 0; i <= mask; ++i)
+        slots[i].sequence.store(i, std::memory_order_relaxed);
+
+    drainer = std::thread{[this] { drain(); }};
+}
+
+mpl::AsyncLogger::~AsyncLogger()
+{
+    running.store(false);
+    wake_drainer();
+    drainer.join();
+}
+
+void mpl::AsyncLogger::log(Level level, CString category, CString message) const
+{
+    if (!enabled(level))
+        return;
+
+    Record record{level, category.c_str(), message.c_str()};
+    while (!try_push(record))
+    {
+        if (overflow_policy == OverflowPolicy::drop)
+        {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        wake_drainer();
+        std::this_thread::yield();
+    }
+
+    if (drainer_idle.load())
+        wake_drainer();
+}
+
+bool mpl::AsyncLogger::enabled(Level level) const
+{
+    return sink->enabled(level);
+}
+
+// A bounded queue after Dmitry Vyukov's: producers race for a position, then own its slot until they hand it over
+bool mpl::AsyncLogger::try_push(Record& record) const
+{
+    auto pos = enqueue_pos.load(std::memory_order_relaxed);
+    while (true)
+    {
+        auto& slot = slots[pos & mask];
+        auto sequence = slot.sequence.load(std::memory_order_acquire);
+        auto lag = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos);
+
+        if (lag == 0)
+        {
+            if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                slot.record = std::move(record);
+                slot.sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if (lag < 0)
+            return false; // the drainer has yet to empty this slot, so the buffer is full
+        else
+            pos = enqueue_pos.load(std::memory_order_relaxed);
+    }
+}
+
+bool mpl::AsyncLogger::try_pop(Record& record)
+{
+    if (!has_records())
+        return false;
+
+    auto& slot = slots[dequeue_pos & mask];
+    record = std::move(slot.record);
+    slot.sequence.store(dequeue_pos + mask + 1, std::memory_order_release);
+    ++dequeue_pos;
+
+    return true;
+}
+
+bool mpl::AsyncLogger::has_records() const
+{
+    return slots[dequeue_pos & mask].sequence.load(std::memory_order_acquire) == dequeue_pos + 1;
+}
+
+void mpl::AsyncLogger::wake_drainer() const
+{
+    {
+        std::lock_guard<std::mutex> lock{wakeup_mutex};
+    }
+    wakeup.notify_one();
+}
+
+void mpl::AsyncLogger::drain()
+{
+    Record record;
+    while (true)
+    {
+        const auto stopping = !running.load();
+
+        // Takes everything there is in one go, so a burst costs one wakeup
+        while (try_pop(record))
+            sink->log(record.level, record.category, record.message);
+
+        if (auto count = dropped.exchange(0, std::memory_order_relaxed))
+            sink->log(Level::warning, "logging",
+                      fmt::format("{} messages were dropped, the log could not keep up", count));
+
+        if (stopping)
+            return;
+
+        std::unique_lock<std::mutex> lock{wakeup_mutex};
+        drainer_idle.store(true);
+        wakeup.wait_for(lock, idle_wakeup, [this] { return !running.load() || has_records(); });
+        drainer_idle.store(false);
+    }
+}
@@ -66,6 +66,12 @@ void mpl::log(Level level, CString category, CString message)
         fmt::print(stderr, "[{}] [{}] {}\n", as_string(level).c_str(), category.c_str(), message.c_str());
 }
 
+bool mpl::enabled(Level level)
+{
+    std::shared_lock<decltype(mutex)> lock{mutex};
+    return !global_logger || global_logger->enabled(level);
+}
+
 void mpl::set_logger(std::shared_ptr<Logger> logger)
 {
     std::lock_guard<decltype(mutex)> lock{mutex};
@@ -24,24 +24,48 @@ namespace mpl = multipass::logging;
 multipass::logging::MultiplexingLogger::MultiplexingLogger(UPtr system_logger)
     : system_logger{std::move(system_logger)}
 {
+    update_max_level();
 }
 
 void mpl::MultiplexingLogger::log(mpl::Level level, CString category, CString message) const
 {
+    if (!enabled(level))
+        return;
+
     std::shared_lock<decltype(mutex)> lock{mutex};
     system_logger->log(level, category, message);
     for (auto logger : loggers)
         logger->log(level, category, message);
 }
 
+bool mpl::MultiplexingLogger::enabled(mpl::Level level) const
+{
+    return enum_type(level) <= max_level.load(std::memory_order_relaxed);
+}
+
 void mpl::MultiplexingLogger::add_logger(const Logger* logger)
 {
     std::lock_guard<decltype(mutex)> lock{mutex};
     loggers.push_back(logger);
+    update_max_level();
 }
 
 void mpl::MultiplexingLogger::remove_logger(const Logger* logger)
 {
     std::lock_guard<decltype(mutex)> lock{mutex};
     loggers.erase(std::remove(loggers.begin(), loggers.end(), logger), loggers.end());
+    update_max_level();
+}
+
+void mpl::MultiplexingLogger::update_max_level()
+{
+    auto level = enum_type(mpl::Level::trace);
+    for (; level > enum_type(mpl::Level::error); --level)
+    {
+        auto takes_level = [level](const Logger* logger) { return logger->enabled(mpl::level_from(level)); };
+        if (takes_level(system_logger.get()) || std::any_of(loggers.begin(), loggers.end(), takes_level))
+            break;
+    }
+
+    max_level.store(level, std::memory_order_relaxed);
 }
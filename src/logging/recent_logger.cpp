@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <multipass/logging/recent_logger.h>
+
+#include <algorithm>
+
+namespace mpl = multipass::logging;
+
+mpl::RecentLogger::RecentLogger(Level level, std::size_t records_per_category, std::size_t max_categories)
+    : logging_level{level}, records_per_category{records_per_category}, max_categories{max_categories}
+{
+}
+
+void mpl::RecentLogger::log(Level level, CString category, CString message) const
+{
+    if (!enabled(level))
+        return;
+
+    Record record{std::chrono::system_clock::now(), level, category.c_str(), message.c_str()};
+
+    std::lock_guard<std::mutex> lock{mutex};
+    auto it = entries.find(record.category);
+    if (it == entries.end())
+    {
+        // Categories of instances long gone are the ones to make room
+        if (entries.size() >= max_categories)
+            entries.erase(std::min_element(entries.begin(), entries.end(), [](const auto& a, const auto& b) {
+                return a.second.back().sequence < b.second.back().sequence;
+            }));
+
+        it = entries.emplace(record.category, std::deque<Entry>{}).first;
+    }
+
+    auto& category_entries = it->second;
+    if (category_entries.size() >= records_per_category)
+        category_entries.pop_front();
+    category_entries.push_back({next_sequence++, std::move(record)});
+}
+
+bool mpl::RecentLogger::enabled(Level level) const
+{
+    return level <= logging_level;
+}
+
+std::vector<mpl::RecentLogger::Record> mpl::RecentLogger::recent(Level level, const std::string& category) const
+{
+    std::vector<const Entry*> matches;
+
+    std::lock_guard<std::mutex> lock{mutex};
+    auto collect = [&matches, level](const std::deque<Entry>& category_entries) {
+        for (const auto& entry : category_entries)
+            if (entry.record.level <= level)
+                matches.push_back(&entry);
+    };
+
+    if (category.empty())
+        for (const auto& category_entries : entries)
+            collect(category_entries.second);
+    else if (entries.find(category) != entries.end())
+        collect(entries.at(category));
+
+    std::sort(matches.begin(), matches.end(),
+              [](const Entry* a, const Entry* b) { return a->sequence < b->sequence; });
+
+    std::vector<Record> records;
+    records.reserve(matches.size());
+    for (const auto* entry : matches)
+        records.push_back(entry->record);
+
+    return records;
+}
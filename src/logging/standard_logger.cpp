@@ -36,3 +36,8 @@ void mpl::StandardLogger::log(mpl::Level level, CString category, CString messag
                    message.c_str());
     }
 }
+
+bool mpl::StandardLogger::enabled(mpl::Level level) const
+{
+    return level <= logging_level;
+}
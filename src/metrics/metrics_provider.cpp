@@ -28,6 +28,8 @@
 #include <QJsonObject>
 #include <QNetworkReply>
 #include <QNetworkRequest>
+#include <QSaveFile>
+#include <QTimer>
 
 namespace mp = multipass;
 namespace mpl = multipass::logging;
@@ -37,11 +39,12 @@ using namespace std::literals::chrono_literals;
 namespace
 {
 constexpr auto category = "metrics";
-constexpr auto saved_metrics_file = "saved_metrics.json";
+constexpr auto saved_metrics_file = "saved_metrics.json"; // all batches at once, as earlier versions kept them
+constexpr auto metrics_spool_file = "metrics_spool.jsonl"; // one batch per line, appended as they come
+constexpr auto post_timeout = 30s;
 
-void post_request(const QUrl& metrics_url, const QByteArray& body)
+void post_request(QNetworkAccessManager& manager, const QUrl& metrics_url, const QByteArray& body)
 {
-    QNetworkAccessManager manager;
     QNetworkRequest request{metrics_url};
     request.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
     request.setHeader(QNetworkRequest::ContentLengthHeader, body.size());
@@ -52,6 +55,7 @@ void post_request(const QUrl& metrics_url, const QByteArray& body)
                                                                    : manager.post(request, body)};
 
     QObject::connect(reply.get(), &QNetworkReply::finished, &event_loop, &QEventLoop::quit);
+    QTimer::singleShot(post_timeout, reply.get(), &QNetworkReply::abort);
 
     event_loop.exec();
 
@@ -70,24 +74,57 @@ void post_request(const QUrl& metrics_url, const QByteArray& body)
     }
 }
 
-auto load_saved_metrics(const mp::Path& data_path)
+void append_to_spool(const QJsonObject& metric, const mp::Path& data_path)
 {
-    QFile metrics_file{QDir(data_path).filePath(saved_metrics_file)};
-
-    if (!metrics_file.exists())
-        return QJsonArray();
+    QFile spool{QDir(data_path).filePath(metrics_spool_file)};
+    if (!spool.open(QIODevice::WriteOnly | QIODevice::Append) ||
+        spool.write(QJsonDocument(metric).toJson(QJsonDocument::Compact) + '\n') < 0)
+        mpl::log(mpl::Level::warning, category, fmt::format("Cannot save metrics: {}", spool.errorString()));
+}
 
-    metrics_file.open(QIODevice::ReadOnly);
-    auto metrics = QJsonDocument::fromJson(metrics_file.readAll()).array();
+void rewrite_spool(const QJsonArray& metrics, const mp::Path& data_path)
+{
+    const auto spool_path = QDir(data_path).filePath(metrics_spool_file);
+    if (metrics.isEmpty())
+    {
+        QFile::remove(spool_path);
+        return;
+    }
 
-    return metrics;
+    QSaveFile spool{spool_path};
+    spool.open(QIODevice::WriteOnly);
+    for (const auto& metric : metrics)
+        spool.write(QJsonDocument(metric.toObject()).toJson(QJsonDocument::Compact) + '\n');
+    spool.commit();
 }
 
-void persist_metrics(const QByteArray& metrics, const mp::Path& data_path)
+auto load_saved_metrics(const mp::Path& data_path)
 {
-    QFile metrics_file{QDir(data_path).filePath(saved_metrics_file)};
-    metrics_file.open(QIODevice::WriteOnly);
-    metrics_file.write(metrics);
+    QJsonArray metrics;
+
+    QFile saved_file{QDir(data_path).filePath(saved_metrics_file)};
+    if (saved_file.open(QIODevice::ReadOnly))
+        metrics = QJsonDocument::fromJson(saved_file.readAll()).array();
+
+    // A line cut short by a crash does not parse and is dropped
+    QFile spool{QDir(data_path).filePath(metrics_spool_file)};
+    if (spool.open(QIODevice::ReadOnly))
+    {
+        while (!spool.atEnd())
+        {
+            auto metric = QJsonDocument::fromJson(spool.readLine());
+            if (metric.isObject())
+                metrics.push_back(metric.object());
+        }
+    }
+
+    if (saved_file.exists())
+    {
+        rewrite_spool(metrics, data_path);
+        saved_file.remove();
+    }
+
+    return metrics;
 }
 } // namespace
 
@@ -98,6 +135,8 @@ mp::MetricsProvider::MetricsProvider(const QUrl& url, const QString& unique_id,
       metric_batches(load_saved_metrics(data_path)),
       metrics_available{!metric_batches.isEmpty()},
       metrics_sender{[this] {
+          // Lives on this thread for all posts, since a manager only works from the thread it was created on
+          QNetworkAccessManager manager;
           std::unique_lock<std::mutex> lock(metrics_mutex);
           auto timeout = std::chrono::seconds(3600);
           auto metrics_failed{false};
@@ -118,7 +157,7 @@ mp::MetricsProvider::MetricsProvider(const QUrl& url, const QString& unique_id,
 
               try
               {
-                  post_request(metrics_url, body);
+                  post_request(manager, metrics_url, body);
 
                   if (metrics_failed)
                       metrics_failed = false;
@@ -145,7 +184,7 @@ mp::MetricsProvider::MetricsProvider(const QUrl& url, const QString& unique_id,
                       timeout = std::chrono::seconds::zero();
                   }
 
-                  persist_metrics(QJsonDocument(metric_batches).toJson(QJsonDocument::Compact), data_path);
+                  rewrite_spool(metric_batches, data_path);
               }
               catch (const std::exception& e)
               {
@@ -223,7 +262,7 @@ void mp::MetricsProvider::update_and_notify_sender(const QJsonObject& metric)
     {
         std::lock_guard<std::mutex> lck(metrics_mutex);
         metric_batches.push_back(metric);
-        persist_metrics(QJsonDocument(metric_batches).toJson(QJsonDocument::Compact), data_path);
+        append_to_spool(metric, data_path);
         metrics_available = true;
     }
     metrics_cv.notify_one();
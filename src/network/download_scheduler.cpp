@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <multipass/download_scheduler.h>
+
+#include <algorithm>
+
+namespace mp = multipass;
+
+namespace
+{
+// Enough to keep a paused download's connections from going idle, and so to resume it without reconnecting
+constexpr qint64 trickle_bytes_per_second = 16 * 1024;
+// Bytes arrive in bursts, which need not be spread out below this
+constexpr auto allowed_burst = std::chrono::milliseconds(100);
+constexpr auto abort_poll_interval = std::chrono::milliseconds(250);
+} // namespace
+
+mp::DownloadScheduler::Ticket::Ticket(DownloadScheduler& scheduler, const QString& host, DownloadPriority priority,
+                                      int connections)
+    : scheduler{scheduler}, host{host}, priority{priority}, granted{connections}
+{
+}
+
+mp::DownloadScheduler::Ticket::~Ticket()
+{
+    scheduler.release(host, priority, granted);
+}
+
+int mp::DownloadScheduler::Ticket::connections() const
+{
+    return granted;
+}
+
+bool mp::DownloadScheduler::Ticket::account(qint64 bytes)
+{
+    return scheduler.throttle(priority, bytes);
+}
+
+void mp::DownloadScheduler::set_limits(qint64 bytes_per_second, int connections_per_host)
+{
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        this->bytes_per_second = std::max(bytes_per_second, qint64{0});
+        this->connections_per_host = std::max(connections_per_host, 0);
+    }
+    changed.notify_all();
+}
+
+std::unique_ptr<mp::DownloadScheduler::Ticket>
+mp::DownloadScheduler::admit(const QString& host, DownloadPriority priority, int connections_wanted,
+                             const std::atomic_bool& abort)
+{
+    const auto interactive = priority == DownloadPriority::interactive;
+    connections_wanted = std::max(connections_wanted, 1);
+
+    std::unique_lock<std::mutex> lock{mutex};
+    auto& state = hosts[host];
+
+    // Background downloads trickle while interactive ones run, so what they hold is free for the latter to take
+    auto free_connections = [this, &state, connections_wanted, interactive] {
+        const auto taken = interactive ? state.interactive_connections : state.connections;
+        return connections_per_host > 0 ? connections_per_host - taken : connections_wanted;
+    };
+    auto may_start = [&free_connections, &state, interactive] {
+        return free_connections() > 0 && (interactive || state.interactive_waiting == 0);
+    };
+
+    if (interactive)
+        ++state.interactive_waiting;
+
+    while (!may_start())
+    {
+        if (abort)
+        {
+            if (interactive)
+                --state.interactive_waiting;
+            return nullptr;
+        }
+
+        changed.wait_for(lock, abort_poll_interval);
+    }
+
+    if (interactive)
+    {
+        --state.interactive_waiting;
+        ++interactive_downloads;
+    }
+
+    const auto granted = std::min(connections_wanted, free_connections());
+    state.connections += granted;
+    if (interactive)
+        state.interactive_connections += granted;
+
+    return std::unique_ptr<Ticket>(new Ticket{*this, host, priority, granted});
+}
+
+void mp::DownloadScheduler::release(const QString& host, DownloadPriority priority, int connections)
+{
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        auto& state = hosts[host];
+        state.connections -= connections;
+        if (priority == DownloadPriority::interactive)
+        {
+            state.interactive_connections -= connections;
+            --interactive_downloads;
+        }
+    }
+    changed.notify_all();
+}
+
+bool mp::DownloadScheduler::throttle(DownloadPriority priority, qint64 bytes)
+{
+    using namespace std::chrono;
+
+    std::unique_lock<std::mutex> lock{mutex};
+
+    const auto paused = priority == DownloadPriority::background && interactive_downloads > 0;
+    const auto rate = paused ? (bytes_per_second > 0 ? std::min(bytes_per_second, trickle_bytes_per_second)
+                                                     : trickle_bytes_per_second)
+                             : bytes_per_second;
+    if (rate <= 0)
+        return false;
+
+    auto& booked_until = paused ? trickle_booked_until : link_booked_until;
+    const auto now = steady_clock::now();
+    booked_until = std::max(booked_until, now) +
+                   duration_cast<steady_clock::duration>(duration<double>(static_cast<double>(bytes) / rate));
+
+    const auto wait_until = booked_until - allowed_burst;
+    if (wait_until <= now)
+        return false;
+
+    // A paused download carries on as soon as the last interactive one is over
+    changed.wait_until(lock, wait_until, [this, paused] { return paused && interactive_downloads == 0; });
+
+    return true;
+}
@@ -17,22 +17,39 @@
 
 #include <multipass/url_downloader.h>
 
+#include <multipass/constants.h>
 #include <multipass/exceptions/aborted_download_exception.h>
 #include <multipass/exceptions/download_exception.h>
 #include <multipass/logging/log.h>
+#include <multipass/memory_size.h>
+#include <multipass/optional.h>
+#include <multipass/settings.h>
+#include <multipass/sha256.h>
+#include <multipass/telemetry.h>
+#include <multipass/utils.h>
 
 #include <multipass/format.h>
 
 #include <QDir>
 #include <QEventLoop>
 #include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLocale>
 #include <QNetworkAccessManager>
 #include <QNetworkDiskCache>
 #include <QNetworkReply>
+#include <QSaveFile>
+#include <QThreadStorage>
 #include <QTimer>
 #include <QUrl>
 
+#include <algorithm>
+#include <functional>
+#include <map>
 #include <memory>
+#include <vector>
 
 namespace mp = multipass;
 namespace mpl = multipass::logging;
@@ -40,21 +57,58 @@ namespace mpl = multipass::logging;
 namespace
 {
 constexpr auto category = "url downloader";
+constexpr qint64 segmented_download_threshold = 64 * 1024 * 1024;
+constexpr auto download_segments = 4;
+constexpr auto downloaded_bytes_metric = "multipass_download_bytes_total";
+constexpr auto max_segment_attempts = 3;
+// Bounds what Qt reads ahead of us, so that holding a download back slows down its connection too
+constexpr qint64 scheduled_read_buffer_size = 256 * 1024;
+
+struct DownloadSegment
+{
+    qint64 offset;
+    qint64 length;
+    qint64 bytes_written;
+    int attempts;
+};
+
+struct RemoteResource
+{
+    bool accepts_ranges;
+    QString etag;
+    QString last_modified;
+};
 
-auto make_network_manager(const mp::Path& cache_dir_path)
+struct DownloadJournal
 {
-    auto manager = std::make_unique<QNetworkAccessManager>();
+    QString url;
+    QString etag;
+    QString last_modified;
+    std::vector<DownloadSegment> segments;
+};
+
+// A manager can only be used from the thread that created it, so each thread keeps its own. Living as long as the
+// thread lets its connections, and their TLS sessions, be reused from one download to the next
+QNetworkAccessManager* network_manager_for(const mp::Path& cache_dir_path)
+{
+    static QThreadStorage<std::map<mp::Path, std::unique_ptr<QNetworkAccessManager>>> thread_managers;
 
-    if (!cache_dir_path.isEmpty())
+    auto& manager = thread_managers.localData()[cache_dir_path];
+    if (!manager)
     {
-        auto network_cache = new QNetworkDiskCache;
-        network_cache->setCacheDirectory(cache_dir_path);
+        manager = std::make_unique<QNetworkAccessManager>();
+
+        if (!cache_dir_path.isEmpty())
+        {
+            auto network_cache = new QNetworkDiskCache;
+            network_cache->setCacheDirectory(cache_dir_path);
 
-        // Manager now owns network_cache and so it will delete it in its dtor
-        manager->setCache(network_cache);
+            // Manager now owns network_cache and so it will delete it in its dtor
+            manager->setCache(network_cache);
+        }
     }
 
-    return manager;
+    return manager.get();
 }
 
 auto get_network_cache_data(QAbstractNetworkCache* network_cache, const QUrl& url)
@@ -67,7 +121,9 @@ auto get_network_cache_data(QAbstractNetworkCache* network_cache, const QUrl& ur
 
 template <typename ProgressAction, typename DownloadAction, typename ErrorAction, typename Time>
 QByteArray download(QNetworkAccessManager* manager, const Time& timeout, QUrl const& url, ProgressAction&& on_progress,
-                    DownloadAction&& on_download, ErrorAction&& on_error, const std::atomic_bool& abort_download)
+                    DownloadAction&& on_download, ErrorAction&& on_error, const std::atomic_bool& abort_download,
+                    const qint64 range_start = 0, const qint64 read_buffer_size = 0,
+                    const QNetworkCacheMetaData& cached = {}, bool* not_modified = nullptr)
 {
     QEventLoop event_loop;
     QTimer download_timeout;
@@ -78,14 +134,31 @@ QByteArray download(QNetworkAccessManager* manager, const Time& timeout, QUrl co
     request.setAttribute(QNetworkRequest::HttpPipeliningAllowedAttribute, true);
     request.setAttribute(QNetworkRequest::FollowRedirectsAttribute, true);
     request.setAttribute(QNetworkRequest::CacheLoadControlAttribute, QNetworkRequest::AlwaysNetwork);
+    if (range_start > 0)
+        request.setRawHeader("Range", QByteArray::fromStdString(fmt::format("bytes={}-", range_start)));
+
+    // Asking only for changes lets the server answer 304 without a body when the cached copy is still current
+    if (cached.isValid())
+    {
+        for (const auto& header : cached.rawHeaders())
+            if (header.first.toLower() == "etag")
+                request.setRawHeader("If-None-Match", header.second);
+
+        const auto last_modified = cached.lastModified().toUTC();
+        if (last_modified.isValid())
+            request.setRawHeader("If-Modified-Since",
+                                 QLocale::c().toString(last_modified, "ddd, dd MMM yyyy hh:mm:ss 'GMT'").toLatin1());
+    }
 
-    auto reply = manager->get(request);
+    // The manager outlives this download, so the reply must not
+    std::unique_ptr<QNetworkReply> reply{manager->get(request)};
+    reply->setReadBufferSize(read_buffer_size);
 
-    QObject::connect(reply, &QNetworkReply::finished, &event_loop, &QEventLoop::quit);
-    QObject::connect(reply, &QNetworkReply::downloadProgress, [&](qint64 bytes_received, qint64 bytes_total) {
-        on_progress(reply, bytes_received, bytes_total);
+    QObject::connect(reply.get(), &QNetworkReply::finished, &event_loop, &QEventLoop::quit);
+    QObject::connect(reply.get(), &QNetworkReply::downloadProgress, [&](qint64 bytes_received, qint64 bytes_total) {
+        on_progress(reply.get(), bytes_received, bytes_total);
     });
-    QObject::connect(reply, &QNetworkReply::readyRead, [&]() { on_download(reply, download_timeout); });
+    QObject::connect(reply.get(), &QNetworkReply::readyRead, [&]() { on_download(reply.get(), download_timeout); });
     QObject::connect(&download_timeout, &QTimer::timeout, [&]() {
         download_timeout.stop();
         reply->abort();
@@ -107,8 +180,361 @@ QByteArray download(QNetworkAccessManager* manager, const Time& timeout, QUrl co
         else
             throw mp::DownloadException{url.toString().toStdString(), download_timeout.isActive() ? msg : "Network timeout"};
     }
+
+    if (not_modified)
+        *not_modified = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == 304;
+
     return reply->readAll();
 }
+
+// A server that does not answer in time is taken not to support ranges, the download itself then finds out why
+RemoteResource probe_resource(QNetworkAccessManager* manager, const QUrl& url, std::chrono::milliseconds timeout)
+{
+    if (url.scheme() != "http" && url.scheme() != "https")
+        return {false, {}, {}};
+
+    QEventLoop event_loop;
+    QTimer probe_timeout;
+    probe_timeout.setSingleShot(true);
+
+    QNetworkRequest request{url};
+    request.setAttribute(QNetworkRequest::FollowRedirectsAttribute, true);
+
+    std::unique_ptr<QNetworkReply> reply{manager->head(request)};
+    QObject::connect(reply.get(), &QNetworkReply::finished, &event_loop, &QEventLoop::quit);
+    QObject::connect(&probe_timeout, &QTimer::timeout, reply.get(), &QNetworkReply::abort);
+
+    probe_timeout.start(timeout);
+    event_loop.exec();
+
+    if (reply->error() != QNetworkReply::NoError)
+        return {false, {}, {}};
+
+    return {reply->rawHeader("Accept-Ranges") == "bytes", QString::fromLatin1(reply->rawHeader("ETag")),
+            QString::fromLatin1(reply->rawHeader("Last-Modified"))};
+}
+
+QString journal_path_for(const QString& file_name)
+{
+    return file_name + mp::download_journal_suffix;
+}
+
+mp::optional<DownloadJournal> load_journal(const QString& file_name)
+{
+    QFile journal_file{journal_path_for(file_name)};
+    if (!journal_file.open(QIODevice::ReadOnly))
+        return mp::nullopt;
+
+    const auto json = QJsonDocument::fromJson(journal_file.readAll()).object();
+    if (json.isEmpty())
+        return mp::nullopt;
+
+    DownloadJournal journal{json["url"].toString(), json["etag"].toString(), json["last_modified"].toString(), {}};
+    for (const auto& entry : json["segments"].toArray())
+    {
+        const auto segment = entry.toObject();
+        journal.segments.push_back({static_cast<qint64>(segment["offset"].toDouble()),
+                                    static_cast<qint64>(segment["length"].toDouble()),
+                                    static_cast<qint64>(segment["bytes_written"].toDouble()), 0});
+    }
+
+    if (journal.segments.empty())
+        return mp::nullopt;
+
+    return journal;
+}
+
+void save_journal(const QString& file_name, const QUrl& url, const RemoteResource& resource,
+                  const std::vector<DownloadSegment>& segments)
+{
+    QJsonArray json_segments;
+    for (const auto& segment : segments)
+    {
+        QJsonObject json_segment;
+        json_segment.insert("offset", static_cast<qint64>(segment.offset));
+        json_segment.insert("length", static_cast<qint64>(segment.length));
+        json_segment.insert("bytes_written", static_cast<qint64>(segment.bytes_written));
+        json_segments.append(json_segment);
+    }
+
+    QJsonObject json;
+    json.insert("url", url.toString());
+    json.insert("etag", resource.etag);
+    json.insert("last_modified", resource.last_modified);
+    json.insert("segments", json_segments);
+
+    QSaveFile journal_file{journal_path_for(file_name)};
+    if (!journal_file.open(QIODevice::WriteOnly) ||
+        journal_file.write(QJsonDocument(json).toJson()) < 0 || !journal_file.commit())
+        mpl::log(mpl::Level::warning, category,
+                 fmt::format("Cannot save partial download state for {}", file_name));
+}
+
+void remove_journal(const QString& file_name)
+{
+    QFile::remove(journal_path_for(file_name));
+}
+
+bool can_resume(const mp::optional<DownloadJournal>& journal, const QUrl& url, const RemoteResource& resource,
+                const QString& file_name)
+{
+    if (!journal || journal->url != url.toString() || !QFile::exists(file_name))
+        return false;
+
+    // Without a validator we cannot tell whether the partial file still belongs to what the server is serving now
+    if (resource.etag.isEmpty() && resource.last_modified.isEmpty())
+        return false;
+
+    return resource.accepts_ranges && journal->etag == resource.etag &&
+           journal->last_modified == resource.last_modified;
+}
+
+// Hashes the downloaded bytes in file order and hands them on to the caller's sink
+class InOrderConsumer
+{
+public:
+    explicit InOrderConsumer(const mp::URLDownloader::DataSink& sink) : sink{sink}
+    {
+    }
+
+    void consume(const QByteArray& data)
+    {
+        hash.add_data(data);
+        if (sink)
+            sink(data);
+    }
+
+    QByteArray digest()
+    {
+        return hash.result().toHex();
+    }
+
+private:
+    const mp::URLDownloader::DataSink& sink;
+    mp::Sha256 hash;
+};
+
+void consume_file_range(QFile& file, qint64 from, qint64 to, InOrderConsumer& consumer)
+{
+    constexpr qint64 chunk_size = 1024 * 1024;
+
+    file.seek(from);
+    while (from < to)
+    {
+        const auto data = file.read(std::min(chunk_size, to - from));
+        if (data.isEmpty())
+            throw std::runtime_error(fmt::format("cannot read back {}", file.fileName()));
+
+        consumer.consume(data);
+        from += data.size();
+    }
+}
+
+// Consumes whatever has become contiguous from the start of the file since the last call
+void consume_committed_prefix(QFile& file, const std::vector<DownloadSegment>& segments, qint64& consumed_bytes,
+                              InOrderConsumer& consumer)
+{
+    for (const auto& segment : segments)
+    {
+        const auto committed_end = segment.offset + segment.bytes_written;
+        if (committed_end > consumed_bytes)
+        {
+            consume_file_range(file, consumed_bytes, committed_end, consumer);
+            consumed_bytes = committed_end;
+        }
+
+        if (segment.bytes_written < segment.length)
+            break;
+    }
+}
+
+std::vector<DownloadSegment> split_into_segments(qint64 size)
+{
+    std::vector<DownloadSegment> segments;
+    const auto segment_length = size / download_segments;
+
+    for (auto i = 0; i < download_segments; ++i)
+    {
+        const auto offset = i * segment_length;
+        const auto length = (i == download_segments - 1) ? size - offset : segment_length;
+        segments.push_back({offset, length, 0, 0});
+    }
+
+    return segments;
+}
+
+// Fetches the file as a number of byte ranges over concurrent connections, each writing into its own region of the
+// preallocated file. A segment that fails is retried from where it stopped, leaving the other segments untouched.
+// The consumer is fed the file's contiguous prefix as it grows. Segments beyond the connections the ticket grants
+// wait for earlier ones to finish.
+template <typename Time>
+void download_segmented(QNetworkAccessManager* manager, const Time& timeout, const QUrl& url, QFile& file,
+                        qint64 size, std::vector<DownloadSegment>& segments, const int download_type,
+                        const mp::ProgressMonitor& monitor, InOrderConsumer& consumer,
+                        const std::atomic_bool& abort_download, mp::DownloadScheduler::Ticket& ticket)
+{
+    if (file.size() != size && !file.resize(size))
+        throw std::runtime_error(fmt::format("cannot allocate {}: {}", file.fileName(), file.errorString()));
+
+    qint64 consumed_bytes{0};
+    consume_committed_prefix(file, segments, consumed_bytes, consumer);
+
+    std::vector<QNetworkReply*> active_replies;
+    QEventLoop event_loop;
+    qint64 bytes_received{0};
+    int last_progress{-1};
+    bool cancelled{false};
+    std::string error;
+
+    std::vector<DownloadSegment*> waiting_segments;
+
+    auto abort_all = [&active_replies] {
+        for (auto reply : std::vector<QNetworkReply*>{active_replies})
+            reply->abort();
+    };
+
+    // Time spent held back by the scheduler must not count against the other segments
+    auto restart_timeouts = [&active_replies] {
+        for (auto reply : active_replies)
+        {
+            auto segment_timeout = reply->findChild<QTimer*>();
+            if (segment_timeout && segment_timeout->isActive())
+                segment_timeout->start();
+        }
+    };
+
+    std::function<void(DownloadSegment*)> start_segment = [&](DownloadSegment* segment) {
+        const auto first_byte = segment->offset + segment->bytes_written;
+        const auto last_byte = segment->offset + segment->length - 1;
+
+        QNetworkRequest request{url};
+        request.setRawHeader("Connection", "Keep-Alive");
+        request.setRawHeader("Range", QByteArray::fromStdString(fmt::format("bytes={}-{}", first_byte, last_byte)));
+        request.setAttribute(QNetworkRequest::FollowRedirectsAttribute, true);
+        request.setAttribute(QNetworkRequest::CacheLoadControlAttribute, QNetworkRequest::AlwaysNetwork);
+
+        auto reply = manager->get(request);
+        reply->setReadBufferSize(scheduled_read_buffer_size);
+        active_replies.push_back(reply);
+
+        auto segment_timeout = new QTimer(reply);
+        segment_timeout->setSingleShot(true);
+        segment_timeout->setInterval(timeout);
+
+        QObject::connect(segment_timeout, &QTimer::timeout, reply, &QNetworkReply::abort);
+        QObject::connect(reply, &QNetworkReply::readyRead, [&, reply, segment, segment_timeout]() {
+            if (abort_download || cancelled)
+            {
+                reply->abort();
+                return;
+            }
+
+            // A server ignoring the Range header would send us the whole file
+            if (reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() != 206)
+            {
+                error = "server did not honour the requested byte range";
+                cancelled = true;
+                abort_all();
+                return;
+            }
+
+            const auto write_position = segment->offset + segment->bytes_written;
+            auto data = reply->read(segment->length - segment->bytes_written);
+            if (!file.seek(write_position) || mp::utils::write_sparse(file, data.constData(), data.size()) < 0)
+            {
+                mpl::log(mpl::Level::error, category, fmt::format("error writing image: {}", file.errorString()));
+                error = fmt::format("error writing image: {}", file.errorString());
+                cancelled = true;
+                abort_all();
+                return;
+            }
+
+            segment->bytes_written += data.size();
+            bytes_received += data.size();
+            mp::Telemetry::instance().count(downloaded_bytes_metric, {}, data.size());
+            if (ticket.account(data.size()))
+                restart_timeouts();
+            segment_timeout->start();
+
+            if (write_position == consumed_bytes)
+            {
+                consumer.consume(data);
+                consumed_bytes += data.size();
+            }
+
+            const auto progress = static_cast<int>((100 * bytes_received + size / 2) / size);
+            if (progress != last_progress)
+            {
+                last_progress = progress;
+                if (!monitor(download_type, progress))
+                {
+                    cancelled = true;
+                    abort_all();
+                }
+            }
+        });
+        QObject::connect(reply, &QNetworkReply::finished, [&, reply, segment, segment_timeout]() {
+            segment_timeout->stop();
+            active_replies.erase(std::remove(active_replies.begin(), active_replies.end(), reply),
+                                 active_replies.end());
+            reply->deleteLater();
+
+            if (segment->bytes_written < segment->length && !abort_download && !cancelled)
+            {
+                if (++segment->attempts < max_segment_attempts)
+                {
+                    mpl::log(mpl::Level::debug, category,
+                             fmt::format("Retrying segment at offset {} of {}: {}", segment->offset, url.toString(),
+                                         reply->errorString()));
+                    start_segment(segment);
+                }
+                else
+                {
+                    error = reply->error() != QNetworkReply::NoError ? reply->errorString().toStdString()
+                                                                     : "connection closed early";
+                    cancelled = true;
+                    abort_all();
+                }
+            }
+
+            while (!cancelled && !abort_download && !waiting_segments.empty() &&
+                   static_cast<int>(active_replies.size()) < ticket.connections())
+            {
+                auto next_segment = waiting_segments.front();
+                waiting_segments.erase(waiting_segments.begin());
+                start_segment(next_segment);
+            }
+
+            if (active_replies.empty())
+                event_loop.quit();
+        });
+
+        segment_timeout->start();
+    };
+
+    for (auto& segment : segments)
+    {
+        bytes_received += segment.bytes_written;
+        if (segment.bytes_written >= segment.length)
+            continue;
+
+        if (static_cast<int>(active_replies.size()) < ticket.connections())
+            start_segment(&segment);
+        else
+            waiting_segments.push_back(&segment);
+    }
+
+    if (!active_replies.empty())
+        event_loop.exec();
+
+    if (abort_download)
+        throw mp::AbortedDownloadException{"Download aborted"};
+
+    if (cancelled)
+        throw mp::DownloadException{url.toString().toStdString(), error.empty() ? "Operation canceled" : error};
+
+    consume_committed_prefix(file, segments, consumed_bytes, consumer);
+}
 } // namespace
 
 mp::URLDownloader::URLDownloader(std::chrono::milliseconds timeout) : URLDownloader{Path(), timeout}
@@ -120,21 +546,99 @@ mp::URLDownloader::URLDownloader(const mp::Path& cache_dir, std::chrono::millise
 {
 }
 
-void mp::URLDownloader::download_to(const QUrl& url, const QString& file_name, int64_t size, const int download_type,
-                                    const mp::ProgressMonitor& monitor)
+QByteArray mp::URLDownloader::download_to(const QUrl& url, const QString& file_name, int64_t size,
+                                          const int download_type, const mp::ProgressMonitor& monitor,
+                                          const DataSink& sink, DownloadPriority priority)
 {
-    auto manager{make_network_manager(cache_dir_path)};
+    auto timer = mp::Telemetry::instance().time("multipass_download_duration_seconds");
+    auto manager = network_manager_for(cache_dir_path);
+
+    const auto resource = probe_resource(manager, url, timeout);
+    const auto segmented = size >= segmented_download_threshold && resource.accepts_ranges;
+
+    scheduler.set_limits(MemorySize{Settings::instance().get(download_bandwidth_key).toStdString()}.in_bytes(),
+                         Settings::instance().get(download_connections_key).toInt());
+    const auto ticket = scheduler.admit(url.host(), priority, segmented ? download_segments : 1, abort_download);
+    if (!ticket)
+        throw mp::AbortedDownloadException{"Download aborted"};
+    auto journal = load_journal(file_name);
+    const auto resume = can_resume(journal, url, resource, file_name);
+    if (journal && !resume)
+    {
+        mpl::log(mpl::Level::debug, category, fmt::format("Discarding partial download of {}", url.toString()));
+        remove_journal(file_name);
+    }
 
     QFile file{file_name};
-    file.open(QIODevice::ReadWrite | QIODevice::Truncate);
+    file.open(resume ? QIODevice::ReadWrite : QIODevice::ReadWrite | QIODevice::Truncate);
+
+    // Keep what was written so far when the server gives us a way to validate it on the next attempt
+    auto keep_or_remove_partial = [&file, &file_name, &url, &resource](const std::vector<DownloadSegment>& segments) {
+        const auto has_data = std::any_of(segments.cbegin(), segments.cend(),
+                                          [](const DownloadSegment& segment) { return segment.bytes_written > 0; });
+        if (has_data && resource.accepts_ranges && (!resource.etag.isEmpty() || !resource.last_modified.isEmpty()))
+        {
+            save_journal(file_name, url, resource, segments);
+        }
+        else
+        {
+            remove_journal(file_name);
+            file.remove();
+        }
+    };
+
+    InOrderConsumer consumer{sink};
+
+    if (segmented)
+    {
+        auto segments = split_into_segments(size);
+        if (resume && journal->segments.size() == segments.size() &&
+            journal->segments.back().offset + journal->segments.back().length == size)
+        {
+            segments = journal->segments;
+            mpl::log(mpl::Level::info, category, fmt::format("Resuming download of {}", url.toString()));
+        }
+
+        try
+        {
+            ::download_segmented(manager, timeout, url, file, size, segments, download_type, monitor, consumer,
+                                 abort_download, *ticket);
+        }
+        catch (const std::exception&)
+        {
+            keep_or_remove_partial(segments);
+            throw;
+        }
+
+        remove_journal(file_name);
+        return consumer.digest();
+    }
+
+
+    DownloadSegment stream{0, size, 0, 0};
+    if (resume && journal->segments.size() == 1 && file.size() >= journal->segments.front().bytes_written)
+    {
+        stream.bytes_written = journal->segments.front().bytes_written;
+        file.resize(stream.bytes_written);
+        file.seek(stream.bytes_written);
+        mpl::log(mpl::Level::info, category,
+                 fmt::format("Resuming download of {} at byte {}", url.toString(), stream.bytes_written));
+    }
+    const auto range_start = stream.bytes_written;
+    // Progress of a reply is relative to the range it answers
+    qint64 progress_base{0};
 
-    auto progress_monitor = [&monitor, download_type, size](QNetworkReply* reply, qint64 bytes_received,
-                                                            qint64 bytes_total) {
+    auto progress_monitor = [&monitor, &progress_base, download_type, size](QNetworkReply* reply,
+                                                                             qint64 bytes_received,
+                                                                             qint64 bytes_total) {
         if (bytes_received == 0)
             return;
 
         if (bytes_total == -1 && size > 0)
-            bytes_total = size;
+            bytes_total = size - progress_base;
+
+        bytes_received += progress_base;
+        bytes_total += progress_base;
 
         auto progress = (size < 0) ? size : (100 * bytes_received + bytes_total / 2) / bytes_total;
         if (!monitor(download_type, progress))
@@ -143,7 +647,10 @@ void mp::URLDownloader::download_to(const QUrl& url, const QString& file_name, i
         }
     };
 
-    auto on_download = [this, &file](QNetworkReply* reply, QTimer& download_timeout) {
+    // Whether the reply answers the range asked for is only known once, with its first bytes
+    auto range_answered = range_start == 0;
+    auto on_download = [this, &file, &consumer, &stream, &progress_base, &ticket, &range_answered,
+                        range_start](QNetworkReply* reply, QTimer& download_timeout) {
         if (abort_download)
         {
             reply->abort();
@@ -155,44 +662,55 @@ void mp::URLDownloader::download_to(const QUrl& url, const QString& file_name, i
         else
             return;
 
-        if (file.write(reply->readAll()) < 0)
+        if (!range_answered)
+        {
+            // The server may answer a ranged request with the whole file, in which case we start over.
+            // Only once we know can the bytes already on disk be handed to the consumer.
+            range_answered = true;
+            if (reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == 206)
+            {
+                progress_base = range_start;
+                consume_file_range(file, 0, range_start, consumer);
+            }
+            else
+            {
+                file.resize(0);
+                file.seek(0);
+                stream.bytes_written = 0;
+            }
+        }
+
+        const auto data = reply->readAll();
+        if (mp::utils::write_sparse(file, data.constData(), data.size()) < 0)
         {
             mpl::log(mpl::Level::error, category, fmt::format("error writing image: {}", file.errorString()));
             reply->abort();
         }
+        consumer.consume(data);
+        stream.bytes_written += data.size();
+        mp::Telemetry::instance().count(downloaded_bytes_metric, {}, data.size());
+        ticket->account(data.size());
         download_timeout.start();
     };
 
-    auto on_error = [&file]() { file.remove(); };
+    auto on_error = [&keep_or_remove_partial, &stream]() { keep_or_remove_partial({stream}); };
 
-    ::download(manager.get(), timeout, url, progress_monitor, on_download, on_error, abort_download);
+    ::download(manager, timeout, url, progress_monitor, on_download, on_error, abort_download, range_start,
+               scheduled_read_buffer_size);
+    if (!mp::utils::finish_sparse_write(file))
+        throw std::runtime_error(fmt::format("error writing {}: {}", file_name, file.errorString()));
+    remove_journal(file_name);
+
+    return consumer.digest();
 }
 
 QByteArray mp::URLDownloader::download(const QUrl& url)
 {
-    auto manager{make_network_manager(cache_dir_path)};
+    auto manager = network_manager_for(cache_dir_path);
 
     auto network_cache = manager->cache();
     auto metadata = network_cache->metaData(url);
 
-    if (metadata.isValid())
-    {
-        try
-        {
-            if (last_modified(url) == metadata.lastModified())
-            {
-                return get_network_cache_data(network_cache, url);
-            }
-        }
-        catch (const std::exception& e)
-        {
-            mpl::log(
-                mpl::Level::info, category,
-                fmt::format("Cannot get last modified date for {}: {}. Using cached data.", url.toString(), e.what()));
-            return get_network_cache_data(network_cache, url);
-        }
-    }
-
     // This will connect to the QNetworkReply::readReady signal and when emitted,
     // reset the timer.
     auto on_download = [this](QNetworkReply* reply, QTimer& download_timeout) {
@@ -207,8 +725,12 @@ QByteArray mp::URLDownloader::download(const QUrl& url)
 
     try
     {
-        return ::download(manager.get(), timeout, url, [](QNetworkReply*, qint64, qint64) {}, on_download, [] {},
-                          abort_download);
+        // A single conditional GET, rather than probing the last modified date first and then downloading
+        bool not_modified{false};
+        auto data = ::download(manager, timeout, url, [](QNetworkReply*, qint64, qint64) {}, on_download, [] {},
+                               abort_download, 0, 0, metadata, &not_modified);
+
+        return not_modified ? get_network_cache_data(network_cache, url) : data;
     }
     catch (const std::exception& e)
     {
@@ -228,16 +750,21 @@ QByteArray mp::URLDownloader::download(const QUrl& url)
 
 QDateTime mp::URLDownloader::last_modified(const QUrl& url)
 {
-    auto manager{make_network_manager(cache_dir_path)};
+    auto manager = network_manager_for(cache_dir_path);
 
     QEventLoop event_loop;
 
+    QTimer request_timeout;
+    request_timeout.setSingleShot(true);
+
     QNetworkRequest request{url};
     request.setAttribute(QNetworkRequest::FollowRedirectsAttribute, true);
 
-    auto reply = manager->head(request);
-    QObject::connect(reply, &QNetworkReply::finished, &event_loop, &QEventLoop::quit);
+    std::unique_ptr<QNetworkReply> reply{manager->head(request)};
+    QObject::connect(reply.get(), &QNetworkReply::finished, &event_loop, &QEventLoop::quit);
+    QObject::connect(&request_timeout, &QTimer::timeout, reply.get(), &QNetworkReply::abort);
 
+    request_timeout.start(timeout);
     event_loop.exec();
 
     if (reply->error() != QNetworkReply::NoError)
@@ -0,0 +1,258 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "libvirt_connection.h"
+#include "libvirt_virtual_machine.h"
+
+#include <multipass/logging/log.h>
+
+#include <multipass/format.h>
+
+#include <QXmlStreamReader>
+
+namespace mp = multipass;
+namespace mpl = multipass::logging;
+
+namespace
+{
+constexpr auto logging_category = "libvirt-connection";
+// How often the event loop wakes up on its own, so that stopping it never waits on libvirtd
+constexpr auto event_loop_wakeup_ms = 250;
+} // namespace
+
+mp::LibvirtConnection::LibvirtConnection(const mp::LibvirtWrapper::UPtr& libvirt_wrapper)
+    : libvirt_wrapper{libvirt_wrapper}, connection{nullptr, nullptr}
+{
+}
+
+mp::LibvirtConnection::~LibvirtConnection()
+{
+    network.reset();
+
+    {
+        std::lock_guard<decltype(connection_mutex)> lock{connection_mutex};
+        deregister_callbacks();
+        connection.reset();
+    }
+
+    stop_event_loop();
+}
+
+mp::LibvirtConnection::Handle mp::LibvirtConnection::get()
+{
+    std::lock_guard<decltype(connection_mutex)> lock{connection_mutex};
+
+    // Callers keep using what they were handed while another finds the connection dead and replaces it
+    auto handle = [this] {
+        libvirt_wrapper->virConnectRef(connection.get());
+        return Handle{connection.get(), libvirt_wrapper->virConnectClose};
+    };
+
+    if (connection && libvirt_wrapper && libvirt_wrapper->virConnectIsAlive(connection.get()) == 1)
+        return handle();
+
+    deregister_callbacks();
+    connection.reset();
+
+    // The event implementation has to be in place before the connection is opened for it to deliver events
+    start_event_loop();
+
+    connection = LibVirtVirtualMachine::open_libvirt_connection(libvirt_wrapper);
+    ++connection_generation;
+    register_callbacks();
+
+    return handle();
+}
+
+int mp::LibvirtConnection::generation() const
+{
+    return connection_generation;
+}
+
+bool mp::LibvirtConnection::tracks_domain_events() const
+{
+    return events_active;
+}
+
+std::shared_ptr<virNetwork> mp::LibvirtConnection::default_network()
+{
+    auto connection = get();
+
+    std::lock_guard<decltype(cache_mutex)> lock{cache_mutex};
+    if (!network || network_generation != connection_generation)
+    {
+        auto handle = libvirt_wrapper->virNetworkLookupByName(connection.get(), "default");
+        network = handle ? std::shared_ptr<virNetwork>{handle, libvirt_wrapper->virNetworkFree} : nullptr;
+        network_generation = connection_generation;
+    }
+
+    return network;
+}
+
+std::string mp::LibvirtConnection::host_architecture()
+{
+    auto connection = get();
+
+    std::lock_guard<decltype(cache_mutex)> lock{cache_mutex};
+    if (architecture.empty())
+    {
+        std::unique_ptr<char, decltype(free)*> capabilities{
+            libvirt_wrapper->virConnectGetCapabilities(connection.get()), free};
+        QXmlStreamReader reader(capabilities.get());
+        while (!reader.atEnd())
+        {
+            reader.readNext();
+
+            if (reader.name() == "arch")
+            {
+                architecture = reader.readElementText().toStdString();
+                break;
+            }
+        }
+    }
+
+    return architecture;
+}
+
+void mp::LibvirtConnection::add_lifecycle_handler(const std::string& domain_name, LifecycleHandler handler)
+{
+    std::lock_guard<decltype(handlers_mutex)> lock{handlers_mutex};
+    lifecycle_handlers[domain_name] = std::move(handler);
+}
+
+void mp::LibvirtConnection::remove_lifecycle_handler(const std::string& domain_name)
+{
+    std::unique_lock<decltype(handlers_mutex)> lock{handlers_mutex};
+    lifecycle_handlers.erase(domain_name);
+
+    // The handler may still be running off its copy; its owner is about to go away
+    handler_done.wait(lock, [this, &domain_name] { return dispatching_to != domain_name; });
+}
+
+int mp::LibvirtConnection::on_lifecycle_event(virConnectPtr /*connection*/, virDomainPtr domain, int /*event*/,
+                                              int /*detail*/, void* opaque)
+{
+    auto self = static_cast<LibvirtConnection*>(opaque);
+    auto domain_name = self->libvirt_wrapper->virDomainGetName(domain);
+    if (!domain_name)
+        return 0;
+
+    // Called without the lock held, as handlers take their instance's state lock, under which others take this one
+    LifecycleHandler handler;
+    {
+        std::lock_guard<decltype(self->handlers_mutex)> lock{self->handlers_mutex};
+        auto it = self->lifecycle_handlers.find(domain_name);
+        if (it == self->lifecycle_handlers.end())
+            return 0;
+
+        handler = it->second;
+        self->dispatching_to = domain_name;
+    }
+
+    handler(domain);
+
+    {
+        std::lock_guard<decltype(self->handlers_mutex)> lock{self->handlers_mutex};
+        self->dispatching_to.clear();
+    }
+    self->handler_done.notify_all();
+
+    return 0;
+}
+
+void mp::LibvirtConnection::on_close(virConnectPtr /*connection*/, int reason, void* opaque)
+{
+    mpl::log(mpl::Level::warning, logging_category, fmt::format("Lost the connection to libvirtd ({})", reason));
+
+    // Nothing is heard about domains until get() reconnects, so instances go back to asking for their state
+    static_cast<LibvirtConnection*>(opaque)->events_active = false;
+}
+
+void mp::LibvirtConnection::start_event_loop()
+{
+    if (event_loop_running || !libvirt_wrapper)
+        return;
+
+    if (libvirt_wrapper->virEventRegisterDefaultImpl() < 0)
+    {
+        mpl::log(mpl::Level::warning, logging_category,
+                 fmt::format("Cannot set up the libvirt event loop: {}", libvirt_wrapper->virGetLastErrorMessage()));
+        return;
+    }
+
+    wakeup_timer = libvirt_wrapper->virEventAddTimeout(event_loop_wakeup_ms, [](int, void*) {}, nullptr, nullptr);
+    event_loop_running = true;
+
+    event_loop = std::thread([this] {
+        while (event_loop_running)
+        {
+            if (libvirt_wrapper->virEventRunDefaultImpl() < 0)
+            {
+                mpl::log(mpl::Level::warning, logging_category,
+                         fmt::format("The libvirt event loop failed: {}", libvirt_wrapper->virGetLastErrorMessage()));
+                events_active = false;
+                event_loop_running = false;
+            }
+        }
+    });
+}
+
+void mp::LibvirtConnection::stop_event_loop()
+{
+    if (!event_loop.joinable())
+        return;
+
+    event_loop_running = false;
+    if (wakeup_timer >= 0)
+        libvirt_wrapper->virEventUpdateTimeout(wakeup_timer, 0);
+
+    event_loop.join();
+
+    if (wakeup_timer >= 0)
+        libvirt_wrapper->virEventRemoveTimeout(wakeup_timer);
+    wakeup_timer = -1;
+}
+
+void mp::LibvirtConnection::register_callbacks()
+{
+    if (!event_loop_running)
+        return;
+
+    lifecycle_callback_id = libvirt_wrapper->virConnectDomainEventRegisterAny(
+        connection.get(), nullptr, VIR_DOMAIN_EVENT_ID_LIFECYCLE, VIR_DOMAIN_EVENT_CALLBACK(on_lifecycle_event), this,
+        nullptr);
+    if (lifecycle_callback_id < 0)
+    {
+        mpl::log(mpl::Level::debug, logging_category, "Domain events are unavailable, instance states will be polled");
+        return;
+    }
+
+    libvirt_wrapper->virConnectRegisterCloseCallback(connection.get(), on_close, this, nullptr);
+    events_active = true;
+}
+
+void mp::LibvirtConnection::deregister_callbacks()
+{
+    events_active = false;
+
+    if (!connection || lifecycle_callback_id < 0)
+        return;
+
+    libvirt_wrapper->virConnectUnregisterCloseCallback(connection.get(), on_close);
+    libvirt_wrapper->virConnectDomainEventDeregisterAny(connection.get(), lifecycle_callback_id);
+    lifecycle_callback_id = -1;
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_LIBVIRT_CONNECTION_H
+#define MULTIPASS_LIBVIRT_CONNECTION_H
+
+#include "libvirt_wrapper.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+namespace multipass
+{
+// One connection to libvirtd, shared by all instances, that also hears about domain lifecycle changes
+class LibvirtConnection
+{
+public:
+    using LifecycleHandler = std::function<void(virDomainPtr domain)>;
+    using Handle = std::shared_ptr<virConnect>; // a reference of its own, which outlives reconnecting
+
+    // Needs to be a reference so testing can override the various libvirt functions
+    explicit LibvirtConnection(const LibvirtWrapper::UPtr& libvirt_wrapper);
+    ~LibvirtConnection();
+
+    // Opens the connection on first use, and again once libvirtd drops it. Throws if libvirtd cannot be reached
+    Handle get();
+
+    // Bumped each time the connection is (re)opened, since handles from an older connection are no longer usable
+    int generation() const;
+
+    // Whether domain lifecycle events are being delivered, i.e. whether cached states can be trusted
+    bool tracks_domain_events() const;
+
+    // The network instances attach to, looked up once per connection rather than by every lease query. Null while
+    // libvirtd has no such network
+    std::shared_ptr<virNetwork> default_network();
+
+    // The host's architecture from libvirtd's capabilities, which only need asking for once
+    std::string host_architecture();
+
+    void add_lifecycle_handler(const std::string& domain_name, LifecycleHandler handler);
+    void remove_lifecycle_handler(const std::string& domain_name);
+
+private:
+    using ConnectionUPtr = std::unique_ptr<virConnect, decltype(virConnectClose)*>;
+
+    static int on_lifecycle_event(virConnectPtr connection, virDomainPtr domain, int event, int detail, void* opaque);
+    static void on_close(virConnectPtr connection, int reason, void* opaque);
+
+    void start_event_loop();
+    void stop_event_loop();
+    void register_callbacks();
+    void deregister_callbacks();
+
+    const LibvirtWrapper::UPtr& libvirt_wrapper;
+    std::mutex connection_mutex;
+    ConnectionUPtr connection;
+    std::atomic<int> connection_generation{0};
+
+    std::mutex cache_mutex;
+    std::shared_ptr<virNetwork> network;
+    int network_generation{0};
+    std::string architecture;
+
+    int lifecycle_callback_id{-1};
+    std::atomic<bool> events_active{false};
+
+    std::mutex handlers_mutex;
+    std::condition_variable handler_done;
+    std::unordered_map<std::string, LifecycleHandler> lifecycle_handlers;
+    std::string dispatching_to; // the domain whose handler the event loop is running, if any
+
+    std::thread event_loop;
+    std::atomic<bool> event_loop_running{false};
+    int wakeup_timer{-1};
+};
+} // namespace multipass
+
+#endif // MULTIPASS_LIBVIRT_CONNECTION_H
@@ -24,8 +24,10 @@
 #include <multipass/utils.h>
 #include <multipass/vm_status_monitor.h>
 #include <shared/linux/backend_utils.h>
+#include <shared/linux/guest_agent.h>
 
 #include <QDir>
+#include <QJsonDocument>
 #include <QXmlStreamReader>
 
 #include <multipass/format.h>
@@ -35,6 +37,8 @@ namespace mpl = multipass::logging;
 
 namespace
 {
+constexpr auto guest_agent_timeout_seconds = 2;
+
 auto instance_mac_addr_for(virDomainPtr domain, const mp::LibvirtWrapper::UPtr& libvirt_wrapper)
 {
     std::string mac_addr;
@@ -56,23 +60,21 @@ auto instance_mac_addr_for(virDomainPtr domain, const mp::LibvirtWrapper::UPtr&
     return mac_addr;
 }
 
-auto instance_ip_for(const std::string& mac_addr, const mp::LibvirtWrapper::UPtr& libvirt_wrapper)
+auto instance_ip_for(const std::string& mac_addr, mp::LibvirtConnection& libvirt_connection,
+                     const mp::LibvirtWrapper::UPtr& libvirt_wrapper)
 {
     mp::optional<mp::IPAddress> ip_address;
 
-    mp::LibVirtVirtualMachine::ConnectionUPtr connection{nullptr, nullptr};
+    std::shared_ptr<virNetwork> network;
     try
     {
-        connection = mp::LibVirtVirtualMachine::open_libvirt_connection(libvirt_wrapper);
+        network = libvirt_connection.default_network();
     }
     catch (const std::exception&)
     {
         return ip_address;
     }
 
-    mp::LibVirtVirtualMachine::NetworkUPtr network{libvirt_wrapper->virNetworkLookupByName(connection.get(), "default"),
-                                                   libvirt_wrapper->virNetworkFree};
-
     virNetworkDHCPLeasePtr* leases = nullptr;
     auto nleases = libvirt_wrapper->virNetworkGetDHCPLeases(network.get(), mac_addr.c_str(), &leases, 0);
 
@@ -93,27 +95,6 @@ auto instance_ip_for(const std::string& mac_addr, const mp::LibvirtWrapper::UPtr
     return ip_address;
 }
 
-auto host_architecture_for(virConnectPtr connection, const mp::LibvirtWrapper::UPtr& libvirt_wrapper)
-{
-    std::string arch;
-    std::unique_ptr<char, decltype(free)*> capabilities{libvirt_wrapper->virConnectGetCapabilities(connection), free};
-
-    QXmlStreamReader reader(capabilities.get());
-
-    while (!reader.atEnd())
-    {
-        reader.readNext();
-
-        if (reader.name() == "arch")
-        {
-            arch = reader.readElementText().toStdString();
-            break;
-        }
-    }
-
-    return arch;
-}
-
 auto generate_xml_config_for(const mp::VirtualMachineDescription& desc, const std::string& bridge_name,
                              const std::string& arch)
 {
@@ -170,6 +151,9 @@ auto generate_xml_config_for(const mp::VirtualMachineDescription& desc, const st
         "      <source path=\'/dev/pts/2\'/>\n"
         "      <target port=\"0\"/>\n"
         "    </serial>\n"
+        "    <channel type=\'unix\'>\n"
+        "      <target type=\'virtio\' name=\'{}\'/>\n"
+        "    </channel>\n"
         "    <video>\n"
         "      <model type=\'qxl\' ram=\'65536\' vram=\'65536\' vgamem=\'16384\' heads=\'1\' primary=\'yes\'/>\n"
         "      <alias name=\'video0\'/>\n"
@@ -177,7 +161,8 @@ auto generate_xml_config_for(const mp::VirtualMachineDescription& desc, const st
         "  </devices>\n"
         "</domain>",
         desc.vm_name, mem_unit, memory, mem_unit, memory, desc.num_cores, arch, qemu_path,
-        desc.image.image_path.toStdString(), desc.cloud_init_iso.toStdString(), desc.mac_addr, bridge_name);
+        desc.image.image_path.toStdString(), desc.cloud_init_iso.toStdString(), desc.mac_addr, bridge_name,
+        mp::backend::guest_agent_port_name);
 }
 
 auto domain_by_name_for(const std::string& vm_name, virConnectPtr connection,
@@ -190,27 +175,23 @@ auto domain_by_name_for(const std::string& vm_name, virConnectPtr connection,
 }
 
 auto domain_by_definition_for(const mp::VirtualMachineDescription& desc, const std::string& bridge_name,
-                              virConnectPtr connection, const mp::LibvirtWrapper::UPtr& libvirt_wrapper)
+                              const std::string& arch, virConnectPtr connection,
+                              const mp::LibvirtWrapper::UPtr& libvirt_wrapper)
 {
     mp::LibVirtVirtualMachine::DomainUPtr domain{
-        libvirt_wrapper->virDomainDefineXML(
-            connection,
-            generate_xml_config_for(desc, bridge_name, host_architecture_for(connection, libvirt_wrapper)).c_str()),
+        libvirt_wrapper->virDomainDefineXML(connection, generate_xml_config_for(desc, bridge_name, arch).c_str()),
         libvirt_wrapper->virDomainFree};
 
     return domain;
 }
 
-auto refresh_instance_state_for_domain(virDomainPtr domain, const mp::VirtualMachine::State& current_instance_state,
-                                       const mp::LibvirtWrapper::UPtr& libvirt_wrapper)
+mp::VirtualMachine::State instance_state_for(int domain_state, bool has_managed_save,
+                                             mp::VirtualMachine::State current_instance_state)
 {
-    auto domain_state{0};
-
-    if (!domain || libvirt_wrapper->virDomainGetState(domain, &domain_state, nullptr, 0) == -1 ||
-        domain_state == VIR_DOMAIN_NOSTATE)
+    if (domain_state == VIR_DOMAIN_NOSTATE)
         return mp::VirtualMachine::State::unknown;
 
-    if (libvirt_wrapper->virDomainHasManagedSaveImage(domain, 0) == 1)
+    if (has_managed_save)
         return mp::VirtualMachine::State::suspended;
 
     // Most of these libvirt domain states don't have a Multipass instance state
@@ -227,6 +208,32 @@ auto refresh_instance_state_for_domain(virDomainPtr domain, const mp::VirtualMac
     return current_instance_state;
 }
 
+// Written past the page cache, so that saving a large guest does not evict everything else the host holds. Not all
+// filesystems take direct I/O, so the ordinary save is tried in its place
+bool managed_save(virDomainPtr domain, const mp::LibvirtWrapper::UPtr& libvirt_wrapper, const std::string& vm_name)
+{
+    if (libvirt_wrapper->virDomainManagedSave(domain, VIR_DOMAIN_SAVE_BYPASS_CACHE) == 0)
+        return true;
+
+    mpl::log(mpl::Level::debug, vm_name,
+             fmt::format("Cannot save bypassing the page cache: {}", libvirt_wrapper->virGetLastErrorMessage()));
+    return libvirt_wrapper->virDomainManagedSave(domain, 0) == 0;
+}
+
+auto refresh_instance_state_for_domain(virDomainPtr domain, const mp::VirtualMachine::State& current_instance_state,
+                                       const mp::LibvirtWrapper::UPtr& libvirt_wrapper)
+{
+    auto domain_state{0};
+
+    if (!domain || libvirt_wrapper->virDomainGetState(domain, &domain_state, nullptr, 0) == -1)
+        return mp::VirtualMachine::State::unknown;
+
+    return instance_state_for(domain_state,
+                              domain_state != VIR_DOMAIN_NOSTATE &&
+                                  libvirt_wrapper->virDomainHasManagedSaveImage(domain, 0) == 1,
+                              current_instance_state);
+}
+
 bool domain_is_running(virDomainPtr domain, const mp::LibvirtWrapper::UPtr& libvirt_wrapper)
 {
     auto domain_state{0};
@@ -241,17 +248,22 @@ bool domain_is_running(virDomainPtr domain, const mp::LibvirtWrapper::UPtr& libv
 
 mp::LibVirtVirtualMachine::LibVirtVirtualMachine(const mp::VirtualMachineDescription& desc,
                                                  const std::string& bridge_name, mp::VMStatusMonitor& monitor,
-                                                 const mp::LibvirtWrapper::UPtr& libvirt_wrapper)
+                                                 const mp::LibvirtWrapper::UPtr& libvirt_wrapper,
+                                                 mp::LibvirtConnection& libvirt_connection)
     : VirtualMachine{desc.vm_name},
+      mac_addr{desc.mac_addr}, // which the domain is defined with, sparing its XML a trip from libvirtd
       username{desc.ssh_username},
       desc{desc},
       monitor{&monitor},
       bridge_name{bridge_name},
-      libvirt_wrapper{libvirt_wrapper}
+      libvirt_wrapper{libvirt_wrapper},
+      libvirt_connection{libvirt_connection}
 {
+    libvirt_connection.add_lifecycle_handler(vm_name, [this](virDomainPtr domain) { on_lifecycle_event(domain); });
+
     try
     {
-        initialize_domain_info(open_libvirt_connection(libvirt_wrapper).get());
+        initialize_domain_info();
     }
     catch (const std::exception&)
     {
@@ -261,7 +273,10 @@ mp::LibVirtVirtualMachine::LibVirtVirtualMachine(const mp::VirtualMachineDescrip
 
 mp::LibVirtVirtualMachine::~LibVirtVirtualMachine()
 {
+    libvirt_connection.remove_lifecycle_handler(vm_name);
     update_suspend_status = false;
+    if (exit_save.joinable())
+        exit_save.join(); // tried again below, should it have failed
 
     if (state == State::running)
         suspend();
@@ -269,13 +284,7 @@ mp::LibVirtVirtualMachine::~LibVirtVirtualMachine()
 
 void mp::LibVirtVirtualMachine::start()
 {
-    auto connection = open_libvirt_connection(libvirt_wrapper);
-    DomainUPtr domain{nullptr, nullptr};
-
-    if (state == VirtualMachine::State::unknown)
-        domain = initialize_domain_info(connection.get());
-    else
-        domain = domain_by_name_for(vm_name, connection.get(), libvirt_wrapper);
+    auto domain = state == VirtualMachine::State::unknown ? initialize_domain_info() : domain_handle();
 
     state = refresh_instance_state_for_domain(domain.get(), state, libvirt_wrapper);
     if (state == State::running)
@@ -320,7 +329,7 @@ void mp::LibVirtVirtualMachine::stop()
 void mp::LibVirtVirtualMachine::shutdown()
 {
     std::unique_lock<decltype(state_mutex)> lock{state_mutex};
-    auto domain = domain_by_name_for(vm_name, open_libvirt_connection(libvirt_wrapper).get(), libvirt_wrapper);
+    auto domain = domain_handle();
     state = refresh_instance_state_for_domain(domain.get(), state, libvirt_wrapper);
     if (state == State::running || state == State::delayed_shutdown || state == State::unknown)
     {
@@ -352,11 +361,11 @@ void mp::LibVirtVirtualMachine::shutdown()
 
 void mp::LibVirtVirtualMachine::suspend()
 {
-    auto domain = domain_by_name_for(vm_name, open_libvirt_connection(libvirt_wrapper).get(), libvirt_wrapper);
+    auto domain = domain_handle();
     state = refresh_instance_state_for_domain(domain.get(), state, libvirt_wrapper);
     if (state == State::running || state == State::delayed_shutdown)
     {
-        if (!domain || libvirt_wrapper->virDomainManagedSave(domain.get(), 0) < 0)
+        if (!domain || !managed_save(domain.get(), libvirt_wrapper, vm_name))
         {
             auto warning_string{
                 fmt::format("Cannot suspend '{}': {}", vm_name, libvirt_wrapper->virGetLastErrorMessage())};
@@ -378,14 +387,48 @@ void mp::LibVirtVirtualMachine::suspend()
     monitor->on_suspend();
 }
 
+bool mp::LibVirtVirtualMachine::start_saving_for_exit()
+{
+    auto domain = domain_handle();
+    state = refresh_instance_state_for_domain(domain.get(), state, libvirt_wrapper);
+    if (!domain || (state != State::running && state != State::delayed_shutdown))
+        return false;
+
+    // As on destruction, the recorded state is left alone for the instance to be resumed. libvirtd does the saving,
+    // so all there is to do here is to wait for it
+    update_suspend_status = false;
+    saving_for_exit = true;
+    exit_save = std::thread([this, domain] {
+        if (managed_save(domain.get(), libvirt_wrapper, vm_name))
+            state = State::suspended;
+        else
+            mpl::log(mpl::Level::warning, vm_name,
+                     fmt::format("Cannot save the instance: {}", libvirt_wrapper->virGetLastErrorMessage()));
+        saving_for_exit = false;
+    });
+
+    return true;
+}
+
+bool mp::LibVirtVirtualMachine::lifecycle_is_thread_safe() const
+{
+    return true;
+}
+
 mp::VirtualMachine::State mp::LibVirtVirtualMachine::current_state()
 {
+    if (saving_for_exit)
+        return State::suspending;
+
+    // Lifecycle events keep the state current, so there is nothing to ask libvirtd
+    if (libvirt_connection.tracks_domain_events() && state != State::unknown)
+        return state;
+
     try
     {
-        auto connection = open_libvirt_connection(libvirt_wrapper);
-        auto domain = domain_by_name_for(vm_name, connection.get(), libvirt_wrapper);
+        auto domain = domain_handle();
         if (!domain)
-            initialize_domain_info(connection.get());
+            domain = initialize_domain_info();
 
         state = refresh_instance_state_for_domain(domain.get(), state, libvirt_wrapper);
     }
@@ -405,7 +448,7 @@ int mp::LibVirtVirtualMachine::ssh_port()
 void mp::LibVirtVirtualMachine::ensure_vm_is_running()
 {
     std::lock_guard<decltype(state_mutex)> lock{state_mutex};
-    auto domain = domain_by_name_for(vm_name, open_libvirt_connection(libvirt_wrapper).get(), libvirt_wrapper);
+    auto domain = domain_handle();
     if (!domain_is_running(domain.get(), libvirt_wrapper))
     {
         // Have to set 'off' here so there is an actual state change to compare to for
@@ -421,7 +464,7 @@ std::string mp::LibVirtVirtualMachine::ssh_hostname()
 {
     auto action = [this] {
         ensure_vm_is_running();
-        auto result = instance_ip_for(mac_addr, libvirt_wrapper);
+        auto result = instance_ip_for(mac_addr, libvirt_connection, libvirt_wrapper);
         if (result)
         {
             ip.emplace(result.value());
@@ -447,7 +490,7 @@ std::string mp::LibVirtVirtualMachine::ipv4()
 {
     if (!ip)
     {
-        auto result = instance_ip_for(mac_addr, libvirt_wrapper);
+        auto result = instance_ip_for(mac_addr, libvirt_connection, libvirt_wrapper);
         if (result)
             ip.emplace(result.value());
         else
@@ -457,6 +500,65 @@ std::string mp::LibVirtVirtualMachine::ipv4()
     return ip.value().as_string();
 }
 
+std::unordered_map<std::string, std::string> mp::LibVirtVirtualMachine::guest_stats()
+{
+    if (!libvirt_wrapper->virDomainQemuAgentCommand)
+        return {};
+
+    try
+    {
+        auto domain = domain_handle();
+        if (!domain)
+            return {};
+
+        // libvirtd holds the agent's channel itself, and tells straight away when nothing in the guest listens on it
+        return backend::guest_agent_stats([this, &domain](const QString& command, const QJsonObject& arguments) {
+            QJsonObject request{{"execute", command}};
+            if (!arguments.isEmpty())
+                request.insert("arguments", arguments);
+
+            std::unique_ptr<char, decltype(free)*> reply{
+                libvirt_wrapper->virDomainQemuAgentCommand(
+                    domain.get(), QJsonDocument(request).toJson(QJsonDocument::Compact).constData(),
+                    guest_agent_timeout_seconds, 0),
+                free};
+            if (!reply)
+                throw std::runtime_error(libvirt_wrapper->virGetLastErrorMessage());
+
+            return QJsonDocument::fromJson(reply.get()).object()["return"];
+        });
+    }
+    catch (const std::exception& e)
+    {
+        mpl::log(mpl::Level::debug, vm_name, fmt::format("Cannot get stats from the guest agent: {}", e.what()));
+        return {};
+    }
+}
+
+mp::VirtualMachine::State mp::LibVirtVirtualMachine::refresh_state_from(int domain_state, int reason)
+{
+    // Libvirt only keeps the reason until libvirtd restarts, whereas a save image stays until the next start
+    auto has_managed_save = domain_state == VIR_DOMAIN_SHUTOFF &&
+                            (reason == VIR_DOMAIN_SHUTOFF_SAVED || state == State::suspended);
+    state = instance_state_for(domain_state, has_managed_save, state);
+
+    return state;
+}
+
+std::string mp::LibVirtVirtualMachine::ipv4_from(const std::unordered_map<std::string, std::string>& leased_addresses)
+{
+    if (!ip)
+    {
+        auto it = leased_addresses.find(mac_addr);
+        if (it == leased_addresses.end())
+            return "UNKNOWN";
+
+        ip.emplace(it->second);
+    }
+
+    return ip.value().as_string();
+}
+
 std::string mp::LibVirtVirtualMachine::ipv6()
 {
     return {};
@@ -472,24 +574,51 @@ void mp::LibVirtVirtualMachine::update_state()
     monitor->persist_state_for(vm_name, state);
 }
 
-mp::LibVirtVirtualMachine::DomainUPtr mp::LibVirtVirtualMachine::initialize_domain_info(virConnectPtr connection)
+mp::LibVirtVirtualMachine::DomainShPtr mp::LibVirtVirtualMachine::initialize_domain_info()
 {
-    auto domain = domain_by_name_for(vm_name, connection, libvirt_wrapper);
+    auto domain = domain_handle();
 
     if (!domain)
     {
-        domain = domain_by_definition_for(desc, bridge_name, connection, libvirt_wrapper);
+        auto connection = libvirt_connection.get();
+        const auto arch = libvirt_connection.host_architecture();
+        std::lock_guard<decltype(domain_mutex)> lock{domain_mutex};
+        cached_domain = domain_by_definition_for(desc, bridge_name, arch, connection.get(), libvirt_wrapper);
+        domain = cached_domain;
     }
 
     if (mac_addr.empty())
         mac_addr = instance_mac_addr_for(domain.get(), libvirt_wrapper);
 
-    ipv4(); // To set ip
+    // Only a running instance has a lease worth asking for; the others look theirs up once they need it
     state = refresh_instance_state_for_domain(domain.get(), state, libvirt_wrapper);
+    if (state == State::running)
+        ipv4();
 
     return domain;
 }
 
+mp::LibVirtVirtualMachine::DomainShPtr mp::LibVirtVirtualMachine::domain_handle()
+{
+    auto connection = libvirt_connection.get();
+
+    std::lock_guard<decltype(domain_mutex)> lock{domain_mutex};
+    if (!cached_domain || domain_generation != libvirt_connection.generation())
+    {
+        cached_domain = domain_by_name_for(vm_name, connection.get(), libvirt_wrapper);
+        domain_generation = libvirt_connection.generation();
+    }
+
+    return cached_domain;
+}
+
+void mp::LibVirtVirtualMachine::on_lifecycle_event(virDomainPtr domain)
+{
+    std::lock_guard<decltype(state_mutex)> lock{state_mutex};
+    state = refresh_instance_state_for_domain(domain, state, libvirt_wrapper);
+    state_wait.notify_all();
+}
+
 mp::LibVirtVirtualMachine::ConnectionUPtr
 mp::LibVirtVirtualMachine::open_libvirt_connection(const mp::LibvirtWrapper::UPtr& libvirt_wrapper)
 {
@@ -18,6 +18,7 @@
 #ifndef MULTIPASS_LIBVIRT_VIRTUAL_MACHINE_H
 #define MULTIPASS_LIBVIRT_VIRTUAL_MACHINE_H
 
+#include "libvirt_connection.h"
 #include "libvirt_wrapper.h"
 
 #include <multipass/ip_address.h>
@@ -25,6 +26,12 @@
 #include <multipass/virtual_machine.h>
 #include <multipass/virtual_machine_description.h>
 
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
 namespace multipass
 {
 class VMStatusMonitor;
@@ -34,10 +41,12 @@ class LibVirtVirtualMachine final : public VirtualMachine
 public:
     using ConnectionUPtr = std::unique_ptr<virConnect, decltype(virConnectClose)*>;
     using DomainUPtr = std::unique_ptr<virDomain, decltype(virDomainFree)*>;
+    using DomainShPtr = std::shared_ptr<virDomain>;
     using NetworkUPtr = std::unique_ptr<virNetwork, decltype(virNetworkFree)*>;
 
     LibVirtVirtualMachine(const VirtualMachineDescription& desc, const std::string& bridge_name,
-                          VMStatusMonitor& monitor, const LibvirtWrapper::UPtr& libvirt_wrapper);
+                          VMStatusMonitor& monitor, const LibvirtWrapper::UPtr& libvirt_wrapper,
+                          LibvirtConnection& libvirt_connection);
     ~LibVirtVirtualMachine();
 
     void start() override;
@@ -53,11 +62,21 @@ public:
     void wait_until_ssh_up(std::chrono::milliseconds timeout) override;
     void ensure_vm_is_running() override;
     void update_state() override;
+    bool start_saving_for_exit() override;
+    std::unordered_map<std::string, std::string> guest_stats() override;
+    bool lifecycle_is_thread_safe() const override; // libvirt connections may be shared between threads
+
+    // For the factory to answer for many instances with one query, in place of asking libvirtd for each
+    State refresh_state_from(int domain_state, int reason);
+    std::string ipv4_from(const std::unordered_map<std::string, std::string>& leased_addresses);
 
     static ConnectionUPtr open_libvirt_connection(const LibvirtWrapper::UPtr& libvirt_wrapper);
 
 private:
-    DomainUPtr initialize_domain_info(virConnectPtr connection);
+    DomainShPtr initialize_domain_info();
+    // The domain looked up on the shared connection, or null if it is not defined yet
+    DomainShPtr domain_handle();
+    void on_lifecycle_event(virDomainPtr domain);
 
     std::string mac_addr;
     const std::string username;
@@ -68,7 +87,13 @@ private:
     const std::string& bridge_name;
     // Needs to be a reference so testing can override the various libvirt functions
     const LibvirtWrapper::UPtr& libvirt_wrapper;
+    LibvirtConnection& libvirt_connection;
+    std::mutex domain_mutex;
+    DomainShPtr cached_domain;
+    int domain_generation{0};
     bool update_suspend_status{true};
+    std::atomic<bool> saving_for_exit{false};
+    std::thread exit_save;
 };
 } // namespace multipass
 
@@ -19,12 +19,16 @@
 #include "libvirt_virtual_machine.h"
 
 #include <multipass/logging/log.h>
+#include <multipass/optional.h>
 #include <multipass/utils.h>
 #include <multipass/virtual_machine_description.h>
 #include <shared/linux/backend_utils.h>
 
 #include <multipass/format.h>
 
+#include <unordered_map>
+#include <utility>
+
 namespace mp = multipass;
 namespace mpl = multipass::logging;
 
@@ -52,27 +56,27 @@ auto generate_libvirt_bridge_xml_config(const mp::Path& data_dir, const std::str
                        bridge_name, subnet, subnet, subnet);
 }
 
-std::string enable_libvirt_network(const mp::Path& data_dir, const mp::LibvirtWrapper::UPtr& libvirt_wrapper)
+std::string enable_libvirt_network(const mp::Path& data_dir, mp::LibvirtConnection& libvirt_connection,
+                                   const mp::LibvirtWrapper::UPtr& libvirt_wrapper)
 {
-    mp::LibVirtVirtualMachine::ConnectionUPtr connection{nullptr, nullptr};
+    std::shared_ptr<virNetwork> network;
     try
     {
-        connection = mp::LibVirtVirtualMachine::open_libvirt_connection(libvirt_wrapper);
+        network = libvirt_connection.default_network();
     }
     catch (const std::exception&)
     {
         return {};
     }
 
-    mp::LibVirtVirtualMachine::NetworkUPtr network{libvirt_wrapper->virNetworkLookupByName(connection.get(), "default"),
-                                                   libvirt_wrapper->virNetworkFree};
     std::string bridge_name;
 
+    // The connection looks the network up again the next time it is asked for it
     if (network == nullptr)
     {
         bridge_name = multipass_bridge_name;
-        network = mp::LibVirtVirtualMachine::NetworkUPtr{
-            libvirt_wrapper->virNetworkCreateXML(connection.get(),
+        network = std::shared_ptr<virNetwork>{
+            libvirt_wrapper->virNetworkCreateXML(libvirt_connection.get().get(),
                                                  generate_libvirt_bridge_xml_config(data_dir, bridge_name).c_str()),
             libvirt_wrapper->virNetworkFree};
     }
@@ -91,6 +95,54 @@ std::string enable_libvirt_network(const mp::Path& data_dir, const mp::LibvirtWr
     return bridge_name;
 }
 
+// Domain state and reason, by domain name
+auto domain_states_for(virConnectPtr connection, const mp::LibvirtWrapper::UPtr& libvirt_wrapper)
+{
+    std::unordered_map<std::string, std::pair<int, int>> domain_states;
+
+    virDomainStatsRecordPtr* records = nullptr;
+    auto nrecords = libvirt_wrapper->virConnectGetAllDomainStats(connection, VIR_DOMAIN_STATS_STATE, &records, 0);
+    if (nrecords < 0)
+        return domain_states; // leaves the instances to ask for themselves
+
+    std::unique_ptr<virDomainStatsRecordPtr, void (*)(virDomainStatsRecordPtr*)> records_ptr{
+        records, libvirt_wrapper->virDomainStatsRecordListFree};
+    for (auto i = 0; i < nrecords; ++i)
+    {
+        auto name = libvirt_wrapper->virDomainGetName(records[i]->dom);
+        auto state{0};
+        auto reason{0};
+        if (name &&
+            libvirt_wrapper->virTypedParamsGetInt(records[i]->params, records[i]->nparams, "state.state", &state) == 1)
+        {
+            libvirt_wrapper->virTypedParamsGetInt(records[i]->params, records[i]->nparams, "state.reason", &reason);
+            domain_states.emplace(name, std::make_pair(state, reason));
+        }
+    }
+
+    return domain_states;
+}
+
+// Leased addresses, by MAC address
+auto leased_addresses_for(mp::LibvirtConnection& libvirt_connection, const mp::LibvirtWrapper::UPtr& libvirt_wrapper)
+{
+    std::unordered_map<std::string, std::string> addresses;
+
+    auto network = libvirt_connection.default_network();
+
+    virNetworkDHCPLeasePtr* leases = nullptr;
+    auto nleases = libvirt_wrapper->virNetworkGetDHCPLeases(network.get(), nullptr, &leases, 0);
+    for (auto i = 0; i < nleases; ++i)
+    {
+        if (leases[i]->mac && leases[i]->ipaddr)
+            addresses.emplace(leases[i]->mac, leases[i]->ipaddr);
+        libvirt_wrapper->virNetworkDHCPLeaseFree(leases[i]);
+    }
+    free(leases);
+
+    return addresses;
+}
+
 auto make_libvirt_wrapper(const std::string& libvirt_object_path)
 {
     try
@@ -109,8 +161,9 @@ mp::LibVirtVirtualMachineFactory::LibVirtVirtualMachineFactory(const mp::Path& d
                                                                const std::string& libvirt_object_path)
     : libvirt_wrapper{make_libvirt_wrapper(libvirt_object_path)},
       data_dir{data_dir},
-      bridge_name{enable_libvirt_network(data_dir, libvirt_wrapper)},
-      libvirt_object_path{libvirt_object_path}
+      libvirt_object_path{libvirt_object_path},
+      libvirt_connection{libvirt_wrapper},
+      bridge_name{enable_libvirt_network(data_dir, libvirt_connection, libvirt_wrapper)}
 {
 }
 
@@ -122,29 +175,32 @@ mp::LibVirtVirtualMachineFactory::LibVirtVirtualMachineFactory(const mp::Path& d
 mp::VirtualMachine::UPtr mp::LibVirtVirtualMachineFactory::create_virtual_machine(const VirtualMachineDescription& desc,
                                                                                   VMStatusMonitor& monitor)
 {
-    if (bridge_name.empty())
-        bridge_name = enable_libvirt_network(data_dir, libvirt_wrapper);
-
-    return std::make_unique<mp::LibVirtVirtualMachine>(desc, bridge_name, monitor, libvirt_wrapper);
+    return std::make_unique<mp::LibVirtVirtualMachine>(desc, network_bridge(), monitor, libvirt_wrapper,
+                                                       libvirt_connection);
 }
 
 mp::LibVirtVirtualMachineFactory::~LibVirtVirtualMachineFactory()
 {
     if (bridge_name == multipass_bridge_name)
     {
-        auto connection = LibVirtVirtualMachine::open_libvirt_connection(libvirt_wrapper);
-        mp::LibVirtVirtualMachine::NetworkUPtr network{
-            libvirt_wrapper->virNetworkLookupByName(connection.get(), "default"), libvirt_wrapper->virNetworkFree};
-
-        libvirt_wrapper->virNetworkDestroy(network.get());
+        try
+        {
+            libvirt_wrapper->virNetworkDestroy(libvirt_connection.default_network().get());
+        }
+        catch (const std::exception& e)
+        {
+            mpl::log(mpl::Level::warning, logging_category, fmt::format("Cannot tear the network down: {}", e.what()));
+        }
     }
 }
 
 void mp::LibVirtVirtualMachineFactory::remove_resources_for(const std::string& name)
 {
-    auto connection = LibVirtVirtualMachine::open_libvirt_connection(libvirt_wrapper);
+    auto connection = libvirt_connection.get();
+    LibVirtVirtualMachine::DomainUPtr domain{libvirt_wrapper->virDomainLookupByName(connection.get(), name.c_str()),
+                                             libvirt_wrapper->virDomainFree};
 
-    libvirt_wrapper->virDomainUndefine(libvirt_wrapper->virDomainLookupByName(connection.get(), name.c_str()));
+    libvirt_wrapper->virDomainUndefine(domain.get());
 }
 
 mp::FetchType mp::LibVirtVirtualMachineFactory::fetch_type()
@@ -178,10 +234,9 @@ void mp::LibVirtVirtualMachineFactory::hypervisor_health_check()
     if (!libvirt_wrapper)
         libvirt_wrapper = make_libvirt_wrapper(libvirt_object_path);
 
-    LibVirtVirtualMachine::open_libvirt_connection(libvirt_wrapper);
+    libvirt_connection.get(); // throws when libvirtd cannot be reached, just as each instance's calls would
 
-    if (bridge_name.empty())
-        bridge_name = enable_libvirt_network(data_dir, libvirt_wrapper);
+    network_bridge();
 }
 
 QString mp::LibVirtVirtualMachineFactory::get_backend_version_string()
@@ -189,9 +244,8 @@ QString mp::LibVirtVirtualMachineFactory::get_backend_version_string()
     try
     {
         unsigned long libvirt_version;
-        auto connection = LibVirtVirtualMachine::open_libvirt_connection(libvirt_wrapper);
-
-        if (libvirt_wrapper->virConnectGetVersion(connection.get(), &libvirt_version) == 0 && libvirt_version != 0)
+        if (libvirt_wrapper->virConnectGetVersion(libvirt_connection.get().get(), &libvirt_version) == 0 &&
+            libvirt_version != 0)
         {
             return QString("libvirt-%1.%2.%3")
                 .arg(libvirt_version / 1000000)
@@ -207,3 +261,62 @@ QString mp::LibVirtVirtualMachineFactory::get_backend_version_string()
     mpl::log(mpl::Level::error, logging_category, "Failed to determine libvirtd version.");
     return QString("libvirt-unknown");
 }
+
+mp::VirtualMachineFactory::InstanceStates
+mp::LibVirtVirtualMachineFactory::query_instances(const std::vector<VirtualMachine::ShPtr>& vms)
+{
+    LibvirtConnection::Handle connection;
+    try
+    {
+        connection = libvirt_connection.get();
+    }
+    catch (const std::exception&)
+    {
+        return VirtualMachineFactory::query_instances(vms);
+    }
+
+    // While domain events are delivered the instances already know their state
+    std::unordered_map<std::string, std::pair<int, int>> domain_states;
+    if (!libvirt_connection.tracks_domain_events())
+        domain_states = domain_states_for(connection.get(), libvirt_wrapper);
+
+    mp::optional<std::unordered_map<std::string, std::string>> leased_addresses;
+
+    InstanceStates states;
+    for (const auto& vm : vms)
+    {
+        auto libvirt_vm = dynamic_cast<LibVirtVirtualMachine*>(vm.get());
+        auto domain_state = domain_states.find(vm->vm_name);
+        auto state = libvirt_vm && domain_state != domain_states.end()
+                         ? libvirt_vm->refresh_state_from(domain_state->second.first, domain_state->second.second)
+                         : vm->current_state();
+
+        std::string ipv4;
+        if (mp::utils::is_running(state))
+        {
+            if (libvirt_vm)
+            {
+                if (!leased_addresses)
+                    leased_addresses = leased_addresses_for(libvirt_connection, libvirt_wrapper);
+                ipv4 = libvirt_vm->ipv4_from(*leased_addresses);
+            }
+            else
+            {
+                ipv4 = vm->ipv4();
+            }
+        }
+
+        states.emplace(vm->vm_name, InstanceState{state, ipv4});
+    }
+
+    return states;
+}
+
+std::string mp::LibVirtVirtualMachineFactory::network_bridge()
+{
+    std::lock_guard<decltype(bridge_mutex)> lock{bridge_mutex};
+    if (bridge_name.empty())
+        bridge_name = enable_libvirt_network(data_dir, libvirt_connection, libvirt_wrapper);
+
+    return bridge_name;
+}
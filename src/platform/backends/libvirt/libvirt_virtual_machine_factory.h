@@ -17,11 +17,13 @@
 #ifndef MULTIPASS_LIBVIRT_VIRTUAL_MACHINE_FACTORY_H
 #define MULTIPASS_LIBVIRT_VIRTUAL_MACHINE_FACTORY_H
 
+#include "libvirt_connection.h"
 #include "libvirt_wrapper.h"
 
 #include <multipass/virtual_machine_factory.h>
 
 #include <memory>
+#include <mutex>
 #include <string>
 
 namespace multipass
@@ -48,14 +50,21 @@ public:
         return {};
     };
     QString get_backend_version_string() override;
+    InstanceStates query_instances(const std::vector<VirtualMachine::ShPtr>& vms) override;
 
     // Making this public makes this modifiable which is necessary for testing
     LibvirtWrapper::UPtr libvirt_wrapper;
 
 private:
+    std::string network_bridge(); // brings the network up the first time, for instances created concurrently
+
     const Path data_dir;
-    std::string bridge_name;
     const std::string libvirt_object_path;
+    // Shared by all instances and the factory itself, so that neither creating nor querying instances connects to
+    // libvirtd, looks their domains or network up again or asks for the host's capabilities
+    LibvirtConnection libvirt_connection;
+    std::mutex bridge_mutex;
+    std::string bridge_name; // guarded by bridge_mutex
 };
 } // namespace multipass
 
@@ -48,16 +48,44 @@ auto get_symbol_address_for(const std::string& symbol, void* handle)
 
     return address;
 }
+
+// The guest agent comes from libvirt-qemu, which libvirt does without. The test executable has neither
+void* open_libvirt_qemu_handle(const std::string& filename)
+{
+    return filename.empty() ? nullptr : dlopen("libvirt-qemu.so.0", RTLD_NOW | RTLD_GLOBAL);
+}
+
+void* optional_symbol_address_for(const std::string& symbol, void* handle)
+{
+    return handle ? dlsym(handle, symbol.c_str()) : nullptr;
+}
 } // namespace
 
 mp::LibvirtWrapper::LibvirtWrapper(const std::string& filename)
     : handle{open_libvirt_handle(filename)},
+      qemu_handle{open_libvirt_qemu_handle(filename)},
       virConnectOpen{reinterpret_cast<virConnectOpen_t>(get_symbol_address_for("virConnectOpen", handle))},
       virConnectClose{reinterpret_cast<virConnectClose_t>(get_symbol_address_for("virConnectClose", handle))},
+      virConnectRef{reinterpret_cast<virConnectRef_t>(get_symbol_address_for("virConnectRef", handle))},
       virConnectGetCapabilities{
           reinterpret_cast<virConnectGetCapabilities_t>(get_symbol_address_for("virConnectGetCapabilities", handle))},
       virConnectGetVersion{
           reinterpret_cast<virConnectGetVersion_t>(get_symbol_address_for("virConnectGetVersion", handle))},
+      virConnectIsAlive{reinterpret_cast<virConnectIsAlive_t>(get_symbol_address_for("virConnectIsAlive", handle))},
+      virConnectDomainEventRegisterAny{reinterpret_cast<virConnectDomainEventRegisterAny_t>(
+          get_symbol_address_for("virConnectDomainEventRegisterAny", handle))},
+      virConnectDomainEventDeregisterAny{reinterpret_cast<virConnectDomainEventDeregisterAny_t>(
+          get_symbol_address_for("virConnectDomainEventDeregisterAny", handle))},
+      virConnectRegisterCloseCallback{reinterpret_cast<virConnectRegisterCloseCallback_t>(
+          get_symbol_address_for("virConnectRegisterCloseCallback", handle))},
+      virConnectUnregisterCloseCallback{reinterpret_cast<virConnectUnregisterCloseCallback_t>(
+          get_symbol_address_for("virConnectUnregisterCloseCallback", handle))},
+      virConnectGetAllDomainStats{reinterpret_cast<virConnectGetAllDomainStats_t>(
+          get_symbol_address_for("virConnectGetAllDomainStats", handle))},
+      virDomainStatsRecordListFree{reinterpret_cast<virDomainStatsRecordListFree_t>(
+          get_symbol_address_for("virDomainStatsRecordListFree", handle))},
+      virTypedParamsGetInt{
+          reinterpret_cast<virTypedParamsGetInt_t>(get_symbol_address_for("virTypedParamsGetInt", handle))},
       virNetworkLookupByName{
           reinterpret_cast<virNetworkLookupByName_t>(get_symbol_address_for("virNetworkLookupByName", handle))},
       virNetworkCreateXML{
@@ -87,12 +115,26 @@ mp::LibvirtWrapper::LibvirtWrapper(const std::string& filename)
           reinterpret_cast<virDomainManagedSave_t>(get_symbol_address_for("virDomainManagedSave", handle))},
       virDomainHasManagedSaveImage{reinterpret_cast<virDomainHasManagedSaveImage_t>(
           get_symbol_address_for("virDomainHasManagedSaveImage", handle))},
+      virDomainGetName{reinterpret_cast<virDomainGetName_t>(get_symbol_address_for("virDomainGetName", handle))},
+      virEventRegisterDefaultImpl{reinterpret_cast<virEventRegisterDefaultImpl_t>(
+          get_symbol_address_for("virEventRegisterDefaultImpl", handle))},
+      virEventRunDefaultImpl{
+          reinterpret_cast<virEventRunDefaultImpl_t>(get_symbol_address_for("virEventRunDefaultImpl", handle))},
+      virEventAddTimeout{reinterpret_cast<virEventAddTimeout_t>(get_symbol_address_for("virEventAddTimeout", handle))},
+      virEventUpdateTimeout{
+          reinterpret_cast<virEventUpdateTimeout_t>(get_symbol_address_for("virEventUpdateTimeout", handle))},
+      virEventRemoveTimeout{
+          reinterpret_cast<virEventRemoveTimeout_t>(get_symbol_address_for("virEventRemoveTimeout", handle))},
       virGetLastErrorMessage{
-          reinterpret_cast<virGetLastErrorMessage_t>(get_symbol_address_for("virGetLastErrorMessage", handle))}
+          reinterpret_cast<virGetLastErrorMessage_t>(get_symbol_address_for("virGetLastErrorMessage", handle))},
+      virDomainQemuAgentCommand{reinterpret_cast<virDomainQemuAgentCommand_t>(
+          optional_symbol_address_for("virDomainQemuAgentCommand", qemu_handle))}
 {
 }
 
 mp::LibvirtWrapper::~LibvirtWrapper()
 {
+    if (qemu_handle)
+        dlclose(qemu_handle);
     dlclose(handle);
 }
@@ -59,8 +59,21 @@ class LibvirtWrapper
 private:
     typedef virConnectPtr (*virConnectOpen_t)(const char* name);
     typedef int (*virConnectClose_t)(virConnectPtr conn);
+    typedef int (*virConnectRef_t)(virConnectPtr conn);
     typedef char* (*virConnectGetCapabilities_t)(virConnectPtr conn);
     typedef int (*virConnectGetVersion_t)(virConnectPtr conn, unsigned long* hvVer);
+    typedef int (*virConnectIsAlive_t)(virConnectPtr conn);
+    typedef int (*virConnectDomainEventRegisterAny_t)(virConnectPtr conn, virDomainPtr dom, int eventID,
+                                                      virConnectDomainEventGenericCallback cb, void* opaque,
+                                                      virFreeCallback freecb);
+    typedef int (*virConnectDomainEventDeregisterAny_t)(virConnectPtr conn, int callbackID);
+    typedef int (*virConnectRegisterCloseCallback_t)(virConnectPtr conn, virConnectCloseFunc cb, void* opaque,
+                                                     virFreeCallback freecb);
+    typedef int (*virConnectUnregisterCloseCallback_t)(virConnectPtr conn, virConnectCloseFunc cb);
+    typedef int (*virConnectGetAllDomainStats_t)(virConnectPtr conn, unsigned int stats,
+                                                 virDomainStatsRecordPtr** retStats, unsigned int flags);
+    typedef void (*virDomainStatsRecordListFree_t)(virDomainStatsRecordPtr* stats);
+    typedef int (*virTypedParamsGetInt_t)(virTypedParameterPtr params, int nparams, const char* name, int* value);
     typedef virNetworkPtr (*virNetworkLookupByName_t)(virConnectPtr conn, const char* name);
     typedef virNetworkPtr (*virNetworkCreateXML_t)(virConnectPtr conn, const char* xmlDesc);
     typedef int (*virNetworkDestroy_t)(virNetworkPtr network);
@@ -82,9 +95,18 @@ private:
     typedef int (*virDomainShutdown_t)(virDomainPtr domain);
     typedef int (*virDomainManagedSave_t)(virDomainPtr domain, unsigned int flags);
     typedef int (*virDomainHasManagedSaveImage_t)(virDomainPtr domain, unsigned int flags);
+    typedef const char* (*virDomainGetName_t)(virDomainPtr domain);
+    typedef int (*virEventRegisterDefaultImpl_t)();
+    typedef int (*virEventRunDefaultImpl_t)();
+    typedef int (*virEventAddTimeout_t)(int timeout, virEventTimeoutCallback cb, void* opaque, virFreeCallback ff);
+    typedef void (*virEventUpdateTimeout_t)(int timer, int timeout);
+    typedef int (*virEventRemoveTimeout_t)(int timer);
     typedef const char* (*virGetLastErrorMessage_t)();
+    typedef char* (*virDomainQemuAgentCommand_t)(virDomainPtr domain, const char* cmd, int timeout,
+                                                 unsigned int flags);
 
     void* handle{nullptr};
+    void* qemu_handle{nullptr};
 
 public:
     using UPtr = std::unique_ptr<LibvirtWrapper>;
@@ -94,8 +116,17 @@ public:
 
     virConnectOpen_t virConnectOpen;
     virConnectClose_t virConnectClose;
+    virConnectRef_t virConnectRef;
     virConnectGetCapabilities_t virConnectGetCapabilities;
     virConnectGetVersion_t virConnectGetVersion;
+    virConnectIsAlive_t virConnectIsAlive;
+    virConnectDomainEventRegisterAny_t virConnectDomainEventRegisterAny;
+    virConnectDomainEventDeregisterAny_t virConnectDomainEventDeregisterAny;
+    virConnectRegisterCloseCallback_t virConnectRegisterCloseCallback;
+    virConnectUnregisterCloseCallback_t virConnectUnregisterCloseCallback;
+    virConnectGetAllDomainStats_t virConnectGetAllDomainStats;
+    virDomainStatsRecordListFree_t virDomainStatsRecordListFree;
+    virTypedParamsGetInt_t virTypedParamsGetInt;
     virNetworkLookupByName_t virNetworkLookupByName;
     virNetworkCreateXML_t virNetworkCreateXML;
     virNetworkDestroy_t virNetworkDestroy;
@@ -116,7 +147,15 @@ public:
     virDomainShutdown_t virDomainShutdown;
     virDomainManagedSave_t virDomainManagedSave;
     virDomainHasManagedSaveImage_t virDomainHasManagedSaveImage;
+    virDomainGetName_t virDomainGetName;
+    virEventRegisterDefaultImpl_t virEventRegisterDefaultImpl;
+    virEventRunDefaultImpl_t virEventRunDefaultImpl;
+    virEventAddTimeout_t virEventAddTimeout;
+    virEventUpdateTimeout_t virEventUpdateTimeout;
+    virEventRemoveTimeout_t virEventRemoveTimeout;
     virGetLastErrorMessage_t virGetLastErrorMessage;
+    // From libvirt-qemu, which not every host has installed; null without it
+    virDomainQemuAgentCommand_t virDomainQemuAgentCommand;
 };
 } // namespace multipass
 
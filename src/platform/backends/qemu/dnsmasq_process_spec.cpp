@@ -24,8 +24,9 @@ namespace mp = multipass;
 namespace mu = multipass::utils;
 
 mp::DNSMasqProcessSpec::DNSMasqProcessSpec(const mp::Path& data_dir, const QString& bridge_name,
-                                           const QString& pid_file_path, const std::string& subnet)
-    : data_dir(data_dir), bridge_name(bridge_name), pid_file_path{pid_file_path}, subnet{subnet}
+                                           const QString& pid_file_path, const std::string& subnet,
+                                           const QString& identifier)
+    : data_dir(data_dir), bridge_name(bridge_name), pid_file_path{pid_file_path}, subnet{subnet}, id{identifier}
 {
 }
 
@@ -116,3 +117,8 @@ profile %1 flags=(attach_disconnected) {
 
     return profile_template.arg(apparmor_profile_name(), signal_peer, root_dir, program(), data_dir, pid_file_path);
 }
+
+QString mp::DNSMasqProcessSpec::identifier() const
+{
+    return id;
+}
@@ -31,20 +31,23 @@ namespace multipass
 class DNSMasqProcessSpec : public ProcessSpec
 {
 public:
+    // The identifier tells apart the profiles of several dnsmasq instances, each serving a bridge of its own
     explicit DNSMasqProcessSpec(const Path& data_dir, const QString& bridge_name, const QString& pid_file_path,
-                                const std::string& subnet);
+                                const std::string& subnet, const QString& identifier = QString());
 
     QString program() const override;
     QStringList arguments() const override;
     logging::Level error_log_level() const override;
 
     QString apparmor_profile() const override;
+    QString identifier() const override;
 
 private:
     const Path data_dir;
     const QString bridge_name;
     const QString pid_file_path;
     const std::string subnet;
+    const QString id;
 };
 
 } // namespace multipass
@@ -26,21 +26,46 @@
 #include <multipass/format.h>
 
 #include <QDir>
+#include <QFile>
+#include <QSaveFile>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
 #include <fstream>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
 
+#include <poll.h>
 #include <signal.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 namespace mp = multipass;
 namespace mpl = multipass::logging;
 
 namespace
 {
+constexpr auto category = "dnsmasq";
+constexpr auto leases_file_name = "dnsmasq.leases";
+constexpr auto hosts_file_name = "dnsmasq.hosts";
+constexpr auto first_host = 2; // the bridge is .1
+constexpr auto last_host = 254;
+constexpr auto watch_poll_timeout_ms = 500; // bounds how long destruction waits for the watcher
+
 auto make_dnsmasq_process(const mp::Path& data_dir, const QString& bridge_name, const QString& pid_file_path,
-                          const std::string& subnet)
+                          const std::string& subnet, const QString& identifier)
 {
-    auto process_spec = std::make_unique<mp::DNSMasqProcessSpec>(data_dir, bridge_name, pid_file_path, subnet);
+    auto process_spec =
+        std::make_unique<mp::DNSMasqProcessSpec>(data_dir, bridge_name, pid_file_path, subnet, identifier);
     return mp::ProcessFactory::instance().create_process(std::move(process_spec));
 }
 
@@ -54,13 +79,312 @@ auto get_dnsmasq_pid(const mp::Path& pid_file_path)
     // std::stoi will throw if pid doesn't exist or is invalid
     return static_cast<unsigned int>(std::stoi(pid));
 }
+
+auto read_leases(const std::string& path)
+{
+    // DNSMasq leases entries consist of:
+    // <lease expiration> <mac addr> <ipv4> <name> * * *
+    const std::string delimiter{" "};
+    const int hw_addr_idx{1};
+    const int ipv4_idx{2};
+    std::unordered_map<std::string, mp::IPAddress> ips;
+    std::ifstream leases_file{path};
+    std::string line;
+    while (getline(leases_file, line))
+    {
+        const auto fields = mp::utils::split(line, delimiter);
+        if (fields.size() > 2)
+        {
+            try
+            {
+                ips.emplace(fields[hw_addr_idx], mp::IPAddress{fields[ipv4_idx]});
+            }
+            catch (const std::exception&)
+            {
+                // A line caught mid-write; the next change reparses it
+            }
+        }
+    }
+
+    return ips;
+}
 } // namespace
 
-mp::DNSMasqServer::DNSMasqServer(const Path& data_dir, const QString& bridge_name, const std::string& subnet)
+// An in-memory index of the leases file, reparsed whenever inotify reports dnsmasq wrote to it
+struct mp::DNSMasqServer::Leases
+{
+    using Signature = std::tuple<ino_t, off_t, time_t, long>;
+
+    explicit Leases(const QString& data_dir) : path{QDir(data_dir).filePath(leases_file_name).toStdString()}
+    {
+        inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotify_fd < 0 ||
+            inotify_add_watch(inotify_fd, QFile::encodeName(data_dir).constData(),
+                              IN_CREATE | IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE) < 0)
+        {
+            mpl::log(mpl::Level::warning, category,
+                     fmt::format("Cannot watch {}, falling back to polling: {}", path, std::strerror(errno)));
+            return;
+        }
+
+        watcher = std::thread{&Leases::watch, this};
+    }
+
+    ~Leases()
+    {
+        stopping = true;
+        if (watcher.joinable())
+            watcher.join();
+
+        if (inotify_fd >= 0)
+            close(inotify_fd);
+    }
+
+    optional<IPAddress> find(const std::string& hw_addr)
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        reload_if_changed();
+        return lookup(hw_addr);
+    }
+
+    std::unordered_map<std::string, IPAddress> all()
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        reload_if_changed();
+        return ips;
+    }
+
+    optional<IPAddress> wait_for(const std::string& hw_addr, std::chrono::milliseconds timeout)
+    {
+        std::unique_lock<std::mutex> lock{mutex};
+        changed.wait_for(lock, timeout, [this, &hw_addr] {
+            reload_if_changed(); // also covers changes that were not reported
+            return ips.find(hw_addr) != ips.end();
+        });
+
+        return lookup(hw_addr);
+    }
+
+private:
+    optional<IPAddress> lookup(const std::string& hw_addr) const
+    {
+        auto it = ips.find(hw_addr);
+        if (it == ips.end())
+            return nullopt;
+
+        return it->second;
+    }
+
+    // Requires the mutex to be held. Stat-ing is cheap, so this also guards against missed events
+    void reload_if_changed()
+    {
+        struct stat info;
+        Signature signature{};
+        if (stat(path.c_str(), &info) == 0)
+            signature = Signature{info.st_ino, info.st_size, info.st_mtim.tv_sec, info.st_mtim.tv_nsec};
+
+        if (signature == loaded_signature)
+            return;
+
+        ips = read_leases(path);
+        loaded_signature = signature;
+        changed.notify_all();
+    }
+
+    void watch()
+    {
+        pollfd fds{inotify_fd, POLLIN, 0};
+        alignas(inotify_event) std::array<char, 4096> buffer;
+
+        while (!stopping)
+        {
+            const auto ready = poll(&fds, 1, watch_poll_timeout_ms);
+            if (ready < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+
+                mpl::log(mpl::Level::warning, category,
+                         fmt::format("Stopped watching {}: {}", path, std::strerror(errno)));
+                return;
+            }
+
+            if (ready == 0)
+                continue;
+
+            auto leases_changed = false;
+            ssize_t length;
+            while ((length = read(inotify_fd, buffer.data(), buffer.size())) > 0)
+            {
+                for (auto entry = buffer.data(); entry < buffer.data() + length;)
+                {
+                    const auto event = reinterpret_cast<const inotify_event*>(entry);
+                    if (event->len && std::strcmp(event->name, leases_file_name) == 0)
+                        leases_changed = true;
+
+                    entry += sizeof(inotify_event) + event->len;
+                }
+            }
+
+            if (leases_changed)
+            {
+                std::lock_guard<std::mutex> lock{mutex};
+                reload_if_changed();
+            }
+        }
+    }
+
+    const std::string path;
+    int inotify_fd{-1};
+    std::atomic_bool stopping{false};
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::unordered_map<std::string, IPAddress> ips;
+    Signature loaded_signature{};
+    std::thread watcher;
+};
+
+// The addresses pinned to each MAC, kept in the hosts file dnsmasq serves them from, one "<mac>,<ipv4>" per line
+struct mp::DNSMasqServer::Reservations
+{
+    Reservations(const QString& data_dir, const std::string& subnet)
+        : path{QDir(data_dir).filePath(hosts_file_name)}, subnet{subnet}
+    {
+        std::ifstream hosts_file{path.toStdString()};
+        std::string line;
+        while (getline(hosts_file, line))
+        {
+            const auto fields = mp::utils::split(line, ",");
+            if (fields.size() != 2)
+                continue;
+
+            try
+            {
+                ips.emplace(fields[0], mp::IPAddress{fields[1]});
+            }
+            catch (const std::exception&)
+            {
+                mpl::log(mpl::Level::warning, category, fmt::format("Ignoring invalid host entry: {}", line));
+            }
+        }
+    }
+
+    optional<IPAddress> find(const std::string& hw_addr)
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        auto it = ips.find(hw_addr);
+        if (it == ips.end())
+            return nullopt;
+
+        return it->second;
+    }
+
+    // Returns the address and whether it was newly reserved. An address dnsmasq already leased to hw_addr is kept,
+    // otherwise the lowest one neither reserved nor leased to anyone else is taken
+    std::pair<IPAddress, bool> reserve(const std::string& hw_addr,
+                                       const std::unordered_map<std::string, IPAddress>& leased)
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        auto it = ips.find(hw_addr);
+        if (it != ips.end())
+            return {it->second, false};
+
+        auto lease = leased.find(hw_addr);
+        auto ip = lease != leased.end() && !taken(lease->second, hw_addr, leased) ? mp::make_optional(lease->second)
+                                                                                   : free_ip(hw_addr, leased);
+        if (!ip)
+            throw std::runtime_error(fmt::format("No free IP address left in {}.0/24", subnet));
+
+        ips.emplace(hw_addr, *ip);
+        if (!save())
+        {
+            ips.erase(hw_addr);
+            throw std::runtime_error(fmt::format("Failed to write {}", qUtf8Printable(path)));
+        }
+
+        return {*ip, true};
+    }
+
+    std::size_t count()
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        return ips.size();
+    }
+
+    bool release(const std::string& hw_addr)
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        if (ips.erase(hw_addr) == 0)
+            return false;
+
+        if (!save())
+            mpl::log(mpl::Level::warning, category, fmt::format("Failed to write {}", qUtf8Printable(path)));
+
+        return true;
+    }
+
+private:
+    bool taken(const IPAddress& ip, const std::string& hw_addr,
+               const std::unordered_map<std::string, IPAddress>& leased) const
+    {
+        auto held_by_other = [&ip, &hw_addr](const std::pair<const std::string, IPAddress>& entry) {
+            return entry.first != hw_addr && entry.second == ip;
+        };
+
+        return std::any_of(ips.begin(), ips.end(), held_by_other) ||
+               std::any_of(leased.begin(), leased.end(), held_by_other);
+    }
+
+    // Gathers what is taken once, rather than going through every entry for every candidate
+    optional<IPAddress> free_ip(const std::string& hw_addr,
+                                const std::unordered_map<std::string, IPAddress>& leased) const
+    {
+        std::unordered_set<uint32_t> taken_ips;
+        for (const auto& entries : {std::cref(ips), std::cref(leased)})
+            for (const auto& entry : entries.get())
+                if (entry.first != hw_addr)
+                    taken_ips.insert(entry.second.as_uint32());
+
+        const mp::IPAddress first{fmt::format("{}.{}", subnet, first_host)};
+        for (auto host = 0; host <= last_host - first_host; ++host)
+        {
+            auto candidate = first + host;
+            if (!taken_ips.count(candidate.as_uint32()))
+                return candidate;
+        }
+
+        return nullopt;
+    }
+
+    // Requires the mutex to be held. QSaveFile only replaces the file once the new one is complete, so dnsmasq never
+    // reads half of it
+    bool save() const
+    {
+        QSaveFile hosts_file{path};
+        if (!hosts_file.open(QIODevice::WriteOnly))
+            return false;
+
+        for (const auto& entry : ips)
+            hosts_file.write(fmt::format("{},{}\n", entry.first, entry.second.as_string()).c_str());
+
+        return hosts_file.commit();
+    }
+
+    const QString path;
+    const std::string subnet;
+    std::mutex mutex;
+    std::unordered_map<std::string, IPAddress> ips;
+};
+
+mp::DNSMasqServer::DNSMasqServer(const Path& data_dir, const QString& bridge_name, const std::string& subnet,
+                                 const QString& identifier)
     : data_dir{data_dir},
       bridge_name{bridge_name},
       pid_file_path{QDir(data_dir).filePath("dnsmasq.pid")},
-      subnet{subnet}
+      subnet{subnet},
+      identifier{identifier},
+      leases{std::make_unique<Leases>(data_dir)},
+      reservations{std::make_unique<Reservations>(data_dir, subnet)}
 {
     try
     {
@@ -72,6 +396,8 @@ mp::DNSMasqServer::DNSMasqServer(const Path& data_dir, const QString& bridge_nam
     }
 }
 
+mp::DNSMasqServer::DNSMasqServer(DNSMasqServer&& other) = default;
+
 mp::DNSMasqServer::~DNSMasqServer()
 {
     try
@@ -87,25 +413,43 @@ mp::DNSMasqServer::~DNSMasqServer()
 
 mp::optional<mp::IPAddress> mp::DNSMasqServer::get_ip_for(const std::string& hw_addr)
 {
-    // DNSMasq leases entries consist of:
-    // <lease expiration> <mac addr> <ipv4> <name> * * *
-    const auto path = QDir(data_dir).filePath("dnsmasq.leases").toStdString();
-    const std::string delimiter{" "};
-    const int hw_addr_idx{1};
-    const int ipv4_idx{2};
-    std::ifstream leases_file{path};
-    std::string line;
-    while (getline(leases_file, line))
+    return leases->find(hw_addr);
+}
+
+mp::optional<mp::IPAddress> mp::DNSMasqServer::wait_for_ip(const std::string& hw_addr,
+                                                           std::chrono::milliseconds timeout)
+{
+    return leases->wait_for(hw_addr, timeout);
+}
+
+mp::IPAddress mp::DNSMasqServer::reserve_ip_for(const std::string& hw_addr)
+{
+    auto reservation = reservations->reserve(hw_addr, leases->all());
+    if (reservation.second)
     {
-        const auto fields = mp::utils::split(line, delimiter);
-        if (fields.size() > 2 && fields[hw_addr_idx] == hw_addr)
-            return mp::optional<mp::IPAddress>{fields[ipv4_idx]};
+        mpl::log(mpl::Level::debug, category,
+                 fmt::format("reserved {} for {}", reservation.first.as_string(), hw_addr));
+        reload_dnsmasq_hosts();
     }
-    return mp::nullopt;
+
+    return reservation.first;
+}
+
+mp::optional<mp::IPAddress> mp::DNSMasqServer::reserved_ip_for(const std::string& hw_addr)
+{
+    return reservations->find(hw_addr);
+}
+
+std::size_t mp::DNSMasqServer::reservation_count()
+{
+    return reservations->count();
 }
 
 void mp::DNSMasqServer::release_mac(const std::string& hw_addr)
 {
+    if (reservations->release(hw_addr))
+        reload_dnsmasq_hosts();
+
     auto ip = get_ip_for(hw_addr);
     if (!ip)
     {
@@ -137,14 +481,14 @@ void mp::DNSMasqServer::release_mac(const std::string& hw_addr)
     dhcp_release.waitForFinished();
 }
 
-void mp::DNSMasqServer::check_dnsmasq_running()
+bool mp::DNSMasqServer::check_dnsmasq_running()
 {
     try
     {
         auto dnsmasq_pid = get_dnsmasq_pid(pid_file_path);
         if (kill(dnsmasq_pid, 0) == 0)
         {
-            return;
+            return false;
         }
     }
     catch (const std::exception&)
@@ -154,11 +498,26 @@ void mp::DNSMasqServer::check_dnsmasq_running()
 
     // Try starting dnsmasq since it's not running
     start_dnsmasq();
+    return true;
+}
+
+void mp::DNSMasqServer::reload_dnsmasq_hosts()
+{
+    try
+    {
+        // dnsmasq rereads its hosts file on SIGHUP
+        auto dnsmasq_pid = get_dnsmasq_pid(pid_file_path);
+        kill(dnsmasq_pid, SIGHUP);
+    }
+    catch (const std::exception&)
+    {
+        // Not running; it reads the file when it starts
+    }
 }
 
 void mp::DNSMasqServer::start_dnsmasq()
 {
-    dnsmasq_cmd = make_dnsmasq_process(data_dir, bridge_name, pid_file_path, subnet);
+    dnsmasq_cmd = make_dnsmasq_process(data_dir, bridge_name, pid_file_path, subnet, identifier);
     const auto dnsmasq_daemon_fork_state = dnsmasq_cmd->execute();
 
     if (dnsmasq_daemon_fork_state.error)
@@ -22,6 +22,7 @@
 #include <multipass/optional.h>
 #include <multipass/path.h>
 
+#include <chrono>
 #include <memory>
 #include <string>
 
@@ -32,22 +33,39 @@ class Process;
 class DNSMasqServer
 {
 public:
-    DNSMasqServer(const Path& data_dir, const QString& bridge_name, const std::string& subnet);
-    DNSMasqServer(DNSMasqServer&& other) = default;
+    // The identifier is only needed where several servers run side by side, each on a bridge of its own
+    DNSMasqServer(const Path& data_dir, const QString& bridge_name, const std::string& subnet,
+                  const QString& identifier = QString());
+    DNSMasqServer(DNSMasqServer&& other);
     ~DNSMasqServer();
 
     optional<IPAddress> get_ip_for(const std::string& hw_addr);
+    // Returns as soon as dnsmasq leases an address to hw_addr, or empty once the timeout expires
+    optional<IPAddress> wait_for_ip(const std::string& hw_addr, std::chrono::milliseconds timeout);
+    // Pins hw_addr to a free address of the subnet and has dnsmasq hand out that one, so the address is known before
+    // the guest asks for it. Repeated calls return the same address
+    IPAddress reserve_ip_for(const std::string& hw_addr);
+    optional<IPAddress> reserved_ip_for(const std::string& hw_addr);
+    std::size_t reservation_count();
     void release_mac(const std::string& hw_addr);
-    void check_dnsmasq_running();
+    // Starts dnsmasq again if it is not running, returning whether it had to
+    bool check_dnsmasq_running();
 
 private:
+    struct Leases;
+    struct Reservations;
+
     void start_dnsmasq();
+    void reload_dnsmasq_hosts();
 
     const QString data_dir;
     const QString bridge_name;
     const QString pid_file_path;
     const std::string subnet;
+    const QString identifier;
     std::unique_ptr<Process> dnsmasq_cmd;
+    std::unique_ptr<Leases> leases;
+    std::unique_ptr<Reservations> reservations;
 };
 } // namespace multipass
 #endif // MULTIPASS_DNSMASQ_SERVER_H
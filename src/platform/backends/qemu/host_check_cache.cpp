@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "host_check_cache.h"
+
+namespace mp = multipass;
+
+mp::HostCheckCache::HostCheckCache(std::chrono::steady_clock::duration ttl) : ttl{ttl}
+{
+}
+
+void mp::HostCheckCache::run(const std::function<void()>& check)
+{
+    std::lock_guard<std::mutex> lock{mutex};
+    const auto now = std::chrono::steady_clock::now();
+    if (passed && now - passed_at < ttl)
+        return;
+
+    passed = false;
+    check();
+
+    passed = true;
+    passed_at = now;
+}
+
+void mp::HostCheckCache::invalidate()
+{
+    std::lock_guard<std::mutex> lock{mutex};
+    passed = false;
+}
@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_HOST_CHECK_CACHE_H
+#define MULTIPASS_HOST_CHECK_CACHE_H
+
+#include <chrono>
+#include <functional>
+#include <mutex>
+
+namespace multipass
+{
+// Remembers that a costly check of the host passed, for a while. A check that throws is not remembered, so the next
+// caller checks again. Callers that come along while one checks wait for that check rather than run their own
+class HostCheckCache
+{
+public:
+    explicit HostCheckCache(std::chrono::steady_clock::duration ttl);
+
+    void run(const std::function<void()>& check); // unless a check passed within the TTL
+    void invalidate();                            // for when something the last check looked at has changed
+
+private:
+    const std::chrono::steady_clock::duration ttl;
+    std::mutex mutex;
+    bool passed{false};                              // guarded by mutex
+    std::chrono::steady_clock::time_point passed_at; // idem
+};
+} // namespace multipass
+
+#endif // MULTIPASS_HOST_CHECK_CACHE_H
@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "instance_cgroups.h"
+
+#include <multipass/constants.h>
+#include <multipass/format.h>
+#include <multipass/logging/log.h>
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+namespace mp = multipass;
+namespace mpl = multipass::logging;
+
+namespace
+{
+constexpr auto category = "cgroups";
+constexpr auto instances_group_name = "multipass.slice";
+constexpr auto controllers = "+cpu +io +memory";
+constexpr auto guest_overhead_bytes = 256LL * 1024 * 1024; // QEMU's own memory, on top of the guest's
+constexpr auto batch_io_bps = 100LL * 1024 * 1024;
+
+QString read_line(const QString& path)
+{
+    QFile file{path};
+    if (!file.open(QIODevice::ReadOnly))
+        return {};
+
+    return QString::fromLatin1(file.readLine()).trimmed();
+}
+
+QString max_or(long long value)
+{
+    return value > 0 ? QString::number(value) : QStringLiteral("max");
+}
+} // namespace
+
+mp::InstanceCgroups::Limits mp::InstanceCgroups::limits_for(const std::string& resource_class, int num_cores,
+                                                            const MemorySize& mem_size, const QString& io_device)
+{
+    // Latency-sensitive instances win contended CPU and disk, without being capped
+    if (resource_class == latency_resource_class)
+        return {1000, 0, 1000, io_device, 0, 0};
+
+    // Batch ones yield to everyone else, and even on an idle host get half of their vCPUs, a capped disk and
+    // little more memory than the guest's
+    if (resource_class == batch_resource_class)
+        return {20,
+                num_cores * cpu_period_us / 2,
+                20,
+                io_device,
+                io_device.isEmpty() ? 0 : batch_io_bps,
+                mem_size.in_bytes() + guest_overhead_bytes};
+
+    return {100, 0, 100, io_device, 0, 0};
+}
+
+QString mp::InstanceCgroups::disk_of(const QString& path)
+{
+    struct stat info;
+    if (stat(QFile::encodeName(path).constData(), &info) != 0)
+        return {};
+
+    const auto device = QString("%1:%2").arg(major(info.st_dev)).arg(minor(info.st_dev));
+    const QFileInfo device_dir{QString("/sys/dev/block/%1").arg(device)};
+    if (!device_dir.exists())
+        return {}; // not a block device, e.g. on btrfs or tmpfs
+
+    if (!QFile::exists(QDir{device_dir.filePath()}.filePath("partition")))
+        return device;
+
+    QDir disk_dir{device_dir.canonicalFilePath()};
+    return disk_dir.cdUp() ? read_line(disk_dir.filePath("dev")) : QString();
+}
+
+mp::InstanceCgroups::InstanceCgroups(const QString& cgroup_root)
+    : cgroup_root{cgroup_root}, instances_group{QDir{cgroup_root}.filePath(instances_group_name)}
+{
+}
+
+void mp::InstanceCgroups::place(const std::string& vm_name, qint64 pid, const Limits& limits)
+{
+    std::lock_guard<decltype(mutex)> lock{mutex};
+    if (pid <= 0 || !prepare())
+        return;
+
+    const auto group = group_for(vm_name);
+    if (!QDir{}.mkpath(group))
+    {
+        mpl::log(mpl::Level::warning, category, fmt::format("Cannot create {}", qUtf8Printable(group)));
+        return;
+    }
+
+    // Set before the process moves in, so that it never runs unconstrained in there
+    apply_locked(vm_name, limits);
+    if (write(QDir{group}.filePath("cgroup.procs"), QString::number(pid)))
+        mpl::log(mpl::Level::debug, vm_name, fmt::format("process {} placed in {}", pid, qUtf8Printable(group)));
+}
+
+void mp::InstanceCgroups::apply(const std::string& vm_name, const Limits& limits)
+{
+    std::lock_guard<decltype(mutex)> lock{mutex};
+    if (prepared && QFile::exists(group_for(vm_name)))
+        apply_locked(vm_name, limits);
+}
+
+void mp::InstanceCgroups::release(const std::string& vm_name)
+{
+    std::lock_guard<decltype(mutex)> lock{mutex};
+    if (prepared)
+        QDir{instances_group}.rmdir(group_for(vm_name)); // only goes once the process has
+}
+
+void mp::InstanceCgroups::apply_locked(const std::string& vm_name, const Limits& limits)
+{
+    const QDir group{group_for(vm_name)};
+    write(group.filePath("cpu.weight"), QString::number(limits.cpu_weight));
+    write(group.filePath("cpu.max"), QString("%1 %2").arg(max_or(limits.cpu_quota_us)).arg(cpu_period_us));
+    write(group.filePath("memory.high"), max_or(limits.memory_high));
+
+    // Not every I/O scheduler weighs cgroups, nor does every device take caps
+    QFile io_weight{group.filePath("io.weight")};
+    if (io_weight.open(QIODevice::WriteOnly | QIODevice::Unbuffered))
+        io_weight.write(QString("default %1").arg(limits.io_weight).toLatin1());
+    if (!limits.io_device.isEmpty())
+    {
+        QFile io_max{group.filePath("io.max")};
+        if (io_max.open(QIODevice::WriteOnly | QIODevice::Unbuffered))
+            io_max.write(QString("%1 rbps=%2 wbps=%2").arg(limits.io_device, max_or(limits.io_bps)).toLatin1());
+    }
+}
+
+bool mp::InstanceCgroups::prepare()
+{
+    if (prepared || unavailable)
+        return prepared;
+
+    if (!QFile::exists(QDir{cgroup_root}.filePath("cgroup.controllers")))
+    {
+        mpl::log(mpl::Level::info, category, "No cgroup v2 hierarchy, instances share the daemon's resources");
+        unavailable = true;
+        return false;
+    }
+
+    // Instances go next to the daemon rather than below it, as a cgroup with processes of its own cannot hand
+    // controllers down
+    if (!QDir{}.mkpath(instances_group) || !write(QDir{cgroup_root}.filePath("cgroup.subtree_control"), controllers) ||
+        !write(QDir{instances_group}.filePath("cgroup.subtree_control"), controllers))
+    {
+        unavailable = true;
+        return false;
+    }
+
+    prepared = true;
+    return true;
+}
+
+QString mp::InstanceCgroups::group_for(const std::string& vm_name) const
+{
+    return QDir{instances_group}.filePath(QString::fromStdString(vm_name) + ".scope");
+}
+
+bool mp::InstanceCgroups::write(const QString& path, const QString& value)
+{
+    QFile file{path};
+    if (file.open(QIODevice::WriteOnly | QIODevice::Unbuffered) && file.write(value.toLatin1()) >= 0)
+        return true;
+
+    mpl::log(mpl::Level::warning, category,
+             fmt::format("Cannot write \"{}\" to {}: {}", value, qUtf8Printable(path), file.errorString()));
+    return false;
+}
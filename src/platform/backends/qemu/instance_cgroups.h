@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_INSTANCE_CGROUPS_H
+#define MULTIPASS_INSTANCE_CGROUPS_H
+
+#include <multipass/memory_size.h>
+
+#include <QString>
+
+#include <mutex>
+#include <string>
+
+namespace multipass
+{
+// Gives each instance's process a cgroup v2 of its own, below one for all instances, so that its CPU, I/O and memory
+// are weighed and capped apart from the daemon's and the other instances'. Hosts without cgroup v2 are left alone
+class InstanceCgroups
+{
+public:
+    struct Limits
+    {
+        int cpu_weight;         // 100 is an even share
+        long long cpu_quota_us; // of every cpu_period_us, or 0 for no cap
+        int io_weight;          // idem
+        QString io_device;      // "<major>:<minor>" of the disk holding the image, or empty
+        long long io_bps;       // read and write caps on it, or 0 for none
+        long long memory_high;  // bytes, past which the kernel reclaims hard, or 0 for no threshold
+    };
+
+    static constexpr long long cpu_period_us = 100000;
+
+    // For an instance of that class, size and disk, as given by disk_of
+    static Limits limits_for(const std::string& resource_class, int num_cores, const MemorySize& mem_size,
+                             const QString& io_device);
+    // The whole disk a file is on, as io.max does not take partitions
+    static QString disk_of(const QString& path);
+
+    explicit InstanceCgroups(const QString& cgroup_root = "/sys/fs/cgroup");
+
+    void place(const std::string& vm_name, qint64 pid, const Limits& limits);
+    void apply(const std::string& vm_name, const Limits& limits); // for one already placed
+    void release(const std::string& vm_name);                     // once its process is gone
+
+private:
+    bool prepare(); // with the mutex held
+    void apply_locked(const std::string& vm_name, const Limits& limits);
+    QString group_for(const std::string& vm_name) const;
+    bool write(const QString& path, const QString& value);
+
+    const QString cgroup_root;
+    const QString instances_group;
+    bool prepared{false};
+    bool unavailable{false};
+    std::mutex mutex;
+};
+} // namespace multipass
+
+#endif // MULTIPASS_INSTANCE_CGROUPS_H
@@ -27,216 +27,164 @@ namespace mpl = multipass::logging;
 
 namespace
 {
-// QString constants for all of the different iptables calls
-const QString iptables{QStringLiteral("iptables")};
-const QString negate{QStringLiteral("!")};
-
-//   Different tables to use
-const QString filter{QStringLiteral("filter")};
-const QString nat{QStringLiteral("nat")};
-const QString mangle{QStringLiteral("mangle")};
-
-//   Chain constants
-const QString INPUT{QStringLiteral("INPUT")};
-const QString OUTPUT{QStringLiteral("OUTPUT")};
-const QString POSTROUTING{QStringLiteral("POSTROUTING")};
-const QString FORWARD{QStringLiteral("FORWARD")};
-
-//   option constants
-const QString destination{QStringLiteral("--destination")};
-const QString delete_rule{QStringLiteral("--delete")};
-const QString in_interface{QStringLiteral("--in-interface")};
-const QString append_rule{QStringLiteral("--append")};
-const QString insert_rule{QStringLiteral("--insert")};
-const QString jump{QStringLiteral("--jump")};
-const QString match{QStringLiteral("--match")};
-const QString out_interface{QStringLiteral("--out-interface")};
-const QString protocol{QStringLiteral("--protocol")};
-const QString source{QStringLiteral("--source")};
-const QString list_rules{QStringLiteral("--list-rules")};
-const QString dash_t{QStringLiteral("-t")}; // Use short option for specifying table to avoid var conflicts
+const QString iptables_save{QStringLiteral("iptables-save")};
+const QString iptables_restore{QStringLiteral("iptables-restore")};
 const QString wait{QStringLiteral("--wait")};
+const QString noflush{QStringLiteral("--noflush")};
 
-//   protocol constants
-const QString udp{QStringLiteral("udp")};
-const QString tcp{QStringLiteral("tcp")};
-
-//   port options and constants
-const QString dport{QStringLiteral("--dport")};
-const QString sport{QStringLiteral("--sport")};
-const QString to_ports{QStringLiteral("--to-ports")};
-const QString port_53{QStringLiteral("53")};
-const QString port_67{QStringLiteral("67")};
-const QString port_68{QStringLiteral("68")};
-const QString port_range{QStringLiteral("1024-65535")};
-
-//   rule target constants
-const QString ACCEPT{QStringLiteral("ACCEPT")};
-const QString MASQUERADE{QStringLiteral("MASQUERADE")};
-const QString REJECT{QStringLiteral("REJECT")};
-const QString RETURN{QStringLiteral("RETURN")};
-
-//   reject rule constants
-const QString reject_with{QStringLiteral("--reject-with")};
-const QString icmp_port_unreachable{QStringLiteral("icmp-port-unreachable")};
+// The tables multipass puts rules in, in the order they are restored
+const QStringList tables{QStringLiteral("filter"), QStringLiteral("nat"), QStringLiteral("mangle")};
+
+// Rules of each table, as "<chain> <rule>"
+using TableRules = QMap<QString, QStringList>;
+
+struct Rule
+{
+    QString table;
+    QString chain_and_rule;
+    bool append;
+};
 
 auto multipass_iptables_comment(const QString& bridge_name)
 {
     return QString("generated for Multipass network %1").arg(bridge_name);
 }
 
-void add_iptables_rule(const QString& table, const QString& chain, const QStringList& rule, bool append = false)
+// Rules are spelled the way iptables-save prints them, so that checking for them is a plain string comparison
+std::vector<Rule> multipass_rules(const QString& bridge_name, const QString& cidr, const QString& comment,
+                                  const std::vector<int>& host_ports)
 {
-    auto process = mp::ProcessFactory::instance().create_process(
-        iptables, QStringList() << wait << dash_t << table << (append ? append_rule : insert_rule) << chain << rule);
-
-    auto exit_state = process->execute();
-
-    if (!exit_state.completed_successfully())
-        throw std::runtime_error(
-            fmt::format("Failed to set iptables rule for table {}: {}", table, process->read_all_standard_error()));
+    const auto comment_option = QString("-m comment --comment \"%1\"").arg(comment);
+    const auto rule = [&comment_option](const QString& table, const QString& chain, const QString& matches,
+                                        const QString& target, bool append = false) {
+        return Rule{table, QString("%1 %2 %3 -j %4").arg(chain, matches, comment_option, target), append};
+    };
+
+    std::vector<Rule> rules{
+        // Setup basic iptables overrides for DHCP/DNS
+        rule("filter", "INPUT", QString("-i %1 -p udp -m udp --dport 67").arg(bridge_name), "ACCEPT"),
+        rule("filter", "INPUT", QString("-i %1 -p udp -m udp --dport 53").arg(bridge_name), "ACCEPT"),
+        rule("filter", "INPUT", QString("-i %1 -p tcp -m tcp --dport 53").arg(bridge_name), "ACCEPT"),
+        rule("filter", "OUTPUT", QString("-o %1 -p udp -m udp --sport 67").arg(bridge_name), "ACCEPT"),
+        rule("filter", "OUTPUT", QString("-o %1 -p udp -m udp --sport 53").arg(bridge_name), "ACCEPT"),
+        rule("filter", "OUTPUT", QString("-o %1 -p tcp -m tcp --sport 53").arg(bridge_name), "ACCEPT"),
+        rule("mangle", "POSTROUTING", QString("-o %1 -p udp -m udp --dport 68").arg(bridge_name),
+             "CHECKSUM --checksum-fill"),
+
+        // Do not masquerade to these reserved address blocks.
+        rule("nat", "POSTROUTING", QString("-s %1 -d 224.0.0.0/24").arg(cidr), "RETURN"),
+        rule("nat", "POSTROUTING", QString("-s %1 -d 255.255.255.255/32").arg(cidr), "RETURN"),
+
+        // Masquerade all packets going from VMs to the LAN/Internet
+        rule("nat", "POSTROUTING", QString("-s %1 ! -d %1 -p tcp").arg(cidr), "MASQUERADE --to-ports 1024-65535"),
+        rule("nat", "POSTROUTING", QString("-s %1 ! -d %1 -p udp").arg(cidr), "MASQUERADE --to-ports 1024-65535"),
+        rule("nat", "POSTROUTING", QString("-s %1 ! -d %1").arg(cidr), "MASQUERADE"),
+
+        // Allow established traffic to the private subnet
+        rule("filter", "FORWARD",
+             QString("-d %1 -o %2 -m conntrack --ctstate RELATED,ESTABLISHED").arg(cidr, bridge_name), "ACCEPT"),
+
+        // Allow outbound traffic from the private subnet
+        rule("filter", "FORWARD", QString("-s %1 -i %2").arg(cidr, bridge_name), "ACCEPT"),
+
+        // Allow traffic between virtual machines
+        rule("filter", "FORWARD", QString("-i %1 -o %1").arg(bridge_name), "ACCEPT"),
+
+        // Reject everything else
+        rule("filter", "FORWARD", QString("-i %1").arg(bridge_name), "REJECT --reject-with icmp-port-unreachable",
+             /*append=*/true),
+        rule("filter", "FORWARD", QString("-o %1").arg(bridge_name), "REJECT --reject-with icmp-port-unreachable",
+             /*append=*/true)};
+
+    // Services the daemon offers instances on the bridge's address
+    for (const auto port : host_ports)
+        rules.push_back(rule("filter", "INPUT", QString("-i %1 -p tcp -m tcp --dport %2").arg(bridge_name).arg(port),
+                             "ACCEPT"));
+
+    return rules;
 }
 
-void delete_iptables_rule(const QString& table, const QStringList& chain_and_rule)
+// One dump of every table, rather than a listing per table
+TableRules get_iptables_rules()
 {
-    auto args = QStringList() << iptables << wait << dash_t << table << delete_rule << chain_and_rule;
-
-    auto process = mp::ProcessFactory::instance().create_process(
-        QStringLiteral("sh"), QStringList() << QStringLiteral("-c") << args.join(" "));
+    auto process = mp::ProcessFactory::instance().create_process(iptables_save);
 
     auto exit_state = process->execute();
 
     if (!exit_state.completed_successfully())
-        throw std::runtime_error(
-            fmt::format("Failed to delete iptables rule for table {}: {}", table, process->read_all_standard_error()));
+        throw std::runtime_error(fmt::format("Failed to get iptables rules: {}", process->read_all_standard_error()));
+
+    TableRules rules;
+    QString table;
+    for (const auto& line : QString::fromUtf8(process->read_all_standard_output()).split('\n'))
+    {
+        if (line.startsWith('*'))
+            table = line.mid(1).trimmed();
+        else if (line.startsWith(QStringLiteral("-A ")))
+            rules[table] << line.mid(3).trimmed();
+    }
+
+    return rules;
 }
 
-auto get_iptables_rules(const QString& table)
+// Applies all the changes in one transaction, leaving anything else in the tables alone
+void restore_iptables_rules(const TableRules& deletions, const std::vector<Rule>& additions)
 {
-    auto process =
-        mp::ProcessFactory::instance().create_process(iptables, QStringList() << wait << dash_t << table << list_rules);
+    QByteArray input;
+    for (const auto& table : tables)
+    {
+        input += QString("*%1\n").arg(table).toUtf8();
+        for (const auto& rule : deletions.value(table))
+            input += QString("-D %1\n").arg(rule).toUtf8();
+        for (const auto& rule : additions)
+            if (rule.table == table)
+                input += QString("%1 %2\n").arg(rule.append ? "-A" : "-I", rule.chain_and_rule).toUtf8();
+        input += "COMMIT\n";
+    }
 
-    auto exit_state = process->execute();
+    auto process = mp::ProcessFactory::instance().create_process(iptables_restore, QStringList() << wait << noflush);
 
-    if (!exit_state.completed_successfully())
-        throw std::runtime_error(
-            fmt::format("Failed to get iptables list for table {}: {}", table, process->read_all_standard_error()));
+    process->start();
+    if (process->wait_for_started())
+    {
+        process->write(input);
+        process->close_write_channel();
+        process->wait_for_finished();
+    }
 
-    return process->read_all_standard_output();
-}
+    auto exit_state = process->process_state();
 
-void set_iptables_rules(const QString& bridge_name, const QString& cidr, const QString& comment)
-{
-    const QStringList comment_option{match, QStringLiteral("comment"), QStringLiteral("--comment"), comment};
-
-    // Setup basic iptables overrides for DHCP/DNS
-    add_iptables_rule(filter, INPUT,
-                      QStringList() << in_interface << bridge_name << protocol << udp << dport << port_67 << jump
-                                    << ACCEPT << comment_option);
-
-    add_iptables_rule(filter, INPUT,
-                      QStringList() << in_interface << bridge_name << protocol << udp << dport << port_53 << jump
-                                    << ACCEPT << comment_option);
-
-    add_iptables_rule(filter, INPUT,
-                      QStringList() << in_interface << bridge_name << protocol << tcp << dport << port_53 << jump
-                                    << ACCEPT << comment_option);
-
-    add_iptables_rule(filter, OUTPUT,
-                      QStringList() << out_interface << bridge_name << protocol << udp << sport << port_67 << jump
-                                    << ACCEPT << comment_option);
-
-    add_iptables_rule(filter, OUTPUT,
-                      QStringList() << out_interface << bridge_name << protocol << udp << sport << port_53 << jump
-                                    << ACCEPT << comment_option);
-
-    add_iptables_rule(filter, OUTPUT,
-                      QStringList() << out_interface << bridge_name << protocol << tcp << sport << port_53 << jump
-                                    << ACCEPT << comment_option);
-
-    add_iptables_rule(mangle, POSTROUTING,
-                      QStringList() << out_interface << bridge_name << protocol << udp << dport << port_68 << jump
-                                    << QStringLiteral("CHECKSUM") << QStringLiteral("--checksum-fill")
-                                    << comment_option);
-
-    // Do not masquerade to these reserved address blocks.
-    add_iptables_rule(nat, POSTROUTING,
-                      QStringList() << source << cidr << destination << QStringLiteral("224.0.0.0/24") << jump << RETURN
-                                    << comment_option);
-
-    add_iptables_rule(nat, POSTROUTING,
-                      QStringList() << source << cidr << destination << QStringLiteral("255.255.255.255/32") << jump
-                                    << RETURN << comment_option);
-
-    // Masquerade all packets going from VMs to the LAN/Internet
-    add_iptables_rule(nat, POSTROUTING,
-                      QStringList() << source << cidr << negate << destination << cidr << protocol << tcp << jump
-                                    << MASQUERADE << to_ports << port_range << comment_option);
-
-    add_iptables_rule(nat, POSTROUTING,
-                      QStringList() << source << cidr << negate << destination << cidr << protocol << udp << jump
-                                    << MASQUERADE << to_ports << port_range << comment_option);
-
-    add_iptables_rule(nat, POSTROUTING,
-                      QStringList() << source << cidr << negate << destination << cidr << jump << MASQUERADE
-                                    << comment_option);
-
-    // Allow established traffic to the private subnet
-    add_iptables_rule(filter, FORWARD,
-                      QStringList() << destination << cidr << out_interface << bridge_name << match
-                                    << QStringLiteral("conntrack") << QStringLiteral("--ctstate")
-                                    << QStringLiteral("RELATED,ESTABLISHED") << jump << ACCEPT << comment_option);
-
-    // Allow outbound traffic from the private subnet
-    add_iptables_rule(filter, FORWARD,
-                      QStringList() << source << cidr << in_interface << bridge_name << jump << ACCEPT
-                                    << comment_option);
-
-    // Allow traffic between virtual machines
-    add_iptables_rule(filter, FORWARD,
-                      QStringList() << in_interface << bridge_name << out_interface << bridge_name << jump << ACCEPT
-                                    << comment_option);
-
-    // Reject everything else
-    add_iptables_rule(filter, FORWARD,
-                      QStringList() << in_interface << bridge_name << jump << REJECT << reject_with
-                                    << icmp_port_unreachable << comment_option,
-                      /*append=*/true);
-
-    add_iptables_rule(filter, FORWARD,
-                      QStringList() << out_interface << bridge_name << jump << REJECT << reject_with
-                                    << icmp_port_unreachable << comment_option,
-                      /*append=*/true);
+    if (!exit_state.completed_successfully())
+        throw std::runtime_error(fmt::format("Failed to set iptables rules: {}", process->read_all_standard_error()));
 }
 
-void clear_iptables_rules_for(const QString& table, const QString& bridge_name, const QString& cidr,
+TableRules multipass_rules_in(const TableRules& rules, const QString& bridge_name, const QString& cidr,
                               const QString& comment)
 {
-    auto rules = QString::fromUtf8(get_iptables_rules(table));
-
-    for (auto& rule : rules.split('\n'))
+    TableRules found;
+    for (auto it = rules.cbegin(); it != rules.cend(); ++it)
     {
-        if (rule.contains(comment) || rule.contains(bridge_name) || rule.contains(cidr))
+        for (const auto& rule : it.value())
         {
-            // Remove the policy type since delete doesn't use that
-            rule.remove(0, 3);
-
-            // Pass the chain and rule wholesale since we capture the whole line
-            delete_iptables_rule(table, QStringList() << rule);
+            if (rule.contains(comment) || rule.contains(bridge_name) || rule.contains(cidr))
+                found[it.key()] << rule;
         }
     }
+
+    return found;
 }
 } // namespace
 
-mp::IPTablesConfig::IPTablesConfig(const QString& bridge_name, const std::string& subnet)
+mp::IPTablesConfig::IPTablesConfig(const QString& bridge_name, const std::string& subnet,
+                                   const std::vector<int>& host_ports)
     : bridge_name{bridge_name},
       cidr{QString("%1.0/24").arg(QString::fromStdString(subnet))},
-      comment{multipass_iptables_comment(bridge_name)}
+      comment{multipass_iptables_comment(bridge_name)},
+      host_ports{host_ports}
 {
     try
     {
-        clear_all_iptables_rules();
-        set_iptables_rules(bridge_name, cidr, comment);
+        set_all_iptables_rules(get_iptables_rules());
     }
     catch (const std::exception& e)
     {
@@ -248,9 +196,14 @@ mp::IPTablesConfig::IPTablesConfig(const QString& bridge_name, const std::string
 
 mp::IPTablesConfig::~IPTablesConfig()
 {
+    if (keep)
+        return;
+
     try
     {
-        clear_all_iptables_rules();
+        auto stale = multipass_rules_in(get_iptables_rules(), bridge_name, cidr, comment);
+        if (!stale.isEmpty())
+            restore_iptables_rules(stale, {});
     }
     catch (const std::exception& e)
     {
@@ -264,11 +217,27 @@ void mp::IPTablesConfig::verify_iptables_rules()
     {
         throw std::runtime_error(error_string);
     }
+
+    auto current = get_iptables_rules();
+    for (const auto& rule : multipass_rules(bridge_name, cidr, comment, host_ports))
+    {
+        if (!current.value(rule.table).contains(rule.chain_and_rule))
+        {
+            // Something else flushed them, e.g. a firewall reloading, so put the whole set back
+            mpl::log(mpl::Level::info, "iptables", "Restoring missing iptables rules");
+            set_all_iptables_rules(current);
+            return;
+        }
+    }
+}
+
+void mp::IPTablesConfig::keep_rules()
+{
+    keep = true;
 }
 
-void mp::IPTablesConfig::clear_all_iptables_rules()
+void mp::IPTablesConfig::set_all_iptables_rules(const QMap<QString, QStringList>& current)
 {
-    clear_iptables_rules_for(filter, bridge_name, cidr, comment);
-    clear_iptables_rules_for(nat, bridge_name, cidr, comment);
-    clear_iptables_rules_for(mangle, bridge_name, cidr, comment);
+    restore_iptables_rules(multipass_rules_in(current, bridge_name, cidr, comment),
+                           multipass_rules(bridge_name, cidr, comment, host_ports));
 }
@@ -19,27 +19,38 @@
 #define MULTIPASS_IPTABLES_CONFIG_H
 
 #include <string>
+#include <vector>
 
+#include <QMap>
 #include <QString>
+#include <QStringList>
 
 namespace multipass
 {
 class IPTablesConfig
 {
 public:
-    IPTablesConfig(const QString& bridge_name, const std::string& subnet);
+    // Instances may reach the host on its host_ports over TCP, besides DNS and DHCP
+    IPTablesConfig(const QString& bridge_name, const std::string& subnet, const std::vector<int>& host_ports = {});
     ~IPTablesConfig();
 
+    // Throws if the rules could not be set up, and puts them back if they have gone missing since
     void verify_iptables_rules();
 
+    // Leaves the rules in place on destruction, for instances that outlive the daemon
+    void keep_rules();
+
 private:
-    void clear_all_iptables_rules();
+    // Replaces whatever multipass rules are among the current ones with a fresh set
+    void set_all_iptables_rules(const QMap<QString, QStringList>& current);
 
     const QString bridge_name;
     const QString cidr;
     const QString comment;
+    const std::vector<int> host_ports;
 
     bool iptables_error{false};
+    bool keep{false};
     std::string error_string;
 };
 } // namespace multipass
@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "ksm_policy.h"
+
+#include <multipass/format.h>
+#include <multipass/logging/log.h>
+#include <multipass/telemetry.h>
+
+#include <QDir>
+#include <QFile>
+#include <QRegularExpression>
+
+#include <algorithm>
+
+#include <unistd.h>
+
+namespace mp = multipass;
+namespace mpl = multipass::logging;
+
+namespace
+{
+constexpr auto category = "ksm";
+constexpr auto pages_per_instance = 100; // the kernel's default pages_to_scan
+constexpr auto max_pages_to_scan = 10000;
+
+long long meminfo_value(const QString& meminfo, const QString& field)
+{
+    const QRegularExpression line{QString("^%1:\\s+(\\d+) kB$").arg(field), QRegularExpression::MultilineOption};
+    return line.match(meminfo).captured(1).toLongLong();
+}
+} // namespace
+
+mp::KsmPolicy::KsmPolicy(const QString& ksm_dir, const QString& meminfo_path)
+    : ksm_dir{ksm_dir}, meminfo_path{meminfo_path}
+{
+}
+
+mp::KsmPolicy::Tuning mp::KsmPolicy::tuning_for(int instances, double available_memory)
+{
+    // Scanning costs CPU, so it only picks up once there is little memory to spare
+    const auto pressure = available_memory < 0.2 ? 16 : available_memory < 0.5 ? 4 : 1;
+    const auto sleep_millisecs = available_memory < 0.2 ? 20 : available_memory < 0.5 ? 50 : 200;
+
+    return {std::min(pages_per_instance * instances * pressure, max_pages_to_scan), sleep_millisecs};
+}
+
+void mp::KsmPolicy::instance_started(const std::string& vm_name)
+{
+    std::lock_guard<decltype(mutex)> lock{mutex};
+    if (instances.insert(vm_name).second)
+        apply();
+}
+
+void mp::KsmPolicy::instance_stopped(const std::string& vm_name)
+{
+    std::lock_guard<decltype(mutex)> lock{mutex};
+    if (instances.erase(vm_name))
+        apply();
+}
+
+void mp::KsmPolicy::retune()
+{
+    {
+        std::lock_guard<decltype(mutex)> lock{mutex};
+        if (!kernel_settings)
+            return;
+
+        apply();
+    }
+
+    mp::Telemetry::instance().set("multipass_ksm_merged_bytes", {}, merged_bytes());
+}
+
+long long mp::KsmPolicy::merged_bytes() const
+{
+    return read("pages_sharing").toLongLong() * sysconf(_SC_PAGESIZE);
+}
+
+void mp::KsmPolicy::apply()
+{
+    // A single instance has nothing to share pages with
+    if (instances.size() < 2)
+    {
+        if (kernel_settings)
+        {
+            write("pages_to_scan", kernel_settings->pages_to_scan);
+            write("sleep_millisecs", kernel_settings->sleep_millisecs);
+            write("run", kernel_settings->run);
+            kernel_settings = nullopt;
+            mpl::log(mpl::Level::debug, category, "gave page merging back to the kernel's settings");
+        }
+
+        return;
+    }
+
+    if (!kernel_settings)
+        kernel_settings = KernelSettings{read("run"), read("pages_to_scan"), read("sleep_millisecs")};
+
+    const auto tuning = tuning_for(static_cast<int>(instances.size()), available_memory());
+    if (write("pages_to_scan", QString::number(tuning.pages_to_scan)) &&
+        write("sleep_millisecs", QString::number(tuning.sleep_millisecs)) && write("run", "1"))
+        mpl::log(mpl::Level::debug, category,
+                 fmt::format("merging pages of {} instances, {} pages every {}ms", instances.size(),
+                             tuning.pages_to_scan, tuning.sleep_millisecs));
+}
+
+double mp::KsmPolicy::available_memory() const
+{
+    QFile file{meminfo_path};
+    if (!file.open(QIODevice::ReadOnly))
+        return 1.0;
+
+    const auto meminfo = QString::fromLatin1(file.readAll());
+    const auto total = meminfo_value(meminfo, "MemTotal");
+    return total > 0 ? static_cast<double>(meminfo_value(meminfo, "MemAvailable")) / total : 1.0;
+}
+
+QString mp::KsmPolicy::read(const QString& name) const
+{
+    QFile file{QDir{ksm_dir}.filePath(name)};
+    if (!file.open(QIODevice::ReadOnly))
+        return {};
+
+    return QString::fromLatin1(file.readAll()).trimmed();
+}
+
+bool mp::KsmPolicy::write(const QString& name, const QString& value)
+{
+    // A setting that could not be read has nothing to be put back to
+    if (value.isEmpty())
+        return true;
+
+    QFile file{QDir{ksm_dir}.filePath(name)};
+    if (file.open(QIODevice::WriteOnly | QIODevice::Unbuffered) && file.write(value.toLatin1()) >= 0)
+        return true;
+
+    if (!warned)
+        mpl::log(mpl::Level::warning, category,
+                 fmt::format("Cannot tune page merging, {}: {}", file.fileName(), file.errorString()));
+    warned = true;
+
+    return false;
+}
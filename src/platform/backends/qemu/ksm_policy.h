@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_KSM_POLICY_H
+#define MULTIPASS_KSM_POLICY_H
+
+#include <multipass/optional.h>
+
+#include <QString>
+
+#include <mutex>
+#include <string>
+#include <unordered_set>
+
+namespace multipass
+{
+// Has the kernel merge identical pages of instances whose memory is mergeable, scanning harder the more of them run
+// and the less memory the host has left. The kernel's own settings are back in place once fewer than two run
+class KsmPolicy
+{
+public:
+    struct Tuning
+    {
+        int pages_to_scan;
+        int sleep_millisecs;
+    };
+
+    explicit KsmPolicy(const QString& ksm_dir = "/sys/kernel/mm/ksm", const QString& meminfo_path = "/proc/meminfo");
+
+    // For that many mergeable instances running, with that fraction of the host's memory still available
+    static Tuning tuning_for(int instances, double available_memory);
+
+    void instance_started(const std::string& vm_name);
+    void instance_stopped(const std::string& vm_name);
+    void retune(); // as memory pressure changes; also reports what merging saves
+
+    long long merged_bytes() const; // memory the pages sharing another's frame would otherwise take
+
+private:
+    struct KernelSettings
+    {
+        QString run;
+        QString pages_to_scan;
+        QString sleep_millisecs;
+    };
+
+    void apply(); // with the mutex held
+    double available_memory() const;
+    QString read(const QString& name) const;
+    bool write(const QString& name, const QString& value);
+
+    const QString ksm_dir;
+    const QString meminfo_path;
+    std::unordered_set<std::string> instances;
+    optional<KernelSettings> kernel_settings; // as found, while tuned
+    bool warned{false};
+    std::mutex mutex;
+};
+} // namespace multipass
+
+#endif // MULTIPASS_KSM_POLICY_H
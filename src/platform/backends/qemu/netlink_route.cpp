@@ -0,0 +1,282 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "netlink_route.h"
+
+#include <multipass/format.h>
+#include <multipass/logging/log.h>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <linux/if_tun.h>
+#include <linux/rtnetlink.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <array>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace mp = multipass;
+namespace mpl = multipass::logging;
+
+namespace
+{
+constexpr auto category = "netlink";
+constexpr auto reply_timeout_s = 5; // for an acknowledgement, which the kernel sends at once when it sends one
+
+auto index_of(const QString& name)
+{
+    return static_cast<int>(if_nametoindex(qUtf8Printable(name)));
+}
+} // namespace
+
+void mp::NetlinkRoute::Request::add_attribute(std::uint16_t type, const void* data, std::size_t size)
+{
+    rtattr attribute{};
+    attribute.rta_type = type;
+    attribute.rta_len = RTA_LENGTH(size);
+    append(&attribute, sizeof(attribute));
+    append(data, size);
+}
+
+void mp::NetlinkRoute::Request::add_attribute(std::uint16_t type, const QString& value)
+{
+    const auto bytes = value.toUtf8();
+    add_attribute(type, bytes.constData(), bytes.size() + 1);
+}
+
+std::size_t mp::NetlinkRoute::Request::begin_nested(std::uint16_t type)
+{
+    const auto offset = buffer.size();
+    add_attribute(type, nullptr, 0);
+    return offset;
+}
+
+void mp::NetlinkRoute::Request::end_nested(std::size_t offset)
+{
+    reinterpret_cast<rtattr*>(&buffer[offset])->rta_len = buffer.size() - offset;
+}
+
+nlmsghdr* mp::NetlinkRoute::Request::header()
+{
+    auto header = reinterpret_cast<nlmsghdr*>(buffer.data());
+    header->nlmsg_len = buffer.size();
+    return header;
+}
+
+void mp::NetlinkRoute::Request::append(const void* data, std::size_t size)
+{
+    const auto offset = buffer.size();
+    buffer.resize(NLMSG_ALIGN(offset + size));
+    if (data)
+        std::memcpy(&buffer[offset], data, size);
+}
+
+mp::optional<int> mp::NetlinkRoute::acknowledgement_in(const char* reply, std::size_t length,
+                                                       std::uint32_t sequence)
+{
+    // Anything else in there is left over from earlier requests
+    auto remaining = static_cast<int>(length);
+    for (auto message = reinterpret_cast<const nlmsghdr*>(reply); NLMSG_OK(message, remaining);
+         message = NLMSG_NEXT(message, remaining))
+    {
+        if (message->nlmsg_seq != sequence || message->nlmsg_type != NLMSG_ERROR)
+            continue;
+
+        if (message->nlmsg_len < NLMSG_LENGTH(sizeof(nlmsgerr)))
+            return EBADMSG;
+
+        return -reinterpret_cast<const nlmsgerr*>(NLMSG_DATA(message))->error;
+    }
+
+    return mp::nullopt;
+}
+
+mp::NetlinkRoute::NetlinkRoute(const Singleton<NetlinkRoute>::PrivatePass& pass)
+    : Singleton<NetlinkRoute>::Singleton{pass}, socket_fd{socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE)}
+{
+    if (socket_fd < 0)
+    {
+        mpl::log(mpl::Level::warning, category, fmt::format("Cannot open a netlink socket: {}", std::strerror(errno)));
+        return;
+    }
+
+    const timeval timeout{reply_timeout_s, 0};
+    if (setsockopt(socket_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0)
+        mpl::log(mpl::Level::warning, category,
+                 fmt::format("Cannot set a timeout on the netlink socket: {}", std::strerror(errno)));
+}
+
+mp::NetlinkRoute::~NetlinkRoute()
+{
+    if (socket_fd >= 0)
+        close(socket_fd);
+}
+
+bool mp::NetlinkRoute::link_exists(const QString& name) const
+{
+    return index_of(name) > 0;
+}
+
+bool mp::NetlinkRoute::add_link(const QString& name, const QString& kind, const std::string& mac_address)
+{
+    ifinfomsg link{};
+    link.ifi_family = AF_UNSPEC;
+
+    Request request{RTM_NEWLINK, NLM_F_CREATE | NLM_F_EXCL, link};
+    request.add_attribute(IFLA_IFNAME, name);
+
+    std::array<unsigned char, 6> mac;
+    if (std::sscanf(mac_address.c_str(), "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx", &mac[0], &mac[1], &mac[2], &mac[3],
+                    &mac[4], &mac[5]) == 6)
+        request.add_attribute(IFLA_ADDRESS, mac.data(), mac.size());
+
+    const auto link_info = request.begin_nested(IFLA_LINKINFO);
+    request.add_attribute(IFLA_INFO_KIND, kind);
+    request.end_nested(link_info);
+
+    return send_request(request, QString("add %1 %2").arg(kind, name));
+}
+
+bool mp::NetlinkRoute::add_tap(const QString& name, bool multi_queue)
+{
+    // Taps are made through the tun device rather than rtnetlink, the same way `ip tuntap` does it
+    const auto tun_fd = open("/dev/net/tun", O_RDWR | O_CLOEXEC);
+    if (tun_fd < 0)
+    {
+        mpl::log(mpl::Level::warning, category, fmt::format("Cannot open /dev/net/tun: {}", std::strerror(errno)));
+        return false;
+    }
+
+    ifreq interface{};
+    std::strncpy(interface.ifr_name, qUtf8Printable(name), IFNAMSIZ - 1);
+    interface.ifr_flags = IFF_TAP | IFF_NO_PI | (multi_queue ? IFF_MULTI_QUEUE : 0);
+
+    const auto created = ioctl(tun_fd, TUNSETIFF, &interface) == 0 && ioctl(tun_fd, TUNSETPERSIST, 1) == 0;
+    if (!created)
+        mpl::log(mpl::Level::warning, category,
+                 fmt::format("Cannot add tap {}: {}", qUtf8Printable(name), std::strerror(errno)));
+
+    close(tun_fd);
+    return created;
+}
+
+bool mp::NetlinkRoute::set_link(const QString& name, const QString& master, bool up)
+{
+    ifinfomsg link{};
+    link.ifi_family = AF_UNSPEC;
+    link.ifi_index = index_of(name);
+    if (up)
+    {
+        link.ifi_flags = IFF_UP;
+        link.ifi_change = IFF_UP;
+    }
+
+    Request request{RTM_NEWLINK, 0, link};
+    if (!master.isEmpty())
+    {
+        const std::uint32_t master_index = index_of(master);
+        request.add_attribute(IFLA_MASTER, &master_index, sizeof(master_index));
+    }
+
+    return send_request(request, QString("set %1").arg(name));
+}
+
+bool mp::NetlinkRoute::add_address(const QString& name, const std::string& address, int prefix_length,
+                                   const std::string& broadcast)
+{
+    in_addr local, broadcast_address;
+    if (inet_pton(AF_INET, address.c_str(), &local) != 1 ||
+        inet_pton(AF_INET, broadcast.c_str(), &broadcast_address) != 1)
+        return false;
+
+    ifaddrmsg interface_address{};
+    interface_address.ifa_family = AF_INET;
+    interface_address.ifa_prefixlen = prefix_length;
+    interface_address.ifa_index = index_of(name);
+
+    Request request{RTM_NEWADDR, NLM_F_CREATE | NLM_F_EXCL, interface_address};
+    request.add_attribute(IFA_LOCAL, &local, sizeof(local));
+    request.add_attribute(IFA_ADDRESS, &local, sizeof(local));
+    request.add_attribute(IFA_BROADCAST, &broadcast_address, sizeof(broadcast_address));
+
+    return send_request(request, QString("add address %1 to %2").arg(QString::fromStdString(address), name));
+}
+
+bool mp::NetlinkRoute::delete_link(const QString& name)
+{
+    ifinfomsg link{};
+    link.ifi_family = AF_UNSPEC;
+    link.ifi_index = index_of(name);
+
+    Request request{RTM_DELLINK, 0, link};
+    return send_request(request, QString("delete %1").arg(name));
+}
+
+bool mp::NetlinkRoute::send_request(Request& request, const QString& description)
+{
+    std::lock_guard<decltype(socket_mutex)> lock{socket_mutex};
+
+    if (socket_fd < 0)
+        return false;
+
+    auto header = request.header();
+    header->nlmsg_seq = ++sequence;
+
+    sockaddr_nl kernel{};
+    kernel.nl_family = AF_NETLINK;
+
+    auto error = 0;
+    if (sendto(socket_fd, header, header->nlmsg_len, 0, reinterpret_cast<sockaddr*>(&kernel), sizeof(kernel)) < 0)
+    {
+        error = errno;
+    }
+    else
+    {
+        // Wait for the acknowledgement of this request, skipping anything left over from earlier ones
+        std::array<char, 8192> reply;
+        for (auto acknowledged = false; !acknowledged;)
+        {
+            auto length = recv(socket_fd, reply.data(), reply.size(), 0);
+            if (length < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                error = errno == EAGAIN || errno == EWOULDBLOCK ? ETIMEDOUT : errno;
+                break;
+            }
+
+            if (auto acknowledgement = acknowledgement_in(reply.data(), length, sequence))
+            {
+                error = *acknowledgement;
+                acknowledged = true;
+            }
+        }
+    }
+
+    if (error)
+        mpl::log(mpl::Level::warning, category,
+                 fmt::format("Cannot {}: {}", qUtf8Printable(description), std::strerror(error)));
+
+    return error == 0;
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_NETLINK_ROUTE_H
+#define MULTIPASS_NETLINK_ROUTE_H
+
+#include <multipass/optional.h>
+#include <multipass/singleton.h>
+
+#include <QString>
+
+#include <linux/netlink.h>
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace multipass
+{
+// Manages network links over one rtnetlink socket kept for the life of the daemon, instead of running `ip` for
+// each change. Like `ip`, failures are reported (and logged) rather than thrown
+class NetlinkRoute : public Singleton<NetlinkRoute>
+{
+public:
+    NetlinkRoute(const Singleton<NetlinkRoute>::PrivatePass&);
+    ~NetlinkRoute();
+
+    bool link_exists(const QString& name) const;
+
+    // A link of the given kind, e.g. "bridge" or "dummy", optionally with a MAC address
+    bool add_link(const QString& name, const QString& kind, const std::string& mac_address = {});
+    // A persistent tap, which QEMU can later open with one queue per vCPU when multi_queue is set
+    bool add_tap(const QString& name, bool multi_queue);
+    // Enslaves the link to master, unless that is empty, and brings it up if asked
+    bool set_link(const QString& name, const QString& master, bool up);
+    bool add_address(const QString& name, const std::string& address, int prefix_length, const std::string& broadcast);
+    bool delete_link(const QString& name);
+
+    // A netlink message, built up an attribute at a time
+    class Request
+    {
+    public:
+        template <typename Payload>
+        Request(std::uint16_t type, std::uint16_t flags, const Payload& payload)
+        {
+            append(nullptr, sizeof(nlmsghdr));
+            header()->nlmsg_type = type;
+            header()->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | flags;
+            append(&payload, sizeof(payload));
+        }
+
+        void add_attribute(std::uint16_t type, const void* data, std::size_t size);
+        void add_attribute(std::uint16_t type, const QString& value);
+
+        // Attributes added until end_nested() go inside this one
+        std::size_t begin_nested(std::uint16_t type);
+        void end_nested(std::size_t offset);
+
+        nlmsghdr* header();
+
+    private:
+        void append(const void* data, std::size_t size);
+
+        std::vector<char> buffer;
+    };
+
+    // The error the kernel acknowledged the request numbered sequence with, 0 for none, if the reply holds it
+    static optional<int> acknowledgement_in(const char* reply, std::size_t length, std::uint32_t sequence);
+
+private:
+    bool send_request(Request& request, const QString& description);
+
+    int socket_fd{-1};
+    std::mutex socket_mutex;
+    std::uint32_t sequence{0};
+};
+} // namespace multipass
+
+#endif // MULTIPASS_NETLINK_ROUTE_H
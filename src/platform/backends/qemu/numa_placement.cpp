@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "numa_placement.h"
+
+#include <QDir>
+#include <QFile>
+
+#include <algorithm>
+
+namespace mp = multipass;
+
+namespace
+{
+// Parses the kernel's cpulist format, e.g. "0-3,8,10-11"
+std::vector<int> parse_cpu_list(const QString& cpu_list)
+{
+    std::vector<int> cpus;
+    for (const auto& range : cpu_list.trimmed().split(',', QString::SkipEmptyParts))
+    {
+        const auto bounds = range.split('-');
+        bool first_ok = false, last_ok = false;
+        const auto first = bounds.first().toInt(&first_ok);
+        const auto last = bounds.last().toInt(&last_ok);
+        if (!first_ok || !last_ok)
+            continue;
+
+        for (auto cpu = first; cpu <= last; ++cpu)
+            cpus.push_back(cpu);
+    }
+
+    return cpus;
+}
+} // namespace
+
+mp::NumaPlacement::NumaPlacement(const QString& node_dir)
+{
+    QDir dir{node_dir};
+    for (const auto& entry : dir.entryList({"node*"}, QDir::Dirs | QDir::NoDotAndDotDot))
+    {
+        bool ok = false;
+        const auto id = entry.mid(4).toInt(&ok);
+        if (!ok)
+            continue;
+
+        QFile cpu_list{dir.filePath(entry + "/cpulist")};
+        if (!cpu_list.open(QIODevice::ReadOnly))
+            continue;
+
+        // Nodes with memory only have nowhere to run vCPUs
+        auto cpus = parse_cpu_list(QString::fromLatin1(cpu_list.readAll()));
+        if (!cpus.empty())
+            nodes.push_back({id, std::move(cpus), 0});
+    }
+
+    std::sort(nodes.begin(), nodes.end(), [](const Node& a, const Node& b) { return a.id < b.id; });
+}
+
+mp::optional<int> mp::NumaPlacement::place(const std::string& vm_name, int num_cores)
+{
+    std::lock_guard<decltype(placement_mutex)> lock{placement_mutex};
+
+    if (nodes.size() < 2)
+        return nullopt;
+
+    auto it = placements.find(vm_name);
+    if (it != placements.end())
+        return it->second.first;
+
+    // Compared as placed_cores / cpus, without dividing
+    auto node = std::min_element(nodes.begin(), nodes.end(), [](const Node& a, const Node& b) {
+        return static_cast<long long>(a.placed_cores) * static_cast<long long>(b.cpus.size()) <
+               static_cast<long long>(b.placed_cores) * static_cast<long long>(a.cpus.size());
+    });
+
+    node->placed_cores += num_cores;
+    placements[vm_name] = std::make_pair(node->id, num_cores);
+
+    return node->id;
+}
+
+void mp::NumaPlacement::place_on(const std::string& vm_name, int num_cores, int node_id)
+{
+    std::lock_guard<decltype(placement_mutex)> lock{placement_mutex};
+
+    if (placements.find(vm_name) != placements.end())
+        return;
+
+    auto node = std::find_if(nodes.begin(), nodes.end(), [node_id](const Node& n) { return n.id == node_id; });
+    if (node == nodes.end())
+        return;
+
+    node->placed_cores += num_cores;
+    placements[vm_name] = std::make_pair(node_id, num_cores);
+}
+
+void mp::NumaPlacement::release(const std::string& vm_name)
+{
+    std::lock_guard<decltype(placement_mutex)> lock{placement_mutex};
+
+    auto it = placements.find(vm_name);
+    if (it == placements.end())
+        return;
+
+    const auto node_id = it->second.first;
+    auto node = std::find_if(nodes.begin(), nodes.end(), [node_id](const Node& n) { return n.id == node_id; });
+    if (node != nodes.end())
+        node->placed_cores -= it->second.second;
+
+    placements.erase(it);
+}
+
+std::vector<int> mp::NumaPlacement::cpus_of(int node_id) const
+{
+    std::lock_guard<decltype(placement_mutex)> lock{placement_mutex};
+
+    auto node = std::find_if(nodes.begin(), nodes.end(), [node_id](const Node& n) { return n.id == node_id; });
+    return node == nodes.end() ? std::vector<int>{} : node->cpus;
+}
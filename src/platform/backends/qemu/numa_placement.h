@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_NUMA_PLACEMENT_H
+#define MULTIPASS_NUMA_PLACEMENT_H
+
+#include <multipass/optional.h>
+
+#include <QString>
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace multipass
+{
+// Spreads instances over the host's NUMA nodes, so that each keeps its vCPUs and its memory on a single node
+class NumaPlacement
+{
+public:
+    explicit NumaPlacement(const QString& node_dir = "/sys/devices/system/node");
+
+    // The node with the fewest vCPUs already placed on it for its size; none on a host with a single node
+    optional<int> place(const std::string& vm_name, int num_cores);
+    // For instances that come back already bound to a node, e.g. when resumed
+    void place_on(const std::string& vm_name, int num_cores, int node_id);
+    void release(const std::string& vm_name);
+
+    std::vector<int> cpus_of(int node_id) const;
+
+private:
+    struct Node
+    {
+        int id;
+        std::vector<int> cpus;
+        int placed_cores;
+    };
+
+    std::vector<Node> nodes;
+    std::unordered_map<std::string, std::pair<int, int>> placements; // node id and vCPUs, by instance
+    mutable std::mutex placement_mutex;
+};
+} // namespace multipass
+
+#endif // MULTIPASS_NUMA_PLACEMENT_H
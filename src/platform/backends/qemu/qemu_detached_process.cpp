@@ -0,0 +1,243 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "qemu_detached_process.h"
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QThread>
+
+#include <algorithm>
+#include <cerrno>
+
+#include <signal.h>
+
+namespace mp = multipass;
+
+namespace
+{
+// QEMU closes its monitors as it exits, so the process is only waited for a little after that
+constexpr auto exit_grace_ms = 1000;
+} // namespace
+
+mp::QemuDetachedProcess::QemuDetachedProcess(Process::UPtr launcher, const QString& qmp_socket_path,
+                                             const QString& pid_file_path)
+    : launcher{std::move(launcher)}, qmp_socket_path{qmp_socket_path}, pid_file_path{pid_file_path}
+{
+    QObject::connect(&qmp_socket, &QLocalSocket::readyRead, this, &Process::ready_read_standard_output);
+    QObject::connect(&qmp_socket, &QLocalSocket::disconnected, this, [this] { on_disconnected(); });
+}
+
+mp::QemuDetachedProcess::~QemuDetachedProcess()
+{
+    QObject::disconnect(&qmp_socket, nullptr, this, nullptr);
+}
+
+bool mp::QemuDetachedProcess::attach()
+{
+    if (!QFile::exists(qmp_socket_path) || !connect_to_qemu(exit_grace_ms))
+    {
+        qmp_socket.abort();
+        pid = 0;
+        return false;
+    }
+
+    attached = true;
+    return true;
+}
+
+QString mp::QemuDetachedProcess::program() const
+{
+    return launcher->program();
+}
+
+QStringList mp::QemuDetachedProcess::arguments() const
+{
+    return launcher->arguments();
+}
+
+QString mp::QemuDetachedProcess::working_directory() const
+{
+    return launcher->working_directory();
+}
+
+QProcessEnvironment mp::QemuDetachedProcess::process_environment() const
+{
+    return launcher->process_environment();
+}
+
+void mp::QemuDetachedProcess::start()
+{
+    pid = 0;
+    exited = false;
+    connection_error = nullopt;
+    QFile::remove(pid_file_path);
+
+    launcher->start();
+}
+
+void mp::QemuDetachedProcess::terminate()
+{
+    if (running())
+        ::kill(pid, SIGTERM);
+}
+
+void mp::QemuDetachedProcess::kill()
+{
+    if (running())
+        ::kill(pid, SIGKILL);
+}
+
+bool mp::QemuDetachedProcess::wait_for_started(int msecs)
+{
+    // QEMU only leaves the launcher to exit once it is set up, with its pid file written and its socket listening
+    QElapsedTimer timer;
+    timer.start();
+    if (!launcher->wait_for_finished(msecs) || !launcher->process_state().completed_successfully())
+        return false;
+
+    if (!connect_to_qemu(std::max<int>(msecs - timer.elapsed(), exit_grace_ms)))
+    {
+        connection_error = ProcessState::Error{QProcess::FailedToStart,
+                                               QString("cannot reach QEMU on %1: %2")
+                                                   .arg(qmp_socket_path, qmp_socket.errorString())};
+        kill();
+        return false;
+    }
+
+    emit started();
+    return true;
+}
+
+bool mp::QemuDetachedProcess::wait_for_finished(int msecs)
+{
+    if (!pid)
+        return false;
+
+    // Whatever QEMU says meanwhile is passed on, as it may be what leads to it exiting
+    QElapsedTimer timer;
+    timer.start();
+    while (!exited && !timer.hasExpired(msecs))
+    {
+        if (qmp_socket.state() == QLocalSocket::ConnectedState)
+            qmp_socket.waitForReadyRead(100);
+        else if (running())
+            QThread::msleep(10);
+        else
+            on_disconnected();
+    }
+
+    return exited;
+}
+
+bool mp::QemuDetachedProcess::running() const
+{
+    return pid > 0 && !exited && (::kill(pid, 0) == 0 || errno == EPERM);
+}
+
+qint64 mp::QemuDetachedProcess::process_id() const
+{
+    return running() ? pid : 0;
+}
+
+mp::ProcessState mp::QemuDetachedProcess::process_state() const
+{
+    if (connection_error)
+    {
+        ProcessState state;
+        state.error = connection_error;
+        return state;
+    }
+
+    if (!attached)
+    {
+        auto launched = launcher->process_state();
+        if (!launched.completed_successfully())
+            return launched;
+    }
+
+    // Not a child of ours, so how it exited is not known; it is reported as a clean exit
+    ProcessState state;
+    if (exited)
+        state.exit_code = 0;
+    return state;
+}
+
+QByteArray mp::QemuDetachedProcess::read_all_standard_output()
+{
+    return qmp_socket.readAll();
+}
+
+QByteArray mp::QemuDetachedProcess::read_all_standard_error()
+{
+    return launcher->read_all_standard_error();
+}
+
+qint64 mp::QemuDetachedProcess::write(const QByteArray& data)
+{
+    auto written = qmp_socket.write(data);
+    qmp_socket.flush();
+    return written;
+}
+
+void mp::QemuDetachedProcess::close_write_channel()
+{
+    // QMP stays open for as long as QEMU runs
+}
+
+mp::ProcessState mp::QemuDetachedProcess::execute(const int timeout)
+{
+    return launcher->execute(timeout);
+}
+
+void mp::QemuDetachedProcess::setup_child_process()
+{
+    // The launcher sets up, and confines, the QEMU it starts
+}
+
+bool mp::QemuDetachedProcess::connect_to_qemu(int msecs)
+{
+    QFile pid_file{pid_file_path};
+    if (!pid_file.open(QIODevice::ReadOnly))
+        return false;
+
+    pid = pid_file.readAll().trimmed().toLongLong();
+    if (!running())
+        return false;
+
+    qmp_socket.connectToServer(qmp_socket_path);
+    return qmp_socket.waitForConnected(msecs);
+}
+
+void mp::QemuDetachedProcess::on_disconnected()
+{
+    if (exited || !pid)
+        return;
+
+    QElapsedTimer timer;
+    timer.start();
+    while (running() && !timer.hasExpired(exit_grace_ms))
+        QThread::msleep(10);
+
+    if (running())
+        return; // QEMU went on without its monitor, which only happens when the socket was taken from it
+
+    exited = true;
+    QFile::remove(pid_file_path);
+    QFile::remove(qmp_socket_path);
+    emit finished(process_state());
+}
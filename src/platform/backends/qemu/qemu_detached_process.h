@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_QEMU_DETACHED_PROCESS_H
+#define MULTIPASS_QEMU_DETACHED_PROCESS_H
+
+#include <multipass/process.h>
+
+#include <QLocalSocket>
+
+namespace multipass
+{
+// A QEMU that daemonizes itself, and so outlives whoever started it. The launching process only lasts until QEMU is
+// set up; from then on, QMP goes over the instance's socket and the process is known by its pid file. Going away
+// does not take QEMU along, and a later daemon can attach to the same QEMU again
+class QemuDetachedProcess final : public Process
+{
+    Q_OBJECT
+public:
+    QemuDetachedProcess(Process::UPtr launcher, const QString& qmp_socket_path, const QString& pid_file_path);
+    ~QemuDetachedProcess(); // leaves QEMU running
+
+    // Takes up a QEMU left running by a previous daemon, without starting anything; false when there is none
+    bool attach();
+
+    QString program() const override;
+    QStringList arguments() const override;
+    QString working_directory() const override;
+    QProcessEnvironment process_environment() const override;
+
+    void start() override;
+    void terminate() override;
+    void kill() override;
+
+    bool wait_for_started(int msecs = 30000) override;
+    bool wait_for_finished(int msecs = 30000) override;
+
+    bool running() const override;
+    qint64 process_id() const override;
+    ProcessState process_state() const override;
+
+    QByteArray read_all_standard_output() override;
+    QByteArray read_all_standard_error() override;
+
+    qint64 write(const QByteArray& data) override;
+    void close_write_channel() override;
+
+    ProcessState execute(const int timeout = 30000) override;
+
+protected:
+    void setup_child_process() override;
+
+private:
+    bool connect_to_qemu(int msecs);
+    void on_disconnected();
+
+    const Process::UPtr launcher;
+    const QString qmp_socket_path;
+    const QString pid_file_path;
+    QLocalSocket qmp_socket;
+    qint64 pid{0};
+    bool attached{false}; // to a QEMU some other daemon started
+    bool exited{false};
+    multipass::optional<ProcessState::Error> connection_error;
+};
+} // namespace multipass
+
+#endif // MULTIPASS_QEMU_DETACHED_PROCESS_H
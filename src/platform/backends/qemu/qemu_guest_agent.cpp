@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "qemu_guest_agent.h"
+
+#include <multipass/format.h>
+
+#include <QElapsedTimer>
+#include <QJsonDocument>
+
+#include <limits>
+#include <random>
+#include <stdexcept>
+
+namespace mp = multipass;
+
+namespace
+{
+// The agent throws away whatever it was in the middle of parsing when it sees this byte, which it also puts before
+// its answer to guest-sync-delimited so that the answer can be told from leftovers
+constexpr char sync_delimiter = '\xff';
+} // namespace
+
+mp::QemuGuestAgent::QemuGuestAgent(const QString& socket_path, int timeout_ms) : timeout_ms{timeout_ms}
+{
+    socket.connectToServer(socket_path);
+    if (!socket.waitForConnected(timeout_ms))
+        throw std::runtime_error(
+            fmt::format("cannot connect to the guest agent on {}: {}", socket_path, socket.errorString()));
+
+    synchronise();
+}
+
+QJsonValue mp::QemuGuestAgent::execute(const QString& command, const QJsonObject& arguments)
+{
+    QJsonObject request{{"execute", command}};
+    if (!arguments.isEmpty())
+        request.insert("arguments", arguments);
+
+    socket.write(QJsonDocument(request).toJson(QJsonDocument::Compact) + '\n');
+    socket.flush();
+
+    const auto reply = read_reply();
+    if (reply.contains("error"))
+        throw std::runtime_error(fmt::format("the guest agent refused {}: {}", command,
+                                             reply["error"].toObject()["desc"].toString()));
+
+    return reply["return"];
+}
+
+void mp::QemuGuestAgent::synchronise()
+{
+    static thread_local std::mt19937 gen{std::random_device{}()};
+    const auto id = static_cast<qint64>(std::uniform_int_distribution<int>{1, std::numeric_limits<int>::max()}(gen));
+
+    QJsonObject request{{"execute", "guest-sync-delimited"}, {"arguments", QJsonObject{{"id", id}}}};
+    socket.write(QByteArray(1, sync_delimiter) + QJsonDocument(request).toJson(QJsonDocument::Compact) + '\n');
+    socket.flush();
+
+    QElapsedTimer timer;
+    timer.start();
+    while (!timer.hasExpired(timeout_ms))
+    {
+        const auto delimiter = pending_input.indexOf(sync_delimiter);
+        if (delimiter < 0)
+        {
+            pending_input.clear();
+            if (!socket.waitForReadyRead(timeout_ms - timer.elapsed()))
+                break;
+            pending_input = socket.readAll();
+            continue;
+        }
+
+        pending_input.remove(0, delimiter + 1);
+        if (read_reply()["return"].toVariant().toLongLong() == id)
+            return;
+    }
+
+    throw std::runtime_error("the guest agent does not answer");
+}
+
+QJsonObject mp::QemuGuestAgent::read_reply()
+{
+    QElapsedTimer timer;
+    timer.start();
+    for (;;)
+    {
+        const auto line_end = pending_input.indexOf('\n');
+        if (line_end >= 0)
+        {
+            const auto line = pending_input.left(line_end).trimmed();
+            pending_input.remove(0, line_end + 1);
+            if (!line.isEmpty())
+                return QJsonDocument::fromJson(line).object();
+            continue;
+        }
+
+        if (timer.hasExpired(timeout_ms) || !socket.waitForReadyRead(timeout_ms - timer.elapsed()))
+            throw std::runtime_error("the guest agent did not answer in time");
+        pending_input += socket.readAll();
+    }
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_QEMU_GUEST_AGENT_H
+#define MULTIPASS_QEMU_GUEST_AGENT_H
+
+#include <QByteArray>
+#include <QJsonObject>
+#include <QJsonValue>
+#include <QLocalSocket>
+#include <QString>
+
+namespace multipass
+{
+// Speaks to qemu-guest-agent over the socket QEMU serves its virtio-serial port on, blocking the calling thread for
+// up to the timeout on each command. The agent keeps no sessions, so whatever an earlier client left unread is
+// skipped by synchronising with it first
+class QemuGuestAgent
+{
+public:
+    QemuGuestAgent(const QString& socket_path, int timeout_ms = 2000);
+
+    // Throws std::runtime_error if the agent refused the command or did not answer in time
+    QJsonValue execute(const QString& command, const QJsonObject& arguments = {});
+
+private:
+    void synchronise();
+    QJsonObject read_reply();
+
+    const int timeout_ms;
+    QLocalSocket socket;
+    QByteArray pending_input;
+};
+} // namespace multipass
+
+#endif // MULTIPASS_QEMU_GUEST_AGENT_H
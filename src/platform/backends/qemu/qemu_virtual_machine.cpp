@@ -18,14 +18,25 @@
 #include "qemu_virtual_machine.h"
 
 #include "dnsmasq_server.h"
+#include "instance_cgroups.h"
+#include "ksm_policy.h"
+#include "netlink_route.h"
+#include "numa_placement.h"
+#include "qmp_client.h"
+#include "qemu_detached_process.h"
+#include "qemu_guest_agent.h"
 #include "qemu_vm_process_spec.h"
 #include "qemu_vmstate_process_spec.h"
 #include <shared/linux/backend_utils.h>
+#include <shared/linux/guest_agent.h>
 #include <shared/linux/process_factory.h>
 
+#include <multipass/constants.h>
+#include <multipass/exceptions/resize_exception.h>
 #include <multipass/exceptions/start_exception.h>
 #include <multipass/logging/log.h>
 #include <multipass/process.h>
+#include <multipass/settings.h>
 #include <multipass/ssh/ssh_session.h>
 #include <multipass/utils.h>
 #include <multipass/vm_status_monitor.h>
@@ -34,16 +45,22 @@
 
 #include <QCoreApplication>
 #include <QFile>
+#include <QFileInfo>
 #include <QHash>
 #include <QJsonArray>
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QProcess>
+#include <QRandomGenerator>
 #include <QString>
 #include <QStringList>
 #include <QSysInfo>
 #include <QTemporaryFile>
 
+#include <sched.h>
+
+#include <algorithm>
+#include <chrono>
 #include <thread>
 
 namespace mp = multipass;
@@ -54,6 +71,10 @@ namespace
 constexpr auto suspend_tag = "suspend";
 constexpr auto machine_type_key = "machine_type";
 constexpr auto arguments_key = "arguments";
+constexpr auto memory_state_channels = 4;
+constexpr auto balloon_path = "/machine/peripheral/balloon0";
+constexpr auto balloon_stats_interval_s = 10;
+constexpr auto image_stream_job = "image-stream";
 
 bool use_cdrom_set(const QJsonObject& metadata)
 {
@@ -84,8 +105,146 @@ QStringList get_arguments(const QJsonObject& metadata)
     return args;
 }
 
+// Laid out page by page in the file with mapped-ram, which leaves zero pages out and lets multifd channels write
+// side by side. Events are what tells when the migration is done
+QJsonObject memory_state_capabilities()
+{
+    QJsonArray capabilities;
+    for (const auto capability : {"events", "mapped-ram", "multifd"})
+        capabilities.append(QJsonObject{{"capability", capability}, {"state", true}});
+
+    return QJsonObject{{"capabilities", capabilities}};
+}
+
+// Memory templates' memory stays in its file, so only the devices' state goes through the migration
+QJsonObject memory_template_capabilities()
+{
+    QJsonArray capabilities;
+    for (const auto capability : {"events", "x-ignore-shared"})
+        capabilities.append(QJsonObject{{"capability", capability}, {"state", true}});
+
+    return QJsonObject{{"capabilities", capabilities}};
+}
+
+// Takes a guest started from a template's memory over from the template, whose hostname, MAC address, machine-id,
+// host keys and random state it has until then. The host's randomness on the standard input goes into the guest's
+// pool, and its boot seed, before any key is made. The network goes last, as the address leased to the new MAC is what
+// the daemon waits on, once the link is up again
+QString personalization_script(const mp::VirtualMachineDescription& desc)
+{
+    return QString(R"(set -e
+name='%1'
+mac='%2'
+umask 077
+cat > /var/lib/systemd/random-seed
+cat /var/lib/systemd/random-seed > /dev/urandom
+umask 022
+device=$(ls -d /sys/class/net/*/device | head -n 1)
+interface=$(basename "${device%/device}")
+old_mac=$(cat "/sys/class/net/$interface/address")
+old_name=$(hostname)
+hostnamectl set-hostname "$name"
+sed -i "s/\b$old_name\b/$name/g" /etc/hosts
+rm -f /etc/machine-id
+systemd-machine-id-setup > /dev/null
+rm -f /etc/ssh/ssh_host_*
+ssh-keygen -A > /dev/null
+systemctl restart ssh
+for config in /etc/netplan/*.yaml; do [ ! -e "$config" ] || sed -i "s/$old_mac/$mac/I" "$config"; done
+ip link set dev "$interface" address "$mac"
+netplan apply
+)")
+        .arg(QString::fromStdString(desc.vm_name), QString::fromStdString(desc.mac_addr));
+}
+
+QByteArray host_randomness()
+{
+    QByteArray randomness(512, '\0');
+    QRandomGenerator::system()->fillRange(reinterpret_cast<quint32*>(randomness.data()),
+                                          randomness.size() / sizeof(quint32));
+    return randomness;
+}
+
+QString partial_memory_state_file_for(const mp::VirtualMachineDescription& desc)
+{
+    return mp::QemuVMProcessSpec::memory_state_file_for(desc) + ".part";
+}
+
+// Taps created before multiqueue was used only take a single queue
+bool tap_is_multi_queue(const QString& tap_device_name)
+{
+    constexpr auto iff_multi_queue = 0x0100;
+
+    QFile flags_file{QString("/sys/class/net/%1/tun_flags").arg(tap_device_name)};
+    if (!flags_file.open(QIODevice::ReadOnly))
+        return false;
+
+    bool ok = false;
+    const auto flags = flags_file.readAll().trimmed().toInt(&ok, 16);
+    return ok && (flags & iff_multi_queue);
+}
+
+// Queues the tap is opened with by the arguments an instance was suspended with, which it has to be resumed with
+int network_queues_in(const QStringList& arguments)
+{
+    for (const auto& argument : arguments)
+    {
+        if (!argument.startsWith("tap,id=hostnet0"))
+            continue;
+
+        for (const auto& option : argument.split(','))
+            if (option.startsWith("queues="))
+                return std::max(option.mid(static_cast<int>(qstrlen("queues="))).toInt(), 1);
+    }
+
+    return 1;
+}
+
+// QEMU opens a multiqueue tap only when asked for more than one queue, and a single-queue one only when not, so a tap
+// left the other way round, by an earlier core count or by the factory, is made again on the same bridge
+void match_tap_to_network_queues(const QString& tap_device_name, int network_queues)
+{
+    const auto multi_queue = network_queues > 1;
+    if (tap_is_multi_queue(tap_device_name) == multi_queue)
+        return;
+
+    const auto bridge_name =
+        QFileInfo{QString("/sys/class/net/%1/master").arg(tap_device_name)}.symLinkTarget().section('/', -1);
+    if (bridge_name.isEmpty())
+        return;
+
+    mpl::log(mpl::Level::debug, "qemu",
+             fmt::format("remaking tap {} with {} queue(s)", tap_device_name, multi_queue ? "multiple" : "a single"));
+    auto& netlink = mp::NetlinkRoute::instance();
+    netlink.delete_link(tap_device_name);
+    if (netlink.add_tap(tap_device_name, multi_queue))
+        netlink.set_link(tap_device_name, bridge_name, /*up=*/true);
+}
+
+QString boot_profile_for(const mp::VirtualMachineDescription& desc)
+{
+    auto profile = mp::Settings::instance().get(mp::boot_profile_key);
+    if (profile == mp::firmware_boot_profile)
+        return profile;
+
+    // Images fetched before the kernel was asked for have none, so they keep booting through firmware
+    if (!QFile::exists(desc.image.kernel_path) || !QFile::exists(desc.image.initrd_path))
+    {
+        mpl::log(mpl::Level::info, desc.vm_name, "no kernel and initrd next to the image, booting through firmware");
+        return mp::firmware_boot_profile;
+    }
+
+    // The minimal machines are x86 ones
+    if (profile != mp::kernel_boot_profile && mp::backend::cpu_arch() != "x86_64")
+        return mp::kernel_boot_profile;
+
+    return profile;
+}
+
 auto make_qemu_process(const mp::VirtualMachineDescription& desc, const mp::optional<QJsonObject>& resume_metadata,
-                       const std::string& tap_device_name)
+                       const std::string& tap_device_name,
+                       const std::unordered_map<std::string, std::string>& native_mounts,
+                       const mp::optional<int>& numa_node, bool detached) -> mp::Process::UPtr
 {
     if (!QFile::exists(desc.image.image_path) || !QFile::exists(desc.cloud_init_iso))
     {
@@ -96,13 +255,32 @@ auto make_qemu_process(const mp::VirtualMachineDescription& desc, const mp::opti
     if (resume_metadata)
     {
         const auto& data = resume_metadata.value();
+        const auto memory_state_file = mp::QemuVMProcessSpec::memory_state_file_for(desc);
         resume_data = mp::QemuVMProcessSpec::ResumeData{suspend_tag, get_vm_machine(data), use_cdrom_set(data),
-                                                        get_arguments(data)};
+                                                        get_arguments(data),
+                                                        QFile::exists(memory_state_file) ? memory_state_file : ""};
     }
 
-    auto process_spec =
-        std::make_unique<mp::QemuVMProcessSpec>(desc, QString::fromStdString(tap_device_name), resume_data);
+    std::vector<mp::QemuVMProcessSpec::SharedDirectory> shared_directories;
+    for (const auto& mount : native_mounts)
+        shared_directories.push_back(
+            {QString::fromStdString(mount.second), mp::QemuVMProcessSpec::mount_tag_for(mount.first)});
+
+    const auto tap = QString::fromStdString(tap_device_name);
+    const auto network_queues = resume_data && !resume_data->arguments.isEmpty()
+                                    ? network_queues_in(resume_data->arguments)
+                                    : std::max(desc.num_cores, 1);
+    match_tap_to_network_queues(tap, network_queues);
+    const auto vhost_net = QFile::exists("/dev/vhost-net");
+    const auto mem_merge = mp::Settings::instance().get_as<bool>(mp::density_mode_key);
+    auto process_spec = std::make_unique<mp::QemuVMProcessSpec>(desc, tap, resume_data, shared_directories, numa_node,
+                                                                network_queues, vhost_net, boot_profile_for(desc),
+                                                                mem_merge, detached);
     auto process = mp::ProcessFactory::instance().create_process(std::move(process_spec));
+    if (detached)
+        process = std::make_unique<mp::QemuDetachedProcess>(std::move(process),
+                                                            mp::QemuVMProcessSpec::qmp_socket_for(desc),
+                                                            mp::QemuVMProcessSpec::pid_file_for(desc));
 
     mpl::log(mpl::Level::debug, desc.vm_name, fmt::format("process working dir '{}'", process->working_directory()));
     mpl::log(mpl::Level::info, desc.vm_name, fmt::format("process program '{}'", process->program()));
@@ -110,33 +288,69 @@ auto make_qemu_process(const mp::VirtualMachineDescription& desc, const mp::opti
     return process;
 }
 
-void remove_tap_device(const QString& tap_device_name)
+// The node an instance's memory was bound to when it was first started, which a resumed instance stays with
+mp::optional<int> bound_numa_node(const QStringList& arguments)
 {
-    if (mp::utils::run_cmd_for_status("ip", {"addr", "show", tap_device_name}))
+    for (const auto& argument : arguments)
     {
-        mp::utils::run_cmd_for_status("ip", {"link", "delete", tap_device_name});
+        const auto start = argument.indexOf("host-nodes=");
+        if (argument.startsWith("memory-backend-") && start >= 0)
+        {
+            bool ok = false;
+            const auto node = argument.mid(start + 11).section(',', 0, 0).toInt(&ok);
+            if (ok)
+                return node;
+        }
     }
+
+    return mp::nullopt;
 }
 
-auto qmp_execute_json(const QString& cmd)
+void pin_thread(int thread_id, const std::vector<int>& cpus)
 {
-    QJsonObject qmp;
-    qmp.insert("execute", cmd);
-    return QJsonDocument(qmp).toJson();
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    for (const auto cpu : cpus)
+        CPU_SET(cpu, &cpu_set);
+
+    sched_setaffinity(thread_id, sizeof(cpu_set), &cpu_set);
 }
 
-auto hmc_to_qmp_json(const QString& command_line)
+void remove_tap_device(const QString& tap_device_name)
 {
-    auto qmp = QJsonDocument::fromJson(qmp_execute_json("human-monitor-command")).object();
-
-    QJsonObject cmd_line;
-    cmd_line.insert("command-line", command_line);
+    auto& netlink = mp::NetlinkRoute::instance();
+    if (netlink.link_exists(tap_device_name))
+    {
+        netlink.delete_link(tap_device_name);
+    }
+}
 
-    qmp.insert("arguments", cmd_line);
+// What leaves the tap reaches the guest, so it is shaped on the way out, while what the guest sends is policed on
+// the way in, there being no queue to hold it back
+void shape_tap_traffic(const QString& tap_device_name, long long bytes_per_second)
+{
+    mp::utils::run_cmd_for_status("tc", {"qdisc", "del", "dev", tap_device_name, "root"});
+    mp::utils::run_cmd_for_status("tc", {"qdisc", "del", "dev", tap_device_name, "ingress"});
+    if (bytes_per_second <= 0)
+        return;
 
-    return QJsonDocument(qmp).toJson();
+    const auto rate = QString("%1bit").arg(bytes_per_second * 8);
+    const auto burst = QString::number(std::max(bytes_per_second / 10, 64LL * 1024)); // 100ms worth, at least 64KiB
+    const auto shaped = mp::utils::run_cmd_for_status("tc", {"qdisc", "add", "dev", tap_device_name, "root", "tbf",
+                                                             "rate", rate, "burst", burst, "latency", "50ms"});
+    const auto policed =
+        mp::utils::run_cmd_for_status("tc", {"qdisc", "add", "dev", tap_device_name, "handle", "ffff:", "ingress"}) &&
+        mp::utils::run_cmd_for_status("tc", {"filter", "add", "dev", tap_device_name, "parent", "ffff:", "matchall",
+                                             "action", "police", "rate", rate, "burst", burst, "drop"});
+    if (!shaped || !policed)
+        mpl::log(mpl::Level::warning, tap_device_name.toStdString(), "Cannot cap the network bandwidth");
 }
 
+// Linux onlines hot-added memory in blocks of this size
+constexpr auto hot_plug_memory_block = 128LL * 1024 * 1024;
+// Beyond it, whoever asked for a resize stops waiting and hears what the instance took on so far
+constexpr auto resize_timeout = std::chrono::minutes(5);
+
 bool instance_image_has_snapshot(const mp::Path& image_path)
 {
     auto process = mp::ProcessFactory::instance().create_process("qemu-img", QStringList{"snapshot", "-l", image_path});
@@ -195,26 +409,85 @@ auto generate_metadata(const QStringList& args)
 } // namespace
 
 mp::QemuVirtualMachine::QemuVirtualMachine(const VirtualMachineDescription& desc, const std::string& tap_device_name,
-                                           DNSMasqServer& dnsmasq_server, VMStatusMonitor& monitor)
-    : VirtualMachine{instance_image_has_snapshot(desc.image.image_path) ? State::suspended : State::off, desc.vm_name},
+                                           DNSMasqServer& dnsmasq_server, VMStatusMonitor& monitor,
+                                           NumaPlacement* numa_placement, KsmPolicy* ksm_policy,
+                                           InstanceCgroups* cgroups)
+    : VirtualMachine{QFile::exists(QemuVMProcessSpec::memory_state_file_for(desc)) ||
+                             instance_image_has_snapshot(desc.image.image_path)
+                         ? State::suspended
+                         : State::off,
+                     desc.vm_name},
       tap_device_name{tap_device_name},
       desc{desc},
+      guest_agent_socket{QemuVMProcessSpec::guest_agent_socket_for(desc)},
       mac_addr{desc.mac_addr},
       username{desc.ssh_username},
       dnsmasq_server{&dnsmasq_server},
-      monitor{&monitor}
+      monitor{&monitor},
+      numa_placement{numa_placement},
+      ksm_policy{ksm_policy},
+      cgroups{cgroups},
+      resource_class{desc.resource_class},
+      throttle{desc.throttle},
+      qmp{std::make_unique<QmpClient>([this](const QByteArray& data) { vm_process->write(data); },
+                                      [this](const QString& event, const QJsonObject& data) {
+                                          on_qmp_event(event, data);
+                                      })}
 {
     QObject::connect(this, &QemuVirtualMachine::on_delete_memory_snapshot, this,
                      [this] {
                          mpl::log(mpl::Level::debug, vm_name, fmt::format("Deleted memory snapshot"));
-                         vm_process->write(hmc_to_qmp_json("delvm " + QString::fromStdString(suspend_tag)));
+                         if (resuming_from_memory_state)
+                             QFile::remove(QemuVMProcessSpec::memory_state_file_for(this->desc));
+                         else
+                             qmp->human_monitor_command("delvm " + QString::fromStdString(suspend_tag));
                          delete_memory_snapshot = false;
+                         resuming_from_memory_state = false;
+                     },
+                     Qt::QueuedConnection);
+
+    // QMP is only spoken from the thread owning the process, whichever thread asks for the numbers
+    QObject::connect(this, &QemuVirtualMachine::on_refresh_hypervisor_stats, this,
+                     [this] { refresh_hypervisor_stats(); }, Qt::QueuedConnection);
+    QObject::connect(this, &QemuVirtualMachine::on_apply_disk_throttle, this, [this] { apply_disk_throttle(false); },
+                     Qt::QueuedConnection);
+    QObject::connect(this, &QemuVirtualMachine::on_resize, this, [this] { apply_resize(); }, Qt::QueuedConnection);
+    // A clone that cannot shed the template's identity would clash with the others, so it is not let on
+    QObject::connect(this, &QemuVirtualMachine::on_personalization_failed, this,
+                     [this](const QString& error) {
+                         saved_error_msg = error.toStdString();
+                         mpl::log(mpl::Level::error, vm_name, saved_error_msg);
+                         if (vm_process)
+                             vm_process->kill();
                      },
                      Qt::QueuedConnection);
+
+    // The template's guest had finished booting and opened both ports, which the clone finds open already
+    QObject::connect(this, &QemuVirtualMachine::on_personalized, this,
+                     [this] {
+                         qmp->execute("set_link", QJsonObject{{"name", "net0"}, {"up", true}});
+                         guest_agent_open = true;
+                         set_guest_ready(true);
+                     },
+                     Qt::QueuedConnection);
+
+    attach_to_detached_process();
 }
 
 mp::QemuVirtualMachine::~QemuVirtualMachine()
 {
+    if (personalization.valid())
+        personalization.wait();
+
+    // Left to run on, on the same tap device, for the next daemon to attach to
+    if (vm_process && detached && state == State::running && vm_process->running())
+    {
+        mpl::log(mpl::Level::info, vm_name, "Leaving the instance running");
+        update_shutdown_status = false;
+        vm_process.reset(nullptr);
+        return;
+    }
+
     if (vm_process)
     {
         update_shutdown_status = false;
@@ -242,18 +515,30 @@ void mp::QemuVirtualMachine::start()
     if (state == State::suspending)
         throw std::runtime_error("cannot start the instance while suspending");
 
+    if (resizing_image)
+        throw std::runtime_error("cannot start the instance while its disk is being grown");
+
     initialize_vm_process();
 
+    // Only the first start is from the template; the instance boots from its own disk after that
+    const auto template_dir = state == State::off ? desc.memory_template_dir : QString{};
+    desc.memory_template_dir.clear();
+
+    const auto memory_state_file = QemuVMProcessSpec::memory_state_file_for(desc);
     if (state == State::suspended)
     {
         mpl::log(mpl::Level::info, vm_name, fmt::format("Resuming from a suspended state"));
 
         update_shutdown_status = true;
         delete_memory_snapshot = true;
+        resuming_from_memory_state = QFile::exists(memory_state_file);
     }
     else
     {
-        monitor->update_metadata_for(vm_name, generate_metadata(vm_process->arguments()));
+        // Left over from a resume that did not go through, and no longer matching the disk
+        QFile::remove(memory_state_file);
+        monitor->update_metadata_for(vm_name, generate_metadata(QemuVMProcessSpec::without_memory_template(
+                                                  vm_process->arguments())));
     }
 
     vm_process->start();
@@ -276,7 +561,60 @@ void mp::QemuVirtualMachine::start()
         }
     }
 
-    vm_process->write(qmp_execute_json("qmp_capabilities"));
+    qmp->execute("qmp_capabilities");
+    pin_vcpus();
+    // Instances started before the balloon was added have none, and merely refuse this
+    qmp->execute("qom-set", QJsonObject{{"path", balloon_path},
+                                        {"property", "guest-stats-polling-interval"},
+                                        {"value", balloon_stats_interval_s}});
+
+    // An instance launched while its image was still downloading reads what it lacks from the image host, until the
+    // stream job has copied the rest in and made the disk whole. A restart picks up where the last one stopped
+    if (mp::utils::qcow2_backing_file(desc.image.image_path).startsWith("http"))
+        qmp->execute("block-stream", QJsonObject{{"job-id", image_stream_job}, {"device", "hda"}},
+                     [this](const QJsonValue&, const QString& error) {
+                         if (!error.isEmpty())
+                             mpl::log(mpl::Level::warning, vm_name,
+                                      fmt::format("Cannot stream in the rest of the image: {}", error));
+                     });
+
+    apply_disk_throttle(true);
+    apply_network_throttle();
+
+    if (resuming_from_memory_state)
+    {
+        qmp->execute("migrate-set-capabilities", memory_state_capabilities());
+        qmp->execute("migrate-set-parameters", QJsonObject{{"multifd-channels", memory_state_channels}});
+        qmp->execute("migrate-incoming", QJsonObject{{"uri", "file:" + memory_state_file}},
+                     [this](const QJsonValue&, const QString& error) {
+                         if (error.isEmpty())
+                             return;
+
+                         // There is no going on from an instance left waiting for its memory, nor from a state it
+                         // cannot load, which would otherwise be tried again on every start
+                         mpl::log(mpl::Level::error, vm_name, fmt::format("Cannot load the memory state: {}", error));
+                         QFile::remove(QemuVMProcessSpec::memory_state_file_for(desc));
+                         resuming_from_memory_state = false;
+                         vm_process->kill();
+                     });
+    }
+    else if (!template_dir.isEmpty())
+    {
+        mpl::log(mpl::Level::info, vm_name, "Starting from the memory template");
+        starting_from_template = true;
+        qmp->execute("migrate-set-capabilities", memory_template_capabilities());
+        qmp->execute("migrate-incoming",
+                     QJsonObject{{"uri", "file:" + QemuVMProcessSpec::template_state_file_in(template_dir)}},
+                     [this](const QJsonValue&, const QString& error) {
+                         if (error.isEmpty())
+                             return;
+
+                         mpl::log(mpl::Level::error, vm_name,
+                                  fmt::format("Cannot load the memory template: {}", error));
+                         starting_from_template = false;
+                         vm_process->kill();
+                     });
+    }
 }
 
 void mp::QemuVirtualMachine::stop()
@@ -293,7 +631,7 @@ void mp::QemuVirtualMachine::shutdown()
     else if ((state == State::running || state == State::delayed_shutdown || state == State::unknown) &&
              vm_process->running())
     {
-        vm_process->write(qmp_execute_json("system_powerdown"));
+        qmp->execute("system_powerdown");
         vm_process->wait_for_finished();
     }
     else
@@ -313,7 +651,7 @@ void mp::QemuVirtualMachine::suspend()
 {
     if ((state == State::running || state == State::delayed_shutdown) && vm_process->running())
     {
-        vm_process->write(hmc_to_qmp_json("savevm " + QString::fromStdString(suspend_tag)));
+        save_memory_state();
 
         if (update_shutdown_status)
         {
@@ -332,6 +670,52 @@ void mp::QemuVirtualMachine::suspend()
     }
 }
 
+std::string mp::QemuVirtualMachine::check_disk(int64_t bytes_per_second)
+{
+    return mp::backend::check_image(desc.image.image_path, bytes_per_second);
+}
+
+bool mp::QemuVirtualMachine::start_saving_for_exit()
+{
+    if ((state != State::running && state != State::delayed_shutdown) || !vm_process || !vm_process->running())
+        return false;
+
+    if (detached && state == State::running)
+        return false; // it runs on through the exit
+
+    // As on destruction, the recorded state is left alone and the process going away is no shutdown. The state turns
+    // to suspended once QEMU reports the memory saved
+    update_shutdown_status = false;
+    state = State::suspending;
+    save_memory_state();
+    return true;
+}
+
+bool mp::QemuVirtualMachine::save_memory_template()
+{
+    if (!desc.memory_template || state != State::running || !vm_process || !vm_process->running())
+        return false;
+
+    const auto state_file = QemuVMProcessSpec::template_state_file_in(QFileInfo{desc.image.image_path}.path());
+    QFile::remove(state_file);
+
+    // QEMU leaves the guest paused once its devices' state is saved, and the process is done with then
+    saving_memory_template = true;
+    qmp->execute("migrate-set-capabilities", memory_template_capabilities());
+    qmp->execute("migrate", QJsonObject{{"uri", "file:" + state_file + ".part"}},
+                 [this](const QJsonValue&, const QString& error) {
+                     if (error.isEmpty())
+                         return;
+
+                     mpl::log(mpl::Level::error, vm_name, fmt::format("Cannot save the memory template: {}", error));
+                     saving_memory_template = false;
+                     vm_process->kill();
+                 });
+    vm_process->wait_for_finished();
+
+    return QFile::exists(state_file);
+}
+
 mp::VirtualMachine::State mp::QemuVirtualMachine::current_state()
 {
     return state;
@@ -349,11 +733,71 @@ void mp::QemuVirtualMachine::update_state()
 
 void mp::QemuVirtualMachine::on_started()
 {
+    if (ksm_policy && mem_merge)
+        ksm_policy->instance_started(vm_name);
+    apply_resource_class(true);
+
+    set_guest_ready(false);
+    guest_agent_open = false;
     state = State::starting;
     update_state();
     monitor->on_resume();
 }
 
+void mp::QemuVirtualMachine::save_memory_state()
+{
+    // Migrating the memory to a file of its own is much quicker than savevm, which writes it into the qcow2 image and
+    // blocks while doing so. QEMU without mapped-ram refuses the capabilities, leaving the snapshot to do the job
+    auto fall_back = [this](const QString& error) { save_snapshot_instead(error); };
+
+    qmp->execute("migrate-set-capabilities", memory_state_capabilities(),
+                 [this, fall_back](const QJsonValue&, const QString& error) {
+                     if (!error.isEmpty())
+                         return fall_back(error);
+
+                     saving_memory_state = true;
+                     qmp->execute("migrate-set-parameters", QJsonObject{{"multifd-channels", memory_state_channels}});
+                     qmp->execute("migrate", QJsonObject{{"uri", "file:" + partial_memory_state_file_for(desc)}},
+                                  [fall_back](const QJsonValue&, const QString& error) {
+                                      if (!error.isEmpty())
+                                          fall_back(error);
+                                  });
+                 });
+}
+
+void mp::QemuVirtualMachine::save_snapshot_instead(const QString& reason)
+{
+    mpl::log(mpl::Level::debug, vm_name, fmt::format("Cannot save the memory state to a file: {}", reason));
+    saving_memory_state = false;
+    // A state left from the last resume would be taken over the snapshot on the next one
+    QFile::remove(partial_memory_state_file_for(desc));
+    QFile::remove(QemuVMProcessSpec::memory_state_file_for(desc));
+    qmp->human_monitor_command("savevm " + QString::fromStdString(suspend_tag));
+}
+
+void mp::QemuVirtualMachine::pin_vcpus()
+{
+    if (!numa_node || !numa_placement)
+        return;
+
+    const auto cpus = numa_placement->cpus_of(*numa_node);
+    if (cpus.empty())
+        return;
+
+    qmp->execute("query-cpus-fast", {}, [this, cpus](const QJsonValue& result, const QString& error) {
+        if (!error.isEmpty())
+        {
+            mpl::log(mpl::Level::debug, vm_name, fmt::format("Cannot pin the vCPUs: {}", error));
+            return;
+        }
+
+        for (const auto& cpu : result.toArray())
+            pin_thread(cpu.toObject()["thread-id"].toInt(), cpus);
+
+        mpl::log(mpl::Level::debug, vm_name, fmt::format("vCPUs pinned to NUMA node {}", *numa_node));
+    });
+}
+
 void mp::QemuVirtualMachine::on_error()
 {
     state = State::off;
@@ -376,20 +820,30 @@ void mp::QemuVirtualMachine::on_shutdown()
     }
 
     ip = nullopt;
+    guest_agent_open = false;
     update_state();
     vm_process.reset(nullptr);
     lock.unlock();
+    if (ksm_policy)
+        ksm_policy->instance_stopped(vm_name);
+    if (cgroups)
+        cgroups->release(vm_name);
     monitor->on_shutdown();
 }
 
 void mp::QemuVirtualMachine::on_suspend()
 {
+    if (ksm_policy)
+        ksm_policy->instance_stopped(vm_name);
+
     state = State::suspended;
     monitor->on_suspend();
 }
 
 void mp::QemuVirtualMachine::on_restart()
 {
+    set_guest_ready(false);
+    guest_agent_open = false;
     state = State::restarting;
     update_state();
 
@@ -411,25 +865,68 @@ void mp::QemuVirtualMachine::ensure_vm_is_running()
     }
 }
 
+bool mp::QemuVirtualMachine::wait_for_guest_ready(std::chrono::milliseconds timeout)
+{
+    using namespace std::literals::chrono_literals;
+
+    if (!has_guest_ready_port)
+        return false;
+
+    // Sliced only to notice the VM going down
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (true)
+    {
+        ensure_vm_is_running();
+
+        std::unique_lock<decltype(guest_ready_mutex)> lock{guest_ready_mutex};
+        if (guest_ready)
+            return true;
+
+        const auto now = std::chrono::steady_clock::now();
+        if (now >= deadline)
+            throw std::runtime_error("timed out waiting for initialization to complete");
+
+        const auto slice = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now);
+        guest_ready_changed.wait_for(lock, std::min<std::chrono::milliseconds>(1s, slice),
+                                     [this] { return guest_ready; });
+    }
+}
+
+void mp::QemuVirtualMachine::set_guest_ready(bool ready)
+{
+    {
+        std::lock_guard<decltype(guest_ready_mutex)> lock{guest_ready_mutex};
+        guest_ready = ready;
+    }
+    guest_ready_changed.notify_all();
+}
+
 std::string mp::QemuVirtualMachine::ssh_hostname()
 {
+    using namespace std::literals::chrono_literals;
+
+    // A reserved address is known before the guest asks for it, so ssh can be probed as soon as the network is up
     if (!ip)
     {
-        auto action = [this] {
-            ensure_vm_is_running();
-            auto result = dnsmasq_server->get_ip_for(mac_addr);
-            if (result)
-            {
-                ip.emplace(result.value());
-                return mp::utils::TimeoutAction::done;
-            }
-            else
-            {
-                return mp::utils::TimeoutAction::retry;
-            }
-        };
-        auto on_timeout = [] { throw std::runtime_error("failed to determine IP address"); };
-        mp::utils::try_action_for(on_timeout, std::chrono::minutes(2), action);
+        auto reserved = dnsmasq_server->reserved_ip_for(mac_addr);
+        if (reserved)
+            ip.emplace(reserved.value());
+    }
+
+    // Otherwise the wait ends as soon as dnsmasq leases the address; it is only sliced to notice the VM going down
+    const auto deadline = std::chrono::steady_clock::now() + 2min;
+    while (!ip)
+    {
+        ensure_vm_is_running();
+
+        const auto now = std::chrono::steady_clock::now();
+        if (now >= deadline)
+            throw std::runtime_error("failed to determine IP address");
+
+        const auto slice = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now);
+        auto result = dnsmasq_server->wait_for_ip(mac_addr, std::min<std::chrono::milliseconds>(1s, slice));
+        if (result)
+            ip.emplace(result.value());
     }
 
     return ip.value().as_string();
@@ -471,9 +968,75 @@ void mp::QemuVirtualMachine::wait_until_ssh_up(std::chrono::milliseconds timeout
 
 void mp::QemuVirtualMachine::initialize_vm_process()
 {
+    qmp->reset("the instance process was replaced");
+    hot_plugged_arguments.clear();
+
+    const auto resuming = state == State::suspended;
+    numa_node = numa_placement && !resuming ? numa_placement->place(vm_name, desc.num_cores) : mp::nullopt;
+    detached = mp::Settings::instance().get_as<bool>(mp::keep_running_key);
     vm_process = make_qemu_process(
-        desc, ((state == State::suspended) ? mp::make_optional(monitor->retrieve_metadata_for(vm_name)) : mp::nullopt),
-        tap_device_name);
+        desc, resuming ? mp::make_optional(monitor->retrieve_metadata_for(vm_name)) : mp::nullopt, tap_device_name,
+        native_mounts, numa_node, detached);
+
+    if (numa_placement && resuming)
+    {
+        numa_node = bound_numa_node(vm_process->arguments());
+        if (numa_node)
+            numa_placement->place_on(vm_name, desc.num_cores, *numa_node);
+    }
+
+    connect_vm_process();
+}
+
+void mp::QemuVirtualMachine::attach_to_detached_process()
+{
+    const auto pid_file = QemuVMProcessSpec::pid_file_for(desc);
+    if (!QFile::exists(pid_file))
+        return;
+
+    // Never started; it only stands for the arguments the running QEMU was given
+    const auto arguments = get_arguments(monitor->retrieve_metadata_for(vm_name));
+    auto launcher = mp::ProcessFactory::instance().create_process("qemu-system-" + mp::backend::cpu_arch(), arguments);
+    auto process = std::make_unique<QemuDetachedProcess>(std::move(launcher), QemuVMProcessSpec::qmp_socket_for(desc),
+                                                         pid_file);
+    if (!process->attach())
+    {
+        // Whatever QEMU left these behind is gone, and the instance is taken to be wherever its files say
+        QFile::remove(pid_file);
+        QFile::remove(QemuVMProcessSpec::qmp_socket_for(desc));
+        return;
+    }
+
+    mpl::log(mpl::Level::info, vm_name, "Attached to the instance left running by the previous daemon");
+    vm_process = std::move(process);
+    detached = true;
+    numa_node = bound_numa_node(vm_process->arguments());
+    if (numa_placement && numa_node)
+        numa_placement->place_on(vm_name, desc.num_cores, *numa_node);
+    connect_vm_process();
+
+    qmp->execute("qmp_capabilities");
+    state = State::running;
+    set_guest_ready(true);
+    // The guest opened its agent's port before we were around to hear of it, so QEMU is asked where it stands
+    qmp->execute("query-chardev", {}, [this](const QJsonValue& result, const QString& error) {
+        if (!error.isEmpty())
+            return;
+
+        for (const auto& chardev : result.toArray())
+            if (chardev.toObject()["label"].toString() == QemuVMProcessSpec::guest_agent_port_id)
+                guest_agent_open = chardev.toObject()["frontend-open"].toBool();
+    });
+    if (ksm_policy && mem_merge)
+        ksm_policy->instance_started(vm_name);
+    apply_resource_class(true);
+}
+
+void mp::QemuVirtualMachine::connect_vm_process()
+{
+    has_guest_ready_port =
+        !vm_process->arguments().filter(QString("id=%1,").arg(QemuVMProcessSpec::guest_ready_port_id)).isEmpty();
+    mem_merge = !vm_process->arguments().contains("mem-merge=off");
 
     QObject::connect(vm_process.get(), &Process::started, [this]() {
         mpl::log(mpl::Level::info, vm_name, "process started");
@@ -483,38 +1046,7 @@ void mp::QemuVirtualMachine::initialize_vm_process()
     QObject::connect(vm_process.get(), &Process::ready_read_standard_output, [this]() {
         auto qmp_output = vm_process->read_all_standard_output();
         mpl::log(mpl::Level::debug, vm_name, fmt::format("QMP: {}", qmp_output));
-        auto qmp_object = QJsonDocument::fromJson(qmp_output.split('\n').first()).object();
-        auto event = qmp_object["event"];
-
-        if (!event.isNull())
-        {
-            if (event.toString() == "RESET" && state != State::restarting)
-            {
-                mpl::log(mpl::Level::info, vm_name, "VM restarting");
-                on_restart();
-            }
-            else if (event.toString() == "POWERDOWN")
-            {
-                mpl::log(mpl::Level::info, vm_name, "VM powering down");
-            }
-            else if (event.toString() == "SHUTDOWN")
-            {
-                mpl::log(mpl::Level::info, vm_name, "VM shut down");
-            }
-            else if (event.toString() == "STOP")
-            {
-                mpl::log(mpl::Level::info, vm_name, "VM suspending");
-            }
-            else if (event.toString() == "RESUME")
-            {
-                mpl::log(mpl::Level::info, vm_name, "VM suspended");
-                if (state == State::suspending || state == State::running)
-                {
-                    vm_process->kill();
-                    on_suspend();
-                }
-            }
-        }
+        qmp->feed(qmp_output);
     });
 
     QObject::connect(vm_process.get(), &Process::ready_read_standard_error, [this]() {
@@ -565,3 +1097,533 @@ void mp::QemuVirtualMachine::initialize_vm_process()
         }
     });
 }
+
+void mp::QemuVirtualMachine::on_qmp_event(const QString& event, const QJsonObject& data)
+{
+    if (event == "VSERPORT_CHANGE" && data["id"].toString() == QemuVMProcessSpec::guest_ready_port_id &&
+        data["open"].toBool())
+    {
+        mpl::log(mpl::Level::info, vm_name, "Guest reported it finished booting");
+        set_guest_ready(true);
+    }
+    else if (event == "VSERPORT_CHANGE" && data["id"].toString() == QemuVMProcessSpec::guest_agent_port_id)
+    {
+        mpl::log(mpl::Level::debug, vm_name,
+                 fmt::format("Guest agent {}", data["open"].toBool() ? "started" : "went away"));
+        guest_agent_open = data["open"].toBool();
+    }
+    else if (event == "RESET" && state != State::restarting)
+    {
+        mpl::log(mpl::Level::info, vm_name, "VM restarting");
+        on_restart();
+    }
+    else if (event == "POWERDOWN")
+    {
+        mpl::log(mpl::Level::info, vm_name, "VM powering down");
+    }
+    else if (event == "SHUTDOWN")
+    {
+        mpl::log(mpl::Level::info, vm_name, "VM shut down");
+    }
+    else if (event == "STOP")
+    {
+        mpl::log(mpl::Level::info, vm_name, "VM suspending");
+    }
+    else if (event == "MIGRATION" && saving_memory_template)
+    {
+        const auto status = data["status"].toString();
+        if (status == "completed" || status == "failed")
+        {
+            const auto state_file = QemuVMProcessSpec::template_state_file_in(QFileInfo{desc.image.image_path}.path());
+            if (status == "completed")
+                QFile::rename(state_file + ".part", state_file);
+            else
+                QFile::remove(state_file + ".part");
+
+            mpl::log(mpl::Level::info, vm_name,
+                     fmt::format("Memory template {}", status == "completed" ? "saved" : "not saved"));
+            saving_memory_template = false;
+            vm_process->kill();
+        }
+    }
+    else if (event == "MIGRATION" && starting_from_template)
+    {
+        const auto status = data["status"].toString();
+        if (status == "completed")
+        {
+            // Off the bridge until it has a MAC of its own, as the template's is in every clone
+            starting_from_template = false;
+            qmp->execute("set_link", QJsonObject{{"name", "net0"}, {"up", false}});
+            qmp->execute("cont");
+            personalization = std::async(std::launch::async, [this] { personalize_clone(); });
+        }
+        else if (status == "failed")
+        {
+            mpl::log(mpl::Level::error, vm_name, "Cannot load the memory template");
+            starting_from_template = false;
+            vm_process->kill();
+        }
+    }
+    else if (event == "MIGRATION" && saving_memory_state)
+    {
+        const auto status = data["status"].toString();
+        if (status == "completed" && (state == State::suspending || state == State::running))
+        {
+            // Only a complete state takes the name it is resumed from
+            const auto memory_state_file = QemuVMProcessSpec::memory_state_file_for(desc);
+            QFile::remove(memory_state_file);
+            QFile::rename(partial_memory_state_file_for(desc), memory_state_file);
+
+            mpl::log(mpl::Level::info, vm_name, "VM suspended");
+            saving_memory_state = false;
+            vm_process->kill();
+            on_suspend();
+        }
+        else if (status == "failed")
+        {
+            save_snapshot_instead("the migration failed");
+        }
+    }
+    else if (event == "BLOCK_JOB_COMPLETED" && data["device"].toString() == image_stream_job)
+    {
+        if (data.contains("error"))
+            mpl::log(mpl::Level::warning, vm_name,
+                     fmt::format("Streaming in the image stopped: {}", data["error"].toString()));
+        else
+            mpl::log(mpl::Level::info, vm_name, "The instance image no longer needs the image host");
+    }
+    else if (event == "RESUME")
+    {
+        mpl::log(mpl::Level::info, vm_name, "VM suspended");
+        if (state == State::suspending || state == State::running)
+        {
+            vm_process->kill();
+            on_suspend();
+        }
+    }
+}
+
+std::unordered_map<std::string, std::string> mp::QemuVirtualMachine::hypervisor_stats()
+{
+    emit on_refresh_hypervisor_stats();
+
+    std::unordered_map<std::string, std::string> stats;
+    {
+        std::lock_guard<decltype(hypervisor_stats_mutex)> lock{hypervisor_stats_mutex};
+        stats = qmp_stats;
+    }
+
+    // The tap device sees the guest's traffic from the host's side, so what it sends the guest receives
+    const auto counters = {std::make_pair("tx_bytes", "network_received_bytes"),
+                           std::make_pair("rx_bytes", "network_sent_bytes")};
+    for (const auto& counter : counters)
+    {
+        QFile counter_file{
+            QString("/sys/class/net/%1/statistics/%2").arg(QString::fromStdString(tap_device_name), counter.first)};
+        if (counter_file.open(QIODevice::ReadOnly))
+            stats[counter.second] = counter_file.readAll().trimmed().toStdString();
+    }
+
+    return stats;
+}
+
+std::unordered_map<std::string, std::string> mp::QemuVirtualMachine::guest_stats()
+{
+    if (!guest_agent_open)
+        return {};
+
+    std::lock_guard<decltype(guest_agent_mutex)> lock{guest_agent_mutex};
+    try
+    {
+        QemuGuestAgent agent{guest_agent_socket};
+        return backend::guest_agent_stats([&agent](const QString& command, const QJsonObject& arguments) {
+            return agent.execute(command, arguments);
+        });
+    }
+    catch (const std::exception& e)
+    {
+        mpl::log(mpl::Level::debug, vm_name, fmt::format("Cannot get stats from the guest agent: {}", e.what()));
+        return {};
+    }
+}
+
+void mp::QemuVirtualMachine::personalize_clone()
+{
+    using namespace std::literals::chrono_literals;
+
+    try
+    {
+        std::lock_guard<decltype(guest_agent_mutex)> lock{guest_agent_mutex};
+        QemuGuestAgent agent{guest_agent_socket};
+        auto execute = [&agent](const QString& command, const QJsonObject& arguments) {
+            return agent.execute(command, arguments);
+        };
+
+        execute("guest-set-time", {}); // from the hardware clock, as the guest's stood still since the template's save
+        backend::run_in_guest(execute, personalization_script(desc), 1min, host_randomness());
+    }
+    catch (const std::exception& e)
+    {
+        emit on_personalization_failed(
+            QString::fromStdString(fmt::format("Cannot take the instance over from its template: {}", e.what())));
+        return;
+    }
+
+    mpl::log(mpl::Level::info, vm_name, "Took the instance over from its template");
+    emit on_personalized();
+}
+
+void mp::QemuVirtualMachine::refresh_hypervisor_stats()
+{
+    if (!vm_process || !vm_process->running())
+        return;
+
+    qmp->execute("query-status", {}, [this](const QJsonValue& result, const QString& error) {
+        if (!error.isEmpty())
+            return;
+
+        std::lock_guard<decltype(hypervisor_stats_mutex)> lock{hypervisor_stats_mutex};
+        qmp_stats["status"] = result.toObject()["status"].toString().toStdString();
+    });
+
+    qmp->execute("query-blockstats", {}, [this](const QJsonValue& result, const QString& error) {
+        if (!error.isEmpty())
+        {
+            mpl::log(mpl::Level::debug, vm_name, fmt::format("Cannot query block statistics: {}", error));
+            return;
+        }
+
+        qint64 read_bytes{0}, written_bytes{0};
+        for (const auto& device : result.toArray())
+        {
+            auto device_stats = device.toObject()["stats"].toObject();
+            read_bytes += device_stats["rd_bytes"].toVariant().toLongLong();
+            written_bytes += device_stats["wr_bytes"].toVariant().toLongLong();
+        }
+
+        std::lock_guard<decltype(hypervisor_stats_mutex)> lock{hypervisor_stats_mutex};
+        qmp_stats["disk_read_bytes"] = std::to_string(read_bytes);
+        qmp_stats["disk_written_bytes"] = std::to_string(written_bytes);
+    });
+
+    // What the guest itself reports through the balloon, i.e. how much of its memory it could do without
+    qmp->execute("qom-get", QJsonObject{{"path", balloon_path}, {"property", "guest-stats"}},
+                 [this](const QJsonValue& result, const QString& error) {
+                     if (!error.isEmpty())
+                         return;
+
+                     const auto guest_stats = result.toObject()["stats"].toObject();
+                     const auto available = guest_stats["stat-available-memory"].toVariant().toLongLong();
+                     const auto free = guest_stats["stat-free-memory"].toVariant().toLongLong();
+                     if (available <= 0 && free <= 0) // -1 until the guest reported at least once
+                         return;
+
+                     std::lock_guard<decltype(hypervisor_stats_mutex)> lock{hypervisor_stats_mutex};
+                     qmp_stats["memory_available_bytes"] = std::to_string(available);
+                     qmp_stats["memory_free_bytes"] = std::to_string(free);
+                 });
+}
+
+void mp::QemuVirtualMachine::set_resource_class(const std::string& resource_class)
+{
+    {
+        std::lock_guard<decltype(resource_class_mutex)> lock{resource_class_mutex};
+        this->resource_class = resource_class;
+    }
+
+    apply_resource_class(false);
+}
+
+void mp::QemuVirtualMachine::apply_resource_class(bool placing)
+{
+    if (!cgroups)
+        return;
+
+    std::lock_guard<decltype(resource_class_mutex)> lock{resource_class_mutex};
+    const auto limits = InstanceCgroups::limits_for(resource_class, desc.num_cores, desc.mem_size,
+                                                    InstanceCgroups::disk_of(desc.image.image_path));
+    if (placing)
+        cgroups->place(vm_name, vm_process->process_id(), limits);
+    else
+        cgroups->apply(vm_name, limits); // takes effect the next time it starts otherwise
+}
+
+void mp::QemuVirtualMachine::set_throttle(const InstanceThrottle& throttle)
+{
+    {
+        std::lock_guard<decltype(throttle_mutex)> lock{throttle_mutex};
+        this->throttle = throttle;
+    }
+
+    apply_network_throttle();
+    emit on_apply_disk_throttle();
+}
+
+void mp::QemuVirtualMachine::apply_disk_throttle(bool starting)
+{
+    if (!vm_process || !vm_process->running())
+        return;
+
+    QJsonObject arguments{{"device", "hda"}, {"bps_rd", 0}, {"bps_wr", 0}, {"iops_rd", 0}, {"iops_wr", 0}};
+    {
+        std::lock_guard<decltype(throttle_mutex)> lock{throttle_mutex};
+        if (starting && throttle.disk_iops <= 0 && throttle.disk_bytes_per_second <= 0)
+            return; // a new process has no caps to lift
+        arguments["iops"] = throttle.disk_iops;
+        arguments["bps"] = throttle.disk_bytes_per_second;
+    }
+
+    qmp->execute("block_set_io_throttle", arguments, [this](const QJsonValue&, const QString& error) {
+        if (!error.isEmpty())
+            mpl::log(mpl::Level::warning, vm_name, fmt::format("Cannot cap the disk: {}", error));
+    });
+}
+
+void mp::QemuVirtualMachine::apply_network_throttle()
+{
+    long long bytes_per_second;
+    {
+        std::lock_guard<decltype(throttle_mutex)> lock{throttle_mutex};
+        bytes_per_second = throttle.network_bytes_per_second;
+        if (bytes_per_second <= 0 && !tap_shaped)
+            return;
+        tap_shaped = bytes_per_second > 0;
+    }
+
+    // The tap outlives the process, and so do its queues
+    shape_tap_traffic(QString::fromStdString(tap_device_name), bytes_per_second);
+}
+
+void mp::QemuVirtualMachine::resize(int num_cores, const MemorySize& mem_size, const MemorySize& disk_space)
+{
+    std::lock_guard<decltype(resize_mutex)> lock{resize_mutex};
+    pending_resize = std::make_shared<PendingResize>();
+    pending_resize->num_cores = num_cores;
+    pending_resize->mem_size = mem_size;
+    pending_resize->disk_space = disk_space;
+
+    // QMP is only spoken from the thread owning the process, so this has to be called from another one
+    auto resize = pending_resize;
+    auto done = resize->done.get_future();
+    emit on_resize();
+
+    std::string errors = "the instance did not finish resizing in time";
+    if (done.wait_for(resize_timeout) == std::future_status::ready)
+        errors = done.get();
+    if (errors.empty())
+        return;
+
+    // Some of it may have gone through, which the caller has to account for
+    std::lock_guard<std::mutex> progress_lock{resize->progress_mutex};
+    resize->abandoned = true;
+    if (!resize->begun)
+        throw std::runtime_error(errors);
+    throw ResizeException{errors, resize->taken_num_cores, resize->taken_mem_size, resize->taken_disk_space};
+}
+
+void mp::QemuVirtualMachine::note_resize_progress(const std::shared_ptr<PendingResize>& resize)
+{
+    std::lock_guard<std::mutex> lock{resize->progress_mutex};
+    resize->begun = true;
+    resize->taken_num_cores = desc.num_cores;
+    resize->taken_mem_size = desc.mem_size;
+    resize->taken_disk_space = desc.disk_space;
+}
+
+void mp::QemuVirtualMachine::apply_resize()
+{
+    auto resize = pending_resize;
+    if (state == State::suspended || state == State::suspending)
+        return resize->done.set_value("cannot resize a suspended instance");
+
+    note_resize_progress(resize);
+
+    // A stopped instance only needs a bigger image, and starts with the rest
+    if (!vm_process || !vm_process->running())
+    {
+        auto take_on = [this, resize](const std::string& error) {
+            resizing_image = false;
+            if (!error.empty())
+                return resize->done.set_value(error);
+
+            desc.num_cores = resize->num_cores;
+            desc.mem_size = resize->mem_size;
+            desc.disk_space = resize->disk_space;
+            note_resize_progress(resize);
+            apply_resource_class(false);
+            resize->done.set_value("");
+        };
+
+        if (resize->disk_space <= desc.disk_space)
+            return take_on("");
+
+        // Growing the image is left to a thread of its own, the instance's being the daemon's too
+        resizing_image = true;
+        return mp::backend::resize_instance_image_async(resize->disk_space, desc.image.image_path, this, take_on);
+    }
+
+    const auto arguments = vm_process->arguments() + hot_plugged_arguments;
+    const auto added_memory = resize->mem_size.in_bytes() - desc.mem_size.in_bytes();
+    const auto dimms = arguments.filter("pc-dimm,").size();
+    if ((added_memory > 0 || resize->num_cores > desc.num_cores) && arguments.filter(",maxcpus=").isEmpty())
+        return resize->done.set_value("this instance cannot take more CPUs or memory while it runs, stop it first");
+    if (added_memory % hot_plug_memory_block != 0)
+        return resize->done.set_value("memory can only grow by multiples of 128MiB while the instance runs");
+    if (added_memory > 0 && dimms >= QemuVMProcessSpec::memory_slots)
+        return resize->done.set_value("no memory slots are left for this instance while it runs, stop it first");
+
+    resize->outstanding_commands = 1; // until every command below is sent
+
+    if (resize->disk_space > desc.disk_space)
+    {
+        ++resize->outstanding_commands;
+        const auto disk_space = resize->disk_space;
+        qmp->execute("block_resize", QJsonObject{{"device", "hda"}, {"size", disk_space.in_bytes()}},
+                     [this, resize, disk_space](const QJsonValue&, const QString& error) {
+                         if (error.isEmpty())
+                             desc.disk_space = disk_space;
+                         finish_resize_command(resize, error.isEmpty() ? error : "Cannot grow the disk: " + error);
+                     });
+    }
+
+    // Memory comes in a DIMM of its own, backed like the boot memory is
+    if (added_memory > 0)
+    {
+        const auto id = QString::number(dimms);
+        const auto backend_type = desc.hugepages ? "memory-backend-file" : "memory-backend-ram";
+        QJsonObject backend{{"qom-type", backend_type}, {"id", "mem" + id}, {"size", added_memory}};
+        auto backend_argument =
+            QString("%1,id=mem%2,size=%3M").arg(backend_type, id).arg(added_memory / (1024 * 1024));
+        if (desc.hugepages)
+        {
+            backend["mem-path"] = "/dev/hugepages";
+            backend["prealloc"] = true;
+            backend_argument += ",mem-path=/dev/hugepages,prealloc=on";
+        }
+        if (numa_node)
+        {
+            backend["host-nodes"] = QJsonArray{*numa_node};
+            backend["policy"] = "bind";
+            backend_argument += QString(",host-nodes=%1,policy=bind").arg(*numa_node);
+        }
+
+        ++resize->outstanding_commands;
+        const auto dimm = QJsonObject{{"driver", "pc-dimm"}, {"id", "dimm" + id}, {"memdev", "mem" + id}};
+        const auto new_arguments = QStringList{"-object", backend_argument, "-device",
+                                               QString("pc-dimm,id=dimm%1,memdev=mem%1").arg(id)};
+        const auto mem_size = resize->mem_size;
+        auto on_dimm_added = [this, resize, new_arguments, mem_size](const QJsonValue&, const QString& error) {
+            if (error.isEmpty())
+            {
+                desc.mem_size = mem_size;
+                hot_plugged_arguments << new_arguments;
+                resize->arguments << new_arguments;
+            }
+            finish_resize_command(resize, error.isEmpty() ? error : "Cannot add memory: " + error);
+        };
+        qmp->execute("object-add", backend,
+                     [this, resize, dimm, on_dimm_added](const QJsonValue&, const QString& error) {
+                         if (!error.isEmpty())
+                             return finish_resize_command(resize, "Cannot add memory: " + error);
+                         qmp->execute("device_add", dimm, on_dimm_added);
+                     });
+    }
+
+    // vCPUs go into the slots -smp left empty, lowest first
+    if (resize->num_cores > desc.num_cores)
+    {
+        ++resize->outstanding_commands;
+        qmp->execute("query-hotpluggable-cpus", {}, [this, resize](const QJsonValue& result, const QString& error) {
+            if (!error.isEmpty())
+                return finish_resize_command(resize, "Cannot add CPUs: " + error);
+
+            const auto slots = result.toArray();
+            auto missing = resize->num_cores - desc.num_cores;
+            auto next_id = (vm_process->arguments() + hot_plugged_arguments).filter(",id=hotcpu").size();
+            for (auto it = slots.end(); it != slots.begin() && missing > 0;)
+            {
+                const auto slot = (*--it).toObject();
+                if (slot.contains("qom-path"))
+                    continue; // plugged in already
+
+                const auto vcpus = slot["vcpus-count"].toInt(1);
+                const auto props = slot["props"].toObject();
+                auto device = props;
+                device["driver"] = slot["type"];
+                device["id"] = QString("hotcpu%1").arg(next_id++);
+                auto argument = QString("%1,id=%2").arg(slot["type"].toString(), device["id"].toString());
+                for (auto prop = props.begin(); prop != props.end(); ++prop)
+                    argument += QString(",%1=%2").arg(prop.key()).arg(prop.value().toInt());
+
+                missing -= vcpus;
+                ++resize->outstanding_commands;
+                qmp->execute("device_add", device,
+                             [this, resize, vcpus, argument](const QJsonValue&, const QString& error) {
+                                 if (error.isEmpty())
+                                 {
+                                     desc.num_cores += vcpus;
+                                     hot_plugged_arguments << "-device" << argument;
+                                     resize->arguments << "-device" << argument;
+                                 }
+                                 finish_resize_command(resize, error.isEmpty() ? error : "Cannot add a CPU: " + error);
+                             });
+            }
+
+            const auto shortfall =
+                missing > 0 ? QString("Cannot add %1 more CPUs while the instance runs, stop it first").arg(missing)
+                            : QString();
+            finish_resize_command(resize, shortfall);
+        });
+    }
+
+    finish_resize_command(resize, {});
+}
+
+void mp::QemuVirtualMachine::finish_resize_command(const std::shared_ptr<PendingResize>& resize, const QString& error)
+{
+    note_resize_progress(resize);
+    if (!error.isEmpty())
+        resize->errors += (resize->errors.empty() ? "" : "\n") + error.toStdString();
+    if (--resize->outstanding_commands > 0)
+        return;
+
+    // A process resumed from a suspension has to come up with the devices this one was given since it started
+    if (!resize->arguments.isEmpty())
+    {
+        auto metadata = monitor->retrieve_metadata_for(vm_name);
+        metadata[arguments_key] = QJsonArray::fromStringList(get_arguments(metadata) + resize->arguments);
+        monitor->update_metadata_for(vm_name, metadata);
+    }
+
+    apply_resource_class(false);
+    resize->done.set_value(resize->errors);
+
+    std::lock_guard<std::mutex> lock{resize->progress_mutex};
+    if (resize->abandoned)
+        mpl::log(mpl::Level::warning, vm_name,
+                 fmt::format("Finished resizing to {} CPUs, {}MiB of memory and {}MiB of disk after the request "
+                             "gave up waiting",
+                             desc.num_cores, desc.mem_size.in_megabytes(), desc.disk_space.in_megabytes()));
+}
+
+void mp::QemuVirtualMachine::add_native_mount(const std::string& source_path, const std::string& target_path)
+{
+    native_mounts[target_path] = source_path;
+}
+
+void mp::QemuVirtualMachine::remove_native_mount(const std::string& target_path)
+{
+    native_mounts.erase(target_path);
+}
+
+std::string mp::QemuVirtualMachine::native_mount_tag(const std::string& target_path)
+{
+    const auto tag = QemuVMProcessSpec::mount_tag_for(target_path);
+
+    // Arguments of a resumed instance are the ones it was first started with, so look there rather than at the
+    // mounts recorded since
+    if (vm_process == nullptr || vm_process->arguments().filter(QString("mount_tag=%1,").arg(tag)).isEmpty())
+        return {};
+
+    return tag.toStdString();
+}
@@ -24,12 +24,23 @@
 #include <multipass/virtual_machine.h>
 #include <multipass/virtual_machine_description.h>
 
+#include <QJsonObject>
 #include <QObject>
 #include <QStringList>
 
+#include <atomic>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
 namespace multipass
 {
 class DNSMasqServer;
+class InstanceCgroups;
+class KsmPolicy;
+class NumaPlacement;
+class QmpClient;
 class VMStatusMonitor;
 
 class QemuVirtualMachine final : public QObject, public VirtualMachine
@@ -37,7 +48,9 @@ class QemuVirtualMachine final : public QObject, public VirtualMachine
     Q_OBJECT
 public:
     QemuVirtualMachine(const VirtualMachineDescription& desc, const std::string& tap_device_name,
-                       DNSMasqServer& dnsmasq_server, VMStatusMonitor& monitor);
+                       DNSMasqServer& dnsmasq_server, VMStatusMonitor& monitor,
+                       NumaPlacement* numa_placement = nullptr, KsmPolicy* ksm_policy = nullptr,
+                       InstanceCgroups* cgroups = nullptr);
     ~QemuVirtualMachine();
 
     void start() override;
@@ -53,29 +66,112 @@ public:
     void ensure_vm_is_running() override;
     void wait_until_ssh_up(std::chrono::milliseconds timeout) override;
     void update_state() override;
+    bool wait_for_guest_ready(std::chrono::milliseconds timeout) override;
+    void add_native_mount(const std::string& source_path, const std::string& target_path) override;
+    void remove_native_mount(const std::string& target_path) override;
+    std::string native_mount_tag(const std::string& target_path) override;
+    std::unordered_map<std::string, std::string> hypervisor_stats() override;
+    std::unordered_map<std::string, std::string> guest_stats() override;
+    void set_resource_class(const std::string& resource_class) override;
+    void set_throttle(const InstanceThrottle& throttle) override;
+    void resize(int num_cores, const MemorySize& mem_size, const MemorySize& disk_space) override;
+    std::string check_disk(int64_t bytes_per_second) override;
+    bool start_saving_for_exit() override;
+    bool save_memory_template() override;
 
 signals:
     void on_delete_memory_snapshot();
+    void on_refresh_hypervisor_stats();
+    void on_apply_disk_throttle();
+    void on_resize();
+    void on_personalization_failed(const QString& error);
+    void on_personalized();
 
 private:
+    // A resize the instance's thread is asked to carry out, along with what is left of it
+    struct PendingResize
+    {
+        int num_cores;
+        MemorySize mem_size;
+        MemorySize disk_space;
+        int outstanding_commands{0};
+        std::string errors{};
+        QStringList arguments{}; // the devices it added, for the process to be resumed with
+        std::promise<std::string> done{}; // fulfilled with the errors, if any
+
+        // What the instance has taken on so far, read by the thread that asked once it is told of errors
+        std::mutex progress_mutex;
+        bool begun{false};
+        bool abandoned{false}; // the asking thread has stopped waiting
+        int taken_num_cores{0};
+        MemorySize taken_mem_size{};
+        MemorySize taken_disk_space{};
+    };
+
     void on_started();
     void on_error();
     void on_shutdown();
     void on_suspend();
     void on_restart();
     void initialize_vm_process();
+    void attach_to_detached_process();
+    void connect_vm_process();
+    void save_memory_state();
+    void pin_vcpus();
+    void save_snapshot_instead(const QString& reason);
+    void set_guest_ready(bool ready);
+    void on_qmp_event(const QString& event, const QJsonObject& data);
+    void refresh_hypervisor_stats();
+    void apply_resource_class(bool placing);
+    void apply_disk_throttle(bool starting);
+    void apply_network_throttle();
+    void apply_resize();
+    void note_resize_progress(const std::shared_ptr<PendingResize>& resize);
+    void finish_resize_command(const std::shared_ptr<PendingResize>& resize, const QString& error);
+    void personalize_clone();
 
     const std::string tap_device_name;
-    const VirtualMachineDescription desc;
+    VirtualMachineDescription desc; // grown by resize(), though only on the instance's thread
+    const QString guest_agent_socket;
     std::unique_ptr<Process> vm_process{nullptr};
     multipass::optional<IPAddress> ip;
     const std::string mac_addr;
     const std::string username;
     DNSMasqServer* dnsmasq_server;
     VMStatusMonitor* monitor;
+    NumaPlacement* numa_placement;
+    KsmPolicy* ksm_policy;
+    InstanceCgroups* cgroups;
+    std::string resource_class;
+    std::mutex resource_class_mutex;
+    InstanceThrottle throttle;
+    bool tap_shaped{false};
+    std::mutex throttle_mutex;
+    std::shared_ptr<PendingResize> pending_resize;
+    std::mutex resize_mutex; // one resize at a time
+    bool resizing_image{false}; // while qemu-img grows the image of a stopped instance
+    QStringList hot_plugged_arguments; // the devices hot-added to the current process, as they would be given to it
+    multipass::optional<int> numa_node;
     std::string saved_error_msg;
+    bool detached{false}; // whether the process outlives the daemon, for the next one to attach to
     bool update_shutdown_status{true};
     bool delete_memory_snapshot{false};
+    bool saving_memory_state{false};
+    bool resuming_from_memory_state{false};
+    bool saving_memory_template{false};
+    bool starting_from_template{false};
+    std::future<void> personalization; // of an instance started from a template, over the guest agent
+    bool has_guest_ready_port{false};
+    bool mem_merge{false}; // whether the process's memory is open to page merging
+    bool guest_ready{false};
+    std::mutex guest_ready_mutex;
+    std::condition_variable guest_ready_changed;
+    std::atomic<bool> guest_agent_open{false}; // whether the guest runs an agent that listens on its port
+    std::mutex guest_agent_mutex;              // the agent answers one client at a time
+    std::unordered_map<std::string, std::string> native_mounts; // source paths, by target path
+    std::unique_ptr<QmpClient> qmp;
+    std::mutex hypervisor_stats_mutex;
+    std::unordered_map<std::string, std::string> qmp_stats; // the last answers QEMU gave
 };
 } // namespace multipass
 
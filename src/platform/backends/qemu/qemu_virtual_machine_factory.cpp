@@ -16,10 +16,14 @@
  */
 
 #include "qemu_virtual_machine_factory.h"
+#include "netlink_route.h"
 #include "qemu_virtual_machine.h"
+#include "qemu_vm_process_spec.h"
 
 #include <multipass/logging/log.h>
+#include <multipass/constants.h>
 #include <multipass/optional.h>
+#include <multipass/settings.h>
 #include <multipass/utils.h>
 #include <multipass/virtual_machine_description.h>
 
@@ -29,15 +33,31 @@
 #include <multipass/format.h>
 #include <yaml-cpp/yaml.h>
 
+#include <QDir>
 #include <QRegularExpression>
 #include <QTcpSocket>
 
+#include <algorithm>
+#include <chrono>
+
 namespace mp = multipass;
 namespace mpl = multipass::logging;
 
 namespace
 {
-constexpr auto multipass_bridge_name = "mpqemubr0";
+// Followed by the shard's number, the first being the one bridge there was before there were several
+constexpr auto multipass_bridge_prefix = "mpqemubr";
+
+// How long a passed health check holds, so that a burst of launches and starts does not verify the host for each one
+constexpr std::chrono::seconds host_check_ttl{30};
+
+// Runs on every boot, in cloud-init's final stage. It leaves the wait to the background, so that cloud-init can finish,
+// and then opens the readiness port, which QEMU reports to us
+constexpr auto guest_ready_script = R"END(#!/bin/sh
+port=/dev/virtio-ports/{}
+[ -e "$port" ] || exit 0
+(cloud-init status --wait >/dev/null 2>&1; : > "$port") &
+)END";
 
 // An interface name can only be 15 characters, so this generates a hash of the
 // VM instance name with a "tap-" prefix and then truncates it.
@@ -53,19 +73,18 @@ void create_virtual_switch(const std::string& subnet, const QString& bridge_name
 {
     const QString dummy_name{bridge_name + "-dummy"};
 
-    if (!mp::utils::run_cmd_for_status("ip", {"addr", "show", bridge_name}))
+    auto& netlink = mp::NetlinkRoute::instance();
+    if (!netlink.link_exists(bridge_name))
     {
         const auto mac_address = mp::utils::generate_mac_address();
-        const auto cidr = fmt::format("{}.1/24", subnet);
+        const auto address = fmt::format("{}.1", subnet);
         const auto broadcast = fmt::format("{}.255", subnet);
 
-        mp::utils::run_cmd_for_status("ip",
-                                      {"link", "add", dummy_name, "address", mac_address.c_str(), "type", "dummy"});
-        mp::utils::run_cmd_for_status("ip", {"link", "add", bridge_name, "type", "bridge"});
-        mp::utils::run_cmd_for_status("ip", {"link", "set", dummy_name, "master", bridge_name});
-        mp::utils::run_cmd_for_status(
-            "ip", {"address", "add", cidr.c_str(), "dev", bridge_name, "broadcast", broadcast.c_str()});
-        mp::utils::run_cmd_for_status("ip", {"link", "set", bridge_name, "up"});
+        netlink.add_link(dummy_name, "dummy", mac_address);
+        netlink.add_link(bridge_name, "bridge");
+        netlink.set_link(dummy_name, bridge_name, /*up=*/false);
+        netlink.add_address(bridge_name, address, 24, broadcast);
+        netlink.set_link(bridge_name, {}, /*up=*/true);
     }
 }
 
@@ -73,20 +92,31 @@ void delete_virtual_switch(const QString& bridge_name)
 {
     const QString dummy_name{bridge_name + "-dummy"};
 
-    if (mp::utils::run_cmd_for_status("ip", {"addr", "show", bridge_name}))
+    auto& netlink = mp::NetlinkRoute::instance();
+    if (netlink.link_exists(bridge_name))
     {
-        mp::utils::run_cmd_for_status("ip", {"link", "delete", bridge_name});
-        mp::utils::run_cmd_for_status("ip", {"link", "delete", dummy_name});
+        netlink.delete_link(bridge_name);
+        netlink.delete_link(dummy_name);
     }
 }
 
-void create_tap_device(const QString& tap_name, const QString& bridge_name)
+// Instances take their taps with them as they go, unless they are left running, detached, for the next daemon
+bool has_taps_left(const QString& bridge_name)
+{
+    const QDir ports_dir{QString("/sys/class/net/%1/brif").arg(bridge_name)};
+    const auto ports = ports_dir.entryList(QDir::AllEntries | QDir::NoDotAndDotDot | QDir::System);
+    return std::any_of(ports.cbegin(), ports.cend(),
+                       [&bridge_name](const QString& port) { return port != bridge_name + "-dummy"; });
+}
+
+// Multiqueue only for instances that get more than one queue, the instance making it again should that change
+void create_tap_device(const QString& tap_name, const QString& bridge_name, int num_cores)
 {
-    if (!mp::utils::run_cmd_for_status("ip", {"addr", "show", tap_name}))
+    auto& netlink = mp::NetlinkRoute::instance();
+    if (!netlink.link_exists(tap_name))
     {
-        mp::utils::run_cmd_for_status("ip", {"tuntap", "add", tap_name, "mode", "tap"});
-        mp::utils::run_cmd_for_status("ip", {"link", "set", tap_name, "master", bridge_name});
-        mp::utils::run_cmd_for_status("ip", {"link", "set", tap_name, "up"});
+        if (netlink.add_tap(tap_name, /*multi_queue=*/num_cores > 1))
+            netlink.set_link(tap_name, bridge_name, /*up=*/true);
     }
 }
 
@@ -109,53 +139,116 @@ void set_ip_forward()
 }
 
 mp::DNSMasqServer create_dnsmasq_server(const mp::Path& network_dir, const QString& bridge_name,
-                                        const std::string& subnet)
+                                        const std::string& subnet, const QString& identifier)
 {
     create_virtual_switch(subnet, bridge_name);
     set_ip_forward();
 
-    return {network_dir, bridge_name, subnet};
+    return {network_dir, bridge_name, subnet, identifier};
+}
+
+// What the daemon serves instances on the bridges, which their rules let through
+std::vector<int> daemon_service_ports()
+{
+    std::vector<int> ports;
+    if (const auto package_cache_port = mp::Settings::instance().get(mp::package_cache_port_key).toInt())
+        ports.push_back(package_cache_port);
+
+    return ports;
 }
 } // namespace
 
-mp::QemuVirtualMachineFactory::QemuVirtualMachineFactory(const mp::Path& data_dir)
-    : bridge_name{QString::fromStdString(multipass_bridge_name)},
-      network_dir{mp::utils::make_dir(QDir(data_dir), "network")},
+mp::QemuVirtualMachineFactory::NetworkShard::NetworkShard(const Path& network_dir, const QString& bridge_name,
+                                                          const QString& identifier)
+    : bridge_name{bridge_name},
       subnet{mp::backend::get_subnet(network_dir, bridge_name)},
-      dnsmasq_server{create_dnsmasq_server(network_dir, bridge_name, subnet)},
-      iptables_config{bridge_name, subnet}
+      dnsmasq_server{create_dnsmasq_server(network_dir, bridge_name, subnet, identifier)},
+      iptables_config{bridge_name, subnet, daemon_service_ports()}
 {
 }
 
+mp::QemuVirtualMachineFactory::QemuVirtualMachineFactory(const mp::Path& data_dir)
+    : network_dir{mp::utils::make_dir(QDir(data_dir), "network")}, host_check{host_check_ttl}
+{
+    // Each shard after the first keeps its subnet, leases and reservations in a directory of its own. Shards no
+    // longer asked for are still brought up while they have a directory, so that their instances keep their addresses
+    const auto wanted_shards = std::max(1, mp::Settings::instance().get(mp::network_shards_key).toInt());
+    for (auto i = 0; i < wanted_shards || QDir{network_dir}.exists(multipass_bridge_prefix + QString::number(i)); ++i)
+    {
+        const auto bridge_name = multipass_bridge_prefix + QString::number(i);
+        if (i == 0)
+            shards.push_back(std::make_unique<NetworkShard>(network_dir, bridge_name, QString()));
+        else
+            shards.push_back(std::make_unique<NetworkShard>(mp::utils::make_dir(QDir(network_dir), bridge_name),
+                                                            bridge_name, bridge_name));
+    }
+
+    // Memory pressure comes and goes while instances run, not only as they start and stop
+    QObject::connect(&ksm_tuning_task, &QTimer::timeout, [this] { ksm_policy.retune(); });
+    ksm_tuning_task.start(std::chrono::minutes(1));
+}
+
 mp::QemuVirtualMachineFactory::~QemuVirtualMachineFactory()
 {
-    delete_virtual_switch(bridge_name);
+    // Instances left running go on using the bridge and its rules, which the next daemon takes up as they are
+    for (auto& shard : shards)
+    {
+        if (has_taps_left(shard->bridge_name))
+            shard->iptables_config.keep_rules();
+        else
+            delete_virtual_switch(shard->bridge_name);
+    }
 }
 
 mp::VirtualMachine::UPtr mp::QemuVirtualMachineFactory::create_virtual_machine(const VirtualMachineDescription& desc,
                                                                                VMStatusMonitor& monitor)
 {
     auto tap_device_name = generate_tap_device_name(desc.vm_name);
-    create_tap_device(QString::fromStdString(tap_device_name), bridge_name);
-
-    auto vm = std::make_unique<mp::QemuVirtualMachine>(desc, tap_device_name, dnsmasq_server, monitor);
-
+    std::unique_lock<decltype(instances_mutex)> lock{instances_mutex};
+    auto& shard = shard_for(desc);
+    shard.dnsmasq_server.reserve_ip_for(desc.mac_addr);
     name_to_mac_map.emplace(desc.vm_name, desc.mac_addr);
-    return vm;
+    name_to_shard_map.emplace(desc.vm_name, &shard);
+    lock.unlock();
+
+    // Only the bookkeeping is serialized; making the tap waits on the kernel, and may go on alongside other instances
+    try
+    {
+        create_tap_device(QString::fromStdString(tap_device_name), shard.bridge_name, desc.num_cores);
+        return std::make_unique<mp::QemuVirtualMachine>(desc, tap_device_name, shard.dnsmasq_server, monitor,
+                                                        &numa_placement, &ksm_policy, &instance_cgroups);
+    }
+    catch (...)
+    {
+        // The reservation stays, as it did, so that the instance keeps its address when it is made again
+        lock.lock();
+        name_to_mac_map.erase(desc.vm_name);
+        name_to_shard_map.erase(desc.vm_name);
+        throw;
+    }
 }
 
 void mp::QemuVirtualMachineFactory::remove_resources_for(const std::string& name)
 {
+    std::unique_lock<decltype(instances_mutex)> lock{instances_mutex};
     auto it = name_to_mac_map.find(name);
-    if (it != name_to_mac_map.end())
+    auto shard_it = name_to_shard_map.find(name);
+    if (it != name_to_mac_map.end() && shard_it != name_to_shard_map.end())
     {
-        dnsmasq_server.release_mac(it->second);
+        shard_it->second->dnsmasq_server.release_mac(it->second);
+        name_to_shard_map.erase(shard_it);
     }
+    lock.unlock();
+
+    numa_placement.release(name);
 }
 
 mp::FetchType mp::QemuVirtualMachineFactory::fetch_type()
 {
-    return mp::FetchType::ImageOnly;
+    // Booting the kernel directly needs it, and its initrd, next to the image
+    return mp::Settings::instance().get(mp::boot_profile_key) == mp::firmware_boot_profile
+               ? mp::FetchType::ImageOnly
+               : mp::FetchType::ImageKernelAndInitrd;
 }
 
 mp::VMImage mp::QemuVirtualMachineFactory::prepare_source_image(const mp::VMImage& source_image)
@@ -172,17 +265,33 @@ void mp::QemuVirtualMachineFactory::prepare_instance_image(const mp::VMImage& in
 }
 
 void mp::QemuVirtualMachineFactory::configure(const std::string& /*name*/, YAML::Node& /*meta_config*/,
-                                              YAML::Node& /*user_config*/)
+                                              YAML::Node& vendor_config)
 {
+    YAML::Node guest_ready_node;
+    guest_ready_node["path"] = "/var/lib/cloud/scripts/per-boot/multipass-ready";
+    guest_ready_node["permissions"] = "0755";
+    guest_ready_node["content"] = fmt::format(guest_ready_script, QemuVMProcessSpec::guest_ready_port_name);
+
+    vendor_config["write_files"].push_back(guest_ready_node);
 }
 
 void mp::QemuVirtualMachineFactory::hypervisor_health_check()
 {
-    mp::backend::check_for_kvm_support();
-    mp::backend::check_if_kvm_is_in_use();
+    // dnsmasq is cheap to look in on and is always brought back; one that had died makes the rest stale as well
+    auto dnsmasq_restarted = false;
+    for (auto& shard : shards)
+        dnsmasq_restarted = shard->dnsmasq_server.check_dnsmasq_running() || dnsmasq_restarted;
 
-    dnsmasq_server.check_dnsmasq_running();
-    iptables_config.verify_iptables_rules();
+    if (dnsmasq_restarted)
+        host_check.invalidate();
+
+    host_check.run([this] {
+        mp::backend::check_for_kvm_support();
+        mp::backend::check_if_kvm_is_in_use();
+
+        for (auto& shard : shards)
+            shard->iptables_config.verify_iptables_rules();
+    });
 }
 
 QString mp::QemuVirtualMachineFactory::get_backend_version_string()
@@ -223,3 +332,24 @@ QString mp::QemuVirtualMachineFactory::get_backend_version_string()
 
     return QString("qemu-unknown");
 }
+
+std::vector<std::string> mp::QemuVirtualMachineFactory::host_addresses()
+{
+    std::vector<std::string> addresses;
+    for (const auto& shard : shards)
+        addresses.push_back(fmt::format("{}.1", shard->subnet));
+
+    return addresses;
+}
+
+mp::QemuVirtualMachineFactory::NetworkShard&
+mp::QemuVirtualMachineFactory::shard_for(const VirtualMachineDescription& desc)
+{
+    for (auto& shard : shards)
+        if (shard->dnsmasq_server.reserved_ip_for(desc.mac_addr) || shard->dnsmasq_server.get_ip_for(desc.mac_addr))
+            return *shard;
+
+    return **std::min_element(shards.begin(), shards.end(), [](const auto& a, const auto& b) {
+        return a->dnsmasq_server.reservation_count() < b->dnsmasq_server.reservation_count();
+    });
+}
@@ -18,15 +18,23 @@
 #define MULTIPASS_QEMU_VIRTUAL_MACHINE_FACTORY_H
 
 #include "dnsmasq_server.h"
+#include "host_check_cache.h"
 #include "iptables_config.h"
+#include "instance_cgroups.h"
+#include "ksm_policy.h"
+#include "numa_placement.h"
 
 #include <multipass/path.h>
 #include <multipass/virtual_machine_factory.h>
 
 #include <QString>
+#include <QTimer>
 
+#include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 namespace multipass
 {
@@ -49,14 +57,33 @@ public:
         return {};
     };
     QString get_backend_version_string() override;
+    std::vector<std::string> host_addresses() override;
 
 private:
-    const QString bridge_name;
+    // A bridge on a /24 of its own, with the dnsmasq that hands out its addresses and the rules forwarding its traffic
+    struct NetworkShard
+    {
+        NetworkShard(const Path& network_dir, const QString& bridge_name, const QString& identifier);
+
+        const QString bridge_name;
+        const std::string subnet;
+        DNSMasqServer dnsmasq_server;
+        IPTablesConfig iptables_config;
+    };
+
+    // The shard the instance was given before, or else the one with the fewest instances
+    NetworkShard& shard_for(const VirtualMachineDescription& desc);
+
     const Path network_dir;
-    const std::string subnet;
-    DNSMasqServer dnsmasq_server;
-    IPTablesConfig iptables_config;
-    std::unordered_map<std::string, std::string> name_to_mac_map;
+    std::vector<std::unique_ptr<NetworkShard>> shards;
+    NumaPlacement numa_placement;
+    KsmPolicy ksm_policy;
+    InstanceCgroups instance_cgroups;
+    QTimer ksm_tuning_task;
+    HostCheckCache host_check;
+    std::mutex instances_mutex; // instances are created concurrently as the daemon starts
+    std::unordered_map<std::string, std::string> name_to_mac_map;    // guarded by instances_mutex
+    std::unordered_map<std::string, NetworkShard*> name_to_shard_map; // idem, as are the shards' reservations
 };
 } // namespace multipass
 
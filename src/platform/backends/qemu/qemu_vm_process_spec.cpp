@@ -20,7 +20,18 @@
 #include <multipass/format.h>
 #include <multipass/logging/log.h>
 #include <multipass/snap_utils.h>
+#include <multipass/utils.h>
 #include <shared/linux/backend_utils.h>
+#include <shared/linux/guest_agent.h>
+
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFileInfo>
+#include <QThread>
+
+#include <unistd.h>
+
+#include <algorithm>
 
 namespace mp = multipass;
 namespace mpl = multipass::logging;
@@ -28,6 +39,28 @@ namespace mu = multipass::utils;
 
 namespace
 {
+// Cloud images label their root filesystem. The kernel command line also names cloud-init's datasource, in place of
+// SMBIOS, which microvm does not have
+constexpr auto kernel_command_line = "root=LABEL=cloudimg-rootfs ro console=ttyS0 ds=nocloud";
+
+// A path as it may go within the quotes of an AppArmor rule, matching itself only: quotes, backslashes and glob
+// characters escaped, anything unprintable written out in octal
+QString apparmor_quoted(const QString& path)
+{
+    QString quoted;
+    for (const auto c : path)
+    {
+        if (QString{"\\\"*?[]{}^"}.contains(c))
+            quoted += QString{"\\"} + c;
+        else if (c.unicode() < 0x20 || c.unicode() == 0x7F)
+            quoted += QString{"\\%1"}.arg(c.unicode(), 3, 8, QChar{'0'});
+        else
+            quoted += c;
+    }
+
+    return quoted;
+}
+
 // This returns the initial two Qemu command line options we used in Multipass. Only of use to resume old suspended
 // images.
 //  === Do not change this! ===
@@ -69,12 +102,122 @@ QStringList initial_qemu_arguments(const mp::VirtualMachineDescription& desc, co
     }
     return args;
 }
+
+// Undoes what detaching changed in arguments that were saved while the instance was detached, so that they can be
+// resumed either way
+QStringList attached_arguments(QStringList args)
+{
+    for (auto i = args.indexOf("-qmp"); i >= 0 && i + 1 < args.size(); i = args.indexOf("-qmp", i + 1))
+        args[i + 1] = "stdio";
+
+    for (auto i = args.indexOf("-display"); i >= 0 && i + 1 < args.size(); i = args.indexOf("-display"))
+    {
+        args.removeAt(i + 1);
+        args[i] = "-nographic";
+    }
+
+    args.removeAll("-daemonize");
+    for (auto i = args.indexOf("-pidfile"); i >= 0 && i + 1 < args.size(); i = args.indexOf("-pidfile"))
+    {
+        args.removeAt(i + 1);
+        args.removeAt(i);
+    }
+
+    return args;
+}
 } // namespace
 
 mp::QemuVMProcessSpec::QemuVMProcessSpec(const mp::VirtualMachineDescription& desc, const QString& tap_device_name,
-                                         const multipass::optional<ResumeData>& resume_data)
-    : desc(desc), tap_device_name(tap_device_name), resume_data{resume_data}
+                                         const multipass::optional<ResumeData>& resume_data,
+                                         const std::vector<SharedDirectory>& shared_directories,
+                                         const multipass::optional<int>& numa_node, int network_queues,
+                                         bool vhost_net, const QString& boot_profile, bool mem_merge,
+                                         bool detached)
+    : desc(desc),
+      tap_device_name(tap_device_name),
+      resume_data{resume_data},
+      shared_directories{shared_directories},
+      numa_node{numa_node},
+      network_queues{network_queues},
+      vhost_net{vhost_net},
+      boot_profile{boot_profile},
+      mem_merge{mem_merge},
+      detached{detached}
+{
+}
+
+QString mp::QemuVMProcessSpec::mount_tag_for(const std::string& target_path)
+{
+    // 9p tags are limited to 31 characters, so derive a short stable one from the path
+    const auto hash = QCryptographicHash::hash(QByteArray::fromStdString(target_path), QCryptographicHash::Sha1);
+    return "mp" + QString::fromLatin1(hash.toHex().left(16));
+}
+
+QString mp::QemuVMProcessSpec::memory_state_file_for(const VirtualMachineDescription& desc)
+{
+    return QFileInfo{desc.image.image_path}.dir().filePath("suspend.memstate");
+}
+
+QString mp::QemuVMProcessSpec::qmp_socket_for(const VirtualMachineDescription& desc)
+{
+    return QFileInfo{desc.image.image_path}.dir().filePath("qmp.sock");
+}
+
+QString mp::QemuVMProcessSpec::pid_file_for(const VirtualMachineDescription& desc)
+{
+    return QFileInfo{desc.image.image_path}.dir().filePath("qemu.pid");
+}
+
+QString mp::QemuVMProcessSpec::guest_agent_socket_for(const VirtualMachineDescription& desc)
+{
+    return QFileInfo{desc.image.image_path}.dir().filePath("guest-agent.sock");
+}
+
+QString mp::QemuVMProcessSpec::template_memory_file_in(const QString& template_dir)
+{
+    return QDir{template_dir}.filePath("template.ram");
+}
+
+QString mp::QemuVMProcessSpec::template_state_file_in(const QString& template_dir)
+{
+    return QDir{template_dir}.filePath("template.devstate");
+}
+
+QStringList mp::QemuVMProcessSpec::without_memory_template(QStringList arguments)
+{
+    for (auto& argument : arguments)
+    {
+        if (!argument.startsWith("memory-backend-file,") || !argument.contains(",share=off"))
+            continue;
+
+        QStringList options;
+        for (const auto& option : argument.split(','))
+            if (!option.startsWith("mem-path=") && !option.startsWith("share="))
+                options << option;
+        options[0] = "memory-backend-ram";
+        argument = options.join(',');
+    }
+
+    const auto incoming = arguments.indexOf("-incoming");
+    if (incoming >= 0 && incoming + 1 < arguments.size())
+    {
+        arguments.removeAt(incoming + 1);
+        arguments.removeAt(incoming);
+    }
+    arguments.removeAll("-S");
+
+    return arguments;
+}
+
+int mp::QemuVMProcessSpec::max_cores_for(const VirtualMachineDescription& desc)
 {
+    return std::max(desc.num_cores, QThread::idealThreadCount());
+}
+
+long long mp::QemuVMProcessSpec::max_memory_in_megabytes_for(const VirtualMachineDescription& desc)
+{
+    const auto host_memory = static_cast<long long>(sysconf(_SC_PHYS_PAGES)) * sysconf(_SC_PAGESIZE);
+    return std::max(desc.mem_size.in_megabytes(), host_memory / (1024 * 1024));
 }
 
 QStringList mp::QemuVMProcessSpec::arguments() const
@@ -86,7 +229,7 @@ QStringList mp::QemuVMProcessSpec::arguments() const
         if (resume_data->arguments.length() > 0)
         {
             // arguments used were saved externally, import them
-            args = resume_data->arguments;
+            args = attached_arguments(resume_data->arguments);
         }
         else
         {
@@ -95,7 +238,12 @@ QStringList mp::QemuVMProcessSpec::arguments() const
         }
 
         // need to append extra arguments for resume
-        args << "-loadvm" << resume_data->suspend_tag;
+        if (resume_data->memory_state_file.isEmpty())
+            args << "-loadvm" << resume_data->suspend_tag;
+        else
+            // The memory state is streamed in over QMP once the process is up
+            args << "-incoming"
+                 << "defer";
 
         QString machine_type = resume_data->machine_type;
         if (!machine_type.isEmpty())
@@ -113,23 +261,103 @@ QStringList mp::QemuVMProcessSpec::arguments() const
         auto mem_size = QString::number(desc.mem_size.in_megabytes()) + 'M'; /* flooring here; format documented in
     `man qemu-system`, under `-m` option; including suffix to avoid relying on default unit */
 
+        const auto direct_boot = boot_profile != firmware_boot_profile;
+        const auto minimal_machine = boot_profile == q35_boot_profile || boot_profile == microvm_boot_profile;
+
         args << "--enable-kvm";
+        // A machine with none of the default devices, only those below, so there is less for the kernel to probe
+        if (minimal_machine)
+            args << "-machine" << (boot_profile == microvm_boot_profile ? "microvm,pcie=on" : "q35") << "-nodefaults";
+        // Guest memory is open to merging with identical pages of other instances by default, so keep it out unless
+        // density mode is on
+        if (!mem_merge)
+            args << "-machine"
+                 << "mem-merge=off";
         // The VM image itself
+        if (desc.disk_profile == default_disk_profile)
+        {
+            args << "-device"
+                 << "virtio-scsi-pci,id=scsi0"
+                 << "-drive" << QString("file=%1,if=none,format=qcow2,discard=unmap,id=hda").arg(desc.image.image_path)
+                 << "-device"
+                 << "scsi-hd,drive=hda,bus=scsi0.0";
+        }
+        else
+        {
+            // Direct I/O submitted from a thread of its own, over as many queues as there are vCPUs, with enough L2
+            // cache to map the whole image instead of going back to its tables on the disk
+            const auto l2_cache_size = std::max<long long>(desc.disk_space.in_bytes() / 8192, 1048576);
+            args << "-object"
+                 << "iothread,id=iothread0"
+                 << "-drive"
+                 << QString("file=%1,if=none,format=qcow2,discard=unmap,cache=none,aio=%2,l2-cache-size=%3,id=hda")
+                        .arg(desc.image.image_path, QString::fromStdString(desc.disk_profile))
+                        .arg(l2_cache_size)
+                 << "-device"
+                 << QString("virtio-blk-pci,drive=hda,iothread=iothread0,num-queues=%1").arg(desc.num_cores);
+        }
+        // Number of cpu cores, and memory to use for VM. Other than on microvm, which has no way to plug devices in,
+        // room is left for more of both to be hot-added up to what the host has
+        if (boot_profile == microvm_boot_profile)
+            args << "-smp" << QString::number(desc.num_cores) << "-m" << mem_size;
+        else
+            args << "-smp" << QString("%1,maxcpus=%2").arg(desc.num_cores).arg(max_cores_for(desc)) << "-m"
+                 << QString("%1,slots=%2,maxmem=%3M")
+                        .arg(mem_size)
+                        .arg(memory_slots)
+                        .arg(max_memory_in_megabytes_for(desc));
+        // A memory template's memory is a file that QEMU writes through to, and that the instances started from it
+        // map copy-on-write, sharing the pages none of them changed. They wait for the template's devices' state
+        const auto template_dir =
+            desc.memory_template ? QFileInfo{desc.image.image_path}.path() : desc.memory_template_dir;
+        if (!template_dir.isEmpty())
+        {
+            auto backend = QString("memory-backend-file,id=ram0,size=%1,mem-path=%2,share=%3")
+                               .arg(mem_size, template_memory_file_in(template_dir),
+                                    desc.memory_template ? "on" : "off");
+            if (numa_node)
+                backend += QString(",host-nodes=%1,policy=bind").arg(*numa_node);
+
+            // Every start gets a generation ID of its own, for clones' kernels to reseed their random pools from the
+            // template's; the device is on the template too, for its state to load into the clones
+            args << "-object" << backend << "-numa"
+                 << "node,memdev=ram0"
+                 << "-device"
+                 << "vmgenid,guid=auto";
+            // Clones stay paused once loaded, for their link to go down before the template's MAC can be seen
+            if (!desc.memory_template)
+                args << "-incoming"
+                     << "defer"
+                     << "-S";
+        }
+        // Preallocated on huge pages when asked, and kept on the host node the vCPUs are pinned to
+        else if (desc.hugepages || numa_node)
+        {
+            auto backend = desc.hugepages
+                               ? QString("memory-backend-file,id=ram0,size=%1,mem-path=/dev/hugepages,prealloc=on")
+                               : QString("memory-backend-ram,id=ram0,size=%1");
+            backend = backend.arg(mem_size);
+            if (numa_node)
+                backend += QString(",host-nodes=%1,policy=bind").arg(*numa_node);
+
+            args << "-object" << backend << "-numa"
+                 << "node,memdev=ram0";
+        }
+        // Hand the pages the guest frees back to the host, so that idle instances do not hold on to all of their memory
         args << "-device"
-             << "virtio-scsi-pci,id=scsi0"
-             << "-drive" << QString("file=%1,if=none,format=qcow2,discard=unmap,id=hda").arg(desc.image.image_path)
-             << "-device"
-             << "scsi-hd,drive=hda,bus=scsi0.0";
-        // Number of cpu cores
-        args << "-smp" << QString::number(desc.num_cores);
-        // Memory to use for VM
-        args << "-m" << mem_size;
-        // Create a virtual NIC in the VM
-        args << "-device"
-             << QString("virtio-net-pci,netdev=hostnet0,id=net0,mac=%1").arg(QString::fromStdString(desc.mac_addr));
-        // Create tap device to connect to virtual bridge
-        args << "-netdev";
-        args << QString("tap,id=hostnet0,ifname=%1,script=no,downscript=no").arg(tap_device_name);
+             << "virtio-balloon-pci,id=balloon0,free-page-reporting=on";
+        // Create a virtual NIC in the VM, with a queue pair per vCPU when the tap allows, each with its own vectors
+        auto nic = QString("virtio-net-pci,netdev=hostnet0,id=net0,mac=%1").arg(QString::fromStdString(desc.mac_addr));
+        if (network_queues > 1)
+            nic += QString(",mq=on,vectors=%1").arg(2 * network_queues + 2);
+        args << "-device" << nic;
+        // Create tap device to connect to virtual bridge, its packets moved by the host kernel rather than by QEMU
+        auto netdev = QString("tap,id=hostnet0,ifname=%1,script=no,downscript=no").arg(tap_device_name);
+        if (vhost_net)
+            netdev += ",vhost=on";
+        if (network_queues > 1)
+            netdev += QString(",queues=%1").arg(network_queues);
+        args << "-netdev" << netdev;
         // Control interface
         args << "-qmp"
              << "stdio";
@@ -144,8 +372,65 @@ QStringList mp::QemuVMProcessSpec::arguments() const
              << "chardev:char0"
              // TODO Add a debugging mode with access to console
              << "-nographic";
-        // Cloud-init disk
-        args << "-cdrom" << desc.cloud_init_iso;
+        // Readiness channel; only the guest opening it matters, so nothing is attached
+        args << "-device"
+             << "virtio-serial-pci,id=virtio-serial0"
+             << "-chardev"
+             << "null,id=char1"
+             << "-device"
+             << QString("virtserialport,chardev=char1,id=%1,name=%2").arg(guest_ready_port_id, guest_ready_port_name);
+        // Guest agent channel, which the daemon connects to whenever it has something to ask
+        args << "-chardev"
+             << QString("socket,id=%1,path=%2,server=on,wait=off")
+                    .arg(guest_agent_port_id, guest_agent_socket_for(desc))
+             << "-device"
+             << QString("virtserialport,chardev=%1,id=%1,name=%2")
+                    .arg(guest_agent_port_id, mp::backend::guest_agent_port_name);
+        // Host directories mounted natively by the guest. QEMU runs as root, so the guest's owners and modes are kept
+        // in extended attributes rather than applied, lest the guest leave setuid-root files on the host
+        for (const auto& dir : shared_directories)
+        {
+            auto path = dir.source_path;
+            args << "-virtfs"
+                 << QString("local,path=%1,mount_tag=%2,security_model=mapped-xattr,id=%2")
+                        .arg(path.replace(",", ",,"), dir.mount_tag);
+        }
+        if (direct_boot)
+        {
+            // The kernel and initrd fetched along with the image, started without firmware or bootloader in between
+            args << "-kernel" << desc.image.kernel_path << "-initrd" << desc.image.initrd_path << "-append"
+                 << kernel_command_line;
+        }
+        else
+        {
+            // Point cloud-init straight at the NoCloud datasource, sparing it from probing the others. The seed itself
+            // stays on the disk below, as SMBIOS only has room for a seed URL and not for the user data
+            args << "-smbios"
+                 << "type=1,serial=ds=nocloud";
+        }
+        // Cloud-init disk, on virtio where there is no IDE controller to put a CD-ROM on
+        if (minimal_machine)
+            args << "-drive" << QString("file=%1,if=none,format=raw,readonly=on,id=cidata").arg(desc.cloud_init_iso)
+                 << "-device"
+                 << "virtio-blk-pci,drive=cidata";
+        else
+            args << "-cdrom" << desc.cloud_init_iso;
+    }
+
+    // QEMU forks itself off once it is set up, and is spoken to over a socket that stays behind for a later daemon
+    if (detached)
+    {
+        const auto qmp = args.indexOf("-qmp");
+        if (qmp >= 0 && qmp + 1 < args.size())
+            args[qmp + 1] = QString("unix:%1,server=on,wait=off").arg(qmp_socket_for(desc));
+        const auto no_graphics = args.indexOf("-nographic"); // which would take stdio, and cannot go with -daemonize
+        if (no_graphics >= 0)
+        {
+            args[no_graphics] = "-display";
+            args.insert(no_graphics + 1, "none");
+        }
+        args << "-daemonize"
+             << "-pidfile" << pid_file_for(desc);
     }
 
     return args;
@@ -177,6 +462,7 @@ profile %1 flags=(attach_disconnected) {
   signal (receive) peer=%2,
 
   /dev/net/tun rw,
+  /dev/vhost-net rw,
   /dev/kvm rw,
   /dev/ptmx rw,
   /dev/kqemu rw,
@@ -222,7 +508,12 @@ profile %1 flags=(attach_disconnected) {
   # Disk images
   %6 rwk,  # QCow2 filesystem image
   %7 rk,   # cloud-init ISO
-}
+  %10{,.part} rw,  # memory state of a suspended instance
+  %12 rw,  # control socket of a detached instance
+  %13 rw,  # and its pid file
+  %14 rw,  # guest agent socket
+  /dev/hugepages/** rw,  # guest memory on huge pages
+%8%9%11%15}
     )END");
 
     /* Customisations depending on if running inside snap or not */
@@ -242,8 +533,41 @@ profile %1 flags=(attach_disconnected) {
         firmware = "/usr/share/seabios/*";
     }
 
-    return profile_template.arg(apparmor_profile_name(), signal_peer, firmware, root_dir, program(),
-                                desc.image.image_path, desc.cloud_init_iso);
+    // Instance images may be thin overlays on a cached image, which qemu needs to read as well
+    QString backing_image;
+    const auto backing_file = mu::qcow2_backing_file(desc.image.image_path);
+    if (!backing_file.isEmpty())
+        backing_image = QString("  %1 rk,  # QCow2 backing image\n").arg(backing_file);
+
+    QString boot_files;
+    if (boot_profile != firmware_boot_profile)
+        boot_files = QString("  %1 r,  # kernel\n  %2 r,  # initrd\n").arg(desc.image.kernel_path, desc.image.initrd_path);
+
+    QString template_files;
+    if (desc.memory_template)
+    {
+        const auto template_dir = QFileInfo{desc.image.image_path}.path();
+        template_files = QString("  %1 rw,  # memory template\n  %2{,.part} rw,\n")
+                             .arg(template_memory_file_in(template_dir), template_state_file_in(template_dir));
+    }
+    else if (!desc.memory_template_dir.isEmpty())
+    {
+        // QEMU opens the memory file for writing even when mapping it privately, but then writes never reach it
+        template_files = QString("  %1 rw,  # memory template the instance starts from\n  %2 r,\n")
+                             .arg(template_memory_file_in(desc.memory_template_dir),
+                                  template_state_file_in(desc.memory_template_dir));
+    }
+
+    QString shared_paths;
+    for (const auto& dir : shared_directories)
+        shared_paths +=
+            QString("  \"%1/\" r,  # native mount\n  \"%1/**\" rwlk,\n").arg(apparmor_quoted(dir.source_path));
+
+    return profile_template
+        .arg(apparmor_profile_name(), signal_peer, firmware, root_dir, program(), desc.image.image_path,
+             desc.cloud_init_iso, backing_image, shared_paths)
+        .arg(memory_state_file_for(desc), boot_files, qmp_socket_for(desc), pid_file_for(desc),
+             guest_agent_socket_for(desc), template_files);
 }
 
 QString mp::QemuVMProcessSpec::identifier() const
@@ -20,9 +20,12 @@
 
 #include "qemu_base_process_spec.h"
 
+#include <multipass/constants.h>
 #include <multipass/optional.h>
 #include <multipass/virtual_machine_description.h>
 
+#include <vector>
+
 namespace multipass
 {
 
@@ -35,12 +38,51 @@ public:
         QString machine_type;
         bool use_cdrom_flag; // to be removed, should be replaced by "arguments"
         QStringList arguments;
+        // Where a migration to file left the instance's memory; when set, it is loaded rather than suspend_tag
+        QString memory_state_file{};
+    };
+
+    // A guest opens this virtio-serial port when it finished booting; QEMU reports that as a VSERPORT_CHANGE event
+    static constexpr auto guest_ready_port_id = "multipass-ready";
+    static constexpr auto guest_ready_port_name = "io.multipass.ready";
+    // Where qemu-guest-agent, when the guest runs it, is spoken to; QEMU reports the guest opening the port the same way
+    static constexpr auto guest_agent_port_id = "guest-agent";
+
+    // A host directory exported over virtio-9p, which the guest mounts by its tag
+    struct SharedDirectory
+    {
+        QString source_path;
+        QString mount_tag;
     };
 
+    // Memory DIMMs and vCPUs can be hot-added to a running instance up to these, which are what the host has, or
+    // what the instance does where that is more
+    static constexpr auto memory_slots = 8;
+    static int max_cores_for(const VirtualMachineDescription& desc);
+    static long long max_memory_in_megabytes_for(const VirtualMachineDescription& desc);
+
     static QString default_machine_type();
+    static QString mount_tag_for(const std::string& target_path);
+    // Kept next to the instance image, so that it goes away along with the instance
+    static QString memory_state_file_for(const VirtualMachineDescription& desc);
+    // Where a detached instance, which outlives the daemon, is spoken to and found again
+    static QString qmp_socket_for(const VirtualMachineDescription& desc);
+    static QString pid_file_for(const VirtualMachineDescription& desc);
+    static QString guest_agent_socket_for(const VirtualMachineDescription& desc);
+    // Where a memory template keeps its memory and, once saved, its devices' state, in its instance directory
+    static QString template_memory_file_in(const QString& template_dir);
+    static QString template_state_file_in(const QString& template_dir);
+    // The arguments an instance started from a template would have been given booting by itself, which its memory
+    // state, once it is suspended, is resumed with
+    static QStringList without_memory_template(QStringList arguments);
 
     explicit QemuVMProcessSpec(const VirtualMachineDescription& desc, const QString& tap_device_name,
-                               const multipass::optional<ResumeData>& resume_data);
+                               const multipass::optional<ResumeData>& resume_data,
+                               const std::vector<SharedDirectory>& shared_directories = {},
+                               const multipass::optional<int>& numa_node = multipass::nullopt,
+                               int network_queues = 1, bool vhost_net = false,
+                               const QString& boot_profile = firmware_boot_profile, bool mem_merge = false,
+                               bool detached = false);
 
     QStringList arguments() const override;
 
@@ -51,6 +93,13 @@ private:
     const VirtualMachineDescription desc;
     const QString tap_device_name;
     const multipass::optional<ResumeData> resume_data;
+    const std::vector<SharedDirectory> shared_directories;
+    const multipass::optional<int> numa_node; // host node the guest memory is bound to
+    const int network_queues;
+    const bool vhost_net;
+    const QString boot_profile; // firmware, or the kernel and initrd fetched with the image, on one of the machines
+    const bool mem_merge;
+    const bool detached; // daemonized, with QMP on a socket of its own rather than on stdio
 };
 
 } // namespace multipass
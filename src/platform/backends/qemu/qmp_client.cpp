@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "qmp_client.h"
+
+#include <QJsonDocument>
+
+namespace mp = multipass;
+
+mp::QmpClient::QmpClient(Writer writer, EventHandler on_event)
+    : writer{std::move(writer)}, on_event{std::move(on_event)}
+{
+}
+
+void mp::QmpClient::execute(const QString& command, const QJsonObject& arguments, ReplyHandler on_reply)
+{
+    QJsonObject qmp;
+    qmp.insert("execute", command);
+    if (!arguments.isEmpty())
+        qmp.insert("arguments", arguments);
+
+    if (on_reply)
+    {
+        auto id = next_id++;
+        qmp.insert("id", id);
+        pending_replies.emplace(id, std::move(on_reply));
+    }
+
+    writer(QJsonDocument(qmp).toJson(QJsonDocument::Compact) + '\n');
+}
+
+void mp::QmpClient::human_monitor_command(const QString& command_line, ReplyHandler on_reply)
+{
+    QJsonObject arguments;
+    arguments.insert("command-line", command_line);
+
+    execute("human-monitor-command", arguments, std::move(on_reply));
+}
+
+void mp::QmpClient::feed(const QByteArray& output)
+{
+    pending_output.append(output);
+
+    int line_end;
+    while ((line_end = pending_output.indexOf('\n')) >= 0)
+    {
+        auto line = pending_output.left(line_end).trimmed();
+        pending_output.remove(0, line_end + 1);
+
+        if (!line.isEmpty())
+            process_line(line);
+    }
+
+    // Not every writer ends its last message with a newline, so take it once it is complete
+    if (!pending_output.trimmed().isEmpty() && QJsonDocument::fromJson(pending_output).isObject())
+    {
+        auto line = pending_output.trimmed();
+        pending_output.clear();
+        process_line(line);
+    }
+}
+
+void mp::QmpClient::reset(const QString& reason)
+{
+    pending_output.clear();
+
+    auto replies = std::move(pending_replies);
+    pending_replies.clear();
+    for (auto& reply : replies)
+        reply.second(QJsonValue{}, reason);
+}
+
+void mp::QmpClient::process_line(const QByteArray& line)
+{
+    auto qmp = QJsonDocument::fromJson(line).object();
+
+    if (qmp.contains("event"))
+    {
+        if (on_event)
+            on_event(qmp["event"].toString(), qmp["data"].toObject());
+        return;
+    }
+
+    // The greeting and replies to untagged commands need no answer
+    if (!qmp.contains("id"))
+        return;
+
+    auto it = pending_replies.find(qmp["id"].toVariant().toLongLong());
+    if (it == pending_replies.end())
+        return;
+
+    auto on_reply = std::move(it->second);
+    pending_replies.erase(it);
+
+    if (qmp.contains("error"))
+    {
+        auto error = qmp["error"].toObject()["desc"].toString();
+        on_reply(QJsonValue{}, error.isEmpty() ? QStringLiteral("unknown error") : error);
+    }
+    else
+    {
+        on_reply(qmp["return"], QString{});
+    }
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_QMP_CLIENT_H
+#define MULTIPASS_QMP_CLIENT_H
+
+#include <QByteArray>
+#include <QJsonObject>
+#include <QJsonValue>
+#include <QString>
+
+#include <functional>
+#include <unordered_map>
+
+namespace multipass
+{
+// Speaks QMP over a QEMU process's stdio: commands are tagged so their replies find their way back, while events
+// and replies arrive interleaved on the same channel
+class QmpClient
+{
+public:
+    using Writer = std::function<void(const QByteArray& data)>;
+    using EventHandler = std::function<void(const QString& event, const QJsonObject& data)>;
+    // Given either the command's return value or, when QEMU refused it, a non-empty error description
+    using ReplyHandler = std::function<void(const QJsonValue& result, const QString& error)>;
+
+    QmpClient(Writer writer, EventHandler on_event);
+
+    void execute(const QString& command, const QJsonObject& arguments = {}, ReplyHandler on_reply = {});
+    void human_monitor_command(const QString& command_line, ReplyHandler on_reply = {});
+
+    // Takes whatever the process printed; a line cut short is finished by a later call
+    void feed(const QByteArray& output);
+
+    // Fails the replies still outstanding, e.g. because the process went away
+    void reset(const QString& reason);
+
+private:
+    void process_line(const QByteArray& line);
+
+    Writer writer;
+    EventHandler on_event;
+    QByteArray pending_output;
+    qint64 next_id{0};
+    std::unordered_map<qint64, ReplyHandler> pending_replies;
+};
+} // namespace multipass
+
+#endif // MULTIPASS_QMP_CLIENT_H
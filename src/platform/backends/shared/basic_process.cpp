@@ -18,6 +18,7 @@
 #include "basic_process.h"
 
 #include <multipass/logging/log.h>
+#include <multipass/tracing.h>
 
 namespace mp = multipass;
 namespace mpl = multipass::logging;
@@ -105,6 +106,7 @@ QProcessEnvironment mp::BasicProcess::process_environment() const
 
 void mp::BasicProcess::start()
 {
+    auto span = Tracer::instance().span("process spawn", {{"program", program().toStdString()}});
     process.start();
 }
 
@@ -154,6 +156,11 @@ bool mp::BasicProcess::running() const
     return process.state() == QProcess::Running;
 }
 
+qint64 mp::BasicProcess::process_id() const
+{
+    return process.processId();
+}
+
 QByteArray mp::BasicProcess::read_all_standard_output()
 {
     return process.readAllStandardOutput();
@@ -176,6 +183,7 @@ void mp::BasicProcess::close_write_channel()
 
 mp::ProcessState mp::BasicProcess::execute(const int timeout)
 {
+    auto span = Tracer::instance().span("process execute", {{"program", program().toStdString()}});
     mp::ProcessState exit_state;
     start();
 
@@ -49,6 +49,7 @@ public:
     bool wait_for_finished(int msecs = 30000) override;
 
     bool running() const override;
+    qint64 process_id() const override;
     ProcessState process_state() const override;
     QString error_string() const;
 
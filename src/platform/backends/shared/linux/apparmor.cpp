@@ -24,6 +24,7 @@
 #include <multipass/snap_utils.h>
 #include <sys/apparmor.h>
 
+#include <QCryptographicHash>
 #include <QDir>
 #include <QProcess>
 
@@ -66,7 +67,8 @@ QStringList generate_extra_apparmor_args()
 
 } // namespace
 
-mp::AppArmor::AppArmor() : apparmor_args{generate_extra_apparmor_args()}
+mp::AppArmor::AppArmor()
+    : apparmor_args{generate_extra_apparmor_args()}, loaded_policies{std::make_unique<LoadedPolicies>()}
 {
     int ret = aa_is_enabled();
     if (ret < 0)
@@ -79,6 +81,38 @@ mp::AppArmor::AppArmor() : apparmor_args{generate_extra_apparmor_args()}
     throw_if_binary_fails(apparmor_parser, {"-V"});
 }
 
+mp::AppArmor::~AppArmor()
+{
+    if (!loaded_policies)
+        return;
+
+    for (const auto& loaded : loaded_policies->by_name)
+    {
+        try
+        {
+            remove_policy(loaded.second.second);
+        }
+        catch (const std::exception& e)
+        {
+            // It's not considered an error when an apparmor cannot be removed
+            mpl::log(mpl::Level::info, "apparmor", e.what());
+        }
+    }
+}
+
+void mp::AppArmor::ensure_policy_loaded(const QByteArray& aa_policy_name, const QByteArray& aa_policy) const
+{
+    const auto hash = QCryptographicHash::hash(aa_policy, QCryptographicHash::Sha256);
+
+    std::lock_guard<decltype(loaded_policies->mutex)> lock{loaded_policies->mutex};
+    auto& loaded = loaded_policies->by_name[aa_policy_name.toStdString()];
+    if (loaded.first == hash)
+        return;
+
+    load_policy(aa_policy);
+    loaded = {hash, aa_policy};
+}
+
 void mp::AppArmor::load_policy(const QByteArray& aa_policy) const
 {
     QProcess process;
@@ -18,8 +18,14 @@
 #ifndef MULTIPASS_APPARMOR_H
 #define MULTIPASS_APPARMOR_H
 
+#include <QByteArray>
 #include <QStringList>
 
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
 namespace multipass
 {
 
@@ -27,14 +33,27 @@ class AppArmor
 {
 public:
     AppArmor();
+    AppArmor(AppArmor&&) = default;
+    ~AppArmor(); // removes the policies still loaded through ensure_policy_loaded()
 
     void load_policy(const QByteArray& aa_policy) const;
     void remove_policy(const QByteArray& aa_policy) const;
 
+    // Compiling a policy is slow, so each is loaded once and kept for the daemon's lifetime. A policy is only loaded
+    // again when the text under that name has changed
+    void ensure_policy_loaded(const QByteArray& aa_policy_name, const QByteArray& aa_policy) const;
+
     void next_exec_under_policy(const QByteArray& aa_policy_name) const;
 
 private:
+    struct LoadedPolicies
+    {
+        std::mutex mutex;
+        std::unordered_map<std::string, std::pair<QByteArray, QByteArray>> by_name; // text's hash, and the text
+    };
+
     const QStringList apparmor_args;
+    std::unique_ptr<LoadedPolicies> loaded_policies;
 };
 
 class AppArmorException : public std::runtime_error
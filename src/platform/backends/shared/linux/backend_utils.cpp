@@ -18,14 +18,19 @@
 #include "backend_utils.h"
 #include "process_factory.h"
 #include "qemuimg_process_spec.h"
+#include <multipass/constants.h>
+#include <multipass/ip_address.h>
 #include <multipass/logging/log.h>
 #include <multipass/memory_size.h>
+#include <multipass/optional.h>
 #include <multipass/process.h>
+#include <multipass/settings.h>
 #include <multipass/utils.h>
 
 #include <multipass/format.h>
 
 #include <QCoreApplication>
+#include <QFile>
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QProcess>
@@ -33,14 +38,27 @@
 #include <QString>
 #include <QSysInfo>
 
+#include <algorithm>
+#include <array>
 #include <chrono>
+#include <cstdint>
+#include <cstring>
 #include <exception>
 #include <random>
+#include <unordered_set>
+#include <vector>
 
+#include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <linux/kvm.h>
+#include <linux/rtnetlink.h>
+#include <net/if.h>
+#include <netinet/ip.h>
+#include <netinet/ip_icmp.h>
+#include <poll.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -52,11 +70,94 @@ namespace
 std::default_random_engine gen;
 std::uniform_int_distribution<int> dist{0, 255};
 
-bool subnet_used_locally(const std::string& subnet)
+constexpr auto candidate_subnets = 100;
+constexpr std::size_t subnets_probed_at_once = 16;
+constexpr std::chrono::milliseconds gateway_probe_timeout{500};
+
+using mp::backend::Route;
+
+// The IPv4 routing table, read once over rtnetlink instead of running `ip -4 route show`; nullopt if that fails
+mp::optional<std::vector<Route>> ipv4_routes()
+{
+    const auto fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (fd < 0)
+        return mp::nullopt;
+
+    struct
+    {
+        nlmsghdr header;
+        rtmsg message;
+    } request{};
+    request.header.nlmsg_len = sizeof(request);
+    request.header.nlmsg_type = RTM_GETROUTE;
+    request.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    request.header.nlmsg_seq = 1;
+    request.message.rtm_family = AF_INET;
+
+    std::vector<Route> routes;
+    auto failed = send(fd, &request, sizeof(request), 0) < 0;
+    auto done = false;
+
+    std::array<char, 32768> reply;
+    while (!done && !failed)
+    {
+        auto length = recv(fd, reply.data(), reply.size(), 0);
+        if (length < 0)
+        {
+            failed = errno != EINTR;
+            continue;
+        }
+
+        for (auto message = reinterpret_cast<nlmsghdr*>(reply.data()); NLMSG_OK(message, length);
+             message = NLMSG_NEXT(message, length))
+        {
+            if (message->nlmsg_type == NLMSG_DONE)
+                done = true;
+            else if (message->nlmsg_type == NLMSG_ERROR)
+                failed = true;
+            if (message->nlmsg_type != RTM_NEWROUTE)
+                continue;
+
+            const auto entry = reinterpret_cast<rtmsg*>(NLMSG_DATA(message));
+            if (entry->rtm_family != AF_INET)
+                continue;
+
+            Route route{0, entry->rtm_dst_len, 0};
+            auto attributes_length = RTM_PAYLOAD(message);
+            for (auto attribute = RTM_RTA(entry); RTA_OK(attribute, attributes_length);
+                 attribute = RTA_NEXT(attribute, attributes_length))
+            {
+                if (attribute->rta_type == RTA_DST)
+                    route.destination = ntohl(*reinterpret_cast<std::uint32_t*>(RTA_DATA(attribute)));
+                else if (attribute->rta_type == RTA_OIF)
+                    route.interface_index = *reinterpret_cast<int*>(RTA_DATA(attribute));
+            }
+            routes.push_back(route);
+        }
+    }
+
+    close(fd);
+    if (failed)
+        return mp::nullopt;
+
+    return routes;
+}
+
+std::uint32_t subnet_address(const std::string& subnet)
+{
+    return mp::IPAddress{fmt::format("{}.0", subnet)}.as_uint32();
+}
+
+bool subnet_used_locally(const std::string& subnet, const mp::optional<std::vector<Route>>& routes)
 {
-    // CLI equivalent: ip -4 route show | grep -q ${SUBNET}
-    const auto output = QString::fromStdString(mp::utils::run_cmd_for_output("ip", {"-4", "route", "show"}));
-    return output.contains(QString::fromStdString(subnet));
+    if (!routes)
+    {
+        // CLI equivalent: ip -4 route show | grep -q ${SUBNET}
+        const auto output = QString::fromStdString(mp::utils::run_cmd_for_output("ip", {"-4", "route", "show"}));
+        return output.contains(QString::fromStdString(subnet));
+    }
+
+    return mp::backend::subnet_routed_locally(subnet, *routes);
 }
 
 bool can_reach_gateway(const std::string& ip)
@@ -64,19 +165,140 @@ bool can_reach_gateway(const std::string& ip)
     return mp::utils::run_cmd_for_status("ping", {"-n", "-q", ip.c_str(), "-c", "-1", "-W", "1"});
 }
 
+std::uint16_t icmp_checksum(const void* data, std::size_t size)
+{
+    std::uint32_t sum = 0;
+    auto words = static_cast<const std::uint16_t*>(data);
+    for (; size > 1; size -= 2)
+        sum += *words++;
+    if (size)
+        sum += *reinterpret_cast<const std::uint8_t*>(words);
+
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+
+    return static_cast<std::uint16_t>(~sum);
+}
+
+// Pings all the addresses (host byte order) at once and returns those answering within the timeout, like `ping`
+// would but in one go. nullopt when ICMP sockets are not available to us
+mp::optional<std::unordered_set<std::uint32_t>> reachable_among(const std::vector<std::uint32_t>& addresses)
+{
+    // Raw sockets see every echo reply on the host, hence the identifier; ping sockets only get their own
+    auto raw = true;
+    auto fd = socket(AF_INET, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, IPPROTO_ICMP);
+    if (fd < 0)
+    {
+        raw = false;
+        fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, IPPROTO_ICMP);
+    }
+    if (fd < 0)
+        return mp::nullopt;
+
+    const auto identifier = htons(static_cast<std::uint16_t>(getpid()));
+    for (std::size_t i = 0; i < addresses.size(); ++i)
+    {
+        icmphdr echo{};
+        echo.type = ICMP_ECHO;
+        echo.un.echo.id = identifier;
+        echo.un.echo.sequence = htons(static_cast<std::uint16_t>(i));
+        echo.checksum = icmp_checksum(&echo, sizeof(echo));
+
+        sockaddr_in destination{};
+        destination.sin_family = AF_INET;
+        destination.sin_addr.s_addr = htonl(addresses[i]);
+        sendto(fd, &echo, sizeof(echo), 0, reinterpret_cast<sockaddr*>(&destination), sizeof(destination));
+    }
+
+    std::unordered_set<std::uint32_t> reachable;
+    const auto deadline = std::chrono::steady_clock::now() + gateway_probe_timeout;
+    for (auto now = std::chrono::steady_clock::now(); now < deadline && reachable.size() < addresses.size();
+         now = std::chrono::steady_clock::now())
+    {
+        pollfd poll_fd{fd, POLLIN, 0};
+        const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now);
+        if (poll(&poll_fd, 1, static_cast<int>(remaining.count()) + 1) <= 0)
+            continue;
+
+        std::array<char, 1024> packet;
+        sockaddr_in source{};
+        socklen_t source_length = sizeof(source);
+        const auto length = recvfrom(fd, packet.data(), packet.size(), 0, reinterpret_cast<sockaddr*>(&source),
+                                     &source_length);
+        if (length <= 0)
+            continue;
+
+        std::size_t offset = 0;
+        if (raw)
+            offset = reinterpret_cast<const iphdr*>(packet.data())->ihl * 4u;
+        if (static_cast<std::size_t>(length) < offset + sizeof(icmphdr))
+            continue;
+
+        icmphdr reply;
+        std::memcpy(&reply, packet.data() + offset, sizeof(reply));
+        if (reply.type == ICMP_ECHOREPLY && (!raw || reply.un.echo.id == identifier))
+            reachable.insert(ntohl(source.sin_addr.s_addr));
+    }
+
+    close(fd);
+    return reachable;
+}
+
+// The first of the candidates whose usual gateway addresses, .1 and .254, do not answer
+mp::optional<std::string> first_unreachable(const std::vector<std::string>& subnets)
+{
+    std::vector<std::uint32_t> gateways;
+    for (const auto& subnet : subnets)
+    {
+        gateways.push_back(subnet_address(subnet) + 1);
+        gateways.push_back(subnet_address(subnet) + 254);
+    }
+
+    const auto reachable = reachable_among(gateways);
+    for (std::size_t i = 0; i < subnets.size(); ++i)
+    {
+        if (!reachable)
+        {
+            // Without ICMP sockets of our own, `ping` is left to probe one gateway after another
+            if (!can_reach_gateway(fmt::format("{}.1", subnets[i])) &&
+                !can_reach_gateway(fmt::format("{}.254", subnets[i])))
+                return subnets[i];
+        }
+        else if (!reachable->count(gateways[2 * i]) && !reachable->count(gateways[2 * i + 1]))
+        {
+            return subnets[i];
+        }
+    }
+
+    return mp::nullopt;
+}
+
 auto virtual_switch_subnet(const QString& bridge_name)
 {
-    // CLI equivalent: ip -4 route show | grep ${BRIDGE_NAME} | cut -d ' ' -f1 | cut -d '.' -f1-3
     QString subnet;
 
-    const auto output =
-        QString::fromStdString(mp::utils::run_cmd_for_output("ip", {"-4", "route", "show"})).split('\n');
-    for (const auto& line : output)
+    const auto routes = ipv4_routes();
+    const auto bridge_index = static_cast<int>(if_nametoindex(qUtf8Printable(bridge_name)));
+    if (routes && bridge_index)
     {
-        if (line.contains(bridge_name))
+        auto route = std::find_if(routes->begin(), routes->end(), [bridge_index](const Route& entry) {
+            return entry.interface_index == bridge_index && entry.prefix_length > 0;
+        });
+        if (route != routes->end())
+            subnet = QString::fromStdString(mp::IPAddress{route->destination}.as_string()).section('.', 0, 2);
+    }
+    else if (!routes)
+    {
+        // CLI equivalent: ip -4 route show | grep ${BRIDGE_NAME} | cut -d ' ' -f1 | cut -d '.' -f1-3
+        const auto output =
+            QString::fromStdString(mp::utils::run_cmd_for_output("ip", {"-4", "route", "show"})).split('\n');
+        for (const auto& line : output)
         {
-            subnet = line.section('.', 0, 2);
-            break;
+            if (line.contains(bridge_name))
+            {
+                subnet = line.section('.', 0, 2);
+                break;
+            }
         }
     }
 
@@ -88,7 +310,7 @@ auto virtual_switch_subnet(const QString& bridge_name)
     return subnet.toStdString();
 }
 
-void check_min_img_size(const mp::MemorySize& requested_size, const mp::Path& image_path)
+std::string qemuimg_virtual_size(const mp::Path& image_path)
 {
     auto qemuimg_process = mp::ProcessFactory::instance().create_process(
         std::make_unique<mp::QemuImgProcessSpec>(QStringList{"info", image_path}));
@@ -104,37 +326,102 @@ void check_min_img_size(const mp::MemorySize& requested_size, const mp::Path& im
     const auto re = QRegularExpression{pattern, QRegularExpression::MultilineOption};
 
     if (const auto match = re.match(img_info); match.hasMatch())
-    {
-        const auto min_size = match.captured("size").toStdString();
-        if (requested_size < mp::MemorySize{min_size})
-            throw std::runtime_error(fmt::format("Requested disk ({} bytes) below minimum for this image ({} bytes)",
-                                                 requested_size.in_bytes(), min_size)); // TODO use human-readable sizes
-    }
+        return match.captured("size").toStdString();
     else
         throw std::runtime_error{fmt::format("Could not obtain image's virtual size")};
 }
 
+// Tuned for speed: parallel coroutines, writes in any order and zero runs skipped a whole cluster at a time. A fresh
+// qcow2 reads as zeroes already, so there is nothing for --target-is-zero to add
+QStringList qcow2_conversion_arguments(const mp::Path& source_path, const mp::Path& qcow2_path, bool compress)
+{
+    QStringList args{"convert", "-p", "-m", "16", "-S", "64k", "-O", "qcow2"};
+
+    // Images can be kept zstd-compressed on request, at the cost of in-order writes which compression needs
+    if (compress)
+        args << "-c" << "-o" << "compression_type=zstd";
+    else
+        args << "-W";
+
+    return args << source_path << qcow2_path;
+}
+
+void convert_image(const mp::Path& source_path, const mp::Path& qcow2_path, bool compress)
+{
+    auto qemuimg_spec =
+        std::make_unique<mp::QemuImgProcessSpec>(qcow2_conversion_arguments(source_path, qcow2_path, compress));
+    auto qemuimg_process = mp::ProcessFactory::instance().create_process(std::move(qemuimg_spec));
+    auto process_state = qemuimg_process->execute(-1);
+
+    if (!process_state.completed_successfully())
+    {
+        throw std::runtime_error(fmt::format("Failed to convert image format: qemu-img failed ({}) with output:\n{}",
+                                             process_state.failure_message(),
+                                             qemuimg_process->read_all_standard_error()));
+    }
+}
+
+void check_min_img_size(const mp::MemorySize& requested_size, const mp::Path& image_path)
+{
+    // Reading the qcow2 header spares the usual images a qemu-img run
+    const auto qcow2_size = mp::utils::qcow2_virtual_size(image_path);
+    const auto min_size = qcow2_size ? std::to_string(qcow2_size) : qemuimg_virtual_size(image_path);
+
+    if (requested_size < mp::MemorySize{min_size})
+        throw std::runtime_error(fmt::format("Requested disk ({} bytes) below minimum for this image ({} bytes)",
+                                             requested_size.in_bytes(), min_size)); // TODO use human-readable sizes
+}
+
+mp::Process::UPtr resize_process(const mp::MemorySize& disk_space, const mp::Path& image_path)
+{
+    auto disk_size = QString::number(disk_space.in_bytes()); // format documented in `man qemu-img` (look for "size")
+    auto qemuimg_spec = std::make_unique<mp::QemuImgProcessSpec>(QStringList{"resize", image_path, disk_size});
+    return mp::ProcessFactory::instance().create_process(std::move(qemuimg_spec));
+}
+
+std::string resize_failure(const mp::ProcessState& process_state, mp::Process& qemuimg_process)
+{
+    return fmt::format("Cannot resize instance image: qemu-img failed ({}) with output:\n{}",
+                       process_state.failure_message(), qemuimg_process.read_all_standard_error());
+}
+
 } // namespace
 
+bool mp::backend::subnet_routed_locally(const std::string& subnet, const std::vector<Route>& routes)
+{
+    constexpr auto subnet_prefix_length = 24;
+    constexpr auto subnet_mask = ~std::uint32_t{0} << (32 - subnet_prefix_length);
+
+    const auto address = subnet_address(subnet);
+    return std::any_of(routes.begin(), routes.end(), [address](const Route& route) {
+        return route.prefix_length >= subnet_prefix_length && (route.destination & subnet_mask) == address;
+    });
+}
+
 std::string mp::backend::generate_random_subnet()
 {
     gen.seed(std::chrono::system_clock::now().time_since_epoch().count());
-    for (auto i = 0; i < 100; ++i)
+    const auto routes = ipv4_routes();
+
+    // Candidates are probed a batch at a time, so that unlucky ones cost one short timeout between them all
+    std::vector<std::string> candidates;
+    for (auto i = 0; i < candidate_subnets; ++i)
     {
         auto subnet = fmt::format("10.{}.{}", dist(gen), dist(gen));
-        if (subnet_used_locally(subnet))
-            continue;
+        if (!subnet_used_locally(subnet, routes))
+            candidates.push_back(subnet);
 
-        if (can_reach_gateway(fmt::format("{}.1", subnet)))
-            continue;
-
-        if (can_reach_gateway(fmt::format("{}.254", subnet)))
-            continue;
-
-        return subnet;
+        if (candidates.size() == subnets_probed_at_once || (i == candidate_subnets - 1 && !candidates.empty()))
+        {
+            if (auto chosen = first_unreachable(candidates))
+                return *chosen;
+            candidates.clear();
+        }
     }
 
-    throw std::runtime_error("Could not determine a subnet for networking.");
+    throw std::runtime_error(fmt::format("Could not determine a subnet for networking: none of {} random 10.x.x.0/24 "
+                                         "subnets is free of local routes and unreachable",
+                                         candidate_subnets));
 }
 
 std::string mp::backend::get_subnet(const mp::Path& network_dir, const QString& bridge_name)
@@ -157,24 +444,86 @@ void mp::backend::resize_instance_image(const MemorySize& disk_space, const mp::
 {
     check_min_img_size(disk_space, image_path);
 
-    auto disk_size = QString::number(disk_space.in_bytes()); // format documented in `man qemu-img` (look for "size")
-    auto qemuimg_spec = std::make_unique<mp::QemuImgProcessSpec>(QStringList{"resize", image_path, disk_size});
+    auto qemuimg_process = resize_process(disk_space, image_path);
+    auto process_state = qemuimg_process->execute();
+    if (!process_state.completed_successfully())
+        throw std::runtime_error(resize_failure(process_state, *qemuimg_process));
+}
+
+void mp::backend::resize_instance_image_async(const MemorySize& disk_space, const mp::Path& image_path,
+                                              QObject* context, std::function<void(const std::string&)> done)
+{
+    try
+    {
+        check_min_img_size(disk_space, image_path);
+    }
+    catch (const std::exception& e)
+    {
+        return done(e.what());
+    }
+
+    // Held by the callback, which is dropped without being run when the context is gone
+    std::shared_ptr<mp::Process> qemuimg_process = resize_process(disk_space, image_path);
+    qemuimg_process->run_async(-1, context, [qemuimg_process, done](const mp::ProcessState& process_state) {
+        done(process_state.completed_successfully() ? std::string{} : resize_failure(process_state, *qemuimg_process));
+    });
+}
+
+void mp::backend::create_image_overlay(const mp::Path& backing_image_path, const mp::Path& overlay_path)
+{
+    auto qemuimg_spec = std::make_unique<mp::QemuImgProcessSpec>(
+        QStringList{"create", "-f", "qcow2", "-F", "qcow2", "-b", backing_image_path, overlay_path});
     auto qemuimg_process = mp::ProcessFactory::instance().create_process(std::move(qemuimg_spec));
 
     auto process_state = qemuimg_process->execute();
     if (!process_state.completed_successfully())
     {
-        throw std::runtime_error(fmt::format("Cannot resize instance image: qemu-img failed ({}) with output:\n{}",
-                                             process_state.failure_message(),
-                                             qemuimg_process->read_all_standard_error()));
+        throw std::runtime_error(
+            fmt::format("Cannot create instance image overlay: qemu-img failed ({}) with output:\n{}",
+                        process_state.failure_message(), qemuimg_process->read_all_standard_error()));
+    }
+}
+
+void mp::backend::rebase_image_overlay(const mp::Path& backing_image_path, const mp::Path& overlay_path)
+{
+    // Only the reference is rewritten, both images being known to hold the same; qemu-img takes the overlay's lock,
+    // and so refuses while an instance has it open
+    auto qemuimg_spec = std::make_unique<mp::QemuImgProcessSpec>(
+        QStringList{"rebase", "-u", "-F", "qcow2", "-b", backing_image_path, overlay_path});
+    auto qemuimg_process = mp::ProcessFactory::instance().create_process(std::move(qemuimg_spec));
+
+    auto process_state = qemuimg_process->execute();
+    if (!process_state.completed_successfully())
+    {
+        throw std::runtime_error(
+            fmt::format("Cannot rebase instance image overlay: qemu-img failed ({}) with output:\n{}",
+                        process_state.failure_message(), qemuimg_process->read_all_standard_error()));
     }
 }
 
+void mp::backend::flatten_image(const mp::Path& image_path, const mp::Path& flat_path, bool compress)
+{
+    // Converting reads through the whole backing chain, so what comes out stands on its own
+    convert_image(image_path, flat_path, compress);
+}
+
 mp::Path mp::backend::convert_to_qcow_if_necessary(const mp::Path& image_path)
 {
     // Check if raw image file, and if so, convert to qcow2 format.
     // TODO: we could support converting from other the image formats that qemu-img can deal with
     const auto qcow2_path{image_path + ".qcow2"};
+    const auto compress = mp::Settings::instance().get_as<bool>(mp::image_compression_key);
+
+    if (mp::utils::is_qcow2_image(image_path))
+    {
+        // Images usually come as zlib-compressed qcow2 already; recompressing them keeps them small but much quicker to
+        // read back
+        if (!compress || mp::utils::is_zstd_compressed_qcow2(image_path))
+            return image_path;
+
+        convert_image(image_path, qcow2_path, compress);
+        return qcow2_path;
+    }
 
     auto qemuimg_spec = std::make_unique<mp::QemuImgProcessSpec>(QStringList{"info", "--output=json", image_path});
     auto qemuimg_process = mp::ProcessFactory::instance().create_process(std::move(qemuimg_spec));
@@ -192,17 +541,7 @@ mp::Path mp::backend::convert_to_qcow_if_necessary(const mp::Path& image_path)
 
     if (image_record["format"].toString() == "raw")
     {
-        qemuimg_spec = std::make_unique<mp::QemuImgProcessSpec>(
-            QStringList{"convert", "-p", "-O", "qcow2", image_path, qcow2_path});
-        qemuimg_process = mp::ProcessFactory::instance().create_process(std::move(qemuimg_spec));
-        process_state = qemuimg_process->execute(-1);
-
-        if (!process_state.completed_successfully())
-        {
-            throw std::runtime_error(
-                fmt::format("Failed to convert image format: qemu-img failed ({}) with output:\n{}",
-                            process_state.failure_message(), qemuimg_process->read_all_standard_error()));
-        }
+        convert_image(image_path, qcow2_path, compress);
         return qcow2_path;
     }
     else
@@ -211,6 +550,34 @@ mp::Path mp::backend::convert_to_qcow_if_necessary(const mp::Path& image_path)
     }
 }
 
+std::string mp::backend::check_image(const mp::Path& image_path, int64_t bytes_per_second)
+{
+    // Only qcow2 images have anything for qemu-img to check
+    if (!mp::utils::is_qcow2_image(image_path))
+        return {};
+
+    // The check reads through a throttle node under the qcow2 one, so that it keeps to the budget as it goes. Sharing
+    // the image lets the check read it even when something else holds it open
+    const auto throttle_group = QString{"throttle-group,id=check,x-bps-read=%1"}.arg(bytes_per_second);
+    const auto image_opts = QString{"driver=qcow2,file.driver=throttle,file.throttle-group=check,"
+                                    "file.file.driver=file,file.file.filename=%1"}
+                                .arg(QString{image_path}.replace(",", ",,"));
+    auto qemuimg_process = mp::ProcessFactory::instance().create_process(std::make_unique<mp::QemuImgProcessSpec>(
+        QStringList{"check", "-U", "--object", throttle_group, "--image-opts", image_opts}));
+    auto process_state = qemuimg_process->execute();
+
+    // qemu-img check returns 2 for corruption, 3 for leaks alone and 63 for formats it cannot check
+    const auto exit_code = process_state.exit_code;
+    if (!process_state.error && exit_code && (*exit_code == 0 || *exit_code == 3 || *exit_code == 63))
+        return {};
+
+    if (!process_state.error && exit_code && *exit_code == 2)
+        return QString{qemuimg_process->read_all_standard_output()}.trimmed().toStdString();
+
+    throw std::runtime_error(fmt::format("Cannot check image: qemu-img failed ({}) with output:\n{}",
+                                         process_state.failure_message(), qemuimg_process->read_all_standard_error()));
+}
+
 QString mp::backend::cpu_arch()
 {
     const QHash<QString, QString> cpu_to_arch{{"x86_64", "x86_64"}, {"arm", "arm"},   {"arm64", "aarch64"},
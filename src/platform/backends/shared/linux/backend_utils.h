@@ -20,7 +20,12 @@
 
 #include <multipass/path.h>
 
+#include <cstdint>
+#include <functional>
 #include <string>
+#include <vector>
+
+class QObject;
 
 namespace multipass
 {
@@ -29,10 +34,35 @@ class ProcessFactory;
 
 namespace backend
 {
+struct Route
+{
+    std::uint32_t destination; // host byte order
+    int prefix_length;
+    int interface_index;
+};
+
+// Whether any route but the default one leads into the /24 subnet, e.g. "10.1.2". Routes wider than the subnet, like
+// a VPN's 10.0.0.0/8, do not count, as they would rule out every candidate; whether the subnet is in use behind them
+// is for probing to tell
+bool subnet_routed_locally(const std::string& subnet, const std::vector<Route>& routes);
+
 std::string generate_random_subnet();
 std::string get_subnet(const Path& network_dir, const QString& bridge_name);
 void resize_instance_image(const MemorySize& disk_space, const multipass::Path& image_path);
+
+// Returns once qemu-img is on its way, which can take a while on images that are large or far from the host. Done is
+// called on context's thread with what went wrong, or nothing when the image was grown
+void resize_instance_image_async(const MemorySize& disk_space, const Path& image_path, QObject* context,
+                                 std::function<void(const std::string&)> done);
+void create_image_overlay(const Path& backing_image_path, const Path& overlay_path);
+void rebase_image_overlay(const Path& backing_image_path, const Path& overlay_path);
+void flatten_image(const Path& image_path, const Path& flat_path, bool compress);
 Path convert_to_qcow_if_necessary(const Path& image_path);
+
+// What qemu-img finds wrong with the image, or nothing when it checks out or its format cannot be checked. Leaked
+// clusters only waste space, so they are not counted as wrong. qemu-img reads the image at no more than
+// bytes_per_second. Throws when qemu-img cannot tell
+std::string check_image(const Path& image_path, int64_t bytes_per_second);
 QString cpu_arch();
 void check_for_kvm_support();
 void check_if_kvm_is_in_use();
@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "guest_agent.h"
+
+#include <multipass/format.h>
+
+#include <QJsonArray>
+#include <QStringList>
+#include <QtEndian>
+
+#include <stdexcept>
+#include <thread>
+
+namespace mp = multipass;
+
+namespace
+{
+constexpr auto guest_file_chunk = 65536;
+constexpr auto max_guest_file_size = 1024 * 1024; // far more than the few files read here ever hold
+constexpr auto max_guest_file_reads = 64;         // for agents handing the file out a few bytes at a time
+constexpr auto utmp_record_size = 384;            // struct utmp on Linux, whatever the architecture
+constexpr auto utmp_user_process = 7;             // USER_PROCESS, the ut_type of a login session
+
+// What the guest has in one of its files, read through the agent rather than by a shell. Throws rather than keep
+// reading a file far bigger than any of these, or one the agent never says the end of
+QByteArray read_guest_file(const mp::backend::GuestAgentCommand& execute, const QString& path)
+{
+    const auto handle = execute("guest-file-open", {{"path", path}, {"mode", "r"}});
+
+    QByteArray contents;
+    try
+    {
+        auto eof = false;
+        for (auto reads = 0; !eof; ++reads)
+        {
+            if (reads == max_guest_file_reads || contents.size() > max_guest_file_size)
+                throw std::runtime_error(fmt::format("the guest's {} is too big to read", path));
+
+            const auto chunk = execute("guest-file-read", {{"handle", handle}, {"count", guest_file_chunk}}).toObject();
+            contents += QByteArray::fromBase64(chunk["buf-b64"].toString().toLatin1());
+            eof = chunk["eof"].toBool() || chunk["count"].toInt() == 0;
+        }
+    }
+    catch (...)
+    {
+        execute("guest-file-close", {{"handle", handle}});
+        throw;
+    }
+
+    execute("guest-file-close", {{"handle", handle}});
+    return contents;
+}
+
+// Fields of /proc/meminfo, in bytes
+long long meminfo_field(const QByteArray& meminfo, const QByteArray& field)
+{
+    for (const auto& line : meminfo.split('\n'))
+        if (line.startsWith(field + ':'))
+            return line.mid(field.size() + 1).trimmed().split(' ').front().toLongLong() * 1024;
+
+    throw std::runtime_error(fmt::format("no {} in the guest's meminfo", field.toStdString()));
+}
+
+// The login sessions in the guest's utmp, one per line of who(1); guest-get-users only tells the users apart
+int utmp_sessions(const QByteArray& utmp)
+{
+    auto sessions = 0;
+    for (auto record = 0; record + utmp_record_size <= utmp.size(); record += utmp_record_size)
+        if (qFromLittleEndian<qint32>(utmp.constData() + record) == utmp_user_process)
+            ++sessions;
+
+    return sessions;
+}
+} // namespace
+
+std::unordered_map<std::string, std::string> mp::backend::guest_agent_stats(const GuestAgentCommand& execute)
+{
+    std::unordered_map<std::string, std::string> stats;
+
+    const auto loadavg = QString::fromLatin1(read_guest_file(execute, "/proc/loadavg")).split(' ');
+    if (loadavg.size() < 3)
+        throw std::runtime_error("the guest's load average is unreadable");
+    stats["load"] = loadavg.mid(0, 3).join(' ').toStdString();
+
+    // Used as free(1) counts it, i.e. less what the kernel could give back from its buffers and caches
+    const auto meminfo = read_guest_file(execute, "/proc/meminfo");
+    const auto memory_total = meminfo_field(meminfo, "MemTotal");
+    const auto memory_used = memory_total - meminfo_field(meminfo, "MemFree") - meminfo_field(meminfo, "Buffers") -
+                             meminfo_field(meminfo, "Cached") - meminfo_field(meminfo, "SReclaimable");
+    stats["memory_usage"] = std::to_string(memory_used);
+    stats["memory_total"] = std::to_string(memory_total);
+
+    for (const auto& filesystem : execute("guest-get-fsinfo", {}).toArray())
+    {
+        const auto fs = filesystem.toObject();
+        if (fs["mountpoint"].toString() == "/" && fs.contains("used-bytes") && fs.contains("total-bytes"))
+        {
+            stats["disk_usage"] = std::to_string(fs["used-bytes"].toVariant().toLongLong());
+            stats["disk_total"] = std::to_string(fs["total-bytes"].toVariant().toLongLong());
+        }
+    }
+    if (!stats.count("disk_usage")) // agents before QEMU 5.0 do not report sizes
+        throw std::runtime_error("the guest agent does not tell the root filesystem's size");
+
+    const auto release = execute("guest-get-osinfo", {}).toObject()["pretty-name"].toString();
+    if (release.isEmpty())
+        throw std::runtime_error("the guest agent does not tell the release");
+    stats["current_release"] = release.toStdString();
+
+    stats["sessions"] = std::to_string(utmp_sessions(read_guest_file(execute, "/run/utmp")));
+
+    return stats;
+}
+
+void mp::backend::run_in_guest(const GuestAgentCommand& execute, const QString& script,
+                               std::chrono::milliseconds timeout, const QByteArray& input)
+{
+    using namespace std::literals::chrono_literals;
+
+    QJsonObject arguments{{"path", "/bin/sh"}, {"arg", QJsonArray{"-c", script}}, {"capture-output", true}};
+    if (!input.isEmpty())
+        arguments["input-data"] = QString::fromLatin1(input.toBase64());
+
+    const auto pid = execute("guest-exec", arguments).toObject()["pid"];
+
+    // The agent only tells whether the script is done when asked
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (true)
+    {
+        const auto status = execute("guest-exec-status", {{"pid", pid}}).toObject();
+        if (status["exited"].toBool())
+        {
+            if (status["exitcode"].toInt() != 0)
+                throw std::runtime_error(fmt::format(
+                    "the script exited with code {}: {}", status["exitcode"].toInt(),
+                    QByteArray::fromBase64(status["err-data"].toString().toLatin1()).trimmed().toStdString()));
+            return;
+        }
+
+        if (std::chrono::steady_clock::now() >= deadline)
+            throw std::runtime_error("the script did not finish in time");
+
+        std::this_thread::sleep_for(100ms);
+    }
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_GUEST_AGENT_H
+#define MULTIPASS_GUEST_AGENT_H
+
+#include <QJsonObject>
+#include <QJsonValue>
+#include <QString>
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <unordered_map>
+
+namespace multipass
+{
+namespace backend
+{
+// The virtio-serial port qemu-guest-agent listens on in the guest
+constexpr auto guest_agent_port_name = "org.qemu.guest_agent.0";
+
+// Runs a qemu-guest-agent command, however the backend reaches the agent, and gives back what it returned. Throws
+// when the agent refused the command or could not be reached
+using GuestAgentCommand = std::function<QJsonValue(const QString& command, const QJsonObject& arguments)>;
+
+// The stats the daemon otherwise gathers over SSH, under the same keys: load, memory_usage, memory_total, disk_usage,
+// disk_total, current_release and sessions. They come from the agent's guest-get-* commands, and from reading
+// /proc and the utmp through it; throws when any of them cannot be had
+std::unordered_map<std::string, std::string> guest_agent_stats(const GuestAgentCommand& execute);
+
+// Runs a shell script as root in the guest through the agent's guest-exec, and waits for it to finish. The input is
+// what the script reads on its standard input. Throws with what it wrote to stderr when it fails, and when it does not
+// finish within the timeout
+void run_in_guest(const GuestAgentCommand& execute, const QString& script, std::chrono::milliseconds timeout,
+                  const QByteArray& input = {});
+} // namespace backend
+} // namespace multipass
+
+#endif // MULTIPASS_GUEST_AGENT_H
@@ -18,6 +18,7 @@
 #include "process_factory.h"
 #include "basic_process.h"
 #include "simple_process_spec.h"
+#include "spawn_process.h"
 #include <multipass/format.h>
 #include <multipass/logging/log.h>
 #include <multipass/process_spec.h>
@@ -34,7 +35,8 @@ public:
     AppArmoredProcess(const mp::AppArmor& aa, std::shared_ptr<mp::ProcessSpec> spec)
         : mp::BasicProcess{spec}, apparmor{aa}
     {
-        apparmor.load_policy(process_spec->apparmor_profile().toLatin1());
+        apparmor.ensure_policy_loaded(process_spec->apparmor_profile_name().toLatin1(),
+                                      process_spec->apparmor_profile().toLatin1());
     }
 
     void setup_child_process() final
@@ -44,23 +46,20 @@ public:
         apparmor.next_exec_under_policy(process_spec->apparmor_profile_name().toLatin1());
     }
 
-    ~AppArmoredProcess()
-    {
-        try
-        {
-            apparmor.remove_policy(process_spec->apparmor_profile().toLatin1());
-        }
-        catch (const std::exception& e)
-        {
-            // It's not considered an error when an apparmor cannot be removed
-            mpl::log(mpl::Level::info, "apparmor", e.what());
-        }
-    }
-
 private:
     const mp::AppArmor& apparmor;
 };
 
+// posix_spawn can neither run code in the child nor (portably) change its directory, so only processes that need
+// neither are spared QProcess
+std::unique_ptr<mp::Process> create_unconfined_process(std::shared_ptr<mp::ProcessSpec> spec)
+{
+    if (mp::SpawnProcess::available() && spec->working_directory().isNull())
+        return std::make_unique<mp::SpawnProcess>(spec);
+
+    return std::make_unique<mp::BasicProcess>(spec);
+}
+
 mp::optional<mp::AppArmor> create_apparmor()
 {
     if (qEnvironmentVariableIsSet("DISABLE_APPARMOR"))
@@ -108,12 +107,12 @@ std::unique_ptr<mp::Process> mp::ProcessFactory::create_process(std::unique_ptr<
         {
             // TODO: This won't fly in strict mode (#1074), since we'll be confined by snapd
             mpl::log(mpl::Level::warning, "apparmor", e.what());
-            return std::make_unique<BasicProcess>(spec);
+            return create_unconfined_process(spec);
         }
     }
     else
     {
-        return std::make_unique<BasicProcess>(std::move(process_spec));
+        return create_unconfined_process(std::move(process_spec));
     }
 }
 
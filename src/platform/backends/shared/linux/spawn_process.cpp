@@ -0,0 +1,422 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "spawn_process.h"
+
+#include <multipass/format.h>
+#include <multipass/logging/log.h>
+#include <multipass/tracing.h>
+
+#include <QElapsedTimer>
+
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434 // the same on every architecture
+#endif
+
+namespace mp = multipass;
+namespace mpl = multipass::logging;
+
+namespace
+{
+constexpr auto exit_poll_ms = 10;
+
+int pidfd_open(pid_t pid)
+{
+    return static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+}
+
+void close_fd(int& fd)
+{
+    if (fd >= 0)
+        close(fd);
+    fd = -1;
+}
+
+// argv and envp for posix_spawn, pointing into storage which must outlive them
+std::vector<char*> to_c_strings(const QStringList& strings, std::vector<QByteArray>& storage)
+{
+    std::vector<char*> pointers;
+    for (const auto& string : strings)
+    {
+        storage.push_back(string.toLocal8Bit());
+        pointers.push_back(storage.back().data());
+    }
+    pointers.push_back(nullptr);
+
+    return pointers;
+}
+} // namespace
+
+bool mp::SpawnProcess::available()
+{
+    static const bool has_pidfd = [] {
+        auto fd = pidfd_open(getpid());
+        const auto opened = fd >= 0;
+        close_fd(fd);
+        return opened;
+    }();
+
+    return has_pidfd;
+}
+
+mp::SpawnProcess::SpawnProcess(std::shared_ptr<mp::ProcessSpec> spec) : process_spec{spec}
+{
+}
+
+mp::SpawnProcess::~SpawnProcess()
+{
+    if (running())
+    {
+        ::kill(pid, SIGKILL);
+        waitpid(pid, nullptr, 0);
+    }
+
+    close_fds();
+}
+
+QString mp::SpawnProcess::program() const
+{
+    return process_spec->program();
+}
+
+QStringList mp::SpawnProcess::arguments() const
+{
+    return process_spec->arguments();
+}
+
+QString mp::SpawnProcess::working_directory() const
+{
+    return process_spec->working_directory();
+}
+
+QProcessEnvironment mp::SpawnProcess::process_environment() const
+{
+    return process_spec->environment();
+}
+
+void mp::SpawnProcess::start()
+{
+    auto span = Tracer::instance().span("process spawn", {{"program", program().toStdString()}});
+
+    std::array<int, 2> in{{-1, -1}}, out{{-1, -1}}, err{{-1, -1}};
+    if (pipe2(in.data(), O_CLOEXEC) < 0 || pipe2(out.data(), O_CLOEXEC) < 0 || pipe2(err.data(), O_CLOEXEC) < 0)
+    {
+        const auto error = errno;
+        for (auto fd : {in[0], in[1], out[0], out[1], err[0], err[1]})
+            close_fd(fd);
+        set_error(QProcess::FailedToStart, QString("Cannot create pipes: %1").arg(std::strerror(error)));
+        return;
+    }
+
+    // The child's ends lose O_CLOEXEC as they are duplicated onto its standard streams
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, in[0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, out[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, err[1], STDERR_FILENO);
+
+    // Start the child with no signals blocked or ignored, whatever the daemon does with them
+    sigset_t no_signals, all_signals;
+    sigemptyset(&no_signals);
+    sigfillset(&all_signals);
+    posix_spawnattr_t attributes;
+    posix_spawnattr_init(&attributes);
+    posix_spawnattr_setsigmask(&attributes, &no_signals);
+    posix_spawnattr_setsigdefault(&attributes, &all_signals);
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+    std::vector<QByteArray> storage;
+    auto argv = to_c_strings(QStringList{program()} + arguments(), storage);
+    auto envp = to_c_strings(process_environment().toStringList(), storage);
+
+    const auto result = posix_spawnp(&pid, argv[0], &actions, &attributes, argv.data(), envp.data());
+
+    posix_spawnattr_destroy(&attributes);
+    posix_spawn_file_actions_destroy(&actions);
+    close(in[0]);
+    close(out[1]);
+    close(err[1]);
+    stdin_fd = in[1];
+    stdout_fd = out[0];
+    stderr_fd = err[0];
+
+    if (result != 0)
+    {
+        pid = -1;
+        close_fds();
+        set_error(QProcess::FailedToStart, QString("Failed to start: %1").arg(std::strerror(result)));
+        return;
+    }
+
+    pid_fd = pidfd_open(pid);
+    fcntl(stdout_fd, F_SETFL, O_NONBLOCK);
+    fcntl(stderr_fd, F_SETFL, O_NONBLOCK);
+
+    stdout_notifier = std::make_unique<QSocketNotifier>(stdout_fd, QSocketNotifier::Read);
+    QObject::connect(stdout_notifier.get(), &QSocketNotifier::activated, this,
+                     [this] { read_available(stdout_fd, standard_output, stdout_notifier, false); });
+    stderr_notifier = std::make_unique<QSocketNotifier>(stderr_fd, QSocketNotifier::Read);
+    QObject::connect(stderr_notifier.get(), &QSocketNotifier::activated, this,
+                     [this] { read_available(stderr_fd, standard_error, stderr_notifier, true); });
+    if (pid_fd >= 0)
+    {
+        exit_notifier = std::make_unique<QSocketNotifier>(pid_fd, QSocketNotifier::Read);
+        QObject::connect(exit_notifier.get(), &QSocketNotifier::activated, this, [this] { reap(); });
+    }
+
+    emit state_changed(QProcess::Running);
+    emit started();
+}
+
+void mp::SpawnProcess::terminate()
+{
+    if (running())
+        ::kill(pid, SIGTERM);
+}
+
+void mp::SpawnProcess::kill()
+{
+    if (running())
+        ::kill(pid, SIGKILL);
+}
+
+bool mp::SpawnProcess::wait_for_started(int /*msecs*/)
+{
+    // posix_spawn only returns once the child has exec'd, or failed to
+    return pid > 0;
+}
+
+bool mp::SpawnProcess::wait_for_finished(int msecs)
+{
+    if (!running())
+        return false;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    while (!exited)
+    {
+        std::array<pollfd, 3> fds{{{pid_fd, POLLIN, 0}, {stdout_fd, POLLIN, 0}, {stderr_fd, POLLIN, 0}}};
+        auto timeout = msecs < 0 ? -1 : std::max<int>(0, msecs - timer.elapsed());
+        if (pid_fd < 0 && (timeout < 0 || timeout > exit_poll_ms)) // no pidfd for this child, so check on it
+            timeout = exit_poll_ms;
+
+        if (poll(fds.data(), fds.size(), timeout) < 0 && errno != EINTR)
+            break;
+
+        if (fds[1].revents)
+            read_available(stdout_fd, standard_output, stdout_notifier, false);
+        if (fds[2].revents)
+            read_available(stderr_fd, standard_error, stderr_notifier, true);
+        if (fds[0].revents || pid_fd < 0)
+            reap();
+
+        if (!exited && msecs >= 0 && timer.elapsed() >= msecs)
+            break;
+    }
+
+    if (!exited)
+        set_error(QProcess::Timedout, "Process operation timed out");
+
+    return exited;
+}
+
+bool mp::SpawnProcess::running() const
+{
+    return pid > 0 && !exited;
+}
+
+qint64 mp::SpawnProcess::process_id() const
+{
+    return running() ? pid : 0;
+}
+
+mp::ProcessState mp::SpawnProcess::process_state() const
+{
+    mp::ProcessState state;
+
+    if (last_error != QProcess::UnknownError)
+        state.error = mp::ProcessState::Error{last_error, error_string()};
+    else if (exited)
+        state.exit_code = exit_code;
+
+    return state;
+}
+
+QString mp::SpawnProcess::error_string() const
+{
+    return QString{"program: %1; error: %2"}.arg(process_spec->program(), error_message);
+}
+
+QByteArray mp::SpawnProcess::read_all_standard_output()
+{
+    read_available(stdout_fd, standard_output, stdout_notifier, false);
+    QByteArray output;
+    output.swap(standard_output);
+    return output;
+}
+
+QByteArray mp::SpawnProcess::read_all_standard_error()
+{
+    read_available(stderr_fd, standard_error, stderr_notifier, true);
+    QByteArray output;
+    output.swap(standard_error);
+    return output;
+}
+
+qint64 mp::SpawnProcess::write(const QByteArray& data)
+{
+    if (stdin_fd < 0)
+        return -1;
+
+    qint64 written = 0;
+    while (written < data.size())
+    {
+        const auto count = ::write(stdin_fd, data.constData() + written, data.size() - written);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count < 0)
+            return written ? written : -1;
+
+        written += count;
+    }
+
+    return written;
+}
+
+void mp::SpawnProcess::close_write_channel()
+{
+    close_fd(stdin_fd);
+}
+
+mp::ProcessState mp::SpawnProcess::execute(const int timeout)
+{
+    auto span = Tracer::instance().span("process execute", {{"program", program().toStdString()}});
+    start();
+
+    if (!wait_for_started(timeout) || !wait_for_finished(timeout) || last_error != QProcess::UnknownError)
+        mpl::log(mpl::Level::error, qUtf8Printable(process_spec->program()), qUtf8Printable(error_message));
+
+    return process_state();
+}
+
+void mp::SpawnProcess::setup_child_process()
+{
+}
+
+void mp::SpawnProcess::set_error(QProcess::ProcessError error, const QString& message)
+{
+    last_error = error;
+    error_message = message;
+
+    emit error_occurred(error, error_string());
+    if (error == QProcess::FailedToStart)
+        emit state_changed(QProcess::NotRunning);
+}
+
+void mp::SpawnProcess::read_available(int& fd, QByteArray& buffer, std::unique_ptr<QSocketNotifier>& notifier,
+                                      bool is_error)
+{
+    if (fd < 0)
+        return;
+
+    std::array<char, 65536> chunk;
+    const auto previous_size = buffer.size();
+    ssize_t count;
+    while ((count = read(fd, chunk.data(), chunk.size())) > 0 || (count < 0 && errno == EINTR))
+    {
+        if (count > 0)
+            buffer.append(chunk.data(), count);
+    }
+
+    if (count == 0) // the child, and anything it passed the pipe on to, is done writing
+    {
+        notifier.reset();
+        close_fd(fd);
+    }
+
+    if (buffer.size() == previous_size)
+        return;
+
+    if (is_error)
+    {
+        // TODO: multiline output produces poor formatting in logs, needs improving
+        mpl::log(process_spec->error_log_level(), qUtf8Printable(process_spec->program()),
+                 buffer.constData() + previous_size);
+        emit ready_read_standard_error();
+    }
+    else
+    {
+        emit ready_read_standard_output();
+    }
+}
+
+void mp::SpawnProcess::reap()
+{
+    int status = 0;
+    if (!running() || waitpid(pid, &status, WNOHANG) != pid)
+        return;
+
+    exited = true;
+    exit_notifier.reset();
+    close_fd(pid_fd);
+
+    // Take what the child wrote just before exiting
+    read_available(stdout_fd, standard_output, stdout_notifier, false);
+    read_available(stderr_fd, standard_error, stderr_notifier, true);
+
+    mp::ProcessState state;
+    if (WIFEXITED(status))
+    {
+        exit_code = WEXITSTATUS(status);
+        state.exit_code = exit_code;
+    }
+    else
+    {
+        last_error = QProcess::Crashed;
+        error_message = "Process crashed";
+        state.error = mp::ProcessState::Error{last_error, error_string()};
+        emit error_occurred(last_error, error_string());
+    }
+
+    emit state_changed(QProcess::NotRunning);
+    emit finished(state);
+}
+
+void mp::SpawnProcess::close_fds()
+{
+    exit_notifier.reset();
+    stdout_notifier.reset();
+    stderr_notifier.reset();
+    close_fd(pid_fd);
+    close_fd(stdin_fd);
+    close_fd(stdout_fd);
+    close_fd(stderr_fd);
+}
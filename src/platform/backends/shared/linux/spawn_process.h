@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_SPAWN_PROCESS_H
+#define MULTIPASS_SPAWN_PROCESS_H
+
+#include <multipass/process.h>
+#include <multipass/process_spec.h>
+
+#include <QSocketNotifier>
+
+#include <memory>
+
+#include <sys/types.h>
+
+namespace multipass
+{
+// SpawnProcess implements the Process interface with posix_spawn, which glibc runs as a vfork-style clone that does
+// not copy the daemon's page tables. Exit is noticed through a pidfd rather than SIGCHLD. Nothing can run in the
+// child before exec, so confined processes still need a BasicProcess
+class SpawnProcess : public Process
+{
+public:
+    // Whether the kernel hands out pidfds (Linux 5.3 and later)
+    static bool available();
+
+    explicit SpawnProcess(std::shared_ptr<ProcessSpec> spec);
+    ~SpawnProcess();
+
+    QString program() const override;
+    QStringList arguments() const override;
+    QString working_directory() const override;
+    QProcessEnvironment process_environment() const override;
+
+    void start() override;
+    void terminate() override;
+    void kill() override;
+
+    bool wait_for_started(int msecs = 30000) override;
+    bool wait_for_finished(int msecs = 30000) override;
+
+    bool running() const override;
+    qint64 process_id() const override;
+    ProcessState process_state() const override;
+    QString error_string() const;
+
+    QByteArray read_all_standard_output() override;
+    QByteArray read_all_standard_error() override;
+
+    // Blocks until all of data has been taken by the child
+    qint64 write(const QByteArray& data) override;
+    void close_write_channel() override;
+
+    ProcessState execute(const int timeout = 30000) override;
+
+protected:
+    void setup_child_process() override;
+
+private:
+    void set_error(QProcess::ProcessError error, const QString& message);
+    void read_available(int& fd, QByteArray& buffer, std::unique_ptr<QSocketNotifier>& notifier, bool is_error);
+    void reap();
+    void close_fds();
+
+    const std::shared_ptr<ProcessSpec> process_spec;
+    pid_t pid{-1};
+    int pid_fd{-1};
+    int stdin_fd{-1};
+    int stdout_fd{-1};
+    int stderr_fd{-1};
+    std::unique_ptr<QSocketNotifier> exit_notifier;
+    std::unique_ptr<QSocketNotifier> stdout_notifier;
+    std::unique_ptr<QSocketNotifier> stderr_notifier;
+    QByteArray standard_output;
+    QByteArray standard_error;
+    bool exited{false};
+    int exit_code{0};
+    QProcess::ProcessError last_error{QProcess::UnknownError};
+    QString error_message{"Unknown error"};
+};
+} // namespace multipass
+
+#endif // MULTIPASS_SPAWN_PROCESS_H
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <multipass/process.h>
+
+#include <QTimer>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace mp = multipass;
+
+std::future<mp::ProcessState> mp::Process::run_async(const int timeout)
+{
+    auto promise = std::make_shared<std::promise<ProcessState>>();
+    auto future = promise->get_future();
+    run_async(timeout, nullptr, [promise](const ProcessState& state) { promise->set_value(state); });
+
+    return future;
+}
+
+void mp::Process::run_async(const int timeout, QObject* context,
+                            std::function<void(const ProcessState&)> on_completion)
+{
+    // Connected to the context, which takes the connections with it when it goes, and has the outcome queued to its
+    // thread; the process itself is left on its own thread for its event loop to tell when it is done
+    auto receiver = context ? context : this;
+    auto connections = std::make_shared<std::vector<QMetaObject::Connection>>();
+    auto timer = timeout < 0 ? nullptr : new QTimer{this};
+    auto done = std::make_shared<bool>(false); // only touched on the receiver's thread
+    auto timed_out = std::make_shared<std::atomic_bool>(false);
+
+    auto complete = [connections, timer, done, timed_out, on_completion](ProcessState state) {
+        if (*done)
+            return;
+        *done = true;
+
+        if (*timed_out)
+            state.error = ProcessState::Error{QProcess::Timedout, QStringLiteral("Process timed out")};
+
+        for (const auto& connection : *connections)
+            QObject::disconnect(connection);
+        if (timer)
+            timer->deleteLater();
+
+        on_completion(state);
+    };
+
+    connections->push_back(connect(this, &Process::finished, receiver, complete));
+    connections->push_back(connect(this, &Process::error_occurred, receiver,
+                                   [complete](QProcess::ProcessError error, const QString& error_string) {
+                                       if (error != QProcess::FailedToStart)
+                                           return; // finished follows
+
+                                       ProcessState state;
+                                       state.error = ProcessState::Error{error, error_string};
+                                       complete(state);
+                                   }));
+
+    if (timer)
+    {
+        timer->setSingleShot(true);
+        connect(timer, &QTimer::timeout, this, [this, timed_out] {
+            *timed_out = true;
+            kill();
+        });
+        timer->start(timeout);
+    }
+
+    start();
+}
@@ -17,7 +17,9 @@
 
 #include "sshfs_server_process_spec.h"
 
+#include <multipass/constants.h>
 #include <multipass/snap_utils.h>
+#include <multipass/tracing.h>
 
 #include <QCoreApplication>
 #include <QCryptographicHash>
@@ -58,16 +60,33 @@ QString mp::SSHFSServerProcessSpec::program() const
 
 QStringList mp::SSHFSServerProcessSpec::arguments() const
 {
-    return QStringList() << QString::fromStdString(config.host) << QString::number(config.port)
-                         << QString::fromStdString(config.username) << QString::fromStdString(config.source_path)
-                         << QString::fromStdString(config.target_path) << serialise_id_map(config.uid_map)
-                         << serialise_id_map(config.gid_map);
+    auto arguments = QStringList() << QString::fromStdString(config.host) << QString::number(config.port)
+                                   << QString::fromStdString(config.username)
+                                   << QString::fromStdString(config.source_path)
+                                   << QString::fromStdString(config.target_path) << serialise_id_map(config.uid_map)
+                                   << serialise_id_map(config.gid_map) << QString::fromStdString(config.profile);
+
+    for (const auto& mount : config.additional_mounts)
+        arguments << QString::fromStdString(mount.source_path) << QString::fromStdString(mount.target_path)
+                  << serialise_id_map(mount.uid_map) << serialise_id_map(mount.gid_map)
+                  << QString::fromStdString(mount.profile);
+
+    return arguments;
 }
 
 QProcessEnvironment mp::SSHFSServerProcessSpec::environment() const
 {
     QProcessEnvironment env = QProcessEnvironment::systemEnvironment();
     env.insert("KEY", QString::fromStdString(config.private_key));
+    env.insert("SSH_CRYPTO", QString::fromStdString(config.crypto_profile));
+    if (!config.control_socket.empty())
+        env.insert("CONTROL_SOCKET", QString::fromStdString(config.control_socket));
+
+    // The helper's spans join the trace of whatever mounts it
+    const auto trace_parent = Tracer::instance().current();
+    if (trace_parent.valid())
+        env.insert(trace_parent_env_var, QString::fromStdString(trace_parent.serialised()));
+
     return env;
 }
 
@@ -112,10 +131,10 @@ profile %1 flags=(attach_disconnected) {
     # CLASSIC ONLY: need to specify required libs from core snap
     /{,var/lib/snapd/}snap/core18/*/{,usr/}lib/@{multiarch}/{,**/}*.so* rm,
 
-    # allow full access just to this user-specified source directory on the host
+    # allow full access just to the user-specified source directories on the host
     %4/ rw,
     %4/** rwlk,
-}
+%5}
     )END");
 
     /* Customisations depending on if running inside snap or not */
@@ -136,8 +155,21 @@ profile %1 flags=(attach_disconnected) {
         signal_peer = "unconfined";
     }
 
+    QString additional_sources;
+    for (const auto& mount : config.additional_mounts)
+    {
+        const auto source = QString::fromStdString(mount.source_path);
+        additional_sources += QString("    %1/ rw,\n    %1/** rwlk,\n").arg(source);
+    }
+
+    if (!config.control_socket.empty())
+        additional_sources += QString("\n    # the socket the daemon finds the server again by\n"
+                                      "    unix (create, bind, listen, accept, send, receive) type=stream,\n"
+                                      "    %1 rw,\n")
+                                  .arg(QString::fromStdString(config.control_socket));
+
     return profile_template.arg(apparmor_profile_name(), signal_peer, root_dir,
-                                QString::fromStdString(config.source_path));
+                                QString::fromStdString(config.source_path), additional_sources);
 }
 
 QString mp::SSHFSServerProcessSpec::identifier() const
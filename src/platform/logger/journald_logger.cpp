@@ -55,3 +55,8 @@ void mpl::JournaldLogger::log(mpl::Level level, CString category, CString messag
                         category.c_str(), nullptr);
     }
 }
+
+bool mpl::JournaldLogger::enabled(mpl::Level level) const
+{
+    return level <= logging_level;
+}
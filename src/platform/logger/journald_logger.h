@@ -29,6 +29,7 @@ class JournaldLogger : public Logger
 public:
     explicit JournaldLogger(Level level);
     void log(Level level, CString category, CString message) const override;
+    bool enabled(Level level) const override;
 
 private:
     Level logging_level;
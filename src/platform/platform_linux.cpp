@@ -27,14 +27,23 @@
 #include "backends/libvirt/libvirt_virtual_machine_factory.h"
 #include "backends/qemu/qemu_virtual_machine_factory.h"
 #include "logger/journald_logger.h"
+#include "shared/linux/backend_utils.h"
 #include "shared/linux/process_factory.h"
 #include "shared/sshfs_server_process_spec.h"
 #include <disabled_update_prompt.h>
 
+#include <QDir>
+#include <QFile>
 #include <QStandardPaths>
 
+#include <fcntl.h>
+#include <linux/fs.h>
 #include <signal.h>
+#include <sys/ioctl.h>
 #include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
 
 namespace mp = multipass;
 namespace mpl = multipass::logging;
@@ -110,6 +119,85 @@ std::unique_ptr<mp::Process> mp::platform::make_sshfs_server_process(const mp::S
     return mp::ProcessFactory::instance().create_process(std::make_unique<mp::SSHFSServerProcessSpec>(config));
 }
 
+void mp::platform::create_image_overlay(const mp::Path& backing_image_path, const mp::Path& overlay_path)
+{
+    mp::backend::create_image_overlay(backing_image_path, overlay_path);
+}
+
+void mp::platform::rebase_image_overlay(const mp::Path& backing_image_path, const mp::Path& overlay_path)
+{
+    mp::backend::rebase_image_overlay(backing_image_path, overlay_path);
+}
+
+void mp::platform::flatten_image(const mp::Path& image_path, const mp::Path& flat_path, bool compress)
+{
+    mp::backend::flatten_image(image_path, flat_path, compress);
+}
+
+bool mp::platform::clone_file(const char* source, const char* destination)
+{
+    const auto source_fd = ::open(source, O_RDONLY | O_CLOEXEC);
+    if (source_fd < 0)
+        return false;
+
+    struct stat st
+    {
+    };
+    if (::fstat(source_fd, &st) < 0)
+    {
+        ::close(source_fd);
+        return false;
+    }
+
+    // Like QFile::copy, refuse to overwrite an existing destination
+    const auto destination_fd = ::open(destination, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, st.st_mode & 0777);
+    if (destination_fd < 0)
+    {
+        ::close(source_fd);
+        return false;
+    }
+
+    // A reflink shares extents on btrfs/XFS; failing that, let the kernel copy without a round trip to user space
+    auto cloned = ::ioctl(destination_fd, FICLONE, source_fd) == 0;
+    if (!cloned)
+    {
+        auto remaining = st.st_size;
+        ssize_t copied = 0;
+        while (remaining > 0 &&
+               (copied = ::copy_file_range(source_fd, nullptr, destination_fd, nullptr, remaining, 0)) > 0)
+            remaining -= copied;
+
+        cloned = remaining == 0;
+    }
+
+    ::close(destination_fd);
+    ::close(source_fd);
+
+    if (!cloned)
+        ::unlink(destination);
+
+    return cloned;
+}
+
+bool mp::platform::on_rotational_disk(const char* path)
+{
+    struct stat st
+    {
+    };
+
+    if (::stat(path, &st) < 0)
+        return false;
+
+    // Partitions have their queue in the directory of the disk they are on
+    QDir device_dir{QString("/sys/dev/block/%1:%2").arg(major(st.st_dev)).arg(minor(st.st_dev))};
+    device_dir.setPath(device_dir.canonicalPath());
+    if (device_dir.path().isEmpty() || (device_dir.exists("partition") && !device_dir.cdUp()))
+        return false; // not on a block device, e.g. on btrfs or tmpfs
+
+    QFile rotational{device_dir.filePath("queue/rotational")};
+    return rotational.open(QIODevice::ReadOnly) && rotational.readAll().trimmed() == "1";
+}
+
 mp::UpdatePrompt::UPtr mp::platform::make_update_prompt()
 {
     return std::make_unique<DisabledUpdatePrompt>();
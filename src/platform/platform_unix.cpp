@@ -70,6 +70,23 @@ int mp::platform::utime(const char* path, int atime, int mtime)
     return ::lutimes(path, tv);
 }
 
+bool mp::platform::sync_file(int fd)
+{
+    return ::fsync(fd) == 0;
+}
+
+long long mp::platform::allocated_size(const char* path)
+{
+    struct stat st
+    {
+    };
+
+    if (::stat(path, &st) < 0)
+        return -1;
+
+    return static_cast<long long>(st.st_blocks) * 512; // st_blocks counts 512-byte units whatever the block size
+}
+
 int mp::platform::symlink_attr_from(const char* path, sftp_attributes_struct* attr)
 {
     struct stat st
@@ -21,8 +21,11 @@
 #include <QHash>
 #include <QJsonDocument>
 #include <QJsonObject>
+#include <QSet>
 #include <QSysInfo>
 
+#include <algorithm>
+
 namespace mp = multipass;
 
 namespace
@@ -56,6 +59,32 @@ QString latest_version_in(const QJsonObject& versions)
     return max_version;
 }
 
+// Hands out one copy of every distinct string, which QString's implicit sharing then keeps for all the products it is
+// in. Versions, releases and aliases repeat across thousands of entries
+class StringPool
+{
+public:
+    QString intern(const QString& string)
+    {
+        auto it = strings.constFind(string);
+        if (it == strings.constEnd())
+            it = strings.insert(string);
+        return *it;
+    }
+
+    QStringList intern(const QStringList& list)
+    {
+        QStringList interned;
+        interned.reserve(list.size());
+        for (const auto& string : list)
+            interned.push_back(intern(string));
+        return interned;
+    }
+
+private:
+    QSet<QString> strings;
+};
+
 QString derive_unpacked_file_path_prefix_from(const QString& image_location)
 {
     QFileInfo info{image_location};
@@ -85,6 +114,9 @@ std::unique_ptr<mp::SimpleStreamsManifest> mp::SimpleStreamsManifest::fromJson(c
     if (arch.isEmpty())
         throw std::runtime_error("Unsupported cloud image architecture");
 
+    StringPool pool;
+    const auto os = pool.intern(QStringLiteral("Ubuntu"));
+
     std::vector<VMImageInfo> products;
     for (const auto& value : manifest_products)
     {
@@ -93,10 +125,10 @@ std::unique_ptr<mp::SimpleStreamsManifest> mp::SimpleStreamsManifest::fromJson(c
         if (product["arch"].toString() != arch)
             continue;
 
-        const auto product_aliases = product["aliases"].toString().split(",");
+        const auto product_aliases = pool.intern(product["aliases"].toString().split(","));
 
-        const auto release = product["release"].toString();
-        const auto release_title = product["release_title"].toString();
+        const auto release = pool.intern(product["release"].toString());
+        const auto release_title = pool.intern(product["release_title"].toString());
         const auto supported = product["supported"].toBool();
 
         const auto versions = product["versions"].toObject();
@@ -107,8 +139,8 @@ std::unique_ptr<mp::SimpleStreamsManifest> mp::SimpleStreamsManifest::fromJson(c
 
         for (auto it = versions.constBegin(); it != versions.constEnd(); ++it)
         {
-            const auto version_string = it.key();
-            const auto version = versions[version_string].toObject();
+            const auto version_string = pool.intern(it.key());
+            const auto version = it.value().toObject();
             const auto items = version["items"].toObject();
             if (items.isEmpty())
                 continue;
@@ -126,7 +158,7 @@ std::unique_ptr<mp::SimpleStreamsManifest> mp::SimpleStreamsManifest::fromJson(c
 
             // Aliases always alias to the latest version
             const QStringList& aliases = version_string == latest_version ? product_aliases : QStringList();
-            products.push_back({aliases, "Ubuntu", release, release_title, supported, image_location, kernel_location,
+            products.push_back({aliases, os, release, release_title, supported, image_location, kernel_location,
                                 initrd_location, sha256, version_string, size, true});
         }
     }
@@ -134,7 +166,14 @@ std::unique_ptr<mp::SimpleStreamsManifest> mp::SimpleStreamsManifest::fromJson(c
     if (products.empty())
         throw std::runtime_error("failed to parse any products");
 
-    QMap<QString, const VMImageInfo*> map;
+    products.shrink_to_fit();
+
+    QHash<QString, const VMImageInfo*> map;
+    map.reserve(static_cast<int>(products.size()));
+    std::vector<const VMImageInfo*> by_id;
+    by_id.reserve(products.size());
+    std::vector<bool> supported;
+    supported.reserve(products.size());
 
     for (const auto& product : products)
     {
@@ -143,8 +182,38 @@ std::unique_ptr<mp::SimpleStreamsManifest> mp::SimpleStreamsManifest::fromJson(c
         {
             map[alias] = &product;
         }
+        by_id.push_back(&product);
+        supported.push_back(product.supported);
+    }
+
+    std::stable_sort(by_id.begin(), by_id.end(),
+                     [](const VMImageInfo* a, const VMImageInfo* b) { return a->id < b->id; });
+
+    return std::unique_ptr<SimpleStreamsManifest>(new SimpleStreamsManifest{
+        updated, std::move(products), std::move(map), std::move(by_id), std::move(supported)});
+}
+
+std::vector<const mp::VMImageInfo*> mp::SimpleStreamsManifest::products_with_id_prefix(const QString& prefix) const
+{
+    auto it = std::lower_bound(products_by_id.cbegin(), products_by_id.cend(), prefix,
+                               [](const VMImageInfo* product, const QString& id) { return product->id < id; });
+
+    std::vector<const VMImageInfo*> matches;
+    for (; it != products_by_id.cend() && (*it)->id.startsWith(prefix); ++it)
+        matches.push_back(*it);
+
+    return matches;
+}
+
+std::vector<const mp::VMImageInfo*> mp::SimpleStreamsManifest::supported_products(bool allow_unsupported) const
+{
+    std::vector<const VMImageInfo*> matches;
+    matches.reserve(products.size());
+    for (std::size_t i = 0; i < products.size(); ++i)
+    {
+        if (allow_unsupported || supported[i])
+            matches.push_back(&products[i]);
     }
 
-    return std::unique_ptr<SimpleStreamsManifest>(
-        new SimpleStreamsManifest{updated, std::move(products), std::move(map)});
+    return matches;
 }
@@ -59,21 +59,10 @@ mp::OpenSSHKeyProvider::KeyUPtr get_priv_key(const QDir& key_dir)
     }
     return create_priv_key(priv_key_path);
 }
-} // namespace
-
-void mp::OpenSSHKeyProvider::KeyDeleter::operator()(ssh_key key)
-{
-    ssh_key_free(key);
-}
 
-mp::OpenSSHKeyProvider::OpenSSHKeyProvider(const mp::Path& cache_dir)
-    : ssh_key_dir{mp::utils::make_dir(cache_dir, "ssh-keys")}, priv_key{get_priv_key(ssh_key_dir)}
+std::string read_priv_key_base64(const QDir& key_dir)
 {
-}
-
-std::string mp::OpenSSHKeyProvider::private_key_as_base64() const
-{
-    QFile key_file{ssh_key_dir.filePath("id_rsa")};
+    QFile key_file{key_dir.filePath("id_rsa")};
     auto opened = key_file.open(QIODevice::ReadOnly);
     if (!opened)
         throw std::runtime_error(fmt::format("Unable to open private key file '{}'", key_file.fileName()));
@@ -83,10 +72,10 @@ std::string mp::OpenSSHKeyProvider::private_key_as_base64() const
     return {data.constData(), data_size};
 }
 
-std::string mp::OpenSSHKeyProvider::public_key_as_base64() const
+std::string export_pub_key_base64(ssh_key priv_key)
 {
     char* base64{nullptr};
-    auto ret = ssh_pki_export_pubkey_base64(priv_key.get(), &base64);
+    auto ret = ssh_pki_export_pubkey_base64(priv_key, &base64);
     std::unique_ptr<char, decltype(std::free)*> base64_output{base64, std::free};
 
     if (ret != SSH_OK)
@@ -94,6 +83,30 @@ std::string mp::OpenSSHKeyProvider::public_key_as_base64() const
 
     return {base64};
 }
+} // namespace
+
+void mp::OpenSSHKeyProvider::KeyDeleter::operator()(ssh_key key)
+{
+    ssh_key_free(key);
+}
+
+mp::OpenSSHKeyProvider::OpenSSHKeyProvider(const mp::Path& cache_dir)
+    : ssh_key_dir{mp::utils::make_dir(cache_dir, "ssh-keys")},
+      priv_key{get_priv_key(ssh_key_dir)},
+      priv_key_base64{read_priv_key_base64(ssh_key_dir)},
+      pub_key_base64{export_pub_key_base64(priv_key.get())}
+{
+}
+
+std::string mp::OpenSSHKeyProvider::private_key_as_base64() const
+{
+    return priv_key_base64;
+}
+
+std::string mp::OpenSSHKeyProvider::public_key_as_base64() const
+{
+    return pub_key_base64;
+}
 
 ssh_key mp::OpenSSHKeyProvider::private_key() const
 {
@@ -23,21 +23,69 @@
 
 #include <multipass/format.h>
 
+#include <algorithm>
 #include <array>
+#include <deque>
 #include <fcntl.h>
+#include <limits>
+#include <vector>
 
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QDirIterator>
 #include <QFile>
+#include <QFileInfo>
 
 namespace mp = multipass;
 
 namespace
 {
-// TODO: For push/pull, use actual file permissions
 constexpr int file_mode = 0664;
 constexpr auto max_transfer = 65536u;
+constexpr auto stream_output_size = 1024u * 1024u;
+constexpr auto max_write_transfer = 256u * 1024u - 1024u; // stays under the 256KiB message limit of sftp-server
 const std::string stream_file_name{"stream_output.dat"};
+constexpr auto sync_block_size = 128u * 1024u;
+constexpr auto to_end = std::numeric_limits<uint64_t>::max();
+// Instances always have python3, cloud-init runs on it
+constexpr auto block_digests_cmd = "python3 -c 'import hashlib, sys\n"
+                                   "with open(sys.argv[1], \"rb\") as f:\n"
+                                   "    for block in iter(lambda: f.read({}), b\"\"):\n"
+                                   "        print(hashlib.sha1(block).hexdigest())' {}";
 
 using SFTPFileUPtr = std::unique_ptr<sftp_file_struct, int (*)(sftp_file)>;
+using SFTPDirUPtr = std::unique_ptr<sftp_dir_struct, int (*)(sftp_dir)>;
+using SFTPAttributesUPtr = std::unique_ptr<sftp_attributes_struct, void (*)(sftp_attributes)>;
+
+const std::array<std::pair<int, QFileDevice::Permissions>, 9> permission_bits{
+    {{0400, QFileDevice::ReadOwner | QFileDevice::ReadUser},
+     {0200, QFileDevice::WriteOwner | QFileDevice::WriteUser},
+     {0100, QFileDevice::ExeOwner | QFileDevice::ExeUser},
+     {0040, QFileDevice::ReadGroup},
+     {0020, QFileDevice::WriteGroup},
+     {0010, QFileDevice::ExeGroup},
+     {0004, QFileDevice::ReadOther},
+     {0002, QFileDevice::WriteOther},
+     {0001, QFileDevice::ExeOther}}};
+
+int mode_from(QFileDevice::Permissions permissions)
+{
+    int mode{0};
+    for (const auto& bit : permission_bits)
+        if (permissions & bit.second)
+            mode |= bit.first;
+    return mode;
+}
+
+QFileDevice::Permissions permissions_from(int mode)
+{
+    QFileDevice::Permissions permissions;
+    for (const auto& bit : permission_bits)
+        if (mode & bit.first)
+            permissions |= bit.second;
+    return permissions;
+}
 
 mp::SFTPSessionUPtr make_sftp_session(ssh_session session)
 {
@@ -49,6 +97,100 @@ mp::SFTPSessionUPtr make_sftp_session(ssh_session session)
     return sftp;
 }
 
+[[noreturn]] void throw_transfer_error(const mp::SFTPSessionUPtr& sftp, mp::SSHSession& session,
+                                      const char* error_msg)
+{
+    mp::SSH::throw_on_error(sftp, session, error_msg, sftp_get_error);
+    throw std::runtime_error(fmt::format("{}: '{}'", error_msg, ssh_get_error(session)));
+}
+
+// Keeps up to `window` reads in flight, so that throughput is bound by bandwidth rather than by round-trips. Reads
+// the file from start until end, or until it ends before that
+template <typename Sink>
+void read_windowed(const mp::SFTPSessionUPtr& sftp, mp::SSHSession& session, sftp_file file, std::size_t window,
+                   uint64_t start, uint64_t end, const char* error_msg, Sink&& sink)
+{
+    struct Request
+    {
+        int id;
+        uint64_t offset;
+        uint32_t size;
+    };
+
+    std::deque<Request> requests;
+    std::array<char, max_transfer> data;
+    uint64_t next_offset{start};
+    auto eof = false;
+
+    while (true)
+    {
+        while (!eof && next_offset < end && requests.size() < window)
+        {
+            const auto size = static_cast<uint32_t>(std::min<uint64_t>(max_transfer, end - next_offset));
+            sftp_seek64(file, next_offset);
+            auto id = sftp_async_read_begin(file, size);
+            if (id < 0)
+                throw_transfer_error(sftp, session, error_msg);
+
+            requests.push_back({id, next_offset, size});
+            next_offset += size;
+        }
+
+        if (requests.empty())
+            break;
+
+        const auto request = requests.front();
+        requests.pop_front();
+
+        auto r = sftp_async_read(file, data.data(), data.size(), request.id);
+        if (r < 0)
+            throw_transfer_error(sftp, session, error_msg);
+
+        if (r > 0)
+            sink(data.data(), r);
+
+        if (static_cast<uint32_t>(r) < request.size)
+        {
+            // The replies queued after a short read do not follow on from it, so drop them and resume from its end
+            for (const auto& pending : requests)
+                sftp_async_read(file, data.data(), data.size(), pending.id);
+            requests.clear();
+
+            eof = r == 0;
+            next_offset = request.offset + r;
+        }
+    }
+}
+
+std::string quote_for_shell(const std::string& arg)
+{
+    std::string quoted{"'"};
+    for (auto c : arg)
+        quoted += c == '\'' ? std::string{"'\\''"} : std::string{c};
+    return quoted + "'";
+}
+
+// One digest per block of the file in the instance, none if they cannot be had
+std::vector<std::string> remote_block_digests(mp::SSHSession& session, const std::string& path)
+{
+    try
+    {
+        auto process = session.exec(fmt::format(block_digests_cmd, sync_block_size, quote_for_shell(path)));
+        const auto output = QString::fromStdString(process.read_std_output());
+        if (process.exit_code() != 0)
+            return {};
+
+        std::vector<std::string> digests;
+        for (const auto& digest : output.split('\n', QString::SkipEmptyParts))
+            digests.push_back(digest.trimmed().toStdString());
+        return digests;
+    }
+    catch (const std::exception&)
+    {
+        return {};
+    }
+}
+
 std::string full_destination(const std::string& destination_path, const std::string& filename)
 {
     if (destination_path.empty())
@@ -76,18 +218,25 @@ mp::SFTPClient::SFTPClient(SSHSessionUPtr ssh_session)
     SSH::throw_on_error(sftp, *this->ssh_session, "[sftp pull] init failed", sftp_init);
 }
 
+void mp::SFTPClient::set_transfer_window(std::size_t requests)
+{
+    transfer_window = std::max<std::size_t>(requests, 1);
+}
+
 void mp::SFTPClient::push_file(const std::string& source_path, const std::string& destination_path)
 {
     auto full_destination_path = full_destination(destination_path, mp::utils::filename_for(source_path));
+    QFile source(QString::fromStdString(source_path));
+    const auto mode = source.exists() ? mode_from(source.permissions()) : file_mode;
     SFTPFileUPtr file_handle{
-        sftp_open(sftp.get(), full_destination_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, file_mode), sftp_close};
+        sftp_open(sftp.get(), full_destination_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, mode), sftp_close};
     SSH::throw_on_error(sftp, *ssh_session, "[sftp push] open failed", sftp_get_error);
 
-    QFile source(QString::fromStdString(source_path));
     if (!source.open(QIODevice::ReadOnly))
         throw std::runtime_error(fmt::format("[sftp push] error opening file for reading: {}", source.errorString()));
 
-    std::array<char, max_transfer> data;
+    // libssh has no asynchronous writes, so at least make each round-trip carry as much as the server takes
+    std::vector<char> data(max_write_transfer);
     while (true)
     {
         auto r = source.read(data.data(), data.size());
@@ -103,6 +252,68 @@ void mp::SFTPClient::push_file(const std::string& source_path, const std::string
     }
 }
 
+void mp::SFTPClient::sync_file(const std::string& source_path, const std::string& destination_path)
+{
+    auto full_destination_path = full_destination(destination_path, mp::utils::filename_for(source_path));
+    const QFileInfo source{QString::fromStdString(source_path)};
+    const auto source_mtime = source.lastModified().toSecsSinceEpoch();
+
+    SFTPAttributesUPtr attributes{sftp_stat(sftp.get(), full_destination_path.c_str()), sftp_attributes_free};
+    const auto is_file = attributes && attributes->type == SSH_FILEXFER_TYPE_REGULAR;
+    if (is_file && attributes->size == static_cast<uint64_t>(source.size()) && attributes->mtime == source_mtime)
+        return;
+
+    const auto digests = is_file && attributes->size > 0 ? remote_block_digests(*ssh_session, full_destination_path)
+                                                         : std::vector<std::string>{};
+    if (digests.empty())
+        push_file(source_path, destination_path);
+    else
+        push_changed_blocks(source_path, full_destination_path, digests);
+
+    // So that the next sync finds it unchanged
+    timeval times[2]{{static_cast<long>(source_mtime), 0}, {static_cast<long>(source_mtime), 0}};
+    if (sftp_utimes(sftp.get(), full_destination_path.c_str(), times) != SSH_OK)
+        throw_transfer_error(sftp, *ssh_session, "[sftp sync] cannot set modification time");
+}
+
+void mp::SFTPClient::push_changed_blocks(const std::string& source_path, const std::string& destination_path,
+                                         const std::vector<std::string>& destination_digests)
+{
+    QFile source(QString::fromStdString(source_path));
+    if (!source.open(QIODevice::ReadOnly))
+        throw std::runtime_error(fmt::format("[sftp sync] error opening file for reading: {}", source.errorString()));
+
+    SFTPFileUPtr file_handle{sftp_open(sftp.get(), destination_path.c_str(), O_WRONLY, file_mode), sftp_close};
+    SSH::throw_on_error(sftp, *ssh_session, "[sftp sync] open failed", sftp_get_error);
+
+    std::vector<char> block(sync_block_size);
+    for (std::size_t i = 0;; ++i)
+    {
+        auto r = source.read(block.data(), block.size());
+        if (r == -1)
+            throw std::runtime_error(fmt::format("[sftp sync] error reading file: {}", source.errorString()));
+
+        if (r == 0)
+            break;
+
+        const auto digest =
+            QCryptographicHash::hash(QByteArray::fromRawData(block.data(), r), QCryptographicHash::Sha1).toHex();
+        if (i < destination_digests.size() && destination_digests[i] == digest.toStdString())
+            continue;
+
+        sftp_seek64(file_handle.get(), i * sync_block_size);
+        sftp_write(file_handle.get(), block.data(), r);
+        SSH::throw_on_error(sftp, *ssh_session, "[sftp sync] remote write failed", sftp_get_error);
+    }
+
+    // Whatever lies past the source's end is left over from a longer file
+    sftp_attributes_struct attributes{};
+    attributes.flags = SSH_FILEXFER_ATTR_SIZE;
+    attributes.size = source.size();
+    if (sftp_setstat(sftp.get(), destination_path.c_str(), &attributes) != SSH_OK)
+        throw_transfer_error(sftp, *ssh_session, "[sftp sync] cannot truncate");
+}
+
 void mp::SFTPClient::pull_file(const std::string& source_path, const std::string& destination_path)
 {
     auto full_destination_path = full_destination(destination_path, mp::utils::filename_for(source_path));
@@ -114,22 +325,113 @@ void mp::SFTPClient::pull_file(const std::string& source_path, const std::string
     SFTPFileUPtr file_handle{sftp_open(sftp.get(), source_path.c_str(), O_RDONLY, file_mode), sftp_close};
     SSH::throw_on_error(sftp, *ssh_session, "[sftp pull] open failed", sftp_get_error);
 
-    std::array<char, max_transfer> data;
-    while (true)
+    read_windowed(sftp, *ssh_session, file_handle.get(), transfer_window, 0, to_end, "[sftp pull] read failed",
+                  [&destination](const char* data, int size) {
+                      if (destination.write(data, size) == -1)
+                          throw std::runtime_error(
+                              fmt::format("[sftp pull] error writing to file: {}", destination.errorString()));
+                  });
+
+    SFTPAttributesUPtr attributes{sftp_fstat(file_handle.get()), sftp_attributes_free};
+    if (attributes)
+        destination.setPermissions(permissions_from(attributes->permissions));
+}
+
+auto mp::SFTPClient::begin_split_push(const std::string& source_path, const std::string& destination_path)
+    -> SplitTransfer
+{
+    const QFileInfo source{QString::fromStdString(source_path)};
+    if (!source.isReadable())
+        throw std::runtime_error(fmt::format("[sftp push] error opening file for reading: {}", source_path));
+
+    SplitTransfer transfer{source_path, full_destination(destination_path, mp::utils::filename_for(source_path)),
+                           static_cast<uint64_t>(source.size()), mode_from(source.permissions())};
+
+    // Kept writable by us until every range is in
+    SFTPFileUPtr file_handle{sftp_open(sftp.get(), transfer.destination_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                                       transfer.mode | 0200),
+                             sftp_close};
+    SSH::throw_on_error(sftp, *ssh_session, "[sftp push] open failed", sftp_get_error);
+
+    return transfer;
+}
+
+auto mp::SFTPClient::begin_split_pull(const std::string& source_path, const std::string& destination_path)
+    -> SplitTransfer
+{
+    SFTPAttributesUPtr attributes{sftp_stat(sftp.get(), source_path.c_str()), sftp_attributes_free};
+    if (!attributes)
+        throw_transfer_error(sftp, *ssh_session, "[sftp pull] stat failed");
+
+    SplitTransfer transfer{source_path, full_destination(destination_path, mp::utils::filename_for(source_path)),
+                           attributes->size, static_cast<int>(attributes->permissions)};
+
+    QFile destination(QString::fromStdString(transfer.destination_path));
+    if (!destination.open(QIODevice::WriteOnly) || !destination.resize(transfer.size))
+        throw std::runtime_error(
+            fmt::format("[sftp pull] error opening file for writing: {}", destination.errorString()));
+
+    return transfer;
+}
+
+void mp::SFTPClient::push_range(const SplitTransfer& transfer, uint64_t offset, uint64_t length)
+{
+    QFile source(QString::fromStdString(transfer.source_path));
+    if (!source.open(QIODevice::ReadOnly) || !source.seek(offset))
+        throw std::runtime_error(fmt::format("[sftp push] error opening file for reading: {}", source.errorString()));
+
+    SFTPFileUPtr file_handle{sftp_open(sftp.get(), transfer.destination_path.c_str(), O_WRONLY, file_mode),
+                             sftp_close};
+    SSH::throw_on_error(sftp, *ssh_session, "[sftp push] open failed", sftp_get_error);
+    sftp_seek64(file_handle.get(), offset);
+
+    std::vector<char> data(max_write_transfer);
+    while (length > 0)
     {
-        auto r = sftp_read(file_handle.get(), data.data(), data.size());
+        auto r = source.read(data.data(), std::min<uint64_t>(data.size(), length));
+
+        if (r == -1)
+            throw std::runtime_error(fmt::format("[sftp push] error reading file: {}", source.errorString()));
 
         if (r == 0)
             break;
 
-        if (r < 0)
-            SSH::throw_on_error(sftp, *ssh_session, "[sftp pull] read failed", sftp_get_error);
-
-        if (destination.write(data.data(), r) == -1)
-            throw std::runtime_error(fmt::format("[sftp pull] error writing to file: {}", destination.errorString()));
+        sftp_write(file_handle.get(), data.data(), r);
+        SSH::throw_on_error(sftp, *ssh_session, "[sftp push] remote write failed", sftp_get_error);
+        length -= r;
     }
 }
 
+void mp::SFTPClient::pull_range(const SplitTransfer& transfer, uint64_t offset, uint64_t length)
+{
+    // Opened for reading too, as opening it for writing only would truncate it under the other ranges
+    QFile destination(QString::fromStdString(transfer.destination_path));
+    if (!destination.open(QIODevice::ReadWrite) || !destination.seek(offset))
+        throw std::runtime_error(
+            fmt::format("[sftp pull] error opening file for writing: {}", destination.errorString()));
+
+    SFTPFileUPtr file_handle{sftp_open(sftp.get(), transfer.source_path.c_str(), O_RDONLY, file_mode), sftp_close};
+    SSH::throw_on_error(sftp, *ssh_session, "[sftp pull] open failed", sftp_get_error);
+
+    read_windowed(sftp, *ssh_session, file_handle.get(), transfer_window, offset, offset + length,
+                  "[sftp pull] read failed", [&destination](const char* data, int size) {
+                      if (destination.write(data, size) == -1)
+                          throw std::runtime_error(
+                              fmt::format("[sftp pull] error writing to file: {}", destination.errorString()));
+                  });
+}
+
+void mp::SFTPClient::end_split_push(const SplitTransfer& transfer)
+{
+    if (!(transfer.mode & 0200) && sftp_chmod(sftp.get(), transfer.destination_path.c_str(), transfer.mode) != SSH_OK)
+        throw_transfer_error(sftp, *ssh_session, "[sftp push] cannot set permissions");
+}
+
+void mp::SFTPClient::end_split_pull(const SplitTransfer& transfer)
+{
+    QFile::setPermissions(QString::fromStdString(transfer.destination_path), permissions_from(transfer.mode));
+}
+
 void mp::SFTPClient::stream_file(const std::string& destination_path, std::istream& cin)
 {
     auto full_destination_path = full_destination(destination_path, stream_file_name);
@@ -151,17 +453,120 @@ void mp::SFTPClient::stream_file(const std::string& source_path, std::ostream& c
     SFTPFileUPtr file_handle{sftp_open(sftp.get(), source_path.c_str(), O_RDONLY, file_mode), sftp_close};
     SSH::throw_on_error(sftp, *ssh_session, "[sftp pull] open failed", sftp_get_error);
 
-    std::array<char, max_transfer> data;
-    while (true)
+    // Replies are gathered into large writes, so that pipelines downstream are not fed in small chunks
+    std::vector<char> output;
+    output.reserve(stream_output_size);
+    auto write_output = [&output, &cout] {
+        if (!cout.write(output.data(), output.size()))
+            throw std::runtime_error("[sftp stream] error writing to output");
+        output.clear();
+    };
+
+    read_windowed(sftp, *ssh_session, file_handle.get(), transfer_window, 0, to_end, "[sftp pull] read failed",
+                  [&output, &write_output](const char* data, int size) {
+                      output.insert(output.end(), data, data + size);
+                      if (output.size() >= stream_output_size)
+                          write_output();
+                  });
+
+    write_output();
+    if (!cout.flush())
+        throw std::runtime_error("[sftp stream] error writing to output");
+}
+
+mp::FileTransfers mp::SFTPClient::push_dir_tree(const std::string& source_dir, const std::string& destination_dir)
+{
+    const QFileInfo source{QDir::cleanPath(QString::fromStdString(source_dir))};
+    const auto root = is_remote_dir(destination_dir)
+                          ? fmt::format("{}/{}", destination_dir, source.fileName())
+                          : destination_dir;
+    make_remote_dir(root, mode_from(source.permissions()));
+
+    FileTransfers files;
+    const QDir source_root{source.filePath()};
+    QDirIterator it{source_root.path(), QDir::AllEntries | QDir::Hidden | QDir::System | QDir::NoDotAndDotDot,
+                    QDirIterator::Subdirectories};
+    while (it.hasNext())
     {
-        auto r = sftp_read(file_handle.get(), data.data(), data.size());
+        it.next();
+        const auto info = it.fileInfo();
+        const auto remote_path = fmt::format("{}/{}", root, source_root.relativeFilePath(info.filePath()));
+        if (info.isDir())
+            make_remote_dir(remote_path, mode_from(info.permissions()));
+        else
+            files.emplace_back(info.filePath().toStdString(), remote_path);
+    }
 
-        if (r == 0)
-            break;
+    return files;
+}
 
-        if (r < 0)
-            SSH::throw_on_error(sftp, *ssh_session, "[sftp pull] read failed", sftp_get_error);
+mp::FileTransfers mp::SFTPClient::pull_dir_tree(const std::string& source_dir, const std::string& destination_dir)
+{
+    const auto source = QDir::cleanPath(QString::fromStdString(source_dir));
+    const QFileInfo destination{QString::fromStdString(destination_dir.empty() ? "." : destination_dir)};
+    const auto root = destination.isDir() ? QDir{destination.filePath()}.filePath(QFileInfo{source}.fileName())
+                                          : destination.filePath();
+    if (!QDir().mkpath(root))
+        throw std::runtime_error(fmt::format("[sftp pull] cannot create directory \"{}\"", root));
+
+    FileTransfers files;
+    list_remote_dir(source.toStdString(), "", files, root.toStdString());
+    return files;
+}
 
-        cout << data.data();
+bool mp::SFTPClient::is_remote_dir(const std::string& path)
+{
+    SFTPAttributesUPtr attributes{sftp_stat(sftp.get(), path.c_str()), sftp_attributes_free};
+    return attributes && attributes->type == SSH_FILEXFER_TYPE_DIRECTORY;
+}
+
+void mp::SFTPClient::make_remote_dir(const std::string& path, int mode)
+{
+    // sftp-server only reports a generic failure for directories that already exist
+    if (sftp_mkdir(sftp.get(), path.c_str(), mode) != SSH_OK && !is_remote_dir(path))
+        throw std::runtime_error(
+            fmt::format("[sftp push] cannot create directory \"{}\": '{}'", path, ssh_get_error(*ssh_session)));
+}
+
+void mp::SFTPClient::list_remote_dir(const std::string& root, const std::string& relative_dir, FileTransfers& files,
+                                     const std::string& destination_root)
+{
+    const auto dir_path = relative_dir.empty() ? root : fmt::format("{}/{}", root, relative_dir);
+    SFTPDirUPtr dir{sftp_opendir(sftp.get(), dir_path.c_str()), sftp_closedir};
+    if (dir == nullptr)
+        throw std::runtime_error(
+            fmt::format("[sftp pull] cannot open directory \"{}\": '{}'", dir_path, ssh_get_error(*ssh_session)));
+
+    while (true)
+    {
+        SFTPAttributesUPtr attributes{sftp_readdir(sftp.get(), dir.get()), sftp_attributes_free};
+        if (attributes == nullptr)
+            break;
+
+        const std::string name{attributes->name};
+        if (name == "." || name == "..")
+            continue;
+
+        const auto relative_path = relative_dir.empty() ? name : fmt::format("{}/{}", relative_dir, name);
+        const auto local_path = QString::fromStdString(fmt::format("{}/{}", destination_root, relative_path));
+        if (attributes->type == SSH_FILEXFER_TYPE_DIRECTORY)
+        {
+            if (!QDir().mkpath(local_path))
+                throw std::runtime_error(fmt::format("[sftp pull] cannot create directory \"{}\"", local_path));
+
+            // Keep the directory writable by us, so that its contents can still be pulled into it
+            QFile::setPermissions(local_path, permissions_from(attributes->permissions) | QFileDevice::WriteOwner |
+                                                  QFileDevice::WriteUser | QFileDevice::ExeOwner |
+                                                  QFileDevice::ExeUser);
+            list_remote_dir(root, relative_path, files, destination_root);
+        }
+        else
+        {
+            files.emplace_back(fmt::format("{}/{}", root, relative_path), local_path.toStdString());
+        }
     }
+
+    if (!sftp_dir_eof(dir.get()))
+        throw std::runtime_error(
+            fmt::format("[sftp pull] failed listing \"{}\": '{}'", dir_path, ssh_get_error(*ssh_session)));
 }
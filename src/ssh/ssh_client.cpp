@@ -21,10 +21,38 @@
 
 #include "ssh_client_key_provider.h"
 
+#include <cerrno>
+#include <vector>
+
+#include <poll.h>
+#include <unistd.h>
+
 namespace mp = multipass;
 
 namespace
 {
+// Far larger than what ssh_connectors move at a time, so that bulk data piped through exec is not paced by wakeups
+constexpr auto io_buffer_size = 256 * 1024;
+
+bool write_all(int fd, const char* data, size_t size)
+{
+    while (size > 0)
+    {
+        auto written = ::write(fd, data, size);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+
+        data += written;
+        size -= written;
+    }
+
+    return true;
+}
+
 mp::SSHClient::ChannelUPtr make_channel(ssh_session session)
 {
     mp::SSHClient::ChannelUPtr channel{ssh_channel_new(session), ssh_channel_free};
@@ -35,20 +63,31 @@ mp::SSHClient::ChannelUPtr make_channel(ssh_session session)
 }
 } // namespace
 
+mp::SSHSessionUPtr mp::make_ssh_session(const std::string& host, int port, const std::string& username,
+                                        const std::string& priv_key_blob)
+{
+    return std::make_unique<mp::SSHSession>(host, port, username, mp::SSHClientKeyProvider(priv_key_blob));
+}
+
 mp::SSHClient::SSHClient(const std::string& host, int port, const std::string& username,
                          const std::string& priv_key_blob, ConsoleCreator console_creator)
-    : SSHClient{std::make_unique<mp::SSHSession>(host, port, username, mp::SSHClientKeyProvider(priv_key_blob)),
-                console_creator}
+    : SSHClient{make_ssh_session(host, port, username, priv_key_blob), console_creator}
 {
 }
 
 mp::SSHClient::SSHClient(SSHSessionUPtr ssh_session, ConsoleCreator console_creator)
-    : ssh_session{std::move(ssh_session)},
+    : owned_session{std::move(ssh_session)},
+      ssh_session{owned_session.get()},
       channel{make_channel(*this->ssh_session)},
       console{console_creator(channel.get())}
 {
 }
 
+mp::SSHClient::SSHClient(SSHSession& ssh_session, ConsoleCreator console_creator)
+    : ssh_session{&ssh_session}, channel{make_channel(ssh_session)}, console{console_creator(channel.get())}
+{
+}
+
 void mp::SSHClient::connect()
 {
     exec({});
@@ -69,33 +108,59 @@ int mp::SSHClient::exec(const std::vector<std::string>& args)
 
 void mp::SSHClient::handle_ssh_events()
 {
-    using ConnectorUPtr = std::unique_ptr<ssh_connector_struct, void (*)(ssh_connector)>;
     std::unique_ptr<ssh_event_struct, void (*)(ssh_event)> event{ssh_event_new(), ssh_event_free};
-
-    // stdin
-    ConnectorUPtr connector_in{ssh_connector_new(*ssh_session), ssh_connector_free};
-    ssh_connector_set_out_channel(connector_in.get(), channel.get(), SSH_CONNECTOR_STDOUT);
-    ssh_connector_set_in_fd(connector_in.get(), fileno(stdin));
-    ssh_event_add_connector(event.get(), connector_in.get());
-
-    // stdout
-    ConnectorUPtr connector_out{ssh_connector_new(*ssh_session), ssh_connector_free};
-    ssh_connector_set_out_fd(connector_out.get(), fileno(stdout));
-    ssh_connector_set_in_channel(connector_out.get(), channel.get(), SSH_CONNECTOR_STDOUT);
-    ssh_event_add_connector(event.get(), connector_out.get());
-
-    // stderr
-    ConnectorUPtr connector_err{ssh_connector_new(*ssh_session), ssh_connector_free};
-    ssh_connector_set_out_fd(connector_err.get(), fileno(stderr));
-    ssh_connector_set_in_channel(connector_err.get(), channel.get(), SSH_CONNECTOR_STDERR);
-    ssh_event_add_connector(event.get(), connector_err.get());
+    std::vector<char> buffer(io_buffer_size);
+
+    // Data is only moved between polls rather than from the callbacks, so that writing to the channel, which waits
+    // on the remote window, never runs within ssh_event_dopoll
+    const auto in_fd = fileno(stdin);
+    auto stdin_ready = false;
+    auto forwarding_stdin = true;
+    ssh_event_add_fd(event.get(), in_fd, POLLIN,
+                     [](socket_t, int, void* ready) {
+                         *static_cast<bool*>(ready) = true;
+                         return 0;
+                     },
+                     &stdin_ready);
+    ssh_event_add_session(event.get(), *ssh_session);
+
+    auto forward_output = [this, &buffer](int is_stderr, int out_fd) {
+        int read;
+        while ((read = ssh_channel_read_nonblocking(channel.get(), buffer.data(), buffer.size(), is_stderr)) > 0)
+            write_all(out_fd, buffer.data(), read);
+    };
 
     while (ssh_channel_is_open(channel.get()) && !ssh_channel_is_eof(channel.get()))
     {
-        ssh_event_dopoll(event.get(), 60000);
+        forward_output(0, fileno(stdout));
+        forward_output(1, fileno(stderr));
+
+        if (stdin_ready)
+        {
+            stdin_ready = false;
+            auto read = ::read(in_fd, buffer.data(), buffer.size());
+            if (read > 0)
+            {
+                ssh_channel_write(channel.get(), buffer.data(), read);
+            }
+            else if (read == 0 || errno != EINTR)
+            {
+                ssh_event_remove_fd(event.get(), in_fd);
+                ssh_channel_send_eof(channel.get());
+                forwarding_stdin = false;
+            }
+        }
+
+        if (ssh_channel_is_open(channel.get()) && !ssh_channel_is_eof(channel.get()) &&
+            ssh_event_dopoll(event.get(), -1) == SSH_ERROR)
+            break;
     }
 
-    ssh_event_remove_connector(event.get(), connector_in.get());
-    ssh_event_remove_connector(event.get(), connector_out.get());
-    ssh_event_remove_connector(event.get(), connector_err.get());
+    // Whatever arrived along with the end of the channel
+    forward_output(0, fileno(stdout));
+    forward_output(1, fileno(stderr));
+
+    if (forwarding_stdin)
+        ssh_event_remove_fd(event.get(), in_fd);
+    ssh_event_remove_session(event.get(), *ssh_session);
 }
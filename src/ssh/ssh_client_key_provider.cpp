@@ -17,18 +17,39 @@
 
 #include "ssh_client_key_provider.h"
 
+#include <mutex>
+#include <unordered_map>
+
 namespace mp = multipass;
 
 namespace
 {
 mp::SSHClientKeyProvider::KeyUPtr import_priv_key(const std::string& priv_key_blob)
 {
-    ssh_key priv_key;
+    ssh_key priv_key{nullptr};
     ssh_pki_import_privkey_base64(priv_key_blob.c_str(), nullptr, nullptr, nullptr, &priv_key);
 
     return mp::SSHClientKeyProvider::KeyUPtr{priv_key};
 }
+
+// The same few keys are handed in for every session, so each is only parsed once per process
+mp::SSHClientKeyProvider::KeySPtr cached_priv_key(const std::string& priv_key_blob)
+{
+    static std::mutex keys_mutex;
+    static std::unordered_map<std::string, mp::SSHClientKeyProvider::KeySPtr> keys;
+
+    std::lock_guard<std::mutex> lock{keys_mutex};
+    auto it = keys.find(priv_key_blob);
+    if (it != keys.end())
+        return it->second;
+
+    mp::SSHClientKeyProvider::KeySPtr key{import_priv_key(priv_key_blob)};
+    if (key)
+        keys.emplace(priv_key_blob, key);
+
+    return key;
 }
+} // namespace
 
 void mp::SSHClientKeyProvider::KeyDeleter::operator()(ssh_key key)
 {
@@ -36,7 +57,7 @@ void mp::SSHClientKeyProvider::KeyDeleter::operator()(ssh_key key)
 }
 
 mp::SSHClientKeyProvider::SSHClientKeyProvider(const std::string& priv_key_blob)
-    : priv_key{import_priv_key(priv_key_blob)}
+    : priv_key{cached_priv_key(priv_key_blob)}
 {
 }
 
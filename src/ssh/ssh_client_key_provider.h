@@ -32,6 +32,7 @@ public:
         void operator()(ssh_key key);
     };
     using KeyUPtr = std::unique_ptr<ssh_key_struct, KeyDeleter>;
+    using KeySPtr = std::shared_ptr<ssh_key_struct>;
 
     explicit SSHClientKeyProvider(const std::string& priv_key_blob);
 
@@ -40,7 +41,7 @@ public:
     ssh_key private_key() const override;
 
 private:
-    KeyUPtr priv_key;
+    KeySPtr priv_key;
 };
 }
 #endif // MULTIPASS_SSH_CLIENT_KEY_PROVIDER_H
@@ -26,8 +26,7 @@
 #include <multipass/format.h>
 #include <libssh/callbacks.h>
 
-#include <array>
-#include <sstream>
+#include <string>
 
 #include <cerrno>
 #include <cstring>
@@ -38,6 +37,8 @@ namespace mpl = multipass::logging;
 namespace
 {
 constexpr auto category = "ssh process";
+constexpr auto read_chunk_size = 64u * 1024u;
+constexpr auto stream_poll_timeout = std::chrono::milliseconds(500); // how soon a lost session is noticed
 
 class ExitStatusCallback
 {
@@ -114,46 +115,82 @@ std::string mp::SSHProcess::read_std_error()
     return read_stream(StreamType::err);
 }
 
+int mp::SSHProcess::stream_output(const OutputHandler& on_output)
+{
+    std::unique_ptr<ssh_event_struct, decltype(ssh_event_free)*> event{ssh_event_new(), ssh_event_free};
+    ssh_event_add_session(event.get(), session);
+
+    std::string buffer(read_chunk_size, '\0');
+    auto forward = [this, &buffer, &on_output](bool is_std_err) {
+        int num_bytes;
+        while ((num_bytes = ssh_channel_read_nonblocking(channel.get(), &buffer[0], buffer.size(), is_std_err)) > 0)
+            on_output(buffer.substr(0, num_bytes), is_std_err);
+    };
+
+    while (ssh_channel_is_open(channel.get()) && !ssh_channel_is_eof(channel.get()))
+    {
+        forward(false);
+        forward(true);
+
+        // Commands may well be silent for long, so the poll only gives the session a chance to be found gone
+        if (ssh_channel_is_open(channel.get()) && !ssh_channel_is_eof(channel.get()) &&
+            (ssh_event_dopoll(event.get(), stream_poll_timeout.count()) == SSH_ERROR || !ssh_is_connected(session)))
+        {
+            ssh_event_remove_session(event.get(), session);
+            throw ExitlessSSHProcessException{cmd, "the SSH session was lost"};
+        }
+    }
+
+    // Whatever arrived along with the end of the channel
+    forward(false);
+    forward(true);
+    ssh_event_remove_session(event.get(), session);
+
+    return ssh_channel_get_exit_status(channel.get());
+}
+
 std::string mp::SSHProcess::read_stream(StreamType type, int timeout)
 {
-    mpl::log(mpl::Level::debug, category,
-             fmt::format("{}:{} {}(type = {}, timeout = {}): ", __FILE__, __LINE__, __FUNCTION__,
-                         static_cast<int>(type), timeout));
+    mpl::log(mpl::Level::debug, category, "{}:{} {}(type = {}, timeout = {}): ", __FILE__, __LINE__, __FUNCTION__,
+             static_cast<int>(type), timeout);
     // If the channel is closed there's no output to read
     if (ssh_channel_is_closed(channel.get()))
     {
-        mpl::log(mpl::Level::debug, category,
-                 fmt::format("{}:{} {}(): channel closed", __FILE__, __LINE__, __FUNCTION__));
+        mpl::log(mpl::Level::debug, category, "{}:{} {}(): channel closed", __FILE__, __LINE__, __FUNCTION__);
         return std::string();
     }
 
-    std::stringstream output;
-    std::array<char, 256> buffer;
+    // Read straight into the string, growing it a chunk at a time
+    std::string output;
+    std::string::size_type size{0};
     int num_bytes{0};
     const bool is_std_err = type == StreamType::err;
     do
     {
-        num_bytes = ssh_channel_read_timeout(channel.get(), buffer.data(), buffer.size(), is_std_err, timeout);
-        mpl::log(mpl::Level::debug, category,
-                 fmt::format("{}:{} {}(): num_bytes = {}", __FILE__, __LINE__, __FUNCTION__, num_bytes));
+        output.resize(size + read_chunk_size);
+        num_bytes = ssh_channel_read_timeout(channel.get(), &output[size], read_chunk_size, is_std_err, timeout);
+        mpl::log(mpl::Level::debug, category, "{}:{} {}(): num_bytes = {}", __FILE__, __LINE__, __FUNCTION__,
+                 num_bytes);
         if (num_bytes < 0)
         {
+            output.resize(size);
+
             // Latest libssh now returns an error if the channel has been closed instead of returning 0 bytes
             if (ssh_channel_is_closed(channel.get()))
             {
-                mpl::log(mpl::Level::debug, category,
-                         fmt::format("{}:{} {}(): channel closed", __FILE__, __LINE__, __FUNCTION__));
-                return output.str();
+                mpl::log(mpl::Level::debug, category, "{}:{} {}(): channel closed", __FILE__, __LINE__, __FUNCTION__);
+                return output;
             }
 
             throw std::runtime_error(fmt::format("error while reading ssh channel for remote process '{}'"
                                                  " - error: {}",
                                                  cmd, num_bytes));
         }
-        output.write(buffer.data(), num_bytes);
+        size += num_bytes;
     } while (num_bytes > 0);
 
-    return output.str();
+    output.resize(size);
+    return output;
 }
 
 ssh_channel mp::SSHProcess::release_channel()
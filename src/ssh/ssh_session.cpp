@@ -18,6 +18,8 @@
 #include <multipass/ssh/ssh_session.h>
 
 #include <multipass/ssh/ssh_key_provider.h>
+#include <multipass/telemetry.h>
+#include <multipass/tracing.h>
 #include <multipass/ssh/throw_on_error.h>
 
 #include <libssh/callbacks.h>
@@ -28,12 +30,55 @@
 #include <QDir>
 #include <QStandardPaths>
 
+#include <atomic>
+#include <mutex>
 #include <sstream>
 #include <stdexcept>
 #include <string>
 
+#include <sys/socket.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#elif defined(__aarch64__) && defined(__linux__)
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
+
 namespace mp = multipass;
 
+namespace
+{
+std::mutex crypto_profile_mutex;
+std::string current_crypto_profile{"auto"};
+std::atomic<bool> compression_enabled{false};
+
+bool host_has_aes_instructions()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax, ebx, ecx, edx;
+    return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_AES);
+#elif defined(__aarch64__) && defined(__linux__)
+    return getauxval(AT_HWCAP) & HWCAP_AES;
+#else
+    return false;
+#endif
+}
+
+// libssh drops the ciphers it does not know, so older versions simply fall through to the ones they do
+std::string ciphers_for(const std::string& profile)
+{
+    static const bool aes_instructions = host_has_aes_instructions();
+    constexpr auto gcm = "aes128-gcm@openssh.com,aes256-gcm@openssh.com";
+    constexpr auto chacha20 = "chacha20-poly1305@openssh.com";
+
+    if (profile == "aes-gcm" || (profile == "auto" && aes_instructions))
+        return fmt::format("{},{},aes256-ctr", gcm, chacha20);
+
+    return fmt::format("{},{},aes256-ctr", chacha20, gcm);
+}
+} // namespace
+
 mp::SSHSession::SSHSession(const std::string& host, int port, const std::string& username,
                            const SSHKeyProvider* key_provider, const std::chrono::milliseconds timeout)
     : session{ssh_new(), ssh_free}
@@ -43,6 +88,7 @@ mp::SSHSession::SSHSession(const std::string& host, int port, const std::string&
 
     const long timeout_secs = std::chrono::duration_cast<std::chrono::seconds>(timeout).count();
     const int nodelay{1};
+    const auto ciphers = ciphers_for(crypto_profile());
     auto ssh_dir =
         QDir(QStandardPaths::writableLocation(QStandardPaths::AppConfigLocation)).filePath("ssh").toStdString();
 
@@ -51,16 +97,27 @@ mp::SSHSession::SSHSession(const std::string& host, int port, const std::string&
     set_option(SSH_OPTIONS_USER, username.c_str());
     set_option(SSH_OPTIONS_TIMEOUT, &timeout_secs);
     set_option(SSH_OPTIONS_NODELAY, &nodelay);
-    set_option(SSH_OPTIONS_CIPHERS_C_S, "chacha20-poly1305@openssh.com,aes256-ctr");
-    set_option(SSH_OPTIONS_CIPHERS_S_C, "chacha20-poly1305@openssh.com,aes256-ctr");
+    set_option(SSH_OPTIONS_CIPHERS_C_S, ciphers.c_str());
+    set_option(SSH_OPTIONS_CIPHERS_S_C, ciphers.c_str());
+    // Falling back to none keeps servers that refuse compression reachable
+    set_option(SSH_OPTIONS_COMPRESSION, compression() ? "zlib@openssh.com,zlib,none" : "no");
     set_option(SSH_OPTIONS_SSH_DIR, ssh_dir.c_str());
 
+    auto& telemetry = Telemetry::instance();
+    auto timer = telemetry.time("multipass_ssh_session_setup_seconds");
+    auto span = Tracer::instance().span("ssh session setup", {{"host", host}, {"port", std::to_string(port)}});
     SSH::throw_on_error(session, "ssh connection failed", ssh_connect);
+
+    // Sessions are kept around for reuse, so have the kernel notice when the other end silently goes away
+    const int keepalive{1};
+    setsockopt(ssh_get_fd(session.get()), SOL_SOCKET, SO_KEEPALIVE, &keepalive, sizeof(keepalive));
     if (key_provider)
     {
         SSH::throw_on_error(session, "ssh failed to authenticate", ssh_userauth_publickey, nullptr,
                             key_provider->private_key());
     }
+
+    telemetry.count("multipass_ssh_sessions_total");
 }
 
 mp::SSHSession::SSHSession(const std::string& host, int port, const std::string& username,
@@ -92,6 +149,45 @@ mp::SSHSession::operator ssh_session() const
     return session.get();
 }
 
+std::string mp::SSHSession::host_key_hash() const
+{
+    ssh_key key{nullptr};
+    if (ssh_get_server_publickey(session.get(), &key) != SSH_OK)
+        return {};
+    std::unique_ptr<ssh_key_struct, void (*)(ssh_key)> key_guard{key, ssh_key_free};
+
+    unsigned char* hash{nullptr};
+    size_t hash_size{0};
+    if (ssh_get_publickey_hash(key, SSH_PUBLICKEY_HASH_SHA256, &hash, &hash_size) != SSH_OK)
+        return {};
+
+    std::string host_key_hash(reinterpret_cast<char*>(hash), hash_size);
+    ssh_clean_pubkey_hash(&hash);
+    return host_key_hash;
+}
+
+void mp::SSHSession::set_crypto_profile(const std::string& profile)
+{
+    std::lock_guard<std::mutex> lock{crypto_profile_mutex};
+    current_crypto_profile = profile.empty() ? "auto" : profile;
+}
+
+std::string mp::SSHSession::crypto_profile()
+{
+    std::lock_guard<std::mutex> lock{crypto_profile_mutex};
+    return current_crypto_profile;
+}
+
+void mp::SSHSession::set_compression(bool enabled)
+{
+    compression_enabled = enabled;
+}
+
+bool mp::SSHSession::compression()
+{
+    return compression_enabled;
+}
+
 namespace
 {
 const char* name_for(ssh_options_e type)
@@ -114,6 +210,8 @@ const char* name_for(ssh_options_e type)
         return "server to client ciphers";
     case SSH_OPTIONS_SSH_DIR:
         return "ssh config directory";
+    case SSH_OPTIONS_COMPRESSION:
+        return "compression";
     default:
         break;
     }
@@ -129,6 +227,7 @@ std::string as_string(ssh_options_e type, const void* value)
     case SSH_OPTIONS_CIPHERS_C_S:
     case SSH_OPTIONS_CIPHERS_S_C:
     case SSH_OPTIONS_SSH_DIR:
+    case SSH_OPTIONS_COMPRESSION:
         return std::string(reinterpret_cast<const char*>(value));
     case SSH_OPTIONS_PORT:
     case SSH_OPTIONS_NODELAY:
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2020 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <multipass/ssh/ssh_session_pool.h>
+
+#include <libssh/libssh.h>
+
+#include <exception>
+
+namespace mp = multipass;
+
+mp::SSHSessionPool::Lease::Lease(std::shared_ptr<Entry> entry)
+    : entry{std::move(entry)}, lock{this->entry->mutex}, uncaught_exceptions{std::uncaught_exceptions()}
+{
+}
+
+mp::SSHSessionPool::Lease::~Lease()
+{
+    // A session that was in use when something went wrong is not trusted with the next command
+    if (entry && std::uncaught_exceptions() > uncaught_exceptions)
+        entry->session = nullopt;
+}
+
+mp::SSHSession& mp::SSHSessionPool::Lease::operator*()
+{
+    return *entry->session;
+}
+
+mp::SSHSession* mp::SSHSessionPool::Lease::operator->()
+{
+    return &*entry->session;
+}
+
+mp::SSHSessionPool::SSHSessionPool(const SSHKeyProvider& key_provider) : key_provider{key_provider}
+{
+}
+
+mp::SSHSessionPool::Lease mp::SSHSessionPool::acquire(const std::string& instance_name, const std::string& host,
+                                                      int port, const std::string& username)
+{
+    std::shared_ptr<Entry> entry;
+    {
+        std::lock_guard<std::mutex> lock{entries_mutex};
+        auto& pooled = entries[instance_name];
+        if (!pooled)
+            pooled = std::make_shared<Entry>();
+        entry = pooled;
+    }
+
+    Lease lease{std::move(entry)};
+    auto& current = *lease.entry;
+    if (current.session && (current.host != host || current.port != port || current.username != username ||
+                            !ssh_is_connected(*current.session)))
+        current.session = nullopt;
+
+    if (!current.session)
+    {
+        current.session.emplace(host, port, username, key_provider);
+        current.host = host;
+        current.port = port;
+        current.username = username;
+    }
+
+    return lease;
+}
+
+void mp::SSHSessionPool::drop(const std::string& instance_name)
+{
+    // A session still leased out is closed when its lease ends
+    std::lock_guard<std::mutex> lock{entries_mutex};
+    entries.erase(instance_name);
+}
+
+void mp::SSHSessionPool::clear()
+{
+    std::lock_guard<std::mutex> lock{entries_mutex};
+    entries.clear();
+}
+
+std::size_t mp::SSHSessionPool::size() const
+{
+    std::lock_guard<std::mutex> lock{entries_mutex};
+    return entries.size();
+}
@@ -0,0 +1,263 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "read_ring.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <unordered_map>
+
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#define MULTIPASS_HAVE_IO_URING
+#endif
+
+namespace mp = multipass;
+
+#ifdef MULTIPASS_HAVE_IO_URING
+namespace
+{
+void* map_ring(int fd, std::size_t size, off_t offset)
+{
+    auto mapped = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+    return mapped == MAP_FAILED ? nullptr : mapped;
+}
+} // namespace
+
+// Spoken to with the raw system calls, sparing a dependency on liburing for the little used here
+struct mp::ReadRing::Rings
+{
+    explicit Rings(unsigned entries)
+    {
+        io_uring_params params{};
+        fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+        if (fd < 0)
+            return;
+
+        sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        const auto single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single_mmap)
+            sq_size = cq_size = std::max(sq_size, cq_size);
+
+        sq_ptr = map_ring(fd, sq_size, IORING_OFF_SQ_RING);
+        cq_ptr = single_mmap ? sq_ptr : map_ring(fd, cq_size, IORING_OFF_CQ_RING);
+        sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe*>(map_ring(fd, sqes_size, IORING_OFF_SQES));
+        if (!sq_ptr || !cq_ptr || !sqes)
+        {
+            release();
+            return;
+        }
+
+        auto sq = static_cast<char*>(sq_ptr);
+        sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+        auto cq = static_cast<char*>(cq_ptr);
+        cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        // Never more in flight than the submission side holds, so that completions cannot overflow theirs
+        capacity = params.sq_entries;
+    }
+
+    ~Rings()
+    {
+        release();
+    }
+
+    void release()
+    {
+        if (sqes)
+            ::munmap(sqes, sqes_size);
+        if (cq_ptr && cq_ptr != sq_ptr)
+            ::munmap(cq_ptr, cq_size);
+        if (sq_ptr)
+            ::munmap(sq_ptr, sq_size);
+        if (fd >= 0)
+            ::close(fd);
+        sqes = nullptr;
+        cq_ptr = sq_ptr = nullptr;
+        fd = -1;
+    }
+
+    void collect(std::vector<Completion>& completions)
+    {
+        auto head = *cq_head;
+        const auto tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head)
+        {
+            const auto& cqe = cqes[head & cq_mask];
+            completions.push_back({cqe.user_data, cqe.res});
+            iovecs.erase(cqe.user_data);
+            --in_flight;
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    int fd{-1};
+    void* sq_ptr{nullptr};
+    std::size_t sq_size{0};
+    void* cq_ptr{nullptr};
+    std::size_t cq_size{0};
+    io_uring_sqe* sqes{nullptr};
+    std::size_t sqes_size{0};
+    unsigned* sq_tail{nullptr};
+    unsigned sq_mask{0};
+    unsigned* sq_array{nullptr};
+    unsigned* cq_head{nullptr};
+    unsigned* cq_tail{nullptr};
+    unsigned cq_mask{0};
+    io_uring_cqe* cqes{nullptr};
+    std::size_t capacity{0};
+    std::size_t unsubmitted{0};
+    std::size_t in_flight{0};
+    std::unordered_map<uint64_t, iovec> iovecs; // READV, which older kernels have too, reads them as it goes
+};
+
+mp::ReadRing::ReadRing(unsigned entries) : rings{std::make_unique<Rings>(entries)}
+{
+}
+
+mp::ReadRing::~ReadRing()
+{
+    // The kernel may still be writing into the buffers, which belong to the caller; let it finish first
+    if (available())
+        reap(true);
+}
+
+bool mp::ReadRing::available() const
+{
+    return rings->fd >= 0;
+}
+
+bool mp::ReadRing::queue(int fd, char* buffer, std::size_t length, uint64_t offset, uint64_t tag)
+{
+    if (rings->unsubmitted + rings->in_flight >= rings->capacity)
+        return false;
+
+    auto& vec = rings->iovecs[tag];
+    vec.iov_base = buffer;
+    vec.iov_len = length;
+
+    const auto tail = *rings->sq_tail;
+    const auto index = tail & rings->sq_mask;
+    auto& sqe = rings->sqes[index];
+    std::memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_READV;
+    sqe.fd = fd;
+    sqe.addr = reinterpret_cast<uint64_t>(&vec);
+    sqe.len = 1;
+    sqe.off = offset;
+    sqe.user_data = tag;
+
+    rings->sq_array[index] = index;
+    __atomic_store_n(rings->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ++rings->unsubmitted;
+
+    return true;
+}
+
+void mp::ReadRing::submit()
+{
+    while (rings->unsubmitted > 0)
+    {
+        const auto submitted = ::syscall(__NR_io_uring_enter, rings->fd, rings->unsubmitted, 0, 0, nullptr, 0);
+        if (submitted < 0 && errno == EINTR)
+            continue;
+        if (submitted <= 0)
+            return; // left queued, for the next try
+
+        rings->unsubmitted -= submitted;
+        rings->in_flight += submitted;
+    }
+}
+
+std::vector<mp::ReadRing::Completion> mp::ReadRing::reap(bool wait_all)
+{
+    submit();
+
+    std::vector<Completion> completions;
+    rings->collect(completions);
+    while (wait_all && rings->in_flight > 0)
+    {
+        if (::syscall(__NR_io_uring_enter, rings->fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno != EINTR)
+            break;
+        rings->collect(completions);
+    }
+
+    return completions;
+}
+
+std::size_t mp::ReadRing::queued() const
+{
+    return rings->unsubmitted;
+}
+
+bool mp::ReadRing::busy() const
+{
+    return rings->unsubmitted + rings->in_flight > 0;
+}
+#else
+struct mp::ReadRing::Rings
+{
+};
+
+mp::ReadRing::ReadRing(unsigned /*entries*/)
+{
+}
+
+mp::ReadRing::~ReadRing() = default;
+
+bool mp::ReadRing::available() const
+{
+    return false;
+}
+
+bool mp::ReadRing::queue(int, char*, std::size_t, uint64_t, uint64_t)
+{
+    return false;
+}
+
+void mp::ReadRing::submit()
+{
+}
+
+std::vector<mp::ReadRing::Completion> mp::ReadRing::reap(bool)
+{
+    return {};
+}
+
+std::size_t mp::ReadRing::queued() const
+{
+    return 0;
+}
+
+bool mp::ReadRing::busy() const
+{
+    return false;
+}
+#endif
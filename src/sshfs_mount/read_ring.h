@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_READ_RING_H
+#define MULTIPASS_READ_RING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace multipass
+{
+// Reads handed to the kernel through an io_uring, queued one by one and submitted together, completed in whatever
+// order they finish. Kernels, builds and sandboxes without io_uring leave the ring unavailable, and nothing but
+// available() may be called then
+class ReadRing
+{
+public:
+    struct Completion
+    {
+        uint64_t tag;
+        int result; // bytes read, or minus the errno
+    };
+
+    explicit ReadRing(unsigned entries);
+    ~ReadRing();
+
+    bool available() const;
+
+    // The buffer must stay put until the read completes. False when the ring has no room for more
+    bool queue(int fd, char* buffer, std::size_t length, uint64_t offset, uint64_t tag);
+    void submit();                               // what was queued, in one go
+    std::vector<Completion> reap(bool wait_all); // submits first; waits for all in flight with wait_all
+    std::size_t queued() const;
+    bool busy() const; // with reads queued or in flight
+
+private:
+    struct Rings;
+    std::unique_ptr<Rings> rings;
+};
+} // namespace multipass
+
+#endif // MULTIPASS_READ_RING_H
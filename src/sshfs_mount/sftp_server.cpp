@@ -17,20 +17,44 @@
 
 #include <multipass/sshfs_mount/sftp_server.h>
 
+#include "read_ring.h"
+
 #include <multipass/cli/client_platform.h>
 #include <multipass/exceptions/exitless_sshprocess_exception.h>
 #include <multipass/logging/log.h>
+#include <multipass/optional.h>
 #include <multipass/platform.h>
 #include <multipass/ssh/ssh_session.h>
 #include <multipass/ssh/throw_on_error.h>
+#include <multipass/telemetry.h>
+#include <multipass/tracing.h>
 #include <multipass/utils.h>
 
 #include <multipass/format.h>
 
-#include <QDateTime>
 #include <QDir>
 #include <QFile>
 
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <utility>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
+
 namespace mp = multipass;
 namespace mpl = multipass::logging;
 
@@ -38,8 +62,33 @@ namespace
 {
 constexpr auto category = "sftp server";
 using SftpHandleUPtr = std::unique_ptr<ssh_string_struct, void (*)(ssh_string)>;
+using MsgUPtr = mp::SftpServer::SftpMessageUptr;
 using namespace std::literals::chrono_literals;
 
+// Leaves room for the reply header within OpenSSH's 256KiB packet limit
+constexpr auto max_read_length = 256u * 1024u - 1024u;
+constexpr auto max_pending_write_size = 1024u * 1024u;
+constexpr auto max_write_back_size = 64u * 1024u * 1024u; // queued for the writer before writes wait for it
+constexpr auto max_write_back_chunk = 8u * 1024u * 1024u; // sequential writes are merged up to this in one pwrite
+constexpr auto min_read_ahead = 1024u * 1024u;     // asked of the kernel once reads look sequential, doubling from
+constexpr auto max_read_ahead = 8u * 1024u * 1024u; // there while they stay so
+constexpr auto sequential_reads_for_read_ahead = 2;
+constexpr auto pipeline_poll_interval_ms = 5;
+constexpr auto max_queued_ring_reads = 16u; // submitted then, even while the instance has more for us
+constexpr auto usage_report_interval = std::chrono::seconds(1); // counted locally in between, messages are hot
+constexpr auto max_cached_attrs = 65536u;
+constexpr auto max_attr_watches = 4096u; // the user's inotify watches are shared with all else they run
+constexpr auto guest_negative_timeout_s = 1;
+constexpr auto max_lost_messages = 3; // in a row while sshfs keeps running, before remounting after all
+constexpr auto max_forwarded_changes = 4096u; // per batch, past that the whole mount is flagged instead
+constexpr auto max_unsent_changes = 64u * 1024u; // bytes queued for an agent that fell behind, then the mount instead
+constexpr auto change_poll_interval_ms = 100; // between looks for host changes while the instance is quiet
+constexpr auto guest_change_grace = std::chrono::seconds(1); // for the host's events about changes the guest made
+constexpr auto attr_watch_mask =
+    IN_ATTRIB | IN_MODIFY | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF;
+// Name entries carry two length-prefixed strings and flags, size, uid/gid, permissions and times
+constexpr auto name_entry_overhead = 4u + 4u + 4u + 8u + 8u + 4u + 8u;
+
 enum Permissions
 {
     read_user = 0400,
@@ -53,13 +102,6 @@ enum Permissions
     exec_other = 01
 };
 
-auto make_sftp_session(ssh_session session, ssh_channel channel)
-{
-    mp::SftpServer::SftpSessionUptr sftp_server_session{sftp_server_new(session, channel), sftp_free};
-    mp::SSH::throw_on_error(sftp_server_session, session, "[sftp] server init failed", sftp_server_init);
-    return sftp_server_session;
-}
-
 int reply_ok(sftp_client_message msg)
 {
     return sftp_reply_status(msg, SSH_FX_OK, nullptr);
@@ -85,78 +127,50 @@ int reply_unsupported(sftp_client_message msg)
     return sftp_reply_status(msg, SSH_FX_OP_UNSUPPORTED, "Unsupported message");
 }
 
-fmt::memory_buffer& operator<<(fmt::memory_buffer& buf, const char* v)
+// The permission characters of an `ls -l` mode string, in order
+constexpr struct
 {
-    fmt::format_to(buf, v);
-    return buf;
+    mode_t bit;
+    char set;
+} mode_chars[] = {{S_IRUSR, 'r'}, {S_IWUSR, 'w'}, {S_IXUSR, 'x'}, {S_IRGRP, 'r'}, {S_IWGRP, 'w'},
+                  {S_IXGRP, 'x'}, {S_IROTH, 'r'}, {S_IWOTH, 'w'}, {S_IXOTH, 'x'}};
+
+// Into a buffer the caller keeps across entries, null-terminated. Its inline storage fits all but the longest names, so
+// directory listings do not allocate per entry
+void longname_from(const struct stat& st, const char* filename, fmt::memory_buffer& out)
+{
+    char mode[1 + std::size(mode_chars)];
+    mode[0] = S_ISLNK(st.st_mode) ? 'l' : S_ISDIR(st.st_mode) ? 'd' : '-';
+    for (std::size_t i = 0; i < std::size(mode_chars); ++i)
+        mode[i + 1] = st.st_mode & mode_chars[i].bit ? mode_chars[i].set : '-';
+
+    tm modified{};
+    char timestamp[32];
+    ::localtime_r(&st.st_mtime, &modified);
+    ::strftime(timestamp, sizeof(timestamp), "%b %-d %H:%M:%S %Y", &modified);
+
+    out.clear();
+    fmt::format_to(out, "{} 1 {} {} {} {} {}", fmt::string_view(mode, sizeof(mode)), st.st_uid, st.st_gid, st.st_size,
+                   timestamp, filename);
+    out.push_back('\0');
 }
 
-auto longname_from(const QFileInfo& file_info, const std::string& filename)
+auto attr_from_stat(const struct stat& st)
 {
-    fmt::memory_buffer out;
-    auto mode = file_info.permissions();
-
-    if (file_info.isSymLink())
-        out << "l";
-    else if (file_info.isDir())
-        out << "d";
-    else
-        out << "-";
-
-    /* user */
-    if (mode & QFileDevice::ReadOwner)
-        out << "r";
-    else
-        out << "-";
-
-    if (mode & QFileDevice::WriteOwner)
-        out << "w";
-    else
-        out << "-";
-
-    if (mode & QFileDevice::ExeOwner)
-        out << "x";
-    else
-        out << "-";
-
-    /*group*/
-    if (mode & QFileDevice::ReadGroup)
-        out << "r";
-    else
-        out << "-";
-
-    if (mode & QFileDevice::WriteGroup)
-        out << "w";
-    else
-        out << "-";
-
-    if (mode & QFileDevice::ExeGroup)
-        out << "x";
-    else
-        out << "-";
-
-    /* other */
-    if (mode & QFileDevice::ReadOther)
-        out << "r";
-    else
-        out << "-";
-
-    if (mode & QFileDevice::WriteOther)
-        out << "w";
-    else
-        out << "-";
+    sftp_attributes_struct attr{};
 
-    if (mode & QFileDevice::ExeOther)
-        out << "x";
-    else
-        out << "-";
+    attr.size = st.st_size;
 
-    fmt::format_to(out, " 1 {} {} {}", file_info.ownerId(), file_info.groupId(), file_info.size());
+    attr.uid = st.st_uid;
+    attr.gid = st.st_gid;
 
-    const auto timestamp = file_info.lastModified().toString("MMM d hh:mm:ss yyyy").toStdString();
-    fmt::format_to(out, " {} {}", timestamp, filename);
+    attr.permissions = st.st_mode;
+    attr.atime = st.st_atime;
+    attr.mtime = st.st_mtime;
+    attr.flags =
+        SSH_FILEXFER_ATTR_SIZE | SSH_FILEXFER_ATTR_UIDGID | SSH_FILEXFER_ATTR_PERMISSIONS | SSH_FILEXFER_ATTR_ACMODTIME;
 
-    return out;
+    return attr;
 }
 
 auto to_qt_permissions(uint32_t perms)
@@ -185,118 +199,1193 @@ auto to_qt_permissions(uint32_t perms)
     return out;
 }
 
-auto to_unix_permissions(QFile::Permissions perms)
-{
-    int out = 0;
-
-    if (perms & QFileDevice::ReadOwner)
-        out |= Permissions::read_user;
-    if (perms & QFileDevice::WriteOwner)
-        out |= Permissions::write_user;
-    if (perms & QFileDevice::ExeOwner)
-        out |= Permissions::exec_user;
-    if (perms & QFileDevice::ReadGroup)
-        out |= Permissions::read_group;
-    if (perms & QFileDevice::WriteGroup)
-        out |= Permissions::write_group;
-    if (perms & QFileDevice::ExeGroup)
-        out |= Permissions::exec_group;
-    if (perms & QFileDevice::ReadOther)
-        out |= Permissions::read_other;
-    if (perms & QFileDevice::WriteOther)
-        out |= Permissions::write_other;
-    if (perms & QFileDevice::ExeOther)
-        out |= Permissions::exec_other;
-
-    return out;
-}
-
 auto validate_path(const std::string& source_path, const std::string& current_path)
 {
     if (source_path.empty())
         return false;
 
-    return current_path.compare(0, source_path.length(), source_path) == 0;
+    return current_path.compare(0, source_path.length(), source_path) == 0;
+}
+
+bool pwrite_all(int fd, const char* data, size_t len, uint64_t offset)
+{
+    while (len > 0)
+    {
+        auto r = ::pwrite(fd, data, len, offset);
+        if (r < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+
+        data += r;
+        len -= r;
+        offset += r;
+    }
+
+    return true;
+}
+
+// Copies within the host, letting the filesystem share extents where it can. A length of 0 copies up to the end,
+// otherwise running into the end is reported as such
+uint32_t copy_range(int from_fd, off_t from_offset, uint64_t length, int to_fd, off_t to_offset)
+{
+    const auto to_end = length == 0;
+    std::vector<char> buffer; // once the kernel cannot copy between these files
+    while (to_end || length > 0)
+    {
+        const auto chunk = to_end ? std::size_t{max_read_length}
+                                  : static_cast<std::size_t>(std::min<uint64_t>(length, max_read_length));
+        ssize_t copied;
+        if (buffer.empty())
+        {
+            copied = ::copy_file_range(from_fd, &from_offset, to_fd, &to_offset, chunk, 0);
+            if (copied < 0 && (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP))
+            {
+                buffer.resize(max_read_length);
+                continue;
+            }
+        }
+        else
+        {
+            copied = ::pread(from_fd, buffer.data(), chunk, from_offset);
+            if (copied > 0 && !pwrite_all(to_fd, buffer.data(), copied, to_offset))
+                return SSH_FX_FAILURE;
+            if (copied > 0)
+            {
+                from_offset += copied;
+                to_offset += copied;
+            }
+        }
+
+        if (copied < 0 && errno == EINTR)
+            continue;
+        if (copied < 0)
+            return SSH_FX_FAILURE;
+        if (copied == 0)
+            return to_end ? SSH_FX_OK : SSH_FX_EOF;
+        if (!to_end)
+            length -= copied;
+    }
+
+    return SSH_FX_OK;
+}
+
+// Walks the fields of a request libssh leaves unparsed
+class RequestFields
+{
+public:
+    explicit RequestFields(sftp_client_message msg)
+    {
+        if (msg->complete_message == nullptr)
+            return;
+
+        pos = static_cast<const unsigned char*>(ssh_buffer_get(msg->complete_message));
+        end = pos + ssh_buffer_get_len(msg->complete_message);
+        number(4); // the request id
+        string();  // the extension's name
+    }
+
+    uint64_t number(int bytes)
+    {
+        if (end - pos < bytes)
+        {
+            pos = end = nullptr;
+            return 0;
+        }
+
+        uint64_t value = 0;
+        for (int i = 0; i < bytes; ++i)
+            value = value << 8 | *pos++;
+        return value;
+    }
+
+    std::string string()
+    {
+        const auto length = number(4);
+        if (static_cast<uint64_t>(end - pos) < length)
+        {
+            pos = end = nullptr;
+            return {};
+        }
+
+        std::string value(pos, pos + length);
+        pos += length;
+        return value;
+    }
+
+    bool complete() const
+    {
+        return pos != nullptr;
+    }
+
+private:
+    const unsigned char* pos{nullptr};
+    const unsigned char* end{nullptr};
+};
+
+// For handles that arrive among the fields libssh leaves unparsed
+SftpHandleUPtr make_handle_string(const std::string& handle)
+{
+    SftpHandleUPtr handle_string{ssh_string_new(handle.size()), ssh_string_free};
+    ssh_string_fill(handle_string.get(), handle.data(), handle.size());
+    return handle_string;
+}
+
+void put_number(std::string& out, uint64_t value, int bytes)
+{
+    for (int i = bytes - 1; i >= 0; --i)
+        out.push_back(static_cast<char>(value >> (8 * i) & 0xff));
+}
+
+// libssh has no reply for statvfs@openssh.com, so the packet is put together here
+int reply_statvfs(ssh_channel channel, sftp_client_message msg, const struct statvfs& st)
+{
+    constexpr auto extended_reply_type = 201;
+    constexpr auto readonly_flag = 0x1u, nosuid_flag = 0x2u;
+
+    std::string packet;
+    put_number(packet, extended_reply_type, 1);
+    put_number(packet, msg->id, 4);
+    for (uint64_t field : {uint64_t{st.f_bsize}, uint64_t{st.f_frsize}, uint64_t{st.f_blocks}, uint64_t{st.f_bfree},
+                           uint64_t{st.f_bavail}, uint64_t{st.f_files}, uint64_t{st.f_ffree}, uint64_t{st.f_favail},
+                           uint64_t{st.f_fsid}, uint64_t{st.f_namemax}})
+        put_number(packet, field, 8);
+    put_number(packet, ((st.f_flag & ST_RDONLY) ? readonly_flag : 0) | ((st.f_flag & ST_NOSUID) ? nosuid_flag : 0),
+               8);
+
+    std::string length;
+    put_number(length, packet.size(), 4);
+    packet.insert(0, length);
+
+    return ssh_channel_write(channel, packet.data(), packet.size()) < 0 ? SSH_ERROR : SSH_OK;
+}
+
+bool read_exactly(ssh_channel channel, std::string& out, uint32_t size)
+{
+    out.resize(size);
+    for (uint32_t read = 0; read < size;)
+    {
+        const auto r = ssh_channel_read(channel, &out[read], size - read, 0);
+        if (r <= 0)
+            return false;
+        read += r;
+    }
+    return true;
+}
+
+// Named with the versions OpenSSH gives them
+constexpr struct
+{
+    const char* name;
+    const char* version;
+} sftp_extensions[] = {{"posix-rename@openssh.com", "1"}, {"hardlink@openssh.com", "1"}, {"fsync@openssh.com", "1"},
+                       {"statvfs@openssh.com", "2"},      {"fstatvfs@openssh.com", "2"}, {"copy-data", "1"}};
+
+// Stands in for sftp_server_init, which has no way to add to the extensions libssh advertises itself. sshfs only uses
+// those it finds in the version reply, so every extension handle_extended answers is listed here
+int init_sftp_server(sftp_session sftp)
+{
+    constexpr auto init_type = 1, version_type = 2;
+    constexpr auto max_init_size = 64u * 1024u;
+
+    std::string length, init;
+    if (!read_exactly(sftp->channel, length, 4))
+        return SSH_ERROR;
+
+    uint32_t init_size{0};
+    for (auto c : length)
+        init_size = init_size << 8 | static_cast<unsigned char>(c);
+    if (init_size < 5 || init_size > max_init_size || !read_exactly(sftp->channel, init, init_size) ||
+        init[0] != init_type)
+        return SSH_ERROR;
+
+    int client_version{0};
+    for (auto i = 1; i < 5; ++i)
+        client_version = client_version << 8 | static_cast<unsigned char>(init[i]);
+    sftp->client_version = client_version;
+    sftp->version = std::min(client_version, LIBSFTP_VERSION);
+
+    std::string packet;
+    put_number(packet, version_type, 1);
+    put_number(packet, LIBSFTP_VERSION, 4);
+    for (const auto& extension : sftp_extensions)
+    {
+        for (const std::string field : {extension.name, extension.version})
+        {
+            put_number(packet, field.size(), 4);
+            packet += field;
+        }
+    }
+
+    std::string packet_length;
+    put_number(packet_length, packet.size(), 4);
+    packet.insert(0, packet_length);
+
+    return ssh_channel_write(sftp->channel, packet.data(), packet.size()) < 0 ? SSH_ERROR : SSH_OK;
+}
+
+auto make_sftp_session(ssh_session session, ssh_channel channel)
+{
+    mp::SftpServer::SftpSessionUptr sftp_server_session{sftp_server_new(session, channel), sftp_free};
+    mp::SSH::throw_on_error(sftp_server_session, session, "[sftp] server init failed", init_sftp_server);
+    return sftp_server_session;
+}
+
+int reply_stat(sftp_client_message msg, sftp_attributes_struct attr, uint32_t status)
+{
+    if (status == SSH_FX_PERMISSION_DENIED)
+        return reply_perm_denied(msg);
+    if (status == SSH_FX_NO_SUCH_FILE)
+        return sftp_reply_status(msg, SSH_FX_NO_SUCH_FILE, "no such file");
+
+    return sftp_reply_attr(msg, &attr);
+}
+
+void check_sshfs_status(mp::SSHSession& session, mp::SSHProcess& sshfs_process)
+{
+    try
+    {
+        if (sshfs_process.exit_code(250ms) != 0)
+            throw std::runtime_error(sshfs_process.read_std_error());
+    }
+    catch (const mp::ExitlessSSHProcessException&)
+    {
+        // Timeout getting exit status; assume sshfs is running in the instance
+    }
+}
+
+// How long the instance trusts what it was told about the host's files. Its caches only see changes made through
+// the mount, so a file edited on the host can look stale for up to that long
+std::string sshfs_options_for(const std::string& profile)
+{
+    if (profile == mp::default_mount_profile)
+        return fmt::format("-o negative_timeout={}", guest_negative_timeout_s);
+    if (profile == mp::strict_mount_profile)
+        return "-o cache=no -o attr_timeout=0 -o entry_timeout=0 -o negative_timeout=0";
+    if (profile == mp::dev_mount_profile)
+        return fmt::format("-o cache_timeout=2 -o attr_timeout=2 -o entry_timeout=2 -o negative_timeout={} "
+                           "-o max_read={} -o max_write={}",
+                           guest_negative_timeout_s, max_read_length, max_read_length);
+    if (profile == mp::write_back_mount_profile)
+        return fmt::format("-o negative_timeout={} -o max_write={}", guest_negative_timeout_s, max_read_length);
+    if (profile == mp::read_only_mount_profile)
+        return fmt::format("-o ro -o kernel_cache -o cache_timeout=3600 -o attr_timeout=3600 -o entry_timeout=3600 "
+                           "-o negative_timeout=3600 -o max_read={}",
+                           max_read_length);
+
+    throw std::runtime_error(fmt::format("unknown mount profile \"{}\"", profile));
+}
+
+// Anything to run first goes in the same command, sparing a round trip to the instance
+auto create_sshfs_process(mp::SSHSession& session, const std::string& source, const std::string& target,
+                          const std::string& profile, const std::string& before = {})
+{
+    auto sshfs_process = session.exec(fmt::format(
+        "{}sudo sshfs -o slave -o nonempty -o transform_symlinks -o allow_other {} :\"{}\" \"{}\"", before,
+        sshfs_options_for(profile), source, target));
+
+    check_sshfs_status(session, sshfs_process);
+
+    return std::make_unique<mp::SSHProcess>(std::move(sshfs_process));
+}
+
+// Labels ops in telemetry, folding the variants that cost the same together
+const char* op_name(int type)
+{
+    switch (type)
+    {
+    case SFTP_OPEN:
+        return "open";
+    case SFTP_CLOSE:
+        return "close";
+    case SFTP_READ:
+        return "read";
+    case SFTP_WRITE:
+        return "write";
+    case SFTP_LSTAT:
+    case SFTP_STAT:
+    case SFTP_FSTAT:
+        return "stat";
+    case SFTP_SETSTAT:
+    case SFTP_FSETSTAT:
+        return "setstat";
+    case SFTP_OPENDIR:
+        return "opendir";
+    case SFTP_READDIR:
+        return "readdir";
+    case SFTP_REALPATH:
+    case SFTP_READLINK:
+        return "resolve";
+    case SFTP_MKDIR:
+    case SFTP_RMDIR:
+    case SFTP_RENAME:
+    case SFTP_REMOVE:
+    case SFTP_SYMLINK:
+        return "modify";
+    default:
+        return "other";
+    }
+}
+} // namespace
+
+class mp::SftpServer::DirStream
+{
+public:
+    explicit DirStream(DIR* dir) : dir{dir, closedir}
+    {
+    }
+
+    int fd()
+    {
+        return dirfd(dir.get());
+    }
+
+    // Hands out entries one at a time; an entry given back with unread() is returned again by the next call
+    dirent* next()
+    {
+        position = telldir(dir.get());
+        return readdir(dir.get());
+    }
+
+    void unread()
+    {
+        seekdir(dir.get(), position);
+    }
+
+private:
+    std::unique_ptr<DIR, decltype(closedir)*> dir;
+    long position{0};
+};
+
+struct mp::SftpServer::OpenFile
+{
+    OpenFile() = default;
+    OpenFile(const OpenFile&) = delete;
+    OpenFile& operator=(const OpenFile&) = delete;
+    ~OpenFile()
+    {
+        close();
+    }
+
+    void close()
+    {
+        if (fd >= 0)
+            ::close(fd);
+        fd = -1;
+        path.clear();
+        write_failed = false;
+        next_read = 0;
+        sequential_reads = 0;
+        read_ahead = 0;
+        read_ahead_until = 0;
+    }
+
+    // The instance asks for a read at a time, so without this the disk would sit idle while each reply travels to it
+    // and the next request back. Reads count as sequential when they start around where the last one ended, as sshfs
+    // keeps several in flight and they may arrive a little out of order
+    void note_read(uint64_t offset, uint64_t length)
+    {
+        const auto sequential = offset + max_read_length >= next_read && offset <= next_read + max_read_length;
+        sequential_reads = sequential ? sequential_reads + 1 : 0;
+        next_read = std::max(next_read, offset + length);
+        if (!sequential)
+        {
+            read_ahead = 0;
+            read_ahead_until = 0;
+            next_read = offset + length;
+            return;
+        }
+
+        // Asked for again once the reads are halfway through what was asked for last, so that it stays ahead
+        if (sequential_reads < sequential_reads_for_read_ahead ||
+            next_read + read_ahead / 2 < read_ahead_until)
+            return;
+
+        read_ahead = read_ahead ? std::min(read_ahead * 2, uint64_t{max_read_ahead}) : uint64_t{min_read_ahead};
+        const auto from = std::max(read_ahead_until, next_read);
+        read_ahead_until = next_read + read_ahead;
+        ::posix_fadvise(fd, from, read_ahead_until - from, POSIX_FADV_WILLNEED);
+    }
+
+    int fd{-1};
+    std::string path;
+    bool write_failed{false}; // by an earlier, already acknowledged write; reported on the next request
+    uint64_t next_read{0};    // where the sequential reads so far end
+    int sequential_reads{0};
+    uint64_t read_ahead{0}; // how much was asked of the kernel last
+    uint64_t read_ahead_until{0};
+};
+
+// Open files and directories, found by handle without hashing. A handle carries its slot's index and the generation
+// the slot was in when handed out, so one used after its close is refused rather than finding the slot's next
+// tenant. Files stay in their slots once closed, so that later opens reuse them instead of allocating
+class mp::SftpServer::HandleTable
+{
+public:
+    // The handle is null if open fails, which then leaves the file closed
+    template <typename Open>
+    void* open_file(Open&& open)
+    {
+        auto index = take_slot();
+        auto& slot = slots[index];
+        if (!open(slot.file))
+        {
+            slot.file.close();
+            free_slots.push_back(index);
+            return nullptr;
+        }
+
+        slot.kind = Kind::file;
+        return handle_for(index);
+    }
+
+    void* add_dir(std::unique_ptr<DirStream> dir)
+    {
+        auto index = take_slot();
+        slots[index].dir = std::move(dir);
+        slots[index].kind = Kind::dir;
+        return handle_for(index);
+    }
+
+    OpenFile* file(void* handle)
+    {
+        auto slot = find(handle, Kind::file);
+        return slot ? &slot->file : nullptr;
+    }
+
+    DirStream* dir(void* handle)
+    {
+        auto slot = find(handle, Kind::dir);
+        return slot ? slot->dir.get() : nullptr;
+    }
+
+    bool close(void* handle)
+    {
+        auto slot = find(handle, Kind::file);
+        if (!slot)
+            slot = find(handle, Kind::dir);
+        if (!slot)
+            return false;
+
+        slot->file.close();
+        slot->dir.reset();
+        slot->kind = Kind::free;
+        ++slot->generation;
+        free_slots.push_back(index_of(handle));
+        return true;
+    }
+
+private:
+    enum class Kind
+    {
+        free,
+        file,
+        dir
+    };
+    struct Slot
+    {
+        Kind kind{Kind::free};
+        uintptr_t generation{1};
+        OpenFile file;
+        std::unique_ptr<DirStream> dir;
+    };
+    static constexpr auto index_bits = 24; // leaves the generation at least 8 bits even with 32-bit pointers
+
+    std::size_t take_slot()
+    {
+        if (free_slots.empty())
+        {
+            if (slots.size() + 1 >= (std::size_t{1} << index_bits))
+                throw std::runtime_error("too many open handles");
+            slots.emplace_back();
+            return slots.size() - 1;
+        }
+
+        auto index = free_slots.back();
+        free_slots.pop_back();
+        return index;
+    }
+
+    void* handle_for(std::size_t index) const
+    {
+        // The index is stored off by one so that no handle is null
+        return reinterpret_cast<void*>((slots[index].generation << index_bits) | (index + 1));
+    }
+
+    static std::size_t index_of(void* handle)
+    {
+        return (reinterpret_cast<uintptr_t>(handle) & ((uintptr_t{1} << index_bits) - 1)) - 1;
+    }
+
+    Slot* find(void* handle, Kind kind)
+    {
+        auto index = index_of(handle);
+        if (handle == nullptr || index >= slots.size() || slots[index].kind != kind || handle_for(index) != handle)
+            return nullptr;
+        return &slots[index];
+    }
+
+    std::deque<Slot> slots; // never moved once made, so pointers to their files stay valid
+    std::vector<std::size_t> free_slots;
+};
+
+// Caches stat results for paths that are not symlinks, including missing ones. Every directory from an entry's
+// parent up to the mount root is watched with inotify, so that any change that could affect the entry drops it.
+class mp::SftpServer::AttrCache
+{
+public:
+    explicit AttrCache(const std::string& root)
+        : root{QDir::cleanPath(QString::fromStdString(root)).toStdString()},
+          inotify_fd{inotify_init1(IN_NONBLOCK | IN_CLOEXEC)}
+    {
+        if (inotify_fd < 0)
+            mpl::log(mpl::Level::warning, category,
+                     "attribute cache disabled, cannot initialize inotify: {}", std::strerror(errno));
+    }
+
+    ~AttrCache()
+    {
+        if (inotify_fd >= 0)
+            ::close(inotify_fd);
+    }
+
+    mp::optional<StatResult> find(const std::string& path)
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        process_events();
+
+        auto entry = entries.find(path);
+        if (entry == entries.end())
+            return mp::nullopt;
+
+        return entry->second;
+    }
+
+    // Must be called before the path is statted; the result is only cached if nothing changed in between
+    mp::optional<uint64_t> prepare(const std::string& path)
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        const auto is_clean = QDir::cleanPath(QString::fromStdString(path)) == QString::fromStdString(path);
+        if (inotify_fd < 0 || path == root || !within_root(path) || !is_clean)
+            return mp::nullopt;
+
+        // Dropped before starting, so that the entry never ends up without the watches of some of its parents
+        if (watches.size() + unwatched_parents_of(path) > max_attr_watches)
+            drop_all();
+
+        for (auto dir = parent_of(path);; dir = parent_of(dir))
+        {
+            if (!watch(dir))
+                return mp::nullopt;
+
+            if (dir.size() <= root.size())
+                break;
+        }
+
+        process_events();
+        return events_seen;
+    }
+
+    void insert(const std::string& path, const StatResult& result, const mp::optional<uint64_t>& generation)
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        if (!generation)
+            return;
+
+        process_events();
+        if (events_seen != *generation)
+            return;
+
+        if (entries.size() >= max_cached_attrs)
+            drop_all();
+
+        entries[path] = result;
+    }
+
+    // For directories the instance lists; the ones holding statted entries are watched already
+    void watch_dir(const std::string& dir)
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        const auto is_clean = QDir::cleanPath(QString::fromStdString(dir)) == QString::fromStdString(dir);
+        if (inotify_fd < 0 || !within_root(dir) || !is_clean)
+            return;
+
+        if (watches.size() >= max_attr_watches)
+            drop_all();
+        watch(dir);
+    }
+
+    // Paths that changed under the watched directories since the last call. Nothing is collected before the first
+    std::set<std::string> take_changes()
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        collect_changes = true;
+        process_events();
+        return std::exchange(changes, {});
+    }
+
+private:
+    static std::string parent_of(const std::string& path)
+    {
+        auto pos = path.rfind('/');
+        return pos == 0 ? "/" : path.substr(0, pos);
+    }
+
+    // By whole components, so that "/mnt/a-b" is not taken to lie under "/mnt/a"
+    bool within_root(const std::string& path) const
+    {
+        return path.compare(0, root.size(), root) == 0 &&
+               (path.size() == root.size() || root == "/" || path[root.size()] == '/');
+    }
+
+    bool watch(const std::string& dir)
+    {
+        if (watches.find(dir) != watches.end())
+            return true;
+
+        auto wd = inotify_add_watch(inotify_fd, dir.c_str(), attr_watch_mask | IN_ONLYDIR);
+        if (wd < 0)
+        {
+            // Out of inotify watches; the paths under it are statted afresh every time instead
+            if (errno == ENOSPC && !warned_out_of_watches)
+            {
+                mpl::log(mpl::Level::warning, category, "not caching attributes under {}, out of inotify watches",
+                         dir);
+                warned_out_of_watches = true;
+            }
+            return false;
+        }
+
+        watches.emplace(dir, wd);
+        watched_paths[wd].insert(dir);
+        return true;
+    }
+
+    std::size_t unwatched_parents_of(const std::string& path) const
+    {
+        std::size_t count{0};
+        for (auto dir = parent_of(path);; dir = parent_of(dir))
+        {
+            count += watches.find(dir) == watches.end();
+            if (dir.size() <= root.size())
+                return count;
+        }
+    }
+
+    // Entries need the watches of all their parents, so both go together. What was listed is flagged as changing
+    void drop_all()
+    {
+        for (const auto& watched : watched_paths)
+            inotify_rm_watch(inotify_fd, watched.first);
+
+        entries.clear();
+        watches.clear();
+        watched_paths.clear();
+        ++events_seen; // stats still in flight were prepared under the watches just dropped
+        note_change(root);
+    }
+
+    void process_events()
+    {
+        alignas(inotify_event) char buffer[4096];
+        ssize_t len;
+
+        while ((len = ::read(inotify_fd, buffer, sizeof(buffer))) > 0)
+        {
+            for (auto ptr = buffer; ptr < buffer + len;)
+            {
+                auto event = reinterpret_cast<const inotify_event*>(ptr);
+                handle_event(*event);
+                ptr += sizeof(inotify_event) + event->len;
+            }
+        }
+    }
+
+    void handle_event(const inotify_event& event)
+    {
+        ++events_seen;
+
+        if (event.mask & IN_Q_OVERFLOW)
+        {
+            entries.clear();
+            note_change(root);
+            return;
+        }
+
+        auto watched = watched_paths.find(event.wd);
+        if (watched == watched_paths.end())
+            return;
+
+        const auto dirs = watched->second;
+        for (const auto& dir : dirs)
+        {
+            // A directory's own size and times change along with its contents
+            entries.erase(dir);
+
+            if (event.len > 0)
+            {
+                const auto path = dir == "/" ? dir + event.name : dir + "/" + event.name;
+                invalidate_tree(path);
+                note_change(path);
+            }
+            if (event.len == 0 || event.mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO))
+                note_change(dir);
+
+            if (event.mask & (IN_DELETE_SELF | IN_MOVE_SELF))
+                invalidate_tree(dir);
+        }
+
+        if (event.mask & IN_IGNORED)
+        {
+            for (const auto& dir : dirs)
+                watches.erase(dir);
+            watched_paths.erase(event.wd);
+        }
+    }
+
+    void note_change(const std::string& path)
+    {
+        if (!collect_changes)
+            return;
+
+        if (changes.size() >= max_forwarded_changes)
+            changes = {root};
+        else
+            changes.insert(path);
+    }
+
+    // Entries and watches at or below a path that moved or went away no longer describe what lives there
+    void invalidate_tree(const std::string& path)
+    {
+        const auto prefix = path + "/";
+
+        entries.erase(path);
+        entries.erase(entries.lower_bound(prefix), entries.lower_bound(path + "0")); // '0' follows '/'
+
+        auto forget_watch = [this](std::map<std::string, int>::iterator it) {
+            auto paths = watched_paths.find(it->second);
+            if (paths != watched_paths.end())
+            {
+                paths->second.erase(it->first);
+                if (paths->second.empty())
+                {
+                    inotify_rm_watch(inotify_fd, paths->first); // a directory moved away keeps its watch otherwise
+                    watched_paths.erase(paths);
+                }
+            }
+            return watches.erase(it);
+        };
+
+        auto it = watches.find(path);
+        if (it != watches.end())
+            forget_watch(it);
+
+        for (it = watches.lower_bound(prefix); it != watches.end() && it->first.compare(0, prefix.size(), prefix) == 0;)
+            it = forget_watch(it);
+    }
+
+    const std::string root;
+    const int inotify_fd;
+    std::mutex mutex;
+    std::map<std::string, StatResult> entries;
+    std::map<std::string, int> watches;
+    std::unordered_map<int, std::set<std::string>> watched_paths;
+    uint64_t events_seen{0};
+    bool collect_changes{false};
+    std::set<std::string> changes;
+    bool warned_out_of_watches{false};
+};
+
+class mp::SftpServer::StatWorkers
+{
+public:
+    struct Job
+    {
+        MsgUPtr msg;
+        bool follow;
+        StatResult result;
+        std::chrono::steady_clock::time_point submitted;
+    };
+
+    StatWorkers(SftpServer& server, int worker_count)
+    {
+        for (int i = 0; i < worker_count; ++i)
+            threads.emplace_back([this, &server] { work(server); });
+    }
+
+    ~StatWorkers()
+    {
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            stopping = true;
+        }
+        work_available.notify_all();
+
+        for (auto& thread : threads)
+            thread.join();
+    }
+
+    void submit(MsgUPtr msg, bool follow)
+    {
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            queued.push_back(Job{std::move(msg), follow, StatResult{}, std::chrono::steady_clock::now()});
+            ++in_flight;
+        }
+        work_available.notify_one();
+    }
+
+    std::vector<Job> take_completed(bool wait_for_all)
+    {
+        std::unique_lock<std::mutex> lock{mutex};
+        if (wait_for_all)
+            job_done.wait(lock, [this] { return in_flight == completed.size(); });
+
+        auto jobs = std::move(completed);
+        completed.clear();
+        in_flight -= jobs.size();
+
+        return jobs;
+    }
+
+    bool idle()
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        return in_flight == 0;
+    }
+
+private:
+    void work(SftpServer& server)
+    {
+        while (true)
+        {
+            std::unique_lock<std::mutex> lock{mutex};
+            work_available.wait(lock, [this] { return stopping || !queued.empty(); });
+            if (stopping)
+                return;
+
+            auto job = std::move(queued.front());
+            queued.pop_front();
+            lock.unlock();
+
+            job.result = server.stat_for(sftp_client_message_get_filename(job.msg.get()), job.follow);
+
+            lock.lock();
+            completed.push_back(std::move(job));
+            lock.unlock();
+            job_done.notify_all();
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable work_available;
+    std::condition_variable job_done;
+    std::deque<Job> queued;
+    std::vector<Job> completed;
+    size_t in_flight{0};
+    bool stopping{false};
+    std::vector<std::thread> threads;
+};
+
+// Writes what the instance sent on a thread of its own, leaving the serving thread to take in more meanwhile. They
+// were acknowledged already, so failures are only collected, for the server to report on the next request
+class mp::SftpServer::WriteBack
+{
+public:
+    WriteBack() : thread{[this] { work(); }}
+    {
+    }
+
+    ~WriteBack()
+    {
+        drain();
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            stopping = true;
+        }
+        work_available.notify_all();
+        thread.join();
+    }
+
+    // Waits while too much is queued already, so that a fast instance cannot outrun the disk without bound
+    void submit(OpenFile* file, int fd, const std::string& path, uint64_t offset, std::vector<char>&& data)
+    {
+        {
+            std::unique_lock<std::mutex> lock{mutex};
+            room_available.wait(lock, [this] { return queued_size < max_write_back_size; });
+            queued_size += data.size();
+            queued.push_back(Chunk{file, fd, path, offset, std::move(data)});
+        }
+        work_available.notify_one();
+    }
+
+    // Until everything submitted has landed
+    void drain()
+    {
+        std::unique_lock<std::mutex> lock{mutex};
+        room_available.wait(lock, [this] { return queued.empty() && !writing; });
+    }
+
+    std::vector<OpenFile*> take_failures()
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        return std::exchange(failed, {});
+    }
+
+private:
+    struct Chunk
+    {
+        OpenFile* file;
+        int fd;
+        std::string path;
+        uint64_t offset;
+        std::vector<char> data;
+    };
+
+    void work()
+    {
+        while (true)
+        {
+            std::unique_lock<std::mutex> lock{mutex};
+            work_available.wait(lock, [this] { return stopping || !queued.empty(); });
+            if (queued.empty())
+                return;
+
+            auto chunk = std::move(queued.front());
+            queued.pop_front();
+            while (!queued.empty() && queued.front().fd == chunk.fd &&
+                   queued.front().offset == chunk.offset + chunk.data.size() &&
+                   chunk.data.size() + queued.front().data.size() <= max_write_back_chunk)
+            {
+                chunk.data.insert(chunk.data.end(), queued.front().data.begin(), queued.front().data.end());
+                queued.pop_front();
+            }
+            writing = true;
+            lock.unlock();
+
+            const auto success = pwrite_all(chunk.fd, chunk.data.data(), chunk.data.size(), chunk.offset);
+            if (!success)
+                mpl::log(mpl::Level::error, category, "failed to write to '{}': {}", chunk.path, std::strerror(errno));
+
+            lock.lock();
+            if (!success)
+                failed.push_back(chunk.file);
+            queued_size -= chunk.data.size();
+            writing = false;
+            lock.unlock();
+            room_available.notify_all();
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable work_available;
+    std::condition_variable room_available; // also when everything landed
+    std::deque<Chunk> queued;
+    size_t queued_size{0};
+    bool writing{false};
+    bool stopping{false};
+    std::vector<OpenFile*> failed;
+    std::thread thread; // last, so that it starts with the rest set up
+};
+
+mp::SftpServer::SftpServer(SSHSession&& session, const std::string& source, const std::string& target,
+                           const std::unordered_map<int, int>& gid_map, const std::unordered_map<int, int>& uid_map,
+                           int default_uid, int default_gid, const std::string& profile)
+    : SftpServer(std::make_shared<SSHSession>(std::move(session)), source, target, gid_map, uid_map, default_uid,
+                 default_gid, profile)
+{
+}
+
+mp::SftpServer::SftpServer(std::shared_ptr<SSHSession> session, const std::string& source, const std::string& target,
+                           const std::unordered_map<int, int>& gid_map, const std::unordered_map<int, int>& uid_map,
+                           int default_uid, int default_gid, const std::string& profile)
+    : ssh_session{std::move(session)},
+      sshfs_process{create_sshfs_process(*ssh_session, mp::utils::escape_char(source, '"'),
+                                         mp::utils::escape_char(target, '"'), profile)},
+      sftp_server_session{make_sftp_session(*ssh_session, sshfs_process->release_channel())},
+      source_path{source},
+      target_path{target},
+      mount_profile{profile},
+      handles{std::make_unique<HandleTable>()},
+      gid_map{gid_map},
+      uid_map{uid_map},
+      default_uid{default_uid},
+      default_gid{default_gid},
+      attr_cache{std::make_unique<AttrCache>(source)}
+{
+}
+
+mp::SftpServer::~SftpServer()
+{
+    stop_invoked = true;
+    land_writes();
+    report_usage(true);
+}
+
+void mp::SftpServer::record_op(const char* op, std::chrono::steady_clock::time_point start)
+{
+    usage.op_latencies[op].push_back(std::chrono::steady_clock::now() - start);
+    report_usage(false);
+}
+
+void mp::SftpServer::report_usage(bool force)
+{
+    const auto now = std::chrono::steady_clock::now();
+    if ((usage.op_latencies.empty() && usage.bytes_written == 0) ||
+        (!force && now - usage.reported < usage_report_interval))
+        return;
+
+    auto& telemetry = Telemetry::instance();
+    for (const auto& op : usage.op_latencies)
+    {
+        Telemetry::Labels op_labels{{"mount", target_path}, {"op", op.first}};
+        if (!instance_label.empty())
+            op_labels["instance"] = instance_label;
+        telemetry.count("multipass_sftp_operations_total", op_labels, op.second.size());
+        for (const auto& latency : op.second)
+            telemetry.observe("multipass_sftp_operation_duration_seconds", op_labels, latency);
+    }
+
+    Telemetry::Labels labels{{"mount", target_path}};
+    if (!instance_label.empty())
+        labels["instance"] = instance_label;
+    telemetry.count("multipass_sftp_read_bytes_total", labels, usage.bytes_read);
+    telemetry.count("multipass_sftp_written_bytes_total", labels, usage.bytes_written);
+
+    usage = Usage{};
+    usage.reported = now;
+}
+
+void mp::SftpServer::label_usage(const std::string& instance)
+{
+    instance_label = instance;
+}
+
+void mp::SftpServer::enable_pipelining(int worker_count)
+{
+    stat_workers = std::make_unique<StatWorkers>(*this, worker_count);
+}
+
+void mp::SftpServer::enable_write_back()
+{
+    write_back = std::make_unique<WriteBack>();
 }
 
-template <typename T>
-auto handle_from(sftp_client_message msg, const std::unordered_map<void*, std::unique_ptr<T>>& handles) -> T*
+void mp::SftpServer::enable_read_ring(unsigned entries)
 {
-    const auto id = sftp_handle(msg->sftp, msg->handle);
-    auto entry = handles.find(id);
-    if (entry != handles.end())
-        return entry->second.get();
-    return nullptr;
+    auto ring = std::make_unique<ReadRing>(entries);
+    if (ring->available())
+        read_ring = std::move(ring);
+    else
+        mpl::log(mpl::Level::debug, category, "io_uring is not available, reads are served one at a time");
 }
 
-void check_sshfs_status(mp::SSHSession& session, mp::SSHProcess& sshfs_process)
+void mp::SftpServer::enable_change_forwarding()
 {
+    // Touching a path through the mount with its own times changes nothing, yet has the instance's kernel tell its
+    // watchers about it. Paths come one per line, relative to the mount
+    const auto agent = fmt::format("sudo sh -c 'cd \"$1\" && while IFS= read -r p; do touch -c -h -r \"$p\" \"$p\"; "
+                                   "done >/dev/null 2>&1' sh \"{}\"",
+                                   mp::utils::escape_char(target_path, '"'));
     try
     {
-        if (sshfs_process.exit_code(250ms) != 0)
-            throw std::runtime_error(sshfs_process.read_std_error());
+        change_agent = std::make_unique<SSHProcess>(ssh_session->exec(agent));
     }
-    catch (const mp::ExitlessSSHProcessException&)
+    catch (const std::exception& e)
     {
-        // Timeout getting exit status; assume sshfs is running in the instance
+        mpl::log(mpl::Level::warning, category, "cannot forward host changes to '{}': {}", target_path, e.what());
     }
 }
 
-auto create_sshfs_process(mp::SSHSession& session, const std::string& source, const std::string& target)
+void mp::SftpServer::forward_changes()
 {
-    auto sshfs_process = session.exec(fmt::format(
-        "sudo sshfs -o slave -o nonempty -o transform_symlinks -o allow_other :\"{}\" \"{}\"", source, target));
+    if (!change_agent)
+        return;
 
-    check_sshfs_status(session, sshfs_process);
+    const auto changes = attr_cache->take_changes();
+    if (!changes.empty())
+        queue_changes(changes);
 
-    return std::make_unique<mp::SSHProcess>(std::move(sshfs_process));
-}
-} // namespace
+    // Only what the agent's channel has room for is written, so that an agent falling behind never holds up the mount
+    const auto channel = change_agent->channel.get();
+    const auto room = std::min<std::size_t>(ssh_channel_window_size(channel), unsent_changes.size());
+    if (room == 0)
+        return;
 
-mp::SftpServer::SftpServer(SSHSession&& session, const std::string& source, const std::string& target,
-                           const std::unordered_map<int, int>& gid_map, const std::unordered_map<int, int>& uid_map,
-                           int default_uid, int default_gid)
-    : ssh_session{std::move(session)},
-      sshfs_process{
-          create_sshfs_process(ssh_session, mp::utils::escape_char(source, '"'), mp::utils::escape_char(target, '"'))},
-      sftp_server_session{make_sftp_session(ssh_session, sshfs_process->release_channel())},
-      source_path{source},
-      target_path{target},
-      gid_map{gid_map},
-      uid_map{uid_map},
-      default_uid{default_uid},
-      default_gid{default_gid}
-{
-}
+    const auto written = ssh_channel_write(channel, unsent_changes.data(), static_cast<uint32_t>(room));
+    if (written < 0)
+    {
+        mpl::log(mpl::Level::warning, category, "stopped forwarding host changes to '{}'", target_path);
+        change_agent.reset();
+        unsent_changes.clear();
+        return;
+    }
 
-mp::SftpServer::~SftpServer()
-{
-    stop_invoked = true;
+    unsent_changes.erase(0, written);
 }
 
-sftp_attributes_struct mp::SftpServer::attr_from(const QFileInfo& file_info)
+void mp::SftpServer::queue_changes(const std::set<std::string>& changes)
 {
-    sftp_attributes_struct attr{};
+    const auto now = std::chrono::steady_clock::now();
+    for (auto it = guest_changes.begin(); it != guest_changes.end();)
+        it = now - it->second > guest_change_grace ? guest_changes.erase(it) : std::next(it);
 
-    attr.size = file_info.size();
+    const QDir source_dir{QString::fromStdString(source_path)};
+    std::string lines;
+    for (const auto& path : changes)
+    {
+        // The instance heard about its own changes already, and a newline cannot be told from the end of a path
+        if (guest_changes.find(path) != guest_changes.end() || path.find('\n') != std::string::npos)
+            continue;
 
-    attr.uid = mapped_uid_for(file_info.ownerId());
-    attr.gid = mapped_gid_for(file_info.groupId());
+        const auto relative = source_dir.relativeFilePath(QString::fromStdString(path)).toStdString();
+        lines += (relative.empty() ? "." : relative) + '\n';
+    }
 
-    attr.permissions = to_unix_permissions(file_info.permissions());
-    attr.atime = file_info.lastRead().toUTC().toMSecsSinceEpoch() / 1000;
-    attr.mtime = file_info.lastModified().toUTC().toMSecsSinceEpoch() / 1000;
-    attr.flags =
-        SSH_FILEXFER_ATTR_SIZE | SSH_FILEXFER_ATTR_UIDGID | SSH_FILEXFER_ATTR_PERMISSIONS | SSH_FILEXFER_ATTR_ACMODTIME;
+    // Touching the mount root tells every watcher to look again, which is all that is left to say by then. The first
+    // line may be partly written already, so it goes out whole
+    unsent_changes += lines;
+    if (unsent_changes.size() > max_unsent_changes)
+        unsent_changes = unsent_changes.substr(0, unsent_changes.find('\n') + 1) + ".\n";
+}
 
-    if (file_info.isSymLink())
-        attr.permissions |= SSH_S_IFLNK | 0777;
-    else if (file_info.isDir())
-        attr.permissions |= SSH_S_IFDIR;
-    else if (file_info.isFile())
-        attr.permissions |= SSH_S_IFREG;
+void mp::SftpServer::note_guest_change(sftp_client_message msg, uint8_t type)
+{
+    const auto now = std::chrono::steady_clock::now();
+    auto note = [this, now](const char* path) {
+        if (path != nullptr)
+            guest_changes[QDir::cleanPath(path).toStdString()] = now;
+    };
 
-    return attr;
+    switch (type)
+    {
+    case SFTP_WRITE:
+    case SFTP_FSETSTAT:
+    {
+        auto file = handles->file(sftp_handle(msg->sftp, msg->handle));
+        if (file != nullptr && !file->path.empty())
+            note(file->path.c_str());
+        break;
+    }
+    case SFTP_OPEN:
+        if (msg->flags & (SSH_FXF_WRITE | SSH_FXF_CREAT | SSH_FXF_TRUNC | SSH_FXF_APPEND))
+            note(sftp_client_message_get_filename(msg));
+        break;
+    case SFTP_SETSTAT:
+    case SFTP_MKDIR:
+    case SFTP_RMDIR:
+    case SFTP_REMOVE:
+        note(sftp_client_message_get_filename(msg));
+        break;
+    case SFTP_RENAME:
+    case SFTP_SYMLINK:
+    case SFTP_EXTENDED:
+        note(sftp_client_message_get_filename(msg));
+        note(sftp_client_message_get_data(msg));
+        break;
+    }
 }
 
 int mp::SftpServer::mapped_uid_for(const int uid)
@@ -333,10 +1422,69 @@ int mp::SftpServer::mapped_gid_for(const int gid)
     return gid;
 }
 
+bool mp::SftpServer::flush_pending_write()
+{
+    if (pending_write.file == nullptr)
+        return true;
+
+    auto file = pending_write.file;
+    if (write_back)
+    {
+        write_back->submit(file, file->fd, file->path, pending_write.offset, std::move(pending_write.data));
+        pending_write.file = nullptr;
+        pending_write.data = {};
+        return true;
+    }
+
+    auto success = pwrite_all(file->fd, pending_write.data.data(), pending_write.data.size(), pending_write.offset);
+    if (!success)
+    {
+        mpl::log(mpl::Level::error, category, "failed to write to '{}': {}", file->path, std::strerror(errno));
+        file->write_failed = true;
+    }
+
+    pending_write.file = nullptr;
+    pending_write.data.clear();
+
+    return success;
+}
+
+void mp::SftpServer::land_writes()
+{
+    flush_pending_write();
+    if (!write_back)
+        return;
+
+    write_back->drain();
+    note_write_back_failures();
+}
+
+void mp::SftpServer::note_write_back_failures()
+{
+    for (auto file : write_back->take_failures())
+        file->write_failed = true;
+}
+
 void mp::SftpServer::process_message(sftp_client_message msg)
 {
     int ret = 0;
     const auto type = sftp_client_message_get_type(msg);
+    const auto start = std::chrono::steady_clock::now();
+    // Every request comes through here, so none pays for naming a span unless tracing
+    auto& tracer = Tracer::instance();
+    mp::optional<Tracer::Span> span;
+    if (tracer.enabled())
+        span.emplace(tracer, fmt::format("sftp {}", op_name(type)), tracer.current(),
+                     Tracer::Args{{"mount", target_path}});
+    mpl::log(mpl::Level::trace, category, "{}(type = {})", __FUNCTION__, static_cast<int>(type));
+
+    // Anything but another write may observe the file, so coalesced data must land first
+    if (type != SFTP_WRITE)
+        land_writes();
+
+    if (change_agent)
+        note_guest_change(msg, type);
+
     switch (type)
     {
     case SFTP_REALPATH:
@@ -393,94 +1541,274 @@ void mp::SftpServer::process_message(sftp_client_message msg)
         ret = handle_extended(msg);
         break;
     default:
-        mpl::log(mpl::Level::warning, category, fmt::format("Unknown message: {}", static_cast<int>(type)));
+        mpl::log(mpl::Level::warning, category, "Unknown message: {}", static_cast<int>(type));
         ret = reply_unsupported(msg);
     }
     if (ret != 0)
-        mpl::log(mpl::Level::error, category, fmt::format("error occurred when replying to client: {}", ret));
+        mpl::log(mpl::Level::error, category, "error occurred when replying to client: {}", ret);
+
+    record_op(op_name(type), start);
 }
 
-void mp::SftpServer::run()
+void mp::SftpServer::reply_completed_stats(bool wait_for_all)
+{
+    for (auto& job : stat_workers->take_completed(wait_for_all))
+    {
+        auto ret = reply_stat(job.msg.get(), job.result.attr, job.result.status);
+        if (ret != 0)
+            mpl::log(mpl::Level::error, category, "error occurred when replying to client: {}", ret);
+        record_op("stat", job.submitted);
+    }
+}
+
+bool mp::SftpServer::submit_ring_read(SftpMessageUptr& client_msg)
 {
-    using MsgUPtr = std::unique_ptr<sftp_client_message_struct, decltype(sftp_client_message_free)*>;
+    auto msg = client_msg.get();
+    auto file = handles->file(sftp_handle(msg->sftp, msg->handle));
+    if (file == nullptr)
+        return false;
+
+    land_writes();
+
+    const auto len = std::min(msg->len, max_read_length);
+    RingRead read{nullptr, {}, std::chrono::steady_clock::now()};
+    if (!spare_read_buffers.empty())
+    {
+        read.buffer = std::move(spare_read_buffers.back());
+        spare_read_buffers.pop_back();
+    }
+    read.buffer.resize(len);
+
+    const auto tag = next_ring_tag++;
+    if (!read_ring->queue(file->fd, read.buffer.data(), len, msg->offset, tag))
+    {
+        spare_read_buffers.push_back(std::move(read.buffer));
+        return false;
+    }
+
+    file->note_read(msg->offset, len);
+    read.msg = std::move(client_msg);
+    ring_reads.emplace(tag, std::move(read)); // the buffer's storage moves along, where the kernel reads into
+    return true;
+}
 
-    while (true)
+void mp::SftpServer::reply_completed_reads(bool wait_for_all)
+{
+    for (const auto& completion : read_ring->reap(wait_for_all))
     {
-        MsgUPtr client_msg{sftp_get_client_message(sftp_server_session.get()), sftp_client_message_free};
-        auto msg = client_msg.get();
-        if (msg == nullptr)
+        auto it = ring_reads.find(completion.tag);
+        if (it == ring_reads.end())
+            continue;
+
+        auto& read = it->second;
+        int ret;
+        if (completion.result < 0)
         {
-            if (stop_invoked)
-                break;
+            ret = sftp_reply_status(read.msg.get(), SSH_FX_FAILURE, std::strerror(-completion.result));
+        }
+        else if (completion.result == 0)
+        {
+            ret = sftp_reply_status(read.msg.get(), SSH_FX_EOF, "End of file");
+        }
+        else
+        {
+            usage.bytes_read += completion.result;
+            ret = sftp_reply_data(read.msg.get(), read.buffer.data(), completion.result);
+        }
 
-            int status{0};
-            try
-            {
-                status = sshfs_process->exit_code(250ms);
-            }
-            catch (const mp::ExitlessSSHProcessException&)
-            {
-                status = 1;
-            }
+        if (ret != 0)
+            mpl::log(mpl::Level::error, category, "error occurred when replying to client: {}", ret);
+        record_op("read", read.submitted);
 
-            if (status != 0)
-            {
-                mpl::log(mpl::Level::error, category,
-                         "sshfs in the instance appears to have exited unexpectedly.  Trying to recover.");
-                auto proc = ssh_session.exec(fmt::format("findmnt --source :{}  -o TARGET -n", source_path));
-                auto mount_path = proc.read_std_output();
-                if (!mount_path.empty())
-                {
-                    ssh_session.exec(fmt::format("sudo umount {}", mount_path));
-                }
+        spare_read_buffers.push_back(std::move(read.buffer));
+        ring_reads.erase(it);
+    }
+}
 
-                sshfs_process = create_sshfs_process(ssh_session, mp::utils::escape_char(source_path, '"'),
-                                                     mp::utils::escape_char(target_path, '"'));
-                sftp_server_session = make_sftp_session(ssh_session, sshfs_process->release_channel());
+void mp::SftpServer::run()
+{
+    // Serving many mounts, the caller forwards changes in its own loop, so that is done here rather than per message
+    do
+    {
+        forward_changes();
 
-                continue;
-            }
-            else
+        // Host changes are looked for again if the instance stays quiet for a while
+        while (change_agent && !has_pending_replies() &&
+               ssh_channel_poll_timeout(sftp_server_session->channel, change_poll_interval_ms, 0) == 0)
+            forward_changes();
+    } while (serve_next_message());
+}
+
+bool mp::SftpServer::serve_next_message()
+{
+
+    if (stat_workers && !stat_workers->idle())
+    {
+        reply_completed_stats(false);
+
+        // Keep answering finished stats while the client has nothing new for us
+        if (!stat_workers->idle() &&
+            ssh_channel_poll_timeout(sftp_server_session->channel, pipeline_poll_interval_ms, 0) == 0)
+            return true;
+    }
+
+    if (read_ring && read_ring->busy())
+    {
+        // Reads queue up while the instance has more for us, and go to the kernel together once it pauses
+        if (read_ring->queued() >= max_queued_ring_reads ||
+            ssh_channel_poll_timeout(sftp_server_session->channel, 0, 0) <= 0)
+            read_ring->submit();
+        reply_completed_reads(false);
+
+        if (read_ring->busy() &&
+            ssh_channel_poll_timeout(sftp_server_session->channel, pipeline_poll_interval_ms, 0) == 0)
+            return true;
+    }
+
+    MsgUPtr client_msg{sftp_get_client_message(sftp_server_session.get()), sftp_client_message_free};
+    auto msg = client_msg.get();
+    if (msg == nullptr)
+    {
+        if (stat_workers)
+            reply_completed_stats(true);
+        if (read_ring)
+            reply_completed_reads(true);
+        land_writes();
+        report_usage(true);
+
+        if (stop_invoked)
+            return false;
+
+        int status{0};
+        try
+        {
+            status = sshfs_process->exit_code(250ms);
+        }
+        catch (const mp::ExitlessSSHProcessException&)
+        {
+            // While sshfs runs its mount is still good, so a message lost on a channel that is still open is not
+            // worth failing everything open in the instance over
+            if (!ssh_channel_is_closed(sftp_server_session->channel) && ++lost_messages <= max_lost_messages)
             {
-                break;
+                mpl::log(mpl::Level::warning, category, "lost a message from sshfs, carrying on");
+                return true;
             }
+            status = 1;
+        }
+
+        if (status != 0)
+        {
+            mpl::log(mpl::Level::error, category,
+                     "sshfs in the instance appears to have exited unexpectedly.  Trying to recover.");
+            restart_sshfs();
+            return true;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    lost_messages = 0;
+
+    if (stat_workers)
+    {
+        const auto type = sftp_client_message_get_type(msg);
+        if (type == SFTP_STAT || type == SFTP_LSTAT)
+        {
+            // The size and times seen should take in what was written to the file just before, as if stat'd in turn
+            land_writes();
+            stat_workers->submit(std::move(client_msg), type == SFTP_STAT);
+            return true;
         }
 
-        process_message(msg);
+        // Anything else may depend on or change what the outstanding stats see
+        reply_completed_stats(true);
+    }
+
+    if (read_ring)
+    {
+        const auto type = sftp_client_message_get_type(msg);
+        if (type == SFTP_READ && submit_ring_read(client_msg))
+            return true;
+
+        // Reads may overlap each other, but anything else may change or close what the outstanding ones read
+        if (type != SFTP_READ)
+            reply_completed_reads(true);
     }
+
+    process_message(msg);
+
+    return true;
+}
+
+void mp::SftpServer::restart_sshfs()
+{
+    // The dead mount is detached lazily, so that whatever still sits in it cannot hold up the new one
+    const auto escaped_source = mp::utils::escape_char(source_path, '"');
+    // Its output must not reach the channel sshfs is about to speak SFTP on
+    const auto unmount = fmt::format(
+        "P=\"$(findmnt --source :\"{}\" -o TARGET -n)\"; [ -z \"$P\" ] || sudo umount -l \"$P\" >/dev/null 2>&1; ",
+        escaped_source);
+
+    sshfs_process = create_sshfs_process(*ssh_session, escaped_source, mp::utils::escape_char(target_path, '"'),
+                                         mount_profile, unmount);
+    sftp_server_session = make_sftp_session(*ssh_session, sshfs_process->release_channel());
+
+    // The new sshfs starts afresh, nothing it sends can name what was open before. The attribute cache is kept, the
+    // host's files are as they were
+    handles = std::make_unique<HandleTable>();
+    lost_messages = 0;
+}
+
+ssh_channel mp::SftpServer::channel() const
+{
+    return sftp_server_session->channel;
+}
+
+bool mp::SftpServer::has_pending_replies() const
+{
+    return (stat_workers && !stat_workers->idle()) || (read_ring && read_ring->busy());
 }
 
 void mp::SftpServer::stop()
 {
     stop_invoked = true;
-    ssh_session.force_shutdown();
+    ssh_session->force_shutdown();
 }
 
 int mp::SftpServer::handle_close(sftp_client_message msg)
 {
     const auto id = sftp_handle(sftp_server_session.get(), msg->handle);
 
-    auto erased = open_file_handles.erase(id);
-    erased += open_dir_handles.erase(id);
-    if (erased == 0)
+    auto file = handles->file(id);
+    const auto write_failed = file && file->write_failed;
+    if (!handles->close(id))
         return reply_bad_handle(msg, "close");
 
     sftp_handle_remove(sftp_server_session.get(), id);
+
+    if (write_failed)
+        return reply_failure(msg);
+
     return reply_ok(msg);
 }
 
 int mp::SftpServer::handle_fstat(sftp_client_message msg)
 {
-    auto file = handle_from(msg, open_file_handles);
+    auto file = handles->file(sftp_handle(msg->sftp, msg->handle));
     if (file == nullptr)
         return reply_bad_handle(msg, "fstat");
 
-    QFileInfo file_info(*file);
-
-    if (file_info.isSymLink())
-        file_info = QFileInfo(file_info.symLinkTarget());
+    struct stat st
+    {
+    };
+    if (::fstat(file->fd, &st) < 0)
+        return sftp_reply_status(msg, SSH_FX_FAILURE, std::strerror(errno));
 
-    auto attr = attr_from(file_info);
+    auto attr = attr_from_stat(st);
+    attr.uid = mapped_uid_for(attr.uid);
+    attr.gid = mapped_gid_for(attr.gid);
     return sftp_reply_attr(msg, &attr);
 }
 
@@ -503,8 +1831,8 @@ int mp::SftpServer::handle_mkdir(sftp_client_message msg)
     if (ret < 0)
     {
         mpl::log(mpl::Level::error, category,
-                 fmt::format("failed to chown '{}' to owner:{} and group:{}\n", filename, parent_dir.ownerId(),
-                             parent_dir.groupId()));
+                 "failed to chown '{}' to owner:{} and group:{}\n", filename, parent_dir.ownerId(),
+                 parent_dir.groupId());
         return reply_failure(msg);
     }
     return reply_ok(msg);
@@ -529,58 +1857,71 @@ int mp::SftpServer::handle_open(sftp_client_message msg)
     if (!validate_path(source_path, filename))
         return reply_perm_denied(msg);
 
-    QIODevice::OpenMode mode{QIODevice::NotOpen};
     const auto flags = sftp_client_message_get_flags(msg);
-    if (flags & SSH_FXF_READ)
-        mode |= QIODevice::ReadOnly;
+    const bool read = flags & SSH_FXF_READ;
+    bool append = flags & SSH_FXF_APPEND;
 
-    if (flags & SSH_FXF_WRITE)
+    // This is needed to workaround an issue where sshfs does not pass through
+    // O_APPEND.  This is fixed in sshfs v. 3.2.
+    // Note: This goes against the default behavior of open().
+    if (flags == SSH_FXF_WRITE)
     {
-        mode |= QIODevice::WriteOnly;
-
-        // This is needed to workaround an issue where sshfs does not pass through
-        // O_APPEND.  This is fixed in sshfs v. 3.2.
-        // Note: This goes against the default behavior of open().
-        if (flags == SSH_FXF_WRITE)
-        {
-            mode |= QIODevice::Append;
-            mpl::log(mpl::Level::info, category, "adding sshfs O_APPEND workaround");
-        }
+        append = true;
+        mpl::log(mpl::Level::info, category, "adding sshfs O_APPEND workaround");
     }
 
-    if (flags & SSH_FXF_APPEND)
-        mode |= QIODevice::Append;
-
-    if (flags & SSH_FXF_TRUNC)
-        mode |= QIODevice::Truncate;
+    const auto write = (flags & SSH_FXF_WRITE) || append;
+    if (!read && !write)
+        return reply_failure(msg);
 
-    auto file = std::make_unique<QFile>(filename);
+    // The same flags QFile, which this used to go through, would pass: writing without reading or appending always
+    // starts the file afresh
+    auto open_flags = O_CLOEXEC | (read && write ? O_RDWR : write ? O_WRONLY : O_RDONLY);
+    if (write)
+        open_flags |= O_CREAT | (append ? O_APPEND : 0) | ((flags & SSH_FXF_TRUNC) || (!read && !append) ? O_TRUNC : 0);
 
-    auto exists = QFileInfo(filename).isSymLink() || file->exists();
+    struct stat st
+    {
+    };
+    const auto exists = ::lstat(filename, &st) == 0;
 
-    if (!file->open(mode))
-        return reply_failure(msg);
+    auto id = handles->open_file([this, msg, filename, open_flags, exists](OpenFile& file) {
+        do
+        {
+            file.fd = ::open(filename, open_flags, 0666);
+        } while (file.fd < 0 && errno == EINTR);
 
-    if (!exists)
-    {
-        if (!file->setPermissions(to_qt_permissions(msg->attr->permissions)))
-            return reply_failure(msg);
+        struct stat opened
+        {
+        };
+        if (file.fd < 0 || ::fstat(file.fd, &opened) < 0 || S_ISDIR(opened.st_mode))
+            return false;
+        file.path = filename;
 
-        QFileInfo current_file(filename);
-        QFileInfo current_dir(current_file.path());
-        auto ret = mp::platform::chown(filename, current_dir.ownerId(), current_dir.groupId());
-        if (ret < 0)
+        if (!exists)
         {
-            mpl::log(mpl::Level::error, category,
-                     fmt::format("failed to chown '{}' to owner:{} and group:{}\n", filename, current_dir.ownerId(),
-                                 current_dir.groupId()));
-            return reply_failure(msg);
+            if (::fchmod(file.fd, msg->attr->permissions & 0777) < 0)
+                return false;
+
+            QFileInfo current_file(filename);
+            QFileInfo current_dir(current_file.path());
+            auto ret = mp::platform::chown(filename, current_dir.ownerId(), current_dir.groupId());
+            if (ret < 0)
+            {
+                mpl::log(mpl::Level::error, category,
+                         "failed to chown '{}' to owner:{} and group:{}\n", filename, current_dir.ownerId(),
+                         current_dir.groupId());
+                return false;
+            }
         }
-    }
 
-    SftpHandleUPtr sftp_handle{sftp_handle_alloc(sftp_server_session.get(), file.get()), ssh_string_free};
-    open_file_handles.emplace(file.get(), std::move(file));
+        return true;
+    });
+
+    if (id == nullptr)
+        return reply_failure(msg);
 
+    SftpHandleUPtr sftp_handle{sftp_handle_alloc(sftp_server_session.get(), id), ssh_string_free};
     return sftp_reply_handle(msg, sftp_handle.get());
 }
 
@@ -590,75 +1931,92 @@ int mp::SftpServer::handle_opendir(sftp_client_message msg)
     if (!validate_path(source_path, filename))
         return reply_perm_denied(msg);
 
-    QDir dir(filename);
-    if (!dir.exists())
+    auto dir = ::opendir(filename);
+    if (dir == nullptr)
+    {
+        if (errno == EACCES)
+            return reply_perm_denied(msg);
         return sftp_reply_status(msg, SSH_FX_NO_SUCH_FILE, "no such directory");
+    }
 
-    if (!dir.isReadable())
-        return reply_perm_denied(msg);
+    if (change_agent)
+        attr_cache->watch_dir(QDir::cleanPath(filename).toStdString());
 
-    auto entry_list =
-        std::make_unique<QFileInfoList>(dir.entryInfoList(QDir::AllEntries | QDir::System | QDir::Hidden));
+    auto dir_stream = std::make_unique<DirStream>(dir);
 
-    SftpHandleUPtr sftp_handle{sftp_handle_alloc(sftp_server_session.get(), entry_list.get()), ssh_string_free};
-    open_dir_handles.emplace(entry_list.get(), std::move(entry_list));
+    auto id = handles->add_dir(std::move(dir_stream));
 
+    SftpHandleUPtr sftp_handle{sftp_handle_alloc(sftp_server_session.get(), id), ssh_string_free};
     return sftp_reply_handle(msg, sftp_handle.get());
 }
 
 int mp::SftpServer::handle_read(sftp_client_message msg)
 {
-    auto file = handle_from(msg, open_file_handles);
+    auto file = handles->file(sftp_handle(msg->sftp, msg->handle));
     if (file == nullptr)
         return reply_bad_handle(msg, "read");
 
-    const auto max_packet_size = 65536u;
-    const auto len = std::min(msg->len, max_packet_size);
+    const auto len = std::min(msg->len, max_read_length);
 
-    std::vector<char> data;
-    data.reserve(len);
+    if (read_buffer.size() < len)
+        read_buffer.resize(len);
+
+    ssize_t r;
+    do
+    {
+        r = ::pread(file->fd, read_buffer.data(), len, msg->offset);
+    } while (r < 0 && errno == EINTR);
 
-    file->seek(msg->offset);
-    auto r = file->read(data.data(), len);
     if (r < 0)
-        return sftp_reply_status(msg, SSH_FX_FAILURE, file->errorString().toStdString().c_str());
+        return sftp_reply_status(msg, SSH_FX_FAILURE, std::strerror(errno));
     else if (r == 0)
         return sftp_reply_status(msg, SSH_FX_EOF, "End of file");
 
-    return sftp_reply_data(msg, data.data(), r);
+    file->note_read(msg->offset, r);
+    usage.bytes_read += r;
+    return sftp_reply_data(msg, read_buffer.data(), r);
 }
 
 int mp::SftpServer::handle_readdir(sftp_client_message msg)
 {
-    auto dir_entries = handle_from(msg, open_dir_handles);
-    if (dir_entries == nullptr)
+    auto dir_stream = handles->dir(sftp_handle(msg->sftp, msg->handle));
+    if (dir_stream == nullptr)
         return reply_bad_handle(msg, "readdir");
 
-    if (dir_entries->empty())
-        return sftp_reply_status(msg, SSH_FX_EOF, nullptr);
-
-    const auto max_num_entries_per_packet = 50;
-    const auto num_entries = std::min(dir_entries->size(), max_num_entries_per_packet);
+    auto num_entries = 0;
+    auto reply_size = 0u;
+    fmt::memory_buffer longname;
 
-    for (int i = 0; i < num_entries; i++)
+    while (auto entry = dir_stream->next())
     {
-        const QFileInfo entry = dir_entries->takeFirst();
-        const auto filename = entry.fileName().toStdString();
-        sftp_attributes_struct attr{};
-        if (entry.isSymLink())
+        struct stat st
         {
-            mp::platform::symlink_attr_from(entry.absoluteFilePath().toStdString().c_str(), &attr);
-            attr.uid = mapped_uid_for(attr.uid);
-            attr.gid = mapped_gid_for(attr.gid);
-        }
-        else
+        };
+
+        // The entry may have gone away since the directory was read
+        if (fstatat(dir_stream->fd(), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+            continue;
+
+        longname_from(st, entry->d_name, longname);
+        const auto entry_size = name_entry_overhead + std::strlen(entry->d_name) + longname.size() - 1;
+        if (num_entries > 0 && reply_size + entry_size > max_read_length)
         {
-            attr = attr_from(entry);
+            dir_stream->unread();
+            break;
         }
-        const auto longname = longname_from(entry, filename);
-        sftp_reply_names_add(msg, filename.c_str(), longname.data(), &attr);
+
+        auto attr = attr_from_stat(st);
+        attr.uid = mapped_uid_for(attr.uid);
+        attr.gid = mapped_gid_for(attr.gid);
+        sftp_reply_names_add(msg, entry->d_name, longname.data(), &attr);
+
+        ++num_entries;
+        reply_size += entry_size;
     }
 
+    if (num_entries == 0)
+        return sftp_reply_status(msg, SSH_FX_EOF, nullptr);
+
     return sftp_reply_names(msg);
 }
 
@@ -729,10 +2087,10 @@ int mp::SftpServer::handle_setstat(sftp_client_message msg)
 
     if (sftp_client_message_get_type(msg) == SFTP_FSETSTAT)
     {
-        auto handle = handle_from(msg, open_file_handles);
-        if (handle == nullptr)
+        auto file = handles->file(sftp_handle(msg->sftp, msg->handle));
+        if (file == nullptr)
             return reply_bad_handle(msg, "setstat");
-        filename = handle->fileName();
+        filename = QString::fromStdString(file->path);
     }
     else
     {
@@ -771,33 +2129,44 @@ int mp::SftpServer::handle_setstat(sftp_client_message msg)
     return reply_ok(msg);
 }
 
-int mp::SftpServer::handle_stat(sftp_client_message msg, const bool follow)
+auto mp::SftpServer::stat_for(const char* filename, bool follow) -> StatResult
 {
-    auto filename = sftp_client_message_get_filename(msg);
     if (!validate_path(source_path, filename))
-        return reply_perm_denied(msg);
+        return {SSH_FX_PERMISSION_DENIED, {}};
 
-    QFileInfo file_info(filename);
-    if (!file_info.isSymLink() && !file_info.exists())
-        return sftp_reply_status(msg, SSH_FX_NO_SUCH_FILE, "no such file");
+    if (auto cached = attr_cache->find(filename))
+        return *cached;
 
-    sftp_attributes_struct attr{};
+    const auto generation = attr_cache->prepare(filename);
 
-    if (!follow && file_info.isSymLink())
-    {
-        mp::platform::symlink_attr_from(filename, &attr);
-        attr.uid = mapped_uid_for(attr.uid);
-        attr.gid = mapped_gid_for(attr.gid);
-    }
-    else
+    struct stat st
     {
-        if (file_info.isSymLink())
-            file_info = QFileInfo(file_info.symLinkTarget());
+    };
+    const auto found = ::lstat(filename, &st) == 0;
+    const auto is_link = found && S_ISLNK(st.st_mode);
 
-        attr = attr_from(file_info);
+    // Links are not cached followed, their targets may be anywhere and change unseen
+    if (!found || (follow && is_link && ::stat(filename, &st) < 0))
+    {
+        StatResult result{SSH_FX_NO_SUCH_FILE, {}};
+        if (!found)
+            attr_cache->insert(filename, result, generation);
+        return result;
     }
 
-    return sftp_reply_attr(msg, &attr);
+    auto attr = attr_from_stat(st);
+    attr.uid = mapped_uid_for(attr.uid);
+    attr.gid = mapped_gid_for(attr.gid);
+    if (!is_link)
+        attr_cache->insert(filename, {SSH_FX_OK, attr}, generation);
+
+    return {SSH_FX_OK, attr};
+}
+
+int mp::SftpServer::handle_stat(sftp_client_message msg, const bool follow)
+{
+    auto result = stat_for(sftp_client_message_get_filename(msg), follow);
+    return reply_stat(msg, result.attr, result.status);
 }
 
 int mp::SftpServer::handle_symlink(sftp_client_message msg)
@@ -817,8 +2186,8 @@ int mp::SftpServer::handle_symlink(sftp_client_message msg)
     if (ret < 0)
     {
         mpl::log(mpl::Level::error, category,
-                 fmt::format("failed to chown '{}' to owner:{} and group:{}\n", new_name, current_dir.ownerId(),
-                             current_dir.groupId()));
+                 "failed to chown '{}' to owner:{} and group:{}\n", new_name, current_dir.ownerId(),
+                 current_dir.groupId());
         return reply_failure(msg);
     }
 
@@ -827,26 +2196,37 @@ int mp::SftpServer::handle_symlink(sftp_client_message msg)
 
 int mp::SftpServer::handle_write(sftp_client_message msg)
 {
-    auto file = handle_from(msg, open_file_handles);
+    auto file = handles->file(sftp_handle(msg->sftp, msg->handle));
     if (file == nullptr)
         return reply_bad_handle(msg, "write");
 
     auto len = ssh_string_len(msg->data);
     auto data_ptr = ssh_string_get_char(msg->data);
-    if (!file->seek(msg->offset))
-        return reply_failure(msg);
 
-    do
+    if (pending_write.file != file || pending_write.offset + pending_write.data.size() != msg->offset)
     {
-        auto r = file->write(data_ptr, len);
-        if (r < 0)
-            return reply_failure(msg);
+        flush_pending_write();
+        pending_write.file = file;
+        pending_write.offset = msg->offset;
+    }
+
+    // A failure from an earlier, already acknowledged write is reported on the next request for the handle
+    if (write_back)
+        note_write_back_failures();
+    if (std::exchange(file->write_failed, false))
+    {
+        pending_write.file = nullptr;
+        return reply_failure(msg);
+    }
 
-        file->flush();
+    pending_write.data.insert(pending_write.data.end(), data_ptr, data_ptr + len);
+    usage.bytes_written += len;
 
-        data_ptr += r;
-        len -= r;
-    } while (len > 0);
+    if (pending_write.data.size() >= max_pending_write_size && !flush_pending_write())
+    {
+        file->write_failed = false;
+        return reply_failure(msg);
+    }
 
     return reply_ok(msg);
 }
@@ -860,7 +2240,10 @@ int mp::SftpServer::handle_extended(sftp_client_message msg)
     const std::string method(submessage);
     if (method == "hardlink@openssh.com")
     {
+        // Linking in from elsewhere would hand out files from outside the mount
         const auto old_name = sftp_client_message_get_filename(msg);
+        if (!validate_path(source_path, old_name))
+            return reply_perm_denied(msg);
 
         const auto new_name = sftp_client_message_get_data(msg);
         if (!validate_path(source_path, new_name))
@@ -873,6 +2256,68 @@ int mp::SftpServer::handle_extended(sftp_client_message msg)
     {
         return handle_rename(msg);
     }
+    else if (method == "statvfs@openssh.com" || method == "fstatvfs@openssh.com")
+    {
+        // Without it the instance makes up its figures for the mount
+        RequestFields fields{msg};
+        const auto path_or_handle = fields.string();
+        if (!fields.complete())
+            return sftp_reply_status(msg, SSH_FX_BAD_MESSAGE, "statvfs: malformed request");
+
+        struct statvfs st;
+        if (method == "statvfs@openssh.com")
+        {
+            if (!validate_path(source_path, path_or_handle))
+                return reply_perm_denied(msg);
+            if (::statvfs(path_or_handle.c_str(), &st) < 0)
+                return reply_failure(msg);
+        }
+        else
+        {
+            auto file = handles->file(sftp_handle(msg->sftp, make_handle_string(path_or_handle).get()));
+            if (file == nullptr)
+                return reply_bad_handle(msg, "fstatvfs");
+            if (::fstatvfs(file->fd, &st) < 0)
+                return reply_failure(msg);
+        }
+
+        return reply_statvfs(sftp_server_session->channel, msg, st);
+    }
+    else if (method == "copy-data")
+    {
+        // Both files are open here already, so the data never has to travel to the instance and back
+        RequestFields fields{msg};
+        const auto from_handle = fields.string();
+        const auto from_offset = fields.number(8);
+        const auto length = fields.number(8);
+        const auto to_handle = fields.string();
+        const auto to_offset = fields.number(8);
+        if (!fields.complete())
+            return sftp_reply_status(msg, SSH_FX_BAD_MESSAGE, "copy-data: malformed request");
+
+        auto from = handles->file(sftp_handle(msg->sftp, make_handle_string(from_handle).get()));
+        auto to = handles->file(sftp_handle(msg->sftp, make_handle_string(to_handle).get()));
+        if (from == nullptr || to == nullptr)
+            return reply_bad_handle(msg, "copy-data");
+
+        // The kernel would refuse copying a file onto itself where the two overlap, and by hand it would garble it
+        const auto overlap = length == 0 || (from_offset < to_offset + length && to_offset < from_offset + length);
+        if (std::exchange(to->write_failed, false) || (from == to && overlap))
+            return reply_failure(msg);
+
+        const auto status = copy_range(from->fd, from_offset, length, to->fd, to_offset);
+        if (status != SSH_FX_OK)
+            return sftp_reply_status(msg, status, nullptr);
+    }
+    else if (method == "fsync@openssh.com")
+    {
+        auto file = handles->file(sftp_handle(msg->sftp, msg->handle));
+        if (file == nullptr)
+            return reply_bad_handle(msg, "fsync");
+
+        if (std::exchange(file->write_failed, false) || ::fsync(file->fd) < 0)
+            return reply_failure(msg);
+    }
     else
     {
         return reply_unsupported(msg);
@@ -0,0 +1,264 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <multipass/sshfs_mount/sftp_service.h>
+
+#include <multipass/format.h>
+#include <multipass/logging/log.h>
+#include <multipass/sshfs_mount/sftp_server.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+
+namespace mp = multipass;
+namespace mpl = multipass::logging;
+
+namespace
+{
+constexpr auto category = "sftp service";
+constexpr auto idle_select_timeout_us = 250000;
+constexpr auto busy_select_timeout_us = 5000;
+constexpr auto serving_thread_count = 4;
+constexpr auto max_messages_per_turn = 64; // before a busy mount goes back to wait its turn with the others
+} // namespace
+
+mp::SftpService::SftpService()
+{
+    for (auto i = 0; i < serving_thread_count; ++i)
+        serving_threads.emplace_back([this] { serve_mounts(); });
+    waiting_thread = std::thread{[this] { run(); }};
+}
+
+mp::SftpService::~SftpService()
+{
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        finishing = true;
+    }
+    work_arrived.notify_one();
+    mount_ready.notify_all();
+    waiting_thread.join();
+    for (auto& thread : serving_threads)
+        thread.join();
+
+    // Once nothing serves them any more
+    ready.clear();
+    incoming.clear();
+    mounts.clear();
+}
+
+void mp::SftpService::serve(const std::string& instance,
+                            std::vector<std::pair<std::string, std::unique_ptr<SftpServer>>> servers)
+{
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        for (auto& server : servers)
+        {
+            Key key{instance, server.first};
+            server.second->label_usage(instance);
+
+            const auto id = next_id++;
+            served[key] = id;
+            incoming.push_back(std::make_shared<Mount>(Mount{std::move(key), id, std::move(server.second)}));
+        }
+    }
+    work_arrived.notify_one();
+}
+
+bool mp::SftpService::stop(const std::string& instance, const std::string& target)
+{
+    std::lock_guard<std::mutex> lock{mutex};
+    auto it = served.find({instance, target});
+    if (it == served.end())
+        return false;
+
+    // Only the waiting thread may drop the server, its channel would not survive being closed under its feet
+    stopping.insert(it->second);
+    served.erase(it);
+    return true;
+}
+
+void mp::SftpService::stop_all(const std::string& instance)
+{
+    std::lock_guard<std::mutex> lock{mutex};
+    for (auto it = served.lower_bound({instance, {}}); it != served.end() && it->first.first == instance;)
+    {
+        stopping.insert(it->second);
+        it = served.erase(it);
+    }
+}
+
+bool mp::SftpService::serves(const std::string& instance, const std::string& target) const
+{
+    std::lock_guard<std::mutex> lock{mutex};
+    return served.count({instance, target}) > 0;
+}
+
+std::size_t mp::SftpService::size() const
+{
+    std::lock_guard<std::mutex> lock{mutex};
+    return served.size();
+}
+
+void mp::SftpService::run()
+{
+    std::vector<ssh_channel> channels;
+    for (;;)
+    {
+        std::vector<std::shared_ptr<Mount>> dropped; // let go of once the lock is, their sessions take a while
+        std::vector<std::shared_ptr<Mount>> idle;
+        auto busy = false;
+        {
+            std::unique_lock<std::mutex> lock{mutex};
+            work_arrived.wait(lock, [this] { return finishing || !incoming.empty() || !mounts.empty(); });
+            if (finishing)
+                break;
+
+            std::move(incoming.begin(), incoming.end(), std::back_inserter(mounts));
+            incoming.clear();
+
+            // Those being served are dropped once they are back
+            for (auto it = mounts.begin(); it != mounts.end();)
+            {
+                const auto& mount = **it;
+                if (mount.serving)
+                {
+                    busy = true;
+                    ++it;
+                    continue;
+                }
+
+                if (stopping.erase(mount.id))
+                {
+                    mpl::log(mpl::Level::info, category,
+                             fmt::format("Stopped serving '{}' in instance \"{}\"", mount.key.second, mount.key.first));
+                }
+                else if (mount.stopped)
+                {
+                    auto served_it = served.find(mount.key);
+                    if (served_it != served.end() && served_it->second == mount.id)
+                        served.erase(served_it);
+                }
+                else
+                {
+                    idle.push_back(*it);
+                    ++it;
+                    continue;
+                }
+
+                dropped.push_back(std::move(*it));
+                it = mounts.erase(it);
+            }
+
+            // Nothing to wait on until a serving thread is done
+            if (idle.empty())
+            {
+                if (busy)
+                    work_arrived.wait_for(lock, std::chrono::microseconds(busy_select_timeout_us));
+                continue;
+            }
+        }
+
+        channels.clear();
+        for (const auto& mount : idle)
+        {
+            channels.push_back(mount->server->channel());
+            busy = busy || mount->server->has_pending_replies();
+        }
+        channels.push_back(nullptr);
+
+        // Channels of different sessions are waited on together. When that fails, one session failing says nothing
+        // about the others, so each channel is asked on its own
+        timeval timeout{0, busy ? busy_select_timeout_us : idle_select_timeout_us};
+        const auto select_failed = ssh_channel_select(channels.data(), nullptr, nullptr, &timeout) == SSH_ERROR;
+
+        const auto ready_end = std::find(channels.begin(), channels.end(), nullptr);
+        for (const auto& mount : idle)
+        {
+            auto& server = *mount->server;
+            const auto readable = select_failed ? ssh_channel_poll_timeout(server.channel(), 0, 0) != 0
+                                                : std::find(channels.begin(), ready_end, server.channel()) != ready_end;
+            if (!readable && !server.has_pending_replies())
+            {
+                server.forward_changes();
+                continue;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock{mutex};
+                mount->serving = true;
+                ready.push_back(mount);
+            }
+            mount_ready.notify_one();
+        }
+    }
+}
+
+void mp::SftpService::serve_mounts()
+{
+    for (;;)
+    {
+        std::shared_ptr<Mount> mount;
+        {
+            std::unique_lock<std::mutex> lock{mutex};
+            mount_ready.wait(lock, [this] { return finishing || !ready.empty(); });
+            if (finishing)
+                return;
+
+            mount = std::move(ready.front());
+            ready.pop_front();
+        }
+
+        serve(*mount);
+
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            mount->serving = false;
+        }
+        work_arrived.notify_one();
+    }
+}
+
+void mp::SftpService::serve(Mount& mount)
+{
+    auto& server = *mount.server;
+    try
+    {
+        // What the mount has to say in a row is served in a row, without going back to be waited on in between
+        for (auto i = 0; i < max_messages_per_turn; ++i)
+        {
+            server.forward_changes();
+            if (!server.serve_next_message())
+            {
+                mpl::log(mpl::Level::info, category,
+                         fmt::format("Mount '{}' in instance \"{}\" has stopped", mount.key.second, mount.key.first));
+                mount.stopped = true;
+                return;
+            }
+
+            if (ssh_channel_poll_timeout(server.channel(), 0, 0) <= 0 && !server.has_pending_replies())
+                return;
+        }
+    }
+    catch (const std::exception& e)
+    {
+        mpl::log(mpl::Level::error, category,
+                 fmt::format("Mount '{}' in instance \"{}\" failed: {}", mount.key.second, mount.key.first, e.what()));
+        mount.stopped = true;
+    }
+}
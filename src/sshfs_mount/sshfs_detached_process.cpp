@@ -0,0 +1,271 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "sshfs_detached_process.h"
+
+#include <QElapsedTimer>
+#include <QFile>
+
+namespace mp = multipass;
+
+namespace
+{
+// The server listens before it reports back, so it is there to be reached by the time the launcher has it connected
+constexpr auto connect_timeout_ms = 5000;
+} // namespace
+
+mp::SSHFSDetachedProcess::SSHFSDetachedProcess(Process::UPtr launcher, const QString& control_socket_path)
+    : launcher{std::move(launcher)}, control_socket_path{control_socket_path}
+{
+    QObject::connect(&control_socket, &QLocalSocket::readyRead, this, &Process::ready_read_standard_output);
+    QObject::connect(&control_socket, &QLocalSocket::disconnected, this, [this] { on_disconnected(); });
+
+    if (!this->launcher)
+        return;
+
+    QObject::connect(this->launcher.get(), &Process::ready_read_standard_output, this, [this] {
+        launch_output.append(this->launcher->read_all_standard_output());
+        if (!reached && launch_output.contains("Connected") && !connect_to_server(connect_timeout_ms))
+        {
+            connection_error = ProcessState::Error{QProcess::FailedToStart,
+                                                   QString("cannot reach sshfs_server on %1: %2")
+                                                       .arg(this->control_socket_path, control_socket.errorString())};
+            emit finished(process_state());
+        }
+        emit ready_read_standard_output();
+    });
+    QObject::connect(this->launcher.get(), &Process::finished, this,
+                     [this](ProcessState launched) { on_launched(launched); });
+    QObject::connect(this->launcher.get(), &Process::error_occurred, this, &Process::error_occurred);
+}
+
+mp::SSHFSDetachedProcess::~SSHFSDetachedProcess()
+{
+    QObject::disconnect(&control_socket, nullptr, this, nullptr);
+    if (launcher)
+        QObject::disconnect(launcher.get(), nullptr, this, nullptr);
+}
+
+std::vector<std::string> mp::SSHFSDetachedProcess::attach(int msecs)
+{
+    QElapsedTimer timer;
+    timer.start();
+    if (QFile::exists(control_socket_path) && connect_to_server(msecs))
+    {
+        std::vector<std::string> targets;
+        QByteArray pending;
+        control_socket.write("targets\n");
+        control_socket.flush();
+
+        // Metric lines may come in between, and are left to be read as usual
+        auto answered = false;
+        while (!answered && !timer.hasExpired(msecs))
+        {
+            int line_end;
+            while (!answered && (line_end = pending.indexOf('\n')) >= 0)
+            {
+                const auto line = pending.left(line_end);
+                pending.remove(0, line_end + 1);
+
+                if (line == "end")
+                    answered = true;
+                else if (line.startsWith("target "))
+                    targets.push_back(line.mid(7).toStdString());
+                else
+                    launch_output.append(line + '\n');
+            }
+
+            if (answered || (!control_socket.waitForReadyRead(100) &&
+                             control_socket.state() != QLocalSocket::ConnectedState))
+                break;
+            pending.append(control_socket.readAll());
+        }
+
+        if (answered && !targets.empty())
+        {
+            launch_output.append(pending);
+            return targets;
+        }
+    }
+
+    // Nothing listens for the server finishing yet, so going away here goes unnoticed
+    control_socket.abort();
+    reached = false;
+    exited = false;
+    launch_output.clear();
+    return {};
+}
+
+QString mp::SSHFSDetachedProcess::program() const
+{
+    return launcher ? launcher->program() : QString{};
+}
+
+QStringList mp::SSHFSDetachedProcess::arguments() const
+{
+    return launcher ? launcher->arguments() : QStringList{};
+}
+
+QString mp::SSHFSDetachedProcess::working_directory() const
+{
+    return launcher ? launcher->working_directory() : QString{};
+}
+
+QProcessEnvironment mp::SSHFSDetachedProcess::process_environment() const
+{
+    return launcher ? launcher->process_environment() : QProcessEnvironment{};
+}
+
+void mp::SSHFSDetachedProcess::start()
+{
+    if (!launcher)
+        return;
+
+    reached = false;
+    exited = false;
+    connection_error = nullopt;
+    launch_output.clear();
+
+    launcher->start();
+}
+
+void mp::SSHFSDetachedProcess::terminate()
+{
+    if (running())
+        write("quit\n");
+    else if (launcher)
+        launcher->terminate();
+}
+
+void mp::SSHFSDetachedProcess::kill()
+{
+    // Not a child of ours, and known by its socket only, so quitting is all it can be asked to do
+    if (running())
+        write("quit\n");
+    else if (launcher)
+        launcher->kill();
+}
+
+bool mp::SSHFSDetachedProcess::wait_for_started(int msecs)
+{
+    return launcher ? launcher->wait_for_started(msecs) : running();
+}
+
+bool mp::SSHFSDetachedProcess::wait_for_finished(int msecs)
+{
+    if (!reached)
+        return launcher && launcher->wait_for_finished(msecs) && !launcher->process_state().completed_successfully();
+
+    QElapsedTimer timer;
+    timer.start();
+    while (!exited && !timer.hasExpired(msecs))
+    {
+        if (control_socket.state() == QLocalSocket::ConnectedState)
+            control_socket.waitForReadyRead(100);
+        else
+            on_disconnected();
+    }
+
+    return exited;
+}
+
+bool mp::SSHFSDetachedProcess::running() const
+{
+    return reached && !exited;
+}
+
+qint64 mp::SSHFSDetachedProcess::process_id() const
+{
+    return 0; // the launcher's is of no use once it exits, and the server's is not known
+}
+
+mp::ProcessState mp::SSHFSDetachedProcess::process_state() const
+{
+    if (connection_error)
+    {
+        ProcessState state;
+        state.error = connection_error;
+        return state;
+    }
+
+    if (!reached && launcher)
+        return launcher->process_state();
+
+    // The server quits cleanly when asked to, or when there is nothing left for it to serve
+    ProcessState state;
+    if (exited)
+        state.exit_code = 0;
+    return state;
+}
+
+QByteArray mp::SSHFSDetachedProcess::read_all_standard_output()
+{
+    auto output = launch_output;
+    launch_output.clear();
+    return output + control_socket.readAll();
+}
+
+QByteArray mp::SSHFSDetachedProcess::read_all_standard_error()
+{
+    // Whatever went wrong setting the server up is passed on by the launcher
+    return launcher ? launcher->read_all_standard_error() : QByteArray{};
+}
+
+qint64 mp::SSHFSDetachedProcess::write(const QByteArray& data)
+{
+    auto written = control_socket.write(data);
+    control_socket.flush();
+    return written;
+}
+
+void mp::SSHFSDetachedProcess::close_write_channel()
+{
+    // The socket stays open for as long as the server runs
+}
+
+mp::ProcessState mp::SSHFSDetachedProcess::execute(const int timeout)
+{
+    return launcher ? launcher->execute(timeout) : ProcessState{};
+}
+
+void mp::SSHFSDetachedProcess::setup_child_process()
+{
+    // The launcher sets up, and confines, the server it leaves behind
+}
+
+bool mp::SSHFSDetachedProcess::connect_to_server(int msecs)
+{
+    control_socket.connectToServer(control_socket_path);
+    reached = control_socket.waitForConnected(msecs);
+    return reached;
+}
+
+void mp::SSHFSDetachedProcess::on_launched(ProcessState launched)
+{
+    // A launcher that exits cleanly leaves the server running, reached through the socket by now
+    if (!reached && !connection_error && !launched.completed_successfully())
+        emit finished(launched);
+}
+
+void mp::SSHFSDetachedProcess::on_disconnected()
+{
+    if (exited || !reached)
+        return;
+
+    exited = true;
+    emit finished(process_state());
+}
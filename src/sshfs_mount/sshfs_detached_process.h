@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_SSHFS_DETACHED_PROCESS_H
+#define MULTIPASS_SSHFS_DETACHED_PROCESS_H
+
+#include <multipass/optional.h>
+#include <multipass/process.h>
+
+#include <QLocalSocket>
+
+#include <string>
+#include <vector>
+
+namespace multipass
+{
+// An sshfs_server started with a control socket, which leaves the process the daemon started behind and so outlives
+// the daemon. That process only lasts until the server is set up; from then on, what would go over the server's
+// stdin and stdout goes over the socket instead, and terminating it asks it to quit. Going away leaves the server
+// running, and a later daemon can attach to it again
+class SSHFSDetachedProcess final : public Process
+{
+    Q_OBJECT
+public:
+    SSHFSDetachedProcess(Process::UPtr launcher, const QString& control_socket_path);
+    ~SSHFSDetachedProcess(); // leaves the server running
+
+    // Takes up a server left running by a previous daemon, without starting anything, and returns the targets it
+    // serves; none when there is no server there
+    std::vector<std::string> attach(int msecs = 5000);
+
+    QString program() const override;
+    QStringList arguments() const override;
+    QString working_directory() const override;
+    QProcessEnvironment process_environment() const override;
+
+    void start() override;
+    void terminate() override;
+    void kill() override;
+
+    bool wait_for_started(int msecs = 30000) override;
+    bool wait_for_finished(int msecs = 30000) override;
+
+    bool running() const override;
+    qint64 process_id() const override;
+    ProcessState process_state() const override;
+
+    QByteArray read_all_standard_output() override;
+    QByteArray read_all_standard_error() override;
+
+    qint64 write(const QByteArray& data) override;
+    void close_write_channel() override;
+
+    ProcessState execute(const int timeout = 30000) override;
+
+protected:
+    void setup_child_process() override;
+
+private:
+    bool connect_to_server(int msecs);
+    void on_launched(ProcessState launched);
+    void on_disconnected();
+
+    const Process::UPtr launcher; // none when attached to a server some other daemon started
+    const QString control_socket_path;
+    QLocalSocket control_socket;
+    QByteArray launch_output; // what came before the server was reached, or in between answers while attaching
+    bool reached{false};
+    bool exited{false};
+    multipass::optional<ProcessState::Error> connection_error;
+};
+} // namespace multipass
+
+#endif // MULTIPASS_SSHFS_DETACHED_PROCESS_H
@@ -26,7 +26,10 @@
 #include <multipass/format.h>
 
 #include <QDir>
+
+#include <algorithm>
 #include <iostream>
+#include <iterator>
 
 namespace mp = multipass;
 namespace mpl = multipass::logging;
@@ -34,6 +37,10 @@ namespace mpl = multipass::logging;
 namespace
 {
 constexpr auto category = "sshfs mount";
+constexpr auto sftp_stat_workers = 4;
+constexpr auto sftp_read_ring_entries = 64u;
+constexpr auto idle_select_timeout_us = 250000;
+constexpr auto busy_select_timeout_us = 5000;
 template <typename Callable>
 auto run_cmd(mp::SSHSession& session, std::string&& cmd, Callable&& error_handler)
 {
@@ -55,7 +62,7 @@ void check_sshfs_exists(mp::SSHSession& session)
 {
     auto error_handler = [](mp::SSHProcess& proc) {
         mpl::log(mpl::Level::warning, category,
-                 fmt::format("Unable to determine if 'sshfs' is installed: {}", proc.read_std_error()));
+                 "Unable to determine if 'sshfs' is installed: {}", proc.read_std_error());
         throw mp::SSHFSMissingError();
     };
 
@@ -108,11 +115,16 @@ void set_owner_for(mp::SSHSession& session, const std::string& root, const std::
                                  relative_target.substr(0, relative_target.find_first_of('/'))));
 }
 
-auto make_sftp_server(mp::SSHSession&& session, const std::string& source, const std::string& target,
-                      const std::unordered_map<int, int>& gid_map, const std::unordered_map<int, int>& uid_map)
+} // namespace
+
+std::unique_ptr<mp::SftpServer> mp::make_sftp_server(std::shared_ptr<SSHSession> shared_session,
+                                                     const SSHFSMountConfig& mount)
 {
+    const auto& source = mount.source_path;
+    const auto& target = mount.target_path;
+    auto& session = *shared_session;
     mpl::log(mpl::Level::debug, category,
-             fmt::format("{}:{} {}(source = {}, target = {}, …): ", __FILE__, __LINE__, __FUNCTION__, source, target));
+             "{}:{} {}(source = {}, target = {}, …): ", __FILE__, __LINE__, __FUNCTION__, source, target);
 
     check_sshfs_exists(session);
 
@@ -126,27 +138,54 @@ auto make_sftp_server(mp::SSHSession&& session, const std::string& source, const
 
     auto output = run_cmd(session, "id -u");
     mpl::log(mpl::Level::debug, category,
-             fmt::format("{}:{} {}(): `id -u` = {}", __FILE__, __LINE__, __FUNCTION__, output));
+             "{}:{} {}(): `id -u` = {}", __FILE__, __LINE__, __FUNCTION__, output);
     auto default_uid = std::stoi(output);
     output = run_cmd(session, "id -g");
     mpl::log(mpl::Level::debug, category,
-             fmt::format("{}:{} {}(): `id -g` = {}", __FILE__, __LINE__, __FUNCTION__, output));
+             "{}:{} {}(): `id -g` = {}", __FILE__, __LINE__, __FUNCTION__, output);
     auto default_gid = std::stoi(output);
 
-    return std::make_unique<mp::SftpServer>(std::move(session), source, target, gid_map, uid_map, default_uid,
-                                            default_gid);
-}
+    auto sftp_server = std::make_unique<mp::SftpServer>(std::move(shared_session), source, target, mount.gid_map,
+                                                        mount.uid_map, default_uid, default_gid, mount.profile);
+    sftp_server->enable_pipelining(sftp_stat_workers);
+    sftp_server->enable_read_ring(sftp_read_ring_entries);
+    sftp_server->enable_change_forwarding();
+    if (mount.profile == mp::write_back_mount_profile)
+        sftp_server->enable_write_back();
 
-} // namespace
+    return sftp_server;
+}
 
 mp::SshfsMount::SshfsMount(SSHSession&& session, const std::string& source, const std::string& target,
-                           const std::unordered_map<int, int>& gid_map, const std::unordered_map<int, int>& uid_map)
-    : sftp_server{make_sftp_server(std::move(session), source, target, gid_map, uid_map)}, sftp_thread{[this] {
-          std::cout << "Connected" << std::endl;
-          sftp_server->run();
-          std::cout << "Stopped" << std::endl;
-      }}
+                           const std::unordered_map<int, int>& gid_map, const std::unordered_map<int, int>& uid_map,
+                           const std::string& profile)
+    : targets{target}
 {
+    sftp_servers.push_back(make_sftp_server(std::make_shared<SSHSession>(std::move(session)),
+                                            {source, target, gid_map, uid_map, profile}));
+    sftp_thread = std::thread{[this] {
+        std::cout << "Connected" << std::endl;
+        sftp_servers.front()->run();
+        stopped = true;
+        std::cout << "Stopped" << std::endl;
+    }};
+}
+
+mp::SshfsMount::SshfsMount(SSHSession&& session, const std::vector<SSHFSMountConfig>& mounts) : multiplexed{true}
+{
+    auto shared_session = std::make_shared<SSHSession>(std::move(session));
+    for (const auto& mount : mounts)
+    {
+        sftp_servers.push_back(make_sftp_server(shared_session, mount));
+        targets.push_back(mount.target_path);
+    }
+
+    sftp_thread = std::thread{[this] {
+        std::cout << "Connected" << std::endl;
+        serve_all();
+        stopped = true;
+        std::cout << "Stopped" << std::endl;
+    }};
 }
 
 mp::SshfsMount::~SshfsMount()
@@ -156,7 +195,100 @@ mp::SshfsMount::~SshfsMount()
 
 void mp::SshfsMount::stop()
 {
-    sftp_server->stop();
+    {
+        std::lock_guard<std::mutex> lock{servers_mutex};
+        stop_invoked = true;
+        for (auto& sftp_server : sftp_servers)
+            sftp_server->stop();
+    }
+
     if (sftp_thread.joinable())
         sftp_thread.join();
 }
+
+void mp::SshfsMount::stop(const std::string& target)
+{
+    if (!multiplexed)
+    {
+        if (std::find(targets.begin(), targets.end(), target) != targets.end())
+            stop();
+        return;
+    }
+
+    // The serving thread drops the server, the channel would not survive being closed under its feet
+    std::lock_guard<std::mutex> lock{servers_mutex};
+    targets_to_stop.insert(target);
+}
+
+std::vector<std::string> mp::SshfsMount::serving()
+{
+    std::lock_guard<std::mutex> lock{servers_mutex};
+    std::vector<std::string> served;
+    if (!stopped)
+        std::copy_if(targets.begin(), targets.end(), std::back_inserter(served),
+                     [this](const std::string& target) { return !targets_to_stop.count(target); });
+
+    return served;
+}
+
+void mp::SshfsMount::serve_all()
+{
+    auto drop_server = [this](std::size_t i) {
+        std::lock_guard<std::mutex> lock{servers_mutex};
+        sftp_servers.erase(sftp_servers.begin() + i);
+        targets.erase(targets.begin() + i);
+    };
+
+    std::vector<ssh_channel> ready;
+    while (!stop_invoked)
+    {
+        {
+            std::lock_guard<std::mutex> lock{servers_mutex};
+            for (std::size_t i = 0; i < sftp_servers.size();)
+            {
+                if (targets_to_stop.count(targets[i]))
+                {
+                    sftp_servers.erase(sftp_servers.begin() + i);
+                    targets.erase(targets.begin() + i);
+                }
+                else
+                {
+                    ++i;
+                }
+            }
+            targets_to_stop.clear();
+        }
+
+        if (sftp_servers.empty())
+            break;
+
+        ready.clear();
+        auto busy = false;
+        for (const auto& sftp_server : sftp_servers)
+        {
+            ready.push_back(sftp_server->channel());
+            busy = busy || sftp_server->has_pending_replies();
+        }
+        ready.push_back(nullptr);
+
+        timeval timeout{0, busy ? busy_select_timeout_us : idle_select_timeout_us};
+        if (ssh_channel_select(ready.data(), nullptr, nullptr, &timeout) == SSH_ERROR)
+            break;
+
+        // The select leaves only the readable channels, up to the first null
+        const auto ready_end = std::find(ready.begin(), ready.end(), nullptr);
+        for (std::size_t i = 0; i < sftp_servers.size();)
+        {
+            auto& sftp_server = sftp_servers[i];
+            sftp_server->forward_changes();
+
+            const auto readable = std::find(ready.begin(), ready_end, sftp_server->channel()) != ready_end;
+            if ((readable || sftp_server->has_pending_replies()) && !sftp_server->serve_next_message())
+            {
+                drop_server(i);
+                continue;
+            }
+            ++i;
+        }
+    }
+}
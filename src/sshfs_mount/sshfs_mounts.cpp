@@ -15,17 +15,29 @@
  *
  */
 
+#include "sshfs_detached_process.h"
+
 #include <multipass/exceptions/sshfs_missing_error.h>
 #include <multipass/format.h>
 #include <multipass/logging/log.h>
 #include <multipass/platform.h>
 #include <multipass/ssh/ssh_key_provider.h>
+#include <multipass/settings.h>
+#include <multipass/ssh/ssh_session.h>
+#include <multipass/sshfs_mount/sftp_server.h>
+#include <multipass/sshfs_mount/sshfs_mount.h>
 #include <multipass/sshfs_mount/sshfs_mounts.h>
 #include <multipass/sshfs_server_config.h>
+#include <multipass/telemetry.h>
 #include <multipass/utils.h>
 #include <multipass/virtual_machine.h>
 
+#include <QCryptographicHash>
+#include <QDir>
 #include <QEventLoop>
+#include <QFile>
+
+#include <unordered_set>
 
 namespace mp = multipass;
 namespace mpl = multipass::logging;
@@ -33,6 +45,32 @@ namespace mpl = multipass::logging;
 namespace
 {
 constexpr auto category = "sshfs-mounts";
+constexpr auto max_socket_path_length = 107; // what sockaddr_un has room for on Linux
+
+// sshfs_server reports its counters as "metric <name> <value> <labels>" lines and the series of its histograms as
+// "histogram <histogram> <name> <value> <labels>" ones, taken in under the instance's name
+void forward_metrics(const std::string& instance, QByteArray& pending_output)
+{
+    int line_end;
+    while ((line_end = pending_output.indexOf('\n')) >= 0)
+    {
+        const auto line = QString::fromUtf8(pending_output.left(line_end));
+        pending_output.remove(0, line_end + 1);
+
+        const auto kind = line.section(' ', 0, 0);
+        const auto skipped = kind == "histogram" ? 1 : 0; // past the histogram's name
+        const auto fields = line.section(' ', 1 + skipped, 2 + skipped).split(' ');
+        auto valid_value = false;
+        const auto value = fields.size() == 2 ? fields[1].toDouble(&valid_value) : 0;
+        if (!valid_value || (kind != "metric" && kind != "histogram"))
+            continue;
+
+        const auto labels = line.section(' ', 3 + skipped).toStdString();
+        mp::Telemetry::instance().set({fields[0].toStdString(),
+                                       fmt::format("instance=\"{}\"{}{}", instance, labels.empty() ? "" : ",", labels),
+                                       value, skipped ? line.section(' ', 1, 1).toStdString() : std::string{}});
+    }
+}
 
 template <typename Signal>
 void start_and_block_until(mp::Process* process, Signal signal, std::function<bool(mp::Process* process)> ready_decider)
@@ -58,87 +96,218 @@ void start_and_block_until(mp::Process* process, Signal signal, std::function<bo
 }
 } // namespace
 
-mp::SSHFSMounts::SSHFSMounts(const SSHKeyProvider& key_provider) : key(key_provider.private_key_as_base64())
+mp::SSHFSMounts::SSHFSMounts(const SSHKeyProvider& key_provider, const QString& control_directory)
+    : key_provider{key_provider}, key(key_provider.private_key_as_base64()), control_directory{control_directory}
 {
+    if (!control_directory.isEmpty())
+        adopt_detached_servers();
 }
 
 void mp::SSHFSMounts::start_mount(VirtualMachine* vm, const std::string& source_path, const std::string& target_path,
                                   const std::unordered_map<int, int>& gid_map,
-                                  const std::unordered_map<int, int>& uid_map)
+                                  const std::unordered_map<int, int>& uid_map, const std::string& profile)
+{
+    start_mounts(vm, {{source_path, target_path, gid_map, uid_map, profile}});
+}
+
+void mp::SSHFSMounts::start_mounts(VirtualMachine* vm, const std::vector<SSHFSMountConfig>& mounts)
 {
+    if (mounts.empty())
+        return;
+
+    if (mp::Settings::instance().get(mp::mount_serving_key) == "daemon")
+        return serve_in_daemon(vm, mounts);
+
     mp::SSHFSServerConfig config;
     config.host = vm->ssh_hostname();
     config.port = vm->ssh_port();
     config.username = vm->ssh_username();
     config.instance = vm->vm_name;
-    config.target_path = target_path;
-    config.source_path = source_path;
-    config.uid_map = uid_map;
-    config.gid_map = gid_map;
+    config.target_path = mounts.front().target_path;
+    config.source_path = mounts.front().source_path;
+    config.uid_map = mounts.front().uid_map;
+    config.profile = mounts.front().profile;
+    config.gid_map = mounts.front().gid_map;
+    config.additional_mounts.assign(mounts.begin() + 1, mounts.end());
     config.private_key = key;
+    config.crypto_profile = mp::SSHSession::crypto_profile();
+
+    if (!control_directory.isEmpty() && mp::Settings::instance().get_as<bool>(mp::keep_running_key))
+    {
+        const auto socket_path = control_socket_path(vm->vm_name, mounts.front().target_path);
+        if (socket_path.toLocal8Bit().size() <= max_socket_path_length)
+            config.control_socket = socket_path.toStdString();
+        else
+            mpl::log(mpl::Level::info, category,
+                     fmt::format("Mounts in instance \"{}\" will not survive the daemon, {} is too long a path",
+                                 vm->vm_name, socket_path));
+    }
+
+    std::vector<std::string> target_paths;
+    for (const auto& mount : mounts)
+        target_paths.push_back(mount.target_path);
 
     auto sshfs_server_process_t = mp::platform::make_sshfs_server_process(config);
+    if (!config.control_socket.empty())
+        sshfs_server_process_t = std::make_unique<mp::SSHFSDetachedProcess>(
+            std::move(sshfs_server_process_t), QString::fromStdString(config.control_socket));
     // FIXME: ProcessFactory really should return qt_delete_later_unique_ptr<Process> as Process emits signals
     // and the respective slots may be called on the event loop, but unique_ptr can delete the Process before
     // the slots are fired, causing a crash.
-    mp::qt_delete_later_unique_ptr<mp::Process> sshfs_server_process(sshfs_server_process_t.release());
+    std::shared_ptr<mp::Process> sshfs_server_process{
+        mp::qt_delete_later_unique_ptr<mp::Process>(sshfs_server_process_t.release())};
+    watch_mount_process(vm->vm_name, target_paths, sshfs_server_process);
+
+    for (const auto& mount : mounts)
+        mpl::log(mpl::Level::info, category,
+                 fmt::format("mounting {} => {} in {}", mount.source_path, mount.target_path, vm->vm_name));
+    mpl::log(mpl::Level::info, category,
+             fmt::format("process program '{}'", sshfs_server_process->program().toStdString()));
+    mpl::log(mpl::Level::info, category,
+             fmt::format("process arguments '{}'", sshfs_server_process->arguments().join(", ").toStdString()));
+
+    start_and_block_until(
+        sshfs_server_process.get(), &mp::Process::ready_read_standard_output, [](mp::Process* process) {
+            return process->read_all_standard_output().contains("Connected"); // Magic string printed by sshfs_server
+        });
+
+    // Check in case sshfs_server stopped, usually due to an error
+    auto process_state = sshfs_server_process->process_state();
+    if (process_state.exit_code == 9) // Magic number returned by sshfs_server
+    {
+        throw mp::SSHFSMissingError();
+    }
+    else if (process_state.exit_code || process_state.error)
+    {
+        throw std::runtime_error(
+            fmt::format("{}: {}", process_state.failure_message(), sshfs_server_process->read_all_standard_error()));
+    }
+
+    keep_mount_process(vm->vm_name, target_paths, sshfs_server_process);
+}
+
+void mp::SSHFSMounts::watch_mount_process(const std::string& instance, const std::vector<std::string>& target_paths,
+                                          const std::shared_ptr<Process>& process)
+{
+    const auto targets_description = fmt::format("'{}'", fmt::join(target_paths, "', '"));
 
     QObject::connect(
-        sshfs_server_process.get(), &mp::Process::finished, this,
-        [this, instance = vm->vm_name, target_path](mp::ProcessState exit_state) {
+        process.get(), &mp::Process::finished, this,
+        [this, instance, target_paths, targets_description, process = process.get()](mp::ProcessState exit_state) {
             if (exit_state.completed_successfully())
             {
                 mpl::log(mpl::Level::info, category,
-                         fmt::format("Mount '{}' in instance \"{}\" has stopped", target_path, instance));
+                         fmt::format("Mount {} in instance \"{}\" has stopped", targets_description, instance));
             }
             else
             {
                 mpl::log(mpl::Level::warning, // not error as it failing can indicate we need to install sshfs in the VM
                          category,
-                         fmt::format("Mount '{}' in instance \"{}\" has stopped unexpectedly: {}", target_path,
+                         fmt::format("Mount {} in instance \"{}\" has stopped unexpectedly: {}", targets_description,
                                      instance, exit_state.failure_message()));
             }
 
-            mount_processes[instance].erase(target_path);
+            // A target may have been stopped and mounted again in a process of its own meanwhile
+            std::lock_guard<std::mutex> lock{mount_processes_mutex};
+            auto& instance_mounts = mount_processes[instance];
+            for (const auto& target_path : target_paths)
+            {
+                auto it = instance_mounts.find(target_path);
+                if (it != instance_mounts.end() && it->second.get() == process)
+                    instance_mounts.erase(it);
+            }
         });
 
     QObject::connect(
-        sshfs_server_process.get(), &mp::Process::error_occurred, this,
-        [instance = vm->vm_name, target_path, process = sshfs_server_process.get()](QProcess::ProcessError error,
-                                                                                    QString error_string) {
+        process.get(), &mp::Process::error_occurred, this,
+        [instance, targets_description](QProcess::ProcessError error, QString error_string) {
             mpl::log(mpl::Level::error, category,
-                     fmt::format("There was an error with sshfs_server for instance \"{}\" with path '{}': {} - {}",
-                                 instance, target_path, mp::utils::qenum_to_string(error), error_string));
+                     fmt::format("There was an error with sshfs_server for instance \"{}\" with path {}: {} - {}",
+                                 instance, targets_description, mp::utils::qenum_to_string(error), error_string));
         });
+}
 
-    mpl::log(mpl::Level::info, category, fmt::format("mounting {} => {} in {}", source_path, target_path, vm->vm_name));
-    mpl::log(mpl::Level::info, category,
-             fmt::format("process program '{}'", sshfs_server_process->program().toStdString()));
-    mpl::log(mpl::Level::info, category,
-             fmt::format("process arguments '{}'", sshfs_server_process->arguments().join(", ").toStdString()));
+void mp::SSHFSMounts::keep_mount_process(const std::string& instance, const std::vector<std::string>& target_paths,
+                                         const std::shared_ptr<Process>& process)
+{
+    QObject::connect(process.get(), &mp::Process::ready_read_standard_output, this,
+                     [instance, process = process.get(), pending_output = std::make_shared<QByteArray>()] {
+                         pending_output->append(process->read_all_standard_output());
+                         forward_metrics(instance, *pending_output);
+                     });
 
-    start_and_block_until(
-        sshfs_server_process.get(), &mp::Process::ready_read_standard_output, [](mp::Process* process) {
-            return process->read_all_standard_output().contains("Connected"); // Magic string printed by sshfs_server
-        });
+    std::lock_guard<std::mutex> lock{mount_processes_mutex};
+    for (const auto& target_path : target_paths)
+        mount_processes[instance][target_path] = process;
+}
 
-    // Check in case sshfs_server stopped, usually due to an error
-    auto process_state = sshfs_server_process->process_state();
-    if (process_state.exit_code == 9) // Magic number returned by sshfs_server
+void mp::SSHFSMounts::adopt_detached_servers()
+{
+    QDir directory{control_directory};
+    directory.mkpath(".");
+
+    // Sockets are named after the instance and the first of the targets their server was started with
+    for (const auto& entry : directory.entryInfoList({"*.sock"}, QDir::System | QDir::Files))
     {
-        throw mp::SSHFSMissingError();
+        const auto socket_path = entry.absoluteFilePath();
+        auto server = std::make_unique<mp::SSHFSDetachedProcess>(nullptr, socket_path);
+        const auto target_paths = server->attach();
+        if (target_paths.empty())
+        {
+            mpl::log(mpl::Level::debug, category, fmt::format("Removing stale mount socket {}", socket_path));
+            QFile::remove(socket_path);
+            continue;
+        }
+
+        const auto instance = entry.completeBaseName().section('.', 0, -2).toStdString();
+        mpl::log(mpl::Level::info, category,
+                 fmt::format("Taking up mounts '{}' in instance \"{}\" from the previous daemon",
+                             fmt::join(target_paths, "', '"), instance));
+
+        std::shared_ptr<mp::Process> process{mp::qt_delete_later_unique_ptr<mp::Process>(server.release())};
+        watch_mount_process(instance, target_paths, process);
+        keep_mount_process(instance, target_paths, process);
     }
-    else if (process_state.exit_code || process_state.error)
+}
+
+QString mp::SSHFSMounts::control_socket_path(const std::string& instance, const std::string& target_path) const
+{
+    const auto hash = QCryptographicHash::hash(QByteArray::fromStdString(target_path), QCryptographicHash::Sha256);
+    return QDir{control_directory}.filePath(
+        QString("%1.%2.sock").arg(QString::fromStdString(instance), QString(hash.toHex().left(8))));
+}
+
+void mp::SSHFSMounts::serve_in_daemon(VirtualMachine* vm, const std::vector<SSHFSMountConfig>& mounts)
+{
+    // As with an sshfs_server, the mounts started together share a session; what readies them runs on this thread
+    auto session = std::make_shared<mp::SSHSession>(vm->ssh_hostname(), vm->ssh_port(), vm->ssh_username(),
+                                                    key_provider);
+
+    std::vector<std::pair<std::string, std::unique_ptr<SftpServer>>> servers;
+    for (const auto& mount : mounts)
     {
-        throw std::runtime_error(
-            fmt::format("{}: {}", process_state.failure_message(), sshfs_server_process->read_all_standard_error()));
+        mpl::log(mpl::Level::info, category,
+                 fmt::format("mounting {} => {} in {}, served by the daemon", mount.source_path, mount.target_path,
+                             vm->vm_name));
+        servers.emplace_back(mount.target_path, mp::make_sftp_server(session, mount));
     }
 
-    mount_processes[vm->vm_name][target_path] = std::move(sshfs_server_process);
+    std::lock_guard<std::mutex> lock{mount_processes_mutex};
+    if (!sftp_service)
+        sftp_service = std::make_unique<SftpService>();
+    sftp_service->serve(vm->vm_name, std::move(servers));
 }
 
 bool mp::SSHFSMounts::stop_mount(const std::string& instance, const std::string& path)
 {
+    std::lock_guard<std::mutex> lock{mount_processes_mutex};
+    if (sftp_service && sftp_service->stop(instance, path))
+    {
+        mpl::log(mpl::Level::info, category,
+                 fmt::format("stopping the daemon's mount for \"{}\" serving '{}'", instance, path));
+        return true;
+    }
+
     auto sshfs_mount_it = mount_processes.find(instance);
     if (sshfs_mount_it == mount_processes.end())
     {
@@ -152,7 +321,16 @@ bool mp::SSHFSMounts::stop_mount(const std::string& instance, const std::string&
         auto& sshfs_mount = map_entry->second;
         mpl::log(mpl::Level::info, category,
                  fmt::format("stopping sshfs_server for \"{}\" serving '{}'", instance, path));
-        sshfs_mount->terminate(); // TODO - if non-responsive, then kill()
+        if (sshfs_mount.use_count() > 1)
+        {
+            // The process keeps serving the instance's other mounts
+            sshfs_mount->write(QByteArray::fromStdString(fmt::format("stop {}\n", path)));
+            sshfs_mount_map.erase(map_entry);
+        }
+        else
+        {
+            sshfs_mount->terminate(); // TODO - if non-responsive, then kill()
+        }
         return true;
     }
     return false;
@@ -160,6 +338,10 @@ bool mp::SSHFSMounts::stop_mount(const std::string& instance, const std::string&
 
 void mp::SSHFSMounts::stop_all_mounts_for_instance(const std::string& instance)
 {
+    std::lock_guard<std::mutex> lock{mount_processes_mutex};
+    if (sftp_service)
+        sftp_service->stop_all(instance);
+
     auto mounts_it = mount_processes.find(instance);
     if (mounts_it == mount_processes.end() || mounts_it->second.empty())
     {
@@ -167,18 +349,34 @@ void mp::SSHFSMounts::stop_all_mounts_for_instance(const std::string& instance)
     }
     else
     {
+        std::unordered_set<mp::Process*> stopped;
         for (auto& sshfs_mount : mounts_it->second)
         {
             mpl::log(mpl::Level::debug, category,
                      fmt::format("Stopping mount '{}' in instance \"{}\"", sshfs_mount.first, instance));
-            sshfs_mount.second->terminate();
+            if (stopped.insert(sshfs_mount.second.get()).second)
+                sshfs_mount.second->terminate();
         }
     }
     mount_processes[instance].clear();
 }
 
+std::size_t mp::SSHFSMounts::mount_count() const
+{
+    std::lock_guard<std::mutex> lock{mount_processes_mutex};
+    std::size_t count = sftp_service ? sftp_service->size() : 0;
+    for (const auto& instance : mount_processes)
+        count += instance.second.size();
+
+    return count;
+}
+
 bool mp::SSHFSMounts::has_instance_already_mounted(const std::string& instance, const std::string& path) const
 {
+    std::lock_guard<std::mutex> lock{mount_processes_mutex};
+    if (sftp_service && sftp_service->serves(instance, path))
+        return true;
+
     auto entry = mount_processes.find(instance);
     if (entry != mount_processes.end() && entry->second.find(path) != entry->second.end())
     {
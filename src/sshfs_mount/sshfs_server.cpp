@@ -15,19 +15,33 @@
  *
  */
 
+#include <chrono>
+#include <cstring>
 #include <iostream>
 #include <memory>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <QStringList>
 
 #include "../ssh/ssh_client_key_provider.h" // FIXME
 #include <multipass/exceptions/sshfs_missing_error.h>
+#include <multipass/format.h>
 #include <multipass/logging/log.h>
 #include <multipass/logging/standard_logger.h>
 #include <multipass/platform.h>
 #include <multipass/ssh/ssh_session.h>
 #include <multipass/sshfs_mount/sshfs_mount.h>
+#include <multipass/telemetry.h>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 namespace mp = multipass;
 namespace mpl = multipass::logging;
@@ -61,11 +75,205 @@ unordered_map<int, int> deserialise_id_map(const char* in)
     }
     return id_map;
 }
+
+// The daemon reads these "metric <name> <value> <labels>" lines, or "histogram <histogram> <name> <value> <labels>"
+// for the series of histograms, to include this process's telemetry in its own
+string metrics_report()
+{
+    string report;
+    for (const auto& sample : mp::Telemetry::instance().samples())
+    {
+        if (sample.histogram.empty())
+            report += fmt::format("metric {} {} {}\n", sample.name, sample.value, sample.labels);
+        else
+            report +=
+                fmt::format("histogram {} {} {} {}\n", sample.histogram, sample.name, sample.value, sample.labels);
+    }
+
+    return report;
+}
+
+void report_metrics_periodically()
+{
+    thread{[] {
+        for (;;)
+        {
+            this_thread::sleep_for(chrono::seconds(10));
+            cout << metrics_report() << flush;
+        }
+    }}.detach();
+}
+
+// With CONTROL_SOCKET set, the server leaves the daemon's process behind, so as to outlive it. The process the
+// daemon started only waits for the server to be set up, passing on what it reports through a pipe as if it were the
+// server itself: "Connected" and a clean exit, or the error and the exit code. This has to happen before any thread
+// is started
+void detach_from_daemon()
+{
+    int report[2];
+    if (pipe(report) == -1)
+    {
+        cerr << "Cannot detach: " << strerror(errno) << endl;
+        exit(1);
+    }
+
+    const auto server = fork();
+    if (server == -1)
+    {
+        cerr << "Cannot detach: " << strerror(errno) << endl;
+        exit(1);
+    }
+
+    if (server > 0)
+    {
+        close(report[1]);
+        string reported;
+        char buffer[256];
+        for (ssize_t read_bytes; (read_bytes = read(report[0], buffer, sizeof(buffer))) != 0;)
+        {
+            if (read_bytes > 0)
+                reported.append(buffer, read_bytes);
+            else if (errno != EINTR)
+                break;
+        }
+
+        const string connected{"Connected\n"};
+        if (reported.size() >= connected.size() &&
+            reported.compare(reported.size() - connected.size(), connected.size(), connected) == 0)
+        {
+            cout << "Connected" << endl;
+            exit(0);
+        }
+
+        int status = 0;
+        waitpid(server, &status, 0);
+        cerr << reported;
+        exit(WIFEXITED(status) ? WEXITSTATUS(status) : 1);
+    }
+
+    // Errors go down the pipe, written to stderr as they would be otherwise; nothing else is read from here on
+    close(report[0]);
+    setsid();
+    const auto null_fd = open("/dev/null", O_RDWR);
+    dup2(null_fd, STDIN_FILENO);
+    dup2(null_fd, STDOUT_FILENO);
+    dup2(report[1], STDERR_FILENO);
+    close(null_fd);
+    close(report[1]);
+}
+
+void report_ready_to_daemon()
+{
+    cerr << "Connected" << endl;
+    const auto null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDERR_FILENO);
+    close(null_fd);
+}
+
+int listen_on(const string& path)
+{
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path))
+        throw runtime_error(fmt::format("control socket path is too long: {}", path));
+    strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+    unlink(path.c_str()); // left behind by a server that did not get to clean up
+    const auto listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener == -1 || bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1 ||
+        listen(listener, 1) == -1)
+        throw runtime_error(fmt::format("cannot listen on {}: {}", path, strerror(errno)));
+    chmod(path.c_str(), S_IRUSR | S_IWUSR);
+
+    return listener;
+}
+
+// Takes the daemon's requests, one line each, until it asks the server to quit or there is nothing left to serve:
+// "stop <target>", "targets", answered with a "target <target>" line per target still served and "end", and "quit".
+// Metric lines go to the daemon as they would on stdout. Only one daemon is talked to at a time, the one that
+// connected last
+void serve_control(mp::SshfsMount& sshfs_mount, int listener)
+{
+    int daemon_fd = -1;
+    string pending;
+    auto close_daemon = [&daemon_fd, &pending] {
+        if (daemon_fd != -1)
+            close(daemon_fd);
+        daemon_fd = -1;
+        pending.clear();
+    };
+    auto send_daemon = [&daemon_fd, &close_daemon](const string& data) {
+        if (daemon_fd != -1 && send(daemon_fd, data.data(), data.size(), MSG_NOSIGNAL) == -1)
+            close_daemon();
+    };
+
+    auto last_report = chrono::steady_clock::now();
+    while (!sshfs_mount.serving().empty())
+    {
+        pollfd fds[] = {{listener, POLLIN, 0}, {daemon_fd, POLLIN, 0}};
+        if (poll(fds, daemon_fd == -1 ? 1 : 2, 1000) == -1 && errno != EINTR)
+            break;
+
+        if (fds[0].revents & POLLIN)
+        {
+            const auto accepted = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+            if (accepted != -1)
+            {
+                close_daemon();
+                daemon_fd = accepted;
+            }
+        }
+        else if (fds[1].revents)
+        {
+            char buffer[1024];
+            const auto received = recv(daemon_fd, buffer, sizeof(buffer), 0);
+            if (received <= 0)
+            {
+                close_daemon(); // the daemon went away, the mounts are served on until the next one comes
+                continue;
+            }
+
+            pending.append(buffer, received);
+            const string stop_command{"stop "};
+            for (size_t line_end; (line_end = pending.find('\n')) != string::npos;)
+            {
+                const auto line = pending.substr(0, line_end);
+                pending.erase(0, line_end + 1);
+
+                if (line == "quit")
+                {
+                    close_daemon();
+                    return;
+                }
+                else if (line == "targets")
+                {
+                    string reply;
+                    for (const auto& target : sshfs_mount.serving())
+                        reply += fmt::format("target {}\n", target);
+                    send_daemon(reply + "end\n");
+                }
+                else if (line.compare(0, stop_command.size(), stop_command) == 0)
+                {
+                    sshfs_mount.stop(line.substr(stop_command.size()));
+                }
+            }
+        }
+
+        if (chrono::steady_clock::now() - last_report >= chrono::seconds(10))
+        {
+            last_report = chrono::steady_clock::now();
+            send_daemon(metrics_report());
+        }
+    }
+
+    close_daemon();
+}
 } // namespace
 
 int main(int argc, char* argv[])
 {
-    if (argc != 8)
+    // Any further mounts come as extra source, target, uid map, gid map and profile quintuples
+    if (argc < 9 || (argc - 9) % 5 != 0)
     {
         cerr << "Incorrect arguments" << endl;
         exit(2);
@@ -85,15 +293,60 @@ int main(int argc, char* argv[])
     const auto target_path = string(argv[5]);
     const unordered_map<int, int> uid_map = deserialise_id_map(argv[6]);
     const unordered_map<int, int> gid_map = deserialise_id_map(argv[7]);
+    const auto profile = string(argv[8]);
+    const auto control_socket = qgetenv("CONTROL_SOCKET").toStdString();
+
+    if (!control_socket.empty())
+        detach_from_daemon();
 
     auto logger = std::make_shared<mpl::StandardLogger>(mpl::Level::error); // QUESTION - how to pass verbosity level?
     mpl::set_logger(logger);
 
+    mp::SSHSession::set_crypto_profile(qgetenv("SSH_CRYPTO").toStdString());
+
     try
     {
         mp::SSHSession session{host, port, username, mp::SSHClientKeyProvider{priv_key_blob}};
 
-        mp::SshfsMount sshfs_mount(move(session), source_path, target_path, gid_map, uid_map);
+        vector<mp::SSHFSMountConfig> mounts{{source_path, target_path, gid_map, uid_map, profile}};
+        for (auto i = 9; i < argc; i += 5)
+            mounts.push_back({argv[i], argv[i + 1], deserialise_id_map(argv[i + 3]), deserialise_id_map(argv[i + 2]),
+                              argv[i + 4]});
+
+        if (!control_socket.empty())
+        {
+            mp::SshfsMount sshfs_mount(move(session), mounts);
+            const auto listener = listen_on(control_socket);
+            report_ready_to_daemon();
+
+            serve_control(sshfs_mount, listener);
+            unlink(control_socket.c_str());
+            sshfs_mount.stop();
+            exit(0);
+        }
+
+        report_metrics_periodically();
+        if (argc > 9)
+        {
+            mp::SshfsMount sshfs_mount(move(session), mounts);
+
+            // Mounts can be stopped one by one with "stop <target>" lines on stdin
+            thread{[&sshfs_mount] {
+                const string stop_command{"stop "};
+                for (string line; getline(cin, line);)
+                {
+                    if (line.compare(0, stop_command.size(), stop_command) == 0)
+                        sshfs_mount.stop(line.substr(stop_command.size()));
+                }
+            }}.detach();
+
+            int sig = mpp::wait_for_quit_signals();
+            cout << "Received signal " << sig << ". Stopping" << endl;
+            sshfs_mount.stop();
+            exit(0);
+        }
+
+        mp::SshfsMount sshfs_mount(move(session), source_path, target_path, gid_map, uid_map, profile);
 
         // ssh lives on its own thread, use this thread to listen for quit signal
         int sig = mpp::wait_for_quit_signals();
@@ -16,13 +16,17 @@
  */
 
 #include <multipass/constants.h>
+#include <multipass/exceptions/invalid_memory_size_exception.h>
+#include <multipass/memory_size.h>
 #include <multipass/platform.h>
 #include <multipass/settings.h>
 #include <multipass/utils.h> // TODO move out
 
 #include <QDir>
+#include <QFileInfo>
 #include <QSettings>
 #include <QStandardPaths>
+#include <QUrl>
 
 #include <algorithm>
 #include <array>
@@ -41,12 +45,74 @@ const auto daemon_root = QStringLiteral("local");
 const auto client_root = QStringLiteral("client");
 const auto petenv_name = QStringLiteral("primary");
 const auto autostart_default = QStringLiteral("true");
+const auto image_overlays_default = QStringLiteral("true");
+const auto warm_pool_default = QStringLiteral("");
+const auto prefetch_images_default = QStringLiteral("");
+const auto memory_templates_default = QStringLiteral("");
+const auto image_compression_default = QStringLiteral("false");
+const auto parallel_operations_default = QStringLiteral("8");
+const auto download_bandwidth_default = QStringLiteral("0"); // no cap
+const auto download_connections_default = QStringLiteral("8");
+const auto scrub_bandwidth_default = QStringLiteral("20M");
+const auto image_peers_default = QStringLiteral("");
+const auto image_sharing_port_default = QStringLiteral("0");
+const auto image_sharing_address_default = QStringLiteral("127.0.0.1"); // peers elsewhere need it set to be reached
+const auto shared_image_cache_default = QStringLiteral("");
+const auto image_cache_size_default = QStringLiteral("0");
+const auto streaming_launch_default = QStringLiteral("false");
+const auto rpc_threads_default = QStringLiteral("64");
+const auto rpc_streams_default = QStringLiteral("100");
+const auto rpc_limits_default = QStringLiteral("");
+const auto fast_exec_default = QStringLiteral("false");
+const auto ssh_crypto_default = QStringLiteral("auto");
+const auto log_overflow_default = QStringLiteral("drop");
+const auto mount_serving_default = QStringLiteral("process");
+const auto package_cache_port_default = QStringLiteral("0");
+const auto density_mode_default = QStringLiteral("false");
+const auto keep_running_default = QStringLiteral("false");
+const auto network_shards_default = QStringLiteral("1");
+const auto boot_profile_default = QString{mp::firmware_boot_profile};
+const auto cpu_overcommit_default = QStringLiteral("4");
+const auto memory_overcommit_default = QStringLiteral("1.5");
+const auto disk_overcommit_default = QStringLiteral("2"); // images only take what their guests wrote
+const auto idle_suspend_default = QStringLiteral("0");
 
 std::map<QString, QString> make_defaults()
 { // clang-format off
     return {{mp::petenv_key, petenv_name},
             {mp::driver_key, mp::platform::default_driver()},
-            {mp::autostart_key, autostart_default}};
+            {mp::autostart_key, autostart_default},
+            {mp::image_overlays_key, image_overlays_default},
+            {mp::warm_pool_key, warm_pool_default},
+            {mp::prefetch_images_key, prefetch_images_default},
+            {mp::memory_templates_key, memory_templates_default},
+            {mp::image_compression_key, image_compression_default},
+            {mp::parallel_operations_key, parallel_operations_default},
+            {mp::download_bandwidth_key, download_bandwidth_default},
+            {mp::download_connections_key, download_connections_default},
+            {mp::scrub_bandwidth_key, scrub_bandwidth_default},
+            {mp::image_peers_key, image_peers_default},
+            {mp::image_sharing_port_key, image_sharing_port_default},
+            {mp::image_sharing_address_key, image_sharing_address_default},
+            {mp::shared_image_cache_key, shared_image_cache_default},
+            {mp::image_cache_size_key, image_cache_size_default},
+            {mp::streaming_launch_key, streaming_launch_default},
+            {mp::density_mode_key, density_mode_default},
+            {mp::keep_running_key, keep_running_default},
+            {mp::network_shards_key, network_shards_default},
+            {mp::boot_profile_key, boot_profile_default},
+            {mp::cpu_overcommit_key, cpu_overcommit_default},
+            {mp::memory_overcommit_key, memory_overcommit_default},
+            {mp::disk_overcommit_key, disk_overcommit_default},
+            {mp::idle_suspend_key, idle_suspend_default},
+            {mp::rpc_threads_key, rpc_threads_default},
+            {mp::rpc_streams_key, rpc_streams_default},
+            {mp::rpc_limits_key, rpc_limits_default},
+            {mp::fast_exec_key, fast_exec_default},
+            {mp::ssh_crypto_key, ssh_crypto_default},
+            {mp::log_overflow_key, log_overflow_default},
+            {mp::mount_serving_key, mount_serving_default},
+            {mp::package_cache_port_key, package_cache_port_default}};
 } // clang-format on
 
 /*
@@ -131,6 +197,80 @@ QString interpret_bool(QString val)
         return val;
 }
 
+bool valid_counts(const QString& val)
+{
+    try
+    {
+        mp::utils::parse_counts(val);
+        return true;
+    }
+    catch (const std::runtime_error&)
+    {
+        return false;
+    }
+}
+
+bool valid_peers(const QString& val)
+{
+    for (const auto& peer : val.split(',', QString::SkipEmptyParts))
+    {
+        const QUrl url{peer.trimmed(), QUrl::StrictMode};
+        if (!url.isValid() || url.scheme() != "http" || url.host().isEmpty())
+            return false;
+    }
+
+    return true;
+}
+
+bool valid_port(const QString& val)
+{
+    bool ok{false};
+    const auto port = val.toInt(&ok);
+    return ok && port >= 0 && port <= 65535;
+}
+
+// An IPv4 or IPv6 address, not a name, as that is what gets listened on
+bool valid_ip_address(const QString& val)
+{
+    if (val.contains(':'))
+    {
+        const QUrl url{QString("http://[%1]").arg(val), QUrl::StrictMode};
+        return url.isValid() && !url.host().isEmpty();
+    }
+
+    const auto parts = val.split('.');
+    return parts.size() == 4 && std::all_of(parts.cbegin(), parts.cend(), [](const QString& part) {
+               bool ok{false};
+               const auto byte = part.toInt(&ok);
+               return ok && part.size() <= 3 && byte >= 0 && byte <= 255;
+           });
+}
+
+bool valid_minutes(const QString& val)
+{
+    bool ok{false};
+    return val.toInt(&ok) >= 0 && ok;
+}
+
+bool valid_ratio(const QString& val)
+{
+    bool ok{false};
+    return val.toDouble(&ok) >= 0 && ok;
+}
+
+bool valid_memory_size(const QString& val)
+{
+    try
+    {
+        mp::MemorySize{val.toStdString()};
+        return true;
+    }
+    catch (const mp::InvalidMemorySizeException&)
+    {
+        return false;
+    }
+}
+
 } // namespace
 
 mp::Settings::Settings(const Singleton<Settings>::PrivatePass& pass)
@@ -151,14 +291,40 @@ std::set<QString> multipass::Settings::keys() const
 QString mp::Settings::get(const QString& key) const
 {
     const auto& default_ret = get_default(key); // make sure the key is valid before reading from disk
+
+    // As long as nobody touched the file, a look at its stamp is all it takes to get what it held last time
+    const auto file_name = file_for(key);
+    const QFileInfo file_info{file_name};
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        auto& cached = cache[file_name];
+        if (cached.modified != file_info.lastModified() || cached.size != file_info.size())
+            cached = {file_info.lastModified(), file_info.size(), {}};
+
+        auto it = cached.values.find(key);
+        if (it != cached.values.end())
+            return it->second;
+    }
+
     auto settings = persistent_settings(key);
-    return checked_get(settings, key, default_ret, mutex);
+    auto ret = checked_get(settings, key, default_ret, mutex);
+
+    // Should the file have changed since its stamp was taken, the next read sees that and reads it anew
+    std::lock_guard<std::mutex> lock{mutex};
+    auto& cached = cache[file_name];
+    if (cached.modified == file_info.lastModified() && cached.size == file_info.size())
+        cached.values[key] = ret;
+
+    return ret;
 }
 
 void mp::Settings::set(const QString& key, const QString& val)
 {
     get_default(key); // make sure the key is valid before setting
     set_aux(key, val);
+
+    std::lock_guard<std::mutex> lock{mutex};
+    cache.erase(file_for(key));
 }
 
 const QString& mp::Settings::get_default(const QString& key) const
@@ -189,8 +355,50 @@ void multipass::Settings::set_aux(const QString& key, QString val) // work with
         throw InvalidSettingsException{key, val, "Invalid hostname"}; // TODO move checking logic out
     else if (key == driver_key && !mp::platform::is_backend_supported(val))
         throw InvalidSettingsException(key, val, "Invalid driver"); // TODO idem
-    else if (key == autostart_key && (val = interpret_bool(val)) != "true" && val != "false")
+    else if ((key == autostart_key || key == image_overlays_key || key == image_compression_key ||
+              key == fast_exec_key || key == streaming_launch_key || key == density_mode_key ||
+              key == keep_running_key) &&
+             (val = interpret_bool(val)) != "true" && val != "false")
         throw InvalidSettingsException(key, val, "Invalid flag, try \"true\" or \"false\"");
+    else if (key == warm_pool_key && !valid_counts(val))
+        throw InvalidSettingsException(key, val, "Invalid warm pool, try \"<image>=<count>[,...]\"");
+    else if (key == rpc_limits_key && !valid_counts(val))
+        throw InvalidSettingsException(key, val, "Invalid limits, try \"<method>=<count>[,...]\"");
+    else if ((key == parallel_operations_key || key == rpc_threads_key || key == rpc_streams_key ||
+              key == download_connections_key || key == network_shards_key) &&
+             val.toInt() < 1)
+        throw InvalidSettingsException(key, val, "Invalid count, try a positive number");
+    else if (key == image_peers_key && !valid_peers(val))
+        throw InvalidSettingsException(key, val, "Invalid peers, try \"http://<host>:<port>[,...]\"");
+    else if (key == image_sharing_address_key && !valid_ip_address(val))
+        throw InvalidSettingsException(key, val, "Invalid address, try an IP address of this host like \"10.0.0.2\"");
+    else if (key == image_sharing_port_key && !valid_port(val))
+        throw InvalidSettingsException(key, val, "Invalid port, try a number up to 65535, or \"0\" not to share");
+    else if (key == package_cache_port_key && !valid_port(val))
+        throw InvalidSettingsException(key, val, "Invalid port, try a number up to 65535, or \"0\" not to cache");
+    else if (key == shared_image_cache_key && !val.isEmpty() && !QDir{val}.exists("vault"))
+        throw InvalidSettingsException(key, val, "Invalid cache, try the directory holding another daemon's vault");
+    else if (key == image_cache_size_key && !valid_memory_size(val))
+        throw InvalidSettingsException(key, val, "Invalid size, try e.g. \"30G\", or \"0\" to expire images by age");
+    else if (key == download_bandwidth_key && !valid_memory_size(val))
+        throw InvalidSettingsException(key, val, "Invalid bandwidth, try a size a second like \"20M\", or \"0\"");
+    else if (key == scrub_bandwidth_key && !valid_memory_size(val))
+        throw InvalidSettingsException(key, val, "Invalid bandwidth, try a size a second like \"20M\", or \"0\"");
+    else if (key == ssh_crypto_key && val != "auto" && val != "aes-gcm" && val != "chacha20")
+        throw InvalidSettingsException(key, val, "Invalid profile, try \"auto\", \"aes-gcm\" or \"chacha20\"");
+    else if (key == boot_profile_key && val != firmware_boot_profile && val != kernel_boot_profile &&
+             val != q35_boot_profile && val != microvm_boot_profile)
+        throw InvalidSettingsException(key, val,
+                                       "Invalid profile, try \"firmware\", \"kernel\", \"q35\" or \"microvm\"");
+    else if ((key == cpu_overcommit_key || key == memory_overcommit_key || key == disk_overcommit_key) &&
+             !valid_ratio(val))
+        throw InvalidSettingsException(key, val, "Invalid ratio, try e.g. \"1.5\", or \"0\" for no limit");
+    else if (key == idle_suspend_key && !valid_minutes(val))
+        throw InvalidSettingsException(key, val, "Invalid period, try a number of minutes, or \"0\" for never");
+    else if (key == log_overflow_key && val != "drop" && val != "block")
+        throw InvalidSettingsException(key, val, "Invalid policy, try \"drop\" or \"block\"");
+    else if (key == mount_serving_key && val != "process" && val != "daemon")
+        throw InvalidSettingsException(key, val, "Invalid mode, try \"process\" or \"daemon\"");
 
     auto settings = persistent_settings(key);
     checked_set(settings, key, val, mutex);
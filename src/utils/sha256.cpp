@@ -0,0 +1,331 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <multipass/format.h>
+#include <multipass/sha256.h>
+
+#include <QFile>
+
+#include <algorithm>
+#include <cstring>
+#include <future>
+#include <stdexcept>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define MULTIPASS_SHA256_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#elif defined(__aarch64__) && (defined(__GNUC__) || defined(__clang__))
+#define MULTIPASS_SHA256_ARMV8 1
+#include <arm_neon.h>
+#if defined(__linux__)
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
+#endif
+
+namespace mp = multipass;
+
+namespace
+{
+constexpr auto file_chunk_size = 1024 * 1024;
+
+alignas(16) constexpr uint32_t round_constants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+using CompressFunction = void (*)(uint32_t* state, const unsigned char* blocks, std::size_t count);
+
+uint32_t rotate_right(uint32_t value, int bits)
+{
+    return (value >> bits) | (value << (32 - bits));
+}
+
+uint32_t load_big_endian(const unsigned char* bytes)
+{
+    return uint32_t{bytes[0]} << 24 | uint32_t{bytes[1]} << 16 | uint32_t{bytes[2]} << 8 | uint32_t{bytes[3]};
+}
+
+void compress_portable(uint32_t* state, const unsigned char* blocks, std::size_t count)
+{
+    for (; count; --count, blocks += 64)
+    {
+        uint32_t w[64];
+        for (auto i = 0; i < 16; ++i)
+            w[i] = load_big_endian(blocks + 4 * i);
+        for (auto i = 16; i < 64; ++i)
+        {
+            const auto s0 = rotate_right(w[i - 15], 7) ^ rotate_right(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            const auto s1 = rotate_right(w[i - 2], 17) ^ rotate_right(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        auto a = state[0], b = state[1], c = state[2], d = state[3];
+        auto e = state[4], f = state[5], g = state[6], h = state[7];
+        for (auto i = 0; i < 64; ++i)
+        {
+            const auto s1 = rotate_right(e, 6) ^ rotate_right(e, 11) ^ rotate_right(e, 25);
+            const auto t1 = h + s1 + ((e & f) ^ (~e & g)) + round_constants[i] + w[i];
+            const auto s0 = rotate_right(a, 2) ^ rotate_right(a, 13) ^ rotate_right(a, 22);
+            const auto t2 = s0 + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+}
+
+#ifdef MULTIPASS_SHA256_X86
+bool has_sha_instructions()
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_SSE4_1) || __get_cpuid_max(0, nullptr) < 7)
+        return false;
+
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    return ebx & (1u << 29);
+}
+
+// The SHA instructions keep the state as ABEF and CDGH, and take the message four words at a time
+__attribute__((target("sha,sse4.1"))) void compress_x86(uint32_t* state, const unsigned char* blocks,
+                                                         std::size_t count)
+{
+    const auto byte_swap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    auto cdab = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state)), 0xB1);
+    auto cdgh = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state + 4)), 0x1B);
+    auto abef = _mm_alignr_epi8(cdab, cdgh, 8);
+    cdgh = _mm_blend_epi16(cdgh, cdab, 0xF0);
+
+    for (; count; --count, blocks += 64)
+    {
+        const auto abef_before = abef;
+        const auto cdgh_before = cdgh;
+
+        __m128i message[4];
+        for (auto i = 0; i < 16; ++i)
+        {
+            auto& words = message[i & 3];
+            if (i < 4)
+                words = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(blocks + 16 * i)),
+                                         byte_swap);
+            else
+                words = _mm_sha256msg2_epu32(
+                    _mm_add_epi32(_mm_sha256msg1_epu32(words, message[(i + 1) & 3]),
+                                  _mm_alignr_epi8(message[(i + 3) & 3], message[(i + 2) & 3], 4)),
+                    message[(i + 3) & 3]);
+
+            auto sums =
+                _mm_add_epi32(words, _mm_load_si128(reinterpret_cast<const __m128i*>(round_constants + 4 * i)));
+            cdgh = _mm_sha256rnds2_epu32(cdgh, abef, sums);
+            sums = _mm_shuffle_epi32(sums, 0x0E);
+            abef = _mm_sha256rnds2_epu32(abef, cdgh, sums);
+        }
+
+        abef = _mm_add_epi32(abef, abef_before);
+        cdgh = _mm_add_epi32(cdgh, cdgh_before);
+    }
+
+    const auto feba = _mm_shuffle_epi32(abef, 0x1B);
+    const auto dchg = _mm_shuffle_epi32(cdgh, 0xB1);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(state), _mm_blend_epi16(feba, dchg, 0xF0));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(state + 4), _mm_alignr_epi8(dchg, feba, 8));
+}
+#endif
+
+#ifdef MULTIPASS_SHA256_ARMV8
+#if defined(__clang__)
+#define MULTIPASS_SHA256_ARMV8_TARGET __attribute__((target("crypto")))
+#else
+#define MULTIPASS_SHA256_ARMV8_TARGET __attribute__((target("+crypto")))
+#endif
+
+bool has_sha_instructions()
+{
+#if defined(__linux__)
+    return getauxval(AT_HWCAP) & HWCAP_SHA2;
+#elif defined(__APPLE__)
+    return true;
+#else
+    return false;
+#endif
+}
+
+MULTIPASS_SHA256_ARMV8_TARGET void compress_armv8(uint32_t* state, const unsigned char* blocks, std::size_t count)
+{
+    auto abcd = vld1q_u32(state);
+    auto efgh = vld1q_u32(state + 4);
+
+    for (; count; --count, blocks += 64)
+    {
+        const auto abcd_before = abcd;
+        const auto efgh_before = efgh;
+
+        uint32x4_t message[4];
+        for (auto i = 0; i < 16; ++i)
+        {
+            auto& words = message[i & 3];
+            if (i < 4)
+                words = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(blocks + 16 * i)));
+            else
+                words = vsha256su1q_u32(vsha256su0q_u32(words, message[(i + 1) & 3]), message[(i + 2) & 3],
+                                        message[(i + 3) & 3]);
+
+            const auto sums = vaddq_u32(words, vld1q_u32(round_constants + 4 * i));
+            const auto abcd_in = abcd;
+            abcd = vsha256hq_u32(abcd, efgh, sums);
+            efgh = vsha256h2q_u32(efgh, abcd_in, sums);
+        }
+
+        abcd = vaddq_u32(abcd, abcd_before);
+        efgh = vaddq_u32(efgh, efgh_before);
+    }
+
+    vst1q_u32(state, abcd);
+    vst1q_u32(state + 4, efgh);
+}
+#endif
+
+CompressFunction compress_function()
+{
+#if defined(MULTIPASS_SHA256_X86)
+    if (has_sha_instructions())
+        return compress_x86;
+#elif defined(MULTIPASS_SHA256_ARMV8)
+    if (has_sha_instructions())
+        return compress_armv8;
+#endif
+    return compress_portable;
+}
+
+void compress(uint32_t* state, const unsigned char* blocks, std::size_t count)
+{
+    static const auto function = compress_function();
+    function(state, blocks, count);
+}
+} // namespace
+
+mp::Sha256::Sha256()
+    : state{{0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19}}
+{
+}
+
+void mp::Sha256::add_data(const char* data, std::size_t size)
+{
+    auto bytes = reinterpret_cast<const unsigned char*>(data);
+    total_size += size;
+
+    if (block_size)
+    {
+        const auto taken = std::min(size, block.size() - block_size);
+        std::memcpy(block.data() + block_size, bytes, taken);
+        block_size += taken;
+        bytes += taken;
+        size -= taken;
+
+        if (block_size < block.size())
+            return;
+
+        compress(state.data(), block.data(), 1);
+        block_size = 0;
+    }
+
+    // Whole blocks are hashed where they are, without going through the buffer
+    const auto whole_blocks = size / block.size();
+    if (whole_blocks)
+        compress(state.data(), bytes, whole_blocks);
+
+    block_size = size % block.size();
+    std::memcpy(block.data(), bytes + whole_blocks * block.size(), block_size);
+}
+
+void mp::Sha256::add_data(const QByteArray& data)
+{
+    add_data(data.constData(), data.size());
+}
+
+QByteArray mp::Sha256::result()
+{
+    const auto size_in_bits = total_size * 8;
+
+    std::array<unsigned char, 72> padding{{0x80}};
+    const auto padding_size = (block_size < 56 ? 56 : 120) - block_size;
+    add_data(reinterpret_cast<const char*>(padding.data()), padding_size);
+
+    std::array<unsigned char, 8> length;
+    for (auto i = 0; i < 8; ++i)
+        length[i] = static_cast<unsigned char>(size_in_bits >> (56 - 8 * i));
+    add_data(reinterpret_cast<const char*>(length.data()), length.size());
+
+    QByteArray digest(32, '\0');
+    for (auto i = 0; i < 8; ++i)
+        for (auto j = 0; j < 4; ++j)
+            digest[4 * i + j] = static_cast<char>(state[i] >> (24 - 8 * j));
+
+    return digest;
+}
+
+QByteArray mp::sha256_of_file(const QString& path)
+{
+    QFile file{path};
+    if (!file.open(QIODevice::ReadOnly))
+        throw std::runtime_error(fmt::format("cannot open {} to hash it: {}", path, file.errorString()));
+
+    Sha256 hash;
+    QByteArray chunk(file_chunk_size, '\0');
+    qint64 read;
+    while ((read = file.read(chunk.data(), chunk.size())) > 0)
+        hash.add_data(chunk.constData(), read);
+
+    if (read < 0)
+        throw std::runtime_error(fmt::format("cannot read {} to hash it: {}", path, file.errorString()));
+
+    return hash.result().toHex();
+}
+
+std::vector<QByteArray> mp::sha256_of_files(const std::vector<QString>& paths)
+{
+    std::vector<std::future<QByteArray>> hashes;
+    for (const auto& path : paths)
+        hashes.push_back(std::async(std::launch::async, [&path] { return sha256_of_file(path); }));
+
+    std::vector<QByteArray> digests;
+    for (auto& hash : hashes)
+        digests.push_back(hash.get());
+
+    return digests;
+}
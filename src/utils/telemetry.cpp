@@ -0,0 +1,190 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <multipass/format.h>
+#include <multipass/telemetry.h>
+
+#include <algorithm>
+#include <array>
+#include <sstream>
+
+namespace mp = multipass;
+
+namespace
+{
+// In seconds, from quick RPCs up to slow image downloads and launches
+constexpr std::array<double, 16> bucket_bounds{0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1,
+                                               2.5,   5,    10,    30,   60,  120,  300, 600};
+
+std::string escaped(const std::string& value)
+{
+    std::string escaped;
+    for (auto c : value)
+    {
+        if (c == '\\' || c == '"')
+            escaped += '\\';
+
+        if (c == '\n')
+            escaped += "\\n";
+        else
+            escaped += c;
+    }
+
+    return escaped;
+}
+
+std::string render(const mp::Telemetry::Labels& labels)
+{
+    std::string rendered;
+    for (const auto& label : labels)
+        rendered += fmt::format("{}{}=\"{}\"", rendered.empty() ? "" : ",", label.first, escaped(label.second));
+
+    return rendered;
+}
+
+std::string series(const std::string& name, const std::string& labels)
+{
+    return labels.empty() ? name : fmt::format("{}{{{}}}", name, labels);
+}
+} // namespace
+
+mp::Telemetry::Timer::Timer(Telemetry& telemetry, std::string name, Labels labels)
+    : telemetry{telemetry}, name{std::move(name)}, labels{std::move(labels)}, start{std::chrono::steady_clock::now()}
+{
+}
+
+mp::Telemetry::Timer::~Timer()
+{
+    telemetry.observe(name, labels, std::chrono::steady_clock::now() - start);
+}
+
+mp::Telemetry::Telemetry(const Singleton<Telemetry>::PrivatePass& pass) : Singleton<Telemetry>::Singleton{pass}
+{
+}
+
+void mp::Telemetry::count(const std::string& name, const Labels& labels, double amount)
+{
+    std::lock_guard<decltype(mutex)> lock{mutex};
+    counters[name][render(labels)] += amount;
+}
+
+void mp::Telemetry::set(const std::string& name, const Labels& labels, double total)
+{
+    std::lock_guard<decltype(mutex)> lock{mutex};
+    counters[name][render(labels)] = total;
+}
+
+void mp::Telemetry::observe(const std::string& name, const Labels& labels,
+                            std::chrono::steady_clock::duration duration)
+{
+    const auto seconds = std::chrono::duration<double>(duration).count();
+    const auto bucket = std::lower_bound(bucket_bounds.begin(), bucket_bounds.end(), seconds) - bucket_bounds.begin();
+
+    std::lock_guard<decltype(mutex)> lock{mutex};
+    auto& histogram = histograms[name][render(labels)];
+    if (histogram.buckets.empty())
+        histogram.buckets.resize(bucket_bounds.size() + 1);
+
+    ++histogram.buckets[bucket];
+    histogram.sum += seconds;
+    ++histogram.count;
+}
+
+mp::Telemetry::Timer mp::Telemetry::time(std::string name, Labels labels)
+{
+    return {*this, std::move(name), std::move(labels)};
+}
+
+std::vector<mp::Telemetry::Sample> mp::Telemetry::samples() const
+{
+    std::vector<Sample> samples;
+
+    std::lock_guard<decltype(mutex)> lock{mutex};
+    for (const auto& counter : counters)
+        for (const auto& sample : counter.second)
+            samples.push_back({counter.first, sample.first, sample.second});
+
+    for (const auto& histogram : histograms)
+        append_histogram_samples(histogram.first, samples);
+
+    for (const auto& histogram : forwarded_histograms)
+        for (const auto& sample : histogram.second)
+            samples.push_back({sample.first.first, sample.first.second, sample.second, histogram.first});
+
+    return samples;
+}
+
+void mp::Telemetry::set(const Sample& sample)
+{
+    std::lock_guard<decltype(mutex)> lock{mutex};
+    if (sample.histogram.empty())
+        counters[sample.name][sample.labels] = sample.value;
+    else
+        forwarded_histograms[sample.histogram][{sample.name, sample.labels}] = sample.value;
+}
+
+std::string mp::Telemetry::exposition() const
+{
+    std::ostringstream out;
+
+    std::lock_guard<decltype(mutex)> lock{mutex};
+    for (const auto& counter : counters)
+    {
+        out << "# TYPE " << counter.first << " counter\n";
+        for (const auto& sample : counter.second)
+            out << fmt::format("{} {}\n", series(counter.first, sample.first), sample.second);
+    }
+
+    // Those kept here and those taken in from elsewhere go under one TYPE line each
+    std::map<std::string, std::vector<Sample>> histogram_samples;
+    for (const auto& histogram : histograms)
+        append_histogram_samples(histogram.first, histogram_samples[histogram.first]);
+
+    for (const auto& histogram : forwarded_histograms)
+        for (const auto& sample : histogram.second)
+            histogram_samples[histogram.first].push_back(
+                {sample.first.first, sample.first.second, sample.second, histogram.first});
+
+    for (const auto& histogram : histogram_samples)
+    {
+        out << "# TYPE " << histogram.first << " histogram\n";
+        for (const auto& sample : histogram.second)
+            out << fmt::format("{} {}\n", series(sample.name, sample.labels), sample.value);
+    }
+
+    return out.str();
+}
+
+void mp::Telemetry::append_histogram_samples(const std::string& name, std::vector<Sample>& samples) const
+{
+    for (const auto& sample : histograms.at(name))
+    {
+        const auto& labels = sample.first;
+        const auto& histogram = sample.second;
+
+        unsigned long long cumulative = 0;
+        for (std::size_t i = 0; i < histogram.buckets.size(); ++i)
+        {
+            cumulative += histogram.buckets[i];
+            auto bound = i < bucket_bounds.size() ? fmt::format("{}", bucket_bounds[i]) : std::string{"+Inf"};
+            samples.push_back({name + "_bucket", fmt::format("{}{}le=\"{}\"", labels, labels.empty() ? "" : ",", bound),
+                               static_cast<double>(cumulative), name});
+        }
+        samples.push_back({name + "_sum", labels, histogram.sum, name});
+        samples.push_back({name + "_count", labels, static_cast<double>(histogram.count), name});
+    }
+}
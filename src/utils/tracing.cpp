@@ -0,0 +1,213 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <multipass/constants.h>
+#include <multipass/format.h>
+#include <multipass/tracing.h>
+
+#include <QCoreApplication>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include <functional>
+#include <random>
+#include <thread>
+
+namespace mp = multipass;
+
+namespace
+{
+thread_local const mp::Tracer::Span* current_span{nullptr};
+
+std::string random_hex(int digits)
+{
+    thread_local std::mt19937_64 generator{std::random_device{}()};
+
+    std::string hex;
+    while (static_cast<int>(hex.size()) < digits)
+        hex += fmt::format("{:016x}", generator());
+
+    return hex.substr(0, digits);
+}
+
+double microseconds_since_epoch(std::chrono::system_clock::time_point time)
+{
+    return std::chrono::duration<double, std::micro>(time.time_since_epoch()).count();
+}
+} // namespace
+
+bool mp::Tracer::Context::valid() const
+{
+    return !trace_id.empty() && !span_id.empty();
+}
+
+std::string mp::Tracer::Context::serialised() const
+{
+    return valid() ? fmt::format("{}-{}", trace_id, span_id) : std::string{};
+}
+
+mp::Tracer::Context mp::Tracer::Context::deserialised(const std::string& serialised)
+{
+    const auto separator = serialised.find('-');
+    if (separator == std::string::npos)
+        return {};
+
+    return {serialised.substr(0, separator), serialised.substr(separator + 1)};
+}
+
+mp::Tracer::Span::Span(Tracer& tracer, std::string name, const Context& parent, Args args)
+    : tracer{tracer},
+      recording{tracer.enabled()},
+      name{std::move(name)},
+      args{std::move(args)},
+      parent{parent},
+      enclosing{current_span},
+      start{std::chrono::system_clock::now()}
+{
+    if (!recording)
+        return;
+
+    own.trace_id = parent.valid() ? parent.trace_id : random_hex(32);
+    own.span_id = random_hex(16);
+    current_span = this;
+}
+
+mp::Tracer::Span::~Span()
+{
+    if (!recording)
+        return;
+
+    current_span = enclosing;
+    if (handed_over_key)
+    {
+        std::lock_guard<decltype(tracer.mutex)> lock{tracer.mutex};
+        tracer.handed_over_contexts.erase(handed_over_key);
+    }
+
+    QJsonObject event_args;
+    for (const auto& arg : args)
+        event_args.insert(QString::fromStdString(arg.first), QString::fromStdString(arg.second));
+    event_args.insert("trace_id", QString::fromStdString(own.trace_id));
+    event_args.insert("span_id", QString::fromStdString(own.span_id));
+    if (parent.valid())
+        event_args.insert("parent_id", QString::fromStdString(parent.span_id));
+
+    // Complete events, which viewers nest by time within each thread
+    QJsonObject event;
+    event.insert("name", QString::fromStdString(name));
+    event.insert("cat", "multipass");
+    event.insert("ph", "X");
+    event.insert("ts", microseconds_since_epoch(start)); // the wall clock lines processes up with each other
+    event.insert("dur", microseconds_since_epoch(std::chrono::system_clock::now()) - microseconds_since_epoch(start));
+    event.insert("pid", QCoreApplication::applicationPid());
+    event.insert("tid", static_cast<qint64>(std::hash<std::thread::id>{}(std::this_thread::get_id()) & 0xffffffff));
+    event.insert("args", event_args);
+
+    tracer.write(QJsonDocument{event}.toJson(QJsonDocument::Compact).toStdString());
+}
+
+const mp::Tracer::Context& mp::Tracer::Span::context() const
+{
+    return own;
+}
+
+void mp::Tracer::Span::hand_over(const void* key)
+{
+    if (!recording)
+        return;
+
+    std::lock_guard<decltype(tracer.mutex)> lock{tracer.mutex};
+    tracer.handed_over_contexts[key] = own;
+    handed_over_key = key;
+}
+
+void mp::Tracer::Span::annotate(const std::string& key, const std::string& value)
+{
+    if (recording)
+        args[key] = value;
+}
+
+mp::Tracer::Tracer(const Singleton<Tracer>::PrivatePass& pass)
+    : Singleton<Tracer>::Singleton{pass},
+      process_parent{Context::deserialised(qgetenv(trace_parent_env_var).toStdString())}
+{
+    trace_to(qgetenv(trace_file_env_var).toStdString());
+}
+
+mp::Tracer::~Tracer()
+{
+    trace_to({});
+}
+
+bool mp::Tracer::enabled() const
+{
+    return tracing.load(std::memory_order_relaxed);
+}
+
+void mp::Tracer::trace_to(const std::string& path)
+{
+    std::lock_guard<decltype(mutex)> lock{mutex};
+    if (file)
+        std::fclose(file);
+
+    // Appending lets every process write to the same file. The closing bracket is optional in this format, which is
+    // what lets them
+    file = path.empty() ? nullptr : std::fopen(path.c_str(), "a");
+    if (file && std::fseek(file, 0, SEEK_END) == 0 && std::ftell(file) == 0)
+        std::fputs("[\n", file);
+
+    tracing = file != nullptr;
+}
+
+mp::Tracer::Span mp::Tracer::span(std::string name, Args args)
+{
+    return span(current(), std::move(name), std::move(args));
+}
+
+mp::Tracer::Span mp::Tracer::span(const Context& parent, std::string name, Args args)
+{
+    return {*this, std::move(name), parent, std::move(args)};
+}
+
+mp::Tracer::Context mp::Tracer::current() const
+{
+    return current_span ? current_span->context() : process_parent;
+}
+
+mp::Tracer::Context mp::Tracer::handed_over(const void* key) const
+{
+    {
+        std::lock_guard<decltype(mutex)> lock{mutex};
+        auto it = handed_over_contexts.find(key);
+        if (it != handed_over_contexts.end())
+            return it->second;
+    }
+
+    return current();
+}
+
+void mp::Tracer::write(const std::string& event)
+{
+    std::lock_guard<decltype(mutex)> lock{mutex};
+    if (!file)
+        return;
+
+    // Whole lines at once, so that processes appending to the same file do not interleave within an event
+    const auto line = event + ",\n";
+    std::fwrite(line.data(), 1, line.size(), file);
+    std::fflush(file);
+}
@@ -29,12 +29,14 @@
 #include <QProcess>
 #include <QStandardPaths>
 #include <QUuid>
+#include <QtEndian>
 #include <QtGlobal>
 
 #include <algorithm>
 #include <array>
 #include <cassert>
 #include <cctype>
+#include <cstring>
 #include <fstream>
 #include <random>
 #include <regex>
@@ -45,6 +47,15 @@ namespace mpl = multipass::logging;
 
 namespace
 {
+constexpr qint64 sparse_block_size = 4096;
+constexpr auto qcow2_magic = "QFI\xfb";
+constexpr quint32 qcow2_max_backing_file_size = 1023; // as qemu has it, longer names are corrupt or crafted
+
+bool is_zero_block(const char* data, qint64 size)
+{
+    return data[0] == 0 && std::memcmp(data, data + 1, size - 1) == 0;
+}
+
 auto quote_for(const std::string& arg, mp::utils::QuoteType quote_type)
 {
     if (quote_type == mp::utils::QuoteType::no_quotes)
@@ -190,6 +201,9 @@ void mp::utils::wait_until_ssh_up(VirtualMachine* virtual_machine, std::chrono::
 void mp::utils::wait_for_cloud_init(mp::VirtualMachine* virtual_machine, std::chrono::milliseconds timeout,
                                     const mp::SSHKeyProvider& key_provider)
 {
+    if (virtual_machine->wait_for_guest_ready(timeout))
+        return;
+
     auto action = [virtual_machine, &key_provider] {
         virtual_machine->ensure_vm_is_running();
         try
@@ -311,6 +325,24 @@ void mp::utils::validate_server_address(const std::string& address)
         throw std::runtime_error(fmt::format("invalid port number in address '{}'", address));
 }
 
+// The local socket next to the daemon's unix socket that skips TLS; empty for addresses that are not unix sockets
+std::string mp::utils::plain_socket_address(const std::string& server_address)
+{
+    const auto tokens = mp::utils::split(server_address, ":");
+    if (tokens.size() != 2u || tokens[0] != "unix")
+        return {};
+
+    return fmt::format("{}-plain", server_address);
+}
+
+// Whether the daemon, and so its instances, sit across a network rather than on this machine
+bool mp::utils::is_remote_server_address(const std::string& server_address)
+{
+    const auto host = server_address.substr(0, server_address.rfind(':'));
+    return server_address.compare(0, 5, "unix:") != 0 && host != "localhost" && host.compare(0, 4, "127.") != 0 &&
+           host != "[::1]";
+}
+
 std::string mp::utils::filename_for(const std::string& path)
 {
     return QFileInfo(QString::fromStdString(path)).fileName().toStdString();
@@ -342,3 +374,126 @@ void mp::utils::check_and_create_config_file(const QString& config_file_path)
         config_file.open(QIODevice::WriteOnly);
     }
 }
+
+qint64 mp::utils::write_sparse(QFile& file, const char* data, qint64 size)
+{
+    qint64 pos{0};
+    while (pos < size)
+    {
+        auto hole_end = pos;
+        while (hole_end + sparse_block_size <= size && is_zero_block(data + hole_end, sparse_block_size))
+            hole_end += sparse_block_size;
+
+        if (hole_end > pos)
+        {
+            if (!file.seek(file.pos() + hole_end - pos))
+                return -1;
+
+            pos = hole_end;
+            continue;
+        }
+
+        // Write everything up to the next zero block in one go
+        auto data_end = pos;
+        do
+        {
+            data_end = std::min(data_end + sparse_block_size, size);
+        } while (data_end < size &&
+                 (data_end + sparse_block_size > size || !is_zero_block(data + data_end, sparse_block_size)));
+
+        if (file.write(data + pos, data_end - pos) != data_end - pos)
+            return -1;
+
+        pos = data_end;
+    }
+
+    return size;
+}
+
+bool mp::utils::finish_sparse_write(QFile& file)
+{
+    return file.size() >= file.pos() || file.resize(file.pos());
+}
+
+std::map<std::string, int> mp::utils::parse_counts(const QString& spec)
+{
+    std::map<std::string, int> counts;
+    for (const auto& entry : spec.split(',', QString::SkipEmptyParts))
+    {
+        const auto name_and_count = entry.trimmed().split('=');
+        auto valid_count = false;
+        const auto count = name_and_count.size() == 2 ? name_and_count.last().toInt(&valid_count) : 0;
+
+        if (!valid_count || count < 0 || name_and_count.first().isEmpty())
+            throw std::runtime_error(fmt::format("Invalid entry \"{}\"", entry));
+
+        counts[name_and_count.first().toStdString()] = count;
+    }
+
+    return counts;
+}
+
+std::map<std::string, int> mp::utils::parse_warm_pool(const QString& spec)
+{
+    return parse_counts(spec);
+}
+
+bool mp::utils::is_qcow2_image(const QString& image_path)
+{
+    QFile image{image_path};
+    return image.open(QIODevice::ReadOnly) && image.read(4) == qcow2_magic;
+}
+
+QString mp::utils::qcow2_backing_file(const QString& image_path)
+{
+    // Header layout from qemu's docs/interop/qcow2.txt: magic, version, backing_file_offset (u64), backing_file_size
+    // (u32), all big-endian
+    QFile image{image_path};
+    if (!image.open(QIODevice::ReadOnly))
+        return {};
+
+    const auto header = image.read(20);
+    if (header.size() < 20 || !header.startsWith(qcow2_magic))
+        return {};
+
+    const auto offset = qFromBigEndian<quint64>(header.constData() + 8);
+    const auto size = qFromBigEndian<quint32>(header.constData() + 16);
+    if (offset == 0 || size == 0 || size > qcow2_max_backing_file_size || !image.seek(static_cast<qint64>(offset)))
+        return {};
+
+    const auto name = image.read(size);
+    if (name.size() != static_cast<int>(size))
+        return {};
+
+    return QString::fromUtf8(name);
+}
+
+quint64 mp::utils::qcow2_virtual_size(const QString& image_path)
+{
+    // The virtual size follows cluster_bits in the header, also a big-endian u64
+    QFile image{image_path};
+    if (!image.open(QIODevice::ReadOnly))
+        return 0;
+
+    const auto header = image.read(32);
+    if (header.size() < 32 || !header.startsWith(qcow2_magic))
+        return 0;
+
+    return qFromBigEndian<quint64>(header.constData() + 24);
+}
+
+bool mp::utils::is_zstd_compressed_qcow2(const QString& image_path)
+{
+    // Version 3 headers flag a compression_type byte at offset 104 with incompatible feature bit 3; zstd is type 1
+    QFile image{image_path};
+    if (!image.open(QIODevice::ReadOnly))
+        return false;
+
+    const auto header = image.read(105);
+    if (header.size() < 105 || !header.startsWith(qcow2_magic) || qFromBigEndian<quint32>(header.constData() + 4) < 3)
+        return false;
+
+    const auto incompatible_features = qFromBigEndian<quint64>(header.constData() + 72);
+    const auto header_length = qFromBigEndian<quint32>(header.constData() + 100);
+    return (incompatible_features & (1u << 3)) && header_length > 104 && header.at(104) == 1;
+}
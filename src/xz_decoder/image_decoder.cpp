@@ -0,0 +1,228 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <multipass/image_decoder.h>
+#include <multipass/xz_image_decoder.h>
+#include <multipass/zstd_image_decoder.h>
+
+#include <multipass/format.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace mp = multipass;
+
+namespace
+{
+constexpr auto max_queued_chunks = 64u;
+
+enum class Compression
+{
+    none,
+    xz,
+    zstd
+};
+
+Compression compression_of(const QString& image_path)
+{
+    if (image_path.endsWith(".xz"))
+        return Compression::xz;
+    if (image_path.endsWith(".zst") || image_path.endsWith(".zstd"))
+        return Compression::zstd;
+
+    return Compression::none;
+}
+} // namespace
+
+mp::DecodePipeline::DecodePipeline(Decoder decoder) : decoder{std::move(decoder)}, worker{[this] { work(); }}
+{
+}
+
+mp::DecodePipeline::~DecodePipeline()
+{
+    {
+        std::lock_guard<std::mutex> lock{queue_mutex};
+        input_done = true;
+        queue.clear();
+    }
+    queue_cv.notify_all();
+}
+
+void mp::DecodePipeline::feed(const QByteArray& chunk)
+{
+    std::unique_lock<std::mutex> lock{queue_mutex};
+    queue_cv.wait(lock, [this] { return queue.size() < max_queued_chunks || worker_done; });
+
+    if (!worker_done)
+        queue.push_back(chunk);
+
+    queue_cv.notify_all();
+}
+
+void mp::DecodePipeline::finish()
+{
+    {
+        std::lock_guard<std::mutex> lock{queue_mutex};
+        input_done = true;
+    }
+    queue_cv.notify_all();
+
+    if (worker.thread.joinable())
+        worker.thread.join();
+
+    if (decode_error)
+        std::rethrow_exception(decode_error);
+}
+
+void mp::DecodePipeline::work()
+{
+    try
+    {
+        decoder([this](QByteArray& chunk) { return next_chunk(chunk); });
+    }
+    catch (...)
+    {
+        std::lock_guard<std::mutex> lock{queue_mutex};
+        decode_error = std::current_exception();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock{queue_mutex};
+        worker_done = true;
+        queue.clear();
+    }
+    queue_cv.notify_all();
+}
+
+bool mp::DecodePipeline::next_chunk(QByteArray& chunk)
+{
+    {
+        std::unique_lock<std::mutex> lock{queue_mutex};
+        queue_cv.wait(lock, [this] { return !queue.empty() || input_done; });
+
+        if (queue.empty())
+            return false;
+
+        chunk = queue.front();
+        queue.pop_front();
+    }
+    queue_cv.notify_all();
+
+    return true;
+}
+
+std::size_t mp::threads_within_decode_budget(unsigned long long part_footprint)
+{
+    return std::max<std::size_t>(1, parallel_decode_budget / std::max<unsigned long long>(part_footprint, 1));
+}
+
+void mp::decode_in_parallel(std::size_t count, const std::function<void(std::size_t)>& decode_part,
+                            const ProgressMonitor& monitor, std::size_t max_threads)
+{
+    auto thread_count = std::min<std::size_t>(count, std::max(1u, std::thread::hardware_concurrency()));
+    if (max_threads > 0)
+        thread_count = std::min(thread_count, max_threads);
+    std::atomic<std::size_t> next_part{0};
+    std::atomic<std::size_t> parts_done{0};
+    std::atomic_bool failed{false};
+    std::mutex error_mutex;
+    std::condition_variable done_cv;
+    std::exception_ptr error;
+
+    auto work = [&] {
+        for (auto i = next_part++; i < count && !failed; i = next_part++)
+        {
+            try
+            {
+                decode_part(i);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock{error_mutex};
+                if (!error)
+                    error = std::current_exception();
+                failed = true;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock{error_mutex};
+                ++parts_done;
+            }
+            done_cv.notify_all();
+        }
+    };
+
+    {
+        std::vector<std::unique_ptr<AutoJoinThread>> workers;
+        for (std::size_t i = 0; i < thread_count; ++i)
+            workers.push_back(std::make_unique<AutoJoinThread>(work));
+
+        std::unique_lock<std::mutex> lock{error_mutex};
+        auto last_reported = parts_done.load();
+        while (parts_done < count && !failed)
+        {
+            done_cv.wait(lock, [&] { return parts_done != last_reported || failed; });
+            last_reported = parts_done;
+            monitor(LaunchProgress::EXTRACT, static_cast<int>(100 * last_reported / count));
+        }
+    }
+
+    if (error)
+        std::rethrow_exception(error);
+}
+
+bool mp::is_compressed_image(const QString& image_path)
+{
+    return compression_of(image_path) != Compression::none;
+}
+
+QString mp::decoded_image_path(const QString& compressed_image_path)
+{
+    if (!is_compressed_image(compressed_image_path))
+        return compressed_image_path;
+
+    return compressed_image_path.left(compressed_image_path.lastIndexOf('.'));
+}
+
+mp::ImageDecoder::UPtr mp::make_image_decoder(const Path& compressed_file_path)
+{
+    switch (compression_of(compressed_file_path))
+    {
+    case Compression::xz:
+        return std::make_unique<XzImageDecoder>(compressed_file_path);
+    case Compression::zstd:
+        return std::make_unique<ZstdImageDecoder>(compressed_file_path);
+    default:
+        throw std::runtime_error(fmt::format("{} is not a compressed image", compressed_file_path));
+    }
+}
+
+mp::PipelinedImageDecoder::UPtr mp::make_pipelined_image_decoder(const Path& compressed_file_path,
+                                                                 const Path& decoded_file_path)
+{
+    switch (compression_of(compressed_file_path))
+    {
+    case Compression::xz:
+        return std::make_unique<PipelinedXzDecoder>(decoded_file_path);
+    case Compression::zstd:
+        return std::make_unique<PipelinedZstdDecoder>(decoded_file_path);
+    default:
+        throw std::runtime_error(fmt::format("{} is not a compressed image", compressed_file_path));
+    }
+}
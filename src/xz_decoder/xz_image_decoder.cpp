@@ -18,6 +18,7 @@
 #include <multipass/xz_image_decoder.h>
 
 #include <multipass/rpc/multipass.grpc.pb.h>
+#include <multipass/utils.h>
 
 #include <multipass/format.h>
 
@@ -52,6 +53,188 @@ bool verify_decode(const xz_ret& ret)
 
     return true;
 }
+
+constexpr auto stream_header_size = 12;
+constexpr auto stream_footer_size = 12;
+// Blocks larger than this are not worth holding in memory for parallel decoding
+constexpr uint64_t max_parallel_block_size = 256 * 1024 * 1024;
+// More blocks than any image needs, which bounds what of an index is held in memory: its indicator, record count,
+// records of two varints of at most 9 bytes each, padding and CRC32
+constexpr uint64_t max_parallel_blocks = 64 * 1024;
+constexpr qint64 max_index_size = 1 + 9 + max_parallel_blocks * 2 * 9 + 3 + 4;
+
+struct XzBlock
+{
+    qint64 compressed_offset;
+    uint64_t unpadded_size;
+    qint64 uncompressed_offset;
+    uint64_t uncompressed_size;
+};
+
+uint64_t padded(uint64_t size)
+{
+    return (size + 3) & ~uint64_t{3};
+}
+
+uint32_t read_le32(const unsigned char* data)
+{
+    return data[0] | (data[1] << 8) | (data[2] << 16) | (static_cast<uint32_t>(data[3]) << 24);
+}
+
+void append_le32(QByteArray& data, uint32_t value)
+{
+    for (auto i = 0; i < 4; ++i)
+        data.append(static_cast<char>((value >> (8 * i)) & 0xFF));
+}
+
+bool read_varint(const unsigned char*& pos, const unsigned char* end, uint64_t& value)
+{
+    value = 0;
+    for (auto shift = 0; pos < end && shift < 63; shift += 7)
+    {
+        const auto byte = *pos++;
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+
+    return false;
+}
+
+void append_varint(QByteArray& data, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        data.append(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    data.append(static_cast<char>(value));
+}
+
+// Reads the block layout from the index of a single-stream .xz file. Returns nothing for anything else (multiple
+// streams, stream padding, a damaged index) so that those fall back to plain streaming.
+std::vector<XzBlock> read_block_index(QFile& xz_file, QByteArray& stream_header)
+{
+    const auto file_size = xz_file.size();
+    if (file_size < stream_header_size + stream_footer_size)
+        return {};
+
+    xz_file.seek(0);
+    stream_header = xz_file.read(stream_header_size);
+    xz_file.seek(file_size - stream_footer_size);
+    const auto footer = xz_file.read(stream_footer_size);
+    if (stream_header.size() != stream_header_size || footer.size() != stream_footer_size || !footer.endsWith("YZ"))
+        return {};
+
+    const auto footer_data = reinterpret_cast<const unsigned char*>(footer.constData());
+    // The stream flags in the footer must match the ones in the header
+    if (footer.mid(8, 2) != stream_header.mid(6, 2) || xz_crc32(footer_data + 4, 6, 0) != read_le32(footer_data))
+        return {};
+
+    const auto index_size = (static_cast<qint64>(read_le32(footer_data + 4)) + 1) * 4;
+    const auto index_offset = file_size - stream_footer_size - index_size;
+    if (index_offset < stream_header_size || index_size > max_index_size)
+        return {};
+
+    xz_file.seek(index_offset);
+    const auto index = xz_file.read(index_size);
+    if (index.size() != index_size || index.at(0) != 0)
+        return {};
+
+    const auto index_data = reinterpret_cast<const unsigned char*>(index.constData());
+    if (xz_crc32(index_data, index_size - 4, 0) != read_le32(index_data + index_size - 4))
+        return {};
+
+    auto pos = index_data + 1;
+    const auto end = index_data + index_size - 4;
+    // Each record takes two bytes at least, so a count the index cannot hold is as damaged as one too large
+    uint64_t record_count;
+    if (!read_varint(pos, end, record_count) || record_count > max_parallel_blocks ||
+        record_count > static_cast<uint64_t>(end - pos) / 2)
+        return {};
+
+    std::vector<XzBlock> blocks;
+    blocks.reserve(record_count);
+    qint64 compressed_offset{stream_header_size}, uncompressed_offset{0};
+    for (uint64_t i = 0; i < record_count; ++i)
+    {
+        uint64_t unpadded_size, uncompressed_size;
+        if (!read_varint(pos, end, unpadded_size) || !read_varint(pos, end, uncompressed_size) ||
+            uncompressed_size > max_parallel_block_size || unpadded_size > static_cast<uint64_t>(index_offset))
+            return {};
+
+        blocks.push_back({compressed_offset, unpadded_size, uncompressed_offset, uncompressed_size});
+        compressed_offset += padded(unpadded_size);
+        uncompressed_offset += uncompressed_size;
+    }
+
+    if (compressed_offset != index_offset)
+        return {};
+
+    return blocks;
+}
+
+// Wraps one block of the original stream into a stream of its own, so that xz-embedded can decode it independently
+QByteArray make_single_block_stream(const QByteArray& stream_header, const QByteArray& block, const XzBlock& info)
+{
+    QByteArray index;
+    index.append('\0');
+    append_varint(index, 1);
+    append_varint(index, info.unpadded_size);
+    append_varint(index, info.uncompressed_size);
+    while (index.size() % 4)
+        index.append('\0');
+    append_le32(index, xz_crc32(reinterpret_cast<const uint8_t*>(index.constData()), index.size(), 0));
+
+    QByteArray footer_fields;
+    append_le32(footer_fields, index.size() / 4 - 1);
+    footer_fields.append(stream_header.mid(6, 2));
+
+    QByteArray stream{stream_header};
+    stream.append(block);
+    stream.append(index);
+    append_le32(stream, xz_crc32(reinterpret_cast<const uint8_t*>(footer_fields.constData()), footer_fields.size(), 0));
+    stream.append(footer_fields);
+    stream.append("YZ");
+
+    return stream;
+}
+
+void decode_block(const QString& xz_file_path, const QString& decoded_file_path, const QByteArray& stream_header,
+                  const XzBlock& info)
+{
+    QFile xz_file{xz_file_path};
+    QFile decoded_file{decoded_file_path};
+    if (!xz_file.open(QIODevice::ReadOnly) || !decoded_file.open(QIODevice::ReadWrite))
+        throw std::runtime_error(fmt::format("failed to open {} for parallel decoding", xz_file_path));
+
+    xz_file.seek(info.compressed_offset);
+    const auto block = xz_file.read(padded(info.unpadded_size));
+    if (static_cast<uint64_t>(block.size()) != padded(info.unpadded_size))
+        throw std::runtime_error("xz file is corrupt");
+
+    const auto stream = make_single_block_stream(stream_header, block, info);
+    std::vector<unsigned char> decoded(info.uncompressed_size);
+
+    mp::XzImageDecoder::XzDecoderUPtr xz_decoder{xz_dec_init(XZ_SINGLE, 0), xz_dec_end};
+    struct xz_buf decode_buf
+    {
+    };
+    decode_buf.in = reinterpret_cast<const unsigned char*>(stream.constData());
+    decode_buf.in_size = stream.size();
+    decode_buf.out = decoded.data();
+    decode_buf.out_size = decoded.size();
+
+    if (xz_dec_run(xz_decoder.get(), &decode_buf) != XZ_STREAM_END || decode_buf.out_pos != decoded.size())
+        throw std::runtime_error("xz file is corrupt");
+
+    // The output was preallocated as a hole, so zero blocks need no writing at all
+    if (!decoded_file.seek(info.uncompressed_offset) ||
+        mp::utils::write_sparse(decoded_file, reinterpret_cast<const char*>(decoded.data()), decoded.size()) < 0)
+        throw std::runtime_error(
+            fmt::format("error writing {}: {}", decoded_file.fileName(), decoded_file.errorString()));
+}
+
 } // namespace
 
 mp::XzImageDecoder::XzImageDecoder(const Path& xz_file_path)
@@ -70,6 +253,27 @@ void mp::XzImageDecoder::decode_to(const Path& decoded_image_path, const Progres
     if (!decoded_file.open(QIODevice::WriteOnly))
         throw std::runtime_error(fmt::format("failed to open {} for writing", decoded_file.fileName()));
 
+    // Files made of several independent blocks (e.g. by `xz -T`) get their blocks decoded concurrently
+    QByteArray stream_header;
+    const auto blocks = read_block_index(xz_file, stream_header);
+    if (blocks.size() > 1)
+    {
+        if (!decoded_file.resize(blocks.back().uncompressed_offset + blocks.back().uncompressed_size))
+            throw std::runtime_error(fmt::format("failed to allocate {}", decoded_file.fileName()));
+
+        // Each block is held compressed, again as the stream made of it, and decoded while it is worked on
+        decoded_file.close();
+        uint64_t largest_footprint = 0;
+        for (const auto& block : blocks)
+            largest_footprint = std::max(largest_footprint, 2 * padded(block.unpadded_size) + block.uncompressed_size);
+        decode_in_parallel(
+            blocks.size(),
+            [&](std::size_t i) { decode_block(xz_file.fileName(), decoded_image_path, stream_header, blocks[i]); },
+            monitor, threads_within_decode_budget(largest_footprint));
+        return;
+    }
+    xz_file.seek(0);
+
     struct xz_buf decode_buf
     {
     };
@@ -102,14 +306,94 @@ void mp::XzImageDecoder::decode_to(const Path& decoded_image_path, const Progres
 
         if (!verify_decode(xz_dec_run(xz_decoder.get(), &decode_buf)))
         {
-            decoded_file.write(write_data.data(), decode_buf.out_pos);
+            if (mp::utils::write_sparse(decoded_file, write_data.data(), decode_buf.out_pos) < 0 ||
+                !mp::utils::finish_sparse_write(decoded_file))
+                throw std::runtime_error(fmt::format("error writing {}", decoded_file.fileName()));
             return;
         }
 
         if (decode_buf.out_pos == max_size)
         {
-            decoded_file.write(write_data.data(), decode_buf.out_pos);
+            if (mp::utils::write_sparse(decoded_file, write_data.data(), decode_buf.out_pos) < 0)
+                throw std::runtime_error(fmt::format("error writing {}", decoded_file.fileName()));
             decode_buf.out_pos = 0;
         }
     }
 }
+
+mp::PipelinedXzDecoder::PipelinedXzDecoder(const Path& decoded_file_path)
+    : decoded_file{decoded_file_path},
+      xz_decoder{xz_dec_init(XZ_DYNALLOC, 1u << 26), xz_dec_end},
+      pipeline{[this](const DecodePipeline::ChunkSource& next_chunk) { run_decoder(next_chunk); }}
+{
+}
+
+void mp::PipelinedXzDecoder::feed(const QByteArray& chunk)
+{
+    pipeline.feed(chunk);
+}
+
+void mp::PipelinedXzDecoder::finish()
+{
+    pipeline.finish();
+
+    if (!stream_end)
+        throw std::runtime_error("xz file is truncated");
+}
+
+void mp::PipelinedXzDecoder::run_decoder(const DecodePipeline::ChunkSource& next_chunk)
+{
+    xz_crc32_init();
+    xz_crc64_init();
+
+    if (!decoded_file.open(QIODevice::WriteOnly))
+        throw std::runtime_error(fmt::format("failed to open {} for writing", decoded_file.fileName()));
+
+    QByteArray chunk;
+    while (next_chunk(chunk))
+    {
+        if (!chunk.isEmpty() && !decode(chunk))
+            break;
+    }
+
+    if (!mp::utils::finish_sparse_write(decoded_file))
+        throw std::runtime_error(fmt::format("error writing {}", decoded_file.fileName()));
+}
+
+bool mp::PipelinedXzDecoder::decode(const QByteArray& chunk)
+{
+    const auto max_size = 65536u;
+    std::vector<char> write_data(max_size);
+
+    struct xz_buf decode_buf
+    {
+    };
+    decode_buf.in = reinterpret_cast<const unsigned char*>(chunk.constData());
+    decode_buf.in_pos = 0;
+    decode_buf.in_size = chunk.size();
+    decode_buf.out = reinterpret_cast<unsigned char*>(write_data.data());
+    decode_buf.out_pos = 0;
+    decode_buf.out_size = max_size;
+
+    // The decoder keeps its state across chunks, so keep running it until this chunk is consumed and it has no
+    // more output pending
+    bool output_full;
+    do
+    {
+        const auto more = verify_decode(xz_dec_run(xz_decoder.get(), &decode_buf));
+
+        output_full = decode_buf.out_pos == max_size;
+        if (mp::utils::write_sparse(decoded_file, write_data.data(), decode_buf.out_pos) < 0)
+            throw std::runtime_error(
+                fmt::format("error writing {}: {}", decoded_file.fileName(), decoded_file.errorString()));
+        decode_buf.out_pos = 0;
+
+        if (!more)
+        {
+            stream_end = true;
+            return false;
+        }
+    } while (decode_buf.in_pos < decode_buf.in_size || output_full);
+
+    return true;
+}
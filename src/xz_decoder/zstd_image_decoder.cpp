@@ -0,0 +1,229 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <multipass/zstd_image_decoder.h>
+
+#include <multipass/utils.h>
+
+#include <multipass/format.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <zstd_errors.h>
+
+namespace mp = multipass;
+
+namespace
+{
+// The window of `zstd --long`, and thus the memory each decoder takes at most; images asking for more are refused
+constexpr auto max_window_log = 27;
+// Frames larger than this are not worth holding in memory for parallel decoding
+constexpr unsigned long long max_parallel_frame_size = 64 * 1024 * 1024;
+constexpr auto progress_step = 1 << 20;
+
+struct ZstdFrame
+{
+    qint64 compressed_offset;
+    qint64 compressed_size;
+    qint64 decoded_offset;
+    qint64 decoded_size;
+};
+
+mp::ZstdImageDecoder::ZstdDecoderUPtr make_decoder()
+{
+    mp::ZstdImageDecoder::ZstdDecoderUPtr decoder{ZSTD_createDCtx(), ZSTD_freeDCtx};
+    if (!decoder)
+        throw std::runtime_error("zstd decoder memory allocation failed");
+
+    ZSTD_DCtx_setParameter(decoder.get(), ZSTD_d_windowLogMax, max_window_log);
+    return decoder;
+}
+
+size_t verify_decode(size_t ret)
+{
+    if (ZSTD_isError(ret) && ZSTD_getErrorCode(ret) == ZSTD_error_frameParameter_windowTooLarge)
+        throw std::runtime_error(
+            fmt::format("zstd file needs a window over {}MiB to decode", (1 << max_window_log) / (1024 * 1024)));
+    if (ZSTD_isError(ret))
+        throw std::runtime_error(fmt::format("zstd file is corrupt: {}", ZSTD_getErrorName(ret)));
+
+    return ret;
+}
+
+// Reads the frame layout of a .zst file, which only tells where each frame decodes to when every frame records its
+// decoded size. Returns nothing otherwise, or for frames too large to decode in memory, so that those are streamed
+std::vector<ZstdFrame> read_frames(const uchar* data, qint64 size)
+{
+    std::vector<ZstdFrame> frames;
+    qint64 offset{0}, decoded_offset{0};
+    while (offset < size)
+    {
+        const auto frame_size = ZSTD_findFrameCompressedSize(data + offset, size - offset);
+        const auto decoded_size = ZSTD_getFrameContentSize(data + offset, size - offset);
+        if (ZSTD_isError(frame_size) || decoded_size == ZSTD_CONTENTSIZE_UNKNOWN ||
+            decoded_size == ZSTD_CONTENTSIZE_ERROR || decoded_size > max_parallel_frame_size)
+            return {};
+
+        frames.push_back({offset, static_cast<qint64>(frame_size), decoded_offset, static_cast<qint64>(decoded_size)});
+        offset += frame_size;
+        decoded_offset += decoded_size;
+    }
+
+    return frames;
+}
+
+void decode_frame(const uchar* data, const QString& decoded_file_path, const ZstdFrame& frame)
+{
+    // Skippable frames, such as those pzstd puts ahead of each frame, decode to nothing
+    if (!frame.decoded_size)
+        return;
+
+    QFile decoded_file{decoded_file_path};
+    if (!decoded_file.open(QIODevice::ReadWrite))
+        throw std::runtime_error(fmt::format("failed to open {} for parallel decoding", decoded_file_path));
+
+    std::vector<char> decoded(frame.decoded_size);
+    auto decoder = make_decoder();
+    const auto decoded_size = verify_decode(ZSTD_decompressDCtx(decoder.get(), decoded.data(), decoded.size(),
+                                                                data + frame.compressed_offset, frame.compressed_size));
+    if (decoded_size != decoded.size())
+        throw std::runtime_error("zstd file is corrupt");
+
+    // The output was preallocated as a hole, so zero blocks need no writing at all
+    if (!decoded_file.seek(frame.decoded_offset) ||
+        mp::utils::write_sparse(decoded_file, decoded.data(), decoded.size()) < 0)
+        throw std::runtime_error(
+            fmt::format("error writing {}: {}", decoded_file.fileName(), decoded_file.errorString()));
+}
+
+// Decodes what is fed to it into the file, as it comes; returns whether the input so far ends a frame
+bool decode_stream(ZSTD_DCtx* decoder, const char* data, size_t size, QFile& decoded_file, std::vector<char>& output)
+{
+    ZSTD_inBuffer input{data, size, 0};
+    bool output_full, frame_end;
+    // A full output buffer may leave more to flush even with the input used up, unless the frame is done with
+    do
+    {
+        ZSTD_outBuffer out{output.data(), output.size(), 0};
+        frame_end = verify_decode(ZSTD_decompressStream(decoder, &out, &input)) == 0;
+
+        output_full = out.pos == out.size;
+        if (mp::utils::write_sparse(decoded_file, output.data(), out.pos) < 0)
+            throw std::runtime_error(
+                fmt::format("error writing {}: {}", decoded_file.fileName(), decoded_file.errorString()));
+    } while (input.pos < input.size || (output_full && !frame_end));
+
+    return frame_end;
+}
+} // namespace
+
+mp::ZstdImageDecoder::ZstdImageDecoder(const Path& zstd_file_path) : zstd_file{zstd_file_path}
+{
+}
+
+void mp::ZstdImageDecoder::decode_to(const Path& decoded_image_path, const ProgressMonitor& monitor)
+{
+    if (!zstd_file.open(QIODevice::ReadOnly))
+        throw std::runtime_error(fmt::format("failed to open {} for reading", zstd_file.fileName()));
+
+    const auto file_size = zstd_file.size();
+    const auto data = zstd_file.map(0, file_size);
+    if (!data)
+        throw std::runtime_error(fmt::format("failed to map {} for reading", zstd_file.fileName()));
+
+    QFile decoded_file{decoded_image_path};
+    if (!decoded_file.open(QIODevice::WriteOnly))
+        throw std::runtime_error(fmt::format("failed to open {} for writing", decoded_file.fileName()));
+
+    // Files made of several frames that record their size (e.g. by `pzstd`) get their frames decoded concurrently
+    const auto frames = read_frames(data, file_size);
+    if (frames.size() > 1)
+    {
+        if (!decoded_file.resize(frames.back().decoded_offset + frames.back().decoded_size))
+            throw std::runtime_error(fmt::format("failed to allocate {}", decoded_file.fileName()));
+
+        decoded_file.close();
+        const auto largest_frame = std::max_element(frames.cbegin(), frames.cend(), [](const auto& a, const auto& b) {
+                                       return a.decoded_size < b.decoded_size;
+                                   })->decoded_size;
+        decode_in_parallel(
+            frames.size(), [&](std::size_t i) { decode_frame(data, decoded_image_path, frames[i]); }, monitor,
+            threads_within_decode_budget(largest_frame));
+        return;
+    }
+
+    auto decoder = make_decoder();
+    std::vector<char> output(ZSTD_DStreamOutSize());
+    auto frame_end = false;
+    for (qint64 offset = 0; offset < file_size; offset += progress_step)
+    {
+        const auto size = std::min<qint64>(progress_step, file_size - offset);
+        frame_end = decode_stream(decoder.get(), reinterpret_cast<const char*>(data) + offset, size, decoded_file,
+                                  output);
+        monitor(LaunchProgress::EXTRACT, static_cast<int>(100 * (offset + size) / file_size));
+    }
+
+    if (!frame_end)
+        throw std::runtime_error("zstd file is truncated");
+
+    if (!mp::utils::finish_sparse_write(decoded_file))
+        throw std::runtime_error(fmt::format("error writing {}", decoded_file.fileName()));
+}
+
+mp::PipelinedZstdDecoder::PipelinedZstdDecoder(const Path& decoded_file_path)
+    : decoded_file{decoded_file_path},
+      zstd_decoder{make_decoder()},
+      pipeline{[this](const DecodePipeline::ChunkSource& next_chunk) { run_decoder(next_chunk); }}
+{
+}
+
+void mp::PipelinedZstdDecoder::feed(const QByteArray& chunk)
+{
+    pipeline.feed(chunk);
+}
+
+void mp::PipelinedZstdDecoder::finish()
+{
+    pipeline.finish();
+
+    if (!frame_end)
+        throw std::runtime_error("zstd file is truncated");
+}
+
+void mp::PipelinedZstdDecoder::run_decoder(const DecodePipeline::ChunkSource& next_chunk)
+{
+    if (!decoded_file.open(QIODevice::WriteOnly))
+        throw std::runtime_error(fmt::format("failed to open {} for writing", decoded_file.fileName()));
+
+    // Unlike xz, a zstd file may go on with further frames, so decoding only ends with the input
+    QByteArray chunk;
+    while (next_chunk(chunk))
+    {
+        if (!chunk.isEmpty())
+            decode(chunk);
+    }
+
+    if (!mp::utils::finish_sparse_write(decoded_file))
+        throw std::runtime_error(fmt::format("error writing {}", decoded_file.fileName()));
+}
+
+void mp::PipelinedZstdDecoder::decode(const QByteArray& chunk)
+{
+    std::vector<char> output(ZSTD_DStreamOutSize());
+    frame_end = decode_stream(zstd_decoder.get(), chunk.constData(), chunk.size(), decoded_file, output);
+}
@@ -0,0 +1,32 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_ALLOCATION_COUNTER_H
+#define MULTIPASS_ALLOCATION_COUNTER_H
+
+#include <cstddef>
+
+namespace multipass
+{
+namespace test
+{
+// Heap allocations made through operator new so far, by every thread. What C libraries malloc is not seen
+std::size_t allocation_count();
+} // namespace test
+} // namespace multipass
+
+#endif // MULTIPASS_ALLOCATION_COUNTER_H
@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2020 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <src/daemon/daemon.h>
+#include <src/daemon/daemon_config.h>
+#include <src/daemon/memory_footprint.h>
+#include <src/platform/update/disabled_update_prompt.h>
+
+#include "stub_cert_store.h"
+#include "stub_certprovider.h"
+#include "stub_image_host.h"
+#include "stub_logger.h"
+#include "stub_ssh_key_provider.h"
+#include "stub_virtual_machine_factory.h"
+#include "temp_dir.h"
+
+#include <multipass/format.h>
+
+#include <benchmark/benchmark.h>
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include <chrono>
+
+#include <sys/resource.h>
+
+namespace mp = multipass;
+namespace mpt = multipass::test;
+
+namespace
+{
+// One image in the cache for every this many instances, for prune_expired_images to go through
+constexpr auto instances_per_cached_image = 100;
+
+void write_json(const QString& path, const QJsonObject& records)
+{
+    QFile file{path};
+    if (!file.open(QIODevice::WriteOnly) || file.write(QJsonDocument{records}.toJson()) < 0)
+        throw std::runtime_error(fmt::format("cannot write {}", path));
+}
+
+QJsonObject make_image_record(const QString& image_path)
+{
+    QJsonObject image;
+    image.insert("path", image_path);
+    image.insert("kernel_path", "");
+    image.insert("initrd_path", "");
+    image.insert("id", "1797c5c82016c1e65f4008fcf89deae3a044ef76087a9ec5b907c6d64a3609ac");
+    image.insert("original_release", "18.04 LTS");
+    image.insert("current_release", "18.04 LTS");
+    image.insert("release_date", "20190101");
+    image.insert("aliases", QJsonArray{QJsonObject{{"alias", "bionic"}}});
+
+    QJsonObject record;
+    record.insert("image", image);
+    record.insert("query", QJsonObject{{"release", "bionic"}, {"persistent", false}, {"remote_name", "release"}});
+    record.insert("last_accessed", static_cast<qint64>(std::chrono::system_clock::now().time_since_epoch().count()));
+
+    return record;
+}
+
+// Shaped like what the daemon keeps for each instance, stopped so that nothing is started on the way up
+QJsonObject make_instance_record(int index)
+{
+    QJsonObject mount;
+    mount.insert("source_path", "/home/ubuntu/src");
+    mount.insert("target_path", "/home/ubuntu/src");
+    mount.insert("mount_type", "classic");
+    mount.insert("uid_mappings", QJsonArray{QJsonObject{{"host_uid", 1000}, {"instance_uid", -1}}});
+    mount.insert("gid_mappings", QJsonArray{QJsonObject{{"host_gid", 1000}, {"instance_gid", -1}}});
+
+    QJsonObject record;
+    record.insert("num_cores", 2);
+    record.insert("mem_size", "2147483648");
+    record.insert("disk_space", "10737418240");
+    record.insert("mac_addr", QString::fromStdString(fmt::format("52:54:00:{:02x}:{:02x}:{:02x}", (index >> 16) & 0xff,
+                                                                 (index >> 8) & 0xff, index & 0xff)));
+    record.insert("ssh_username", "ubuntu");
+    record.insert("state", static_cast<int>(mp::VirtualMachine::State::stopped));
+    record.insert("deleted", false);
+    record.insert("metadata", QJsonObject{});
+    record.insert("mounts", QJsonArray{mount});
+
+    return record;
+}
+
+// The instance database and the vault's, as the daemon finds them on the way up
+void write_databases(const QString& cache_dir, const QString& data_dir, int num_instances)
+{
+    QJsonObject instances, instance_images, cached_images;
+    for (auto i = 0; i < num_instances; ++i)
+    {
+        const auto name = QString("instance-%1").arg(i);
+        instances.insert(name, make_instance_record(i));
+        instance_images.insert(name, make_image_record(QDir{data_dir}.filePath(name + "/image.img")));
+
+        if (i % instances_per_cached_image == 0)
+            cached_images.insert(QString("image-%1").arg(i),
+                                 make_image_record(QDir{cache_dir}.filePath(QString("image-%1.img").arg(i))));
+    }
+
+    write_json(QDir{data_dir}.filePath("multipassd-vm-instances.json"), instances);
+    write_json(QDir{data_dir}.filePath("multipassd-instance-image-records.json"), instance_images);
+    write_json(QDir{cache_dir}.filePath("multipassd-image-records.json"), cached_images);
+}
+
+std::unique_ptr<const mp::DaemonConfig> make_config(const QString& cache_dir, const QString& data_dir)
+{
+    mp::DaemonConfigBuilder builder;
+    builder.server_address = fmt::format("unix:{}/multipass_socket", qUtf8Printable(data_dir));
+    builder.cache_directory = cache_dir;
+    builder.data_directory = data_dir;
+    builder.factory = std::make_unique<mpt::StubVirtualMachineFactory>();
+    builder.image_hosts.push_back(std::make_unique<mpt::StubVMImageHost>());
+    builder.ssh_key_provider = std::make_unique<mpt::StubSSHKeyProvider>();
+    builder.cert_provider = std::make_unique<mpt::StubCertProvider>();
+    builder.client_cert_store = std::make_unique<mpt::StubCertStore>();
+    builder.connection_type = mp::RpcConnectionType::insecure;
+    builder.logger = std::make_unique<mpt::StubLogger>();
+    builder.update_prompt = std::make_unique<mp::DisabledUpdatePrompt>();
+
+    // The real vault, over the records written above; the stub one has none, which would get every instance dropped
+    return builder.build();
+}
+
+long peak_resident_kib()
+{
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// From the daemon being constructed up to it being ready for its first RPC, which it takes once the events queued on
+// the way up are handled. The instance and vault databases hold as many entries as the argument says
+void daemon_startup(benchmark::State& state)
+{
+    const auto num_instances = static_cast<int>(state.range(0));
+    std::size_t heap_growth{0};
+
+    for (auto _ : state)
+    {
+        mpt::TempDir cache_dir, data_dir;
+        write_databases(cache_dir.path(), data_dir.path(), num_instances);
+        auto config = make_config(cache_dir.path(), data_dir.path());
+
+        const auto heap_before = mp::memory_footprint::heap_in_use();
+        const auto start = std::chrono::steady_clock::now();
+        {
+            mp::Daemon daemon{std::move(config)};
+            QCoreApplication::processEvents();
+
+            state.SetIterationTime(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+            const auto heap_after = mp::memory_footprint::heap_in_use();
+            heap_growth = std::max(heap_growth, heap_after > heap_before ? heap_after - heap_before : 0);
+        }
+    }
+
+    // The peak is the whole run's so far, so runs are best compared one size at a time
+    state.counters["heap_bytes"] = heap_growth;
+    state.counters["heap_bytes_per_instance"] = static_cast<double>(heap_growth) / num_instances;
+    state.counters["peak_rss_kib"] = peak_resident_kib();
+}
+} // namespace
+
+BENCHMARK(daemon_startup)
+    ->Arg(10)
+    ->Arg(100)
+    ->Arg(1000)
+    ->Arg(10000)
+    ->UseManualTime()
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(3);
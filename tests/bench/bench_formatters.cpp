@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <multipass/cli/csv_formatter.h>
+#include <multipass/cli/json_formatter.h>
+#include <multipass/cli/table_formatter.h>
+#include <multipass/cli/yaml_formatter.h>
+#include <multipass/rpc/multipass.grpc.pb.h>
+
+#include <benchmark/benchmark.h>
+
+#include <string>
+
+namespace mp = multipass;
+
+namespace
+{
+mp::ListReply make_list_reply(int num_instances)
+{
+    mp::ListReply reply;
+    for (auto i = 0; i < num_instances; ++i)
+    {
+        auto entry = reply.add_instances();
+        entry->set_name("instance-" + std::to_string(i));
+        entry->mutable_instance_status()->set_status(i % 3 ? mp::InstanceStatus::RUNNING
+                                                           : mp::InstanceStatus::STOPPED);
+        entry->set_current_release("18.04 LTS");
+        entry->set_ipv4("10.21.124." + std::to_string(i % 250));
+    }
+
+    return reply;
+}
+
+mp::InfoReply make_info_reply(int num_instances)
+{
+    mp::InfoReply reply;
+    for (auto i = 0; i < num_instances; ++i)
+    {
+        auto entry = reply.add_info();
+        entry->set_name("instance-" + std::to_string(i));
+        entry->mutable_instance_status()->set_status(mp::InstanceStatus::RUNNING);
+        entry->set_image_release("18.04 LTS");
+        entry->set_id("1797c5c82016c1e65f4008fcf89deae3a044ef76087a9ec5b907c6d64a3609ac");
+        entry->set_load("0.03 0.10 0.15");
+        entry->set_memory_usage("38797312");
+        entry->set_memory_total("1610612736");
+        entry->set_disk_usage("1932735284");
+        entry->set_disk_total("6764573492");
+        entry->set_current_release("Ubuntu 18.04.3 LTS");
+        entry->set_ipv4("10.21.124." + std::to_string(i % 250));
+
+        auto mount_info = entry->mutable_mount_info();
+        mount_info->set_longest_path_len(17);
+        auto mount = mount_info->add_mount_paths();
+        mount->set_source_path("/home/user/source");
+        mount->set_target_path("source");
+        (*mount->mutable_mount_maps()->mutable_uid_map())[1000] = 1000;
+        (*mount->mutable_mount_maps()->mutable_gid_map())[1000] = 1000;
+    }
+
+    return reply;
+}
+
+template <typename Formatter>
+void format_list(benchmark::State& state)
+{
+    const auto reply = make_list_reply(state.range(0));
+    Formatter formatter;
+
+    for (auto _ : state)
+        benchmark::DoNotOptimize(formatter.format(reply));
+
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+template <typename Formatter>
+void format_info(benchmark::State& state)
+{
+    const auto reply = make_info_reply(state.range(0));
+    Formatter formatter;
+
+    for (auto _ : state)
+        benchmark::DoNotOptimize(formatter.format(reply));
+
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+} // namespace
+
+BENCHMARK_TEMPLATE(format_list, mp::TableFormatter)->Arg(10)->Arg(1000);
+BENCHMARK_TEMPLATE(format_list, mp::JsonFormatter)->Arg(10)->Arg(1000);
+BENCHMARK_TEMPLATE(format_list, mp::CSVFormatter)->Arg(10)->Arg(1000);
+BENCHMARK_TEMPLATE(format_list, mp::YamlFormatter)->Arg(10)->Arg(1000);
+BENCHMARK_TEMPLATE(format_info, mp::TableFormatter)->Arg(10)->Arg(1000);
+BENCHMARK_TEMPLATE(format_info, mp::JsonFormatter)->Arg(10)->Arg(1000);
+BENCHMARK_TEMPLATE(format_info, mp::YamlFormatter)->Arg(10)->Arg(1000);
@@ -0,0 +1,190 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "temp_dir.h"
+
+#include <multipass/cloud_init_iso.h>
+#include <multipass/image_decoder.h>
+#include <multipass/sha256.h>
+
+#include <benchmark/benchmark.h>
+
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QProcess>
+#include <QStringList>
+
+#include <xz.h>
+
+#include <random>
+
+namespace mp = multipass;
+namespace mpt = multipass::test;
+
+namespace
+{
+constexpr auto image_size = 32 << 20;
+
+// Roughly what a disk image looks like to the decoder: stretches of zeroes between data that compresses somewhat
+QByteArray make_image()
+{
+    QByteArray image(image_size, '\0');
+    std::mt19937 gen{42};
+    std::uniform_int_distribution<int> letter{'a', 'p'};
+    for (auto block = 0; block < image.size(); block += 1 << 20)
+        if (block % (3 << 20))
+            for (auto i = block; i < block + (1 << 20); ++i)
+                image[i] = static_cast<char>(letter(gen));
+
+    return image;
+}
+
+// There are no encoders in the tree, so the compressed image is made with the xz or zstd tool
+bool write_compressed_image(const QString& path, const QString& tool, const QStringList& tool_args)
+{
+    QProcess encoder;
+    encoder.start(tool, QStringList{"--stdout"} + tool_args);
+    if (!encoder.waitForStarted())
+        return false;
+
+    encoder.write(make_image());
+    encoder.closeWriteChannel();
+    if (!encoder.waitForFinished(-1) || encoder.exitCode() != 0)
+        return false;
+
+    QFile file{path};
+    return file.open(QIODevice::WriteOnly) && file.write(encoder.readAllStandardOutput()) > 0;
+}
+
+void decode(benchmark::State& state, const QString& tool, const QString& suffix, const QStringList& tool_args)
+{
+    mpt::TempDir temp_dir;
+    const auto compressed_path = temp_dir.path() + "/image.img" + suffix;
+    const auto image_path = temp_dir.path() + "/image.img";
+    if (!write_compressed_image(compressed_path, tool, tool_args))
+    {
+        state.SkipWithError("cannot run the encoder to make the compressed image");
+        return;
+    }
+
+    for (auto _ : state)
+    {
+        auto decoder = mp::make_image_decoder(compressed_path);
+        decoder->decode_to(image_path, [](auto...) { return true; });
+    }
+
+    state.SetBytesProcessed(state.iterations() * image_size);
+}
+
+void xz_decode_single_block(benchmark::State& state)
+{
+    decode(state, "xz", ".xz", {"--check=crc32"});
+}
+
+void xz_decode_multiple_blocks(benchmark::State& state)
+{
+    decode(state, "xz", ".xz", {"--check=crc32", "--threads=4", "--block-size=4MiB"});
+}
+
+void zstd_decode_single_frame(benchmark::State& state)
+{
+    decode(state, "zstd", ".zst", {"-19"});
+}
+
+// pzstd writes a frame for each of its jobs, which are what gets decoded concurrently
+void zstd_decode_multiple_frames(benchmark::State& state)
+{
+    decode(state, "pzstd", ".zst", {"-19", "--processes=4"});
+}
+
+// What the xz decoder checks its blocks with; the argument is the length of each buffer
+void xz_crc32_compute(benchmark::State& state)
+{
+    xz_crc32_init();
+    const auto data = make_image().left(state.range(0));
+    const auto bytes = reinterpret_cast<const uint8_t*>(data.constData());
+
+    for (auto _ : state)
+        benchmark::DoNotOptimize(xz_crc32(bytes, data.size(), 0));
+
+    state.SetBytesProcessed(state.iterations() * data.size());
+}
+
+void xz_crc64_compute(benchmark::State& state)
+{
+    xz_crc64_init();
+    const auto data = make_image().left(state.range(0));
+    const auto bytes = reinterpret_cast<const uint8_t*>(data.constData());
+
+    for (auto _ : state)
+        benchmark::DoNotOptimize(xz_crc64(bytes, data.size(), 0));
+
+    state.SetBytesProcessed(state.iterations() * data.size());
+}
+
+// How images are verified as they download, against what Qt would do with the same bytes
+void sha256_compute(benchmark::State& state)
+{
+    const auto data = make_image().left(state.range(0));
+
+    for (auto _ : state)
+    {
+        mp::Sha256 hash;
+        hash.add_data(data);
+        benchmark::DoNotOptimize(hash.result());
+    }
+
+    state.SetBytesProcessed(state.iterations() * data.size());
+}
+
+void qt_sha256_compute(benchmark::State& state)
+{
+    const auto data = make_image().left(state.range(0));
+
+    for (auto _ : state)
+        benchmark::DoNotOptimize(QCryptographicHash::hash(data, QCryptographicHash::Sha256));
+
+    state.SetBytesProcessed(state.iterations() * data.size());
+}
+
+void cloud_init_iso_write(benchmark::State& state)
+{
+    mpt::TempDir temp_dir;
+    const auto iso_path = QDir{temp_dir.path()}.filePath("cloud-init-config.iso");
+    const std::string user_data(state.range(0), '#');
+
+    for (auto _ : state)
+    {
+        mp::CloudInitIso iso;
+        iso.add_file("meta-data", "#cloud-config\ninstance-id: bench\nlocal-hostname: bench\n");
+        iso.add_file("vendor-data", "#cloud-config\ngrowpart:\n  mode: auto\n  devices: [\"/\"]\n");
+        iso.add_file("user-data", user_data);
+        iso.write_to(iso_path);
+    }
+}
+} // namespace
+
+BENCHMARK(xz_decode_single_block)->Unit(benchmark::kMillisecond);
+BENCHMARK(xz_decode_multiple_blocks)->Unit(benchmark::kMillisecond);
+BENCHMARK(zstd_decode_single_frame)->Unit(benchmark::kMillisecond);
+BENCHMARK(zstd_decode_multiple_frames)->Unit(benchmark::kMillisecond);
+BENCHMARK(xz_crc32_compute)->Arg(64)->Arg(4 << 10)->Arg(1 << 20);
+BENCHMARK(xz_crc64_compute)->Arg(64)->Arg(4 << 10)->Arg(1 << 20);
+BENCHMARK(sha256_compute)->Arg(4 << 10)->Arg(1 << 20);
+BENCHMARK(qt_sha256_compute)->Arg(4 << 10)->Arg(1 << 20);
+BENCHMARK(cloud_init_iso_write)->Arg(64)->Arg(64 << 10)->Unit(benchmark::kMicrosecond);
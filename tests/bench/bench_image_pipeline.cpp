@@ -0,0 +1,343 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <src/daemon/default_vm_image_vault.h>
+
+#include "local_image_server.h"
+#include "temp_dir.h"
+
+#include <multipass/format.h>
+#include <multipass/image_decoder.h>
+#include <multipass/query.h>
+#include <multipass/rpc/multipass.grpc.pb.h>
+#include <multipass/sha256.h>
+#include <multipass/url_downloader.h>
+#include <multipass/vm_image_host.h>
+
+#include <benchmark/benchmark.h>
+
+#include <QDir>
+#include <QFile>
+#include <QProcess>
+#include <QStandardPaths>
+#include <QStringList>
+
+#include <chrono>
+#include <random>
+
+#include <sys/resource.h>
+
+namespace mp = multipass;
+namespace mpt = multipass::test;
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+constexpr qint64 image_size = 256 << 20; // about what a minimal cloud image decodes to
+
+// The images every variant is served, made once for the whole run so that they only differ in how they are fetched
+struct ServedImages
+{
+    ServedImages()
+    {
+        QByteArray image(image_size, '\0');
+        std::mt19937 gen{42};
+        std::uniform_int_distribution<int> letter{'a', 'p'};
+        for (auto block = 0; block < image.size(); block += 1 << 20)
+            if (block % (3 << 20))
+                for (auto i = block; i < block + (1 << 20); ++i)
+                    image[i] = static_cast<char>(letter(gen));
+
+        made = write("image.img", image) &&
+               encode("single-block.img.xz", image, {"--check=crc32"}) &&
+               encode("multi-block.img.xz", image, {"--check=crc32", "--threads=4", "--block-size=8MiB"});
+    }
+
+    bool write(const QString& name, const QByteArray& content)
+    {
+        QFile file{path(name)};
+        return file.open(QIODevice::WriteOnly) && file.write(content) == content.size();
+    }
+
+    // There are no encoders in the tree, so the compressed images are made with the xz tool
+    bool encode(const QString& name, const QByteArray& image, const QStringList& xz_args)
+    {
+        QProcess encoder;
+        encoder.start("xz", QStringList{"--stdout", "-1"} + xz_args);
+        if (!encoder.waitForStarted())
+            return false;
+
+        encoder.write(image);
+        encoder.closeWriteChannel();
+        return encoder.waitForFinished(-1) && encoder.exitCode() == 0 &&
+               write(name, encoder.readAllStandardOutput());
+    }
+
+    QString path(const QString& name) const
+    {
+        return QDir{dir.path()}.filePath(name);
+    }
+
+    mpt::TempDir dir;
+    bool made{false};
+};
+
+ServedImages& served_images()
+{
+    static ServedImages images;
+    return images;
+}
+
+// Hands the vault the one image it was made with, as the manifests would
+struct LocalImageHost : public mp::VMImageHost
+{
+    explicit LocalImageHost(const mp::VMImageInfo& info) : info{info}
+    {
+    }
+
+    mp::optional<mp::VMImageInfo> info_for(const mp::Query&) override
+    {
+        return info;
+    }
+
+    std::vector<mp::VMImageInfo> all_info_for(const mp::Query&) override
+    {
+        return {info};
+    }
+
+    mp::VMImageInfo info_for_full_hash(const std::string&) override
+    {
+        return info;
+    }
+
+    std::vector<mp::VMImageInfo> all_images_for(const std::string&, const bool) override
+    {
+        return {info};
+    }
+
+    void for_each_entry_do(const Action& action) override
+    {
+        action("release", info);
+    }
+
+    std::vector<std::string> supported_remotes() override
+    {
+        return {"release"};
+    }
+
+    int manifest_generation() override
+    {
+        return 0;
+    }
+
+    const mp::VMImageInfo info;
+};
+
+// When the vault moved from one phase to the next, as told by its progress and by the prepare action it is given
+struct Phases
+{
+    double seconds(Clock::time_point from, Clock::time_point to) const
+    {
+        return std::chrono::duration<double>(to - from).count();
+    }
+
+    Clock::time_point start, verify, extract, convert, converted, done;
+};
+
+double cpu_seconds()
+{
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+// What the qemu backend prepares raw images with
+mp::VMImage convert_to_qcow2(const mp::VMImage& source_image)
+{
+    auto image = source_image;
+    image.image_path = source_image.image_path + ".qcow2";
+
+    QProcess qemu_img;
+    qemu_img.start("qemu-img", {"convert", "-f", "raw", "-O", "qcow2", source_image.image_path, image.image_path});
+    if (!qemu_img.waitForFinished(-1) || qemu_img.exitCode() != 0)
+        throw std::runtime_error(fmt::format("qemu-img failed: {}", qemu_img.readAllStandardError().toStdString()));
+
+    return image;
+}
+
+// One launch's worth of fetching, into a vault of its own, from the image being downloaded to the instance having
+// its copy. The counters give each phase's throughput, in bytes of the image as served for the download and verify,
+// and as decoded for the rest, along with how many cores the process kept busy throughout. The server runs in the
+// process too, so its share is counted, though it does little more than copy from the page cache.
+// Images of 64MiB and more are downloaded over several connections from servers that take byte ranges
+void fetch_image(benchmark::State& state, const QString& file_name, bool accept_ranges)
+{
+    auto& images = served_images();
+    if (!images.made)
+    {
+        state.SkipWithError("cannot run xz to make the compressed images");
+        return;
+    }
+
+    if (QStandardPaths::findExecutable("qemu-img").isEmpty())
+    {
+        state.SkipWithError("qemu-img is needed to convert the images");
+        return;
+    }
+
+    mpt::LocalImageServer server{images.dir.path(), accept_ranges};
+    const auto served_size = QFile{images.path(file_name)}.size();
+    LocalImageHost host{{{"bench"},
+                         "Ubuntu",
+                         "bench",
+                         "Bench",
+                         true,
+                         server.url_for(file_name).toString(),
+                         {},
+                         {},
+                         QString::fromLatin1(mp::sha256_of_file(images.path(file_name))),
+                         "20200101",
+                         served_size,
+                         true}};
+
+    double download{0}, verify{0}, decode{0}, convert{0}, instance{0}, cpu{0}, wall{0};
+    for (auto _ : state)
+    {
+        mpt::TempDir cache_dir, data_dir;
+        mp::URLDownloader downloader{cache_dir.path(), std::chrono::seconds(30)};
+        mp::DefaultVMImageVault vault{{&host}, &downloader, cache_dir.path(), data_dir.path(), mp::days{1}};
+
+        Phases phases;
+        auto monitor = [&phases](int download_type, int) {
+            if (download_type == mp::LaunchProgress::VERIFY)
+                phases.verify = Clock::now();
+            else if (download_type == mp::LaunchProgress::EXTRACT)
+                phases.extract = Clock::now();
+            return true;
+        };
+        auto prepare = [&phases](const mp::VMImage& source_image) {
+            phases.convert = Clock::now();
+            auto image = convert_to_qcow2(source_image);
+            phases.converted = Clock::now();
+            return image;
+        };
+
+        const auto cpu_before = cpu_seconds();
+        phases.start = Clock::now();
+        vault.fetch_image(mp::FetchType::ImageOnly, {"bench", "bench", false, "release", mp::Query::Type::Alias},
+                          prepare, monitor);
+        phases.done = Clock::now();
+        cpu += cpu_seconds() - cpu_before;
+
+        // Raw images skip extracting, going from verifying straight to converting
+        const auto verified = phases.extract != Clock::time_point{} ? phases.extract : phases.convert;
+        download += phases.seconds(phases.start, phases.verify);
+        verify += phases.seconds(phases.verify, verified);
+        decode += phases.seconds(verified, phases.convert);
+        convert += phases.seconds(phases.convert, phases.converted);
+        instance += phases.seconds(phases.converted, phases.done);
+        wall += phases.seconds(phases.start, phases.done);
+        state.SetIterationTime(phases.seconds(phases.start, phases.done));
+    }
+
+    const auto fetches = static_cast<double>(state.iterations());
+    const auto rate = [](double bytes, double seconds) { return seconds > 0 ? bytes / seconds : 0; };
+    state.counters["download_bytes_per_second"] = rate(fetches * served_size, download);
+    state.counters["verify_bytes_per_second"] = rate(fetches * served_size, verify);
+    state.counters["decode_bytes_per_second"] = rate(fetches * image_size, decode);
+    state.counters["convert_bytes_per_second"] = rate(fetches * image_size, convert);
+    state.counters["instance_bytes_per_second"] = rate(fetches * image_size, instance);
+    state.counters["cpu_utilization"] = rate(cpu, wall);
+    state.SetBytesProcessed(state.iterations() * image_size);
+}
+
+// The passes that hashing and decoding while downloading fold into the download, run one after the other over what
+// was served, as they were before. Adding them to the single connection fetch of the same image gives what fetching
+// it without either would take
+void separate_passes(benchmark::State& state, const QString& file_name)
+{
+    auto& images = served_images();
+    if (!images.made)
+    {
+        state.SkipWithError("cannot run xz to make the compressed images");
+        return;
+    }
+
+    const auto served_path = images.path(file_name);
+    const auto compressed = mp::is_compressed_image(served_path);
+    double hash{0}, decode{0}, cpu{0}, wall{0};
+    for (auto _ : state)
+    {
+        mpt::TempDir output_dir;
+        const auto cpu_before = cpu_seconds();
+        const auto start = Clock::now();
+        benchmark::DoNotOptimize(mp::sha256_of_file(served_path));
+        const auto hashed = Clock::now();
+        if (compressed)
+            mp::make_image_decoder(served_path)
+                ->decode_to(QDir{output_dir.path()}.filePath("image.img"), [](auto...) { return true; });
+        const auto end = Clock::now();
+        cpu += cpu_seconds() - cpu_before;
+
+        hash += std::chrono::duration<double>(hashed - start).count();
+        decode += std::chrono::duration<double>(end - hashed).count();
+        wall += std::chrono::duration<double>(end - start).count();
+        state.SetIterationTime(std::chrono::duration<double>(end - start).count());
+    }
+
+    const auto fetches = static_cast<double>(state.iterations());
+    const auto served_size = QFile{served_path}.size();
+    state.counters["hash_bytes_per_second"] = hash > 0 ? fetches * served_size / hash : 0;
+    state.counters["decode_bytes_per_second"] = compressed && decode > 0 ? fetches * image_size / decode : 0;
+    state.counters["cpu_utilization"] = wall > 0 ? cpu / wall : 0;
+}
+} // namespace
+
+BENCHMARK_CAPTURE(fetch_image, raw_single_connection, "image.img", false)
+    ->UseManualTime()
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(3);
+BENCHMARK_CAPTURE(fetch_image, raw_segmented, "image.img", true)
+    ->UseManualTime()
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(3);
+BENCHMARK_CAPTURE(fetch_image, xz_single_block_single_connection, "single-block.img.xz", false)
+    ->UseManualTime()
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(3);
+BENCHMARK_CAPTURE(fetch_image, xz_single_block_segmented, "single-block.img.xz", true)
+    ->UseManualTime()
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(3);
+BENCHMARK_CAPTURE(fetch_image, xz_multi_block_single_connection, "multi-block.img.xz", false)
+    ->UseManualTime()
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(3);
+BENCHMARK_CAPTURE(fetch_image, xz_multi_block_segmented, "multi-block.img.xz", true)
+    ->UseManualTime()
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(3);
+BENCHMARK_CAPTURE(separate_passes, raw, "image.img")->UseManualTime()->Unit(benchmark::kMillisecond)->Iterations(3);
+BENCHMARK_CAPTURE(separate_passes, xz_single_block, "single-block.img.xz")
+    ->UseManualTime()
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(3);
+BENCHMARK_CAPTURE(separate_passes, xz_multi_block, "multi-block.img.xz")
+    ->UseManualTime()
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(3);
@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <src/daemon/journaled_json_store.h>
+
+#include "file_operations.h"
+#include "temp_dir.h"
+
+#include <multipass/simple_streams_manifest.h>
+
+#include <benchmark/benchmark.h>
+
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+namespace mp = multipass;
+namespace mpt = multipass::test;
+
+namespace
+{
+// The test manifest's one product, repeated to reach the size of a real cloud-images.ubuntu.com manifest
+QByteArray make_manifest(int num_products)
+{
+    auto manifest = QJsonDocument::fromJson(mpt::load_test_file("good_manifest.json")).object();
+    const auto products = manifest["products"].toObject();
+    const auto product = products.begin().value().toObject();
+
+    QJsonObject many_products;
+    for (auto i = 0; i < num_products; ++i)
+    {
+        auto copy = product;
+        copy["aliases"] = QString("bench-%1,b%1").arg(i);
+        many_products.insert(QString("%1-%2").arg(products.begin().key()).arg(i), copy);
+    }
+    manifest["products"] = many_products;
+
+    return QJsonDocument{manifest}.toJson(QJsonDocument::Compact);
+}
+
+// Shaped like what the daemon keeps for each instance
+QJsonObject make_instance_record(int generation)
+{
+    QJsonObject mount;
+    mount.insert("source_path", "/home/ubuntu/src");
+    mount.insert("target_path", "/home/ubuntu/src");
+    mount.insert("mount_type", "classic");
+    mount.insert("uid_mappings", QJsonArray{QJsonObject{{"host_uid", 1000}, {"instance_uid", -1}}});
+    mount.insert("gid_mappings", QJsonArray{QJsonObject{{"host_gid", 1000}, {"instance_gid", -1}}});
+
+    QJsonObject record;
+    record.insert("num_cores", 2);
+    record.insert("mem_size", "2147483648");
+    record.insert("disk_space", "10737418240");
+    record.insert("mac_addr", "52:54:00:aa:bb:cc");
+    record.insert("ssh_username", "ubuntu");
+    record.insert("state", generation % 2 ? 2 : 4);
+    record.insert("deleted", false);
+    record.insert("metadata", QJsonObject{});
+    record.insert("mounts", QJsonArray{mount});
+
+    return record;
+}
+
+void simple_streams_manifest_parse(benchmark::State& state)
+{
+    const auto json = make_manifest(state.range(0));
+
+    for (auto _ : state)
+        benchmark::DoNotOptimize(mp::SimpleStreamsManifest::fromJson(json));
+
+    state.SetBytesProcessed(state.iterations() * json.size());
+}
+
+// Follows Daemon::persist_instances: every record is put on each pass, but only one of them changed
+void persist_instances_one_changed(benchmark::State& state)
+{
+    const auto num_instances = state.range(0);
+    mpt::TempDir temp_dir;
+    mp::JournaledJsonStore store{temp_dir.path() + "/instances.json", temp_dir.path() + "/instances.journal"};
+    store.load();
+
+    for (auto i = 0; i < num_instances; ++i)
+        store.put(QString("instance-%1").arg(i), make_instance_record(0));
+
+    auto generation = 0;
+    for (auto _ : state)
+    {
+        ++generation;
+        for (auto i = 0; i < num_instances; ++i)
+            store.put(QString("instance-%1").arg(i), make_instance_record(i ? 0 : generation));
+    }
+
+    state.SetItemsProcessed(state.iterations() * num_instances);
+}
+
+void persist_instances_all_changed(benchmark::State& state)
+{
+    const auto num_instances = state.range(0);
+    mpt::TempDir temp_dir;
+    mp::JournaledJsonStore store{temp_dir.path() + "/instances.json", temp_dir.path() + "/instances.journal"};
+    store.load();
+
+    auto generation = 0;
+    for (auto _ : state)
+    {
+        ++generation;
+        for (auto i = 0; i < num_instances; ++i)
+            store.put(QString("instance-%1").arg(i), make_instance_record(generation));
+    }
+
+    state.SetItemsProcessed(state.iterations() * num_instances);
+}
+} // namespace
+
+BENCHMARK(simple_streams_manifest_parse)->Arg(10)->Arg(500)->Unit(benchmark::kMicrosecond);
+BENCHMARK(persist_instances_one_changed)->Arg(10)->Arg(100)->Unit(benchmark::kMicrosecond);
+BENCHMARK(persist_instances_all_changed)->Arg(10)->Arg(100)->Unit(benchmark::kMillisecond);
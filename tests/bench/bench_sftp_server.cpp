@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "file_operations.h"
+#include "scripted_sftp_client.h"
+#include "temp_dir.h"
+
+#include <benchmark/benchmark.h>
+
+
+namespace mp = multipass;
+namespace mpt = multipass::test;
+
+namespace
+{
+constexpr auto ops_per_run = 64;
+
+void add_open(mpt::ScriptedSftpClient& client, const QString& path, uint32_t flags)
+{
+    auto open = client.add(SFTP_OPEN);
+    open->filename = client.keep(path.toStdString());
+    open->flags = flags;
+    open->attr = client.keep_attributes(SSH_FILEXFER_ATTR_PERMISSIONS, 0644);
+}
+
+void sftp_read(benchmark::State& state)
+{
+    const auto len = static_cast<uint32_t>(state.range(0));
+    mpt::TempDir temp_dir;
+    auto file_name = temp_dir.path() + "/read-me";
+    mpt::make_file_with_content(file_name, std::string(len * ops_per_run, 'r'));
+
+    mpt::ScriptedSftpClient client;
+    add_open(client, file_name, SSH_FXF_READ);
+    for (auto i = 0; i < ops_per_run; ++i)
+    {
+        auto read = client.add(SFTP_READ);
+        read->offset = i * len;
+        read->len = len;
+    }
+    client.add(SFTP_CLOSE);
+
+    for (auto _ : state)
+        client.make_server(temp_dir.path().toStdString()).run();
+
+    state.SetBytesProcessed(state.iterations() * ops_per_run * len);
+    state.SetItemsProcessed(state.iterations() * ops_per_run);
+}
+
+void sftp_write(benchmark::State& state)
+{
+    const auto len = static_cast<uint32_t>(state.range(0));
+    mpt::TempDir temp_dir;
+    auto file_name = temp_dir.path() + "/write-me";
+
+    mpt::ScriptedSftpClient client;
+    add_open(client, file_name, SSH_FXF_WRITE | SSH_FXF_CREAT | SSH_FXF_TRUNC);
+    for (auto i = 0; i < ops_per_run; ++i)
+    {
+        auto write = client.add(SFTP_WRITE);
+        write->data = client.payload(len);
+        write->offset = i * len;
+    }
+    client.add(SFTP_CLOSE);
+
+    for (auto _ : state)
+        client.make_server(temp_dir.path().toStdString()).run();
+
+    state.SetBytesProcessed(state.iterations() * ops_per_run * len);
+    state.SetItemsProcessed(state.iterations() * ops_per_run);
+}
+
+void sftp_readdir(benchmark::State& state)
+{
+    const auto num_files = state.range(0);
+    mpt::TempDir temp_dir;
+    for (auto i = 0; i < num_files; ++i)
+        mpt::make_file_with_content(temp_dir.path() + QString("/file-%1").arg(i));
+
+    mpt::ScriptedSftpClient client;
+    client.add(SFTP_OPENDIR)->filename = client.keep(temp_dir.path().toStdString());
+    for (auto i = 0; i <= num_files / 50 + 1; ++i) // a reply carries at least fifty entries
+        client.add(SFTP_READDIR);
+    client.add(SFTP_CLOSE);
+
+    for (auto _ : state)
+        client.make_server(temp_dir.path().toStdString()).run();
+
+    state.SetItemsProcessed(state.iterations() * (num_files + 2));
+}
+} // namespace
+
+BENCHMARK(sftp_read)->RangeMultiplier(8)->Range(4 << 10, 256 << 10);
+BENCHMARK(sftp_write)->RangeMultiplier(8)->Range(4 << 10, 256 << 10);
+BENCHMARK(sftp_readdir)->Arg(10)->Arg(1000);
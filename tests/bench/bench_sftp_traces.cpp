@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "allocation_counter.h"
+#include "scripted_sftp_client.h"
+#include "sftp_trace.h"
+#include "temp_dir.h"
+
+#include <benchmark/benchmark.h>
+
+#include <QCoreApplication>
+#include <QDir>
+
+namespace mpt = multipass::test;
+
+namespace
+{
+// Replies are not checked: replaying a trace again makes some requests fail (e.g. mkdir of an existing directory),
+// just like they would for a client repeating the same work
+void replay_trace(benchmark::State& state, const char* trace_name)
+{
+    mpt::TempDir temp_dir;
+    mpt::ScriptedSftpClient client;
+    const QDir traces_dir{QCoreApplication::applicationDirPath() + "/traces"};
+    const auto trace_path = traces_dir.filePath(QString("%1.trace").arg(trace_name));
+    const auto requests = mpt::load_sftp_trace(trace_path, temp_dir.path(), client);
+
+    std::size_t allocations{0};
+    for (auto _ : state)
+    {
+        auto server = client.make_server(temp_dir.path().toStdString());
+
+        const auto allocations_before = mpt::allocation_count();
+        server.run();
+        allocations += mpt::allocation_count() - allocations_before;
+    }
+
+    state.SetItemsProcessed(state.iterations() * requests);
+    state.counters["requests"] = requests;
+    state.counters["allocs_per_request"] = static_cast<double>(allocations) / (state.iterations() * requests);
+}
+} // namespace
+
+BENCHMARK_CAPTURE(replay_trace, git_status, "git_status")->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(replay_trace, npm_install, "npm_install")->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(replay_trace, cargo_build, "cargo_build")->Unit(benchmark::kMillisecond);
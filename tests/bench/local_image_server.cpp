@@ -0,0 +1,175 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "local_image_server.h"
+
+#include <multipass/format.h>
+
+#include <QDir>
+#include <QFile>
+#include <QRegularExpression>
+#include <QTcpServer>
+#include <QTcpSocket>
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+
+namespace mpt = multipass::test;
+
+namespace
+{
+constexpr qint64 chunk_size = 256 * 1024;
+constexpr qint64 max_queued_bytes = 4 * chunk_size;
+
+struct Exchange
+{
+    QByteArray request;
+    QFile file;
+    qint64 remaining{0};
+};
+
+void reply_and_close(QTcpSocket* socket, const char* status)
+{
+    socket->write(fmt::format("HTTP/1.1 {}\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", status).c_str());
+    socket->disconnectFromHost();
+}
+
+void send_more(QTcpSocket* socket, Exchange& exchange)
+{
+    while (exchange.remaining > 0 && socket->bytesToWrite() < max_queued_bytes)
+    {
+        const auto data = exchange.file.read(std::min(chunk_size, exchange.remaining));
+        if (data.isEmpty())
+            return socket->abort();
+
+        exchange.remaining -= data.size();
+        socket->write(data);
+    }
+
+    if (exchange.remaining == 0)
+        socket->disconnectFromHost();
+}
+
+void answer(QTcpSocket* socket, Exchange& exchange, const QString& root, bool accept_ranges)
+{
+    static const QRegularExpression request_line{"^(GET|HEAD) /([^/ ]+) HTTP/1\\.[01]\r\n"};
+    static const QRegularExpression range_header{"\r\nrange: *bytes=(\\d+)-(\\d*)\r\n",
+                                                 QRegularExpression::CaseInsensitiveOption};
+
+    const auto request = QString::fromLatin1(exchange.request);
+    const auto match = request_line.match(request);
+    if (!match.hasMatch())
+        return reply_and_close(socket, "400 Bad Request");
+
+    exchange.file.setFileName(QDir{root}.filePath(match.captured(2)));
+    if (!exchange.file.open(QIODevice::ReadOnly))
+        return reply_and_close(socket, "404 Not Found");
+
+    const auto size = exchange.file.size();
+    qint64 first = 0, last = size - 1;
+    const auto range = range_header.match(request);
+    const auto ranged = accept_ranges && range.hasMatch();
+    if (ranged)
+    {
+        first = range.captured(1).toLongLong();
+        if (!range.captured(2).isEmpty())
+            last = std::min(last, range.captured(2).toLongLong());
+        if (first > last)
+            return reply_and_close(socket, "416 Range Not Satisfiable");
+    }
+
+    auto headers = fmt::format("HTTP/1.1 {}\r\nContent-Type: application/octet-stream\r\nContent-Length: {}\r\n",
+                               ranged ? "206 Partial Content" : "200 OK", last - first + 1);
+    if (ranged)
+        headers += fmt::format("Content-Range: bytes {}-{}/{}\r\n", first, last, size);
+    if (accept_ranges)
+        headers += "Accept-Ranges: bytes\r\n";
+    socket->write((headers + "Connection: close\r\n\r\n").c_str());
+
+    if (match.captured(1) == "HEAD")
+        return socket->disconnectFromHost();
+
+    exchange.file.seek(first);
+    exchange.remaining = last - first + 1;
+    QObject::connect(socket, &QTcpSocket::bytesWritten, socket, [socket, &exchange] { send_more(socket, exchange); });
+    send_more(socket, exchange);
+}
+
+void serve(QTcpSocket* socket, const QString& root, bool accept_ranges)
+{
+    auto exchange = std::make_shared<Exchange>();
+
+    QObject::connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+    QObject::connect(socket, &QTcpSocket::readyRead, socket, [socket, exchange, root, accept_ranges] {
+        if (exchange->request.endsWith("\r\n\r\n"))
+        {
+            socket->readAll(); // one request per connection
+            return;
+        }
+
+        exchange->request.append(socket->readAll());
+        const auto end = exchange->request.indexOf("\r\n\r\n");
+        if (end >= 0)
+        {
+            exchange->request.truncate(end + 4);
+            answer(socket, *exchange, root, accept_ranges);
+        }
+    });
+}
+} // namespace
+
+mpt::LocalImageServer::LocalImageServer(const QString& root, bool accept_ranges)
+    : root{root}, accept_ranges{accept_ranges}, context{new QObject}
+{
+    context->moveToThread(&thread);
+    thread.start();
+
+    QMetaObject::invokeMethod(
+        context,
+        [this] {
+            auto server = new QTcpServer{context};
+            QObject::connect(server, &QTcpServer::newConnection, context, [this, server] {
+                while (auto socket = server->nextPendingConnection())
+                    serve(socket, this->root, this->accept_ranges);
+            });
+
+            if (server->listen(QHostAddress::LocalHost))
+                port = server->serverPort();
+        },
+        Qt::BlockingQueuedConnection);
+
+    if (!port)
+    {
+        QMetaObject::invokeMethod(context, [this] { delete context; }, Qt::BlockingQueuedConnection);
+        thread.quit();
+        thread.wait();
+        throw std::runtime_error("cannot listen on the loopback interface");
+    }
+}
+
+mpt::LocalImageServer::~LocalImageServer()
+{
+    QMetaObject::invokeMethod(context, [this] { delete context; }, Qt::BlockingQueuedConnection);
+    thread.quit();
+    thread.wait();
+}
+
+QUrl mpt::LocalImageServer::url_for(const QString& file_name) const
+{
+    return QUrl{QString("http://127.0.0.1:%1/%2").arg(port).arg(file_name)};
+}
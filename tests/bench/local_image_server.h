@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_LOCAL_IMAGE_SERVER_H
+#define MULTIPASS_LOCAL_IMAGE_SERVER_H
+
+#include <QObject>
+#include <QString>
+#include <QThread>
+#include <QUrl>
+
+namespace multipass
+{
+namespace test
+{
+// Serves the files in a directory over HTTP on the loopback interface, from a thread of its own so that whoever
+// downloads from it may block. GET and HEAD are all it answers; byte ranges are honoured, and advertised, only when
+// asked to, so that downloads can be made to take the single connection path
+class LocalImageServer
+{
+public:
+    LocalImageServer(const QString& root, bool accept_ranges);
+    ~LocalImageServer();
+
+    QUrl url_for(const QString& file_name) const;
+
+private:
+    const QString root;
+    const bool accept_ranges;
+    QThread thread;
+    QObject* context; // lives on the thread, along with the server and its sockets
+    quint16 port{0};
+};
+} // namespace test
+} // namespace multipass
+
+#endif // MULTIPASS_LOCAL_IMAGE_SERVER_H
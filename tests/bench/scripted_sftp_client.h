@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_SCRIPTED_SFTP_CLIENT_H
+#define MULTIPASS_SCRIPTED_SFTP_CLIENT_H
+
+#include "mock_sftp.h"
+#include "mock_sftpserver.h"
+#include "mock_ssh.h"
+
+#include <multipass/ssh/ssh_session.h>
+#include <multipass/sshfs_mount/sftp_server.h>
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace multipass
+{
+namespace test
+{
+template <typename T>
+using Stub = MockScope<T>;
+
+// Stands in for sshfs on the other end: a session that connects, then a client that sends a fixed script of
+// messages and goes away once they all have been answered. Stubs rather than mocks, which would record every call.
+// Messages refer to open handles by slot, so a script can keep several files open at once
+struct ScriptedSftpClient
+{
+    using MsgUPtr = std::unique_ptr<sftp_client_message_struct>;
+    using StringUPtr = std::unique_ptr<ssh_string_struct, void (*)(ssh_string)>;
+
+    sftp_client_message add(uint8_t type, int slot = 0)
+    {
+        script.push_back(std::make_unique<sftp_client_message_struct>());
+        script.back()->type = type;
+        slots.push_back(slot);
+        data.push_back(nullptr);
+        return script.back().get();
+    }
+
+    // Strings the messages point to, kept alive as long as the script
+    char* keep(const std::string& str)
+    {
+        strings.push_back(str);
+        return &strings.back()[0];
+    }
+
+    void set_data(sftp_client_message msg, const std::string& str)
+    {
+        for (auto i = script.size(); i-- > 0;)
+            if (script[i].get() == msg)
+            {
+                data[i] = keep(str);
+                return;
+            }
+    }
+
+    sftp_attributes keep_attributes(uint32_t flags, uint32_t permissions)
+    {
+        attributes.emplace_back();
+        attributes.back().flags = flags;
+        attributes.back().permissions = permissions;
+        return &attributes.back();
+    }
+
+    ssh_string payload(uint32_t len)
+    {
+        auto it = payloads.find(len);
+        if (it == payloads.end())
+        {
+            const std::string content(len, 'w');
+            StringUPtr str{ssh_string_new(len), ssh_string_free};
+            ssh_string_fill(str.get(), content.data(), len);
+            it = payloads.emplace(len, std::move(str)).first;
+        }
+        return it->second.get();
+    }
+
+    SftpServer make_server(const std::string& path)
+    {
+        next = 0;
+        return {SSHSession{"a", 42}, path, path, no_mapping, no_mapping, default_id, default_id};
+    }
+
+    std::size_t current() const
+    {
+        return next - 1;
+    }
+
+    std::vector<MsgUPtr> script;
+    std::vector<int> slots;
+    std::vector<char*> data;
+    std::deque<std::string> strings;
+    std::deque<sftp_attributes_struct> attributes;
+    std::map<uint32_t, StringUPtr> payloads;
+    std::size_t next{0};
+    std::unordered_map<int, void*> handles;
+    ssh_channel_callbacks channel_cbs{nullptr};
+    std::unordered_map<int, int> no_mapping;
+    int default_id{1000};
+
+    Stub<decltype(mock_ssh_connect)> connect{mock_ssh_connect, [](auto...) { return SSH_OK; }};
+    Stub<decltype(mock_ssh_is_connected)> is_connected{mock_ssh_is_connected, [](auto...) { return 1; }};
+    Stub<decltype(mock_ssh_channel_open_session)> open_session{mock_ssh_channel_open_session,
+                                                               [](auto...) { return SSH_OK; }};
+    Stub<decltype(mock_ssh_channel_request_exec)> request_exec{mock_ssh_channel_request_exec,
+                                                               [](auto...) { return SSH_OK; }};
+    Stub<decltype(mock_ssh_add_channel_callbacks)> add_channel_cbs{mock_ssh_add_channel_callbacks,
+                                                                   [this](ssh_channel, ssh_channel_callbacks cb) {
+                                                                       channel_cbs = cb;
+                                                                       return SSH_OK;
+                                                                   }};
+    Stub<decltype(mock_ssh_event_dopoll)> event_do_poll{mock_ssh_event_dopoll, [this](auto...) {
+                                                            channel_cbs->channel_exit_status_function(
+                                                                nullptr, nullptr, 0, channel_cbs->userdata);
+                                                            return SSH_OK;
+                                                        }};
+    std::string pending_init;
+    Stub<decltype(mock_ssh_channel_read)> read_sftp_init{
+        mock_ssh_channel_read, [this](ssh_channel, void* dest, uint32_t count, int) {
+            // The client's SSH_FXP_INIT, for each sftp session the server starts
+            if (pending_init.empty())
+                pending_init.assign("\0\0\0\x05\x01\0\0\0\x03", 9);
+            const auto size = std::min<std::string::size_type>(count, pending_init.size());
+            std::copy_n(pending_init.begin(), size, static_cast<char*>(dest));
+            pending_init.erase(0, size);
+            return static_cast<int>(size);
+        }};
+    Stub<decltype(mock_sftp_free)> free_sftp{mock_sftp_free, [](sftp_session sftp) {
+                                                 std::free(sftp->handles);
+                                                 std::free(sftp);
+                                             }};
+    Stub<decltype(mock_sftp_get_client_message)> get_client_msg{
+        mock_sftp_get_client_message,
+        [this](auto...) -> sftp_client_message { return next < script.size() ? script[next++].get() : nullptr; }};
+    Stub<decltype(mock_sftp_client_message_free)> msg_free{mock_sftp_client_message_free, [](auto...) {}};
+    Stub<decltype(mock_sftp_client_message_get_data)> get_data{mock_sftp_client_message_get_data,
+                                                               [this](auto...) { return data[current()]; }};
+    Stub<decltype(mock_sftp_handle_alloc)> handle_alloc{mock_sftp_handle_alloc, [this](sftp_session, void* info) {
+                                                            handles[slots[current()]] = info;
+                                                            return nullptr;
+                                                        }};
+    Stub<decltype(mock_sftp_handle)> get_handle{mock_sftp_handle,
+                                                [this](auto...) { return handles[slots[current()]]; }};
+    Stub<decltype(mock_sftp_handle_remove)> handle_remove{mock_sftp_handle_remove, [](auto...) {}};
+    Stub<decltype(mock_sftp_reply_handle)> reply_handle{mock_sftp_reply_handle, [](auto...) { return SSH_OK; }};
+    Stub<decltype(mock_sftp_reply_status)> reply_status{mock_sftp_reply_status, [](auto...) { return SSH_OK; }};
+    Stub<decltype(mock_sftp_reply_attr)> reply_attr{mock_sftp_reply_attr, [](auto...) { return SSH_OK; }};
+    Stub<decltype(mock_sftp_reply_name)> reply_name{mock_sftp_reply_name, [](auto...) { return SSH_OK; }};
+    Stub<decltype(mock_sftp_reply_data)> reply_data{mock_sftp_reply_data,
+                                                    [](sftp_client_message, const void* data, int) {
+                                                        benchmark::DoNotOptimize(data);
+                                                        return SSH_OK;
+                                                    }};
+    Stub<decltype(mock_sftp_reply_names_add)> reply_names_add{mock_sftp_reply_names_add,
+                                                              [](auto...) { return SSH_OK; }};
+    Stub<decltype(mock_sftp_reply_names)> reply_names{mock_sftp_reply_names, [](auto...) { return SSH_OK; }};
+};
+} // namespace test
+} // namespace multipass
+
+#endif // MULTIPASS_SCRIPTED_SFTP_CLIENT_H
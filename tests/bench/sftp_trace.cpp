@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "sftp_trace.h"
+#include "file_operations.h"
+
+#include <multipass/format.h>
+
+#include <QDir>
+#include <QFile>
+#include <QStringList>
+#include <QTextStream>
+
+#include <stdexcept>
+#include <unordered_map>
+
+namespace mpt = multipass::test;
+
+namespace
+{
+uint32_t open_flags(const QString& flags)
+{
+    static const std::unordered_map<char, uint32_t> flag_for{{'r', SSH_FXF_READ},  {'w', SSH_FXF_WRITE},
+                                                             {'a', SSH_FXF_APPEND}, {'c', SSH_FXF_CREAT},
+                                                             {'t', SSH_FXF_TRUNC},  {'x', SSH_FXF_EXCL}};
+    uint32_t result{0};
+    for (const auto flag : flags.toStdString())
+    {
+        auto it = flag_for.find(flag);
+        if (it == flag_for.end())
+            throw std::runtime_error(fmt::format("unknown open flag '{}'", flag));
+        result |= it->second;
+    }
+
+    return result;
+}
+
+const std::unordered_map<std::string, uint8_t> path_requests{
+    {"stat", SFTP_STAT},   {"lstat", SFTP_LSTAT}, {"realpath", SFTP_REALPATH}, {"readlink", SFTP_READLINK},
+    {"mkdir", SFTP_MKDIR}, {"rmdir", SFTP_RMDIR}, {"remove", SFTP_REMOVE}};
+} // namespace
+
+int mpt::load_sftp_trace(const QString& trace_path, const QString& root, ScriptedSftpClient& client)
+{
+    QFile trace{trace_path};
+    if (!trace.open(QIODevice::ReadOnly | QIODevice::Text))
+        throw std::runtime_error(fmt::format("cannot read {}", trace_path));
+
+    const QDir root_dir{root};
+    auto path = [&root_dir, &client](const QString& relative) {
+        return client.keep(QDir::cleanPath(root_dir.filePath(relative)).toStdString());
+    };
+
+    int requests{0}, line_number{0};
+    QTextStream in{&trace};
+    while (!in.atEnd())
+    {
+        ++line_number;
+        const auto fields = in.readLine().split(' ', QString::SkipEmptyParts);
+        if (fields.isEmpty() || fields[0].startsWith('#'))
+            continue;
+
+        auto field = [&fields, &trace_path, line_number](int i) {
+            if (i >= fields.size())
+                throw std::runtime_error(fmt::format("{}:{}: missing arguments", trace_path, line_number));
+            return fields[i];
+        };
+        auto number = [&field](int i) { return field(i).toULongLong(); };
+        auto slot = [&number](int i) { return static_cast<int>(number(i)); };
+
+        const auto request = fields[0].toStdString();
+        if (request == "file")
+        {
+            root_dir.mkpath(QFileInfo{root_dir.filePath(field(1))}.path());
+            mpt::make_file_with_content(root_dir.filePath(field(1)), std::string(number(2), 'f'));
+            continue;
+        }
+        if (request == "dir")
+        {
+            root_dir.mkpath(field(1));
+            continue;
+        }
+
+        ++requests;
+        if (request == "open")
+        {
+            auto msg = client.add(SFTP_OPEN, slot(1));
+            msg->filename = path(field(2));
+            msg->flags = open_flags(field(3));
+            msg->attr = client.keep_attributes(SSH_FILEXFER_ATTR_PERMISSIONS, 0644);
+        }
+        else if (request == "opendir")
+        {
+            client.add(SFTP_OPENDIR, slot(1))->filename = path(field(2));
+        }
+        else if (request == "close" || request == "fstat" || request == "readdir")
+        {
+            auto type = request == "close" ? SFTP_CLOSE : request == "fstat" ? SFTP_FSTAT : SFTP_READDIR;
+            client.add(type, slot(1));
+        }
+        else if (request == "read" || request == "write")
+        {
+            auto msg = client.add(request == "read" ? SFTP_READ : SFTP_WRITE, slot(1));
+            msg->offset = number(2);
+            if (request == "read")
+                msg->len = number(3);
+            else
+                msg->data = client.payload(number(3));
+        }
+        else if (request == "fsetstat")
+        {
+            client.add(SFTP_FSETSTAT, slot(1))->attr =
+                client.keep_attributes(SSH_FILEXFER_ATTR_PERMISSIONS, field(2).toUInt(nullptr, 8));
+        }
+        else if (request == "setstat")
+        {
+            auto msg = client.add(SFTP_SETSTAT);
+            msg->filename = path(field(1));
+            msg->attr = client.keep_attributes(SSH_FILEXFER_ATTR_PERMISSIONS, field(2).toUInt(nullptr, 8));
+        }
+        else if (request == "rename")
+        {
+            auto msg = client.add(SFTP_RENAME);
+            msg->filename = path(field(1));
+            client.set_data(msg, path(field(2)));
+        }
+        else if (path_requests.count(request))
+        {
+            auto msg = client.add(path_requests.at(request));
+            msg->filename = path(field(1));
+            msg->attr = client.keep_attributes(SSH_FILEXFER_ATTR_PERMISSIONS, 0755); // mkdir uses it
+        }
+        else
+        {
+            throw std::runtime_error(fmt::format("{}:{}: unknown request \"{}\"", trace_path, line_number, request));
+        }
+    }
+
+    return requests;
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MULTIPASS_SFTP_TRACE_H
+#define MULTIPASS_SFTP_TRACE_H
+
+#include "scripted_sftp_client.h"
+
+#include <QString>
+
+namespace multipass
+{
+namespace test
+{
+// Loads a recorded sshfs session into the client's script and lays out, under root, the files it expects to find.
+// A trace has one request per line, with paths relative to the mount and handles named by slot:
+//   file <path> <size> | dir <path>                  made before the replay starts
+//   open <slot> <path> <flags: r w a c t x>          close|fstat|readdir <slot>
+//   read|write <slot> <offset> <length>              fsetstat <slot> <mode>
+//   opendir <slot> <path>                            setstat <path> <mode>
+//   stat|lstat|realpath|readlink|mkdir|rmdir|remove <path>
+//   rename <from> <to>
+// Returns how many requests the trace makes; throws on lines it cannot read
+int load_sftp_trace(const QString& trace_path, const QString& root, ScriptedSftpClient& client);
+} // namespace test
+} // namespace multipass
+
+#endif // MULTIPASS_SFTP_TRACE_H
@@ -34,13 +34,21 @@ add_c_mocks(
   ssh_options_set
   ssh_userauth_publickey
   ssh_channel_is_closed
+  ssh_channel_is_open
+  ssh_channel_is_eof
   ssh_channel_new
   ssh_channel_open_session
   ssh_channel_request_exec
   ssh_channel_request_shell
   ssh_channel_request_pty
   ssh_channel_change_pty_size
+  ssh_channel_read
   ssh_channel_read_timeout
+  ssh_channel_read_nonblocking
+  ssh_channel_poll_timeout
+  ssh_channel_select
+  ssh_channel_write
+  ssh_channel_window_size
   ssh_channel_get_exit_status
   ssh_event_dopoll
   ssh_add_channel_callbacks
@@ -61,11 +69,16 @@ add_c_mocks(
   sftp_handle
   sftp_handle_alloc
   sftp_handle_remove
+  inotify_add_watch
   sftp_new
   sftp_init
   sftp_open
   sftp_write
   sftp_read
+  sftp_async_read_begin
+  sftp_async_read
+  sftp_fstat
+  sftp_stat
   sftp_free
   sftp_get_error
   sftp_close
@@ -23,6 +23,9 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <chrono>
+#include <thread>
+
 namespace mpt = multipass::test;
 
 /*
@@ -42,6 +45,11 @@ int virConnectClose(virConnectPtr conn)
     return 0;
 }
 
+int virConnectRef(virConnectPtr /*conn*/)
+{
+    return 0;
+}
+
 char* virConnectGetCapabilities(virConnectPtr /*conn*/)
 {
     return strdup("");
@@ -53,6 +61,42 @@ int virConnectGetVersion(virConnectPtr /*conn*/, unsigned long* hvVer)
     return 0;
 }
 
+int virConnectIsAlive(virConnectPtr /*conn*/)
+{
+    return 1;
+}
+
+// Without domain events, instances keep asking libvirt for their state, as most tests expect
+int virConnectDomainEventRegisterAny(virConnectPtr /*conn*/, virDomainPtr /*dom*/, int /*eventID*/,
+                                     virConnectDomainEventGenericCallback /*cb*/, void* /*opaque*/,
+                                     virFreeCallback /*freecb*/)
+{
+    return -1;
+}
+
+int virConnectDomainEventDeregisterAny(virConnectPtr /*conn*/, int /*callbackID*/)
+{
+    return 0;
+}
+
+int virConnectRegisterCloseCallback(virConnectPtr /*conn*/, virConnectCloseFunc /*cb*/, void* /*opaque*/,
+                                    virFreeCallback /*freecb*/)
+{
+    return 0;
+}
+
+int virConnectUnregisterCloseCallback(virConnectPtr /*conn*/, virConnectCloseFunc /*cb*/)
+{
+    return 0;
+}
+
+int virConnectGetAllDomainStats(virConnectPtr /*conn*/, unsigned int /*stats*/, virDomainStatsRecordPtr** retStats,
+                                unsigned int /*flags*/)
+{
+    *retStats = nullptr;
+    return 0;
+}
+
 int virDomainCreate(virDomainPtr /*domain*/)
 {
     return 0;
@@ -80,6 +124,11 @@ int virDomainGetState(virDomainPtr /*domain*/, int* state, int* /*reason*/, unsi
     return 0;
 }
 
+const char* virDomainGetName(virDomainPtr /*domain*/)
+{
+    return "pied-piper-valley";
+}
+
 char* virDomainGetXMLDesc(virDomainPtr /*domain*/, unsigned int /*flags*/)
 {
     return strdup("mac");
@@ -105,6 +154,13 @@ int virDomainShutdown(virDomainPtr /*domain*/)
     return 0;
 }
 
+void virDomainStatsRecordListFree(virDomainStatsRecordPtr* stats)
+{
+    for (auto record = stats; record && *record; ++record)
+        free(*record);
+    free(stats);
+}
+
 int virDomainUndefine(virDomainPtr /*domain*/)
 {
     return 0;
@@ -156,6 +212,36 @@ virNetworkPtr virNetworkLookupByName(virConnectPtr /*conn*/, const char* /*name*
     return mpt::fake_handle<virNetworkPtr>();
 }
 
+int virTypedParamsGetInt(virTypedParameterPtr /*params*/, int /*nparams*/, const char* /*name*/, int* /*value*/)
+{
+    return 0;
+}
+
+int virEventRegisterDefaultImpl()
+{
+    return 0;
+}
+
+int virEventRunDefaultImpl()
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    return 0;
+}
+
+int virEventAddTimeout(int /*timeout*/, virEventTimeoutCallback /*cb*/, void* /*opaque*/, virFreeCallback /*ff*/)
+{
+    return 1;
+}
+
+void virEventUpdateTimeout(int /*timer*/, int /*timeout*/)
+{
+}
+
+int virEventRemoveTimeout(int /*timer*/)
+{
+    return 0;
+}
+
 const char* virGetLastErrorMessage()
 {
     static char fake_error[64] = "";
@@ -31,7 +31,13 @@
 #include <multipass/virtual_machine.h>
 #include <multipass/virtual_machine_description.h>
 
+#include <QJsonDocument>
+#include <QJsonObject>
+
 #include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
 
 #include <gmock/gmock.h>
 
@@ -74,6 +80,7 @@ TEST_F(LibVirtBackend, health_check_failed_connection_throws)
 {
     mp::LibVirtVirtualMachineFactory backend(data_dir.path(), fake_libvirt_path);
     backend.libvirt_wrapper->virConnectOpen = [](auto...) -> virConnectPtr { return nullptr; };
+    backend.libvirt_wrapper->virConnectIsAlive = [](auto...) { return 0; };
 
     EXPECT_THROW(backend.hypervisor_health_check(), std::runtime_error);
 }
@@ -195,10 +202,71 @@ TEST_F(LibVirtBackend, machine_persists_and_sets_state_on_suspend)
     EXPECT_THAT(machine->current_state(), Eq(mp::VirtualMachine::State::suspended));
 }
 
+TEST_F(LibVirtBackend, suspend_bypasses_the_page_cache)
+{
+    mp::LibVirtVirtualMachineFactory backend{data_dir.path(), fake_libvirt_path};
+    backend.libvirt_wrapper->virDomainGetState = [](auto, auto state, auto, auto) {
+        *state = VIR_DOMAIN_RUNNING;
+        return 0;
+    };
+    static std::vector<unsigned int> save_flags;
+    save_flags.clear();
+    backend.libvirt_wrapper->virDomainManagedSave = [](auto, unsigned int flags) {
+        save_flags.push_back(flags);
+        return 0;
+    };
+
+    NiceMock<mpt::MockVMStatusMonitor> mock_monitor;
+    auto machine = backend.create_virtual_machine(default_description, mock_monitor);
+    machine->suspend();
+
+    EXPECT_THAT(save_flags, ElementsAre(VIR_DOMAIN_SAVE_BYPASS_CACHE));
+}
+
+TEST_F(LibVirtBackend, suspend_goes_through_the_page_cache_without_direct_io)
+{
+    mp::LibVirtVirtualMachineFactory backend{data_dir.path(), fake_libvirt_path};
+    backend.libvirt_wrapper->virDomainGetState = [](auto, auto state, auto, auto) {
+        *state = VIR_DOMAIN_RUNNING;
+        return 0;
+    };
+    static std::vector<unsigned int> save_flags;
+    save_flags.clear();
+    backend.libvirt_wrapper->virDomainManagedSave = [](auto, unsigned int flags) {
+        save_flags.push_back(flags);
+        return flags & VIR_DOMAIN_SAVE_BYPASS_CACHE ? -1 : 0;
+    };
+
+    NiceMock<mpt::MockVMStatusMonitor> mock_monitor;
+    auto machine = backend.create_virtual_machine(default_description, mock_monitor);
+    machine->suspend();
+
+    EXPECT_THAT(save_flags, ElementsAre(VIR_DOMAIN_SAVE_BYPASS_CACHE, 0u));
+    EXPECT_THAT(machine->current_state(), Eq(mp::VirtualMachine::State::suspended));
+}
+
+TEST_F(LibVirtBackend, saves_for_exit_in_the_background)
+{
+    mp::LibVirtVirtualMachineFactory backend{data_dir.path(), fake_libvirt_path};
+    backend.libvirt_wrapper->virDomainGetState = [](auto, auto state, auto, auto) {
+        *state = VIR_DOMAIN_RUNNING;
+        return 0;
+    };
+
+    NiceMock<mpt::MockVMStatusMonitor> mock_monitor;
+    auto machine = backend.create_virtual_machine(default_description, mock_monitor);
+
+    EXPECT_CALL(mock_monitor, persist_state_for(_, _)).Times(0);
+    ASSERT_TRUE(machine->start_saving_for_exit());
+    while (machine->current_state() == mp::VirtualMachine::State::suspending)
+        std::this_thread::sleep_for(1ms);
+}
+
 TEST_F(LibVirtBackend, start_with_broken_libvirt_connection_throws)
 {
     mp::LibVirtVirtualMachineFactory backend{data_dir.path(), fake_libvirt_path};
     backend.libvirt_wrapper->virConnectOpen = [](auto...) -> virConnectPtr { return nullptr; };
+    backend.libvirt_wrapper->virConnectIsAlive = [](auto...) { return 0; };
 
     NiceMock<mpt::MockVMStatusMonitor> mock_monitor;
     auto machine = backend.create_virtual_machine(default_description, mock_monitor);
@@ -212,6 +280,7 @@ TEST_F(LibVirtBackend, shutdown_with_broken_libvirt_connection_throws)
 {
     mp::LibVirtVirtualMachineFactory backend{data_dir.path(), fake_libvirt_path};
     backend.libvirt_wrapper->virConnectOpen = [](auto...) -> virConnectPtr { return nullptr; };
+    backend.libvirt_wrapper->virConnectIsAlive = [](auto...) { return 0; };
 
     NiceMock<mpt::MockVMStatusMonitor> mock_monitor;
     auto machine = backend.create_virtual_machine(default_description, mock_monitor);
@@ -225,6 +294,7 @@ TEST_F(LibVirtBackend, suspend_with_broken_libvirt_connection_throws)
 {
     mp::LibVirtVirtualMachineFactory backend{data_dir.path(), fake_libvirt_path};
     backend.libvirt_wrapper->virConnectOpen = [](auto...) -> virConnectPtr { return nullptr; };
+    backend.libvirt_wrapper->virConnectIsAlive = [](auto...) { return 0; };
 
     NiceMock<mpt::MockVMStatusMonitor> mock_monitor;
     auto machine = backend.create_virtual_machine(default_description, mock_monitor);
@@ -238,6 +308,7 @@ TEST_F(LibVirtBackend, current_state_with_broken_libvirt_unknown)
 {
     mp::LibVirtVirtualMachineFactory backend{data_dir.path(), fake_libvirt_path};
     backend.libvirt_wrapper->virConnectOpen = [](auto...) -> virConnectPtr { return nullptr; };
+    backend.libvirt_wrapper->virConnectIsAlive = [](auto...) { return 0; };
 
     NiceMock<mpt::MockVMStatusMonitor> mock_monitor;
     auto machine = backend.create_virtual_machine(default_description, mock_monitor);
@@ -286,6 +357,198 @@ TEST_F(LibVirtBackend, current_state_off_domain_starts_running)
     EXPECT_THAT(machine->current_state(), Eq(mp::VirtualMachine::State::running));
 }
 
+TEST_F(LibVirtBackend, current_state_follows_domain_events_without_querying_libvirt)
+{
+    static virConnectDomainEventGenericCallback lifecycle_callback;
+    static void* lifecycle_opaque;
+    static auto state_queries{0};
+    lifecycle_callback = nullptr;
+    state_queries = 0;
+
+    mp::LibVirtVirtualMachineFactory backend{data_dir.path(), fake_libvirt_path};
+    backend.libvirt_wrapper->virConnectDomainEventRegisterAny = [](virConnectPtr, virDomainPtr, int,
+                                                                   virConnectDomainEventGenericCallback cb,
+                                                                   void* opaque, virFreeCallback) {
+        lifecycle_callback = cb;
+        lifecycle_opaque = opaque;
+        return 1;
+    };
+
+    NiceMock<mpt::MockVMStatusMonitor> mock_monitor;
+    auto machine = backend.create_virtual_machine(default_description, mock_monitor);
+    ASSERT_THAT(lifecycle_callback, NotNull());
+
+    backend.libvirt_wrapper->virDomainGetState = [](auto, auto state, auto, auto) {
+        ++state_queries;
+        *state = VIR_DOMAIN_RUNNING;
+        return 0;
+    };
+
+    EXPECT_THAT(machine->current_state(), Eq(mp::VirtualMachine::State::off));
+    EXPECT_EQ(state_queries, 0);
+
+    reinterpret_cast<virConnectDomainEventCallback>(lifecycle_callback)(
+        nullptr, mpt::fake_handle<virDomainPtr>(), VIR_DOMAIN_EVENT_STARTED, 0, lifecycle_opaque);
+
+    EXPECT_THAT(machine->current_state(), Eq(mp::VirtualMachine::State::running));
+    EXPECT_EQ(state_queries, 1);
+}
+
+TEST_F(LibVirtBackend, query_instances_gets_all_states_and_addresses_in_single_calls)
+{
+    static auto stats_queries{0};
+    static auto lease_queries{0};
+    stats_queries = lease_queries = 0;
+
+    mp::LibVirtVirtualMachineFactory backend{data_dir.path(), fake_libvirt_path};
+    backend.libvirt_wrapper->virDomainGetXMLDesc = [](auto...) {
+        return strdup("<domain><mac address='52:54:00:00:00:01'/></domain>");
+    };
+
+    NiceMock<mpt::MockVMStatusMonitor> mock_monitor;
+    mp::VirtualMachine::ShPtr machine = backend.create_virtual_machine(default_description, mock_monitor);
+
+    backend.libvirt_wrapper->virConnectGetAllDomainStats = [](virConnectPtr, unsigned int,
+                                                              virDomainStatsRecordPtr** stats, unsigned int) {
+        ++stats_queries;
+        auto records = static_cast<virDomainStatsRecordPtr*>(calloc(2, sizeof(virDomainStatsRecordPtr)));
+        records[0] = static_cast<virDomainStatsRecordPtr>(calloc(1, sizeof(virDomainStatsRecord)));
+        records[0]->dom = mpt::fake_handle<virDomainPtr>();
+        *stats = records;
+
+        return 1;
+    };
+    backend.libvirt_wrapper->virTypedParamsGetInt = [](virTypedParameterPtr, int, const char* name, int* value) {
+        if (strcmp(name, "state.state") != 0)
+            return 0;
+
+        *value = VIR_DOMAIN_RUNNING;
+        return 1;
+    };
+    backend.libvirt_wrapper->virNetworkGetDHCPLeases = [](auto, auto, auto leases, auto) {
+        ++lease_queries;
+        virNetworkDHCPLeasePtr* leases_ret;
+        leases_ret = (virNetworkDHCPLeasePtr*)calloc(1, sizeof(virNetworkDHCPLeasePtr));
+        leases_ret[0] = (virNetworkDHCPLeasePtr)calloc(1, sizeof(virNetworkDHCPLease));
+        leases_ret[0]->mac = strdup("52:54:00:00:00:01");
+        leases_ret[0]->ipaddr = strdup("10.0.0.5");
+        *leases = leases_ret;
+
+        return 1;
+    };
+
+    auto states = backend.query_instances({machine});
+
+    ASSERT_EQ(states.count(default_description.vm_name), 1u);
+    EXPECT_THAT(states[default_description.vm_name].state, Eq(mp::VirtualMachine::State::running));
+    EXPECT_EQ(states[default_description.vm_name].ipv4, "10.0.0.5");
+    EXPECT_EQ(stats_queries, 1);
+    EXPECT_EQ(lease_queries, 1);
+}
+
+TEST_F(LibVirtBackend, instances_share_the_network_and_host_capabilities)
+{
+    static auto network_lookups{0};
+    static auto capabilities_queries{0};
+    network_lookups = capabilities_queries = 0;
+
+    mp::LibVirtVirtualMachineFactory backend{data_dir.path(), fake_libvirt_path};
+    backend.libvirt_wrapper->virNetworkLookupByName = [](auto...) {
+        ++network_lookups;
+        return mpt::fake_handle<virNetworkPtr>();
+    };
+    backend.libvirt_wrapper->virConnectGetCapabilities = [](auto...) {
+        ++capabilities_queries;
+        return strdup("<capabilities><host><cpu><arch>x86_64</arch></cpu></host></capabilities>");
+    };
+    backend.libvirt_wrapper->virDomainLookupByName = [](auto...) -> virDomainPtr { return nullptr; };
+    backend.libvirt_wrapper->virDomainGetState = [](auto, auto state, auto, auto) {
+        *state = VIR_DOMAIN_RUNNING;
+        return 0;
+    };
+
+    NiceMock<mpt::MockVMStatusMonitor> mock_monitor;
+    auto first = backend.create_virtual_machine(default_description, mock_monitor);
+    auto second = backend.create_virtual_machine(default_description, mock_monitor);
+
+    EXPECT_THAT(first->current_state(), Eq(mp::VirtualMachine::State::running));
+    EXPECT_THAT(second->current_state(), Eq(mp::VirtualMachine::State::running));
+    EXPECT_EQ(network_lookups, 0); // the factory looked the network up already, while it was being set up
+    EXPECT_EQ(capabilities_queries, 1);
+}
+
+TEST_F(LibVirtBackend, guest_stats_are_empty_without_libvirt_qemu)
+{
+    mp::LibVirtVirtualMachineFactory backend{data_dir.path(), fake_libvirt_path};
+    mpt::StubVMStatusMonitor stub_monitor;
+    auto machine = backend.create_virtual_machine(default_description, stub_monitor);
+
+    ASSERT_EQ(backend.libvirt_wrapper->virDomainQemuAgentCommand, nullptr);
+    EXPECT_TRUE(machine->guest_stats().empty());
+}
+
+TEST_F(LibVirtBackend, guest_stats_come_from_the_guest_agent)
+{
+    static std::string opened_file;
+
+    mp::LibVirtVirtualMachineFactory backend{data_dir.path(), fake_libvirt_path};
+    mpt::StubVMStatusMonitor stub_monitor;
+    auto machine = backend.create_virtual_machine(default_description, stub_monitor);
+
+    backend.libvirt_wrapper->virDomainQemuAgentCommand = [](virDomainPtr, const char* cmd, int, unsigned int) {
+        const auto request = QJsonDocument::fromJson(cmd).object();
+        const auto command = request["execute"].toString();
+        const auto arguments = request["arguments"].toObject();
+
+        QByteArray reply;
+        if (command == "guest-file-open")
+        {
+            opened_file = arguments["path"].toString().toStdString();
+            reply = "1";
+        }
+        else if (command == "guest-file-read")
+        {
+            const QByteArray contents = opened_file == "/proc/loadavg"
+                                            ? "0.50 0.25 0.10 1/100 1234\n"
+                                            : "MemTotal: 2000 kB\nMemFree: 500 kB\nBuffers: 100 kB\n"
+                                              "Cached: 300 kB\nSReclaimable: 100 kB\n";
+            reply = "{\"count\": " + QByteArray::number(contents.size()) + ", \"buf-b64\": \"" +
+                    contents.toBase64() + "\", \"eof\": true}";
+        }
+        else if (command == "guest-file-close")
+            reply = "{}";
+        else if (command == "guest-get-fsinfo")
+            reply = "[{\"mountpoint\": \"/boot/efi\"}, "
+                    "{\"mountpoint\": \"/\", \"used-bytes\": 1000, \"total-bytes\": 5000}]";
+        else if (command == "guest-get-osinfo")
+            reply = "{\"pretty-name\": \"Ubuntu 18.04.3 LTS\"}";
+        else if (command == "guest-get-users")
+            reply = "[{\"user\": \"ubuntu\"}]";
+        else
+            return static_cast<char*>(nullptr);
+
+        return strdup(("{\"return\": " + reply + "}").constData());
+    };
+
+    const auto stats = machine->guest_stats();
+
+    EXPECT_THAT(stats, UnorderedElementsAre(Pair("load", "0.50 0.25 0.10"), Pair("memory_usage", "1024000"),
+                                            Pair("memory_total", "2048000"), Pair("disk_usage", "1000"),
+                                            Pair("disk_total", "5000"), Pair("current_release", "Ubuntu 18.04.3 LTS"),
+                                            Pair("sessions", "1")));
+}
+
+TEST_F(LibVirtBackend, guest_stats_are_empty_when_the_guest_runs_no_agent)
+{
+    mp::LibVirtVirtualMachineFactory backend{data_dir.path(), fake_libvirt_path};
+    mpt::StubVMStatusMonitor stub_monitor;
+    auto machine = backend.create_virtual_machine(default_description, stub_monitor);
+
+    backend.libvirt_wrapper->virDomainQemuAgentCommand = [](auto...) { return static_cast<char*>(nullptr); };
+
+    EXPECT_TRUE(machine->guest_stats().empty());
+}
+
 TEST_F(LibVirtBackend, returns_version_string)
 {
     mp::LibVirtVirtualMachineFactory backend{data_dir.path(), fake_libvirt_path};
@@ -326,6 +589,7 @@ TEST_F(LibVirtBackend, returns_version_string_when_failed_connecting)
 
     mp::LibVirtVirtualMachineFactory backend{data_dir.path(), fake_libvirt_path};
     backend.libvirt_wrapper->virConnectOpen = [](auto...) -> virConnectPtr { return nullptr; };
+    backend.libvirt_wrapper->virConnectIsAlive = [](auto...) { return 0; };
     backend.libvirt_wrapper->virConnectGetVersion = [](virConnectPtr conn, long unsigned int* hwVer) {
         return static_virConnectGetVersion(conn, hwVer);
     };
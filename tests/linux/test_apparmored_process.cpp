@@ -76,10 +76,24 @@ TEST_F(ApparmoredProcessTest, loads_profile_with_apparmor)
     EXPECT_TRUE(input.contains(apparmor_profile_text));
 }
 
-TEST_F(ApparmoredProcessTest, unloads_profile_with_apparmor_on_process_out_of_scope)
+TEST_F(ApparmoredProcessTest, keeps_profile_loaded_for_later_processes)
 {
     auto process = process_factory.create_process(std::make_unique<TestProcessSpec>());
     process.reset();
+    QFile::remove(apparmor_output_file);
+
+    process = process_factory.create_process(std::make_unique<TestProcessSpec>());
+
+    // the parser should not have run again
+    EXPECT_FALSE(QFile::exists(apparmor_output_file));
+}
+
+TEST_F(ApparmoredProcessTest, unloads_profile_with_apparmor_when_factory_goes_away)
+{
+    auto process = process_factory.create_process(std::make_unique<TestProcessSpec>());
+    process.reset();
+
+    mpt::ResetProcessFactory{}; // drops the factory and its AppArmor
 
     // apparmor profile should have been removed
     QFile apparmor_input(apparmor_output_file);
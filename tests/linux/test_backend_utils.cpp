@@ -17,15 +17,20 @@
 
 #include <src/platform/backends/shared/linux/backend_utils.h>
 
+#include <multipass/constants.h>
 #include <multipass/format.h>
 #include <multipass/memory_size.h>
 
 #include "tests/extra_assertions.h"
 #include "tests/mock_process_factory.h"
+#include "tests/mock_settings.h"
 
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
+#include <QTemporaryFile>
+#include <QtEndian>
+
 namespace mp = multipass;
 namespace mpt = multipass::test;
 
@@ -38,6 +43,19 @@ const auto failure = mp::ProcessState{1, mp::nullopt};
 const auto crash = mp::ProcessState{mp::nullopt, mp::ProcessState::Error{QProcess::Crashed, "core dumped"}};
 const auto null_string_matcher = static_cast<mp::optional<decltype(_)>>(mp::nullopt);
 
+// Just enough of a qcow2 header for its format and virtual size to be read
+void write_qcow2_header(QTemporaryFile& file, const mp::MemorySize& size)
+{
+    QByteArray header(32, '\0');
+    qToBigEndian<quint32>(0x514649fb, header.data());
+    qToBigEndian<quint32>(3, header.data() + 4);
+    qToBigEndian<quint64>(size.in_bytes(), header.data() + 24);
+
+    ASSERT_TRUE(file.open());
+    file.write(header);
+    file.flush();
+}
+
 QByteArray fake_img_info(const mp::MemorySize& size)
 {
     return QByteArray::fromStdString(
@@ -238,3 +256,178 @@ TEST(BackendUtils, image_resizing_not_attempted_when_minimum_size_not_understood
     test_image_resizing(img, min_size, request_size, qemuimg_info_output, qemuimg_info_result, attempt_resize,
                         qemuimg_resize_result, throw_msg_matcher);
 }
+
+TEST(BackendUtils, image_resizing_reads_qcow2_size_without_qemuimg_info)
+{
+    QTemporaryFile img;
+    write_qcow2_header(img, mp::MemorySize{"2G"});
+    const auto request_size = mp::MemorySize{"5G"};
+    auto process_count = 0;
+    auto mock_factory_scope = mpt::MockProcessFactory::Inject();
+
+    mock_factory_scope->register_callback([&](mpt::MockProcess* process) {
+        ++process_count;
+        simulate_qemuimg_resize(process, img.fileName(), request_size, success);
+    });
+
+    mp::backend::resize_instance_image(request_size, img.fileName());
+
+    EXPECT_EQ(process_count, 1);
+}
+
+TEST(BackendUtils, image_resizing_not_attempted_when_below_qcow2_size)
+{
+    QTemporaryFile img;
+    write_qcow2_header(img, mp::MemorySize{"3G"});
+    auto mock_factory_scope = mpt::MockProcessFactory::Inject();
+
+    mock_factory_scope->register_callback([](mpt::MockProcess*) { ADD_FAILURE() << "no process expected"; });
+
+    MP_EXPECT_THROW_THAT(mp::backend::resize_instance_image(mp::MemorySize{"2G"}, img.fileName()),
+                         std::runtime_error, Property(&std::runtime_error::what, HasSubstr("below minimum")));
+}
+
+TEST(BackendUtils, qcow2_image_is_not_converted)
+{
+    QTemporaryFile img;
+    write_qcow2_header(img, mp::MemorySize{"1G"});
+    auto mock_factory_scope = mpt::MockProcessFactory::Inject();
+
+    mock_factory_scope->register_callback([](mpt::MockProcess*) { ADD_FAILURE() << "no process expected"; });
+
+    EXPECT_EQ(mp::backend::convert_to_qcow_if_necessary(img.fileName()), img.fileName());
+}
+
+TEST(BackendUtils, raw_image_is_converted_in_parallel_with_compression_when_set)
+{
+    const auto img = "/images/custom.img";
+    auto& mock_settings = mpt::MockSettings::mock_instance();
+    EXPECT_CALL(mock_settings, get(Eq(mp::image_compression_key))).WillOnce(Return("true"));
+
+    QStringList convert_args;
+    auto mock_factory_scope = mpt::MockProcessFactory::Inject();
+    mock_factory_scope->register_callback([&convert_args](mpt::MockProcess* process) {
+        if (process->arguments().constFirst() == "info")
+            ON_CALL(*process, read_all_standard_output).WillByDefault(Return("{\"format\": \"raw\"}"));
+        else
+            convert_args = process->arguments();
+    });
+
+    EXPECT_EQ(mp::backend::convert_to_qcow_if_necessary(img), QString{img} + ".qcow2");
+    EXPECT_THAT(convert_args, AllOf(Contains("-m"), Contains("-c"), Contains("compression_type=zstd")));
+    EXPECT_THAT(convert_args, Not(Contains("-W")));
+}
+
+TEST(BackendUtils, qcow2_image_is_recompressed_when_compression_is_set)
+{
+    QTemporaryFile img;
+    write_qcow2_header(img, mp::MemorySize{"1G"});
+    auto& mock_settings = mpt::MockSettings::mock_instance();
+    EXPECT_CALL(mock_settings, get(Eq(mp::image_compression_key))).WillRepeatedly(Return("true"));
+
+    QStringList convert_args;
+    auto mock_factory_scope = mpt::MockProcessFactory::Inject();
+    mock_factory_scope->register_callback(
+        [&convert_args](mpt::MockProcess* process) { convert_args = process->arguments(); });
+
+    EXPECT_EQ(mp::backend::convert_to_qcow_if_necessary(img.fileName()), img.fileName() + ".qcow2");
+    EXPECT_THAT(convert_args, AllOf(Contains("convert"), Contains("compression_type=zstd"), Contains(img.fileName())));
+}
+
+TEST(BackendUtils, image_overlay_is_created_with_backing_file)
+{
+    const auto base = "/vault/images/base.img";
+    const auto overlay = "/vault/instances/foo/base.img";
+    auto process_count = 0;
+    auto mock_factory_scope = mpt::MockProcessFactory::Inject();
+
+    mock_factory_scope->register_callback([&](mpt::MockProcess* process) {
+        ++process_count;
+        ASSERT_EQ(process->program().toStdString(), "qemu-img");
+        EXPECT_EQ(process->arguments(), QStringList({"create", "-f", "qcow2", "-F", "qcow2", "-b", base, overlay}));
+        EXPECT_CALL(*process, execute).WillOnce(Return(success));
+    });
+
+    mp::backend::create_image_overlay(base, overlay);
+
+    EXPECT_EQ(process_count, 1);
+}
+
+TEST(BackendUtils, image_overlay_failure_throws)
+{
+    auto mock_factory_scope = mpt::MockProcessFactory::Inject();
+
+    mock_factory_scope->register_callback([](mpt::MockProcess* process) {
+        EXPECT_CALL(*process, execute).WillOnce(Return(failure));
+        EXPECT_CALL(*process, read_all_standard_error).WillOnce(Return("no backing file"));
+    });
+
+    MP_EXPECT_THROW_THAT(mp::backend::create_image_overlay("base", "overlay"), std::runtime_error,
+                         Property(&std::runtime_error::what, AllOf(HasSubstr("qemu-img failed"),
+                                                                   HasSubstr("no backing file"))));
+}
+
+TEST(BackendUtils, image_check_reads_through_a_throttle)
+{
+    QTemporaryFile img;
+    write_qcow2_header(img, mp::MemorySize{"1G"});
+    QStringList check_args;
+    auto mock_factory_scope = mpt::MockProcessFactory::Inject();
+    mock_factory_scope->register_callback(
+        [&check_args](mpt::MockProcess* process) { check_args = process->arguments(); });
+
+    EXPECT_EQ(mp::backend::check_image(img.fileName(), 1024 * 1024), "");
+    EXPECT_THAT(check_args, AllOf(Contains("check"), Contains("throttle-group,id=check,x-bps-read=1048576"),
+                                  Contains(HasSubstr("file.throttle-group=check"))));
+    EXPECT_THAT(check_args, Contains(HasSubstr(img.fileName())));
+}
+
+TEST(BackendUtils, image_check_reports_corruption)
+{
+    QTemporaryFile img;
+    write_qcow2_header(img, mp::MemorySize{"1G"});
+    const auto corrupt = mp::ProcessState{2, mp::nullopt};
+    auto mock_factory_scope = mpt::MockProcessFactory::Inject();
+    mock_factory_scope->register_callback([&corrupt](mpt::MockProcess* process) {
+        EXPECT_CALL(*process, execute).WillOnce(Return(corrupt));
+        EXPECT_CALL(*process, read_all_standard_output).WillOnce(Return("ERROR cluster 5 refcount=0\n"));
+    });
+
+    EXPECT_EQ(mp::backend::check_image(img.fileName(), 1024 * 1024), "ERROR cluster 5 refcount=0");
+}
+
+TEST(BackendUtils, raw_image_is_not_checked)
+{
+    QTemporaryFile img;
+    ASSERT_TRUE(img.open());
+    auto mock_factory_scope = mpt::MockProcessFactory::Inject();
+
+    mock_factory_scope->register_callback([](mpt::MockProcess*) { ADD_FAILURE() << "no process expected"; });
+
+    EXPECT_EQ(mp::backend::check_image(img.fileName(), 1024 * 1024), "");
+}
+
+TEST(BackendUtils, subnet_with_a_route_into_it_is_used)
+{
+    const std::vector<mp::backend::Route> routes{{0, 0, 1}, {0x0a010200, 24, 2}};
+
+    EXPECT_TRUE(mp::backend::subnet_routed_locally("10.1.2", routes));
+    EXPECT_FALSE(mp::backend::subnet_routed_locally("10.1.3", routes));
+}
+
+TEST(BackendUtils, subnet_with_a_narrower_route_into_it_is_used)
+{
+    const std::vector<mp::backend::Route> routes{{0x0a0102c0, 26, 2}, {0x0a010305, 32, 3}};
+
+    EXPECT_TRUE(mp::backend::subnet_routed_locally("10.1.2", routes));
+    EXPECT_TRUE(mp::backend::subnet_routed_locally("10.1.3", routes));
+    EXPECT_FALSE(mp::backend::subnet_routed_locally("10.1.4", routes));
+}
+
+TEST(BackendUtils, routes_wider_than_the_subnet_leave_it_free)
+{
+    const std::vector<mp::backend::Route> routes{{0, 0, 1}, {0x0a000000, 8, 2}, {0x0a010000, 16, 3}};
+
+    EXPECT_FALSE(mp::backend::subnet_routed_locally("10.1.2", routes));
+    EXPECT_FALSE(mp::backend::subnet_routed_locally("10.200.7", routes));
+}
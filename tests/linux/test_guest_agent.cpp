@@ -0,0 +1,218 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <src/platform/backends/shared/linux/guest_agent.h>
+
+#include "tests/extra_assertions.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <QJsonArray>
+#include <QtEndian>
+
+#include <functional>
+#include <limits>
+#include <map>
+#include <stdexcept>
+
+namespace mp = multipass;
+namespace mpb = multipass::backend;
+
+using namespace testing;
+using namespace std::literals::chrono_literals;
+
+namespace
+{
+// Stands in for the agent, answering guest-exec and, once asked often enough, guest-exec-status
+struct GuestAgent
+{
+    QJsonValue operator()(const QString& command, const QJsonObject& arguments)
+    {
+        commands.append(command);
+        if (command == "guest-exec")
+        {
+            exec_arguments = arguments;
+            return QJsonObject{{"pid", 42}};
+        }
+
+        if (command == "guest-exec-status")
+        {
+            EXPECT_EQ(arguments["pid"].toInt(), 42);
+            if (--polls_until_exit > 0)
+                return QJsonObject{{"exited", false}};
+
+            return QJsonObject{{"exited", true},
+                               {"exitcode", exit_code},
+                               {"err-data", QString::fromLatin1(QByteArray{"it went wrong\n"}.toBase64())}};
+        }
+
+        throw std::runtime_error{"unknown command"};
+    }
+
+    int polls_until_exit{1};
+    int exit_code{0};
+    QJsonObject exec_arguments;
+    QStringList commands;
+};
+} // namespace
+
+TEST(GuestAgent, runs_scripts_through_the_shell_and_waits_for_them)
+{
+    GuestAgent agent;
+    agent.polls_until_exit = 3;
+
+    mpb::run_in_guest(std::ref(agent), "echo hello", 10s);
+
+    EXPECT_EQ(agent.exec_arguments["path"].toString(), "/bin/sh");
+    EXPECT_EQ(agent.exec_arguments["arg"].toArray(), (QJsonArray{"-c", "echo hello"}));
+    EXPECT_FALSE(agent.exec_arguments.contains("input-data"));
+    EXPECT_EQ(agent.commands,
+              QStringList({"guest-exec", "guest-exec-status", "guest-exec-status", "guest-exec-status"}));
+}
+
+TEST(GuestAgent, hands_scripts_their_input)
+{
+    GuestAgent agent;
+    const QByteArray input{"\x00\x01random\xff", 9};
+
+    mpb::run_in_guest(std::ref(agent), "cat > /dev/urandom", 10s, input);
+
+    EXPECT_EQ(QByteArray::fromBase64(agent.exec_arguments["input-data"].toString().toLatin1()), input);
+}
+
+TEST(GuestAgent, throws_with_what_failing_scripts_wrote)
+{
+    GuestAgent agent;
+    agent.exit_code = 3;
+
+    MP_EXPECT_THROW_THAT(mpb::run_in_guest(std::ref(agent), "false", 10s), std::runtime_error,
+                         Property(&std::runtime_error::what, AllOf(HasSubstr("code 3"), HasSubstr("it went wrong"))));
+}
+
+TEST(GuestAgent, gives_up_on_scripts_that_do_not_finish_in_time)
+{
+    GuestAgent agent;
+    agent.polls_until_exit = std::numeric_limits<int>::max();
+
+    EXPECT_THROW(mpb::run_in_guest(std::ref(agent), "sleep infinity", 0ms), std::runtime_error);
+}
+
+namespace
+{
+// Stands in for the agent serving the files and guest-get-* answers guest_agent_stats asks for
+struct StatsAgent
+{
+    StatsAgent()
+    {
+        files["/proc/loadavg"] = "0.42 0.10 0.01 1/123 4567\n";
+        files["/proc/meminfo"] = "MemTotal: 2048 kB\nMemFree: 512 kB\nBuffers: 128 kB\nCached: 256 kB\n"
+                                 "SReclaimable: 128 kB\n";
+
+        // Two sessions of the same user, and a login prompt that is none
+        QByteArray utmp;
+        for (auto type : {7, 7, 6})
+        {
+            QByteArray record(384, '\0');
+            qToLittleEndian<qint32>(type, record.data());
+            record.replace(44, 6, "ubuntu");
+            utmp += record;
+        }
+        files["/run/utmp"] = utmp;
+    }
+
+    QJsonValue operator()(const QString& command, const QJsonObject& arguments)
+    {
+        commands.append(command);
+        if (command == "guest-file-open")
+        {
+            open_file = files.at(arguments["path"].toString());
+            return 1;
+        }
+
+        if (command == "guest-file-read")
+        {
+            if (endless)
+                return QJsonObject{{"count", 1}, {"buf-b64", "AA=="}, {"eof", false}};
+
+            const auto chunk = open_file.left(arguments["count"].toInt());
+            open_file.remove(0, chunk.size());
+            return QJsonObject{{"count", chunk.size()},
+                               {"buf-b64", QString::fromLatin1(chunk.toBase64())},
+                               {"eof", open_file.isEmpty()}};
+        }
+
+        if (command == "guest-file-close")
+            return QJsonObject{};
+
+        if (command == "guest-get-fsinfo")
+            return QJsonArray{QJsonObject{{"mountpoint", "/"}, {"used-bytes", 1000}, {"total-bytes", 5000}}};
+
+        if (command == "guest-get-osinfo")
+            return QJsonObject{{"pretty-name", "Ubuntu 20.04 LTS"}};
+
+        throw std::runtime_error{"unknown command"};
+    }
+
+    std::map<QString, QByteArray> files;
+    QByteArray open_file;
+    bool endless{false};
+    QStringList commands;
+};
+} // namespace
+
+TEST(GuestAgent, reports_stats_under_the_keys_ssh_would)
+{
+    StatsAgent agent;
+
+    auto stats = mpb::guest_agent_stats(std::ref(agent));
+
+    EXPECT_EQ(stats["load"], "0.42 0.10 0.01");
+    EXPECT_EQ(stats["memory_total"], std::to_string(2048 * 1024));
+    EXPECT_EQ(stats["memory_usage"], std::to_string(1024 * 1024));
+    EXPECT_EQ(stats["disk_usage"], "1000");
+    EXPECT_EQ(stats["disk_total"], "5000");
+    EXPECT_EQ(stats["current_release"], "Ubuntu 20.04 LTS");
+}
+
+TEST(GuestAgent, counts_login_sessions_rather_than_users)
+{
+    StatsAgent agent;
+
+    EXPECT_EQ(mpb::guest_agent_stats(std::ref(agent))["sessions"], "2");
+}
+
+TEST(GuestAgent, gives_up_on_files_the_agent_never_gets_to_the_end_of)
+{
+    StatsAgent agent;
+    agent.endless = true;
+
+    MP_EXPECT_THROW_THAT(mpb::guest_agent_stats(std::ref(agent)), std::runtime_error,
+                         Property(&std::runtime_error::what, HasSubstr("too big")));
+    EXPECT_LE(agent.commands.count("guest-file-read"), 64);
+    EXPECT_EQ(agent.commands.last(), "guest-file-close");
+}
+
+TEST(GuestAgent, gives_up_on_files_too_big_to_be_what_they_should)
+{
+    StatsAgent agent;
+    agent.files["/proc/loadavg"] = QByteArray(2 * 1024 * 1024, '0');
+
+    MP_EXPECT_THROW_THAT(mpb::guest_agent_stats(std::ref(agent)), std::runtime_error,
+                         Property(&std::runtime_error::what, HasSubstr("too big")));
+    EXPECT_EQ(agent.commands.last(), "guest-file-close");
+}
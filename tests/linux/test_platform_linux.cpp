@@ -16,8 +16,10 @@
  */
 
 #include "tests/fake_handle.h"
+#include "tests/file_operations.h"
 #include "tests/mock_environment_helpers.h"
 #include "tests/mock_settings.h"
+#include "tests/temp_dir.h"
 #include "tests/test_with_mocked_bin_path.h"
 
 #include <src/platform/backends/libvirt/libvirt_virtual_machine_factory.h>
@@ -305,4 +307,51 @@ TEST_P(TestUnsupportedDrivers, test_unsupported_driver)
 
 INSTANTIATE_TEST_SUITE_P(PlatformLinux, TestUnsupportedDrivers,
                          Values(QStringLiteral("hyperkit"), QStringLiteral("hyper-v"), QStringLiteral("other")));
+
+TEST(PlatformLinux, clone_file_copies_content)
+{
+    mpt::TempDir temp_dir;
+    const auto source = temp_dir.path() + "/source";
+    const auto destination = temp_dir.path() + "/destination";
+    const std::string content{"some image content"};
+    mpt::make_file_with_content(source, content);
+
+    ASSERT_TRUE(mp::platform::clone_file(QFile::encodeName(source).constData(),
+                                         QFile::encodeName(destination).constData()));
+    EXPECT_EQ(mpt::load(destination).toStdString(), content);
+}
+
+TEST(PlatformLinux, clone_file_does_not_overwrite_destination)
+{
+    mpt::TempDir temp_dir;
+    const auto source = temp_dir.path() + "/source";
+    const auto destination = temp_dir.path() + "/destination";
+    mpt::make_file_with_content(source, "new");
+    mpt::make_file_with_content(destination, "old");
+
+    EXPECT_FALSE(mp::platform::clone_file(QFile::encodeName(source).constData(),
+                                          QFile::encodeName(destination).constData()));
+    EXPECT_EQ(mpt::load(destination).toStdString(), "old");
+}
+
+TEST(PlatformLinux, allocated_size_leaves_holes_out)
+{
+    mpt::TempDir temp_dir;
+    const auto path = temp_dir.path() + "/sparse.img";
+    QFile file{path};
+    ASSERT_TRUE(file.open(QIODevice::WriteOnly));
+    ASSERT_TRUE(file.resize(64 * 1024 * 1024));
+    file.close();
+
+    const auto allocated = mp::platform::allocated_size(QFile::encodeName(path).constData());
+    EXPECT_GE(allocated, 0);
+    EXPECT_LT(allocated, file.size());
+    EXPECT_EQ(mp::platform::allocated_size(QFile::encodeName(path + ".missing").constData()), -1);
+}
+
+TEST(PlatformLinux, missing_and_virtual_files_are_not_on_rotational_disks)
+{
+    EXPECT_FALSE(mp::platform::on_rotational_disk("/nonexistent/path"));
+    EXPECT_FALSE(mp::platform::on_rotational_disk("/proc/self/status"));
+}
 } // namespace
@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <src/platform/backends/shared/linux/spawn_process.h>
+#include <src/platform/backends/shared/simple_process_spec.h>
+
+#include "tests/test_with_mocked_bin_path.h"
+
+#include <gmock/gmock.h>
+
+namespace mp = multipass;
+namespace mpt = multipass::test;
+
+using namespace testing;
+
+// Tests return early on kernels without pidfds, where the factory never picks SpawnProcess
+struct SpawnProcessTest : public mpt::TestWithMockedBinPath
+{
+};
+
+TEST_F(SpawnProcessTest, execute_missing_command)
+{
+    if (!mp::SpawnProcess::available())
+        return;
+
+    mp::SpawnProcess process(mp::simple_process_spec("a_missing_command"));
+    auto process_state = process.execute();
+
+    EXPECT_FALSE(process_state.exit_code);
+    ASSERT_TRUE(process_state.error);
+    EXPECT_EQ(QProcess::ProcessError::FailedToStart, process_state.error->state);
+}
+
+TEST_F(SpawnProcessTest, execute_crashing_command)
+{
+    if (!mp::SpawnProcess::available())
+        return;
+
+    mp::SpawnProcess process(mp::simple_process_spec("mock_process"));
+    auto process_state = process.execute();
+
+    EXPECT_FALSE(process_state.exit_code);
+    ASSERT_TRUE(process_state.error);
+    EXPECT_EQ(QProcess::ProcessError::Crashed, process_state.error->state);
+}
+
+TEST_F(SpawnProcessTest, execute_good_command_with_positive_exit_code)
+{
+    if (!mp::SpawnProcess::available())
+        return;
+
+    mp::SpawnProcess process(mp::simple_process_spec("mock_process", {"7"}));
+    auto process_state = process.execute();
+
+    ASSERT_TRUE(process_state.exit_code);
+    EXPECT_EQ(7, *process_state.exit_code);
+    EXPECT_FALSE(process_state.error);
+}
+
+TEST_F(SpawnProcessTest, process_state_when_runs_and_stops_ok)
+{
+    if (!mp::SpawnProcess::available())
+        return;
+
+    mp::SpawnProcess process(mp::simple_process_spec("mock_process", {"7", "stay-alive"}));
+    process.start();
+
+    EXPECT_TRUE(process.wait_for_started());
+    EXPECT_TRUE(process.running());
+    EXPECT_FALSE(process.process_state().exit_code);
+
+    process.write(QByteArray(1, '\0')); // will make mock_process quit
+    EXPECT_TRUE(process.wait_for_finished());
+
+    auto process_state = process.process_state();
+    ASSERT_TRUE(process_state.exit_code);
+    EXPECT_EQ(7, *process_state.exit_code);
+}
+
+TEST_F(SpawnProcessTest, process_state_when_runs_but_fails_to_stop)
+{
+    if (!mp::SpawnProcess::available())
+        return;
+
+    mp::SpawnProcess process(mp::simple_process_spec("mock_process", {"2", "stay-alive"}));
+    process.start();
+
+    EXPECT_FALSE(process.wait_for_finished(100)); // will hit timeout
+
+    auto process_state = process.process_state();
+    EXPECT_FALSE(process_state.exit_code);
+    ASSERT_TRUE(process_state.error);
+    EXPECT_EQ(QProcess::Timedout, process_state.error->state);
+}
+
+TEST_F(SpawnProcessTest, reports_finished_once_reaped)
+{
+    if (!mp::SpawnProcess::available())
+        return;
+
+    mp::SpawnProcess process(mp::simple_process_spec("mock_process", {"0"}));
+    mp::optional<mp::ProcessState> finished_state;
+    QObject::connect(&process, &mp::Process::finished,
+                     [&finished_state](const mp::ProcessState& state) { finished_state = state; });
+
+    process.start();
+    EXPECT_TRUE(process.wait_for_finished());
+
+    ASSERT_TRUE(finished_state);
+    EXPECT_TRUE(finished_state->completed_successfully());
+    EXPECT_FALSE(process.running());
+}
@@ -24,10 +24,11 @@ mpt::MischievousURLDownloader::MischievousURLDownloader(std::chrono::millisecond
 {
 }
 
-void mpt::MischievousURLDownloader::download_to(const QUrl& url, const QString& file_name, int64_t size,
-                                                const int download_type, const mp::ProgressMonitor& monitor)
+QByteArray mpt::MischievousURLDownloader::download_to(const QUrl& url, const QString& file_name, int64_t size,
+                                                      const int download_type, const mp::ProgressMonitor& monitor,
+                                                      const DataSink& sink, DownloadPriority priority)
 {
-    URLDownloader::download_to(choose_url(url), file_name, size, download_type, monitor);
+    return URLDownloader::download_to(choose_url(url), file_name, size, download_type, monitor, sink, priority);
 }
 
 QByteArray mpt::MischievousURLDownloader::download(const QUrl& url)
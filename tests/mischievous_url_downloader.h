@@ -22,6 +22,8 @@
 
 #include <QUrl>
 
+#include <atomic>
+
 namespace multipass
 {
 namespace test
@@ -31,13 +33,13 @@ class MischievousURLDownloader : public URLDownloader
 public:
     MischievousURLDownloader(std::chrono::milliseconds timeout);
 
-    void download_to(const QUrl& url, const QString& file_name, int64_t size, const int download_type,
-                     const ProgressMonitor& monitor) override;
+    QByteArray download_to(const QUrl& url, const QString& file_name, int64_t size, const int download_type,
+                           const ProgressMonitor& monitor, const DataSink& sink, DownloadPriority priority) override;
     QByteArray download(const QUrl& url) override;
     QDateTime last_modified(const QUrl& url) override;
 
 public:
-    int mischiefs = 0;
+    std::atomic<int> mischiefs{0}; // manifests are fetched concurrently
 
 private:
     const QUrl& choose_url(const QUrl& url);
@@ -77,6 +77,7 @@ public:
     MOCK_METHOD0(terminate, void());
     MOCK_METHOD0(kill, void());
     MOCK_CONST_METHOD0(running, bool());
+    MOCK_CONST_METHOD0(process_id, qint64());
     MOCK_CONST_METHOD0(process_state, ProcessState());
     MOCK_METHOD1(execute, ProcessState(int));
 
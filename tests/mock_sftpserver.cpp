@@ -34,4 +34,5 @@ extern "C"
     IMPL_MOCK_DEFAULT(2, sftp_handle);
     IMPL_MOCK_DEFAULT(2, sftp_handle_alloc);
     IMPL_MOCK_DEFAULT(2, sftp_handle_remove);
+    IMPL_MOCK_DEFAULT(3, inotify_add_watch);
 }
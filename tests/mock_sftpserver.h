@@ -21,6 +21,7 @@
 #include <premock.hpp>
 
 #include <libssh/sftp.h>
+#include <sys/inotify.h>
 
 DECL_MOCK(sftp_server_new);
 DECL_MOCK(sftp_server_init);
@@ -38,5 +39,6 @@ DECL_MOCK(sftp_client_message_get_filename);
 DECL_MOCK(sftp_handle);
 DECL_MOCK(sftp_handle_alloc);
 DECL_MOCK(sftp_handle_remove);
+DECL_MOCK(inotify_add_watch);
 
 #endif // MULTIPASS_MOCK_SFTPSERVER_H
@@ -24,10 +24,18 @@ extern "C"
     IMPL_MOCK_DEFAULT(3, ssh_options_set);
     IMPL_MOCK_DEFAULT(3, ssh_userauth_publickey);
     IMPL_MOCK_DEFAULT(1, ssh_channel_is_closed);
+    IMPL_MOCK_DEFAULT(1, ssh_channel_is_open);
+    IMPL_MOCK_DEFAULT(1, ssh_channel_is_eof);
     IMPL_MOCK_DEFAULT(1, ssh_channel_new);
     IMPL_MOCK_DEFAULT(1, ssh_channel_open_session);
     IMPL_MOCK_DEFAULT(2, ssh_channel_request_exec);
+    IMPL_MOCK_DEFAULT(4, ssh_channel_read);
     IMPL_MOCK_DEFAULT(5, ssh_channel_read_timeout);
+    IMPL_MOCK_DEFAULT(4, ssh_channel_read_nonblocking);
+    IMPL_MOCK_DEFAULT(3, ssh_channel_poll_timeout);
+    IMPL_MOCK_DEFAULT(4, ssh_channel_select);
+    IMPL_MOCK_DEFAULT(3, ssh_channel_write);
+    IMPL_MOCK_DEFAULT(1, ssh_channel_window_size);
     IMPL_MOCK_DEFAULT(1, ssh_channel_get_exit_status);
     IMPL_MOCK_DEFAULT(2, ssh_event_dopoll);
     IMPL_MOCK_DEFAULT(2, ssh_add_channel_callbacks);
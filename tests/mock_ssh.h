@@ -29,10 +29,18 @@ DECL_MOCK(ssh_is_connected);
 DECL_MOCK(ssh_options_set);
 DECL_MOCK(ssh_userauth_publickey);
 DECL_MOCK(ssh_channel_is_closed);
+DECL_MOCK(ssh_channel_is_open);
+DECL_MOCK(ssh_channel_is_eof);
 DECL_MOCK(ssh_channel_new);
 DECL_MOCK(ssh_channel_open_session);
 DECL_MOCK(ssh_channel_request_exec);
+DECL_MOCK(ssh_channel_read);
 DECL_MOCK(ssh_channel_read_timeout);
+DECL_MOCK(ssh_channel_read_nonblocking);
+DECL_MOCK(ssh_channel_poll_timeout);
+DECL_MOCK(ssh_channel_select);
+DECL_MOCK(ssh_channel_write);
+DECL_MOCK(ssh_channel_window_size);
 DECL_MOCK(ssh_channel_get_exit_status);
 DECL_MOCK(ssh_event_dopoll);
 DECL_MOCK(ssh_add_channel_callbacks);
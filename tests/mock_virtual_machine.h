@@ -21,12 +21,17 @@
 #include <gmock/gmock.h>
 #include <multipass/virtual_machine.h>
 
+#include <string>
+#include <unordered_map>
+
 namespace multipass
 {
 namespace test
 {
 struct MockVirtualMachine : public multipass::VirtualMachine
 {
+    using Stats = std::unordered_map<std::string, std::string>;
+
     MockVirtualMachine(const std::string vm_name) : VirtualMachine{vm_name}
     {
         ON_CALL(*this, current_state()).WillByDefault(Return(multipass::VirtualMachine::State::off));
@@ -50,6 +55,9 @@ struct MockVirtualMachine : public multipass::VirtualMachine
     MOCK_METHOD0(ensure_vm_is_running, void());
     MOCK_METHOD1(wait_until_ssh_up, void(std::chrono::milliseconds));
     MOCK_METHOD0(update_state, void());
+    MOCK_METHOD3(resize, void(int, const MemorySize&, const MemorySize&));
+    MOCK_METHOD0(start_saving_for_exit, bool());
+    MOCK_METHOD0(guest_stats, Stats());
 };
 } // namespace test
 } // namespace multipass
@@ -22,6 +22,7 @@
 #include <cerrno>
 #include <cstring>
 #include <iostream>
+#include <signal.h>
 #include <unistd.h>
 
 const auto unexpected_error = 5;
@@ -77,6 +78,9 @@ int main(int argc, char* argv[])
 
         close(pipefd[1]);
 
+        // The server asks dnsmasq to reload its hosts file with SIGHUP
+        signal(SIGHUP, SIG_IGN);
+
         return QCoreApplication::exec();
     }
     else if (pid > 0)
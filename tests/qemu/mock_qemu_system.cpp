@@ -51,6 +51,14 @@ int main(int argc, char* argv[])
             {
                 break;
             }
+            else if (execute == "migrate-set-capabilities" && json_object.contains("id"))
+            {
+                // Like a QEMU without mapped-ram, which leaves suspending to savevm
+                std::cout << "{\"error\": {\"class\": \"GenericError\", \"desc\": \"mapped-ram is not supported\"}, "
+                             "\"id\": "
+                          << json_object["id"].toInt() << "}\n"
+                          << std::flush;
+            }
             else if (execute == "human-monitor-command")
             {
                 auto args = json_object["arguments"].toObject();
@@ -71,6 +71,14 @@ TEST_F(TestDnsmasqProcessSpec, apparmor_profile_identifier)
     EXPECT_EQ(spec.identifier(), "");
 }
 
+TEST_F(TestDnsmasqProcessSpec, apparmor_profile_identifier_tells_shards_apart)
+{
+    mp::DNSMasqProcessSpec spec(data_dir, bridge_name, pid_file_path, subnet, "mpqemubr1");
+
+    EXPECT_EQ(spec.identifier(), "mpqemubr1");
+    EXPECT_TRUE(spec.apparmor_profile().contains("profile multipass.mpqemubr1.dnsmasq"));
+}
+
 TEST_F(TestDnsmasqProcessSpec, apparmor_profile_running_as_snap_correct)
 {
     QTemporaryDir snap_dir;
@@ -27,6 +27,8 @@
 #include "tests/test_with_mocked_bin_path.h"
 #include <QDir>
 
+#include <chrono>
+#include <future>
 #include <memory>
 #include <string>
 
@@ -105,6 +107,107 @@ TEST_F(DNSMasqServer, returns_null_ip_when_leases_file_does_not_exist)
     EXPECT_FALSE(ip);
 }
 
+TEST_F(DNSMasqServer, wait_for_ip_returns_when_lease_is_written)
+{
+    mp::DNSMasqServer dns{data_dir.path(), bridge_name, subnet};
+
+    auto ip =
+        std::async(std::launch::async, [&dns, this] { return dns.wait_for_ip(hw_addr, std::chrono::minutes(1)); });
+    make_lease_entry();
+
+    ASSERT_EQ(ip.wait_for(std::chrono::seconds(30)), std::future_status::ready);
+    auto result = ip.get();
+    ASSERT_TRUE(result);
+    EXPECT_THAT(result.value(), Eq(mp::IPAddress(expected_ip)));
+}
+
+TEST_F(DNSMasqServer, wait_for_ip_times_out_without_lease)
+{
+    mp::DNSMasqServer dns{data_dir.path(), bridge_name, subnet};
+
+    EXPECT_FALSE(dns.wait_for_ip(hw_addr, std::chrono::milliseconds(10)));
+}
+
+TEST_F(DNSMasqServer, reserves_first_free_ip)
+{
+    mp::DNSMasqServer dns{data_dir.path(), bridge_name, subnet};
+
+    EXPECT_THAT(dns.reserve_ip_for(hw_addr), Eq(mp::IPAddress{subnet + ".2"}));
+    EXPECT_THAT(dns.reserve_ip_for("00:01:02:03:04:06"), Eq(mp::IPAddress{subnet + ".3"}));
+}
+
+TEST_F(DNSMasqServer, reserve_ip_is_stable_and_written_to_hosts_file)
+{
+    mp::DNSMasqServer dns{data_dir.path(), bridge_name, subnet};
+
+    const auto ip = dns.reserve_ip_for(hw_addr);
+    EXPECT_THAT(dns.reserve_ip_for(hw_addr), Eq(ip));
+
+    auto reserved = dns.reserved_ip_for(hw_addr);
+    ASSERT_TRUE(reserved);
+    EXPECT_THAT(reserved.value(), Eq(ip));
+
+    QFile hosts_file{QDir{data_dir.path()}.filePath("dnsmasq.hosts")};
+    ASSERT_TRUE(hosts_file.open(QIODevice::ReadOnly));
+    EXPECT_THAT(hosts_file.readAll().toStdString(), Eq(hw_addr + "," + ip.as_string() + "\n"));
+}
+
+TEST_F(DNSMasqServer, reserve_ip_keeps_existing_lease)
+{
+    mp::DNSMasqServer dns{data_dir.path(), bridge_name, subnet};
+    make_lease_entry();
+
+    EXPECT_THAT(dns.reserve_ip_for(hw_addr), Eq(mp::IPAddress{expected_ip}));
+}
+
+TEST_F(DNSMasqServer, reserve_ip_skips_addresses_leased_to_others)
+{
+    mp::DNSMasqServer dns{data_dir.path(), bridge_name, subnet};
+    mpt::make_file_with_content(QDir{data_dir.path()}.filePath("dnsmasq.leases"),
+                                "0 00:01:02:03:04:06 " + subnet + ".2 other *");
+
+    EXPECT_THAT(dns.reserve_ip_for(hw_addr), Eq(mp::IPAddress{subnet + ".3"}));
+}
+
+TEST_F(DNSMasqServer, counts_reservations)
+{
+    mp::DNSMasqServer dns{data_dir.path(), bridge_name, subnet};
+    EXPECT_THAT(dns.reservation_count(), Eq(0u));
+
+    dns.reserve_ip_for(hw_addr);
+    dns.reserve_ip_for("00:01:02:03:04:06");
+    EXPECT_THAT(dns.reservation_count(), Eq(2u));
+
+    dns.release_mac(hw_addr);
+    EXPECT_THAT(dns.reservation_count(), Eq(1u));
+}
+
+TEST_F(DNSMasqServer, reservations_survive_restart)
+{
+    mp::optional<mp::IPAddress> ip;
+    {
+        mp::DNSMasqServer dns{data_dir.path(), bridge_name, subnet};
+        dns.reserve_ip_for("00:01:02:03:04:06");
+        ip.emplace(dns.reserve_ip_for(hw_addr));
+    }
+
+    mp::DNSMasqServer dns{data_dir.path(), bridge_name, subnet};
+    auto reserved = dns.reserved_ip_for(hw_addr);
+    ASSERT_TRUE(reserved);
+    EXPECT_THAT(reserved.value(), Eq(ip.value()));
+}
+
+TEST_F(DNSMasqServer, release_mac_drops_reservation)
+{
+    mp::DNSMasqServer dns{data_dir.path(), bridge_name, subnet};
+    const auto ip = dns.reserve_ip_for(hw_addr);
+
+    dns.release_mac(hw_addr);
+
+    EXPECT_FALSE(dns.reserved_ip_for(hw_addr));
+    EXPECT_THAT(dns.reserve_ip_for("00:01:02:03:04:06"), Eq(ip));
+}
+
 TEST_F(DNSMasqServer, release_mac_releases_ip)
 {
     const QString dchp_release_called{QDir{data_dir.path()}.filePath("dhcp_release_called")};
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <src/platform/backends/qemu/host_check_cache.h>
+
+#include <gmock/gmock.h>
+
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace mp = multipass;
+using namespace testing;
+
+TEST(HostCheckCache, checks_once_within_its_ttl)
+{
+    mp::HostCheckCache cache{std::chrono::hours(1)};
+    auto checks = 0;
+
+    cache.run([&checks] { ++checks; });
+    cache.run([&checks] { ++checks; });
+
+    EXPECT_EQ(checks, 1);
+}
+
+TEST(HostCheckCache, checks_again_once_its_ttl_is_over)
+{
+    mp::HostCheckCache cache{std::chrono::milliseconds(1)};
+    auto checks = 0;
+
+    cache.run([&checks] { ++checks; });
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    cache.run([&checks] { ++checks; });
+
+    EXPECT_EQ(checks, 2);
+}
+
+TEST(HostCheckCache, does_not_remember_failed_checks)
+{
+    mp::HostCheckCache cache{std::chrono::hours(1)};
+    auto checks = 0;
+
+    auto failing_check = [&checks] {
+        ++checks;
+        throw std::runtime_error{"no KVM"};
+    };
+
+    EXPECT_THROW(cache.run(failing_check), std::runtime_error);
+    cache.run([&checks] { ++checks; });
+
+    EXPECT_EQ(checks, 2);
+}
+
+TEST(HostCheckCache, checks_again_once_invalidated)
+{
+    mp::HostCheckCache cache{std::chrono::hours(1)};
+    auto checks = 0;
+
+    cache.run([&checks] { ++checks; });
+    cache.invalidate();
+    cache.run([&checks] { ++checks; });
+
+    EXPECT_EQ(checks, 2);
+}
+
+TEST(HostCheckCache, runs_one_check_for_callers_that_come_along_at_once)
+{
+    mp::HostCheckCache cache{std::chrono::hours(1)};
+    std::atomic<int> checks{0};
+
+    std::vector<std::thread> callers;
+    for (auto i = 0; i < 8; ++i)
+        callers.emplace_back([&cache, &checks] {
+            cache.run([&checks] {
+                ++checks;
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            });
+        });
+    for (auto& caller : callers)
+        caller.join();
+
+    EXPECT_EQ(checks, 1);
+}
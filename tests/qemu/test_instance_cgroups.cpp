@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <src/platform/backends/qemu/ksm_policy.h>
+#include <src/platform/backends/qemu/instance_cgroups.h>
+
+#include "tests/file_operations.h"
+#include "tests/temp_dir.h"
+
+#include <multipass/constants.h>
+
+#include <QDir>
+#include <QFile>
+
+#include <gmock/gmock.h>
+
+namespace mp = multipass;
+namespace mpt = multipass::test;
+using namespace testing;
+
+namespace
+{
+struct InstanceCgroups : public Test
+{
+    QString get(const QString& path)
+    {
+        QFile file{QDir{temp_dir.path()}.filePath(path)};
+        file.open(QIODevice::ReadOnly);
+        return QString::fromLatin1(file.readAll()).trimmed();
+    }
+
+    mpt::TempDir temp_dir;
+    const mp::MemorySize mem_size{"1G"};
+};
+} // namespace
+
+TEST_F(InstanceCgroups, weighs_the_resource_classes)
+{
+    EXPECT_EQ(mp::InstanceCgroups::limits_for(mp::default_resource_class, 2, mem_size, "8:0").cpu_weight, 100);
+    EXPECT_EQ(mp::InstanceCgroups::limits_for(mp::latency_resource_class, 2, mem_size, "8:0").io_weight, 1000);
+    EXPECT_EQ(mp::InstanceCgroups::limits_for(mp::latency_resource_class, 2, mem_size, "8:0").cpu_quota_us, 0);
+    EXPECT_EQ(mp::InstanceCgroups::limits_for(mp::batch_resource_class, 2, mem_size, "8:0").cpu_weight, 20);
+}
+
+TEST_F(InstanceCgroups, caps_batch_instances)
+{
+    const auto limits = mp::InstanceCgroups::limits_for(mp::batch_resource_class, 4, mem_size, "8:0");
+
+    EXPECT_EQ(limits.cpu_quota_us, 200000);
+    EXPECT_GT(limits.io_bps, 0);
+    EXPECT_GT(limits.memory_high, mem_size.in_bytes());
+}
+
+TEST_F(InstanceCgroups, does_not_cap_io_without_a_disk)
+{
+    EXPECT_EQ(mp::InstanceCgroups::limits_for(mp::batch_resource_class, 4, mem_size, "").io_bps, 0);
+}
+
+TEST_F(InstanceCgroups, places_the_process_in_a_scope_of_its_own)
+{
+    mpt::make_file_with_content(QDir{temp_dir.path()}.filePath("cgroup.controllers"), "cpu io memory\n");
+    mp::InstanceCgroups cgroups{temp_dir.path()};
+
+    cgroups.place("foo", 1234, mp::InstanceCgroups::limits_for(mp::batch_resource_class, 2, mem_size, "8:0"));
+
+    EXPECT_EQ(get("cgroup.subtree_control"), "+cpu +io +memory");
+    EXPECT_EQ(get("multipass.slice/cgroup.subtree_control"), "+cpu +io +memory");
+    EXPECT_EQ(get("multipass.slice/foo.scope/cgroup.procs"), "1234");
+    EXPECT_EQ(get("multipass.slice/foo.scope/cpu.weight"), "20");
+    EXPECT_EQ(get("multipass.slice/foo.scope/cpu.max"), "100000 100000");
+    EXPECT_EQ(get("multipass.slice/foo.scope/io.weight"), "default 20");
+    EXPECT_EQ(get("multipass.slice/foo.scope/io.max"), "8:0 rbps=104857600 wbps=104857600");
+    EXPECT_EQ(get("multipass.slice/foo.scope/memory.high"), QString::number(mem_size.in_bytes() + 256 * 1024 * 1024));
+}
+
+TEST_F(InstanceCgroups, lifts_caps_when_the_class_changes)
+{
+    mpt::make_file_with_content(QDir{temp_dir.path()}.filePath("cgroup.controllers"), "cpu io memory\n");
+    mp::InstanceCgroups cgroups{temp_dir.path()};
+    cgroups.place("foo", 1234, mp::InstanceCgroups::limits_for(mp::batch_resource_class, 2, mem_size, "8:0"));
+
+    cgroups.apply("foo", mp::InstanceCgroups::limits_for(mp::latency_resource_class, 2, mem_size, "8:0"));
+
+    EXPECT_EQ(get("multipass.slice/foo.scope/cpu.weight"), "1000");
+    EXPECT_EQ(get("multipass.slice/foo.scope/cpu.max"), "max 100000");
+    EXPECT_EQ(get("multipass.slice/foo.scope/io.max"), "8:0 rbps=max wbps=max");
+    EXPECT_EQ(get("multipass.slice/foo.scope/memory.high"), "max");
+}
+
+TEST_F(InstanceCgroups, leaves_hosts_without_cgroup_v2_alone)
+{
+    mp::InstanceCgroups cgroups{temp_dir.path()};
+
+    cgroups.place("foo", 1234, mp::InstanceCgroups::limits_for(mp::batch_resource_class, 2, mem_size, "8:0"));
+
+    EXPECT_FALSE(QDir{QDir{temp_dir.path()}.filePath("multipass.slice")}.exists());
+}
+
+TEST_F(InstanceCgroups, ignores_instances_never_placed)
+{
+    mpt::make_file_with_content(QDir{temp_dir.path()}.filePath("cgroup.controllers"), "cpu io memory\n");
+    mp::InstanceCgroups cgroups{temp_dir.path()};
+
+    cgroups.apply("foo", mp::InstanceCgroups::limits_for(mp::latency_resource_class, 2, mem_size, "8:0"));
+
+    EXPECT_FALSE(QDir{QDir{temp_dir.path()}.filePath("multipass.slice/foo.scope")}.exists());
+}
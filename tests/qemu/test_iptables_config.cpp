@@ -23,6 +23,8 @@
 
 #include <QString>
 
+#include <algorithm>
+
 namespace mp = multipass;
 namespace mpt = multipass::test;
 using namespace testing;
@@ -38,24 +40,70 @@ struct IPTablesConfig : public Test
     const QString evilbr0{QStringLiteral("evilbr0")};
     const std::string subnet{"192.168.2"};
 
+    // iptables-save output once the rules for goodbr0 are in place
+    QByteArray goodbr0_rules{
+        "*filter\n"
+        ":INPUT ACCEPT [0:0]\n"
+        "-A INPUT -i goodbr0 -p tcp -m tcp --dport 53 -m comment --comment \"generated for Multipass network goodbr0\" "
+        "-j ACCEPT\n"
+        "-A INPUT -i goodbr0 -p udp -m udp --dport 53 -m comment --comment \"generated for Multipass network goodbr0\" "
+        "-j ACCEPT\n"
+        "-A INPUT -i goodbr0 -p udp -m udp --dport 67 -m comment --comment \"generated for Multipass network goodbr0\" "
+        "-j ACCEPT\n"
+        "-A FORWARD -i goodbr0 -o goodbr0 -m comment --comment \"generated for Multipass network goodbr0\" -j ACCEPT\n"
+        "-A FORWARD -s 192.168.2.0/24 -i goodbr0 -m comment --comment \"generated for Multipass network goodbr0\" "
+        "-j ACCEPT\n"
+        "-A FORWARD -d 192.168.2.0/24 -o goodbr0 -m conntrack --ctstate RELATED,ESTABLISHED -m comment --comment "
+        "\"generated for Multipass network goodbr0\" -j ACCEPT\n"
+        "-A FORWARD -i goodbr0 -m comment --comment \"generated for Multipass network goodbr0\" -j REJECT "
+        "--reject-with icmp-port-unreachable\n"
+        "-A FORWARD -o goodbr0 -m comment --comment \"generated for Multipass network goodbr0\" -j REJECT "
+        "--reject-with icmp-port-unreachable\n"
+        "-A OUTPUT -o goodbr0 -p tcp -m tcp --sport 53 -m comment --comment "
+        "\"generated for Multipass network goodbr0\" -j ACCEPT\n"
+        "-A OUTPUT -o goodbr0 -p udp -m udp --sport 53 -m comment --comment "
+        "\"generated for Multipass network goodbr0\" -j ACCEPT\n"
+        "-A OUTPUT -o goodbr0 -p udp -m udp --sport 67 -m comment --comment "
+        "\"generated for Multipass network goodbr0\" -j ACCEPT\n"
+        "COMMIT\n"
+        "*nat\n"
+        "-A POSTROUTING -s 192.168.2.0/24 ! -d 192.168.2.0/24 -m comment --comment "
+        "\"generated for Multipass network goodbr0\" -j MASQUERADE\n"
+        "-A POSTROUTING -s 192.168.2.0/24 ! -d 192.168.2.0/24 -p udp -m comment --comment "
+        "\"generated for Multipass network goodbr0\" -j MASQUERADE --to-ports 1024-65535\n"
+        "-A POSTROUTING -s 192.168.2.0/24 ! -d 192.168.2.0/24 -p tcp -m comment --comment "
+        "\"generated for Multipass network goodbr0\" -j MASQUERADE --to-ports 1024-65535\n"
+        "-A POSTROUTING -s 192.168.2.0/24 -d 255.255.255.255/32 -m comment --comment "
+        "\"generated for Multipass network goodbr0\" -j RETURN\n"
+        "-A POSTROUTING -s 192.168.2.0/24 -d 224.0.0.0/24 -m comment --comment "
+        "\"generated for Multipass network goodbr0\" -j RETURN\n"
+        "COMMIT\n"
+        "*mangle\n"
+        "-A POSTROUTING -o goodbr0 -p udp -m udp --dport 68 -m comment --comment "
+        "\"generated for Multipass network goodbr0\" -j CHECKSUM --checksum-fill\n"
+        "COMMIT\n"};
+    QByteArray current_rules;
+    bool restore_fails{false};
+
     mpt::MockProcessFactory::Callback iptables_callback = [this](mpt::MockProcess* process) {
-        if (process->program() == "iptables")
+        if (process->program() == "iptables-save")
+        {
+            ON_CALL(*process, read_all_standard_output()).WillByDefault(Return(current_rules));
+        }
+        else if (process->program() == "iptables-restore" && restore_fails)
         {
-            if (process->arguments().contains(goodbr0))
-            {
-                mp::ProcessState exit_state;
-                exit_state.exit_code = 0;
-                EXPECT_CALL(*process, execute(_)).WillOnce(Return(exit_state));
-            }
-            else if (process->arguments().contains(evilbr0))
-            {
-                mp::ProcessState exit_state;
-                exit_state.exit_code = 1;
-                EXPECT_CALL(*process, execute(_)).WillOnce(Return(exit_state));
-                ON_CALL(*process, read_all_standard_error()).WillByDefault(Return("Evil bridge detected!\n"));
-            }
+            mp::ProcessState exit_state;
+            exit_state.exit_code = 1;
+            ON_CALL(*process, process_state()).WillByDefault(Return(exit_state));
+            ON_CALL(*process, read_all_standard_error()).WillByDefault(Return("Evil bridge detected!\n"));
         }
     };
+
+    auto count_of(const std::vector<mpt::MockProcessFactory::ProcessInfo>& processes, const QString& program)
+    {
+        return std::count_if(processes.cbegin(), processes.cend(),
+                             [&program](const auto& info) { return info.command == program; });
+    }
 };
 } // namespace
 
@@ -73,8 +121,69 @@ TEST_F(IPTablesConfig, iptables_error_throws)
 {
     auto factory = mpt::MockProcessFactory::Inject();
     factory->register_callback(iptables_callback);
+    restore_fails = true;
 
     mp::IPTablesConfig iptables_config{evilbr0, subnet};
 
     EXPECT_THROW(iptables_config.verify_iptables_rules(), std::runtime_error);
 }
+
+TEST_F(IPTablesConfig, rules_are_set_in_one_restore)
+{
+    auto factory = mpt::MockProcessFactory::Inject();
+    factory->register_callback(iptables_callback);
+
+    mp::IPTablesConfig iptables_config{goodbr0, subnet};
+
+    auto processes = factory->process_list();
+    EXPECT_EQ(count_of(processes, "iptables-save"), 1);
+    EXPECT_EQ(count_of(processes, "iptables-restore"), 1);
+    EXPECT_EQ(count_of(processes, "iptables"), 0);
+}
+
+TEST_F(IPTablesConfig, verify_only_dumps_rules_that_are_in_place)
+{
+    auto factory = mpt::MockProcessFactory::Inject();
+    factory->register_callback(iptables_callback);
+
+    mp::IPTablesConfig iptables_config{goodbr0, subnet};
+    current_rules = goodbr0_rules;
+
+    iptables_config.verify_iptables_rules();
+
+    auto processes = factory->process_list();
+    EXPECT_EQ(count_of(processes, "iptables-save"), 2);
+    EXPECT_EQ(count_of(processes, "iptables-restore"), 1);
+}
+
+TEST_F(IPTablesConfig, verify_restores_missing_rules)
+{
+    auto factory = mpt::MockProcessFactory::Inject();
+    factory->register_callback(iptables_callback);
+
+    mp::IPTablesConfig iptables_config{goodbr0, subnet};
+
+    iptables_config.verify_iptables_rules();
+
+    EXPECT_EQ(count_of(factory->process_list(), "iptables-restore"), 2);
+}
+
+TEST_F(IPTablesConfig, lets_instances_reach_the_host_ports_it_is_given)
+{
+    auto factory = mpt::MockProcessFactory::Inject();
+    factory->register_callback(iptables_callback);
+
+    mp::IPTablesConfig iptables_config{goodbr0, subnet, {3142}};
+    current_rules = goodbr0_rules;
+
+    iptables_config.verify_iptables_rules();
+
+    EXPECT_EQ(count_of(factory->process_list(), "iptables-restore"), 2);
+
+    current_rules.replace("*filter\n:INPUT ACCEPT [0:0]\n",
+                          "*filter\n:INPUT ACCEPT [0:0]\n-A INPUT -i goodbr0 -p tcp -m tcp --dport 3142 -m comment "
+                          "--comment \"generated for Multipass network goodbr0\" -j ACCEPT\n");
+    iptables_config.verify_iptables_rules();
+
+    EXPECT_EQ(count_of(factory->process_list(), "iptables-restore"), 2);
+}
@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <src/platform/backends/qemu/ksm_policy.h>
+
+#include "tests/file_operations.h"
+#include "tests/temp_dir.h"
+
+#include <QDir>
+#include <QFile>
+
+#include <gmock/gmock.h>
+
+#include <unistd.h>
+
+namespace mp = multipass;
+namespace mpt = multipass::test;
+using namespace testing;
+
+namespace
+{
+struct KsmPolicy : public Test
+{
+    KsmPolicy()
+    {
+        set("run", "0\n");
+        set("pages_to_scan", "100\n");
+        set("sleep_millisecs", "20\n");
+        set("pages_sharing", "0\n");
+        set_available_memory(8, 8);
+    }
+
+    void set(const QString& name, const std::string& value)
+    {
+        mpt::make_file_with_content(QDir{temp_dir.path()}.filePath(name), value);
+    }
+
+    QString get(const QString& name)
+    {
+        QFile file{QDir{temp_dir.path()}.filePath(name)};
+        file.open(QIODevice::ReadOnly);
+        return QString::fromLatin1(file.readAll()).trimmed();
+    }
+
+    void set_available_memory(int available_gb, int total_gb)
+    {
+        mpt::make_file_with_content(meminfo_path, "MemTotal:       " + std::to_string(total_gb * 1048576) +
+                                                      " kB\nMemFree:         1024 kB\nMemAvailable:   " +
+                                                      std::to_string(available_gb * 1048576) + " kB\n");
+    }
+
+    mpt::TempDir temp_dir;
+    mpt::TempDir proc_dir;
+    const QString meminfo_path{QDir{proc_dir.path()}.filePath("meminfo")};
+};
+} // namespace
+
+TEST_F(KsmPolicy, scans_harder_with_more_instances_and_less_memory)
+{
+    EXPECT_EQ(mp::KsmPolicy::tuning_for(2, 0.9).pages_to_scan, 200);
+    EXPECT_EQ(mp::KsmPolicy::tuning_for(2, 0.9).sleep_millisecs, 200);
+    EXPECT_EQ(mp::KsmPolicy::tuning_for(2, 0.3).pages_to_scan, 800);
+    EXPECT_EQ(mp::KsmPolicy::tuning_for(2, 0.1).sleep_millisecs, 20);
+    EXPECT_EQ(mp::KsmPolicy::tuning_for(50, 0.1).pages_to_scan, 10000);
+}
+
+TEST_F(KsmPolicy, leaves_a_single_instance_alone)
+{
+    mp::KsmPolicy policy{temp_dir.path(), meminfo_path};
+
+    policy.instance_started("first");
+
+    EXPECT_EQ(get("run"), "0");
+    EXPECT_EQ(get("pages_to_scan"), "100");
+}
+
+TEST_F(KsmPolicy, merges_once_two_instances_run)
+{
+    mp::KsmPolicy policy{temp_dir.path(), meminfo_path};
+
+    policy.instance_started("first");
+    policy.instance_started("second");
+
+    EXPECT_EQ(get("run"), "1");
+    EXPECT_EQ(get("pages_to_scan"), "200");
+    EXPECT_EQ(get("sleep_millisecs"), "200");
+}
+
+TEST_F(KsmPolicy, retunes_as_memory_runs_short)
+{
+    mp::KsmPolicy policy{temp_dir.path(), meminfo_path};
+    policy.instance_started("first");
+    policy.instance_started("second");
+
+    set_available_memory(1, 8);
+    policy.retune();
+
+    EXPECT_EQ(get("pages_to_scan"), "3200");
+    EXPECT_EQ(get("sleep_millisecs"), "20");
+}
+
+TEST_F(KsmPolicy, puts_the_kernel_settings_back)
+{
+    mp::KsmPolicy policy{temp_dir.path(), meminfo_path};
+    policy.instance_started("first");
+    policy.instance_started("second");
+
+    policy.instance_stopped("second");
+
+    EXPECT_EQ(get("run"), "0");
+    EXPECT_EQ(get("pages_to_scan"), "100");
+    EXPECT_EQ(get("sleep_millisecs"), "20");
+}
+
+TEST_F(KsmPolicy, reports_merged_pages_in_bytes)
+{
+    set("pages_sharing", "10\n");
+    mp::KsmPolicy policy{temp_dir.path(), meminfo_path};
+
+    EXPECT_EQ(policy.merged_bytes(), 10 * sysconf(_SC_PAGESIZE));
+}
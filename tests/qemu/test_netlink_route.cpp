@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <src/platform/backends/qemu/netlink_route.h>
+
+#include <gmock/gmock.h>
+
+#include <linux/rtnetlink.h>
+
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+namespace mp = multipass;
+using namespace testing;
+
+namespace
+{
+ifinfomsg a_link()
+{
+    ifinfomsg link{};
+    link.ifi_family = AF_UNSPEC;
+    link.ifi_index = 7;
+    return link;
+}
+
+const rtattr* attribute_at(mp::NetlinkRoute::Request& request, std::size_t offset)
+{
+    return reinterpret_cast<const rtattr*>(reinterpret_cast<const char*>(request.header()) + offset);
+}
+
+constexpr auto first_attribute = NLMSG_ALIGN(NLMSG_LENGTH(sizeof(ifinfomsg)));
+
+// An acknowledgement as the kernel sends it, the request's header following the error
+void append_acknowledgement(std::vector<char>& reply, std::uint32_t sequence, int error)
+{
+    nlmsghdr header{};
+    header.nlmsg_len = NLMSG_LENGTH(sizeof(nlmsgerr));
+    header.nlmsg_type = NLMSG_ERROR;
+    header.nlmsg_seq = sequence;
+
+    nlmsgerr acknowledgement{};
+    acknowledgement.error = -error;
+
+    const auto offset = reply.size();
+    reply.resize(offset + NLMSG_SPACE(sizeof(nlmsgerr)));
+    std::memcpy(&reply[offset], &header, sizeof(header));
+    std::memcpy(&reply[offset + NLMSG_HDRLEN], &acknowledgement, sizeof(acknowledgement));
+}
+} // namespace
+
+TEST(NetlinkRequest, starts_with_its_header_and_payload)
+{
+    mp::NetlinkRoute::Request request{RTM_NEWLINK, NLM_F_CREATE, a_link()};
+    const auto header = request.header();
+
+    EXPECT_EQ(header->nlmsg_len, NLMSG_LENGTH(sizeof(ifinfomsg)));
+    EXPECT_EQ(header->nlmsg_type, RTM_NEWLINK);
+    EXPECT_EQ(header->nlmsg_flags, NLM_F_REQUEST | NLM_F_ACK | NLM_F_CREATE);
+    EXPECT_EQ(reinterpret_cast<const ifinfomsg*>(NLMSG_DATA(header))->ifi_index, 7);
+}
+
+TEST(NetlinkRequest, pads_attributes_to_their_alignment)
+{
+    mp::NetlinkRoute::Request request{RTM_NEWLINK, 0, a_link()};
+    request.add_attribute(IFLA_IFNAME, QString{"mpbr0"});
+    const std::uint32_t master = 3;
+    request.add_attribute(IFLA_MASTER, &master, sizeof(master));
+
+    const auto name = attribute_at(request, first_attribute);
+    EXPECT_EQ(name->rta_type, IFLA_IFNAME);
+    EXPECT_EQ(name->rta_len, RTA_LENGTH(6)); // the name's terminator included, the padding not
+    EXPECT_STREQ(static_cast<const char*>(RTA_DATA(name)), "mpbr0");
+
+    const auto next = attribute_at(request, first_attribute + RTA_ALIGN(name->rta_len));
+    EXPECT_EQ(next->rta_type, IFLA_MASTER);
+    EXPECT_EQ(*static_cast<const std::uint32_t*>(RTA_DATA(next)), master);
+
+    EXPECT_EQ(request.header()->nlmsg_len, first_attribute + RTA_SPACE(6) + RTA_SPACE(sizeof(master)));
+    EXPECT_EQ(request.header()->nlmsg_len % NLMSG_ALIGNTO, 0u);
+}
+
+TEST(NetlinkRequest, nested_attributes_span_their_contents)
+{
+    mp::NetlinkRoute::Request request{RTM_NEWLINK, 0, a_link()};
+    const auto link_info = request.begin_nested(IFLA_LINKINFO);
+    request.add_attribute(IFLA_INFO_KIND, QString{"bridge"});
+    request.end_nested(link_info);
+
+    const auto nested = attribute_at(request, link_info);
+    EXPECT_EQ(link_info, first_attribute);
+    EXPECT_EQ(nested->rta_type, IFLA_LINKINFO);
+    EXPECT_EQ(nested->rta_len, RTA_LENGTH(RTA_SPACE(7)));
+
+    const auto kind = static_cast<const rtattr*>(RTA_DATA(nested));
+    EXPECT_EQ(kind->rta_type, IFLA_INFO_KIND);
+    EXPECT_STREQ(static_cast<const char*>(RTA_DATA(kind)), "bridge");
+    EXPECT_EQ(request.header()->nlmsg_len, first_attribute + nested->rta_len);
+}
+
+TEST(NetlinkAcknowledgement, reports_success)
+{
+    std::vector<char> reply;
+    append_acknowledgement(reply, 4, 0);
+
+    EXPECT_EQ(mp::NetlinkRoute::acknowledgement_in(reply.data(), reply.size(), 4), mp::optional<int>{0});
+}
+
+TEST(NetlinkAcknowledgement, reports_the_error_of_the_request)
+{
+    std::vector<char> reply;
+    append_acknowledgement(reply, 4, EEXIST);
+
+    EXPECT_EQ(mp::NetlinkRoute::acknowledgement_in(reply.data(), reply.size(), 4), mp::optional<int>{EEXIST});
+}
+
+TEST(NetlinkAcknowledgement, skips_those_of_earlier_requests)
+{
+    std::vector<char> reply;
+    append_acknowledgement(reply, 3, ENODEV);
+    append_acknowledgement(reply, 4, 0);
+
+    EXPECT_EQ(mp::NetlinkRoute::acknowledgement_in(reply.data(), reply.size(), 4), mp::optional<int>{0});
+    EXPECT_EQ(mp::NetlinkRoute::acknowledgement_in(reply.data(), reply.size(), 5), mp::nullopt);
+}
+
+TEST(NetlinkAcknowledgement, rejects_a_truncated_one)
+{
+    std::vector<char> reply;
+    append_acknowledgement(reply, 4, 0);
+    reinterpret_cast<nlmsghdr*>(reply.data())->nlmsg_len = NLMSG_HDRLEN + 2;
+
+    EXPECT_EQ(mp::NetlinkRoute::acknowledgement_in(reply.data(), reply.size(), 4), mp::optional<int>{EBADMSG});
+}
+
+TEST(NetlinkAcknowledgement, ignores_a_reply_cut_short)
+{
+    std::vector<char> reply;
+    append_acknowledgement(reply, 4, 0);
+
+    EXPECT_EQ(mp::NetlinkRoute::acknowledgement_in(reply.data(), NLMSG_HDRLEN - 1, 4), mp::nullopt);
+}
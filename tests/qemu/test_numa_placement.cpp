@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <src/platform/backends/qemu/numa_placement.h>
+
+#include "tests/file_operations.h"
+#include "tests/temp_dir.h"
+
+#include <QDir>
+
+#include <gmock/gmock.h>
+
+namespace mp = multipass;
+namespace mpt = multipass::test;
+using namespace testing;
+
+namespace
+{
+struct NumaPlacement : public Test
+{
+    void add_node(const QString& node, const std::string& cpu_list)
+    {
+        QDir{temp_dir.path()}.mkpath(node);
+        mpt::make_file_with_content(QDir{temp_dir.path()}.filePath(node + "/cpulist"), cpu_list);
+    }
+
+    mpt::TempDir temp_dir;
+};
+} // namespace
+
+TEST_F(NumaPlacement, does_not_place_on_single_node_hosts)
+{
+    add_node("node0", "0-7\n");
+    mp::NumaPlacement placement{temp_dir.path()};
+
+    EXPECT_FALSE(placement.place("vm", 2));
+}
+
+TEST_F(NumaPlacement, balances_vcpus_across_nodes)
+{
+    add_node("node0", "0-3\n");
+    add_node("node1", "4-5,8-9\n");
+    add_node("node2", "\n"); // memory only
+    mp::NumaPlacement placement{temp_dir.path()};
+
+    EXPECT_EQ(placement.place("first", 4), mp::make_optional(0));
+    EXPECT_EQ(placement.place("second", 2), mp::make_optional(1));
+    EXPECT_EQ(placement.place("third", 1), mp::make_optional(1));
+    EXPECT_EQ(placement.place("first", 4), mp::make_optional(0));
+
+    placement.release("first");
+    EXPECT_EQ(placement.place("fourth", 1), mp::make_optional(0));
+
+    EXPECT_THAT(placement.cpus_of(1), ElementsAre(4, 5, 8, 9));
+}
+
+TEST_F(NumaPlacement, accounts_for_instances_already_bound)
+{
+    add_node("node0", "0-3\n");
+    add_node("node1", "4-7\n");
+    mp::NumaPlacement placement{temp_dir.path()};
+
+    placement.place_on("resumed", 2, 0);
+
+    EXPECT_EQ(placement.place("new", 2), mp::make_optional(1));
+}
@@ -18,6 +18,7 @@
 #include <src/platform/backends/qemu/qemu_virtual_machine_factory.h>
 
 #include "tests/extra_assertions.h"
+#include "tests/file_operations.h"
 #include "tests/mock_environment_helpers.h"
 #include "tests/mock_process_factory.h"
 #include "tests/mock_status_monitor.h"
@@ -37,6 +38,8 @@
 #include <scope_guard.hpp>
 
 #include <QJsonArray>
+#include <yaml-cpp/yaml.h>
+
 #include <thread>
 
 namespace mp = multipass;
@@ -140,6 +143,30 @@ TEST_F(QemuBackend, machine_start_suspend_sends_monitoring_event)
     machine->suspend();
 }
 
+TEST_F(QemuBackend, suspending_to_a_snapshot_leaves_no_memory_state_behind)
+{
+    NiceMock<mpt::MockVMStatusMonitor> mock_monitor;
+    mpt::TempDir instance_dir;
+    const auto image_path = instance_dir.path() + "/image.img";
+    const auto memory_state_path = instance_dir.path() + "/suspend.memstate";
+    mpt::make_file_with_content(image_path);
+    mpt::make_file_with_content(memory_state_path);
+    auto description = default_description;
+    description.image.image_path = image_path;
+    mp::QemuVirtualMachineFactory backend{data_dir.path()};
+
+    auto machine = backend.create_virtual_machine(description, mock_monitor);
+    ASSERT_THAT(machine->current_state(), Eq(mp::VirtualMachine::State::suspended));
+    machine->start();
+    machine->state = mp::VirtualMachine::State::running;
+
+    // The test QEMU refuses to save the memory to a file, so the state resumed from must not outlive the snapshot
+    EXPECT_CALL(mock_monitor, on_suspend());
+    machine->suspend();
+
+    EXPECT_FALSE(QFile::exists(memory_state_path));
+}
+
 TEST_F(QemuBackend, throws_when_starting_while_suspending)
 {
     NiceMock<mpt::MockVMStatusMonitor> mock_monitor;
@@ -404,6 +431,23 @@ TEST_F(QemuBackend, verify_qemu_arguments_from_metadata_are_used)
     EXPECT_TRUE(qemu->arguments.contains("-hows_it_going"));
 }
 
+TEST_F(QemuBackend, configure_adds_guest_ready_script)
+{
+    auto factory = mpt::MockProcessFactory::Inject();
+    factory->register_callback(handle_external_process_calls);
+
+    mp::QemuVirtualMachineFactory backend{data_dir.path()};
+    YAML::Node meta_config, vendor_config;
+    backend.configure("pied-piper-valley", meta_config, vendor_config);
+
+    ASSERT_TRUE(vendor_config["write_files"].IsSequence());
+    ASSERT_EQ(vendor_config["write_files"].size(), 1u);
+
+    const auto& script = vendor_config["write_files"][0];
+    EXPECT_EQ(script["path"].as<std::string>(), "/var/lib/cloud/scripts/per-boot/multipass-ready");
+    EXPECT_THAT(script["content"].as<std::string>(), HasSubstr("/dev/virtio-ports/io.multipass.ready"));
+}
+
 TEST_F(QemuBackend, returns_version_string)
 {
     constexpr auto qemu_version_output = "QEMU emulator version 2.11.1(Debian 1:2.11+dfsg-1ubuntu7.15)\n"
@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <src/platform/backends/qemu/qemu_detached_process.h>
+#include <src/platform/backends/shared/linux/process_factory.h>
+#include <src/platform/backends/shared/simple_process_spec.h>
+
+#include "tests/mock_process_factory.h"
+#include "tests/temp_dir.h"
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QProcess>
+
+#include <gmock/gmock.h>
+
+namespace mp = multipass;
+namespace mpt = multipass::test;
+using namespace testing;
+
+namespace
+{
+struct QemuDetachedProcess : public Test
+{
+    QemuDetachedProcess()
+    {
+        process_factory->register_callback([this](mpt::MockProcess* process) {
+            EXPECT_CALL(*process, process_state()).WillRepeatedly(Return(launched_state));
+        });
+        launched_state.exit_code = 0;
+    }
+
+    ~QemuDetachedProcess()
+    {
+        if (qemu.state() != QProcess::NotRunning)
+        {
+            qemu.kill();
+            qemu.waitForFinished();
+        }
+    }
+
+    // Stands in for a QEMU that has set itself up: the pid file written and the monitor listening
+    void set_up_qemu()
+    {
+        qemu.start("sleep", {"60"});
+        ASSERT_TRUE(qemu.waitForStarted());
+
+        QFile pid_file{pid_file_path};
+        ASSERT_TRUE(pid_file.open(QIODevice::WriteOnly));
+        pid_file.write(QByteArray::number(qemu.processId()));
+        pid_file.close();
+
+        ASSERT_TRUE(monitor.listen(qmp_socket_path));
+    }
+
+    std::unique_ptr<mp::QemuDetachedProcess> make_process()
+    {
+        return std::make_unique<mp::QemuDetachedProcess>(
+            mp::ProcessFactory::instance().create_process(mp::simple_process_spec("qemu-system-x86_64")),
+            qmp_socket_path, pid_file_path);
+    }
+
+    std::unique_ptr<mpt::MockProcessFactory::Scope> process_factory = mpt::MockProcessFactory::Inject();
+    mp::ProcessState launched_state;
+    mpt::TempDir dir;
+    QString qmp_socket_path{dir.path() + "/qmp.sock"};
+    QString pid_file_path{dir.path() + "/qemu.pid"};
+    QProcess qemu;
+    QLocalServer monitor;
+};
+} // namespace
+
+TEST_F(QemuDetachedProcess, does_not_attach_when_nothing_was_left_running)
+{
+    auto process = make_process();
+
+    EXPECT_FALSE(process->attach());
+    EXPECT_FALSE(process->running());
+    EXPECT_EQ(process->process_id(), 0);
+}
+
+TEST_F(QemuDetachedProcess, does_not_attach_to_a_qemu_that_is_gone)
+{
+    set_up_qemu();
+    qemu.kill();
+    qemu.waitForFinished();
+
+    auto process = make_process();
+
+    EXPECT_FALSE(process->attach());
+    EXPECT_FALSE(process->running());
+}
+
+TEST_F(QemuDetachedProcess, attaches_to_the_qemu_left_running_and_talks_to_it_over_its_socket)
+{
+    set_up_qemu();
+    auto process = make_process();
+
+    ASSERT_TRUE(process->attach());
+    EXPECT_TRUE(process->running());
+    EXPECT_EQ(process->process_id(), qemu.processId());
+
+    ASSERT_TRUE(monitor.waitForNewConnection(1000));
+    auto connection = monitor.nextPendingConnection();
+    process->write("{\"execute\": \"qmp_capabilities\"}\n");
+    ASSERT_TRUE(connection->waitForReadyRead(1000));
+    EXPECT_EQ(connection->readAll(), "{\"execute\": \"qmp_capabilities\"}\n");
+
+    connection->write("{\"return\": {}}\n");
+    connection->flush();
+    QCoreApplication::processEvents();
+    EXPECT_EQ(process->read_all_standard_output(), "{\"return\": {}}\n");
+}
+
+TEST_F(QemuDetachedProcess, starts_once_the_launcher_has_left_qemu_set_up)
+{
+    auto process = make_process();
+    auto started = false;
+    QObject::connect(process.get(), &mp::Process::started, [&started] { started = true; });
+
+    process->start();
+    set_up_qemu();
+    ASSERT_TRUE(process->wait_for_started());
+
+    EXPECT_TRUE(started);
+    EXPECT_TRUE(process->running());
+    EXPECT_FALSE(process->process_state().error);
+}
+
+TEST_F(QemuDetachedProcess, does_not_start_when_the_launcher_fails)
+{
+    launched_state.exit_code = 1;
+    auto process = make_process();
+
+    process->start();
+
+    EXPECT_FALSE(process->wait_for_started());
+    EXPECT_FALSE(process->running());
+    EXPECT_FALSE(process->process_state().completed_successfully());
+}
+
+TEST_F(QemuDetachedProcess, finishes_once_qemu_exits)
+{
+    set_up_qemu();
+    auto process = make_process();
+    ASSERT_TRUE(process->attach());
+    auto finished = false;
+    QObject::connect(process.get(), &mp::Process::finished, [&finished] { finished = true; });
+
+    ASSERT_TRUE(monitor.waitForNewConnection(1000));
+    qemu.kill();
+    qemu.waitForFinished();
+    monitor.nextPendingConnection()->disconnectFromServer();
+
+    EXPECT_TRUE(process->wait_for_finished(5000));
+    EXPECT_TRUE(finished);
+    EXPECT_FALSE(process->running());
+    EXPECT_FALSE(QFile::exists(pid_file_path));
+}
+
+TEST_F(QemuDetachedProcess, leaves_qemu_running_when_it_goes)
+{
+    set_up_qemu();
+    auto process = make_process();
+    ASSERT_TRUE(process->attach());
+
+    process.reset();
+
+    EXPECT_EQ(qemu.state(), QProcess::Running);
+    EXPECT_TRUE(QFile::exists(pid_file_path));
+}
@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <src/platform/backends/qemu/qemu_guest_agent.h>
+
+#include "tests/extra_assertions.h"
+#include "tests/temp_dir.h"
+
+#include <QJsonDocument>
+#include <QLocalServer>
+#include <QLocalSocket>
+
+#include <gmock/gmock.h>
+
+#include <functional>
+#include <future>
+#include <stdexcept>
+#include <thread>
+
+namespace mp = multipass;
+namespace mpt = multipass::test;
+using namespace testing;
+
+namespace
+{
+// Serves one connection on a thread of its own, as the agent would, answering each request with what the handler
+// makes of it. The handler gets the raw line, sync delimiter and all
+struct FakeAgent
+{
+    using Handler = std::function<QByteArray(const QByteArray& request)>;
+
+    FakeAgent(const QString& socket_path, Handler handler)
+        : server_thread{[this, socket_path, handler] {
+              QLocalServer server;
+              listening.set_value(server.listen(socket_path));
+              if (!server.waitForNewConnection(5000))
+                  return;
+
+              auto connection = server.nextPendingConnection();
+              QByteArray input;
+              while (connection->state() == QLocalSocket::ConnectedState && connection->waitForReadyRead(5000))
+              {
+                  input += connection->readAll();
+                  for (auto line_end = input.indexOf('\n'); line_end >= 0; line_end = input.indexOf('\n'))
+                  {
+                      connection->write(handler(input.left(line_end)));
+                      connection->flush();
+                      input.remove(0, line_end + 1);
+                  }
+              }
+          }}
+    {
+        EXPECT_TRUE(listening.get_future().get());
+    }
+
+    ~FakeAgent()
+    {
+        server_thread.join();
+    }
+
+    std::promise<bool> listening;
+    std::thread server_thread;
+};
+
+// Answers the sync with the id it was given, after leftovers of an earlier client, and hands the rest on
+FakeAgent::Handler synchronising(std::function<QByteArray(const QJsonObject& request)> handler)
+{
+    return [handler](const QByteArray& line) -> QByteArray {
+        if (line.startsWith('\xff'))
+        {
+            const auto request = QJsonDocument::fromJson(line.mid(1)).object();
+            const auto id = request["arguments"].toObject()["id"].toVariant().toLongLong();
+            return "{\"return\": 1}\n\xff{\"return\": " + QByteArray::number(id) + "}\n";
+        }
+
+        return handler(QJsonDocument::fromJson(line).object());
+    };
+}
+
+struct QemuGuestAgent : public Test
+{
+    mpt::TempDir dir;
+    QString socket_path{dir.path() + "/agent.sock"};
+};
+} // namespace
+
+TEST_F(QemuGuestAgent, runs_commands_once_past_what_an_earlier_client_left)
+{
+    QJsonObject received;
+    FakeAgent agent{socket_path, synchronising([&received](const QJsonObject& request) -> QByteArray {
+                        received = request;
+                        return "{\"return\": {\"version\": \"4.2.0\"}}\n";
+                    })};
+
+    {
+        mp::QemuGuestAgent guest_agent{socket_path};
+        auto result = guest_agent.execute("guest-info", {{"verbose", true}});
+        EXPECT_EQ(result.toObject()["version"].toString(), "4.2.0");
+    }
+
+    EXPECT_EQ(received["execute"].toString(), "guest-info");
+    EXPECT_TRUE(received["arguments"].toObject()["verbose"].toBool());
+}
+
+TEST_F(QemuGuestAgent, throws_with_why_the_agent_refused_a_command)
+{
+    FakeAgent agent{socket_path, synchronising([](const QJsonObject&) -> QByteArray {
+                        return "{\"error\": {\"class\": \"GenericError\", \"desc\": \"no such file\"}}\n";
+                    })};
+
+    mp::QemuGuestAgent guest_agent{socket_path};
+    MP_EXPECT_THROW_THAT(guest_agent.execute("guest-file-open", {{"path", "/nope"}}), std::runtime_error,
+                         Property(&std::runtime_error::what,
+                                  AllOf(HasSubstr("guest-file-open"), HasSubstr("no such file"))));
+}
+
+TEST_F(QemuGuestAgent, gives_up_on_an_agent_that_does_not_sync)
+{
+    FakeAgent agent{socket_path, [](const QByteArray&) { return QByteArray{"{\"return\": {}}\n"}; }};
+
+    EXPECT_THROW(mp::QemuGuestAgent(socket_path, 200), std::runtime_error);
+}
+
+TEST_F(QemuGuestAgent, gives_up_on_commands_the_agent_does_not_answer)
+{
+    FakeAgent agent{socket_path, synchronising([](const QJsonObject&) { return QByteArray{}; })};
+
+    mp::QemuGuestAgent guest_agent{socket_path, 200};
+    MP_EXPECT_THROW_THAT(guest_agent.execute("guest-get-osinfo"), std::runtime_error,
+                         Property(&std::runtime_error::what, HasSubstr("did not answer in time")));
+}
+
+TEST_F(QemuGuestAgent, throws_when_there_is_no_agent)
+{
+    EXPECT_THROW(mp::QemuGuestAgent(socket_path, 200), std::runtime_error);
+}
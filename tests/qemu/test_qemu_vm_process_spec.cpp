@@ -51,9 +51,12 @@ TEST_F(TestQemuVMProcessSpec, default_arguments_correct)
                                              "-device",
                                              "scsi-hd,drive=hda,bus=scsi0.0",
                                              "-smp",
-                                             "2",
+                                             QString("2,maxcpus=%1").arg(mp::QemuVMProcessSpec::max_cores_for(desc)),
                                              "-m",
-                                             "3072M",
+                                             QString("3072M,slots=8,maxmem=%1M")
+                                                 .arg(mp::QemuVMProcessSpec::max_memory_in_megabytes_for(desc)),
+                                             "-device",
+                                             "virtio-balloon-pci,id=balloon0,free-page-reporting=on",
                                              "-device",
                                              "virtio-net-pci,netdev=hostnet0,id=net0,mac=00:11:22:33:44:55",
                                              "-netdev",
@@ -67,10 +70,158 @@ TEST_F(TestQemuVMProcessSpec, default_arguments_correct)
                                              "-serial",
                                              "chardev:char0",
                                              "-nographic",
+                                             "-device",
+                                             "virtio-serial-pci,id=virtio-serial0",
+                                             "-chardev",
+                                             "null,id=char1",
+                                             "-device",
+                                             "virtserialport,chardev=char1,id=multipass-ready,name=io.multipass.ready",
+                                             "-chardev",
+                                             "socket,id=guest-agent,path=/path/to/guest-agent.sock,server=on,wait=off",
+                                             "-device",
+                                             "virtserialport,chardev=guest-agent,id=guest-agent,"
+                                             "name=org.qemu.guest_agent.0",
+                                             "-smbios",
+                                             "type=1,serial=ds=nocloud",
                                              "-cdrom",
                                              "/path/to/cloud_init.iso"}));
 }
 
+TEST_F(TestQemuVMProcessSpec, direct_disk_profiles_use_an_iothread)
+{
+    auto tuned_desc = desc;
+    tuned_desc.disk_profile = "io_uring";
+
+    mp::QemuVMProcessSpec spec(tuned_desc, tap_device_name, mp::nullopt);
+
+    const auto args = spec.arguments();
+    EXPECT_TRUE(args.contains("iothread,id=iothread0"));
+    EXPECT_TRUE(args.contains("file=/path/to/image,if=none,format=qcow2,discard=unmap,cache=none,aio=io_uring,"
+                              "l2-cache-size=1048576,id=hda"));
+    EXPECT_TRUE(args.contains("virtio-blk-pci,drive=hda,iothread=iothread0,num-queues=2"));
+    EXPECT_FALSE(args.contains("virtio-scsi-pci,id=scsi0"));
+}
+
+TEST_F(TestQemuVMProcessSpec, hugepages_back_memory_on_the_numa_node)
+{
+    auto hugepages_desc = desc;
+    hugepages_desc.hugepages = true;
+
+    mp::QemuVMProcessSpec spec(hugepages_desc, tap_device_name, mp::nullopt, {}, 1);
+
+    const auto args = spec.arguments();
+    const auto object = args.indexOf("-object");
+    ASSERT_NE(object, -1);
+    EXPECT_EQ(args.at(object + 1), "memory-backend-file,id=ram0,size=3072M,mem-path=/dev/hugepages,prealloc=on,"
+                                   "host-nodes=1,policy=bind");
+    EXPECT_EQ(args.at(object + 2), "-numa");
+    EXPECT_EQ(args.at(object + 3), "node,memdev=ram0");
+}
+
+TEST_F(TestQemuVMProcessSpec, multi_queue_taps_get_a_queue_pair_per_core)
+{
+    mp::QemuVMProcessSpec spec(desc, tap_device_name, mp::nullopt, {}, mp::nullopt, 2, true);
+
+    const auto args = spec.arguments();
+    EXPECT_TRUE(args.contains("virtio-net-pci,netdev=hostnet0,id=net0,mac=00:11:22:33:44:55,mq=on,vectors=6"));
+    EXPECT_TRUE(args.contains("tap,id=hostnet0,ifname=tap_device,script=no,downscript=no,vhost=on,queues=2"));
+}
+
+TEST_F(TestQemuVMProcessSpec, kernel_boot_profile_boots_the_fetched_kernel)
+{
+    auto kernel_desc = desc;
+    kernel_desc.image.kernel_path = "/path/to/kernel";
+    kernel_desc.image.initrd_path = "/path/to/initrd";
+
+    mp::QemuVMProcessSpec spec(kernel_desc, tap_device_name, mp::nullopt, {}, mp::nullopt, 1, false, "kernel");
+
+    const auto args = spec.arguments();
+    const auto kernel = args.indexOf("-kernel");
+    ASSERT_NE(kernel, -1);
+    EXPECT_EQ(args.mid(kernel, 6), QStringList({"-kernel", "/path/to/kernel", "-initrd", "/path/to/initrd", "-append",
+                                                "root=LABEL=cloudimg-rootfs ro console=ttyS0 ds=nocloud"}));
+    EXPECT_FALSE(args.contains("-smbios"));
+    EXPECT_FALSE(args.contains("-nodefaults"));
+    EXPECT_TRUE(args.contains("-cdrom"));
+    EXPECT_TRUE(spec.apparmor_profile().contains("/path/to/kernel r,"));
+    EXPECT_TRUE(spec.apparmor_profile().contains("/path/to/initrd r,"));
+}
+
+TEST_F(TestQemuVMProcessSpec, microvm_boot_profile_uses_a_minimal_machine)
+{
+    auto kernel_desc = desc;
+    kernel_desc.image.kernel_path = "/path/to/kernel";
+    kernel_desc.image.initrd_path = "/path/to/initrd";
+
+    mp::QemuVMProcessSpec spec(kernel_desc, tap_device_name, mp::nullopt, {}, mp::nullopt, 1, false, "microvm");
+
+    const auto args = spec.arguments();
+    const auto machine = args.indexOf("-machine");
+    ASSERT_NE(machine, -1);
+    EXPECT_EQ(args.at(machine + 1), "microvm,pcie=on");
+    EXPECT_EQ(args.at(machine + 2), "-nodefaults");
+    EXPECT_FALSE(args.contains("-cdrom"));
+    EXPECT_TRUE(args.contains("file=/path/to/cloud_init.iso,if=none,format=raw,readonly=on,id=cidata"));
+    EXPECT_TRUE(args.contains("virtio-blk-pci,drive=cidata"));
+}
+
+TEST_F(TestQemuVMProcessSpec, hot_plug_room_never_below_the_instance)
+{
+    auto big_desc = desc;
+    big_desc.num_cores = 4096;
+    big_desc.mem_size = mp::MemorySize{"16384G"};
+
+    EXPECT_EQ(mp::QemuVMProcessSpec::max_cores_for(big_desc), 4096);
+    EXPECT_EQ(mp::QemuVMProcessSpec::max_memory_in_megabytes_for(big_desc), 16384LL * 1024);
+    EXPECT_GE(mp::QemuVMProcessSpec::max_cores_for(desc), 2);
+}
+
+TEST_F(TestQemuVMProcessSpec, microvm_boot_profile_leaves_no_room_to_hot_plug)
+{
+    auto kernel_desc = desc;
+    kernel_desc.image.kernel_path = "/path/to/kernel";
+    kernel_desc.image.initrd_path = "/path/to/initrd";
+
+    mp::QemuVMProcessSpec spec(kernel_desc, tap_device_name, mp::nullopt, {}, mp::nullopt, 1, false, "microvm");
+
+    const auto args = spec.arguments();
+    EXPECT_EQ(args.at(args.indexOf("-smp") + 1), "2");
+    EXPECT_EQ(args.at(args.indexOf("-m") + 1), "3072M");
+}
+
+TEST_F(TestQemuVMProcessSpec, density_mode_leaves_memory_mergeable)
+{
+    mp::QemuVMProcessSpec spec(desc, tap_device_name, mp::nullopt, {}, mp::nullopt, 1, false, "firmware", true);
+
+    EXPECT_FALSE(spec.arguments().contains("mem-merge=off"));
+}
+
+TEST_F(TestQemuVMProcessSpec, keeps_memory_from_merging_without_density_mode)
+{
+    mp::QemuVMProcessSpec spec(desc, tap_device_name, mp::nullopt, {}, mp::nullopt, 1, false, "firmware", false);
+
+    const auto args = spec.arguments();
+    const auto machine = args.indexOf("-machine");
+    ASSERT_NE(machine, -1);
+    EXPECT_EQ(args.at(machine + 1), "mem-merge=off");
+}
+
+TEST_F(TestQemuVMProcessSpec, detached_instances_daemonize_with_qmp_on_a_socket)
+{
+    mp::QemuVMProcessSpec spec(desc, tap_device_name, mp::nullopt, {}, mp::nullopt, 1, false, "firmware", false,
+                               true);
+
+    const auto args = spec.arguments();
+    const auto qmp = args.indexOf("-qmp");
+    ASSERT_NE(qmp, -1);
+    EXPECT_EQ(args.at(qmp + 1), "unix:/path/to/qmp.sock,server=on,wait=off");
+    EXPECT_FALSE(args.contains("-nographic"));
+    EXPECT_EQ(args.at(args.indexOf("-display") + 1), "none");
+    EXPECT_TRUE(args.contains("-daemonize"));
+    EXPECT_EQ(args.at(args.indexOf("-pidfile") + 1), "/path/to/qemu.pid");
+    EXPECT_TRUE(spec.apparmor_profile().contains("/path/to/qmp.sock rw,"));
+}
+
 TEST_F(TestQemuVMProcessSpec, legacy_resume_arguments_correct)
 {
     const mp::QemuVMProcessSpec::ResumeData resume_data{"suspend_tag", "machine_type", false, {}};
@@ -147,6 +298,99 @@ TEST_F(TestQemuVMProcessSpec, resume_arguments_taken_from_resumedata)
     EXPECT_EQ(spec.arguments(), QStringList({"-one", "-two", "-loadvm", "suspend_tag", "-machine", "machine_type"}));
 }
 
+TEST_F(TestQemuVMProcessSpec, resume_arguments_saved_while_detached_are_attached_again)
+{
+    const mp::QemuVMProcessSpec::ResumeData resume_data{
+        "suspend_tag",
+        "machine_type",
+        false,
+        {"-qmp", "unix:/path/to/qmp.sock,server=on,wait=off", "-display", "none", "-daemonize", "-pidfile",
+         "/path/to/qemu.pid"}};
+
+    mp::QemuVMProcessSpec spec(desc, tap_device_name, resume_data);
+
+    EXPECT_EQ(spec.arguments(),
+              QStringList({"-qmp", "stdio", "-nographic", "-loadvm", "suspend_tag", "-machine", "machine_type"}));
+}
+
+TEST_F(TestQemuVMProcessSpec, resume_from_memory_state_waits_for_incoming_migration)
+{
+    const mp::QemuVMProcessSpec::ResumeData resume_data{
+        "suspend_tag", "machine_type", false, {"-one"}, "/path/to/suspend.memstate"};
+
+    mp::QemuVMProcessSpec spec(desc, tap_device_name, resume_data);
+
+    EXPECT_EQ(spec.arguments(), QStringList({"-one", "-incoming", "defer", "-machine", "machine_type"}));
+}
+
+TEST_F(TestQemuVMProcessSpec, memory_state_is_kept_next_to_the_image)
+{
+    mp::QemuVMProcessSpec spec(desc, tap_device_name, mp::nullopt);
+
+    EXPECT_EQ(mp::QemuVMProcessSpec::memory_state_file_for(desc), "/path/to/suspend.memstate");
+    EXPECT_TRUE(spec.apparmor_profile().contains("/path/to/suspend.memstate{,.part} rw,"));
+}
+
+TEST_F(TestQemuVMProcessSpec, memory_templates_write_their_memory_through_to_a_file)
+{
+    auto template_desc = desc;
+    template_desc.memory_template = true;
+
+    mp::QemuVMProcessSpec spec(template_desc, tap_device_name, mp::nullopt);
+
+    const auto args = spec.arguments();
+    const auto object = args.indexOf("-object");
+    ASSERT_NE(object, -1);
+    EXPECT_EQ(args.at(object + 1), "memory-backend-file,id=ram0,size=3072M,mem-path=/path/to/template.ram,share=on");
+    EXPECT_FALSE(args.contains("-incoming"));
+    EXPECT_TRUE(args.contains("vmgenid,guid=auto"));
+    EXPECT_TRUE(spec.apparmor_profile().contains("/path/to/template.ram rw,"));
+    EXPECT_TRUE(spec.apparmor_profile().contains("/path/to/template.devstate{,.part} rw,"));
+}
+
+TEST_F(TestQemuVMProcessSpec, clones_map_the_template_memory_privately_and_wait_for_its_state)
+{
+    auto clone_desc = desc;
+    clone_desc.memory_template_dir = "/path/to/template";
+
+    mp::QemuVMProcessSpec spec(clone_desc, tap_device_name, mp::nullopt);
+
+    const auto args = spec.arguments();
+    const auto object = args.indexOf("-object");
+    ASSERT_NE(object, -1);
+    EXPECT_EQ(args.at(object + 1),
+              "memory-backend-file,id=ram0,size=3072M,mem-path=/path/to/template/template.ram,share=off");
+    EXPECT_EQ(args.at(args.indexOf("-incoming") + 1), "defer");
+    EXPECT_TRUE(args.contains("-S"));
+    EXPECT_TRUE(args.contains("vmgenid,guid=auto"));
+}
+
+TEST_F(TestQemuVMProcessSpec, clones_may_open_the_template_memory_for_writing_but_not_its_state)
+{
+    auto clone_desc = desc;
+    clone_desc.memory_template_dir = "/path/to/template";
+
+    mp::QemuVMProcessSpec spec(clone_desc, tap_device_name, mp::nullopt);
+
+    const auto profile = spec.apparmor_profile();
+    EXPECT_TRUE(profile.contains("  /path/to/template/template.ram rw,"));
+    EXPECT_TRUE(profile.contains("  /path/to/template/template.devstate r,\n"));
+}
+
+TEST_F(TestQemuVMProcessSpec, clones_resume_with_memory_of_their_own)
+{
+    auto clone_desc = desc;
+    clone_desc.memory_template_dir = "/path/to/template";
+
+    mp::QemuVMProcessSpec spec(clone_desc, tap_device_name, mp::nullopt);
+
+    const auto args = mp::QemuVMProcessSpec::without_memory_template(spec.arguments());
+    EXPECT_TRUE(args.contains("memory-backend-ram,id=ram0,size=3072M"));
+    EXPECT_TRUE(args.contains("node,memdev=ram0"));
+    EXPECT_FALSE(args.contains("-incoming"));
+    EXPECT_FALSE(args.contains("-S"));
+}
+
 TEST_F(TestQemuVMProcessSpec, resume_with_missing_machine_type_guesses_correctly)
 {
     mp::QemuVMProcessSpec::ResumeData resume_data_missing_machine_info;
@@ -173,6 +417,43 @@ TEST_F(TestQemuVMProcessSpec, apparmor_profile_includes_disk_images)
     EXPECT_TRUE(spec.apparmor_profile().contains("/path/to/cloud_init.iso rk,"));
 }
 
+TEST_F(TestQemuVMProcessSpec, apparmor_profile_lets_qemu_serve_the_guest_agent_socket)
+{
+    mp::QemuVMProcessSpec spec(desc, tap_device_name, mp::nullopt);
+
+    EXPECT_TRUE(spec.apparmor_profile().contains("/path/to/guest-agent.sock rw,"));
+}
+
+TEST_F(TestQemuVMProcessSpec, shared_directories_are_exported_over_9p)
+{
+    mp::QemuVMProcessSpec spec(desc, tap_device_name, mp::nullopt, {{"/path/to/source", "mptag"}});
+
+    const auto args = spec.arguments();
+    const auto virtfs = args.indexOf("-virtfs");
+    ASSERT_NE(virtfs, -1);
+    EXPECT_EQ(args.at(virtfs + 1), "local,path=/path/to/source,mount_tag=mptag,security_model=mapped-xattr,id=mptag");
+    EXPECT_TRUE(spec.apparmor_profile().contains("\"/path/to/source/**\" rwlk,"));
+}
+
+TEST_F(TestQemuVMProcessSpec, shared_directories_cannot_add_apparmor_rules)
+{
+    mp::QemuVMProcessSpec spec(desc, tap_device_name, mp::nullopt,
+                               {{"/path/to/\" rwlk,\n  /** rwlk,\n  \"/src*", "mptag"}});
+
+    const auto profile = spec.apparmor_profile();
+    EXPECT_TRUE(profile.contains("\"/path/to/\\\" rwlk,\\012  /\\*\\* rwlk,\\012  \\\"/src\\*/**\" rwlk,"));
+    EXPECT_FALSE(profile.contains("\n  /** rwlk,"));
+}
+
+TEST_F(TestQemuVMProcessSpec, mount_tags_are_short_and_stable)
+{
+    const auto tag = mp::QemuVMProcessSpec::mount_tag_for("/home/ubuntu/a/very/long/target/path/inside/the/guest");
+
+    EXPECT_LE(tag.size(), 31);
+    EXPECT_EQ(tag, mp::QemuVMProcessSpec::mount_tag_for("/home/ubuntu/a/very/long/target/path/inside/the/guest"));
+    EXPECT_NE(tag, mp::QemuVMProcessSpec::mount_tag_for("/home/ubuntu/other"));
+}
+
 TEST_F(TestQemuVMProcessSpec, apparmor_profile_identifier)
 {
     mp::QemuVMProcessSpec spec(desc, tap_device_name, mp::nullopt);
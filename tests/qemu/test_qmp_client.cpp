@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <src/platform/backends/qemu/qmp_client.h>
+
+#include <QJsonDocument>
+
+#include <gmock/gmock.h>
+
+#include <vector>
+
+namespace mp = multipass;
+using namespace testing;
+
+namespace
+{
+struct QmpClient : public Test
+{
+    mp::QmpClient qmp{[this](const QByteArray& data) { written.push_back(QJsonDocument::fromJson(data).object()); },
+                      [this](const QString& event, const QJsonObject&) { events.push_back(event); }};
+    std::vector<QJsonObject> written;
+    std::vector<QString> events;
+};
+} // namespace
+
+TEST_F(QmpClient, tags_commands_awaiting_replies)
+{
+    qmp.execute("qmp_capabilities");
+    qmp.execute("query-status", {}, [](auto...) {});
+
+    ASSERT_EQ(written.size(), 2u);
+    EXPECT_FALSE(written[0].contains("id"));
+    EXPECT_EQ(written[1]["execute"].toString(), "query-status");
+    EXPECT_TRUE(written[1].contains("id"));
+}
+
+TEST_F(QmpClient, routes_replies_among_events_to_their_commands)
+{
+    QString status, error;
+    qmp.execute("query-status", {}, [&status](const QJsonValue& result, const QString&) {
+        status = result.toObject()["status"].toString();
+    });
+    qmp.execute("query-blockstats", {}, [&error](const QJsonValue&, const QString& reason) { error = reason; });
+
+    auto status_id = written[0]["id"].toInt();
+    auto blockstats_id = written[1]["id"].toInt();
+    qmp.feed(QString("{\"QMP\": {\"version\": {}}}\r\n"
+                     "{\"error\": {\"class\": \"GenericError\", \"desc\": \"no disks\"}, \"id\": %1}\r\n"
+                     "{\"event\": \"RESUME\"}\r\n"
+                     "{\"return\": {\"running\": true, \"status\": \"running\"}, \"id\": %2}\r\n")
+                 .arg(blockstats_id)
+                 .arg(status_id)
+                 .toUtf8());
+
+    EXPECT_EQ(status, "running");
+    EXPECT_EQ(error, "no disks");
+    EXPECT_THAT(events, ElementsAre("RESUME"));
+}
+
+TEST_F(QmpClient, waits_for_lines_split_across_reads)
+{
+    qmp.feed("{\"event\": \"POWER");
+    EXPECT_THAT(events, IsEmpty());
+
+    qmp.feed("DOWN\"}\n{\"event\": \"SHUTDOWN\"}");
+    EXPECT_THAT(events, ElementsAre("POWERDOWN", "SHUTDOWN"));
+}
+
+TEST_F(QmpClient, reset_fails_outstanding_replies)
+{
+    QString error;
+    qmp.execute("query-status", {}, [&error](const QJsonValue&, const QString& reason) { error = reason; });
+
+    qmp.reset("gone");
+
+    EXPECT_EQ(error, "gone");
+}
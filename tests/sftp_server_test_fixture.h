@@ -24,6 +24,9 @@
 
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <string>
+
 namespace multipass
 {
 namespace test
@@ -70,31 +73,48 @@ private:
 struct SftpServerTest : public testing::Test
 {
     SftpServerTest()
-        : free_sftp{mock_sftp_free, [](sftp_session sftp) {
+        : free_sftp{mock_sftp_free,
+                    [](sftp_session sftp) {
                         std::free(sftp->handles);
                         std::free(sftp);
-                    }}
+                    }},
+          read_sftp_init{mock_ssh_channel_read, [this](ssh_channel, void* dest, uint32_t count, int) {
+                             // Every sftp session the server starts is greeted with a client's SSH_FXP_INIT
+                             if (pending_init.empty())
+                                 pending_init = sftp_init;
+                             const auto size = std::min<std::string::size_type>(count, pending_init.size());
+                             std::copy_n(pending_init.begin(), size, static_cast<char*>(dest));
+                             pending_init.erase(0, size);
+                             return static_cast<int>(size);
+                         }}
     {
         connect.returnValue(SSH_OK);
         is_connected.returnValue(true);
         open_session.returnValue(SSH_OK);
         request_exec.returnValue(SSH_OK);
-        init_sftp.returnValue(SSH_OK);
         reply_status.returnValue(SSH_OK);
         get_client_msg.returnValue(nullptr);
         handle_sftp.returnValue(nullptr);
+        poll_channel.returnValue(1);
+        write_channel.returnValue(SSH_OK);
+        channel_window.returnValue(1024u * 1024u);
     }
 
     decltype(MOCK(ssh_connect)) connect{MOCK(ssh_connect)};
     decltype(MOCK(ssh_is_connected)) is_connected{MOCK(ssh_is_connected)};
     decltype(MOCK(ssh_channel_open_session)) open_session{MOCK(ssh_channel_open_session)};
     decltype(MOCK(ssh_channel_request_exec)) request_exec{MOCK(ssh_channel_request_exec)};
-    decltype(MOCK(sftp_server_init)) init_sftp{MOCK(sftp_server_init)};
     decltype(MOCK(sftp_reply_status)) reply_status{MOCK(sftp_reply_status)};
     decltype(MOCK(sftp_get_client_message)) get_client_msg{MOCK(sftp_get_client_message)};
     decltype(MOCK(sftp_client_message_free)) msg_free{MOCK(sftp_client_message_free)};
     decltype(MOCK(sftp_handle)) handle_sftp{MOCK(sftp_handle)};
+    decltype(MOCK(ssh_channel_poll_timeout)) poll_channel{MOCK(ssh_channel_poll_timeout)};
+    decltype(MOCK(ssh_channel_write)) write_channel{MOCK(ssh_channel_write)};
+    decltype(MOCK(ssh_channel_window_size)) channel_window{MOCK(ssh_channel_window_size)};
     MockScope<decltype(mock_sftp_free)> free_sftp;
+    const std::string sftp_init{"\0\0\0\x05\x01\0\0\0\x03", 9};
+    std::string pending_init;
+    MockScope<decltype(mock_ssh_channel_read)> read_sftp_init;
 };
 } // namespace test
 } // namespace multipass
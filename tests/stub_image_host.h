@@ -55,6 +55,11 @@ struct StubVMImageHost final : public multipass::VMImageHost
     {
         return {};
     }
+
+    int manifest_generation() override
+    {
+        return 0;
+    }
 };
 }
 }
@@ -81,6 +81,11 @@ public:
         return true;
     }
 
+    qint64 process_id() const override
+    {
+        return 0;
+    }
+
     mp::ProcessState process_state() const override
     {
         return mp::ProcessState();
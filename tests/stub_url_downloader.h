@@ -29,9 +29,11 @@ struct StubURLDownloader : public multipass::URLDownloader
     StubURLDownloader() : multipass::URLDownloader{std::chrono::seconds(10)}
     {
     }
-    void download_to(const QUrl& url, const QString& file_name, int64_t size, const int download_type,
-                     const multipass::ProgressMonitor&) override
+    QByteArray download_to(const QUrl& url, const QString& file_name, int64_t size, const int download_type,
+                           const multipass::ProgressMonitor&, const DataSink&,
+                           multipass::DownloadPriority) override
     {
+        return {};
     }
     QByteArray download(const QUrl& url) override
     {
@@ -27,7 +27,7 @@ namespace multipass
 {
 namespace test
 {
-struct StubVMImageVault final : public multipass::VMImageVault
+struct StubVMImageVault : public multipass::VMImageVault
 {
     multipass::VMImage fetch_image(const multipass::FetchType&, const multipass::Query&, const PrepareAction& prepare,
                                    const multipass::ProgressMonitor&) override
@@ -44,6 +44,31 @@ struct StubVMImageVault final : public multipass::VMImageVault
     void prune_expired_images() override{};
     void update_images(const FetchType& fetch_type, const PrepareAction& prepare,
                        const ProgressMonitor& monitor) override{};
+    void prefetch_image(const FetchType& fetch_type, const Query& query, const PrepareAction& prepare,
+                        const ProgressMonitor& monitor) override{};
+    multipass::VMImage clone_instance_image(const std::string&, const std::string&) override
+    {
+        return {dummy_image.name(), dummy_image.name(), dummy_image.name(), {}, {}, {}, {}, {}};
+    }
+    multipass::VMImage clone_template_image(const std::string&, const std::string&) override
+    {
+        return {dummy_image.name(), dummy_image.name(), dummy_image.name(), {}, {}, {}, {}, {}};
+    }
+    void snapshot_instance_image(const std::string&, const std::string&) override{};
+    void restore_instance_image(const std::string&, const std::string&) override{};
+    std::vector<ImageSnapshot> instance_image_snapshots(const std::string&) override
+    {
+        return {};
+    }
+    void bake_instance_image(const std::string&, const std::string&, bool) override{};
+    void remove_baked_image(const std::string&) override{};
+    bool is_baked_image(const multipass::Query&) override
+    {
+        return false;
+    }
+
+    void scrub_images(const multipass::FetchType&, const PrepareAction&, const multipass::ProgressMonitor&,
+                      int64_t) override{};
 
     TempFile dummy_image;
 };
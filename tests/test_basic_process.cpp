@@ -22,6 +22,13 @@
 
 #include <gmock/gmock.h>
 
+#include <QCoreApplication>
+#include <QEventLoop>
+#include <QThread>
+
+#include <chrono>
+#include <future>
+
 namespace mp = multipass;
 namespace mpt = multipass::test;
 
@@ -83,6 +90,76 @@ TEST_F(BasicProcessTest, execute_good_command_with_zero_exit_code)
     EXPECT_FALSE(process_state.error);
 }
 
+TEST_F(BasicProcessTest, run_async_hands_process_back_with_its_state)
+{
+    const int exit_code = 7;
+    mp::BasicProcess process(mp::simple_process_spec("mock_process", {QString::number(exit_code)}));
+    auto future = process.run_async();
+    while (future.wait_for(std::chrono::seconds::zero()) != std::future_status::ready)
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+    auto process_state = future.get();
+
+    ASSERT_TRUE(process_state.exit_code);
+    EXPECT_EQ(exit_code, *process_state.exit_code);
+    EXPECT_EQ(QThread::currentThread(), process.thread());
+}
+
+TEST_F(BasicProcessTest, run_async_calls_back_on_context_thread)
+{
+    mp::BasicProcess process(mp::simple_process_spec("mock_process", {QString::number(0)}));
+    QObject context;
+    QEventLoop loop;
+    mp::optional<mp::ProcessState> process_state;
+    QThread* called_on{nullptr};
+
+    process.run_async(30000, &context, [&](const mp::ProcessState& state) {
+        process_state = state;
+        called_on = QThread::currentThread();
+        loop.quit();
+    });
+    loop.exec();
+
+    ASSERT_TRUE(process_state);
+    EXPECT_TRUE(process_state->completed_successfully());
+    EXPECT_EQ(QThread::currentThread(), called_on);
+}
+
+TEST_F(BasicProcessTest, run_async_kills_processes_that_run_over)
+{
+    mp::BasicProcess process(mp::simple_process_spec("mock_process", {QString::number(0), "stay-alive"}));
+    QEventLoop loop;
+    mp::optional<mp::ProcessState> process_state;
+
+    process.run_async(10, &loop, [&](const mp::ProcessState& state) {
+        process_state = state;
+        loop.quit();
+    });
+    loop.exec();
+
+    ASSERT_TRUE(process_state);
+    ASSERT_TRUE(process_state->error);
+    EXPECT_EQ(QProcess::Timedout, process_state->error->state);
+}
+
+TEST_F(BasicProcessTest, run_async_does_not_call_back_once_context_is_gone)
+{
+    mp::BasicProcess process(mp::simple_process_spec("mock_process", {QString::number(0), "stay-alive"}));
+    auto called = false;
+
+    {
+        QObject context;
+        process.run_async(-1, &context, [&called](const mp::ProcessState&) { called = true; });
+    }
+
+    QEventLoop loop;
+    QObject::connect(&process, &mp::Process::finished, &loop, &QEventLoop::quit, Qt::QueuedConnection);
+    process.write(QByteArray(1, '\0')); // will make mock_process quit
+    loop.exec();
+    QCoreApplication::processEvents();
+
+    EXPECT_FALSE(called);
+}
+
 TEST_F(BasicProcessTest, process_state_when_runs_and_stops_ok)
 {
     const int exit_code = 7;
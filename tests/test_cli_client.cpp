@@ -86,6 +86,32 @@ struct MockDaemonRpc : public mp::DaemonRpc
                                       grpc::ServerWriter<mp::UmountReply>* response));
     MOCK_METHOD3(version, grpc::Status(grpc::ServerContext* context, const mp::VersionRequest* request,
                                        grpc::ServerWriter<mp::VersionReply>* response));
+    MOCK_METHOD3(watch, grpc::Status(grpc::ServerContext* context, const mp::WatchRequest* request,
+                                     grpc::ServerWriter<mp::WatchReply>* response));
+    MOCK_METHOD3(metrics, grpc::Status(grpc::ServerContext* context, const mp::MetricsRequest* request,
+                                       grpc::ServerWriter<mp::MetricsReply>* response));
+    MOCK_METHOD3(clone, grpc::Status(grpc::ServerContext* context, const mp::CloneRequest* request,
+                                     grpc::ServerWriter<mp::CloneReply>* response));
+    MOCK_METHOD3(snapshot, grpc::Status(grpc::ServerContext* context, const mp::SnapshotRequest* request,
+                                        grpc::ServerWriter<mp::SnapshotReply>* response));
+    MOCK_METHOD3(restore, grpc::Status(grpc::ServerContext* context, const mp::RestoreRequest* request,
+                                       grpc::ServerWriter<mp::RestoreReply>* response));
+    MOCK_METHOD3(snapshots, grpc::Status(grpc::ServerContext* context, const mp::SnapshotsRequest* request,
+                                         grpc::ServerWriter<mp::SnapshotsReply>* response));
+    MOCK_METHOD3(logs, grpc::Status(grpc::ServerContext* context, const mp::LogsRequest* request,
+                                    grpc::ServerWriter<mp::LogsReply>* response));
+    MOCK_METHOD3(qos, grpc::Status(grpc::ServerContext* context, const mp::QosRequest* request,
+                                   grpc::ServerWriter<mp::QosReply>* response));
+    MOCK_METHOD3(throttle, grpc::Status(grpc::ServerContext* context, const mp::ThrottleRequest* request,
+                                        grpc::ServerWriter<mp::ThrottleReply>* response));
+    MOCK_METHOD3(resize, grpc::Status(grpc::ServerContext* context, const mp::ResizeRequest* request,
+                                      grpc::ServerWriter<mp::ResizeReply>* response));
+    MOCK_METHOD3(bake, grpc::Status(grpc::ServerContext* context, const mp::BakeRequest* request,
+                                    grpc::ServerWriter<mp::BakeReply>* response));
+    MOCK_METHOD3(utilization, grpc::Status(grpc::ServerContext* context, const mp::UtilizationRequest* request,
+                                           grpc::ServerWriter<mp::UtilizationReply>* response));
+    MOCK_METHOD3(forward, grpc::Status(grpc::ServerContext* context, const mp::ForwardRequest* request,
+                                       grpc::ServerWriter<mp::ForwardReply>* response));
     MOCK_METHOD3(ping,
                  grpc::Status(grpc::ServerContext* context, const mp::PingRequest* request, mp::PingReply* response));
 };
@@ -271,6 +297,48 @@ TEST_F(Client, transfer_cmd_fails_source_is_dir)
                 Eq(mp::ReturnCode::CommandLineError));
 }
 
+TEST_F(Client, transfer_cmd_recursive_accepts_dir_source)
+{
+    EXPECT_CALL(mock_daemon, ssh_info(_, _, _));
+    EXPECT_THAT(send_command({"transfer", "--recursive", mpt::test_data_path().toStdString(), "test-vm:bar"}),
+                Eq(mp::ReturnCode::Ok));
+}
+
+TEST_F(Client, transfer_cmd_parallel_ok)
+{
+    EXPECT_CALL(mock_daemon, ssh_info(_, _, _));
+    EXPECT_THAT(send_command({"transfer", "--parallel", "8", "test-vm:foo", "test-vm:bar",
+                              mpt::test_data_path().toStdString()}),
+                Eq(mp::ReturnCode::Ok));
+}
+
+TEST_F(Client, transfer_cmd_fails_invalid_parallel)
+{
+    EXPECT_THAT(send_command({"transfer", "--parallel", "0", "test-vm:foo", mpt::test_data_path().toStdString()}),
+                Eq(mp::ReturnCode::CommandLineError));
+}
+
+TEST_F(Client, transfer_cmd_sync_ok)
+{
+    EXPECT_CALL(mock_daemon, ssh_info(_, _, _));
+    EXPECT_THAT(send_command({"transfer", "--sync", mpt::test_data_path().toStdString() + "good_index.json",
+                              "test-vm:bar"}),
+                Eq(mp::ReturnCode::Ok));
+}
+
+TEST_F(Client, transfer_cmd_fails_sync_from_instance)
+{
+    EXPECT_THAT(send_command({"transfer", "--sync", "test-vm:foo", mpt::test_data_path().toStdString()}),
+                Eq(mp::ReturnCode::CommandLineError));
+}
+
+TEST_F(Client, transfer_cmd_compress_ok)
+{
+    EXPECT_CALL(mock_daemon, ssh_info(_, _, _));
+    EXPECT_THAT(send_command({"transfer", "--compress", "test-vm:foo", mpt::test_data_path().toStdString()}),
+                Eq(mp::ReturnCode::Ok));
+}
+
 TEST_F(Client, transfer_cmd_fails_no_instance)
 {
     EXPECT_THAT(send_command({"transfer", mpt::test_data_path().toStdString() + "good_index.json", "."}),
@@ -486,6 +554,24 @@ TEST_F(Client, launch_cmd_name_option_ok)
     EXPECT_THAT(send_command({"launch", "-n", "foo"}), Eq(mp::ReturnCode::Ok));
 }
 
+TEST_F(Client, launch_cmd_timings_option_requests_timings)
+{
+    EXPECT_CALL(mock_daemon, launch(_, Property(&mp::LaunchRequest::timings, IsTrue()), _));
+    EXPECT_THAT(send_command({"launch", "--timings"}), Eq(mp::ReturnCode::Ok));
+}
+
+TEST_F(Client, launch_cmd_count_option_requests_count)
+{
+    EXPECT_CALL(mock_daemon, launch(_, Property(&mp::LaunchRequest::count, Eq(20)), _));
+    EXPECT_THAT(send_command({"launch", "--count", "20", "-n", "runner"}), Eq(mp::ReturnCode::Ok));
+}
+
+TEST_F(Client, launch_cmd_count_option_fails_with_non_positive_count)
+{
+    EXPECT_THAT(send_command({"launch", "--count", "0"}), Eq(mp::ReturnCode::CommandLineError));
+    EXPECT_THAT(send_command({"launch", "--count", "many"}), Eq(mp::ReturnCode::CommandLineError));
+}
+
 TEST_F(Client, launch_cmd_name_option_fails_no_value)
 {
     EXPECT_THAT(send_command({"launch", "-n"}), Eq(mp::ReturnCode::CommandLineError));
@@ -629,6 +715,12 @@ TEST_F(Client, exec_cmd_no_double_dash_ok_cmd_arg)
     EXPECT_THAT(send_command({"exec", "foo", "cmd"}), Eq(mp::ReturnCode::Ok));
 }
 
+TEST_F(Client, exec_cmd_compress_ok)
+{
+    EXPECT_CALL(mock_daemon, ssh_info(_, _, _));
+    EXPECT_THAT(send_command({"exec", "--compress", "foo", "--", "cmd"}), Eq(mp::ReturnCode::Ok));
+}
+
 TEST_F(Client, exec_cmd_no_double_dash_ok_multiple_args)
 {
     EXPECT_CALL(mock_daemon, ssh_info(_, _, _));
@@ -640,6 +732,36 @@ TEST_F(Client, exec_cmd_no_double_dash_fails_cmd_arg_with_opts)
     EXPECT_THAT(send_command({"exec", "foo", "cmd", "--foo"}), Eq(mp::ReturnCode::CommandLineError));
 }
 
+TEST_F(Client, exec_cmd_fast_exec_asks_daemon_when_nothing_is_cached)
+{
+    EXPECT_CALL(mock_settings, get(Eq(mp::fast_exec_key))).WillRepeatedly(Return("true"));
+    EXPECT_CALL(mock_daemon, ssh_info(_, make_ssh_info_instance_matcher("never-cached"), _));
+    EXPECT_THAT(send_command({"exec", "never-cached", "cmd"}), Eq(mp::ReturnCode::Ok));
+}
+
+TEST_F(Client, exec_cmd_all_asks_for_every_instance)
+{
+    EXPECT_CALL(mock_daemon, ssh_info(_, make_ssh_info_instance_matcher("*"), _));
+    EXPECT_THAT(send_command({"exec", "--all", "--", "cmd", "--foo"}), Eq(mp::ReturnCode::Ok));
+}
+
+TEST_F(Client, exec_cmd_all_fails_missing_cmd_arg)
+{
+    EXPECT_THAT(send_command({"exec", "--all"}), Eq(mp::ReturnCode::CommandLineError));
+}
+
+TEST_F(Client, exec_cmd_wildcard_asks_for_matching_instances)
+{
+    EXPECT_CALL(mock_daemon, ssh_info(_, make_ssh_info_instance_matcher("web-*"), _));
+    EXPECT_THAT(send_command({"exec", "--parallel", "2", "web-*", "cmd"}), Eq(mp::ReturnCode::Ok));
+}
+
+TEST_F(Client, exec_cmd_fails_non_positive_parallel)
+{
+    EXPECT_THAT(send_command({"exec", "--all", "--parallel", "0", "cmd"}), Eq(mp::ReturnCode::CommandLineError));
+    EXPECT_THAT(send_command({"exec", "--all", "--parallel", "many", "cmd"}), Eq(mp::ReturnCode::CommandLineError));
+}
+
 TEST_F(Client, exec_cmd_help_ok)
 {
     EXPECT_THAT(send_command({"exec", "-h"}), Eq(mp::ReturnCode::Ok));
@@ -700,6 +822,22 @@ TEST_F(Client, info_cmd_fails_with_names_and_all)
     EXPECT_THAT(send_command({"info", "--all", "foo", "bar"}), Eq(mp::ReturnCode::CommandLineError));
 }
 
+TEST_F(Client, info_cmd_requests_refresh)
+{
+    EXPECT_CALL(mock_daemon, info(_, Property(&mp::InfoRequest::refresh, IsTrue()), _));
+    EXPECT_THAT(send_command({"info", "--refresh", "foo"}), Eq(mp::ReturnCode::Ok));
+}
+
+TEST_F(Client, info_cmd_requests_only_given_fields)
+{
+    EXPECT_CALL(mock_daemon, info(_, Truly([](const mp::InfoRequest* request) {
+                                      return request->fields_size() == 2 && request->fields(0) == "name" &&
+                                             request->fields(1) == "state";
+                                  }),
+                                  _));
+    EXPECT_THAT(send_command({"info", "--fields", "name,state", "foo"}), Eq(mp::ReturnCode::Ok));
+}
+
 // list cli tests
 TEST_F(Client, list_cmd_ok_no_args)
 {
@@ -717,6 +855,376 @@ TEST_F(Client, list_cmd_help_ok)
     EXPECT_THAT(send_command({"list", "-h"}), Eq(mp::ReturnCode::Ok));
 }
 
+TEST_F(Client, list_cmd_requests_refresh)
+{
+    EXPECT_CALL(mock_daemon, list(_, Property(&mp::ListRequest::refresh, IsTrue()), _));
+    EXPECT_THAT(send_command({"list", "--refresh"}), Eq(mp::ReturnCode::Ok));
+}
+
+TEST_F(Client, list_cmd_passes_instance_filter)
+{
+    EXPECT_CALL(mock_daemon, list(_, Truly([](const mp::ListRequest* request) {
+                                      const auto& filter = request->filter();
+                                      return filter.states_size() == 2 &&
+                                             filter.states(0) == mp::InstanceStatus::RUNNING &&
+                                             filter.states(1) == mp::InstanceStatus::DELAYED_SHUTDOWN &&
+                                             filter.name_glob() == "web-*" && filter.image() == "bionic";
+                                  }),
+                                  _));
+    EXPECT_THAT(send_command({"list", "--state", "running,delayed-shutdown", "--match", "web-*", "--image", "bionic"}),
+                Eq(mp::ReturnCode::Ok));
+}
+
+TEST_F(Client, list_cmd_gathers_instances_from_every_message)
+{
+    EXPECT_CALL(mock_daemon, list(_, Property(&mp::ListRequest::chunked_reply, IsTrue()), _))
+        .WillOnce([](Unused, Unused, grpc::ServerWriter<mp::ListReply>* response) {
+            mp::ListReply chunk, last;
+            chunk.add_instances()->set_name("first-vm");
+            last.add_instances()->set_name("second-vm");
+            response->Write(chunk);
+            response->Write(last);
+            return grpc::Status{};
+        });
+
+    std::stringstream cout_stream;
+    EXPECT_THAT(send_command({"list", "--format", "csv"}, cout_stream), Eq(mp::ReturnCode::Ok));
+    EXPECT_THAT(cout_stream.str(), AllOf(HasSubstr("first-vm"), HasSubstr("second-vm")));
+}
+
+TEST_F(Client, list_cmd_fails_with_unknown_state)
+{
+    EXPECT_THAT(send_command({"list", "--state", "sleepy"}), Eq(mp::ReturnCode::CommandLineError));
+}
+
+// metrics cli tests
+TEST_F(Client, metrics_cmd_prints_the_exposition)
+{
+    const auto exposition =
+        std::string{"# TYPE multipass_ssh_sessions_total counter\nmultipass_ssh_sessions_total 3\n"};
+    EXPECT_CALL(mock_daemon, metrics(_, _, _))
+        .WillOnce([&exposition](Unused, Unused, grpc::ServerWriter<mp::MetricsReply>* response) {
+            mp::MetricsReply reply;
+            reply.set_exposition(exposition);
+            response->Write(reply);
+            return grpc::Status{};
+        });
+
+    std::stringstream cout_stream;
+    EXPECT_THAT(send_command({"metrics"}, cout_stream), Eq(mp::ReturnCode::Ok));
+    EXPECT_EQ(cout_stream.str(), exposition);
+}
+
+TEST_F(Client, metrics_cmd_fails_with_args)
+{
+    EXPECT_THAT(send_command({"metrics", "foo"}), Eq(mp::ReturnCode::CommandLineError));
+}
+
+// clone cli tests
+TEST_F(Client, clone_cmd_prints_the_new_name)
+{
+    EXPECT_CALL(mock_daemon, clone(_, _, _))
+        .WillOnce([](Unused, const mp::CloneRequest* request, grpc::ServerWriter<mp::CloneReply>* response) {
+            EXPECT_EQ(request->source_name(), "foo");
+            EXPECT_EQ(request->destination_name(), "bar");
+            mp::CloneReply reply;
+            reply.set_instance_name("bar");
+            response->Write(reply);
+            return grpc::Status{};
+        });
+
+    std::stringstream cout_stream;
+    EXPECT_THAT(send_command({"clone", "foo", "--name", "bar"}, cout_stream), Eq(mp::ReturnCode::Ok));
+    EXPECT_EQ(cout_stream.str(), "Cloned: bar\n");
+}
+
+TEST_F(Client, clone_cmd_fails_without_source)
+{
+    EXPECT_THAT(send_command({"clone"}), Eq(mp::ReturnCode::CommandLineError));
+}
+
+TEST_F(Client, clone_cmd_fails_with_multiple_sources)
+{
+    EXPECT_THAT(send_command({"clone", "foo", "bar"}), Eq(mp::ReturnCode::CommandLineError));
+}
+
+// snapshot cli tests
+TEST_F(Client, snapshot_cmd_prints_the_snapshot_name)
+{
+    EXPECT_CALL(mock_daemon, snapshot(_, _, _))
+        .WillOnce([](Unused, const mp::SnapshotRequest* request, grpc::ServerWriter<mp::SnapshotReply>* response) {
+            EXPECT_EQ(request->instance_name(), "foo");
+            EXPECT_TRUE(request->snapshot_name().empty());
+            mp::SnapshotReply reply;
+            reply.set_snapshot_name("snapshot1");
+            response->Write(reply);
+            return grpc::Status{};
+        });
+
+    std::stringstream cout_stream;
+    EXPECT_THAT(send_command({"snapshot", "foo"}, cout_stream), Eq(mp::ReturnCode::Ok));
+    EXPECT_EQ(cout_stream.str(), "Snapshot taken: snapshot1\n");
+}
+
+TEST_F(Client, snapshot_cmd_fails_without_instance)
+{
+    EXPECT_THAT(send_command({"snapshot"}), Eq(mp::ReturnCode::CommandLineError));
+}
+
+TEST_F(Client, restore_cmd_sends_instance_and_snapshot)
+{
+    EXPECT_CALL(mock_daemon, restore(_, _, _))
+        .WillOnce([](Unused, const mp::RestoreRequest* request, Unused) {
+            EXPECT_EQ(request->instance_name(), "foo");
+            EXPECT_EQ(request->snapshot_name(), "clean");
+            return grpc::Status{};
+        });
+
+    EXPECT_THAT(send_command({"restore", "foo", "clean"}), Eq(mp::ReturnCode::Ok));
+}
+
+TEST_F(Client, restore_cmd_fails_without_snapshot)
+{
+    EXPECT_THAT(send_command({"restore", "foo"}), Eq(mp::ReturnCode::CommandLineError));
+}
+
+TEST_F(Client, snapshots_cmd_lists_the_snapshots)
+{
+    EXPECT_CALL(mock_daemon, snapshots(_, _, _))
+        .WillOnce([](Unused, Unused, grpc::ServerWriter<mp::SnapshotsReply>* response) {
+            mp::SnapshotsReply reply;
+            auto snapshot = reply.add_snapshots();
+            snapshot->set_name("clean");
+            snapshot->set_created("2019-05-01T10:00:00Z");
+            response->Write(reply);
+            return grpc::Status{};
+        });
+
+    std::stringstream cout_stream;
+    EXPECT_THAT(send_command({"snapshots", "foo"}, cout_stream), Eq(mp::ReturnCode::Ok));
+    EXPECT_THAT(cout_stream.str(), HasSubstr("clean"));
+    EXPECT_THAT(cout_stream.str(), HasSubstr("2019-05-01T10:00:00Z"));
+}
+
+// logs cli tests
+TEST_F(Client, logs_cmd_prints_every_batch)
+{
+    EXPECT_CALL(mock_daemon, logs(_, _, _))
+        .WillOnce([](Unused, const mp::LogsRequest* request, grpc::ServerWriter<mp::LogsReply>* response) {
+            EXPECT_EQ(request->instance_name(), "foo");
+            EXPECT_EQ(request->level(), "warning");
+            for (const auto& message : {"first", "second"})
+            {
+                mp::LogsReply reply;
+                auto record = reply.add_records();
+                record->set_level("warning");
+                record->set_category("foo");
+                record->set_message(message);
+                response->Write(reply);
+            }
+            return grpc::Status{};
+        });
+
+    std::stringstream cout_stream;
+    EXPECT_THAT(send_command({"logs", "foo", "--level", "warning"}, cout_stream), Eq(mp::ReturnCode::Ok));
+    EXPECT_THAT(cout_stream.str(), AllOf(HasSubstr("[foo] first"), HasSubstr("[foo] second")));
+}
+
+TEST_F(Client, logs_cmd_fails_with_multiple_instances)
+{
+    EXPECT_THAT(send_command({"logs", "foo", "bar"}), Eq(mp::ReturnCode::CommandLineError));
+}
+
+// qos cli tests
+TEST_F(Client, qos_cmd_sends_the_class)
+{
+    EXPECT_CALL(mock_daemon, qos(_, Truly([](const mp::QosRequest* request) {
+                                     return request->resource_class() == mp::batch_resource_class &&
+                                            request->instance_names().instance_name_size() == 2;
+                                 }),
+                                 _));
+    EXPECT_THAT(send_command({"qos", "foo", "bar", "--class", "batch"}), Eq(mp::ReturnCode::Ok));
+}
+
+TEST_F(Client, qos_cmd_fails_without_a_class)
+{
+    EXPECT_THAT(send_command({"qos", "foo"}), Eq(mp::ReturnCode::CommandLineError));
+}
+
+TEST_F(Client, qos_cmd_fails_with_names_and_all)
+{
+    EXPECT_THAT(send_command({"qos", "foo", "--all", "-c", "latency"}), Eq(mp::ReturnCode::CommandLineError));
+}
+
+// throttle cli tests
+TEST_F(Client, throttle_cmd_leaves_out_caps_not_given)
+{
+    EXPECT_CALL(mock_daemon, throttle(_, Truly([](const mp::ThrottleRequest* request) {
+                                          return request->disk_iops() == 500 &&
+                                                 request->disk_bytes_per_second() == -1 &&
+                                                 request->network_bytes_per_second() == 10 * 1024 * 1024;
+                                      }),
+                                      _));
+    EXPECT_THAT(send_command({"throttle", "foo", "--disk-iops", "500", "--network-bandwidth", "10M"}),
+                Eq(mp::ReturnCode::Ok));
+}
+
+TEST_F(Client, throttle_cmd_lifts_caps_with_none)
+{
+    EXPECT_CALL(mock_daemon, throttle(_, Truly([](const mp::ThrottleRequest* request) {
+                                          return request->disk_bytes_per_second() == 0;
+                                      }),
+                                      _));
+    EXPECT_THAT(send_command({"throttle", "--all", "--disk-bandwidth", "none"}), Eq(mp::ReturnCode::Ok));
+}
+
+TEST_F(Client, throttle_cmd_fails_without_caps)
+{
+    EXPECT_THAT(send_command({"throttle", "foo"}), Eq(mp::ReturnCode::CommandLineError));
+}
+
+TEST_F(Client, throttle_cmd_fails_with_bad_sizes)
+{
+    EXPECT_THAT(send_command({"throttle", "foo", "--disk-bandwidth", "fast"}), Eq(mp::ReturnCode::CommandLineError));
+}
+
+// resize cli tests
+TEST_F(Client, resize_cmd_leaves_out_resources_not_given)
+{
+    EXPECT_CALL(mock_daemon, resize(_, Truly([](const mp::ResizeRequest* request) {
+                                        return request->instance_name() == "foo" && request->num_cores() == 4 &&
+                                               request->mem_size().empty() && request->disk_space() == "20G";
+                                    }),
+                                    _));
+    EXPECT_THAT(send_command({"resize", "foo", "--cpus", "4", "--disk", "20G"}), Eq(mp::ReturnCode::Ok));
+}
+
+TEST_F(Client, resize_cmd_fails_without_resources)
+{
+    EXPECT_THAT(send_command({"resize", "foo"}), Eq(mp::ReturnCode::CommandLineError));
+}
+
+TEST_F(Client, resize_cmd_fails_without_instance)
+{
+    EXPECT_THAT(send_command({"resize", "--mem", "4G"}), Eq(mp::ReturnCode::CommandLineError));
+}
+
+TEST_F(Client, resize_cmd_fails_with_bad_sizes)
+{
+    EXPECT_THAT(send_command({"resize", "foo", "--mem", "lots"}), Eq(mp::ReturnCode::CommandLineError));
+}
+
+// bake cli tests
+TEST_F(Client, bake_cmd_names_the_instance_and_image)
+{
+    EXPECT_CALL(mock_daemon, bake(_, Truly([](const mp::BakeRequest* request) {
+                                      return request->instance_name() == "foo" && request->image_name() == "golden" &&
+                                             request->compress() && !request->remove();
+                                  }),
+                                  _));
+    EXPECT_THAT(send_command({"bake", "foo", "golden", "--compress"}), Eq(mp::ReturnCode::Ok));
+}
+
+TEST_F(Client, bake_cmd_deletes_with_the_image_alone)
+{
+    EXPECT_CALL(mock_daemon, bake(_, Truly([](const mp::BakeRequest* request) {
+                                      return request->instance_name().empty() && request->image_name() == "golden" &&
+                                             request->remove();
+                                  }),
+                                  _));
+    EXPECT_THAT(send_command({"bake", "--delete", "golden"}), Eq(mp::ReturnCode::Ok));
+}
+
+TEST_F(Client, bake_cmd_fails_without_image)
+{
+    EXPECT_THAT(send_command({"bake", "foo"}), Eq(mp::ReturnCode::CommandLineError));
+}
+
+TEST_F(Client, bake_cmd_fails_deleting_compressed)
+{
+    EXPECT_THAT(send_command({"bake", "--delete", "golden", "--compress"}), Eq(mp::ReturnCode::CommandLineError));
+}
+
+// utilization cli tests
+TEST_F(Client, utilization_cmd_asks_for_the_windows_given)
+{
+    EXPECT_CALL(mock_daemon, utilization(_, Truly([](const mp::UtilizationRequest* request) {
+                                             return request->instance_names().instance_name_size() == 1 &&
+                                                    request->window_seconds_size() == 2 &&
+                                                    request->window_seconds(0) == 5400 &&
+                                                    request->window_seconds(1) == 604800;
+                                         }),
+                                         _));
+    EXPECT_THAT(send_command({"utilization", "foo", "--window", "90m", "--window", "7d"}), Eq(mp::ReturnCode::Ok));
+}
+
+TEST_F(Client, utilization_cmd_prints_each_summary)
+{
+    EXPECT_CALL(mock_daemon, utilization(_, _, _))
+        .WillOnce([](Unused, Unused, grpc::ServerWriter<mp::UtilizationReply>* response) {
+            mp::UtilizationReply reply;
+            auto summary = reply.add_summaries();
+            summary->set_instance_name("foo");
+            summary->set_metric("memory_usage");
+            summary->set_window_seconds(86400);
+            summary->set_min(104857600);
+            summary->set_average(209715200);
+            summary->set_p95(314572800);
+            summary->set_max(419430400);
+            response->Write(reply);
+            return grpc::Status{};
+        });
+
+    std::stringstream cout_stream;
+    EXPECT_THAT(send_command({"utilization"}, cout_stream), Eq(mp::ReturnCode::Ok));
+    EXPECT_THAT(cout_stream.str(), AllOf(HasSubstr("memory_usage"), HasSubstr("1d"), HasSubstr("100.0M"),
+                                         HasSubstr("300.0M"), HasSubstr("400.0M")));
+}
+
+TEST_F(Client, utilization_cmd_fails_with_bad_window)
+{
+    EXPECT_THAT(send_command({"utilization", "--window", "3w"}), Eq(mp::ReturnCode::CommandLineError));
+}
+
+// forward cli tests
+TEST_F(Client, forward_cmd_adds_and_removes_ports)
+{
+    EXPECT_CALL(mock_daemon, forward(_, Truly([](const mp::ForwardRequest* request) {
+                                         return request->instance_name() == "foo" && request->add_size() == 1 &&
+                                                request->add(0).host_port() == 8080 &&
+                                                request->add(0).instance_port() == 80 &&
+                                                request->add(0).address() == "0.0.0.0" &&
+                                                request->remove_size() == 1 && request->remove(0) == 2222;
+                                     }),
+                                     _));
+    EXPECT_THAT(send_command({"forward", "foo", "8080:80", "--address", "0.0.0.0", "--remove", "2222"}),
+                Eq(mp::ReturnCode::Ok));
+}
+
+TEST_F(Client, forward_cmd_lists_the_forwards)
+{
+    EXPECT_CALL(mock_daemon, forward(_, _, _))
+        .WillOnce([](Unused, Unused, grpc::ServerWriter<mp::ForwardReply>* response) {
+            mp::ForwardReply reply;
+            auto forward = reply.add_port_forwards();
+            forward->set_address("127.0.0.1");
+            forward->set_host_port(8080);
+            forward->set_instance_port(80);
+            response->Write(reply);
+            return grpc::Status{};
+        });
+
+    std::stringstream cout_stream;
+    EXPECT_THAT(send_command({"forward", "foo"}, cout_stream), Eq(mp::ReturnCode::Ok));
+    EXPECT_THAT(cout_stream.str(), AllOf(HasSubstr("127.0.0.1:8080"), HasSubstr("80")));
+}
+
+TEST_F(Client, forward_cmd_fails_with_bad_ports)
+{
+    EXPECT_THAT(send_command({"forward", "foo", "8080"}), Eq(mp::ReturnCode::CommandLineError));
+    EXPECT_THAT(send_command({"forward", "foo", "8080:99999"}), Eq(mp::ReturnCode::CommandLineError));
+}
+
 // mount cli tests
 // Note: mpt::test_data_path() returns an absolute path
 TEST_F(Client, mount_cmd_good_absolute_source_path)
@@ -789,6 +1297,40 @@ TEST_F(Client, mount_cmd_fails_invalid_host_int_gid_map)
                 Eq(mp::ReturnCode::CommandLineError));
 }
 
+TEST_F(Client, mount_cmd_native_type_requests_native_mount)
+{
+    EXPECT_CALL(mock_daemon,
+                mount(_, Property(&mp::MountRequest::mount_type, Eq(mp::MountRequest::NATIVE)), _));
+    EXPECT_THAT(send_command({"mount", "--type", "native", mpt::test_data_path().toStdString(), "test-vm:test"}),
+                Eq(mp::ReturnCode::Ok));
+}
+
+TEST_F(Client, mount_cmd_fails_invalid_type)
+{
+    EXPECT_THAT(send_command({"mount", "--type", "nfs", mpt::test_data_path().toStdString(), "test-vm:test"}),
+                Eq(mp::ReturnCode::CommandLineError));
+}
+
+TEST_F(Client, mount_cmd_profile_is_passed_on)
+{
+    EXPECT_CALL(mock_daemon, mount(_, Property(&mp::MountRequest::mount_profile, Eq("dev")), _));
+    EXPECT_THAT(send_command({"mount", "--profile", "dev", mpt::test_data_path().toStdString(), "test-vm:test"}),
+                Eq(mp::ReturnCode::Ok));
+}
+
+TEST_F(Client, mount_cmd_fails_invalid_profile)
+{
+    EXPECT_THAT(send_command({"mount", "--profile", "fast", mpt::test_data_path().toStdString(), "test-vm:test"}),
+                Eq(mp::ReturnCode::CommandLineError));
+}
+
+TEST_F(Client, mount_cmd_fails_profile_for_native_mount)
+{
+    EXPECT_THAT(send_command({"mount", "--type", "native", "--profile", "strict", mpt::test_data_path().toStdString(),
+                              "test-vm:test"}),
+                Eq(mp::ReturnCode::CommandLineError));
+}
+
 // recover cli tests
 TEST_F(Client, recover_cmd_fails_no_args)
 {
@@ -1413,6 +1955,141 @@ TEST_F(Client, find_cmd_unsupported_option_ok)
     EXPECT_THAT(send_command({"find", "--show-unsupported"}), Eq(mp::ReturnCode::Ok));
 }
 
+// batch cli tests
+TEST_F(Client, batch_cmd_runs_each_line)
+{
+    std::stringstream cin{"# comment\n\nlist\nstop 'foo bar'\n"};
+    EXPECT_CALL(mock_daemon, list(_, _, _));
+    EXPECT_CALL(mock_daemon, stop(_, make_instance_in_repeated_field_matcher<mp::StopRequest, 1>("foo bar"), _));
+    EXPECT_THAT(send_command({"batch"}, trash_stream, trash_stream, cin), Eq(mp::ReturnCode::Ok));
+}
+
+TEST_F(Client, batch_cmd_reports_failed_lines_and_goes_on)
+{
+    std::stringstream cin{"list foo\nlist\n"};
+    EXPECT_CALL(mock_daemon, list(_, _, _));
+    EXPECT_THAT(send_command({"batch"}, trash_stream, trash_stream, cin), Eq(mp::ReturnCode::CommandLineError));
+}
+
+TEST_F(Client, batch_cmd_stop_on_error_stops_at_first_failure)
+{
+    std::stringstream cin{"list foo\nlist\n"};
+    EXPECT_CALL(mock_daemon, list(_, _, _)).Times(0);
+    EXPECT_THAT(send_command({"batch", "--stop-on-error"}, trash_stream, trash_stream, cin),
+                Eq(mp::ReturnCode::CommandLineError));
+}
+
+TEST_F(Client, batch_cmd_rejects_nested_batch)
+{
+    std::stringstream cin{"batch\n"};
+    EXPECT_THAT(send_command({"batch"}, trash_stream, trash_stream, cin), Eq(mp::ReturnCode::CommandLineError));
+}
+
+TEST_F(Client, batch_cmd_fails_with_args)
+{
+    EXPECT_THAT(send_command({"batch", "foo"}), Eq(mp::ReturnCode::CommandLineError));
+}
+
+// fleet cli tests
+struct ClientFleet : public Client
+{
+    void TearDown() override
+    {
+        Mock::VerifyAndClearExpectations(&other_daemon);
+        Client::TearDown();
+    }
+
+    std::string hosts() const
+    {
+        return fmt::format("--hosts={},{}", server_address, other_address);
+    }
+
+    static grpc::Status commitment(grpc::ServerWriter<mp::VersionReply>* response, int cpus, int cpus_limit)
+    {
+        mp::VersionReply reply;
+        reply.mutable_host_commitment()->set_cpus(cpus);
+        reply.mutable_host_commitment()->set_cpus_limit(cpus_limit);
+        response->Write(reply);
+        return grpc::Status{};
+    }
+
+#ifdef WIN32
+    std::string other_address{"localhost:50052"};
+#else
+    std::string other_address{"unix:/tmp/test-multipassd-fleet.socket"};
+#endif
+    StrictMock<MockDaemonRpc> other_daemon{other_address, mp::RpcConnectionType::insecure, cert_provider, cert_store};
+};
+
+TEST_F(ClientFleet, lists_the_instances_of_every_host)
+{
+    auto reply_with = [](std::string name) {
+        return [name](Unused, Unused, grpc::ServerWriter<mp::ListReply>* response) {
+            mp::ListReply reply;
+            reply.add_instances()->set_name(name);
+            response->Write(reply);
+            return grpc::Status{};
+        };
+    };
+    EXPECT_CALL(mock_daemon, list(_, _, _)).WillOnce(reply_with("here-vm"));
+    EXPECT_CALL(other_daemon, list(_, _, _)).WillOnce(reply_with("there-vm"));
+
+    std::stringstream cout;
+    EXPECT_THAT(send_command({"fleet", hosts(), "list"}, cout), Eq(mp::ReturnCode::Ok));
+    EXPECT_THAT(cout.str(), AllOf(HasSubstr("here-vm"), HasSubstr("there-vm"), HasSubstr(other_address)));
+}
+
+TEST_F(ClientFleet, lists_what_answers_when_a_host_fails)
+{
+    EXPECT_CALL(mock_daemon, list(_, _, _)).WillOnce(Return(grpc::Status{grpc::StatusCode::INTERNAL, "broken"}));
+    EXPECT_CALL(other_daemon, list(_, _, _));
+
+    std::stringstream cerr;
+    EXPECT_THAT(send_command({"fleet", hosts(), "list"}, trash_stream, cerr), Eq(mp::ReturnCode::CommandFail));
+    EXPECT_THAT(cerr.str(), HasSubstr("broken"));
+}
+
+TEST_F(ClientFleet, finds_images_once_across_hosts)
+{
+    auto reply = [](Unused, Unused, grpc::ServerWriter<mp::FindReply>* response) {
+        mp::FindReply reply;
+        reply.add_images_info()->set_release("18.04 LTS");
+        response->Write(reply);
+        return grpc::Status{};
+    };
+    EXPECT_CALL(mock_daemon, find(_, _, _)).WillOnce(reply);
+    EXPECT_CALL(other_daemon, find(_, _, _)).WillOnce(reply);
+
+    std::stringstream cout;
+    EXPECT_THAT(send_command({"fleet", hosts(), "find", "--format=csv"}, cout), Eq(mp::ReturnCode::Ok));
+    const auto output = cout.str();
+    EXPECT_EQ(output.find("18.04 LTS"), output.rfind("18.04 LTS"));
+}
+
+TEST_F(ClientFleet, launches_on_the_least_committed_host)
+{
+    auto committed = [](int cpus) {
+        return [cpus](Unused, Unused, grpc::ServerWriter<mp::VersionReply>* response) {
+            return commitment(response, cpus, 16);
+        };
+    };
+    EXPECT_CALL(mock_daemon, version(_, _, _)).WillOnce(committed(12));
+    EXPECT_CALL(other_daemon, version(_, _, _)).WillOnce(committed(4));
+    EXPECT_CALL(other_daemon, launch(_, Property(&mp::LaunchRequest::num_cores, 2), _));
+
+    EXPECT_THAT(send_command({"fleet", hosts(), "launch", "--", "--cpus", "2"}), Eq(mp::ReturnCode::Ok));
+}
+
+TEST_F(ClientFleet, needs_hosts)
+{
+    EXPECT_THAT(send_command({"fleet", "list"}), Eq(mp::ReturnCode::CommandLineError));
+}
+
+TEST_F(ClientFleet, rejects_other_commands)
+{
+    EXPECT_THAT(send_command({"fleet", hosts(), "delete", "foo"}), Eq(mp::ReturnCode::CommandLineError));
+}
+
 // get/set cli tests
 struct TestBasicGetSetOptions : Client, WithParamInterface<const char*>
 {
@@ -1434,7 +2111,8 @@ TEST_P(TestBasicGetSetOptions, set_can_write_settings)
     EXPECT_THAT(send_command({"set", keyval_arg(key, val)}), Eq(mp::ReturnCode::Ok));
 }
 
-INSTANTIATE_TEST_SUITE_P(Client, TestBasicGetSetOptions, Values(mp::petenv_key, mp::driver_key, mp::autostart_key));
+INSTANTIATE_TEST_SUITE_P(Client, TestBasicGetSetOptions,
+                         Values(mp::petenv_key, mp::driver_key, mp::autostart_key, mp::image_overlays_key));
 
 TEST_F(Client, get_cmd_fails_with_no_arguments)
 {
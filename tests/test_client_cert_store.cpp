@@ -95,3 +95,52 @@ TEST_F(ClientCertStore, add_cert_stores_certificate)
     const auto content = cert_store.PEM_cert_chain();
     EXPECT_THAT(content, StrEq(cert_data));
 }
+
+TEST_F(ClientCertStore, reads_the_chain_again_only_once_a_certificate_is_added)
+{
+    constexpr auto cert_data = "-----BEGIN CERTIFICATE-----\n"
+                               "MIIBUjCB+AIBKjAKBggqhkjOPQQDAjA1MQswCQYDVQQGEwJDQTESMBAGA1UECgwJ\n"
+                               "Q2Fub25pY2FsMRIwEAYDVQQDDAlsb2NhbGhvc3QwHhcNMTgwNjIxMTM0MjI5WhcN\n"
+                               "MTkwNjIxMTM0MjI5WjA1MQswCQYDVQQGEwJDQTESMBAGA1UECgwJQ2Fub25pY2Fs\n"
+                               "MRIwEAYDVQQDDAlsb2NhbGhvc3QwWTATBgcqhkjOPQIBBggqhkjOPQMBBwNCAAQA\n"
+                               "FGNAqq7c5IMDeQ/cV4+EmogmkfpbTLSPfXgXVLHRsvL04xUAkqGpL+eyGFVE6dqa\n"
+                               "J7sAPJJwlVj1xD0r5DX5MAoGCCqGSM49BAMCA0kAMEYCIQCvI0PYv9f201fbe4LP\n"
+                               "BowTeYWSqMQtLNjvZgd++AAGhgIhALNPW+NRSKCXwadiIFgpbjPInLPqXPskLWSc\n"
+                               "aXByaQyt\n"
+                               "-----END CERTIFICATE-----\n";
+
+    mp::ClientCertStore cert_store{cert_dir};
+    EXPECT_TRUE(cert_store.PEM_cert_chain().empty());
+
+    const QDir dir{cert_dir};
+    mpt::make_file_with_content(dir.filePath("multipass_client_certs.pem"), "changed behind the store's back");
+    EXPECT_TRUE(cert_store.PEM_cert_chain().empty());
+
+    cert_store.add_cert(cert_data);
+    EXPECT_THAT(cert_store.PEM_cert_chain(), StrEq(std::string{"changed behind the store's back"} + cert_data));
+}
+
+TEST_F(ClientCertStore, serves_the_chain_last_read_without_going_to_disk)
+{
+    constexpr auto cert_data = "-----BEGIN CERTIFICATE-----\n"
+                               "MIIBUjCB+AIBKjAKBggqhkjOPQQDAjA1MQswCQYDVQQGEwJDQTESMBAGA1UECgwJ\n"
+                               "Q2Fub25pY2FsMRIwEAYDVQQDDAlsb2NhbGhvc3QwHhcNMTgwNjIxMTM0MjI5WhcN\n"
+                               "MTkwNjIxMTM0MjI5WjA1MQswCQYDVQQGEwJDQTESMBAGA1UECgwJQ2Fub25pY2Fs\n"
+                               "MRIwEAYDVQQDDAlsb2NhbGhvc3QwWTATBgcqhkjOPQIBBggqhkjOPQMBBwNCAAQA\n"
+                               "FGNAqq7c5IMDeQ/cV4+EmogmkfpbTLSPfXgXVLHRsvL04xUAkqGpL+eyGFVE6dqa\n"
+                               "J7sAPJJwlVj1xD0r5DX5MAoGCCqGSM49BAMCA0kAMEYCIQCvI0PYv9f201fbe4LP\n"
+                               "BowTeYWSqMQtLNjvZgd++AAGhgIhALNPW+NRSKCXwadiIFgpbjPInLPqXPskLWSc\n"
+                               "aXByaQyt\n"
+                               "-----END CERTIFICATE-----\n";
+
+    mp::ClientCertStore cert_store{cert_dir};
+    cert_store.add_cert(cert_data);
+    EXPECT_THAT(cert_store.PEM_cert_chain(), StrEq(cert_data));
+
+    const QDir dir{cert_dir};
+    ASSERT_TRUE(QFile::remove(dir.filePath("multipass_client_certs.pem")));
+    EXPECT_THAT(cert_store.PEM_cert_chain(), StrEq(cert_data));
+
+    cert_store.add_cert(cert_data);
+    EXPECT_THAT(cert_store.PEM_cert_chain(), StrEq(cert_data)); // only what the file holds now
+}
@@ -45,3 +45,22 @@ TEST_F(CloudInitIso, creates_iso_file)
     EXPECT_TRUE(file.exists());
     EXPECT_THAT(file.size(), Ge(0));
 }
+
+TEST_F(CloudInitIso, lays_out_whole_blocks_with_file_data_last)
+{
+    mp::CloudInitIso iso;
+    iso.add_file("meta-data", "meta data");
+    iso.add_file("user-data", "user data");
+    iso.write_to(iso_path);
+
+    QFile file{iso_path};
+    ASSERT_TRUE(file.open(QIODevice::ReadOnly));
+    const auto image = file.readAll();
+
+    // 16 reserved blocks, 3 for the descriptors, 2 for the path tables, 2 for the directories, 1 for each file
+    constexpr auto block_size = 2048;
+    ASSERT_THAT(image.size(), Eq(25 * block_size));
+    EXPECT_THAT(image.mid(16 * block_size + 1, 5), Eq("CD001"));
+    EXPECT_THAT(image.mid(23 * block_size, 9), Eq("meta data"));
+    EXPECT_THAT(image.mid(24 * block_size, 9), Eq("user data"));
+}
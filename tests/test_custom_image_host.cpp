@@ -206,7 +206,7 @@ TEST_F(CustomImageHost, handles_and_recovers_from_initial_network_failure)
     EXPECT_TRUE(host.info_for(query));
 }
 
-TEST_F(CustomImageHost, handles_and_recovers_from_later_network_failure)
+TEST_F(CustomImageHost, keeps_last_good_manifest_through_later_network_failure)
 {
     const auto ttl = 0s; // to ensure updates are always retried
     mp::CustomVMImageHost host{&url_downloader, ttl, test_path};
@@ -215,13 +215,16 @@ TEST_F(CustomImageHost, handles_and_recovers_from_later_network_failure)
     EXPECT_TRUE(host.info_for(query));
 
     url_downloader.mischiefs = 1000;
-    EXPECT_THROW(host.info_for(query), std::runtime_error);
+    EXPECT_TRUE(host.info_for(query));
+    host.wait_for_manifest_refresh();
+    EXPECT_TRUE(host.info_for(query));
 
     url_downloader.mischiefs = 0;
+    host.wait_for_manifest_refresh();
     EXPECT_TRUE(host.info_for(query));
 }
 
-TEST_F(CustomImageHost, handles_and_recovers_from_independent_server_failures)
+TEST_F(CustomImageHost, keeps_remotes_whose_server_fails_later)
 {
     const auto ttl = 0h;
     mp::CustomVMImageHost host{&url_downloader, ttl, test_path};
@@ -232,6 +235,8 @@ TEST_F(CustomImageHost, handles_and_recovers_from_independent_server_failures)
     for (size_t i = 0; i < num_remotes; ++i)
     {
         url_downloader.mischiefs = i;
-        EXPECT_EQ(mpt::count_remotes(host), num_remotes - i);
+        mpt::count_remotes(host);
+        host.wait_for_manifest_refresh();
+        EXPECT_EQ(mpt::count_remotes(host), num_remotes);
     }
 }
@@ -19,11 +19,13 @@
 #include <src/daemon/daemon.h>
 #include <src/daemon/daemon_config.h>
 #include <src/daemon/daemon_rpc.h>
+#include <src/daemon/journaled_json_store.h>
 #include <src/platform/update/disabled_update_prompt.h>
 
 #include <multipass/auto_join_thread.h>
 #include <multipass/cli/argparser.h>
 #include <multipass/cli/command.h>
+#include <multipass/exceptions/resize_exception.h>
 #include <multipass/name_generator.h>
 #include <multipass/version.h>
 #include <multipass/virtual_machine_factory.h>
@@ -31,6 +33,9 @@
 #include <multipass/vm_image_vault.h>
 
 #include "mock_environment_helpers.h"
+#include "mock_settings.h"
+#include "mock_ssh.h"
+#include "mock_virtual_machine.h"
 #include "mock_virtual_machine_factory.h"
 #include "stub_cert_store.h"
 #include "stub_certprovider.h"
@@ -47,16 +52,25 @@
 #include <gtest/gtest.h>
 
 #include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
 #include <QNetworkProxyFactory>
 #include <QSysInfo>
+#include <QThread>
+#include <QTimer>
 
 #include <scope_guard.hpp>
 
+#include <atomic>
 #include <memory>
 #include <ostream>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <unordered_map>
 
 namespace mp = multipass;
 namespace mpt = multipass::test;
@@ -112,6 +126,9 @@ struct MockDaemon : public mp::Daemon
                  void(const mp::UmountRequest*, grpc::ServerWriter<mp::UmountReply>*, std::promise<grpc::Status>*));
     MOCK_METHOD3(version,
                  void(const mp::VersionRequest*, grpc::ServerWriter<mp::VersionReply>*, std::promise<grpc::Status>*));
+    MOCK_METHOD3(watch,
+                 void(const mp::WatchRequest*, grpc::ServerWriter<mp::WatchReply>*, std::promise<grpc::Status>*));
+    MOCK_METHOD1(unwatch, void(grpc::ServerWriter<mp::WatchReply>*));
 
     template <typename Request, typename Reply>
     void set_promise_value(const Request*, grpc::ServerWriter<Reply>*, std::promise<grpc::Status>* status_promise)
@@ -357,6 +374,16 @@ TEST_F(Daemon, provides_version)
     EXPECT_THAT(stream.str(), HasSubstr(mp::version_string));
 }
 
+TEST_F(Daemon, reports_host_commitment_with_version)
+{
+    mp::Daemon daemon{config_builder.build()};
+
+    std::stringstream stream;
+    send_command({"version"}, stream);
+
+    EXPECT_THAT(stream.str(), HasSubstr("committed  0 of "));
+}
+
 TEST_F(Daemon, failed_restart_command_returns_fulfilled_promise)
 {
     mp::Daemon daemon{config_builder.build()};
@@ -371,6 +398,21 @@ TEST_F(Daemon, failed_restart_command_returns_fulfilled_promise)
     EXPECT_TRUE(is_ready(status_promise.get_future()));
 }
 
+TEST_F(Daemon, info_rejects_unknown_fields)
+{
+    mp::Daemon daemon{config_builder.build()};
+
+    mp::InfoRequest request;
+    request.add_fields("name");
+    request.add_fields("colour");
+    std::promise<grpc::Status> status_promise;
+
+    daemon.info(&request, nullptr, &status_promise);
+    auto status = status_promise.get_future().get();
+    EXPECT_EQ(status.error_code(), grpc::StatusCode::INVALID_ARGUMENT);
+    EXPECT_THAT(status.error_message(), HasSubstr("unknown field \"colour\""));
+}
+
 TEST_F(Daemon, proxy_contains_valid_info)
 {
     auto guard = sg::make_scope_guard([] {
@@ -465,6 +507,63 @@ TEST_P(DaemonCreateLaunchTestSuite, generates_name_on_creation_when_client_does_
     EXPECT_THAT(stream.str(), HasSubstr(expected_name));
 }
 
+TEST_F(Daemon, reports_each_launch_phase_once)
+{
+    mp::Daemon daemon{config_builder.build()};
+
+    std::stringstream stream;
+    send_command({"launch", "--timings"}, stream);
+
+    const auto output = stream.str();
+    for (const auto phase : {"fetch_image", "instance_image", "start", "total"})
+    {
+        const auto at = output.find(fmt::format("  {:<16}", phase));
+        ASSERT_NE(at, std::string::npos) << phase;
+        EXPECT_EQ(output.find(fmt::format("  {:<16}", phase), at + 1), std::string::npos) << phase;
+    }
+    EXPECT_LT(output.find("  fetch_image"), output.find("  instance_image"));
+    EXPECT_LT(output.find("  instance_image"), output.find("  start "));
+    EXPECT_LT(output.find("  start "), output.find("  total"));
+}
+
+TEST_F(Daemon, purging_replies_before_resources_are_reclaimed)
+{
+    const std::string name{"pied-piper-valley"};
+    auto mock_factory = use_a_mock_vm_factory();
+    config_builder.name_generator = std::make_unique<StubNameGenerator>(name);
+    mp::Daemon daemon{config_builder.build()};
+    send_command({"launch"});
+
+    // The daemon waits on the reaper before it goes, so this is met without any further command
+    EXPECT_CALL(*mock_factory, remove_resources_for(name));
+    send_command({"delete", "--purge", name});
+
+    std::stringstream stream;
+    send_command({"list"}, stream);
+    EXPECT_THAT(stream.str(), Not(HasSubstr(name)));
+}
+
+TEST_F(Daemon, reclaims_the_resources_of_purged_instances_on_its_own_thread)
+{
+    const std::string name{"pied-piper-valley"};
+    auto mock_factory = use_a_mock_vm_factory();
+    config_builder.name_generator = std::make_unique<StubNameGenerator>(name);
+    const auto daemon_thread = QThread::currentThread();
+    QThread* reclaimed_on{nullptr};
+
+    {
+        mp::Daemon daemon{config_builder.build()};
+        send_command({"launch"});
+
+        EXPECT_CALL(*mock_factory, remove_resources_for(name)).WillOnce(Invoke([&reclaimed_on](const std::string&) {
+            reclaimed_on = QThread::currentThread();
+        }));
+        send_command({"delete", "--purge", name});
+    }
+
+    EXPECT_EQ(reclaimed_on, daemon_thread);
+}
+
 MATCHER_P2(YAMLNodeContainsString, key, val, "")
 {
     if (!arg.IsMap())
@@ -688,3 +787,605 @@ INSTANTIATE_TEST_SUITE_P(Daemon, MinSpaceViolatedSuite,
                                  Values("0", "0B", "0GB", "123B", "42kb", "100")));
 
 } // namespace
+
+namespace
+{
+// What a daemon that saved a memory template of the default image leaves behind
+struct DaemonMemoryTemplates : public Daemon
+{
+    // Has a record of every instance, for the template to be restored
+    struct TemplateVault : public mpt::StubVMImageVault
+    {
+        bool has_record_for(const std::string&) override
+        {
+            return true;
+        }
+
+        mp::VMImage clone_template_image(const std::string& template_name, const std::string& name) override
+        {
+            clones.push_back(template_name);
+            return StubVMImageVault::clone_template_image(template_name, name);
+        }
+
+        std::vector<std::string> clones;
+    };
+
+    DaemonMemoryTemplates()
+    {
+        auto vault = std::make_unique<TemplateVault>();
+        template_vault = vault.get();
+        config_builder.vault = std::move(vault);
+        config_builder.name_generator = std::make_unique<StubNameGenerator>(clone_name);
+        mock_factory = use_a_mock_vm_factory();
+
+        auto& mock_settings = mpt::MockSettings::mock_instance();
+        EXPECT_CALL(mock_settings, get(_)).Times(AnyNumber());
+        EXPECT_CALL(mock_settings, get(Eq(mp::memory_templates_key))).WillRepeatedly(Return("default"));
+
+        write({{template_name, QJsonObject{{"num_cores", 1},
+                                           {"mem_size", QString::number(1024LL * 1024 * 1024)},
+                                           {"disk_space", QString::number(5LL * 1024 * 1024 * 1024)},
+                                           {"mac_addr", "52:54:00:00:00:01"},
+                                           {"ssh_username", "ubuntu"},
+                                           {"state", 0}}}},
+              "multipassd-vm-instances.json");
+        write({{template_name, QJsonObject{{"image", "default"}, {"saved", true}}}},
+              "multipassd-memory-templates.json");
+    }
+
+    void write(const QJsonObject& records, const char* file_name)
+    {
+        QFile file{QDir{data_dir.path()}.filePath(file_name)};
+        ASSERT_TRUE(file.open(QIODevice::WriteOnly));
+        file.write(QJsonDocument{records}.toJson());
+    }
+
+    QJsonObject read(const char* file_name)
+    {
+        QFile file{QDir{data_dir.path()}.filePath(file_name)};
+        return file.open(QIODevice::ReadOnly) ? QJsonDocument::fromJson(file.readAll()).object() : QJsonObject{};
+    }
+
+    // Whether each instance the factory was asked for starts from a template
+    void record_created_instances()
+    {
+        ON_CALL(*mock_factory, create_virtual_machine(_, _))
+            .WillByDefault(Invoke(
+                [this](const mp::VirtualMachineDescription& desc, mp::VMStatusMonitor&) -> mp::VirtualMachine::UPtr {
+                    created.emplace_back(desc.vm_name, desc.memory_template_dir);
+                    return std::make_unique<mpt::StubVirtualMachine>();
+                }));
+    }
+
+    const std::string template_name{"template-name"};
+    const std::string clone_name{"clone-name"};
+    TemplateVault* template_vault;
+    mpt::MockVirtualMachineFactory* mock_factory;
+    std::vector<std::pair<std::string, QString>> created;
+};
+} // namespace
+
+TEST_F(DaemonMemoryTemplates, launches_clones_of_the_templates_saved_before_a_restart)
+{
+    record_created_instances();
+    mp::Daemon daemon{config_builder.build()};
+
+    std::stringstream stream;
+    send_command({"launch"}, stream);
+
+    EXPECT_THAT(stream.str(), HasSubstr("Starting " + clone_name));
+    EXPECT_THAT(template_vault->clones, ElementsAre(template_name));
+    ASSERT_EQ(created.size(), 2u);
+    EXPECT_EQ(created[0], std::make_pair(template_name, QString{}));
+    EXPECT_EQ(created[1].first, clone_name);
+    EXPECT_FALSE(created[1].second.isEmpty());
+    EXPECT_TRUE(read("multipassd-vm-instances.json").contains(QString::fromStdString(clone_name)));
+}
+
+TEST_F(DaemonMemoryTemplates, launches_as_usual_what_does_not_ask_for_the_defaults)
+{
+    record_created_instances();
+    mp::Daemon daemon{config_builder.build()};
+
+    send_command({"launch", "--mem", "2G"});
+
+    EXPECT_TRUE(template_vault->clones.empty());
+    ASSERT_EQ(created.size(), 2u);
+    EXPECT_EQ(created[1], std::make_pair(clone_name, QString{}));
+}
+
+TEST_F(DaemonMemoryTemplates, falls_back_to_a_usual_launch_when_the_clone_cannot_be_created)
+{
+    EXPECT_CALL(*mock_factory, create_virtual_machine(_, _))
+        .WillOnce(Return(ByMove(std::make_unique<mpt::StubVirtualMachine>())))
+        .WillOnce(
+            Invoke([](const mp::VirtualMachineDescription& desc, mp::VMStatusMonitor&) -> mp::VirtualMachine::UPtr {
+                EXPECT_FALSE(desc.memory_template_dir.isEmpty());
+                throw std::runtime_error{"no clone"};
+            }))
+        .WillOnce(
+            Invoke([](const mp::VirtualMachineDescription& desc, mp::VMStatusMonitor&) -> mp::VirtualMachine::UPtr {
+                EXPECT_TRUE(desc.memory_template_dir.isEmpty());
+                return std::make_unique<mpt::StubVirtualMachine>();
+            }));
+    EXPECT_CALL(*mock_factory, remove_resources_for(clone_name));
+    mp::Daemon daemon{config_builder.build()};
+
+    std::stringstream stream;
+    send_command({"launch"}, stream);
+
+    EXPECT_THAT(stream.str(), HasSubstr(clone_name));
+    EXPECT_TRUE(read("multipassd-vm-instances.json").contains(QString::fromStdString(clone_name)));
+}
+
+TEST_F(DaemonMemoryTemplates, retires_the_templates_of_images_no_longer_asked_for)
+{
+    EXPECT_CALL(mpt::MockSettings::mock_instance(), get(Eq(mp::memory_templates_key)))
+        .WillRepeatedly(Return(""));
+    EXPECT_CALL(*mock_factory, remove_resources_for(template_name));
+    mp::Daemon daemon{config_builder.build()};
+
+    std::stringstream stream;
+    send_command({"launch"}, stream); // for the daemon's queued work to have run
+
+    EXPECT_TRUE(template_vault->clones.empty());
+    EXPECT_FALSE(read("multipassd-memory-templates.json").contains(QString::fromStdString(template_name)));
+    EXPECT_FALSE(read("multipassd-vm-instances.json").contains(QString::fromStdString(template_name)));
+}
+
+namespace
+{
+// Has a record of every instance, for those in the database to be taken up
+struct RecordingVault : public mpt::StubVMImageVault
+{
+    bool has_record_for(const std::string&) override
+    {
+        return true;
+    }
+};
+
+QJsonObject persisted_record_of(const mpt::TempDir& data_dir, const QString& name)
+{
+    const QDir dir{data_dir.path()};
+    mp::JournaledJsonStore db{dir.filePath("multipassd-vm-instances.json"),
+                              dir.filePath("multipassd-vm-instances.journal")};
+    return db.load()[name].toObject();
+}
+
+QJsonObject instance_record(const QString& mac_addr, mp::VirtualMachine::State state)
+{
+    return QJsonObject{{"num_cores", 1},
+                       {"mem_size", QString::number(1024LL * 1024 * 1024)},
+                       {"disk_space", QString::number(5LL * 1024 * 1024 * 1024)},
+                       {"mac_addr", mac_addr},
+                       {"ssh_username", "ubuntu"},
+                       {"state", static_cast<int>(state)}};
+}
+
+void write_instance_db(const mpt::TempDir& data_dir, const QJsonObject& records)
+{
+    QFile file{QDir{data_dir.path()}.filePath("multipassd-vm-instances.json")};
+    EXPECT_TRUE(file.open(QIODevice::WriteOnly));
+    file.write(QJsonDocument{records}.toJson());
+}
+} // namespace
+
+struct DaemonPortForwards : public Daemon
+{
+    DaemonPortForwards()
+    {
+        config_builder.vault = std::make_unique<RecordingVault>();
+
+        QJsonObject records;
+        for (const auto& name : {"foo", "bar"})
+            records.insert(name, QJsonObject{{"num_cores", 1},
+                                             {"mem_size", QString::number(1024LL * 1024 * 1024)},
+                                             {"disk_space", QString::number(5LL * 1024 * 1024 * 1024)},
+                                             {"mac_addr", records.isEmpty() ? "52:54:00:00:00:01"
+                                                                            : "52:54:00:00:00:02"},
+                                             {"ssh_username", "ubuntu"},
+                                             {"state", 0}});
+
+        auto bar = records["bar"].toObject();
+        bar.insert("port_forwards",
+                   QJsonArray{QJsonObject{{"address", "127.0.0.1"}, {"host_port", 8080}, {"instance_port", 80}},
+                              QJsonObject{{"address", "localhost"}, {"host_port", 8081}, {"instance_port", 81}}});
+        records.insert("bar", bar);
+
+        QFile file{QDir{data_dir.path()}.filePath("multipassd-vm-instances.json")};
+        EXPECT_TRUE(file.open(QIODevice::WriteOnly));
+        file.write(QJsonDocument{records}.toJson());
+    }
+
+    QJsonArray persisted_forwards_of(const QString& name)
+    {
+        return persisted_record_of(data_dir, name)["port_forwards"].toArray();
+    }
+};
+
+TEST_F(DaemonPortForwards, keeps_the_forwards_of_stopped_instances)
+{
+    {
+        mp::Daemon daemon{config_builder.build()};
+        send_command({"forward", "foo", "2222:22", "--address", "0.0.0.0"});
+    }
+
+    const auto forwards = persisted_forwards_of("foo");
+    ASSERT_EQ(forwards.size(), 1);
+    EXPECT_EQ(forwards[0].toObject()["address"].toString(), "0.0.0.0");
+    EXPECT_EQ(forwards[0].toObject()["host_port"].toInt(), 2222);
+    EXPECT_EQ(forwards[0].toObject()["instance_port"].toInt(), 22);
+}
+
+TEST_F(DaemonPortForwards, drops_persisted_forwards_without_an_ipv4_address)
+{
+    mp::Daemon daemon{config_builder.build()};
+
+    std::stringstream stream;
+    send_command({"forward", "bar"}, stream);
+
+    EXPECT_THAT(stream.str(), HasSubstr("127.0.0.1:8080"));
+    EXPECT_THAT(stream.str(), Not(HasSubstr("8081")));
+}
+
+TEST_F(DaemonPortForwards, refuses_host_ports_forwarded_to_another_instance)
+{
+    {
+        mp::Daemon daemon{config_builder.build()};
+
+        std::stringstream err_stream;
+        send_command({"forward", "foo", "8080:80"}, trash_stream, err_stream);
+        EXPECT_THAT(err_stream.str(), HasSubstr("port 8080 is forwarded to \"bar\" already"));
+    }
+
+    EXPECT_TRUE(persisted_forwards_of("foo").isEmpty());
+}
+
+TEST_F(DaemonPortForwards, refuses_host_ports_asked_for_twice)
+{
+    mp::Daemon daemon{config_builder.build()};
+
+    std::stringstream err_stream;
+    send_command({"forward", "foo", "3000:80", "3000:81"}, trash_stream, err_stream);
+
+    EXPECT_THAT(err_stream.str(), HasSubstr("port 3000 is asked to be forwarded more than once"));
+}
+
+TEST_F(DaemonPortForwards, refuses_addresses_that_are_not_ipv4)
+{
+    mp::Daemon daemon{config_builder.build()};
+
+    std::stringstream err_stream;
+    send_command({"forward", "foo", "3000:80", "--address", "not-an-address"}, trash_stream, err_stream);
+
+    EXPECT_THAT(err_stream.str(), HasSubstr("\"not-an-address\" is not an IPv4 address"));
+}
+
+struct DaemonIdleInstances : public Daemon
+{
+    DaemonIdleInstances()
+    {
+        config_builder.vault = std::make_unique<RecordingVault>();
+
+        auto foo = instance_record("52:54:00:00:00:01", mp::VirtualMachine::State::suspended);
+        foo.insert("idle_suspended", true);
+        write_instance_db(data_dir, QJsonObject{{"foo", foo}});
+
+        auto mock_factory = use_a_mock_vm_factory();
+        auto vm = std::make_unique<NiceMock<mpt::MockVirtualMachine>>("foo");
+        instance = vm.get();
+        ON_CALL(*vm, current_state()).WillByDefault(Invoke([this] { return state.load(); }));
+        EXPECT_CALL(*mock_factory, create_virtual_machine(_, _)).WillOnce(Return(ByMove(std::move(vm))));
+    }
+
+    std::atomic<mp::VirtualMachine::State> state{mp::VirtualMachine::State::suspended};
+    mpt::MockVirtualMachine* instance;
+};
+
+TEST_F(DaemonIdleInstances, resumes_instances_suspended_for_being_idle_on_the_next_shell)
+{
+    mp::Daemon daemon{config_builder.build()};
+    EXPECT_CALL(*instance, start()).WillOnce(Invoke([this] { state = mp::VirtualMachine::State::running; }));
+
+    std::stringstream err_stream;
+    send_command({"shell", "foo"}, trash_stream, err_stream);
+
+    EXPECT_THAT(err_stream.str(), Not(HasSubstr("is not running")));
+    EXPECT_FALSE(persisted_record_of(data_dir, "foo")["idle_suspended"].toBool());
+}
+
+TEST_F(DaemonIdleInstances, leaves_instances_suspended_by_hand_alone)
+{
+    write_instance_db(data_dir,
+                      QJsonObject{{"foo", instance_record("52:54:00:00:00:01", mp::VirtualMachine::State::suspended)}});
+
+    mp::Daemon daemon{config_builder.build()};
+    EXPECT_CALL(*instance, start()).Times(0);
+
+    std::stringstream err_stream;
+    send_command({"shell", "foo"}, trash_stream, err_stream);
+
+    EXPECT_THAT(err_stream.str(), HasSubstr("instance \"foo\" is not running"));
+}
+
+struct DaemonExecFanOut : public Daemon
+{
+    DaemonExecFanOut()
+    {
+        config_builder.vault = std::make_unique<RecordingVault>();
+        write_instance_db(data_dir,
+                          QJsonObject{{"foo-1", instance_record("52:54:00:00:00:01", mp::VirtualMachine::State::off)},
+                                      {"foo-2", instance_record("52:54:00:00:00:02", mp::VirtualMachine::State::off)},
+                                      {"bar", instance_record("52:54:00:00:00:03", mp::VirtualMachine::State::off)}});
+
+        auto mock_factory = use_a_mock_vm_factory();
+        EXPECT_CALL(*mock_factory, create_virtual_machine(_, _))
+            .Times(3)
+            .WillRepeatedly(Invoke([](const mp::VirtualMachineDescription& desc, mp::VMStatusMonitor&) {
+                auto vm = std::make_unique<NiceMock<mpt::MockVirtualMachine>>(desc.vm_name);
+                ON_CALL(*vm, current_state())
+                    .WillByDefault(Return(desc.vm_name == "foo-2" ? mp::VirtualMachine::State::stopped
+                                                                  : mp::VirtualMachine::State::running));
+                return mp::VirtualMachine::UPtr{std::move(vm)};
+            }));
+
+        // Every session the client opens fails at once, which names the instances it was handed
+        connect.returnValue(SSH_ERROR);
+    }
+
+    decltype(MOCK(ssh_connect)) connect{MOCK(ssh_connect)};
+};
+
+TEST_F(DaemonExecFanOut, expands_wildcards_to_the_running_instances_they_match)
+{
+    mp::Daemon daemon{config_builder.build()};
+
+    std::stringstream err_stream;
+    send_command({"exec", "foo-*", "--", "true"}, trash_stream, err_stream);
+
+    EXPECT_THAT(err_stream.str(), HasSubstr("foo-1: exec failed"));
+    EXPECT_THAT(err_stream.str(), Not(HasSubstr("foo-2")));
+    EXPECT_THAT(err_stream.str(), Not(HasSubstr("bar")));
+}
+
+TEST_F(DaemonExecFanOut, runs_on_every_running_instance_with_all)
+{
+    mp::Daemon daemon{config_builder.build()};
+
+    std::stringstream err_stream;
+    send_command({"exec", "--all", "--", "true"}, trash_stream, err_stream);
+
+    EXPECT_THAT(err_stream.str(), HasSubstr("bar: exec failed"));
+    EXPECT_THAT(err_stream.str(), HasSubstr("foo-1: exec failed"));
+    EXPECT_THAT(err_stream.str(), Not(HasSubstr("foo-2")));
+}
+
+TEST_F(DaemonExecFanOut, reports_wildcards_matching_no_running_instance)
+{
+    mp::Daemon daemon{config_builder.build()};
+
+    std::stringstream err_stream;
+    send_command({"exec", "baz*", "--", "true"}, trash_stream, err_stream);
+
+    EXPECT_THAT(err_stream.str(), HasSubstr("No running instances to execute the command on"));
+}
+
+struct DaemonResize : public Daemon
+{
+    DaemonResize()
+    {
+        config_builder.vault = std::make_unique<RecordingVault>();
+
+        write_instance_db(data_dir,
+                          QJsonObject{{"foo", instance_record("52:54:00:00:00:01", mp::VirtualMachine::State::off)}});
+
+        auto mock_factory = use_a_mock_vm_factory();
+        auto vm = std::make_unique<NiceMock<mpt::MockVirtualMachine>>("foo");
+        instance = vm.get();
+        EXPECT_CALL(*mock_factory, create_virtual_machine(_, _)).WillOnce(Return(ByMove(std::move(vm))));
+    }
+
+    mpt::MockVirtualMachine* instance;
+};
+
+TEST_F(DaemonResize, records_the_new_resources_once_the_instance_has_them)
+{
+    {
+        mp::Daemon daemon{config_builder.build()};
+        EXPECT_CALL(*instance, resize(2, mp::MemorySize{"2G"}, mp::MemorySize{"10G"}));
+        send_command({"resize", "foo", "--cpus", "2", "--mem", "2G", "--disk", "10G"});
+    }
+
+    const auto record = persisted_record_of(data_dir, "foo");
+    EXPECT_EQ(record["num_cores"].toInt(), 2);
+    EXPECT_EQ(record["mem_size"].toString(), QString::number(2LL * 1024 * 1024 * 1024));
+    EXPECT_EQ(record["disk_space"].toString(), QString::number(10LL * 1024 * 1024 * 1024));
+}
+
+TEST_F(DaemonResize, records_what_went_through_of_a_resize_that_fell_short)
+{
+    std::stringstream err_stream;
+    {
+        mp::Daemon daemon{config_builder.build()};
+        EXPECT_CALL(*instance, resize(_, _, _))
+            .WillOnce(Throw(mp::ResizeException{"Cannot add memory: no", 2, mp::MemorySize{"1G"},
+                                                mp::MemorySize{"10G"}}));
+        send_command({"resize", "foo", "--cpus", "2", "--mem", "2G", "--disk", "10G"}, trash_stream, err_stream);
+    }
+
+    EXPECT_THAT(err_stream.str(), HasSubstr("Cannot add memory: no"));
+    const auto record = persisted_record_of(data_dir, "foo");
+    EXPECT_EQ(record["num_cores"].toInt(), 2);
+    EXPECT_EQ(record["mem_size"].toString(), QString::number(1024LL * 1024 * 1024));
+    EXPECT_EQ(record["disk_space"].toString(), QString::number(10LL * 1024 * 1024 * 1024));
+}
+
+TEST_F(DaemonResize, keeps_the_recorded_resources_when_nothing_went_through)
+{
+    std::stringstream err_stream;
+    {
+        mp::Daemon daemon{config_builder.build()};
+        EXPECT_CALL(*instance, resize(_, _, _)).WillOnce(Throw(std::runtime_error{"cannot resize it"}));
+        send_command({"resize", "foo", "--cpus", "2"}, trash_stream, err_stream);
+    }
+
+    EXPECT_THAT(err_stream.str(), HasSubstr("cannot resize it"));
+    EXPECT_EQ(persisted_record_of(data_dir, "foo")["num_cores"].toInt(), 1);
+}
+
+struct DaemonExitSave : public Daemon
+{
+    DaemonExitSave()
+    {
+        config_builder.vault = std::make_unique<RecordingVault>();
+        write_instance_db(data_dir,
+                          QJsonObject{{"foo", instance_record("52:54:00:00:00:01", mp::VirtualMachine::State::off)},
+                                      {"bar", instance_record("52:54:00:00:00:02", mp::VirtualMachine::State::off)}});
+
+        auto mock_factory = use_a_mock_vm_factory();
+        EXPECT_CALL(*mock_factory, create_virtual_machine(_, _))
+            .Times(2)
+            .WillRepeatedly(Invoke([this](const mp::VirtualMachineDescription& desc, mp::VMStatusMonitor&) {
+                auto vm = std::make_unique<NiceMock<mpt::MockVirtualMachine>>(desc.vm_name);
+                instances[desc.vm_name] = vm.get();
+                return mp::VirtualMachine::UPtr{std::move(vm)};
+            }));
+    }
+
+    std::unordered_map<std::string, mpt::MockVirtualMachine*> instances;
+};
+
+TEST_F(DaemonExitSave, quits_once_the_running_instances_are_saved)
+{
+    mp::Daemon daemon{config_builder.build()};
+
+    std::atomic<mp::VirtualMachine::State> state{mp::VirtualMachine::State::running};
+    ON_CALL(*instances["foo"], current_state()).WillByDefault(Invoke([&state] { return state.load(); }));
+    EXPECT_CALL(*instances["foo"], start_saving_for_exit()).WillOnce(Invoke([&state] {
+        state = mp::VirtualMachine::State::suspending;
+        QTimer::singleShot(300, [&state] { state = mp::VirtualMachine::State::suspended; });
+        return true;
+    }));
+
+    auto saved = false;
+    daemon.save_instances_then([this, &saved, &state] {
+        saved = state == mp::VirtualMachine::State::suspended;
+        loop.quit();
+    });
+    loop.exec();
+
+    EXPECT_TRUE(saved);
+}
+
+TEST_F(DaemonExitSave, goes_on_when_nothing_needs_saving)
+{
+    mp::Daemon daemon{config_builder.build()};
+    EXPECT_CALL(*instances["foo"], start_saving_for_exit()).WillOnce(Return(false));
+    EXPECT_CALL(*instances["bar"], start_saving_for_exit()).WillOnce(Return(false));
+
+    auto saved = false;
+    daemon.save_instances_then([this, &saved] {
+        saved = true;
+        loop.quit();
+    });
+    if (!saved)
+        loop.exec();
+
+    EXPECT_TRUE(saved);
+}
+
+TEST_F(DaemonExitSave, saves_only_once)
+{
+    mp::Daemon daemon{config_builder.build()};
+    EXPECT_CALL(*instances["foo"], start_saving_for_exit()).WillOnce(Return(false));
+
+    auto times_done = 0;
+    daemon.save_instances_then([&times_done] { ++times_done; });
+    daemon.save_instances_then([&times_done] { ++times_done; });
+
+    EXPECT_EQ(times_done, 1);
+}
+
+struct DaemonGuestStats : public Daemon
+{
+    DaemonGuestStats()
+    {
+        config_builder.vault = std::make_unique<RecordingVault>();
+        write_instance_db(data_dir,
+                          QJsonObject{{"foo", instance_record("52:54:00:00:00:01", mp::VirtualMachine::State::off)}});
+
+        auto mock_factory = use_a_mock_vm_factory();
+        auto vm = std::make_unique<NiceMock<mpt::MockVirtualMachine>>("foo");
+        ON_CALL(*vm, current_state()).WillByDefault(Return(mp::VirtualMachine::State::running));
+        instance = vm.get();
+        EXPECT_CALL(*mock_factory, create_virtual_machine(_, _)).WillOnce(Return(ByMove(std::move(vm))));
+    }
+
+    mpt::MockVirtualMachine::Stats agent_stats{{"load", "0.42 0.10 0.01"},   {"memory_usage", "1024"},
+                                               {"memory_total", "2048"},     {"disk_usage", "1000"},
+                                               {"disk_total", "5000"},       {"current_release", "Ubuntu 20.04 LTS"},
+                                               {"sessions", "2"}};
+    mpt::MockVirtualMachine* instance;
+};
+
+TEST_F(DaemonGuestStats, takes_the_stats_from_the_guest_agent)
+{
+    mp::Daemon daemon{config_builder.build()};
+    EXPECT_CALL(*instance, guest_stats()).WillRepeatedly(Return(agent_stats));
+
+    std::stringstream stream;
+    send_command({"info", "foo"}, stream);
+
+    EXPECT_THAT(stream.str(), HasSubstr("0.42 0.10 0.01"));
+    EXPECT_THAT(stream.str(), HasSubstr("Ubuntu 20.04 LTS"));
+}
+
+TEST_F(DaemonGuestStats, reuses_the_stats_gathered_last)
+{
+    mp::Daemon daemon{config_builder.build()};
+    EXPECT_CALL(*instance, guest_stats()).WillOnce(Return(agent_stats));
+
+    std::stringstream stream;
+    send_command({"info", "foo"}, stream);
+    send_command({"info", "foo"}, stream);
+}
+
+TEST_F(DaemonGuestStats, does_not_keep_stats_gathered_across_a_state_change)
+{
+    mp::Daemon daemon{config_builder.build()};
+    EXPECT_CALL(*instance, guest_stats())
+        .WillOnce(Invoke([this, &daemon] {
+            daemon.persist_state_for("foo", mp::VirtualMachine::State::running);
+            return agent_stats;
+        }))
+        .WillOnce(Return(agent_stats));
+
+    std::stringstream stream;
+    send_command({"info", "foo"}, stream);
+    send_command({"info", "foo"}, stream);
+}
+
+TEST_F(DaemonGuestStats, does_not_keep_stats_of_deleted_instances)
+{
+    mp::Daemon daemon{config_builder.build()};
+    EXPECT_CALL(*instance, guest_stats()).Times(2).WillRepeatedly(Return(agent_stats));
+
+    std::stringstream stream;
+    send_command({"info", "foo"}, stream);
+    send_command({"delete", "foo"}, stream);
+    send_command({"recover", "foo"}, stream);
+    send_command({"info", "foo"}, stream);
+}
+
+TEST_F(DaemonGuestStats, goes_over_ssh_when_the_agent_leaves_stats_out)
+{
+    agent_stats.erase("sessions");
+    mp::Daemon daemon{config_builder.build()};
+    EXPECT_CALL(*instance, guest_stats()).WillRepeatedly(Return(agent_stats));
+
+    std::stringstream stream;
+    send_command({"info", "foo"}, stream);
+
+    // There is no guest to reach over SSH here, so none of what the agent did tell shows
+    EXPECT_THAT(stream.str(), Not(HasSubstr("0.42 0.10 0.01")));
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <multipass/download_scheduler.h>
+
+#include <gmock/gmock.h>
+
+namespace mp = multipass;
+using namespace testing;
+
+namespace
+{
+struct DownloadScheduler : public Test
+{
+    mp::DownloadScheduler scheduler;
+    std::atomic_bool keep_waiting{false};
+    std::atomic_bool give_up{true};
+};
+} // namespace
+
+TEST_F(DownloadScheduler, grants_what_is_left_of_a_host_connections)
+{
+    scheduler.set_limits(0, 5);
+
+    auto first = scheduler.admit("images.example", mp::DownloadPriority::interactive, 4, keep_waiting);
+    auto second = scheduler.admit("images.example", mp::DownloadPriority::interactive, 4, keep_waiting);
+    auto elsewhere = scheduler.admit("mirror.example", mp::DownloadPriority::interactive, 4, keep_waiting);
+
+    ASSERT_TRUE(first && second && elsewhere);
+    EXPECT_EQ(first->connections(), 4);
+    EXPECT_EQ(second->connections(), 1);
+    EXPECT_EQ(elsewhere->connections(), 4);
+}
+
+TEST_F(DownloadScheduler, waits_for_connections_to_be_released)
+{
+    scheduler.set_limits(0, 1);
+
+    auto first = scheduler.admit("images.example", mp::DownloadPriority::interactive, 1, keep_waiting);
+    EXPECT_EQ(scheduler.admit("images.example", mp::DownloadPriority::background, 1, give_up), nullptr);
+
+    first.reset();
+    EXPECT_NE(scheduler.admit("images.example", mp::DownloadPriority::background, 1, give_up), nullptr);
+}
+
+TEST_F(DownloadScheduler, does_not_hold_back_without_a_cap)
+{
+    auto ticket = scheduler.admit("images.example", mp::DownloadPriority::background, 1, keep_waiting);
+
+    EXPECT_FALSE(ticket->account(64 * 1024 * 1024));
+}
+
+TEST_F(DownloadScheduler, background_downloads_trickle_while_interactive_ones_run)
+{
+    auto background = scheduler.admit("images.example", mp::DownloadPriority::background, 1, keep_waiting);
+    {
+        auto interactive = scheduler.admit("images.example", mp::DownloadPriority::interactive, 1, keep_waiting);
+
+        EXPECT_FALSE(interactive->account(64 * 1024 * 1024));
+        EXPECT_TRUE(background->account(4 * 1024));
+    }
+
+    EXPECT_FALSE(background->account(64 * 1024 * 1024));
+}
+
+TEST_F(DownloadScheduler, interactive_downloads_take_over_connections_held_by_background_ones)
+{
+    scheduler.set_limits(0, 2);
+
+    auto background = scheduler.admit("images.example", mp::DownloadPriority::background, 2, keep_waiting);
+    ASSERT_EQ(background->connections(), 2);
+
+    auto interactive = scheduler.admit("images.example", mp::DownloadPriority::interactive, 2, give_up);
+    ASSERT_NE(interactive, nullptr);
+    EXPECT_EQ(interactive->connections(), 2);
+    EXPECT_TRUE(background->account(4 * 1024));
+
+    EXPECT_EQ(scheduler.admit("images.example", mp::DownloadPriority::interactive, 1, give_up), nullptr);
+    EXPECT_EQ(scheduler.admit("images.example", mp::DownloadPriority::background, 1, give_up), nullptr);
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <src/daemon/host_capacity.h>
+
+#include <gmock/gmock.h>
+
+namespace mp = multipass;
+using namespace testing;
+
+namespace
+{
+constexpr auto GiB = 1024LL * 1024 * 1024;
+
+struct HostCapacity : public Test
+{
+    const mp::HostCapacity::Resources host{8, 16 * GiB, 100 * GiB};
+};
+} // namespace
+
+TEST_F(HostCapacity, scales_the_host_by_the_ratios)
+{
+    const auto limits = mp::HostCapacity{host, 4, 1.5, 2}.limits();
+
+    EXPECT_EQ(limits.cpus, 32);
+    EXPECT_EQ(limits.memory_bytes, 24 * GiB);
+    EXPECT_EQ(limits.disk_bytes, 200 * GiB);
+}
+
+TEST_F(HostCapacity, admits_what_fits)
+{
+    mp::HostCapacity capacity{host, 1, 1, 1};
+
+    EXPECT_THAT(capacity.shortfall({6, 12 * GiB, 50 * GiB}, {2, 4 * GiB, 50 * GiB}), IsEmpty());
+}
+
+TEST_F(HostCapacity, names_every_resource_that_runs_short)
+{
+    mp::HostCapacity capacity{host, 1, 1, 1};
+
+    const auto shortfall = capacity.shortfall({6, 12 * GiB, 50 * GiB}, {4, 1 * GiB, 60 * GiB});
+
+    EXPECT_THAT(shortfall, HasSubstr("4 more vCPUs (6 of 8 committed)"));
+    EXPECT_THAT(shortfall, Not(HasSubstr("memory")));
+    EXPECT_THAT(shortfall, HasSubstr("60.0GiB more disk"));
+}
+
+TEST_F(HostCapacity, ignores_what_the_request_does_not_add_to)
+{
+    mp::HostCapacity capacity{host, 1, 1, 1};
+
+    EXPECT_THAT(capacity.shortfall({6, 12 * GiB, 500 * GiB}, {2, 4 * GiB, 0}), IsEmpty());
+}
+
+TEST_F(HostCapacity, does_not_limit_resources_without_a_ratio)
+{
+    mp::HostCapacity capacity{host, 0, 1, 0};
+
+    EXPECT_EQ(capacity.limits().cpus, 0);
+    EXPECT_THAT(capacity.shortfall({100, 0, 0}, {100, 1 * GiB, 1000 * GiB}), IsEmpty());
+}
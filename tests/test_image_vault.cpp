@@ -18,11 +18,14 @@
 #include "src/daemon/default_vm_image_vault.h"
 
 #include "file_operations.h"
+#include "mock_process_factory.h"
+#include "mock_settings.h"
 #include "path.h"
 #include "stub_url_downloader.h"
 #include "temp_dir.h"
 #include "temp_file.h"
 
+#include <multipass/constants.h>
 #include <multipass/exceptions/aborted_download_exception.h>
 #include <multipass/exceptions/create_image_exception.h>
 #include <multipass/optional.h>
@@ -31,11 +34,16 @@
 #include <multipass/utils.h>
 #include <multipass/vm_image_host.h>
 
+#include <QCryptographicHash>
 #include <QThread>
+#include <QThreadPool>
 #include <QUrl>
 
 #include <gmock/gmock.h>
 
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
 #include <unordered_set>
 
 namespace mp = multipass;
@@ -49,6 +57,23 @@ constexpr auto default_id = "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca49
 constexpr auto default_version = "20160217.1";
 const QDateTime default_last_modified{QDate(2019, 6, 25), QTime(13, 15, 0)};
 
+QByteArray sha256_of(const QByteArray& content)
+{
+    return QCryptographicHash::hash(content, QCryptographicHash::Sha256).toHex();
+}
+
+// Just the qcow2 header fields the vault reads: magic, version, backing_file_offset and backing_file_size
+void make_qcow2_image(const QString& path, const QString& backing_file = {})
+{
+    QByteArray header{"QFI\xfb", 4};
+    header.append(QByteArray::fromHex("00000003"));
+    header.append(QByteArray::fromHex(backing_file.isEmpty() ? "0000000000000000" : "0000000000000020"));
+    header.append(QByteArray::fromHex(QByteArray::number(backing_file.toUtf8().size(), 16).rightJustified(8, '0')));
+    header.append(QByteArray(32 - header.size(), '\0'));
+    header.append(backing_file.toUtf8());
+    mpt::make_file_with_content(path, header.toStdString());
+}
+
 struct ImageHost : public mp::VMImageHost
 {
     mp::optional<mp::VMImageInfo> info_for(const mp::Query& query) override
@@ -80,6 +105,11 @@ struct ImageHost : public mp::VMImageHost
         return {"release"};
     }
 
+    int manifest_generation() override
+    {
+        return 0;
+    }
+
     mpt::TempFile image;
     mpt::TempFile kernel;
     mpt::TempFile initrd;
@@ -92,12 +122,26 @@ struct TrackingURLDownloader : public mp::URLDownloader
     TrackingURLDownloader() : mp::URLDownloader{std::chrono::seconds(10)}
     {
     }
-    void download_to(const QUrl& url, const QString& file_name, int64_t size, const int download_type,
-                     const mp::ProgressMonitor&) override
+    QByteArray download_to(const QUrl& url, const QString& file_name, int64_t size, const int download_type,
+                           const mp::ProgressMonitor&, const DataSink&, mp::DownloadPriority) override
     {
         mpt::make_file_with_content(file_name, "");
+
+        std::unique_lock<std::mutex> lock{mutex};
         downloaded_urls << url.toString();
         downloaded_files << file_name;
+
+        ++in_flight;
+        max_in_flight = std::max(max_in_flight, in_flight);
+        if (overlap_wanted > 1)
+        {
+            in_flight_changed.notify_all();
+            in_flight_changed.wait_for(lock, std::chrono::seconds(5),
+                                       [this] { return max_in_flight >= overlap_wanted; });
+        }
+        --in_flight;
+
+        return sha256_of("");
     }
 
     QByteArray download(const QUrl& url) override
@@ -112,6 +156,13 @@ struct TrackingURLDownloader : public mp::URLDownloader
 
     QStringList downloaded_files;
     QStringList downloaded_urls;
+
+    // Downloads wait until this many of them are under way, for at most a few seconds
+    int overlap_wanted{1};
+    int in_flight{0};
+    int max_in_flight{0};
+    std::mutex mutex;
+    std::condition_variable in_flight_changed;
 };
 
 struct BadURLDownloader : public mp::URLDownloader
@@ -119,10 +170,11 @@ struct BadURLDownloader : public mp::URLDownloader
     BadURLDownloader() : mp::URLDownloader{std::chrono::seconds(10)}
     {
     }
-    void download_to(const QUrl& url, const QString& file_name, int64_t size, const int download_type,
-                     const mp::ProgressMonitor&) override
+    QByteArray download_to(const QUrl& url, const QString& file_name, int64_t size, const int download_type,
+                           const mp::ProgressMonitor&, const DataSink&, mp::DownloadPriority) override
     {
         mpt::make_file_with_content(file_name, "Bad hash");
+        return sha256_of("Bad hash");
     }
 
     QByteArray download(const QUrl& url) override
@@ -136,12 +188,13 @@ struct HttpURLDownloader : public mp::URLDownloader
     HttpURLDownloader() : mp::URLDownloader{std::chrono::seconds(10)}
     {
     }
-    void download_to(const QUrl& url, const QString& file_name, int64_t size, const int download_type,
-                     const mp::ProgressMonitor&) override
+    QByteArray download_to(const QUrl& url, const QString& file_name, int64_t size, const int download_type,
+                           const mp::ProgressMonitor&, const DataSink&, mp::DownloadPriority) override
     {
         mpt::make_file_with_content(file_name, "");
         downloaded_urls << url.toString();
         downloaded_files << file_name;
+        return sha256_of("");
     }
 
     QByteArray download(const QUrl& url) override
@@ -163,8 +216,8 @@ struct RunningURLDownloader : public mp::URLDownloader
     RunningURLDownloader() : mp::URLDownloader{std::chrono::seconds(10)}
     {
     }
-    void download_to(const QUrl& url, const QString& file_name, int64_t size, const int download_type,
-                     const mp::ProgressMonitor&) override
+    QByteArray download_to(const QUrl& url, const QString& file_name, int64_t size, const int download_type,
+                           const mp::ProgressMonitor&, const DataSink&, mp::DownloadPriority) override
     {
         while (!abort_download)
             QThread::yieldCurrentThread();
@@ -230,6 +283,320 @@ TEST_F(ImageVault, downloads_kernel_and_initrd)
     EXPECT_FALSE(vm_image.initrd_path.isEmpty());
 }
 
+TEST_F(ImageVault, downloads_kernel_and_initrd_alongside_the_image)
+{
+    url_downloader.overlap_wanted = 3;
+    auto pool = QThreadPool::globalInstance();
+    pool->setMaxThreadCount(std::max(pool->maxThreadCount(), 4));
+
+    mp::DefaultVMImageVault vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{0}};
+    vault.fetch_image(mp::FetchType::ImageKernelAndInitrd, default_query, stub_prepare, stub_monitor);
+
+    EXPECT_EQ(url_downloader.max_in_flight, 3);
+}
+
+TEST_F(ImageVault, takes_images_from_peers_first)
+{
+    auto& mock_settings = mpt::MockSettings::mock_instance();
+    EXPECT_CALL(mock_settings, get(_)).Times(AnyNumber());
+    EXPECT_CALL(mock_settings, get(Eq(mp::image_peers_key))).WillRepeatedly(Return("http://peer.example:50052"));
+
+    mp::DefaultVMImageVault vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{0}};
+    vault.fetch_image(mp::FetchType::ImageOnly, default_query, stub_prepare, stub_monitor);
+
+    EXPECT_THAT(url_downloader.downloaded_urls,
+                ElementsAre(QString("http://peer.example:50052/images/%1").arg(default_id)));
+}
+
+TEST_F(ImageVault, uses_images_of_a_shared_cache)
+{
+    mpt::TempDir shared_dir;
+    {
+        mp::DefaultVMImageVault owner{hosts, &url_downloader, shared_dir.path(), shared_dir.path(), mp::days{0}};
+        owner.fetch_image(mp::FetchType::ImageOnly, default_query, stub_prepare, stub_monitor);
+    }
+    url_downloader.downloaded_urls.clear();
+
+    auto& mock_settings = mpt::MockSettings::mock_instance();
+    EXPECT_CALL(mock_settings, get(_)).Times(AnyNumber());
+    EXPECT_CALL(mock_settings, get(Eq(mp::shared_image_cache_key))).WillRepeatedly(Return(shared_dir.path()));
+
+    mp::DefaultVMImageVault vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{0}};
+    auto vm_image = vault.fetch_image(mp::FetchType::ImageOnly, default_query, stub_prepare, stub_monitor);
+
+    EXPECT_THAT(url_downloader.downloaded_urls, IsEmpty());
+    EXPECT_TRUE(QFile::exists(vm_image.image_path));
+    EXPECT_FALSE(vm_image.image_path.startsWith(shared_dir.path()));
+}
+
+TEST_F(ImageVault, streams_uncached_images_and_caches_them_behind)
+{
+    const auto image_url = QStringLiteral("https://cloud-images.ubuntu.com/xenial/current/xenial.img");
+    host.mock_image_info.image_location = image_url;
+    auto& mock_settings = mpt::MockSettings::mock_instance();
+    EXPECT_CALL(mock_settings, get(_)).Times(AnyNumber());
+    EXPECT_CALL(mock_settings, get(Eq(mp::streaming_launch_key))).WillRepeatedly(Return("true"));
+    EXPECT_CALL(mock_settings, get(Eq(mp::driver_key))).WillRepeatedly(Return("qemu"));
+
+    std::mutex args_mutex;
+    QStringList overlay_args, rebase_args;
+    auto mock_factory_scope = mpt::MockProcessFactory::Inject();
+    mock_factory_scope->register_callback([&](mpt::MockProcess* process) {
+        const auto args = process->arguments(); // qemu-img create -f qcow2 -F qcow2 -b <backing> <overlay>
+        std::lock_guard<std::mutex> lock{args_mutex};
+        if (args.value(0) == "create")
+        {
+            overlay_args = args;
+            make_qcow2_image(args.last(), args.at(args.size() - 2));
+        }
+        else if (args.value(0) == "rebase")
+            rebase_args = args;
+    });
+
+    mp::VMImage vm_image;
+    {
+        mp::DefaultVMImageVault vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{0}};
+        vm_image = vault.fetch_image(mp::FetchType::ImageOnly, default_query, stub_prepare, stub_monitor);
+
+        std::lock_guard<std::mutex> lock{args_mutex};
+        EXPECT_THAT(overlay_args, AllOf(Contains("create"), Contains(image_url), Contains(vm_image.image_path)));
+        EXPECT_TRUE(vm_image.image_path.startsWith(data_dir.path()));
+    }
+
+    EXPECT_THAT(url_downloader.downloaded_urls, Contains(image_url));
+
+    // Once the cached copy is verified, the instance reads from it rather than from the image host
+    ASSERT_FALSE(url_downloader.downloaded_files.isEmpty());
+    EXPECT_THAT(rebase_args, AllOf(Contains("-u"), Contains(vm_image.image_path)));
+    EXPECT_TRUE(rebase_args.at(rebase_args.indexOf("-b") + 1).startsWith(cache_dir.path()));
+}
+
+struct ImageVaultStreaming : public ImageVault, public WithParamInterface<std::pair<QString, QString>>
+{
+};
+
+TEST_P(ImageVaultStreaming, does_not_stream_without_https_or_qemu)
+{
+    const auto& param = GetParam();
+    host.mock_image_info.image_location = param.first;
+    auto& mock_settings = mpt::MockSettings::mock_instance();
+    EXPECT_CALL(mock_settings, get(_)).Times(AnyNumber());
+    EXPECT_CALL(mock_settings, get(Eq(mp::streaming_launch_key))).WillRepeatedly(Return("true"));
+    EXPECT_CALL(mock_settings, get(Eq(mp::driver_key))).WillRepeatedly(Return(param.second));
+
+    auto streamed = false;
+    auto mock_factory_scope = mpt::MockProcessFactory::Inject();
+    mock_factory_scope->register_callback([&streamed, &param](mpt::MockProcess* process) {
+        streamed = streamed || process->arguments().contains(param.first);
+    });
+
+    mp::DefaultVMImageVault vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{0}};
+    vault.fetch_image(mp::FetchType::ImageOnly, default_query, stub_prepare, stub_monitor);
+
+    EXPECT_FALSE(streamed);
+    EXPECT_THAT(url_downloader.downloaded_urls, Contains(param.first));
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    ImageVault, ImageVaultStreaming,
+    Values(std::make_pair(QStringLiteral("http://cloud-images.ubuntu.com/xenial/current/xenial.img"),
+                          QStringLiteral("qemu")),
+           std::make_pair(QStringLiteral("https://cloud-images.ubuntu.com/xenial/current/xenial.img"),
+                          QStringLiteral("libvirt"))));
+
+TEST_F(ImageVault, clones_share_a_frozen_layer_until_both_are_gone)
+{
+    auto mock_factory_scope = mpt::MockProcessFactory::Inject();
+    mock_factory_scope->register_callback([](mpt::MockProcess* process) {
+        const auto args = process->arguments(); // qemu-img create -f qcow2 -F qcow2 -b <backing> <overlay>
+        if (args.value(0) == "create")
+            make_qcow2_image(args.last(), args.at(args.size() - 2));
+    });
+
+    mp::DefaultVMImageVault vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{0}};
+    auto prepare = [](const mp::VMImage& source_image) -> mp::VMImage {
+        make_qcow2_image(source_image.image_path);
+        return source_image;
+    };
+    auto source_image = vault.fetch_image(mp::FetchType::ImageOnly, default_query, prepare, stub_monitor);
+
+    auto clone_image = vault.clone_instance_image(instance_name, "clone");
+
+    const auto layer = mp::utils::qcow2_backing_file(clone_image.image_path);
+    EXPECT_TRUE(layer.startsWith(data_dir.path()));
+    EXPECT_EQ(mp::utils::qcow2_backing_file(source_image.image_path), layer);
+    EXPECT_TRUE(vault.has_record_for("clone"));
+
+    vault.remove(instance_name);
+    EXPECT_TRUE(QFile::exists(layer));
+
+    vault.remove("clone");
+    EXPECT_FALSE(QFile::exists(layer));
+}
+
+TEST_F(ImageVault, template_clones_all_share_one_layer)
+{
+    auto mock_factory_scope = mpt::MockProcessFactory::Inject();
+    mock_factory_scope->register_callback([](mpt::MockProcess* process) {
+        const auto args = process->arguments();
+        if (args.value(0) == "create")
+            make_qcow2_image(args.last(), args.at(args.size() - 2));
+    });
+
+    mp::DefaultVMImageVault vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{0}};
+    auto prepare = [](const mp::VMImage& source_image) -> mp::VMImage {
+        make_qcow2_image(source_image.image_path);
+        return source_image;
+    };
+    auto template_image = vault.fetch_image(mp::FetchType::ImageOnly, default_query, prepare, stub_monitor);
+
+    auto first_clone = vault.clone_template_image(instance_name, "first");
+    auto second_clone = vault.clone_template_image(instance_name, "second");
+
+    const auto layer = mp::utils::qcow2_backing_file(first_clone.image_path);
+    EXPECT_TRUE(layer.startsWith(data_dir.path()));
+    EXPECT_EQ(mp::utils::qcow2_backing_file(second_clone.image_path), layer);
+    EXPECT_EQ(mp::utils::qcow2_backing_file(template_image.image_path), layer);
+    EXPECT_THROW(vault.clone_template_image(instance_name, "first"), std::runtime_error);
+}
+
+TEST_F(ImageVault, launches_baked_images_by_their_name)
+{
+    auto mock_factory_scope = mpt::MockProcessFactory::Inject();
+    mock_factory_scope->register_callback([](mpt::MockProcess* process) {
+        const auto args = process->arguments();
+        if (args.value(0) == "create")
+            make_qcow2_image(args.last(), args.at(args.size() - 2));
+        else if (args.value(0) == "convert")
+            make_qcow2_image(args.last());
+    });
+
+    mp::DefaultVMImageVault vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{0}};
+    auto prepare = [](const mp::VMImage& source_image) -> mp::VMImage {
+        make_qcow2_image(source_image.image_path);
+        return source_image;
+    };
+    vault.fetch_image(mp::FetchType::ImageOnly, default_query, prepare, stub_monitor);
+
+    vault.bake_instance_image(instance_name, "golden", false);
+    EXPECT_THROW(vault.bake_instance_image(instance_name, "golden", false), std::runtime_error);
+
+    url_downloader.downloaded_urls.clear();
+    mp::Query baked_query{"baked-one", "golden", false, "", mp::Query::Type::Alias};
+    auto vm_image = vault.fetch_image(mp::FetchType::ImageOnly, baked_query, prepare, stub_monitor);
+
+    const auto baked_image = mp::utils::qcow2_backing_file(vm_image.image_path);
+    EXPECT_TRUE(baked_image.startsWith(data_dir.path()));
+    EXPECT_THAT(url_downloader.downloaded_urls, IsEmpty());
+    EXPECT_THROW(vault.remove_baked_image("golden"), std::runtime_error);
+
+    vault.remove("baked-one");
+    vault.remove_baked_image("golden");
+    EXPECT_FALSE(QFile::exists(baked_image));
+
+    mp::Query missing_query{"baked-two", "golden", false, "baked", mp::Query::Type::Alias};
+    EXPECT_THROW(vault.fetch_image(mp::FetchType::ImageOnly, missing_query, prepare, stub_monitor), std::runtime_error);
+}
+
+TEST_F(ImageVault, baked_image_names_never_step_out_of_their_directory)
+{
+    auto mock_factory_scope = mpt::MockProcessFactory::Inject();
+    mock_factory_scope->register_callback([](mpt::MockProcess* process) {
+        const auto args = process->arguments();
+        if (args.value(0) == "create")
+            make_qcow2_image(args.last(), args.at(args.size() - 2));
+        else if (args.value(0) == "convert")
+            make_qcow2_image(args.last());
+    });
+
+    mp::DefaultVMImageVault vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{0}};
+    auto prepare = [](const mp::VMImage& source_image) -> mp::VMImage {
+        make_qcow2_image(source_image.image_path);
+        return source_image;
+    };
+    vault.fetch_image(mp::FetchType::ImageOnly, default_query, prepare, stub_monitor);
+
+    for (const auto name : {".", "..", "", "../golden", "gold en"})
+    {
+        EXPECT_THROW(vault.bake_instance_image(instance_name, name, false), std::runtime_error);
+        EXPECT_THROW(vault.remove_baked_image(name), std::runtime_error);
+    }
+    EXPECT_TRUE(vault.has_record_for(instance_name));
+
+    vault.bake_instance_image(instance_name, "golden-1", false);
+    EXPECT_TRUE(vault.is_baked_image({"", "golden-1", false, "", mp::Query::Type::Alias}));
+    EXPECT_TRUE(vault.is_baked_image({"", "golden-1", false, "baked", mp::Query::Type::Alias}));
+    EXPECT_FALSE(vault.is_baked_image({"", "golden-1", false, "release", mp::Query::Type::Alias}));
+    EXPECT_FALSE(vault.is_baked_image(default_query));
+}
+
+TEST_F(ImageVault, restoring_a_snapshot_discards_what_was_written_since)
+{
+    auto mock_factory_scope = mpt::MockProcessFactory::Inject();
+    mock_factory_scope->register_callback([](mpt::MockProcess* process) {
+        const auto args = process->arguments();
+        if (args.value(0) == "create")
+            make_qcow2_image(args.last(), args.at(args.size() - 2));
+    });
+
+    mp::DefaultVMImageVault vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{0}};
+    auto prepare = [](const mp::VMImage& source_image) -> mp::VMImage {
+        make_qcow2_image(source_image.image_path);
+        return source_image;
+    };
+    auto vm_image = vault.fetch_image(mp::FetchType::ImageOnly, default_query, prepare, stub_monitor);
+
+    vault.snapshot_instance_image(instance_name, "clean");
+    const auto layer = mp::utils::qcow2_backing_file(vm_image.image_path);
+    {
+        QFile image{vm_image.image_path};
+        ASSERT_TRUE(image.open(QIODevice::Append));
+        image.write("written since");
+    }
+
+    vault.restore_instance_image(instance_name, "clean");
+
+    EXPECT_EQ(mp::utils::qcow2_backing_file(vm_image.image_path), layer);
+    EXPECT_FALSE(mpt::load(vm_image.image_path).contains("written since"));
+
+    auto snapshots = vault.instance_image_snapshots(instance_name);
+    ASSERT_EQ(snapshots.size(), 1u);
+    EXPECT_EQ(snapshots.front().name, "clean");
+    EXPECT_THROW(vault.snapshot_instance_image(instance_name, "clean"), std::runtime_error);
+    EXPECT_THROW(vault.restore_instance_image(instance_name, "dirty"), std::runtime_error);
+
+    vault.remove(instance_name);
+    EXPECT_FALSE(QFile::exists(layer));
+}
+
+TEST_F(ImageVault, snapshots_are_remembered)
+{
+    auto mock_factory_scope = mpt::MockProcessFactory::Inject();
+    mock_factory_scope->register_callback([](mpt::MockProcess* process) {
+        const auto args = process->arguments();
+        if (args.value(0) == "create")
+            make_qcow2_image(args.last(), args.at(args.size() - 2));
+    });
+
+    auto prepare = [](const mp::VMImage& source_image) -> mp::VMImage {
+        make_qcow2_image(source_image.image_path);
+        return source_image;
+    };
+    {
+        mp::DefaultVMImageVault vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{0}};
+        vault.fetch_image(mp::FetchType::ImageOnly, default_query, prepare, stub_monitor);
+        vault.snapshot_instance_image(instance_name, "first");
+        vault.snapshot_instance_image(instance_name, "second");
+    }
+
+    mp::DefaultVMImageVault vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{0}};
+    auto snapshots = vault.instance_image_snapshots(instance_name);
+    ASSERT_EQ(snapshots.size(), 2u);
+    EXPECT_EQ(snapshots[0].name, "first");
+    EXPECT_EQ(snapshots[1].name, "second");
+    EXPECT_LE(snapshots[0].created, snapshots[1].created);
+}
+
 TEST_F(ImageVault, calls_prepare)
 {
     mp::DefaultVMImageVault vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{0}};
@@ -290,8 +657,12 @@ TEST_F(ImageVault, remembers_instance_images)
         return source_image;
     };
 
-    mp::DefaultVMImageVault first_vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{0}};
-    auto vm_image1 = first_vault.fetch_image(mp::FetchType::ImageOnly, default_query, prepare, stub_monitor);
+    mp::VMImage vm_image1;
+    {
+        // Records are written behind, and at the latest when the vault goes away
+        mp::DefaultVMImageVault first_vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{0}};
+        vm_image1 = first_vault.fetch_image(mp::FetchType::ImageOnly, default_query, prepare, stub_monitor);
+    }
 
     mp::DefaultVMImageVault another_vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{0}};
     auto vm_image2 = another_vault.fetch_image(mp::FetchType::ImageOnly, default_query, prepare, stub_monitor);
@@ -309,8 +680,12 @@ TEST_F(ImageVault, remembers_prepared_images)
         return source_image;
     };
 
-    mp::DefaultVMImageVault first_vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{0}};
-    auto vm_image1 = first_vault.fetch_image(mp::FetchType::ImageOnly, default_query, prepare, stub_monitor);
+    mp::VMImage vm_image1;
+    {
+        // Records are written behind, and at the latest when the vault goes away
+        mp::DefaultVMImageVault first_vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{0}};
+        vm_image1 = first_vault.fetch_image(mp::FetchType::ImageOnly, default_query, prepare, stub_monitor);
+    }
 
     auto another_query = default_query;
     another_query.name = "valley-pied-piper-chat";
@@ -323,6 +698,45 @@ TEST_F(ImageVault, remembers_prepared_images)
     EXPECT_THAT(vm_image1.id, Eq(vm_image2.id));
 }
 
+TEST_F(ImageVault, shares_identical_images_across_remotes)
+{
+    mp::DefaultVMImageVault vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{0}};
+    auto vm_image1 = vault.fetch_image(mp::FetchType::ImageOnly, default_query, stub_prepare, stub_monitor);
+
+    auto release_query = default_query;
+    release_query.name = "valley-pied-piper-chat";
+    release_query.remote_name = "release";
+    auto vm_image2 = vault.fetch_image(mp::FetchType::ImageOnly, release_query, stub_prepare, stub_monitor);
+
+    EXPECT_THAT(url_downloader.downloaded_files.size(), Eq(1));
+    EXPECT_THAT(vm_image1.id, Eq(vm_image2.id));
+}
+
+TEST_F(ImageVault, prefetches_only_images_not_yet_cached)
+{
+    mp::DefaultVMImageVault vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{0}};
+    vault.prefetch_image(mp::FetchType::ImageOnly, default_query, stub_prepare, stub_monitor);
+    vault.prefetch_image(mp::FetchType::ImageOnly, default_query, stub_prepare, stub_monitor);
+    auto vm_image = vault.fetch_image(mp::FetchType::ImageOnly, default_query, stub_prepare, stub_monitor);
+
+    EXPECT_THAT(url_downloader.downloaded_files.size(), Eq(1));
+    EXPECT_THAT(vm_image.id, Eq(default_id));
+}
+
+TEST_F(ImageVault, writes_records_behind_changes)
+{
+    auto prepare = [](const mp::VMImage& source_image) -> mp::VMImage { return source_image; };
+    const auto records_path = QDir{data_dir.path()}.filePath("vault/multipassd-instance-image-records.json");
+
+    mp::DefaultVMImageVault vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{0}};
+    vault.fetch_image(mp::FetchType::ImageOnly, default_query, prepare, stub_monitor);
+    vault.remove(default_query.name);
+
+    QThread::msleep(1000);
+    ASSERT_TRUE(QFileInfo::exists(records_path));
+    EXPECT_FALSE(mpt::load(records_path).contains(default_query.name.c_str()));
+}
+
 TEST_F(ImageVault, uses_image_from_prepare)
 {
     constexpr auto expected_data = "12345-pied-piper-rats";
@@ -383,6 +797,50 @@ TEST_F(ImageVault, image_exists_not_expired)
     EXPECT_TRUE(QFileInfo::exists(file_name));
 }
 
+TEST_F(ImageVault, least_recently_used_image_goes_when_over_budget)
+{
+    auto& mock_settings = mpt::MockSettings::mock_instance();
+    EXPECT_CALL(mock_settings, get(_)).Times(AnyNumber());
+    EXPECT_CALL(mock_settings, get(Eq(mp::image_cache_size_key))).WillRepeatedly(Return("1"));
+
+    mp::DefaultVMImageVault vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{1}};
+
+    QDir images_dir{mp::utils::make_dir(cache_dir.path(), "images")};
+    auto file_name = images_dir.filePath("mock_image.img");
+
+    auto prepare = [&file_name](const mp::VMImage& source_image) -> mp::VMImage {
+        mpt::make_file_with_content(file_name, "more than a byte");
+        return {file_name, "", "", source_image.id, "", "", "", {}};
+    };
+    vault.fetch_image(mp::FetchType::ImageOnly, default_query, prepare, stub_monitor);
+
+    vault.prune_expired_images();
+
+    EXPECT_FALSE(QFileInfo::exists(file_name));
+}
+
+TEST_F(ImageVault, images_within_budget_do_not_expire)
+{
+    auto& mock_settings = mpt::MockSettings::mock_instance();
+    EXPECT_CALL(mock_settings, get(_)).Times(AnyNumber());
+    EXPECT_CALL(mock_settings, get(Eq(mp::image_cache_size_key))).WillRepeatedly(Return("1G"));
+
+    mp::DefaultVMImageVault vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{0}};
+
+    QDir images_dir{mp::utils::make_dir(cache_dir.path(), "images")};
+    auto file_name = images_dir.filePath("mock_image.img");
+
+    auto prepare = [&file_name](const mp::VMImage& source_image) -> mp::VMImage {
+        mpt::make_file_with_content(file_name);
+        return {file_name, "", "", source_image.id, "", "", "", {}};
+    };
+    vault.fetch_image(mp::FetchType::ImageOnly, default_query, prepare, stub_monitor);
+
+    vault.prune_expired_images();
+
+    EXPECT_TRUE(QFileInfo::exists(file_name));
+}
+
 TEST_F(ImageVault, invalid_image_dir_is_removed)
 {
     mp::DefaultVMImageVault vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{1}};
@@ -400,6 +858,42 @@ TEST_F(ImageVault, invalid_image_dir_is_removed)
     EXPECT_FALSE(QFileInfo::exists(invalid_image_dir.absolutePath()));
 }
 
+TEST_F(ImageVault, image_dir_with_partial_download_is_kept)
+{
+    mp::DefaultVMImageVault vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{1}};
+
+    QDir partial_image_dir(mp::utils::make_dir(cache_dir.path(), "vault/images/partial_image"));
+    auto file_name = partial_image_dir.filePath("mock_image.img");
+
+    mpt::make_file_with_content(file_name);
+    mpt::make_file_with_content(file_name + mp::download_journal_suffix);
+
+    vault.prune_expired_images();
+
+    EXPECT_TRUE(QFileInfo::exists(file_name));
+}
+
+TEST_F(ImageVault, image_dir_with_download_left_off_past_expiry_is_removed)
+{
+    mp::DefaultVMImageVault vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{1}};
+
+    QDir partial_image_dir(mp::utils::make_dir(cache_dir.path(), "vault/images/partial_image"));
+    auto file_name = partial_image_dir.filePath("mock_image.img");
+
+    mpt::make_file_with_content(file_name);
+    mpt::make_file_with_content(file_name + mp::download_journal_suffix);
+
+    QFile journal{file_name + mp::download_journal_suffix};
+    ASSERT_TRUE(journal.open(QIODevice::ReadWrite));
+    ASSERT_TRUE(journal.setFileTime(QDateTime::currentDateTime().addDays(-2), QFileDevice::FileModificationTime));
+    journal.close();
+
+    vault.prune_expired_images();
+
+    EXPECT_FALSE(QFileInfo::exists(file_name));
+    EXPECT_FALSE(QFileInfo::exists(partial_image_dir.absolutePath()));
+}
+
 TEST_F(ImageVault, invalid_custom_image_file_throws)
 {
     mp::DefaultVMImageVault vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{0}};
@@ -411,6 +905,33 @@ TEST_F(ImageVault, invalid_custom_image_file_throws)
     EXPECT_THROW(vault.fetch_image(mp::FetchType::ImageOnly, query, stub_prepare, stub_monitor), std::runtime_error);
 }
 
+TEST_F(ImageVault, prepares_a_custom_image_file_once)
+{
+    mpt::TempDir custom_dir;
+    const auto image_path = custom_dir.path() + "/custom.img";
+    mpt::make_file_with_content(image_path);
+
+    mp::DefaultVMImageVault vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{0}};
+    auto query = default_query;
+    query.release = QUrl::fromLocalFile(image_path).toString().toStdString();
+    query.query_type = mp::Query::Type::LocalFile;
+
+    int prepared{0};
+    auto prepare = [&prepared](const mp::VMImage& source_image) -> mp::VMImage {
+        ++prepared;
+        return source_image;
+    };
+    auto vm_image = vault.fetch_image(mp::FetchType::ImageOnly, query, prepare, stub_monitor);
+
+    query.name = "second";
+    auto second_image = vault.fetch_image(mp::FetchType::ImageOnly, query, prepare, stub_monitor);
+
+    EXPECT_EQ(prepared, 1);
+    EXPECT_NE(vm_image.image_path, second_image.image_path);
+    EXPECT_TRUE(QFile::exists(second_image.image_path));
+    EXPECT_FALSE(second_image.image_path.startsWith(custom_dir.path()));
+}
+
 TEST_F(ImageVault, custom_image_url_downloads)
 {
     mp::DefaultVMImageVault vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{0}};
@@ -532,3 +1053,34 @@ TEST_F(ImageVault, aborted_download_throws)
     EXPECT_THROW(vault.fetch_image(mp::FetchType::ImageOnly, default_query, stub_prepare, stub_monitor),
                  mp::AbortedDownloadException);
 }
+
+TEST_F(ImageVault, scrubbing_fetches_images_that_changed_since_prepared)
+{
+    mp::DefaultVMImageVault vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{0}};
+    vault.fetch_image(mp::FetchType::ImageOnly, default_query, stub_prepare, stub_monitor);
+    const auto image_path = url_downloader.downloaded_files[0];
+
+    vault.scrub_images(mp::FetchType::ImageOnly, stub_prepare, stub_monitor, 1024 * 1024);
+    EXPECT_THAT(url_downloader.downloaded_files.size(), Eq(1));
+
+    QFile::remove(image_path);
+    mpt::make_file_with_content(image_path, "bit rot");
+    vault.scrub_images(mp::FetchType::ImageOnly, stub_prepare, stub_monitor, 1024 * 1024);
+
+    EXPECT_THAT(url_downloader.downloaded_files.size(), Eq(2));
+    EXPECT_THAT(mpt::load(url_downloader.downloaded_files[1]), Eq(QByteArray{}));
+}
+
+TEST_F(ImageVault, scrubbing_holds_images_to_what_they_hashed_to_once_prepared)
+{
+    mp::DefaultVMImageVault vault{hosts, &url_downloader, cache_dir.path(), data_dir.path(), mp::days{0}};
+    vault.fetch_image(mp::FetchType::ImageOnly, default_query, stub_prepare, stub_monitor);
+    const auto image_path = url_downloader.downloaded_files[0];
+
+    // Rot that sets in before the first scrub is found all the same
+    QFile::remove(image_path);
+    mpt::make_file_with_content(image_path, "bit rot");
+    vault.scrub_images(mp::FetchType::ImageOnly, stub_prepare, stub_monitor, 1024 * 1024);
+
+    EXPECT_THAT(url_downloader.downloaded_files.size(), Eq(2));
+}
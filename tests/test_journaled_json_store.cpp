@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <src/daemon/journaled_json_store.h>
+
+#include "file_operations.h"
+#include "temp_dir.h"
+
+#include <QDir>
+#include <QFile>
+
+#include <gmock/gmock.h>
+
+namespace mp = multipass;
+namespace mpt = multipass::test;
+using namespace testing;
+
+namespace
+{
+struct JournaledJsonStore : public Test
+{
+    mpt::TempDir temp_dir;
+    QString snapshot_path{QDir{temp_dir.path()}.filePath("records.json")};
+    QString journal_path{QDir{temp_dir.path()}.filePath("records.journal")};
+};
+
+QJsonObject record_with(int value)
+{
+    return QJsonObject{{"value", value}};
+}
+} // namespace
+
+TEST_F(JournaledJsonStore, reloads_what_was_put_and_removed)
+{
+    {
+        mp::JournaledJsonStore store{snapshot_path, journal_path};
+        store.load();
+        store.put("pied", record_with(1));
+        store.put("piper", record_with(2));
+        store.put("pied", record_with(3));
+        store.remove("piper");
+    }
+
+    mp::JournaledJsonStore store{snapshot_path, journal_path};
+    auto records = store.load();
+
+    EXPECT_THAT(records.keys(), ElementsAre("pied"));
+    EXPECT_EQ(records["pied"].toObject(), record_with(3));
+}
+
+TEST_F(JournaledJsonStore, unchanged_records_are_not_journaled)
+{
+    mp::JournaledJsonStore store{snapshot_path, journal_path};
+    store.load();
+    store.put("pied", record_with(1));
+    auto journal_size = QFile{journal_path}.size();
+
+    store.put("pied", record_with(1));
+    store.remove("piper");
+
+    EXPECT_EQ(QFile{journal_path}.size(), journal_size);
+}
+
+TEST_F(JournaledJsonStore, drops_entry_torn_by_crash)
+{
+    mpt::make_file_with_content(snapshot_path, "{\"pied\": {\"value\": 1}}");
+    mpt::make_file_with_content(journal_path, "{\"key\": \"piper\", \"record\": {\"value\": 2}}\n"
+                                              "{\"key\": \"pied\", \"rec");
+
+    mp::JournaledJsonStore store{snapshot_path, journal_path};
+    auto records = store.load();
+
+    EXPECT_EQ(records["pied"].toObject(), record_with(1));
+    EXPECT_EQ(records["piper"].toObject(), record_with(2));
+}
+
+TEST_F(JournaledJsonStore, compaction_folds_journal_into_snapshot)
+{
+    {
+        mp::JournaledJsonStore store{snapshot_path, journal_path};
+        store.load();
+        for (auto i = 0; i < 100; ++i)
+            store.put("pied", record_with(i));
+
+        EXPECT_LT(mpt::load(journal_path).count('\n'), 100);
+    }
+
+    mp::JournaledJsonStore store{snapshot_path, journal_path};
+    EXPECT_EQ(store.load()["pied"].toObject(), record_with(99));
+}
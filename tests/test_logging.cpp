@@ -0,0 +1,252 @@
+/*
+ * Copyright (C) 2020 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "mock_logger.h"
+
+#include <multipass/logging/async_logger.h>
+#include <multipass/logging/client_logger.h>
+#include <multipass/logging/log.h>
+#include <multipass/logging/multiplexing_logger.h>
+#include <multipass/logging/recent_logger.h>
+#include <multipass/logging/standard_logger.h>
+
+#include <gmock/gmock.h>
+
+#include <future>
+#include <string>
+#include <vector>
+
+namespace mp = multipass;
+namespace mpl = multipass::logging;
+namespace mpt = multipass::test;
+using namespace testing;
+
+namespace
+{
+struct LevelLogger : public mpt::MockLogger
+{
+    explicit LevelLogger(mpl::Level level) : level{level}
+    {
+    }
+
+    bool enabled(mpl::Level query) const override
+    {
+        return query <= level;
+    }
+
+    mpl::Level level;
+};
+
+// Only ever called by the async logger's drainer, so the messages can be looked at once the logger is gone
+struct RecordingLogger : public mpl::Logger
+{
+    RecordingLogger(std::vector<std::string>& messages, std::shared_future<void> go_ahead = {})
+        : messages{messages}, go_ahead{go_ahead}
+    {
+    }
+
+    void log(mpl::Level, mpl::CString, mpl::CString message) const override
+    {
+        if (go_ahead.valid())
+            go_ahead.wait();
+        messages.push_back(message.c_str());
+    }
+
+    std::vector<std::string>& messages;
+    std::shared_future<void> go_ahead;
+};
+
+struct RecordingWriter
+{
+    bool Write(const mp::VersionReply& reply)
+    {
+        replies.push_back(reply.log_line());
+        return true;
+    }
+
+    std::vector<std::string> replies;
+};
+
+using BatchingClientLogger = mpl::ClientLogger<mp::VersionReply, RecordingWriter>;
+} // namespace
+
+TEST(MultiplexingLogger, is_enabled_up_to_most_verbose_logger)
+{
+    mpl::MultiplexingLogger logger{std::make_unique<mpl::StandardLogger>(mpl::Level::warning)};
+    EXPECT_TRUE(logger.enabled(mpl::Level::warning));
+    EXPECT_FALSE(logger.enabled(mpl::Level::debug));
+
+    LevelLogger client_logger{mpl::Level::debug};
+    logger.add_logger(&client_logger);
+    EXPECT_TRUE(logger.enabled(mpl::Level::debug));
+    EXPECT_FALSE(logger.enabled(mpl::Level::trace));
+
+    logger.remove_logger(&client_logger);
+    EXPECT_FALSE(logger.enabled(mpl::Level::debug));
+}
+
+TEST(MultiplexingLogger, does_not_forward_disabled_levels)
+{
+    mpl::MultiplexingLogger logger{std::make_unique<mpl::StandardLogger>(mpl::Level::error)};
+    LevelLogger client_logger{mpl::Level::info};
+    logger.add_logger(&client_logger);
+
+    EXPECT_CALL(client_logger, log(mpl::Level::debug, _, _)).Times(0);
+    EXPECT_CALL(client_logger, log(mpl::Level::info, _, _));
+    logger.log(mpl::Level::debug, "test", "not wanted");
+    logger.log(mpl::Level::info, "test", "wanted");
+
+    logger.remove_logger(&client_logger);
+}
+
+TEST(Log, skips_formatting_when_level_is_disabled)
+{
+    auto logger = std::make_shared<StrictMock<LevelLogger>>(mpl::Level::info);
+    mpl::set_logger(logger);
+
+    EXPECT_CALL(*logger, log(mpl::Level::info, _, _));
+    mpl::log(mpl::Level::debug, "test", "{}", 42);
+    mpl::log(mpl::Level::info, "test", "{}", 42);
+
+    mpl::set_logger(nullptr);
+}
+
+TEST(AsyncLogger, passes_every_message_on_in_order)
+{
+    std::vector<std::string> messages;
+    {
+        mpl::AsyncLogger logger{std::make_unique<RecordingLogger>(messages), mpl::AsyncLogger::OverflowPolicy::block,
+                                8};
+        for (auto i = 0; i < 100; ++i)
+            logger.log(mpl::Level::info, "test", std::to_string(i));
+    }
+
+    ASSERT_EQ(messages.size(), 100u);
+    for (auto i = 0; i < 100; ++i)
+        EXPECT_EQ(messages[i], std::to_string(i));
+}
+
+TEST(AsyncLogger, counts_what_it_drops_while_the_sink_is_stuck)
+{
+    std::vector<std::string> messages;
+    std::promise<void> go_ahead;
+    {
+        mpl::AsyncLogger logger{std::make_unique<RecordingLogger>(messages, go_ahead.get_future().share()),
+                                mpl::AsyncLogger::OverflowPolicy::drop, 2};
+        for (auto i = 0; i < 10; ++i)
+            logger.log(mpl::Level::info, "test", std::to_string(i));
+
+        go_ahead.set_value();
+    }
+
+    ASSERT_FALSE(messages.empty());
+    EXPECT_LE(messages.size(), 4u); // the one being written, a full buffer and the warning
+    EXPECT_THAT(messages.back(), HasSubstr("dropped"));
+}
+
+TEST(AsyncLogger, is_enabled_as_its_sink_is)
+{
+    mpl::AsyncLogger logger{std::make_unique<mpl::StandardLogger>(mpl::Level::warning),
+                            mpl::AsyncLogger::OverflowPolicy::drop};
+    EXPECT_TRUE(logger.enabled(mpl::Level::warning));
+    EXPECT_FALSE(logger.enabled(mpl::Level::debug));
+}
+
+TEST(RecentLogger, keeps_the_latest_of_each_category_in_order)
+{
+    mpl::RecentLogger logger{mpl::Level::debug, 2};
+    logger.log(mpl::Level::info, "chatty", "1");
+    logger.log(mpl::Level::info, "quiet", "2");
+    logger.log(mpl::Level::info, "chatty", "3");
+    logger.log(mpl::Level::info, "chatty", "4");
+    logger.log(mpl::Level::trace, "quiet", "not kept");
+
+    std::vector<std::string> messages;
+    for (const auto& record : logger.recent(mpl::Level::trace))
+        messages.push_back(record.message);
+
+    EXPECT_THAT(messages, ElementsAre("2", "3", "4"));
+}
+
+TEST(RecentLogger, filters_by_level_and_category)
+{
+    mpl::RecentLogger logger{mpl::Level::trace};
+    logger.log(mpl::Level::debug, "foo", "details");
+    logger.log(mpl::Level::error, "foo", "trouble");
+    logger.log(mpl::Level::error, "bar", "other trouble");
+
+    auto records = logger.recent(mpl::Level::warning, "foo");
+    ASSERT_EQ(records.size(), 1u);
+    EXPECT_EQ(records.front().message, "trouble");
+    EXPECT_THAT(logger.recent(mpl::Level::trace, "baz"), IsEmpty());
+}
+
+TEST(RecentLogger, makes_room_for_new_categories)
+{
+    mpl::RecentLogger logger{mpl::Level::trace, 8, 2};
+    logger.log(mpl::Level::info, "gone", "old");
+    logger.log(mpl::Level::info, "kept", "newer");
+    logger.log(mpl::Level::info, "new", "newest");
+
+    EXPECT_THAT(logger.recent(mpl::Level::trace, "gone"), IsEmpty());
+    EXPECT_EQ(logger.recent(mpl::Level::trace).size(), 2u);
+}
+
+TEST(ClientLogger, holds_lines_back_until_it_goes)
+{
+    mpl::MultiplexingLogger mpx{std::make_unique<mpl::StandardLogger>(mpl::Level::error)};
+    RecordingWriter writer;
+    {
+        BatchingClientLogger logger{mpl::Level::debug, mpx, &writer};
+        mpx.log(mpl::Level::debug, "test", "first");
+        mpx.log(mpl::Level::trace, "test", "too verbose");
+        mpx.log(mpl::Level::info, "test", "second");
+        EXPECT_THAT(writer.replies, IsEmpty());
+    }
+
+    ASSERT_EQ(writer.replies.size(), 1u);
+    EXPECT_THAT(writer.replies.front(), AllOf(HasSubstr("first\n"), HasSubstr("second\n")));
+    EXPECT_THAT(writer.replies.front(), Not(HasSubstr("too verbose")));
+}
+
+TEST(ClientLogger, writes_a_batch_once_it_is_big_enough)
+{
+    mpl::MultiplexingLogger mpx{std::make_unique<mpl::StandardLogger>(mpl::Level::error)};
+    RecordingWriter writer;
+    BatchingClientLogger logger{mpl::Level::debug, mpx, &writer};
+
+    const std::string message(1024, 'x');
+    for (auto written = 0u; written < BatchingClientLogger::max_batch_size; written += message.size())
+        mpx.log(mpl::Level::debug, "test", message);
+
+    EXPECT_EQ(writer.replies.size(), 1u);
+}
+
+TEST(ClientLogger, merges_pending_lines_into_replies)
+{
+    mpl::MultiplexingLogger mpx{std::make_unique<mpl::StandardLogger>(mpl::Level::error)};
+    RecordingWriter writer;
+    BatchingClientLogger logger{mpl::Level::debug, mpx, &writer};
+    mpx.log(mpl::Level::debug, "test", "pending");
+
+    mp::VersionReply reply;
+    logger.merge_into(reply);
+    logger.flush();
+
+    EXPECT_THAT(reply.log_line(), HasSubstr("pending\n"));
+    EXPECT_THAT(writer.replies, IsEmpty());
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <src/daemon/memory_footprint.h>
+
+#include <multipass/vm_image_info.h>
+
+#include <gmock/gmock.h>
+
+#include <cstring>
+#include <memory>
+
+namespace mp = multipass;
+namespace mf = multipass::memory_footprint;
+using namespace testing;
+
+namespace
+{
+TEST(MemoryFootprint, heap_in_use_counts_what_is_allocated)
+{
+    const auto before = mf::heap_in_use();
+    if (!before)
+        return; // the allocator does not tell
+
+    constexpr std::size_t block = 16 * 1024 * 1024;
+    auto held = std::make_unique<char[]>(block);
+    std::memset(held.get(), 1, block);
+
+    EXPECT_GE(mf::heap_in_use(), before + block);
+}
+
+TEST(MemoryFootprint, resident_is_known_on_linux)
+{
+    EXPECT_GT(mf::resident(), 0u);
+}
+
+TEST(MemoryFootprint, short_strings_take_nothing_off_the_heap)
+{
+    EXPECT_EQ(mf::of(std::string{"ubuntu"}), 0u);
+    EXPECT_GT(mf::of(std::string(100, 'x')), 100u);
+}
+
+TEST(MemoryFootprint, image_info_counts_its_strings)
+{
+    mp::VMImageInfo info{{"default", "lts"}, "Ubuntu", "bionic", "18.04 LTS", true, "releases/bionic/disk1.img",
+                         "", "", QString(64, 'a'), "20190101", 1, true};
+
+    EXPECT_GT(mf::of(info), sizeof(info) + 64 * sizeof(QChar));
+}
+} // namespace
@@ -30,6 +30,7 @@
 #include <gmock/gmock.h>
 
 #include <locale>
+#include <sstream>
 
 namespace mp = multipass;
 namespace mpt = multipass::test;
@@ -907,6 +908,25 @@ TEST_P(FormatterSuite, properly_formats_output)
     EXPECT_EQ(output, expected_output);
 }
 
+TEST_P(FormatterSuite, streams_the_same_output)
+{
+    const auto& [formatter, reply, expected_output, test_name] = GetParam();
+    Q_UNUSED(test_name); // gcc 7.4 can't do [[maybe_unused]] for structured bindings
+
+    std::ostringstream output;
+
+    if (auto input = dynamic_cast<const mp::ListReply*>(reply))
+        formatter->format_to(output, *input);
+    else if (auto input = dynamic_cast<const mp::InfoReply*>(reply))
+        formatter->format_to(output, *input);
+    else if (auto input = dynamic_cast<const mp::FindReply*>(reply))
+        formatter->format_to(output, *input);
+    else
+        FAIL() << "Not a supported reply type.";
+
+    EXPECT_EQ(output.str(), expected_output);
+}
+
 INSTANTIATE_TEST_SUITE_P(OrderableListInfoOutputFormatter, FormatterSuite,
                          ValuesIn(orderable_list_info_formatter_outputs), print_param_name);
 INSTANTIATE_TEST_SUITE_P(NonOrderableListInfoOutputFormatter, FormatterSuite,
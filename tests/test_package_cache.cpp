@@ -0,0 +1,190 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <src/daemon/package_cache.h>
+
+#include "temp_dir.h"
+
+#include <QEventLoop>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTimer>
+
+#include <gmock/gmock.h>
+
+#include <memory>
+
+namespace mp = multipass;
+namespace mpt = multipass::test;
+using namespace testing;
+
+namespace
+{
+const QString package_path{"/ubuntu/pool/main/h/hello/hello_2.10-2ubuntu2_amd64.deb"};
+const QString index_path{"/ubuntu/dists/focal/InRelease"};
+
+// Stands in for the archive, answering every request with the same body, or the same redirect, and counting them
+struct Archive
+{
+    Archive()
+    {
+        QObject::connect(&server, &QTcpServer::newConnection, [this] {
+            while (auto socket = server.nextPendingConnection())
+            {
+                QObject::connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+                QObject::connect(socket, &QTcpSocket::readyRead, socket, [this, socket] {
+                    if (!socket->readAll().contains("\r\n\r\n"))
+                        return;
+
+                    ++requests;
+                    if (!location.isEmpty())
+                        socket->write("HTTP/1.1 302 Found\r\nLocation: " + location +
+                                      "\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+                    else
+                        socket->write("HTTP/1.1 200 OK\r\nContent-Length: " + QByteArray::number(body.size()) +
+                                      "\r\nConnection: close\r\n\r\n" + body);
+                    socket->disconnectFromHost();
+                });
+            }
+        });
+        server.listen(QHostAddress::LocalHost);
+    }
+
+    QString url_for(const QString& path) const
+    {
+        return QString("http://127.0.0.1:%1%2").arg(server.serverPort()).arg(path);
+    }
+
+    QTcpServer server;
+    const QByteArray body{"what the archive has"};
+    QByteArray location;
+    int requests{0};
+};
+
+struct PackageCache : public Test
+{
+    // Asks a cache the way apt asks its proxy, without waiting for the answer
+    std::unique_ptr<QTcpSocket> ask(const QByteArray& request_line, quint16 port)
+    {
+        auto socket = std::make_unique<QTcpSocket>();
+        socket->connectToHost(QHostAddress::LocalHost, port);
+        socket->write(request_line + "\r\nHost: 127.0.0.1\r\n\r\n");
+        return socket;
+    }
+
+    std::unique_ptr<QTcpSocket> ask(const QByteArray& request_line)
+    {
+        return ask(request_line, cache.port());
+    }
+
+    std::unique_ptr<QTcpSocket> get(const QString& path)
+    {
+        return ask("GET " + archive.url_for(path).toLatin1() + " HTTP/1.1");
+    }
+
+    QByteArray response_on(QTcpSocket& socket)
+    {
+        QEventLoop loop;
+        QObject::connect(&socket, &QTcpSocket::disconnected, &loop, &QEventLoop::quit);
+        QTimer::singleShot(5000, &loop, &QEventLoop::quit);
+        if (socket.state() != QAbstractSocket::UnconnectedState)
+            loop.exec();
+
+        return socket.readAll();
+    }
+
+    QByteArray body_on(QTcpSocket& socket)
+    {
+        const auto response = response_on(socket);
+        return response.mid(response.indexOf("\r\n\r\n") + 4);
+    }
+
+    mpt::TempDir dir;
+    Archive archive;
+    // The archive stands in on loopback, which the cache would not otherwise go to
+    mp::PackageCache cache{
+        {"127.0.0.1"}, 0, dir.path() + "/packages", 1024 * 1024, [](const QHostAddress&) { return true; }};
+};
+} // namespace
+
+TEST_F(PackageCache, fetches_packages_once_for_everyone_asking)
+{
+    auto first = get(package_path);
+    auto second = get(package_path);
+
+    EXPECT_EQ(body_on(*first), archive.body);
+    EXPECT_EQ(body_on(*second), archive.body);
+
+    auto later = get(package_path);
+
+    EXPECT_EQ(body_on(*later), archive.body);
+    EXPECT_EQ(archive.requests, 1);
+}
+
+TEST_F(PackageCache, passes_anything_but_packages_through)
+{
+    auto first = get(index_path);
+    EXPECT_EQ(body_on(*first), archive.body);
+
+    auto second = get(index_path);
+    EXPECT_EQ(body_on(*second), archive.body);
+
+    EXPECT_EQ(archive.requests, 2);
+}
+
+TEST_F(PackageCache, refuses_tunnels)
+{
+    auto socket = ask("CONNECT archive.ubuntu.com:443 HTTP/1.1");
+
+    EXPECT_TRUE(response_on(*socket).startsWith("HTTP/1.1 501 "));
+    EXPECT_EQ(archive.requests, 0);
+}
+
+TEST_F(PackageCache, hands_redirects_back_to_be_followed_through_it)
+{
+    archive.location = archive.url_for("/elsewhere" + package_path).toLatin1();
+
+    auto socket = get(package_path);
+    const auto response = response_on(*socket);
+
+    EXPECT_TRUE(response.startsWith("HTTP/1.1 302 "));
+    EXPECT_TRUE(response.contains("Location: " + archive.location + "\r\n"));
+    EXPECT_EQ(archive.requests, 1);
+}
+
+TEST_F(PackageCache, goes_nowhere_but_public_addresses_by_default)
+{
+    mp::PackageCache guarded{{"127.0.0.1"}, 0, dir.path() + "/guarded", 1024 * 1024};
+
+    auto package = ask("GET " + archive.url_for(package_path).toLatin1() + " HTTP/1.1", guarded.port());
+    auto index = ask("GET " + archive.url_for(index_path).toLatin1() + " HTTP/1.1", guarded.port());
+
+    EXPECT_TRUE(response_on(*package).startsWith("HTTP/1.1 403 "));
+    EXPECT_TRUE(response_on(*index).startsWith("HTTP/1.1 403 "));
+    EXPECT_EQ(archive.requests, 0);
+}
+
+TEST_F(PackageCache, tells_public_addresses_apart)
+{
+    for (const auto address : {"91.189.91.38", "2001:67c:1562::15", "::ffff:91.189.91.38"})
+        EXPECT_TRUE(mp::PackageCache::is_public_address(QHostAddress{address})) << address;
+
+    for (const auto address : {"127.0.0.1", "10.1.2.3", "172.20.0.1", "192.168.64.1", "169.254.169.254", "100.64.0.1",
+                               "0.0.0.0", "224.0.0.251", "255.255.255.255", "::1", "::", "fe80::1", "fd00::1",
+                               "ff02::1", "::ffff:127.0.0.1", "::ffff:169.254.169.254"})
+        EXPECT_FALSE(mp::PackageCache::is_public_address(QHostAddress{address})) << address;
+}
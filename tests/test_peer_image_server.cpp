@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <src/daemon/peer_image_server.h>
+
+#include "file_operations.h"
+#include "temp_dir.h"
+
+#include <multipass/exceptions/download_exception.h>
+#include <multipass/url_downloader.h>
+
+#include <QUrl>
+
+#include <gmock/gmock.h>
+
+namespace mp = multipass;
+namespace mpt = multipass::test;
+using namespace testing;
+
+namespace
+{
+const std::string cached_id(64, 'a');
+
+struct PeerImageServer : public Test
+{
+    QUrl url_for(const std::string& id)
+    {
+        return QString("http://127.0.0.1:%1/images/%2").arg(server.port()).arg(QString::fromStdString(id));
+    }
+
+    mpt::TempDir dir;
+    QString image_path{dir.path() + "/cached.img"};
+    mp::PeerImageServer server{QHostAddress::LocalHost, 0,
+                               [this](const std::string& id) { return id == cached_id ? image_path : mp::Path{}; }};
+    mp::URLDownloader downloader{std::chrono::seconds(10)};
+    mp::ProgressMonitor monitor{[](int, int) { return true; }};
+};
+} // namespace
+
+TEST_F(PeerImageServer, serves_cached_images_by_id)
+{
+    mpt::make_file_with_content(image_path, "the image itself");
+    const auto target = dir.path() + "/downloaded.img";
+
+    downloader.download_to(url_for(cached_id), target, -1, 0, monitor);
+
+    EXPECT_EQ(mpt::load(target), "the image itself");
+}
+
+TEST_F(PeerImageServer, refuses_images_it_does_not_have)
+{
+    mpt::make_file_with_content(image_path, "the image itself");
+
+    EXPECT_THROW(downloader.download_to(url_for(std::string(64, 'b')), dir.path() + "/downloaded.img", -1, 0, monitor),
+                 mp::DownloadException);
+}
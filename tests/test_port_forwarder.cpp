@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <src/daemon/port_forwarder.h>
+
+#include <gmock/gmock.h>
+
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace mp = multipass;
+using namespace testing;
+
+namespace
+{
+sockaddr_in loopback(int port)
+{
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(static_cast<uint16_t>(port));
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    return address;
+}
+
+// Listens on a port of the loopback interface the system picks, for as long as it lives
+struct Listening
+{
+    Listening()
+    {
+        const int on = 1;
+        ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        auto address = loopback(0);
+        ::bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+        ::listen(fd, 1);
+
+        socklen_t length = sizeof(address);
+        ::getsockname(fd, reinterpret_cast<sockaddr*>(&address), &length);
+        port = ntohs(address.sin_port);
+    }
+
+    ~Listening()
+    {
+        ::close(fd);
+    }
+
+    int fd{::socket(AF_INET, SOCK_STREAM, 0)};
+    int port;
+};
+
+int free_port()
+{
+    return Listening{}.port;
+}
+
+std::string read_to_end(int fd)
+{
+    std::string data;
+    char buffer[4096];
+    ssize_t read;
+    while ((read = ::recv(fd, buffer, sizeof(buffer), 0)) > 0)
+        data.append(buffer, read);
+
+    return data;
+}
+
+struct PortForwarder : public Test
+{
+    mp::PortForwarder forwarder;
+};
+} // namespace
+
+TEST_F(PortForwarder, relays_both_ways_to_the_instance_port)
+{
+    Listening instance;
+    std::thread echo{[&instance] {
+        const auto connection = ::accept(instance.fd, nullptr, nullptr);
+        const auto received = "echo: " + read_to_end(connection);
+        ::send(connection, received.data(), received.size(), 0);
+        ::close(connection);
+    }};
+
+    const auto host_port = free_port();
+    forwarder.start("foo", {"127.0.0.1", host_port, instance.port}, "127.0.0.1");
+
+    const auto client = ::socket(AF_INET, SOCK_STREAM, 0);
+    auto address = loopback(host_port);
+    ASSERT_EQ(::connect(client, reinterpret_cast<sockaddr*>(&address), sizeof(address)), 0);
+    ::send(client, "hello", 5, 0);
+    ::shutdown(client, SHUT_WR);
+
+    EXPECT_EQ(read_to_end(client), "echo: hello");
+    ::close(client);
+    echo.join();
+}
+
+TEST_F(PortForwarder, keeps_serving_when_a_connection_cannot_be_set_up)
+{
+    Listening instance;
+    std::thread echo{[&instance] {
+        const auto connection = ::accept(instance.fd, nullptr, nullptr);
+        const auto received = "echo: " + read_to_end(connection);
+        ::send(connection, received.data(), received.size(), 0);
+        ::close(connection);
+    }};
+
+    const auto host_port = free_port();
+    forwarder.start("foo", {"127.0.0.1", host_port, instance.port}, "127.0.0.1");
+    auto address = loopback(host_port);
+
+    // Descriptors run out but for one, which lets the relay thread accept the connection but not make its pipes
+    const auto refused = ::socket(AF_INET, SOCK_STREAM, 0);
+    timeval timeout{5, 0};
+    ::setsockopt(refused, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    rlimit original;
+    ::getrlimit(RLIMIT_NOFILE, &original);
+    rlimit lowered{std::min<rlim_t>(original.rlim_cur, 1024), original.rlim_max};
+    ::setrlimit(RLIMIT_NOFILE, &lowered);
+    std::vector<int> fillers;
+    int filler;
+    while ((filler = ::dup(refused)) >= 0)
+        fillers.push_back(filler);
+    EXPECT_FALSE(fillers.empty());
+    if (!fillers.empty())
+    {
+        ::close(fillers.back());
+        fillers.pop_back();
+    }
+
+    EXPECT_EQ(::connect(refused, reinterpret_cast<sockaddr*>(&address), sizeof(address)), 0);
+    char byte;
+    EXPECT_EQ(::recv(refused, &byte, 1, 0), 0); // hung up on rather than left hanging
+
+    for (auto fd : fillers)
+        ::close(fd);
+    ::setrlimit(RLIMIT_NOFILE, &original);
+    ::close(refused);
+
+    const auto client = ::socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_EQ(::connect(client, reinterpret_cast<sockaddr*>(&address), sizeof(address)), 0);
+    ::send(client, "hello", 5, 0);
+    ::shutdown(client, SHUT_WR);
+
+    EXPECT_EQ(read_to_end(client), "echo: hello");
+    ::close(client);
+    echo.join();
+}
+
+TEST_F(PortForwarder, throws_when_the_host_port_is_taken)
+{
+    Listening taken;
+
+    EXPECT_THROW(forwarder.start("foo", {"127.0.0.1", taken.port, 80}, "127.0.0.1"), std::runtime_error);
+}
+
+TEST_F(PortForwarder, stopping_frees_the_host_port)
+{
+    const auto host_port = free_port();
+    forwarder.start("foo", {"127.0.0.1", host_port, 80}, "127.0.0.1");
+    forwarder.stop_all_for("foo");
+
+    EXPECT_NO_THROW(forwarder.start("bar", {"127.0.0.1", host_port, 80}, "127.0.0.1"));
+}
+
+TEST_F(PortForwarder, throws_on_addresses_that_are_not_ipv4)
+{
+    EXPECT_THROW(forwarder.start("foo", {"127.0.0.1", free_port(), 80}, "UNKNOWN"), std::runtime_error);
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <src/daemon/progress_coalescer.h>
+
+#include <gmock/gmock.h>
+
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace mp = multipass;
+using namespace testing;
+
+namespace
+{
+struct ProgressCoalescer : public Test
+{
+    bool write(int type, int percentage)
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        written.emplace_back(type, percentage);
+        return accept_writes;
+    }
+
+    std::mutex mutex;
+    std::vector<std::pair<int, int>> written;
+    bool accept_writes{true};
+};
+} // namespace
+
+TEST_F(ProgressCoalescer, writes_only_the_latest_of_a_burst)
+{
+    {
+        mp::ProgressCoalescer progress{[this](int type, int percentage) { return write(type, percentage); }, 1};
+        for (auto percentage = 0; percentage <= 100; ++percentage)
+            EXPECT_TRUE(progress(1, percentage));
+    }
+
+    ASSERT_THAT(written, Not(IsEmpty()));
+    EXPECT_LT(written.size(), 101u);
+    EXPECT_EQ(written.back(), std::make_pair(1, 100));
+}
+
+TEST_F(ProgressCoalescer, skips_unchanged_progress)
+{
+    mp::ProgressCoalescer progress{[this](int type, int percentage) { return write(type, percentage); }};
+
+    progress(2, 50);
+    progress.flush();
+    progress(2, 50);
+    progress.flush();
+    progress(3, 50);
+    progress.flush();
+
+    EXPECT_THAT(written, ElementsAre(std::make_pair(2, 50), std::make_pair(3, 50)));
+}
+
+TEST_F(ProgressCoalescer, reports_the_client_going_away)
+{
+    accept_writes = false;
+    mp::ProgressCoalescer progress{[this](int type, int percentage) { return write(type, percentage); }};
+
+    EXPECT_TRUE(progress(1, 10));
+    progress.flush();
+
+    EXPECT_FALSE(progress(1, 20));
+}
@@ -24,7 +24,14 @@
 #include <multipass/ssh/sftp_client.h>
 #include <multipass/ssh/ssh_session.h>
 
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+
+#include <algorithm>
 #include <gmock/gmock.h>
+#include <sstream>
+#include <unordered_map>
 
 namespace mp = multipass;
 namespace mpt = multipass::test;
@@ -157,7 +164,8 @@ TEST_F(SFTPClient, pull_throws_on_sftp_read_failed)
         file->sftp = session;
         return file;
     });
-    REPLACE(sftp_read, [](sftp_file file, auto...) {
+    REPLACE(sftp_async_read_begin, [](auto...) { return 0; });
+    REPLACE(sftp_async_read, [](sftp_file file, auto...) {
         file->sftp->errnum = SSH_ERROR;
         return -1;
     });
@@ -167,6 +175,147 @@ TEST_F(SFTPClient, pull_throws_on_sftp_read_failed)
     EXPECT_THROW(sftp.pull_file(source_path, "bar"), std::runtime_error);
 }
 
+TEST_F(SFTPClient, pull_keeps_several_reads_in_flight)
+{
+    mpt::TempDir temp_dir;
+    auto file_name = temp_dir.path() + "/test-file";
+    const std::string content(3 * 65536 + 100, 'x');
+
+    std::unordered_map<int, uint64_t> requests;
+    std::size_t max_in_flight{0};
+    int next_id{0};
+
+    REPLACE(sftp_init, [](auto...) { return SSH_OK; });
+    REPLACE(sftp_open, [](sftp_session session, auto...) {
+        auto file = get_dummy_sftp_file();
+        file->sftp = session;
+        return file;
+    });
+    REPLACE(sftp_async_read_begin, [&](sftp_file file, uint32_t len) {
+        requests[next_id] = file->offset;
+        file->offset += len;
+        max_in_flight = std::max(max_in_flight, requests.size());
+        return next_id++;
+    });
+    REPLACE(sftp_async_read, [&](sftp_file, void* data, uint32_t size, uint32_t id) {
+        const auto offset = std::min<uint64_t>(requests.at(id), content.size());
+        const auto count = std::min<uint64_t>(size, content.size() - offset);
+        std::copy_n(content.begin() + offset, count, static_cast<char*>(data));
+        requests.erase(id);
+        return static_cast<int>(count);
+    });
+    REPLACE(sftp_fstat, [](auto...) { return nullptr; });
+
+    auto sftp = make_sftp_client();
+    sftp.pull_file("foo", file_name.toStdString());
+
+    QFile pulled{file_name};
+    ASSERT_TRUE(pulled.open(QIODevice::ReadOnly));
+    EXPECT_EQ(pulled.readAll().toStdString(), content);
+    EXPECT_GT(max_in_flight, 1u);
+}
+
+TEST_F(SFTPClient, pull_range_reads_only_its_range)
+{
+    mpt::TempDir temp_dir;
+    auto file_name = temp_dir.path() + "/test-file";
+    std::string content(3 * 65536 + 100, 'x');
+    std::fill_n(content.begin() + 65536, 65536 + 50, 'y');
+
+    std::unordered_map<int, std::pair<uint64_t, uint32_t>> requests;
+    int next_id{0};
+
+    REPLACE(sftp_init, [](auto...) { return SSH_OK; });
+    REPLACE(sftp_open, [](sftp_session session, auto...) {
+        auto file = get_dummy_sftp_file();
+        file->sftp = session;
+        return file;
+    });
+    REPLACE(sftp_async_read_begin, [&](sftp_file file, uint32_t len) {
+        requests[next_id] = {file->offset, len};
+        file->offset += len;
+        return next_id++;
+    });
+    REPLACE(sftp_async_read, [&](sftp_file, void* data, uint32_t, uint32_t id) {
+        const auto offset = std::min<uint64_t>(requests.at(id).first, content.size());
+        const auto count = std::min<uint64_t>(requests.at(id).second, content.size() - offset);
+        std::copy_n(content.begin() + offset, count, static_cast<char*>(data));
+        requests.erase(id);
+        return static_cast<int>(count);
+    });
+
+    mpt::make_file_with_content(file_name, std::string(content.size(), '-'));
+    const mp::SFTPClient::SplitTransfer transfer{"foo", file_name.toStdString(), content.size(), 0644};
+
+    auto sftp = make_sftp_client();
+    sftp.pull_range(transfer, 65536, 65536 + 50);
+
+    QFile pulled{file_name};
+    ASSERT_TRUE(pulled.open(QIODevice::ReadOnly));
+    EXPECT_EQ(pulled.readAll().toStdString(), std::string(65536, '-') + std::string(65536 + 50, 'y') +
+                                                  std::string(65536 + 50, '-'));
+}
+
+TEST_F(SFTPClient, push_range_writes_at_its_offset)
+{
+    mpt::TempDir temp_dir;
+    auto file_name = temp_dir.path() + "/test-file";
+    mpt::make_file_with_content(file_name, std::string(1000, 'x') + std::string(500, 'y') + std::string(1000, 'x'));
+
+    uint64_t written_at{0};
+    std::string written;
+
+    REPLACE(sftp_init, [](auto...) { return SSH_OK; });
+    REPLACE(sftp_open, [](sftp_session session, auto...) {
+        auto file = get_dummy_sftp_file();
+        file->sftp = session;
+        return file;
+    });
+    REPLACE(sftp_write, [&](sftp_file file, const void* data, size_t count) {
+        if (written.empty())
+            written_at = file->offset;
+        written.append(static_cast<const char*>(data), count);
+        file->offset += count;
+        return static_cast<ssize_t>(count);
+    });
+    REPLACE(sftp_get_error, [](auto...) { return SSH_FX_OK; });
+
+    const mp::SFTPClient::SplitTransfer transfer{file_name.toStdString(), "bar", 2500, 0644};
+
+    auto sftp = make_sftp_client();
+    sftp.push_range(transfer, 1000, 500);
+
+    EXPECT_EQ(written_at, 1000u);
+    EXPECT_EQ(written, std::string(500, 'y'));
+}
+
+TEST_F(SFTPClient, sync_leaves_unchanged_file_alone)
+{
+    mpt::TempDir temp_dir;
+    auto file_name = temp_dir.path() + "/test-file";
+    mpt::make_file_with_content(file_name);
+    const QFileInfo info{file_name};
+
+    REPLACE(sftp_init, [](auto...) { return SSH_OK; });
+    REPLACE(sftp_stat, [&info](auto...) {
+        auto attributes = static_cast<sftp_attributes>(calloc(1, sizeof(struct sftp_attributes_struct)));
+        attributes->type = SSH_FILEXFER_TYPE_REGULAR;
+        attributes->size = info.size();
+        attributes->mtime = info.lastModified().toSecsSinceEpoch();
+        return attributes;
+    });
+    auto opened = false;
+    REPLACE(sftp_open, [&opened](auto...) {
+        opened = true;
+        return nullptr;
+    });
+
+    auto sftp = make_sftp_client();
+    sftp.sync_file(file_name.toStdString(), "bar");
+
+    EXPECT_FALSE(opened);
+}
+
 // testing stream method
 
 TEST_F(SFTPClient, in_steam_throws_on_sftp_open_failed)
@@ -228,7 +377,8 @@ TEST_F(SFTPClient, out_stream_throws_on_sftp_read_failed)
         file->sftp = session;
         return file;
     });
-    REPLACE(sftp_read, [](sftp_file file, auto...) {
+    REPLACE(sftp_async_read_begin, [](auto...) { return 0; });
+    REPLACE(sftp_async_read, [](sftp_file file, auto...) {
         file->sftp->errnum = SSH_ERROR;
         return -1;
     });
@@ -238,3 +388,35 @@ TEST_F(SFTPClient, out_stream_throws_on_sftp_read_failed)
     std::ostream fake_cout{test_stream.rdbuf()};
     EXPECT_THROW(sftp.stream_file(source_path, fake_cout), std::runtime_error);
 }
+
+TEST_F(SFTPClient, out_stream_writes_binary_data_unchanged)
+{
+    const std::string content{"binary\0data\0\xff", 13};
+    std::unordered_map<int, uint64_t> requests;
+    int next_id{0};
+
+    REPLACE(sftp_init, [](auto...) { return SSH_OK; });
+    REPLACE(sftp_open, [](sftp_session session, auto...) {
+        auto file = get_dummy_sftp_file();
+        file->sftp = session;
+        return file;
+    });
+    REPLACE(sftp_async_read_begin, [&](sftp_file file, uint32_t len) {
+        requests[next_id] = file->offset;
+        file->offset += len;
+        return next_id++;
+    });
+    REPLACE(sftp_async_read, [&](sftp_file, void* data, uint32_t size, uint32_t id) {
+        const auto offset = std::min<uint64_t>(requests.at(id), content.size());
+        const auto count = std::min<uint64_t>(size, content.size() - offset);
+        std::copy_n(content.begin() + offset, count, static_cast<char*>(data));
+        requests.erase(id);
+        return static_cast<int>(count);
+    });
+
+    auto sftp = make_sftp_client();
+
+    std::stringstream output;
+    sftp.stream_file("bar", output);
+    EXPECT_EQ(output.str(), content);
+}
@@ -0,0 +1,203 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "sftp_server_test_fixture.h"
+
+#include <multipass/ssh/ssh_session.h>
+#include <multipass/sshfs_mount/sftp_server.h>
+#include <multipass/sshfs_mount/sftp_service.h>
+
+#include <gmock/gmock.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <thread>
+
+namespace mp = multipass;
+namespace mpt = multipass::test;
+
+using namespace testing;
+
+namespace
+{
+struct SftpService : public mpt::SftpServerTest
+{
+    auto make_servers(const std::vector<std::string>& targets)
+    {
+        std::vector<std::pair<std::string, std::unique_ptr<mp::SftpServer>>> servers;
+        for (const auto& target : targets)
+        {
+            mp::SSHSession session{"a", 42};
+            servers.emplace_back(target, std::make_unique<mp::SftpServer>(std::move(session), target, target,
+                                                                          default_map, default_map, 1000, 1000));
+            channels.push_back(servers.back().second->channel());
+        }
+        return servers;
+    }
+
+    // Waits a while for the service to stop serving the target on its own
+    bool stops_serving(const mp::SftpService& service, const std::string& instance, const std::string& target)
+    {
+        for (auto i = 0; i < 200 && service.serves(instance, target); ++i)
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        return !service.serves(instance, target);
+    }
+
+    mpt::ExitStatusMock exit_status_mock;
+    void make_readable(ssh_channel channel)
+    {
+        std::lock_guard<std::mutex> lock{readable_mutex};
+        readable.insert(channel);
+    }
+
+    // Only the channels made readable ever have anything to say, otherwise the waiting thread only goes around
+    std::mutex readable_mutex;
+    std::set<ssh_channel> readable;
+    MockScope<decltype(mock_ssh_channel_select)> select{mock_ssh_channel_select,
+                                                        [this](ssh_channel* read_channels, auto...) {
+                                                            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                                                            std::lock_guard<std::mutex> lock{readable_mutex};
+                                                            auto ready = read_channels;
+                                                            for (auto channel = read_channels; *channel; ++channel)
+                                                                if (readable.count(*channel))
+                                                                    *ready++ = *channel;
+                                                            *ready = nullptr;
+                                                            return SSH_OK;
+                                                        }};
+    std::vector<ssh_channel> channels; // of the servers made, in turn
+    std::unordered_map<int, int> default_map;
+};
+} // namespace
+
+TEST_F(SftpService, serves_what_it_is_handed_until_stopped)
+{
+    mp::SftpService service;
+    service.serve("foo", make_servers({"/one", "/two"}));
+
+    EXPECT_TRUE(service.serves("foo", "/one"));
+    EXPECT_TRUE(service.serves("foo", "/two"));
+    EXPECT_FALSE(service.serves("bar", "/one"));
+
+    EXPECT_TRUE(service.stop("foo", "/one"));
+    EXPECT_FALSE(service.serves("foo", "/one"));
+    EXPECT_TRUE(service.serves("foo", "/two"));
+    EXPECT_FALSE(service.stop("foo", "/one"));
+}
+
+TEST_F(SftpService, stops_all_of_an_instance_alone)
+{
+    mp::SftpService service;
+    service.serve("foo", make_servers({"/one", "/two"}));
+    service.serve("bar", make_servers({"/one"}));
+
+    service.stop_all("foo");
+
+    EXPECT_FALSE(service.serves("foo", "/one"));
+    EXPECT_FALSE(service.serves("foo", "/two"));
+    EXPECT_TRUE(service.serves("bar", "/one"));
+}
+
+TEST_F(SftpService, serves_a_target_mounted_again_after_stopping)
+{
+    mp::SftpService service;
+    service.serve("foo", make_servers({"/one"}));
+    service.stop("foo", "/one");
+    service.serve("foo", make_servers({"/one"}));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20)); // for the serving thread to drop the first
+    EXPECT_TRUE(service.serves("foo", "/one"));
+}
+
+TEST_F(SftpService, stops_serving_a_mount_whose_sshfs_is_done_alone)
+{
+    mp::SftpService service;
+    service.serve("foo", make_servers({"/one", "/two"}));
+    make_readable(channels[0]); // with nothing to read, as sshfs exited
+
+    EXPECT_TRUE(stops_serving(service, "foo", "/one"));
+    EXPECT_TRUE(service.serves("foo", "/two"));
+}
+
+TEST_F(SftpService, restarts_sshfs_that_exited_unexpectedly)
+{
+    std::atomic<int> execs{0};
+    MockScope<decltype(mock_ssh_channel_request_exec)> request_exec{mock_ssh_channel_request_exec, [&execs](auto...) {
+                                                                        ++execs;
+                                                                        return SSH_OK;
+                                                                    }};
+    exit_status_mock.return_exit_code(1);
+
+    mp::SftpService service;
+    service.serve("foo", make_servers({"/one"}));
+    const auto started = execs.load();
+    make_readable(channels[0]);
+
+    for (auto i = 0; i < 200 && execs <= started; ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    EXPECT_GT(execs, started);
+    EXPECT_TRUE(service.serves("foo", "/one"));
+}
+
+TEST_F(SftpService, drops_a_mount_that_throws_and_serves_the_others)
+{
+    exit_status_mock.return_exit_code(1);
+
+    mp::SftpService service;
+    service.serve("foo", make_servers({"/one", "/two"}));
+
+    // sshfs cannot be started again
+    MockScope<decltype(mock_ssh_channel_request_exec)> request_exec{mock_ssh_channel_request_exec,
+                                                                    [](auto...) { return SSH_ERROR; }};
+    make_readable(channels[0]);
+
+    EXPECT_TRUE(stops_serving(service, "foo", "/one"));
+    EXPECT_TRUE(service.serves("foo", "/two"));
+}
+
+TEST_F(SftpService, serves_mounts_while_another_is_held_up)
+{
+    std::atomic<bool> held_up_done{false};
+    std::atomic<bool> other_served_meanwhile{false};
+    MockScope<decltype(mock_sftp_get_client_message)> get_message{
+        mock_sftp_get_client_message, [this, &held_up_done, &other_served_meanwhile](sftp_session sftp) {
+            if (sftp->channel == channels[0])
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(300));
+                held_up_done = true;
+            }
+            else if (!held_up_done)
+            {
+                other_served_meanwhile = true;
+            }
+            return static_cast<sftp_client_message>(nullptr);
+        }};
+
+    {
+        mp::SftpService service;
+        service.serve("foo", make_servers({"/one", "/two"}));
+        make_readable(channels[0]);
+        std::this_thread::sleep_for(std::chrono::milliseconds(20)); // for the first to be held up
+        make_readable(channels[1]);
+
+        EXPECT_TRUE(stops_serving(service, "foo", "/two"));
+        EXPECT_TRUE(stops_serving(service, "foo", "/one"));
+    }
+
+    EXPECT_TRUE(other_served_meanwhile);
+}
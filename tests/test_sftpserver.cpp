@@ -25,12 +25,14 @@
 #include <multipass/platform.h>
 #include <multipass/ssh/ssh_session.h>
 #include <multipass/sshfs_mount/sftp_server.h>
+#include <multipass/telemetry.h>
 
 #include <QDateTime>
 
 #include <multipass/format.h>
 #include <gmock/gmock.h>
 
+#include <map>
 #include <queue>
 
 namespace mp = multipass;
@@ -191,6 +193,27 @@ auto make_data(const std::string& in)
     return out;
 }
 
+// Fields of requests that libssh leaves unparsed, encoded the way they come over the wire
+std::string number_field(uint64_t value, int bytes)
+{
+    std::string out;
+    for (int i = bytes - 1; i >= 0; --i)
+        out.push_back(static_cast<char>(value >> (8 * i) & 0xff));
+    return out;
+}
+
+std::string string_field(const std::string& value)
+{
+    return number_field(value.size(), 4) + value;
+}
+
+auto make_complete_message(const std::string& payload)
+{
+    std::unique_ptr<ssh_buffer_struct, decltype(ssh_buffer_free)*> message{ssh_buffer_new(), ssh_buffer_free};
+    ssh_buffer_add_data(message.get(), payload.data(), payload.size());
+    return message;
+}
+
 bool content_match(const QString& path, const std::string& data)
 {
     auto content = mpt::load(path);
@@ -241,10 +264,37 @@ bool compare_permission(uint32_t ssh_permissions, const QFileInfo& file, Permiss
 
 TEST_F(SftpServer, throws_when_failed_to_init)
 {
-    REPLACE(sftp_server_init, [](auto...) { return SSH_ERROR; });
+    REPLACE(ssh_channel_read, [](auto...) { return SSH_ERROR; });
+    EXPECT_THROW(make_sftpserver(), std::runtime_error);
+}
+
+TEST_F(SftpServer, throws_when_the_client_does_not_start_with_init)
+{
+    REPLACE(ssh_channel_read, [](ssh_channel, void* dest, uint32_t count, int) {
+        const std::string open{"\0\0\0\x05\x03\0\0\0\x01", 9};
+        std::copy_n(open.begin(), std::min<std::string::size_type>(count, open.size()), static_cast<char*>(dest));
+        return static_cast<int>(std::min<std::string::size_type>(count, open.size()));
+    });
     EXPECT_THROW(make_sftpserver(), std::runtime_error);
 }
 
+TEST_F(SftpServer, advertises_the_extensions_it_answers)
+{
+    std::string written;
+    REPLACE(ssh_channel_write, [&written](ssh_channel, const void* data, uint32_t len) {
+        written.append(static_cast<const char*>(data), len);
+        return static_cast<int>(len);
+    });
+
+    auto sftp = make_sftpserver();
+
+    ASSERT_GT(written.size(), 9u);
+    EXPECT_EQ(written.substr(4, 5), std::string("\x02\0\0\0\x03", 5));
+    for (const auto& extension : {"posix-rename@openssh.com", "hardlink@openssh.com", "fsync@openssh.com",
+                                  "statvfs@openssh.com", "fstatvfs@openssh.com", "copy-data"})
+        EXPECT_THAT(written, HasSubstr(extension));
+}
+
 TEST_F(SftpServer, throws_when_sshfs_errors_on_start)
 {
     bool invoked{false};
@@ -299,6 +349,54 @@ TEST_F(SftpServer, sshfs_restarts_on_error)
     EXPECT_TRUE(invoked);
 }
 
+TEST_F(SftpServer, keeps_the_mount_while_sshfs_is_still_running)
+{
+    int sshfs_starts{0};
+    auto request_exec = [&sshfs_starts](ssh_channel, const char* raw_cmd) {
+        if (std::string{raw_cmd}.find("sudo sshfs") != std::string::npos)
+            ++sshfs_starts;
+        return SSH_OK;
+    };
+    REPLACE(ssh_channel_request_exec, request_exec);
+
+    auto sftp = make_sftpserver();
+
+    bool sshfs_running{true};
+    ssh_channel_callbacks callbacks{nullptr};
+    auto add_channel_cbs = [&callbacks](ssh_channel, ssh_channel_callbacks cb) {
+        callbacks = cb;
+        return SSH_OK;
+    };
+    auto event_do_poll = [&sshfs_running, &callbacks](auto...) {
+        if (sshfs_running)
+            return SSH_ERROR;
+        callbacks->channel_exit_status_function(nullptr, nullptr, 0, callbacks->userdata);
+        return SSH_OK;
+    };
+
+    auto msg = make_msg(SFTP_BAD_MESSAGE);
+    int num_calls{0};
+    auto get_client_msg = [&num_calls, &sshfs_running, &msg](auto...) -> sftp_client_message {
+        ++num_calls;
+        if (num_calls == 2)
+            return msg.get();
+        if (num_calls == 3)
+            sshfs_running = false;
+        return nullptr;
+    };
+
+    REPLACE(ssh_add_channel_callbacks, add_channel_cbs);
+    REPLACE(ssh_event_dopoll, event_do_poll);
+    REPLACE(ssh_channel_is_closed, [](auto...) { return 0; });
+    REPLACE(sftp_get_client_message, get_client_msg);
+    REPLACE(sftp_reply_status, [](auto...) { return SSH_OK; });
+
+    sftp.run();
+
+    EXPECT_THAT(num_calls, Eq(3));
+    EXPECT_THAT(sshfs_starts, Eq(1));
+}
+
 TEST_F(SftpServer, stops_after_a_null_message)
 {
     auto sftp = make_sftpserver();
@@ -344,6 +442,26 @@ TEST_F(SftpServer, handles_realpath)
     EXPECT_TRUE(invoked);
 }
 
+TEST_F(SftpServer, reports_ops_per_mount_once_stopped)
+{
+    mpt::TempFile file;
+    auto file_name = name_as_char_array(file.name().toStdString());
+
+    auto sftp = make_sftpserver(file.name().toStdString());
+    auto msg = make_msg(SFTP_REALPATH);
+    msg->filename = file_name.data();
+
+    REPLACE(sftp_reply_name, [](auto...) { return SSH_OK; });
+    REPLACE(sftp_get_client_message, make_msg_handler());
+
+    sftp.run();
+
+    const auto labels = fmt::format("{{mount=\"{}\",op=\"resolve\"}}", file.name());
+    const auto exposition = mp::Telemetry::instance().exposition();
+    EXPECT_THAT(exposition, HasSubstr(fmt::format("multipass_sftp_operations_total{} 1\n", labels)));
+    EXPECT_THAT(exposition, HasSubstr(fmt::format("multipass_sftp_operation_duration_seconds_count{} 1\n", labels)));
+}
+
 TEST_F(SftpServer, realpath_in_invalid_dir_fails)
 {
     mpt::TempDir temp_dir;
@@ -854,7 +972,56 @@ TEST_F(SftpServer, handles_readdir)
     EXPECT_THAT(eof_num_calls, Eq(1));
 
     std::vector<std::string> expected_entries = {".", "..", "test-dir-entry", "test-file"};
-    EXPECT_THAT(entries, ContainerEq(expected_entries));
+    EXPECT_THAT(entries, UnorderedElementsAreArray(expected_entries));
+}
+
+TEST_F(SftpServer, readdir_fills_replies_past_fifty_entries)
+{
+    mpt::TempDir temp_dir;
+    const auto num_files = 200;
+    for (auto i = 0; i < num_files; ++i)
+        mpt::make_file_with_content(temp_dir.path() + QString("/test-file-%1").arg(i));
+
+    auto sftp = make_sftpserver(temp_dir.path().toStdString());
+    auto open_dir_msg = make_msg(SFTP_OPENDIR);
+    auto dir_name = name_as_char_array(temp_dir.path().toStdString());
+    open_dir_msg->filename = dir_name.data();
+
+    auto readdir_msg = make_msg(SFTP_READDIR);
+    auto readdir_msg_final = make_msg(SFTP_READDIR);
+
+    void* id{nullptr};
+    auto handle_alloc = [&id](sftp_session, void* info) {
+        id = info;
+        return nullptr;
+    };
+
+    int eof_num_calls{0};
+    auto reply_status = make_reply_status(readdir_msg_final.get(), SSH_FX_EOF, eof_num_calls);
+
+    int num_entries{0}, num_replies{0};
+    auto reply_names_add = [&num_entries](auto...) {
+        ++num_entries;
+        return SSH_OK;
+    };
+    auto reply_names = [&num_replies](auto...) {
+        ++num_replies;
+        return SSH_OK;
+    };
+
+    REPLACE(sftp_reply_handle, [](auto...) { return SSH_OK; });
+    REPLACE(sftp_handle_alloc, handle_alloc);
+    REPLACE(sftp_handle, [&id](auto...) { return id; });
+    REPLACE(sftp_get_client_message, make_msg_handler());
+    REPLACE(sftp_reply_status, reply_status);
+    REPLACE(sftp_reply_names_add, reply_names_add);
+    REPLACE(sftp_reply_names, reply_names);
+
+    sftp.run();
+
+    EXPECT_THAT(eof_num_calls, Eq(1));
+    EXPECT_THAT(num_replies, Eq(1));
+    EXPECT_THAT(num_entries, Eq(num_files + 2)); // including . and ..
 }
 
 TEST_F(SftpServer, handles_readdir_attributes_preserved)
@@ -956,6 +1123,50 @@ TEST_F(SftpServer, handles_close)
     EXPECT_THAT(ok_num_calls, Eq(1));
 }
 
+TEST_F(SftpServer, refuses_handles_used_after_close)
+{
+    mpt::TempDir temp_dir;
+    auto file_name = temp_dir.path() + "/test-file";
+    mpt::make_file_with_content(file_name);
+
+    auto sftp = make_sftpserver(temp_dir.path().toStdString());
+    auto name = name_as_char_array(file_name.toStdString());
+    auto open_msg = make_msg(SFTP_OPEN);
+    open_msg->filename = name.data();
+    open_msg->flags |= SSH_FXF_READ;
+    auto close_msg = make_msg(SFTP_CLOSE);
+    auto reopen_msg = make_msg(SFTP_OPEN);
+    reopen_msg->filename = name.data();
+    reopen_msg->flags |= SSH_FXF_READ;
+    auto read_msg = make_msg(SFTP_READ);
+    read_msg->len = 10;
+
+    std::vector<void*> ids;
+    auto handle_alloc = [&ids](sftp_session, void* info) {
+        ids.push_back(info);
+        return nullptr;
+    };
+
+    std::vector<uint32_t> statuses;
+    auto reply_status = [&statuses](sftp_client_message, uint32_t status, const char*) {
+        statuses.push_back(status);
+        return SSH_OK;
+    };
+
+    REPLACE(sftp_reply_handle, [](auto...) { return SSH_OK; });
+    REPLACE(sftp_handle_alloc, handle_alloc);
+    REPLACE(sftp_handle, [&ids](auto...) { return ids.front(); });
+    REPLACE(sftp_get_client_message, make_msg_handler());
+    REPLACE(sftp_reply_status, reply_status);
+    REPLACE(sftp_handle_remove, [](auto...) {});
+
+    sftp.run();
+
+    ASSERT_THAT(ids.size(), Eq(2u));
+    EXPECT_THAT(ids[0], Ne(ids[1]));
+    EXPECT_THAT(statuses, ElementsAre(SSH_FX_OK, SSH_FX_BAD_MESSAGE));
+}
+
 TEST_F(SftpServer, handles_fstat)
 {
     mpt::TempDir temp_dir;
@@ -1141,22 +1352,34 @@ TEST_F(SftpServer, handles_writes)
     EXPECT_TRUE(content_match(file_name, "The answer is always 42"));
 }
 
-TEST_F(SftpServer, handles_reads)
+TEST_F(SftpServer, coalesced_writes_are_visible_to_following_read)
 {
     mpt::TempDir temp_dir;
     auto file_name = temp_dir.path() + "/test-file";
-    auto size = mpt::make_file_with_content(file_name);
 
     auto sftp = make_sftpserver(temp_dir.path().toStdString());
     auto open_msg = make_msg(SFTP_OPEN);
     auto name = name_as_char_array(file_name.toStdString());
+    sftp_attributes_struct attr{};
+    attr.permissions = 0777;
+
     open_msg->filename = name.data();
-    open_msg->flags |= SSH_FXF_READ;
+    open_msg->attr = &attr;
+    open_msg->flags |= SSH_FXF_READ | SSH_FXF_WRITE | SSH_FXF_TRUNC;
+
+    auto write_msg1 = make_msg(SFTP_WRITE);
+    auto data1 = make_data("The answer is ");
+    write_msg1->data = data1.get();
+    write_msg1->offset = 0;
+
+    auto write_msg2 = make_msg(SFTP_WRITE);
+    auto data2 = make_data("always 42");
+    write_msg2->data = data2.get();
+    write_msg2->offset = ssh_string_len(data1.get());
 
     auto read_msg = make_msg(SFTP_READ);
-    read_msg->offset = 10;
-    const int expected_size = size - read_msg->offset;
-    read_msg->len = expected_size;
+    read_msg->offset = 0;
+    read_msg->len = 100;
 
     void* id{nullptr};
     auto handle_alloc = [&id](sftp_session, void* info) {
@@ -1164,14 +1387,9 @@ TEST_F(SftpServer, handles_reads)
         return nullptr;
     };
 
-    int num_calls{0};
-    auto reply_data = [&num_calls, &read_msg](sftp_client_message msg, const void* data, int len) {
-        EXPECT_THAT(len, Gt(0));
-        EXPECT_THAT(msg, Eq(read_msg.get()));
-
-        std::string data_read{reinterpret_cast<const char*>(data), static_cast<std::string::size_type>(len)};
-        EXPECT_THAT(data_read, StrEq("test file"));
-        ++num_calls;
+    std::string data_read;
+    auto reply_data = [&data_read](sftp_client_message, const void* data, int len) {
+        data_read.assign(reinterpret_cast<const char*>(data), static_cast<std::string::size_type>(len));
         return SSH_OK;
     };
 
@@ -1179,99 +1397,616 @@ TEST_F(SftpServer, handles_reads)
     REPLACE(sftp_handle_alloc, handle_alloc);
     REPLACE(sftp_handle, [&id](auto...) { return id; });
     REPLACE(sftp_get_client_message, make_msg_handler());
+    REPLACE(sftp_reply_status, [](auto...) { return SSH_OK; });
     REPLACE(sftp_reply_data, reply_data);
 
     sftp.run();
 
-    ASSERT_THAT(num_calls, Eq(1));
+    EXPECT_THAT(data_read, StrEq("The answer is always 42"));
 }
 
-TEST_F(SftpServer, handle_extended_link)
+TEST_F(SftpServer, coalesced_writes_are_visible_to_following_pipelined_stat)
 {
     mpt::TempDir temp_dir;
     auto file_name = temp_dir.path() + "/test-file";
-    auto link_name = temp_dir.path() + "/test-link";
-    mpt::make_file_with_content(file_name);
 
     auto sftp = make_sftpserver(temp_dir.path().toStdString());
-    auto msg = make_msg(SFTP_EXTENDED);
-    auto submessage = name_as_char_array("hardlink@openssh.com");
-    msg->submessage = submessage.data();
+    sftp.enable_pipelining(2);
+    auto open_msg = make_msg(SFTP_OPEN);
     auto name = name_as_char_array(file_name.toStdString());
-    msg->filename = name.data();
+    sftp_attributes_struct attr{};
+    attr.permissions = 0777;
 
-    auto target_name = name_as_char_array(link_name.toStdString());
-    REPLACE(sftp_client_message_get_data, [&target_name](auto...) { return target_name.data(); });
+    open_msg->filename = name.data();
+    open_msg->attr = &attr;
+    open_msg->flags |= SSH_FXF_READ | SSH_FXF_WRITE | SSH_FXF_TRUNC;
 
-    int num_calls{0};
-    auto reply_status = make_reply_status(msg.get(), SSH_FX_OK, num_calls);
-    REPLACE(sftp_reply_status, reply_status);
+    auto write_msg = make_msg(SFTP_WRITE);
+    auto data = make_data("The answer is always 42");
+    write_msg->data = data.get();
+    write_msg->offset = 0;
+
+    auto stat_msg = make_msg(SFTP_STAT);
+    stat_msg->filename = name.data();
+
+    void* id{nullptr};
+    auto handle_alloc = [&id](sftp_session, void* info) {
+        id = info;
+        return nullptr;
+    };
+
+    std::vector<uint64_t> sizes;
+    auto reply_attr = [&sizes](sftp_client_message, sftp_attributes attr) {
+        sizes.push_back(attr->size);
+        return SSH_OK;
+    };
+
+    REPLACE(sftp_reply_handle, [](auto...) { return SSH_OK; });
+    REPLACE(sftp_handle_alloc, handle_alloc);
+    REPLACE(sftp_handle, [&id](auto...) { return id; });
     REPLACE(sftp_get_client_message, make_msg_handler());
+    REPLACE(sftp_reply_status, [](auto...) { return SSH_OK; });
+    REPLACE(sftp_reply_attr, reply_attr);
 
     sftp.run();
 
-    ASSERT_THAT(num_calls, Eq(1));
-
-    QFileInfo info(link_name);
-    EXPECT_TRUE(QFile::exists(link_name));
-    EXPECT_TRUE(content_match(link_name, "this is a test file"));
+    EXPECT_THAT(sizes, ElementsAre(ssh_string_len(data.get())));
 }
 
-TEST_F(SftpServer, extended_link_in_invalid_dir_fails)
+TEST_F(SftpServer, written_back_writes_are_visible_to_following_read)
 {
     mpt::TempDir temp_dir;
+    auto file_name = temp_dir.path() + "/test-file";
 
     auto sftp = make_sftpserver(temp_dir.path().toStdString());
-    auto msg = make_msg(SFTP_EXTENDED);
-    auto submessage = name_as_char_array("hardlink@openssh.com");
-    msg->submessage = submessage.data();
-    auto invalid_path = name_as_char_array("bar");
-    msg->filename = invalid_path.data();
-
-    auto invalid_link = name_as_char_array("/foo/baz");
-    REPLACE(sftp_client_message_get_data, [&invalid_link](auto...) { return invalid_link.data(); });
+    sftp.enable_write_back();
+    auto open_msg = make_msg(SFTP_OPEN);
+    auto name = name_as_char_array(file_name.toStdString());
+    sftp_attributes_struct attr{};
+    attr.permissions = 0777;
 
-    int perm_denied_num_calls{0};
-    auto reply_status = make_reply_status(msg.get(), SSH_FX_PERMISSION_DENIED, perm_denied_num_calls);
+    open_msg->filename = name.data();
+    open_msg->attr = &attr;
+    open_msg->flags |= SSH_FXF_READ | SSH_FXF_WRITE | SSH_FXF_TRUNC;
 
-    REPLACE(sftp_get_client_message, make_msg_handler());
-    REPLACE(sftp_reply_status, reply_status);
+    // Enough to be handed to the writer before the next write comes in
+    auto write_msg1 = make_msg(SFTP_WRITE);
+    auto data1 = make_data(std::string(2 * 1024 * 1024, 'x'));
+    write_msg1->data = data1.get();
+    write_msg1->offset = 0;
 
-    sftp.run();
+    auto write_msg2 = make_msg(SFTP_WRITE);
+    auto data2 = make_data("always 42");
+    write_msg2->data = data2.get();
+    write_msg2->offset = ssh_string_len(data1.get());
 
-    EXPECT_THAT(perm_denied_num_calls, Eq(1));
-}
+    auto read_msg = make_msg(SFTP_READ);
+    read_msg->offset = ssh_string_len(data1.get()) - 4;
+    read_msg->len = 100;
 
-TEST_F(SftpServer, handle_extended_rename)
-{
-    mpt::TempDir temp_dir;
-    auto old_name = temp_dir.path() + "/test-file";
-    auto new_name = temp_dir.path() + "/test-renamed";
-    mpt::make_file_with_content(old_name);
+    void* id{nullptr};
+    auto handle_alloc = [&id](sftp_session, void* info) {
+        id = info;
+        return nullptr;
+    };
 
-    auto sftp = make_sftpserver(temp_dir.path().toStdString());
-    auto msg = make_msg(SFTP_EXTENDED);
-    auto submessage = name_as_char_array("posix-rename@openssh.com");
-    msg->submessage = submessage.data();
-    auto name = name_as_char_array(old_name.toStdString());
-    msg->filename = name.data();
+    std::string data_read;
+    auto reply_data = [&data_read](sftp_client_message, const void* data, int len) {
+        data_read.assign(reinterpret_cast<const char*>(data), static_cast<std::string::size_type>(len));
+        return SSH_OK;
+    };
 
-    auto target_name = name_as_char_array(new_name.toStdString());
-    REPLACE(sftp_client_message_get_data, [&target_name](auto...) { return target_name.data(); });
+    std::vector<int> write_statuses;
+    auto reply_status = [&write_statuses](sftp_client_message msg, uint32_t status, const char*) {
+        if (msg->type == SFTP_WRITE)
+            write_statuses.push_back(status);
+        return SSH_OK;
+    };
 
-    int num_calls{0};
-    auto reply_status = make_reply_status(msg.get(), SSH_FX_OK, num_calls);
-    REPLACE(sftp_reply_status, reply_status);
+    REPLACE(sftp_reply_handle, [](auto...) { return SSH_OK; });
+    REPLACE(sftp_handle_alloc, handle_alloc);
+    REPLACE(sftp_handle, [&id](auto...) { return id; });
     REPLACE(sftp_get_client_message, make_msg_handler());
+    REPLACE(sftp_reply_status, reply_status);
+    REPLACE(sftp_reply_data, reply_data);
 
     sftp.run();
 
-    ASSERT_THAT(num_calls, Eq(1));
-    EXPECT_TRUE(QFile::exists(new_name));
-    EXPECT_FALSE(QFile::exists(old_name));
+    EXPECT_THAT(write_statuses, ElementsAre(SSH_FX_OK, SSH_FX_OK));
+    EXPECT_THAT(data_read, StrEq("xxxxalways 42"));
 }
 
-TEST_F(SftpServer, extended_rename_in_invalid_dir_fails)
+TEST_F(SftpServer, handle_extended_fsync)
+{
+    mpt::TempDir temp_dir;
+    auto file_name = temp_dir.path() + "/test-file";
+
+    auto sftp = make_sftpserver(temp_dir.path().toStdString());
+    auto open_msg = make_msg(SFTP_OPEN);
+    auto name = name_as_char_array(file_name.toStdString());
+    sftp_attributes_struct attr{};
+    attr.permissions = 0777;
+
+    open_msg->filename = name.data();
+    open_msg->attr = &attr;
+    open_msg->flags |= SSH_FXF_WRITE | SSH_FXF_TRUNC;
+
+    auto write_msg = make_msg(SFTP_WRITE);
+    auto data = make_data("The answer is always 42");
+    write_msg->data = data.get();
+    write_msg->offset = 0;
+
+    auto fsync_msg = make_msg(SFTP_EXTENDED);
+    auto submessage = name_as_char_array("fsync@openssh.com");
+    fsync_msg->submessage = submessage.data();
+
+    void* id{nullptr};
+    auto handle_alloc = [&id](sftp_session, void* info) {
+        id = info;
+        return nullptr;
+    };
+
+    int num_calls{0};
+    auto reply_status = [&num_calls, &fsync_msg](sftp_client_message msg, uint32_t status, const char*) {
+        if (msg == fsync_msg.get())
+        {
+            EXPECT_THAT(status, Eq(SSH_FX_OK));
+            ++num_calls;
+        }
+        return SSH_OK;
+    };
+
+    REPLACE(sftp_reply_handle, [](auto...) { return SSH_OK; });
+    REPLACE(sftp_handle_alloc, handle_alloc);
+    REPLACE(sftp_handle, [&id](auto...) { return id; });
+    REPLACE(sftp_get_client_message, make_msg_handler());
+    REPLACE(sftp_reply_status, reply_status);
+
+    sftp.run();
+
+    ASSERT_THAT(num_calls, Eq(1));
+    EXPECT_TRUE(content_match(file_name, "The answer is always 42"));
+}
+
+TEST_F(SftpServer, handles_reads)
+{
+    mpt::TempDir temp_dir;
+    auto file_name = temp_dir.path() + "/test-file";
+    auto size = mpt::make_file_with_content(file_name);
+
+    auto sftp = make_sftpserver(temp_dir.path().toStdString());
+    auto open_msg = make_msg(SFTP_OPEN);
+    auto name = name_as_char_array(file_name.toStdString());
+    open_msg->filename = name.data();
+    open_msg->flags |= SSH_FXF_READ;
+
+    auto read_msg = make_msg(SFTP_READ);
+    read_msg->offset = 10;
+    const int expected_size = size - read_msg->offset;
+    read_msg->len = expected_size;
+
+    void* id{nullptr};
+    auto handle_alloc = [&id](sftp_session, void* info) {
+        id = info;
+        return nullptr;
+    };
+
+    int num_calls{0};
+    auto reply_data = [&num_calls, &read_msg](sftp_client_message msg, const void* data, int len) {
+        EXPECT_THAT(len, Gt(0));
+        EXPECT_THAT(msg, Eq(read_msg.get()));
+
+        std::string data_read{reinterpret_cast<const char*>(data), static_cast<std::string::size_type>(len)};
+        EXPECT_THAT(data_read, StrEq("test file"));
+        ++num_calls;
+        return SSH_OK;
+    };
+
+    REPLACE(sftp_reply_handle, [](auto...) { return SSH_OK; });
+    REPLACE(sftp_handle_alloc, handle_alloc);
+    REPLACE(sftp_handle, [&id](auto...) { return id; });
+    REPLACE(sftp_get_client_message, make_msg_handler());
+    REPLACE(sftp_reply_data, reply_data);
+
+    sftp.run();
+
+    ASSERT_THAT(num_calls, Eq(1));
+}
+
+TEST_F(SftpServer, sequential_reads_read_ahead_and_return_the_file_in_order)
+{
+    mpt::TempDir temp_dir;
+    auto file_name = temp_dir.path() + "/test-file";
+    std::string content;
+    for (auto i = 0; i < 6; ++i)
+        content += std::string(100 * 1024, static_cast<char>('a' + i));
+    mpt::make_file_with_content(file_name, content);
+
+    auto sftp = make_sftpserver(temp_dir.path().toStdString());
+    auto open_msg = make_msg(SFTP_OPEN);
+    auto name = name_as_char_array(file_name.toStdString());
+    open_msg->filename = name.data();
+    open_msg->flags |= SSH_FXF_READ;
+
+    std::vector<std::unique_ptr<sftp_client_message_struct>> read_msgs;
+    for (auto i = 0; i < 6; ++i)
+    {
+        read_msgs.push_back(make_msg(SFTP_READ));
+        read_msgs.back()->offset = i * 100 * 1024;
+        read_msgs.back()->len = 100 * 1024;
+    }
+
+    void* id{nullptr};
+    auto handle_alloc = [&id](sftp_session, void* info) {
+        id = info;
+        return nullptr;
+    };
+
+    std::string data_read;
+    auto reply_data = [&data_read](sftp_client_message, const void* data, int len) {
+        data_read.append(reinterpret_cast<const char*>(data), static_cast<std::string::size_type>(len));
+        return SSH_OK;
+    };
+
+    REPLACE(sftp_reply_handle, [](auto...) { return SSH_OK; });
+    REPLACE(sftp_handle_alloc, handle_alloc);
+    REPLACE(sftp_handle, [&id](auto...) { return id; });
+    REPLACE(sftp_get_client_message, make_msg_handler());
+    REPLACE(sftp_reply_data, reply_data);
+
+    sftp.run();
+
+    EXPECT_EQ(data_read, content);
+}
+
+TEST_F(SftpServer, reads_through_the_ring_are_all_replied_with_their_own_data)
+{
+    mpt::TempDir temp_dir;
+    auto file_name = temp_dir.path() + "/test-file";
+    std::string content;
+    for (auto i = 0; i < 6; ++i)
+        content += std::string(100 * 1024, static_cast<char>('a' + i));
+    mpt::make_file_with_content(file_name, content);
+
+    auto sftp = make_sftpserver(temp_dir.path().toStdString());
+    sftp.enable_read_ring(4); // served one at a time where the kernel offers no io_uring
+    auto open_msg = make_msg(SFTP_OPEN);
+    auto name = name_as_char_array(file_name.toStdString());
+    open_msg->filename = name.data();
+    open_msg->flags |= SSH_FXF_READ;
+
+    std::vector<std::unique_ptr<sftp_client_message_struct>> read_msgs;
+    for (auto i = 0; i < 7; ++i)
+    {
+        read_msgs.push_back(make_msg(SFTP_READ));
+        read_msgs.back()->offset = i * 100 * 1024;
+        read_msgs.back()->len = 100 * 1024;
+    }
+
+    void* id{nullptr};
+    auto handle_alloc = [&id](sftp_session, void* info) {
+        id = info;
+        return nullptr;
+    };
+
+    std::map<uint64_t, std::string> data_read;
+    auto reply_data = [&data_read](sftp_client_message msg, const void* data, int len) {
+        data_read[msg->offset].assign(reinterpret_cast<const char*>(data), static_cast<std::string::size_type>(len));
+        return SSH_OK;
+    };
+
+    std::vector<uint64_t> eof_offsets;
+    auto reply_status = [&eof_offsets](sftp_client_message msg, uint32_t status, const char*) {
+        if (status == SSH_FX_EOF)
+            eof_offsets.push_back(msg->offset);
+        return SSH_OK;
+    };
+
+    REPLACE(ssh_channel_poll_timeout, [](auto...) { return 1; });
+    REPLACE(sftp_reply_handle, [](auto...) { return SSH_OK; });
+    REPLACE(sftp_handle_alloc, handle_alloc);
+    REPLACE(sftp_handle, [&id](auto...) { return id; });
+    REPLACE(sftp_get_client_message, make_msg_handler());
+    REPLACE(sftp_reply_data, reply_data);
+    REPLACE(sftp_reply_status, reply_status);
+
+    sftp.run();
+
+    ASSERT_EQ(data_read.size(), 6u);
+    for (auto i = 0; i < 6; ++i)
+        EXPECT_EQ(data_read[i * 100 * 1024], content.substr(i * 100 * 1024, 100 * 1024));
+    EXPECT_THAT(eof_offsets, ElementsAre(6 * 100 * 1024));
+}
+
+TEST_F(SftpServer, handles_reads_larger_than_64k_in_one_reply)
+{
+    mpt::TempDir temp_dir;
+    auto file_name = temp_dir.path() + "/test-file";
+    const std::string content(128 * 1024, 'x');
+    mpt::make_file_with_content(file_name, content);
+
+    auto sftp = make_sftpserver(temp_dir.path().toStdString());
+    auto open_msg = make_msg(SFTP_OPEN);
+    auto name = name_as_char_array(file_name.toStdString());
+    open_msg->filename = name.data();
+    open_msg->flags |= SSH_FXF_READ;
+
+    auto read_msg = make_msg(SFTP_READ);
+    read_msg->offset = 0;
+    read_msg->len = content.size();
+
+    void* id{nullptr};
+    auto handle_alloc = [&id](sftp_session, void* info) {
+        id = info;
+        return nullptr;
+    };
+
+    int num_calls{0};
+    auto reply_data = [&num_calls, &content](sftp_client_message, const void* data, int len) {
+        std::string data_read{reinterpret_cast<const char*>(data), static_cast<std::string::size_type>(len)};
+        EXPECT_EQ(data_read, content);
+        ++num_calls;
+        return SSH_OK;
+    };
+
+    REPLACE(sftp_reply_handle, [](auto...) { return SSH_OK; });
+    REPLACE(sftp_handle_alloc, handle_alloc);
+    REPLACE(sftp_handle, [&id](auto...) { return id; });
+    REPLACE(sftp_get_client_message, make_msg_handler());
+    REPLACE(sftp_reply_data, reply_data);
+
+    sftp.run();
+
+    ASSERT_THAT(num_calls, Eq(1));
+}
+
+TEST_F(SftpServer, reads_large_files_that_shrink_while_open)
+{
+    mpt::TempDir temp_dir;
+    auto file_name = temp_dir.path() + "/test-file";
+    const auto half = 2 * 1024 * 1024;
+    mpt::make_file_with_content(file_name, std::string(half, 'a') + std::string(half, 'b'));
+
+    auto sftp = make_sftpserver(temp_dir.path().toStdString());
+    auto open_msg = make_msg(SFTP_OPEN);
+    auto name = name_as_char_array(file_name.toStdString());
+    open_msg->filename = name.data();
+    open_msg->flags |= SSH_FXF_READ;
+
+    auto tail_read_msg = make_msg(SFTP_READ);
+    tail_read_msg->offset = 2 * half - 10;
+    tail_read_msg->len = 100;
+
+    auto read_msg = make_msg(SFTP_READ);
+    read_msg->offset = half + 10;
+    read_msg->len = 100;
+
+    void* id{nullptr};
+    auto handle_alloc = [&id](sftp_session, void* info) {
+        id = info;
+        return nullptr;
+    };
+
+    std::vector<std::string> replies;
+    auto reply_data = [&replies, &file_name, half](sftp_client_message, const void* data, int len) {
+        replies.emplace_back(reinterpret_cast<const char*>(data), static_cast<std::string::size_type>(len));
+        EXPECT_TRUE(QFile::resize(file_name, half));
+        return SSH_OK;
+    };
+
+    int eof_num_calls{0};
+    auto reply_status = make_reply_status(read_msg.get(), SSH_FX_EOF, eof_num_calls);
+
+    REPLACE(sftp_reply_handle, [](auto...) { return SSH_OK; });
+    REPLACE(sftp_handle_alloc, handle_alloc);
+    REPLACE(sftp_handle, [&id](auto...) { return id; });
+    REPLACE(sftp_get_client_message, make_msg_handler());
+    REPLACE(sftp_reply_data, reply_data);
+    REPLACE(sftp_reply_status, reply_status);
+
+    sftp.run();
+
+    EXPECT_THAT(replies, ElementsAre(std::string(10, 'b')));
+    EXPECT_THAT(eof_num_calls, Eq(1));
+}
+
+TEST_F(SftpServer, handle_extended_link)
+{
+    mpt::TempDir temp_dir;
+    auto file_name = temp_dir.path() + "/test-file";
+    auto link_name = temp_dir.path() + "/test-link";
+    mpt::make_file_with_content(file_name);
+
+    auto sftp = make_sftpserver(temp_dir.path().toStdString());
+    auto msg = make_msg(SFTP_EXTENDED);
+    auto submessage = name_as_char_array("hardlink@openssh.com");
+    msg->submessage = submessage.data();
+    auto name = name_as_char_array(file_name.toStdString());
+    msg->filename = name.data();
+
+    auto target_name = name_as_char_array(link_name.toStdString());
+    REPLACE(sftp_client_message_get_data, [&target_name](auto...) { return target_name.data(); });
+
+    int num_calls{0};
+    auto reply_status = make_reply_status(msg.get(), SSH_FX_OK, num_calls);
+    REPLACE(sftp_reply_status, reply_status);
+    REPLACE(sftp_get_client_message, make_msg_handler());
+
+    sftp.run();
+
+    ASSERT_THAT(num_calls, Eq(1));
+
+    QFileInfo info(link_name);
+    EXPECT_TRUE(QFile::exists(link_name));
+    EXPECT_TRUE(content_match(link_name, "this is a test file"));
+}
+
+TEST_F(SftpServer, extended_link_in_invalid_dir_fails)
+{
+    mpt::TempDir temp_dir;
+
+    auto sftp = make_sftpserver(temp_dir.path().toStdString());
+    auto msg = make_msg(SFTP_EXTENDED);
+    auto submessage = name_as_char_array("hardlink@openssh.com");
+    msg->submessage = submessage.data();
+    auto invalid_path = name_as_char_array("bar");
+    msg->filename = invalid_path.data();
+
+    auto invalid_link = name_as_char_array("/foo/baz");
+    REPLACE(sftp_client_message_get_data, [&invalid_link](auto...) { return invalid_link.data(); });
+
+    int perm_denied_num_calls{0};
+    auto reply_status = make_reply_status(msg.get(), SSH_FX_PERMISSION_DENIED, perm_denied_num_calls);
+
+    REPLACE(sftp_get_client_message, make_msg_handler());
+    REPLACE(sftp_reply_status, reply_status);
+
+    sftp.run();
+
+    EXPECT_THAT(perm_denied_num_calls, Eq(1));
+}
+
+TEST_F(SftpServer, handle_extended_copy_data)
+{
+    mpt::TempDir temp_dir;
+    auto from_name = temp_dir.path() + "/test-file";
+    auto to_name = temp_dir.path() + "/test-copy";
+    mpt::make_file_with_content(from_name, "The answer is always 42");
+
+    auto sftp = make_sftpserver(temp_dir.path().toStdString());
+    sftp_attributes_struct attr{};
+    attr.permissions = 0777;
+
+    auto from = name_as_char_array(from_name.toStdString());
+    auto open_from_msg = make_msg(SFTP_OPEN);
+    open_from_msg->filename = from.data();
+    open_from_msg->attr = &attr;
+    open_from_msg->flags |= SSH_FXF_READ;
+
+    auto to = name_as_char_array(to_name.toStdString());
+    auto open_to_msg = make_msg(SFTP_OPEN);
+    open_to_msg->filename = to.data();
+    open_to_msg->attr = &attr;
+    open_to_msg->flags |= SSH_FXF_WRITE | SSH_FXF_CREAT | SSH_FXF_TRUNC;
+
+    // Handles "0" and "1" name the files in the order they were opened
+    auto complete_message = make_complete_message(number_field(7, 4) + string_field("copy-data") + string_field("0") +
+                                                  number_field(4, 8) + number_field(6, 8) + string_field("1") +
+                                                  number_field(0, 8));
+
+    auto copy_msg = make_msg(SFTP_EXTENDED);
+    auto submessage = name_as_char_array("copy-data");
+    copy_msg->submessage = submessage.data();
+    copy_msg->complete_message = complete_message.get();
+
+    std::vector<void*> ids;
+    auto handle_alloc = [&ids](sftp_session, void* info) {
+        ids.push_back(info);
+        return nullptr;
+    };
+    auto handle = [&ids](sftp_session, ssh_string handle) {
+        return ids.at(std::stoul(std::string(ssh_string_get_char(handle), ssh_string_len(handle))));
+    };
+
+    int num_calls{0};
+    auto reply_status = make_reply_status(copy_msg.get(), SSH_FX_OK, num_calls);
+
+    REPLACE(sftp_reply_handle, [](auto...) { return SSH_OK; });
+    REPLACE(sftp_handle_alloc, handle_alloc);
+    REPLACE(sftp_handle, handle);
+    REPLACE(sftp_get_client_message, make_msg_handler());
+    REPLACE(sftp_reply_status, reply_status);
+
+    sftp.run();
+
+    ASSERT_THAT(num_calls, Eq(1));
+    EXPECT_TRUE(content_match(to_name, "answer"));
+}
+
+TEST_F(SftpServer, handle_extended_statvfs)
+{
+    mpt::TempDir temp_dir;
+
+    auto sftp = make_sftpserver(temp_dir.path().toStdString());
+    auto msg = make_msg(SFTP_EXTENDED);
+    auto submessage = name_as_char_array("statvfs@openssh.com");
+    msg->submessage = submessage.data();
+    msg->id = 7;
+    auto complete_message = make_complete_message(number_field(7, 4) + string_field("statvfs@openssh.com") +
+                                                  string_field(temp_dir.path().toStdString()));
+    msg->complete_message = complete_message.get();
+
+    std::string written;
+    auto channel_write = [&written](ssh_channel, const void* data, uint32_t len) {
+        written.append(static_cast<const char*>(data), len);
+        return static_cast<int>(len);
+    };
+
+    REPLACE(sftp_get_client_message, make_msg_handler());
+    REPLACE(ssh_channel_write, channel_write);
+
+    sftp.run();
+
+    // Length, type and id, then eleven 64-bit fields starting with the block size
+    ASSERT_THAT(written.size(), Eq(4u + 1u + 4u + 11u * 8u));
+    const auto header = number_field(written.size() - 4, 4) + number_field(201, 1) + number_field(7, 4);
+    EXPECT_THAT(written.substr(0, 9), Eq(header));
+    EXPECT_THAT(written.substr(9, 8), Ne(number_field(0, 8)));
+}
+
+TEST_F(SftpServer, extended_statvfs_outside_the_mount_fails)
+{
+    mpt::TempDir temp_dir;
+
+    auto sftp = make_sftpserver(temp_dir.path().toStdString());
+    auto msg = make_msg(SFTP_EXTENDED);
+    auto submessage = name_as_char_array("statvfs@openssh.com");
+    msg->submessage = submessage.data();
+    auto complete_message = make_complete_message(number_field(7, 4) + string_field("statvfs@openssh.com") +
+                                                  string_field("/foo"));
+    msg->complete_message = complete_message.get();
+
+    int perm_denied_num_calls{0};
+    auto reply_status = make_reply_status(msg.get(), SSH_FX_PERMISSION_DENIED, perm_denied_num_calls);
+
+    REPLACE(sftp_get_client_message, make_msg_handler());
+    REPLACE(sftp_reply_status, reply_status);
+
+    sftp.run();
+
+    EXPECT_THAT(perm_denied_num_calls, Eq(1));
+}
+
+TEST_F(SftpServer, handle_extended_rename)
+{
+    mpt::TempDir temp_dir;
+    auto old_name = temp_dir.path() + "/test-file";
+    auto new_name = temp_dir.path() + "/test-renamed";
+    mpt::make_file_with_content(old_name);
+
+    auto sftp = make_sftpserver(temp_dir.path().toStdString());
+    auto msg = make_msg(SFTP_EXTENDED);
+    auto submessage = name_as_char_array("posix-rename@openssh.com");
+    msg->submessage = submessage.data();
+    auto name = name_as_char_array(old_name.toStdString());
+    msg->filename = name.data();
+
+    auto target_name = name_as_char_array(new_name.toStdString());
+    REPLACE(sftp_client_message_get_data, [&target_name](auto...) { return target_name.data(); });
+
+    int num_calls{0};
+    auto reply_status = make_reply_status(msg.get(), SSH_FX_OK, num_calls);
+    REPLACE(sftp_reply_status, reply_status);
+    REPLACE(sftp_get_client_message, make_msg_handler());
+
+    sftp.run();
+
+    ASSERT_THAT(num_calls, Eq(1));
+    EXPECT_TRUE(QFile::exists(new_name));
+    EXPECT_FALSE(QFile::exists(old_name));
+}
+
+TEST_F(SftpServer, extended_rename_in_invalid_dir_fails)
 {
     mpt::TempDir temp_dir;
 
@@ -1351,6 +2086,291 @@ TEST_P(Stat, handles)
     EXPECT_THAT(num_calls, Eq(1));
 }
 
+TEST_F(SftpServer, stat_through_a_dangling_link_finds_no_such_file)
+{
+    mpt::TempDir temp_dir;
+    auto link_name = temp_dir.path() + "/test-link";
+    auto missing_name = temp_dir.path() + "/missing";
+    ASSERT_TRUE(mp::platform::symlink(missing_name.toStdString().c_str(), link_name.toStdString().c_str(), false));
+
+    auto sftp = make_sftpserver(temp_dir.path().toStdString());
+    auto name = name_as_char_array(link_name.toStdString());
+    auto stat_msg = make_msg(SFTP_STAT);
+    stat_msg->filename = name.data();
+    auto lstat_msg = make_msg(SFTP_LSTAT);
+    lstat_msg->filename = name.data();
+
+    int failures{0};
+    auto reply_status = [&failures, &stat_msg](sftp_client_message msg, uint32_t status, const char*) {
+        EXPECT_THAT(msg, Eq(stat_msg.get()));
+        EXPECT_THAT(status, Eq(SSH_FX_NO_SUCH_FILE));
+        ++failures;
+        return SSH_OK;
+    };
+
+    int attrs{0};
+    auto reply_attr = [&attrs, &lstat_msg](sftp_client_message msg, sftp_attributes attr) {
+        EXPECT_THAT(msg, Eq(lstat_msg.get()));
+        EXPECT_TRUE(S_ISLNK(attr->permissions));
+        ++attrs;
+        return SSH_OK;
+    };
+
+    REPLACE(sftp_get_client_message, make_msg_handler());
+    REPLACE(sftp_reply_status, reply_status);
+    REPLACE(sftp_reply_attr, reply_attr);
+
+    sftp.run();
+
+    EXPECT_EQ(failures, 1);
+    EXPECT_EQ(attrs, 1);
+}
+
+TEST_F(SftpServer, cached_stat_reflects_host_changes)
+{
+    mpt::TempDir temp_dir;
+    auto file_name = temp_dir.path() + "/test-file";
+    mpt::make_file_with_content(file_name, "short");
+
+    auto sftp = make_sftpserver(temp_dir.path().toStdString());
+    auto name = name_as_char_array(file_name.toStdString());
+    auto stat_msg1 = make_msg(SFTP_STAT);
+    stat_msg1->filename = name.data();
+    auto stat_msg2 = make_msg(SFTP_STAT);
+    stat_msg2->filename = name.data();
+
+    int num_msgs{0};
+    auto msg_handler = make_msg_handler();
+    auto get_client_msg = [&num_msgs, &msg_handler, &file_name](auto... args) {
+        if (num_msgs++ == 1)
+        {
+            QFile file{file_name};
+            file.open(QFile::Append);
+            file.write(" and now longer");
+        }
+        return msg_handler(args...);
+    };
+
+    std::vector<uint64_t> sizes;
+    auto reply_attr = [&sizes](sftp_client_message, sftp_attributes attr) {
+        sizes.push_back(attr->size);
+        return SSH_OK;
+    };
+
+    REPLACE(sftp_get_client_message, get_client_msg);
+    REPLACE(sftp_reply_attr, reply_attr);
+
+    sftp.run();
+
+    EXPECT_THAT(sizes, ElementsAre(5u, 20u));
+}
+
+TEST_F(SftpServer, stat_is_not_cached_when_out_of_inotify_watches)
+{
+    mpt::TempDir temp_dir;
+    auto file_name = temp_dir.path() + "/test-file";
+    mpt::make_file_with_content(file_name, "short");
+
+    auto sftp = make_sftpserver(temp_dir.path().toStdString());
+    auto name = name_as_char_array(file_name.toStdString());
+    auto stat_msg1 = make_msg(SFTP_STAT);
+    stat_msg1->filename = name.data();
+    auto stat_msg2 = make_msg(SFTP_STAT);
+    stat_msg2->filename = name.data();
+
+    int num_msgs{0};
+    auto msg_handler = make_msg_handler();
+    auto get_client_msg = [&num_msgs, &msg_handler, &file_name](auto... args) {
+        if (num_msgs++ == 1)
+        {
+            QFile file{file_name};
+            file.open(QFile::Append);
+            file.write(" and now longer");
+        }
+        return msg_handler(args...);
+    };
+
+    std::vector<uint64_t> sizes;
+    auto reply_attr = [&sizes](sftp_client_message, sftp_attributes attr) {
+        sizes.push_back(attr->size);
+        return SSH_OK;
+    };
+
+    REPLACE(inotify_add_watch, [](auto...) {
+        errno = ENOSPC;
+        return -1;
+    });
+    REPLACE(sftp_get_client_message, get_client_msg);
+    REPLACE(sftp_reply_attr, reply_attr);
+
+    sftp.run();
+
+    EXPECT_THAT(sizes, ElementsAre(5u, 20u));
+}
+
+TEST_F(SftpServer, cached_missing_file_is_found_once_created)
+{
+    mpt::TempDir temp_dir;
+    auto file_name = temp_dir.path() + "/test-file";
+
+    auto sftp = make_sftpserver(temp_dir.path().toStdString());
+    auto name = name_as_char_array(file_name.toStdString());
+    auto stat_msg1 = make_msg(SFTP_LSTAT);
+    stat_msg1->filename = name.data();
+    auto stat_msg2 = make_msg(SFTP_LSTAT);
+    stat_msg2->filename = name.data();
+
+    int num_msgs{0};
+    auto msg_handler = make_msg_handler();
+    auto get_client_msg = [&num_msgs, &msg_handler, &file_name](auto... args) {
+        if (num_msgs++ == 1)
+            mpt::make_file_with_content(file_name);
+        return msg_handler(args...);
+    };
+
+    int missing_num_calls{0};
+    auto reply_status = make_reply_status(stat_msg1.get(), SSH_FX_NO_SUCH_FILE, missing_num_calls);
+    int found_num_calls{0};
+    auto reply_attr = [&found_num_calls, &stat_msg2](sftp_client_message msg, sftp_attributes) {
+        EXPECT_THAT(msg, Eq(stat_msg2.get()));
+        ++found_num_calls;
+        return SSH_OK;
+    };
+
+    REPLACE(sftp_get_client_message, get_client_msg);
+    REPLACE(sftp_reply_status, reply_status);
+    REPLACE(sftp_reply_attr, reply_attr);
+
+    sftp.run();
+
+    EXPECT_THAT(missing_num_calls, Eq(1));
+    EXPECT_THAT(found_num_calls, Eq(1));
+}
+
+TEST_F(SftpServer, forwards_host_changes_to_the_instance)
+{
+    mpt::TempDir temp_dir;
+    auto file_name = temp_dir.path() + "/test-file";
+    mpt::make_file_with_content(file_name, "short");
+
+    auto sftp = make_sftpserver(temp_dir.path().toStdString());
+    sftp.enable_change_forwarding();
+
+    auto name = name_as_char_array(file_name.toStdString());
+    auto stat_msg1 = make_msg(SFTP_STAT);
+    stat_msg1->filename = name.data();
+    auto stat_msg2 = make_msg(SFTP_STAT);
+    stat_msg2->filename = name.data();
+
+    int num_msgs{0};
+    auto msg_handler = make_msg_handler();
+    auto get_client_msg = [&num_msgs, &msg_handler, &file_name](auto... args) {
+        if (num_msgs++ == 1)
+        {
+            QFile file{file_name};
+            file.open(QFile::Append);
+            file.write(" and now longer");
+        }
+        return msg_handler(args...);
+    };
+
+    std::string written;
+    auto channel_write = [&written](ssh_channel, const void* data, uint32_t len) {
+        written.append(static_cast<const char*>(data), len);
+        return static_cast<int>(len);
+    };
+
+    REPLACE(sftp_get_client_message, get_client_msg);
+    REPLACE(sftp_reply_attr, [](auto...) { return SSH_OK; });
+    REPLACE(ssh_channel_write, channel_write);
+
+    sftp.run();
+
+    EXPECT_THAT(written, HasSubstr("test-file\n"));
+}
+
+TEST_F(SftpServer, does_not_forward_changes_made_by_the_instance)
+{
+    mpt::TempDir temp_dir;
+    auto file_name = temp_dir.path() + "/test-file";
+    mpt::make_file_with_content(file_name);
+    auto new_dir_name = name_as_char_array(temp_dir.path().toStdString() + "/mkdir-test");
+
+    auto sftp = make_sftpserver(temp_dir.path().toStdString());
+    sftp.enable_change_forwarding();
+
+    auto name = name_as_char_array(file_name.toStdString());
+    auto stat_msg = make_msg(SFTP_STAT);
+    stat_msg->filename = name.data();
+    auto mkdir_msg = make_msg(SFTP_MKDIR);
+    mkdir_msg->filename = new_dir_name.data();
+    sftp_attributes_struct attr{};
+    attr.permissions = 0777;
+    mkdir_msg->attr = &attr;
+
+    std::string written;
+    auto channel_write = [&written](ssh_channel, const void* data, uint32_t len) {
+        written.append(static_cast<const char*>(data), len);
+        return static_cast<int>(len);
+    };
+
+    REPLACE(sftp_get_client_message, make_msg_handler());
+    REPLACE(sftp_reply_attr, [](auto...) { return SSH_OK; });
+    REPLACE(ssh_channel_write, channel_write);
+
+    sftp.run();
+
+    EXPECT_TRUE(QDir{new_dir_name.data()}.exists());
+    EXPECT_THAT(written, Not(HasSubstr("mkdir-test")));
+}
+
+TEST_F(SftpServer, pipelined_stats_are_replied_before_following_requests)
+{
+    mpt::TempDir temp_dir;
+    auto file_name = temp_dir.path() + "/test-file";
+    mpt::make_file_with_content(file_name);
+
+    auto sftp = make_sftpserver(temp_dir.path().toStdString());
+    sftp.enable_pipelining(2);
+
+    auto name = name_as_char_array(file_name.toStdString());
+    auto missing_name = name_as_char_array(temp_dir.path().toStdString() + "/missing");
+    auto stat_msg1 = make_msg(SFTP_STAT);
+    stat_msg1->filename = name.data();
+    auto stat_msg2 = make_msg(SFTP_LSTAT);
+    stat_msg2->filename = missing_name.data();
+    auto stat_msg3 = make_msg(SFTP_STAT);
+    stat_msg3->filename = name.data();
+    auto realpath_msg = make_msg(SFTP_REALPATH);
+    realpath_msg->filename = name.data();
+
+    std::vector<sftp_client_message> replied;
+    auto reply_attr = [&replied](sftp_client_message msg, sftp_attributes) {
+        replied.push_back(msg);
+        return SSH_OK;
+    };
+    auto reply_status = [&replied](sftp_client_message msg, uint32_t status, const char*) {
+        EXPECT_THAT(status, Eq(SSH_FX_NO_SUCH_FILE));
+        replied.push_back(msg);
+        return SSH_OK;
+    };
+    auto reply_name = [&replied, &stat_msg1, &stat_msg2, &stat_msg3](sftp_client_message, const char*,
+                                                                     sftp_attributes) {
+        EXPECT_THAT(replied, UnorderedElementsAre(stat_msg1.get(), stat_msg2.get(), stat_msg3.get()));
+        return SSH_OK;
+    };
+
+    REPLACE(ssh_channel_poll_timeout, [](auto...) { return 1; });
+    REPLACE(sftp_get_client_message, make_msg_handler());
+    REPLACE(sftp_reply_attr, reply_attr);
+    REPLACE(sftp_reply_status, reply_status);
+    REPLACE(sftp_reply_name, reply_name);
+
+    sftp.run();
+
+    EXPECT_THAT(replied.size(), Eq(3u));
+}
+
 namespace
 {
 INSTANTIATE_TEST_SUITE_P(SftpServer, Stat, ::testing::Values(SFTP_LSTAT, SFTP_STAT), string_for_message);
@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "file_operations.h"
+#include "temp_dir.h"
+
+#include <multipass/sha256.h>
+
+#include <gmock/gmock.h>
+
+#include <QCryptographicHash>
+
+#include <random>
+
+namespace mp = multipass;
+namespace mpt = multipass::test;
+
+using namespace testing;
+
+namespace
+{
+QByteArray sha256_hex(const QByteArray& data)
+{
+    mp::Sha256 hash;
+    hash.add_data(data);
+    return hash.result().toHex();
+}
+
+QByteArray random_bytes(int size)
+{
+    std::mt19937 gen{42};
+    std::uniform_int_distribution<int> byte{0, 255};
+    QByteArray bytes(size, '\0');
+    for (auto& b : bytes)
+        b = static_cast<char>(byte(gen));
+
+    return bytes;
+}
+} // namespace
+
+TEST(Sha256, hashes_the_standard_test_vectors)
+{
+    EXPECT_THAT(sha256_hex(""), Eq("e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"));
+    EXPECT_THAT(sha256_hex("abc"), Eq("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"));
+    EXPECT_THAT(sha256_hex("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"),
+                Eq("248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"));
+    EXPECT_THAT(sha256_hex(QByteArray(1000000, 'a')),
+                Eq("cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"));
+}
+
+TEST(Sha256, matches_qt_however_the_data_is_split)
+{
+    const auto data = random_bytes(10000);
+
+    for (auto piece_size : {1, 7, 63, 64, 65, 1000, 4096})
+    {
+        mp::Sha256 hash;
+        for (auto offset = 0; offset < data.size(); offset += piece_size)
+            hash.add_data(data.mid(offset, piece_size));
+
+        EXPECT_THAT(hash.result(), Eq(QCryptographicHash::hash(data, QCryptographicHash::Sha256))) << piece_size;
+    }
+}
+
+TEST(Sha256, hashes_files_concurrently_in_their_order)
+{
+    mpt::TempDir temp_dir;
+    const auto image = random_bytes(3 << 20);
+    const QByteArray kernel{"kernel"};
+    const std::vector<QString> paths{temp_dir.path() + "/image", temp_dir.path() + "/kernel",
+                                     temp_dir.path() + "/initrd"};
+    mpt::make_file_with_content(paths[0], image.toStdString());
+    mpt::make_file_with_content(paths[1], kernel.toStdString());
+    mpt::make_file_with_content(paths[2], "");
+
+    EXPECT_THAT(mp::sha256_of_files(paths),
+                ElementsAre(QCryptographicHash::hash(image, QCryptographicHash::Sha256).toHex(),
+                            QCryptographicHash::hash(kernel, QCryptographicHash::Sha256).toHex(),
+                            QCryptographicHash::hash("", QCryptographicHash::Sha256).toHex()));
+}
+
+TEST(Sha256, throws_for_a_file_it_cannot_read)
+{
+    mpt::TempDir temp_dir;
+
+    EXPECT_THROW(mp::sha256_of_file(temp_dir.path() + "/missing"), std::runtime_error);
+}
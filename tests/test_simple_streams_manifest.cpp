@@ -114,6 +114,51 @@ TEST(SimpleStreamsManifest, can_query_all_versions)
     }
 }
 
+TEST(SimpleStreamsManifest, finds_products_by_id_prefix)
+{
+    auto json = mpt::load_test_file("releases/multiple_versions_manifest.json");
+    auto manifest = mp::SimpleStreamsManifest::fromJson(json);
+
+    const auto matches = manifest->products_with_id_prefix("1");
+    ASSERT_THAT(matches.size(), Eq(2u));
+    EXPECT_THAT(matches[0]->id, Eq("1507bd2b3288ef4bacd3e699fe71b827b7ccf321ec4487e168a30d7089d3c8e4"));
+    EXPECT_THAT(matches[1]->id, Eq("1797c5c82016c1e65f4008fcf89deae3a044ef76087a9ec5b907c6d64a3609ac"));
+
+    EXPECT_THAT(manifest->products_with_id_prefix("ab115").size(), Eq(1u));
+    EXPECT_THAT(manifest->products_with_id_prefix("f"), IsEmpty());
+}
+
+TEST(SimpleStreamsManifest, shares_repeated_strings_between_products)
+{
+    auto json = mpt::load_test_file("releases/multiple_versions_manifest.json");
+    auto manifest = mp::SimpleStreamsManifest::fromJson(json);
+
+    std::vector<const mp::VMImageInfo*> same_version;
+    for (const auto& product : manifest->products)
+    {
+        if (product.version == "20170619.1")
+            same_version.push_back(&product);
+    }
+
+    ASSERT_THAT(same_version.size(), Eq(2u));
+    EXPECT_EQ(same_version[0]->version.constData(), same_version[1]->version.constData());
+    EXPECT_EQ(same_version[0]->os.constData(), same_version[1]->os.constData());
+}
+
+TEST(SimpleStreamsManifest, supported_products_leave_out_unsupported_ones)
+{
+    auto json = mpt::load_test_file("releases/multiple_versions_manifest.json");
+    auto manifest = mp::SimpleStreamsManifest::fromJson(json);
+
+    const auto all = manifest->supported_products(true);
+    EXPECT_THAT(all.size(), Eq(manifest->products.size()));
+
+    const auto supported = manifest->supported_products(false);
+    EXPECT_THAT(supported.size(), Eq(all.size() - 1)); // artful is no longer supported
+    for (const auto product : supported)
+        EXPECT_TRUE(product->supported);
+}
+
 TEST(SimpleStreamsManifest, info_has_kernel_and_initrd_paths)
 {
     auto json = mpt::load_test_file("good_manifest.json");
@@ -21,6 +21,8 @@
 #include "file_operations.h"
 #include "temp_dir.h"
 
+#include <QFile>
+
 #include <gmock/gmock.h>
 
 #include <chrono>
@@ -98,3 +100,13 @@ TEST_F(SSHKeyProvider, public_key_is_stable)
 
     EXPECT_THAT(key_one, StrEq(key_two));
 }
+
+TEST_F(SSHKeyProvider, private_key_is_read_only_once)
+{
+    mp::OpenSSHKeyProvider key_provider{key_dir.path()};
+    const auto key_before = key_provider.private_key_as_base64();
+
+    QFile::remove(QDir{key_dir.path()}.filePath("ssh-keys/id_rsa"));
+
+    EXPECT_THAT(key_provider.private_key_as_base64(), StrEq(key_before));
+}
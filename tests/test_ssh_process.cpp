@@ -17,6 +17,8 @@
 
 #include "mock_ssh.h"
 
+#include <multipass/exceptions/exitless_sshprocess_exception.h>
+#include <multipass/logging/log.h>
 #include <multipass/ssh/ssh_session.h>
 
 #include <gmock/gmock.h>
@@ -25,6 +27,7 @@
 #include <thread>
 
 namespace mp = multipass;
+namespace mpl = multipass::logging;
 using namespace testing;
 
 namespace
@@ -154,3 +157,88 @@ TEST_F(SSHProcess, can_read_output)
 
     EXPECT_THAT(output, StrEq(expected_output));
 }
+
+TEST_F(SSHProcess, can_read_output_spanning_several_reads)
+{
+    const std::string expected_output(200 * 1024, 'x');
+    auto remaining = expected_output.size();
+    auto channel_read = [&expected_output, &remaining](ssh_channel, void* dest, uint32_t count, int is_stderr, int) {
+        const auto num_to_copy = std::min(count, static_cast<uint32_t>(remaining));
+        const auto begin = expected_output.begin() + expected_output.size() - remaining;
+        std::copy_n(begin, num_to_copy, reinterpret_cast<char*>(dest));
+        remaining -= num_to_copy;
+        return num_to_copy;
+    };
+    REPLACE(ssh_channel_read_timeout, channel_read);
+
+    auto proc = session.exec("something");
+    auto output = proc.read_std_output();
+
+    EXPECT_EQ(output, expected_output);
+}
+
+TEST_F(SSHProcess, reading_output_skips_disabled_debug_logs)
+{
+    struct CountingLogger : public mpl::Logger
+    {
+        void log(mpl::Level, mpl::CString, mpl::CString) const override
+        {
+            ++count;
+        }
+        bool enabled(mpl::Level level) const override
+        {
+            return level <= mpl::Level::info;
+        }
+        mutable int count{0};
+    };
+
+    auto logger = std::make_shared<CountingLogger>();
+    mpl::set_logger(logger);
+    REPLACE(ssh_channel_read_timeout, [](auto...) { return 0; });
+
+    auto proc = session.exec("something");
+    proc.read_std_output();
+    mpl::set_logger(nullptr);
+
+    EXPECT_EQ(logger->count, 0);
+}
+
+TEST_F(SSHProcess, streams_output_as_it_arrives)
+{
+    auto eof = false;
+    std::string pending{"some content here"};
+    REPLACE(ssh_channel_is_open, [](auto...) { return 1; });
+    REPLACE(ssh_channel_is_eof, [&eof](auto...) { return eof; });
+    REPLACE(ssh_channel_read_nonblocking, [&pending](ssh_channel, void* dest, uint32_t count, int is_stderr) {
+        if (is_stderr || pending.empty())
+            return 0;
+        const auto num_to_copy = std::min(count, static_cast<uint32_t>(pending.size()));
+        std::copy_n(pending.begin(), num_to_copy, reinterpret_cast<char*>(dest));
+        pending.erase(0, num_to_copy);
+        return static_cast<int>(num_to_copy);
+    });
+    REPLACE(ssh_event_dopoll, [&eof](ssh_event, int timeout) {
+        EXPECT_GE(timeout, 0);
+        eof = true;
+        return SSH_OK;
+    });
+    REPLACE(ssh_channel_get_exit_status, [](auto...) { return 7; });
+
+    std::string output;
+    auto proc = session.exec("something");
+    EXPECT_EQ(proc.stream_output([&output](const std::string& chunk, bool) { output += chunk; }), 7);
+    EXPECT_EQ(output, "some content here");
+}
+
+TEST_F(SSHProcess, stops_streaming_once_the_session_is_lost)
+{
+    REPLACE(ssh_channel_is_open, [](auto...) { return 1; });
+    REPLACE(ssh_channel_is_eof, [](auto...) { return 0; });
+    REPLACE(ssh_channel_read_nonblocking, [](auto...) { return 0; });
+    REPLACE(ssh_event_dopoll, [](auto...) { return SSH_AGAIN; });
+
+    auto proc = session.exec("something");
+    is_connected.returnValue(false);
+
+    EXPECT_THROW(proc.stream_output([](auto...) {}), mp::ExitlessSSHProcessException);
+}
@@ -101,3 +101,44 @@ TEST(SSHSession, exec_succeeds)
 
     EXPECT_NO_THROW(session.exec("dummy"));
 }
+
+TEST(SSHSession, ciphers_follow_crypto_profile)
+{
+    std::string ciphers;
+    REPLACE(ssh_options_set, [&ciphers](ssh_session, ssh_options_e type, const void* value) {
+        if (type == SSH_OPTIONS_CIPHERS_C_S)
+            ciphers = static_cast<const char*>(value);
+        return SSH_OK;
+    });
+    REPLACE(ssh_connect, [](auto...) { return SSH_OK; });
+
+    mp::SSHSession::set_crypto_profile("chacha20");
+    mp::SSHSession{"theanswertoeverything", 42};
+    EXPECT_THAT(ciphers, StartsWith("chacha20-poly1305@openssh.com"));
+
+    mp::SSHSession::set_crypto_profile("aes-gcm");
+    mp::SSHSession{"theanswertoeverything", 42};
+    EXPECT_THAT(ciphers, StartsWith("aes128-gcm@openssh.com"));
+
+    mp::SSHSession::set_crypto_profile("auto");
+}
+
+TEST(SSHSession, compression_is_only_asked_for_when_enabled)
+{
+    std::string compression;
+    REPLACE(ssh_options_set, [&compression](ssh_session, ssh_options_e type, const void* value) {
+        if (type == SSH_OPTIONS_COMPRESSION)
+            compression = static_cast<const char*>(value);
+        return SSH_OK;
+    });
+    REPLACE(ssh_connect, [](auto...) { return SSH_OK; });
+
+    mp::SSHSession{"theanswertoeverything", 42};
+    EXPECT_EQ(compression, "no");
+
+    mp::SSHSession::set_compression(true);
+    mp::SSHSession{"theanswertoeverything", 42};
+    EXPECT_THAT(compression, StartsWith("zlib@openssh.com"));
+
+    mp::SSHSession::set_compression(false);
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2020 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "mock_ssh.h"
+#include "stub_ssh_key_provider.h"
+
+#include <multipass/ssh/ssh_session_pool.h>
+
+#include <gmock/gmock.h>
+
+#include <stdexcept>
+
+namespace mp = multipass;
+using namespace testing;
+
+namespace
+{
+struct SSHSessionPool : public Test
+{
+    SSHSessionPool()
+    {
+        connect.returnValue(SSH_OK);
+        auth.returnValue(SSH_AUTH_SUCCESS);
+    }
+
+    decltype(MOCK(ssh_connect)) connect{MOCK(ssh_connect)};
+    decltype(MOCK(ssh_userauth_publickey)) auth{MOCK(ssh_userauth_publickey)};
+    mp::test::StubSSHKeyProvider key_provider;
+    mp::SSHSessionPool pool{key_provider};
+};
+
+TEST_F(SSHSessionPool, reuses_a_connected_session)
+{
+    REPLACE(ssh_is_connected, [](auto...) { return true; });
+
+    pool.acquire("foo", "host", 42, "ubuntu");
+    pool.acquire("foo", "host", 42, "ubuntu");
+
+    EXPECT_NO_THROW(connect.expectCalled(1));
+}
+
+TEST_F(SSHSessionPool, reconnects_a_dead_session)
+{
+    REPLACE(ssh_is_connected, [](auto...) { return false; });
+
+    pool.acquire("foo", "host", 42, "ubuntu");
+    pool.acquire("foo", "host", 42, "ubuntu");
+
+    EXPECT_NO_THROW(connect.expectCalled(2));
+}
+
+TEST_F(SSHSessionPool, reconnects_when_the_address_changes)
+{
+    REPLACE(ssh_is_connected, [](auto...) { return true; });
+
+    pool.acquire("foo", "host", 42, "ubuntu");
+    pool.acquire("foo", "other_host", 42, "ubuntu");
+
+    EXPECT_NO_THROW(connect.expectCalled(2));
+}
+
+TEST_F(SSHSessionPool, keeps_sessions_per_instance)
+{
+    REPLACE(ssh_is_connected, [](auto...) { return true; });
+
+    pool.acquire("foo", "host", 42, "ubuntu");
+    pool.acquire("bar", "host", 42, "ubuntu");
+
+    EXPECT_NO_THROW(connect.expectCalled(2));
+}
+
+TEST_F(SSHSessionPool, reconnects_after_drop)
+{
+    REPLACE(ssh_is_connected, [](auto...) { return true; });
+
+    pool.acquire("foo", "host", 42, "ubuntu");
+    pool.drop("foo");
+    pool.acquire("foo", "host", 42, "ubuntu");
+
+    EXPECT_NO_THROW(connect.expectCalled(2));
+}
+
+TEST_F(SSHSessionPool, discards_a_session_that_saw_an_exception)
+{
+    REPLACE(ssh_is_connected, [](auto...) { return true; });
+
+    try
+    {
+        auto session = pool.acquire("foo", "host", 42, "ubuntu");
+        throw std::runtime_error{"lost"};
+    }
+    catch (const std::runtime_error&)
+    {
+    }
+    pool.acquire("foo", "host", 42, "ubuntu");
+
+    EXPECT_NO_THROW(connect.expectCalled(2));
+}
+} // namespace
@@ -37,7 +37,8 @@ struct TestSSHFSServerProcessSpec : public Test
                                  "source_path",
                                  "target_path",
                                  {{1, 2}, {3, 4}},
-                                 {{5, -1}, {6, 10}}};
+                                 {{5, -1}, {6, 10}},
+                                 {}};
 };
 
 TEST_F(TestSSHFSServerProcessSpec, program_correct)
@@ -49,7 +50,7 @@ TEST_F(TestSSHFSServerProcessSpec, program_correct)
 TEST_F(TestSSHFSServerProcessSpec, arguments_correct)
 {
     mp::SSHFSServerProcessSpec spec(config);
-    ASSERT_EQ(spec.arguments().size(), 7);
+    ASSERT_EQ(spec.arguments().size(), 8);
     EXPECT_EQ(spec.arguments()[0], "host");
     EXPECT_EQ(spec.arguments()[1], "42");
     EXPECT_EQ(spec.arguments()[2], "username");
@@ -58,6 +59,29 @@ TEST_F(TestSSHFSServerProcessSpec, arguments_correct)
     // Ordering of below options not guaranteed, hence the or-s.
     EXPECT_TRUE(spec.arguments()[5] == "6:10,5:-1," || spec.arguments()[5] == "5:-1,6:10,");
     EXPECT_TRUE(spec.arguments()[6] == "3:4,1:2," || spec.arguments()[6] == "1:2,3:4,");
+    EXPECT_EQ(spec.arguments()[7], "default");
+}
+
+TEST_F(TestSSHFSServerProcessSpec, additional_mounts_are_appended_to_arguments)
+{
+    config.additional_mounts.push_back({"other_source", "other_target", {{7, 8}}, {{9, 10}}, "dev"});
+
+    mp::SSHFSServerProcessSpec spec(config);
+    ASSERT_EQ(spec.arguments().size(), 13);
+    EXPECT_EQ(spec.arguments()[8], "other_source");
+    EXPECT_EQ(spec.arguments()[9], "other_target");
+    EXPECT_EQ(spec.arguments()[10], "9:10,");
+    EXPECT_EQ(spec.arguments()[11], "7:8,");
+    EXPECT_EQ(spec.arguments()[12], "dev");
+}
+
+TEST_F(TestSSHFSServerProcessSpec, apparmor_profile_allows_additional_sources)
+{
+    config.additional_mounts.push_back({"other_source", "other_target", {}, {}});
+
+    mp::SSHFSServerProcessSpec spec(config);
+    EXPECT_TRUE(spec.apparmor_profile().contains("source_path/** rwlk,"));
+    EXPECT_TRUE(spec.apparmor_profile().contains("other_source/** rwlk,"));
 }
 
 TEST_F(TestSSHFSServerProcessSpec, environment_correct)
@@ -67,3 +91,18 @@ TEST_F(TestSSHFSServerProcessSpec, environment_correct)
     ASSERT_TRUE(spec.environment().contains("KEY"));
     EXPECT_EQ(spec.environment().value("KEY"), "private_key");
 }
+
+TEST_F(TestSSHFSServerProcessSpec, control_socket_is_passed_in_environment_and_allowed)
+{
+    config.control_socket = "/some/dir/instance.0123abcd.sock";
+
+    mp::SSHFSServerProcessSpec spec(config);
+    EXPECT_EQ(spec.environment().value("CONTROL_SOCKET"), "/some/dir/instance.0123abcd.sock");
+    EXPECT_TRUE(spec.apparmor_profile().contains("/some/dir/instance.0123abcd.sock rw,"));
+}
+
+TEST_F(TestSSHFSServerProcessSpec, no_control_socket_by_default)
+{
+    mp::SSHFSServerProcessSpec spec(config);
+    EXPECT_FALSE(spec.environment().contains("CONTROL_SOCKET"));
+}
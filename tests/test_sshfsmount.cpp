@@ -47,10 +47,11 @@ struct SshfsMount : public mp::test::SftpServerTest
         channel_is_closed.returnValue(0);
     }
 
-    mp::SshfsMount make_sshfsmount(mp::optional<std::string> target = mp::nullopt)
+    mp::SshfsMount make_sshfsmount(mp::optional<std::string> target = mp::nullopt,
+                                   const std::string& profile = mp::default_mount_profile)
     {
         mp::SSHSession session{"a", 42};
-        return {std::move(session), default_source, target.value_or(default_target), default_map, default_map};
+        return {std::move(session), default_source, target.value_or(default_target), default_map, default_map, profile};
     }
 
     auto make_exec_that_fails_for(const std::string& expected_cmd, bool& invoked)
@@ -128,7 +129,8 @@ struct SshfsMount : public mp::test::SftpServerTest
         return channel_read;
     }
 
-    void test_command_execution(const CommandVector& commands, mp::optional<std::string> target = mp::nullopt)
+    void test_command_execution(const CommandVector& commands, mp::optional<std::string> target = mp::nullopt,
+                                const std::string& profile = mp::default_mount_profile)
     {
         bool invoked{false};
         std::string output;
@@ -141,7 +143,7 @@ struct SshfsMount : public mp::test::SftpServerTest
         auto request_exec = make_exec_to_check_commands(commands, remaining, next_expected_cmd, output, invoked);
         REPLACE(ssh_channel_request_exec, request_exec);
 
-        make_sshfsmount(target.value_or(default_target));
+        make_sshfsmount(target.value_or(default_target), profile);
 
         EXPECT_TRUE(next_expected_cmd == commands.end()) << "\"" << next_expected_cmd->first << "\" not executed";
     }
@@ -347,11 +349,23 @@ TEST_F(SshfsMount, executes_commands)
         {"sudo /bin/bash -c 'cd \"/home/ubuntu/\" && chown -R ubuntu:ubuntu target'", ""},
         {"id -u", "1000"},
         {"id -g", "1000"},
-        {"sudo sshfs -o slave -o nonempty -o transform_symlinks -o allow_other :\"source\" \"target\"", "don't care"}};
+        {"sudo sshfs -o slave -o nonempty -o transform_symlinks -o allow_other -o negative_timeout=1 :\"source\" "
+         "\"target\"",
+         "don't care"}};
 
     test_command_execution(commands, std::string("target"));
 }
 
+TEST_F(SshfsMount, passes_profile_options_to_sshfs)
+{
+    CommandVector commands = {
+        {"sudo sshfs -o slave -o nonempty -o transform_symlinks -o allow_other -o cache=no -o attr_timeout=0 "
+         "-o entry_timeout=0 -o negative_timeout=0 :\"source\" \"target\"",
+         "don't care"}};
+
+    test_command_execution(commands, std::string("target"), mp::strict_mount_profile);
+}
+
 TEST_F(SshfsMount, works_with_absolute_paths)
 {
     CommandVector commands = {
@@ -22,11 +22,22 @@
 #include "mock_process_factory.h"
 #include "mock_virtual_machine.h"
 #include "stub_ssh_key_provider.h"
+#include "temp_dir.h"
 
 #include <QCoreApplication>
+#include <QDir>
+#include <QFile>
 #include <QTimer>
 #include <gmock/gmock.h>
 
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
 namespace mp = multipass;
 namespace mpt = multipass::test;
 
@@ -193,6 +204,40 @@ TEST_F(SSHFSMountsTest, stop_all_mounts_terminates_all_sshfs_processes)
     sshfs_mounts.stop_all_mounts_for_instance(vm.vm_name);
 }
 
+TEST_F(SSHFSMountsTest, mounts_started_together_share_one_sshfs_process)
+{
+    auto factory = mpt::MockProcessFactory::Inject();
+    mpt::MockProcessFactory::Callback sshfs_terminates_once = [this](mpt::MockProcess* process) {
+        sshfs_prints_connected(process);
+
+        if (process->program().contains("sshfs_server"))
+        {
+            EXPECT_CALL(*process, terminate).Times(1);
+        }
+    };
+    factory->register_callback(sshfs_terminates_once);
+
+    mp::SSHFSMounts sshfs_mounts(key_provider);
+    NiceMock<mpt::MockVirtualMachine> vm{"my_instance"};
+
+    sshfs_mounts.start_mounts(&vm, {{"/source/one", "/target/one", gid_map, uid_map},
+                                    {"/source/two", "/target/two", gid_map, uid_map}});
+
+    ASSERT_EQ(factory->process_list().size(), 1u);
+    const auto& arguments = factory->process_list()[0].arguments;
+    ASSERT_EQ(arguments.size(), 11);
+    EXPECT_EQ(arguments[3], "/source/one");
+    EXPECT_EQ(arguments[4], "/target/one");
+    EXPECT_EQ(arguments[7], "/source/two");
+    EXPECT_EQ(arguments[8], "/target/two");
+
+    // Only stopping the last of its mounts terminates the shared process
+    EXPECT_TRUE(sshfs_mounts.stop_mount(vm.vm_name, "/target/one"));
+    EXPECT_FALSE(sshfs_mounts.has_instance_already_mounted(vm.vm_name, "/target/one"));
+    EXPECT_TRUE(sshfs_mounts.has_instance_already_mounted(vm.vm_name, "/target/two"));
+    EXPECT_TRUE(sshfs_mounts.stop_mount(vm.vm_name, "/target/two"));
+}
+
 TEST_F(SSHFSMountsTest, has_instance_already_mounted_returns_true_when_found)
 {
     auto factory = mpt::MockProcessFactory::Inject();
@@ -234,3 +279,55 @@ TEST_F(SSHFSMountsTest, has_instance_already_mounted_returns_false_when_no_such_
 
     EXPECT_FALSE(sshfs_mounts.has_instance_already_mounted("bad_vm_name", target_path));
 }
+
+TEST_F(SSHFSMountsTest, stale_control_sockets_are_removed)
+{
+    mpt::TempDir control_dir;
+    const auto stale_socket = QDir{control_dir.path()}.filePath("my_instance.0123abcd.sock");
+    QFile{stale_socket}.open(QIODevice::WriteOnly);
+
+    mp::SSHFSMounts sshfs_mounts(key_provider, control_dir.path());
+
+    EXPECT_FALSE(QFile::exists(stale_socket));
+    EXPECT_FALSE(sshfs_mounts.has_instance_already_mounted("my_instance", target_path));
+}
+
+TEST_F(SSHFSMountsTest, mounts_of_a_running_detached_server_are_taken_up)
+{
+    mpt::TempDir control_dir;
+    const auto socket_path = QDir{control_dir.path()}.filePath("my_instance.0123abcd.sock").toStdString();
+
+    // Stands in for an sshfs_server left running by a previous daemon, answering what it serves
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+    const auto listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    ASSERT_EQ(bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)), 0);
+    ASSERT_EQ(listen(listener, 1), 0);
+
+    std::string request;
+    std::thread server{[listener, &request, this] {
+        const auto daemon_fd = accept(listener, nullptr, nullptr);
+        char buffer[64];
+        const auto received = read(daemon_fd, buffer, sizeof(buffer));
+        request.assign(buffer, received > 0 ? received : 0);
+
+        const auto reply = "target " + target_path + "\ntarget /other/target\nend\n";
+        write(daemon_fd, reply.data(), reply.size());
+        read(daemon_fd, buffer, sizeof(buffer)); // until the daemon goes away
+        close(daemon_fd);
+    }};
+
+    {
+        mp::SSHFSMounts sshfs_mounts(key_provider, control_dir.path());
+
+        EXPECT_EQ(request, "targets\n");
+        EXPECT_TRUE(sshfs_mounts.has_instance_already_mounted("my_instance", target_path));
+        EXPECT_TRUE(sshfs_mounts.has_instance_already_mounted("my_instance", "/other/target"));
+        EXPECT_FALSE(sshfs_mounts.has_instance_already_mounted("other_instance", target_path));
+    }
+
+    QCoreApplication::sendPostedEvents(nullptr, QEvent::DeferredDelete); // lets go of the socket
+    server.join();
+    close(listener);
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <src/daemon/task_graph.h>
+
+#include <gmock/gmock.h>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace mp = multipass;
+using namespace testing;
+using namespace std::chrono_literals;
+
+namespace
+{
+using Work = mp::TaskGraph::Work;
+
+TEST(TaskGraph, runs_independent_steps_together)
+{
+    // Each step only returns once it hears from the other, which it would never do if they ran in turn
+    std::promise<void> first_started, second_started;
+    auto first_heard = first_started.get_future();
+    auto second_heard = second_started.get_future();
+    std::atomic<bool> overlapped{true};
+
+    mp::TaskGraph graph;
+    graph.add("first", Work::blocking, [&] {
+        first_started.set_value();
+        if (second_heard.wait_for(5s) != std::future_status::ready)
+            overlapped = false;
+    });
+    graph.add("second", Work::compute, [&] {
+        second_started.set_value();
+        if (first_heard.wait_for(5s) != std::future_status::ready)
+            overlapped = false;
+    });
+    graph.run();
+
+    EXPECT_TRUE(overlapped);
+}
+
+TEST(TaskGraph, runs_steps_after_those_they_wait_on)
+{
+    std::mutex mutex;
+    std::vector<std::string> order;
+    auto note = [&](const std::string& name) {
+        return [&, name] {
+            std::lock_guard<std::mutex> lock{mutex};
+            order.push_back(name);
+        };
+    };
+
+    mp::TaskGraph graph;
+    auto fetch = graph.add("fetch", Work::blocking, note("fetch"));
+    auto configure = graph.add("configure", Work::compute, note("configure"));
+    auto describe = graph.add("describe", Work::compute, note("describe"), {fetch, configure});
+    graph.add("prepare", Work::blocking, note("prepare"), {describe});
+    graph.run();
+
+    ASSERT_EQ(order.size(), 4u);
+    EXPECT_THAT(std::vector<std::string>(order.begin(), order.begin() + 2), UnorderedElementsAre("fetch", "configure"));
+    EXPECT_EQ(order[2], "describe");
+    EXPECT_EQ(order[3], "prepare");
+}
+
+TEST(TaskGraph, skips_what_follows_a_failure_and_rethrows_it)
+{
+    std::atomic<bool> ran_dependent{false};
+
+    mp::TaskGraph graph;
+    auto failing = graph.add("failing", Work::blocking, [] { throw std::runtime_error{"no image"}; });
+    graph.add("dependent", Work::compute, [&] { ran_dependent = true; }, {failing});
+
+    EXPECT_THROW(
+        {
+            try
+            {
+                graph.run();
+            }
+            catch (const std::runtime_error& e)
+            {
+                EXPECT_STREQ(e.what(), "no image");
+                throw;
+            }
+        },
+        std::runtime_error);
+
+    EXPECT_FALSE(ran_dependent);
+    EXPECT_THAT(graph.skipped(), ElementsAre("dependent"));
+}
+
+TEST(TaskGraph, cancelling_skips_steps_yet_to_start)
+{
+    std::atomic<bool> ran_after{false};
+
+    mp::TaskGraph graph;
+    auto first = graph.add("first", Work::blocking, [&graph] { graph.cancel(); });
+    graph.add("after", Work::blocking, [&] { ran_after = true; }, {first});
+    graph.run();
+
+    EXPECT_TRUE(graph.cancelled());
+    EXPECT_FALSE(ran_after);
+    EXPECT_THAT(graph.skipped(), ElementsAre("after"));
+}
+
+TEST(TaskGraph, refuses_to_wait_on_later_steps)
+{
+    mp::TaskGraph graph;
+    EXPECT_THROW(graph.add("early", Work::compute, [] {}, {0}), std::invalid_argument);
+}
+} // namespace
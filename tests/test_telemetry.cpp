@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <multipass/telemetry.h>
+
+#include <gmock/gmock.h>
+
+namespace mp = multipass;
+using namespace testing;
+
+TEST(Telemetry, renders_counters_with_their_labels)
+{
+    auto& telemetry = mp::Telemetry::instance();
+    telemetry.count("test_counted_total", {{"mount", "/home/\"quoted\""}}, 2);
+    telemetry.count("test_counted_total", {{"mount", "/home/\"quoted\""}});
+
+    EXPECT_THAT(telemetry.exposition(), HasSubstr("# TYPE test_counted_total counter\n"
+                                                  "test_counted_total{mount=\"/home/\\\"quoted\\\"\"} 3\n"));
+}
+
+TEST(Telemetry, renders_histograms_cumulatively)
+{
+    auto& telemetry = mp::Telemetry::instance();
+    telemetry.observe("test_timed_seconds", {{"method", "launch"}}, std::chrono::milliseconds(3));
+    telemetry.observe("test_timed_seconds", {{"method", "launch"}}, std::chrono::seconds(2));
+
+    const auto exposition = telemetry.exposition();
+    EXPECT_THAT(exposition, HasSubstr("test_timed_seconds_bucket{method=\"launch\",le=\"0.005\"} 1\n"));
+    EXPECT_THAT(exposition, HasSubstr("test_timed_seconds_bucket{method=\"launch\",le=\"2.5\"} 2\n"));
+    EXPECT_THAT(exposition, HasSubstr("test_timed_seconds_bucket{method=\"launch\",le=\"+Inf\"} 2\n"));
+    EXPECT_THAT(exposition, HasSubstr("test_timed_seconds_count{method=\"launch\"} 2\n"));
+}
+
+TEST(Telemetry, takes_in_samples_from_elsewhere)
+{
+    auto& telemetry = mp::Telemetry::instance();
+    telemetry.set({"test_forwarded_total", "instance=\"foo\"", 42});
+
+    EXPECT_THAT(telemetry.samples(), Contains(Field(&mp::Telemetry::Sample::value, 42)));
+    EXPECT_THAT(telemetry.exposition(), HasSubstr("test_forwarded_total{instance=\"foo\"} 42\n"));
+}
+
+TEST(Telemetry, takes_in_histograms_from_elsewhere_as_histograms)
+{
+    auto& telemetry = mp::Telemetry::instance();
+    telemetry.set({"test_forwarded_seconds_bucket", "instance=\"foo\",le=\"+Inf\"", 3, "test_forwarded_seconds"});
+    telemetry.set({"test_forwarded_seconds_sum", "instance=\"foo\"", 1.5, "test_forwarded_seconds"});
+    telemetry.set({"test_forwarded_seconds_count", "instance=\"foo\"", 3, "test_forwarded_seconds"});
+
+    const auto exposition = telemetry.exposition();
+    EXPECT_THAT(exposition, HasSubstr("# TYPE test_forwarded_seconds histogram\n"
+                                      "test_forwarded_seconds_bucket{instance=\"foo\",le=\"+Inf\"} 3\n"
+                                      "test_forwarded_seconds_count{instance=\"foo\"} 3\n"
+                                      "test_forwarded_seconds_sum{instance=\"foo\"} 1.5\n"));
+    EXPECT_THAT(exposition, Not(HasSubstr("# TYPE test_forwarded_seconds_bucket counter")));
+    EXPECT_THAT(telemetry.samples(), Contains(Field(&mp::Telemetry::Sample::histogram, "test_forwarded_seconds")));
+}
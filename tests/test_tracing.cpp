@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "temp_dir.h"
+
+#include <multipass/tracing.h>
+
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include <gmock/gmock.h>
+
+#include <thread>
+
+namespace mp = multipass;
+namespace mpt = multipass::test;
+using namespace testing;
+
+namespace
+{
+struct Tracer : public Test
+{
+    Tracer()
+    {
+        tracer.trace_to(trace_path.toStdString());
+    }
+
+    ~Tracer()
+    {
+        tracer.trace_to({});
+    }
+
+    // What viewers read, with the bracket they close themselves
+    QJsonArray events()
+    {
+        tracer.trace_to({});
+
+        QFile file{trace_path};
+        file.open(QIODevice::ReadOnly);
+        auto contents = file.readAll().trimmed();
+        contents.chop(1); // the trailing comma
+        return QJsonDocument::fromJson(contents + "]").array();
+    }
+
+    mpt::TempDir temp_dir;
+    QString trace_path{temp_dir.path() + "/trace.json"};
+    mp::Tracer& tracer{mp::Tracer::instance()};
+};
+} // namespace
+
+TEST_F(Tracer, writes_complete_events_with_their_args)
+{
+    {
+        auto span = tracer.span("launch", {{"instance", "foo"}});
+    }
+
+    const auto events = this->events();
+    ASSERT_EQ(events.size(), 1);
+
+    const auto event = events.first().toObject();
+    EXPECT_EQ(event["name"].toString(), "launch");
+    EXPECT_EQ(event["ph"].toString(), "X");
+    EXPECT_EQ(event["args"].toObject()["instance"].toString(), "foo");
+    EXPECT_EQ(event["args"].toObject()["trace_id"].toString().size(), 32);
+}
+
+TEST_F(Tracer, nests_spans_in_their_enclosing_trace)
+{
+    mp::Tracer::Context outer_context, inner_context;
+    {
+        auto outer = tracer.span("outer");
+        auto inner = tracer.span("inner");
+        outer_context = outer.context();
+        inner_context = inner.context();
+    }
+
+    EXPECT_EQ(inner_context.trace_id, outer_context.trace_id);
+    EXPECT_NE(inner_context.span_id, outer_context.span_id);
+    EXPECT_FALSE(tracer.current().valid());
+}
+
+TEST_F(Tracer, carries_the_trace_to_other_threads)
+{
+    mp::Tracer::Context parent, carried, handed_over;
+    {
+        auto span = tracer.span("rpc");
+        span.hand_over(this);
+        parent = span.context();
+
+        auto work = tracer.carry("worker", [this] { return tracer.current(); });
+        std::thread{[&] {
+            carried = work();
+            handed_over = tracer.handed_over(this);
+        }}.join();
+    }
+
+    EXPECT_EQ(carried.trace_id, parent.trace_id);
+    EXPECT_EQ(handed_over.span_id, parent.span_id);
+    EXPECT_FALSE(tracer.handed_over(this).valid());
+}
+
+TEST_F(Tracer, takes_contexts_back_from_their_serialised_form)
+{
+    auto span = tracer.span("client");
+    const auto context = mp::Tracer::Context::deserialised(span.context().serialised());
+
+    EXPECT_EQ(context.trace_id, span.context().trace_id);
+    EXPECT_EQ(context.span_id, span.context().span_id);
+}
+
+TEST(TracerDisabled, records_nothing)
+{
+    auto& tracer = mp::Tracer::instance();
+    auto span = tracer.span("ignored");
+
+    EXPECT_FALSE(tracer.enabled());
+    EXPECT_FALSE(span.context().valid());
+}
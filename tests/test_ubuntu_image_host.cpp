@@ -257,7 +257,7 @@ TEST_F(UbuntuImageHost, handles_and_recovers_from_initial_network_failure)
     EXPECT_TRUE(host.info_for(query));
 }
 
-TEST_F(UbuntuImageHost, handles_and_recovers_from_later_network_failure)
+TEST_F(UbuntuImageHost, keeps_last_good_manifest_through_later_network_failure)
 {
     const auto ttl = 0s; // to ensure updates are always retried
     mp::UbuntuVMImageHost host{all_remote_specs, &url_downloader, ttl};
@@ -266,13 +266,16 @@ TEST_F(UbuntuImageHost, handles_and_recovers_from_later_network_failure)
     EXPECT_TRUE(host.info_for(query));
 
     url_downloader.mischiefs = 1000;
-    EXPECT_THROW(host.info_for(query), std::runtime_error);
+    EXPECT_TRUE(host.info_for(query));
+    host.wait_for_manifest_refresh();
+    EXPECT_TRUE(host.info_for(query));
 
     url_downloader.mischiefs = 0;
+    host.wait_for_manifest_refresh();
     EXPECT_TRUE(host.info_for(query));
 }
 
-TEST_F(UbuntuImageHost, handles_and_recovers_from_independent_server_failures)
+TEST_F(UbuntuImageHost, keeps_remotes_whose_server_fails_later)
 {
     const auto ttl = 0h;
     mp::UbuntuVMImageHost host{all_remote_specs, &url_downloader, ttl};
@@ -283,7 +286,9 @@ TEST_F(UbuntuImageHost, handles_and_recovers_from_independent_server_failures)
     for (size_t i = 0; i < num_remotes; ++i)
     {
         url_downloader.mischiefs = i;
-        EXPECT_EQ(mpt::count_remotes(host), num_remotes - i);
+        mpt::count_remotes(host);
+        host.wait_for_manifest_refresh();
+        EXPECT_EQ(mpt::count_remotes(host), num_remotes);
     }
 }
 
@@ -293,3 +298,29 @@ TEST_F(UbuntuImageHost, throws_unsupported_image_when_image_not_supported)
 
     EXPECT_THROW(host.info_for(make_query("artful", release_remote_spec.first)), mp::UnsupportedImageException);
 }
+
+TEST_F(UbuntuImageHost, keeps_manifest_generation_while_manifests_are_unchanged)
+{
+    const auto ttl = 0s; // to ensure updates are always retried
+    mp::UbuntuVMImageHost host{all_remote_specs, &url_downloader, ttl};
+
+    const auto generation = host.manifest_generation();
+    EXPECT_EQ(host.manifest_generation(), generation);
+    host.wait_for_manifest_refresh();
+
+    url_downloader.mischiefs = 1; // the last good manifest stays
+    host.manifest_generation();
+    host.wait_for_manifest_refresh();
+    EXPECT_EQ(host.manifest_generation(), generation);
+}
+
+TEST_F(UbuntuImageHost, bumps_manifest_generation_when_a_missing_remote_comes_through)
+{
+    const auto ttl = 1h; // so that updates are only retried when unsuccessful
+    url_downloader.mischiefs = 1;
+    mp::UbuntuVMImageHost host{all_remote_specs, &url_downloader, ttl};
+
+    const auto generation = host.manifest_generation();
+    EXPECT_EQ(mpt::count_remotes(host), all_remote_specs.size());
+    EXPECT_NE(host.manifest_generation(), generation);
+}
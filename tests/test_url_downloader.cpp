@@ -0,0 +1,226 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "file_operations.h"
+#include "temp_dir.h"
+
+#include <multipass/exceptions/download_exception.h>
+#include <multipass/format.h>
+#include <multipass/url_downloader.h>
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QFile>
+#include <QRegularExpression>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QUrl>
+
+#include <gmock/gmock.h>
+
+#include <memory>
+
+namespace mp = multipass;
+namespace mpt = multipass::test;
+using namespace testing;
+
+namespace
+{
+// Answers HEAD and GET for one image from the test's own thread, which the downloader's event loops keep serving
+struct FakeImageHost
+{
+    FakeImageHost()
+    {
+        QObject::connect(&server, &QTcpServer::newConnection, [this] {
+            while (auto socket = server.nextPendingConnection())
+                serve(socket);
+        });
+        server.listen(QHostAddress::LocalHost);
+    }
+
+    QUrl url() const
+    {
+        return QUrl{QString("http://127.0.0.1:%1/image.img").arg(server.serverPort())};
+    }
+
+    void serve(QTcpSocket* socket)
+    {
+        auto request = std::make_shared<QByteArray>();
+        QObject::connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+        QObject::connect(socket, &QTcpSocket::readyRead, socket, [this, socket, request] {
+            request->append(socket->readAll());
+            if (request->contains("\r\n\r\n") && answering)
+                answer(socket, QString::fromLatin1(*request));
+        });
+    }
+
+    void answer(QTcpSocket* socket, const QString& request)
+    {
+        static const QRegularExpression range_header{"\r\nrange: *bytes=(\\d+)-(\\d*)\r\n",
+                                                     QRegularExpression::CaseInsensitiveOption};
+        const auto head = request.startsWith("HEAD");
+        const auto range = range_header.match(request);
+        const auto ranged = honours_ranges && range.hasMatch();
+        if (!head)
+            requested_ranges.push_back(range.hasMatch() ? range.captured(1) + "-" + range.captured(2) : "");
+
+        qint64 first = 0, last = image.size() - 1;
+        if (ranged)
+        {
+            first = range.captured(1).toLongLong();
+            if (!range.captured(2).isEmpty())
+                last = range.captured(2).toLongLong();
+        }
+
+        auto headers = fmt::format("HTTP/1.1 {}\r\nContent-Length: {}\r\nAccept-Ranges: bytes\r\nETag: {}\r\n"
+                                   "Last-Modified: Wed, 21 Oct 2015 07:28:00 GMT\r\nConnection: close\r\n",
+                                   ranged ? "206 Partial Content" : "200 OK", last - first + 1, etag);
+        if (ranged)
+            headers += fmt::format("Content-Range: bytes {}-{}/{}\r\n", first, last, image.size());
+        socket->write((headers + "\r\n").c_str());
+
+        if (!head)
+        {
+            auto body = image.mid(first, last - first + 1);
+            if (cut_after >= 0)
+                body.truncate(cut_after);
+            socket->write(body);
+        }
+        socket->disconnectFromHost();
+    }
+
+    QByteArray image;
+    std::string etag{"\"v1\""};
+    bool answering{true};
+    bool honours_ranges{true};
+    qint64 cut_after{-1}; // bytes of a body to send before hanging up, all of it when negative
+    QStringList requested_ranges; // of GETs, empty for the whole image
+    QTcpServer server;
+};
+
+QByteArray make_image(int size)
+{
+    QByteArray image;
+    image.reserve(size);
+    for (auto i = 0; i < size; ++i)
+        image.append(static_cast<char>(1 + i % 251)); // no zeros, so that nothing is written sparse
+
+    return image;
+}
+
+struct URLDownloader : public Test
+{
+    QByteArray digest_of(const QByteArray& data)
+    {
+        return QCryptographicHash::hash(data, QCryptographicHash::Sha256).toHex();
+    }
+
+    mpt::TempDir dir;
+    QString target{dir.path() + "/image.img"};
+    FakeImageHost host;
+    mp::URLDownloader downloader{std::chrono::seconds(10)};
+    mp::ProgressMonitor monitor{[](int, int) { return true; }};
+};
+} // namespace
+
+TEST_F(URLDownloader, downloads_small_images_over_one_connection)
+{
+    host.image = make_image(100000);
+
+    const auto digest = downloader.download_to(host.url(), target, host.image.size(), 0, monitor);
+
+    EXPECT_EQ(mpt::load(target), host.image);
+    EXPECT_EQ(digest, digest_of(host.image));
+    EXPECT_THAT(host.requested_ranges, ElementsAre(""));
+}
+
+TEST_F(URLDownloader, downloads_large_images_in_ranges)
+{
+    host.image = make_image(64 * 1024 * 1024);
+
+    const auto digest = downloader.download_to(host.url(), target, host.image.size(), 0, monitor);
+
+    EXPECT_EQ(digest, digest_of(host.image));
+    EXPECT_EQ(mpt::load(target), host.image);
+    EXPECT_THAT(host.requested_ranges, AllOf(SizeIs(4), Each(Not(IsEmpty()))));
+}
+
+TEST_F(URLDownloader, keeps_an_interrupted_download_and_resumes_it)
+{
+    host.image = make_image(100000);
+    host.cut_after = 30000;
+
+    EXPECT_THROW(downloader.download_to(host.url(), target, host.image.size(), 0, monitor), mp::DownloadException);
+    EXPECT_TRUE(QFile::exists(target + mp::download_journal_suffix));
+
+    host.cut_after = -1;
+    const auto digest = downloader.download_to(host.url(), target, host.image.size(), 0, monitor);
+
+    EXPECT_THAT(host.requested_ranges, ElementsAre("", "30000-"));
+    EXPECT_EQ(digest, digest_of(host.image));
+    EXPECT_EQ(mpt::load(target), host.image);
+    EXPECT_FALSE(QFile::exists(target + mp::download_journal_suffix));
+}
+
+TEST_F(URLDownloader, starts_over_when_the_image_changed_since_interrupted)
+{
+    host.image = make_image(100000);
+    host.cut_after = 30000;
+    EXPECT_THROW(downloader.download_to(host.url(), target, host.image.size(), 0, monitor), mp::DownloadException);
+
+    host.cut_after = -1;
+    host.etag = "\"v2\"";
+    host.image = make_image(100001).mid(1);
+    const auto digest = downloader.download_to(host.url(), target, host.image.size(), 0, monitor);
+
+    EXPECT_THAT(host.requested_ranges, ElementsAre("", ""));
+    EXPECT_EQ(digest, digest_of(host.image));
+    EXPECT_EQ(mpt::load(target), host.image);
+}
+
+TEST_F(URLDownloader, starts_over_once_when_a_resumed_download_gets_the_whole_image)
+{
+    host.image = make_image(100000);
+    host.cut_after = 30000;
+    EXPECT_THROW(downloader.download_to(host.url(), target, host.image.size(), 0, monitor), mp::DownloadException);
+
+    host.cut_after = -1;
+    host.honours_ranges = false;
+    const auto digest = downloader.download_to(host.url(), target, host.image.size(), 0, monitor);
+
+    EXPECT_THAT(host.requested_ranges, ElementsAre("", "30000-"));
+    EXPECT_EQ(digest, digest_of(host.image));
+    EXPECT_EQ(mpt::load(target), host.image);
+}
+
+TEST_F(URLDownloader, gives_up_on_hosts_that_do_not_answer)
+{
+    host.image = make_image(100);
+    host.answering = false;
+    mp::URLDownloader impatient_downloader{std::chrono::milliseconds(200)};
+
+    EXPECT_THROW(impatient_downloader.download_to(host.url(), target, host.image.size(), 0, monitor),
+                 mp::DownloadException);
+    EXPECT_THROW(impatient_downloader.last_modified(host.url()), mp::DownloadException);
+}
+
+TEST_F(URLDownloader, reads_when_images_were_last_modified)
+{
+    host.image = make_image(100);
+
+    EXPECT_EQ(downloader.last_modified(host.url()), QDateTime(QDate(2015, 10, 21), QTime(7, 28), Qt::UTC));
+}
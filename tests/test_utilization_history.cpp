@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <src/daemon/utilization_history.h>
+
+#include <gmock/gmock.h>
+
+namespace mp = multipass;
+using namespace testing;
+using namespace std::chrono_literals;
+
+namespace
+{
+struct UtilizationHistory : public Test
+{
+    // On a bucket boundary of every width, so that samples line up with them
+    const mp::UtilizationHistory::Clock::time_point start{std::chrono::hours{24 * 18000}};
+    mp::UtilizationHistory history;
+};
+} // namespace
+
+TEST_F(UtilizationHistory, summarizes_what_was_recorded)
+{
+    for (int i = 1; i <= 20; ++i)
+        history.record("foo", "load", i, start + i * 60s);
+
+    auto summary = history.summarize("foo", "load", 1h, start + 20min);
+    ASSERT_TRUE(summary);
+    EXPECT_EQ(summary->min, 1);
+    EXPECT_EQ(summary->max, 20);
+    EXPECT_DOUBLE_EQ(summary->average, 10.5);
+    EXPECT_EQ(summary->p95, 19);
+    EXPECT_EQ(summary->samples, 20u);
+    EXPECT_EQ(summary->resolution, 60s);
+}
+
+TEST_F(UtilizationHistory, leaves_out_what_came_before_the_window)
+{
+    history.record("foo", "load", 100, start);
+    history.record("foo", "load", 1, start + 30min);
+
+    auto summary = history.summarize("foo", "load", 10min, start + 30min);
+    ASSERT_TRUE(summary);
+    EXPECT_EQ(summary->max, 1);
+    EXPECT_EQ(summary->samples, 1u);
+}
+
+TEST_F(UtilizationHistory, summarizes_long_windows_from_coarser_buckets)
+{
+    for (int i = 0; i < 48 * 2; ++i)
+        history.record("foo", "memory_usage", i % 2 ? 300 : 100, start + i * 30min);
+
+    auto summary = history.summarize("foo", "memory_usage", 7 * 24h, start + 48h);
+    ASSERT_TRUE(summary);
+    EXPECT_EQ(summary->resolution, 3600s);
+    EXPECT_EQ(summary->min, 100);
+    EXPECT_EQ(summary->max, 300);
+    EXPECT_EQ(summary->p95, 200); // each hour averages out
+}
+
+TEST_F(UtilizationHistory, keeps_a_bounded_history)
+{
+    for (int i = 0; i < 1000; ++i)
+        history.record("foo", "load", i < 500 ? 100 : 1, start + i * 60s);
+
+    // Only the last two hours are kept by the minute, long after the busy start
+    auto summary = history.summarize("foo", "load", 2h, start + 999min);
+    ASSERT_TRUE(summary);
+    EXPECT_EQ(summary->resolution, 60s);
+    EXPECT_EQ(summary->max, 1);
+}
+
+TEST_F(UtilizationHistory, knows_nothing_of_forgotten_instances)
+{
+    history.record("foo", "load", 1, start);
+    history.record("foo", "disk_usage", 1, start);
+    EXPECT_THAT(history.metrics("foo"), ElementsAre("disk_usage", "load"));
+
+    history.forget("foo");
+    EXPECT_THAT(history.metrics("foo"), IsEmpty());
+    EXPECT_FALSE(history.summarize("foo", "load", 1h, start));
+}
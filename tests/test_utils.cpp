@@ -29,6 +29,7 @@
 
 #include <sstream>
 #include <string>
+#include <vector>
 
 namespace mp = multipass;
 namespace mpt = multipass::test;
@@ -229,6 +230,28 @@ TEST(Utils, try_action_does_not_timeout)
     EXPECT_TRUE(action_called);
 }
 
+TEST(Utils, try_action_backs_off_up_to_the_cap)
+{
+    std::vector<std::chrono::milliseconds> pauses;
+    mp::utils::RetryPolicy policy;
+    policy.initial_delay = std::chrono::milliseconds(10);
+    policy.max_delay = std::chrono::milliseconds(35);
+    policy.wait = [&pauses](std::chrono::milliseconds pause) { pauses.push_back(pause); };
+
+    int attempts{0};
+    auto action = [&attempts] {
+        return ++attempts < 5 ? mp::utils::TimeoutAction::retry : mp::utils::TimeoutAction::done;
+    };
+    mp::utils::try_action_for([] { ADD_FAILURE() << "timed out"; }, std::chrono::minutes(1), action, policy);
+
+    EXPECT_EQ(attempts, 5);
+    ASSERT_EQ(pauses.size(), 4u);
+    EXPECT_EQ(pauses[0], std::chrono::milliseconds(10));
+    EXPECT_EQ(pauses[1], std::chrono::milliseconds(20));
+    EXPECT_EQ(pauses[2], std::chrono::milliseconds(35));
+    EXPECT_EQ(pauses[3], std::chrono::milliseconds(35));
+}
+
 TEST(Utils, uuid_has_no_curly_brackets)
 {
     auto uuid = mp::utils::make_uuid();
@@ -313,6 +336,21 @@ TEST(Utils, validate_server_address_does_not_throw_on_good_address)
     EXPECT_NO_THROW(mp::utils::validate_server_address("test-server.net:123"));
 }
 
+TEST(Utils, plain_socket_address_only_for_unix_sockets)
+{
+    EXPECT_EQ(mp::utils::plain_socket_address("unix:/tmp/a_socket"), "unix:/tmp/a_socket-plain");
+    EXPECT_EQ(mp::utils::plain_socket_address("test-server.net:123"), "");
+}
+
+TEST(Utils, only_addresses_off_this_machine_are_remote)
+{
+    EXPECT_TRUE(mp::utils::is_remote_server_address("test-server.net:123"));
+    EXPECT_TRUE(mp::utils::is_remote_server_address("10.1.2.3:50051"));
+    EXPECT_FALSE(mp::utils::is_remote_server_address("unix:/tmp/a_socket"));
+    EXPECT_FALSE(mp::utils::is_remote_server_address("localhost:50051"));
+    EXPECT_FALSE(mp::utils::is_remote_server_address("127.0.0.1:50051"));
+}
+
 TEST(Utils, dir_is_a_dir)
 {
     mpt::TempDir temp_dir;
@@ -396,3 +434,136 @@ TEST(Utils, existing_config_file_is_untouched)
 
     EXPECT_THAT(new_last_modified, Eq(original_last_modified));
 }
+
+TEST(Utils, write_sparse_preserves_content)
+{
+    mpt::TempDir temp_dir;
+    QFile file{temp_dir.path() + "/sparse"};
+    ASSERT_TRUE(file.open(QIODevice::ReadWrite));
+
+    QByteArray data{"header"};
+    data.append(QByteArray(3 * 4096, '\0'));
+    data.append("payload");
+
+    EXPECT_THAT(mp::utils::write_sparse(file, data.constData(), data.size()), Eq(data.size()));
+    EXPECT_TRUE(mp::utils::finish_sparse_write(file));
+
+    file.seek(0);
+    EXPECT_THAT(file.readAll(), Eq(data));
+}
+
+TEST(Utils, write_sparse_trailing_zeros_set_file_size)
+{
+    mpt::TempDir temp_dir;
+    QFile file{temp_dir.path() + "/sparse"};
+    ASSERT_TRUE(file.open(QIODevice::ReadWrite));
+
+    const QByteArray data(8 * 4096, '\0');
+
+    EXPECT_THAT(mp::utils::write_sparse(file, data.constData(), data.size()), Eq(data.size()));
+    EXPECT_TRUE(mp::utils::finish_sparse_write(file));
+
+    EXPECT_THAT(file.size(), Eq(data.size()));
+}
+
+TEST(Utils, qcow2_backing_file_is_read_from_header)
+{
+    const QByteArray backing_file{"/var/cache/vault/images/base.img"};
+    QByteArray header{"QFI\xfb", 4};
+    header.append(QByteArray::fromHex("00000003"));         // version
+    header.append(QByteArray::fromHex("0000000000000020")); // backing_file_offset
+    header.append(QByteArray::fromHex("00000020"));         // backing_file_size
+    header.append(QByteArray(32 - header.size(), '\0'));
+    header.append(backing_file);
+
+    mpt::TempDir temp_dir;
+    const auto image_path = temp_dir.path() + "/overlay.img";
+    mpt::make_file_with_content(image_path, header.toStdString());
+
+    EXPECT_TRUE(mp::utils::is_qcow2_image(image_path));
+    EXPECT_THAT(mp::utils::qcow2_backing_file(image_path), Eq(QString{backing_file}));
+}
+
+TEST(Utils, qcow2_backing_file_is_empty_when_its_size_is_oversized)
+{
+    QByteArray header{"QFI\xfb", 4};
+    header.append(QByteArray::fromHex("00000003"));         // version
+    header.append(QByteArray::fromHex("0000000000000020")); // backing_file_offset
+    header.append(QByteArray::fromHex("00000400"));         // backing_file_size, one past qemu's limit
+    header.append(QByteArray(32 - header.size(), '\0'));
+    header.append(QByteArray(1024, 'a'));
+
+    mpt::TempDir temp_dir;
+    const auto image_path = temp_dir.path() + "/overlay.img";
+    mpt::make_file_with_content(image_path, header.toStdString());
+
+    EXPECT_TRUE(mp::utils::qcow2_backing_file(image_path).isEmpty());
+}
+
+TEST(Utils, qcow2_backing_file_is_empty_when_cut_short)
+{
+    QByteArray header{"QFI\xfb", 4};
+    header.append(QByteArray::fromHex("00000003"));         // version
+    header.append(QByteArray::fromHex("0000000000000020")); // backing_file_offset
+    header.append(QByteArray::fromHex("00000020"));         // backing_file_size
+    header.append(QByteArray(32 - header.size(), '\0'));
+    header.append("/var/cache");
+
+    mpt::TempDir temp_dir;
+    const auto image_path = temp_dir.path() + "/overlay.img";
+    mpt::make_file_with_content(image_path, header.toStdString());
+
+    EXPECT_TRUE(mp::utils::qcow2_backing_file(image_path).isEmpty());
+}
+
+TEST(Utils, qcow2_backing_file_is_empty_for_other_images)
+{
+    mpt::TempDir temp_dir;
+    const auto image_path = temp_dir.path() + "/raw.img";
+    mpt::make_file_with_content(image_path, std::string(512, '\0'));
+
+    EXPECT_FALSE(mp::utils::is_qcow2_image(image_path));
+    EXPECT_TRUE(mp::utils::qcow2_backing_file(image_path).isEmpty());
+}
+
+TEST(Utils, zstd_compressed_qcow2_is_recognised_from_header)
+{
+    QByteArray header{"QFI\xfb", 4};
+    header.append(QByteArray::fromHex("00000003")); // version
+    header.append(QByteArray(72 - header.size(), '\0'));
+    header.append(QByteArray::fromHex("0000000000000008")); // incompatible_features: compression type
+    header.append(QByteArray(100 - header.size(), '\0'));
+    header.append(QByteArray::fromHex("00000070")); // header_length
+    header.append(QByteArray::fromHex("01"));       // compression_type: zstd
+    header.append(QByteArray(112 - header.size(), '\0'));
+
+    mpt::TempDir temp_dir;
+    const auto image_path = temp_dir.path() + "/base.img";
+    mpt::make_file_with_content(image_path, header.toStdString());
+    EXPECT_TRUE(mp::utils::is_zstd_compressed_qcow2(image_path));
+
+    header[104] = 0; // zlib
+    mpt::make_file_with_content(image_path, header.toStdString());
+    EXPECT_FALSE(mp::utils::is_zstd_compressed_qcow2(image_path));
+}
+
+TEST(Utils, parse_counts_reads_counts_per_name)
+{
+    EXPECT_THAT(mp::utils::parse_counts("launch=4,mount=0"), ElementsAre(Pair("launch", 4), Pair("mount", 0)));
+    EXPECT_THROW(mp::utils::parse_counts("launch=4,mount"), std::runtime_error);
+}
+
+TEST(Utils, parse_warm_pool_reads_counts_per_image)
+{
+    EXPECT_THAT(mp::utils::parse_warm_pool("default=2, focal=1"),
+                ElementsAre(Pair("default", 2), Pair("focal", 1)));
+    EXPECT_TRUE(mp::utils::parse_warm_pool("").empty());
+}
+
+TEST(Utils, parse_warm_pool_throws_on_malformed_entries)
+{
+    EXPECT_THROW(mp::utils::parse_warm_pool("default"), std::runtime_error);
+    EXPECT_THROW(mp::utils::parse_warm_pool("default=two"), std::runtime_error);
+    EXPECT_THROW(mp::utils::parse_warm_pool("=1"), std::runtime_error);
+    EXPECT_THROW(mp::utils::parse_warm_pool("focal=-1"), std::runtime_error);
+}
@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <src/daemon/watch_stream.h>
+
+#include <gmock/gmock.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace mp = multipass;
+using namespace testing;
+using namespace std::chrono_literals;
+
+namespace
+{
+struct WatchStream : public Test
+{
+    bool write(const mp::WatchReply& reply)
+    {
+        std::unique_lock<std::mutex> lock{mutex};
+        ++writes_started;
+        written_some.notify_all();
+        released.wait(lock, [this] { return !hold_writes; });
+        written.push_back(reply.instance_name());
+        written_some.notify_all();
+        return accept_writes;
+    }
+
+    void release_writes()
+    {
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            hold_writes = false;
+        }
+        released.notify_all();
+    }
+
+    bool wait_for_writes(std::size_t count)
+    {
+        std::unique_lock<std::mutex> lock{mutex};
+        return written_some.wait_for(lock, 5s, [this, count] { return written.size() >= count; });
+    }
+
+    bool wait_for_a_write_to_start()
+    {
+        std::unique_lock<std::mutex> lock{mutex};
+        return written_some.wait_for(lock, 5s, [this] { return writes_started > 0; });
+    }
+
+    std::unique_ptr<mp::WatchStream> make_stream(std::size_t max_pending = 4096)
+    {
+        return std::make_unique<mp::WatchStream>([this](const mp::WatchReply& reply) { return write(reply); },
+                                                 &status_promise, max_pending);
+    }
+
+    static mp::WatchReply reply_for(const std::string& name)
+    {
+        mp::WatchReply reply;
+        reply.set_instance_name(name);
+        return reply;
+    }
+
+    std::mutex mutex;
+    std::condition_variable released;
+    std::condition_variable written_some;
+    std::vector<std::string> written;
+    std::size_t writes_started{0};
+    bool hold_writes{false};
+    bool accept_writes{true};
+    std::promise<grpc::Status> status_promise;
+};
+} // namespace
+
+TEST_F(WatchStream, writes_replies_in_order)
+{
+    auto stream = make_stream();
+
+    EXPECT_TRUE(stream->push(reply_for("foo")));
+    EXPECT_TRUE(stream->push(reply_for("bar")));
+    EXPECT_TRUE(stream->push(reply_for("baz")));
+
+    ASSERT_TRUE(wait_for_writes(3));
+    EXPECT_THAT(written, ElementsAre("foo", "bar", "baz"));
+}
+
+TEST_F(WatchStream, queues_while_the_client_is_slow)
+{
+    hold_writes = true;
+    auto stream = make_stream();
+
+    for (auto i = 0; i < 100; ++i)
+        EXPECT_TRUE(stream->push(reply_for(std::to_string(i))));
+
+    release_writes();
+    ASSERT_TRUE(wait_for_writes(100));
+    EXPECT_EQ(written.front(), "0");
+    EXPECT_EQ(written.back(), "99");
+}
+
+TEST_F(WatchStream, gives_up_on_a_client_too_far_behind)
+{
+    hold_writes = true;
+    auto stream = make_stream(2);
+
+    EXPECT_TRUE(stream->push(reply_for("foo")));
+    ASSERT_TRUE(wait_for_a_write_to_start());
+    EXPECT_TRUE(stream->push(reply_for("bar")));
+    EXPECT_TRUE(stream->push(reply_for("baz")));
+    EXPECT_FALSE(stream->push(reply_for("qux")));
+    EXPECT_FALSE(stream->push(reply_for("quux")));
+
+    release_writes();
+    stream.reset();
+
+    EXPECT_EQ(status_promise.get_future().get().error_code(), grpc::StatusCode::RESOURCE_EXHAUSTED);
+}
+
+TEST_F(WatchStream, reports_the_client_going_away)
+{
+    accept_writes = false;
+    auto stream = make_stream();
+
+    EXPECT_TRUE(stream->push(reply_for("foo")));
+    ASSERT_TRUE(wait_for_writes(1));
+
+    auto deadline = std::chrono::steady_clock::now() + 5s;
+    while (stream->push(reply_for("bar")) && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(1ms);
+
+    EXPECT_FALSE(stream->push(reply_for("baz")));
+    stream.reset();
+    EXPECT_TRUE(status_promise.get_future().get().ok());
+}
+
+TEST_F(WatchStream, finishes_the_call_only_once_gone)
+{
+    auto status = status_promise.get_future();
+    auto stream = make_stream();
+    stream->push(reply_for("foo"));
+
+    EXPECT_EQ(status.wait_for(0s), std::future_status::timeout);
+
+    stream.reset();
+    ASSERT_EQ(status.wait_for(0s), std::future_status::ready);
+    EXPECT_TRUE(status.get().ok());
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <xz.h>
+
+#include <gmock/gmock.h>
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+using namespace testing;
+
+namespace
+{
+// One bit at a time, the way the CRCs are specified
+uint32_t reference_crc32(const uint8_t* buf, size_t size, uint32_t crc)
+{
+    crc = ~crc;
+    while (size--)
+    {
+        crc ^= *buf++;
+        for (auto bit = 0; bit < 8; ++bit)
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+    }
+    return ~crc;
+}
+
+uint64_t reference_crc64(const uint8_t* buf, size_t size, uint64_t crc)
+{
+    crc = ~crc;
+    while (size--)
+    {
+        crc ^= *buf++;
+        for (auto bit = 0; bit < 8; ++bit)
+            crc = (crc >> 1) ^ (0xC96C5795D7870F42ull & (0ull - (crc & 1)));
+    }
+    return ~crc;
+}
+
+struct XzCrc : public Test
+{
+    XzCrc()
+    {
+        xz_crc32_init();
+        xz_crc64_init();
+
+        std::mt19937 gen{42};
+        std::uniform_int_distribution<int> byte{0, 255};
+        for (auto& b : data)
+            b = static_cast<uint8_t>(byte(gen));
+    }
+
+    std::vector<uint8_t> data = std::vector<uint8_t>(4096 + 16);
+};
+} // namespace
+
+TEST_F(XzCrc, computes_the_check_values)
+{
+    const auto check = reinterpret_cast<const uint8_t*>("123456789");
+
+    EXPECT_THAT(xz_crc32(check, 9, 0), Eq(0xCBF43926u));
+    EXPECT_THAT(xz_crc64(check, 9, 0), Eq(0x995DC9BBDF1939FAull));
+}
+
+TEST_F(XzCrc, matches_the_bitwise_crcs_at_any_length_and_alignment)
+{
+    for (auto offset = 0u; offset < 16; ++offset)
+        for (auto size = 0u; size <= 4096; size += size < 256 ? 1 : 61)
+        {
+            const auto buf = data.data() + offset;
+            ASSERT_THAT(xz_crc32(buf, size, 0), Eq(reference_crc32(buf, size, 0))) << offset << " " << size;
+            ASSERT_THAT(xz_crc64(buf, size, 0), Eq(reference_crc64(buf, size, 0))) << offset << " " << size;
+        }
+}
+
+TEST_F(XzCrc, continues_from_a_previous_crc)
+{
+    const auto crc32 = xz_crc32(data.data(), 1000, 0);
+    const auto crc64 = xz_crc64(data.data(), 1000, 0);
+
+    EXPECT_THAT(xz_crc32(data.data() + 1000, 3000, crc32), Eq(reference_crc32(data.data(), 4000, 0)));
+    EXPECT_THAT(xz_crc64(data.data() + 1000, 3000, crc64), Eq(reference_crc64(data.data(), 4000, 0)));
+}
@@ -0,0 +1,211 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <multipass/xz_image_decoder.h>
+
+#include "extra_assertions.h"
+#include "temp_dir.h"
+
+#include <QFile>
+
+#include <gmock/gmock.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace mp = multipass;
+namespace mpt = multipass::test;
+using namespace testing;
+
+namespace
+{
+void append_le32(QByteArray& data, uint32_t value)
+{
+    for (auto i = 0; i < 4; ++i)
+        data.append(static_cast<char>((value >> (8 * i)) & 0xFF));
+}
+
+void append_varint(QByteArray& data, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        data.append(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    data.append(static_cast<char>(value));
+}
+
+void append_crc32(QByteArray& data, int offset)
+{
+    append_le32(data, xz_crc32(reinterpret_cast<const uint8_t*>(data.constData()) + offset, data.size() - offset, 0));
+}
+
+void pad(QByteArray& data, int offset)
+{
+    while ((data.size() - offset) % 4)
+        data.append('\0');
+}
+
+// A block bearing the part as LZMA2 chunks stored uncompressed, which is all the decoder needs to take it apart
+QByteArray make_block(const QByteArray& part)
+{
+    // Header size, one filter and no sizes, LZMA2 with a 4KiB dictionary
+    QByteArray block{"\x02\x00\x21\x01\x00\x00\x00\x00", 8};
+    append_crc32(block, 0);
+
+    for (auto offset = 0; offset < part.size(); offset += 64 * 1024)
+    {
+        const auto chunk = part.mid(offset, 64 * 1024);
+        block.append(offset ? '\x02' : '\x01'); // the first chunk resets the dictionary
+        block.append(static_cast<char>((chunk.size() - 1) >> 8));
+        block.append(static_cast<char>((chunk.size() - 1) & 0xFF));
+        block.append(chunk);
+    }
+    block.append('\0');
+
+    return block;
+}
+
+// A single stream without checks; its index counts record_count blocks, or as many as there are when negative
+QByteArray make_xz(const std::vector<QByteArray>& parts, int64_t record_count = -1)
+{
+    QByteArray xz{"\xFD\x37\x7A\x58\x5A\x00\x00\x00", 8};
+    append_crc32(xz, 6);
+
+    QByteArray index(1, '\0');
+    append_varint(index, record_count < 0 ? parts.size() : record_count);
+    for (const auto& part : parts)
+    {
+        const auto block = make_block(part);
+        xz.append(block);
+        pad(xz, 0);
+        append_varint(index, block.size());
+        append_varint(index, part.size());
+    }
+    pad(index, 0);
+    append_crc32(index, 0);
+    xz.append(index);
+
+    QByteArray footer;
+    append_le32(footer, index.size() / 4 - 1);
+    footer.append("\x00\x00", 2);
+    QByteArray crc;
+    append_le32(crc, xz_crc32(reinterpret_cast<const uint8_t*>(footer.constData()), footer.size(), 0));
+    xz.append(crc + footer + "YZ");
+
+    return xz;
+}
+
+QByteArray make_part(int seed, int size)
+{
+    QByteArray part(size, '\0');
+    // Leave some zero runs around, which the decoder skips over when writing
+    for (auto i = 0; i < size / 2; ++i)
+        part[i] = static_cast<char>((i * 31 + seed) % 251);
+    return part;
+}
+
+struct XzImageDecoder : public Test
+{
+    XzImageDecoder()
+    {
+        xz_crc32_init();
+    }
+
+    void write_image(const QByteArray& contents)
+    {
+        QFile file{image_path};
+        ASSERT_TRUE(file.open(QIODevice::WriteOnly));
+        file.write(contents);
+    }
+
+    QByteArray decoded()
+    {
+        QFile file{decoded_path};
+        EXPECT_TRUE(file.open(QIODevice::ReadOnly));
+        return file.readAll();
+    }
+
+    mpt::TempDir dir;
+    QString image_path{dir.path() + "/image.xz"};
+    QString decoded_path{dir.path() + "/image.img"};
+    mp::ProgressMonitor monitor{[](auto...) { return true; }};
+};
+} // namespace
+
+TEST_F(XzImageDecoder, decodes_a_single_block_file)
+{
+    const auto part = make_part(1, 200 * 1024);
+    write_image(make_xz({part}));
+
+    mp::XzImageDecoder{image_path}.decode_to(decoded_path, monitor);
+
+    EXPECT_EQ(decoded(), part);
+}
+
+TEST_F(XzImageDecoder, decodes_the_blocks_of_a_file_in_parallel)
+{
+    std::vector<QByteArray> parts;
+    QByteArray contents;
+    for (auto i = 0; i < 8; ++i)
+    {
+        parts.push_back(make_part(i, 100 * 1024 + i));
+        contents += parts.back();
+    }
+    write_image(make_xz(parts));
+
+    mp::XzImageDecoder{image_path}.decode_to(decoded_path, monitor);
+
+    EXPECT_EQ(decoded(), contents);
+}
+
+TEST_F(XzImageDecoder, streams_files_with_more_blocks_than_it_decodes_in_parallel)
+{
+    std::vector<QByteArray> parts;
+    QByteArray contents;
+    for (auto i = 0; i < 64 * 1024 + 1; ++i)
+    {
+        parts.push_back(make_part(i, 16));
+        contents += parts.back();
+    }
+    write_image(make_xz(parts));
+
+    mp::XzImageDecoder{image_path}.decode_to(decoded_path, monitor);
+
+    EXPECT_EQ(decoded(), contents);
+}
+
+TEST_F(XzImageDecoder, refuses_an_index_counting_more_blocks_than_it_holds)
+{
+    write_image(make_xz({make_part(1, 1024), make_part(2, 1024)}, int64_t{1} << 40));
+
+    MP_EXPECT_THROW_THAT(mp::XzImageDecoder{image_path}.decode_to(decoded_path, monitor), std::runtime_error,
+                         Property(&std::runtime_error::what, HasSubstr("corrupt")));
+}
+
+TEST(DecodeBudget, decodes_the_largest_blocks_one_at_a_time)
+{
+    const uint64_t largest_block = 256 * 1024 * 1024; // held compressed twice and once decoded, at worst
+
+    EXPECT_EQ(mp::threads_within_decode_budget(3 * largest_block), 1u);
+}
+
+TEST(DecodeBudget, decodes_as_many_blocks_at_once_as_the_budget_holds)
+{
+    EXPECT_EQ(mp::threads_within_decode_budget(64 * 1024 * 1024), mp::parallel_decode_budget / (64 * 1024 * 1024));
+    EXPECT_GE(mp::threads_within_decode_budget(0), 1u);
+}
@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2019 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <multipass/zstd_image_decoder.h>
+
+#include "extra_assertions.h"
+#include "temp_dir.h"
+
+#include <QFile>
+
+#include <gmock/gmock.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+namespace mp = multipass;
+namespace mpt = multipass::test;
+using namespace testing;
+
+namespace
+{
+QByteArray make_part(int seed, int size)
+{
+    QByteArray part(size, '\0');
+    // Leave some zero blocks around, which the decoder skips over when writing
+    for (auto i = 0; i < size / 2; ++i)
+        part[i] = static_cast<char>((i * 31 + seed) % 251);
+    return part;
+}
+
+QByteArray compress_frame(const QByteArray& part)
+{
+    QByteArray frame(static_cast<int>(ZSTD_compressBound(part.size())), '\0');
+    const auto size = ZSTD_compress(frame.data(), frame.size(), part.constData(), part.size(), 1);
+    EXPECT_FALSE(ZSTD_isError(size));
+    frame.resize(static_cast<int>(size));
+    return frame;
+}
+
+// A frame that does not record its size, so that it is streamed, asking for a window of 1 << window_log
+QByteArray compress_streamed_frame(const QByteArray& part, int window_log)
+{
+    std::unique_ptr<ZSTD_CCtx, decltype(ZSTD_freeCCtx)*> encoder{ZSTD_createCCtx(), ZSTD_freeCCtx};
+    ZSTD_CCtx_setParameter(encoder.get(), ZSTD_c_windowLog, window_log);
+
+    QByteArray frame(static_cast<int>(ZSTD_compressBound(part.size())), '\0');
+    ZSTD_inBuffer input{part.constData(), static_cast<size_t>(part.size()), 0};
+    ZSTD_outBuffer output{frame.data(), static_cast<size_t>(frame.size()), 0};
+    // Going on before ending leaves the size unknown, which would otherwise shrink the window to fit
+    EXPECT_FALSE(ZSTD_isError(ZSTD_compressStream2(encoder.get(), &output, &input, ZSTD_e_continue)));
+    EXPECT_EQ(ZSTD_compressStream2(encoder.get(), &output, &input, ZSTD_e_end), 0u);
+    frame.resize(static_cast<int>(output.pos));
+    return frame;
+}
+
+struct ZstdImageDecoder : public Test
+{
+    void write_image(const QByteArray& contents)
+    {
+        QFile file{image_path};
+        ASSERT_TRUE(file.open(QIODevice::WriteOnly));
+        file.write(contents);
+    }
+
+    QByteArray decoded()
+    {
+        QFile file{decoded_path};
+        EXPECT_TRUE(file.open(QIODevice::ReadOnly));
+        return file.readAll();
+    }
+
+    mpt::TempDir dir;
+    QString image_path{dir.path() + "/image.zst"};
+    QString decoded_path{dir.path() + "/image.img"};
+    mp::ProgressMonitor monitor{[](auto...) { return true; }};
+};
+} // namespace
+
+TEST_F(ZstdImageDecoder, decodes_the_frames_of_a_file_in_parallel)
+{
+    QByteArray contents, image;
+    for (auto i = 0; i < 8; ++i)
+    {
+        const auto part = make_part(i, 256 * 1024);
+        contents += part;
+        image += compress_frame(part);
+    }
+    write_image(image);
+
+    mp::ZstdImageDecoder{image_path}.decode_to(decoded_path, monitor);
+
+    EXPECT_EQ(decoded(), contents);
+}
+
+TEST_F(ZstdImageDecoder, streams_a_frame_that_does_not_record_its_size)
+{
+    const auto part = make_part(1, 1024 * 1024);
+    write_image(compress_streamed_frame(part, 20));
+
+    mp::ZstdImageDecoder{image_path}.decode_to(decoded_path, monitor);
+
+    EXPECT_EQ(decoded(), part);
+}
+
+TEST_F(ZstdImageDecoder, refuses_frames_that_need_more_than_a_long_window)
+{
+    write_image(compress_streamed_frame(make_part(1, 1024), 28));
+
+    MP_EXPECT_THROW_THAT(mp::ZstdImageDecoder{image_path}.decode_to(decoded_path, monitor), std::runtime_error,
+                         Property(&std::runtime_error::what, HasSubstr("window over 128MiB")));
+}
+
+TEST(DecodeInParallel, decodes_on_no_more_than_the_threads_it_is_given)
+{
+    std::atomic<int> active{0}, most_active{0}, decoded{0};
+    mp::decode_in_parallel(
+        16,
+        [&](std::size_t) {
+            const auto now_active = ++active;
+            auto most = most_active.load();
+            while (most < now_active && !most_active.compare_exchange_weak(most, now_active))
+                ;
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            --active;
+            ++decoded;
+        },
+        [](auto...) { return true; }, 2);
+
+    EXPECT_EQ(decoded, 16);
+    EXPECT_LE(most_active, 2);
+}